@@ -84,6 +84,7 @@ depend = libcap
 depend = libdrm
 depend = libevdev
 depend = libnotify
+depend = libpipewire
 depend = libpulse
 depend = libva
 depend = libx11
@@ -58,6 +58,8 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/third-party/moonlight-common-c/src/RtspParser.c"
         "${CMAKE_SOURCE_DIR}/third-party/moonlight-common-c/src/Video.h"
         "${CMAKE_SOURCE_DIR}/third-party/tray/src/tray.h"
+        "${CMAKE_SOURCE_DIR}/src/admission.cpp"
+        "${CMAKE_SOURCE_DIR}/src/admission.h"
         "${CMAKE_SOURCE_DIR}/src/upnp.cpp"
         "${CMAKE_SOURCE_DIR}/src/upnp.h"
         "${CMAKE_SOURCE_DIR}/src/cbs.cpp"
@@ -71,10 +73,20 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/entry_handler.h"
         "${CMAKE_SOURCE_DIR}/src/file_handler.cpp"
         "${CMAKE_SOURCE_DIR}/src/file_handler.h"
+        "${CMAKE_SOURCE_DIR}/src/flight_recorder.cpp"
+        "${CMAKE_SOURCE_DIR}/src/flight_recorder.h"
+        "${CMAKE_SOURCE_DIR}/src/frame_arena.h"
         "${CMAKE_SOURCE_DIR}/src/globals.cpp"
         "${CMAKE_SOURCE_DIR}/src/globals.h"
+        "${CMAKE_SOURCE_DIR}/src/gpu_sampler.cpp"
+        "${CMAKE_SOURCE_DIR}/src/gpu_sampler.h"
+        "${CMAKE_SOURCE_DIR}/src/gpu_scheduler.cpp"
+        "${CMAKE_SOURCE_DIR}/src/gpu_scheduler.h"
         "${CMAKE_SOURCE_DIR}/src/logging.cpp"
         "${CMAKE_SOURCE_DIR}/src/logging.h"
+        "${CMAKE_SOURCE_DIR}/src/metrics.cpp"
+        "${CMAKE_SOURCE_DIR}/src/metrics.h"
+        "${CMAKE_SOURCE_DIR}/src/motion_coalescer.h"
         "${CMAKE_SOURCE_DIR}/src/main.cpp"
         "${CMAKE_SOURCE_DIR}/src/main.h"
         "${CMAKE_SOURCE_DIR}/src/crypto.cpp"
@@ -83,10 +95,49 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/nvhttp.h"
         "${CMAKE_SOURCE_DIR}/src/httpcommon.cpp"
         "${CMAKE_SOURCE_DIR}/src/httpcommon.h"
+        "${CMAKE_SOURCE_DIR}/src/capture_benchmark.cpp"
+        "${CMAKE_SOURCE_DIR}/src/capture_benchmark.h"
+        "${CMAKE_SOURCE_DIR}/src/encoder_benchmark.cpp"
+        "${CMAKE_SOURCE_DIR}/src/encoder_benchmark.h"
+        "${CMAKE_SOURCE_DIR}/src/video_trace.cpp"
+        "${CMAKE_SOURCE_DIR}/src/video_trace.h"
+        "${CMAKE_SOURCE_DIR}/src/recording.cpp"
+        "${CMAKE_SOURCE_DIR}/src/recording.h"
+        "${CMAKE_SOURCE_DIR}/src/tracing.cpp"
+        "${CMAKE_SOURCE_DIR}/src/tracing.h"
+        "${CMAKE_SOURCE_DIR}/src/sw_encoder_tuner.cpp"
+        "${CMAKE_SOURCE_DIR}/src/sw_encoder_tuner.h"
+        "${CMAKE_SOURCE_DIR}/src/encoder_budget.cpp"
+        "${CMAKE_SOURCE_DIR}/src/encoder_budget.h"
+        "${CMAKE_SOURCE_DIR}/src/dynamic_resolution.cpp"
+        "${CMAKE_SOURCE_DIR}/src/dynamic_resolution.h"
+        "${CMAKE_SOURCE_DIR}/src/screen_content.cpp"
+        "${CMAKE_SOURCE_DIR}/src/screen_content.h"
+        "${CMAKE_SOURCE_DIR}/src/thread_affinity.cpp"
+        "${CMAKE_SOURCE_DIR}/src/thread_affinity.h"
+        "${CMAKE_SOURCE_DIR}/src/encoder_probe_cache.cpp"
+        "${CMAKE_SOURCE_DIR}/src/encoder_probe_cache.h"
+        "${CMAKE_SOURCE_DIR}/src/image_memory.cpp"
+        "${CMAKE_SOURCE_DIR}/src/image_memory.h"
+        "${CMAKE_SOURCE_DIR}/src/image_pool.cpp"
+        "${CMAKE_SOURCE_DIR}/src/image_pool.h"
+        "${CMAKE_SOURCE_DIR}/src/memory_budget.cpp"
+        "${CMAKE_SOURCE_DIR}/src/memory_budget.h"
         "${CMAKE_SOURCE_DIR}/src/confighttp.cpp"
         "${CMAKE_SOURCE_DIR}/src/confighttp.h"
         "${CMAKE_SOURCE_DIR}/src/rtsp.cpp"
         "${CMAKE_SOURCE_DIR}/src/rtsp.h"
+        "${CMAKE_SOURCE_DIR}/src/bandwidth_probe.cpp"
+        "${CMAKE_SOURCE_DIR}/src/bandwidth_probe.h"
+        "${CMAKE_SOURCE_DIR}/src/bitrate_controller.cpp"
+        "${CMAKE_SOURCE_DIR}/src/bitrate_controller.h"
+        "${CMAKE_SOURCE_DIR}/src/network_estimator.cpp"
+        "${CMAKE_SOURCE_DIR}/src/network_estimator.h"
+        "${CMAKE_SOURCE_DIR}/src/network_profile.cpp"
+        "${CMAKE_SOURCE_DIR}/src/network_profile.h"
+        "${CMAKE_SOURCE_DIR}/src/region_of_interest.cpp"
+        "${CMAKE_SOURCE_DIR}/src/region_of_interest.h"
+        "${CMAKE_SOURCE_DIR}/src/spsc_ring.h"
         "${CMAKE_SOURCE_DIR}/src/stream.cpp"
         "${CMAKE_SOURCE_DIR}/src/stream.h"
         "${CMAKE_SOURCE_DIR}/src/video.cpp"
@@ -97,6 +148,8 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/input.h"
         "${CMAKE_SOURCE_DIR}/src/audio.cpp"
         "${CMAKE_SOURCE_DIR}/src/audio.h"
+        "${CMAKE_SOURCE_DIR}/src/audio_loss.cpp"
+        "${CMAKE_SOURCE_DIR}/src/audio_loss.h"
         "${CMAKE_SOURCE_DIR}/src/platform/common.h"
         "${CMAKE_SOURCE_DIR}/src/process.cpp"
         "${CMAKE_SOURCE_DIR}/src/process.h"
@@ -108,10 +161,14 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/task_pool.h"
         "${CMAKE_SOURCE_DIR}/src/thread_pool.h"
         "${CMAKE_SOURCE_DIR}/src/thread_safe.h"
+        "${CMAKE_SOURCE_DIR}/src/consumer_signal.h"
+        "${CMAKE_SOURCE_DIR}/src/timer_wheel.h"
         "${CMAKE_SOURCE_DIR}/src/sync.h"
         "${CMAKE_SOURCE_DIR}/src/round_robin.h"
         "${CMAKE_SOURCE_DIR}/src/stat_trackers.h"
         "${CMAKE_SOURCE_DIR}/src/stat_trackers.cpp"
+        "${CMAKE_SOURCE_DIR}/src/rgb_to_yuv.cpp"
+        "${CMAKE_SOURCE_DIR}/src/rgb_to_yuv.h"
         "${CMAKE_SOURCE_DIR}/src/rswrapper.h"
         "${CMAKE_SOURCE_DIR}/src/rswrapper.c"
         ${PLATFORM_TARGET_FILES})
@@ -123,6 +180,10 @@ list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_ASSETS_DIR="${SUNSHINE_ASSETS_DIR_DEF}
 
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_TRAY=${SUNSHINE_TRAY})
 
+if(SUNSHINE_ENABLE_TRACING)
+    list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_TRACING=1)
+endif()
+
 # Publisher metadata
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_PUBLISHER_NAME="${SUNSHINE_PUBLISHER_NAME}")
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_PUBLISHER_WEBSITE="${SUNSHINE_PUBLISHER_WEBSITE}")
@@ -116,6 +116,20 @@ if(LIBVA_FOUND)
             "${CMAKE_SOURCE_DIR}/src/platform/linux/vaapi.cpp")
 endif()
 
+# vulkan
+if(${SUNSHINE_ENABLE_VULKAN})
+    find_package(Vulkan REQUIRED)
+else()
+    set(Vulkan_FOUND OFF)
+endif()
+if(Vulkan_FOUND)
+    add_compile_definitions(SUNSHINE_BUILD_VULKAN)
+    include_directories(SYSTEM ${Vulkan_INCLUDE_DIRS})
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/vulkan.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/vulkan.cpp")
+endif()
+
 # wayland
 if(${SUNSHINE_ENABLE_WAYLAND})
     find_package(Wayland REQUIRED)
@@ -136,6 +150,14 @@ if(WAYLAND_FOUND)
     GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "unstable/linux-dmabuf" linux-dmabuf-unstable-v1)
     GEN_WAYLAND("${CMAKE_SOURCE_DIR}/third-party/wlr-protocols" "unstable" wlr-screencopy-unstable-v1)
 
+    # ext-image-copy-capture is only available since wayland-protocols 1.37
+    if(EXISTS "${WAYLAND_PROTOCOLS_DIR}/staging/ext-image-copy-capture/ext-image-copy-capture-v1.xml")
+        add_compile_definitions(SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE)
+        GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "staging/ext-foreign-toplevel-list" ext-foreign-toplevel-list-v1)
+        GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "staging/ext-image-capture-source" ext-image-capture-source-v1)
+        GEN_WAYLAND("${WAYLAND_PROTOCOLS_DIR}" "staging/ext-image-copy-capture" ext-image-copy-capture-v1)
+    endif()
+
     include_directories(
             SYSTEM
             ${WAYLAND_INCLUDE_DIRS}
@@ -149,6 +171,27 @@ if(WAYLAND_FOUND)
             "${CMAKE_SOURCE_DIR}/src/platform/linux/wayland.cpp")
 endif()
 
+# pipewire
+if(${SUNSHINE_ENABLE_PIPEWIRE})
+    pkg_check_modules(PIPEWIRE libpipewire-0.3 REQUIRED)
+else()
+    set(PIPEWIRE_FOUND OFF)
+endif()
+if(PIPEWIRE_FOUND)
+    add_compile_definitions(SUNSHINE_BUILD_PIPEWIRE)
+    include_directories(SYSTEM ${PIPEWIRE_INCLUDE_DIRS})
+    list(APPEND PLATFORM_LIBRARIES ${PIPEWIRE_LIBRARIES})
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/pipewire.cpp")
+endif()
+
+# xdg desktop portal, the frames of the screencast come through pipewire
+if(PIPEWIRE_FOUND AND LIBDRM_FOUND)
+    add_compile_definitions(SUNSHINE_BUILD_PORTAL)
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/portalgrab.cpp")
+endif()
+
 # x11
 if(${SUNSHINE_ENABLE_X11})
     find_package(X11 REQUIRED)
@@ -234,13 +277,19 @@ endif ()
 
 list(APPEND PLATFORM_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/platform/linux/publish.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/dbus.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/dbus.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/graphics.h"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/graphics.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/misc.h"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/misc.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/rtkit.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/rtkit.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/audio.cpp"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/virtual_display.h"
         "${CMAKE_SOURCE_DIR}/src/platform/linux/virtual_display.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/xdp.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/linux/xdp.cpp"
         "${CMAKE_SOURCE_DIR}/third-party/glad/src/egl.c"
         "${CMAKE_SOURCE_DIR}/third-party/glad/src/gl.c"
         "${CMAKE_SOURCE_DIR}/third-party/glad/include/EGL/eglplatform.h"
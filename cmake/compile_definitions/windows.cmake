@@ -20,9 +20,6 @@ link_directories(${CURL_STATIC_LIBRARY_DIRS})
 # miniupnpc
 add_definitions(-DMINIUPNP_STATICLIB)
 
-# extra tools/binaries for audio/display devices
-add_subdirectory(tools)  # todo - this is temporary, only tools for Windows are needed, for now
-
 # nvidia
 include_directories(SYSTEM "${CMAKE_SOURCE_DIR}/third-party/nvapi-open-source-sdk")
 file(GLOB NVPREFS_FILES CONFIGURE_DEPENDS
@@ -2,7 +2,9 @@
 
 FIND_LIBRARY(APP_KIT_LIBRARY AppKit)
 FIND_LIBRARY(APP_SERVICES_LIBRARY ApplicationServices)
+FIND_LIBRARY(AUDIO_TOOLBOX_LIBRARY AudioToolbox)
 FIND_LIBRARY(AV_FOUNDATION_LIBRARY AVFoundation)
+FIND_LIBRARY(CORE_AUDIO_LIBRARY CoreAudio)
 FIND_LIBRARY(CORE_MEDIA_LIBRARY CoreMedia)
 FIND_LIBRARY(CORE_VIDEO_LIBRARY CoreVideo)
 FIND_LIBRARY(FOUNDATION_LIBRARY Foundation)
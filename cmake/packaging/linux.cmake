@@ -54,6 +54,7 @@ set(CPACK_DEBIAN_PACKAGE_DEPENDS "\
             libevdev2, \
             libnuma1, \
             libopus0, \
+            libpipewire-0.3-0, \
             libpulse0, \
             libva2, \
             libva-drm2, \
@@ -75,6 +76,7 @@ set(CPACK_RPM_PACKAGE_REQUIRES "\
             miniupnpc >= 2.2.4, \
             numactl-libs >= 2.0.14, \
             openssl >= 3.0.2, \
+            pipewire-libs, \
             pulseaudio-libs >= 10.0, \
             which >= 2.21")
 
@@ -78,6 +78,16 @@ if(BUILD_TESTS)
     add_subdirectory(tests)
 endif()
 
+# benchmarks
+if(BUILD_BENCHMARKS)
+    add_subdirectory(tests/benchmarks)
+endif()
+
+# extra tools, only the stream benchmark is built on other platforms than Windows
+if(WIN32 OR BUILD_BENCHMARKS)
+    add_subdirectory(tools)
+endif()
+
 # custom compile flags, must be after adding tests
 
 if (NOT BUILD_TESTS)
@@ -86,16 +96,27 @@ else()
     set(TEST_DIR "${CMAKE_SOURCE_DIR}/tests")
 endif()
 
+if (NOT BUILD_BENCHMARKS)
+    set(BENCHMARK_DIR "")
+else()
+    set(BENCHMARK_DIR "${CMAKE_SOURCE_DIR}/tests/benchmarks")
+endif()
+
 # src/upnp
 set_source_files_properties("${CMAKE_SOURCE_DIR}/src/upnp.cpp"
-        DIRECTORY "${CMAKE_SOURCE_DIR}" "${TEST_DIR}"
+        DIRECTORY "${CMAKE_SOURCE_DIR}" "${TEST_DIR}" "${BENCHMARK_DIR}"
         PROPERTIES COMPILE_FLAGS -Wno-pedantic)
 
 # third-party/nanors
 set_source_files_properties("${CMAKE_SOURCE_DIR}/src/rswrapper.c"
-        DIRECTORY "${CMAKE_SOURCE_DIR}" "${TEST_DIR}"
+        DIRECTORY "${CMAKE_SOURCE_DIR}" "${TEST_DIR}" "${BENCHMARK_DIR}"
         PROPERTIES COMPILE_FLAGS "-ftree-vectorize -funroll-loops")
 
+# src/rgb_to_yuv
+set_source_files_properties("${CMAKE_SOURCE_DIR}/src/rgb_to_yuv.cpp"
+        DIRECTORY "${CMAKE_SOURCE_DIR}" "${TEST_DIR}" "${BENCHMARK_DIR}"
+        PROPERTIES COMPILE_FLAGS "-ftree-vectorize -fvect-cost-model=dynamic")
+
 # third-party/ViGEmClient
 set(VIGEM_COMPILE_FLAGS "")
 string(APPEND VIGEM_COMPILE_FLAGS "-Wno-unknown-pragmas ")
@@ -104,7 +125,7 @@ string(APPEND VIGEM_COMPILE_FLAGS "-Wno-class-memaccess ")
 string(APPEND VIGEM_COMPILE_FLAGS "-Wno-unused-function ")
 string(APPEND VIGEM_COMPILE_FLAGS "-Wno-unused-variable ")
 set_source_files_properties("${CMAKE_SOURCE_DIR}/third-party/ViGEmClient/src/ViGEmClient.cpp"
-        DIRECTORY "${CMAKE_SOURCE_DIR}" "${TEST_DIR}"
+        DIRECTORY "${CMAKE_SOURCE_DIR}" "${TEST_DIR}" "${BENCHMARK_DIR}"
         PROPERTIES
         COMPILE_DEFINITIONS "UNICODE=1;ERROR_INVALID_DEVICE_OBJECT_PARAMETER=650"
         COMPILE_FLAGS ${VIGEM_COMPILE_FLAGS})
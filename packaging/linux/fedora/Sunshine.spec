@@ -44,6 +44,7 @@ BuildRequires: npm
 BuildRequires: numactl-devel
 BuildRequires: openssl-devel
 BuildRequires: opus-devel
+BuildRequires: pipewire-devel
 BuildRequires: pulseaudio-libs-devel
 BuildRequires: rpm-build
 BuildRequires: systemd-udev
@@ -84,6 +85,7 @@ Requires: libX11 >= 1.7.3.1
 Requires: miniupnpc >= 2.2.4
 Requires: numactl-libs >= 2.0.14
 Requires: openssl >= 3.0.2
+Requires: pipewire-libs
 Requires: pulseaudio-libs >= 10.0
 Requires: which >= 2.21
 
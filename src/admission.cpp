@@ -0,0 +1,166 @@
+/**
+ * @file src/admission.cpp
+ * @brief Definitions for admitting new streams within the capacity of the host.
+ */
+// standard includes
+#include <algorithm>
+#include <utility>
+
+// local includes
+#include "admission.h"
+#include "config.h"
+#include "platform/common.h"
+
+using namespace std::literals;
+
+namespace admission {
+  model_t::lease_t::lease_t(model_t *model, std::uint64_t id):
+      _model {model},
+      _id {id} {
+  }
+
+  model_t::lease_t::lease_t(lease_t &&other) noexcept:
+      _model {std::exchange(other._model, nullptr)},
+      _id {other._id} {
+  }
+
+  model_t::lease_t &model_t::lease_t::operator=(lease_t &&other) noexcept {
+    if (this != &other) {
+      release();
+
+      _model = std::exchange(other._model, nullptr);
+      _id = other._id;
+    }
+
+    return *this;
+  }
+
+  model_t::lease_t::~lease_t() {
+    release();
+  }
+
+  void model_t::lease_t::release() {
+    if (!_model) {
+      return;
+    }
+
+    std::lock_guard lg {_model->_lock};
+    _model->_streams.erase(_id);
+    _model = nullptr;
+  }
+
+  void model_t::lease_t::set_bitrate(int bitrate) {
+    if (!_model) {
+      return;
+    }
+
+    std::lock_guard lg {_model->_lock};
+    if (auto it = _model->_streams.find(_id); it != std::end(_model->_streams)) {
+      it->second.bitrate = bitrate;
+    }
+  }
+
+  model_t::model_t(limits_t limits):
+      _limits {limits} {
+  }
+
+  decision_t model_t::decide(const stream_t &requested) const {
+    std::lock_guard lg {_lock};
+
+    decision_t decision {decision_t::verdict_e::admit, requested, {}};
+    auto downgrade = [&decision](std::string reason) {
+      decision.verdict = decision_t::verdict_e::downgrade;
+      if (!decision.reason.empty()) {
+        decision.reason += ", "s;
+      }
+      decision.reason += reason;
+    };
+    auto reject = [&decision](std::string reason) {
+      decision.verdict = decision_t::verdict_e::reject;
+      decision.reason = std::move(reason);
+      return decision;
+    };
+
+    // The drivers count the sessions of other processes too, and ours only once they're open
+    auto sessions = std::max((int) _streams.size(), _sampled_sessions);
+    if (_limits.sessions > 0 && sessions >= _limits.sessions) {
+      return reject("every encode session of the host is in use"s);
+    }
+
+    if (_limits.egress_bitrate > 0) {
+      auto left = _limits.egress_bitrate;
+      for (auto &[id, stream] : _streams) {
+        left -= stream.bitrate;
+      }
+
+      if (left < min_bitrate) {
+        return reject("no upload bandwidth is left"s);
+      }
+      if (decision.stream.bitrate > left) {
+        decision.stream.bitrate = (int) left;
+        downgrade("the bitrate is capped to the upload bandwidth left"s);
+      }
+    }
+
+    if (_limits.pixel_rate > 0) {
+      auto left = _limits.pixel_rate;
+      for (auto &[id, stream] : _streams) {
+        left -= stream.pixel_rate();
+      }
+
+      if (decision.stream.pixel_rate() > left) {
+        auto fits = false;
+        for (auto framerate : {60.0, 30.0}) {
+          decision.stream.framerate = std::min(requested.framerate, framerate);
+          if (decision.stream.pixel_rate() <= left) {
+            fits = true;
+            break;
+          }
+        }
+
+        if (!fits) {
+          return reject("the encoders of the host can't take another stream"s);
+        }
+        downgrade("the framerate is lowered to what the encoders of the host can take"s);
+      }
+    }
+
+    return decision;
+  }
+
+  model_t::lease_t model_t::attach(const stream_t &stream) {
+    std::lock_guard lg {_lock};
+
+    auto id = _next_id++;
+    _streams.emplace(id, stream);
+    return {this, id};
+  }
+
+  void model_t::set_sampled_sessions(int sessions) {
+    std::lock_guard lg {_lock};
+    _sampled_sessions = sessions;
+  }
+
+  int model_t::sessions() const {
+    std::lock_guard lg {_lock};
+    return (int) _streams.size();
+  }
+
+  model_t &instance() {
+    static model_t model {[]() {
+      // Hosts that don't list their GPUs are counted as having one
+      auto gpus = std::max<int>(1, platf::encode_gpus().size());
+
+      return limits_t {
+        config::video.max_sessions_per_gpu * gpus,
+        config::video.max_encode_rate * 1e6,
+        (std::int64_t) config::video.max_egress_bitrate * 1000,
+      };
+    }()};
+    return model;
+  }
+
+  std::string status_message(const decision_t &decision) {
+    return "The host can't stream any more: "s + decision.reason;
+  }
+}  // namespace admission
@@ -0,0 +1,137 @@
+/**
+ * @file src/admission.h
+ * @brief Declarations for admitting new streams within the capacity of the host.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace admission {
+  /**
+   * @brief What a stream takes of the host.
+   */
+  struct stream_t {
+    int width;
+    int height;
+    double framerate;
+    int bitrate;  ///< In Kbps, 0 while it isn't known yet.
+
+    /**
+     * @brief Get the pixels per second the stream encodes.
+     */
+    double pixel_rate() const {
+      return (double) width * height * framerate;
+    }
+  };
+
+  /**
+   * @brief What the host can take, 0 for no limit.
+   */
+  struct limits_t {
+    int sessions;  ///< Encode sessions over all GPUs.
+    double pixel_rate;  ///< Pixels per second over all encoders.
+    std::int64_t egress_bitrate;  ///< Kbps over all streams.
+  };
+
+  /**
+   * @brief Whether a stream is admitted, and at what.
+   */
+  struct decision_t {
+    enum class verdict_e {
+      admit,  ///< As requested
+      downgrade,  ///< At a lower framerate or bitrate than requested
+      reject,  ///< Not at all
+    };
+
+    verdict_e verdict;
+    stream_t stream;  ///< What the stream is admitted at.
+    std::string reason;  ///< Why it was downgraded or rejected.
+  };
+
+  /**
+   * @brief Tracks what the running streams take of the host, and decides whether a new one fits in what's left.
+   * @details A stream that doesn't fit is tried at 60 and then 30 FPS when it asked for more, and is capped at
+   *          the bitrate left, rather than overloading the streams already running. The resolution is left to
+   *          `dynamic_resolution`, since the client decodes at the one it asked for. All methods are thread-safe.
+   */
+  class model_t {
+  public:
+    /**
+     * @brief A running stream, which counts toward the load of the host until it's destroyed.
+     */
+    class lease_t {
+    public:
+      lease_t() = default;
+      lease_t(lease_t &&other) noexcept;
+      lease_t &operator=(lease_t &&other) noexcept;
+      ~lease_t();
+
+      /**
+       * @brief Account for the stream changing its bitrate.
+       * @param bitrate The bitrate in Kbps.
+       */
+      void set_bitrate(int bitrate);
+
+    private:
+      friend class model_t;
+
+      lease_t(model_t *model, std::uint64_t id);
+
+      void release();
+
+      model_t *_model = nullptr;
+      std::uint64_t _id = 0;
+    };
+
+    // The least bitrate a stream is admitted at, in Kbps
+    static constexpr int min_bitrate = 1000;
+
+    explicit model_t(limits_t limits);
+
+    /**
+     * @brief Decide whether a new stream fits.
+     * @param requested What the client asked for.
+     */
+    decision_t decide(const stream_t &requested) const;
+
+    /**
+     * @brief Count a stream toward the load of the host.
+     * @param stream What it was admitted at.
+     * @return The lease of the stream.
+     */
+    lease_t attach(const stream_t &stream);
+
+    /**
+     * @brief Account for the encode sessions the drivers report, which include those of other processes.
+     * @param sessions The sessions over all GPUs, negative if they aren't known.
+     */
+    void set_sampled_sessions(int sessions);
+
+    /**
+     * @brief Get the number of streams counted toward the load of the host.
+     */
+    int sessions() const;
+
+  private:
+    const limits_t _limits;
+
+    mutable std::mutex _lock;
+    std::map<std::uint64_t, stream_t> _streams;
+    std::uint64_t _next_id = 1;
+    int _sampled_sessions = -1;
+  };
+
+  /**
+   * @brief Get the model of the host, with the limits of `config::video`.
+   */
+  model_t &instance();
+
+  /**
+   * @brief Get the status message for a stream that was rejected.
+   */
+  std::string status_message(const decision_t &decision);
+}  // namespace admission
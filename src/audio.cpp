@@ -3,6 +3,10 @@
  * @brief Definitions for audio capture and encoding.
  */
 // standard includes
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <optional>
 #include <thread>
 
 // lib includes
@@ -10,17 +14,29 @@
 
 // local includes
 #include "audio.h"
+#include "audio_loss.h"
 #include "config.h"
 #include "globals.h"
 #include "logging.h"
 #include "platform/common.h"
+#include "spsc_ring.h"
+#include "thread_affinity.h"
 #include "thread_safe.h"
 #include "utility.h"
 
 namespace audio {
   using namespace std::literals;
   using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
-  using sample_queue_t = std::shared_ptr<safe::queue_t<std::vector<float>>>;
+
+  struct sample_t {
+    std::vector<float> samples;
+
+    // When the samples were captured, as far as the microphone can tell
+    std::chrono::steady_clock::time_point captured;
+  };
+
+  // The buffers of the slots are reused, so capturing a packet doesn't allocate
+  using sample_queue_t = std::shared_ptr<util::spsc_ring_t<sample_t, 32>>;
 
   static int start_audio_control(audio_ctx_t &ctx);
   static void stop_audio_control(audio_ctx_t &);
@@ -83,15 +99,145 @@ namespace audio {
     },
   };
 
-  void encodeThread(sample_queue_t samples, config_t config, void *channel_data) {
-    auto packets = mail::man->queue<packet_t>(mail::audio_packets);
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
+  /**
+   * @brief An audio stream shared by the sessions that stream with the same audio settings.
+   * @details One session captures and encodes at a time, from its own capture() thread,
+   *          and another one takes over when it leaves. Every packet is handed to every session,
+   *          which encrypts it on its own.
+   */
+  class shared_stream_t {
+  public:
+    explicit shared_stream_t(const config_t &config):
+        config {config} {
+    }
+
+    void join(void *channel_data) {
+      std::lock_guard lg {_lock};
+
+      _sessions.emplace_back(channel_data);
     }
 
+    void leave(void *channel_data) {
+      std::lock_guard lg {_lock};
+
+      std::erase(_sessions, channel_data);
+      if (_leader == channel_data) {
+        _leader = nullptr;
+        _cv.notify_all();
+      }
+    }
+
+    /**
+     * @brief Wait for the stream to be free, and run it from the calling session.
+     * @return `true` if the session runs the stream.
+     */
+    bool lead(void *channel_data, std::chrono::milliseconds timeout) {
+      std::unique_lock ul {_lock};
+
+      if (!_cv.wait_for(ul, timeout, [&]() {
+            return !_leader || _leader == channel_data;
+          })) {
+        return false;
+      }
+
+      if (!_leader) {
+        BOOST_LOG(info) << "Session "sv << channel_data << " runs the shared audio stream for "sv << _sessions.size() << " session(s)"sv;
+        _leader = channel_data;
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Hand an encoded packet to every session.
+     */
+    void fan_out(safe::mail_raw_t::queue_t<packet_t> &packets, buffer_t &&packet, std::chrono::steady_clock::time_point captured) {
+      std::lock_guard lg {_lock};
+
+      if (_sessions.empty()) {
+        return;
+      }
+
+      for (auto it = _sessions.begin(); it != _sessions.end() - 1; ++it) {
+        packets->raise(*it, buffer_t {packet}, captured);
+      }
+      packets->raise(_sessions.back(), std::move(packet), captured);
+    }
+
+    const config_t config;
+
+  private:
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::vector<void *> _sessions;
+    void *_leader = nullptr;
+  };
+
+  std::mutex shared_streams_lock;
+  std::vector<std::weak_ptr<shared_stream_t>> shared_streams;
+
+  /**
+   * @brief Check whether two sessions would get the same audio from an encoder.
+   */
+  bool same_audio(const config_t &a, const config_t &b) {
+    if (a.packetDuration != b.packetDuration || a.channels != b.channels || a.mask != b.mask || a.flags != b.flags) {
+      return false;
+    }
+
+    if (!a.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+      return true;
+    }
+
+    auto &params_a = a.customStreamParams;
+    auto &params_b = b.customStreamParams;
+    return params_a.channelCount == params_b.channelCount &&
+           params_a.streams == params_b.streams &&
+           params_a.coupledStreams == params_b.coupledStreams &&
+           std::memcmp(params_a.mapping, params_b.mapping, sizeof(params_a.mapping)) == 0;
+  }
+
+  /**
+   * @brief Add a session to the shared stream for its audio settings, creating it if there's none.
+   */
+  std::shared_ptr<shared_stream_t> join_shared_stream(const config_t &config, void *channel_data) {
+    std::lock_guard lg {shared_streams_lock};
+
+    std::erase_if(shared_streams, [](auto &weak) {
+      return weak.expired();
+    });
+
+    std::shared_ptr<shared_stream_t> shared_stream;
+    for (auto &weak : shared_streams) {
+      auto candidate = weak.lock();
+      if (candidate && same_audio(candidate->config, config)) {
+        shared_stream = std::move(candidate);
+        break;
+      }
+    }
+
+    if (!shared_stream) {
+      shared_stream = std::make_shared<shared_stream_t>(config);
+      shared_streams.emplace_back(shared_stream);
+    }
+
+    shared_stream->join(channel_data);
+    return shared_stream;
+  }
+
+  // The packets of a Reed-Solomon block of the audio sender, see RTPA_DATA_SHARDS
+  constexpr int fec_block_packets = 4;
+
+  /**
+   * @brief Encode the samples of a stream until they're closed.
+   * @param loss_events The loss percentages of the network to adapt to, or nullptr to keep the encoder as it was opened.
+   */
+  void encodeThread(sample_queue_t samples, config_t config, void *channel_data, shared_stream_t *shared_stream, safe::mail_raw_t::event_t<int> loss_events) {
+    auto packets = mail::man->queue<packet_t>(mail::audio_packets);
+    auto stream = stream_config(config);
+
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin_current_thread("audio encode"sv);
 
     opus_t opus {opus_multistream_encoder_create(
       stream.sampleRate,
@@ -105,16 +251,63 @@ namespace audio {
 
     opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE(stream.bitrate));
     opus_multistream_encoder_ctl(opus.get(), OPUS_SET_VBR(0));
+    opus_multistream_encoder_ctl(opus.get(), OPUS_SET_COMPLEXITY(config::audio.opus_complexity));
 
     BOOST_LOG(info) << "Opus initialized: "sv << stream.sampleRate / 1000 << " kHz, "sv
                     << stream.channelCount << " channels, "sv
-                    << stream.bitrate / 1000 << " kbps (total), LOWDELAY"sv;
+                    << stream.bitrate / 1000 << " kbps (total), complexity "sv
+                    << config::audio.opus_complexity << ", LOWDELAY"sv;
+
+    loss_settings_t settings {false, 0, stream.bitrate};
+    std::optional<loss_settings_t> pending_settings;
+    std::uint64_t packets_encoded = 0;
 
     auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    while (auto sample = samples->pop()) {
+    while (true) {
+      samples->wait();
+      if (samples->closed()) {
+        break;
+      }
+
+      // Encoding fell behind, so the backlog is dropped rather than delaying audio for good
+      if (samples->size() == sample_queue_t::element_type::capacity) {
+        while (samples->size() > 1) {
+          samples->pop();
+        }
+      }
+
+      if (loss_events && loss_events->peek()) {
+        if (auto loss_percentage = loss_events->pop(0ms)) {
+          pending_settings = loss_settings(*loss_percentage, stream.bitrate);
+
+          // The sessions sharing the stream joined it at any point of their blocks
+          if (shared_stream) {
+            pending_settings->bitrate = stream.bitrate;
+          }
+        }
+      }
+
+      // Packets of another bitrate have another size, which the Reed-Solomon blocks of the audio sender can't mix
+      if (pending_settings && (pending_settings->bitrate == settings.bitrate || packets_encoded % fec_block_packets == 0)) {
+        if (*pending_settings != settings) {
+          opus_multistream_encoder_ctl(opus.get(), OPUS_SET_INBAND_FEC(pending_settings->inband_fec ? 1 : 0));
+          opus_multistream_encoder_ctl(opus.get(), OPUS_SET_PACKET_LOSS_PERC(pending_settings->packet_loss_percentage));
+          opus_multistream_encoder_ctl(opus.get(), OPUS_SET_BITRATE(pending_settings->bitrate));
+
+          BOOST_LOG(debug) << "Adapting audio to "sv << pending_settings->packet_loss_percentage << "% loss: in-band FEC "sv
+                           << (pending_settings->inband_fec ? "on"sv : "off"sv) << ", "sv << pending_settings->bitrate / 1000 << " kbps"sv;
+        }
+
+        settings = *pending_settings;
+        pending_settings.reset();
+      }
+
+      auto &sample = samples->front();
       buffer_t packet {1400};
 
-      int bytes = opus_multistream_encode_float(opus.get(), sample->data(), frame_size, std::begin(packet), packet.size());
+      int bytes = opus_multistream_encode_float(opus.get(), sample.samples.data(), frame_size, std::begin(packet), packet.size());
+      auto captured = sample.captured;
+      samples->pop();
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio: "sv << opus_strerror(bytes);
         packets->stop();
@@ -123,20 +316,22 @@ namespace audio {
       }
 
       packet.fake_resize(bytes);
-      packets->raise(channel_data, std::move(packet));
+      ++packets_encoded;
+      if (shared_stream) {
+        shared_stream->fan_out(packets, std::move(packet), captured);
+      } else {
+        packets->raise(channel_data, std::move(packet), captured);
+      }
     }
   }
 
-  void capture(safe::mail_t mail, config_t config, void *channel_data) {
+  /**
+   * @brief Capture and encode audio until the session shuts down.
+   * @param shared_stream The stream the packets are handed out by, or nullptr to send them to this session only.
+   */
+  static void capture_stream(safe::mail_t mail, config_t config, void *channel_data, shared_stream_t *shared_stream) {
     auto shutdown_event = mail->event<bool>(mail::shutdown);
-    if (!config::audio.stream || config.input_only) {
-      shutdown_event->view();
-      return;
-    }
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
-    }
+    auto stream = stream_config(config);
 
     auto ref = get_audio_ctx_ref();
     if (!ref) {
@@ -206,12 +401,14 @@ namespace audio {
 
     // Capture takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_affinity::pin_current_thread("audio capture"sv);
 
-    auto samples = std::make_shared<sample_queue_t::element_type>(30);
-    std::thread thread {encodeThread, samples, config, channel_data};
+    auto samples = std::make_shared<sample_queue_t::element_type>();
+    auto loss_events = config::audio.adaptive ? mail->event<int>(mail::audio_loss) : nullptr;
+    std::thread thread {encodeThread, samples, config, channel_data, shared_stream, std::move(loss_events)};
 
     auto fg = util::fail_guard([&]() {
-      samples->stop();
+      samples->close();
       thread.join();
 
       shutdown_event->view();
@@ -219,11 +416,15 @@ namespace audio {
 
     int samples_per_frame = frame_size * stream.channelCount;
 
+    // Captured into when the encoder is behind, so the capture device is still drained
+    sample_t overflow_sample;
+
     while (!shutdown_event->peek()) {
-      std::vector<float> sample_buffer;
-      sample_buffer.resize(samples_per_frame);
+      auto slot = samples->back();
+      auto &sample = slot ? *slot : overflow_sample;
+      sample.samples.resize(samples_per_frame);
 
-      auto status = mic->sample(sample_buffer);
+      auto status = mic->sample(sample.samples);
       switch (status) {
         case platf::capture_e::ok:
           break;
@@ -246,7 +447,36 @@ namespace audio {
           return;
       }
 
-      samples->raise(std::move(sample_buffer));
+      if (slot) {
+        slot->captured = std::chrono::steady_clock::now() - mic->latency();
+        samples->push();
+      }
+    }
+  }
+
+  void capture(safe::mail_t mail, config_t config, void *channel_data) {
+    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    if (!config::audio.stream || config.input_only) {
+      shutdown_event->view();
+      return;
+    }
+
+    if (!config::audio.shared_encoder) {
+      capture_stream(std::move(mail), config, channel_data, nullptr);
+      return;
+    }
+
+    auto shared_stream = join_shared_stream(config, channel_data);
+    auto fg = util::fail_guard([&]() {
+      shared_stream->leave(channel_data);
+    });
+
+    // The session that runs the stream keeps it until it shuts down, then another one takes over
+    while (!shutdown_event->peek()) {
+      if (shared_stream->lead(channel_data, 500ms)) {
+        capture_stream(mail, config, channel_data, shared_stream.get());
+        return;
+      }
     }
   }
 
@@ -281,6 +511,15 @@ namespace audio {
     return STEREO;
   }
 
+  opus_stream_config_t stream_config(const config_t &config) {
+    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
+    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+      apply_surround_params(stream, config.customStreamParams);
+    }
+
+    return stream;
+  }
+
   int start_audio_control(audio_ctx_t &ctx) {
     auto fg = util::fail_guard([]() {
       BOOST_LOG(warning) << "There will be no audio"sv;
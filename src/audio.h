@@ -10,6 +10,8 @@
 #include "utility.h"
 
 #include <bitset>
+#include <chrono>
+#include <tuple>
 
 namespace audio {
   enum stream_config_e : int {
@@ -74,11 +76,18 @@ namespace audio {
   };
 
   using buffer_t = util::buffer_t<std::uint8_t>;
-  using packet_t = std::pair<void *, buffer_t>;
+  // The session, the encoded packet and when its samples were captured
+  using packet_t = std::tuple<void *, buffer_t, std::chrono::steady_clock::time_point>;
   using audio_ctx_ref_t = safe::shared_t<audio_ctx_t>::ptr_t;
 
   void capture(safe::mail_t mail, config_t config, void *channel_data);
 
+  /**
+   * @brief Get the Opus stream the audio of a session is encoded with.
+   * @param config The audio configuration of the session.
+   */
+  opus_stream_config_t stream_config(const config_t &config);
+
   /**
    * @brief Get the reference to the audio context.
    * @returns A shared pointer reference to audio context.
@@ -107,3 +116,9 @@ namespace audio {
    */
   bool is_audio_ctx_sink_available(const audio_ctx_t &ctx);
 }  // namespace audio
+
+// Every audio encoding thread raises packets for the audio sender, which takes them one by one
+template<>
+struct safe::mail_queue<audio::packet_t> {
+  using type = safe::mpsc_queue_t<audio::packet_t>;
+};
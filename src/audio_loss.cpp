@@ -0,0 +1,84 @@
+/**
+ * @file src/audio_loss.cpp
+ * @brief Definitions for adapting the Opus encoder of an audio stream to the loss the client reports.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
+// local includes
+#include "audio_loss.h"
+
+namespace audio {
+  namespace {
+    // In-band FEC is enabled from this loss percentage on
+    constexpr int fec_loss_percentage = 1;
+
+    // Opus spends more of the bitrate on the copy the more loss it expects, which gains little past this
+    constexpr int max_packet_loss_percentage = 40;
+
+    // The bitrate backs off to a share of the bitrate without loss from these loss percentages on
+    constexpr int congestion_loss_percentage = 10;
+    constexpr int heavy_congestion_loss_percentage = 25;
+
+    // Weight of the previous loss once the loss falls
+    constexpr double loss_decay = 0.8;
+  }  // namespace
+
+  loss_settings_t loss_settings(int loss_percentage, int bitrate) {
+    loss_percentage = std::clamp(loss_percentage, 0, 100);
+
+    loss_settings_t settings {
+      loss_percentage >= fec_loss_percentage,
+      std::min(loss_percentage, max_packet_loss_percentage),
+      bitrate,
+    };
+
+    if (loss_percentage >= heavy_congestion_loss_percentage) {
+      settings.bitrate = bitrate / 2;
+    } else if (loss_percentage >= congestion_loss_percentage) {
+      settings.bitrate = bitrate * 3 / 4;
+    }
+
+    return settings;
+  }
+
+  void loss_monitor_t::packets_sent(int packets) {
+    std::lock_guard lg {_lock};
+    _packets_sent += std::max(packets, 0);
+  }
+
+  std::optional<int> loss_monitor_t::packets_lost(int packets, clock::time_point now) {
+    std::lock_guard lg {_lock};
+
+    _packets_lost += std::max(packets, 0);
+    if (!_last_update) {
+      _last_update = now;
+      return std::nullopt;
+    }
+
+    if (now - *_last_update < update_interval) {
+      return std::nullopt;
+    }
+    _last_update = now;
+
+    // Nothing was sent, so nothing is known about the network
+    if (_packets_sent == 0) {
+      _packets_lost = 0;
+      return std::nullopt;
+    }
+
+    auto loss = std::min(1.0, (double) _packets_lost / (double) _packets_sent);
+    _loss = loss > _loss ? loss : _loss * loss_decay + loss * (1 - loss_decay);
+    _packets_sent = 0;
+    _packets_lost = 0;
+
+    auto loss_percentage = (int) std::lround(_loss * 100);
+    if (loss_percentage == _loss_percentage) {
+      return std::nullopt;
+    }
+
+    _loss_percentage = loss_percentage;
+    return loss_percentage;
+  }
+}  // namespace audio
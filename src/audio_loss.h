@@ -0,0 +1,75 @@
+/**
+ * @file src/audio_loss.h
+ * @brief Declarations for adapting the Opus encoder of an audio stream to the loss the client reports.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace audio {
+  /**
+   * @brief How the Opus encoder of a stream protects its audio against loss.
+   */
+  struct loss_settings_t {
+    bool inband_fec;  ///< Whether every packet carries a low bitrate copy of the previous one.
+    int packet_loss_percentage;  ///< The loss the encoder expects, which sizes that copy.
+    int bitrate;  ///< The bitrate in bits per second.
+
+    bool operator==(const loss_settings_t &) const = default;
+  };
+
+  /**
+   * @brief Get the settings of the Opus encoder for the loss of the network.
+   * @details In-band FEC protects against the loss of single packets, which the Reed-Solomon blocks of
+   *          the audio stream can't always recover when a burst takes out more than their parity.
+   *          Heavy loss means the network is congested, so the bitrate backs off as well.
+   * @param loss_percentage The percentage of packets the network loses.
+   * @param bitrate The bitrate of the stream in bits per second without loss.
+   * @return The settings.
+   */
+  loss_settings_t loss_settings(int loss_percentage, int bitrate);
+
+  /**
+   * @brief Tracks the share of packets the network to a client loses.
+   * @details The client only reports the loss of video packets, which share the network path with audio,
+   *          so those stand in for the loss of audio as well. Loss is picked up at once and fades slowly,
+   *          so the encoder doesn't drop its protection between two bursts. All methods are thread-safe.
+   */
+  class loss_monitor_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Account for video packets handed to the network.
+     * @param packets The number of packets, FEC included.
+     */
+    void packets_sent(int packets);
+
+    /**
+     * @brief Account for packets the client reported lost, and update the loss once an interval passed.
+     * @param packets The number of packets lost since the last report.
+     * @param now The current time.
+     * @return The new loss percentage, if it changed.
+     */
+    std::optional<int> packets_lost(int packets, clock::time_point now = clock::now());
+
+    // How often the loss is updated
+    static constexpr auto update_interval = std::chrono::milliseconds {500};
+
+  private:
+    std::mutex _lock;
+
+    // Observed since the last update
+    std::int64_t _packets_sent = 0;
+    std::int64_t _packets_lost = 0;
+
+    double _loss = 0;
+    int _loss_percentage = 0;
+
+    std::optional<clock::time_point> _last_update;
+  };
+}  // namespace audio
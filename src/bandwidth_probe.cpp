@@ -0,0 +1,162 @@
+/**
+ * @file src/bandwidth_probe.cpp
+ * @brief Definitions for the probe of the network path to a client, which picks the bitrate a stream starts at.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "bandwidth_probe.h"
+
+using namespace std::literals;
+
+namespace stream {
+  namespace {
+    // Share of the rate of the stream every step is sent at
+    constexpr std::array<double, 3> step_shares {0.25, 0.5, 1.0};
+
+    // A step the path kept up with delivered this share of its rate, without more loss or queueing than this
+    constexpr double min_delivered_share = 0.9;
+    constexpr double loss_threshold = 0.02;
+    constexpr auto rtt_inflation_threshold = 10ms;
+
+    // The transport can't send faster than its window per round-trip time, so steps stay below that
+    constexpr double window_share = 0.8;
+
+    // Padding that's due is sent in bursts of at most this long at the rate of the step
+    constexpr auto max_burst = 10ms;
+
+    // Streams start below what the path carried, leaving room for frames larger than average
+    constexpr double capacity_headroom = 0.85;
+  }  // namespace
+
+  int bandwidth_probe_t::result_t::bitrate(int max_bitrate, int fec_percentage) const {
+    if (!capacity) {
+      return max_bitrate;
+    }
+
+    auto min_bitrate = std::min(max_bitrate, std::max(500, max_bitrate / 20));
+    auto bitrate = (int) (*capacity * capacity_headroom / (1 + fec_percentage / 100.0));
+    return std::clamp(bitrate, min_bitrate, max_bitrate);
+  }
+
+  bandwidth_probe_t::bandwidth_probe_t(int max_bitrate, int fec_percentage):
+      _max_rate {std::max(max_bitrate, 1) * 1000.0 / 8 * (1 + std::max(fec_percentage, 0) / 100.0)} {
+    for (std::size_t x = 0; x < _steps.size(); ++x) {
+      _steps[x].rate = _max_rate * step_shares[x];
+    }
+  }
+
+  std::size_t bandwidth_probe_t::update(const sample_t &sample, clock::time_point now) {
+    std::lock_guard lg {_lock};
+
+    if (_result || _stopped) {
+      return 0;
+    }
+
+    if (!_start) {
+      _start = now;
+      _last_update = now;
+    }
+
+    // The transport resets its count of lost packets every now and then
+    if (_last_packets_lost) {
+      _packets_lost += sample.packets_lost >= *_last_packets_lost ? sample.packets_lost - *_last_packets_lost : sample.packets_lost;
+    }
+    _last_packets_lost = sample.packets_lost;
+
+    _min_rtt = std::min(_min_rtt.value_or(sample.rtt), sample.rtt);
+    auto base_rtt = std::max(*_min_rtt, 1ms);
+    auto delivered = _bytes_sent - std::min<std::uint64_t>(_bytes_sent, sample.bytes_in_flight);
+
+    auto &judged = _steps[_judging];
+    auto judge_start = *_start + _judging * step_duration + base_rtt;
+    if (!judged.start && now >= judge_start) {
+      judged.start = now;
+      judged.start_delivered = delivered;
+      judged.start_packets_lost = _packets_lost;
+    }
+
+    if (judged.start) {
+      judged.max_rtt = std::max(judged.max_rtt, sample.rtt);
+
+      if (now >= judge_start + step_duration) {
+        auto elapsed = std::chrono::duration<double>(now - *judged.start).count();
+        auto delivered_rate = (delivered - judged.start_delivered) / std::max(elapsed, 1e-3);
+        auto loss = (double) (_packets_lost - judged.start_packets_lost) / std::max<std::uint64_t>(judged.packets_sent, 1);
+
+        auto max_inflation = std::max<std::chrono::milliseconds>(rtt_inflation_threshold, base_rtt / 2);
+        auto kept_up = delivered_rate >= judged.rate * min_delivered_share && judged.max_rtt - base_rtt <= max_inflation && loss <= loss_threshold;
+        if (!kept_up) {
+          // The path carried at least the step before
+          auto capacity = std::max(delivered_rate, _judging > 0 ? _steps[_judging - 1].rate : 0.0);
+          finish((int) (capacity * 8 / 1000));
+          return 0;
+        }
+
+        // Beyond a step limited by the window, the path couldn't be pushed any harder
+        if (judged.window_limited || ++_judging == _steps.size()) {
+          finish(std::nullopt);
+          return 0;
+        }
+      }
+    }
+
+    auto elapsed = now - *_last_update;
+    _last_update = now;
+
+    _sending = std::min<std::size_t>((now - *_start) / step_duration, _steps.size());
+    if (_sending == _steps.size()) {
+      _credit = 0;
+      return 0;
+    }
+
+    auto &step = _steps[_sending];
+    auto max_rate = sample.window / std::chrono::duration<double>(base_rtt).count() * window_share;
+    if (step.rate > max_rate) {
+      step.rate = max_rate;
+      step.window_limited = true;
+    }
+
+    _credit = std::min(_credit + step.rate * std::chrono::duration<double>(elapsed).count(), step.rate * std::chrono::duration<double>(max_burst).count());
+    return (std::size_t) _credit;
+  }
+
+  void bandwidth_probe_t::sent(std::size_t bytes, int packets) {
+    std::lock_guard lg {_lock};
+
+    _credit = std::max(_credit - bytes, 0.0);
+    _bytes_sent += bytes;
+    _packets_sent += std::max(packets, 0);
+    if (_sending < _steps.size()) {
+      _steps[_sending].packets_sent += std::max(packets, 0);
+    }
+  }
+
+  bool bandwidth_probe_t::done() const {
+    std::lock_guard lg {_lock};
+    return _result || _stopped;
+  }
+
+  std::optional<bandwidth_probe_t::result_t> bandwidth_probe_t::wait(std::chrono::milliseconds timeout) {
+    std::unique_lock ul {_lock};
+
+    _finished.wait_for(ul, timeout, [this]() {
+      return _result.has_value();
+    });
+
+    _stopped = true;
+    return _result;
+  }
+
+  void bandwidth_probe_t::finish(std::optional<int> capacity) {
+    _result = result_t {
+      capacity,
+      (double) _packets_lost / std::max<std::uint64_t>(_packets_sent, 1),
+      _min_rtt.value_or(0ms),
+    };
+    _credit = 0;
+
+    _finished.notify_all();
+  }
+}  // namespace stream
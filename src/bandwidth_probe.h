@@ -0,0 +1,131 @@
+/**
+ * @file src/bandwidth_probe.h
+ * @brief Declarations for the probe of the network path to a client, which picks the bitrate a stream starts at.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace stream {
+  /**
+   * @brief Probes how much a client's network path carries before its video starts.
+   * @details Padding is sent in steps of a rising rate, up to the rate of the stream the client asked for with its FEC.
+   *          The client acknowledges it, so the delivered rate, the rise of the round-trip time and the packets that
+   *          had to be resent show whether the path kept up with each step. Probing stops at the first step it didn't
+   *          keep up with, and the stream starts below what the path carried rather than finding out from the loss
+   *          of its first frames. Only the thread sending the padding updates the probe, any thread may wait for it.
+   */
+  class bandwidth_probe_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief What the transport of the padding last reported.
+     */
+    struct sample_t {
+      std::uint64_t bytes_in_flight;  ///< The bytes sent and not acknowledged yet.
+      std::chrono::milliseconds rtt;  ///< The round-trip time.
+      std::uint32_t packets_lost;  ///< A running count of the packets that had to be resent, which may be reset.
+      std::uint32_t window;  ///< The bytes that may be in flight at once.
+    };
+
+    /**
+     * @brief What the probe found.
+     */
+    struct result_t {
+      std::optional<int> capacity;  ///< The rate the path carried in kilobits, unset if it kept up with every step.
+      double loss;  ///< The share of the padding that had to be resent.
+      std::chrono::milliseconds rtt;  ///< The round-trip time without queueing.
+
+      /**
+       * @brief Get the bitrate a stream fits into the path at.
+       * @param max_bitrate The bitrate the client asked for in kilobits.
+       * @param fec_percentage The FEC percentage of the stream.
+       * @return The bitrate in kilobits, which is never above `max_bitrate`.
+       */
+      int bitrate(int max_bitrate, int fec_percentage) const;
+    };
+
+    /**
+     * @param max_bitrate The bitrate the client asked for in kilobits.
+     * @param fec_percentage The FEC percentage of the stream, whose packets the path carries as well.
+     */
+    bandwidth_probe_t(int max_bitrate, int fec_percentage);
+
+    /**
+     * @brief Account for what the transport reports, and get how much padding to send.
+     * @param sample What the transport of the padding reports.
+     * @param now The current time.
+     * @return The bytes of padding due by now, 0 once the probe is done.
+     */
+    std::size_t update(const sample_t &sample, clock::time_point now = clock::now());
+
+    /**
+     * @brief Account for padding handed to the transport.
+     * @param bytes The bytes of the padding.
+     * @param packets The number of packets it was sent in.
+     */
+    void sent(std::size_t bytes, int packets);
+
+    /**
+     * @brief Check whether the probe is done, and no more padding is sent.
+     */
+    bool done() const;
+
+    /**
+     * @brief Wait for the probe to finish, and stop it if it takes too long.
+     * @param timeout How long to wait for.
+     * @return What the probe found, or nothing if it didn't finish in time.
+     */
+    std::optional<result_t> wait(std::chrono::milliseconds timeout);
+
+    // How long every step of the rate lasts
+    static constexpr auto step_duration = std::chrono::milliseconds {150};
+
+  private:
+    struct step_t {
+      double rate;  // Bytes per second
+      bool window_limited = false;
+
+      std::uint64_t packets_sent = 0;
+
+      // Taken once the padding of the step should arrive, a round-trip time after it was sent
+      std::optional<clock::time_point> start;
+      std::uint64_t start_delivered = 0;
+      std::uint64_t start_packets_lost = 0;
+      std::chrono::milliseconds max_rtt {};
+    };
+
+    void finish(std::optional<int> capacity);
+
+    const double _max_rate;
+
+    mutable std::mutex _lock;
+    std::condition_variable _finished;
+
+    std::optional<result_t> _result;
+    bool _stopped = false;
+
+    std::optional<clock::time_point> _start;
+    std::optional<clock::time_point> _last_update;
+    std::optional<std::chrono::milliseconds> _min_rtt;
+
+    // Steps are sent one after another, and each is judged a round-trip time after it was sent
+    std::array<step_t, 3> _steps;
+    std::size_t _sending = 0;
+    std::size_t _judging = 0;
+
+    double _credit = 0;
+    std::uint64_t _bytes_sent = 0;
+    std::uint64_t _packets_sent = 0;
+    std::uint64_t _packets_lost = 0;
+    std::optional<std::uint32_t> _last_packets_lost;
+  };
+}  // namespace stream
@@ -0,0 +1,196 @@
+/**
+ * @file src/bitrate_controller.cpp
+ * @brief Definitions for the congestion controller adapting the bitrate and FEC of a video stream.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
+// local includes
+#include "bitrate_controller.h"
+
+using namespace std::literals;
+
+namespace stream {
+  namespace {
+    // Back off when more than this share of the packets is lost
+    constexpr double loss_threshold = 0.02;
+
+    // Only probe for more bandwidth while less than this share of the packets is lost
+    constexpr double probe_loss_threshold = 0.005;
+
+    // Back off when even the quickest frame of an update waited this much longer than the quickest frame ever did
+    constexpr auto queue_delay_threshold = 10ms;
+
+    constexpr double decrease_factor = 0.85;
+
+    // Share of the maximum bitrate added with every update
+    constexpr double increase_step = 0.05;
+
+    // Give the network time to drain after backing off
+    constexpr auto decrease_hold = 1s;
+    constexpr auto increase_hold = 2s;
+
+    // The encoder is only reconfigured for changes of at least this share
+    constexpr double min_bitrate_change = 0.05;
+
+    // FEC added per lost share of the packets
+    constexpr double fec_per_loss = 2;
+    constexpr int max_fec_percentage = 50;
+
+    // With per-frame FEC, ordinary frames make do with a share of the base FEC on a clean network,
+    // while frames the client recovers with get more, and more quickly as the loss grows
+    constexpr int normal_fec_divisor = 4;
+    constexpr double normal_fec_per_loss = 3;
+    constexpr double recovery_fec_per_loss = 6;
+    constexpr int max_recovery_fec_percentage = 100;
+
+    // The most FEC a frame can have, see fec::encode()
+    constexpr int fec_percentage_limit = 255;
+  }  // namespace
+
+  bitrate_controller_t::bitrate_controller_t(int max_bitrate, int fec_percentage, bool adapt_bitrate, bool per_frame_fec):
+      _adapt_bitrate {adapt_bitrate},
+      _per_frame_fec {per_frame_fec},
+      _max_bitrate {std::max(max_bitrate, 1)},
+      _min_bitrate {std::min(_max_bitrate, std::max(500, _max_bitrate / 20))},
+      _base_fec_percentage {fec_percentage},
+      _bitrate {_max_bitrate},
+      _fec_percentage {fec_percentage},
+      _encoder_bitrate {_max_bitrate} {
+  }
+
+  void bitrate_controller_t::packets_lost(int packets) {
+    std::lock_guard lg {_lock};
+    _packets_lost += std::max(packets, 0);
+  }
+
+  void bitrate_controller_t::frames_lost(int frames) {
+    std::lock_guard lg {_lock};
+    _frames_lost += std::max(frames, 0);
+  }
+
+  std::optional<int> bitrate_controller_t::frame_sent(int packets, std::optional<std::chrono::nanoseconds> queue_delay, clock::time_point now) {
+    std::lock_guard lg {_lock};
+
+    _packets_sent += packets;
+    ++_frames_sent;
+    if (queue_delay) {
+      _window_min_queue_delay = std::min(_window_min_queue_delay.value_or(*queue_delay), *queue_delay);
+    }
+
+    if (!_last_update) {
+      _last_update = now;
+      return std::nullopt;
+    }
+
+    if (now - *_last_update < update_interval) {
+      return std::nullopt;
+    }
+    _last_update = now;
+
+    auto packet_loss = (double) _packets_lost / std::max<std::int64_t>(_packets_sent, 1);
+    auto frame_loss = (double) _frames_lost / std::max<std::int64_t>(_frames_sent, 1);
+    _loss = (_loss + std::min(1.0, std::max(packet_loss, frame_loss))) / 2;
+
+    // The quickest frame shows the time it takes to capture and encode, everything above is queueing.
+    // The baseline drifts up slowly, so it follows the encoder when frames get harder to encode.
+    bool queueing = false;
+    if (auto window_delay = _window_min_queue_delay) {
+      if (!_min_queue_delay || *window_delay < *_min_queue_delay) {
+        _min_queue_delay = window_delay;
+      } else {
+        *_min_queue_delay += (*window_delay - *_min_queue_delay) / 8;
+      }
+      queueing = *window_delay - *_min_queue_delay > queue_delay_threshold;
+    }
+
+    _packets_sent = 0;
+    _frames_sent = 0;
+    _packets_lost = 0;
+    _frames_lost = 0;
+    _window_min_queue_delay.reset();
+
+    auto since_decrease = _last_decrease ? now - *_last_decrease : clock::duration::max();
+    if (_adapt_bitrate) {
+      if (_loss > loss_threshold || queueing) {
+        if (since_decrease >= decrease_hold) {
+          _bitrate = std::max(_min_bitrate, (int) (_bitrate * decrease_factor));
+          _last_decrease = now;
+        }
+      } else if (_loss < probe_loss_threshold && since_decrease >= increase_hold) {
+        _bitrate = std::min(_max_bitrate, _bitrate + std::max(1, (int) (_max_bitrate * increase_step)));
+      }
+    }
+
+    _fec_percentage = std::clamp(
+      _base_fec_percentage + (int) std::lround(_loss * 100 * fec_per_loss),
+      _base_fec_percentage,
+      std::max(_base_fec_percentage, max_fec_percentage)
+    );
+
+    // Small steps are saved up, except the last ones to either limit
+    auto change = std::abs(_bitrate - _encoder_bitrate);
+    if (change == 0 || (change < _encoder_bitrate * min_bitrate_change && _bitrate != _max_bitrate && _bitrate != _min_bitrate)) {
+      return std::nullopt;
+    }
+
+    _encoder_bitrate = _bitrate;
+    return _bitrate;
+  }
+
+  void bitrate_controller_t::reconfigure(int max_bitrate, int fec_percentage) {
+    std::lock_guard lg {_lock};
+
+    _max_bitrate = std::max(max_bitrate, 1);
+    _min_bitrate = std::min(_max_bitrate, std::max(500, _max_bitrate / 20));
+    _base_fec_percentage = fec_percentage;
+
+    // Without adapting, the stream runs at the limit
+    _bitrate = _adapt_bitrate ? std::clamp(_bitrate, _min_bitrate, _max_bitrate) : _max_bitrate;
+    _fec_percentage = std::clamp(_fec_percentage, _base_fec_percentage, std::max(_base_fec_percentage, max_fec_percentage));
+  }
+
+  void bitrate_controller_t::start_from(int bitrate, double loss, clock::time_point now) {
+    std::lock_guard lg {_lock};
+
+    if (_adapt_bitrate) {
+      _bitrate = _encoder_bitrate = std::clamp(bitrate, _min_bitrate, _max_bitrate);
+      _last_decrease = now;
+    }
+
+    _loss = std::clamp(loss, 0.0, 1.0);
+    _fec_percentage = std::clamp(
+      _base_fec_percentage + (int) std::lround(_loss * 100 * fec_per_loss),
+      _base_fec_percentage,
+      std::max(_base_fec_percentage, max_fec_percentage)
+    );
+  }
+
+  int bitrate_controller_t::bitrate() const {
+    std::lock_guard lg {_lock};
+    return _bitrate;
+  }
+
+  double bitrate_controller_t::loss() const {
+    std::lock_guard lg {_lock};
+    return _loss;
+  }
+
+  int bitrate_controller_t::fec_percentage(bool recovery) const {
+    std::lock_guard lg {_lock};
+
+    if (!_per_frame_fec) {
+      return _fec_percentage;
+    }
+
+    auto loss_percentage = _loss * 100;
+    if (recovery) {
+      auto min = std::min(_base_fec_percentage * 2, fec_percentage_limit);
+      return std::clamp((int) std::lround(loss_percentage * recovery_fec_per_loss), min, std::max(min, max_recovery_fec_percentage));
+    }
+
+    auto min = std::max(1, _base_fec_percentage / normal_fec_divisor);
+    return std::clamp((int) std::lround(loss_percentage * normal_fec_per_loss), min, std::max(_base_fec_percentage, max_fec_percentage));
+  }
+}  // namespace stream
@@ -0,0 +1,127 @@
+/**
+ * @file src/bitrate_controller.h
+ * @brief Declarations for the congestion controller adapting the bitrate and FEC of a video stream.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace stream {
+  /**
+   * @brief Closed-loop congestion controller of a single video stream.
+   * @details Packet loss reported by the client, frames the client had to recover from, and the delay
+   *          of frames before they're sent drive an AIMD loop. The bitrate backs off multiplicatively when
+   *          the network falls behind, and creeps back up to the bitrate the client asked for once it keeps up.
+   *          The FEC percentage follows the loss rate, either for every frame alike, or per frame type:
+   *          ordinary frames get less FEC on a clean network, while frames the client recovers from loss with
+   *          get more, as losing one of those costs another recovery. The network estimator adds no FEC of its
+   *          own next to it, and only paces for the round-trip time and drain rate while the bitrate adapts.
+   *          The resolution follows the bitrate it settles on. All methods are thread-safe.
+   */
+  class bitrate_controller_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param max_bitrate The bitrate the client asked for in kilobits, which is never exceeded.
+     * @param fec_percentage The FEC percentage to use without loss.
+     *        It's never gone below, except for ordinary frames with per-frame FEC.
+     * @param adapt_bitrate Whether to adapt the bitrate, or only the FEC percentage.
+     * @param per_frame_fec Whether to pick the FEC percentage per frame type.
+     */
+    bitrate_controller_t(int max_bitrate, int fec_percentage, bool adapt_bitrate = true, bool per_frame_fec = false);
+
+    /**
+     * @brief Account for packets the client reported lost.
+     * @param packets The number of packets lost since the last report.
+     */
+    void packets_lost(int packets);
+
+    /**
+     * @brief Account for frames the client couldn't decode, and asked to recover from.
+     * @param frames The number of frames.
+     */
+    void frames_lost(int frames);
+
+    /**
+     * @brief Account for a frame handed to the network, and adapt to what was observed since the last update.
+     * @details Only the thread sending the video of the stream may call this.
+     * @param packets The number of packets of the frame, FEC included.
+     * @param queue_delay The time from capture until the frame was picked up for sending, unless it repeats the previous frame.
+     * @param now The current time.
+     * @return The new bitrate in kilobits, if it changed enough to reconfigure the encoder.
+     */
+    std::optional<int> frame_sent(int packets, std::optional<std::chrono::nanoseconds> queue_delay, clock::time_point now = clock::now());
+
+    /**
+     * @brief Change the limits of the stream, taking effect with the next update.
+     * @param max_bitrate The bitrate in kilobits which is never exceeded.
+     * @param fec_percentage The FEC percentage to use without loss.
+     */
+    void reconfigure(int max_bitrate, int fec_percentage);
+
+    /**
+     * @brief Start from what probing the network found, rather than from the maximum bitrate without loss.
+     * @details The bitrate only holds while adapting it, and is only climbed from once the increase hold passed.
+     * @param bitrate The bitrate in kilobits the encoder starts at.
+     * @param loss The share of the packets the network lost.
+     * @param now The current time.
+     */
+    void start_from(int bitrate, double loss, clock::time_point now = clock::now());
+
+    /**
+     * @brief Get the bitrate the encoder should use.
+     * @return The bitrate in kilobits.
+     */
+    int bitrate() const;
+
+    /**
+     * @brief Get the smoothed share of packets the network loses.
+     */
+    double loss() const;
+
+    /**
+     * @brief Get the FEC percentage the video sender should use for a frame.
+     * @param recovery Whether the frame is an IDR frame, the first frame after reference frame invalidation,
+     *        or the first frame of a wave of intra refresh.
+     * @return The percentage.
+     */
+    int fec_percentage(bool recovery = false) const;
+
+    // How often the bitrate and FEC are adapted
+    static constexpr auto update_interval = std::chrono::milliseconds {500};
+
+  private:
+    const bool _adapt_bitrate;
+    const bool _per_frame_fec;
+
+    mutable std::mutex _lock;
+    int _max_bitrate;
+    int _min_bitrate;
+    int _base_fec_percentage;
+
+    int _bitrate;
+    int _fec_percentage;
+
+    // The bitrate the encoder was last told about
+    int _encoder_bitrate;
+
+    // Observed since the last update
+    std::int64_t _packets_sent = 0;
+    std::int64_t _frames_sent = 0;
+    std::int64_t _packets_lost = 0;
+    std::int64_t _frames_lost = 0;
+    std::optional<std::chrono::nanoseconds> _window_min_queue_delay;
+
+    // Smoothed across updates
+    double _loss = 0;
+    std::optional<std::chrono::nanoseconds> _min_queue_delay;
+
+    std::optional<clock::time_point> _last_update;
+    std::optional<clock::time_point> _last_decrease;
+  };
+}  // namespace stream
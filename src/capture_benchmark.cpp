@@ -0,0 +1,368 @@
+/**
+ * @file src/capture_benchmark.cpp
+ * @brief Definitions for picking the capture method by benchmarking the available ones.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "capture_benchmark.h"
+#include "config.h"
+#include "display_device.h"
+#include "image_pool.h"
+#include "logging.h"
+#include "video.h"
+
+using namespace std::literals;
+
+namespace video {
+  namespace {
+    // Bump when the way the winner is picked changes
+    constexpr int cache_version = 1;
+
+    constexpr auto benchmark_duration = 2s;
+
+    std::chrono::nanoseconds average(const std::vector<std::chrono::nanoseconds> &durations) {
+      if (durations.empty()) {
+        return {};
+      }
+
+      std::chrono::nanoseconds total {};
+      for (auto duration : durations) {
+        total += duration;
+      }
+      return total / durations.size();
+    }
+
+    /**
+     * @brief Capture a display with the method in `config::video.capture` for a little while.
+     * @return The stats, or `std::nullopt` if the method can't capture the display.
+     */
+    std::optional<capture_stats_t> benchmark(platf::mem_type_e dev_type, const std::string &display_name, int framerate, std::chrono::nanoseconds duration) {
+      auto disp = platf::display(dev_type, display_name, {1920, 1080, framerate, 1000, 1, 0, 1, 0, 0, 0});
+      if (!disp) {
+        return std::nullopt;
+      }
+
+      // Frames are dropped as soon as they're delivered, so a few images are plenty
+      image_pool_t imgs {4, 3s};
+
+      std::vector<std::chrono::steady_clock::time_point> arrivals;
+      std::vector<std::chrono::nanoseconds> latencies;
+      std::vector<std::chrono::nanoseconds> call_latencies;
+      std::size_t duplicates = 0;
+
+      // When the backend last asked for an image to capture into
+      std::optional<std::chrono::steady_clock::time_point> pulled;
+
+      auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
+        img_out = imgs.acquire([&]() {
+          return disp->alloc_img();
+        }, 100ms);
+
+        if (!img_out) {
+          return false;
+        }
+
+        pulled = std::chrono::steady_clock::now();
+
+        img_out->frame_timestamp.reset();
+        img_out->damage.reset();
+        img_out->cursor.reset();
+        return true;
+      };
+
+      auto deadline = std::chrono::steady_clock::now() + duration;
+      auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        auto now = std::chrono::steady_clock::now();
+        if (frame_captured && img) {
+          arrivals.emplace_back(now);
+          if (img->frame_timestamp) {
+            latencies.emplace_back(now - *img->frame_timestamp);
+          }
+          if (pulled) {
+            call_latencies.emplace_back(now - *pulled);
+            pulled.reset();
+          }
+
+          // The backend knows nothing changed since the previous frame
+          if (img->damage && img->damage->empty()) {
+            ++duplicates;
+          }
+        }
+
+        return now < deadline;
+      };
+
+      auto cpu_start = platf::process_cpu_time();
+
+      bool cursor = true;
+      auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &cursor);
+      if (status != platf::capture_e::ok && status != platf::capture_e::timeout) {
+        return std::nullopt;
+      }
+
+      auto stats = summarize_capture(arrivals, latencies, platf::process_cpu_time() - cpu_start, std::chrono::nanoseconds {1s} / framerate);
+      stats.call_latency = average(call_latencies);
+      stats.duplicate_frames = duplicates;
+
+      return stats;
+    }
+
+    double to_ms(std::chrono::nanoseconds duration) {
+      return std::chrono::duration<double, std::milli> {duration}.count();
+    }
+
+    std::string_view mem_type_name(platf::mem_type_e dev_type) {
+      switch (dev_type) {
+        case platf::mem_type_e::system:
+          return "system"sv;
+        case platf::mem_type_e::vaapi:
+          return "vaapi"sv;
+        case platf::mem_type_e::dxgi:
+          return "dxgi"sv;
+        case platf::mem_type_e::cuda:
+          return "cuda"sv;
+        case platf::mem_type_e::videotoolbox:
+          return "videotoolbox"sv;
+        case platf::mem_type_e::vulkan:
+          return "vulkan"sv;
+        default:
+          return "unknown"sv;
+      }
+    }
+  }  // namespace
+
+  capture_stats_t summarize_capture(const std::vector<std::chrono::steady_clock::time_point> &arrivals, const std::vector<std::chrono::nanoseconds> &latencies, std::chrono::nanoseconds cpu_time, std::chrono::nanoseconds refresh_interval) {
+    capture_stats_t stats {arrivals.size(), average(latencies), {}, cpu_time};
+
+    if (arrivals.size() > 2) {
+      auto intervals = arrivals.size() - 1;
+      double mean = std::chrono::duration<double> {arrivals.back() - arrivals.front()}.count() / intervals;
+
+      double variance = 0;
+      for (std::size_t x = 1; x < arrivals.size(); ++x) {
+        auto deviation = std::chrono::duration<double> {arrivals[x] - arrivals[x - 1]}.count() - mean;
+        variance += deviation * deviation;
+      }
+
+      stats.jitter = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double> {std::sqrt(variance / intervals)});
+    }
+
+    if (arrivals.size() > 1) {
+      stats.fps = (arrivals.size() - 1) / std::chrono::duration<double> {arrivals.back() - arrivals.front()}.count();
+    }
+
+    // Every refresh that passed between two frames without one is a missed frame
+    if (refresh_interval > 0ns) {
+      for (std::size_t x = 1; x < arrivals.size(); ++x) {
+        auto refreshes = (std::size_t) std::llround(std::chrono::duration<double> {arrivals[x] - arrivals[x - 1]} / refresh_interval);
+        stats.missed_frames += std::max<std::size_t>(refreshes, 1) - 1;
+      }
+    }
+
+    if (!arrivals.empty()) {
+      stats.cpu_time /= arrivals.size();
+    }
+
+    return stats;
+  }
+
+  std::string pick_capture_method(const std::vector<std::pair<std::string, capture_stats_t>> &results) {
+    if (results.empty()) {
+      return {};
+    }
+
+    std::size_t max_frames = 0;
+    for (auto &[method, stats] : results) {
+      max_frames = std::max(max_frames, stats.frames);
+    }
+
+    // Nothing on the display changed, so there's nothing to tell the methods apart by
+    if (max_frames < 2) {
+      return results.front().first;
+    }
+
+    const std::pair<std::string, capture_stats_t> *best = nullptr;
+    std::chrono::nanoseconds best_cost {};
+    for (auto &result : results) {
+      auto &stats = result.second;
+
+      // A method that misses frames is never the fastest
+      if (stats.frames * 10 < max_frames * 9) {
+        continue;
+      }
+
+      auto cost = stats.latency + stats.jitter + stats.cpu_time;
+      if (!best || cost < best_cost) {
+        best = &result;
+        best_cost = cost;
+      }
+    }
+
+    return best->first;
+  }
+
+  std::optional<std::string> load_capture_method(const std::filesystem::path &file, const std::string &key) {
+    std::error_code ec;
+    if (key.empty() || !std::filesystem::exists(file, ec)) {
+      return std::nullopt;
+    }
+
+    try {
+      std::ifstream in {file};
+      auto root = nlohmann::json::parse(in);
+
+      if (root.value("version", 0) != cache_version || root.value("key", ""s) != key) {
+        BOOST_LOG(info) << "GPUs, drivers, displays or the encoder changed since the capture methods were last benchmarked"sv;
+        return std::nullopt;
+      }
+
+      return root.at("capture").get<std::string>();
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read "sv << file.string() << ": "sv << e.what();
+      return std::nullopt;
+    }
+  }
+
+  void save_capture_method(const std::filesystem::path &file, const std::string &key, const std::string &method) {
+    nlohmann::json root;
+    root["version"] = cache_version;
+    root["key"] = key;
+    root["capture"] = method;
+
+    // Write to a temporary file first, so a crash never leaves a truncated file behind
+    auto tmp_file = file;
+    tmp_file += ".tmp";
+
+    try {
+      {
+        std::ofstream out {tmp_file};
+        out << root.dump(4);
+        if (!out) {
+          throw std::runtime_error {"write failed"};
+        }
+      }
+
+      std::filesystem::rename(tmp_file, file);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't write "sv << file.string() << ": "sv << e.what();
+    }
+  }
+
+  std::vector<std::pair<std::string, capture_stats_t>> benchmark_capture_methods(platf::mem_type_e dev_type, const std::string &display_name, int framerate, std::chrono::nanoseconds duration) {
+    auto methods = platf::capture_methods();
+    auto previous_method = config::video.capture;
+
+    BOOST_LOG(info) << "Benchmarking "sv << methods.size() << " capture methods for "sv << std::chrono::duration_cast<std::chrono::seconds>(duration).count() << " seconds each"sv;
+
+    std::vector<std::pair<std::string, capture_stats_t>> results;
+    for (auto &method : methods) {
+      config::video.capture = method;
+
+      auto stats = benchmark(dev_type, display_name, framerate, duration);
+      if (!stats) {
+        BOOST_LOG(info) << "Capture method ["sv << method << "] can't capture the display"sv;
+        continue;
+      }
+
+      BOOST_LOG(info) << "Capture method ["sv << method << "]: "sv << stats->frames << " frames ("sv << stats->fps << " fps), latency "sv
+                      << to_ms(stats->latency) << "ms, capture call "sv << to_ms(stats->call_latency) << "ms, jitter "sv
+                      << to_ms(stats->jitter) << "ms, CPU "sv << to_ms(stats->cpu_time) << "ms per frame, "sv
+                      << stats->duplicate_frames << " duplicated and "sv << stats->missed_frames << " missed frames"sv;
+      results.emplace_back(method, *stats);
+    }
+
+    config::video.capture = previous_method;
+    return results;
+  }
+
+  int benchmark_capture(const std::vector<platf::mem_type_e> &dev_types, const std::filesystem::path &report_file, int framerate, std::chrono::seconds duration) {
+    const auto display_name {display_device::map_output_name(config::video.output_name)};
+
+    nlohmann::json root;
+    root["version"] = PROJECT_VERSION;
+    root["framerate"] = framerate;
+    root["results"] = nlohmann::json::array();
+
+    for (auto dev_type : dev_types) {
+      for (auto &[method, stats] : benchmark_capture_methods(dev_type, display_name, framerate, duration)) {
+        root["results"].push_back({
+          {"method", method},
+          {"memory", mem_type_name(dev_type)},
+          {"frames", stats.frames},
+          {"fps", stats.fps},
+          {"latency_ms", to_ms(stats.latency)},
+          {"call_latency_ms", to_ms(stats.call_latency)},
+          {"jitter_ms", to_ms(stats.jitter)},
+          {"cpu_ms_per_frame", to_ms(stats.cpu_time)},
+          {"duplicate_frames", stats.duplicate_frames},
+          {"missed_frames", stats.missed_frames},
+        });
+      }
+    }
+
+    if (root["results"].empty()) {
+      BOOST_LOG(error) << "No capture method could capture the display"sv;
+      return -1;
+    }
+
+    try {
+      std::ofstream out {report_file};
+      out << root.dump(4);
+      if (!out) {
+        throw std::runtime_error {"write failed"};
+      }
+    } catch (std::exception &e) {
+      BOOST_LOG(error) << "Couldn't write "sv << report_file.string() << ": "sv << e.what();
+      return -1;
+    }
+
+    BOOST_LOG(info) << "Wrote the results of "sv << root["results"].size() << " benchmarks to "sv << report_file.string();
+    return 0;
+  }
+
+  void select_capture_method(platf::mem_type_e dev_type, const std::string &encoder_name, const std::string &display_name) {
+    if (!config::video.capture_benchmark) {
+      return;
+    }
+
+    // Without a fingerprint of the hardware, there's no telling when the winner is stale
+    std::string key;
+    if (auto fingerprint = platf::encoder_probe_fingerprint(); !fingerprint.empty()) {
+      key = fingerprint + "\nencoder "s + encoder_name + "\ndisplay "s + display_name;
+    }
+
+    auto file = platf::appdata() / "capture_benchmark.json";
+    if (auto method = load_capture_method(file, key)) {
+      BOOST_LOG(info) << "Capturing with ["sv << *method << "], the fastest method when last benchmarked"sv;
+      config::video.capture = *method;
+      return;
+    }
+
+    config::video.capture.clear();
+    if (platf::capture_methods().size() < 2) {
+      return;
+    }
+
+    auto results = benchmark_capture_methods(dev_type, display_name, 60, benchmark_duration);
+
+    // Fall back to the automatic order when none could capture
+    config::video.capture = pick_capture_method(results);
+    if (config::video.capture.empty()) {
+      return;
+    }
+
+    BOOST_LOG(info) << "Capturing with ["sv << config::video.capture << "], the fastest method"sv;
+    if (!key.empty()) {
+      save_capture_method(file, key, config::video.capture);
+    }
+  }
+}  // namespace video
@@ -0,0 +1,97 @@
+/**
+ * @file src/capture_benchmark.h
+ * @brief Declarations for picking the capture method by benchmarking the available ones.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace video {
+  /**
+   * @brief What capturing a display with one method cost.
+   */
+  struct capture_stats_t {
+    std::size_t frames;  ///< The number of frames delivered.
+    std::chrono::nanoseconds latency;  ///< The average time from a frame being displayed to it being delivered.
+    std::chrono::nanoseconds jitter;  ///< The standard deviation of the time between frames.
+    std::chrono::nanoseconds cpu_time;  ///< The CPU time of the process per frame.
+    std::chrono::nanoseconds call_latency {};  ///< The average time from the backend asking for an image to capture into to the frame being delivered.
+    double fps {};  ///< The number of frames delivered per second.
+    std::size_t duplicate_frames {};  ///< The number of frames delivered that the backend knew were the same as the previous one.
+    std::size_t missed_frames {};  ///< The number of refreshes of the display that passed without a frame being delivered.
+  };
+
+  /**
+   * @brief Summarize the frames delivered during a benchmark.
+   * @param arrivals When each frame was delivered.
+   * @param latencies The latency of each frame that had a timestamp.
+   * @param cpu_time The CPU time the process used during the benchmark.
+   * @param refresh_interval The time between refreshes of the display, to count the missed frames by, or zero not to.
+   */
+  capture_stats_t summarize_capture(const std::vector<std::chrono::steady_clock::time_point> &arrivals, const std::vector<std::chrono::nanoseconds> &latencies, std::chrono::nanoseconds cpu_time, std::chrono::nanoseconds refresh_interval = {});
+
+  /**
+   * @brief Pick the fastest capture method.
+   * @details Methods that delivered less than 90% of the frames of the best one are dropped.
+   *          Of the others, the one with the lowest sum of latency, jitter and CPU time per frame wins.
+   *          Without at least two frames from any method, the first one wins.
+   * @param results The stats of every method that could be set up, in order of preference.
+   * @return The method, or an empty string if there are none.
+   */
+  std::string pick_capture_method(const std::vector<std::pair<std::string, capture_stats_t>> &results);
+
+  /**
+   * @brief Get the method that won the last benchmark.
+   * @param file The file the winner is persisted in.
+   * @param key The key the benchmark must have been run for.
+   * @return The method, or `std::nullopt` if it has to be benchmarked again.
+   */
+  std::optional<std::string> load_capture_method(const std::filesystem::path &file, const std::string &key);
+
+  /**
+   * @brief Persist the winner of a benchmark.
+   * @param file The file the winner is persisted in.
+   * @param key The key the benchmark was run for.
+   * @param method The method.
+   */
+  void save_capture_method(const std::filesystem::path &file, const std::string &key, const std::string &method);
+
+  /**
+   * @brief Capture a display with every capture method available for a while.
+   * @details `config::video.capture` is left as it was.
+   * @param dev_type The memory type to capture into.
+   * @param display_name The display to capture.
+   * @param framerate The framerate to capture at, which the missed frames are counted against.
+   * @param duration How long to capture with each method.
+   * @return The stats of every method that could capture the display, in order of preference.
+   */
+  std::vector<std::pair<std::string, capture_stats_t>> benchmark_capture_methods(platf::mem_type_e dev_type, const std::string &display_name, int framerate, std::chrono::nanoseconds duration);
+
+  /**
+   * @brief Benchmark every capture method with every memory type given, and write a JSON report.
+   * @param dev_types The memory types to capture into, e.g. those of the encoders.
+   * @param report_file Where to write the report.
+   * @param framerate The framerate to capture at.
+   * @param duration How long to capture with each method and memory type.
+   * @return 0 on success, or -1 if no method could capture the display.
+   */
+  int benchmark_capture(const std::vector<platf::mem_type_e> &dev_types, const std::filesystem::path &report_file, int framerate, std::chrono::seconds duration);
+
+  /**
+   * @brief Benchmark every capture method available and set `config::video.capture` to the fastest.
+   * @details The winner is reused until the GPUs, drivers, displays or the encoder change.
+   * @param dev_type The memory type of the encoder the frames are captured for.
+   * @param encoder_name The name of the encoder.
+   * @param display_name The display to capture.
+   */
+  void select_capture_method(platf::mem_type_e dev_type, const std::string &encoder_name, const std::string &display_name);
+}  // namespace video
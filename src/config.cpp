@@ -4,10 +4,13 @@
  */
 // standard includes
 #include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <unordered_map>
 #include <utility>
@@ -66,6 +69,20 @@ namespace config {
       return nvenc::nvenc_two_pass::quarter_resolution;
     }
 
+    nvenc::nvenc_split_encode split_encode_from_view(const ::std::string_view &mode) {
+      if (mode == "disabled") {
+        return nvenc::nvenc_split_encode::disabled;
+      }
+      if (mode == "auto") {
+        return nvenc::nvenc_split_encode::automatic;
+      }
+      if (mode == "forced") {
+        return nvenc::nvenc_split_encode::forced;
+      }
+      BOOST_LOG(warning) << "config: unknown nvenc_split_encode value: " << mode;
+      return nvenc::nvenc_split_encode::disabled;
+    }
+
   }  // namespace nv
 
   namespace amd {
@@ -356,6 +373,27 @@ namespace config {
     }
   }  // namespace sw
 
+  video_t::screen_content_e screen_content_from_view(const ::std::string_view value) {
+    if (value == "auto"sv) {
+      return video_t::screen_content_e::automatic;
+    }
+    if (value == "enabled"sv) {
+      return video_t::screen_content_e::enabled;
+    }
+    return video_t::screen_content_e::disabled;  // Default to this if value is invalid
+  }
+
+  stream_t::thread_affinity_e thread_affinity_from_view(const ::std::string_view value) {
+#define _CONVERT_(x) \
+  if (value == #x##sv) \
+  return stream_t::thread_affinity_e::x
+    _CONVERT_(disabled);
+    _CONVERT_(performance_cores);
+    _CONVERT_(shared_cache);
+#undef _CONVERT_
+    return stream_t::thread_affinity_e::disabled;  // Default to this if value is invalid
+  }
+
   namespace dd {
     video_t::dd_t::config_option_e config_option_from_view(const ::std::string_view value) {
 #define _CONVERT_(x) \
@@ -447,16 +485,26 @@ namespace config {
     0,  // av1_mode
 
     2,  // min_threads
+
+    0,  // intra_refresh_frames
+    false,  // temporal_layers
+    video_t::screen_content_e::disabled,  // screen_content
+    false,  // adaptive_chroma
+
+    0,  // roi_qp_offset
+    {},  // roi_regions
     {
       "superfast"s,  // preset
       "zerolatency"s,  // tune
       11,  // superfast
+      true,  // auto_tune
     },  // software
 
     {},  // nv
     true,  // nv_realtime_hags
     true,  // nv_opengl_vulkan_on_dxgi
     true,  // nv_sunshine_high_power_mode
+    1,  // nv_pipeline_depth
     {},  // nv_legacy
 
     {
@@ -493,6 +541,12 @@ namespace config {
     },  // vaapi
 
     {},  // capture
+    false,  // capture_benchmark
+    false,  // kms_vblank
+    3,  // wayland_capture_buffers
+    false,  // dxgi_vblank
+    2,  // wgc_capture_buffers
+    3,  // sck_capture_buffers
     {},  // encoder
     {},  // adapter_name
     {},  // output_name
@@ -512,9 +566,24 @@ namespace config {
 
     0,  // max_bitrate
     0,  // minimum_fps_target (0 = framerate)
+    0,  // static_frame_repeats (0 = unlimited)
+    false,  // shared_encoder
+    60,  // encoder_pool_timeout
+    0,  // frame_memory_budget
+    false,  // encoder_load_balancing
+    false,  // encoder_step_down
+    false,  // dynamic_resolution
+    0,  // max_sessions_per_gpu (0 = unlimited)
+    0,  // max_encode_rate (0 = unlimited)
+    0,  // max_egress_bitrate (0 = unlimited)
+    1,  // max_app_instances
+    false,  // hdr_tone_mapping
+    203,  // sdr_white_level
+    0,  // standby_displays
 
     "1920x1080x60",  // fallback_mode
     false, // isolated Display
+    0,  // vdisplay_pool_size
     false, // ignore_encoder_probe_failure
   };
 
@@ -525,17 +594,51 @@ namespace config {
     true,  // install_steam_drivers
     true, // keep_sink_default
     true, // auto_capture
+    "pipewire",  // backend
+    10,  // opus_complexity
+    false,  // shared_encoder
+    false,  // adaptive_audio
   };
 
   stream_t stream {
     10s,  // ping_timeout
+    0ms,  // suspend_timeout
 
     APPS_JSON_PATH,
 
     20,  // fecPercentage
+    false,  // adaptive_bitrate
+    false,  // dynamic_fec
+    false,  // adaptive_pacing
+    false,  // bandwidth_probe
+    0,  // pacing_spread
+    0,  // pacing_spread_idr
+    0ms,  // max_frame_latency
 
     ENCRYPTION_MODE_NEVER,  // lan_encryption_mode
     ENCRYPTION_MODE_OPPORTUNISTIC,  // wan_encryption_mode
+
+    0,  // video_send_threads
+    0,  // fec_worker_threads
+    false,  // pacing_spin
+    false,  // pacing_realtime
+    false,  // kernel_pacing
+    false,  // video_zerocopy
+    false,  // registered_io
+    {},  // xdp_interface
+    false,  // session_sockets
+    false,  // interface_failover
+    false,  // performance_mode
+    stream_t::thread_affinity_e::disabled,  // thread_affinity
+    0,  // app_reserved_cores
+    100,  // app_cpu_weight
+    false,  // async_app_launch
+
+    {},  // video_trace_dir
+    {},  // video_trace_replay
+    true,  // video_trace_replay_realtime
+
+    {},  // recording_dir
   };
 
   nvhttp_t nvhttp {
@@ -547,6 +650,8 @@ namespace config {
     platf::get_host_name(),  // sunshine_name,
     "sunshine_state.json"s,  // file_state
     {},  // external_ip
+    4,  // https_threads
+    false,  // shared_state
   };
 
   input_t input {
@@ -558,6 +663,9 @@ namespace config {
     -1ms,  // back_button_timeout
     500ms,  // key_repeat_delay
     std::chrono::duration<double> {1 / 24.9},  // key_repeat_period
+    0ns,  // motion_interval
+    0ns,  // gamepad_report_interval
+    0,  // gamepad_pool
 
     {
       platf::supported_gamepads(nullptr).front().name.data(),
@@ -603,6 +711,62 @@ namespace config {
     {},  // server commands
   };
 
+  namespace {
+    runtime_t runtime_from_globals() {
+      return runtime_t {
+        0,
+        stream.fec_percentage,
+        video.max_bitrate,
+        stream.pacing_spread,
+        stream.pacing_spread_idr,
+        sunshine.min_log_level,
+      };
+    }
+
+    // What reloads start from, before the config file and command line apply
+    const runtime_t runtime_defaults = runtime_from_globals();
+
+    std::atomic<std::shared_ptr<const runtime_t>> current_runtime {std::make_shared<const runtime_t>(runtime_defaults)};
+    std::atomic<std::uint64_t> current_runtime_version {0};
+
+    // Serializes the publishers of snapshots, and guards the listeners and the options of the command line
+    std::mutex runtime_mutex;
+    std::vector<std::function<void(const runtime_t &, const runtime_t &)>> runtime_listeners;
+    std::unordered_map<std::string, std::string> cmd_line_vars;
+
+    void publish_runtime(runtime_t runtime) {
+      std::lock_guard lg {runtime_mutex};
+
+      auto previous = current_runtime.load();
+      runtime.version = previous->version;
+      if (runtime == *previous) {
+        return;
+      }
+
+      ++runtime.version;
+      auto next = std::make_shared<const runtime_t>(runtime);
+      current_runtime.store(next);
+      current_runtime_version.store(runtime.version, std::memory_order_release);
+
+      for (auto &listener : runtime_listeners) {
+        listener(*previous, *next);
+      }
+    }
+  }  // namespace
+
+  std::shared_ptr<const runtime_t> runtime() {
+    return current_runtime.load();
+  }
+
+  std::uint64_t runtime_version() {
+    return current_runtime_version.load(std::memory_order_acquire);
+  }
+
+  void on_runtime_change(std::function<void(const runtime_t &previous, const runtime_t &current)> &&listener) {
+    std::lock_guard lg {runtime_mutex};
+    runtime_listeners.emplace_back(std::move(listener));
+  }
+
   bool endline(char ch) {
     return ch == '\r' || ch == '\n';
   }
@@ -968,7 +1132,9 @@ namespace config {
       auto undo_cmd = prep_cmd.get_optional<std::string>("undo"s);
       auto elevated = prep_cmd.get_optional<bool>("elevated"s);
 
-      input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      auto &cmd = input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      cmd.parallel = prep_cmd.get_optional<bool>("parallel"s).value_or(false);
+      cmd.timeout = std::chrono::seconds {std::max(prep_cmd.get_optional<int>("timeout"s).value_or(0), 0)};
     }
   }
 
@@ -1087,6 +1253,43 @@ namespace config {
     return opts;
   }
 
+  /**
+   * @brief Parse the settings that apply without a restart.
+   */
+  void apply_runtime(std::unordered_map<std::string, std::string> &vars, runtime_t &runtime) {
+    int_between_f(vars, "fec_percentage", runtime.fec_percentage, {1, 255});
+    int_f(vars, "max_bitrate", runtime.max_bitrate);
+    int_between_f(vars, "pacing_spread", runtime.pacing_spread, {0, 100});
+    int_between_f(vars, "pacing_spread_idr", runtime.pacing_spread_idr, {0, 100});
+
+    std::string log_level_string;
+    string_f(vars, "min_log_level", log_level_string);
+
+    if (!log_level_string.empty()) {
+      if (log_level_string == "verbose"sv) {
+        runtime.min_log_level = 0;
+      } else if (log_level_string == "debug"sv) {
+        runtime.min_log_level = 1;
+      } else if (log_level_string == "info"sv) {
+        runtime.min_log_level = 2;
+      } else if (log_level_string == "warning"sv) {
+        runtime.min_log_level = 3;
+      } else if (log_level_string == "error"sv) {
+        runtime.min_log_level = 4;
+      } else if (log_level_string == "fatal"sv) {
+        runtime.min_log_level = 5;
+      } else if (log_level_string == "none"sv) {
+        runtime.min_log_level = 6;
+      } else {
+        // accept digit directly
+        auto val = log_level_string[0];
+        if (val >= '0' && val < '7') {
+          runtime.min_log_level = val - '0';
+        }
+      }
+    }
+  }
+
   void apply_config(std::unordered_map<std::string, std::string> &&vars) {
 #ifndef __ANDROID__
     // TODO: Android can possibly support this
@@ -1104,6 +1307,14 @@ namespace config {
       modified_config_settings[name] = val;
     }
 
+    auto runtime = runtime_from_globals();
+    apply_runtime(vars, runtime);
+    stream.fec_percentage = runtime.fec_percentage;
+    video.max_bitrate = runtime.max_bitrate;
+    stream.pacing_spread = runtime.pacing_spread;
+    stream.pacing_spread_idr = runtime.pacing_spread_idr;
+    sunshine.min_log_level = runtime.min_log_level;
+
     bool_f(vars, "headless_mode", video.headless_mode);
     bool_f(vars, "limit_framerate", video.limit_framerate);
     bool_f(vars, "double_refreshrate", video.double_refreshrate);
@@ -1111,11 +1322,25 @@ namespace config {
     int_between_f(vars, "hevc_mode", video.hevc_mode, {0, 3});
     int_between_f(vars, "av1_mode", video.av1_mode, {0, 3});
     int_f(vars, "min_threads", video.min_threads);
+    int_between_f(vars, "intra_refresh_frames", video.intra_refresh_frames, {0, 600});
+    if (video.intra_refresh_frames == 1) {
+      video.intra_refresh_frames = 2;
+    }
+    bool_f(vars, "temporal_layers", video.temporal_layers);
+    generic_f(vars, "screen_content", video.screen_content, screen_content_from_view);
+    bool_f(vars, "adaptive_chroma", video.adaptive_chroma);
+    int_between_f(vars, "roi_qp_offset", video.roi_qp_offset, {-25, 0});
+    list_int_f(vars, "roi_regions", video.roi_regions);
+    if (video.roi_regions.size() % 4) {
+      BOOST_LOG(warning) << "roi_regions needs 4 values per region, ignoring the incomplete one"sv;
+      video.roi_regions.resize(video.roi_regions.size() / 4 * 4);
+    }
     string_f(vars, "sw_preset", video.sw.sw_preset);
     if (!video.sw.sw_preset.empty()) {
       video.sw.svtav1_preset = sw::svtav1_preset_from_view(video.sw.sw_preset);
     }
     string_f(vars, "sw_tune", video.sw.sw_tune);
+    bool_f(vars, "sw_auto_tune", video.sw.auto_tune);
 
     int_between_f(vars, "nvenc_preset", video.nv.quality_preset, {1, 7});
     int_between_f(vars, "nvenc_vbv_increase", video.nv.vbv_percentage_increase, {0, 400});
@@ -1123,11 +1348,17 @@ namespace config {
     generic_f(vars, "nvenc_twopass", video.nv.two_pass, nv::twopass_from_view);
     bool_f(vars, "nvenc_h264_cavlc", video.nv.h264_cavlc);
     bool_f(vars, "nvenc_intra_refresh", video.nv.intra_refresh);
+    bool_f(vars, "nvenc_subframe_output", video.nv.subframe_output);
+    generic_f(vars, "nvenc_split_encode", video.nv.split_encode, nv::split_encode_from_view);
     bool_f(vars, "nvenc_realtime_hags", video.nv_realtime_hags);
     bool_f(vars, "nvenc_opengl_vulkan_on_dxgi", video.nv_opengl_vulkan_on_dxgi);
     bool_f(vars, "nvenc_latency_over_power", video.nv_sunshine_high_power_mode);
+    int_between_f(vars, "nvenc_pipeline_depth", video.nv_pipeline_depth, {1, 4});
 
 #if !defined(__ANDROID__) && !defined(__APPLE__)
+    video.nv.intra_refresh_frames = video.intra_refresh_frames;
+    video.nv.temporal_layers = video.temporal_layers;
+    video.nv.qp_delta_map = video.roi_qp_offset != 0;
     video.nv_legacy.preset = video.nv.quality_preset + 11;
     video.nv_legacy.multipass = video.nv.two_pass == nvenc::nvenc_two_pass::quarter_resolution ? NV_ENC_TWO_PASS_QUARTER_RESOLUTION :
                                 video.nv.two_pass == nvenc::nvenc_two_pass::full_resolution    ? NV_ENC_TWO_PASS_FULL_RESOLUTION :
@@ -1178,6 +1409,15 @@ namespace config {
     bool_f(vars, "vaapi_strict_rc_buffer", video.vaapi.strict_rc_buffer);
 
     string_f(vars, "capture", video.capture);
+    video.capture_benchmark = video.capture == "benchmark"sv;
+    if (video.capture_benchmark) {
+      video.capture.clear();
+    }
+    bool_f(vars, "kms_vblank", video.kms_vblank);
+    int_between_f(vars, "wayland_capture_buffers", video.wayland_capture_buffers, {1, 8});
+    bool_f(vars, "dxgi_vblank", video.dxgi_vblank);
+    int_between_f(vars, "wgc_capture_buffers", video.wgc_capture_buffers, {1, 8});
+    int_between_f(vars, "sck_capture_buffers", video.sck_capture_buffers, {3, 8});
     string_f(vars, "encoder", video.encoder);
     string_f(vars, "adapter_name", video.adapter_name);
     string_f(vars, "output_name", video.output_name);
@@ -1203,11 +1443,25 @@ namespace config {
       video.dd.wa.hdr_toggle_delay = std::chrono::milliseconds {value};
     }
 
-    int_f(vars, "max_bitrate", video.max_bitrate);
     double_between_f(vars, "minimum_fps_target", video.minimum_fps_target, {0.0, 1000.0});
+    int_between_f(vars, "static_frame_repeats", video.static_frame_repeats, {0, 1000});
+    bool_f(vars, "shared_encoder", video.shared_encoder);
+    int_between_f(vars, "encoder_pool_timeout", video.encoder_pool_timeout, {0, 600});
+    int_between_f(vars, "frame_memory_budget", video.frame_memory_budget, {0, 1024 * 1024});
+    bool_f(vars, "encoder_load_balancing", video.encoder_load_balancing);
+    bool_f(vars, "encoder_step_down", video.encoder_step_down);
+    bool_f(vars, "dynamic_resolution", video.dynamic_resolution);
+    int_between_f(vars, "max_sessions_per_gpu", video.max_sessions_per_gpu, {0, 64});
+    int_between_f(vars, "max_encode_rate", video.max_encode_rate, {0, 100000});
+    int_between_f(vars, "max_egress_bitrate", video.max_egress_bitrate, {0, 100000});
+    int_between_f(vars, "max_app_instances", video.max_app_instances, {1, 8});
+    bool_f(vars, "hdr_tone_mapping", video.hdr_tone_mapping);
+    int_between_f(vars, "sdr_white_level", video.sdr_white_level, {80, 480});
+    int_between_f(vars, "standby_displays", video.standby_displays, {0, 4});
 
     string_f(vars, "fallback_mode", video.fallback_mode);
     bool_f(vars, "isolated_virtual_display_option", video.isolated_virtual_display_option);
+    int_between_f(vars, "vdisplay_pool_size", video.vdisplay_pool_size, {0, 8});
     bool_f(vars, "ignore_encoder_probe_failure", video.ignore_encoder_probe_failure);
 
     path_f(vars, "pkey", nvhttp.pkey);
@@ -1221,6 +1475,8 @@ namespace config {
     path_f(vars, "credentials_file", config::sunshine.credentials_file);
 
     string_f(vars, "external_ip", nvhttp.external_ip);
+    int_between_f(vars, "https_threads", nvhttp.https_threads, {1, 32});
+    bool_f(vars, "shared_state", nvhttp.shared_state);
     list_prep_cmd_f(vars, "global_prep_cmd", config::sunshine.prep_cmds);
     list_prep_cmd_f(vars, "global_state_cmd", config::sunshine.state_cmds);
     list_server_cmd_f(vars, "server_cmd", config::sunshine.server_cmds);
@@ -1231,6 +1487,10 @@ namespace config {
     bool_f(vars, "install_steam_audio_drivers", audio.install_steam_drivers);
     bool_f(vars, "keep_sink_default", audio.keep_default);
     bool_f(vars, "auto_capture_sink", audio.auto_capture);
+    string_restricted_f(vars, "audio_backend", audio.backend, {"pipewire"sv, "pulseaudio"sv});
+    int_between_f(vars, "opus_complexity", audio.opus_complexity, {0, 10});
+    bool_f(vars, "shared_audio_encoder", audio.shared_encoder);
+    bool_f(vars, "adaptive_audio", audio.adaptive);
 
     string_restricted_f(vars, "origin_web_ui_allowed", nvhttp.origin_web_ui_allowed, {"pc"sv, "lan"sv, "wan"sv});
 
@@ -1240,11 +1500,54 @@ namespace config {
       stream.ping_timeout = std::chrono::milliseconds(to);
     }
 
+    int suspend_timeout = -1;
+    int_between_f(vars, "suspend_timeout", suspend_timeout, {0, std::numeric_limits<int>::max()});
+    if (suspend_timeout != -1) {
+      stream.suspend_timeout = std::chrono::milliseconds(suspend_timeout);
+    }
+
     int_between_f(vars, "lan_encryption_mode", stream.lan_encryption_mode, {0, 2});
     int_between_f(vars, "wan_encryption_mode", stream.wan_encryption_mode, {0, 2});
 
     path_f(vars, "file_apps", stream.file_apps);
-    int_between_f(vars, "fec_percentage", stream.fec_percentage, {1, 255});
+    bool_f(vars, "adaptive_bitrate", stream.adaptive_bitrate);
+    bool_f(vars, "dynamic_fec", stream.dynamic_fec);
+    bool_f(vars, "adaptive_pacing", stream.adaptive_pacing);
+    bool_f(vars, "bandwidth_probe", stream.bandwidth_probe);
+
+    int max_frame_latency = 0;
+    int_between_f(vars, "max_frame_latency", max_frame_latency, {0, 1000});
+    stream.max_frame_latency = std::chrono::milliseconds {max_frame_latency};
+    int_between_f(vars, "video_send_threads", stream.video_send_threads, {0, 16});
+    int_between_f(vars, "fec_worker_threads", stream.fec_worker_threads, {0, 8});
+    bool_f(vars, "pacing_spin", stream.pacing_spin);
+    bool_f(vars, "pacing_realtime", stream.pacing_realtime);
+    bool_f(vars, "kernel_pacing", stream.kernel_pacing);
+    bool_f(vars, "video_zerocopy", stream.video_zerocopy);
+    bool_f(vars, "registered_io", stream.registered_io);
+    string_f(vars, "xdp_interface", stream.xdp_interface);
+    bool_f(vars, "session_sockets", stream.session_sockets);
+    bool_f(vars, "interface_failover", stream.interface_failover);
+    bool_f(vars, "performance_mode", stream.performance_mode);
+    generic_f(vars, "thread_affinity", stream.thread_affinity, thread_affinity_from_view);
+    int_between_f(vars, "app_reserved_cores", stream.app_reserved_cores, {0, 64});
+    int_between_f(vars, "app_cpu_weight", stream.app_cpu_weight, {1, 10000});
+    bool_f(vars, "async_app_launch", stream.async_app_launch);
+
+    // Relative paths are in the config directory, but empty ones stay empty as they disable tracing
+    string_f(vars, "video_trace_dir", stream.video_trace_dir);
+    if (!stream.video_trace_dir.empty()) {
+      path_f(vars, "video_trace_dir", stream.video_trace_dir);
+    }
+    string_f(vars, "video_trace_replay", stream.video_trace_replay);
+    if (!stream.video_trace_replay.empty()) {
+      path_f(vars, "video_trace_replay", stream.video_trace_replay);
+    }
+    bool_f(vars, "video_trace_replay_realtime", stream.video_trace_replay_realtime);
+    string_f(vars, "recording_dir", stream.recording_dir);
+    if (!stream.recording_dir.empty()) {
+      path_f(vars, "recording_dir", stream.recording_dir);
+    }
 
     map_int_int_f(vars, "keybindings"s, input.keybindings);
 
@@ -1283,6 +1586,20 @@ namespace config {
     bool_f(vars, "touchpad_as_ds4", input.touchpad_as_ds4);
     bool_f(vars, "ds5_inputtino_randomize_mac", input.ds5_inputtino_randomize_mac);
 
+    int motion_rate_limit = 0;
+    int_between_f(vars, "motion_rate_limit", motion_rate_limit, {0, 10000});
+    if (motion_rate_limit > 0) {
+      input.motion_interval = std::chrono::nanoseconds {1s} / motion_rate_limit;
+    }
+
+    int gamepad_rate_limit = 0;
+    int_between_f(vars, "gamepad_rate_limit", gamepad_rate_limit, {0, 10000});
+    if (gamepad_rate_limit > 0) {
+      input.gamepad_report_interval = std::chrono::nanoseconds {1s} / gamepad_rate_limit;
+    }
+
+    int_between_f(vars, "gamepad_pool", input.gamepad_pool, {0, 16});
+
     bool_f(vars, "mouse", input.mouse);
     bool_f(vars, "keyboard", input.keyboard);
     bool_f(vars, "controller", input.controller);
@@ -1340,33 +1657,6 @@ namespace config {
                                                                    "zh_TW"sv,  // Chinese (Traditional)
                                                                  });
 
-    std::string log_level_string;
-    string_f(vars, "min_log_level", log_level_string);
-
-    if (!log_level_string.empty()) {
-      if (log_level_string == "verbose"sv) {
-        sunshine.min_log_level = 0;
-      } else if (log_level_string == "debug"sv) {
-        sunshine.min_log_level = 1;
-      } else if (log_level_string == "info"sv) {
-        sunshine.min_log_level = 2;
-      } else if (log_level_string == "warning"sv) {
-        sunshine.min_log_level = 3;
-      } else if (log_level_string == "error"sv) {
-        sunshine.min_log_level = 4;
-      } else if (log_level_string == "fatal"sv) {
-        sunshine.min_log_level = 5;
-      } else if (log_level_string == "none"sv) {
-        sunshine.min_log_level = 6;
-      } else {
-        // accept digit directly
-        auto val = log_level_string[0];
-        if (val >= '0' && val < '7') {
-          sunshine.min_log_level = val - '0';
-        }
-      }
-    }
-
     auto it = vars.find("flags"s);
     if (it != std::end(vars)) {
       apply_flags(it->second.c_str());
@@ -1382,6 +1672,36 @@ namespace config {
 
     ::video::active_hevc_mode = video.hevc_mode;
     ::video::active_av1_mode = video.av1_mode;
+
+    publish_runtime(runtime);
+  }
+
+  int reload_runtime() {
+    std::unordered_map<std::string, std::string> vars;
+    try {
+      vars = parse_config(file_handler::read_file(sunshine.config_file.c_str()));
+    } catch (const std::exception &e) {
+      BOOST_LOG(error) << "Couldn't reload the config: "sv << e.what();
+      return -1;
+    }
+
+    {
+      std::lock_guard lg {runtime_mutex};
+      for (auto &[name, value] : cmd_line_vars) {
+        vars.insert_or_assign(name, value);
+      }
+    }
+
+    auto runtime = runtime_defaults;
+    apply_runtime(vars, runtime);
+
+    auto version = runtime_version();
+    publish_runtime(runtime);
+    if (runtime_version() != version) {
+      BOOST_LOG(info) << "Reloaded the config, sessions pick up the FEC, bitrate limit, pacing and log level from it"sv;
+    }
+
+    return 0;
   }
 
   int parse(int argc, char *argv[]) {
@@ -1458,6 +1778,11 @@ namespace config {
       // Read config file
       auto vars = parse_config(file_handler::read_file(sunshine.config_file.c_str()));
 
+      {
+        std::lock_guard lg {runtime_mutex};
+        cmd_line_vars = cmd_vars;
+      }
+
       for (auto &[name, value] : cmd_vars) {
         vars.insert_or_assign(std::move(name), std::move(value));
       }
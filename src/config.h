@@ -7,6 +7,9 @@
 // standard includes
 #include <bitset>
 #include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -20,6 +23,15 @@ namespace config {
   inline std::unordered_map<std::string, std::string> modified_config_settings;
 
   struct video_t {
+    /**
+     * @brief When text and UI are encoded with the screen content tools.
+     */
+    enum class screen_content_e : int {
+      disabled,  ///< Never
+      automatic,  ///< While the stream is mostly static, see screen_content::detector_t
+      enabled,  ///< Always
+    };
+
     bool headless_mode;
     bool limit_framerate;
     bool double_refreshrate;
@@ -31,16 +43,26 @@ namespace config {
 
     int min_threads;  // Minimum number of threads/slices for CPU encoding
 
+    int intra_refresh_frames;  // Answer keyframe requests with intra refresh spread over this many frames, 0 to disable
+    bool temporal_layers;  // Encode every other frame as a non-reference frame, which the network drops first
+    screen_content_e screen_content;
+    bool adaptive_chroma;  // Encode streams the client asked 4:4:4 of in 4:2:0 while they're moving, see screen_content::detector_t
+
+    int roi_qp_offset;  // QP offset of the regions viewers look at, negative for more bits, 0 to disable
+    std::vector<int> roi_regions;  // Regions with text or UI as x, y, width, height in pixels of the display
+
     struct {
       std::string sw_preset;
       std::string sw_tune;
       std::optional<int> svtav1_preset;
+      bool auto_tune;  // Pick the threads and preset from the host and the stream, and step the preset down on overruns
     } sw;
 
     nvenc::nvenc_config nv;
     bool nv_realtime_hags;
     bool nv_opengl_vulkan_on_dxgi;
     bool nv_sunshine_high_power_mode;
+    int nv_pipeline_depth;
 
     struct {
       int preset;
@@ -84,6 +106,12 @@ namespace config {
     } vaapi;
 
     std::string capture;
+    bool capture_benchmark;  ///< Pick `capture` by benchmarking the available methods.
+    bool kms_vblank;  ///< Synchronize KMS capture to the vblank of the captured display.
+    int wayland_capture_buffers;  ///< Number of buffers in the Wayland capture ring.
+    bool dxgi_vblank;  ///< Synchronize Windows capture to the vblank of the captured display.
+    int wgc_capture_buffers;  ///< Number of buffers in the Windows.Graphics.Capture frame pool.
+    int sck_capture_buffers;  ///< Queue depth of the ScreenCaptureKit stream.
     std::string encoder;
     std::string adapter_name;
     std::string output_name;
@@ -145,9 +173,24 @@ namespace config {
 
     int max_bitrate;  // Maximum bitrate, sets ceiling in kbps for bitrate requested from client
     double minimum_fps_target;  ///< Lowest framerate that will be used when streaming. Range 0-1000, 0 = half of client's requested framerate.
+    int static_frame_repeats;  ///< Duplicates of a static frame to send before sending nothing. Range 0-1000, 0 = unlimited.
+    bool shared_encoder;  ///< Share one encoder between sessions with the same video settings.
+    int encoder_pool_timeout;  ///< Seconds an encoder session is kept open after its stream ended. Range 0-600, 0 = disabled.
+    int frame_memory_budget;  ///< MiB the capture images and encoder frames of every stream should fit in. 0 = unlimited.
+    bool encoder_load_balancing;  ///< Open the encoder of each stream on the least loaded GPU, unless `adapter_name` pins one.
+    bool encoder_step_down;  ///< Step hardware encoders down from their configured quality while their frames overrun their time.
+    bool dynamic_resolution;  ///< Encode streams at a lower resolution while their bitrate or encoder can't keep up.
+    int max_sessions_per_gpu;  ///< Streams admitted per GPU. Range 0-64, 0 = unlimited.
+    int max_encode_rate;  ///< Megapixels per second admitted over all streams. Range 0-100000, 0 = unlimited.
+    int max_egress_bitrate;  ///< Mbps admitted over all streams. Range 0-100000, 0 = unlimited.
+    int max_app_instances;  ///< Apps running at once, each past the first on a virtual display of its own. Range 1-8.
+    bool hdr_tone_mapping;  ///< Tone map HDR displays to SDR for SDR streams, instead of turning HDR off for them.
+    int sdr_white_level;  ///< The nits of HDR displays mapped to SDR white when tone mapping. Range 80-480.
+    int standby_displays;  ///< Displays kept open after a stream switched away from them, to switch back quickly. Range 0-4.
 
     std::string fallback_mode;
     bool isolated_virtual_display_option;
+    int vdisplay_pool_size;  ///< EVDI devices kept open and disconnected for virtual displays to come. Range 0-8, 0 = disabled.
     bool ignore_encoder_probe_failure;
   };
 
@@ -158,6 +201,13 @@ namespace config {
     bool install_steam_drivers;
     bool keep_default;
     bool auto_capture;
+
+    // The Linux capture backend, pipewire falls back to pulseaudio if it can't connect
+    std::string backend;
+
+    int opus_complexity;
+    bool shared_encoder;  ///< Share one audio encoder between sessions with the same audio settings.
+    bool adaptive;  ///< Adapt the in-band FEC and bitrate of the Opus encoder to the loss the client reports.
   };
 
   constexpr int ENCRYPTION_MODE_NEVER = 0;  // Never use video encryption, even if the client supports it
@@ -165,15 +215,101 @@ namespace config {
   constexpr int ENCRYPTION_MODE_MANDATORY = 2;  // Always use video encryption and refuse clients that can't encrypt
 
   struct stream_t {
+    /**
+     * @brief Where the threads of the streaming pipeline run.
+     */
+    enum class thread_affinity_e : int {
+      disabled,  ///< Let the OS place them
+      performance_cores,  ///< On the fastest cores, on the NUMA node of the GPU if it has any
+      shared_cache,  ///< Like performance_cores, and on a single L3 domain
+    };
+
     std::chrono::milliseconds ping_timeout;
 
+    // Keep the app and displays of a session that lost its client this long for the client to resume it, 0 to not
+    std::chrono::milliseconds suspend_timeout;
+
     std::string file_apps;
 
     int fec_percentage;
 
+    // Adapt the bitrate and FEC percentage of every stream to the loss and delay of its network
+    bool adaptive_bitrate;
+
+    // Raise FEC for the frames clients recover from loss with, and lower it for the others
+    bool dynamic_fec;
+
+    // Pace the video of every stream at a rate adapted to the round-trip time, loss and drain rate of its network
+    bool adaptive_pacing;
+
+    // Probe how much the network of every stream carries before its video starts, and start below that
+    bool bandwidth_probe;
+
+    // Percentage of the frame interval to spread the packets of a frame, or of a keyframe, over. 0 sends them at the pacing rate
+    int pacing_spread;
+    int pacing_spread_idr;
+
+    // Drop frames that waited longer than this to be sent, until the encoder no longer references them. 0 disables it
+    std::chrono::milliseconds max_frame_latency;
+
     // Video encryption settings for LAN and WAN streams
     int lan_encryption_mode;
     int wan_encryption_mode;
+
+    // Number of threads sending video, 0 picks a value based on the number of cores
+    int video_send_threads;
+
+    // Number of threads preparing FEC blocks ahead of sending, 0 disables pipelining
+    int fec_worker_threads;
+
+    // Busy-wait through the end of pacing sleeps for more accurate wake-ups
+    bool pacing_spin;
+
+    // Run pacing threads with a real-time scheduling policy where available
+    bool pacing_realtime;
+
+    // Pace video with kernel transmit times (SO_TXTIME) rather than sleeping where available
+    bool kernel_pacing;
+
+    // Send video without copying it into the kernel (MSG_ZEROCOPY) where available
+    bool video_zerocopy;
+
+    // Send batches of video through Registered I/O where available
+    bool registered_io;
+
+    // Send video through an AF_XDP socket on this interface, bypassing the network stack, empty to not
+    std::string xdp_interface;
+
+    // Send to each client from a socket connected to it, sharing the port with SO_REUSEPORT, where available
+    bool session_sockets;
+
+    // Move the video and audio of a client to another interface on its network when the current one fails, where available
+    bool interface_failover;
+
+    // Switch the CPU governor, the EPP and amdgpu GPUs to their performance profile while streaming, where available
+    bool performance_mode;
+
+    // Where the capture, encode, send, audio, control and input threads run
+    thread_affinity_e thread_affinity;
+
+    // Cores the apps are kept off, for the streaming threads, and the CPU weight of the apps against Apollo's 100
+    int app_reserved_cores;
+    int app_cpu_weight;
+
+    // Answer the launch of an app once its display is set up, and run its prep commands while the stream is negotiated
+    bool async_app_launch;
+
+    // Record the encoded frames of every session to a trace file in this directory, empty disables it
+    std::string video_trace_dir;
+
+    // Send the frames of this trace file to every session instead of capturing, empty disables it
+    std::string video_trace_replay;
+
+    // Keep the timing of the frames in the replayed trace, rather than sending them as fast as possible
+    bool video_trace_replay_realtime;
+
+    // Record the video and audio of every session to a Matroska file in this directory, empty disables it
+    std::string recording_dir;
   };
 
   struct nvhttp_t {
@@ -189,6 +325,10 @@ namespace config {
     std::string file_state;
 
     std::string external_ip;
+
+    int https_threads;  ///< The number of threads serving the HTTPS requests of clients.
+
+    bool shared_state;  ///< Other instances may change file_state, which is read again once it changed on disk.
   };
 
   struct input_t {
@@ -197,6 +337,9 @@ namespace config {
     std::chrono::milliseconds back_button_timeout;
     std::chrono::milliseconds key_repeat_delay;
     std::chrono::duration<double> key_repeat_period;
+    std::chrono::nanoseconds motion_interval;  ///< The minimum time between the motion events of a gamepad sensor, 0 for no limit.
+    std::chrono::nanoseconds gamepad_report_interval;  ///< The minimum time between the reports of a virtual gamepad, 0 for no limit.
+    int gamepad_pool;  ///< The number of virtual gamepads of each type created ahead of the arrival of their controllers.
 
     std::string gamepad;
     bool ds4_back_as_touchpad_click;
@@ -243,6 +386,8 @@ namespace config {
     std::string do_cmd;
     std::string undo_cmd;
     bool elevated;
+    bool parallel = false;  ///< Start together with the neighbouring commands that are flagged parallel as well.
+    std::chrono::seconds timeout {};  ///< Terminate the command after this long, 0 to wait for it indefinitely.
   };
 
   struct server_cmd_t {
@@ -297,6 +442,46 @@ namespace config {
   extern input_t input;
   extern sunshine_t sunshine;
 
+  /**
+   * @brief The settings running sessions pick up when they change, without restarting Apollo.
+   * @details Snapshots never change once published, a reload of the config file publishes a new one.
+   */
+  struct runtime_t {
+    std::uint64_t version;  // Grows with each snapshot, 0 before the config is parsed
+    int fec_percentage;
+    int max_bitrate;  // 0 for no limit
+    int pacing_spread;
+    int pacing_spread_idr;
+    int min_log_level;
+
+    bool operator==(const runtime_t &) const = default;
+  };
+
+  /**
+   * @brief Get the current snapshot of the runtime settings.
+   * @return The snapshot, which stays valid as long as it's held.
+   */
+  std::shared_ptr<const runtime_t> runtime();
+
+  /**
+   * @brief Get the version of the current snapshot, cheaply enough to check for a new one on every frame.
+   * @return The version.
+   */
+  std::uint64_t runtime_version();
+
+  /**
+   * @brief Get notified of every snapshot published from now on.
+   * @param listener Called with the previous and the new snapshot, from the thread publishing it.
+   */
+  void on_runtime_change(std::function<void(const runtime_t &previous, const runtime_t &current)> &&listener);
+
+  /**
+   * @brief Re-read the runtime settings from the config file, and publish a snapshot if they changed.
+   * @details Options given on the command line still override the file. Other settings take effect on restart.
+   * @return 0 on success, -1 if the config file couldn't be parsed.
+   */
+  int reload_runtime();
+
   int parse(int argc, char *argv[]);
   std::unordered_map<std::string, std::string> parse_config(const std::string_view &file_content);
 }  // namespace config
@@ -7,12 +7,20 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <charconv>
+#include <cstdlib>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <regex>
 #include <set>
 #include <sstream>
 #include <thread>
+#include <unordered_map>
 #include <numeric>
 #include <algorithm>
 
@@ -30,13 +38,16 @@
 #include "crypto.h"
 #include "display_device.h"
 #include "file_handler.h"
+#include "flight_recorder.h"
 #include "globals.h"
 #include "httpcommon.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
+#include "upnp.h"
 #include "utility.h"
 #include "uuid.h"
 
@@ -287,6 +298,134 @@ namespace confighttp {
     return true;
   }
 
+  namespace {
+    /**
+     * @brief A file of the web UI held in memory, with the variants compressed when the web UI was built.
+     */
+    struct web_asset_t {
+      fs::file_time_type last_write;
+      std::string etag;
+      std::string content;
+      std::string brotli;
+      std::string gzip;
+    };
+
+    std::mutex web_assets_lock;
+    std::unordered_map<std::string, std::shared_ptr<const web_asset_t>> web_assets;
+
+    /**
+     * @brief Read a compressed variant of a file, unless it's older than the file.
+     */
+    std::string read_compressed_variant(const fs::path &path, const std::string &extension, fs::file_time_type last_write) {
+      auto variant = path;
+      variant += extension;
+
+      std::error_code ec;
+      auto variant_last_write = fs::last_write_time(variant, ec);
+      if (ec || variant_last_write < last_write) {
+        return {};
+      }
+
+      return file_handler::read_file(variant.string().c_str());
+    }
+
+    /**
+     * @brief Get a file of the web UI, reading it again only if it changed on disk.
+     * @return The file, or nullptr if it doesn't exist.
+     */
+    std::shared_ptr<const web_asset_t> load_web_asset(const fs::path &path) {
+      std::error_code ec;
+      auto last_write = fs::last_write_time(path, ec);
+      if (ec) {
+        return nullptr;
+      }
+
+      std::lock_guard lg {web_assets_lock};
+      auto &asset = web_assets[path.string()];
+      if (!asset || asset->last_write != last_write) {
+        auto loaded = std::make_shared<web_asset_t>();
+        loaded->last_write = last_write;
+        loaded->content = file_handler::read_file(path.string().c_str());
+        loaded->brotli = read_compressed_variant(path, ".br", last_write);
+        loaded->gzip = read_compressed_variant(path, ".gz", last_write);
+        loaded->etag = '"' + util::hex(crypto::hash(loaded->content)).to_string().substr(0, 32) + '"';
+        asset = std::move(loaded);
+      }
+
+      return asset;
+    }
+
+    /**
+     * @brief Check whether an Accept-Encoding header allows an encoding.
+     */
+    bool accepts_encoding(const SimpleWeb::CaseInsensitiveMultimap &header, std::string_view encoding) {
+      auto accept_encoding = header.find("Accept-Encoding");
+      if (accept_encoding == header.end()) {
+        return false;
+      }
+
+      std::vector<std::string> codings;
+      boost::split(codings, accept_encoding->second, boost::is_any_of(","));
+      for (auto &coding : codings) {
+        boost::algorithm::trim(coding);
+        auto params = coding.find(';');
+        if (!boost::iequals(boost::trim_copy(coding.substr(0, params)), encoding)) {
+          continue;
+        }
+
+        // A quality of 0 rules the encoding out
+        auto quality = params == std::string::npos ? std::string::npos : coding.find("q=", params);
+        return quality == std::string::npos || std::strtod(coding.c_str() + quality + 2, nullptr) > 0;
+      }
+
+      return false;
+    }
+
+    /**
+     * @brief Send a file of the web UI from memory, compressed if the client accepts it.
+     * @details Vite names the files it bundles after a hash of their contents, so those never change,
+     *          other files are revalidated with their ETag.
+     * @param response The HTTP response object.
+     * @param request The HTTP request object.
+     * @param path The path of the file.
+     * @param content_type The type of the file.
+     * @param headers More headers to send.
+     */
+    void send_web_asset(resp_https_t response, req_https_t request, const fs::path &path, const std::string &content_type, SimpleWeb::CaseInsensitiveMultimap headers = {}) {
+      auto asset = load_web_asset(path);
+      if (!asset) {
+        not_found(response, request);
+        return;
+      }
+
+      static const std::regex hashed_name {R"(.+-[A-Za-z0-9_-]{8}\.(js|css)$)"};
+      auto hashed = std::regex_match(path.filename().string(), hashed_name);
+
+      headers.emplace("Content-Type", content_type);
+      headers.emplace("X-Frame-Options", "DENY");
+      headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+      headers.emplace("ETag", asset->etag);
+      headers.emplace("Cache-Control", hashed ? "public, max-age=31536000, immutable" : "no-cache");
+      headers.emplace("Vary", "Accept-Encoding");
+
+      auto if_none_match = request->header.find("If-None-Match");
+      if (if_none_match != request->header.end() && if_none_match->second == asset->etag) {
+        response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+        return;
+      }
+
+      if (!asset->brotli.empty() && accepts_encoding(request->header, "br")) {
+        headers.emplace("Content-Encoding", "br");
+        response->write(SimpleWeb::StatusCode::success_ok, asset->brotli, headers);
+      } else if (!asset->gzip.empty() && accepts_encoding(request->header, "gzip")) {
+        headers.emplace("Content-Encoding", "gzip");
+        response->write(SimpleWeb::StatusCode::success_ok, asset->gzip, headers);
+      } else {
+        response->write(SimpleWeb::StatusCode::success_ok, asset->content, headers);
+      }
+    }
+  }  // namespace
+
   /**
    * @brief Get the index page.
    * @param response The HTTP response object.
@@ -299,12 +438,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "index.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "index.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -319,12 +453,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "pin.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "pin.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -339,13 +468,9 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "apps.html");
     SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
     headers.emplace("Access-Control-Allow-Origin", "https://images.igdb.com/");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "apps.html", "text/html; charset=utf-8", std::move(headers));
   }
 
   /**
@@ -360,12 +485,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "clients.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "clients.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -380,12 +500,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "config.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "config.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -400,12 +515,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "password.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "password.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -425,12 +535,7 @@ namespace confighttp {
       return;
     }
 
-    std::string content = file_handler::read_file(WEB_DIR "login.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "login.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -446,12 +551,7 @@ namespace confighttp {
       return;
     }
 
-    std::string content = file_handler::read_file(WEB_DIR "welcome.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "welcome.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -466,12 +566,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "troubleshooting.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_web_asset(response, request, WEB_DIR "troubleshooting.html", "text/html; charset=utf-8");
   }
 
   /**
@@ -482,12 +577,7 @@ namespace confighttp {
   void getFaviconImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/apollo.ico", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/x-icon");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_web_asset(response, request, WEB_DIR "images/apollo.ico", "image/x-icon");
   }
 
   /**
@@ -501,12 +591,7 @@ namespace confighttp {
   void getApolloLogoImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/logo-apollo-45.png", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/png");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_web_asset(response, request, WEB_DIR "images/logo-apollo-45.png", "image/png");
   }
 
   /**
@@ -554,12 +639,7 @@ namespace confighttp {
       bad_request(response, request);
       return;
     }
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", mimeType->second);
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    std::ifstream in(filePath.string(), std::ios::binary);
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_web_asset(response, request, filePath, mimeType->second);
   }
 
   /**
@@ -677,6 +757,7 @@ namespace confighttp {
 
     print_req(request);
 
+    proc::instances.terminate_all();
     proc::proc.terminate();
     nlohmann::json output_tree;
     output_tree["status"] = true;
@@ -983,6 +1064,7 @@ namespace confighttp {
     print_req(request);
 
     nvhttp::erase_all_clients();
+    proc::instances.terminate_all();
     proc::proc.terminate();
     nlohmann::json output_tree;
     output_tree["status"] = true;
@@ -1070,6 +1152,9 @@ namespace confighttp {
         config_stream << k << " = " << (v.is_string() ? v.get<std::string>() : v.dump()) << std::endl;
       }
       file_handler::write_file(config::sunshine.config_file.c_str(), config_stream.str());
+
+      // Running sessions pick up what doesn't need a restart
+      config::reload_runtime();
       output_tree["status"] = true;
       send_response(response, output_tree);
     } catch (std::exception &e) {
@@ -1128,12 +1213,122 @@ namespace confighttp {
     }
   }
 
+  // The most bytes a read from an offset returns, the client continues from X-Log-Offset for the rest
+  constexpr std::uintmax_t LOG_CHUNK_MAX = 4 * 1024 * 1024;
+  constexpr auto LOG_FOLLOW_MAX = 30s;
+  constexpr auto LOG_FOLLOW_INTERVAL = 250ms;
+
+  /**
+   * @brief A request for the log waiting for the log to grow past an offset.
+   */
+  struct log_follower_t {
+    resp_https_t response;
+    std::uintmax_t offset;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  std::mutex log_followers_lock;
+  std::vector<log_follower_t> log_followers;
+
+  std::uintmax_t log_size() {
+    std::error_code ec;
+    auto size = fs::file_size(config::sunshine.log_file, ec);
+    return ec ? 0 : size;
+  }
+
+  /**
+   * @brief Parse an unsigned number making up all of a string.
+   * @return The number, or `std::nullopt` if the string is something else.
+   */
+  std::optional<std::uintmax_t> parse_uint(std::string_view str) {
+    std::uintmax_t value;
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != std::errc {} || ptr != str.data() + str.size()) {
+      return std::nullopt;
+    }
+
+    return value;
+  }
+
+  /**
+   * @brief Respond with part of the log file.
+   * @param response The HTTP response object.
+   * @param offset The offset in bytes to start at.
+   * @param length The maximum number of bytes to send.
+   * @param partial Whether to answer a Range request.
+   */
+  void send_log(resp_https_t response, std::uintmax_t offset, std::uintmax_t length, bool partial) {
+    auto size = log_size();
+    std::string content = file_handler::read_file_range(config::sunshine.log_file.c_str(), offset, length);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    std::string contentType = "text/plain";
+  #ifdef _WIN32
+    contentType += "; charset=";
+    contentType += currentCodePageToCharset();
+  #endif
+    headers.emplace("Content-Type", contentType);
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    headers.emplace("Cache-Control", "no-store");
+    headers.emplace("Accept-Ranges", "bytes");
+    headers.emplace("X-Log-Size", std::to_string(size));
+    headers.emplace("X-Log-Offset", std::to_string(offset + content.size()));
+
+    if (partial && !content.empty()) {
+      headers.emplace("Content-Range", std::format("bytes {}-{}/{}", offset, offset + content.size() - 1, size));
+      response->write(SimpleWeb::StatusCode::success_partial_content, content, headers);
+      return;
+    }
+
+    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+  }
+
+  /**
+   * @brief Answer the requests following the log that are due.
+   * @param all Answer every request, e.g. when shutting down.
+   */
+  void answer_log_followers(bool all) {
+    auto size = log_size();
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<log_follower_t> due;
+    {
+      std::lock_guard lg {log_followers_lock};
+      std::erase_if(log_followers, [&](log_follower_t &follower) {
+        if (!all && follower.offset == size && now < follower.deadline) {
+          return false;
+        }
+
+        due.emplace_back(std::move(follower));
+        return true;
+      });
+    }
+
+    for (auto &follower : due) {
+      // The log was recreated if it shrunk
+      send_log(follower.response, follower.offset > size ? 0 : follower.offset, LOG_CHUNK_MAX, false);
+    }
+  }
+
   /**
    * @brief Get the logs from the log file.
    * @param response The HTTP response object.
    * @param request The HTTP request object.
    *
-   * @api_examples{/api/logs| GET| null}
+   * Without arguments, the response is the whole log file. To keep large logs cheap, either of these reads part of it:
+   * | Argument | Description |
+   * | -------- | ----------- |
+   * | tail     | The number of lines to get from the end of the log. |
+   * | offset   | The offset in bytes to read the log from, at most 4 MiB at a time. |
+   * | wait     | With offset, the number of seconds (up to 30) to hold the request until the log grows past offset. |
+   *
+   * A standard `Range: bytes=` header is answered as well. Every response carries the size of the log in `X-Log-Size`,
+   * and the offset right after the bytes sent in `X-Log-Offset`. Live tailing requests `tail` once, then keeps
+   * requesting `offset` from the last `X-Log-Offset` with `wait`, which only reads what was appended.
+   * An offset past the end of the log means the log was recreated, and reads it from the start.
+   *
+   * @api_examples{/api/logs?tail=100| GET| null}
    */
   void getLogs(resp_https_t response, req_https_t request) {
     if (!authenticate(response, request)) {
@@ -1141,17 +1336,234 @@ namespace confighttp {
     }
 
     print_req(request);
-    std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
+
+    auto size = log_size();
+
+    if (auto range = request->header.find("range"); range != request->header.end()) {
+      std::string_view spec = range->second;
+      auto dash = spec.find('-');
+      if (spec.starts_with("bytes="sv) && dash != std::string_view::npos && spec.find(',') == std::string_view::npos) {
+        auto first = spec.substr(6, dash - 6);
+        auto last = spec.substr(dash + 1);
+
+        std::optional<std::uintmax_t> begin, end;
+        if (first.empty()) {
+          // The last bytes of the log
+          if (auto count = parse_uint(last)) {
+            begin = size - std::min(*count, size);
+            end = size;
+          }
+        } else if ((begin = parse_uint(first))) {
+          end = last.empty() ? std::optional {size} : parse_uint(last).transform([](auto x) { return x + 1; });
+        }
+
+        if (begin && end && *begin < *end) {
+          if (*begin >= size) {
+            SimpleWeb::CaseInsensitiveMultimap headers;
+            headers.emplace("Content-Range", std::format("bytes */{}", size));
+            response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable, headers);
+            return;
+          }
+
+          send_log(response, *begin, *end - *begin, true);
+          return;
+        }
+      }
+      // An invalid range is ignored, as with any other server
+    }
+
+    auto args = request->parse_query_string();
+    auto tail = args.find("tail");
+    auto offset = args.find("offset");
+
+    if (tail != args.end()) {
+      auto lines = parse_uint(tail->second);
+      if (!lines) {
+        bad_request(response, request, "tail must be a number of lines");
+        return;
+      }
+
+      send_log(response, file_handler::find_tail(config::sunshine.log_file.c_str(), *lines), std::numeric_limits<std::uintmax_t>::max(), false);
+      return;
+    }
+
+    if (offset != args.end()) {
+      auto from = parse_uint(offset->second);
+      if (!from) {
+        bad_request(response, request, "offset must be a number of bytes");
+        return;
+      }
+
+      auto wait = args.find("wait");
+      if (wait != args.end() && *from == size) {
+        auto seconds = parse_uint(wait->second);
+        if (!seconds) {
+          bad_request(response, request, "wait must be a number of seconds");
+          return;
+        }
+
+        // Answered by the log follow thread once the log grows
+        auto hold = std::chrono::seconds(std::min<std::uintmax_t>(*seconds, LOG_FOLLOW_MAX.count()));
+
+        std::lock_guard lg {log_followers_lock};
+        log_followers.emplace_back(log_follower_t {response, *from, std::chrono::steady_clock::now() + hold});
+        return;
+      }
+
+      send_log(response, *from > size ? 0 : *from, LOG_CHUNK_MAX, false);
+      return;
+    }
+
+    send_log(response, 0, std::numeric_limits<std::uintmax_t>::max(), false);
+  }
+
+  /**
+   * @brief Get the streaming metrics of every active session.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * The response contains latency histograms summarized as percentiles, counters and gauges for each session:
+   * @code{.json}
+   * {
+   *   "sessions": [
+   *     {
+   *       "id": 1,
+   *       "device_name": "Client",
+   *       "capture_to_send": {"count": 600, "avg_ms": 6.1, "p50_ms": 8.0, "p90_ms": 8.0, "p99_ms": 16.0},
+   *       "fec": {...},
+   *       "send": {...},
+   *       "frame": {...},
+   *       "input_to_send": {...},
+   *       "audio_capture_to_send": {...},
+   *       "frames": 600,
+   *       "dropped_frames": 0,
+   *       "idr_frames": 1,
+   *       "bytes_sent": 15000000,
+   *       "queue_depth": 0,
+   *       "fec_percentage": 20,
+   *       "bitrate_kbps": 20000
+   *     }
+   *   ]
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/metrics| GET| null}
+   */
+  void getMetrics(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    send_response(response, metrics::to_json());
+  }
+
+  /**
+   * @brief Get the streaming metrics of every active session in the Prometheus text exposition format.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * @api_examples{/api/metrics/prometheus| GET| null}
+   */
+  void getMetricsPrometheus(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
     SimpleWeb::CaseInsensitiveMultimap headers;
-    std::string contentType = "text/plain";
-  #ifdef _WIN32
-    contentType += "; charset=";
-    contentType += currentCodePageToCharset();
-  #endif
-    headers.emplace("Content-Type", contentType);
+    headers.emplace("Content-Type", "text/plain; version=0.0.4");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+    response->write(SimpleWeb::StatusCode::success_ok, metrics::to_prometheus(), headers);
+  }
+
+  /**
+   * @brief Get the latest records of the flight recorder, which journals what happened to every frame of the streams.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * The `seconds` query parameter sets how far back the records go, 10 seconds by default.
+   * Each record has its age in microseconds, the session it's about and the frame, with a value and an aux field
+   * whose meaning depends on the event:
+   * | event       | value                          | aux                                |
+   * |-------------|--------------------------------|------------------------------------|
+   * | capture     | content version of the image   | ns since the image was presented   |
+   * | convert     | ns the conversion took         |                                    |
+   * | encode      | ns the encoding took           |                                    |
+   * | fec         | ns FEC and encryption took     | the block of the frame             |
+   * | send_batch  | packets sent                   | ns slept to pace the batch         |
+   * | queue_depth | frames queued for the sender   |                                    |
+   * | idr_request |                                |                                    |
+   * | input       | size of the input packet       |                                    |
+   *
+   * @code{.json}
+   * {
+   *   "records": [
+   *     {"age_us": 9998512, "event": "encode", "session": 2654435769, "frame": 1201, "value": 2310000, "aux": 0}
+   *   ]
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/flight-recorder?seconds=5| GET| null}
+   */
+  void getFlightRecorder(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::uintmax_t seconds = 10;
+    auto args = request->parse_query_string();
+    if (auto arg = args.find("seconds"); arg != args.end()) {
+      auto value = parse_uint(arg->second);
+      if (!value) {
+        bad_request(response, request, "seconds must be a number of seconds");
+        return;
+      }
+      seconds = std::min<std::uintmax_t>(*value, 3600);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto records = flight_recorder::journal().since(now - std::chrono::seconds {seconds});
+
+    nlohmann::json output_tree;
+    output_tree["records"] = flight_recorder::to_json(records, now);
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Get the state of the publication of the host over mDNS and of its UPnP port mappings.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   *
+   * Both run in the background and retry on their own, so they may still be settling after startup.
+   * @code{.json}
+   * {
+   *   "mdns": "disabled|pending|published|failed",
+   *   "upnp": "disabled|discovering|mapped|failed"
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/discovery| GET| null}
+   */
+  void getDiscovery(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    constexpr std::string_view mdns_states[] {"disabled", "pending", "published", "failed"};
+    constexpr std::string_view upnp_states[] {"disabled", "discovering", "mapped", "failed"};
+
+    nlohmann::json output_tree;
+    output_tree["mdns"] = mdns_states[(int) platf::publish::status()];
+    output_tree["upnp"] = upnp_states[(int) upnp::status()];
+    send_response(response, output_tree);
   }
 
   /**
@@ -1331,6 +1743,7 @@ namespace confighttp {
 
     print_req(request);
 
+    proc::instances.terminate_all();
     proc::proc.terminate();
 
     // We may not return from this call
@@ -1353,6 +1766,7 @@ namespace confighttp {
 
     BOOST_LOG(warning) << "Requested quit from config page!"sv;
 
+    proc::instances.terminate_all();
     proc::proc.terminate();
 
 #ifdef _WIN32
@@ -1540,6 +1954,10 @@ namespace confighttp {
     server.resource["^/api/apps/launch$"]["POST"] = launchApp;
     server.resource["^/api/apps/close$"]["POST"] = closeApp;
     server.resource["^/api/logs$"]["GET"] = getLogs;
+    server.resource["^/api/metrics$"]["GET"] = getMetrics;
+    server.resource["^/api/metrics/prometheus$"]["GET"] = getMetricsPrometheus;
+    server.resource["^/api/flight-recorder$"]["GET"] = getFlightRecorder;
+    server.resource["^/api/discovery$"]["GET"] = getDiscovery;
     server.resource["^/api/config$"]["GET"] = getConfig;
     server.resource["^/api/config$"]["POST"] = saveConfig;
     server.resource["^/api/configLocale$"]["GET"] = getLocale;
@@ -1576,11 +1994,19 @@ namespace confighttp {
     };
     std::thread tcp { accept_and_run, &server };
 
+    std::thread log_follow {[shutdown_event]() {
+      while (!shutdown_event->view(LOG_FOLLOW_INTERVAL)) {
+        answer_log_followers(false);
+      }
+      answer_log_followers(true);
+    }};
+
     // Wait for any event
     shutdown_event->view();
 
     server.stop();
 
+    log_follow.join();
     tcp.join();
   }
 }  // namespace confighttp
@@ -0,0 +1,59 @@
+/**
+ * @file src/consumer_signal.h
+ * @brief Declarations for waking the consumer of a lock-free queue.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <cstdint>
+
+namespace util {
+  /**
+   * @brief Lets the single consumer of a lock-free queue sleep until producers publish values, without locking.
+   * @details The consumer samples the signal with prepare() before checking the queue, and passes the sample
+   *          to wait() if it found nothing. A value published in between bumps the signal, so wait() returns
+   *          at once instead of missing it. Producers only make the wake-up call while the consumer sleeps.
+   */
+  class consumer_signal_t {
+  public:
+    consumer_signal_t() = default;
+
+    consumer_signal_t(const consumer_signal_t &) = delete;
+    consumer_signal_t &operator=(const consumer_signal_t &) = delete;
+
+    /**
+     * @brief Sample the signal, before the consumer checks the queue.
+     */
+    std::uint32_t prepare() const {
+      return _count.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Sleep until the signal is notified, unless it was since prepare() returned `seen`.
+     * @details Only the consumer thread may call this.
+     */
+    void wait(std::uint32_t seen) {
+      // Either notify() sees the consumer asleep, or the consumer sees the signal it bumped
+      _sleeping.store(true, std::memory_order_seq_cst);
+      if (_count.load(std::memory_order_seq_cst) == seen) {
+        _count.wait(seen, std::memory_order_acquire);
+      }
+      _sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Wake the consumer up, after a value was published.
+     */
+    void notify() {
+      _count.fetch_add(1, std::memory_order_seq_cst);
+      if (_sleeping.load(std::memory_order_seq_cst)) {
+        _count.notify_one();
+      }
+    }
+
+  private:
+    std::atomic<std::uint32_t> _count {};
+    std::atomic<bool> _sleeping {};
+  };
+}  // namespace util
@@ -2,6 +2,9 @@
  * @file src/crypto.cpp
  * @brief Definitions for cryptography functions.
  */
+// standard includes
+#include <optional>
+
 // lib includes
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
@@ -15,11 +18,31 @@ namespace crypto {
   cert_chain_t::cert_chain_t():
       _certs {}, _cert_ctx { X509_STORE_CTX_new() } {
   }
+  /**
+   * @brief Get the SHA-256 of the DER of a certificate.
+   */
+  static std::optional<sha256_t> fingerprint(x509_t::element_type *cert) {
+    sha256_t digest;
+    unsigned int size = digest.size();
+    if (!cert || !X509_digest(cert, EVP_sha256(), digest.data(), &size)) {
+      return std::nullopt;
+    }
+
+    return digest;
+  }
+
   void cert_chain_t::add(p_named_cert_t& named_cert_p) {
+    auto cert = x509(named_cert_p->cert);
+    auto digest = fingerprint(cert.get());
+    if (!digest) {
+      return;
+    }
+
     x509_store_t x509_store { X509_STORE_new() };
+    X509_STORE_add_cert(x509_store.get(), cert.get());
 
-    X509_STORE_add_cert(x509_store.get(), x509(named_cert_p->cert).get());
-    _certs.emplace_back(std::make_pair(named_cert_p, std::move(x509_store)));
+    // The first device paired with a certificate keeps it
+    _certs.try_emplace(*digest, named_cert_p, std::move(x509_store));
   }
 
   void cert_chain_t::clear() {
@@ -45,45 +68,36 @@ namespace crypto {
   }
 
   /**
-   * @brief Verify the certificate chain.
-   * When certificates from two or more instances of Moonlight have been added to x509_store_t,
-   * only one of them will be verified by X509_verify_cert, resulting in only a single instance of
-   * Moonlight to be able to use Sunshine
-   *
-   * To circumvent this, x509_store_t instance will be created for each instance of the certificates.
-   * @param cert The certificate to verify.
-   * @return nullptr if the certificate is valid, otherwise an error string.
+   * Only the store holding the certificate with the same fingerprint is tried.
+   * A single x509_store_t holding the certificates of two or more instances of Moonlight
+   * would only verify one of them, so each certificate has a store of its own.
    */
   const char * cert_chain_t::verify(x509_t::element_type *cert, p_named_cert_t& named_cert_out) {
-    int err_code = 0;
-    for (auto &[named_cert_p, x509_store] : _certs) {
-      auto fg = util::fail_guard([this]() {
-        X509_STORE_CTX_cleanup(_cert_ctx.get());
-      });
-
-      X509_STORE_CTX_init(_cert_ctx.get(), x509_store.get(), cert, nullptr);
-      X509_STORE_CTX_set_verify_cb(_cert_ctx.get(), openssl_verify_cb);
-
-      // We don't care to validate the entire chain for the purposes of client auth.
-      // Some versions of clients forked from Moonlight Embedded produce client certs
-      // that OpenSSL doesn't detect as self-signed due to some X509v3 extensions.
-      X509_STORE_CTX_set_flags(_cert_ctx.get(), X509_V_FLAG_PARTIAL_CHAIN);
+    auto digest = fingerprint(cert);
+    auto it = digest ? _certs.find(*digest) : std::end(_certs);
+    if (it == std::end(_certs)) {
+      return X509_verify_cert_error_string(X509_V_ERR_CERT_UNTRUSTED);
+    }
 
-      auto err = X509_verify_cert(_cert_ctx.get());
+    auto &[named_cert_p, x509_store] = it->second;
+    auto fg = util::fail_guard([this]() {
+      X509_STORE_CTX_cleanup(_cert_ctx.get());
+    });
 
-      if (err == 1) {
-        named_cert_out = named_cert_p;
-        return nullptr;
-      }
+    X509_STORE_CTX_init(_cert_ctx.get(), x509_store.get(), cert, nullptr);
+    X509_STORE_CTX_set_verify_cb(_cert_ctx.get(), openssl_verify_cb);
 
-      err_code = X509_STORE_CTX_get_error(_cert_ctx.get());
+    // We don't care to validate the entire chain for the purposes of client auth.
+    // Some versions of clients forked from Moonlight Embedded produce client certs
+    // that OpenSSL doesn't detect as self-signed due to some X509v3 extensions.
+    X509_STORE_CTX_set_flags(_cert_ctx.get(), X509_V_FLAG_PARTIAL_CHAIN);
 
-      if (err_code != X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT && err_code != X509_V_ERR_INVALID_CA) {
-        return X509_verify_cert_error_string(err_code);
-      }
+    if (X509_verify_cert(_cert_ctx.get()) != 1) {
+      return X509_verify_cert_error_string(X509_STORE_CTX_get_error(_cert_ctx.get()));
     }
 
-    return X509_verify_cert_error_string(err_code);
+    named_cert_out = named_cert_p;
+    return nullptr;
   }
 
   namespace cipher {
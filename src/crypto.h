@@ -6,6 +6,8 @@
 
 // standard includes
 #include <array>
+#include <cstring>
+#include <unordered_map>
 
 // lib includes
 #include <list>
@@ -142,10 +144,28 @@ namespace crypto {
 
     void clear();
 
+    /**
+     * @brief Verify a certificate against the paired one with the same fingerprint.
+     * @param cert The certificate to verify.
+     * @param named_cert_out Set to the paired certificate on success.
+     * @return nullptr if the certificate is valid, otherwise an error string.
+     */
     const char *verify(x509_t::element_type *cert, p_named_cert_t& named_cert_out);
 
   private:
-    std::vector<std::pair<p_named_cert_t, x509_store_t>> _certs;
+    /**
+     * @brief Hashes fingerprints, whose bytes are uniformly distributed already.
+     */
+    struct fingerprint_hash_t {
+      std::size_t operator()(const sha256_t &fingerprint) const {
+        std::size_t hash;
+        std::memcpy(&hash, fingerprint.data(), sizeof(hash));
+        return hash;
+      }
+    };
+
+    // Keyed by the SHA-256 of the DER of the certificate
+    std::unordered_map<sha256_t, std::pair<p_named_cert_t, x509_store_t>, fingerprint_hash_t> _certs;
     x509_store_ctx_t _cert_ctx;
   };
 
@@ -5,6 +5,12 @@
 // header include
 #include "display_device.h"
 
+// standard includes
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <regex>
+
 // lib includes
 #include <boost/algorithm/string.hpp>
 #include <display_device/audio_context_interface.h>
@@ -12,8 +18,6 @@
 #include <display_device/json.h>
 #include <display_device/retry_scheduler.h>
 #include <display_device/settings_manager_interface.h>
-#include <mutex>
-#include <regex>
 
 // local includes
 #include "audio.h"
@@ -31,6 +35,12 @@ namespace display_device {
   namespace {
     constexpr std::chrono::milliseconds DEFAULT_RETRY_INTERVAL {5000};
 
+    // The scheduler only runs a task on its own thread after a sleep
+    constexpr std::chrono::milliseconds ASYNC_START_DELAY {1};
+
+    // How long the capture waits for a configuration that is being applied
+    constexpr std::chrono::milliseconds CONFIGURATION_WAIT_TIMEOUT {30000};
+
     /**
      * @brief A global for the settings manager interface and other settings whose lifetime is managed by `display_device::init(...)`.
      */
@@ -38,6 +48,9 @@ namespace display_device {
       std::mutex mutex {};
       std::chrono::milliseconds config_revert_delay {0};
       std::unique_ptr<RetryScheduler<SettingsManagerInterface>> sm_instance {nullptr};
+
+      // Ready once the first attempt of the last configuration has been made, or it was replaced
+      std::shared_future<void> configuration_settled {};
     } DD_DATA;
 
     /**
@@ -413,6 +426,10 @@ namespace display_device {
 
       switch (video_config.dd.hdr_option) {
         case hdr_option_e::automatic:
+          // SDR streams of an HDR display are tone mapped, so HDR doesn't need to be turned off for them
+          if (!session.enable_hdr && video_config.hdr_tone_mapping) {
+            return std::nullopt;
+          }
           return session.enable_hdr ? HdrState::Enabled : HdrState::Disabled;
         case hdr_option_e::disabled:
           break;
@@ -648,10 +665,11 @@ namespace display_device {
         return;
       }
 
-      // Note: by default the executor function is immediately executed in the calling thread. With delay, we want to avoid that.
+      // Note: by default the executor function is immediately executed in the calling thread.
+      // Reverting at the end of a stream shouldn't hold it up, so that is left to the scheduler thread, after the delay if any.
       SchedulerOptions scheduler_option {.m_sleep_durations = {DEFAULT_RETRY_INTERVAL}};
-      if (option == revert_option_e::try_indefinitely_with_delay && DD_DATA.config_revert_delay > std::chrono::milliseconds::zero()) {
-        scheduler_option.m_sleep_durations = {DD_DATA.config_revert_delay, DEFAULT_RETRY_INTERVAL};
+      if (option == revert_option_e::try_indefinitely_with_delay) {
+        scheduler_option.m_sleep_durations = {std::max(DD_DATA.config_revert_delay, ASYNC_START_DELAY), DEFAULT_RETRY_INTERVAL};
         scheduler_option.m_execution = SchedulerOptions::Execution::ScheduledOnly;
       }
 
@@ -803,14 +821,39 @@ namespace display_device {
       return;
     }
 
-    DD_DATA.sm_instance->schedule([config](auto &settings_iface, auto &stop_token) {
+    // Replacing the task of the scheduler cancels a revert that is still pending, so reconnecting
+    // within the revert delay leaves the display as it is instead of reverting and configuring it again
+    auto settled = std::make_shared<std::promise<void>>();
+    DD_DATA.configuration_settled = settled->get_future().share();
+
+    // Applied on the scheduler thread, so the launch carries on until the display is needed
+    DD_DATA.sm_instance->schedule([config, settled](auto &settings_iface, auto &stop_token) mutable {
       // We only want to keep retrying in case of a transient errors.
       // In other cases, when we either fail or succeed we just want to stop...
       if (settings_iface.applySettings(config) != SettingsManagerInterface::ApplyResult::ApiTemporarilyUnavailable) {
         stop_token.requestStop();
       }
+
+      // Retries don't hold up the stream, like they didn't when the first attempt was made by the caller
+      if (settled) {
+        settled->set_value();
+        settled.reset();
+      }
     },
-                                  {.m_sleep_durations = {DEFAULT_RETRY_INTERVAL}});
+                                  {.m_sleep_durations = {ASYNC_START_DELAY, DEFAULT_RETRY_INTERVAL}, .m_execution = SchedulerOptions::Execution::ScheduledOnly});
+  }
+
+  void wait_for_configuration() {
+    std::shared_future<void> settled;
+    {
+      std::lock_guard lock {DD_DATA.mutex};
+      settled = DD_DATA.configuration_settled;
+    }
+
+    // A replaced configuration breaks its promise, which makes the future ready just the same
+    if (settled.valid() && settled.wait_for(CONFIGURATION_WAIT_TIMEOUT) != std::future_status::ready) {
+      BOOST_LOG(warning) << "Display configuration is taking too long, carrying on without it";
+    }
   }
 
   void revert_configuration() {
@@ -80,6 +80,10 @@ namespace display_device {
    * the users can do something about it once they are connected. Otherwise, we might
    * prevent users from logging in at all if we keep failing to apply configuration.
    *
+   * The configuration is applied on a separate thread, so the caller can carry on with launching
+   * the stream while it is applied. Call wait_for_configuration() before the display is needed.
+   * Configuring cancels a revert that is still waiting for its delay.
+   *
    * @param config Configuration for the display.
    *
    * @examples
@@ -89,6 +93,17 @@ namespace display_device {
    */
   void configure_display(const SingleDisplayConfiguration &config);
 
+  /**
+   * @brief Wait until the configuration scheduled last has been tried once.
+   * @note Returns right away if no configuration is pending, and gives up after some time.
+   *
+   * @examples
+   * configure_display(valid_config);
+   * wait_for_configuration();
+   * @examples_end
+   */
+  void wait_for_configuration();
+
   /**
    * @brief Revert the display configuration and restore the previous state.
    *
@@ -0,0 +1,93 @@
+/**
+ * @file src/dynamic_resolution.cpp
+ * @brief Definitions for lowering the encode resolution of a stream under bandwidth or encoder pressure.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "dynamic_resolution.h"
+
+using namespace std::literals;
+
+namespace dynamic_resolution {
+  namespace {
+    // Bits each pixel of a frame needs before blocking shows, for H.264, HEVC and AV1
+    constexpr std::array<double, 3> min_bits_per_pixel {0.05, 0.035, 0.03};
+
+    // Step back up once the resolution above gets this much more than it needs, and wouldn't load the encoder more than this
+    constexpr double headroom_ratio = 1.5;
+    constexpr double max_encoder_load = 0.6;
+
+    // Windows in a row with the pressure, or the headroom, before stepping
+    constexpr int pressure_updates = 2;
+    constexpr int headroom_updates = 5;
+
+    // The stream needs a moment after each step, the bitrate controller and the encoder have to catch up
+    constexpr auto settle_time = 6s;
+  }  // namespace
+
+  std::pair<int, int> scaled_size(int width, int height, int step) {
+    auto scale = scales[std::clamp(step, 0, (int) scales.size() - 1)];
+    return {(int) (width * scale) & ~1, (int) (height * scale) & ~1};
+  }
+
+  controller_t::controller_t(int width, int height, int framerate, int video_format, int bitrate):
+      _width {width},
+      _height {height},
+      _framerate {std::max(framerate, 1)},
+      _min_bits_per_pixel {min_bits_per_pixel[std::clamp(video_format, 0, 2)]},
+      _bitrate {bitrate} {
+  }
+
+  double controller_t::bits_per_pixel(int step) const {
+    auto [width, height] = scaled_size(_width, _height, step);
+    return _bitrate * 1000.0 / ((double) width * height * _framerate);
+  }
+
+  void controller_t::set_step(int step) {
+    _step = std::clamp(step, 0, (int) scales.size() - 1);
+    _pressure_updates = 0;
+    _headroom_updates = 0;
+    _settled.reset();
+    _last_update.reset();
+  }
+
+  std::optional<int> controller_t::update(double encoder_load, bool encoder_saturated, clock::time_point now) {
+    if (!_last_update) {
+      _last_update = now;
+      _settled = now + settle_time;
+      return std::nullopt;
+    }
+
+    if (now - *_last_update < update_interval) {
+      return std::nullopt;
+    }
+    _last_update = now;
+
+    if (now < *_settled) {
+      return std::nullopt;
+    }
+
+    auto pressure = encoder_saturated || bits_per_pixel(_step) < _min_bits_per_pixel;
+    _pressure_updates = pressure ? _pressure_updates + 1 : 0;
+    if (_pressure_updates >= pressure_updates && _step + 1 < (int) scales.size()) {
+      return _step + 1;
+    }
+
+    auto headroom = false;
+    if (!pressure && _step > 0) {
+      auto [width, height] = size();
+      auto [up_width, up_height] = scaled_size(_width, _height, _step - 1);
+      auto up_load = encoder_load * up_width * up_height / ((double) width * height);
+
+      headroom = bits_per_pixel(_step - 1) >= _min_bits_per_pixel * headroom_ratio && up_load < max_encoder_load;
+    }
+    _headroom_updates = headroom ? _headroom_updates + 1 : 0;
+    if (_headroom_updates >= headroom_updates) {
+      return _step - 1;
+    }
+
+    return std::nullopt;
+  }
+}  // namespace dynamic_resolution
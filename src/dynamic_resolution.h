@@ -0,0 +1,105 @@
+/**
+ * @file src/dynamic_resolution.h
+ * @brief Declarations for lowering the encode resolution of a stream under bandwidth or encoder pressure.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <chrono>
+#include <optional>
+#include <utility>
+
+namespace dynamic_resolution {
+  /**
+   * @brief The scales of the resolution of the client at each step, e.g. 1080p, 900p, 720p and 540p.
+   */
+  constexpr std::array<double, 4> scales {1.0, 5.0 / 6, 2.0 / 3, 0.5};
+
+  /**
+   * @brief Get the size a stream is encoded at a step.
+   * @param width The width the client asked for.
+   * @param height The height the client asked for.
+   * @param step The position in `scales`.
+   * @return The width and height, rounded down to even numbers.
+   */
+  std::pair<int, int> scaled_size(int width, int height, int step);
+
+  /**
+   * @brief Chooses the step a stream is encoded at, from its bitrate and how loaded its encoder is.
+   * @details A stream steps down once its bits per pixel drop below what the codec needs, or its encoder overruns
+   *          the frame time at its lowest quality, for a few windows in a row. It steps back up after a long run
+   *          of windows in which the resolution above would have the bits it needs, without loading the encoder
+   *          too much. The framerate is never traded. Only the encoding thread may call it.
+   */
+  class controller_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param width The width the client asked for.
+     * @param height The height the client asked for.
+     * @param framerate The frames per second of the stream.
+     * @param video_format The codec, 0 for H.264, 1 for HEVC, 2 for AV1.
+     * @param bitrate The bitrate of the stream in Kbps.
+     */
+    controller_t(int width, int height, int framerate, int video_format, int bitrate);
+
+    /**
+     * @brief Account for a frame of the stream.
+     * @param encoder_load The share of the frame time the encoder takes, see `encoder_budget::monitor_t::load()`.
+     * @param encoder_saturated Whether the encoder overruns with no quality left to trade.
+     * @param now The current time.
+     * @return The step the stream should be encoded at, if it should change.
+     */
+    std::optional<int> update(double encoder_load, bool encoder_saturated, clock::time_point now = clock::now());
+
+    /**
+     * @brief Set the step the stream is encoded at.
+     */
+    void set_step(int step);
+
+    /**
+     * @brief Set the bitrate the stream was asked to change to.
+     * @param bitrate The bitrate in Kbps.
+     */
+    void set_bitrate(int bitrate) {
+      _bitrate = bitrate;
+    }
+
+    int step() const {
+      return _step;
+    }
+
+    int bitrate() const {
+      return _bitrate;
+    }
+
+    /**
+     * @brief Get the size the stream is encoded at its step.
+     */
+    std::pair<int, int> size() const {
+      return scaled_size(_width, _height, _step);
+    }
+
+    // How often the stream is judged
+    static constexpr auto update_interval = std::chrono::seconds {2};
+
+  private:
+    double bits_per_pixel(int step) const;
+
+    const int _width;
+    const int _height;
+    const int _framerate;
+    const double _min_bits_per_pixel;
+
+    int _bitrate;
+    int _step = 0;
+
+    int _pressure_updates = 0;
+    int _headroom_updates = 0;
+
+    std::optional<clock::time_point> _last_update;
+    std::optional<clock::time_point> _settled;
+  };
+}  // namespace dynamic_resolution
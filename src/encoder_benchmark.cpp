@@ -0,0 +1,158 @@
+/**
+ * @file src/encoder_benchmark.cpp
+ * @brief Definitions for benchmarking the encoders, to pick hardware and tune the encoder settings.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "encoder_benchmark.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace video {
+  namespace {
+    std::chrono::nanoseconds percentile(const std::vector<std::chrono::nanoseconds> &sorted, double p) {
+      if (sorted.empty()) {
+        return {};
+      }
+
+      return sorted[std::min(sorted.size() - 1, (std::size_t) (p * sorted.size()))];
+    }
+
+    double to_ms(std::chrono::nanoseconds duration) {
+      return std::chrono::duration<double, std::milli> {duration}.count();
+    }
+  }  // namespace
+
+  encode_stats_t summarize_encode(const std::vector<encoded_frame_t> &frames, std::chrono::nanoseconds elapsed, int framerate) {
+    encode_stats_t stats {frames.size()};
+    if (frames.empty()) {
+      return stats;
+    }
+
+    stats.fps = frames.size() / std::max(std::chrono::duration<double> {elapsed}.count(), 1e-9);
+
+    std::vector<std::chrono::nanoseconds> latencies;
+    std::chrono::nanoseconds convert_time {};
+    std::uint64_t bytes = 0;
+    for (auto &frame : frames) {
+      latencies.emplace_back(frame.latency);
+      convert_time += frame.convert_time;
+      bytes += frame.size;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    stats.latency_p50 = percentile(latencies, 0.5);
+    stats.latency_p95 = percentile(latencies, 0.95);
+    stats.latency_p99 = percentile(latencies, 0.99);
+    stats.convert_time = convert_time / frames.size();
+
+    // The frames are encoded faster than real time, so the bitrate is what they'd take at the requested framerate
+    framerate = std::max(framerate, 1);
+    stats.bitrate_kbps = bytes * 8 / 1000.0 * framerate / frames.size();
+
+    // Every window of a second's worth of frames is one sample of the bitrate, the last partial one left out
+    std::vector<double> windows;
+    for (std::size_t x = 0; x + framerate <= frames.size(); x += framerate) {
+      std::uint64_t window_bytes = 0;
+      for (std::size_t y = x; y < x + framerate; ++y) {
+        window_bytes += frames[y].size;
+      }
+      windows.emplace_back(window_bytes * 8 / 1000.0);
+    }
+
+    if (windows.size() > 1) {
+      double mean = 0;
+      for (auto window : windows) {
+        mean += window;
+      }
+      mean /= windows.size();
+
+      double variance = 0;
+      for (auto window : windows) {
+        variance += (window - mean) * (window - mean);
+      }
+      stats.bitrate_stddev_kbps = std::sqrt(variance / windows.size());
+    }
+
+    return stats;
+  }
+
+  bool draw_test_pattern(platf::img_t &img, std::int64_t frame) {
+    if (!img.data || img.pixel_pitch != 4 || img.width <= 0 || img.height <= 0) {
+      return false;
+    }
+
+    auto noise_width = std::max(img.width / 4, 1);
+    auto noise_height = std::max(img.height / 4, 1);
+    auto noise_x = (int) ((frame * 16) % std::max(img.width - noise_width, 1));
+    auto noise_y = (int) ((frame * 8) % std::max(img.height - noise_height, 1));
+
+    // Seeded by the frame, so the same frame always looks the same
+    auto state = (std::uint32_t) (frame * 2654435761u) | 1;
+
+    for (int y = 0; y < img.height; ++y) {
+      auto row = (std::uint32_t *) (img.data + (std::size_t) y * img.row_pitch);
+      for (int x = 0; x < img.width; ++x) {
+        if (x >= noise_x && x < noise_x + noise_width && y >= noise_y && y < noise_y + noise_height) {
+          state ^= state << 13;
+          state ^= state >> 17;
+          state ^= state << 5;
+          row[x] = state | 0xFF000000;
+          continue;
+        }
+
+        auto shift = (std::uint32_t) (x + frame * 4);
+        row[x] = 0xFF000000 | ((shift & 0xFF) << 16) | (((std::uint32_t) y & 0xFF) << 8) | ((shift + y) & 0xFF);
+      }
+    }
+
+    return true;
+  }
+
+  bool save_encoder_benchmark(const std::filesystem::path &file, const std::vector<encoder_benchmark_result_t> &results) {
+    nlohmann::json root;
+    root["version"] = PROJECT_VERSION;
+    root["results"] = nlohmann::json::array();
+
+    for (auto &result : results) {
+      auto &stats = result.stats;
+      root["results"].push_back({
+        {"encoder", result.encoder},
+        {"codec", result.codec},
+        {"width", result.width},
+        {"height", result.height},
+        {"framerate", result.framerate},
+        {"bitrate_kbps", result.bitrate},
+        {"generated_content", result.generated_content},
+        {"frames", stats.frames},
+        {"fps", stats.fps},
+        {"latency_ms", {{"p50", to_ms(stats.latency_p50)}, {"p95", to_ms(stats.latency_p95)}, {"p99", to_ms(stats.latency_p99)}}},
+        {"convert_ms", to_ms(stats.convert_time)},
+        {"output_bitrate_kbps", stats.bitrate_kbps},
+        {"output_bitrate_stddev_kbps", stats.bitrate_stddev_kbps},
+      });
+    }
+
+    try {
+      std::ofstream out {file};
+      out << root.dump(4);
+      if (!out) {
+        throw std::runtime_error {"write failed"};
+      }
+    } catch (std::exception &e) {
+      BOOST_LOG(error) << "Couldn't write "sv << file.string() << ": "sv << e.what();
+      return false;
+    }
+
+    return true;
+  }
+}  // namespace video
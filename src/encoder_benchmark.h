@@ -0,0 +1,80 @@
+/**
+ * @file src/encoder_benchmark.h
+ * @brief Declarations for benchmarking the encoders, to pick hardware and tune the encoder settings.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace video {
+  /**
+   * @brief What encoding one frame cost.
+   */
+  struct encoded_frame_t {
+    std::chrono::nanoseconds convert_time;  ///< The time spent converting the image for the encoder.
+    std::chrono::nanoseconds latency;  ///< The time from the start of the conversion to the frame coming out of the encoder.
+    std::size_t size;  ///< The size of the encoded frame in bytes.
+  };
+
+  /**
+   * @brief What encoding a stream with one encoder, codec and display mode cost.
+   */
+  struct encode_stats_t {
+    std::size_t frames;  ///< The number of frames encoded.
+    double fps;  ///< The number of frames encoded per second, encoding as fast as possible.
+    std::chrono::nanoseconds latency_p50;  ///< The median latency of a frame.
+    std::chrono::nanoseconds latency_p95;  ///< The 95th percentile of the latency of a frame.
+    std::chrono::nanoseconds latency_p99;  ///< The 99th percentile of the latency of a frame.
+    std::chrono::nanoseconds convert_time;  ///< The average time spent converting an image.
+    double bitrate_kbps;  ///< The average bitrate, as if the frames were encoded at the requested framerate.
+    double bitrate_stddev_kbps;  ///< The standard deviation of the bitrate of each second at the requested framerate.
+  };
+
+  /**
+   * @brief The result of benchmarking one encoder, codec and display mode.
+   */
+  struct encoder_benchmark_result_t {
+    std::string encoder;  ///< The name of the encoder, e.g. `nvenc`.
+    std::string codec;  ///< The name of the codec implementation, e.g. `h264_nvenc`.
+    int width;
+    int height;
+    int framerate;
+    int bitrate;  ///< The bitrate the encoder was configured with, in kbps.
+    bool generated_content;  ///< Whether the frames had moving content, or were all the same blank image.
+    encode_stats_t stats;
+  };
+
+  /**
+   * @brief Summarize the frames encoded during a benchmark.
+   * @param frames The cost of each frame, in the order they were encoded.
+   * @param elapsed How long encoding the frames took.
+   * @param framerate The framerate the encoder was configured with.
+   */
+  encode_stats_t summarize_encode(const std::vector<encoded_frame_t> &frames, std::chrono::nanoseconds elapsed, int framerate);
+
+  /**
+   * @brief Draw moving content into an image, so the encoder has something to encode.
+   * @details A gradient scrolls across the image and a block of noise moves around it.
+   *          Only images in system memory with 4 bytes per pixel can be drawn into.
+   * @param img The image.
+   * @param frame The index of the frame, which decides where the content is.
+   * @return `true` if the image could be drawn into.
+   */
+  bool draw_test_pattern(platf::img_t &img, std::int64_t frame);
+
+  /**
+   * @brief Write the results of a benchmark as a JSON report.
+   * @param file The report file.
+   * @param results The results.
+   * @return `true` if the report was written.
+   */
+  bool save_encoder_benchmark(const std::filesystem::path &file, const std::vector<encoder_benchmark_result_t> &results);
+}  // namespace video
@@ -0,0 +1,106 @@
+/**
+ * @file src/encoder_budget.cpp
+ * @brief Definitions for keeping encoders within the time a frame lasts.
+ */
+// standard includes
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+// local includes
+#include "encoder_budget.h"
+
+using namespace std::literals;
+
+namespace encoder_budget {
+  namespace {
+    // Step down once more than 1 in this many frames overrun, or once they take this share of the frame time on average
+    constexpr int overrun_ratio = 10;
+    constexpr double busy_share = 0.85;
+
+    // Step back up after this many updates in a row taking less than this share of the frame time
+    constexpr double idle_share = 0.5;
+    constexpr int idle_updates = 15;
+
+    // The first frames of a new encoder are slower than the rest, and an IDR frame is among them
+    constexpr auto settle_time = 5s;
+
+    using key_t = std::tuple<std::string, int, int, int, int>;
+
+    std::mutex levels_lock;
+    std::map<key_t, int> levels;
+  }  // namespace
+
+  monitor_t::monitor_t(int framerate, int level, int max_level):
+      _frame_time {std::chrono::nanoseconds {1s} / std::max(framerate, 1)},
+      _level {level},
+      _max_level {max_level} {
+  }
+
+  std::optional<int> monitor_t::frame_encoded(std::chrono::nanoseconds busy_time, clock::time_point now) {
+    ++_frames;
+    _busy_time += busy_time;
+    if (busy_time > _frame_time) {
+      ++_overruns;
+    }
+
+    if (!_last_update) {
+      _last_update = now;
+      _settled = now + settle_time;
+      return std::nullopt;
+    }
+
+    if (now - *_last_update < update_interval) {
+      return std::nullopt;
+    }
+    _last_update = now;
+
+    auto mean = (double) _busy_time.count() / _frames;
+    auto overloaded = _overruns * overrun_ratio > _frames || mean > _frame_time.count() * busy_share;
+    auto idle = !_overruns && mean < _frame_time.count() * idle_share;
+
+    // An encoder that's still settling isn't saturated yet
+    _load = mean / _frame_time.count();
+    _saturated = now >= *_settled && overloaded && _level >= _max_level;
+
+    _frames = 0;
+    _overruns = 0;
+    _busy_time = {};
+
+    if (now < *_settled) {
+      return std::nullopt;
+    }
+
+    if (overloaded) {
+      _idle_updates = 0;
+      if (_level < _max_level) {
+        _settled = now + settle_time;
+        return _level + 1;
+      }
+    } else if (idle) {
+      if (++_idle_updates >= idle_updates && _level > 0) {
+        _idle_updates = 0;
+        _settled = now + settle_time;
+        return _level - 1;
+      }
+    } else {
+      _idle_updates = 0;
+    }
+
+    return std::nullopt;
+  }
+
+  int level_for(std::string_view encoder, int video_format, int width, int height, int framerate) {
+    std::lock_guard lg {levels_lock};
+
+    auto it = levels.find(key_t {encoder, video_format, width, height, framerate});
+    return it == std::end(levels) ? 0 : it->second;
+  }
+
+  void set_level(std::string_view encoder, int video_format, int width, int height, int framerate, int level) {
+    std::lock_guard lg {levels_lock};
+    levels[key_t {encoder, video_format, width, height, framerate}] = level;
+  }
+}  // namespace encoder_budget
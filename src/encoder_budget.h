@@ -0,0 +1,99 @@
+/**
+ * @file src/encoder_budget.h
+ * @brief Declarations for keeping encoders within the time a frame lasts.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace encoder_budget {
+  /**
+   * @brief Watches how long an encoder takes to convert and encode its frames, and steps down its quality
+   *        while they take longer than a frame lasts.
+   * @details Once more than a tenth of the frames of a window overrun the frame time, or they take most of it
+   *          on average, the encoder should be reopened a level down. After a long run of frames taking less
+   *          than half of it, it may go back up a level. After each step, the encoder is given time to settle
+   *          before it's judged again. What a level means is up to the encoder, e.g. a faster preset or one pass
+   *          less. Only the encoding thread may call it.
+   */
+  class monitor_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param framerate The frames per second of the stream.
+     * @param level The level the encoder was opened at.
+     * @param max_level The most levels it can be stepped down.
+     */
+    monitor_t(int framerate, int level, int max_level);
+
+    /**
+     * @brief Account for a frame handed to the encoder.
+     * @param busy_time How long converting and encoding it took.
+     * @param now The current time.
+     * @return The level the encoder should be reopened at, if it should change.
+     */
+    std::optional<int> frame_encoded(std::chrono::nanoseconds busy_time, clock::time_point now = clock::now());
+
+    /**
+     * @brief Get the level the encoder was opened at.
+     */
+    int level() const {
+      return _level;
+    }
+
+    /**
+     * @brief Get the share of the frame time converting and encoding took on average, over the last window.
+     * @return The share, 0 before the first window.
+     */
+    double load() const {
+      return _load;
+    }
+
+    /**
+     * @brief Get whether the last window overran the frame time with no level left to step down.
+     */
+    bool saturated() const {
+      return _saturated;
+    }
+
+    // How long frames are watched before the encoder is judged
+    static constexpr auto update_interval = std::chrono::seconds {2};
+
+  private:
+    const std::chrono::nanoseconds _frame_time;
+    const int _level;
+    const int _max_level;
+
+    // Observed since the last update
+    std::int64_t _frames = 0;
+    std::int64_t _overruns = 0;
+    std::chrono::nanoseconds _busy_time {};
+
+    int _idle_updates = 0;
+
+    double _load = 0;
+    bool _saturated = false;
+
+    std::optional<clock::time_point> _last_update;
+    std::optional<clock::time_point> _settled;
+  };
+
+  /**
+   * @brief Get the level the encoder of a stream was last left at.
+   * @details Streams of the same encoder, codec, size and framerate start where the previous one left off,
+   *          so they don't overrun again.
+   * @param encoder The name of the encoder.
+   * @param video_format The codec, 0 for H.264, 1 for HEVC, 2 for AV1.
+   */
+  int level_for(std::string_view encoder, int video_format, int width, int height, int framerate);
+
+  /**
+   * @brief Remember the level the encoder of a stream was stepped to.
+   */
+  void set_level(std::string_view encoder, int video_format, int width, int height, int framerate, int level);
+}  // namespace encoder_budget
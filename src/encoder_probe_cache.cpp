@@ -0,0 +1,142 @@
+/**
+ * @file src/encoder_probe_cache.cpp
+ * @brief Definitions for the persistent cache of encoder probe results.
+ */
+// standard includes
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "encoder_probe_cache.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace video {
+  namespace {
+    // Bump when the meaning of the cached capabilities changes
+    constexpr int cache_version = 1;
+
+    constexpr std::array<std::string_view, 3> codec_names {"h264"sv, "hevc"sv, "av1"sv};
+  }  // namespace
+
+  encoder_probe_cache_t::encoder_probe_cache_t(std::filesystem::path file):
+      _file {std::move(file)} {
+  }
+
+  void encoder_probe_cache_t::load(const std::string &key) {
+    std::lock_guard lg {_lock};
+
+    // The results in memory are still current
+    if (!key.empty() && key == _key) {
+      return;
+    }
+
+    _key = key;
+    _results.clear();
+
+    std::error_code ec;
+    if (key.empty() || !std::filesystem::exists(_file, ec)) {
+      return;
+    }
+
+    try {
+      std::ifstream in {_file};
+      auto root = nlohmann::json::parse(in);
+
+      if (root.value("version", 0) != cache_version || root.value("key", ""s) != key) {
+        BOOST_LOG(info) << "GPUs, drivers or display configuration changed since the encoders were last probed"sv;
+        return;
+      }
+
+      for (auto &[name, node] : root.at("encoders").items()) {
+        result_t result {node.at("passed").get<bool>(), {}};
+        for (std::size_t x = 0; x < codec_names.size(); ++x) {
+          result.capabilities[x] = node.at(codec_names[x]).get<std::uint64_t>();
+        }
+
+        _results.emplace(name, result);
+      }
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read "sv << _file.string() << ": "sv << e.what();
+      _results.clear();
+    }
+  }
+
+  std::optional<encoder_probe_cache_t::result_t> encoder_probe_cache_t::find(std::string_view encoder) const {
+    std::lock_guard lg {_lock};
+
+    auto it = _results.find(encoder);
+    if (it == std::end(_results)) {
+      return std::nullopt;
+    }
+
+    return it->second;
+  }
+
+  void encoder_probe_cache_t::store(std::string_view encoder, const result_t &result) {
+    std::lock_guard lg {_lock};
+
+    if (_key.empty()) {
+      return;
+    }
+
+    auto it = _results.find(encoder);
+    if (it != std::end(_results) && it->second == result) {
+      return;
+    }
+
+    _results.insert_or_assign(std::string {encoder}, result);
+    save();
+  }
+
+  void encoder_probe_cache_t::clear() {
+    std::lock_guard lg {_lock};
+
+    _key.clear();
+    _results.clear();
+
+    std::error_code ec;
+    std::filesystem::remove(_file, ec);
+  }
+
+  void encoder_probe_cache_t::save() {
+    nlohmann::json encoders = nlohmann::json::object();
+    for (auto &[name, result] : _results) {
+      nlohmann::json node;
+      node["passed"] = result.passed;
+      for (std::size_t x = 0; x < codec_names.size(); ++x) {
+        node[std::string {codec_names[x]}] = result.capabilities[x];
+      }
+
+      encoders[name] = std::move(node);
+    }
+
+    nlohmann::json root;
+    root["version"] = cache_version;
+    root["key"] = _key;
+    root["encoders"] = std::move(encoders);
+
+    // Write to a temporary file first, so a crash never leaves a truncated cache behind
+    auto tmp_file = _file;
+    tmp_file += ".tmp";
+
+    try {
+      {
+        std::ofstream out {tmp_file};
+        out << root.dump(4);
+        if (!out) {
+          throw std::runtime_error {"write failed"};
+        }
+      }
+
+      std::filesystem::rename(tmp_file, _file);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't write "sv << _file.string() << ": "sv << e.what();
+    }
+  }
+}  // namespace video
@@ -0,0 +1,71 @@
+/**
+ * @file src/encoder_probe_cache.h
+ * @brief Declarations for the persistent cache of encoder probe results.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace video {
+  /**
+   * @brief Results of `validate_encoder()` persisted across restarts.
+   * @details The results are tied to a key describing the GPUs, their drivers and the display configuration.
+   *          They are discarded as soon as the key changes, so a stale result is never used.
+   *          All methods are thread-safe, so encoders validated in parallel can store their results directly.
+   */
+  class encoder_probe_cache_t {
+  public:
+    struct result_t {
+      bool passed;  ///< Whether the encoder passed validation.
+      std::array<std::uint64_t, 3> capabilities;  ///< The capabilities of H.264, HEVC and AV1.
+
+      bool operator==(const result_t &) const = default;
+    };
+
+    explicit encoder_probe_cache_t(std::filesystem::path file);
+
+    /**
+     * @brief Load the results cached for a key.
+     * @details Results cached for another key are dropped. An empty key disables the cache.
+     * @param key The key the results must have been cached for.
+     */
+    void load(const std::string &key);
+
+    /**
+     * @brief Get the cached result of an encoder.
+     * @param encoder The name of the encoder.
+     * @return The result, or `std::nullopt` if the encoder has to be probed.
+     */
+    std::optional<result_t> find(std::string_view encoder) const;
+
+    /**
+     * @brief Cache the result of an encoder and write the cache to disk.
+     * @param encoder The name of the encoder.
+     * @param result The result of the validation.
+     */
+    void store(std::string_view encoder, const result_t &result);
+
+    /**
+     * @brief Drop all results, in memory and on disk.
+     */
+    void clear();
+
+  private:
+    void save();
+
+    std::filesystem::path _file;
+
+    mutable std::mutex _lock;
+    std::string _key;
+    std::map<std::string, result_t, std::less<>> _results;
+  };
+}  // namespace video
@@ -3,12 +3,15 @@
  * @brief Definitions for entry handling functions.
  */
 // standard includes
+#include <algorithm>
 #include <csignal>
+#include <filesystem>
 #include <format>
 #include <iostream>
 #include <thread>
 
 // local includes
+#include "capture_benchmark.h"
 #include "config.h"
 #include "confighttp.h"
 #include "entry_handler.h"
@@ -17,6 +20,7 @@
 #include "logging.h"
 #include "network.h"
 #include "platform/common.h"
+#include "video.h"
 
 extern "C" {
 #ifdef _WIN32
@@ -55,6 +59,54 @@ namespace args {
     return 0;
   }
 
+  int benchmark_encoders(const char *name, int argc, char *argv[]) {
+    std::filesystem::path report_file = argc > 0 ? std::filesystem::path {argv[0]} : platf::appdata() / "encoder_benchmark.json";
+
+    auto duration = 5s;
+    if (argc > 1) {
+      try {
+        duration = std::chrono::seconds {std::max(1, std::stoi(argv[1]))};
+      } catch (std::exception &) {
+        help(name);
+        return 1;
+      }
+    }
+
+    auto platf_deinit_guard = platf::init();
+    if (!platf_deinit_guard) {
+      BOOST_LOG(error) << "Platform failed to initialize"sv;
+      return 1;
+    }
+
+    return video::benchmark_encoders(report_file, duration) ? 1 : 0;
+  }
+
+  int benchmark_capture(const char *name, int argc, char *argv[]) {
+    std::filesystem::path report_file = argc > 0 ? std::filesystem::path {argv[0]} : platf::appdata() / "capture_benchmark_report.json";
+
+    auto duration = 5s;
+    int framerate = 60;
+    try {
+      if (argc > 1) {
+        duration = std::chrono::seconds {std::max(1, std::stoi(argv[1]))};
+      }
+      if (argc > 2) {
+        framerate = std::max(1, std::stoi(argv[2]));
+      }
+    } catch (std::exception &) {
+      help(name);
+      return 1;
+    }
+
+    auto platf_deinit_guard = platf::init();
+    if (!platf_deinit_guard) {
+      BOOST_LOG(error) << "Platform failed to initialize"sv;
+      return 1;
+    }
+
+    return video::benchmark_capture(video::encoder_mem_types(), report_file, framerate, duration) ? 1 : 0;
+  }
+
 #ifdef _WIN32
   int restore_nvprefs_undo() {
     if (nvprefs_instance.load()) {
@@ -54,6 +54,28 @@ namespace args {
    */
   int version();
 
+  /**
+   * @brief Benchmark the encoders and write a JSON report, then exit.
+   * @param name The name of the program.
+   * @param argc The number of arguments.
+   * @param argv The arguments, the report file and the number of seconds to encode each display mode, both optional.
+   * @examples
+   * benchmark_encoders("sunshine", 2, {"encoders.json", "10"});
+   * @examples_end
+   */
+  int benchmark_encoders(const char *name, int argc, char *argv[]);
+
+  /**
+   * @brief Benchmark the capture methods and write a JSON report, then exit.
+   * @param name The name of the program.
+   * @param argc The number of arguments.
+   * @param argv The arguments, the report file, the number of seconds to capture with each method and the framerate, all optional.
+   * @examples
+   * benchmark_capture("sunshine", 3, {"capture.json", "10", "120"});
+   * @examples_end
+   */
+  int benchmark_capture(const char *name, int argc, char *argv[]);
+
 #ifdef _WIN32
   /**
    * @brief Restore global NVIDIA control panel settings.
@@ -4,6 +4,7 @@
  */
 
 // standard includes
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 
@@ -42,6 +43,62 @@ namespace file_handler {
     return std::string {(std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()};
   }
 
+  std::string read_file_range(const char *path, std::uintmax_t offset, std::uintmax_t length) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec || offset >= size) {
+      return {};
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    in.seekg(offset);
+
+    std::string contents(std::min(length, size - offset), '\0');
+    in.read(contents.data(), contents.size());
+    contents.resize(in.gcount());
+
+    return contents;
+  }
+
+  std::uintmax_t find_tail(const char *path, std::size_t lines) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec || size == 0) {
+      return 0;
+    }
+    if (lines == 0) {
+      return size;
+    }
+
+    std::ifstream in(path, std::ios::binary);
+
+    // The newline ending the last line doesn't start another line
+    auto end = size;
+    in.seekg(end - 1);
+    if (in.get() == '\n') {
+      --end;
+    }
+
+    char buffer[64 * 1024];
+    while (end > 0) {
+      auto count = std::min<std::uintmax_t>(end, sizeof(buffer));
+      in.seekg(end - count);
+      if (!in.read(buffer, count)) {
+        return 0;
+      }
+
+      for (auto x = count; x > 0; --x) {
+        if (buffer[x - 1] == '\n' && lines-- == 1) {
+          return end - count + x;
+        }
+      }
+
+      end -= count;
+    }
+
+    return 0;
+  }
+
   int write_file(const char *path, const std::string_view &contents) {
     std::ofstream out(path);
 
@@ -53,4 +110,24 @@ namespace file_handler {
 
     return 0;
   }
+
+  int write_file_atomic(const char *path, const std::string_view &contents) {
+    auto temp = std::string {path} + ".tmp";
+    {
+      std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+      if (!out.is_open() || !(out << contents) || !out.flush()) {
+        return -1;
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+      BOOST_LOG(error) << "Couldn't replace " << path << ": " << ec.message();
+      std::filesystem::remove(temp, ec);
+      return -1;
+    }
+
+    return 0;
+  }
 }  // namespace file_handler
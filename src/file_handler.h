@@ -5,6 +5,8 @@
 #pragma once
 
 // standard includes
+#include <cstdint>
+#include <limits>
 #include <string>
 
 /**
@@ -41,6 +43,29 @@ namespace file_handler {
    */
   std::string read_file(const char *path);
 
+  /**
+   * @brief Read part of a file to string.
+   * @param path The path of the file.
+   * @param offset The offset in bytes to start reading at.
+   * @param length The maximum number of bytes to read.
+   * @return The bytes read, fewer than `length` when the file ends first.
+   * @examples
+   * std::string newest = read_file_range("path/to/file", 4096);
+   * @examples_end
+   */
+  std::string read_file_range(const char *path, std::uintmax_t offset, std::uintmax_t length = std::numeric_limits<std::uintmax_t>::max());
+
+  /**
+   * @brief Find where the last lines of a file start, reading only the end of the file.
+   * @param path The path of the file.
+   * @param lines The number of lines.
+   * @return The offset in bytes of the first of the lines, ``0`` when the file has no more lines than that.
+   * @examples
+   * std::string last_lines = read_file_range("path/to/file", find_tail("path/to/file", 100));
+   * @examples_end
+   */
+  std::uintmax_t find_tail(const char *path, std::size_t lines);
+
   /**
    * @brief Writes a file.
    * @param path The path of the file.
@@ -51,4 +76,16 @@ namespace file_handler {
    * @examples_end
    */
   int write_file(const char *path, const std::string_view &contents);
+
+  /**
+   * @brief Replaces a file in one step, so it's never found partially written.
+   * @details The contents go to a temporary file next to it first, which is then renamed over it.
+   * @param path The path of the file.
+   * @param contents The contents to write.
+   * @return ``0`` on success, ``-1`` on failure.
+   * @examples
+   * int write_status = write_file_atomic("path/to/file", "file contents");
+   * @examples_end
+   */
+  int write_file_atomic(const char *path, const std::string_view &contents);
 }  // namespace file_handler
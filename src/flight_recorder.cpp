@@ -0,0 +1,136 @@
+/**
+ * @file src/flight_recorder.cpp
+ * @brief Definitions for the always-on journal of what happened to the latest frames of the streams.
+ */
+// standard includes
+#include <algorithm>
+#include <bit>
+
+// local includes
+#include "flight_recorder.h"
+
+namespace flight_recorder {
+  namespace {
+    // About 6 MB, which holds the last 10 seconds or more of a couple of streams at 240 fps
+    constexpr std::size_t journal_capacity = 1 << 17;
+
+    const char *event_name(event_e event) {
+      switch (event) {
+        case event_e::capture:
+          return "capture";
+        case event_e::convert:
+          return "convert";
+        case event_e::encode:
+          return "encode";
+        case event_e::fec:
+          return "fec";
+        case event_e::send_batch:
+          return "send_batch";
+        case event_e::queue_depth:
+          return "queue_depth";
+        case event_e::idr_request:
+          return "idr_request";
+        case event_e::input:
+          return "input";
+      }
+
+      return "unknown";
+    }
+  }  // namespace
+
+  recorder_t::recorder_t(std::size_t capacity):
+      _mask {std::bit_ceil(std::max<std::uint64_t>(capacity, 1)) - 1} {
+    _slots = std::make_unique<slot_t[]>(_mask + 1);
+  }
+
+  void recorder_t::record(event_e event, std::uint32_t session, std::int64_t frame_index, std::int64_t value, std::int64_t aux, std::chrono::steady_clock::time_point now) {
+    auto index = _next.fetch_add(1, std::memory_order_relaxed);
+    auto &slot = _slots[index & _mask];
+
+    // A reader that sees the fields change sees the sequence change too
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.time.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    slot.meta.store((std::uint64_t) session << 16 | (std::uint64_t) event, std::memory_order_relaxed);
+    slot.frame_index.store(frame_index, std::memory_order_relaxed);
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.aux.store(aux, std::memory_order_relaxed);
+
+    slot.sequence.store(index + 1, std::memory_order_release);
+  }
+
+  std::vector<record_t> recorder_t::since(std::chrono::steady_clock::time_point since) const {
+    std::vector<record_t> records;
+
+    auto end = _next.load(std::memory_order_acquire);
+    auto begin = end > _mask + 1 ? end - (_mask + 1) : 0;
+    records.reserve(end - begin);
+
+    for (auto index = begin; index < end; ++index) {
+      auto &slot = _slots[index & _mask];
+
+      // Still being written, or overwritten since
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence != index + 1) {
+        continue;
+      }
+
+      auto time = std::chrono::steady_clock::time_point {std::chrono::steady_clock::duration {slot.time.load(std::memory_order_relaxed)}};
+      auto meta = slot.meta.load(std::memory_order_relaxed);
+      record_t record {
+        time,
+        (event_e) (meta & 0xFFFF),
+        (std::uint32_t) (meta >> 16),
+        slot.frame_index.load(std::memory_order_relaxed),
+        slot.value.load(std::memory_order_relaxed),
+        slot.aux.load(std::memory_order_relaxed),
+      };
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != sequence || time < since) {
+        continue;
+      }
+
+      records.emplace_back(record);
+    }
+
+    // Threads recording at once may have taken their slots in another order than their times
+    std::stable_sort(std::begin(records), std::end(records), [](const record_t &a, const record_t &b) {
+      return a.time < b.time;
+    });
+
+    return records;
+  }
+
+  recorder_t &journal() {
+    static recorder_t journal {journal_capacity};
+    return journal;
+  }
+
+  std::uint32_t session_id(const void *session) {
+    if (!session) {
+      return 0;
+    }
+
+    auto id = (std::uint32_t) (((std::uint64_t) (std::uintptr_t) session * 0x9E3779B97F4A7C15ull) >> 32);
+    return id ? id : 1;
+  }
+
+  nlohmann::json to_json(const std::vector<record_t> &records, std::chrono::steady_clock::time_point now) {
+    nlohmann::json node = nlohmann::json::array();
+
+    for (auto &record : records) {
+      node.push_back({
+        {"age_us", std::chrono::duration_cast<std::chrono::microseconds>(now - record.time).count()},
+        {"event", event_name(record.event)},
+        {"session", record.session},
+        {"frame", record.frame_index},
+        {"value", record.value},
+        {"aux", record.aux},
+      });
+    }
+
+    return node;
+  }
+}  // namespace flight_recorder
@@ -0,0 +1,119 @@
+/**
+ * @file src/flight_recorder.h
+ * @brief Declarations for the always-on journal of what happened to the latest frames of the streams.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+namespace flight_recorder {
+  /**
+   * @brief What a record is about, and what its value and aux fields hold.
+   */
+  enum class event_e : std::uint16_t {
+    capture,  ///< The capture thread got a new image. The value is its content version, aux the ns since it was presented.
+    convert,  ///< An image was converted for the encoder. The value is the ns it took.
+    encode,  ///< A frame was encoded. The value is the ns it took.
+    fec,  ///< A block of a frame was protected with FEC and encrypted. The value is the ns it took, aux the block.
+    send_batch,  ///< A batch of packets was sent. The value is the number of packets, aux the ns slept to pace it.
+    queue_depth,  ///< The video sender took a frame. The value is the number of frames still queued.
+    idr_request,  ///< The encoder took a request for an IDR frame.
+    input,  ///< An input packet arrived. The value is its size.
+  };
+
+  /**
+   * @brief A record read back from the journal.
+   */
+  struct record_t {
+    std::chrono::steady_clock::time_point time;
+    event_e event;
+    std::uint32_t session;  ///< The session the record is about, 0 for none.
+    std::int64_t frame_index;  ///< The frame the record is about, 0 for none.
+    std::int64_t value;
+    std::int64_t aux;
+  };
+
+  /**
+   * @brief A fixed-capacity ring of records, overwriting the oldest ones.
+   * @details Recording is a relaxed increment and a few relaxed stores, so any thread can record
+   *          on its hot path. A record being overwritten while it's read is skipped by the reader.
+   */
+  class recorder_t {
+  public:
+    /**
+     * @param capacity The number of records kept, rounded up to a power of two.
+     */
+    explicit recorder_t(std::size_t capacity);
+
+    /**
+     * @brief Append a record.
+     * @param event What the record is about.
+     * @param session The session, 0 for none.
+     * @param frame_index The frame, 0 for none.
+     * @param value The value, as described by the event.
+     * @param aux The aux field, as described by the event.
+     * @param now When it happened.
+     */
+    void record(event_e event, std::uint32_t session, std::int64_t frame_index, std::int64_t value, std::int64_t aux = 0, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    /**
+     * @brief Get the records since a point in time, oldest first.
+     * @param since The time of the oldest record wanted.
+     */
+    std::vector<record_t> since(std::chrono::steady_clock::time_point since) const;
+
+  private:
+    struct slot_t {
+      // The index the slot was last written at plus one, 0 while it's written
+      std::atomic_uint64_t sequence {0};
+      std::atomic_int64_t time {0};
+      std::atomic_uint64_t meta {0};
+      std::atomic_int64_t frame_index {0};
+      std::atomic_int64_t value {0};
+      std::atomic_int64_t aux {0};
+    };
+
+    std::unique_ptr<slot_t[]> _slots;
+    std::uint64_t _mask;
+    std::atomic_uint64_t _next {0};
+  };
+
+  /**
+   * @brief Get the journal of the streams.
+   */
+  recorder_t &journal();
+
+  /**
+   * @brief Get the id a session is recorded under.
+   * @param session The `channel_data` of the session.
+   */
+  std::uint32_t session_id(const void *session);
+
+  /**
+   * @brief Append a record to the journal of the streams.
+   * @param event What the record is about.
+   * @param session The `channel_data` of the session, or nullptr for none.
+   * @param frame_index The frame, 0 for none.
+   * @param value The value, as described by the event.
+   * @param aux The aux field, as described by the event.
+   */
+  inline void record(event_e event, const void *session, std::int64_t frame_index, std::int64_t value, std::int64_t aux = 0) {
+    journal().record(event, session_id(session), frame_index, value, aux);
+  }
+
+  /**
+   * @brief Get records as JSON.
+   * @param records The records, oldest first.
+   * @param now The time their age is given from.
+   * @return The records, each with its age in microseconds and the name of its event.
+   */
+  nlohmann::json to_json(const std::vector<record_t> &records, std::chrono::steady_clock::time_point now);
+}  // namespace flight_recorder
@@ -0,0 +1,156 @@
+/**
+ * @file src/frame_arena.h
+ * @brief Declarations for a bump allocator of buffers that live for a single frame.
+ */
+#pragma once
+
+// standard includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace util {
+  /**
+   * @brief Bump allocator for buffers that share the lifetime of a single frame.
+   * @details Allocations are carved out of one contiguous block and are all released at once by reset().
+   *          Allocations that don't fit go to overflow blocks, and the next reset() grows the main block
+   *          to the high-water mark, so a steady stream of similarly sized frames stops allocating entirely.
+   *          Destructors are never run, so only trivially destructible types may be stored.
+   */
+  class frame_arena_t {
+  public:
+    frame_arena_t() = default;
+
+    explicit frame_arena_t(std::size_t capacity):
+        _block {new std::byte[capacity]},
+        _capacity {capacity} {
+    }
+
+    frame_arena_t(const frame_arena_t &) = delete;
+    frame_arena_t &operator=(const frame_arena_t &) = delete;
+
+    // The largest alignment of an allocation, a cache line
+    static constexpr std::size_t max_alignment = 64;
+
+    /**
+     * @brief Allocate uninitialized memory that stays valid until the next reset().
+     * @param size The number of bytes.
+     * @param alignment The alignment, a power of two up to `max_alignment`.
+     * @return Pointer to the allocated memory.
+     */
+    void *allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+      auto base = (std::uintptr_t) _block.get();
+      auto offset = ((base + _used + alignment - 1) & ~(alignment - 1)) - base;
+
+      if (offset + size <= _capacity) {
+        _used = offset + size;
+        return &_block[offset];
+      }
+
+      // Blocks are only aligned to std::max_align_t, over-aligned allocations are aligned within them
+      _overflow_size += size + alignment;
+      auto overflow = (std::uintptr_t) _overflow.emplace_back(new std::byte[size + alignment - 1]).get();
+      return (void *) ((overflow + alignment - 1) & ~(alignment - 1));
+    }
+
+    /**
+     * @brief Allocate an uninitialized array that stays valid until the next reset().
+     * @tparam T The element type.
+     * @param count The number of elements.
+     * @param alignment The alignment, at least that of `T` and at most `max_alignment`.
+     * @return The allocated elements.
+     */
+    template<class T>
+    std::span<T> alloc(std::size_t count, std::size_t alignment = alignof(T)) {
+      static_assert(std::is_trivially_destructible_v<T>, "frame_arena_t never runs destructors");
+      static_assert(alignof(T) <= max_alignment, "frame_arena_t doesn't support over-aligned types");
+
+      return {(T *) allocate(sizeof(T) * count, std::max(alignment, alignof(T))), count};
+    }
+
+    /**
+     * @brief Release every allocation made since the last reset().
+     * @details If the previous frame didn't fit, the main block is grown to hold all of it.
+     */
+    void reset() {
+      if (!_overflow.empty()) {
+        _capacity = _used + _overflow_size;
+        _block.reset(new std::byte[_capacity]);
+
+        _overflow.clear();
+        _overflow_size = 0;
+      }
+
+      _used = 0;
+    }
+
+    /**
+     * @brief Get the size of the main block.
+     * @return The number of bytes that can be allocated without touching the heap.
+     */
+    std::size_t capacity() const {
+      return _capacity;
+    }
+
+  private:
+    std::unique_ptr<std::byte[]> _block;
+    std::size_t _capacity = 0;
+    std::size_t _used = 0;
+
+    std::vector<std::unique_ptr<std::byte[]>> _overflow;
+    std::size_t _overflow_size = 0;
+  };
+
+  /**
+   * @brief Allocator that lets standard containers use a `frame_arena_t`.
+   * @tparam T The value type.
+   */
+  template<class T>
+  class arena_allocator_t {
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    /**
+     * @param arena The arena to allocate from.
+     * @param alignment The alignment of every allocation, raised to that of the value type.
+     */
+    explicit arena_allocator_t(frame_arena_t &arena, std::size_t alignment = alignof(T)) noexcept:
+        _arena {&arena},
+        _alignment {alignment} {
+    }
+
+    template<class U>
+    arena_allocator_t(const arena_allocator_t<U> &other) noexcept:
+        _arena {other._arena},
+        _alignment {other._alignment} {
+    }
+
+    T *allocate(std::size_t n) {
+      return (T *) _arena->allocate(sizeof(T) * n, std::max(_alignment, alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t) noexcept {
+      // Memory is released by frame_arena_t::reset()
+    }
+
+    template<class U>
+    bool operator==(const arena_allocator_t<U> &other) const noexcept {
+      return _arena == other._arena;
+    }
+
+  private:
+    template<class U>
+    friend class arena_allocator_t;
+
+    frame_arena_t *_arena;
+    std::size_t _alignment;
+  };
+}  // namespace util
@@ -53,6 +53,9 @@ namespace mail {
   MAIL(touch_port);
   MAIL(idr);
   MAIL(invalidate_ref_frames);
+  MAIL(bitrate);
+  MAIL(audio_loss);
+  MAIL(shared_encoder_packets);
   MAIL(gamepad_feedback);
   MAIL(hdr);
 #undef MAIL
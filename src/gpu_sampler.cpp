@@ -0,0 +1,268 @@
+/**
+ * @file src/gpu_sampler.cpp
+ * @brief Definitions for sampling the utilization of the GPUs while streaming.
+ */
+// standard includes
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <vector>
+
+// platform includes
+#ifdef _WIN32
+  #include <Windows.h>
+#elif defined(__linux__)
+  #include <dlfcn.h>
+#endif
+
+// local includes
+#include "admission.h"
+#include "gpu_sampler.h"
+#include "gpu_scheduler.h"
+#include "logging.h"
+#include "metrics.h"
+#include "platform/common.h"
+
+using namespace std::literals;
+
+namespace gpu_sampler {
+  namespace {
+    constexpr auto interval = 1s;
+
+#if defined(_WIN32) || defined(__linux__)
+    /**
+     * @brief The parts of NVML the sampler calls, loaded at runtime since it ships with the driver.
+     */
+    namespace nvml {
+      using return_t = int;
+      using device_t = struct device_st *;
+
+      constexpr return_t SUCCESS = 0;
+      constexpr unsigned int CLOCK_GRAPHICS = 0;
+
+      struct pci_info_t {
+        char bus_id_legacy[16];
+        unsigned int domain;
+        unsigned int bus;
+        unsigned int device;
+        unsigned int pci_device_id;
+        unsigned int pci_sub_system_id;
+        char bus_id[32];
+      };
+
+      struct utilization_t {
+        unsigned int gpu;
+        unsigned int memory;
+      };
+
+      struct memory_t {
+        unsigned long long total;
+        unsigned long long free;
+        unsigned long long used;
+      };
+
+      return_t (*init)();
+      return_t (*device_get_count)(unsigned int *count);
+      return_t (*device_get_handle_by_index)(unsigned int index, device_t *device);
+      return_t (*device_get_name)(device_t device, char *name, unsigned int length);
+      return_t (*device_get_pci_info)(device_t device, pci_info_t *pci);
+      return_t (*device_get_utilization_rates)(device_t device, utilization_t *utilization);
+      return_t (*device_get_encoder_utilization)(device_t device, unsigned int *utilization, unsigned int *sampling_period_us);
+      return_t (*device_get_encoder_stats)(device_t device, unsigned int *sessions, unsigned int *average_fps, unsigned int *average_latency);
+      return_t (*device_get_clock_info)(device_t device, unsigned int type, unsigned int *mhz);
+      return_t (*device_get_memory_info)(device_t device, memory_t *memory);
+
+      bool load() {
+  #ifdef _WIN32
+        auto handle = LoadLibraryExA("nvml.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+        auto symbol = [handle](const char *name) {
+          return (void *) GetProcAddress(handle, name);
+        };
+  #else
+        auto handle = dlopen("libnvidia-ml.so.1", RTLD_LAZY | RTLD_LOCAL);
+        auto symbol = [handle](const char *name) {
+          return dlsym(handle, name);
+        };
+  #endif
+        if (!handle) {
+          BOOST_LOG(debug) << "NVML isn't installed, NVIDIA GPUs won't be sampled through it"sv;
+          return false;
+        }
+
+        std::tuple<void **, const char *> funcs[] {
+          {(void **) &init, "nvmlInit_v2"},
+          {(void **) &device_get_count, "nvmlDeviceGetCount_v2"},
+          {(void **) &device_get_handle_by_index, "nvmlDeviceGetHandleByIndex_v2"},
+          {(void **) &device_get_name, "nvmlDeviceGetName"},
+          {(void **) &device_get_pci_info, "nvmlDeviceGetPciInfo_v3"},
+          {(void **) &device_get_utilization_rates, "nvmlDeviceGetUtilizationRates"},
+          {(void **) &device_get_encoder_utilization, "nvmlDeviceGetEncoderUtilization"},
+          {(void **) &device_get_encoder_stats, "nvmlDeviceGetEncoderStats"},
+          {(void **) &device_get_clock_info, "nvmlDeviceGetClockInfo"},
+          {(void **) &device_get_memory_info, "nvmlDeviceGetMemoryInfo"},
+        };
+
+        for (auto &[func, name] : funcs) {
+          *func = symbol(name);
+          if (!*func) {
+            BOOST_LOG(warning) << "NVML is missing "sv << name << ", NVIDIA GPUs won't be sampled through it"sv;
+            return false;
+          }
+        }
+
+        return init() == SUCCESS;
+      }
+
+      /**
+       * @brief Sample the NVIDIA GPUs, leaving out what the driver doesn't report for one.
+       */
+      std::vector<metrics::gpu_metrics_t> sample() {
+        std::vector<metrics::gpu_metrics_t> gpus;
+
+        unsigned int count;
+        if (device_get_count(&count) != SUCCESS) {
+          return gpus;
+        }
+
+        for (unsigned int x = 0; x < count; ++x) {
+          device_t device;
+          if (device_get_handle_by_index(x, &device) != SUCCESS) {
+            continue;
+          }
+
+          metrics::gpu_metrics_t sample;
+
+          // The platform names GPUs by what it opens them with, which NVML only knows the PCI address of
+          if (pci_info_t pci; device_get_pci_info(device, &pci) == SUCCESS) {
+            sample.gpu = platf::gpu_by_pci_address(pci.domain, pci.bus, pci.device);
+          }
+          if (char name[96]; sample.gpu.empty() && device_get_name(device, name, sizeof(name)) == SUCCESS) {
+            sample.gpu = name;
+          }
+
+          if (utilization_t utilization; device_get_utilization_rates(device, &utilization) == SUCCESS) {
+            sample.busy_percent = (int) utilization.gpu;
+          }
+          if (unsigned int utilization, period_us; device_get_encoder_utilization(device, &utilization, &period_us) == SUCCESS) {
+            sample.encoder_percent = (int) utilization;
+          }
+          if (unsigned int sessions, fps, latency; device_get_encoder_stats(device, &sessions, &fps, &latency) == SUCCESS) {
+            sample.encoder_sessions = (int) sessions;
+          }
+          if (unsigned int mhz; device_get_clock_info(device, CLOCK_GRAPHICS, &mhz) == SUCCESS) {
+            sample.clock_mhz = (int) mhz;
+          }
+          if (memory_t memory; device_get_memory_info(device, &memory) == SUCCESS) {
+            sample.memory_used_bytes = (std::int64_t) memory.used;
+            sample.memory_budget_bytes = (std::int64_t) memory.total;
+          }
+
+          gpus.emplace_back(std::move(sample));
+        }
+
+        return gpus;
+      }
+    }  // namespace nvml
+#endif
+
+    /**
+     * @brief Sample every GPU, taking what the platform reports over what NVML left unknown.
+     */
+    std::vector<metrics::gpu_metrics_t> sample(bool nvml_loaded) {
+      auto gpus = platf::sample_gpus();
+
+#if defined(_WIN32) || defined(__linux__)
+      if (!nvml_loaded) {
+        return gpus;
+      }
+
+      for (auto &nvidia : nvml::sample()) {
+        auto it = std::find_if(std::begin(gpus), std::end(gpus), [&nvidia](const auto &gpu) {
+          return gpu.gpu == nvidia.gpu;
+        });
+        if (it == std::end(gpus)) {
+          gpus.emplace_back(std::move(nvidia));
+          continue;
+        }
+
+        auto merge = [](auto &value, auto other) {
+          if (value < 0) {
+            value = other;
+          }
+        };
+        merge(it->busy_percent, nvidia.busy_percent);
+        merge(it->encoder_percent, nvidia.encoder_percent);
+        merge(it->encoder_sessions, nvidia.encoder_sessions);
+        merge(it->clock_mhz, nvidia.clock_mhz);
+        merge(it->memory_used_bytes, nvidia.memory_used_bytes);
+        merge(it->memory_budget_bytes, nvidia.memory_budget_bytes);
+      }
+#endif
+
+      return gpus;
+    }
+  }  // namespace
+
+  static void run(ctx_t &ctx) {
+#if defined(_WIN32) || defined(__linux__)
+    static bool nvml_loaded = nvml::load();
+#else
+    constexpr bool nvml_loaded = false;
+#endif
+
+    std::unique_lock ul {ctx.lock};
+    while (!ctx.stop) {
+      ul.unlock();
+
+      auto gpus = sample(nvml_loaded);
+
+      int sessions = -1;
+      for (auto &gpu : gpus) {
+        if (gpu.encoder_sessions >= 0) {
+          sessions = std::max(sessions, 0) + gpu.encoder_sessions;
+        }
+
+        // The encoder is what sessions compete for, the GPU as a whole stands in where it isn't reported
+        auto percent = gpu.encoder_percent >= 0 ? gpu.encoder_percent : gpu.busy_percent;
+        if (percent >= 0) {
+          gpu_scheduler::instance().set_sampled_utilization(gpu.gpu, percent / 100.0);
+        }
+      }
+      admission::instance().set_sampled_sessions(sessions);
+      metrics::set_gpus(std::move(gpus));
+
+      ul.lock();
+      ctx.cv.wait_for(ul, interval, [&ctx]() {
+        return ctx.stop;
+      });
+    }
+  }
+
+  static int start(ctx_t &ctx) {
+    ctx.stop = false;
+    ctx.thread = std::thread {run, std::ref(ctx)};
+    return 0;
+  }
+
+  static void stop(ctx_t &ctx) {
+    {
+      std::lock_guard lg {ctx.lock};
+      ctx.stop = true;
+    }
+    ctx.cv.notify_all();
+    ctx.thread.join();
+
+    // A stale sample would outlive the stream, and keep weighing on the scheduler after it
+    for (auto &gpu : metrics::gpus()) {
+      gpu_scheduler::instance().set_sampled_utilization(gpu.gpu, 0);
+    }
+    admission::instance().set_sampled_sessions(-1);
+    metrics::set_gpus({});
+  }
+
+  ref_t get_ref() {
+    static auto ctx_shared {safe::make_shared<ctx_t>(start, stop)};
+    return ctx_shared.ref();
+  }
+}  // namespace gpu_sampler
@@ -0,0 +1,33 @@
+/**
+ * @file src/gpu_sampler.h
+ * @brief Declarations for sampling the utilization of the GPUs while streaming.
+ */
+#pragma once
+
+// standard includes
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// local includes
+#include "thread_safe.h"
+
+namespace gpu_sampler {
+  struct ctx_t {
+    std::mutex lock;
+    std::condition_variable cv;
+    bool stop;
+    std::thread thread;
+  };
+
+  using ref_t = safe::shared_t<ctx_t>::ptr_t;
+
+  /**
+   * @brief Sample the GPUs once a second while a reference is held.
+   * @details Each sample replaces `metrics::gpus()`, and the busy share of each encoder feeds the load
+   *          `gpu_scheduler::instance()` places new sessions by, which counts encoders of other processes.
+   *          NVIDIA GPUs are sampled through NVML when its library is installed, the others through `platf::sample_gpus()`.
+   * @return The reference, which keeps the sampling thread running until the last one is released.
+   */
+  ref_t get_ref();
+}  // namespace gpu_sampler
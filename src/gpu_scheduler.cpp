@@ -0,0 +1,178 @@
+/**
+ * @file src/gpu_scheduler.cpp
+ * @brief Definitions for placing the encode sessions of concurrent streams on the GPUs of the host.
+ */
+// standard includes
+#include <algorithm>
+#include <utility>
+
+// local includes
+#include "config.h"
+#include "gpu_scheduler.h"
+#include "platform/common.h"
+
+namespace gpu_scheduler {
+  namespace {
+    // How much each frame moves the utilization of a session
+    constexpr double smoothing = 0.1;
+
+    thread_local placement_t *current_placement = nullptr;
+  }  // namespace
+
+  scheduler_t::lease_t::lease_t(scheduler_t *scheduler, std::string gpu):
+      _scheduler {scheduler},
+      _gpu {std::move(gpu)} {
+  }
+
+  scheduler_t::lease_t::lease_t(lease_t &&other) noexcept:
+      _scheduler {std::exchange(other._scheduler, nullptr)},
+      _gpu {std::move(other._gpu)},
+      _utilization {other._utilization},
+      _last_frame {other._last_frame} {
+  }
+
+  scheduler_t::lease_t &scheduler_t::lease_t::operator=(lease_t &&other) noexcept {
+    if (this != &other) {
+      release();
+
+      _scheduler = std::exchange(other._scheduler, nullptr);
+      _gpu = std::move(other._gpu);
+      _utilization = other._utilization;
+      _last_frame = other._last_frame;
+    }
+
+    return *this;
+  }
+
+  scheduler_t::lease_t::~lease_t() {
+    release();
+  }
+
+  void scheduler_t::lease_t::release() {
+    if (!_scheduler) {
+      return;
+    }
+
+    std::lock_guard lg {_scheduler->_lock};
+    if (auto gpu = _scheduler->find(_gpu)) {
+      --gpu->sessions;
+      gpu->utilization = std::max(0.0, gpu->utilization - _utilization);
+    }
+    _scheduler = nullptr;
+  }
+
+  void scheduler_t::lease_t::frame_encoded(std::chrono::nanoseconds encode_time, clock::time_point now) {
+    if (!_scheduler) {
+      return;
+    }
+
+    auto last_frame = std::exchange(_last_frame, now);
+    if (!last_frame || now <= *last_frame) {
+      return;
+    }
+
+    auto share = std::clamp((double) encode_time.count() / (now - *last_frame).count(), 0.0, 1.0);
+    auto utilization = _utilization + (share - _utilization) * smoothing;
+
+    std::lock_guard lg {_scheduler->_lock};
+    if (auto gpu = _scheduler->find(_gpu)) {
+      gpu->utilization = std::max(0.0, gpu->utilization + utilization - _utilization);
+    }
+    _utilization = utilization;
+  }
+
+  scheduler_t::scheduler_t(std::vector<std::string> gpus) {
+    for (auto &gpu : gpus) {
+      _gpus.emplace_back().name = std::move(gpu);
+    }
+  }
+
+  std::optional<std::string> scheduler_t::choose(int video_format) const {
+    std::lock_guard lg {_lock};
+
+    const gpu_t *best = nullptr;
+    auto load = [](const gpu_t &gpu) {
+      return std::max(gpu.utilization, gpu.sampled_utilization) + gpu.sessions * session_weight;
+    };
+    for (auto &gpu : _gpus) {
+      if (gpu.incapable_formats.contains(video_format)) {
+        continue;
+      }
+
+      if (!best || load(gpu) < load(*best)) {
+        best = &gpu;
+      }
+    }
+
+    if (!best) {
+      return std::nullopt;
+    }
+    return best->name;
+  }
+
+  void scheduler_t::mark_incapable(const std::string &gpu, int video_format) {
+    std::lock_guard lg {_lock};
+    if (auto it = find(gpu)) {
+      it->incapable_formats.insert(video_format);
+    }
+  }
+
+  scheduler_t::lease_t scheduler_t::attach(const std::string &gpu) {
+    std::lock_guard lg {_lock};
+
+    auto it = find(gpu);
+    if (!it) {
+      return {};
+    }
+
+    ++it->sessions;
+    return {this, gpu};
+  }
+
+  void scheduler_t::set_sampled_utilization(const std::string &gpu, double utilization) {
+    std::lock_guard lg {_lock};
+    if (auto it = find(gpu)) {
+      it->sampled_utilization = utilization;
+    }
+  }
+
+  std::vector<scheduler_t::load_t> scheduler_t::loads() const {
+    std::lock_guard lg {_lock};
+
+    std::vector<load_t> loads;
+    for (auto &gpu : _gpus) {
+      loads.push_back({gpu.name, gpu.sessions, gpu.utilization, gpu.sampled_utilization});
+    }
+    return loads;
+  }
+
+  scheduler_t::gpu_t *scheduler_t::find(const std::string &gpu) {
+    auto it = std::find_if(std::begin(_gpus), std::end(_gpus), [&](const gpu_t &x) {
+      return x.name == gpu;
+    });
+    return it == std::end(_gpus) ? nullptr : &*it;
+  }
+
+  scheduler_t &instance() {
+    static scheduler_t scheduler {platf::encode_gpus()};
+    return scheduler;
+  }
+
+  placement_t::placement_t(std::string gpu):
+      _gpu {std::move(gpu)},
+      _previous {std::exchange(current_placement, this)} {
+  }
+
+  placement_t::~placement_t() {
+    current_placement = _previous;
+  }
+
+  std::string render_device() {
+    if (current_placement && !current_placement->_gpu.empty()) {
+      current_placement->_used = true;
+      return current_placement->_gpu;
+    }
+
+    return config::video.adapter_name;
+  }
+}  // namespace gpu_scheduler
@@ -0,0 +1,166 @@
+/**
+ * @file src/gpu_scheduler.h
+ * @brief Declarations for placing the encode sessions of concurrent streams on the GPUs of the host.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace gpu_scheduler {
+  /**
+   * @brief Tracks the encode sessions running on each GPU, and places new ones on the least loaded one.
+   * @details The load of a GPU is the share of the time its sessions spend encoding, measured frame by frame,
+   *          plus a little for each session so idle sessions still spread out. GPUs that failed to open an
+   *          encoder for a codec aren't chosen for it again. All methods are thread-safe.
+   */
+  class scheduler_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief The load of a GPU.
+     */
+    struct load_t {
+      std::string gpu;
+      int sessions;
+      double utilization;  ///< The share of the time spent encoding, summed over the sessions.
+      double sampled_utilization;  ///< The share of the time the encoder of the GPU was busy, as last sampled.
+    };
+
+    /**
+     * @brief A session running on a GPU, which counts toward its load until it's destroyed.
+     */
+    class lease_t {
+    public:
+      lease_t() = default;
+      lease_t(lease_t &&other) noexcept;
+      lease_t &operator=(lease_t &&other) noexcept;
+      ~lease_t();
+
+      /**
+       * @brief Account for a frame the session encoded.
+       * @param encode_time How long it took.
+       * @param now The current time.
+       */
+      void frame_encoded(std::chrono::nanoseconds encode_time, clock::time_point now = clock::now());
+
+    private:
+      friend class scheduler_t;
+
+      lease_t(scheduler_t *scheduler, std::string gpu);
+
+      void release();
+
+      scheduler_t *_scheduler = nullptr;
+      std::string _gpu;
+
+      // The smoothed share of the time this session spends encoding
+      double _utilization = 0;
+      std::optional<clock::time_point> _last_frame;
+    };
+
+    /**
+     * @param gpus The GPUs sessions can be placed on, preferred in this order when they're equally loaded.
+     */
+    explicit scheduler_t(std::vector<std::string> gpus);
+
+    /**
+     * @brief Choose the GPU for a new session.
+     * @param video_format The codec of the session, 0 for H.264, 1 for HEVC, 2 for AV1.
+     * @return The least loaded GPU that can encode the codec, or `std::nullopt` if none is left to choose from.
+     */
+    std::optional<std::string> choose(int video_format) const;
+
+    /**
+     * @brief Remember that a GPU failed to open an encoder for a codec.
+     */
+    void mark_incapable(const std::string &gpu, int video_format);
+
+    /**
+     * @brief Count a session toward the load of a GPU.
+     * @param gpu The GPU, which may be empty for a session that wasn't placed.
+     * @return The lease of the session, which does nothing for a GPU that isn't scheduled.
+     */
+    lease_t attach(const std::string &gpu);
+
+    /**
+     * @brief Account for the utilization of a GPU as sampled from the driver.
+     * @details This includes encoders of other processes, so the load of a GPU is the larger of this and
+     *          the share of the time the sessions placed on it spend encoding.
+     * @param gpu The GPU.
+     * @param utilization The share of the time its encoder was busy, between 0 and 1.
+     */
+    void set_sampled_utilization(const std::string &gpu, double utilization);
+
+    /**
+     * @brief Get the load of each GPU.
+     */
+    std::vector<load_t> loads() const;
+
+  private:
+    // Each session weighs as much as this share of encoding time, so a GPU with fewer of them wins a tie
+    static constexpr double session_weight = 0.05;
+
+    struct gpu_t {
+      std::string name;
+      int sessions = 0;
+      double utilization = 0;
+      double sampled_utilization = 0;
+      std::set<int> incapable_formats;
+    };
+
+    gpu_t *find(const std::string &gpu);
+
+    mutable std::mutex _lock;
+    std::vector<gpu_t> _gpus;
+  };
+
+  /**
+   * @brief Get the scheduler of the GPUs `platf::encode_gpus()` reports.
+   */
+  scheduler_t &instance();
+
+  /**
+   * @brief Place the encode devices created on the current thread on a GPU while it's alive.
+   * @details Encode devices that open a GPU by name rather than the one their display captures on call
+   *          `render_device()`, which returns the placed GPU rather than `config::video.adapter_name`.
+   *          Their images are uploaded from system memory, or imported as DMA-BUFs, either of which crosses GPUs.
+   */
+  class placement_t {
+  public:
+    /**
+     * @param gpu The GPU, or an empty string to leave encode devices where they'd be without it.
+     */
+    explicit placement_t(std::string gpu);
+    ~placement_t();
+
+    placement_t(const placement_t &) = delete;
+    placement_t &operator=(const placement_t &) = delete;
+
+    /**
+     * @brief Get whether an encode device was opened on the GPU.
+     */
+    bool used() const {
+      return _used;
+    }
+
+  private:
+    friend std::string render_device();
+
+    std::string _gpu;
+    bool _used = false;
+    placement_t *_previous;
+  };
+
+  /**
+   * @brief Get the GPU an encode device opening one by name should open.
+   * @return The GPU placed on the current thread, or else `config::video.adapter_name`, which may be empty.
+   */
+  std::string render_device();
+}  // namespace gpu_scheduler
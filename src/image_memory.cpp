@@ -0,0 +1,323 @@
+/**
+ * @file src/image_memory.cpp
+ * @brief Definitions for allocating the pixels of captured images.
+ */
+// standard includes
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+// platform includes
+#ifdef _WIN32
+  #include <Windows.h>
+#elif defined(__linux__)
+  #include <sys/mman.h>
+#endif
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define IMAGE_COPY_X86 1
+  #include <immintrin.h>
+#endif
+
+// local includes
+#include "image_memory.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace util {
+  namespace {
+#if defined(_WIN32) || defined(__linux__)
+    struct mapping_t {
+      std::size_t size;
+      bool working_set_grown;
+    };
+
+    // Images are allocated a handful of times per stream, so a locked map of them is cheap enough
+    std::mutex mappings_lock;
+    std::unordered_map<std::uint8_t *, mapping_t> mappings;
+
+    struct watch_t {
+      image_watch_fn allocated;
+      image_watch_fn freeing;
+    };
+
+    // Guarded by mappings_lock
+    int next_watch_id = 0;
+    std::unordered_map<int, watch_t> watches;
+
+    std::size_t round_up(std::size_t size, std::size_t alignment) {
+      return (size + alignment - 1) / alignment * alignment;
+    }
+
+    void log_not_locked_once() {
+      static std::once_flag logged;
+      std::call_once(logged, []() {
+        BOOST_LOG(debug) << "Captured images can't be locked in memory, they may be paged out"sv;
+      });
+    }
+#endif
+
+#ifdef _WIN32
+    bool resize_working_set(std::size_t size, bool grow) {
+      SIZE_T minimum, maximum;
+      DWORD flags;
+      if (!GetProcessWorkingSetSizeEx(GetCurrentProcess(), &minimum, &maximum, &flags)) {
+        return false;
+      }
+
+      if (grow) {
+        return SetProcessWorkingSetSizeEx(GetCurrentProcess(), minimum + size, maximum + size, flags);
+      }
+      return SetProcessWorkingSetSizeEx(GetCurrentProcess(), minimum - size, maximum - size, flags);
+    }
+
+    std::uint8_t *map(mapping_t &mapping) {
+      auto size = mapping.size;
+
+      USHORT node = NUMA_NO_PREFERRED_NODE;
+      PROCESSOR_NUMBER processor;
+      GetCurrentProcessorNumberEx(&processor);
+      if (!GetNumaProcessorNodeEx(&processor, &node)) {
+        node = NUMA_NO_PREFERRED_NODE;
+      }
+
+      void *data = nullptr;
+
+      // Large pages need SeLockMemoryPrivilege, and are always locked
+      auto large_page = GetLargePageMinimum();
+      if (large_page && size >= large_page) {
+        auto length = round_up(size, large_page);
+        data = VirtualAllocExNuma(GetCurrentProcess(), nullptr, length, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+        if (data) {
+          mapping.size = length;
+          return (std::uint8_t *) data;
+        }
+      }
+
+      data = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+      if (!data) {
+        return nullptr;
+      }
+
+      // Locked pages count against the minimum working set, which grows by the image while it exists
+      mapping.working_set_grown = resize_working_set(size, true);
+      if (!mapping.working_set_grown || !VirtualLock(data, size)) {
+        log_not_locked_once();
+      }
+
+      return (std::uint8_t *) data;
+    }
+
+    void unmap(std::uint8_t *data, const mapping_t &mapping) {
+      VirtualFree(data, 0, MEM_RELEASE);
+
+      if (mapping.working_set_grown) {
+        resize_working_set(mapping.size, false);
+      }
+    }
+#elif defined(__linux__)
+    constexpr std::size_t huge_page = 2 * 1024 * 1024;
+
+    std::uint8_t *map(mapping_t &mapping) {
+      auto size = mapping.size;
+      void *data = MAP_FAILED;
+
+      // Explicit huge pages are only there when the admin reserved them, and are never swapped
+      if (size >= huge_page) {
+        auto length = round_up(size, huge_page);
+        data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+          mapping.size = size = length;
+        }
+      }
+
+      if (data == MAP_FAILED) {
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+          return nullptr;
+        }
+
+        if (size >= huge_page) {
+          madvise(data, size, MADV_HUGEPAGE);
+        }
+      }
+
+      // Locking faults the pages in on this thread, which places them on its NUMA node
+      if (mlock(data, size)) {
+        log_not_locked_once();
+      }
+
+      return (std::uint8_t *) data;
+    }
+
+    void unmap(std::uint8_t *data, const mapping_t &mapping) {
+      munmap(data, mapping.size);
+    }
+#endif
+
+    // Bands of less than this aren't worth a thread
+    constexpr std::size_t min_band_size = 1024 * 1024;
+
+#ifdef IMAGE_COPY_X86
+    [[gnu::target("avx2")]] void copy_band_avx2(const std::uint8_t *src, std::uint8_t *dst, std::size_t size) {
+      // Non-temporal stores need an aligned destination
+      auto head = std::min((32 - (std::uintptr_t) dst % 32) % 32, size);
+      std::memcpy(dst, src, head);
+
+      std::size_t x = head;
+      if ((std::uintptr_t) (src + x) % 32 == 0) {
+        // Streaming loads only bypass the caches for write-combined memory, like some mapped staging textures
+        for (; x + 128 <= size; x += 128) {
+          auto a = _mm256_stream_load_si256((__m256i *) (src + x));
+          auto b = _mm256_stream_load_si256((__m256i *) (src + x + 32));
+          auto c = _mm256_stream_load_si256((__m256i *) (src + x + 64));
+          auto d = _mm256_stream_load_si256((__m256i *) (src + x + 96));
+          _mm256_stream_si256((__m256i *) (dst + x), a);
+          _mm256_stream_si256((__m256i *) (dst + x + 32), b);
+          _mm256_stream_si256((__m256i *) (dst + x + 64), c);
+          _mm256_stream_si256((__m256i *) (dst + x + 96), d);
+        }
+      } else {
+        for (; x + 128 <= size; x += 128) {
+          auto a = _mm256_loadu_si256((const __m256i *) (src + x));
+          auto b = _mm256_loadu_si256((const __m256i *) (src + x + 32));
+          auto c = _mm256_loadu_si256((const __m256i *) (src + x + 64));
+          auto d = _mm256_loadu_si256((const __m256i *) (src + x + 96));
+          _mm256_stream_si256((__m256i *) (dst + x), a);
+          _mm256_stream_si256((__m256i *) (dst + x + 32), b);
+          _mm256_stream_si256((__m256i *) (dst + x + 64), c);
+          _mm256_stream_si256((__m256i *) (dst + x + 96), d);
+        }
+      }
+
+      // Non-temporal stores aren't ordered with the stores of other threads until fenced
+      _mm_sfence();
+
+      std::memcpy(dst + x, src + x, size - x);
+    }
+#endif
+
+    void copy_band_default(const std::uint8_t *src, std::uint8_t *dst, std::size_t size) {
+      std::memcpy(dst, src, size);
+    }
+  }  // namespace
+
+  std::uint8_t *alloc_image(std::size_t size) {
+#if defined(_WIN32) || defined(__linux__)
+    mapping_t mapping {size, false};
+    auto data = map(mapping);
+    if (!data) {
+      throw std::bad_alloc {};
+    }
+
+    std::lock_guard lg {mappings_lock};
+    mappings.emplace(data, mapping);
+    for (auto &[id, watch] : watches) {
+      watch.allocated(data, mapping.size);
+    }
+    return data;
+#else
+    return new std::uint8_t[size];
+#endif
+  }
+
+  void free_image(std::uint8_t *data) {
+    if (!data) {
+      return;
+    }
+
+#if defined(_WIN32) || defined(__linux__)
+    mapping_t mapping;
+    {
+      std::lock_guard lg {mappings_lock};
+      auto it = mappings.find(data);
+      mapping = it->second;
+      for (auto &[id, watch] : watches) {
+        watch.freeing(data, mapping.size);
+      }
+      mappings.erase(it);
+    }
+
+    unmap(data, mapping);
+#else
+    delete[] data;
+#endif
+  }
+
+  int watch_images(image_watch_fn allocated, image_watch_fn freeing) {
+#if defined(_WIN32) || defined(__linux__)
+    std::lock_guard lg {mappings_lock};
+    for (auto &[data, mapping] : mappings) {
+      allocated(data, mapping.size);
+    }
+
+    auto id = next_watch_id++;
+    watches.emplace(id, watch_t {std::move(allocated), std::move(freeing)});
+    return id;
+#else
+    return -1;
+#endif
+  }
+
+  void unwatch_images(int id) {
+#if defined(_WIN32) || defined(__linux__)
+    std::lock_guard lg {mappings_lock};
+    auto it = watches.find(id);
+    if (it == std::end(watches)) {
+      return;
+    }
+
+    for (auto &[data, mapping] : mappings) {
+      it->second.freeing(data, mapping.size);
+    }
+    watches.erase(it);
+#endif
+  }
+
+  image_copy_t::image_copy_t(int threads):
+      _threads {std::max(threads, 1)},
+      _pool {std::max(threads, 1) - 1} {
+#ifdef IMAGE_COPY_X86
+    if (__builtin_cpu_supports("avx2")) {
+      _copy_band = copy_band_avx2;
+      _isa = "AVX2";
+    } else
+#endif
+    {
+      _copy_band = copy_band_default;
+      _isa = "default";
+    }
+  }
+
+  const char *image_copy_t::isa() const {
+    return _isa;
+  }
+
+  void image_copy_t::copy(const std::uint8_t *src, std::uint8_t *dst, std::size_t size) {
+    constexpr std::size_t page = 4096;
+
+    auto bands = (std::size_t) std::clamp<std::size_t>(size / min_band_size, 1, _threads);
+    auto band_start = [&](std::size_t index) {
+      return index == bands ? size : size * index / bands / page * page;
+    };
+
+    std::vector<std::future<void>> futures;
+    futures.reserve(bands - 1);
+    for (std::size_t x = 0; x < bands - 1; ++x) {
+      auto start = band_start(x);
+      futures.emplace_back(_pool.push(_copy_band, src + start, dst + start, band_start(x + 1) - start));
+    }
+
+    auto start = band_start(bands - 1);
+    _copy_band(src + start, dst + start, size - start);
+
+    for (auto &future : futures) {
+      future.wait();
+    }
+  }
+}  // namespace util
@@ -0,0 +1,95 @@
+/**
+ * @file src/image_memory.h
+ * @brief Declarations for allocating the pixels of captured images.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// local includes
+#include "thread_pool.h"
+
+namespace util {
+  /**
+   * @brief Allocate the pixels of a captured image, which stay resident while the stream runs.
+   * @details Large images are backed by huge pages where the OS provides them, explicit ones first and
+   *          transparent ones second, which saves TLB misses when converting and copying them.
+   *          The memory is locked so it's never paged out mid-stream, and it's placed on the NUMA node
+   *          of the calling thread, which runs on the node of the encoding thread when threads are pinned.
+   *          Each of these falls back silently to ordinary memory when the OS or its limits refuse it.
+   * @param size The number of bytes.
+   * @return The memory, aligned to at least a page.
+   * @throws std::bad_alloc if no memory could be allocated.
+   */
+  std::uint8_t *alloc_image(std::size_t size);
+
+  /**
+   * @brief Free the pixels allocated by alloc_image().
+   * @param data The memory, or nullptr.
+   */
+  void free_image(std::uint8_t *data);
+
+  /**
+   * @brief Called with the pixels of an image allocated by alloc_image(), and their size in bytes.
+   */
+  using image_watch_fn = std::function<void(std::uint8_t *data, std::size_t size)>;
+
+  /**
+   * @brief Watch the images allocated by alloc_image(), like to register them with a device uploading them.
+   * @details `allocated` is called with every image that exists already and every image allocated later,
+   *          `freeing` with every image before it's freed and with every image left once the watch is removed.
+   *          No image is allocated or freed while either runs.
+   * @param allocated Called with images that were allocated.
+   * @param freeing Called with images about to be freed.
+   * @return The id to remove the watch by.
+   */
+  int watch_images(image_watch_fn allocated, image_watch_fn freeing);
+
+  /**
+   * @brief Remove a watch added by watch_images().
+   * @param id The id of the watch.
+   */
+  void unwatch_images(int id);
+
+  /**
+   * @brief Copies captured images that are read back from the GPU into the pixels of an image.
+   * @details The memory is split in bands of whole pages that are copied in parallel.
+   *          With AVX2, the bands are copied with streaming loads and non-temporal stores, which don't
+   *          evict the caches of the capture thread and skip reading the destination before writing it.
+   */
+  class image_copy_t {
+  public:
+    using copy_band_fn = void (*)(const std::uint8_t *src, std::uint8_t *dst, std::size_t size);
+
+    /**
+     * @brief Create a copier.
+     * @param threads The number of threads to copy with, including the calling thread.
+     */
+    explicit image_copy_t(int threads);
+
+    /**
+     * @brief Get the name of the ISA the copy was picked for.
+     */
+    const char *isa() const;
+
+    /**
+     * @brief Copy memory that doesn't overlap.
+     * @param src The memory to copy.
+     * @param dst The memory to copy to.
+     * @param size The number of bytes.
+     */
+    void copy(const std::uint8_t *src, std::uint8_t *dst, std::size_t size);
+
+  private:
+    int _threads;
+
+    copy_band_fn _copy_band;
+    const char *_isa;
+
+    // The calling thread copies the last band
+    thread_pool_util::ThreadPool _pool;
+  };
+}  // namespace util
@@ -0,0 +1,208 @@
+/**
+ * @file src/image_pool.cpp
+ * @brief Definitions for the pool of captured images.
+ */
+// standard includes
+#include <bit>
+
+// local includes
+#include "image_pool.h"
+#include "metrics.h"
+
+namespace video {
+  void image_pool_t::shared_t::release(std::uint64_t bit) {
+    free_mask.fetch_or(bit);
+
+    // The capture thread only sleeps when the pool is exhausted
+    if (waiters.load() > 0) {
+      std::lock_guard lg {lock};
+      cv.notify_all();
+    }
+  }
+
+  namespace {
+    std::size_t image_bytes(const platf::img_t &img) {
+      if (img.row_pitch > 0) {
+        return (std::size_t) img.row_pitch * img.height;
+      }
+
+      // Images in GPU memory don't tell their pitch
+      return (std::size_t) img.width * img.height * 4;
+    }
+
+    /**
+     * @brief Keep memory accounted for as long as an image lives, even past the pool.
+     */
+    std::shared_ptr<platf::img_t> hold(std::shared_ptr<platf::img_t> img, memory_budget::lease_t lease) {
+      struct held_t {
+        std::shared_ptr<platf::img_t> img;
+        memory_budget::lease_t lease;
+      };
+
+      auto held = std::make_shared<held_t>(held_t {std::move(img), std::move(lease)});
+      return std::shared_ptr<platf::img_t> {held, held->img.get()};
+    }
+  }  // namespace
+
+  image_pool_t::image_pool_t(std::size_t capacity, std::chrono::steady_clock::duration trim_timeout, memory_budget::budget_t *budget):
+      _shared {std::make_shared<shared_t>()},
+      _imgs(std::min(capacity, max_capacity)),
+      _trim_timeout {trim_timeout},
+      _budget {budget} {
+    _shared->free_mask = _imgs.size() == max_capacity ? ~std::uint64_t {} : (std::uint64_t {1} << _imgs.size()) - 1;
+  }
+
+  std::shared_ptr<platf::img_t> image_pool_t::acquire(const std::function<std::shared_ptr<platf::img_t>()> &alloc, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    auto free_mask = _shared->free_mask.load();
+    auto slot = take_free_slot(free_mask, alloc);
+    while (!slot) {
+      // Wait for an image to be returned
+      std::unique_lock ul {_shared->lock};
+      ++_shared->waiters;
+      auto returned = _shared->cv.wait_until(ul, deadline, [&]() {
+        return _shared->free_mask.load() != free_mask;
+      });
+      --_shared->waiters;
+      ul.unlock();
+
+      if (!returned) {
+        update_metrics();
+        return nullptr;
+      }
+
+      free_mask = _shared->free_mask.load();
+      slot = take_free_slot(free_mask, alloc);
+    }
+
+    trim();
+    update_metrics();
+
+    // Keep the image alive even if the pool is cleared while it's in use
+    auto bit = std::uint64_t {1} << *slot;
+    auto img = _imgs[*slot];
+    return std::shared_ptr<platf::img_t> {img.get(), [img, shared = _shared, bit](platf::img_t *) mutable {
+                                            img.reset();
+                                            shared->release(bit);
+                                          }};
+  }
+
+  std::optional<std::size_t> image_pool_t::take_free_slot(std::uint64_t free_mask, const std::function<std::shared_ptr<platf::img_t>()> &alloc) {
+    // Prefer the lowest allocated image, so the images trimmed first are the ones used least
+    auto candidates = free_mask & _allocated_mask;
+    if (!candidates) {
+      candidates = free_mask & ~_allocated_mask;
+      if (!candidates) {
+        return std::nullopt;
+      }
+
+      // Over the budget, the images there are have to do
+      std::optional<memory_budget::lease_t> lease;
+      if (_budget && _image_bytes) {
+        if (allocated() < min_images) {
+          lease = _budget->reserve(memory_budget::pool_e::capture, _image_bytes);
+        } else if (!(lease = _budget->try_reserve(memory_budget::pool_e::capture, _image_bytes))) {
+          return std::nullopt;
+        }
+      }
+
+      auto slot = (std::size_t) std::countr_zero(candidates);
+      auto img = alloc();
+      if (!img) {
+        return std::nullopt;
+      }
+
+      if (_budget) {
+        if (!_image_bytes) {
+          _image_bytes = image_bytes(*img);
+          lease = _budget->reserve(memory_budget::pool_e::capture, _image_bytes);
+        }
+
+        img = hold(std::move(img), std::move(*lease));
+      }
+      _imgs[slot] = std::move(img);
+
+      _allocated_mask |= std::uint64_t {1} << slot;
+      candidates = std::uint64_t {1} << slot;
+    }
+
+    auto slot = (std::size_t) std::countr_zero(candidates);
+
+    // Free bits are only ever cleared on this thread
+    _shared->free_mask.fetch_and(~(std::uint64_t {1} << slot));
+    return slot;
+  }
+
+  void image_pool_t::trim() {
+    auto used_count = in_use();
+    auto allocated_count = allocated();
+
+    // remember the timestamp of currently used count
+    const auto now = std::chrono::steady_clock::now();
+    if (_used_timestamps.size() <= used_count) {
+      _used_timestamps.resize(used_count + 1);
+    }
+    _used_timestamps[used_count] = now;
+
+    // decide whether to trim allocated unused above the currently used count
+    // based on last used timestamp and universal timeout
+    size_t trim_target = used_count;
+    for (size_t i = used_count; i < _used_timestamps.size(); i++) {
+      if (_used_timestamps[i] && now - *_used_timestamps[i] < _trim_timeout) {
+        trim_target = i;
+      }
+    }
+
+    // Over the budget, the images that aren't needed right now are freed at once
+    if (_budget && _budget->over()) {
+      trim_target = std::min(trim_target, std::max(used_count, min_images));
+    }
+
+    if (allocated_count <= trim_target) {
+      return;
+    }
+
+    // trim allocated unused above the newly decided trim target, highest slots first
+    auto to_trim = allocated_count - trim_target;
+    auto candidates = _shared->free_mask.load() & _allocated_mask;
+    while (to_trim > 0 && candidates) {
+      auto slot = 63 - std::countl_zero(candidates);
+      auto bit = std::uint64_t {1} << slot;
+
+      _imgs[slot].reset();
+      _allocated_mask &= ~bit;
+      candidates &= ~bit;
+      --to_trim;
+    }
+
+    // forget timestamps that no longer relevant
+    _used_timestamps.resize(trim_target + 1);
+  }
+
+  void image_pool_t::clear() {
+    for (auto &img : _imgs) {
+      img.reset();
+    }
+    _allocated_mask = 0;
+
+    // The next display may capture images of another size
+    _image_bytes = 0;
+
+    update_metrics();
+  }
+
+  std::size_t image_pool_t::allocated() const {
+    return std::popcount(_allocated_mask);
+  }
+
+  std::size_t image_pool_t::in_use() const {
+    return std::popcount(_allocated_mask & ~_shared->free_mask.load());
+  }
+
+  void image_pool_t::update_metrics() const {
+    auto &capture = metrics::capture();
+    capture.images_allocated = allocated();
+    capture.images_in_use = in_use();
+  }
+}  // namespace video
@@ -0,0 +1,97 @@
+/**
+ * @file src/image_pool.h
+ * @brief Declarations for the pool of captured images.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// local includes
+#include "memory_budget.h"
+#include "platform/common.h"
+
+namespace video {
+  /**
+   * @brief Fixed-capacity pool of images filled by the capture thread.
+   * @details Images are handed out as `std::shared_ptr` and return to the pool when the last copy is destroyed,
+   *          from whichever thread that happens on. Free slots are tracked in an atomic bitmask,
+   *          so acquiring and returning an image is O(1) and lock-free unless the pool is exhausted.
+   *          With a memory budget, the pool only grows past its first images while they fit within the budget,
+   *          and waits for an image to be returned instead. Only one thread may acquire images or clear and trim the pool.
+   */
+  class image_pool_t {
+  public:
+    static constexpr std::size_t max_capacity = 64;
+
+    // The image captured into and the one encoded, which are allocated even over the budget
+    static constexpr std::size_t min_images = 2;
+
+    /**
+     * @param capacity The maximum number of images, at most `max_capacity`.
+     * @param trim_timeout How long allocated images stay around after they were last needed.
+     * @param budget The budget the images are accounted to, or nullptr for none.
+     */
+    image_pool_t(std::size_t capacity, std::chrono::steady_clock::duration trim_timeout, memory_budget::budget_t *budget = nullptr);
+
+    /**
+     * @brief Take a free image out of the pool, allocating a new one if no allocated image is free.
+     * @param alloc Allocates a new image.
+     * @param timeout How long to wait for an image to be returned when none is available.
+     * @return The image, or nullptr if none became available before the timeout.
+     */
+    std::shared_ptr<platf::img_t> acquire(const std::function<std::shared_ptr<platf::img_t>()> &alloc, std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Release every image held by the pool.
+     * @details Images that are still in use are destroyed once they're returned.
+     */
+    void clear();
+
+    /**
+     * @brief Get the number of allocated images.
+     */
+    std::size_t allocated() const;
+
+    /**
+     * @brief Get the number of images that haven't been returned yet.
+     */
+    std::size_t in_use() const;
+
+  private:
+    // State shared with images that are in use, which may outlive the pool
+    struct shared_t {
+      std::atomic_uint64_t free_mask;
+
+      // Only used when the pool is exhausted
+      std::atomic_int waiters {};
+      std::mutex lock;
+      std::condition_variable cv;
+
+      void release(std::uint64_t bit);
+    };
+
+    std::optional<std::size_t> take_free_slot(std::uint64_t free_mask, const std::function<std::shared_ptr<platf::img_t>()> &alloc);
+    void trim();
+    void update_metrics() const;
+
+    std::shared_ptr<shared_t> _shared;
+    std::vector<std::shared_ptr<platf::img_t>> _imgs;
+    std::uint64_t _allocated_mask = 0;
+
+    std::chrono::steady_clock::duration _trim_timeout;
+    std::vector<std::optional<std::chrono::steady_clock::time_point>> _used_timestamps;
+
+    // The size of the images, known once the first one is allocated, as the images of a display are alike
+    memory_budget::budget_t *_budget;
+    std::size_t _image_bytes = 0;
+  };
+}  // namespace video
@@ -12,7 +12,7 @@ extern "C" {
 #include <bitset>
 #include <chrono>
 #include <cmath>
-#include <list>
+#include <mutex>
 #include <thread>
 #include <unordered_map>
 
@@ -24,8 +24,12 @@ extern "C" {
 #include "globals.h"
 #include "input.h"
 #include "logging.h"
+#include "motion_coalescer.h"
 #include "platform/common.h"
+#include "spsc_ring.h"
+#include "thread_affinity.h"
 #include "thread_pool.h"
+#include "tracing.h"
 #include "utility.h"
 
 // Win32 WHEEL_DELTA constant
@@ -115,6 +119,26 @@ namespace input {
   static platf::input_t platf_input;
   static std::bitset<platf::MAX_GAMEPADS> gamepadMask {};
 
+  // Serializes the input sent to the OS and the state above between the input threads and the task_pool
+  static std::mutex dispatch_lock;
+
+  /**
+   * @brief An input message copied out of the control stream, sized for the largest packet a client sends.
+   */
+  struct input_message_t {
+    // For the input_to_send metric
+    std::chrono::steady_clock::time_point arrival;
+
+    std::uint16_t size;
+
+    // Set when the message was folded into an earlier one
+    bool batched;
+
+    std::array<std::uint8_t, 128> data;
+  };
+
+  using input_ring_t = util::spsc_ring_t<input_message_t, 1024>;
+
   void free_gamepad(platf::input_t &platf_input, int id) {
     platf::gamepad_update(platf_input, id, platf::gamepad_state_t {});
     platf::free_gamepad(platf_input, id);
@@ -127,12 +151,15 @@ namespace input {
         gamepad_state {},
         back_timeout_id {},
         id {-1},
-        back_button_state {button_state_e::NONE} {
+        back_button_state {button_state_e::NONE},
+        motion_coalescers {motion_coalescer_t {config::input.motion_interval}, motion_coalescer_t {config::input.motion_interval}},
+        motion_flush_ids {} {
     }
 
     ~gamepad_t() {
       if (id >= 0) {
-        task_pool.push([id = this->id]() {
+        task_pool.push(thread_pool_util::priority_e::high, [id = this->id]() {
+          std::lock_guard lg {dispatch_lock};
           free_gamepad(platf_input, id);
         });
       }
@@ -150,8 +177,27 @@ namespace input {
     // Sunshine forces the button to be in a specific state until the gamepad state matches that of
     // Moonlight once more.
     button_state_e back_button_state;
+
+    // One per sensor, indexed by whether it's the gyroscope
+    std::array<motion_coalescer_t, 2> motion_coalescers;
+    std::array<thread_pool_util::ThreadPool::task_id_t, 2> motion_flush_ids;
   };
 
+  /**
+   * @brief Drop the motion samples of a gamepad that are still pending.
+   * @param gamepad The gamepad.
+   */
+  void reset_motion(gamepad_t &gamepad) {
+    for (int sensor = 0; sensor < gamepad.motion_coalescers.size(); ++sensor) {
+      if (gamepad.motion_flush_ids[sensor]) {
+        task_pool.cancel(gamepad.motion_flush_ids[sensor]);
+        gamepad.motion_flush_ids[sensor] = nullptr;
+      }
+
+      gamepad.motion_coalescers[sensor].reset();
+    }
+  }
+
   struct input_t {
     enum shortkey_e {
       CTRL = 0x1,  ///< Control key
@@ -162,7 +208,8 @@ namespace input {
 
     input_t(
       safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event,
-      platf::feedback_queue_t feedback_queue
+      platf::feedback_queue_t feedback_queue,
+      std::shared_ptr<metrics::session_metrics_t> session_metrics
     ):
         shortcutFlags {},
         gamepads(MAX_GAMEPADS),
@@ -172,7 +219,20 @@ namespace input {
         mouse_left_button_timeout {},
         touch_port {{0, 0, 0, 0}, 0, 0, 1.0f},
         accumulated_vscroll_delta {},
-        accumulated_hscroll_delta {} {
+        accumulated_hscroll_delta {},
+        session_metrics {std::move(session_metrics)},
+        input_ring {std::make_shared<input_ring_t>()} {
+    }
+
+    ~input_t() {
+      input_ring->close();
+
+      // The input thread may have held the last reference
+      if (input_thread.get_id() == std::this_thread::get_id()) {
+        input_thread.detach();
+      } else if (input_thread.joinable()) {
+        input_thread.join();
+      }
     }
 
     // Keep track of alt+ctrl+shift key combo
@@ -184,15 +244,19 @@ namespace input {
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event;
     platf::feedback_queue_t feedback_queue;
 
-    std::list<std::vector<uint8_t>> input_queue;
-    std::mutex input_queue_lock;
-
     thread_pool_util::ThreadPool::task_id_t mouse_left_button_timeout;
 
     input::touch_port_t touch_port;
 
     int32_t accumulated_vscroll_delta;
     int32_t accumulated_hscroll_delta;
+
+    std::shared_ptr<metrics::session_metrics_t> session_metrics;
+
+    // Filled by the control stream thread and drained by the input thread,
+    // shared so it outlives this context for as long as the input thread needs it
+    std::shared_ptr<input_ring_t> input_ring;
+    std::thread input_thread;
   };
 
   /**
@@ -280,7 +344,7 @@ namespace input {
 
   void print(PNV_MULTI_CONTROLLER_PACKET packet) {
     // Moonlight spams controller packet even when not necessary
-    BOOST_LOG(verbose)
+    BOOST_LOG_HOT(verbose)
       << "--begin controller packet--"sv << std::endl
       << "controllerNumber ["sv << packet->controllerNumber << ']' << std::endl
       << "activeGamepadMask ["sv << util::hex(packet->activeGamepadMask).to_string_view() << ']' << std::endl
@@ -367,7 +431,7 @@ namespace input {
    * @param packet The controller motion packet.
    */
   void print(PSS_CONTROLLER_MOTION_PACKET packet) {
-    BOOST_LOG(verbose)
+    BOOST_LOG_HOT(verbose)
       << "--begin controller motion packet--"sv << std::endl
       << "controllerNumber ["sv << util::hex(packet->controllerNumber).to_string_view() << ']' << std::endl
       << "motionType ["sv << util::hex(packet->motionType).to_string_view() << ']' << std::endl
@@ -382,7 +446,7 @@ namespace input {
    * @param packet The controller battery packet.
    */
   void print(PSS_CONTROLLER_BATTERY_PACKET packet) {
-    BOOST_LOG(verbose)
+    BOOST_LOG_HOT(verbose)
       << "--begin controller battery packet--"sv << std::endl
       << "controllerNumber ["sv << util::hex(packet->controllerNumber).to_string_view() << ']' << std::endl
       << "batteryState ["sv << util::hex(packet->batteryState).to_string_view() << ']' << std::endl
@@ -586,6 +650,8 @@ namespace input {
      */
     if (button == BUTTON_LEFT && release && !input->mouse_left_button_timeout) {
       auto f = [=]() {
+        std::lock_guard lg {dispatch_lock};
+
         auto left_released = mouse_press[BUTTON_LEFT];
         if (left_released) {
           // Already released left button
@@ -597,7 +663,7 @@ namespace input {
         input->mouse_left_button_timeout = nullptr;
       };
 
-      input->mouse_left_button_timeout = task_pool.pushDelayed(std::move(f), 10ms).task_id;
+      input->mouse_left_button_timeout = task_pool.pushDelayed(thread_pool_util::priority_e::high, std::move(f), 10ms).task_id;
 
       return;
     }
@@ -708,6 +774,8 @@ namespace input {
   }
 
   void repeat_key(uint16_t key_code, uint8_t flags, uint8_t synthetic_modifiers) {
+    std::lock_guard lg {dispatch_lock};
+
     // If key no longer pressed, stop repeating
     if (!key_press[make_kpid(key_code, flags)]) {
       key_press_repeat_id = nullptr;
@@ -716,7 +784,7 @@ namespace input {
 
     send_key_and_modifiers(key_code, false, flags, synthetic_modifiers);
 
-    key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_period, key_code, flags, synthetic_modifiers).task_id;
+    key_press_repeat_id = task_pool.pushDelayed(thread_pool_util::priority_e::high, repeat_key, config::input.key_repeat_period, key_code, flags, synthetic_modifiers).task_id;
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_KEYBOARD_PACKET packet) {
@@ -756,7 +824,7 @@ namespace input {
         }
 
         if (config::input.key_repeat_delay.count() > 0) {
-          key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_delay, keyCode, packet->flags, synthetic_modifiers).task_id;
+          key_press_repeat_id = task_pool.pushDelayed(thread_pool_util::priority_e::high, repeat_key, config::input.key_repeat_delay, keyCode, packet->flags, synthetic_modifiers).task_id;
         }
       } else {
         // Already released
@@ -1045,7 +1113,36 @@ namespace input {
       from_netfloat(packet->z),
     };
 
-    platf::gamepad_motion(platf_input, motion);
+    auto now = std::chrono::steady_clock::now();
+    int sensor = packet->motionType == LI_MOTION_TYPE_GYRO;
+
+    auto &coalescer = gamepad.motion_coalescers[sensor];
+    auto &flush_id = gamepad.motion_flush_ids[sensor];
+    if (auto merged = coalescer.add(motion, now)) {
+      if (flush_id) {
+        task_pool.cancel(flush_id);
+        flush_id = nullptr;
+      }
+
+      platf::gamepad_motion(platf_input, *merged);
+      return;
+    }
+
+    // Send the samples merged so far once the interval is up, unless another sample comes first
+    if (!flush_id) {
+      auto f = [input, controller = packet->controllerNumber, sensor]() {
+        std::lock_guard lg {dispatch_lock};
+
+        auto &gamepad = input->gamepads[controller];
+        gamepad.motion_flush_ids[sensor] = nullptr;
+
+        if (auto merged = gamepad.motion_coalescers[sensor].flush(std::chrono::steady_clock::now())) {
+          platf::gamepad_motion(platf_input, *merged);
+        }
+      };
+
+      flush_id = task_pool.pushDelayed(thread_pool_util::priority_e::high, std::move(f), *coalescer.deadline() - now).task_id;
+    }
   }
 
   /**
@@ -1107,6 +1204,7 @@ namespace input {
       gamepad.id = id;
     } else if (!(packet->activeGamepadMask & (1 << packet->controllerNumber)) && gamepad.id >= 0) {
       // If this is the final event for a gamepad being removed, free the gamepad and return.
+      reset_motion(gamepad);
       free_gamepad(platf_input, gamepad.id);
       gamepad.id = -1;
       return;
@@ -1157,6 +1255,8 @@ namespace input {
         // Don't emulate home button if timeout < 0
         if (config::input.back_button_timeout >= 0ms) {
           auto f = [input, controller = packet->controllerNumber]() {
+            std::unique_lock ul {dispatch_lock};
+
             auto &gamepad = input->gamepads[controller];
 
             auto &state = gamepad.gamepad_state;
@@ -1170,8 +1270,10 @@ namespace input {
             state.buttonFlags |= platf::HOME;
             platf::gamepad_update(platf_input, gamepad.id, state);
 
-            // Sleep for a short time to allow the input to be detected
+            // Sleep for a short time to allow the input to be detected, without holding up other input
+            ul.unlock();
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            ul.lock();
 
             // Release Home button
             state.buttonFlags &= ~platf::HOME;
@@ -1180,6 +1282,7 @@ namespace input {
             gamepad.back_timeout_id = nullptr;
           };
 
+          // Sleeps while holding the Home button, so it's kept off the workers reserved for input
           gamepad.back_timeout_id = task_pool.pushDelayed(std::move(f), config::input.back_button_timeout).task_id;
         }
       } else if (gamepad.back_timeout_id) {
@@ -1475,49 +1578,12 @@ namespace input {
   }
 
   /**
-   * @brief Called on a thread pool thread to process an input message.
+   * @brief Called on the input thread to send an input message to the OS.
    * @param input The input context pointer.
+   * @param payload The input message, batched with the later ones already.
    */
-  void passthrough_next_message(std::shared_ptr<input_t> input) {
-    // 'entry' backs the 'payload' pointer, so they must remain in scope together
-    std::vector<uint8_t> entry;
-    PNV_INPUT_HEADER payload;
-
-    // Lock the input queue while batching, but release it before sending
-    // the input to the OS. This avoids potentially lengthy lock contention
-    // in the control stream thread while input is being processed by the OS.
-    {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-
-      // If all entries have already been processed, nothing to do
-      if (input->input_queue.empty()) {
-        return;
-      }
-
-      // Pop off the first entry, which we will send
-      entry = input->input_queue.front();
-      payload = (PNV_INPUT_HEADER) entry.data();
-      input->input_queue.pop_front();
-
-      // Try to batch with remaining items on the queue
-      auto i = input->input_queue.begin();
-      while (i != input->input_queue.end()) {
-        auto batchable_entry = *i;
-        auto batchable_payload = (PNV_INPUT_HEADER) batchable_entry.data();
-
-        auto batch_result = batch(payload, batchable_payload);
-        if (batch_result == batch_result_e::terminate_batch) {
-          // Stop batching
-          break;
-        } else if (batch_result == batch_result_e::batched) {
-          // Erase this entry since it was batched
-          i = input->input_queue.erase(i);
-        } else {
-          // We couldn't batch this entry, but try to batch later entries.
-          i++;
-        }
-      }
-    }
+  void passthrough_message(std::shared_ptr<input_t> &input, PNV_INPUT_HEADER payload) {
+    TRACE_SCOPE("input: passthrough");
 
     // Print the final input packet
     input::print((void *) payload);
@@ -1571,12 +1637,103 @@ namespace input {
     }
   }
 
+  /**
+   * @brief Batch a newly queued input message into the earliest message still open to it.
+   * @details Every message is batched once as it arrives, instead of scanning the queue for every message sent.
+   *          A message closes the ones it terminates a batch for, and opens itself if it couldn't be batched.
+   * @param open The messages still open to batching, oldest first.
+   * @param message The newly queued message.
+   */
+  void batch(std::vector<input_message_t *> &open, input_message_t &message) {
+    auto payload = (PNV_INPUT_HEADER) message.data.data();
+
+    for (auto it = std::begin(open); it != std::end(open);) {
+      auto batch_result = batch((PNV_INPUT_HEADER) (*it)->data.data(), payload);
+      if (batch_result == batch_result_e::batched) {
+        // Skip this message since it was batched
+        message.batched = true;
+        return;
+      } else if (batch_result == batch_result_e::terminate_batch) {
+        // Stop batching into the earlier message
+        it = open.erase(it);
+      } else {
+        // Try the other open messages, e.g. for other controllers
+        ++it;
+      }
+    }
+
+    // Too many open messages only means batching less
+    if (open.size() < open.capacity()) {
+      open.push_back(&message);
+    }
+  }
+
+  /**
+   * @brief Send the queued input messages of a session to the OS as soon as they arrive.
+   * @details The messages are batched in place, while the control stream thread keeps queueing.
+   *          Input doesn't wait behind unrelated work on the task_pool this way.
+   * @param weak_input The input context, which owns this thread.
+   * @param ring The queue of input messages.
+   */
+  void input_thread_main(std::weak_ptr<input_t> weak_input, std::shared_ptr<input_ring_t> ring) {
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin_current_thread("input"sv);
+
+    // Enough for every sensor of every controller between two messages sent
+    std::vector<input_message_t *> open;
+    open.reserve(MAX_GAMEPADS * 2);
+
+    while (true) {
+      ring->wait();
+      if (ring->closed()) {
+        return;
+      }
+
+      auto input = weak_input.lock();
+      if (!input) {
+        return;
+      }
+
+      while (!ring->empty()) {
+        auto size = ring->size();
+        for (std::size_t x = 0; x < size; ++x) {
+          batch(open, (*ring)[x]);
+        }
+
+        // The messages queued so far reach the OS together, where the platform supports it
+        {
+          std::lock_guard lg {dispatch_lock};
+          platf::begin_input_batch(platf_input);
+          for (std::size_t x = 0; x < size; ++x) {
+            auto &message = (*ring)[x];
+            if (!message.batched) {
+              passthrough_message(input, (PNV_INPUT_HEADER) message.data.data());
+            }
+          }
+          platf::end_input_batch(platf_input);
+        }
+
+        auto injected = std::chrono::steady_clock::now();
+        for (std::size_t x = 0; x < size; ++x) {
+          auto &message = ring->front();
+          if (!message.batched && input->session_metrics) {
+            input->session_metrics->input_injected(message.arrival, injected);
+          }
+          ring->pop();
+        }
+
+        // Nothing is batched into a message after it's sent
+        open.clear();
+      }
+    }
+  }
+
   /**
    * @brief Called on the control stream thread to queue an input message.
    * @param input The input context pointer.
    * @param input_data The input message.
    */
-  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data, const crypto::PERM& permission) {
+  void passthrough(std::shared_ptr<input_t> &input, std::span<const std::uint8_t> input_data, const crypto::PERM& permission) {
     // No input permissions at all
     if (!(permission & crypto::PERM::_all_inputs)) {
       return;
@@ -1585,7 +1742,7 @@ namespace input {
     // Have some input permission
     // Otherwise have all input permission
     if ((permission & crypto::PERM::_all_inputs) != crypto::PERM::_all_inputs) {
-      PNV_INPUT_HEADER payload = (PNV_INPUT_HEADER)input_data.data();
+      auto payload = (const NV_INPUT_HEADER *)input_data.data();
 
       // Check permission
       switch (util::endian::little(payload->magic)) {
@@ -1636,19 +1793,37 @@ namespace input {
       }
     }
 
-    {
-      std::lock_guard<std::mutex> lg(input->input_queue_lock);
-      input->input_queue.push_back(std::move(input_data));
+    if (input_data.size() > std::tuple_size_v<decltype(input_message_t::data)>) {
+      BOOST_LOG(warning) << "Dropping input message of "sv << input_data.size() << " bytes"sv;
+      return;
+    }
+
+    auto &ring = *input->input_ring;
+
+    // Only a stalled OS fills the ring, input must not be dropped, as releases would get lost
+    input_message_t *message;
+    while (!(message = ring.back())) {
+      std::this_thread::yield();
     }
-    task_pool.push(passthrough_next_message, input);
+
+    message->arrival = std::chrono::steady_clock::now();
+    message->size = (std::uint16_t) input_data.size();
+    message->batched = false;
+    std::copy(std::begin(input_data), std::end(input_data), std::begin(message->data));
+    ring.push();
   }
 
   void reset(std::shared_ptr<input_t> &input) {
-    task_pool.cancel(key_press_repeat_id);
-    task_pool.cancel(input->mouse_left_button_timeout);
+    {
+      std::lock_guard lg {dispatch_lock};
+      task_pool.cancel(key_press_repeat_id);
+      task_pool.cancel(input->mouse_left_button_timeout);
+    }
 
     // Ensure input is synchronous, by using the task_pool
-    task_pool.push([]() {
+    task_pool.push(thread_pool_util::priority_e::high, []() {
+      std::lock_guard lg {dispatch_lock};
+
       for (int x = 0; x < mouse_press.size(); ++x) {
         if (mouse_press[x]) {
           platf::button_mouse(platf_input, x, true);
@@ -1691,14 +1866,18 @@ namespace input {
     return true;
   }
 
-  std::shared_ptr<input_t> alloc(safe::mail_t mail) {
+  std::shared_ptr<input_t> alloc(safe::mail_t mail, std::shared_ptr<metrics::session_metrics_t> session_metrics) {
     auto input = std::make_shared<input_t>(
       mail->event<input::touch_port_t>(mail::touch_port),
-      mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback)
+      mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback),
+      std::move(session_metrics)
     );
 
+    input->input_thread = std::thread {input_thread_main, std::weak_ptr {input}, input->input_ring};
+
     // Workaround to ensure new frames will be captured when a client connects
     task_pool.pushDelayed([]() {
+      std::lock_guard lg {dispatch_lock};
       platf::move_mouse(platf_input, 1, 1);
       platf::move_mouse(platf_input, -1, -1);
     },
@@ -6,24 +6,26 @@
 
 // standard includes
 #include <functional>
+#include <span>
 
 // local includes
 #include "platform/common.h"
 #include "thread_safe.h"
 #include "crypto.h"
+#include "metrics.h"
 
 namespace input {
   struct input_t;
 
   void print(void *input);
   void reset(std::shared_ptr<input_t> &input);
-  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data, const crypto::PERM& permission);
+  void passthrough(std::shared_ptr<input_t> &input, std::span<const std::uint8_t> input_data, const crypto::PERM& permission);
 
   [[nodiscard]] std::unique_ptr<platf::deinit_t> init();
 
   bool probe_gamepads();
 
-  std::shared_ptr<input_t> alloc(safe::mail_t mail);
+  std::shared_ptr<input_t> alloc(safe::mail_t mail, std::shared_ptr<metrics::session_metrics_t> session_metrics);
 
   struct touch_port_t: public platf::touch_port_t {
     int env_width, env_height;
@@ -35,7 +35,7 @@ using namespace std::literals;
 
 namespace bl = boost::log;
 
-boost::shared_ptr<boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>> sink;
+boost::shared_ptr<text_sink> sink;
 
 bl::sources::severity_logger<int> verbose(0);  // Dominating output
 bl::sources::severity_logger<int> debug(1);  // Follow what is happening
@@ -101,6 +101,14 @@ namespace logging {
     auto t = std::chrono::system_clock::to_time_t(now);
     auto lt = *std::localtime(&t);
 
+    // Runs on the sink thread only, so this reports every drop once
+    static std::uint64_t reported = 0;
+    if (auto dropped = count_on_overflow::dropped.load(std::memory_order_relaxed); dropped != reported) {
+      os << "["sv << std::put_time(&lt, "%Y-%m-%d %H:%M:%S.") << boost::format("%03u") % ms.count() << "]: "sv
+         << "Warning: "sv << (dropped - reported) << " log records dropped, the log couldn't keep up\n"sv;
+      reported = dropped;
+    }
+
     os << "["sv << std::put_time(&lt, "%Y-%m-%d %H:%M:%S.") << boost::format("%03u") % ms.count() << "]: "sv
        << log_type << view.attribute_values()[message].extract<std::string>();
   }
@@ -182,6 +190,7 @@ namespace logging {
 
     sink->locked_backend()->add_stream(boost::make_shared<std::ofstream>(log_file));
     sink->set_filter(severity >= min_log_level);
+    min_level = min_log_level;
     sink->set_formatter(&formatter);
 
     // Flush after each log record to ensure log file contents on disk isn't stale.
@@ -197,6 +206,20 @@ namespace logging {
     return std::make_unique<deinit_t>();
   }
 
+  void set_min_log_level(int min_log_level) {
+    if (!sink) {
+      return;
+    }
+
+#ifndef __ANDROID__
+    setup_av_logging(min_log_level);
+    setup_libdisplaydevice_logging(min_log_level);
+#endif
+
+    sink->set_filter(severity >= min_log_level);
+    min_level = min_log_level;
+  }
+
 #ifndef __ANDROID__
   void setup_av_logging(int min_log_level) {
     if (min_log_level >= 1) {
@@ -273,6 +296,10 @@ namespace logging {
       << "    --help                    | print help"sv << std::endl
       << "    --creds username password | set user credentials for the Web manager"sv << std::endl
       << "    --version                 | print the version of sunshine"sv << std::endl
+      << "    --benchmark-encoders [report.json] [seconds]"sv << std::endl
+      << "                              | benchmark every encoder, codec and display mode, then write a JSON report"sv << std::endl
+      << "    --benchmark-capture [report.json] [seconds] [fps]"sv << std::endl
+      << "                              | benchmark every capture method, then write a JSON report"sv << std::endl
       << std::endl
       << "    flags"sv << std::endl
       << "        -0 | Read PIN from stdin"sv << std::endl
@@ -4,11 +4,44 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <cstdint>
+
 // lib includes
 #include <boost/log/common.hpp>
 #include <boost/log/sinks.hpp>
 
-using text_sink = boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>;
+namespace logging {
+  /**
+   * @brief Drops records when the queue of the sink is full, counting them for the sink thread to report.
+   * @details The threads logging never block on a sink thread that falls behind, e.g. on a slow disk.
+   */
+  struct count_on_overflow {
+    template<typename LockT>
+    bool on_overflow(const boost::log::record_view &, LockT &) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    void on_queue_space_available() {
+    }
+
+    void interrupt() {
+    }
+
+    static inline std::atomic<std::uint64_t> dropped {};
+  };
+
+  /**
+   * @brief The most records waiting for the sink thread.
+   */
+  constexpr std::size_t log_queue_size = 8192;
+}  // namespace logging
+
+using text_sink = boost::log::sinks::asynchronous_sink<
+  boost::log::sinks::text_ostream_backend,
+  boost::log::sinks::bounded_fifo_queue<logging::log_queue_size, logging::count_on_overflow>>;
 
 extern boost::log::sources::severity_logger<int> verbose;
 extern boost::log::sources::severity_logger<int> debug;
@@ -23,10 +56,37 @@ extern boost::log::sources::severity_logger<int> tests;
 #include "config.h"
 #include "stat_trackers.h"
 
+/**
+ * @brief Log like BOOST_LOG, but check the level with a plain comparison before anything else.
+ * @details Meant for the hot paths such as per-packet diagnostics. When the level is filtered out, this skips
+ *          opening a record in the logging core, and the arguments are never evaluated.
+ * @examples
+ * BOOST_LOG_HOT(verbose) << "Sent packet "sv << seq;
+ * @examples_end
+ */
+#define BOOST_LOG_HOT(lg) \
+  if (!::logging::enabled(lg)) { \
+  } else \
+    BOOST_LOG(lg)
+
 /**
  * @brief Handles the initialization and deinitialization of the logging system.
  */
 namespace logging {
+  /**
+   * @brief The minimum log level written, set by init().
+   */
+  inline std::atomic<int> min_level {0};
+
+  /**
+   * @brief Check if records of a logger get written.
+   * @param logger The logger.
+   * @return `true` if the level of the logger isn't filtered out.
+   */
+  inline bool enabled(const boost::log::sources::severity_logger<int> &logger) {
+    return logger.default_severity() >= min_level.load(std::memory_order_relaxed);
+  }
+
   class deinit_t {
   public:
     /**
@@ -56,6 +116,12 @@ namespace logging {
    */
   [[nodiscard]] std::unique_ptr<deinit_t> init(int min_log_level, const std::string &log_file);
 
+  /**
+   * @brief Change the minimum log level of the initialized logging system.
+   * @param min_log_level The minimum log level to output.
+   */
+  void set_min_log_level(int min_log_level);
+
   /**
    * @brief Setup AV logging.
    * @param min_log_level The log level.
@@ -148,6 +214,76 @@ namespace logging {
     stat_trackers::min_max_avg_tracker<T> tracker;
   };
 
+  /**
+   * @brief A helper class for tracking and logging the distribution of numerical values across a period of time
+   * @details Unlike min_max_avg_periodic_logger, the tail percentiles show stutters that the average hides.
+   * @examples
+   * percentile_periodic_logger<double> logger(debug, "Test time value", "ms", 5s);
+   * logger.collect_and_log(1.0);
+   * // ...
+   * logger.collect_and_log(2.0);
+   * // after 5 seconds
+   * logger.collect_and_log(3.0);
+   * // In the log:
+   * // [2024:01:01:12:00:00]: Debug: Test time value (min/p50/p90/p99/p99.9/max/avg): 1.00ms/1.01ms/2.00ms/2.00ms/2.00ms/2.00ms/1.50ms
+   * @examples_end
+   */
+  template<typename T>
+  class percentile_periodic_logger {
+  public:
+    percentile_periodic_logger(boost::log::sources::severity_logger<int> &severity, std::string_view message, std::string_view units, std::chrono::seconds interval_in_seconds = std::chrono::seconds(20)):
+        severity(severity),
+        message(message),
+        units(units),
+        interval(interval_in_seconds),
+        enabled(config::sunshine.min_log_level <= severity.default_severity()) {
+    }
+
+    void collect_and_log(const T &value) {
+      if (enabled) {
+        auto print_info = [&](const typename stat_trackers::percentile_tracker<T>::stats_t &stats) {
+          auto f = stat_trackers::two_digits_after_decimal();
+          if constexpr (std::is_floating_point_v<T>) {
+            BOOST_LOG(severity.get()) << message << " (min/p50/p90/p99/p99.9/max/avg): "
+                                      << f % stats.min << units << "/" << f % stats.p50 << units << "/" << f % stats.p90 << units << "/"
+                                      << f % stats.p99 << units << "/" << f % stats.p999 << units << "/" << f % stats.max << units << "/"
+                                      << f % stats.avg << units;
+          } else {
+            BOOST_LOG(severity.get()) << message << " (min/p50/p90/p99/p99.9/max/avg): "
+                                      << (T) stats.min << units << "/" << (T) stats.p50 << units << "/" << (T) stats.p90 << units << "/"
+                                      << (T) stats.p99 << units << "/" << (T) stats.p999 << units << "/" << (T) stats.max << units << "/"
+                                      << f % stats.avg << units;
+          }
+        };
+        tracker.collect_and_callback_on_interval(value, print_info, interval);
+      }
+    }
+
+    void collect_and_log(std::function<T()> func) {
+      if (enabled) {
+        collect_and_log(func());
+      }
+    }
+
+    void reset() {
+      if (enabled) {
+        tracker.reset();
+      }
+    }
+
+    bool is_enabled() const {
+      return enabled;
+    }
+
+  private:
+    std::reference_wrapper<boost::log::sources::severity_logger<int>> severity;
+    std::string message;
+    std::string units;
+    std::chrono::seconds interval;
+    bool enabled;
+    stat_trackers::percentile_tracker<T> tracker;
+  };
+
   /**
    * @brief A helper class for tracking and logging short time intervals across a period of time
    * @examples
@@ -160,7 +296,7 @@ namespace logging {
    * // ...
    * logger.second_point_now_and_log();
    * // In the log:
-   * // [2024:01:01:12:00:00]: Debug: Test duration (min/max/avg): 1.23ms/3.21ms/2.31ms
+   * // [2024:01:01:12:00:00]: Debug: Test duration (min/p50/p90/p99/p99.9/max/avg): 1.23ms/2.31ms/3.10ms/3.21ms/3.21ms/3.21ms/2.31ms
    * @examples_end
    */
   class time_delta_periodic_logger {
@@ -205,7 +341,7 @@ namespace logging {
 
   private:
     std::chrono::steady_clock::time_point point1 = std::chrono::steady_clock::now();
-    min_max_avg_periodic_logger<double> logger;
+    percentile_periodic_logger<double> logger;
   };
 
   /**
@@ -19,6 +19,7 @@
 #include "nvhttp.h"
 #include "process.h"
 #include "system_tray.h"
+#include "tracing.h"
 #include "upnp.h"
 #include "uuid.h"
 #include "video.h"
@@ -61,6 +62,12 @@ std::map<std::string_view, std::function<int(const char *name, int argc, char **
   {"version"sv, [](const char *name, int argc, char **argv) {
      return args::version();
    }},
+  {"benchmark-encoders"sv, [](const char *name, int argc, char **argv) {
+     return args::benchmark_encoders(name, argc, argv);
+   }},
+  {"benchmark-capture"sv, [](const char *name, int argc, char **argv) {
+     return args::benchmark_capture(name, argc, argv);
+   }},
 #ifdef _WIN32
   {"restore-nvprefs-undo"sv, [](const char *name, int argc, char **argv) {
      return args::restore_nvprefs_undo();
@@ -170,6 +177,12 @@ int main(int argc, char *argv[]) {
     BOOST_LOG(error) << "Logging failed to initialize"sv;
   }
 
+  config::on_runtime_change([](const config::runtime_t &previous, const config::runtime_t &current) {
+    if (previous.min_log_level != current.min_log_level) {
+      logging::set_min_log_level(current.min_log_level);
+    }
+  });
+
   // logging can begin at this point
   // if anything is logged prior to this point, it will appear in stdout, but not in the log viewer in the UI
   // the version should be printed to the log before anything else
@@ -295,7 +308,8 @@ int main(int argc, char *argv[]) {
 
 #endif
 
-  task_pool.start(1);
+  // One worker is kept for input, so it never waits behind the blocking tasks of the other one
+  task_pool.start(2, 1);
 
   // Create signal handler after logging has been initialized
   auto shutdown_event = mail::man->event<bool>(mail::shutdown);
@@ -308,6 +322,7 @@ int main(int argc, char *argv[]) {
       lifetime::debug_trap();
     };
 
+    proc::instances.terminate_all();
     proc::proc.terminate();
 
     force_shutdown = task_pool.pushDelayed(task, 10s).task_id;
@@ -360,64 +375,67 @@ int main(int argc, char *argv[]) {
     BOOST_LOG(warning) << "No gamepad input is available"sv;
   }
 
-  if (video::probe_encoders()) {
-    bool allow_probing = video::allow_encoder_probing();
-    // Create a temporary virtual display for encoder capability probing
-    if (proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK) {
-      std::string probe_uuid_str = PROBE_DISPLAY_UUID;
-      auto probe_uuid = uuid_util::uuid_t::parse(probe_uuid_str);
+  // Probing can take seconds, the servers come up meanwhile and anything needing an encoder waits for it
+  video::start_initial_probe([]() {
+    if (video::probe_encoders()) {
+      bool allow_probing = video::allow_encoder_probing();
+      // Create a temporary virtual display for encoder capability probing
+      if (proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK) {
+        std::string probe_uuid_str = PROBE_DISPLAY_UUID;
+        auto probe_uuid = uuid_util::uuid_t::parse(probe_uuid_str);
 
-      BOOST_LOG(info) << "Creating a temporary virtual display to probe for encoders..."sv;
+        BOOST_LOG(info) << "Creating a temporary virtual display to probe for encoders..."sv;
 
-      if (!config::video.adapter_name.empty()) {
+        if (!config::video.adapter_name.empty()) {
 #ifdef _WIN32
-        VDISPLAY::setRenderAdapterByName(platf::from_utf8(config::video.adapter_name));
+          VDISPLAY::setRenderAdapterByName(platf::from_utf8(config::video.adapter_name));
 #else
-        VDISPLAY::setRenderAdapterByName(config::video.adapter_name);
+          VDISPLAY::setRenderAdapterByName(config::video.adapter_name);
 #endif
-      }
+        }
 
 #ifdef _WIN32
-      auto* probe_guid = (GUID*)(void*)&probe_uuid;
-      VDISPLAY::createVirtualDisplay(
-        probe_uuid_str.c_str(),
-        "Probe",
-        800,
-        600,
-        60,
-        *probe_guid
-      );
+        auto* probe_guid = (GUID*)(void*)&probe_uuid;
+        VDISPLAY::createVirtualDisplay(
+          probe_uuid_str.c_str(),
+          "Probe",
+          800,
+          600,
+          60,
+          *probe_guid
+        );
 #else
-      VDISPLAY::createVirtualDisplay(
-        probe_uuid_str.c_str(),
-        "Probe",
-        800,
-        600,
-        60,
-        probe_uuid
-      );
+        VDISPLAY::createVirtualDisplay(
+          probe_uuid_str.c_str(),
+          "Probe",
+          800,
+          600,
+          60,
+          probe_uuid
+        );
 #endif
 
-      std::this_thread::sleep_for(500ms);
+        std::this_thread::sleep_for(500ms);
 
-      // Probe again anyways
-      if (video::probe_encoders()) {
-        if (allow_probing) {
-          BOOST_LOG(error) << "Video failed to find working encoder: allow probing but failed"sv;
-        } else {
-          BOOST_LOG(error) << "Video failed to find working encoder even after attempted with a virtual display"sv;
+        // Probe again anyways
+        if (video::probe_encoders()) {
+          if (allow_probing) {
+            BOOST_LOG(error) << "Video failed to find working encoder: allow probing but failed"sv;
+          } else {
+            BOOST_LOG(error) << "Video failed to find working encoder even after attempted with a virtual display"sv;
+          }
         }
-      }
 
 #ifdef _WIN32
-      VDISPLAY::removeVirtualDisplay(*probe_guid);
+        VDISPLAY::removeVirtualDisplay(*probe_guid);
 #else
-      VDISPLAY::removeVirtualDisplay(probe_uuid);
+        VDISPLAY::removeVirtualDisplay(probe_uuid);
 #endif
-    } else if (!allow_probing) {
-      BOOST_LOG(error) << "Video failed to find working encoder: probe failed and virtual display driver isn't initialized"sv;
+      } else if (!allow_probing) {
+        BOOST_LOG(error) << "Video failed to find working encoder: probe failed and virtual display driver isn't initialized"sv;
+      }
     }
-  }
+  });
 
   if (http::init()) {
     BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
@@ -482,9 +500,15 @@ int main(int argc, char *argv[]) {
   configThread.join();
   rtspThread.join();
 
+  video::wait_for_initial_probe();
+
   task_pool.stop();
   task_pool.join();
 
+#ifdef SUNSHINE_TRACING
+  tracing::save(platf::appdata() / "trace.json");
+#endif
+
 #ifdef _WIN32
   // Restore global NVIDIA control panel settings
   if (nvprefs_instance.owning_undo_file() && nvprefs_instance.load()) {
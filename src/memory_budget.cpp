@@ -0,0 +1,102 @@
+/**
+ * @file src/memory_budget.cpp
+ * @brief Definitions for accounting the memory of the frame pools against a limit.
+ */
+// local includes
+#include "config.h"
+#include "memory_budget.h"
+
+namespace memory_budget {
+  lease_t::lease_t(budget_t *budget, pool_e pool, std::size_t bytes):
+      _budget {budget},
+      _pool {pool},
+      _bytes {bytes} {
+  }
+
+  lease_t::lease_t(lease_t &&other) noexcept:
+      _budget {other._budget},
+      _pool {other._pool},
+      _bytes {other._bytes} {
+    other._budget = nullptr;
+    other._bytes = 0;
+  }
+
+  lease_t &lease_t::operator=(lease_t &&other) noexcept {
+    if (this != &other) {
+      release();
+
+      _budget = other._budget;
+      _pool = other._pool;
+      _bytes = other._bytes;
+      other._budget = nullptr;
+      other._bytes = 0;
+    }
+
+    return *this;
+  }
+
+  lease_t::~lease_t() {
+    release();
+  }
+
+  void lease_t::release() {
+    if (_budget) {
+      _budget->release(_pool, _bytes);
+      _budget = nullptr;
+      _bytes = 0;
+    }
+  }
+
+  budget_t::budget_t(std::size_t limit):
+      _limit {limit} {
+  }
+
+  std::optional<lease_t> budget_t::try_reserve(pool_e pool, std::size_t bytes) {
+    auto used = _used.load(std::memory_order_relaxed);
+    do {
+      if (_limit && used + bytes > _limit) {
+        _refused.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+      }
+    } while (!_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+
+    _pool_used[(int) pool].fetch_add(bytes, std::memory_order_relaxed);
+    return lease_t {this, pool, bytes};
+  }
+
+  lease_t budget_t::reserve(pool_e pool, std::size_t bytes) {
+    _used.fetch_add(bytes, std::memory_order_relaxed);
+    _pool_used[(int) pool].fetch_add(bytes, std::memory_order_relaxed);
+    return lease_t {this, pool, bytes};
+  }
+
+  bool budget_t::over() const {
+    return _limit && used() > _limit;
+  }
+
+  bool budget_t::fits(std::size_t bytes) const {
+    return !_limit || used() + bytes <= _limit;
+  }
+
+  std::size_t budget_t::used() const {
+    return _used.load(std::memory_order_relaxed);
+  }
+
+  std::size_t budget_t::used(pool_e pool) const {
+    return _pool_used[(int) pool].load(std::memory_order_relaxed);
+  }
+
+  std::uint64_t budget_t::refused() const {
+    return _refused.load(std::memory_order_relaxed);
+  }
+
+  void budget_t::release(pool_e pool, std::size_t bytes) {
+    _pool_used[(int) pool].fetch_sub(bytes, std::memory_order_relaxed);
+    _used.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  budget_t &frames() {
+    static budget_t budget {(std::size_t) config::video.frame_memory_budget * 1024 * 1024};
+    return budget;
+  }
+}  // namespace memory_budget
@@ -0,0 +1,133 @@
+/**
+ * @file src/memory_budget.h
+ * @brief Declarations for accounting the memory of the frame pools against a limit.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace memory_budget {
+  /**
+   * @brief What the memory of a lease holds.
+   */
+  enum class pool_e : int {
+    capture,  ///< Images of the capture pool
+    encoder,  ///< Frames of an encoder, open or parked
+    MAX_POOLS  ///< The number of pools
+  };
+
+  class budget_t;
+
+  /**
+   * @brief Memory accounted to a budget for as long as the lease lives.
+   */
+  class lease_t {
+  public:
+    lease_t() = default;
+    lease_t(lease_t &&other) noexcept;
+    lease_t &operator=(lease_t &&other) noexcept;
+    lease_t(const lease_t &) = delete;
+    lease_t &operator=(const lease_t &) = delete;
+    ~lease_t();
+
+    /**
+     * @brief Get the number of bytes accounted.
+     */
+    std::size_t bytes() const {
+      return _bytes;
+    }
+
+  private:
+    friend class budget_t;
+
+    lease_t(budget_t *budget, pool_e pool, std::size_t bytes);
+    void release();
+
+    budget_t *_budget = nullptr;
+    pool_e _pool = pool_e::capture;
+    std::size_t _bytes = 0;
+  };
+
+  /**
+   * @brief Accounts the memory of the frame pools of every session, and tells the pools that can shrink
+   *        whether they may grow.
+   * @details Pools that a stream can't do without, like the frames of an encoder being opened, are always
+   *          accounted, and make the pools that only buffer give way. Any thread may use it.
+   */
+  class budget_t {
+  public:
+    /**
+     * @param limit The most bytes the pools should take, 0 for no limit.
+     */
+    explicit budget_t(std::size_t limit);
+
+    /**
+     * @brief Account memory if it fits within the limit.
+     * @param pool What the memory holds.
+     * @param bytes The number of bytes.
+     * @return The lease, or `std::nullopt` if the memory would go over the limit.
+     */
+    std::optional<lease_t> try_reserve(pool_e pool, std::size_t bytes);
+
+    /**
+     * @brief Account memory a stream can't do without, even over the limit.
+     * @param pool What the memory holds.
+     * @param bytes The number of bytes.
+     */
+    lease_t reserve(pool_e pool, std::size_t bytes);
+
+    /**
+     * @brief Get whether the pools take more than the limit.
+     */
+    bool over() const;
+
+    /**
+     * @brief Get whether more memory fits within the limit.
+     * @param bytes The number of bytes.
+     */
+    bool fits(std::size_t bytes) const;
+
+    /**
+     * @brief Get the limit in bytes, 0 for no limit.
+     */
+    std::size_t limit() const {
+      return _limit;
+    }
+
+    /**
+     * @brief Get the number of bytes accounted.
+     */
+    std::size_t used() const;
+
+    /**
+     * @brief Get the number of bytes accounted to a pool.
+     * @param pool The pool.
+     */
+    std::size_t used(pool_e pool) const;
+
+    /**
+     * @brief Get the number of reservations refused for going over the limit.
+     */
+    std::uint64_t refused() const;
+
+  private:
+    friend class lease_t;
+
+    void release(pool_e pool, std::size_t bytes);
+
+    const std::size_t _limit;
+    std::atomic_size_t _used {0};
+    std::array<std::atomic_size_t, (int) pool_e::MAX_POOLS> _pool_used {};
+    std::atomic_uint64_t _refused {0};
+  };
+
+  /**
+   * @brief Get the budget of the frame pools, limited by `frame_memory_budget`.
+   */
+  budget_t &frames();
+}  // namespace memory_budget
@@ -0,0 +1,482 @@
+/**
+ * @file src/metrics.cpp
+ * @brief Definitions for the per-session streaming metrics registry.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+// local includes
+#include "memory_budget.h"
+#include "metrics.h"
+
+using namespace std::literals;
+
+namespace metrics {
+  namespace {
+    std::mutex registry_lock;
+    std::vector<std::weak_ptr<session_metrics_t>> registry;
+
+    std::mutex gpus_lock;
+    std::vector<gpu_metrics_t> gpu_samples;
+
+    /**
+     * @brief Get the sessions that are still alive, dropping the others from the registry.
+     */
+    std::vector<std::shared_ptr<session_metrics_t>> live_sessions() {
+      std::lock_guard lg {registry_lock};
+
+      std::vector<std::shared_ptr<session_metrics_t>> sessions;
+      std::erase_if(registry, [&](auto &weak) {
+        auto session = weak.lock();
+        if (!session) {
+          return true;
+        }
+
+        sessions.emplace_back(std::move(session));
+        return false;
+      });
+
+      return sessions;
+    }
+
+    std::int64_t to_ns(std::chrono::steady_clock::time_point time_point) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count();
+    }
+
+    double to_ms(std::chrono::nanoseconds duration) {
+      return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    nlohmann::json histogram_json(const histogram_t &histogram) {
+      auto snapshot = histogram.snapshot();
+
+      nlohmann::json node;
+      node["count"] = snapshot.count;
+      node["avg_ms"] = snapshot.count ? to_ms(snapshot.sum) / snapshot.count : 0.0;
+      node["p50_ms"] = to_ms(snapshot.quantile(0.5));
+      node["p90_ms"] = to_ms(snapshot.quantile(0.9));
+      node["p99_ms"] = to_ms(snapshot.quantile(0.99));
+
+      return node;
+    }
+
+    /**
+     * @brief Escape a Prometheus label value.
+     */
+    std::string escape_label(std::string_view value) {
+      std::string escaped;
+      escaped.reserve(value.size());
+
+      for (auto ch : value) {
+        switch (ch) {
+          case '\\':
+            escaped += "\\\\"sv;
+            break;
+          case '"':
+            escaped += "\\\""sv;
+            break;
+          case '\n':
+            escaped += "\\n"sv;
+            break;
+          default:
+            escaped += ch;
+        }
+      }
+
+      return escaped;
+    }
+
+    /**
+     * @brief Write the buckets, sum and count of a histogram in the Prometheus format.
+     */
+    void write_histogram(std::ostringstream &out, std::string_view name, std::string_view labels, const histogram_t &histogram) {
+      auto snapshot = histogram.snapshot();
+
+      std::uint64_t cumulative = 0;
+      for (std::size_t x = 0; x < histogram_t::bucket_limits.size(); ++x) {
+        cumulative += snapshot.buckets[x];
+        out << std::format("apollo_{}_seconds_bucket{{{},le=\"{}\"}} {}\n", name, labels, std::chrono::duration<double>(histogram_t::bucket_limits[x]).count(), cumulative);
+      }
+      out << std::format("apollo_{}_seconds_bucket{{{},le=\"+Inf\"}} {}\n", name, labels, snapshot.count);
+      out << std::format("apollo_{}_seconds_sum{{{}}} {}\n", name, labels, std::chrono::duration<double>(snapshot.sum).count());
+      out << std::format("apollo_{}_seconds_count{{{}}} {}\n", name, labels, snapshot.count);
+    }
+
+    struct histogram_desc_t {
+      std::string_view name;
+      std::string_view help;
+      histogram_t session_metrics_t::*histogram;
+    };
+
+    struct value_desc_t {
+      std::string_view name;
+      std::string_view type;
+      std::string_view help;
+      std::int64_t (*get)(const session_metrics_t &);
+    };
+
+    struct gpu_value_desc_t {
+      std::string_view name;
+      std::string_view help;
+      std::int64_t (*get)(const gpu_metrics_t &);
+    };
+
+    constexpr std::array gpu_values {
+      gpu_value_desc_t {"busy_percent", "Share of the time the GPU was busy", [](const gpu_metrics_t &m) -> std::int64_t {
+                          return m.busy_percent;
+                        }},
+      gpu_value_desc_t {"encoder_percent", "Share of the time the video encoder of the GPU was busy", [](const gpu_metrics_t &m) -> std::int64_t {
+                          return m.encoder_percent;
+                        }},
+      gpu_value_desc_t {"encoder_sessions", "Encode sessions open on the GPU, by any process", [](const gpu_metrics_t &m) -> std::int64_t {
+                          return m.encoder_sessions;
+                        }},
+      gpu_value_desc_t {"clock_mhz", "Graphics clock of the GPU", [](const gpu_metrics_t &m) -> std::int64_t {
+                          return m.clock_mhz;
+                        }},
+      gpu_value_desc_t {"memory_used_bytes", "Video memory in use", [](const gpu_metrics_t &m) -> std::int64_t {
+                          return m.memory_used_bytes;
+                        }},
+      gpu_value_desc_t {"memory_budget_bytes", "Video memory the OS lets this process use", [](const gpu_metrics_t &m) -> std::int64_t {
+                          return m.memory_budget_bytes;
+                        }},
+    };
+
+    constexpr std::array histograms {
+      histogram_desc_t {"capture_to_send", "Time from the capture of a frame until it's picked up for sending", &session_metrics_t::capture_to_send},
+      histogram_desc_t {"fec", "Time to FEC encode and encrypt a FEC block", &session_metrics_t::fec},
+      histogram_desc_t {"send", "Time spent in a single batched send", &session_metrics_t::send},
+      histogram_desc_t {"frame", "Time spent sending a frame, pacing included", &session_metrics_t::frame},
+      histogram_desc_t {"input_to_send", "Time from the arrival of client input until the first frame captured after it was sent to the OS goes on the wire", &session_metrics_t::input_to_send},
+      histogram_desc_t {"audio_capture_to_send", "Time from the capture of audio samples until the packet encoding them goes on the wire", &session_metrics_t::audio_capture_to_send},
+    };
+
+    constexpr std::array values {
+      value_desc_t {"frames", "counter", "Frames sent", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.frames;
+                    }},
+      value_desc_t {"dropped_frames", "counter", "Encoded frames that were never sent", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.dropped_frames;
+                    }},
+      value_desc_t {"idr_frames", "counter", "Keyframes sent", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.idr_frames;
+                    }},
+      value_desc_t {"bytes_sent", "counter", "Video bytes sent", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.bytes_sent;
+                    }},
+      value_desc_t {"source_failovers", "counter", "Switches of the interface video and audio are sent from, with interface failover", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.source_failovers;
+                    }},
+      value_desc_t {"queue_depth", "gauge", "Frames waiting to be sent", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.queue_depth;
+                    }},
+      value_desc_t {"fec_percentage", "gauge", "FEC percentage of the last FEC block", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.fec_percentage;
+                    }},
+      value_desc_t {"bitrate_kbps", "gauge", "Video bitrate over the last second", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.bitrate_kbps;
+                    }},
+      value_desc_t {"rtt_ms", "gauge", "Round-trip time to the client, with adaptive pacing", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.rtt_ms;
+                    }},
+      value_desc_t {"jitter_ms", "gauge", "Variance of the round-trip time to the client, with adaptive pacing", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.jitter_ms;
+                    }},
+      value_desc_t {"pacing_rate_mbps", "gauge", "Rate video is paced at, with adaptive pacing", [](const session_metrics_t &m) -> std::int64_t {
+                      return m.pacing_rate_mbps;
+                    }},
+    };
+  }  // namespace
+
+  std::chrono::microseconds histogram_t::snapshot_t::quantile(double q) const {
+    if (count == 0) {
+      return {};
+    }
+
+    auto target = (std::uint64_t) std::ceil(q * count);
+    std::uint64_t seen = 0;
+    for (std::size_t x = 0; x < bucket_limits.size(); ++x) {
+      seen += buckets[x];
+      if (seen >= target) {
+        return bucket_limits[x];
+      }
+    }
+
+    // The overflow bucket has no upper limit, so fall back to the average when it's larger
+    return std::max(bucket_limits.back(), std::chrono::duration_cast<std::chrono::microseconds>(sum / count));
+  }
+
+  void histogram_t::record(std::chrono::nanoseconds duration) {
+    auto bucket = std::lower_bound(std::begin(bucket_limits), std::end(bucket_limits), duration) - std::begin(bucket_limits);
+
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _sum_ns.fetch_add(duration.count(), std::memory_order_relaxed);
+  }
+
+  histogram_t::snapshot_t histogram_t::snapshot() const {
+    snapshot_t snapshot;
+
+    // The count is derived from the buckets so it always matches them
+    snapshot.count = 0;
+    for (std::size_t x = 0; x < _buckets.size(); ++x) {
+      snapshot.buckets[x] = _buckets[x].load(std::memory_order_relaxed);
+      snapshot.count += snapshot.buckets[x];
+    }
+    snapshot.sum = std::chrono::nanoseconds {_sum_ns.load(std::memory_order_relaxed)};
+
+    return snapshot;
+  }
+
+  void session_metrics_t::frame_started(std::int64_t frame_index, bool is_idr) {
+    frames.fetch_add(1, std::memory_order_relaxed);
+    if (is_idr) {
+      idr_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Frame indices restart when the encoder is reinitialized
+    if (_last_frame_index >= 0 && frame_index > _last_frame_index + 1) {
+      dropped_frames.fetch_add(frame_index - _last_frame_index - 1, std::memory_order_relaxed);
+    }
+    _last_frame_index = frame_index;
+  }
+
+  void session_metrics_t::frame_sent(std::uint64_t bytes) {
+    bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+
+    auto now = std::chrono::steady_clock::now();
+    if (_bitrate_window_start == std::chrono::steady_clock::time_point {}) {
+      _bitrate_window_start = now;
+    }
+
+    _bitrate_window_bytes += bytes;
+
+    auto elapsed = now - _bitrate_window_start;
+    if (elapsed >= 1s) {
+      auto kbits = _bitrate_window_bytes * 8 / 1000;
+      bitrate_kbps = (std::int64_t) (kbits / std::chrono::duration<double>(elapsed).count());
+
+      _bitrate_window_start = now;
+      _bitrate_window_bytes = 0;
+    }
+  }
+
+  void session_metrics_t::input_injected(std::chrono::steady_clock::time_point arrival, std::chrono::steady_clock::time_point injected) {
+    if (_input_injected_ns.load(std::memory_order_acquire) != 0) {
+      return;
+    }
+
+    // The video sender only looks at the arrival once the injection is published
+    _input_arrival_ns.store(to_ns(arrival), std::memory_order_relaxed);
+    _input_injected_ns.store(std::max<std::int64_t>(to_ns(injected), 1), std::memory_order_release);
+  }
+
+  void session_metrics_t::frame_on_wire(std::chrono::steady_clock::time_point captured) {
+    auto injected = _input_injected_ns.load(std::memory_order_acquire);
+    if (injected == 0 || injected > to_ns(captured)) {
+      return;
+    }
+
+    auto arrival = _input_arrival_ns.load(std::memory_order_relaxed);
+    input_to_send.record(std::chrono::nanoseconds {to_ns(std::chrono::steady_clock::now()) - arrival});
+
+    _input_injected_ns.store(0, std::memory_order_release);
+  }
+
+  capture_metrics_t &capture() {
+    static capture_metrics_t metrics;
+    return metrics;
+  }
+
+  encoder_metrics_t &encoder() {
+    static encoder_metrics_t metrics;
+    return metrics;
+  }
+
+  queue_metrics_t &queues() {
+    static queue_metrics_t metrics;
+    return metrics;
+  }
+
+  void set_gpus(std::vector<gpu_metrics_t> gpus) {
+    std::lock_guard lg {gpus_lock};
+    gpu_samples = std::move(gpus);
+  }
+
+  std::vector<gpu_metrics_t> gpus() {
+    std::lock_guard lg {gpus_lock};
+    return gpu_samples;
+  }
+
+  std::shared_ptr<session_metrics_t> register_session(std::uint32_t id, const std::string &device_name) {
+    auto session = std::make_shared<session_metrics_t>();
+    session->id = id;
+    session->device_name = device_name;
+
+    std::lock_guard lg {registry_lock};
+    registry.emplace_back(session);
+
+    return session;
+  }
+
+  nlohmann::json to_json() {
+    nlohmann::json sessions = nlohmann::json::array();
+
+    for (auto &session : live_sessions()) {
+      nlohmann::json node;
+      node["id"] = session->id;
+      node["device_name"] = session->device_name;
+
+      for (auto &desc : histograms) {
+        node[std::string {desc.name}] = histogram_json((*session).*desc.histogram);
+      }
+      for (auto &desc : values) {
+        node[std::string {desc.name}] = desc.get(*session);
+      }
+
+      sessions.emplace_back(std::move(node));
+    }
+
+    nlohmann::json output_tree;
+    output_tree["capture"]["images_allocated"] = capture().images_allocated.load();
+    output_tree["capture"]["images_in_use"] = capture().images_in_use.load();
+    output_tree["memory"]["frame_capture_bytes"] = memory_budget::frames().used(memory_budget::pool_e::capture);
+    output_tree["memory"]["frame_encoder_bytes"] = memory_budget::frames().used(memory_budget::pool_e::encoder);
+    output_tree["memory"]["frame_limit_bytes"] = memory_budget::frames().limit();
+    output_tree["memory"]["frame_refused"] = memory_budget::frames().refused();
+    output_tree["encoder"]["packets_allocated"] = encoder().packets_allocated.load();
+    output_tree["encoder"]["packets_reused"] = encoder().packets_reused.load();
+    output_tree["encoder"]["packet_buffers_allocated"] = encoder().packet_buffers_allocated.load();
+    output_tree["encoder"]["quality_steps_down"] = encoder().quality_steps_down.load();
+    output_tree["encoder"]["quality_steps_up"] = encoder().quality_steps_up.load();
+    output_tree["encoder"]["resolution_steps_down"] = encoder().resolution_steps_down.load();
+    output_tree["encoder"]["resolution_steps_up"] = encoder().resolution_steps_up.load();
+    output_tree["encoder"]["failures"] = encoder().failures.load();
+    output_tree["encoder"]["fallbacks"] = encoder().fallbacks.load();
+    output_tree["encoder"]["last_recovery_ms"] = encoder().last_recovery_ms.load();
+    output_tree["encoder"]["encode"] = histogram_json(encoder().encode);
+    output_tree["encoder"]["encode_split"] = histogram_json(encoder().encode_split);
+    output_tree["queues"]["video_packets_dropped"] = queues().video_packets_dropped.load();
+    output_tree["queues"]["audio_packets_dropped"] = queues().audio_packets_dropped.load();
+    output_tree["queues"]["gamepad_feedback_dropped"] = queues().gamepad_feedback_dropped.load();
+
+    nlohmann::json gpu_nodes = nlohmann::json::array();
+    for (auto &gpu : gpus()) {
+      nlohmann::json node;
+      node["gpu"] = gpu.gpu;
+      for (auto &desc : gpu_values) {
+        node[std::string {desc.name}] = desc.get(gpu);
+      }
+
+      gpu_nodes.emplace_back(std::move(node));
+    }
+
+    output_tree["gpus"] = std::move(gpu_nodes);
+    output_tree["sessions"] = std::move(sessions);
+    return output_tree;
+  }
+
+  std::string to_prometheus() {
+    auto sessions = live_sessions();
+
+    std::ostringstream out;
+    auto labels = [](const session_metrics_t &session) {
+      return std::format(R"(session="{}",device="{}")", session.id, escape_label(session.device_name));
+    };
+
+    for (auto &desc : histograms) {
+      out << "# HELP apollo_"sv << desc.name << "_seconds "sv << desc.help << '\n';
+      out << "# TYPE apollo_"sv << desc.name << "_seconds histogram\n"sv;
+
+      for (auto &session : sessions) {
+        write_histogram(out, desc.name, labels(*session), (*session).*desc.histogram);
+      }
+    }
+
+    for (auto &desc : values) {
+      auto suffix = desc.type == "counter"sv ? "_total"sv : ""sv;
+
+      out << "# HELP apollo_"sv << desc.name << suffix << ' ' << desc.help << '\n';
+      out << "# TYPE apollo_"sv << desc.name << suffix << ' ' << desc.type << '\n';
+
+      for (auto &session : sessions) {
+        out << std::format("apollo_{}{}{{{}}} {}\n", desc.name, suffix, labels(*session), desc.get(*session));
+      }
+    }
+
+    out << "# HELP apollo_capture_images_allocated Images allocated by the capture pool\n"sv;
+    out << "# TYPE apollo_capture_images_allocated gauge\n"sv;
+    out << "apollo_capture_images_allocated "sv << capture().images_allocated << '\n';
+    out << "# HELP apollo_capture_images_in_use Images of the capture pool that are waiting to be encoded\n"sv;
+    out << "# TYPE apollo_capture_images_in_use gauge\n"sv;
+    out << "apollo_capture_images_in_use "sv << capture().images_in_use << '\n';
+    out << "# HELP apollo_frame_memory_bytes Memory taken by the capture images and encoder frames of the streams\n"sv;
+    out << "# TYPE apollo_frame_memory_bytes gauge\n"sv;
+    out << "apollo_frame_memory_bytes{pool=\"capture\"} "sv << memory_budget::frames().used(memory_budget::pool_e::capture) << '\n';
+    out << "apollo_frame_memory_bytes{pool=\"encoder\"} "sv << memory_budget::frames().used(memory_budget::pool_e::encoder) << '\n';
+    out << "# HELP apollo_frame_memory_limit_bytes The frame memory budget, 0 for no limit\n"sv;
+    out << "# TYPE apollo_frame_memory_limit_bytes gauge\n"sv;
+    out << "apollo_frame_memory_limit_bytes "sv << memory_budget::frames().limit() << '\n';
+    out << "# HELP apollo_frame_memory_refused_total Capture images that weren't allocated to stay within the frame memory budget\n"sv;
+    out << "# TYPE apollo_frame_memory_refused_total counter\n"sv;
+    out << "apollo_frame_memory_refused_total "sv << memory_budget::frames().refused() << '\n';
+    out << "# HELP apollo_encoder_packets_allocated_total Packets allocated by the avcodec encoders\n"sv;
+    out << "# TYPE apollo_encoder_packets_allocated_total counter\n"sv;
+    out << "apollo_encoder_packets_allocated_total "sv << encoder().packets_allocated << '\n';
+    out << "# HELP apollo_encoder_packets_reused_total Packets of the avcodec encoders taken from their pool\n"sv;
+    out << "# TYPE apollo_encoder_packets_reused_total counter\n"sv;
+    out << "apollo_encoder_packets_reused_total "sv << encoder().packets_reused << '\n';
+    out << "# HELP apollo_encoder_packet_buffers_allocated_total Packet data buffers allocated by the avcodec encoders\n"sv;
+    out << "# TYPE apollo_encoder_packet_buffers_allocated_total counter\n"sv;
+    out << "apollo_encoder_packet_buffers_allocated_total "sv << encoder().packet_buffers_allocated << '\n';
+    out << "# HELP apollo_encoder_quality_steps_down_total Encoders reopened a quality level down because their frames overran their time\n"sv;
+    out << "# TYPE apollo_encoder_quality_steps_down_total counter\n"sv;
+    out << "apollo_encoder_quality_steps_down_total "sv << encoder().quality_steps_down << '\n';
+    out << "# HELP apollo_encoder_quality_steps_up_total Encoders reopened a quality level up because they had time to spare\n"sv;
+    out << "# TYPE apollo_encoder_quality_steps_up_total counter\n"sv;
+    out << "apollo_encoder_quality_steps_up_total "sv << encoder().quality_steps_up << '\n';
+    out << "# HELP apollo_encoder_resolution_steps_down_total Encoders reopened at a lower resolution because of bandwidth or encoder pressure\n"sv;
+    out << "# TYPE apollo_encoder_resolution_steps_down_total counter\n"sv;
+    out << "apollo_encoder_resolution_steps_down_total "sv << encoder().resolution_steps_down << '\n';
+    out << "# HELP apollo_encoder_resolution_steps_up_total Encoders reopened at a higher resolution once the pressure was gone\n"sv;
+    out << "# TYPE apollo_encoder_resolution_steps_up_total counter\n"sv;
+    out << "apollo_encoder_resolution_steps_up_total "sv << encoder().resolution_steps_up << '\n';
+    out << "# HELP apollo_encoder_failures_total Encoders that failed while streaming, or failed to open\n"sv;
+    out << "# TYPE apollo_encoder_failures_total counter\n"sv;
+    out << "apollo_encoder_failures_total "sv << encoder().failures << '\n';
+    out << "# HELP apollo_encoder_fallbacks_total Streams switched to the next encoder because theirs kept failing\n"sv;
+    out << "# TYPE apollo_encoder_fallbacks_total counter\n"sv;
+    out << "apollo_encoder_fallbacks_total "sv << encoder().fallbacks << '\n';
+    out << "# HELP apollo_encoder_last_recovery_milliseconds Time from the failure of an encoder until the stream had one open again\n"sv;
+    out << "# TYPE apollo_encoder_last_recovery_milliseconds gauge\n"sv;
+    out << "apollo_encoder_last_recovery_milliseconds "sv << encoder().last_recovery_ms << '\n';
+    out << "# HELP apollo_encoder_encode_seconds Time to encode a frame, with a single engine of the GPU or split across its NVENC engines\n"sv;
+    out << "# TYPE apollo_encoder_encode_seconds histogram\n"sv;
+    write_histogram(out, "encoder_encode"sv, R"(engines="single")", encoder().encode);
+    write_histogram(out, "encoder_encode"sv, R"(engines="split")", encoder().encode_split);
+    out << "# HELP apollo_queue_dropped_total Values dropped by a queue between threads because its consumer fell behind\n"sv;
+    out << "# TYPE apollo_queue_dropped_total counter\n"sv;
+    out << "apollo_queue_dropped_total{queue=\"video_packets\"} "sv << queues().video_packets_dropped << '\n';
+    out << "apollo_queue_dropped_total{queue=\"audio_packets\"} "sv << queues().audio_packets_dropped << '\n';
+    out << "apollo_queue_dropped_total{queue=\"gamepad_feedback\"} "sv << queues().gamepad_feedback_dropped << '\n';
+
+    // GPUs without a source for a value are left out of it
+    auto sampled = gpus();
+    for (auto &desc : gpu_values) {
+      out << "# HELP apollo_gpu_"sv << desc.name << ' ' << desc.help << '\n';
+      out << "# TYPE apollo_gpu_"sv << desc.name << " gauge\n"sv;
+
+      for (auto &gpu : sampled) {
+        if (auto value = desc.get(gpu); value >= 0) {
+          out << std::format("apollo_gpu_{}{{gpu=\"{}\"}} {}\n", desc.name, escape_label(gpu.gpu), value);
+        }
+      }
+    }
+
+    return out.str();
+  }
+}  // namespace metrics
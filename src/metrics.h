@@ -0,0 +1,253 @@
+/**
+ * @file src/metrics.h
+ * @brief Declarations for the per-session streaming metrics registry.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+namespace metrics {
+  /**
+   * @brief Lock-free histogram of durations.
+   * @details Buckets double in size from 250us up to 128ms, with a final bucket for anything slower.
+   *          Recording is a few relaxed atomic increments, so it's safe on the hot path of any thread.
+   */
+  class histogram_t {
+  public:
+    static constexpr std::array<std::chrono::microseconds, 10> bucket_limits {
+      std::chrono::microseconds {250},
+      std::chrono::microseconds {500},
+      std::chrono::milliseconds {1},
+      std::chrono::milliseconds {2},
+      std::chrono::milliseconds {4},
+      std::chrono::milliseconds {8},
+      std::chrono::milliseconds {16},
+      std::chrono::milliseconds {32},
+      std::chrono::milliseconds {64},
+      std::chrono::milliseconds {128},
+    };
+
+    struct snapshot_t {
+      // Non-cumulative counts, the last one holding everything above the last limit
+      std::array<std::uint64_t, bucket_limits.size() + 1> buckets;
+      std::uint64_t count;
+      std::chrono::nanoseconds sum;
+
+      /**
+       * @brief Estimate a quantile from the buckets.
+       * @param q The quantile, between 0 and 1.
+       * @return The upper limit of the bucket holding the quantile, or zero if nothing was recorded.
+       */
+      std::chrono::microseconds quantile(double q) const;
+    };
+
+    void record(std::chrono::nanoseconds duration);
+
+    snapshot_t snapshot() const;
+
+  private:
+    std::array<std::atomic_uint64_t, bucket_limits.size() + 1> _buckets {};
+    std::atomic_int64_t _sum_ns {};
+  };
+
+  /**
+   * @brief Metrics of a single streaming session.
+   * @details The histograms, counters and gauges may be read at any time from any thread.
+   */
+  struct session_metrics_t {
+    std::uint32_t id;
+    std::string device_name;
+
+    // Capture of the frame until the video sender picks it up, which covers encoding and queueing
+    histogram_t capture_to_send;
+    // FEC encoding and encryption of a single FEC block
+    histogram_t fec;
+    // A single batched send
+    histogram_t send;
+    // The whole time spent sending a frame, pacing included
+    histogram_t frame;
+    // Arrival of client input until the first frame captured after it was sent to the OS goes on the wire
+    histogram_t input_to_send;
+    // Capture of audio samples until the packet encoding them goes on the wire
+    histogram_t audio_capture_to_send;
+
+    std::atomic_uint64_t frames {};
+    // Frames produced by the encoder that never reached the video sender
+    std::atomic_uint64_t dropped_frames {};
+    std::atomic_uint64_t idr_frames {};
+    std::atomic_uint64_t bytes_sent {};
+    // Only updated with interface failover
+    std::atomic_uint64_t source_failovers {};
+
+    std::atomic_int64_t queue_depth {};
+    std::atomic_int64_t fec_percentage {};
+    std::atomic_int64_t bitrate_kbps {};
+
+    // Only updated with adaptive pacing, zero while unknown
+    std::atomic_int64_t rtt_ms {};
+    std::atomic_int64_t jitter_ms {};
+    std::atomic_int64_t pacing_rate_mbps {};
+
+    /**
+     * @brief Account for a frame picked up by the video sender.
+     * @details Only the thread sending the video of this session may call this.
+     * @param frame_index The index of the frame.
+     * @param is_idr Whether the frame is a keyframe.
+     */
+    void frame_started(std::int64_t frame_index, bool is_idr);
+
+    /**
+     * @brief Account for the bytes sent for a frame and update the bitrate once per second.
+     * @details Only the thread sending the video of this session may call this.
+     * @param bytes The number of bytes put on the wire.
+     */
+    void frame_sent(std::uint64_t bytes);
+
+    /**
+     * @brief Account for client input sent to the OS.
+     * @details Only the first input since the last one accounted for in input_to_send is tracked,
+     *          so a burst of input is measured from its oldest message.
+     *          Only the thread sending the input of this session may call this.
+     * @param arrival When the input arrived from the client.
+     * @param injected When the input was sent to the OS.
+     */
+    void input_injected(std::chrono::steady_clock::time_point arrival, std::chrono::steady_clock::time_point injected);
+
+    /**
+     * @brief Account for packets of a frame put on the wire.
+     * @details Records input_to_send if the frame was captured after the tracked input was sent to the OS.
+     *          Only the thread sending the video of this session may call this.
+     * @param captured When the frame was captured.
+     */
+    void frame_on_wire(std::chrono::steady_clock::time_point captured);
+
+  private:
+    // Of the input tracked for input_to_send, in nanoseconds of the steady clock, zero when none is.
+    // Only the input thread sets them, only the video sender clears them.
+    std::atomic_int64_t _input_arrival_ns {};
+    std::atomic_int64_t _input_injected_ns {};
+
+    // Only touched by the thread sending the video of this session
+    std::int64_t _last_frame_index = -1;
+    std::chrono::steady_clock::time_point _bitrate_window_start;
+    std::uint64_t _bitrate_window_bytes = 0;
+  };
+
+  /**
+   * @brief Metrics of the capture thread, shared by every session.
+   */
+  struct capture_metrics_t {
+    std::atomic_int64_t images_allocated {};
+    std::atomic_int64_t images_in_use {};
+  };
+
+  /**
+   * @brief Get the metrics of the capture thread.
+   * @return The metrics.
+   */
+  capture_metrics_t &capture();
+
+  /**
+   * @brief Allocations of the packets of the avcodec encoders, the quality levels and resolutions
+   *        encoders were stepped through to keep up with their frame time and bitrate, how streams
+   *        recovered from failing encoders, and how long frames took to encode, shared by every session.
+   */
+  struct encoder_metrics_t {
+    // Encoding a frame with a single engine of the GPU, or on the CPU
+    histogram_t encode;
+    // Encoding a frame split across the NVENC engines of the GPU
+    histogram_t encode_split;
+
+    std::atomic_uint64_t packets_allocated {};
+    std::atomic_uint64_t packets_reused {};
+    std::atomic_uint64_t packet_buffers_allocated {};
+    std::atomic_uint64_t quality_steps_down {};
+    std::atomic_uint64_t quality_steps_up {};
+    std::atomic_uint64_t resolution_steps_down {};
+    std::atomic_uint64_t resolution_steps_up {};
+    std::atomic_uint64_t failures {};
+    std::atomic_uint64_t fallbacks {};
+
+    // From the failure of an encoder until the stream had one open again, zero until one failed
+    std::atomic_int64_t last_recovery_ms {};
+  };
+
+  /**
+   * @brief Get the metrics of the encoders.
+   * @return The metrics.
+   */
+  encoder_metrics_t &encoder();
+
+  /**
+   * @brief Values dropped by the queues between threads because the thread popping them fell behind.
+   */
+  struct queue_metrics_t {
+    std::atomic_uint64_t video_packets_dropped {};
+    std::atomic_uint64_t audio_packets_dropped {};
+    std::atomic_uint64_t gamepad_feedback_dropped {};
+  };
+
+  /**
+   * @brief Get the metrics of the queues between threads.
+   * @return The metrics.
+   */
+  queue_metrics_t &queues();
+
+  /**
+   * @brief Utilization of a GPU, sampled in the background while streaming.
+   * @details Values the GPU has no source for are -1.
+   */
+  struct gpu_metrics_t {
+    std::string gpu;
+    int busy_percent = -1;
+    int encoder_percent = -1;
+    int encoder_sessions = -1;
+    int clock_mhz = -1;
+    std::int64_t memory_used_bytes = -1;
+    std::int64_t memory_budget_bytes = -1;
+  };
+
+  /**
+   * @brief Replace the utilization of the GPUs with a new sample.
+   * @param gpus The GPUs.
+   */
+  void set_gpus(std::vector<gpu_metrics_t> gpus);
+
+  /**
+   * @brief Get the last sampled utilization of the GPUs.
+   * @return The GPUs, empty if they haven't been sampled.
+   */
+  std::vector<gpu_metrics_t> gpus();
+
+  /**
+   * @brief Register a new session with the metrics registry.
+   * @details The registry only keeps a weak reference, so the session disappears from it once the
+   *          returned pointer and all its copies are destroyed.
+   * @param id The launch session ID.
+   * @param device_name The name of the client.
+   * @return The metrics of the session.
+   */
+  std::shared_ptr<session_metrics_t> register_session(std::uint32_t id, const std::string &device_name);
+
+  /**
+   * @brief Get the metrics of every registered session.
+   * @return The metrics as JSON.
+   */
+  nlohmann::json to_json();
+
+  /**
+   * @brief Get the metrics of every registered session.
+   * @return The metrics in the Prometheus text exposition format.
+   */
+  std::string to_prometheus();
+}  // namespace metrics
@@ -0,0 +1,110 @@
+/**
+ * @file src/motion_coalescer.h
+ * @brief Declarations for limiting the rate of gamepad motion events.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <optional>
+
+// local includes
+#include "platform/common.h"
+
+namespace input {
+  /**
+   * @brief Merges the motion samples of one sensor of a gamepad that arrive faster than a given rate.
+   * @details Samples within an interval are averaged, which keeps the rotation integrated from gyro samples intact.
+   *          A sample that arrives after a full interval is sent right away, so the rate limit never adds latency
+   *          to a sensor at rest. The pending average is due at deadline(), or with the next sample after it.
+   */
+  class motion_coalescer_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    motion_coalescer_t() = default;
+
+    /**
+     * @param interval The minimum time between samples sent, 0 to send every sample.
+     */
+    explicit motion_coalescer_t(std::chrono::nanoseconds interval):
+        _interval {interval} {
+    }
+
+    /**
+     * @brief Add a sample.
+     * @param motion The sample.
+     * @param now The time the sample arrived.
+     * @return The sample to send now, if any.
+     */
+    std::optional<platf::gamepad_motion_t> add(const platf::gamepad_motion_t &motion, clock::time_point now) {
+      if (_count > 0 && (motion.id.globalIndex != _motion.id.globalIndex || motion.motionType != _motion.motionType)) {
+        reset();
+      }
+
+      if (_count == 0) {
+        _motion = motion;
+      } else {
+        _motion.x += motion.x;
+        _motion.y += motion.y;
+        _motion.z += motion.z;
+      }
+      ++_count;
+
+      if (_last_sent && now - *_last_sent < _interval) {
+        return std::nullopt;
+      }
+
+      return flush(now);
+    }
+
+    /**
+     * @brief Take the average of the samples pending.
+     * @param now The current time.
+     * @return The sample to send, if any.
+     */
+    std::optional<platf::gamepad_motion_t> flush(clock::time_point now) {
+      if (_count == 0) {
+        return std::nullopt;
+      }
+
+      auto motion = _motion;
+      motion.x /= _count;
+      motion.y /= _count;
+      motion.z /= _count;
+
+      _count = 0;
+      _last_sent = now;
+
+      return motion;
+    }
+
+    /**
+     * @return When the samples pending are due, if any.
+     */
+    std::optional<clock::time_point> deadline() const {
+      if (_count == 0 || !_last_sent) {
+        return std::nullopt;
+      }
+
+      return *_last_sent + _interval;
+    }
+
+    /**
+     * @brief Drop the samples pending, e.g. when the gamepad goes away.
+     */
+    void reset() {
+      _count = 0;
+      _last_sent.reset();
+    }
+
+  private:
+    std::chrono::nanoseconds _interval {};
+
+    // The sum of the samples pending
+    platf::gamepad_motion_t _motion {};
+    int _count {};
+
+    std::optional<clock::time_point> _last_sent;
+  };
+}  // namespace input
@@ -223,4 +223,66 @@ namespace net {
 
     return !instancename.empty() ? instancename : "Apollo";
   }
+
+  /**
+   * @brief Check whether an address is on the network of an interface address.
+   * @param address The address to check.
+   * @param network The interface address.
+   * @param prefix_length The length of the network prefix of the interface address.
+   * @return `true` if the address is reachable without a router.
+   */
+  bool on_network(boost::asio::ip::address address, boost::asio::ip::address network, int prefix_length) {
+    address = normalize_address(address);
+    network = normalize_address(network);
+    if (address.is_v4() != network.is_v4()) {
+      return false;
+    }
+
+    auto compare = [prefix_length](const auto &a, const auto &b) {
+      auto bits = std::clamp<int>(prefix_length, 0, a.size() * 8);
+      for (std::size_t x = 0; bits > 0; ++x, bits -= 8) {
+        auto mask = (std::uint8_t) (0xFF << (8 - std::min(bits, 8)));
+        if ((a[x] & mask) != (b[x] & mask)) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    if (address.is_v4()) {
+      return compare(address.to_v4().to_bytes(), network.to_v4().to_bytes());
+    }
+    return compare(address.to_v6().to_bytes(), network.to_v6().to_bytes());
+  }
+
+  /**
+   * @brief Pick the addresses the host can send a stream to a client from, most preferred first.
+   * @param interfaces The addresses of the interfaces of the host.
+   * @param local_address The address the client reached the host at.
+   * @param client_address The address of the client.
+   * @return The addresses, or an empty list if the local address isn't on any of the interfaces.
+   */
+  std::vector<platf::interface_address_t> source_interfaces(const std::vector<platf::interface_address_t> &interfaces, boost::asio::ip::address local_address, boost::asio::ip::address client_address) {
+    local_address = normalize_address(local_address);
+
+    auto primary = std::find_if(std::begin(interfaces), std::end(interfaces), [&](auto &iface) {
+      return normalize_address(iface.address) == local_address;
+    });
+    if (primary == std::end(interfaces)) {
+      return {};
+    }
+
+    std::vector<platf::interface_address_t> sources {*primary};
+    for (auto &iface : interfaces) {
+      auto known = std::any_of(std::begin(sources), std::end(sources), [&](auto &source) {
+        return source.name == iface.name;
+      });
+
+      if (!known && on_network(client_address, iface.address, iface.prefix_length)) {
+        sources.emplace_back(iface);
+      }
+    }
+
+    return sources;
+  }
 }  // namespace net
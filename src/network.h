@@ -7,12 +7,14 @@
 // standard includes
 #include <tuple>
 #include <utility>
+#include <vector>
 
 // lib includes
 #include <boost/asio.hpp>
 #include <enet/enet.h>
 
 // local includes
+#include "platform/common.h"
 #include "utility.h"
 
 namespace net {
@@ -102,4 +104,24 @@ namespace net {
    * @return Hostname-based instance name or "Sunshine" if hostname is invalid.
    */
   std::string mdns_instance_name(const std::string_view &hostname);
+
+  /**
+   * @brief Check whether an address is on the network of an interface address.
+   * @param address The address to check.
+   * @param network The interface address.
+   * @param prefix_length The length of the network prefix of the interface address.
+   * @return `true` if the address is reachable without a router.
+   */
+  bool on_network(boost::asio::ip::address address, boost::asio::ip::address network, int prefix_length);
+
+  /**
+   * @brief Pick the addresses the host can send a stream to a client from, most preferred first.
+   * @details The address the client reached the host at comes first, followed by an address of every other
+   *          interface on the network of the client, which reaches it without a router.
+   * @param interfaces The addresses of the interfaces of the host.
+   * @param local_address The address the client reached the host at.
+   * @param client_address The address of the client.
+   * @return The addresses, or an empty list if the local address isn't on any of the interfaces.
+   */
+  std::vector<platf::interface_address_t> source_interfaces(const std::vector<platf::interface_address_t> &interfaces, boost::asio::ip::address local_address, boost::asio::ip::address client_address);
 }  // namespace net
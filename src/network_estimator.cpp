@@ -0,0 +1,185 @@
+/**
+ * @file src/network_estimator.cpp
+ * @brief Definitions for the estimator of the network path to a client, which paces its video.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
+// local includes
+#include "network_estimator.h"
+
+using namespace std::literals;
+
+namespace stream {
+  namespace {
+    // Back off when more than this share of the packets is lost
+    constexpr double loss_threshold = 0.02;
+
+    // Only probe for a faster rate while less than this share of the packets is lost
+    constexpr double probe_loss_threshold = 0.005;
+
+    // Back off when the round-trip time grew this much above the quickest one, as queues along the path fill up
+    constexpr auto rtt_inflation_threshold = 10ms;
+
+    constexpr double decrease_factor = 0.85;
+
+    // Share of the maximum rate added with every update
+    constexpr double increase_step = 0.05;
+
+    // Give the path time to drain after backing off
+    constexpr auto decrease_hold = 1s;
+    constexpr auto increase_hold = 2s;
+
+    // Pacing slower than the stream sends on average would queue frames up, so keep some headroom above it
+    constexpr double min_rate_headroom = 1.5;
+    constexpr int min_pacing_rate = 20;
+
+    // The drain rate is only known once the socket was full for this share of the time
+    constexpr double busy_share = 0.5;
+
+    // FEC added per millisecond of jitter above the threshold
+    constexpr auto jitter_threshold = 5ms;
+    constexpr int max_jitter_fec_percentage = 20;
+
+    // The most FEC a frame can have, see fec::encode()
+    constexpr int fec_percentage_limit = 255;
+  }  // namespace
+
+  network_estimator_t::network_estimator_t(int max_pacing_rate_mbps, bool back_off_on_loss):
+      _max_pacing_rate {std::max(max_pacing_rate_mbps, min_pacing_rate)},
+      _back_off_on_loss {back_off_on_loss},
+      _pacing_rate {_max_pacing_rate} {
+  }
+
+  void network_estimator_t::rtt_sampled(std::chrono::milliseconds rtt, std::chrono::milliseconds variance) {
+    std::lock_guard lg {_lock};
+
+    _rtt = rtt;
+    _jitter = variance;
+    _window_min_rtt = std::min(_window_min_rtt.value_or(rtt), rtt);
+  }
+
+  void network_estimator_t::packets_lost(int packets) {
+    std::lock_guard lg {_lock};
+    _packets_lost += std::max(packets, 0);
+  }
+
+  void network_estimator_t::batch_sent(std::size_t bytes, std::chrono::nanoseconds duration) {
+    std::lock_guard lg {_lock};
+
+    _bytes_batched += bytes;
+    _send_time += duration;
+  }
+
+  bool network_estimator_t::frame_sent(int packets, std::size_t bytes, clock::time_point now) {
+    std::lock_guard lg {_lock};
+
+    _packets_sent += packets;
+    _bytes_sent += bytes;
+
+    if (!_last_update) {
+      _last_update = now;
+      return false;
+    }
+
+    auto window = now - *_last_update;
+    if (window < update_interval) {
+      return false;
+    }
+    _last_update = now;
+
+    auto packet_loss = (double) _packets_lost / std::max<std::int64_t>(_packets_sent, 1);
+    _loss = (_loss + std::min(1.0, packet_loss)) / 2;
+
+    auto window_us = std::chrono::duration_cast<std::chrono::microseconds>(window).count();
+    auto send_rate = (int) (_bytes_sent * 8 / std::max<std::int64_t>(window_us, 1));
+
+    // While the socket stays full, sends complete as fast as the host can put packets on the wire
+    auto send_us = std::chrono::duration_cast<std::chrono::microseconds>(_send_time).count();
+    if (send_us > window_us * busy_share) {
+      _drain_rate = (int) (_bytes_batched * 8 / std::max<std::int64_t>(send_us, 1));
+    } else {
+      _drain_rate = 0;
+    }
+
+    // The quickest round trip shows the path without queueing.
+    // The baseline drifts up slowly, so it follows the path when the client roams.
+    bool queueing = false;
+    if (auto window_rtt = _window_min_rtt) {
+      if (!_min_rtt || *window_rtt < *_min_rtt) {
+        _min_rtt = window_rtt;
+      } else {
+        *_min_rtt += (*window_rtt - *_min_rtt) / 8;
+      }
+      queueing = *window_rtt - *_min_rtt > rtt_inflation_threshold;
+    }
+
+    _packets_sent = 0;
+    _packets_lost = 0;
+    _bytes_sent = 0;
+    _bytes_batched = 0;
+    _send_time = {};
+    _window_min_rtt.reset();
+
+    auto since_decrease = _last_decrease ? now - *_last_decrease : clock::duration::max();
+    if ((_back_off_on_loss && _loss > loss_threshold) || queueing) {
+      if (since_decrease >= decrease_hold) {
+        _pacing_rate = (int) (_pacing_rate * decrease_factor);
+        _last_decrease = now;
+      }
+    } else if (_loss < probe_loss_threshold && since_decrease >= increase_hold) {
+      _pacing_rate += std::max(1, (int) (_max_pacing_rate * increase_step));
+    }
+
+    auto min_rate = std::min(_max_pacing_rate, std::max(min_pacing_rate, (int) (send_rate * min_rate_headroom)));
+    _pacing_rate = std::clamp(_pacing_rate, min_rate, _max_pacing_rate);
+
+    // Pacing faster than the socket drains only fills it up
+    if (_drain_rate > 0) {
+      _pacing_rate = std::clamp(_drain_rate, min_pacing_rate, _pacing_rate);
+    }
+
+    return true;
+  }
+
+  void network_estimator_t::start_from(int pacing_rate_mbps, std::chrono::milliseconds rtt, clock::time_point now) {
+    std::lock_guard lg {_lock};
+
+    _pacing_rate = std::clamp(pacing_rate_mbps, min_pacing_rate, _max_pacing_rate);
+    _last_decrease = now;
+
+    if (rtt > 0ms && !_rtt) {
+      _rtt = rtt;
+    }
+  }
+
+  network_estimator_t::estimates_t network_estimator_t::estimates() const {
+    std::lock_guard lg {_lock};
+
+    return {
+      _rtt,
+      _min_rtt,
+      _jitter,
+      _loss,
+      _drain_rate,
+      _pacing_rate,
+    };
+  }
+
+  int network_estimator_t::pacing_rate() const {
+    std::lock_guard lg {_lock};
+    return _pacing_rate;
+  }
+
+  int network_estimator_t::fec_percentage(int fec_percentage) const {
+    std::lock_guard lg {_lock};
+
+    if (!_jitter || *_jitter <= jitter_threshold) {
+      return fec_percentage;
+    }
+
+    auto extra = std::min<int>((*_jitter - jitter_threshold).count(), max_jitter_fec_percentage);
+    return std::min(fec_percentage + extra, fec_percentage_limit);
+  }
+}  // namespace stream
@@ -0,0 +1,139 @@
+/**
+ * @file src/network_estimator.h
+ * @brief Declarations for the estimator of the network path to a client, which paces its video.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace stream {
+  /**
+   * @brief Estimates the network path to the client of a single video stream.
+   * @details The round-trip time and its variance come from the control stream, the packet loss from the
+   *          reports of the client, and the drain rate from how long sends block once the socket is full.
+   *          The pacing rate follows them in an AIMD loop: it backs off when the path loses packets or its
+   *          queues grow, and creeps back up to the maximum once it keeps up. It never goes below what the
+   *          stream needs, so frames never queue up behind the pacing itself. When the bitrate of the
+   *          stream adapts to the loss, the loss is left to it, and the rate only follows the round-trip time and
+   *          drain rate, so both don't back off for the same loss. All methods are thread-safe.
+   */
+  class network_estimator_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief What's currently known about the path.
+     */
+    struct estimates_t {
+      std::optional<std::chrono::milliseconds> rtt;  ///< Smoothed round-trip time.
+      std::optional<std::chrono::milliseconds> min_rtt;  ///< Round-trip time without queueing.
+      std::optional<std::chrono::milliseconds> jitter;  ///< Variance of the round-trip time.
+      double loss;  ///< Smoothed share of packets lost.
+      int drain_rate_mbps;  ///< How fast the socket drained while it was full, 0 when it never was.
+      int pacing_rate_mbps;  ///< How fast video is paced.
+    };
+
+    static constexpr int default_max_pacing_rate_mbps = 800;
+
+    /**
+     * @param max_pacing_rate_mbps The rate to pace at while the path keeps up.
+     * @param back_off_on_loss Whether to back off when the path loses packets, or leave the loss to the bitrate.
+     */
+    explicit network_estimator_t(int max_pacing_rate_mbps = default_max_pacing_rate_mbps, bool back_off_on_loss = true);
+
+    /**
+     * @brief Account for a round-trip time measured on the control stream.
+     * @param rtt The smoothed round-trip time.
+     * @param variance Its variance.
+     */
+    void rtt_sampled(std::chrono::milliseconds rtt, std::chrono::milliseconds variance);
+
+    /**
+     * @brief Account for packets the client reported lost.
+     * @param packets The number of packets lost since the last report.
+     */
+    void packets_lost(int packets);
+
+    /**
+     * @brief Account for a batch of packets handed to the socket.
+     * @details Only the thread sending the video of the stream may call this.
+     * @param bytes The bytes of the batch.
+     * @param duration How long the send took.
+     */
+    void batch_sent(std::size_t bytes, std::chrono::nanoseconds duration);
+
+    /**
+     * @brief Account for a frame handed to the network, and adapt to what was observed since the last update.
+     * @details Only the thread sending the video of the stream may call this.
+     * @param packets The number of packets of the frame, FEC included.
+     * @param bytes The bytes of the frame, headers included.
+     * @param now The current time.
+     * @return `true` if the estimates were updated.
+     */
+    bool frame_sent(int packets, std::size_t bytes, clock::time_point now = clock::now());
+
+    /**
+     * @brief Start from what the last session to the client settled on, rather than from the maximum rate.
+     * @details The rate is only climbed from once the increase hold passed. The quickest round-trip time
+     *          is left to be measured, as the path may have changed since.
+     * @param pacing_rate_mbps The rate to pace at.
+     * @param rtt The round-trip time.
+     * @param now The current time.
+     */
+    void start_from(int pacing_rate_mbps, std::chrono::milliseconds rtt, clock::time_point now = clock::now());
+
+    /**
+     * @brief Get the current estimates.
+     */
+    estimates_t estimates() const;
+
+    /**
+     * @brief Get the rate video should be paced at.
+     * @return The rate in megabits per second.
+     */
+    int pacing_rate() const;
+
+    /**
+     * @brief Get the FEC percentage to use on this path.
+     * @details Paths with a jittery round-trip time, like Wi-Fi, tend to lose packets in bursts, so they get more FEC.
+     *          Only for streams with a fixed FEC percentage, as the reported loss already counts the packets jitter made late.
+     * @param fec_percentage The fixed FEC percentage of the stream.
+     * @return The percentage.
+     */
+    int fec_percentage(int fec_percentage) const;
+
+    // How often the pacing rate is adapted
+    static constexpr auto update_interval = std::chrono::milliseconds {500};
+
+  private:
+    const int _max_pacing_rate;
+    const bool _back_off_on_loss;
+
+    mutable std::mutex _lock;
+
+    int _pacing_rate;
+
+    // Observed since the last update
+    std::int64_t _packets_sent = 0;
+    std::int64_t _packets_lost = 0;
+    std::uint64_t _bytes_sent = 0;
+    std::uint64_t _bytes_batched = 0;
+    std::chrono::nanoseconds _send_time {};
+    std::optional<std::chrono::milliseconds> _window_min_rtt;
+
+    // Smoothed across updates
+    double _loss = 0;
+    int _drain_rate = 0;
+    std::optional<std::chrono::milliseconds> _rtt;
+    std::optional<std::chrono::milliseconds> _min_rtt;
+    std::optional<std::chrono::milliseconds> _jitter;
+
+    std::optional<clock::time_point> _last_update;
+    std::optional<clock::time_point> _last_decrease;
+  };
+}  // namespace stream
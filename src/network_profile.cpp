@@ -0,0 +1,71 @@
+/**
+ * @file src/network_profile.cpp
+ * @brief Definitions for what's learned about the network path to a paired client across its sessions.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "network_profile.h"
+
+using namespace std::literals;
+
+namespace stream {
+  namespace {
+    // A bitrate held with more loss than this isn't one the path carries well
+    constexpr double max_stable_loss = 0.02;
+  }  // namespace
+
+  nlohmann::json network_profile_t::serialize() const {
+    nlohmann::json node = nlohmann::json::object();
+
+    node["bitrate"] = bitrate;
+    node["loss"] = loss;
+    node["rtt"] = rtt.count();
+    node["mtu"] = mtu;
+    node["pacing_rate"] = pacing_rate_mbps;
+    node["interface"] = interface;
+
+    return node;
+  }
+
+  std::optional<network_profile_t> network_profile_t::parse(const nlohmann::json &node) {
+    if (!node.is_object()) {
+      return std::nullopt;
+    }
+
+    try {
+      network_profile_t profile;
+      profile.bitrate = std::max(node.value("bitrate", 0), 0);
+      profile.loss = std::clamp(node.value("loss", 0.0), 0.0, 1.0);
+      profile.rtt = std::chrono::milliseconds {std::max<std::int64_t>(node.value("rtt", 0), 0)};
+      profile.mtu = std::max(node.value("mtu", 0), 0);
+      profile.pacing_rate_mbps = std::max(node.value("pacing_rate", 0), 0);
+      profile.interface = node.value("interface", ""s);
+
+      return profile;
+    } catch (const nlohmann::json::exception &) {
+      return std::nullopt;
+    }
+  }
+
+  void stable_bitrate_t::sample(int bitrate, double loss, clock::time_point now) {
+    std::lock_guard lg {_lock};
+
+    if (!_current || _current->bitrate != bitrate || loss > max_stable_loss) {
+      _current = sample_t {bitrate, loss};
+      _since = now;
+      return;
+    }
+
+    _current->loss = loss;
+    if (now - _since >= stable_hold) {
+      _stable = _current;
+    }
+  }
+
+  std::optional<stable_bitrate_t::sample_t> stable_bitrate_t::stable() const {
+    std::lock_guard lg {_lock};
+    return _stable;
+  }
+}  // namespace stream
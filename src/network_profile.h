@@ -0,0 +1,83 @@
+/**
+ * @file src/network_profile.h
+ * @brief Declarations for what's learned about the network path to a paired client across its sessions.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+namespace stream {
+  /**
+   * @brief What the last sessions of a client learned about the path to it.
+   * @details Persisted with the pairing state of the client, so the next session starts where the last one
+   *          settled rather than finding the path out again. Fields that were never learned are 0 or empty.
+   */
+  struct network_profile_t {
+    int bitrate = 0;  ///< The last bitrate in kilobits the video held without backing off.
+    double loss = 0;  ///< The share of packets lost at that bitrate.
+    std::chrono::milliseconds rtt {};  ///< The round-trip time without queueing.
+    int mtu = 0;  ///< The path MTU.
+    int pacing_rate_mbps = 0;  ///< The rate the video was last paced at.
+    std::string interface;  ///< The interface the video was last sent from with interface failover.
+
+    bool operator==(const network_profile_t &) const = default;
+
+    /**
+     * @brief Get the profile as stored in the state file.
+     */
+    nlohmann::json serialize() const;
+
+    /**
+     * @brief Read a profile from the state file.
+     * @param node The node of the profile.
+     * @return The profile, or `std::nullopt` if the node isn't one.
+     */
+    static std::optional<network_profile_t> parse(const nlohmann::json &node);
+  };
+
+  /**
+   * @brief Tracks the last bitrate a video stream held for a while.
+   * @details A bitrate counts as stable once the bitrate controller kept it for `stable_hold`
+   *          with little loss. All methods are thread-safe.
+   */
+  class stable_bitrate_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    struct sample_t {
+      int bitrate;  ///< The bitrate in kilobits.
+      double loss;  ///< The share of packets lost.
+    };
+
+    /**
+     * @brief Account for the bitrate the stream currently sends at.
+     * @param bitrate The bitrate in kilobits.
+     * @param loss The share of packets lost.
+     * @param now The current time.
+     */
+    void sample(int bitrate, double loss, clock::time_point now = clock::now());
+
+    /**
+     * @brief Get the last stable bitrate.
+     * @return The bitrate and its loss, or `std::nullopt` if the stream never held one.
+     */
+    std::optional<sample_t> stable() const;
+
+    // How long a bitrate must hold to count as stable
+    static constexpr auto stable_hold = std::chrono::seconds {5};
+
+  private:
+    mutable std::mutex _lock;
+
+    std::optional<sample_t> _current;
+    clock::time_point _since;
+    std::optional<sample_t> _stable;
+  };
+}  // namespace stream
@@ -6,7 +6,10 @@
 #include "nvenc_base.h"
 
 // standard includes
+#include <chrono>
 #include <format>
+#include <thread>
+#include <tuple>
 
 // local includes
 #include "src/config.h"
@@ -24,6 +27,11 @@
   #error Check and update NVENC code for backwards compatibility!
 #endif
 
+// Split-frame encoding came with Video Codec SDK 12.1
+#if NVENCAPI_MAJOR_VERSION > 12 || (NVENCAPI_MAJOR_VERSION == 12 && NVENCAPI_MINOR_VERSION >= 1)
+  #define NVENC_HAVE_SPLIT_ENCODE
+#endif
+
 namespace {
 
   GUID quality_preset_guid_from_number(unsigned number) {
@@ -102,6 +110,14 @@ namespace nvenc {
     // to maximize driver compatibility. AV1 was introduced in SDK v12.0.
     minimum_api_version = (client_config.videoFormat <= 1) ? MAKE_NVENC_VER(11U, 0U) : MAKE_NVENC_VER(12U, 0U);
 
+    auto split_encode = use_split_encode(config, client_config.videoFormat, client_config.width, client_config.height, client_config.framerate);
+#ifdef NVENC_HAVE_SPLIT_ENCODE
+    // The split mode is part of the initialization parameters of the SDK the encoder was built with
+    if (split_encode) {
+      minimum_api_version = NVENCAPI_VERSION;
+    }
+#endif
+
     if (!nvenc && !init_library()) {
       return false;
     }
@@ -139,7 +155,7 @@ namespace nvenc {
       return false;
     }
 
-    NV_ENC_INITIALIZE_PARAMS init_params = {min_struct_version(NV_ENC_INITIALIZE_PARAMS_VER)};
+    init_params = {min_struct_version(NV_ENC_INITIALIZE_PARAMS_VER)};
 
     switch (client_config.videoFormat) {
       case 0:
@@ -212,12 +228,34 @@ namespace nvenc {
     }
 
     encoder_params.rfi = get_encoder_cap(NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION);
+    encoder_params.dynamic_bitrate = get_encoder_cap(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE);
+
+    // The frames are padded to whole packets when they're sent as they're encoded, which is fine
+    // for H.264 and HEVC bitstreams only. A single slice leaves nothing to send early.
+    encoder_params.subframe_output = config.subframe_output && client_config.videoFormat <= 1 && get_encoder_cap(NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK);
+    encoder_params.slices = std::max(client_config.slicesPerFrame, 1);
+    if (encoder_params.subframe_output && encoder_params.slices < 2) {
+      encoder_params.slices = 4;
+    }
+
+    encoder_params.split_encode = false;
+    if (split_encode) {
+#ifdef NVENC_HAVE_SPLIT_ENCODE
+      // Forced rather than automatic, since the driver doesn't split frames for the ultra-low latency tuning on its own
+      encoder_params.split_encode = get_encoder_cap(NV_ENC_CAPS_NUM_ENCODER_ENGINES) > 1;
+      init_params.splitEncodeMode = encoder_params.split_encode ? NV_ENC_SPLIT_AUTO_FORCED_MODE : NV_ENC_SPLIT_DISABLE_MODE;
+#else
+      BOOST_LOG(warning) << "NvEnc: split-frame encoding needs Video Codec SDK 12.1, encoding with a single engine";
+#endif
+    }
 
     init_params.presetGUID = quality_preset_guid_from_number(config.quality_preset);
     init_params.tuningInfo = NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY;
     init_params.enablePTD = 1;
     init_params.enableEncodeAsync = async_event_handle ? 1 : 0;
     init_params.enableWeightedPrediction = config.weighted_prediction && get_encoder_cap(NV_ENC_CAPS_SUPPORT_WEIGHTED_PREDICTION);
+    init_params.enableSubFrameWrite = encoder_params.subframe_output;
+    init_params.reportSliceOffsets = encoder_params.subframe_output;
 
     init_params.encodeWidth = encoder_params.width;
     init_params.darWidth = encoder_params.width;
@@ -232,7 +270,7 @@ namespace nvenc {
       return false;
     }
 
-    NV_ENC_CONFIG enc_config = preset_config.presetCfg;
+    enc_config = preset_config.presetCfg;
     enc_config.profileGUID = NV_ENC_CODEC_PROFILE_AUTOSELECT_GUID;
     enc_config.gopLength = NVENC_INFINITE_GOPLENGTH;
     enc_config.frameIntervalP = 1;
@@ -244,7 +282,12 @@ namespace nvenc {
                                     config.two_pass == nvenc_two_pass::full_resolution    ? NV_ENC_TWO_PASS_FULL_RESOLUTION :
                                                                                             NV_ENC_MULTI_PASS_DISABLED;
 
-    enc_config.rcParams.enableAQ = config.adaptive_quantization;
+    // Spatial AQ moves bits from the edges of text to flat regions
+    enc_config.rcParams.enableAQ = config.adaptive_quantization && !client_config.screen_content;
+    if (config.qp_delta_map) {
+      enc_config.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+      encoder_params.qp_delta_map = true;
+    }
     enc_config.rcParams.averageBitRate = client_config.bitrate * 1000;
 
     if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE)) {
@@ -258,7 +301,7 @@ namespace nvenc {
       format_config.repeatSPSPPS = 1;
       format_config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
       format_config.sliceMode = 3;
-      format_config.sliceModeData = client_config.slicesPerFrame;
+      format_config.sliceModeData = encoder_params.slices;
       if (buffer_is_yuv444()) {
         format_config.chromaFormatIDC = 3;
       }
@@ -288,6 +331,29 @@ namespace nvenc {
       }
     };
 
+    auto set_intra_refresh_if_enabled = [&](auto &format_config) {
+      if (client_config.enableIntraRefresh != 1 && !config.intra_refresh && config.intra_refresh_frames <= 0) {
+        return;
+      }
+
+      if (!get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+        BOOST_LOG(error) << "NvEnc: Intra-refresh was asked for but the encoder does not support intra-refresh";
+        return;
+      }
+
+      // Waves run continuously, and keyframe requests restart them when intra_refresh_frames is set
+      auto period = config.intra_refresh_frames > 0 ? config.intra_refresh_frames : 300;
+      format_config.enableIntraRefresh = 1;
+      format_config.intraRefreshPeriod = period;
+      format_config.intraRefreshCnt = period - 1;
+      encoder_params.intra_refresh_frames = config.intra_refresh_frames > 0 ? period - 1 : 0;
+      if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
+        format_config.singleSliceIntraRefresh = 1;
+      } else {
+        BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
+      }
+    };
+
     auto fill_h264_hevc_vui = [&](auto &vui_config) {
       vui_config.videoSignalTypePresentFlag = 1;
       vui_config.videoFormat = NV_ENC_VUI_VIDEO_FORMAT_UNSPECIFIED;
@@ -315,6 +381,19 @@ namespace nvenc {
           }
           set_ref_frames(format_config.maxNumRefFrames, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_h264);
+          set_intra_refresh_if_enabled(format_config);
+          if (config.temporal_layers) {
+            if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_TEMPORAL_SVC) && get_encoder_cap(NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS) >= 2) {
+              // Without the SVC prefix NAL units, the bitstream stays plain H.264 for the client
+              format_config.enableTemporalSVC = 1;
+              format_config.disableSVCPrefixNalu = 1;
+              format_config.maxTemporalLayers = 2;
+              format_config.h264Extension.svcTemporalConfig.numTemporalLayers = 2;
+              encoder_params.temporal_layers = true;
+            } else {
+              BOOST_LOG(warning) << "NvEnc: Temporal layers were asked for but the encoder does not support temporal SVC";
+            }
+          }
           fill_h264_hevc_vui(format_config.h264VUIParameters);
           break;
         }
@@ -329,21 +408,8 @@ namespace nvenc {
           }
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_hevc);
+          set_intra_refresh_if_enabled(format_config);
           fill_h264_hevc_vui(format_config.hevcVUIParameters);
-          if (client_config.enableIntraRefresh == 1) {
-            if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
-              format_config.enableIntraRefresh = 1;
-              format_config.intraRefreshPeriod = 300;
-              format_config.intraRefreshCnt = 299;
-              if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
-                format_config.singleSliceIntraRefresh = 1;
-              } else {
-                BOOST_LOG(warning) << "NvEnc: Single Slice Intra Refresh not supported";
-              }
-            } else {
-              BOOST_LOG(error) << "NvEnc: Client asked for intra-refresh but the encoder does not support intra-refresh";
-            }
-          }
           break;
         }
 
@@ -369,12 +435,8 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numFwdRefs, 8);
           set_minqp_if_enabled(config.min_qp_av1);
 
-          if (client_config.slicesPerFrame > 1) {
-            // NVENC only supports slice counts that are powers of two, so we'll pick powers of two
-            // with bias to rows due to hopefully more similar macroblocks with a row vs a column.
-            format_config.numTileRows = std::pow(2, std::ceil(std::log2(client_config.slicesPerFrame) / 2));
-            format_config.numTileColumns = std::pow(2, std::floor(std::log2(client_config.slicesPerFrame) / 2));
-          }
+          // Tiles are encoded in parallel by the NVENC engines, and decoded in parallel by the client
+          std::tie(format_config.numTileColumns, format_config.numTileRows) = video::av1_tiles(client_config);
           break;
         }
     }
@@ -402,6 +464,11 @@ namespace nvenc {
     }
     output_bitstream = create_bitstream_buffer.bitstreamBuffer;
 
+    // The slice offsets are reported per macroblock in the worst case
+    if (encoder_params.subframe_output) {
+      slice_offsets.resize(((encoder_params.width + 15) / 16) * ((encoder_params.height + 15) / 16));
+    }
+
     if (!create_and_register_input_buffer()) {
       return false;
     }
@@ -420,6 +487,12 @@ namespace nvenc {
       if (init_params.enableEncodeAsync) {
         extra += " async";
       }
+      if (encoder_params.subframe_output) {
+        extra += std::format(" subframe-output({} slices)", encoder_params.slices);
+      }
+      if (encoder_params.split_encode) {
+        extra += " split-frame";
+      }
       if (buffer_is_yuv444()) {
         extra += " yuv444";
       }
@@ -435,6 +508,12 @@ namespace nvenc {
       if (encoder_params.rfi) {
         extra += " rfi";
       }
+      if (encoder_params.intra_refresh_frames) {
+        extra += std::format(" intra-refresh({} frames)", encoder_params.intra_refresh_frames);
+      }
+      if (encoder_params.qp_delta_map) {
+        extra += " qp-delta-map";
+      }
       if (init_params.enableWeightedPrediction) {
         extra += " weighted-prediction";
       }
@@ -485,9 +564,70 @@ namespace nvenc {
 
     encoder_state = {};
     encoder_params = {};
+    qp_delta_map.clear();
   }
 
-  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr) {
+  bool nvenc_base::reset_encoder(int bitrate) {
+    if (!reconfigure_bitrate(bitrate, true)) {
+      return false;
+    }
+
+    encoder_state = {};
+    return true;
+  }
+
+  bool nvenc_base::set_bitrate(int bitrate) {
+    if (!encoder_params.dynamic_bitrate) {
+      return false;
+    }
+
+    return reconfigure_bitrate(bitrate, false);
+  }
+
+  bool nvenc_base::set_regions_of_interest(const std::vector<video::region_of_interest_t> &regions) {
+    if (!encoder || !encoder_params.qp_delta_map) {
+      return false;
+    }
+
+    if (regions.empty()) {
+      qp_delta_map.clear();
+      return true;
+    }
+
+    // The map has an entry per macroblock for H.264, per CTB for HEVC and per superblock for AV1
+    auto block_size = init_params.encodeGUID == NV_ENC_CODEC_H264_GUID ? 16 :
+                      init_params.encodeGUID == NV_ENC_CODEC_HEVC_GUID ? 32 :
+                                                                          64;
+    qp_delta_map = video::make_qp_delta_map(regions, encoder_params.width, encoder_params.height, block_size);
+    return true;
+  }
+
+  bool nvenc_base::reconfigure_bitrate(int bitrate, bool reset) {
+    if (!encoder) {
+      return false;
+    }
+
+    // Keep the VBV buffer the same number of frames long
+    auto &rc_params = enc_config.rcParams;
+    auto average_bitrate = (uint32_t) bitrate * 1000;
+    if (rc_params.vbvBufferSize && rc_params.averageBitRate) {
+      rc_params.vbvBufferSize = (uint32_t) ((uint64_t) rc_params.vbvBufferSize * average_bitrate / rc_params.averageBitRate);
+    }
+    rc_params.averageBitRate = average_bitrate;
+
+    NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {min_struct_version(NV_ENC_RECONFIGURE_PARAMS_VER)};
+    reconfigure_params.reInitEncodeParams = init_params;
+    reconfigure_params.resetEncoder = reset;
+    reconfigure_params.forceIDR = reset;
+    if (nvenc_failed(nvenc->nvEncReconfigureEncoder(encoder, &reconfigure_params))) {
+      BOOST_LOG(error) << "NvEnc: NvEncReconfigureEncoder() failed: " << last_nvenc_error_string;
+      return false;
+    }
+
+    return true;
+  }
+
+  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr, const subframe_callback_t &on_subframe, const bitstream_copy_t &copy_bitstream) {
     if (!encoder) {
       return {};
     }
@@ -513,16 +653,33 @@ namespace nvenc {
       }
     });
 
+    // Once the stream has started, a wave of intra refresh replaces the IDR frame
+    auto intra_refresh = force_idr && encoder_params.intra_refresh_frames && encoder_state.last_encoded_frame_index;
+
+    // The layers alternate from the IDR frame, which is in the base layer
+    auto non_reference = encoder_params.temporal_layers && !(force_idr && !intra_refresh) && encoder_state.frames_since_idr % 2 == 1;
+
     NV_ENC_PIC_PARAMS pic_params = {min_struct_version(NV_ENC_PIC_PARAMS_VER, 4, 6)};
     pic_params.inputWidth = encoder_params.width;
     pic_params.inputHeight = encoder_params.height;
-    pic_params.encodePicFlags = force_idr ? NV_ENC_PIC_FLAG_FORCEIDR : 0;
+    pic_params.encodePicFlags = force_idr && !intra_refresh ? NV_ENC_PIC_FLAG_FORCEIDR : 0;
+    if (intra_refresh) {
+      if (init_params.encodeGUID == NV_ENC_CODEC_H264_GUID) {
+        pic_params.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+      } else {
+        pic_params.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+      }
+    }
     pic_params.inputTimeStamp = frame_index;
     pic_params.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
     pic_params.inputBuffer = mapped_input_buffer.mappedResource;
     pic_params.bufferFmt = mapped_input_buffer.mappedBufferFmt;
     pic_params.outputBitstream = output_bitstream;
     pic_params.completionEvent = async_event_handle;
+    if (!qp_delta_map.empty()) {
+      pic_params.qpDeltaMap = qp_delta_map.data();
+      pic_params.qpDeltaMapSize = qp_delta_map.size();
+    }
 
     if (nvenc_failed(nvenc->nvEncEncodePicture(encoder, &pic_params))) {
       BOOST_LOG(error) << "NvEnc: NvEncEncodePicture() failed: " << last_nvenc_error_string;
@@ -533,7 +690,12 @@ namespace nvenc {
     lock_bitstream.outputBitstream = output_bitstream;
     lock_bitstream.doNotWait = async_event_handle ? 1 : 0;
 
-    if (async_event_handle && !wait_for_async_event(100)) {
+    if (on_subframe && encoder_params.subframe_output) {
+      if (!wait_for_subframes(frame_index, encoder_state.rfi_needs_confirmation, intra_refresh, non_reference, on_subframe)) {
+        BOOST_LOG(error) << "NvEnc: frame " << frame_index << " encode wait timeout";
+        return {};
+      }
+    } else if (async_event_handle && !wait_for_async_event(100)) {
       BOOST_LOG(error) << "NvEnc: frame " << frame_index << " encode wait timeout";
       return {};
     }
@@ -544,11 +706,20 @@ namespace nvenc {
     }
 
     auto data_pointer = (uint8_t *) lock_bitstream.bitstreamBufferPtr;
+    std::vector<uint8_t> data;
+    if (copy_bitstream) {
+      copy_bitstream({data_pointer, lock_bitstream.bitstreamSizeInBytes});
+    } else {
+      data.assign(data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes);
+    }
+
     nvenc_encoded_frame encoded_frame {
-      {data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes},
+      std::move(data),
       lock_bitstream.outputTimeStamp,
       lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
       encoder_state.rfi_needs_confirmation,
+      intra_refresh,
+      non_reference,
     };
 
     if (encoder_state.rfi_needs_confirmation) {
@@ -557,6 +728,7 @@ namespace nvenc {
     }
 
     encoder_state.last_encoded_frame_index = frame_index;
+    encoder_state.frames_since_idr = encoded_frame.idr ? 1 : encoder_state.frames_since_idr + 1;
 
     if (encoded_frame.idr) {
       BOOST_LOG(debug) << "NvEnc: idr frame " << encoded_frame.frame_index;
@@ -566,11 +738,69 @@ namespace nvenc {
       BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed: " << last_nvenc_error_string;
     }
 
-    encoder_state.frame_size_logger.collect_and_log(encoded_frame.data.size() / 1000.);
+    encoder_state.frame_size_logger.collect_and_log(lock_bitstream.bitstreamSizeInBytes / 1000.);
 
     return encoded_frame;
   }
 
+  bool nvenc_base::wait_for_subframes(uint64_t frame_index, bool after_ref_frame_invalidation, bool intra_refresh, bool non_reference, const subframe_callback_t &on_subframe) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    uint32_t slices_done = 0;
+
+    while (true) {
+      if (async_event_handle) {
+        // Poll for finished slices between short waits for the whole frame
+        if (wait_for_async_event(1)) {
+          return true;
+        }
+      } else if (slices_done + 1 >= encoder_params.slices) {
+        // The blocking lock of the frame waits for the last slice
+        return true;
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(250));
+      }
+
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+
+      NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
+      lock_bitstream.outputBitstream = output_bitstream;
+      lock_bitstream.doNotWait = 1;
+      lock_bitstream.sliceOffsets = slice_offsets.data();
+
+      auto status = nvenc->nvEncLockBitstream(encoder, &lock_bitstream);
+      if (status == NV_ENC_ERR_LOCK_BUSY || status == NV_ENC_ERR_ENCODER_BUSY) {
+        continue;
+      }
+      if (nvenc_failed(status)) {
+        BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed: " << last_nvenc_error_string;
+        return false;
+      }
+
+      // The last slice is handed out with the whole frame
+      if (lock_bitstream.numSlices > slices_done && lock_bitstream.numSlices < encoder_params.slices) {
+        slices_done = lock_bitstream.numSlices;
+
+        auto data_pointer = (const uint8_t *) lock_bitstream.bitstreamBufferPtr;
+        on_subframe({
+          {data_pointer, lock_bitstream.bitstreamSizeInBytes},
+          slices_done,
+          encoder_params.slices,
+          lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
+          after_ref_frame_invalidation,
+          intra_refresh,
+          non_reference,
+        });
+      }
+
+      if (nvenc_failed(nvenc->nvEncUnlockBitstream(encoder, lock_bitstream.outputBitstream))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnlockBitstream() failed: " << last_nvenc_error_string;
+        return false;
+      }
+    }
+  }
+
   bool nvenc_base::invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame) {
     if (!encoder || !encoder_params.rfi) {
       return false;
@@ -4,6 +4,10 @@
  */
 #pragma once
 
+// standard includes
+#include <functional>
+#include <vector>
+
 // lib includes
 #include <ffnvcodec/nvEncodeAPI.h>
 
@@ -50,15 +54,50 @@ namespace nvenc {
      */
     void destroy_encoder();
 
+    /**
+     * @brief Restart the encoder for a new stream without destroying it.
+     * @details The first frame after the reset is an IDR frame, and the frame indexes start over.
+     * @param bitrate The bitrate of the new stream in kilobits.
+     * @return `true` on success, `false` on error.
+     */
+    bool reset_encoder(int bitrate);
+
+    /**
+     * @brief Change the bitrate while encoding, without an IDR frame.
+     * @param bitrate The new bitrate in kilobits.
+     * @return `false` if the GPU can't change the bitrate of a running encoder, or on error.
+     */
+    bool set_bitrate(int bitrate);
+
+    /**
+     * @brief Set the regions of interest of the frames encoded from now on.
+     * @param regions The regions, where the first one takes precedence where they overlap.
+     * @return `false` if the encoder wasn't opened with a QP delta map.
+     */
+    bool set_regions_of_interest(const std::vector<video::region_of_interest_t> &regions);
+
+    /**
+     * @brief Called with the slices of a frame that are done while the frame is being encoded.
+     */
+    using subframe_callback_t = std::function<void(const nvenc_encoded_subframe &subframe)>;
+
+    /**
+     * @brief Called with the locked bitstream of a frame, to copy it out of the encoder.
+     */
+    using bitstream_copy_t = std::function<void(std::span<const uint8_t> bitstream)>;
+
     /**
      * @brief Encode the next frame using platform-specific input surface.
      * @param frame_index Frame index that uniquely identifies the frame.
      *        Afterwards serves as parameter for `invalidate_ref_frames()`.
      *        No restrictions on the first frame index, but later frame indexes must be subsequent.
      * @param force_idr Whether to encode frame as forced IDR.
+     * @param on_subframe Optional. Called whenever more slices are done, if the encoder was created with sub-frame output.
+     *        Isn't called for the last slice, which is part of the returned frame only.
+     * @param copy_bitstream Optional. Copies the bitstream in place of the `data` of the returned frame, which is left empty.
      * @return Encoded frame.
      */
-    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr);
+    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr, const subframe_callback_t &on_subframe = {}, const bitstream_copy_t &copy_bitstream = {});
 
     /**
      * @brief Perform reference frame invalidation (RFI) procedure.
@@ -69,6 +108,13 @@ namespace nvenc {
      */
     bool invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame);
 
+    /**
+     * @brief Check whether the frames are split across the NVENC engines of the GPU.
+     */
+    bool split_encode() const {
+      return encoder_params.split_encode;
+    }
+
   protected:
     /**
      * @brief Required. Used for loading NvEnc library and setting `nvenc` variable with `NvEncodeAPICreateInstance()`.
@@ -126,6 +172,13 @@ namespace nvenc {
       NV_ENC_BUFFER_FORMAT buffer_format = NV_ENC_BUFFER_FORMAT_UNDEFINED;
       uint32_t ref_frames_in_dpb = 0;
       bool rfi = false;
+      bool dynamic_bitrate = false;
+      uint32_t slices = 1;
+      bool subframe_output = false;
+      uint32_t intra_refresh_frames = 0;  ///< Frames of the wave of intra refresh that replaces a forced IDR frame, 0 to force IDR frames
+      bool qp_delta_map = false;
+      bool temporal_layers = false;  ///< Every other frame after an IDR frame is in the upper of two temporal layers
+      bool split_encode = false;  ///< The frames are split across the NVENC engines
     } encoder_params;
 
     std::string last_nvenc_error_string;
@@ -141,14 +194,37 @@ namespace nvenc {
                                          ///< Can be set in constructor or `init_library()`, must override `wait_for_async_event()`.
 
   private:
+    /**
+     * @brief Reconfigure the encoder for a new bitrate.
+     * @param bitrate The new bitrate in kilobits.
+     * @param reset Whether to restart the encoder with an IDR frame.
+     * @return `true` on success, `false` on error.
+     */
+    bool reconfigure_bitrate(int bitrate, bool reset);
+
+    /**
+     * @brief Wait for the frame to be encoded while handing out the slices that are done.
+     * @return `true` once the frame can be locked, `false` on timeout or error.
+     */
+    bool wait_for_subframes(uint64_t frame_index, bool after_ref_frame_invalidation, bool intra_refresh, bool non_reference, const subframe_callback_t &on_subframe);
+
     NV_ENC_OUTPUT_PTR output_bitstream = nullptr;
+    std::vector<uint32_t> slice_offsets;
+
+    // QP offset per macroblock, CTB or superblock, empty when the whole frame is alike
+    std::vector<int8_t> qp_delta_map;
     uint32_t minimum_api_version = 0;
 
+    // Kept for reconfiguration, init_params.encodeConfig points to enc_config
+    NV_ENC_INITIALIZE_PARAMS init_params = {};
+    NV_ENC_CONFIG enc_config = {};
+
     struct {
       uint64_t last_encoded_frame_index = 0;
+      uint64_t frames_since_idr = 0;
       bool rfi_needs_confirmation = false;
       std::pair<uint64_t, uint64_t> last_rfi_range;
-      logging::min_max_avg_periodic_logger<double> frame_size_logger = {debug, "NvEnc: encoded frame sizes in kB", ""};
+      logging::percentile_periodic_logger<double> frame_size_logger = {debug, "NvEnc: encoded frame sizes in kB", ""};
     } encoder_state;
   };
 
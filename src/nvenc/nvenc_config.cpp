@@ -0,0 +1,42 @@
+/**
+ * @file src/nvenc/nvenc_config.cpp
+ * @brief Definitions for NVENC encoder configuration.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "nvenc_config.h"
+
+namespace nvenc {
+
+  int quality_levels(const nvenc_config &config) {
+    return (config.two_pass != nvenc_two_pass::disabled ? 1 : 0) + std::max(config.quality_preset - 1, 0);
+  }
+
+  nvenc_config at_quality_level(nvenc_config config, int level) {
+    if (level > 0 && config.two_pass != nvenc_two_pass::disabled) {
+      config.two_pass = nvenc_two_pass::disabled;
+      --level;
+    }
+
+    config.quality_preset = std::max(config.quality_preset - std::max(level, 0), 1);
+    return config;
+  }
+
+  bool use_split_encode(const nvenc_config &config, int video_format, int width, int height, int framerate) {
+    if (video_format != 1 && video_format != 2) {
+      return false;
+    }
+
+    switch (config.split_encode) {
+      case nvenc_split_encode::forced:
+        return true;
+      case nvenc_split_encode::automatic:
+        return (long long) width * height * framerate >= split_encode_pixel_rate;
+      default:
+        return false;
+    }
+  }
+
+}  // namespace nvenc
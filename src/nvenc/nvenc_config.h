@@ -12,6 +12,12 @@ namespace nvenc {
     full_resolution,  ///< Better overall statistics, slower and uses more extra vram
   };
 
+  enum class nvenc_split_encode {
+    disabled,  ///< Every frame is encoded by a single NVENC engine
+    automatic,  ///< Frames are split across the NVENC engines at pixel rates a single engine doesn't keep up with
+    forced,  ///< Frames are always split across the NVENC engines
+  };
+
   /**
    * @brief NVENC encoder configuration.
    */
@@ -51,6 +57,53 @@ namespace nvenc {
 
     // Intra refresh for clients that doesn't request keyframe correctly
     bool intra_refresh = false;
+
+    // Answer keyframe requests with a wave of intra refresh spread over this many frames instead of an IDR frame, 0 to disable
+    int intra_refresh_frames = 0;
+
+    // Vary the QP across the frame for the regions of interest
+    bool qp_delta_map = false;
+
+    // Hand out the slices of a frame as soon as they're encoded, so they can be sent while the rest is encoded
+    bool subframe_output = false;
+
+    // Encode H.264 in two temporal layers, so every other frame is a non-reference frame the network can drop
+    bool temporal_layers = false;
+
+    // Split the HEVC and AV1 frames across the NVENC engines of GPUs that have several
+    nvenc_split_encode split_encode = nvenc_split_encode::disabled;
   };
 
+  /**
+   * @brief The lowest pixel rate at which frames are split across the NVENC engines automatically, 4K at 120 FPS.
+   * @details A single engine takes most of the frame time at this rate, so the encode latency grows with every frame that overruns.
+   */
+  constexpr long long split_encode_pixel_rate = 3840LL * 2160 * 120;
+
+  /**
+   * @brief Check whether the frames of a stream are split across the NVENC engines.
+   * @details Only HEVC and AV1 frames can be split. GPUs with a single engine ignore the split.
+   * @param config The configuration.
+   * @param video_format The codec of the stream, 0 for H.264, 1 for HEVC and 2 for AV1.
+   * @param width The width of the stream.
+   * @param height The height of the stream.
+   * @param framerate The framerate of the stream.
+   */
+  bool use_split_encode(const nvenc_config &config, int video_format, int width, int height, int framerate);
+
+  /**
+   * @brief Get how many quality levels a configuration can be stepped down while frames overrun their time.
+   * @details Two-pass encoding is dropped first, then the preset gets faster one step at a time down to P1.
+   * @param config The configuration.
+   */
+  int quality_levels(const nvenc_config &config);
+
+  /**
+   * @brief Step a configuration down some quality levels, see `quality_levels()`.
+   * @param config The configuration.
+   * @param level The levels to step down.
+   * @return The configuration to open the encoder with.
+   */
+  nvenc_config at_quality_level(nvenc_config config, int level);
+
 }  // namespace nvenc
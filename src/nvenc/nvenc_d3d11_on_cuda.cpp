@@ -38,6 +38,13 @@ namespace nvenc {
           }
           cuda_surface = 0;
         }
+
+        if (cuda_stream) {
+          if (cuda_failed(cuda_functions.cuStreamDestroy(cuda_stream))) {
+            BOOST_LOG(error) << "NvEnc: cuStreamDestroy() failed: error " << last_cuda_error;
+          }
+          cuda_stream = nullptr;
+        }
       }
 
       if (cuda_failed(cuda_functions.cuCtxDestroy(cuda_context))) {
@@ -81,7 +88,9 @@ namespace nvenc {
           !load_function(cuda_functions.cuGraphicsMapResources, "cuGraphicsMapResources") ||
           !load_function(cuda_functions.cuGraphicsUnmapResources, "cuGraphicsUnmapResources") ||
           !load_function(cuda_functions.cuGraphicsSubResourceGetMappedArray, "cuGraphicsSubResourceGetMappedArray") ||
-          !load_function(cuda_functions.cuMemcpy2D, "cuMemcpy2D_v2")) {
+          !load_function(cuda_functions.cuMemcpy2DAsync, "cuMemcpy2DAsync_v2") ||
+          !load_function(cuda_functions.cuStreamCreate, "cuStreamCreate") ||
+          !load_function(cuda_functions.cuStreamDestroy, "cuStreamDestroy_v2")) {
         BOOST_LOG(error) << "NvEnc: missing CUDA functions in " << dll_name;
         FreeLibrary(cuda_functions.dll);
         cuda_functions = {};
@@ -100,6 +109,7 @@ namespace nvenc {
         if (cuda_succeeded(cuda_functions.cuInit(0)) &&
             cuda_succeeded(cuda_functions.cuD3D11GetDevice(&cuda_device, dxgi_adapter)) &&
             cuda_succeeded(cuda_functions.cuCtxCreate(&cuda_context, CU_CTX_SCHED_BLOCKING_SYNC, cuda_device)) &&
+            cuda_succeeded(cuda_functions.cuStreamCreate(&cuda_stream, CU_STREAM_NON_BLOCKING)) &&
             cuda_succeeded(cuda_functions.cuCtxPopCurrent(&cuda_context))) {
           device = cuda_context;
         } else {
@@ -184,6 +194,12 @@ namespace nvenc {
       }
 
       registered_input_buffer = register_resource.registeredResource;
+
+      // The encoder waits for the copy queued on the stream, instead of the encoding thread
+      if (nvenc_failed(nvenc->nvEncSetIOCudaStreams(encoder, &cuda_stream, &cuda_stream))) {
+        BOOST_LOG(error) << "NvEnc: NvEncSetIOCudaStreams() failed: " << last_nvenc_error_string;
+        return false;
+      }
     }
 
     return true;
@@ -195,13 +211,14 @@ namespace nvenc {
       return false;
     }
 
-    if (cuda_failed(cuda_functions.cuGraphicsMapResources(1, &cuda_d3d_input_texture, 0))) {
+    // Direct3D11 rendering into the texture completes before the mapping, and waits for the unmapping
+    if (cuda_failed(cuda_functions.cuGraphicsMapResources(1, &cuda_d3d_input_texture, cuda_stream))) {
       BOOST_LOG(error) << "NvEnc: cuGraphicsMapResources() failed: error " << last_cuda_error;
       return false;
     }
 
     auto unmap = [&]() -> bool {
-      if (cuda_failed(cuda_functions.cuGraphicsUnmapResources(1, &cuda_d3d_input_texture, 0))) {
+      if (cuda_failed(cuda_functions.cuGraphicsUnmapResources(1, &cuda_d3d_input_texture, cuda_stream))) {
         BOOST_LOG(error) << "NvEnc: cuGraphicsUnmapResources() failed: error " << last_cuda_error;
         return false;
       }
@@ -226,8 +243,8 @@ namespace nvenc {
       copy_params.WidthInBytes = encoder_params.width * 2;
       copy_params.Height = encoder_params.height * 3;
 
-      if (cuda_failed(cuda_functions.cuMemcpy2D(&copy_params))) {
-        BOOST_LOG(error) << "NvEnc: cuMemcpy2D() failed: error " << last_cuda_error;
+      if (cuda_failed(cuda_functions.cuMemcpy2DAsync(&copy_params, cuda_stream))) {
+        BOOST_LOG(error) << "NvEnc: cuMemcpy2DAsync() failed: error " << last_cuda_error;
         return false;
       }
     }
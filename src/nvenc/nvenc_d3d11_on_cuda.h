@@ -15,6 +15,7 @@ namespace nvenc {
   /**
    * @brief Interop Direct3D11 on CUDA NVENC encoder.
    *        Input surface is Direct3D11, encoding is performed by CUDA.
+   *        The surface is copied on a CUDA stream the encoder waits for, so the copy never blocks the encoding thread.
    */
   class nvenc_d3d11_on_cuda final: public nvenc_d3d11 {
   public:
@@ -74,12 +75,15 @@ namespace nvenc {
       tcuGraphicsMapResources *cuGraphicsMapResources;
       tcuGraphicsUnmapResources *cuGraphicsUnmapResources;
       tcuGraphicsSubResourceGetMappedArray *cuGraphicsSubResourceGetMappedArray;
-      tcuMemcpy2D_v2 *cuMemcpy2D;
+      tcuMemcpy2DAsync_v2 *cuMemcpy2DAsync;
+      tcuStreamCreate *cuStreamCreate;
+      tcuStreamDestroy_v2 *cuStreamDestroy;
       HMODULE dll;
     } cuda_functions = {};
 
     CUresult last_cuda_error = CUDA_SUCCESS;
     CUcontext cuda_context = nullptr;
+    CUstream cuda_stream = nullptr;
     CUgraphicsResource cuda_d3d_input_texture = nullptr;
     CUdeviceptr cuda_surface = 0;
     size_t cuda_surface_pitch = 0;
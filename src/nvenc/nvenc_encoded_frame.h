@@ -6,6 +6,7 @@
 
 // standard includes
 #include <cstdint>
+#include <span>
 #include <vector>
 
 namespace nvenc {
@@ -18,6 +19,21 @@ namespace nvenc {
     uint64_t frame_index = 0;
     bool idr = false;
     bool after_ref_frame_invalidation = false;
+    bool intra_refresh = false;  ///< Starts a wave of intra refresh in place of an IDR frame.
+    bool non_reference = false;  ///< In the upper temporal layer, so no later frame references it.
+  };
+
+  /**
+   * @brief Frame that is still being encoded, with the slices that are done.
+   */
+  struct nvenc_encoded_subframe {
+    std::span<const uint8_t> data;  ///< Frame from its first byte to the end of the last slice that's done.
+    uint32_t slices = 0;  ///< Number of slices in `data`.
+    uint32_t total_slices = 0;  ///< Number of slices in the frame.
+    bool idr = false;
+    bool after_ref_frame_invalidation = false;
+    bool intra_refresh = false;
+    bool non_reference = false;
   };
 
 }  // namespace nvenc
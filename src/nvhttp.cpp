@@ -6,21 +6,27 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
 #include <filesystem>
 #include <format>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <string>
 
 // lib includes
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/context_base.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 #include <Simple-Web-Server/server_http.hpp>
 
 // local includes
+#include "admission.h"
 #include "config.h"
 #include "display_device.h"
 #include "file_handler.h"
@@ -65,6 +71,150 @@ namespace nvhttp {
   static std::string otp_device_name;
   static std::chrono::time_point<std::chrono::steady_clock> otp_creation_time;
 
+  /**
+   * @brief Responses serialized once and served for as long as the state they were built from is unchanged.
+   * @details Entries are keyed by everything a response depends on that differs between requests.
+   *          Changes to the host that aren't part of the key go through invalidate(), which drops every entry.
+   */
+  class response_cache_t {
+  public:
+    struct entry_t {
+      std::string body;
+      std::string etag;
+    };
+
+    /**
+     * @brief Get the response for a key, building it if it isn't cached yet.
+     * @param key Everything the response depends on besides the state covered by invalidate().
+     * @param build Returns the body of the response.
+     * @return The cached response.
+     */
+    template<class F>
+    std::shared_ptr<const entry_t> get(const std::string &key, F &&build) {
+      std::uint64_t version;
+      {
+        std::lock_guard lg {_lock};
+
+        auto it = _entries.find(key);
+        if (it != std::end(_entries)) {
+          return it->second;
+        }
+
+        version = _version;
+      }
+
+      auto entry = std::make_shared<entry_t>();
+      entry->body = build();
+      entry->etag = std::format("\"{:x}-{:x}\"", version, std::hash<std::string> {}(entry->body));
+
+      std::lock_guard lg {_lock};
+
+      // Don't keep a response built from state that changed in the meantime
+      if (version == _version) {
+        if (_entries.size() >= max_entries) {
+          _entries.clear();
+        }
+
+        _entries.emplace(key, entry);
+      }
+
+      return entry;
+    }
+
+    /**
+     * @brief Drop every response, because the state they were built from changed.
+     */
+    void invalidate() {
+      std::lock_guard lg {_lock};
+
+      ++_version;
+      _entries.clear();
+    }
+
+  private:
+    // Each client address and permission level gets entries of its own, old ones are best dropped now and then
+    static constexpr std::size_t max_entries = 64;
+
+    std::mutex _lock;
+    std::uint64_t _version {};
+    std::unordered_map<std::string, std::shared_ptr<const entry_t>> _entries;
+  };
+
+  response_cache_t response_cache;
+
+  void invalidate_response_cache() {
+    response_cache.invalidate();
+  }
+
+  /**
+   * @brief Keeps the cover images of the apps in memory, so opening the app grid doesn't read them from disk again.
+   * @details An image is read again once its modification time or size changes.
+   */
+  class app_image_cache_t {
+  public:
+    /**
+     * @brief Get an image, reading it if it isn't cached or changed on disk.
+     * @param path The path of the image.
+     * @return The image with an ETag made of its hash, or nullptr if it can't be read.
+     */
+    std::shared_ptr<const response_cache_t::entry_t> get(const std::string &path) {
+      std::error_code ec;
+      auto mtime = std::filesystem::last_write_time(path, ec);
+      auto size = ec ? 0 : std::filesystem::file_size(path, ec);
+      if (ec) {
+        return nullptr;
+      }
+
+      {
+        std::lock_guard lg {_lock};
+
+        auto it = _entries.find(path);
+        if (it != std::end(_entries) && it->second.mtime == mtime && it->second.size == size) {
+          return it->second.image;
+        }
+      }
+
+      auto image = std::make_shared<response_cache_t::entry_t>();
+      image->body = file_handler::read_file_range(path.c_str(), 0);
+      image->etag = '"' + util::hex_vec(crypto::hash(image->body)) + '"';
+      if (image->body.size() != size) {
+        // Changed while reading, serve it now and read it again next time
+        return image;
+      }
+
+      std::lock_guard lg {_lock};
+
+      _bytes += size;
+      if (auto it = _entries.find(path); it != std::end(_entries)) {
+        _bytes -= it->second.size;
+        _entries.erase(it);
+      }
+      if (_bytes > max_bytes) {
+        // Large libraries are best kept in part, the covers that get requested come back soon enough
+        _entries.clear();
+        _bytes = size;
+      }
+
+      _entries.emplace(path, image_entry_t {mtime, size, image});
+      return image;
+    }
+
+  private:
+    static constexpr std::uintmax_t max_bytes = 64 * 1024 * 1024;
+
+    struct image_entry_t {
+      std::filesystem::file_time_type mtime;
+      std::uintmax_t size;
+      std::shared_ptr<const response_cache_t::entry_t> image;
+    };
+
+    std::mutex _lock;
+    std::uintmax_t _bytes {};
+    std::unordered_map<std::string, image_entry_t> _entries;
+  };
+
+  app_image_cache_t app_image_cache;
+
   class SunshineHTTPSServer: public SimpleWeb::ServerBase<SunshineHTTPS> {
   public:
     SunshineHTTPSServer(const std::string &certification_file, const std::string &private_key_file):
@@ -84,6 +234,14 @@ namespace nvhttp {
     boost::asio::ssl::context context;
 
     void after_bind() override {
+      // Let clients resume their TLS sessions, which skips the certificate exchange on every request of a client
+      auto ctx = context.native_handle();
+      const auto id_context = std::to_string(config.port);
+      SSL_CTX_set_session_id_context(ctx, (const unsigned char *) id_context.data(), id_context.size());
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size(ctx, 256);
+      SSL_CTX_set_timeout(ctx, 3600);
+
       if (verify) {
         context.set_verify_mode(boost::asio::ssl::verify_peer | boost::asio::ssl::verify_fail_if_no_peer_cert | boost::asio::ssl::verify_client_once);
         context.set_verify_callback([](int verified, boost::asio::ssl::verify_context &ctx) {
@@ -149,6 +307,15 @@ namespace nvhttp {
   // uniqueID, session
   std::unordered_map<std::string, pair_session_t> map_id_sess;
   client_t client_root;
+
+  // The HTTPS threads, the HTTP thread and the web UI all reach the pairing sessions and the paired clients
+  std::mutex clients_lock;
+
+  // What the sessions of each paired client learned about the path to it, by the UUID of its certificate
+  std::unordered_map<std::string, stream::network_profile_t> network_profiles;
+
+  // Launching, resuming and canceling share the host audio setting and the running app
+  std::mutex launch_lock;
   std::atomic<uint32_t> session_id_counter;
 
   using resp_https_t = std::shared_ptr<typename SimpleWeb::ServerBase<SunshineHTTPS>::Response>;
@@ -203,10 +370,224 @@ namespace nvhttp {
     return commands;
   }
 
+  namespace {
+    // Bursts of changes, like unpairing many clients from the web UI, are written once after this
+    constexpr auto state_write_delay = 1s;
+
+    // A state that couldn't be written is tried again after this
+    constexpr auto state_retry_delay = 5s;
+
+    // The state last saved or loaded, with the keys of the file Apollo doesn't know about, held with clients_lock
+    nlohmann::json state_tree;
+
+    // Only held to hand the state over, the file is written with state_write_lock held instead
+    std::mutex pending_state_lock;
+    std::optional<nlohmann::json> pending_state;
+    std::mutex state_write_lock;
+
+    // When the state file was last read or written by this instance, held with state_write_lock
+    std::optional<fs::file_time_type> state_file_time;
+
+    // The state this instance last read or wrote, what another instance changed since is merged against it
+    nlohmann::json shared_base;
+
+    std::optional<fs::file_time_type> state_file_mtime() {
+      std::error_code ec;
+      auto time = fs::last_write_time(config::nvhttp.file_state, ec);
+      if (ec) {
+        return std::nullopt;
+      }
+
+      return time;
+    }
+
+    /**
+     * @brief Merge what another instance wrote to the state file into the state of this instance.
+     * @details Devices are matched by uuid. A device only the other instance changed since @p base takes its
+     *          change, otherwise the one of this instance is kept. Devices unpaired by either instance stay
+     *          unpaired and devices paired by either are kept.
+     * @param base The state this instance last read or wrote.
+     * @param ours The state of this instance.
+     * @param theirs The state file as the other instance wrote it.
+     * @return The state to write.
+     */
+    nlohmann::json merge_state(const nlohmann::json &base, const nlohmann::json &ours, const nlohmann::json &theirs) {
+      auto named_devices = [](const nlohmann::json &state) {
+        if (!state.is_object() || !state.contains("root")) {
+          return nlohmann::json::array();
+        }
+
+        return state["root"].value("named_devices", nlohmann::json::array());
+      };
+
+      auto by_uuid = [](const nlohmann::json &devices) {
+        std::unordered_map<std::string, nlohmann::json> devices_by_uuid;
+        for (auto &device : devices) {
+          devices_by_uuid.emplace(device.value("uuid", ""s), device);
+        }
+
+        return devices_by_uuid;
+      };
+
+      auto our_devices = named_devices(ours);
+      auto their_devices = named_devices(theirs);
+      auto base_by_uuid = by_uuid(named_devices(base));
+      auto ours_by_uuid = by_uuid(our_devices);
+      auto theirs_by_uuid = by_uuid(their_devices);
+
+      auto devices = nlohmann::json::array();
+      for (auto &device : our_devices) {
+        auto uuid = device.value("uuid", ""s);
+        auto base_device = base_by_uuid.find(uuid);
+        auto their_device = theirs_by_uuid.find(uuid);
+
+        if (their_device == std::end(theirs_by_uuid)) {
+          // Unpaired by the other instance, unless this one just paired it
+          if (base_device == std::end(base_by_uuid)) {
+            devices.push_back(device);
+          }
+        } else if (base_device != std::end(base_by_uuid) && base_device->second == device) {
+          devices.push_back(their_device->second);
+        } else {
+          devices.push_back(device);
+        }
+      }
+
+      for (auto &device : their_devices) {
+        auto uuid = device.value("uuid", ""s);
+
+        // Paired by the other instance
+        if (!base_by_uuid.contains(uuid) && !ours_by_uuid.contains(uuid)) {
+          devices.push_back(device);
+        }
+      }
+
+      // The keys of the file Apollo doesn't know about are the other instance's as well
+      auto merged = theirs.is_object() ? theirs : nlohmann::json::object();
+      auto their_root = merged.value("root", nlohmann::json::object());
+      merged["root"] = ours["root"];
+      merged["root"]["named_devices"] = devices;
+      if (their_root.contains("uniqueid")) {
+        merged["root"]["uniqueid"] = their_root["uniqueid"];
+      }
+
+      auto uniqueids = their_root.value("uniqueids", nlohmann::json::object());
+      uniqueids.update(ours["root"].value("uniqueids", nlohmann::json::object()));
+      merged["root"]["uniqueids"] = uniqueids;
+
+      return merged;
+    }
+
+    void write_pending_state() {
+      std::lock_guard lg {state_write_lock};
+
+      std::optional<nlohmann::json> state;
+      {
+        std::lock_guard pending_lg {pending_state_lock};
+        state.swap(pending_state);
+      }
+
+      if (!state) {
+        return;
+      }
+
+      auto contents = *state;
+
+      // Held until the file is written, so instances write one after another
+      std::optional<boost::interprocess::file_lock> file_lock;
+      if (config::nvhttp.shared_state) {
+        auto lock_path = config::nvhttp.file_state + ".lock";
+        try {
+          std::ofstream {lock_path, std::ios::app};
+          file_lock.emplace(lock_path.c_str());
+          file_lock->lock();
+        } catch (std::exception &e) {
+          BOOST_LOG(warning) << "Couldn't lock "sv << lock_path << ": "sv << e.what();
+          file_lock.reset();
+        }
+
+        if (auto time = state_file_mtime(); time && time != state_file_time) {
+          try {
+            nlohmann::json theirs;
+            std::ifstream in(config::nvhttp.file_state);
+            in >> theirs;
+
+            contents = merge_state(shared_base, *state, theirs);
+          } catch (std::exception &e) {
+            BOOST_LOG(warning) << "Couldn't read "sv << config::nvhttp.file_state << " to merge it: "sv << e.what();
+          }
+        }
+      }
+
+      // Pretty-print with an indent of 4 spaces.
+      if (file_handler::write_file_atomic(config::nvhttp.file_state.c_str(), contents.dump(4))) {
+        BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state << ", trying again in "sv << state_retry_delay.count() << 's';
+
+        // A state saved meanwhile holds this change too, and is written already
+        std::lock_guard pending_lg {pending_state_lock};
+        if (!pending_state) {
+          pending_state = std::move(*state);
+          task_pool.pushDelayed(write_pending_state, state_retry_delay);
+        }
+        return;
+      }
+
+      // What the other instance changed is read again before the state changes next, and merged until then
+      state_file_time = contents == *state ? state_file_mtime() : std::nullopt;
+      shared_base = std::move(*state);
+    }
+
+    /**
+     * @brief Write the state from the task pool shortly, along with any change coming until then.
+     */
+    void persist_state(const nlohmann::json &root) {
+      std::lock_guard lg {pending_state_lock};
+      auto scheduled = pending_state.has_value();
+      pending_state = root;
+      if (!scheduled) {
+        task_pool.pushDelayed(write_pending_state, state_write_delay);
+      }
+    }
+
+    /**
+     * @brief Get the uniqueid of this instance from the root of the state.
+     * @details Instances sharing the state file each keep their own uniqueid under the port they listen on,
+     *          as clients take them for a single host otherwise. The first of them takes over `uniqueid`.
+     * @return The uniqueid, empty if this instance has none yet.
+     */
+    std::string instance_unique_id(const nlohmann::json &root) {
+      std::string uid = root["uniqueid"];
+      if (!config::nvhttp.shared_state) {
+        return uid;
+      }
+
+      auto port = std::to_string(config::sunshine.port);
+      auto uniqueids = root.value("uniqueids", nlohmann::json::object());
+      if (uniqueids.contains(port)) {
+        return uniqueids[port];
+      }
+
+      for (auto &[instance, instance_uid] : uniqueids.items()) {
+        if (instance_uid == uid) {
+          return {};
+        }
+      }
+
+      return uid;
+    }
+  }  // namespace
+
+  /**
+   * @brief Save the paired clients into the state, which is written to the state file shortly.
+   * @note clients_lock must be held.
+   */
   void save_state() {
-    nlohmann::json root = nlohmann::json::object();
-    // If the state file exists, try to read it.
-    if (fs::exists(config::nvhttp.file_state)) {
+    // Paired clients and their permissions show in the responses
+    invalidate_response_cache();
+
+    nlohmann::json root = state_tree.is_object() ? state_tree : nlohmann::json::object();
+    // Before anything was loaded, the keys of the state file are kept.
+    if (!state_tree.is_object() && fs::exists(config::nvhttp.file_state)) {
       try {
         std::ifstream in(config::nvhttp.file_state);
         in >> root;
@@ -216,12 +597,21 @@ namespace nvhttp {
       }
     }
 
+    auto previous_root = root.value("root", nlohmann::json::object());
+
     // Erase any previous "root" key.
     root.erase("root");
 
     // Create a new "root" object and set the unique id.
     root["root"] = nlohmann::json::object();
-    root["root"]["uniqueid"] = http::unique_id;
+    if (config::nvhttp.shared_state) {
+      // The other instances keep theirs, see instance_unique_id()
+      root["root"]["uniqueid"] = previous_root.value("uniqueid", http::unique_id);
+      root["root"]["uniqueids"] = previous_root.value("uniqueids", nlohmann::json::object());
+      root["root"]["uniqueids"][std::to_string(config::sunshine.port)] = http::unique_id;
+    } else {
+      root["root"]["uniqueid"] = http::unique_id;
+    }
 
     client_t &client = client_root;
     nlohmann::json named_cert_nodes = nlohmann::json::array();
@@ -253,6 +643,10 @@ namespace nvhttp {
         named_cert_node["allow_client_commands"] = named_cert_p->allow_client_commands;
         named_cert_node["always_use_virtual_display"] = named_cert_p->always_use_virtual_display;
 
+        if (auto profile = network_profiles.find(named_cert_p->uuid); profile != std::end(network_profiles)) {
+          named_cert_node["network_profile"] = profile->second.serialize();
+        }
+
         // Add "do" commands if available.
         if (!named_cert_p->do_cmds.empty()) {
           nlohmann::json do_cmds_node = nlohmann::json::array();
@@ -277,31 +671,42 @@ namespace nvhttp {
 
     root["root"]["named_devices"] = named_cert_nodes;
 
-    try {
-      std::ofstream out(config::nvhttp.file_state);
-      out << root.dump(4);  // Pretty-print with an indent of 4 spaces.
-    } catch (std::exception &e) {
-      BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state << ": "sv << e.what();
-      return;
-    }
+    state_tree = root;
+    persist_state(root);
   }
 
+  /**
+   * @brief Load the paired clients from the state, reading the state file unless it was saved or loaded already.
+   * @note clients_lock must be held.
+   */
   void load_state() {
-    if (!fs::exists(config::nvhttp.file_state)) {
-      BOOST_LOG(info) << "File "sv << config::nvhttp.file_state << " doesn't exist"sv;
-      http::unique_id = uuid_util::uuid_t::generate().string();
-      return;
-    }
+    // What was saved since the file was read may not be written yet
+    if (!state_tree.is_object()) {
+      if (!fs::exists(config::nvhttp.file_state)) {
+        BOOST_LOG(info) << "File "sv << config::nvhttp.file_state << " doesn't exist"sv;
+        http::unique_id = uuid_util::uuid_t::generate().string();
+        return;
+      }
 
-    nlohmann::json tree;
-    try {
-      std::ifstream in(config::nvhttp.file_state);
-      in >> tree;
-    } catch (std::exception &e) {
-      BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
-      return;
+      // Taken before reading, so a change made meanwhile is read again
+      auto time = state_file_mtime();
+
+      try {
+        std::ifstream in(config::nvhttp.file_state);
+        in >> state_tree;
+      } catch (std::exception &e) {
+        BOOST_LOG(error) << "Couldn't read "sv << config::nvhttp.file_state << ": "sv << e.what();
+        state_tree = nullptr;
+        return;
+      }
+
+      std::lock_guard lg {state_write_lock};
+      state_file_time = time;
+      shared_base = state_tree;
     }
 
+    const nlohmann::json &tree = state_tree;
+
     // Check that the file contains a "root.uniqueid" value.
     if (!tree.contains("root") || !tree["root"].contains("uniqueid")) {
       http::uuid = uuid_util::uuid_t::generate();
@@ -309,12 +714,21 @@ namespace nvhttp {
       return;
     }
 
-    std::string uid = tree["root"]["uniqueid"];
-    http::uuid = uuid_util::uuid_t::parse(uid);
-    http::unique_id = uid;
+    auto uid = instance_unique_id(tree["root"]);
+    if (uid.empty()) {
+      // The first time this instance shares the state of another one, kept when it's read again before saving
+      if (http::unique_id.empty()) {
+        http::uuid = uuid_util::uuid_t::generate();
+        http::unique_id = http::uuid.string();
+      }
+    } else {
+      http::uuid = uuid_util::uuid_t::parse(uid);
+      http::unique_id = uid;
+    }
 
     nlohmann::json root = tree["root"];
     client_t client;  // Local client to load into
+    std::unordered_map<std::string, stream::network_profile_t> profiles;
 
     // Import from the old format if available.
     if (root.contains("devices")) {
@@ -352,6 +766,11 @@ namespace nvhttp {
         // Load command entries for "do" and "undo" keys.
         named_cert_p->do_cmds = extract_command_entries(el, "do");
         named_cert_p->undo_cmds = extract_command_entries(el, "undo");
+
+        if (auto profile = stream::network_profile_t::parse(el.value("network_profile", nlohmann::json {}))) {
+          profiles.emplace(named_cert_p->uuid, std::move(*profile));
+        }
+
         client.named_devices.emplace_back(named_cert_p);
       }
     }
@@ -363,9 +782,45 @@ namespace nvhttp {
     }
 
     client_root = client;
+    network_profiles = std::move(profiles);
   }
 
+  namespace {
+    /**
+     * @brief Read the state file again if another instance changed it, see config::nvhttp_t::shared_state.
+     * @note clients_lock must be held.
+     */
+    void refresh_shared_state() {
+      if (!config::nvhttp.shared_state || config::sunshine.flags[config::flag::FRESH_STATE]) {
+        return;
+      }
+
+      auto time = state_file_mtime();
+      {
+        std::lock_guard lg {state_write_lock};
+        if (!time || time == state_file_time) {
+          return;
+        }
+
+        // What this instance changed since is merged into the file shortly
+        std::lock_guard pending_lg {pending_state_lock};
+        if (pending_state) {
+          return;
+        }
+      }
+
+      BOOST_LOG(info) << "Another instance changed "sv << config::nvhttp.file_state << ", reading it again"sv;
+
+      state_tree = nullptr;
+      load_state();
+      invalidate_response_cache();
+    }
+  }  // namespace
+
   void add_authorized_client(const p_named_cert_t& named_cert_p) {
+    // The clients paired by other instances stay paired
+    refresh_shared_state();
+
     client_t &client = client_root;
     client.named_devices.push_back(named_cert_p);
 
@@ -413,6 +868,12 @@ namespace nvhttp {
       std::copy(prepend_iv_p, prepend_iv_p + sizeof(prepend_iv), std::begin(launch_session->iv));
     }
 
+    // Clients may capture a display of their own, which isn't moved when another client switches displays
+    launch_session->display_name = get_arg(args, "display", "");
+    if (!launch_session->display_name.empty()) {
+      BOOST_LOG(info) << "Client ["sv << named_cert_p->name << "] requested to capture display ["sv << launch_session->display_name << ']';
+    }
+
     std::stringstream mode;
     if (named_cert_p->display_mode.empty()) {
       auto mode_str = get_arg(args, "mode", config::video.fallback_mode.c_str());
@@ -464,6 +925,7 @@ namespace nvhttp {
 
     launch_session->client_do_cmds = named_cert_p->do_cmds;
     launch_session->client_undo_cmds = named_cert_p->undo_cmds;
+    launch_session->network_profile = find_network_profile(named_cert_p->uuid);
 
     launch_session->input_only = input_only;
 
@@ -666,6 +1128,26 @@ namespace nvhttp {
     return (crypto::named_cert_t*)request->userp.get();
   }
 
+  /**
+   * @brief Send a cached response, or only its ETag if the client has that version already.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param entry The cached response.
+   * @param headers The headers to send besides the ETag.
+   */
+  template<class T>
+  void send_cached_response(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request, const response_cache_t::entry_t &entry, SimpleWeb::CaseInsensitiveMultimap headers = {}) {
+    headers.emplace("ETag", entry.etag);
+
+    auto if_none_match = request->header.find("If-None-Match");
+    if (if_none_match != std::end(request->header) && if_none_match->second == entry.etag) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+    } else {
+      response->write(entry.body, headers);
+    }
+    response->close_connection_after_response = true;
+  }
+
   template <class T>
   void print_req(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
     BOOST_LOG(debug) << "TUNNEL :: "sv << tunnel<T>::to_string;
@@ -829,6 +1311,8 @@ namespace nvhttp {
   }
 
   bool pin(std::string pin, std::string name) {
+    std::lock_guard lg {clients_lock};
+
     pt::ptree tree;
     if (map_id_sess.empty()) {
       return false;
@@ -894,70 +1378,16 @@ namespace nvhttp {
     }
 
     auto local_endpoint = request->local_endpoint();
+    auto local_address = net::addr_to_normalized_string(local_endpoint.address());
 
-    pt::ptree tree;
-
-    tree.put("root.<xmlattr>.status_code", 200);
-    tree.put("root.hostname", config::nvhttp.sunshine_name);
-
-    tree.put("root.appversion", VERSION);
-    tree.put("root.GfeVersion", GFE_VERSION);
-    tree.put("root.uniqueid", http::unique_id);
-    tree.put("root.HttpsPort", net::map_port(PORT_HTTPS));
-    tree.put("root.ExternalPort", net::map_port(PORT_HTTP));
-    tree.put("root.MaxLumaPixelsHEVC", video::active_hevc_mode > 1 ? "1869449984" : "0");
-
-    // Only include the MAC address for requests sent from paired clients over HTTPS.
-    // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
+    crypto::named_cert_t *named_cert_p = nullptr;
     if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      tree.put("root.mac", platf::get_mac_address(net::addr_to_normalized_string(local_endpoint.address())));
-
-      auto named_cert_p = get_verified_cert(request);
-      if (!!(named_cert_p->perm & PERM::server_cmd)) {
-        pt::ptree& root_node = tree.get_child("root");
-
-        if (config::sunshine.server_cmds.size() > 0) {
-          // Broadcast server_cmds
-          for (const auto& cmd : config::sunshine.server_cmds) {
-            pt::ptree cmd_node;
-            cmd_node.put_value(cmd.cmd_name);
-            root_node.push_back(std::make_pair("ServerCommand", cmd_node));
-          }
-        }
-      } else {
-        BOOST_LOG(debug) << "Permission Get ServerCommand denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
-      }
-
-      tree.put("root.Permission", std::to_string((uint32_t)named_cert_p->perm));
-
-    #if defined(_WIN32) || defined(__linux__)
-      tree.put("root.VirtualDisplayCapable", true);
-      if (!!(named_cert_p->perm & PERM::_all_actions)) {
-        tree.put("root.VirtualDisplayDriverReady", proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK);
-      } else {
-        tree.put("root.VirtualDisplayDriverReady", true);
-      }
-    #endif
-    } else {
-      tree.put("root.mac", "00:00:00:00:00:00");
-      tree.put("root.Permission", "0");
-    }
-
-    // Moonlight clients track LAN IPv6 addresses separately from LocalIP which is expected to
-    // always be an IPv4 address. If we return that same IPv6 address here, it will clobber the
-    // stored LAN IPv4 address. To avoid this, we need to return an IPv4 address in this field
-    // when we get a request over IPv6.
-    //
-    // HACK: We should return the IPv4 address of local interface here, but we don't currently
-    // have that implemented. For now, we will emulate the behavior of GFE+GS-IPv6-Forwarder,
-    // which returns 127.0.0.1 as LocalIP for IPv6 connections. Moonlight clients with IPv6
-    // support know to ignore this bogus address.
-    if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
-      tree.put("root.LocalIP", "127.0.0.1");
-    } else {
-      tree.put("root.LocalIP", net::addr_to_normalized_string(local_endpoint.address()));
+      named_cert_p = get_verified_cert(request);
     }
 
+    // The codecs are only known once the encoders are probed
+    video::wait_for_initial_probe();
+
     uint32_t codec_mode_flags = SCM_H264;
     if (video::last_encoder_probe_supported_yuv444_for_codec[0]) {
       codec_mode_flags |= SCM_H264_HIGH8_444;
@@ -986,34 +1416,119 @@ namespace nvhttp {
         codec_mode_flags |= SCM_AV1_HIGH10_444;
       }
     }
-    tree.put("root.ServerCodecModeSupport", codec_mode_flags);
-
-    tree.put("root.PairStatus", pair_status);
 
+    int current_appid = 0;
+    std::string current_app_uuid;
     if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      int current_appid = proc::proc.running();
+      current_appid = proc::proc.running();
       // When input only mode is enabled, the only resume method should be launching the same app again.
       if (config::input.enable_input_only_mode && current_appid != proc::input_only_app_id) {
         current_appid = 0;
       }
+      current_app_uuid = proc::proc.get_running_app_uuid();
+    }
+
+    // Everything the response depends on, besides the pairing state covered by invalidation
+    auto key = std::format(
+      "serverinfo/{}/{}/{}/{}/{}/{}/{}/{}",
+      tunnel<T>::to_string,
+      pair_status,
+      local_address,
+      named_cert_p ? (uint32_t) named_cert_p->perm : 0,
+      codec_mode_flags,
+      video::active_hevc_mode,
+      current_appid,
+      current_app_uuid
+    );
+  #if defined(_WIN32) || defined(__linux__)
+    key += std::format("/{}", (int) proc::vDisplayDriverStatus);
+  #endif
+
+    auto cached = response_cache.get(key, [&]() {
+      pt::ptree tree;
+
+      tree.put("root.<xmlattr>.status_code", 200);
+      tree.put("root.hostname", config::nvhttp.sunshine_name);
+
+      tree.put("root.appversion", VERSION);
+      tree.put("root.GfeVersion", GFE_VERSION);
+      tree.put("root.uniqueid", http::unique_id);
+      tree.put("root.HttpsPort", net::map_port(PORT_HTTPS));
+      tree.put("root.ExternalPort", net::map_port(PORT_HTTP));
+      tree.put("root.MaxLumaPixelsHEVC", video::active_hevc_mode > 1 ? "1869449984" : "0");
+
+      // Only include the MAC address for requests sent from paired clients over HTTPS.
+      // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
+      if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+        tree.put("root.mac", platf::get_mac_address(local_address));
+
+        if (!!(named_cert_p->perm & PERM::server_cmd)) {
+          pt::ptree& root_node = tree.get_child("root");
+
+          if (config::sunshine.server_cmds.size() > 0) {
+            // Broadcast server_cmds
+            for (const auto& cmd : config::sunshine.server_cmds) {
+              pt::ptree cmd_node;
+              cmd_node.put_value(cmd.cmd_name);
+              root_node.push_back(std::make_pair("ServerCommand", cmd_node));
+            }
+          }
+        } else {
+          BOOST_LOG(debug) << "Permission Get ServerCommand denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
+        }
+
+        tree.put("root.Permission", std::to_string((uint32_t)named_cert_p->perm));
+
+      #if defined(_WIN32) || defined(__linux__)
+        tree.put("root.VirtualDisplayCapable", true);
+        if (!!(named_cert_p->perm & PERM::_all_actions)) {
+          tree.put("root.VirtualDisplayDriverReady", proc::vDisplayDriverStatus == VDISPLAY::DRIVER_STATUS::OK);
+        } else {
+          tree.put("root.VirtualDisplayDriverReady", true);
+        }
+      #endif
+      } else {
+        tree.put("root.mac", "00:00:00:00:00:00");
+        tree.put("root.Permission", "0");
+      }
+
+      // Moonlight clients track LAN IPv6 addresses separately from LocalIP which is expected to
+      // always be an IPv4 address. If we return that same IPv6 address here, it will clobber the
+      // stored LAN IPv4 address. To avoid this, we need to return an IPv4 address in this field
+      // when we get a request over IPv6.
+      //
+      // HACK: We should return the IPv4 address of local interface here, but we don't currently
+      // have that implemented. For now, we will emulate the behavior of GFE+GS-IPv6-Forwarder,
+      // which returns 127.0.0.1 as LocalIP for IPv6 connections. Moonlight clients with IPv6
+      // support know to ignore this bogus address.
+      if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
+        tree.put("root.LocalIP", "127.0.0.1");
+      } else {
+        tree.put("root.LocalIP", local_address);
+      }
+
+      tree.put("root.ServerCodecModeSupport", codec_mode_flags);
+
+      tree.put("root.PairStatus", pair_status);
+
       tree.put("root.currentgame", current_appid);
-      tree.put("root.currentgameuuid", proc::proc.get_running_app_uuid());
+      tree.put("root.currentgameuuid", current_app_uuid);
       tree.put("root.state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
-    } else {
-      tree.put("root.currentgame", 0);
-      tree.put("root.currentgameuuid", "");
-      tree.put("root.state", "SUNSHINE_SERVER_FREE");
-    }
 
-    std::ostringstream data;
+      std::ostringstream data;
 
-    pt::write_xml(data, tree);
-    response->write(data.str());
-    response->close_connection_after_response = true;
+      pt::write_xml(data, tree);
+      return data.str();
+    });
+
+    send_cached_response<T>(response, request, *cached);
   }
 
   nlohmann::json get_all_clients() {
     nlohmann::json named_cert_nodes = nlohmann::json::array();
+
+    std::lock_guard lg {clients_lock};
+    refresh_shared_state();
     client_t &client = client_root;
     std::list<std::string> connected_uuids = rtsp_stream::get_all_session_uuids();
 
@@ -1069,88 +1584,104 @@ namespace nvhttp {
   void applist(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    video::wait_for_initial_probe();
 
-    auto g = util::fail_guard([&]() {
-      std::ostringstream data;
+    auto named_cert_p = get_verified_cert(request);
+    auto allowed = !!(named_cert_p->perm & PERM::_all_actions);
 
-      pt::write_xml(data, tree);
-      response->write(data.str());
-      response->close_connection_after_response = true;
-    });
+    auto current_appid = proc::proc.running();
+    auto should_hide_inactive_apps = config::input.enable_input_only_mode && current_appid > 0 && current_appid != proc::input_only_app_id;
+    bool enable_legacy_ordering = config::sunshine.legacy_ordering && named_cert_p->enable_legacy_ordering;
+
+    // Everything the response depends on, besides the apps covered by invalidation
+    auto key = std::format(
+      "applist/{}/{}/{}/{}",
+      allowed,
+      should_hide_inactive_apps ? current_appid : 0,
+      enable_legacy_ordering,
+      video::active_hevc_mode
+    );
 
-    auto &apps = tree.add_child("root", pt::ptree {});
+    auto cached = response_cache.get(key, [&]() {
+      pt::ptree tree;
 
-    apps.put("<xmlattr>.status_code", 200);
+      auto &apps = tree.add_child("root", pt::ptree {});
 
-    auto named_cert_p = get_verified_cert(request);
-    if (!!(named_cert_p->perm & PERM::_all_actions)) {
-      auto current_appid = proc::proc.running();
-      auto should_hide_inactive_apps = config::input.enable_input_only_mode && current_appid > 0 && current_appid != proc::input_only_app_id;
-
-      auto app_list = proc::proc.get_apps();
-
-      bool enable_legacy_ordering = config::sunshine.legacy_ordering && named_cert_p->enable_legacy_ordering;
-      size_t bits;
-      if (enable_legacy_ordering) {
-        bits = zwpad::pad_width_for_count(app_list.size());
-      }
-
-      for (size_t i = 0; i < app_list.size(); i++) {
-        auto& app = app_list[i];
-        auto appid = util::from_view(app.id);
-        if (should_hide_inactive_apps) {
-          if (
-            appid != current_appid
-            && appid != proc::input_only_app_id
-            && appid != proc::terminate_app_id
-          ) {
-            continue;
-          }
-        } else {
-          if (appid == proc::terminate_app_id) {
-            continue;
-          }
-        }
+      apps.put("<xmlattr>.status_code", 200);
+
+      if (allowed) {
+        auto app_list = proc::proc.get_apps();
 
-        std::string app_name;
+        size_t bits;
         if (enable_legacy_ordering) {
-          app_name = zwpad::pad_for_ordering(app.name, bits, i);
-        } else {
-          app_name = app.name;
+          bits = zwpad::pad_width_for_count(app_list.size());
         }
 
+        for (size_t i = 0; i < app_list.size(); i++) {
+          auto& app = app_list[i];
+          auto appid = util::from_view(app.id);
+          if (should_hide_inactive_apps) {
+            if (
+              appid != current_appid
+              && appid != proc::input_only_app_id
+              && appid != proc::terminate_app_id
+            ) {
+              continue;
+            }
+          } else {
+            if (appid == proc::terminate_app_id) {
+              continue;
+            }
+          }
+
+          std::string app_name;
+          if (enable_legacy_ordering) {
+            app_name = zwpad::pad_for_ordering(app.name, bits, i);
+          } else {
+            app_name = app.name;
+          }
+
+          pt::ptree app_node;
+
+          app_node.put("IsHdrSupported"s, video::active_hevc_mode == 3 ? 1 : 0);
+          app_node.put("AppTitle"s, app_name);
+          app_node.put("UUID", app.uuid);
+          app_node.put("IDX", app.idx);
+          app_node.put("ID", app.id);
+
+          apps.push_back(std::make_pair("App", std::move(app_node)));
+        }
+      } else {
         pt::ptree app_node;
 
-        app_node.put("IsHdrSupported"s, video::active_hevc_mode == 3 ? 1 : 0);
-        app_node.put("AppTitle"s, app_name);
-        app_node.put("UUID", app.uuid);
-        app_node.put("IDX", app.idx);
-        app_node.put("ID", app.id);
+        app_node.put("IsHdrSupported"s, 0);
+        app_node.put("AppTitle"s, "Permission Denied");
+        app_node.put("UUID", "");
+        app_node.put("IDX", "0");
+        app_node.put("ID", "114514");
 
         apps.push_back(std::make_pair("App", std::move(app_node)));
       }
-    } else {
-      BOOST_LOG(debug) << "Permission ListApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
 
-      pt::ptree app_node;
-
-      app_node.put("IsHdrSupported"s, 0);
-      app_node.put("AppTitle"s, "Permission Denied");
-      app_node.put("UUID", "");
-      app_node.put("IDX", "0");
-      app_node.put("ID", "114514");
+      std::ostringstream data;
 
-      apps.push_back(std::make_pair("App", std::move(app_node)));
+      pt::write_xml(data, tree);
+      return data.str();
+    });
 
-      return;
+    if (!allowed) {
+      BOOST_LOG(debug) << "Permission ListApp denied for [" << named_cert_p->name << "] (" << (uint32_t)named_cert_p->perm << ")";
     }
 
+    send_cached_response<SunshineHTTPS>(response, request, *cached);
   }
 
   void launch(bool &host_audio, resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
+    // Streams need the encoder picked at startup, even without another probe
+    video::wait_for_initial_probe();
+
     pt::ptree tree;
     auto g = util::fail_guard([&]() {
       std::ostringstream data;
@@ -1206,12 +1737,16 @@ namespace nvhttp {
       return;
     }
 
+    // Apps other than the running one get an instance of their own next to it, while there's room for one
+    bool next_to_running_app = false;
+
     if (!is_input_only) {
       // Special handling for the "terminate" app
       if (
         (config::input.enable_input_only_mode && appid == proc::terminate_app_id)
         || appuuid_str == TERMINATE_APP_UUID
       ) {
+        proc::instances.terminate_all();
         proc::proc.terminate();
 
         tree.put("root.resume", 0);
@@ -1229,11 +1764,15 @@ namespace nvhttp {
           || (!appuuid_str.empty() && appuuid_str != current_app_uuid)
         )
       ) {
-        tree.put("root.resume", 0);
-        tree.put("root.<xmlattr>.status_code", 400);
-        tree.put("root.<xmlattr>.status_message", "An app is already running on this host");
+        if (config::video.max_app_instances <= 1) {
+          tree.put("root.resume", 0);
+          tree.put("root.<xmlattr>.status_code", 400);
+          tree.put("root.<xmlattr>.status_message", "An app is already running on this host");
 
-        return;
+          return;
+        }
+
+        next_to_running_app = true;
       }
     }
 
@@ -1251,6 +1790,20 @@ namespace nvhttp {
       return;
     }
 
+    // Refuse streams the host has no room left for before starting an app for them, their bitrate comes later
+    if (!is_input_only) {
+      auto decision = admission::instance().decide({launch_session->width, launch_session->height, launch_session->fps / 1000.0, 0});
+      if (decision.verdict == admission::decision_t::verdict_e::reject) {
+        BOOST_LOG(warning) << "Refusing to launch the app, "sv << decision.reason;
+
+        tree.put("root.<xmlattr>.status_code", 503);
+        tree.put("root.<xmlattr>.status_message", admission::status_message(decision));
+        tree.put("root.gamesession", 0);
+
+        return;
+      }
+    }
+
     bool no_active_sessions = rtsp_stream::session_count() == 0;
 
     if (is_input_only) {
@@ -1311,7 +1864,18 @@ namespace nvhttp {
           launch_session->client_undo_cmds.clear();
         }
 
-        auto err = proc::proc.execute(*app_iter, launch_session);
+        int err = 0;
+        if (!next_to_running_app) {
+          err = proc::proc.execute(*app_iter, launch_session);
+        } else if (auto instance = proc::instances.find(app_iter->uuid)) {
+          BOOST_LOG(info) << "Joining instance "sv << instance << " of ["sv << app_iter->name << ']';
+
+          launch_session->app_instance = instance;
+          launch_session->display_name = proc::instances.display_name(instance);
+        } else {
+          err = proc::instances.launch(*app_iter, launch_session);
+        }
+
         if (err) {
           tree.put("root.<xmlattr>.status_code", err);
           tree.put(
@@ -1348,6 +1912,8 @@ namespace nvhttp {
   void resume(bool &host_audio, resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
+    video::wait_for_initial_probe();
+
     pt::ptree tree;
     auto g = util::fail_guard([&]() {
       std::ostringstream data;
@@ -1407,6 +1973,19 @@ namespace nvhttp {
       launch_session->input_only = true;
     }
 
+    if (!launch_session->input_only) {
+      auto decision = admission::instance().decide({launch_session->width, launch_session->height, launch_session->fps / 1000.0, 0});
+      if (decision.verdict == admission::decision_t::verdict_e::reject) {
+        BOOST_LOG(warning) << "Refusing to resume the app, "sv << decision.reason;
+
+        tree.put("root.resume", 0);
+        tree.put("root.<xmlattr>.status_code", 503);
+        tree.put("root.<xmlattr>.status_message", admission::status_message(decision));
+
+        return;
+      }
+    }
+
     if (no_active_sessions && !proc::proc.virtual_display) {
       // We want to prepare display only if there are no active sessions
       // and the current session isn't virtual display at the moment.
@@ -1484,6 +2063,7 @@ namespace nvhttp {
 
     rtsp_stream::terminate_sessions();
 
+    proc::instances.terminate_all();
     if (proc::proc.running() > 0) {
       proc::proc.terminate();
     }
@@ -1514,13 +2094,19 @@ namespace nvhttp {
     auto args = request->parse_query_string();
     auto app_image = proc::proc.get_app_image(util::from_view(get_arg(args, "appid")));
 
+    auto image = app_image_cache.get(app_image);
+    if (!image) {
+      BOOST_LOG(warning) << "Couldn't read app image ["sv << app_image << ']';
+      return;
+    }
+
     fg.disable();
 
-    std::ifstream in(app_image, std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/png");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
-    response->close_connection_after_response = true;
+    // Clients may keep the image for a while, and revalidate it with the ETag after that
+    send_cached_response<SunshineHTTPS>(response, request, *image, {
+      {"Content-Type", "image/png"},
+      {"Cache-Control", "private, max-age=600"},
+    });
   }
 
   void getClipboard(resp_https_t response, req_https_t request) {
@@ -1643,6 +2229,7 @@ namespace nvhttp {
     bool clean_slate = config::sunshine.flags[config::flag::FRESH_STATE];
 
     if (!clean_slate) {
+      std::lock_guard lg {clients_lock};
       load_state();
     }
 
@@ -1687,6 +2274,8 @@ namespace nvhttp {
 
       });
 
+      std::lock_guard lg {clients_lock};
+      refresh_shared_state();
       auto err_str = cert_chain.verify(x509.get(), named_cert_p);
       if (err_str) {
         BOOST_LOG(warning) << "SSL Verification error :: "sv << err_str;
@@ -1716,26 +2305,38 @@ namespace nvhttp {
 
     https_server.default_resource["GET"] = not_found<SunshineHTTPS>;
     https_server.resource["^/serverinfo$"]["GET"] = serverinfo<SunshineHTTPS>;
-    https_server.resource["^/pair$"]["GET"] = pair<SunshineHTTPS>;
+    https_server.resource["^/pair$"]["GET"] = [](auto resp, auto req) {
+      std::lock_guard lg {clients_lock};
+      pair<SunshineHTTPS>(resp, req);
+    };
     https_server.resource["^/applist$"]["GET"] = applist;
     https_server.resource["^/appasset$"]["GET"] = appasset;
     https_server.resource["^/launch$"]["GET"] = [&host_audio](auto resp, auto req) {
+      std::lock_guard lg {launch_lock};
       launch(host_audio, resp, req);
     };
     https_server.resource["^/resume$"]["GET"] = [&host_audio](auto resp, auto req) {
+      std::lock_guard lg {launch_lock};
       resume(host_audio, resp, req);
     };
-    https_server.resource["^/cancel$"]["GET"] = cancel;
+    https_server.resource["^/cancel$"]["GET"] = [](auto resp, auto req) {
+      std::lock_guard lg {launch_lock};
+      cancel(resp, req);
+    };
     https_server.resource["^/actions/clipboard$"]["GET"] = getClipboard;
     https_server.resource["^/actions/clipboard$"]["POST"] = setClipboard;
 
     https_server.config.reuse_address = true;
     https_server.config.address = net::af_to_any_address_string(address_family);
     https_server.config.port = port_https;
+    https_server.config.thread_pool_size = config::nvhttp.https_threads;
 
     http_server.default_resource["GET"] = not_found<SimpleWeb::HTTP>;
     http_server.resource["^/serverinfo$"]["GET"] = serverinfo<SimpleWeb::HTTP>;
-    http_server.resource["^/pair$"]["GET"] = pair<SimpleWeb::HTTP>;
+    http_server.resource["^/pair$"]["GET"] = [](auto resp, auto req) {
+      std::lock_guard lg {clients_lock};
+      pair<SimpleWeb::HTTP>(resp, req);
+    };
 
     http_server.config.reuse_address = true;
     http_server.config.address = net::af_to_any_address_string(address_family);
@@ -1768,6 +2369,9 @@ namespace nvhttp {
 
     ssl.join();
     tcp.join();
+
+    // No request can change the state anymore
+    write_pending_state();
   }
 
   std::string request_otp(const std::string& passphrase, const std::string& deviceName) {
@@ -1775,6 +2379,8 @@ namespace nvhttp {
       return "";
     }
 
+    std::lock_guard lg {clients_lock};
+
     one_time_pin = crypto::rand_alphabet(4, "0123456789"sv);
     otp_passphrase = passphrase;
     otp_device_name = deviceName;
@@ -1785,6 +2391,8 @@ namespace nvhttp {
 
   void
   erase_all_clients() {
+    std::lock_guard lg {clients_lock};
+
     client_t client;
     client_root = client;
     cert_chain.clear();
@@ -1835,6 +2443,8 @@ namespace nvhttp {
   ) {
     find_and_udpate_session_info(uuid, name, newPerm);
 
+    std::lock_guard lg {clients_lock};
+    refresh_shared_state();
     client_t &client = client_root;
     auto it = client.named_devices.begin();
     for (; it != client.named_devices.end(); ++it) {
@@ -1856,28 +2466,71 @@ namespace nvhttp {
     return false;
   }
 
+  std::optional<stream::network_profile_t> find_network_profile(const std::string &uuid) {
+    std::lock_guard lg {clients_lock};
+
+    auto it = network_profiles.find(uuid);
+    if (it == std::end(network_profiles)) {
+      return std::nullopt;
+    }
+
+    return it->second;
+  }
+
+  void store_network_profile(const std::string &uuid, const stream::network_profile_t &profile) {
+    std::lock_guard lg {clients_lock};
+    refresh_shared_state();
+
+    // Only paired clients have a profile, which goes away with their pairing
+    auto &named_devices = client_root.named_devices;
+    if (std::none_of(std::begin(named_devices), std::end(named_devices), [&](const auto &named_cert_p) {
+          return named_cert_p->uuid == uuid;
+        })) {
+      return;
+    }
+
+    auto &stored = network_profiles[uuid];
+    if (stored == profile) {
+      return;
+    }
+    stored = profile;
+
+    if (!config::sunshine.flags[config::flag::FRESH_STATE]) {
+      save_state();
+    }
+  }
+
   bool unpair_client(const std::string_view uuid) {
     bool removed = false;
-    client_t &client = client_root;
-    for (auto it = client.named_devices.begin(); it != client.named_devices.end();) {
-      if ((*it)->uuid == uuid) {
-        it = client.named_devices.erase(it);
-        removed = true;
-      } else {
-        ++it;
+    bool none_paired;
+    {
+      std::lock_guard lg {clients_lock};
+      refresh_shared_state();
+
+      client_t &client = client_root;
+      for (auto it = client.named_devices.begin(); it != client.named_devices.end();) {
+        if ((*it)->uuid == uuid) {
+          it = client.named_devices.erase(it);
+          removed = true;
+        } else {
+          ++it;
+        }
       }
-    }
 
-    save_state();
-    load_state();
+      save_state();
+      load_state();
+
+      none_paired = client.named_devices.empty();
+    }
 
+    // Stopping the app runs its undo commands, which would hold up every other request waiting for clients_lock
     if (removed) {
       auto session = rtsp_stream::find_session(uuid);
       if (session) {
         stop_session(*session, true);
       }
 
-      if (client.named_devices.empty()) {
+      if (none_paired) {
         proc::proc.terminate();
       }
     }
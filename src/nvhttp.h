@@ -9,6 +9,7 @@
 #include <string>
 #include <chrono>
 #include <list>
+#include <optional>
 
 // lib includes
 #include <boost/property_tree/ptree.hpp>
@@ -17,6 +18,7 @@
 
 // local includes
 #include "crypto.h"
+#include "network_profile.h"
 #include "rtsp.h"
 #include "thread_safe.h"
 
@@ -206,6 +208,23 @@ namespace nvhttp {
    */
   bool unpair_client(std::string_view uuid);
 
+  /**
+   * @brief Get what the last sessions of a paired client learned about the path to it.
+   * @param uuid The UUID of the client.
+   * @return The profile, or `std::nullopt` if none was learned yet.
+   */
+  std::optional<stream::network_profile_t> find_network_profile(const std::string &uuid);
+
+  /**
+   * @brief Store what a session learned about the path to a paired client, along with its pairing.
+   * @param uuid The UUID of the client.
+   * @param profile The profile.
+   * @examples
+   * nvhttp::store_network_profile(session.device_uuid, profile);
+   * @examples_end
+   */
+  void store_network_profile(const std::string &uuid, const stream::network_profile_t &profile);
+
   /**
    * @brief Get all paired clients.
    * @return The list of all paired clients.
@@ -223,6 +242,14 @@ namespace nvhttp {
    */
   void erase_all_clients();
 
+  /**
+   * @brief Drop the cached serverinfo and applist responses, e.g. after the apps changed.
+   * @examples
+   * nvhttp::invalidate_response_cache();
+   * @examples_end
+   */
+  void invalidate_response_cache();
+
   /**
    * @brief      Stops a session.
    *
@@ -9,7 +9,10 @@
 #include <filesystem>
 #include <functional>
 #include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <vector>
 
 // lib includes
 #include <boost/core/noncopyable.hpp>
@@ -23,6 +26,7 @@
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/thread_safe.h"
 #include "src/utility.h"
 #include "src/video_colorspace.h"
@@ -234,6 +238,7 @@ namespace platf {
     dxgi,  ///< DXGI
     cuda,  ///< CUDA
     videotoolbox,  ///< VideoToolbox
+    vulkan,  ///< Vulkan, with the images imported as dmabufs like VAAPI
     unknown  ///< Unknown
   };
 
@@ -364,6 +369,18 @@ namespace platf {
     virtual ~deinit_t() = default;
   };
 
+  /**
+   * @brief A rectangle of an image, in pixels.
+   */
+  struct damage_rect_t {
+    std::int32_t x;
+    std::int32_t y;
+    std::int32_t width;
+    std::int32_t height;
+
+    bool operator==(const damage_rect_t &) const = default;
+  };
+
   struct img_t: std::enable_shared_from_this<img_t> {
   public:
     img_t() = default;
@@ -379,8 +396,19 @@ namespace platf {
     std::int32_t pixel_pitch {};
     std::int32_t row_pitch {};
 
+    // When the content was presented on the display, where the backend can tell, or else when it was captured
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
 
+    // Regions that changed since the previous image captured from the same display.
+    // When unset, the whole image must be assumed to have changed.
+    std::optional<std::vector<damage_rect_t>> damage;
+
+    // Where the cursor was drawn into the image, when it's captured and visible
+    std::optional<damage_rect_t> cursor;
+
+    // Set by the capture thread, images with the same content version are identical
+    std::uint64_t content_version {};
+
     virtual ~img_t() = default;
   };
 
@@ -399,12 +427,51 @@ namespace platf {
     std::optional<null_t> null;
   };
 
+  class display_t;
+
   struct encode_device_t {
     virtual ~encode_device_t() = default;
 
     virtual int convert(platf::img_t &img) = 0;
 
+    /**
+     * @brief Release the display so the device can wait in the encoder session pool.
+     * @return `false` if the device can't outlive its display.
+     */
+    virtual bool detach_display() {
+      return false;
+    }
+
+    /**
+     * @brief Resume on a new display after `detach_display()`.
+     * @param display The display, which captures the same output in the same mode.
+     * @return `false` if the device can't convert the images of this display.
+     */
+    virtual bool attach_display(const std::shared_ptr<platf::display_t> &display) {
+      return false;
+    }
+
+    /**
+     * @brief Convert images of another size from now on, e.g. after the mode of the display changed.
+     * @details The frames handed to the encoder keep their size, only the conversion into them changes.
+     * @param width The width of the images.
+     * @param height The height of the images.
+     * @return `false` if the device only converts images of the size it was made for.
+     */
+    virtual bool resize_input(int width, int height) {
+      return false;
+    }
+
+    /**
+     * @brief The luminance range HDR images of the display are tone mapped from and to when they're streamed in SDR.
+     */
+    struct tone_mapping_t {
+      float sdr_white_nits;  ///< The luminance mapped to SDR white.
+      float peak_nits;  ///< The peak luminance of the display, 0 if the images aren't tone mapped.
+    };
+
     video::sunshine_colorspace_t colorspace;
+    tone_mapping_t tone_mapping {};
   };
 
   struct avcodec_encode_device_t: encode_device_t {
@@ -418,6 +485,14 @@ namespace platf {
     virtual void apply_colorspace() {
     }
 
+    /**
+     * @brief Whether the next image can be converted while the previous frame is still being encoded.
+     * @details Devices that convert into several frames in turn let the packets be received on another thread.
+     */
+    virtual bool can_convert_while_encoding() const {
+      return false;
+    }
+
     /**
      * @brief Set the frame to be encoded.
      * @note Implementations must take ownership of 'frame'.
@@ -549,6 +624,13 @@ namespace platf {
   public:
     virtual capture_e sample(std::vector<float> &frame_buffer) = 0;
 
+    /**
+     * @brief Get how long the samples returned by the last call to sample() were buffered before it returned.
+     */
+    virtual std::chrono::nanoseconds latency() {
+      return std::chrono::nanoseconds {};
+    }
+
     virtual ~mic_t() = default;
   };
 
@@ -598,12 +680,44 @@ namespace platf {
   // A list of names of displays accepted as display_name with the mem_type_e
   std::vector<std::string> display_names(mem_type_e hwdevice_type);
 
+  /**
+   * @brief Get a counter that changes whenever displays may have been connected, disconnected or reconfigured.
+   * @details The names from `display_names()` are only enumerated again once this changes.
+   *          Platforms that can't tell return a new value on every call.
+   * @return The generation of the display topology.
+   */
+  std::uint64_t display_topology_generation();
+
   /**
    * @brief Check if GPUs/drivers have changed since the last call to this function.
    * @return `true` if a change has occurred or if it is unknown whether a change occurred.
    */
   bool needs_encoder_reenumeration();
 
+  /**
+   * @brief Describe the GPUs, their drivers and the displays attached to them.
+   * @details This keys the encoder probe cache, so it must change whenever the probe results could.
+   * @return The description, or an empty string if the probe results can't be cached.
+   */
+  std::string encoder_probe_fingerprint();
+
+  /**
+   * @brief Check if encoders can be validated concurrently on separate threads.
+   * @return `true` if capturing the same display from several threads at once is safe.
+   */
+  bool concurrent_encoder_probing();
+
+  /**
+   * @brief Get the capture methods that can be benchmarked against each other.
+   * @return The values of `config::video.capture` to try, in the order they're tried automatically.
+   */
+  std::vector<std::string> capture_methods();
+
+  /**
+   * @brief Get the CPU time used by all threads of the process so far.
+   */
+  std::chrono::nanoseconds process_cpu_time();
+
   boost::process::v1::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const boost::process::v1::environment &env, FILE *file, std::error_code &ec, boost::process::v1::group *group);
 
   enum class thread_priority_e : int {
@@ -614,6 +728,59 @@ namespace platf {
   };
   void adjust_thread_priority(thread_priority_e priority);
 
+  /**
+   * @brief A logical CPU of the host, and what it shares with the other ones.
+   */
+  struct cpu_info_t {
+    int id;  ///< The logical CPU number the OS uses for affinity.
+    int l3_domain;  ///< An id shared by the CPUs using the same L3 cache, -1 if unknown.
+    int numa_node;  ///< The NUMA node of the CPU, -1 if unknown.
+    int efficiency_class;  ///< Higher for faster cores, e.g. 1 for P-cores and 0 for E-cores of hybrid CPUs.
+    int core = -1;  ///< An id shared by the SMT siblings of a physical core, -1 if unknown.
+  };
+
+  /**
+   * @brief Get the logical CPUs of the host the process may run on.
+   * @return The CPUs, or an empty list if the topology isn't known on this platform.
+   */
+  std::vector<cpu_info_t> cpu_topology();
+
+  /**
+   * @brief Get the NUMA node of the GPU used for encoding.
+   * @return The NUMA node, or -1 if it isn't known.
+   */
+  int gpu_numa_node();
+
+  /**
+   * @brief Get the GPUs encode sessions can be placed on, for encoders that open a GPU by name.
+   * @return The names `config::video.adapter_name` takes, or an empty list if sessions can't be placed on this platform.
+   */
+  std::vector<std::string> encode_gpus();
+
+  /**
+   * @brief Sample the utilization of the GPUs from the sources the OS has for them.
+   * @details NVIDIA GPUs are sampled through NVML on top of this, see `gpu_sampler`.
+   *          Only the sampling thread of `gpu_sampler` may call this.
+   * @return The GPUs, named like `encode_gpus()` where it reports any, or an empty list if nothing can be sampled.
+   */
+  std::vector<metrics::gpu_metrics_t> sample_gpus();
+
+  /**
+   * @brief Get the name of a GPU from its PCI address.
+   * @param domain The PCI domain.
+   * @param bus The PCI bus.
+   * @param device The PCI device.
+   * @return The name the GPU goes by in `sample_gpus()`, or an empty string if it isn't known.
+   */
+  std::string gpu_by_pci_address(unsigned int domain, unsigned int bus, unsigned int device);
+
+  /**
+   * @brief Restrict the current thread to some CPUs.
+   * @param cpus The ids of the CPUs from `cpu_topology()`.
+   * @return `true` if the thread was restricted to them.
+   */
+  bool set_thread_affinity(const std::vector<int> &cpus);
+
   // Allow OS-specific actions to be taken to prepare for streaming
   void streaming_will_start();
   void streaming_will_stop();
@@ -651,6 +818,14 @@ namespace platf {
     }
   };
 
+  /**
+   * @brief Tracks the zero-copy sends that still reference a set of buffers.
+   */
+  struct zerocopy_ticket_t {
+    // Id of the last zero-copy send made with this ticket, if any
+    std::optional<std::uint64_t> last_id;
+  };
+
   struct batched_send_info_t {
     // Optional headers to be prepended to each packet
     const char *headers;
@@ -659,7 +834,7 @@ namespace platf {
     // One or more data buffers to use for the payloads
     //
     // NB: Data buffers must be aligned to payload size!
-    std::vector<buffer_descriptor_t> &payload_buffers;
+    std::span<buffer_descriptor_t> payload_buffers;
     size_t payload_size;
 
     // The offset (in header+payload message blocks) in the header and payload
@@ -674,6 +849,19 @@ namespace platf {
     uint16_t target_port;
     boost::asio::ip::address &source_address;
 
+    // If set, the kernel holds the messages until this time instead of sending them immediately.
+    // Only honored on sockets that enable_socket_txtime() succeeded on.
+    std::optional<std::chrono::steady_clock::time_point> txtime = std::nullopt;
+
+    // If set, the payloads are sent without copying them into the kernel, and the buffers must stay
+    // untouched until wait_for_zerocopy() returns for this ticket. Only honored on sockets that
+    // enable_socket_zerocopy() succeeded on.
+    zerocopy_ticket_t *zerocopy = nullptr;
+
+    // Set if the socket is bound to the source address and connected to the target, so the
+    // messages are sent without either. Only set on sockets that enable_socket_reuseport() succeeded on.
+    bool connected = false;
+
     /**
      * @brief Returns a payload buffer descriptor for the given payload offset.
      * @param offset The offset in the total payload data (bytes).
@@ -706,10 +894,21 @@ namespace platf {
     boost::asio::ip::address &target_address;
     uint16_t target_port;
     boost::asio::ip::address &source_address;
+
+    // Same as batched_send_info_t::connected
+    bool connected = false;
   };
 
   bool send(send_info_t &send_info);
 
+  /**
+   * @brief Send packets to any number of destinations with as few syscalls as the OS allows.
+   * @details Packets that fail to send don't keep the rest from being sent.
+   * @param send_infos The packets, grouped by the socket they're sent from.
+   * @return `true` if every packet was sent.
+   */
+  bool send_many(std::span<send_info_t> send_infos);
+
   enum class qos_data_type_e : int {
     audio,  ///< Audio
     video  ///< Video
@@ -725,6 +924,100 @@ namespace platf {
    */
   std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging);
 
+  /**
+   * @brief Enable kernel pacing of outgoing traffic on the given socket.
+   * @details Once enabled, `batched_send_info_t::txtime` sets the earliest time each batch
+   *          leaves the host. This requires a qdisc that honors transmit times, such as fq.
+   * @param native_socket The native socket handle.
+   * @return `true` if transmit times are supported on this socket.
+   */
+  bool enable_socket_txtime(uintptr_t native_socket);
+
+  /**
+   * @brief Enable zero-copy sends on the given socket.
+   * @param native_socket The native socket handle.
+   * @return `true` if zero-copy sends are supported on this socket.
+   */
+  bool enable_socket_zerocopy(uintptr_t native_socket);
+
+  /**
+   * @brief Open a UDP socket whose batches are sent through Registered I/O.
+   * @details `send_batch()` copies the packets of the socket into pre-registered buffers, and sends each
+   *          batch with a single kernel transition, even without UDP segmentation offload.
+   * @param v6 Whether the socket is IPv6.
+   * @param native_socket Set to the native socket handle, which the caller owns.
+   * @return Stops using Registered I/O for the socket once destroyed, `nullptr` if it isn't supported on this platform.
+   */
+  std::unique_ptr<deinit_t> open_socket_registered_io(bool v6, std::uintptr_t &native_socket);
+
+  /**
+   * @brief Send the batches of a socket through an AF_XDP socket on a network interface.
+   * @details `send_batch()` writes the packets to destinations reached through the interface straight
+   *          into the transmit ring of its driver, with the port and traffic class of the socket.
+   *          Anything else is still sent through the socket. Transmit times are ignored.
+   * @param native_socket The native socket handle, which must be bound.
+   * @param interface The name of the interface.
+   * @return Stops using AF_XDP for the socket once destroyed, `nullptr` if it isn't available.
+   */
+  std::unique_ptr<deinit_t> enable_socket_xdp(uintptr_t native_socket, const std::string &interface);
+
+  /**
+   * @brief Let other sockets bind the same local address and port as the given socket.
+   * @details This lets a socket connected to a single client share the port of the socket that
+   *          waits for new clients, so the kernel gives each client its own send buffer.
+   * @param native_socket The native socket handle, which must not be bound yet.
+   * @return `true` if the port can be shared on this platform.
+   */
+  bool enable_socket_reuseport(uintptr_t native_socket);
+
+  /**
+   * @brief Get the largest IP packet that reaches an address without being fragmented.
+   * @details This is the MTU the host learned for the path, which starts out as the MTU of the route
+   *          or interface leading there and shrinks when routers report they can't forward a packet.
+   * @param address The destination.
+   * @return The MTU in bytes, -1 if it's unknown.
+   */
+  int path_mtu(const boost::asio::ip::address &address);
+
+  /**
+   * @brief An address of a network interface of the host.
+   */
+  struct interface_address_t {
+    std::string name;  ///< The name of the interface.
+    boost::asio::ip::address address;
+    int prefix_length;  ///< The length of the network prefix of the address.
+  };
+
+  /**
+   * @brief Get the addresses of the network interfaces that are up, loopback interfaces excluded.
+   * @return The addresses, or an empty list if they aren't known on this platform.
+   */
+  std::vector<interface_address_t> interface_addresses();
+
+  /**
+   * @brief Transmit statistics of a network interface.
+   */
+  struct interface_stats_t {
+    bool carrier;  ///< Whether the interface has a link.
+    std::uint64_t tx_packets;
+    std::uint64_t tx_dropped;  ///< Packets the interface dropped for lack of room or a link.
+    std::uint64_t tx_errors;
+  };
+
+  /**
+   * @brief Get the transmit statistics of a network interface.
+   * @param name The name of the interface.
+   * @return The statistics, or `std::nullopt` if the interface is gone or they aren't known on this platform.
+   */
+  std::optional<interface_stats_t> interface_stats(const std::string &name);
+
+  /**
+   * @brief Wait until the kernel no longer references the buffers of the sends made with a ticket.
+   * @param native_socket The native socket handle.
+   * @param ticket The ticket passed to `send_batch()`, which is cleared on return.
+   */
+  void wait_for_zerocopy(uintptr_t native_socket, zerocopy_ticket_t &ticket);
+
   /**
    * @brief Open a url in the default web browser.
    * @param url The url to open.
@@ -745,6 +1038,42 @@ namespace platf {
    */
   bool process_group_running(std::uintptr_t native_handle);
 
+  /**
+   * @brief Watches for a process, or every process of a group, to exit, until destroyed.
+   */
+  class process_watcher_t {
+  public:
+    virtual ~process_watcher_t() = default;
+  };
+
+  /**
+   * @brief Get notified as soon as a process, or every process of a group, exited.
+   * @param process The native handle of the process, ignored when watching a group.
+   * @param group The native handle of the process group to watch, 0 to watch the process.
+   * @param exited Called once from another thread when they exited, never after the watcher is destroyed.
+   * @return The watcher, or nullptr if their exit can only be polled for with this platform.
+   */
+  std::unique_ptr<process_watcher_t> watch_process_exit(std::uintptr_t process, std::uintptr_t group, std::function<void()> &&exited);
+
+  /**
+   * @brief Keeps the processes of an app within a share of the CPUs, until destroyed.
+   */
+  class app_isolation_t {
+  public:
+    virtual ~app_isolation_t() = default;
+  };
+
+  /**
+   * @brief Restrict a launched app to some CPUs and a share of their time, leaving the rest to the streaming threads.
+   * @details Processes the app starts later inherit the restrictions.
+   * @param process The native handle of the process of the app.
+   * @param group The native handle of the process group of the app, 0 if it has none.
+   * @param cpus The CPUs the app may run on, empty for every CPU.
+   * @param cpu_weight The share of CPU time of the app against the 100 of Apollo.
+   * @return The isolation, or nullptr if the app can't be isolated on this platform.
+   */
+  std::unique_ptr<app_isolation_t> isolate_app(std::uintptr_t process, std::uintptr_t group, const std::vector<int> &cpus, int cpu_weight);
+
   input_t input();
   /**
    * @brief Get the current mouse position on screen
@@ -764,6 +1093,18 @@ namespace platf {
   void gamepad_update(input_t &input, int nr, const gamepad_state_t &gamepad_state);
   void unicode(input_t &input, char *utf8, int size);
 
+  /**
+   * @brief Queue the input sent by this thread until `end_input_batch()`, where the platform can send it at once.
+   * @param input The input_t instance to use.
+   */
+  void begin_input_batch(input_t &input);
+
+  /**
+   * @brief Send the input queued by this thread since `begin_input_batch()`.
+   * @param input The input_t instance to use.
+   */
+  void end_input_batch(input_t &input);
+
   typedef deinit_t client_input_t;
 
   /**
@@ -831,8 +1172,29 @@ namespace platf {
 #define SERVICE_TYPE "_nvstream._tcp"
 
   namespace publish {
+    /**
+     * @brief State of the publication of the host on the local network.
+     */
+    enum class status_e : int {
+      disabled,  ///< Discovery is disabled or unavailable on this host
+      pending,  ///< Waiting for the mDNS service to publish the host
+      published,  ///< The host is published
+      failed,  ///< The last attempt failed, it's retried in the background
+    };
+
+    /**
+     * @brief Start publishing the host on the local network.
+     * @details Returns without waiting for the mDNS service, the publication completes in the background.
+     * @return The publication, which unpublishes the host when destroyed, or `nullptr` if it can't be started at all.
+     */
     [[nodiscard]] std::unique_ptr<deinit_t> start();
-  }
+
+    /**
+     * @brief Get the state of the publication.
+     * @return The state.
+     */
+    status_e status();
+  }  // namespace publish
 
   [[nodiscard]] std::unique_ptr<deinit_t> init();
 
@@ -66,9 +66,36 @@ namespace platf {
 
       return capture_e::ok;
     }
+
+    std::chrono::nanoseconds latency() override {
+      // Interpolated from the timing info PulseAudio keeps up to date, so this doesn't wait for the server
+      int status;
+      auto latency = pa_simple_get_latency(mic.get(), &status);
+      if (latency == (pa_usec_t) -1) {
+        return 0ns;
+      }
+
+      return std::chrono::microseconds {latency};
+    }
   };
 
+#ifdef SUNSHINE_BUILD_PIPEWIRE
+  namespace pw {
+    std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &source_name);
+  }  // namespace pw
+#endif
+
   std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, std::string source_name) {
+#ifdef SUNSHINE_BUILD_PIPEWIRE
+    if (config::audio.backend == "pipewire"sv) {
+      if (auto mic = pw::microphone(mapping, channels, sample_rate, frame_size, source_name)) {
+        return mic;
+      }
+
+      BOOST_LOG(warning) << "Falling back to capturing audio through PulseAudio"sv;
+    }
+#endif
+
     auto mic = std::make_unique<mic_attr_t>();
 
     pa_sample_spec ss {PA_SAMPLE_FLOAT32, sample_rate, (std::uint8_t) channels};
@@ -3,10 +3,14 @@
  * @brief Definitions for CUDA encoding.
  */
 // standard includes
+#include <algorithm>
 #include <bitset>
 #include <fcntl.h>
 #include <filesystem>
+#include <poll.h>
 #include <thread>
+#include <unistd.h>
+#include <unordered_set>
 
 // lib includes
 #include <ffnvcodec/dynlink_loader.h>
@@ -21,6 +25,8 @@ extern "C" {
 // local includes
 #include "cuda.h"
 #include "graphics.h"
+#include "src/config.h"
+#include "src/image_memory.h"
 #include "src/logging.h"
 #include "src/utility.h"
 #include "src/video.h"
@@ -81,6 +87,22 @@ namespace cuda {
 
   using registered_resource_t = util::safe_ptr<CUgraphicsResource_st, unregisterResource>;
 
+  void destroyExternalMemory(CUexternalMemory memory) {
+    CU_CHECK_IGNORE(cdf->cuDestroyExternalMemory(memory), "Couldn't destroy external memory");
+  }
+
+  void freeMappedBuffer(void *ptr) {
+    CU_CHECK_IGNORE(cdf->cuMemFree((CUdeviceptr) ptr), "Couldn't free mapped buffer");
+  }
+
+  using external_memory_t = util::safe_ptr<CUextMemory_st, destroyExternalMemory>;
+  using mapped_buffer_t = util::safe_ptr<void, freeMappedBuffer>;
+
+  // Only the few DRM formats the kernel can read, see graphics.cpp for why they're not included
+  constexpr std::uint32_t drm_format_xrgb8888 = 'X' | ('R' << 8) | ('2' << 16) | ('4' << 24);
+  constexpr std::uint32_t drm_format_argb8888 = 'A' | ('R' << 8) | ('2' << 16) | ('4' << 24);
+  constexpr std::uint64_t drm_format_mod_linear = 0;
+
   class img_t: public platf::img_t {
   public:
     tex_t tex;
@@ -99,6 +121,138 @@ namespace cuda {
     return 0;
   }
 
+  /**
+   * @brief Fill a frame with black, the aspect ratio padding included.
+   * @param sws The converter, with the colorspace of the frame applied.
+   * @param frame The frame.
+   * @param width The width of the captured image.
+   * @param height The height of the captured image.
+   * @param stream The stream to convert on.
+   * @return 0 on success or -1 on failure.
+   */
+  int fill_black(sws_t &sws, AVFrame *frame, int width, int height, stream_t::pointer stream) {
+    auto tex = tex_t::make(height, width * 4);
+    if (!tex) {
+      return -1;
+    }
+
+    // The default green color is ugly.
+    // Update the background color
+    platf::img_t img;
+    img.width = width;
+    img.height = height;
+    img.pixel_pitch = 4;
+    img.row_pitch = img.width * img.pixel_pitch;
+
+    std::vector<std::uint8_t> image_data;
+    image_data.resize(img.row_pitch * img.height);
+
+    img.data = image_data.data();
+
+    if (sws.load_ram(img, tex->array)) {
+      return -1;
+    }
+
+    return sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex->texture.linear, stream, {frame->width, frame->height, 0, 0});
+  }
+
+  /**
+   * @brief Least recently used cache of dmabufs imported as CUDA external memory.
+   * @details Works like `egl::rgb_cache_t`, except the dmabufs are read by the conversion kernel directly.
+   *          Only single plane linear dmabufs can be imported this way.
+   */
+  class external_memory_cache_t {
+  public:
+    static constexpr std::size_t capacity = egl::rgb_cache_t::capacity;
+
+    /**
+     * @brief Get the textures of a dmabuf, importing the dmabuf if it isn't cached.
+     * @param sd The dmabuf.
+     * @param recycled Whether the source reuses its buffers, otherwise nothing is kept past the next call.
+     * @return The textures, valid until the next call, or nullptr if the import failed.
+     */
+    tex_t *import(const egl::surface_descriptor_t &sd, bool recycled) {
+      std::optional<egl::buffer_key_t> key;
+      if (recycled) {
+        key = egl::buffer_key_t::make(sd);
+      }
+
+      if (!key) {
+        clear();
+      } else {
+        auto it = std::find_if(std::begin(entries), std::end(entries), [&](const entry_t &entry) {
+          return entry.key == *key;
+        });
+
+        if (it != std::end(entries)) {
+          std::rotate(std::begin(entries), it, it + 1);
+          return &entries.front().tex;
+        }
+      }
+
+      auto size = lseek(sd.fds[0], 0, SEEK_END);
+      if (size < 0) {
+        return nullptr;
+      }
+
+      CUDA_EXTERNAL_MEMORY_HANDLE_DESC handle_desc {};
+      handle_desc.type = CU_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD;
+      handle_desc.handle.fd = dup(sd.fds[0]);
+      handle_desc.size = size;
+
+      // CUDA owns the file descriptor once the import succeeded
+      CUexternalMemory memory;
+      if (check(cdf->cuImportExternalMemory(&memory, &handle_desc), "Couldn't import dmabuf as external memory: "sv)) {
+        close(handle_desc.handle.fd);
+        return nullptr;
+      }
+
+      entry_t entry;
+      entry.key = key.value_or(egl::buffer_key_t {});
+      entry.memory.reset(memory);
+
+      CUDA_EXTERNAL_MEMORY_BUFFER_DESC buffer_desc {};
+      buffer_desc.offset = sd.offsets[0];
+      buffer_desc.size = (unsigned long long) sd.pitches[0] * sd.height;
+
+      CUdeviceptr ptr;
+      if (check(cdf->cuExternalMemoryGetMappedBuffer(&ptr, memory, &buffer_desc), "Couldn't map external memory: "sv)) {
+        return nullptr;
+      }
+      entry.buffer.reset((void *) ptr);
+
+      auto tex = tex_t::wrap((void *) ptr, sd.width, sd.height, sd.pitches[0]);
+      if (!tex) {
+        return nullptr;
+      }
+      entry.tex = std::move(*tex);
+
+      if (entries.size() >= capacity) {
+        entries.pop_back();
+      }
+
+      entries.insert(std::begin(entries), std::move(entry));
+      return &entries.front().tex;
+    }
+
+    void clear() {
+      entries.clear();
+    }
+
+  private:
+    struct entry_t {
+      egl::buffer_key_t key;
+
+      // Destroyed in reverse order
+      external_memory_t memory;
+      mapped_buffer_t buffer;
+      tex_t tex;
+    };
+
+    // Most recently used first
+    std::vector<entry_t> entries;
+  };
+
   class cuda_t: public platf::avcodec_encode_device_t {
   public:
     int init(int in_width, int in_height) {
@@ -115,23 +269,28 @@ namespace cuda {
       return 0;
     }
 
+    bool detach_display() override {
+      // The images are imported when they're converted, nothing refers to the display
+      return true;
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &) override {
+      return true;
+    }
+
     int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
-      this->hwframe.reset(frame);
       this->frame = frame;
 
+      // The first surface is the frame, the others get a copy of its properties and side data
+      surfaces.resize(std::max(config::video.nv_pipeline_depth, 1));
+      surfaces[0].frame.reset(frame);
+
       auto hwframe_ctx = (AVHWFramesContext *) hw_frames_ctx->data;
       if (hwframe_ctx->sw_format != AV_PIX_FMT_NV12) {
         BOOST_LOG(error) << "cuda::cuda_t doesn't support any format other than AV_PIX_FMT_NV12"sv;
         return -1;
       }
 
-      if (!frame->buf[0]) {
-        if (av_hwframe_get_buffer(hw_frames_ctx, frame, 0)) {
-          BOOST_LOG(error) << "Couldn't get hwframe for NVENC"sv;
-          return -1;
-        }
-      }
-
       auto cuda_ctx = (AVCUDADeviceContext *) hwframe_ctx->device_ctx->hwctx;
 
       stream = make_stream();
@@ -141,6 +300,33 @@ namespace cuda {
 
       cuda_ctx->stream = stream.get();
 
+      for (std::size_t x = 0; x < surfaces.size(); ++x) {
+        auto &surface = surfaces[x];
+
+        if (x > 0) {
+          surface.frame.reset(av_frame_alloc());
+          if (!surface.frame || av_frame_copy_props(surface.frame.get(), frame)) {
+            return -1;
+          }
+        }
+
+        if (!surface.frame->buf[0]) {
+          if (av_hwframe_get_buffer(hw_frames_ctx, surface.frame.get(), 0)) {
+            BOOST_LOG(error) << "Couldn't get hwframe for NVENC"sv;
+            return -1;
+          }
+        }
+
+        // A single surface is converted on the stream NVENC reads from
+        if (surfaces.size() > 1) {
+          surface.stream = make_stream();
+          surface.converted = make_event();
+          if (!surface.stream || !surface.converted) {
+            return -1;
+          }
+        }
+      }
+
       auto sws_opt = sws_t::make(width, height, frame->width, frame->height, width * 4);
       if (!sws_opt) {
         return -1;
@@ -155,38 +341,100 @@ namespace cuda {
 
     void apply_colorspace() override {
       sws.apply_colorspace(colorspace);
+      for (auto &surface : surfaces) {
+        fill_black(sws, surface.frame.get(), width, height, stream.get());
+      }
+    }
 
-      auto tex = tex_t::make(height, width * 4);
-      if (!tex) {
-        return;
+    bool resize_input(int in_width, int in_height) override {
+      if (!frame) {
+        return false;
       }
 
-      // The default green color is ugly.
-      // Update the background color
-      platf::img_t img;
-      img.width = width;
-      img.height = height;
-      img.pixel_pitch = 4;
-      img.row_pitch = img.width * img.pixel_pitch;
+      // The surfaces stay, only the scaling into them changes
+      auto sws_opt = sws_t::make(in_width, in_height, frame->width, frame->height, in_width * 4);
+      if (!sws_opt) {
+        return false;
+      }
 
-      std::vector<std::uint8_t> image_data;
-      image_data.resize(img.row_pitch * img.height);
+      sws = std::move(*sws_opt);
 
-      img.data = image_data.data();
+      width = in_width;
+      height = in_height;
+      linear_interpolation = width != frame->width || height != frame->height;
 
-      if (sws.load_ram(img, tex->array)) {
-        return;
-      }
+      // The letterbox of the new aspect ratio must be black
+      apply_colorspace();
 
-      sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex->texture.linear, stream.get(), {frame->width, frame->height, 0, 0});
+      return true;
+    }
+
+    bool can_convert_while_encoding() const override {
+      // The next image goes into another surface than the one NVENC is reading
+      return surfaces.size() > 1;
     }
 
     cudaTextureObject_t tex_obj(const tex_t &tex) const {
       return linear_interpolation ? tex.texture.linear : tex.texture.point;
     }
 
+    struct surface_t {
+      frame_t frame;
+
+      // Only used with more than one surface
+      stream_t stream;
+      event_t converted;
+    };
+
+    /**
+     * @brief Pick the surface to convert the next image into, and make it the frame to encode.
+     * @details Surfaces NVENC still holds a reference to are skipped, so the conversion never
+     *          overwrites a frame that's still being encoded. When all of them are in use,
+     *          the current surface is converted into again, like with a single surface.
+     * @return The stream to convert on.
+     */
+    stream_t::pointer begin_convert() {
+      auto next = current_surface;
+      for (std::size_t x = 1; x < surfaces.size(); ++x) {
+        auto index = (current_surface + x) % surfaces.size();
+        if (av_buffer_get_ref_count(surfaces[index].frame->buf[0]) == 1) {
+          next = index;
+          break;
+        }
+      }
+
+      // Keyframe requests are made on the frame to encode
+      auto next_frame = surfaces[next].frame.get();
+      if (next_frame != frame) {
+        next_frame->pict_type = frame->pict_type;
+        next_frame->flags = (next_frame->flags & ~AV_FRAME_FLAG_KEY) | (frame->flags & AV_FRAME_FLAG_KEY);
+
+        frame = next_frame;
+        current_surface = next;
+      }
+
+      auto &surface = surfaces[current_surface];
+      return surface.stream ? surface.stream.get() : stream.get();
+    }
+
+    /**
+     * @brief Make NVENC wait for the conversion without blocking the CPU.
+     * @return 0 on success or -1 on failure.
+     */
+    int end_convert() {
+      auto &surface = surfaces[current_surface];
+      if (!surface.stream) {
+        return 0;
+      }
+
+      return stream_wait(surface.converted.get(), surface.stream.get(), stream.get());
+    }
+
+    // NVENC reads the frames on this stream
     stream_t stream;
-    frame_t hwframe;
+
+    std::vector<surface_t> surfaces;
+    std::size_t current_surface = 0;
 
     int width, height;
 
@@ -196,10 +444,95 @@ namespace cuda {
     sws_t sws;
   };
 
+  /**
+   * @brief Pins the captured images while any RAM encoding device exists, so they're uploaded by DMA rather than through a staging copy.
+   */
+  class pinned_images_t {
+  public:
+    static std::shared_ptr<pinned_images_t> get() {
+      static std::mutex lock;
+      static std::weak_ptr<pinned_images_t> instance;
+
+      std::lock_guard lg {lock};
+      auto pinned = instance.lock();
+      if (!pinned) {
+        pinned = std::shared_ptr<pinned_images_t> {new pinned_images_t};
+        instance = pinned;
+      }
+
+      return pinned;
+    }
+
+    ~pinned_images_t() {
+      util::unwatch_images(_watch);
+    }
+
+    /**
+     * @brief Check whether the pixels of an image are pinned.
+     */
+    bool contains(std::uint8_t *data) {
+      std::lock_guard lg {_lock};
+      return _images.contains(data);
+    }
+
+  private:
+    pinned_images_t() {
+      _watch = util::watch_images(
+        [this](std::uint8_t *data, std::size_t size) {
+          if (!register_host(data, size)) {
+            std::lock_guard lg {_lock};
+            _images.emplace(data);
+          }
+        },
+        [this](std::uint8_t *data, std::size_t) {
+          std::lock_guard lg {_lock};
+          if (_images.erase(data)) {
+            unregister_host(data);
+          }
+        }
+      );
+    }
+
+    int _watch;
+
+    std::mutex _lock;
+    std::unordered_set<std::uint8_t *> _images;
+  };
+
   class cuda_ram_t: public cuda_t {
   public:
+    cuda_ram_t():
+        pinned {pinned_images_t::get()} {
+    }
+
+    ~cuda_ram_t() override {
+      // Work still reading the images or the array is done before they're unpinned and freed
+      if (last_stream) {
+        stream_synchronize(last_stream);
+      }
+    }
+
     int convert(platf::img_t &img) override {
-      return sws.load_ram(img, tex.array) || sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(tex), stream.get());
+      auto convert_stream = begin_convert();
+
+      // A synchronous copy from pageable memory waits for the work of every stream, which keeps it from
+      // overwriting the array while a conversion on the stream of another surface still reads it
+      if (!uploaded || !pinned->contains(img.data)) {
+        last_stream = nullptr;
+        return sws.load_ram(img, tex.array) || sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(tex), convert_stream) || end_convert();
+      }
+
+      // The upload of a pinned image only waits for the previous conversion reading the array
+      if (last_stream && last_stream != convert_stream && stream_wait(array_read.get(), last_stream, convert_stream)) {
+        return -1;
+      }
+      last_stream = convert_stream;
+
+      // The conversion is queued behind the upload, and only the upload is waited for, as the image may be reused once this returns
+      return sws.load_ram_async(img, tex.array, convert_stream, uploaded.get()) ||
+             sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(tex), convert_stream) ||
+             end_convert() ||
+             event_synchronize(uploaded.get());
     }
 
     int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) override {
@@ -214,16 +547,47 @@ namespace cuda {
 
       tex = std::move(*tex_opt);
 
+      // Without the events, images are uploaded synchronously
+      uploaded = make_event();
+      array_read = make_event();
+      if (!uploaded || !array_read) {
+        uploaded.reset();
+      }
+
       return 0;
     }
 
+    bool resize_input(int in_width, int in_height) override {
+      auto tex_opt = tex_t::make(in_height, in_width * 4);
+      if (!tex_opt || !cuda_t::resize_input(in_width, in_height)) {
+        return false;
+      }
+
+      // The previous array may still be read by a conversion
+      if (last_stream) {
+        stream_synchronize(last_stream);
+        last_stream = nullptr;
+      }
+      tex = std::move(*tex_opt);
+
+      return true;
+    }
+
     tex_t tex;
+
+    std::shared_ptr<pinned_images_t> pinned;
+
+    // Recorded once an image is uploaded, and on the stream that last read the array
+    event_t uploaded;
+    event_t array_read;
+    stream_t::pointer last_stream = nullptr;
   };
 
   class cuda_vram_t: public cuda_t {
   public:
     int convert(platf::img_t &img) override {
-      return sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(((img_t *) &img)->tex), stream.get());
+      auto convert_stream = begin_convert();
+      return sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(((img_t *) &img)->tex), convert_stream) || end_convert();
     }
   };
 
@@ -275,6 +639,21 @@ namespace cuda {
 
   class gl_cuda_vram_t: public platf::avcodec_encode_device_t {
   public:
+    bool detach_display() override {
+      return true;
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &) override {
+      // The sequence numbers and dmabufs of the new display have nothing in common with the old one
+      sequence = 0;
+      rgb = nullptr;
+      rgb_cache.clear();
+      overlay_cache.clear();
+      external_tex = nullptr;
+      external_cache.clear();
+      return true;
+    }
+
     /**
      * @brief Initialize the GL->CUDA encoding device.
      * @param in_width Width of captured frames.
@@ -369,9 +748,89 @@ namespace cuda {
       CU_CHECK(cdf->cuGraphicsGLRegisterImage(&y_res, nv12->tex[0], GL_TEXTURE_2D, CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY), "Couldn't register Y plane texture");
       CU_CHECK(cdf->cuGraphicsGLRegisterImage(&uv_res, nv12->tex[1], GL_TEXTURE_2D, CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY), "Couldn't register UV plane texture");
 
+      // The conversion kernel writes NV12 and P010
+      external_memory = sw_format == AV_PIX_FMT_NV12 || sw_format == AV_PIX_FMT_P010;
+      if (external_memory) {
+        auto cuda_sws_opt = sws_t::make(width, height, frame->width, frame->height, width * 4);
+        if (!cuda_sws_opt) {
+          return -1;
+        }
+
+        cuda_sws = std::move(*cuda_sws_opt);
+        cuda_sws.p010 = sw_format == AV_PIX_FMT_P010;
+      }
+
       return 0;
     }
 
+    /**
+     * @brief Check whether a dmabuf can be read by the conversion kernel without going through GL.
+     * @param descriptor The captured image.
+     * @return `true` if the dmabuf is worth importing as CUDA external memory.
+     */
+    bool can_import_external(const egl::img_descriptor_t &descriptor) const {
+      auto &sd = descriptor.sd;
+
+      // Cropping and multi-planar or tiled layouts are left to GL
+      return external_memory &&
+             sd.fds[1] < 0 &&
+             (sd.fourcc == drm_format_xrgb8888 || sd.fourcc == drm_format_argb8888) &&
+             sd.modifier == drm_format_mod_linear &&
+             sd.width == width && sd.height == height &&
+             offset_x == 0 && offset_y == 0;
+    }
+
+    /**
+     * @brief Convert a dmabuf imported as CUDA external memory straight into the target CUDA frame.
+     * @details The cursor is blended by the conversion kernel, so the image isn't copied to blend it first.
+     * @param descriptor The captured image, with its cursor if it's visible.
+     * @param tex The textures of the dmabuf.
+     * @return 0 on success or -1 on failure.
+     */
+    int convert_external(const egl::img_descriptor_t &descriptor, const tex_t &tex) {
+      // Without GL, nothing waits for the implicit fence of the dmabuf
+      pollfd pfd {descriptor.sd.fds[0], POLLIN, 0};
+      poll(&pfd, 1, 100);
+
+      auto scaled = width != frame->width || height != frame->height;
+      auto texture = scaled ? tex.texture.linear : tex.texture.point;
+      if (!descriptor.data) {
+        return cuda_sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], texture, stream.get());
+      }
+
+      // The cursor only changes when its serial does
+      if (!cursor_tex || descriptor.serial != cursor_serial) {
+        auto tex_opt = tex_t::make(descriptor.src_h, descriptor.src_w * 4);
+        if (!tex_opt) {
+          return -1;
+        }
+
+        platf::img_t cursor_img;
+        cursor_img.data = descriptor.data;
+        cursor_img.width = descriptor.src_w;
+        cursor_img.height = descriptor.src_h;
+        cursor_img.pixel_pitch = 4;
+        cursor_img.row_pitch = descriptor.src_w * 4;
+        if (cuda_sws.load_ram(cursor_img, tex_opt->array)) {
+          return -1;
+        }
+
+        cursor_tex = std::move(*tex_opt);
+        cursor_serial = descriptor.serial;
+      }
+
+      cursor_t cursor {
+        cursor_tex->texture.linear,
+        (float) descriptor.x,
+        (float) descriptor.y,
+        (float) descriptor.width,
+        (float) descriptor.height,
+        (float) descriptor.src_w / std::max(descriptor.width, 1),
+        (float) descriptor.src_h / std::max(descriptor.height, 1),
+      };
+      return cuda_sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], texture, stream.get(), cursor);
+    }
+
     /**
      * @brief Convert the captured image into the target CUDA frame.
      * @param img Captured screen image.
@@ -382,23 +841,40 @@ namespace cuda {
 
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank_rgb = egl::create_blank(img);
+        rgb = &blank_rgb;
+        external_tex = nullptr;
+        overlay_cache.textures.clear();
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
+        rgb = nullptr;
+        external_tex = nullptr;
+        overlay_cache.import(display.get(), descriptor.overlays, descriptor.recycled);
+        if (can_import_external(descriptor)) {
+          external_tex = external_cache.import(descriptor.sd, descriptor.recycled);
+          if (!external_tex) {
+            BOOST_LOG(info) << "Couldn't import dmabuf as CUDA external memory, converting through GL"sv;
+            external_memory = false;
+            external_cache.clear();
+          }
+        }
+      }
 
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
+      // The overlays can only be blended in GL
+      if (external_tex && descriptor.overlays.empty()) {
+        return convert_external(descriptor, *external_tex);
+      }
 
-        if (!rgb_opt) {
+      if (!rgb) {
+        rgb = rgb_cache.import(display.get(), descriptor.sd, descriptor.recycled);
+        if (!rgb) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
       // Perform the color conversion and scaling in GL
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0], overlay_cache.textures);
       sws.convert(nv12->buf);
 
       auto fmt_desc = av_pix_fmt_desc_get(sw_format);
@@ -432,6 +908,12 @@ namespace cuda {
      */
     void apply_colorspace() override {
       sws.apply_colorspace(colorspace);
+      sws.apply_tone_mapping(tone_mapping);
+
+      if (external_memory) {
+        cuda_sws.apply_colorspace(colorspace);
+        fill_black(cuda_sws, frame, width, height, stream.get());
+      }
     }
 
     file_t file;
@@ -450,11 +932,24 @@ namespace cuda {
     int width, height;
 
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::rgb_cache_t rgb_cache;
+    egl::overlay_cache_t overlay_cache;
+    egl::rgb_t blank_rgb;
+    egl::rgb_t *rgb = nullptr;
 
     registered_resource_t y_res;
     registered_resource_t uv_res;
 
+    // Cleared the first time a dmabuf can't be imported as CUDA external memory
+    bool external_memory = false;
+    sws_t cuda_sws;
+    external_memory_cache_t external_cache;
+    tex_t *external_tex = nullptr;
+
+    // The cursor the conversion kernel blends
+    std::optional<tex_t> cursor_tex;
+    unsigned long cursor_serial = 0;
+
     int offset_x, offset_y;
   };
 
@@ -841,6 +1336,9 @@ namespace cuda {
           return platf::capture_e::error;
         }
 
+        // The frames grabbed below aren't handed over, the image with the cursor toggled must be
+        force_refresh = true;
+
         // If trying to capture directly, test if it actually does.
         if (capture_params.bAllowDirectCapture) {
           CUdeviceptr device_ptr;
@@ -902,7 +1400,7 @@ namespace cuda {
 
         NVFBC_TOCUDA_GRAB_FRAME_PARAMS grab {
           NVFBC_TOCUDA_GRAB_FRAME_PARAMS_VER,
-          NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT,
+          (std::uint32_t) (force_refresh ? NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT | NVFBC_TOCUDA_GRAB_FLAGS_FORCE_REFRESH : NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT),
           &device_ptr,
           &info,
           (std::uint32_t) timeout.count(),
@@ -917,6 +1415,13 @@ namespace cuda {
           return platf::capture_e::error;
         }
 
+        // NvFBC leaves its buffer alone while the screen doesn't change, and so does the copy to an image,
+        // the encoder repeats the last image it got instead
+        if (!info.bIsNewFrame && !force_refresh) {
+          return platf::capture_e::timeout;
+        }
+        force_refresh = false;
+
         if (!pull_free_image_cb(img_out)) {
           return platf::capture_e::interrupted;
         }
@@ -961,6 +1466,9 @@ namespace cuda {
       bool cursor_visible;
       handle_t handle;
 
+      // Hand over the next grab even if the screen didn't change since the last one
+      bool force_refresh = true;
+
       NVFBC_CREATE_CAPTURE_SESSION_PARAMS capture_params;
     };
   }  // namespace nvfbc
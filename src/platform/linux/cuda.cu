@@ -116,6 +116,47 @@ namespace cuda {
     CU_CHECK_IGNORE(cudaStreamDestroy(ptr), "Couldn't free cuda stream");
   }
 
+  void freeCudaEvent_t::operator()(cudaEvent_t ptr) {
+    CU_CHECK_IGNORE(cudaEventDestroy(ptr), "Couldn't free cuda event");
+  }
+
+  event_t make_event() {
+    cudaEvent_t event;
+
+    CU_CHECK_PTR(cudaEventCreateWithFlags(&event, cudaEventDisableTiming), "Couldn't create cuda event");
+
+    return event_t {event};
+  }
+
+  int stream_wait(event_t::pointer event, stream_t::pointer from, stream_t::pointer to) {
+    CU_CHECK(cudaEventRecord(event, from), "Couldn't record cuda event");
+    CU_CHECK(cudaStreamWaitEvent(to, event, 0), "Couldn't wait for cuda event");
+
+    return 0;
+  }
+
+  int event_synchronize(event_t::pointer event) {
+    CU_CHECK(cudaEventSynchronize(event), "Couldn't wait for cuda event");
+
+    return 0;
+  }
+
+  int stream_synchronize(stream_t::pointer stream) {
+    CU_CHECK(cudaStreamSynchronize(stream), "Couldn't wait for cuda stream");
+
+    return 0;
+  }
+
+  int register_host(void *data, std::size_t size) {
+    CU_CHECK(cudaHostRegister(data, size, cudaHostRegisterPortable), "Couldn't pin host memory");
+
+    return 0;
+  }
+
+  void unregister_host(void *data) {
+    CU_CHECK_IGNORE(cudaHostUnregister(data), "Couldn't unpin host memory");
+  }
+
   stream_t make_stream(int flags) {
     cudaStream_t stream;
 
@@ -155,7 +196,45 @@ namespace cuda {
     return (dot(pixel, make_float3(vec_y)) + vec_y.w) * color_matrix->range_y.x + color_matrix->range_y.y;
   }
 
-  __global__ void RGBA_to_NV12(
+  /**
+   * @brief Write a normalized luma or chroma sample, 8 bit for NV12, and 10 bit in the high bits for P010.
+   */
+  template<class T>
+  inline __device__ T quantize(float value, float scale_8bit) {
+    if constexpr (sizeof(T) == 1) {
+      return value * scale_8bit;
+    } else {
+      return (T) (__saturatef(value) * 1023.0f + 0.5f) << 6;
+    }
+  }
+
+  /**
+   * @brief Sample the captured image, with the cursor blended over it if there's one.
+   */
+  template<bool blend_cursor>
+  inline __device__ float3 sample(cudaTextureObject_t srcImage, float x, float y, const cursor_t &cursor) {
+    float3 rgb = bgra_to_rgb(tex2D<float4>(srcImage, x, y));
+
+    if constexpr (blend_cursor) {
+      float cx = x - cursor.x;
+      float cy = y - cursor.y;
+      if (cx >= 0.0f && cy >= 0.0f && cx < cursor.width && cy < cursor.height) {
+        float4 bgra = tex2D<float4>(cursor.texture, cx * cursor.scale_x, cy * cursor.scale_y);
+        rgb = lerp(rgb, bgra_to_rgb(bgra), bgra.w);
+      }
+    }
+
+    return rgb;
+  }
+
+  /**
+   * @brief Scale, blend the cursor and convert to YUV in a single pass, so every pixel is fetched once per frame.
+   * @details Each thread converts a 2x2 block of luma and the chroma sample they share.
+   * @tparam T The type of a sample, std::uint8_t for NV12 and std::uint16_t for P010.
+   * @tparam blend_cursor Whether to blend the cursor over the image.
+   */
+  template<class T, bool blend_cursor>
+  __global__ void RGBA_to_YUV(
     cudaTextureObject_t srcImage,
     std::uint8_t *dstY,
     std::uint8_t *dstUV,
@@ -163,7 +242,8 @@ namespace cuda {
     std::uint32_t dstPitchUV,
     float scale,
     const viewport_t viewport,
-    const cuda_color_t *const color_matrix
+    const cuda_color_t *const color_matrix,
+    const cursor_t cursor
   ) {
     int idX = (threadIdx.x + blockDim.x * blockIdx.x) * 2;
     int idY = (threadIdx.y + blockDim.y * blockIdx.y) * 2;
@@ -181,28 +261,23 @@ namespace cuda {
     idX += viewport.offsetX;
     idY += viewport.offsetY;
 
-    uint8_t *dstY0 = dstY + idX + idY * dstPitchY;
-    uint8_t *dstY1 = dstY + idX + (idY + 1) * dstPitchY;
-    dstUV = dstUV + idX + (idY / 2 * dstPitchUV);
+    T *dstY0 = (T *) (dstY + idY * dstPitchY) + idX;
+    T *dstY1 = (T *) (dstY + (idY + 1) * dstPitchY) + idX;
+    T *dstUVp = (T *) (dstUV + idY / 2 * dstPitchUV) + idX;
 
-    float3 rgb_lt = bgra_to_rgb(tex2D<float4>(srcImage, x, y));
-    float3 rgb_rt = bgra_to_rgb(tex2D<float4>(srcImage, x + scale, y));
-    float3 rgb_lb = bgra_to_rgb(tex2D<float4>(srcImage, x, y + scale));
-    float3 rgb_rb = bgra_to_rgb(tex2D<float4>(srcImage, x + scale, y + scale));
+    float3 rgb_lt = sample<blend_cursor>(srcImage, x, y, cursor);
+    float3 rgb_rt = sample<blend_cursor>(srcImage, x + scale, y, cursor);
+    float3 rgb_lb = sample<blend_cursor>(srcImage, x, y + scale, cursor);
+    float3 rgb_rb = sample<blend_cursor>(srcImage, x + scale, y + scale, cursor);
 
-    float2 uv_lt = calcUV(rgb_lt, color_matrix) * 256.0f;
-    float2 uv_rt = calcUV(rgb_rt, color_matrix) * 256.0f;
-    float2 uv_lb = calcUV(rgb_lb, color_matrix) * 256.0f;
-    float2 uv_rb = calcUV(rgb_rb, color_matrix) * 256.0f;
+    float2 uv = (calcUV(rgb_lt, color_matrix) + calcUV(rgb_lb, color_matrix) + calcUV(rgb_rt, color_matrix) + calcUV(rgb_rb, color_matrix)) * 0.25f;
 
-    float2 uv = (uv_lt + uv_lb + uv_rt + uv_rb) * 0.25f;
-
-    dstUV[0] = uv.x;
-    dstUV[1] = uv.y;
-    dstY0[0] = calcY(rgb_lt, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
-    dstY0[1] = calcY(rgb_rt, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
-    dstY1[0] = calcY(rgb_lb, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
-    dstY1[1] = calcY(rgb_rb, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
+    dstUVp[0] = quantize<T>(uv.x, 256.0f);
+    dstUVp[1] = quantize<T>(uv.y, 256.0f);
+    dstY0[0] = quantize<T>(calcY(rgb_lt, color_matrix), 245.0f);  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
+    dstY0[1] = quantize<T>(calcY(rgb_rt, color_matrix), 245.0f);  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
+    dstY1[0] = quantize<T>(calcY(rgb_lb, color_matrix), 245.0f);  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
+    dstY1[1] = quantize<T>(calcY(rgb_rb, color_matrix), 245.0f);  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
   }
 
   int tex_t::copy(std::uint8_t *src, int height, int pitch) {
@@ -221,6 +296,32 @@ namespace cuda {
     res.resType = cudaResourceTypeArray;
     res.res.array.array = tex.array;
 
+    if (tex.make_texture_objects(res)) {
+      return std::nullopt;
+    }
+
+    return tex;
+  }
+
+  std::optional<tex_t> tex_t::wrap(void *ptr, int width, int height, int pitch) {
+    tex_t tex;
+
+    cudaResourceDesc res {};
+    res.resType = cudaResourceTypePitch2D;
+    res.res.pitch2D.devPtr = ptr;
+    res.res.pitch2D.desc = cudaCreateChannelDesc<uchar4>();
+    res.res.pitch2D.width = width;
+    res.res.pitch2D.height = height;
+    res.res.pitch2D.pitchInBytes = pitch;
+
+    if (tex.make_texture_objects(res)) {
+      return std::nullopt;
+    }
+
+    return tex;
+  }
+
+  int tex_t::make_texture_objects(const cudaResourceDesc &res) {
     cudaTextureDesc desc {};
 
     desc.readMode = cudaReadModeNormalizedFloat;
@@ -229,13 +330,13 @@ namespace cuda {
 
     std::fill_n(std::begin(desc.addressMode), 2, cudaAddressModeClamp);
 
-    CU_CHECK_OPT(cudaCreateTextureObject(&tex.texture.point, &res, &desc, nullptr), "Couldn't create cuda texture that uses point interpolation");
+    CU_CHECK(cudaCreateTextureObject(&texture.point, &res, &desc, nullptr), "Couldn't create cuda texture that uses point interpolation");
 
     desc.filterMode = cudaFilterModeLinear;
 
-    CU_CHECK_OPT(cudaCreateTextureObject(&tex.texture.linear, &res, &desc, nullptr), "Couldn't create cuda texture that uses linear interpolation");
+    CU_CHECK(cudaCreateTextureObject(&texture.linear, &res, &desc, nullptr), "Couldn't create cuda texture that uses linear interpolation");
 
-    return tex;
+    return 0;
   }
 
   tex_t::tex_t():
@@ -317,16 +418,33 @@ namespace cuda {
     return convert(Y, UV, pitchY, pitchUV, texture, stream, viewport);
   }
 
-  int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport) {
+  template<class T, bool blend_cursor>
+  static int launch(const sws_t &sws, std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport, const cursor_t &cursor) {
     int threadsX = viewport.width / 2;
     int threadsY = viewport.height / 2;
 
-    dim3 block(threadsPerBlock);
-    dim3 grid(div_align(threadsX, threadsPerBlock), threadsY);
+    dim3 block(sws.threadsPerBlock);
+    dim3 grid(div_align(threadsX, sws.threadsPerBlock), threadsY);
+
+    RGBA_to_YUV<T, blend_cursor><<<grid, block, 0, stream>>>(texture, Y, UV, pitchY, pitchUV, sws.scale, viewport, (cuda_color_t *) sws.color_matrix.get(), cursor);
+
+    return CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_YUV failed");
+  }
+
+  int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport) {
+    if (p010) {
+      return launch<std::uint16_t, false>(*this, Y, UV, pitchY, pitchUV, texture, stream, viewport, {});
+    }
+
+    return launch<std::uint8_t, false>(*this, Y, UV, pitchY, pitchUV, texture, stream, viewport, {});
+  }
 
-    RGBA_to_NV12<<<grid, block, 0, stream>>>(texture, Y, UV, pitchY, pitchUV, scale, viewport, (cuda_color_t *) color_matrix.get());
+  int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const cursor_t &cursor) {
+    if (p010) {
+      return launch<std::uint16_t, true>(*this, Y, UV, pitchY, pitchUV, texture, stream, viewport, cursor);
+    }
 
-    return CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_NV12 failed");
+    return launch<std::uint8_t, true>(*this, Y, UV, pitchY, pitchUV, texture, stream, viewport, cursor);
   }
 
   void sws_t::apply_colorspace(const video::sunshine_colorspace_t &colorspace) {
@@ -338,4 +456,11 @@ namespace cuda {
     return CU_CHECK_IGNORE(cudaMemcpy2DToArray(array, 0, 0, img.data, img.row_pitch, img.width * img.pixel_pitch, img.height, cudaMemcpyHostToDevice), "Couldn't copy to cuda array");
   }
 
+  int sws_t::load_ram_async(platf::img_t &img, cudaArray_t array, stream_t::pointer stream, event_t::pointer uploaded) {
+    CU_CHECK(cudaMemcpy2DToArrayAsync(array, 0, 0, img.data, img.row_pitch, img.width * img.pixel_pitch, img.height, cudaMemcpyHostToDevice, stream), "Couldn't queue the copy to cuda array");
+    CU_CHECK(cudaEventRecord(uploaded, stream), "Couldn't record cuda event");
+
+    return 0;
+  }
+
 }  // namespace cuda
@@ -6,6 +6,7 @@
 
 #if defined(SUNSHINE_BUILD_CUDA)
   // standard includes
+  #include <cstddef>
   #include <cstdint>
   #include <memory>
   #include <optional>
@@ -42,12 +43,15 @@ namespace cuda {
 }  // namespace cuda
 
 typedef struct cudaArray *cudaArray_t;
+struct cudaResourceDesc;
 
   #if !defined(__CUDACC__)
 typedef struct CUstream_st *cudaStream_t;
+typedef struct CUevent_st *cudaEvent_t;
 typedef unsigned long long cudaTextureObject_t;
   #else /* defined(__CUDACC__) */
 typedef __location__(device_builtin) struct CUstream_st *cudaStream_t;
+typedef __location__(device_builtin) struct CUevent_st *cudaEvent_t;
 typedef __location__(device_builtin) unsigned long long cudaTextureObject_t;
   #endif /* !defined(__CUDACC__) */
 
@@ -63,20 +67,88 @@ namespace cuda {
     void operator()(cudaStream_t ptr);
   };
 
+  class freeCudaEvent_t {
+  public:
+    void operator()(cudaEvent_t ptr);
+  };
+
   using ptr_t = std::unique_ptr<void, freeCudaPtr_t>;
   using stream_t = std::unique_ptr<CUstream_st, freeCudaStream_t>;
+  using event_t = std::unique_ptr<CUevent_st, freeCudaEvent_t>;
 
   stream_t make_stream(int flags = 0);
 
+  /**
+   * @brief Create an event without timing, only meant to order work across streams.
+   */
+  event_t make_event();
+
+  /**
+   * @brief Make all work submitted to a stream from now on wait for the work submitted to another stream so far.
+   * @param event The event to record on the other stream.
+   * @param from The other stream.
+   * @param to The stream to make wait.
+   * @return 0 on success or -1 on failure.
+   */
+  int stream_wait(event_t::pointer event, stream_t::pointer from, stream_t::pointer to);
+
+  /**
+   * @brief Block until the work recorded on an event is done.
+   * @param event The event.
+   * @return 0 on success or -1 on failure.
+   */
+  int event_synchronize(event_t::pointer event);
+
+  /**
+   * @brief Block until the work submitted to a stream so far is done.
+   * @param stream The stream.
+   * @return 0 on success or -1 on failure.
+   */
+  int stream_synchronize(stream_t::pointer stream);
+
+  /**
+   * @brief Pin host memory, so it's copied to the GPU by DMA without a staging copy.
+   * @param data The memory.
+   * @param size The number of bytes.
+   * @return 0 on success or -1 on failure.
+   */
+  int register_host(void *data, std::size_t size);
+
+  /**
+   * @brief Unpin host memory pinned by register_host().
+   * @param data The memory.
+   */
+  void unregister_host(void *data);
+
   struct viewport_t {
     int width, height;
     int offsetX, offsetY;
   };
 
+  /**
+   * @brief A cursor blended over the captured image while it's converted.
+   */
+  struct cursor_t {
+    cudaTextureObject_t texture;  ///< The BGRA pixels of the cursor, which aren't premultiplied.
+    float x, y;  ///< The position in the captured image.
+    float width, height;  ///< The size in the captured image.
+    float scale_x, scale_y;  ///< The pixels of the texture for every pixel of the captured image.
+  };
+
   class tex_t {
   public:
     static std::optional<tex_t> make(int height, int pitch);
 
+    /**
+     * @brief Create textures on pitched device memory holding BGRA pixels, without taking ownership of it.
+     * @param ptr The device memory, aligned for textures.
+     * @param width The width in pixels.
+     * @param height The height in pixels.
+     * @param pitch The size of a row in bytes.
+     * @return The textures, or std::nullopt on failure.
+     */
+    static std::optional<tex_t> wrap(void *ptr, int width, int height, int pitch);
+
     tex_t();
     tex_t(tex_t &&);
 
@@ -92,6 +164,9 @@ namespace cuda {
       cudaTextureObject_t point;
       cudaTextureObject_t linear;
     } texture;
+
+  private:
+    int make_texture_objects(const cudaResourceDesc &res);
   };
 
   class sws_t {
@@ -111,14 +186,32 @@ namespace cuda {
     int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream);
     int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport);
 
+    /**
+     * @brief Convert the loaded image with a cursor blended over it, in the same pass.
+     */
+    int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const cursor_t &cursor);
+
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
 
     int load_ram(platf::img_t &img, cudaArray_t array);
 
+    /**
+     * @brief Queue the upload of an image in pinned host memory.
+     * @param img The image, which must stay unchanged until `uploaded` completed.
+     * @param array The array to upload to.
+     * @param stream The stream to upload on.
+     * @param uploaded The event recorded once the upload is queued.
+     * @return 0 on success or -1 on failure.
+     */
+    int load_ram_async(platf::img_t &img, cudaArray_t array, stream_t::pointer stream, event_t::pointer uploaded);
+
     ptr_t color_matrix;
 
     int threadsPerBlock;
 
+    // Write P010 rather than NV12
+    bool p010 = false;
+
     viewport_t viewport;
 
     float scale;
@@ -0,0 +1,124 @@
+/**
+ * @file src/platform/linux/dbus.cpp
+ * @brief Definitions for the dynamically loaded subset of libdbus-1.
+ */
+// standard includes
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+// local includes
+#include "dbus.h"
+#include "misc.h"
+#include "src/logging.h"
+
+using namespace std::literals;
+
+namespace dbus {
+  threads_init_default_fn threads_init_default;
+  error_init_fn error_init;
+  error_free_fn error_free;
+  error_is_set_fn error_is_set;
+  bus_get_fn bus_get;
+  bus_get_unique_name_fn bus_get_unique_name;
+  bus_add_match_fn bus_add_match;
+  bus_remove_match_fn bus_remove_match;
+  connection_set_exit_on_disconnect_fn connection_set_exit_on_disconnect;
+  connection_send_with_reply_and_block_fn connection_send_with_reply_and_block;
+  connection_read_write_fn connection_read_write;
+  connection_pop_message_fn connection_pop_message;
+  message_new_method_call_fn message_new_method_call;
+  message_append_args_fn message_append_args;
+  message_get_args_fn message_get_args;
+  message_is_signal_fn message_is_signal;
+  message_get_path_fn message_get_path;
+  message_unref_fn message_unref;
+  message_iter_init_fn message_iter_init;
+  message_iter_init_append_fn message_iter_init_append;
+  message_iter_get_arg_type_fn message_iter_get_arg_type;
+  message_iter_get_basic_fn message_iter_get_basic;
+  message_iter_recurse_fn message_iter_recurse;
+  message_iter_next_fn message_iter_next;
+  message_iter_append_basic_fn message_iter_append_basic;
+  message_iter_open_container_fn message_iter_open_container;
+  message_iter_close_container_fn message_iter_close_container;
+
+  int init() {
+    static void *handle {nullptr};
+    static bool funcs_loaded = false;
+
+    if (funcs_loaded) {
+      return 0;
+    }
+
+    if (!handle) {
+      handle = dyn::handle({"libdbus-1.so.3", "libdbus-1.so"});
+      if (!handle) {
+        return -1;
+      }
+    }
+
+    std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+      {(dyn::apiproc *) &threads_init_default, "dbus_threads_init_default"},
+      {(dyn::apiproc *) &error_init, "dbus_error_init"},
+      {(dyn::apiproc *) &error_free, "dbus_error_free"},
+      {(dyn::apiproc *) &error_is_set, "dbus_error_is_set"},
+      {(dyn::apiproc *) &bus_get, "dbus_bus_get"},
+      {(dyn::apiproc *) &bus_get_unique_name, "dbus_bus_get_unique_name"},
+      {(dyn::apiproc *) &bus_add_match, "dbus_bus_add_match"},
+      {(dyn::apiproc *) &bus_remove_match, "dbus_bus_remove_match"},
+      {(dyn::apiproc *) &connection_set_exit_on_disconnect, "dbus_connection_set_exit_on_disconnect"},
+      {(dyn::apiproc *) &connection_send_with_reply_and_block, "dbus_connection_send_with_reply_and_block"},
+      {(dyn::apiproc *) &connection_read_write, "dbus_connection_read_write"},
+      {(dyn::apiproc *) &connection_pop_message, "dbus_connection_pop_message"},
+      {(dyn::apiproc *) &message_new_method_call, "dbus_message_new_method_call"},
+      {(dyn::apiproc *) &message_append_args, "dbus_message_append_args"},
+      {(dyn::apiproc *) &message_get_args, "dbus_message_get_args"},
+      {(dyn::apiproc *) &message_is_signal, "dbus_message_is_signal"},
+      {(dyn::apiproc *) &message_get_path, "dbus_message_get_path"},
+      {(dyn::apiproc *) &message_unref, "dbus_message_unref"},
+      {(dyn::apiproc *) &message_iter_init, "dbus_message_iter_init"},
+      {(dyn::apiproc *) &message_iter_init_append, "dbus_message_iter_init_append"},
+      {(dyn::apiproc *) &message_iter_get_arg_type, "dbus_message_iter_get_arg_type"},
+      {(dyn::apiproc *) &message_iter_get_basic, "dbus_message_iter_get_basic"},
+      {(dyn::apiproc *) &message_iter_recurse, "dbus_message_iter_recurse"},
+      {(dyn::apiproc *) &message_iter_next, "dbus_message_iter_next"},
+      {(dyn::apiproc *) &message_iter_append_basic, "dbus_message_iter_append_basic"},
+      {(dyn::apiproc *) &message_iter_open_container, "dbus_message_iter_open_container"},
+      {(dyn::apiproc *) &message_iter_close_container, "dbus_message_iter_close_container"},
+    };
+
+    if (dyn::load(handle, funcs)) {
+      return -1;
+    }
+
+    funcs_loaded = true;
+    return 0;
+  }
+
+  Connection *connect(int type) {
+    static std::once_flag connect_once[2];
+    static Connection *connections[2] {};
+
+    std::call_once(connect_once[type], [type]() {
+      if (init() || !threads_init_default()) {
+        return;
+      }
+
+      Error error;
+      error_init(&error);
+      auto connection = bus_get(type, &error);
+      if (error_is_set(&error)) {
+        BOOST_LOG(debug) << "Couldn't connect to the "sv << (type == BUS_SYSTEM ? "system"sv : "session"sv) << " bus: "sv << error.message;
+        error_free(&error);
+        return;
+      }
+
+      // Losing the bus mustn't end the stream
+      connection_set_exit_on_disconnect(connection, false);
+      connections[type] = connection;
+    });
+
+    return connections[type];
+  }
+}  // namespace dbus
@@ -0,0 +1,132 @@
+/**
+ * @file src/platform/linux/dbus.h
+ * @brief Declarations for the dynamically loaded subset of libdbus-1.
+ * @note Only the types and functions used to talk to RealtimeKit and the XDG desktop portal are declared.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+
+namespace dbus {
+  typedef std::uint32_t bool_t;
+
+  struct Connection;
+  struct Message;
+
+  /**
+   * @brief The layout of DBusError, which is only ever allocated by its users.
+   */
+  struct Error {
+    const char *name;
+    const char *message;
+    unsigned int dummy;
+    void *padding;
+  };
+
+  /**
+   * @brief The layout of DBusMessageIter, which is only ever allocated by its users.
+   */
+  struct MessageIter {
+    void *dummy1;
+    void *dummy2;
+    std::uint32_t dummy3;
+    int dummy4;
+    int dummy5;
+    int dummy6;
+    int dummy7;
+    int dummy8;
+    int dummy9;
+    int dummy10;
+    int dummy11;
+    int pad1;
+    void *pad2;
+    void *pad3;
+  };
+
+  constexpr int BUS_SESSION = 0;
+  constexpr int BUS_SYSTEM = 1;
+
+  constexpr int TYPE_INVALID = 0;
+  constexpr int TYPE_BOOLEAN = 'b';
+  constexpr int TYPE_UINT32 = 'u';
+  constexpr int TYPE_INT32 = 'i';
+  constexpr int TYPE_UINT64 = 't';
+  constexpr int TYPE_STRING = 's';
+  constexpr int TYPE_OBJECT_PATH = 'o';
+  constexpr int TYPE_UNIX_FD = 'h';
+  constexpr int TYPE_ARRAY = 'a';
+  constexpr int TYPE_VARIANT = 'v';
+  constexpr int TYPE_STRUCT = 'r';
+  constexpr int TYPE_DICT_ENTRY = 'e';
+
+  typedef bool_t (*threads_init_default_fn)();
+  typedef void (*error_init_fn)(Error *);
+  typedef void (*error_free_fn)(Error *);
+  typedef bool_t (*error_is_set_fn)(const Error *);
+  typedef Connection *(*bus_get_fn)(int type, Error *);
+  typedef const char *(*bus_get_unique_name_fn)(Connection *);
+  typedef void (*bus_add_match_fn)(Connection *, const char *rule, Error *);
+  typedef void (*bus_remove_match_fn)(Connection *, const char *rule, Error *);
+  typedef void (*connection_set_exit_on_disconnect_fn)(Connection *, bool_t exit_on_disconnect);
+  typedef Message *(*connection_send_with_reply_and_block_fn)(Connection *, Message *, int timeout_milliseconds, Error *);
+  typedef bool_t (*connection_read_write_fn)(Connection *, int timeout_milliseconds);
+  typedef Message *(*connection_pop_message_fn)(Connection *);
+  typedef Message *(*message_new_method_call_fn)(const char *destination, const char *path, const char *iface, const char *method);
+  typedef bool_t (*message_append_args_fn)(Message *, int first_arg_type, ...);
+  typedef bool_t (*message_get_args_fn)(Message *, Error *, int first_arg_type, ...);
+  typedef bool_t (*message_is_signal_fn)(Message *, const char *iface, const char *signal_name);
+  typedef const char *(*message_get_path_fn)(Message *);
+  typedef void (*message_unref_fn)(Message *);
+  typedef bool_t (*message_iter_init_fn)(Message *, MessageIter *);
+  typedef void (*message_iter_init_append_fn)(Message *, MessageIter *);
+  typedef int (*message_iter_get_arg_type_fn)(MessageIter *);
+  typedef void (*message_iter_get_basic_fn)(MessageIter *, void *value);
+  typedef void (*message_iter_recurse_fn)(MessageIter *, MessageIter *sub);
+  typedef bool_t (*message_iter_next_fn)(MessageIter *);
+  typedef bool_t (*message_iter_append_basic_fn)(MessageIter *, int type, const void *value);
+  typedef bool_t (*message_iter_open_container_fn)(MessageIter *, int type, const char *contained_signature, MessageIter *sub);
+  typedef bool_t (*message_iter_close_container_fn)(MessageIter *, MessageIter *sub);
+
+  extern threads_init_default_fn threads_init_default;
+  extern error_init_fn error_init;
+  extern error_free_fn error_free;
+  extern error_is_set_fn error_is_set;
+  extern bus_get_fn bus_get;
+  extern bus_get_unique_name_fn bus_get_unique_name;
+  extern bus_add_match_fn bus_add_match;
+  extern bus_remove_match_fn bus_remove_match;
+  extern connection_set_exit_on_disconnect_fn connection_set_exit_on_disconnect;
+  extern connection_send_with_reply_and_block_fn connection_send_with_reply_and_block;
+  extern connection_read_write_fn connection_read_write;
+  extern connection_pop_message_fn connection_pop_message;
+  extern message_new_method_call_fn message_new_method_call;
+  extern message_append_args_fn message_append_args;
+  extern message_get_args_fn message_get_args;
+  extern message_is_signal_fn message_is_signal;
+  extern message_get_path_fn message_get_path;
+  extern message_unref_fn message_unref;
+  extern message_iter_init_fn message_iter_init;
+  extern message_iter_init_append_fn message_iter_init_append;
+  extern message_iter_get_arg_type_fn message_iter_get_arg_type;
+  extern message_iter_get_basic_fn message_iter_get_basic;
+  extern message_iter_recurse_fn message_iter_recurse;
+  extern message_iter_next_fn message_iter_next;
+  extern message_iter_append_basic_fn message_iter_append_basic;
+  extern message_iter_open_container_fn message_iter_open_container;
+  extern message_iter_close_container_fn message_iter_close_container;
+
+  /**
+   * @brief Load libdbus-1, on first use.
+   * @return 0 if every function was loaded.
+   */
+  int init();
+
+  /**
+   * @brief Connect to a message bus, shared with the other users of the bus within the process.
+   * @details The process doesn't exit when the bus goes away.
+   * @param type `BUS_SESSION` or `BUS_SYSTEM`.
+   * @return The connection, or nullptr if libdbus-1 or the bus are missing.
+   */
+  Connection *connect(int type);
+}  // namespace dbus
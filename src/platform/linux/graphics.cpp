@@ -3,7 +3,13 @@
  * @brief Definitions for graphics related functions.
  */
 // standard includes
+#include <algorithm>
 #include <fcntl.h>
+#include <fstream>
+#include <functional>
+
+// platform includes
+#include <sys/stat.h>
 
 // local includes
 #include "graphics.h"
@@ -22,6 +28,10 @@ extern "C" {
 #define fourcc_code(a, b, c, d) ((std::uint32_t) (a) | ((std::uint32_t) (b) << 8) | ((std::uint32_t) (c) << 16) | ((std::uint32_t) (d) << 24))
 #define fourcc_mod_code(vendor, val) ((((uint64_t) vendor) << 56) | ((val) & 0x00ffffffffffffffULL))
 #define DRM_FORMAT_MOD_INVALID fourcc_mod_code(0, ((1ULL << 56) - 1))
+#define DRM_FORMAT_XRGB16161616F fourcc_code('X', 'R', '4', 'H')
+#define DRM_FORMAT_ARGB16161616F fourcc_code('A', 'R', '4', 'H')
+#define DRM_FORMAT_XBGR16161616F fourcc_code('X', 'B', '4', 'H')
+#define DRM_FORMAT_ABGR16161616F fourcc_code('A', 'B', '4', 'H')
 
 #if !defined(SUNSHINE_SHADERS_DIR)  // for testing this needs to be defined in cmake as we don't do an install
   #define SUNSHINE_SHADERS_DIR SUNSHINE_ASSETS_DIR "/shaders/opengl"
@@ -183,6 +193,11 @@ namespace gl {
     ctx.AttachShader(program.handle(), vert.handle());
     ctx.AttachShader(program.handle(), frag.handle());
 
+    // Allows the binary to be cached
+    if (ctx.ProgramParameteri) {
+      ctx.ProgramParameteri(program.handle(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
     // p_handle stores a copy of the program handle, since program will be moved before
     // the fail guard function is called.
     auto fg = util::fail_guard([p_handle = program.handle(), &vert, &frag]() {
@@ -202,6 +217,75 @@ namespace gl {
     return program;
   }
 
+  util::Either<program_t, std::string> program_t::link(const shader_t &comp) {
+    program_t program;
+
+    program._program.el = ctx.CreateProgram();
+
+    ctx.AttachShader(program.handle(), comp.handle());
+
+    // Allows the binary to be cached
+    if (ctx.ProgramParameteri) {
+      ctx.ProgramParameteri(program.handle(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    auto fg = util::fail_guard([p_handle = program.handle(), &comp]() {
+      ctx.DetachShader(p_handle, comp.handle());
+    });
+
+    ctx.LinkProgram(program.handle());
+
+    int status = 0;
+    ctx.GetProgramiv(program.handle(), GL_LINK_STATUS, &status);
+
+    if (!status) {
+      return program.err_str();
+    }
+
+    return program;
+  }
+
+  util::Either<program_t, std::string> program_t::load(GLenum format, const std::string_view &binary) {
+    program_t program;
+
+    program._program.el = ctx.CreateProgram();
+    ctx.ProgramBinary(program.handle(), format, binary.data(), binary.size());
+
+    int status = 0;
+    ctx.GetProgramiv(program.handle(), GL_LINK_STATUS, &status);
+
+    if (!status) {
+      return program.err_str();
+    }
+
+    return program;
+  }
+
+  std::optional<std::pair<GLenum, std::string>> program_t::binary() const {
+    if (!ctx.GetProgramBinary) {
+      return std::nullopt;
+    }
+
+    GLint length = 0;
+    ctx.GetProgramiv(handle(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+      return std::nullopt;
+    }
+
+    std::string binary;
+    binary.resize(length);
+
+    GLenum format;
+    ctx.GetProgramBinary(handle(), length, &length, &format, binary.data());
+    if (length <= 0) {
+      return std::nullopt;
+    }
+
+    binary.resize(length);
+
+    return std::make_pair(format, std::move(binary));
+  }
+
   void program_t::bind(const buffer_t &buffer) {
     ctx.UseProgram(handle());
     auto i = ctx.GetUniformBlockIndex(handle(), buffer.block());
@@ -261,6 +345,104 @@ namespace gl {
     return _program.el;
   }
 
+  program_cache_t::program_cache_t(std::filesystem::path dir):
+      _dir {std::move(dir)} {
+  }
+
+  std::optional<program_t> program_cache_t::load(const std::string_view &vert, const std::string_view &frag) {
+    if (!ctx.ProgramBinary) {
+      return std::nullopt;
+    }
+
+    auto name = key(vert, frag);
+
+    std::lock_guard lg {_lock};
+
+    auto it = _binaries.find(name);
+    if (it == std::end(_binaries)) {
+      std::ifstream in {_dir / name, std::ios::binary};
+
+      GLenum format;
+      if (!in.read((char *) &format, sizeof(format))) {
+        return std::nullopt;
+      }
+
+      std::string binary {std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {}};
+      it = _binaries.emplace(name, std::make_pair(format, std::move(binary))).first;
+    }
+
+    auto program = program_t::load(it->second.first, it->second.second);
+    if (program.has_right()) {
+      BOOST_LOG(info) << "GL: the driver rejected a cached program, linking it again: "sv << program.right();
+
+      std::error_code ec;
+      std::filesystem::remove(_dir / name, ec);
+      _binaries.erase(it);
+
+      return std::nullopt;
+    }
+
+    return std::move(program.left());
+  }
+
+  void program_cache_t::store(const program_t &program, const std::string_view &vert, const std::string_view &frag) {
+    auto binary = program.binary();
+    if (!binary) {
+      return;
+    }
+
+    auto name = key(vert, frag);
+
+    std::lock_guard lg {_lock};
+
+    std::error_code ec;
+    std::filesystem::create_directories(_dir, ec);
+
+    // Write to a temporary file first, so a crash never leaves a truncated binary behind
+    auto file = _dir / name;
+    auto tmp_file = file;
+    tmp_file += ".tmp";
+
+    {
+      std::ofstream out {tmp_file, std::ios::binary};
+      out.write((const char *) &binary->first, sizeof(binary->first));
+      out.write(binary->second.data(), binary->second.size());
+
+      if (!out) {
+        BOOST_LOG(warning) << "Couldn't write "sv << tmp_file.string();
+        return;
+      }
+    }
+
+    std::filesystem::rename(tmp_file, file, ec);
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't write "sv << file.string() << ": "sv << ec.message();
+      return;
+    }
+
+    _binaries.insert_or_assign(std::move(name), std::move(*binary));
+  }
+
+  std::string program_cache_t::key(const std::string_view &vert, const std::string_view &frag) const {
+    std::string data;
+    for (auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      auto value = (const char *) ctx.GetString(name);
+      data += value ? value : "";
+      data += '\n';
+    }
+
+    data += vert;
+    data += '\n';
+    data += frag;
+
+    return std::string {util::hex(std::hash<std::string> {}(data)).to_string_view()} + ".bin";
+  }
+
+  program_cache_t &program_cache() {
+    static program_cache_t cache {platf::appdata() / "shader_cache"};
+    return cache;
+  }
+
 }  // namespace gl
 
 namespace gbm {
@@ -392,6 +574,33 @@ namespace egl {
     return display;
   }
 
+  std::vector<std::uint64_t> query_modifiers(display_t::pointer display, std::uint32_t fourcc) {
+    // Part of EGL_EXT_image_dma_buf_import_modifiers, which make_display() requires
+    typedef EGLBoolean (*query_dmabuf_modifiers_fn)(EGLDisplay, EGLint format, EGLint max_modifiers, std::uint64_t *modifiers, EGLBoolean *external_only, EGLint *num_modifiers);
+    static auto query_dmabuf_modifiers = (query_dmabuf_modifiers_fn) eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+
+    EGLint count = 0;
+    if (!query_dmabuf_modifiers || !query_dmabuf_modifiers(display, (EGLint) fourcc, 0, nullptr, nullptr, &count) || count <= 0) {
+      return {};
+    }
+
+    std::vector<std::uint64_t> modifiers(count);
+    std::vector<EGLBoolean> external_only(count);
+    if (!query_dmabuf_modifiers(display, (EGLint) fourcc, count, modifiers.data(), external_only.data(), &count)) {
+      return {};
+    }
+    modifiers.resize(count);
+
+    // Those can only be sampled through GL_TEXTURE_EXTERNAL_OES, while the shaders use GL_TEXTURE_2D
+    for (auto x = count; x-- > 0;) {
+      if (external_only[x]) {
+        modifiers.erase(std::begin(modifiers) + x);
+      }
+    }
+
+    return modifiers;
+  }
+
   std::optional<ctx_t> make_ctx(display_t::pointer display) {
     constexpr int conf_attr[] {
       EGL_RENDERABLE_TYPE,
@@ -559,6 +768,87 @@ namespace egl {
     return rgb;
   }
 
+  std::optional<buffer_key_t> buffer_key_t::make(const surface_descriptor_t &sd) {
+    buffer_key_t key {};
+    key.width = sd.width;
+    key.height = sd.height;
+    key.fourcc = sd.fourcc;
+    key.modifier = sd.modifier;
+
+    for (int x = 0; x < 4; ++x) {
+      if (sd.fds[x] < 0) {
+        continue;
+      }
+
+      struct stat st;
+      if (fstat(sd.fds[x], &st)) {
+        return std::nullopt;
+      }
+
+      key.dev = st.st_dev;
+      key.inodes[x] = st.st_ino;
+      key.pitches[x] = sd.pitches[x];
+      key.offsets[x] = sd.offsets[x];
+    }
+
+    return key;
+  }
+
+  rgb_t *rgb_cache_t::import(display_t::pointer egl_display, const surface_descriptor_t &xrgb, bool recycled) {
+    std::optional<buffer_key_t> key;
+    if (recycled) {
+      key = buffer_key_t::make(xrgb);
+    }
+
+    if (!key) {
+      clear();
+    } else {
+      auto it = std::find_if(std::begin(entries), std::end(entries), [&](const entry_t &entry) {
+        return entry.key == *key;
+      });
+
+      if (it != std::end(entries)) {
+        std::rotate(std::begin(entries), it, it + 1);
+        return &entries.front().rgb;
+      }
+    }
+
+    auto rgb_opt = import_source(egl_display, xrgb);
+    if (!rgb_opt) {
+      return nullptr;
+    }
+
+    if (entries.size() >= capacity) {
+      entries.pop_back();
+    }
+
+    // Buffers that can't be identified or aren't reused are only kept for a single frame
+    entries.insert(std::begin(entries), entry_t {key.value_or(buffer_key_t {}), std::move(*rgb_opt)});
+    return &entries.front().rgb;
+  }
+
+  void rgb_cache_t::clear() {
+    entries.clear();
+  }
+
+  void overlay_cache_t::import(display_t::pointer egl_display, const std::vector<overlay_t> &overlays, bool recycled) {
+    // Overlays keep their place in the stack while a game runs, so each place gets the cache of its buffers
+    if (caches.size() < overlays.size()) {
+      caches.resize(overlays.size());
+    }
+
+    textures.resize(overlays.size());
+    for (std::size_t x = 0; x < overlays.size(); ++x) {
+      auto rgb = caches[x].import(egl_display, overlays[x].sd, recycled);
+      textures[x] = rgb ? (*rgb)->tex[0] : 0;
+    }
+  }
+
+  void overlay_cache_t::clear() {
+    textures.clear();
+    caches.clear();
+  }
+
   /**
    * @brief Create a black RGB texture of the specified image size.
    * @param img The image to use for texture sizing.
@@ -712,6 +1002,70 @@ namespace egl {
 
     program[0].bind(color_matrix);
     program[1].bind(color_matrix);
+    if (nv12_program) {
+      nv12_program->bind(color_matrix);
+    }
+  }
+
+  void sws_t::apply_tone_mapping(const platf::encode_device_t::tone_mapping_t &tone_mapping) {
+    float tone_map[] {tone_mapping.sdr_white_nits, tone_mapping.peak_nits};
+
+    GLuint handles[] {
+      program[0].handle(),
+      program[1].handle(),
+      nv12_program ? nv12_program->handle() : 0,
+    };
+
+    for (auto handle : handles) {
+      if (!handle) {
+        continue;
+      }
+
+      auto loc_tone_map = gl::ctx.GetUniformLocation(handle, "tone_map");
+      if (loc_tone_map < 0) {
+        BOOST_LOG(warning) << "Couldn't find uniform [tone_map]"sv;
+        continue;
+      }
+
+      gl::ctx.UseProgram(handle);
+      gl::ctx.Uniform2fv(loc_tone_map, 1, tone_map);
+    }
+  }
+
+  /**
+   * @brief Load the program converting an image into both planes of a frame at once.
+   * @return The program, or `std::nullopt` if the driver can't run it.
+   */
+  static std::optional<gl::program_t> make_nv12_program() {
+    if (!gl::ctx.VERSION_4_3 || !gl::ctx.DispatchCompute || !gl::ctx.BindImageTexture) {
+      return std::nullopt;
+    }
+
+    auto source = file_handler::read_file(SUNSHINE_SHADERS_DIR "/ConvertNV12.comp");
+
+    auto &cache = gl::program_cache();
+    if (auto program = cache.load(source, {})) {
+      gl_drain_errors;
+      return program;
+    }
+    gl_drain_errors;
+
+    auto shader = gl::shader_t::compile(source, GL_COMPUTE_SHADER);
+    if (shader.has_right()) {
+      BOOST_LOG(info) << "ConvertNV12.comp: "sv << shader.right();
+      return std::nullopt;
+    }
+
+    auto program = gl::program_t::link(shader.left());
+    if (program.has_right()) {
+      BOOST_LOG(info) << "GL linker: "sv << program.right();
+      return std::nullopt;
+    }
+
+    cache.store(program.left(), source, {});
+    gl_drain_errors;
+
+    return std::move(program.left());
   }
 
   std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, gl::tex_t &&tex) {
@@ -740,7 +1094,7 @@ namespace egl {
     auto width_i = 1.0f / sws.out_width;
 
     {
-      const char *sources[] {
+      const char *files[] {
         SUNSHINE_SHADERS_DIR "/ConvertUV.frag",
         SUNSHINE_SHADERS_DIR "/ConvertUV.vert",
         SUNSHINE_SHADERS_DIR "/ConvertY.frag",
@@ -753,53 +1107,74 @@ namespace egl {
         GL_VERTEX_SHADER,
       };
 
-      constexpr auto count = sizeof(sources) / sizeof(const char *);
-
-      util::Either<gl::shader_t, std::string> compiled_sources[count];
+      constexpr auto count = sizeof(files) / sizeof(const char *);
 
-      bool error_flag = false;
+      std::string sources[count];
       for (int x = 0; x < count; ++x) {
-        auto &compiled_source = compiled_sources[x];
+        sources[x] = file_handler::read_file(files[x]);
+      }
+
+      // The vertex and fragment shader of the Y, UV and cursor programs
+      constexpr std::pair<int, int> program_sources[] {
+        {3, 2},
+        {1, 0},
+        {3, 4},
+      };
 
-        compiled_source = gl::shader_t::compile(file_handler::read_file(sources[x]), shader_type[x % 2]);
+      auto &cache = gl::program_cache();
+
+      bool cached[3] {};
+      for (int x = 0; x < 3; ++x) {
+        auto [vert, frag] = program_sources[x];
+
+        auto program = cache.load(sources[vert], sources[frag]);
         gl_drain_errors;
 
-        if (compiled_source.has_right()) {
-          BOOST_LOG(error) << sources[x] << ": "sv << compiled_source.right();
-          error_flag = true;
+        if (program) {
+          sws.program[x] = std::move(*program);
+          cached[x] = true;
         }
       }
 
-      if (error_flag) {
-        return std::nullopt;
-      }
+      if (!cached[0] || !cached[1] || !cached[2]) {
+        util::Either<gl::shader_t, std::string> compiled_sources[count];
 
-      auto program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[4].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
+        bool error_flag = false;
+        for (int x = 0; x < count; ++x) {
+          auto &compiled_source = compiled_sources[x];
 
-      // Cursor - shader
-      sws.program[2] = std::move(program.left());
+          compiled_source = gl::shader_t::compile(sources[x], shader_type[x % 2]);
+          gl_drain_errors;
 
-      program = gl::program_t::link(compiled_sources[1].left(), compiled_sources[0].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
+          if (compiled_source.has_right()) {
+            BOOST_LOG(error) << files[x] << ": "sv << compiled_source.right();
+            error_flag = true;
+          }
+        }
 
-      // UV - shader
-      sws.program[1] = std::move(program.left());
+        if (error_flag) {
+          return std::nullopt;
+        }
 
-      program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[2].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
+        for (int x = 0; x < 3; ++x) {
+          if (cached[x]) {
+            continue;
+          }
 
-      // Y - shader
-      sws.program[0] = std::move(program.left());
+          auto [vert, frag] = program_sources[x];
+
+          auto program = gl::program_t::link(compiled_sources[vert].left(), compiled_sources[frag].left());
+          if (program.has_right()) {
+            BOOST_LOG(error) << "GL linker: "sv << program.right();
+            return std::nullopt;
+          }
+
+          cache.store(program.left(), sources[vert], sources[frag]);
+          gl_drain_errors;
+
+          sws.program[x] = std::move(program.left());
+        }
+      }
     }
 
     auto loc_width_i = gl::ctx.GetUniformLocation(sws.program[1].handle(), "width_i");
@@ -835,6 +1210,19 @@ namespace egl {
     sws.program[0].bind(sws.color_matrix);
     sws.program[1].bind(sws.color_matrix);
 
+    sws.nv12_program = make_nv12_program();
+    if (sws.nv12_program) {
+      sws.loc_offset = gl::ctx.GetUniformLocation(sws.nv12_program->handle(), "offset");
+      sws.loc_size = gl::ctx.GetUniformLocation(sws.nv12_program->handle(), "size");
+
+      if (sws.loc_offset < 0 || sws.loc_size < 0) {
+        BOOST_LOG(warning) << "Couldn't find uniforms of ConvertNV12.comp, converting in two passes"sv;
+        sws.nv12_program.reset();
+      } else {
+        sws.nv12_program->bind(sws.color_matrix);
+      }
+    }
+
     gl::ctx.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     gl_drain_errors;
@@ -887,7 +1275,45 @@ namespace egl {
     gl::ctx.BindTexture(GL_TEXTURE_2D, tex[0]);
     gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, gl_format, in_width, in_height);
 
-    return make(in_width, in_height, out_width, out_height, std::move(tex));
+    auto sws = make(in_width, in_height, out_width, out_height, std::move(tex));
+    if (sws) {
+      sws->target_format = gl_format;
+      sws->intermediate_format = gl_format;
+    }
+
+    return sws;
+  }
+
+  /**
+   * @brief Check whether a DRM format holds half floats.
+   * @param fourcc The DRM format.
+   */
+  static bool is_fp16_format(std::uint32_t fourcc) {
+    return fourcc == DRM_FORMAT_XRGB16161616F || fourcc == DRM_FORMAT_ARGB16161616F ||
+           fourcc == DRM_FORMAT_XBGR16161616F || fourcc == DRM_FORMAT_ABGR16161616F;
+  }
+
+  void sws_t::match_intermediate_format(std::uint32_t fourcc) {
+    if (!target_format) {
+      return;
+    }
+
+    // Floating point scanouts can't be copied into a fixed point texture, and would lose their precision
+    auto format = is_fp16_format(fourcc) ? GL_RGBA16F : target_format;
+    if (format == intermediate_format) {
+      return;
+    }
+
+    auto new_tex = gl::tex_t::make(1);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, new_tex[0]);
+    gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, format, in_width, in_height);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+    // The old texture is deleted along with new_tex
+    std::swap(tex[0], new_tex[0]);
+    cursor_framebuffer.bind(&tex[0], &tex[1]);
+
+    intermediate_format = format;
   }
 
   void sws_t::load_ram(platf::img_t &img) {
@@ -897,7 +1323,9 @@ namespace egl {
     gl::ctx.TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img.width, img.height, GL_BGRA, GL_UNSIGNED_BYTE, img.data);
   }
 
-  void sws_t::load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture) {
+  void sws_t::load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture, const std::vector<int> &overlay_textures) {
+    match_intermediate_format(img.sd.fourcc);
+
     // When only a sub-part of the image must be encoded...
     const bool copy = offset_x || offset_y || img.sd.width != in_width || img.sd.height != in_height;
     if (copy) {
@@ -910,23 +1338,68 @@ namespace egl {
       loaded_texture = texture;
     }
 
-    if (img.data) {
+    const bool overlays = std::any_of(std::begin(overlay_textures), std::end(overlay_textures), [](int overlay_texture) {
+      return overlay_texture != 0;
+    });
+
+    // Overlays and the cursor are drawn onto the monitor image, so it has to be a copy
+    if ((overlays || img.data) && !copy) {
       GLenum attachment = GL_COLOR_ATTACHMENT0;
 
       gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, cursor_framebuffer[0]);
       gl::ctx.UseProgram(program[2].handle());
 
-      // When a copy has already been made...
-      if (!copy) {
-        gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
-        gl::ctx.DrawBuffers(1, &attachment);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
+      gl::ctx.DrawBuffers(1, &attachment);
+
+      gl::ctx.Viewport(0, 0, in_width, in_height);
+      gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
+
+      loaded_texture = tex[0];
+    }
 
-        gl::ctx.Viewport(0, 0, in_width, in_height);
-        gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
+    if (overlays) {
+      // Each overlay is cropped and scaled into place in a single blit
+      auto framebuf = gl::frame_buf_t::make(1);
+      GLenum attachment = GL_COLOR_ATTACHMENT0;
 
-        loaded_texture = tex[0];
+      for (std::size_t x = 0; x < overlay_textures.size() && x < img.overlays.size(); ++x) {
+        if (!overlay_textures[x]) {
+          continue;
+        }
+
+        auto &overlay = img.overlays[x];
+
+        framebuf.bind(&overlay_textures[x], &overlay_textures[x] + 1);
+        gl::ctx.ReadBuffer(GL_COLOR_ATTACHMENT0);
+
+        gl::ctx.BindFramebuffer(GL_DRAW_FRAMEBUFFER, cursor_framebuffer[0]);
+        gl::ctx.DrawBuffers(1, &attachment);
+
+        gl::ctx.BlitFramebuffer(
+          overlay.src_x,
+          overlay.src_y,
+          overlay.src_x + overlay.src_w,
+          overlay.src_y + overlay.src_h,
+          overlay.dst_x,
+          overlay.dst_y,
+          overlay.dst_x + overlay.dst_w,
+          overlay.dst_y + overlay.dst_h,
+          GL_COLOR_BUFFER_BIT,
+          GL_LINEAR
+        );
       }
 
+      gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    if (img.data) {
+      GLenum attachment = GL_COLOR_ATTACHMENT0;
+
+      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, cursor_framebuffer[0]);
+      gl::ctx.UseProgram(program[2].handle());
+
       gl::ctx.BindTexture(GL_TEXTURE_2D, tex[1]);
       if (serial != img.serial) {
         serial = img.serial;
@@ -956,7 +1429,71 @@ namespace egl {
     }
   }
 
+  /**
+   * @brief Get the texture attached to a framebuffer, and its format as an image.
+   * @return The texture and the format, or `std::nullopt` if it can't be written as an image.
+   */
+  static std::optional<std::pair<GLuint, GLenum>> attached_image(GLuint framebuffer, GLenum attachment) {
+    GLint texture = 0;
+    gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    gl::ctx.GetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &texture);
+    gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!texture) {
+      return std::nullopt;
+    }
+
+    GLint format = 0;
+    gl::ctx.BindTexture(GL_TEXTURE_2D, texture);
+    gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+
+    switch (format) {
+      case GL_R8:
+      case GL_RG8:
+      case GL_R16:
+      case GL_RG16:
+        return std::make_pair((GLuint) texture, (GLenum) format);
+      default:
+        return std::nullopt;
+    }
+  }
+
+  bool sws_t::convert_single_pass(gl::frame_buf_t &fb) {
+    auto y = attached_image(fb[0], GL_COLOR_ATTACHMENT0);
+    auto uv = attached_image(fb[1], GL_COLOR_ATTACHMENT1);
+    if (!y || !uv) {
+      return false;
+    }
+
+    gl::ctx.BindImageTexture(0, y->first, 0, GL_FALSE, 0, GL_WRITE_ONLY, y->second);
+    gl::ctx.BindImageTexture(1, uv->first, 0, GL_FALSE, 0, GL_WRITE_ONLY, uv->second);
+
+    gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
+
+    gl::ctx.UseProgram(nv12_program->handle());
+    gl::ctx.Uniform2i(loc_offset, offsetX, offsetY);
+    gl::ctx.Uniform2i(loc_size, out_width, out_height);
+
+    // An invocation per 2x2 block, in groups of 8x8
+    gl::ctx.DispatchCompute((out_width + 15) / 16, (out_height + 15) / 16, 1);
+
+    // The planes are read as textures or by the encoder from here on
+    gl::ctx.MemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+    gl::ctx.BindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, y->second);
+    gl::ctx.BindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, uv->second);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+    gl::ctx.Flush();
+
+    return true;
+  }
+
   int sws_t::convert(gl::frame_buf_t &fb) {
+    if (nv12_program && convert_single_pass(fb)) {
+      return 0;
+    }
+
     gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
 
     GLenum attachments[] {
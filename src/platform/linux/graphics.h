@@ -5,8 +5,16 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <filesystem>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <string_view>
+#include <vector>
+
+// platform includes
+#include <sys/types.h>
 
 // lib includes
 #include <glad/egl.h>
@@ -154,6 +162,27 @@ namespace gl {
 
     static util::Either<program_t, std::string> link(const shader_t &vert, const shader_t &frag);
 
+    /**
+     * @brief Link a compute program.
+     * @param comp The compute shader.
+     * @return The program, or the error of the linker.
+     */
+    static util::Either<program_t, std::string> link(const shader_t &comp);
+
+    /**
+     * @brief Create a program from a binary retrieved with `binary()`.
+     * @param format The format of the binary.
+     * @param binary The binary.
+     * @return The program, or the error if the driver rejected the binary.
+     */
+    static util::Either<program_t, std::string> load(GLenum format, const std::string_view &binary);
+
+    /**
+     * @brief Retrieve the binary of the linked program.
+     * @return The format and the binary, or `std::nullopt` if the driver can't provide it.
+     */
+    std::optional<std::pair<GLenum, std::string>> binary() const;
+
     void bind(const buffer_t &buffer);
 
     std::optional<buffer_t> uniform(const char *block, std::pair<const char *, std::string_view> *members, std::size_t count);
@@ -163,6 +192,46 @@ namespace gl {
   private:
     program_internal_t _program;
   };
+
+  /**
+   * @brief Persistent cache of linked program binaries, so displays and sessions don't compile the shaders again.
+   * @details Binaries are tied to the vendor, renderer and version of the current driver, and to the sources
+   *          of the shaders. Drivers may still reject a binary, in which case the program is linked again.
+   *          All methods are thread-safe, but must be called with a current context.
+   */
+  class program_cache_t {
+  public:
+    explicit program_cache_t(std::filesystem::path dir);
+
+    /**
+     * @brief Load the cached program linked from the shader sources.
+     * @param vert The source of the vertex shader.
+     * @param frag The source of the fragment shader.
+     * @return The program, or `std::nullopt` if it has to be linked.
+     */
+    std::optional<program_t> load(const std::string_view &vert, const std::string_view &frag);
+
+    /**
+     * @brief Cache a program linked from the shader sources and write it to disk.
+     * @param program The program.
+     * @param vert The source of the vertex shader.
+     * @param frag The source of the fragment shader.
+     */
+    void store(const program_t &program, const std::string_view &vert, const std::string_view &frag);
+
+  private:
+    std::string key(const std::string_view &vert, const std::string_view &frag) const;
+
+    std::filesystem::path _dir;
+
+    std::mutex _lock;
+    std::map<std::string, std::pair<GLenum, std::string>> _binaries;
+  };
+
+  /**
+   * @brief Get the program binary cache of the process.
+   */
+  program_cache_t &program_cache();
 }  // namespace gl
 
 namespace gbm {
@@ -240,6 +309,14 @@ namespace egl {
   display_t make_display(std::variant<gbm::gbm_t::pointer, wl_display *, _XDisplay *> native_display);
   std::optional<ctx_t> make_ctx(display_t::pointer display);
 
+  /**
+   * @brief Get the modifiers of the dmabufs of a format the display can import as a texture.
+   * @param display The display to import the dmabufs with.
+   * @param fourcc The DRM format of the dmabufs.
+   * @return The modifiers, in the order of preference of the driver, empty if the format can't be imported.
+   */
+  std::vector<std::uint64_t> query_modifiers(display_t::pointer display, std::uint32_t fourcc);
+
   std::optional<rgb_t>
     import_source(
       display_t::pointer egl_display,
@@ -248,6 +325,97 @@ namespace egl {
 
   rgb_t create_blank(platf::img_t &img);
 
+  /**
+   * @brief Identifies a dmabuf by the inodes of its planes, which are unique per buffer, along with its layout.
+   * @details Inodes can only be reused once the buffer is gone, so anything holding on to an
+   *          import of the buffer keeps its key valid.
+   */
+  struct buffer_key_t {
+    dev_t dev;
+    std::array<ino_t, 4> inodes;
+    int width;
+    int height;
+    std::uint32_t fourcc;
+    std::uint64_t modifier;
+    std::array<std::uint32_t, 4> pitches;
+    std::array<std::uint32_t, 4> offsets;
+
+    bool operator==(const buffer_key_t &) const = default;
+
+    /**
+     * @brief Get the key of a dmabuf.
+     * @param sd The dmabuf.
+     * @return The key, or std::nullopt if a plane couldn't be identified.
+     */
+    static std::optional<buffer_key_t> make(const surface_descriptor_t &sd);
+  };
+
+  /**
+   * @brief Least recently used cache of imported RGB dmabufs.
+   * @details Compositors and KMS cycle through a few scanout buffers, so once each of them was
+   *          imported, capturing another frame doesn't need to create any EGL image at all.
+   */
+  class rgb_cache_t {
+  public:
+    static constexpr std::size_t capacity = 4;
+
+    /**
+     * @brief Get the texture of a dmabuf, importing the dmabuf if it isn't cached.
+     * @param egl_display The display to import the dmabuf with.
+     * @param xrgb The dmabuf.
+     * @param recycled Whether the source reuses its buffers, otherwise nothing is kept past the next call.
+     * @return The imported image, valid until the next call, or nullptr if the import failed.
+     */
+    rgb_t *import(display_t::pointer egl_display, const surface_descriptor_t &xrgb, bool recycled = true);
+
+    void clear();
+
+  private:
+    struct entry_t {
+      buffer_key_t key;
+      rgb_t rgb;
+    };
+
+    // Most recently used first
+    std::vector<entry_t> entries;
+  };
+
+  /**
+   * @brief A plane scanned out on top of the captured one, like the one a compositor hands a fullscreen game.
+   */
+  struct overlay_t {
+    surface_descriptor_t sd;
+
+    // The part of the dmabuf that's scanned out
+    int src_x, src_y, src_w, src_h;
+
+    // Where it's scanned out, in the coordinates of the captured image
+    int dst_x, dst_y, dst_w, dst_h;
+  };
+
+  /**
+   * @brief Imports the overlays of captured images, with a cache of its own for each of them.
+   */
+  class overlay_cache_t {
+  public:
+    /**
+     * @brief Import the overlays of a captured image into textures.
+     * @details Overlays that can't be imported get texture 0, so they're left out rather than failing the frame.
+     * @param egl_display The display to import the dmabufs with.
+     * @param overlays The overlays, bottom to top.
+     * @param recycled Whether the source reuses its buffers.
+     */
+    void import(display_t::pointer egl_display, const std::vector<overlay_t> &overlays, bool recycled);
+
+    void clear();
+
+    // The texture of each overlay, valid until the next call
+    std::vector<int> textures;
+
+  private:
+    std::vector<rgb_cache_t> caches;
+  };
+
   std::optional<nv12_t> import_target(
     display_t::pointer egl_display,
     std::array<file_t, nv12_img_t::num_fds> &&fds,
@@ -282,19 +450,35 @@ namespace egl {
     }
 
     void reset() {
-      for (auto x = 0; x < 4; ++x) {
-        if (sd.fds[x] >= 0) {
-          close(sd.fds[x]);
+      close_fds(sd);
 
-          sd.fds[x] = -1;
-        }
+      for (auto &overlay : overlays) {
+        close_fds(overlay.sd);
       }
+      overlays.clear();
     }
 
     surface_descriptor_t sd;
 
+    // Blended over the image from bottom to top, before the cursor
+    std::vector<overlay_t> overlays;
+
     // Increment sequence when new rgb_t needs to be created
     std::uint64_t sequence;
+
+    // Whether the dmabuf is one of a few buffers the source cycles through
+    bool recycled = false;
+
+  private:
+    static void close_fds(surface_descriptor_t &sd) {
+      for (auto x = 0; x < 4; ++x) {
+        if (sd.fds[x] >= 0) {
+          close(sd.fds[x]);
+
+          sd.fds[x] = -1;
+        }
+      }
+    }
   };
 
   class sws_t {
@@ -308,11 +492,32 @@ namespace egl {
     // Make an area of the image black
     int blank(gl::frame_buf_t &fb, int offsetX, int offsetY, int width, int height);
 
+    /**
+     * @brief Convert the loaded image into both planes with a single compute dispatch.
+     * @details Each pixel of the image is sampled once for the Y and the UV plane, instead of once per plane.
+     * @param fb The framebuffers of the Y and UV planes.
+     * @return Whether the image was converted, if not the planes can't be written as images.
+     */
+    bool convert_single_pass(gl::frame_buf_t &fb);
+
     void load_ram(platf::img_t &img);
-    void load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture);
+    void load_vram(img_descriptor_t &img, int offset_x, int offset_y, int texture, const std::vector<int> &overlay_textures = {});
 
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
 
+    /**
+     * @brief Tone map PQ images of an HDR display to SDR, or stop doing so.
+     * @param tone_mapping The luminance range to map, all 0 to stop.
+     */
+    void apply_tone_mapping(const platf::encode_device_t::tone_mapping_t &tone_mapping);
+
+    /**
+     * @brief Make the texture the monitor image is copied into and the cursor blended onto match the captured format.
+     * @details Half float scanouts of HDR desktops get a half float texture, anything else one of the target depth.
+     * @param fourcc The DRM format of the captured image.
+     */
+    void match_intermediate_format(std::uint32_t fourcc);
+
     // The first texture is the monitor image.
     // The second texture is the cursor image
     gl::tex_t tex;
@@ -323,6 +528,10 @@ namespace egl {
 
     // Y - shader, UV - shader, Cursor - shader
     gl::program_t program[3];
+
+    // Writes both planes in a single pass when the driver supports compute shaders
+    std::optional<gl::program_t> nv12_program;
+    GLint loc_offset, loc_size;
     gl::buffer_t color_matrix;
 
     int out_width, out_height;
@@ -334,6 +543,10 @@ namespace egl {
 
     // Store latest cursor for load_vram
     std::uint64_t serial;
+
+    // The format for the depth of the target frame, and the one of the monitor image texture, 0 if not owned by sws_t
+    GLint target_format = 0;
+    GLint intermediate_format = 0;
   };
 
   bool fail();
@@ -22,7 +22,10 @@ using namespace std::literals;
 namespace platf {
 
   input_t input() {
-    return {new input_raw_t()};
+    auto raw = new input_raw_t();
+    gamepad::fill_pool(raw);
+
+    return {raw};
   }
 
   std::unique_ptr<client_input_t> allocate_client_input_context(input_t &input) {
@@ -69,6 +72,13 @@ namespace platf {
     platf::keyboard::unicode(raw, utf8, size);
   }
 
+  void begin_input_batch(input_t &input) {
+    // Input is sent as soon as it's generated
+  }
+
+  void end_input_batch(input_t &input) {
+  }
+
   void touch_update(client_input_t *input, const touch_port_t &touch_port, const touch_input_t &touch) {
     auto raw = (client_input_raw_t *) input;
     platf::touch::update(raw, touch_port, touch);
@@ -4,6 +4,10 @@
  */
 #pragma once
 
+// standard includes
+#include <array>
+#include <mutex>
+
 // lib includes
 #include <boost/locale.hpp>
 #include <inputtino/input.hpp>
@@ -25,6 +29,19 @@ namespace platf {
     std::unique_ptr<joypads_t> joypad;
     gamepad_feedback_msg_t last_rumble;
     gamepad_feedback_msg_t last_rgb_led;
+
+    // Every part of the state is its own write and sync, so only the parts that changed are sent again
+    std::optional<gamepad_state_t> last_state;
+  };
+
+  /**
+   * A gamepad created ahead of the arrival of the controller it's for.
+   */
+  struct pooled_joypad_t {
+    std::unique_ptr<joypads_t> joypad;
+
+    // Set while the controller of the slot is connected, so a device created meanwhile isn't kept
+    bool claimed = false;
   };
 
   struct input_raw_t {
@@ -61,6 +78,13 @@ namespace platf {
      * The pointer is shared because that state will be shared with background threads that deal with rumble and LED
      */
     std::vector<std::shared_ptr<joypad_state>> gamepads;
+
+    /**
+     * The gamepads created ahead of time, by type and then by the global index of the controller they're for.
+     * They're created on the task pool, hence the lock.
+     */
+    std::array<std::vector<pooled_joypad_t>, 3> gamepad_pool;
+    std::mutex gamepad_pool_lock;
   };
 
   struct client_input_raw_t: public client_input_t {
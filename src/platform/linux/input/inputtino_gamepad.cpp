@@ -11,6 +11,7 @@
 #include "inputtino_common.h"
 #include "inputtino_gamepad.h"
 #include "src/config.h"
+#include "src/globals.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
@@ -53,6 +54,105 @@ namespace platf::gamepad {
     return inputtino::PS5Joypad::create({.name = "Sunshine PS5 (virtual) pad", .vendor_id = 0x054C, .product_id = 0x0CE6, .version = 0x8111, .device_phys = device_mac, .device_uniq = device_mac});
   }
 
+  /**
+   * @brief Create a virtual gamepad.
+   * @param type The type of gamepad.
+   * @param globalIndex The global index of the controller, which the MAC of a DualSense is derived from.
+   * @return The gamepad, or nullptr if it couldn't be created.
+   */
+  std::unique_ptr<joypads_t> create(ControllerType type, int globalIndex) {
+    switch (type) {
+      case XboxOneWired:
+        {
+          auto xOne = create_xbox_one();
+          if (!xOne) {
+            BOOST_LOG(warning) << "Unable to create virtual Xbox One controller: " << xOne.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*xOne));
+        }
+      case SwitchProWired:
+        {
+          auto switchPro = create_switch();
+          if (!switchPro) {
+            BOOST_LOG(warning) << "Unable to create virtual Switch Pro controller: " << switchPro.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*switchPro));
+        }
+      case DualSenseWired:
+        {
+          auto ds5 = create_ds5(globalIndex);
+          if (!ds5) {
+            BOOST_LOG(warning) << "Unable to create virtual DualShock 5 controller: " << ds5.getErrorMessage();
+            return nullptr;
+          }
+          return std::make_unique<joypads_t>(std::move(*ds5));
+        }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Create the gamepad of a slot of the pool in the background, unless its controller is connected.
+   */
+  void refill(input_raw_t *raw, ControllerType type, int globalIndex) {
+    task_pool.push([raw, type, globalIndex]() {
+      auto joypad = create(type, globalIndex);
+
+      std::lock_guard lg {raw->gamepad_pool_lock};
+      auto &slot = raw->gamepad_pool[type][globalIndex];
+      if (!slot.claimed) {
+        slot.joypad = std::move(joypad);
+      }
+    });
+  }
+
+  /**
+   * @brief Take the gamepad of a slot of the pool.
+   * @return The gamepad, or nullptr if the slot isn't pooled or its gamepad isn't created yet.
+   */
+  std::unique_ptr<joypads_t> claim(input_raw_t *raw, ControllerType type, int globalIndex) {
+    std::lock_guard lg {raw->gamepad_pool_lock};
+
+    auto &slots = raw->gamepad_pool[type];
+    if (globalIndex < 0 || (std::size_t) globalIndex >= slots.size()) {
+      return nullptr;
+    }
+
+    slots[globalIndex].claimed = true;
+    return std::move(slots[globalIndex].joypad);
+  }
+
+  void fill_pool(input_raw_t *raw) {
+    if (config::input.gamepad_pool <= 0) {
+      return;
+    }
+
+    // A manually selected type is the only one that will ever be needed
+    std::vector<ControllerType> types;
+    if (config::input.gamepad == "xone"sv) {
+      types = {XboxOneWired};
+    } else if (config::input.gamepad == "ds5"sv) {
+      types = {DualSenseWired};
+    } else if (config::input.gamepad == "switch"sv) {
+      types = {SwitchProWired};
+    } else {
+      types = {XboxOneWired, DualSenseWired, SwitchProWired};
+    }
+
+    auto count = std::min<int>(config::input.gamepad_pool, MAX_GAMEPADS);
+    BOOST_LOG(info) << "Creating "sv << count << " virtual gamepads of each type ahead of time"sv;
+
+    std::lock_guard lg {raw->gamepad_pool_lock};
+    for (auto type : types) {
+      raw->gamepad_pool[type].resize(count);
+      for (int x = 0; x < count; ++x) {
+        refill(raw, type, x);
+      }
+    }
+  }
+
   int alloc(input_raw_t *raw, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue) {
     ControllerType selectedGamepadType;
 
@@ -116,73 +216,69 @@ namespace platf::gamepad {
       gamepad->last_rumble = msg;
     };
 
-    switch (selectedGamepadType) {
-      case XboxOneWired:
-        {
-          auto xOne = create_xbox_one();
-          if (xOne) {
-            (*xOne).set_on_rumble(on_rumble_fn);
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*xOne));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual Xbox One controller: " << xOne.getErrorMessage();
-            return -1;
-          }
-        }
-      case SwitchProWired:
-        {
-          auto switchPro = create_switch();
-          if (switchPro) {
-            (*switchPro).set_on_rumble(on_rumble_fn);
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*switchPro));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual Switch Pro controller: " << switchPro.getErrorMessage();
-            return -1;
-          }
-        }
-      case DualSenseWired:
-        {
-          auto ds5 = create_ds5(id.globalIndex);
-          if (ds5) {
-            (*ds5).set_on_rumble(on_rumble_fn);
-            (*ds5).set_on_led([feedback_queue, idx = id.clientRelativeIndex, gamepad](int r, int g, int b) {
-              // Don't resend duplicate LED data
-              if (gamepad->last_rgb_led.type == platf::gamepad_feedback_e::set_rgb_led && gamepad->last_rgb_led.data.rgb_led.r == r && gamepad->last_rgb_led.data.rgb_led.g == g && gamepad->last_rgb_led.data.rgb_led.b == b) {
-                return;
-              }
-
-              auto msg = gamepad_feedback_msg_t::make_rgb_led(idx, r, g, b);
-              feedback_queue->raise(msg);
-              gamepad->last_rgb_led = msg;
-            });
-
-            (*ds5).set_on_trigger_effect([feedback_queue, idx = id.clientRelativeIndex](const inputtino::PS5Joypad::TriggerEffect &trigger_effect) {
-              feedback_queue->raise(gamepad_feedback_msg_t::make_adaptive_triggers(idx, trigger_effect.event_flags, trigger_effect.type_left, trigger_effect.type_right, trigger_effect.left, trigger_effect.right));
-            });
-
-            // Activate the motion sensors
-            feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_ACCEL, 100));
-            feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_GYRO, 100));
-
-            gamepad->joypad = std::make_unique<joypads_t>(std::move(*ds5));
-            raw->gamepads[id.globalIndex] = std::move(gamepad);
-            return 0;
-          } else {
-            BOOST_LOG(warning) << "Unable to create virtual DualShock 5 controller: " << ds5.getErrorMessage();
-            return -1;
-          }
+    auto joypad = claim(raw, selectedGamepadType, id.globalIndex);
+    if (joypad) {
+      BOOST_LOG(debug) << "Gamepad " << id.globalIndex << " claimed a pooled virtual controller"sv;
+    } else {
+      joypad = create(selectedGamepadType, id.globalIndex);
+      if (!joypad) {
+        return -1;
+      }
+    }
+
+    std::visit([&](auto &gc) {
+      gc.set_on_rumble(on_rumble_fn);
+    }, *joypad);
+
+    if (auto ds5 = std::get_if<inputtino::PS5Joypad>(joypad.get())) {
+      ds5->set_on_led([feedback_queue, idx = id.clientRelativeIndex, gamepad](int r, int g, int b) {
+        // Don't resend duplicate LED data
+        if (gamepad->last_rgb_led.type == platf::gamepad_feedback_e::set_rgb_led && gamepad->last_rgb_led.data.rgb_led.r == r && gamepad->last_rgb_led.data.rgb_led.g == g && gamepad->last_rgb_led.data.rgb_led.b == b) {
+          return;
         }
+
+        auto msg = gamepad_feedback_msg_t::make_rgb_led(idx, r, g, b);
+        feedback_queue->raise(msg);
+        gamepad->last_rgb_led = msg;
+      });
+
+      ds5->set_on_trigger_effect([feedback_queue, idx = id.clientRelativeIndex](const inputtino::PS5Joypad::TriggerEffect &trigger_effect) {
+        feedback_queue->raise(gamepad_feedback_msg_t::make_adaptive_triggers(idx, trigger_effect.event_flags, trigger_effect.type_left, trigger_effect.type_right, trigger_effect.left, trigger_effect.right));
+      });
+
+      // Activate the motion sensors
+      feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_ACCEL, 100));
+      feedback_queue->raise(gamepad_feedback_msg_t::make_motion_event_state(id.clientRelativeIndex, LI_MOTION_TYPE_GYRO, 100));
     }
-    return -1;
+
+    gamepad->joypad = std::move(joypad);
+    raw->gamepads[id.globalIndex] = std::move(gamepad);
+    return 0;
   }
 
   void free(input_raw_t *raw, int nr) {
+    auto type = std::visit([](auto &gc) {
+      using joypad_t = std::decay_t<decltype(gc)>;
+      if constexpr (std::is_same_v<joypad_t, inputtino::PS5Joypad>) {
+        return DualSenseWired;
+      } else if constexpr (std::is_same_v<joypad_t, inputtino::SwitchJoypad>) {
+        return SwitchProWired;
+      } else {
+        return XboxOneWired;
+      }
+    }, *raw->gamepads[nr]->joypad);
+
     // This will call the destructor which in turn will stop the background threads for rumble and LED (and ultimately remove the joypad device)
     raw->gamepads[nr]->joypad.reset();
     raw->gamepads[nr].reset();
+
+    // The slot gets a new device rather than this one, so the next controller doesn't inherit its state
+    std::lock_guard lg {raw->gamepad_pool_lock};
+    auto &slots = raw->gamepad_pool[type];
+    if ((std::size_t) nr < slots.size()) {
+      slots[nr].claimed = false;
+      refill(raw, type, nr);
+    }
   }
 
   void update(input_raw_t *raw, int nr, const gamepad_state_t &gamepad_state) {
@@ -191,13 +287,24 @@ namespace platf::gamepad {
       return;
     }
 
-    std::visit([gamepad_state](inputtino::Joypad &gc) {
-      gc.set_pressed_buttons(gamepad_state.buttonFlags);
-      gc.set_stick(inputtino::Joypad::LS, gamepad_state.lsX, gamepad_state.lsY);
-      gc.set_stick(inputtino::Joypad::RS, gamepad_state.rsX, gamepad_state.rsY);
-      gc.set_triggers(gamepad_state.lt, gamepad_state.rt);
+    auto &last = gamepad->last_state;
+    std::visit([&](inputtino::Joypad &gc) {
+      if (!last || last->buttonFlags != gamepad_state.buttonFlags) {
+        gc.set_pressed_buttons(gamepad_state.buttonFlags);
+      }
+      if (!last || last->lsX != gamepad_state.lsX || last->lsY != gamepad_state.lsY) {
+        gc.set_stick(inputtino::Joypad::LS, gamepad_state.lsX, gamepad_state.lsY);
+      }
+      if (!last || last->rsX != gamepad_state.rsX || last->rsY != gamepad_state.rsY) {
+        gc.set_stick(inputtino::Joypad::RS, gamepad_state.rsX, gamepad_state.rsY);
+      }
+      if (!last || last->lt != gamepad_state.lt || last->rt != gamepad_state.rt) {
+        gc.set_triggers(gamepad_state.lt, gamepad_state.rt);
+      }
     },
                *gamepad->joypad);
+
+    last = gamepad_state;
   }
 
   void touch(input_raw_t *raw, const gamepad_touch_t &touch) {
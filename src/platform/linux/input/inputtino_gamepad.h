@@ -23,6 +23,12 @@ namespace platf::gamepad {
     SwitchProWired  ///< Switch Pro Wired Controller
   };
 
+  /**
+   * @brief Create the gamepads of the pool, as configured by `gamepad_pool`.
+   * @param raw The input context the pool belongs to.
+   */
+  void fill_pool(input_raw_t *raw);
+
   int alloc(input_raw_t *raw, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue);
 
   void free(input_raw_t *raw, int nr);
@@ -3,15 +3,19 @@
  * @brief Definitions for KMS screen capture.
  */
 // standard includes
+#include <algorithm>
+#include <atomic>
 #include <errno.h>
 #include <fcntl.h>
 #include <filesystem>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
 
 // platform includes
 #include <drm_fourcc.h>
 #include <linux/dma-buf.h>
+#include <poll.h>
 #include <sys/capability.h>
 #include <sys/mman.h>
 #include <xf86drm.h>
@@ -21,12 +25,14 @@
 #include "cuda.h"
 #include "graphics.h"
 #include "src/config.h"
+#include "src/image_memory.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/round_robin.h"
 #include "src/utility.h"
 #include "src/video.h"
 #include "vaapi.h"
+#include "vulkan.h"
 #include "wayland.h"
 
 using namespace std::literals;
@@ -278,6 +284,36 @@ namespace platf {
       util::shared_t<plane_t> plane;
     };
 
+    /**
+     * @brief The values the properties of a DRM object had when they were read.
+     */
+    class prop_values_t {
+    public:
+      prop_values_t(obj_prop_t obj_prop, const std::unordered_map<std::uint32_t, std::string> &names):
+          obj_prop {std::move(obj_prop)},
+          names {&names} {
+      }
+
+      std::optional<std::uint64_t> operator[](std::string_view name) const {
+        if (!obj_prop) {
+          return std::nullopt;
+        }
+
+        for (auto x = 0; x < obj_prop->count_props; ++x) {
+          auto it = names->find(obj_prop->props[x]);
+          if (it != std::end(*names) && it->second == name) {
+            return obj_prop->prop_values[x];
+          }
+        }
+
+        return std::nullopt;
+      }
+
+    private:
+      obj_prop_t obj_prop;
+      const std::unordered_map<std::uint32_t, std::string> *names;
+    };
+
     struct cursor_t {
       // Public properties used during blending
       bool visible = false;
@@ -351,15 +387,15 @@ namespace platf {
         return 0;
       }
 
-      fb_t fb(plane_t::pointer plane) {
+      fb_t fb(std::uint32_t fb_id) {
         cap_sys_admin admin;
 
-        auto fb2 = drmModeGetFB2(fd.el, plane->fb_id);
+        auto fb2 = drmModeGetFB2(fd.el, fb_id);
         if (fb2) {
           return std::make_unique<wrapper_fb>(fb2);
         }
 
-        auto fb = drmModeGetFB(fd.el, plane->fb_id);
+        auto fb = drmModeGetFB(fd.el, fb_id);
         if (fb) {
           return std::make_unique<wrapper_fb>(fb);
         }
@@ -367,6 +403,38 @@ namespace platf {
         return nullptr;
       }
 
+      fb_t fb(plane_t::pointer plane) {
+        return fb(plane->fb_id);
+      }
+
+      /**
+       * @brief Get a framebuffer that's scanned out every frame.
+       * @details Compositors flip between a handful of framebuffers, so the ones seen last are kept
+       *          with their handles, and a framebuffer is only queried when a new one shows up.
+       * @param fb_id The id of the framebuffer.
+       * @return The framebuffer, which stays valid until the next call, or nullptr if it couldn't be queried.
+       */
+      wrapper_fb *cached_fb(std::uint32_t fb_id) {
+        auto it = std::find_if(std::begin(fb_cache), std::end(fb_cache), [fb_id](const fb_t &fb) {
+          return fb->fb_id == fb_id;
+        });
+        if (it != std::end(fb_cache)) {
+          std::rotate(std::begin(fb_cache), it, std::next(it));
+          return fb_cache.front().get();
+        }
+
+        auto new_fb = fb(fb_id);
+        if (!new_fb) {
+          return nullptr;
+        }
+
+        if (fb_cache.size() == fb_cache_size) {
+          fb_cache.pop_back();
+        }
+        fb_cache.insert(std::begin(fb_cache), std::move(new_fb));
+        return fb_cache.front().get();
+      }
+
       crtc_t crtc(std::uint32_t id) {
         return drmModeGetCrtc(fd.el, id);
       }
@@ -494,6 +562,32 @@ namespace platf {
         return props;
       }
 
+      /**
+       * @brief Read the values of the properties of an object, to look them up by name.
+       * @details The names of the properties are only queried the first time they're seen,
+       *          so reading the values takes a single ioctl rather than one for every property.
+       * @param id The id of the object.
+       * @param type The type of the object, like DRM_MODE_OBJECT_PLANE.
+       * @return The values, which stay valid until the card is destroyed.
+       */
+      prop_values_t prop_values(std::uint32_t id, std::uint32_t type) {
+        obj_prop_t obj_prop = drmModeObjectGetProperties(fd.el, id, type);
+
+        auto &names = prop_names[id];
+        if (obj_prop) {
+          for (auto x = 0; x < obj_prop->count_props; ++x) {
+            if (names.contains(obj_prop->props[x])) {
+              continue;
+            }
+
+            prop_t prop = drmModeGetProperty(fd.el, obj_prop->props[x]);
+            names.emplace(obj_prop->props[x], prop ? prop->name : "");
+          }
+        }
+
+        return {std::move(obj_prop), names};
+      }
+
       std::vector<std::pair<prop_t, std::uint64_t>> plane_props(std::uint32_t id) {
         return props(id, DRM_MODE_OBJECT_PLANE);
       }
@@ -525,6 +619,13 @@ namespace platf {
       file_t fd;
       file_t render_fd;
       plane_res_t plane_res;
+
+      // The names of the properties of every object read, by the ids of the properties
+      std::unordered_map<std::uint32_t, std::unordered_map<std::uint32_t, std::string>> prop_names;
+
+      // The framebuffers scanned out last, the latest first
+      static constexpr std::size_t fb_cache_size = 4;
+      std::vector<fb_t> fb_cache;
     };
 
     std::map<std::uint32_t, monitor_t> map_crtc_to_monitor(const std::vector<connector_t> &connectors) {
@@ -542,7 +643,7 @@ namespace platf {
 
     struct kms_img_t: public img_t {
       ~kms_img_t() override {
-        delete[] data;
+        util::free_image(data);
         data = nullptr;
       }
     };
@@ -588,6 +689,7 @@ namespace platf {
 
       int init(const std::string &display_name, const ::video::config_t &config) {
         delay = std::chrono::nanoseconds {1s} / config.framerate;
+        vblank_sync = config::video.kms_vblank;
 
         // Handle virtual display names (e.g., "VIRTUAL-80EE83C6")
         // Virtual displays don't have a physical KMS representation, so we fall back to the primary monitor
@@ -740,7 +842,8 @@ namespace platf {
                 connector_id = connector.connector_id;
 
                 auto connector_props = card.connector_props(*connector_id);
-                hdr_metadata_blob_id = card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv);
+                hdr_metadata_blob_id = card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv).value_or(0);
+                hdr_mode = is_hdr_blob(hdr_metadata_blob_id);
               }
             }
 
@@ -785,15 +888,33 @@ namespace platf {
           BOOST_LOG(warning) << "No KMS cursor plane found. Cursor may not be displayed while streaming!"sv;
         }
 
+        // Any other plane of the CRTC may have something scanned out on top of the captured one
+        overlay_plane_ids.clear();
+        for (auto plane = std::begin(card); plane != end; ++plane) {
+          if (plane->plane_id == plane_id || !(plane->possible_crtcs & (1 << crtc_index)) || card.is_cursor(plane->plane_id)) {
+            continue;
+          }
+
+          overlay_plane_ids.emplace_back(plane->plane_id);
+        }
+
         return 0;
       }
 
       bool is_hdr() {
-        if (!hdr_metadata_blob_id || *hdr_metadata_blob_id == 0) {
+        return hdr_mode;
+      }
+
+      /**
+       * @brief Check whether an HDR_OUTPUT_METADATA blob puts the connector in HDR mode.
+       * @param blob_id The ID of the blob, 0 for none.
+       */
+      bool is_hdr_blob(std::uint64_t blob_id) {
+        if (blob_id == 0) {
           return false;
         }
 
-        prop_blob_t hdr_metadata_blob = drmModeGetPropertyBlob(card.fd.el, *hdr_metadata_blob_id);
+        prop_blob_t hdr_metadata_blob = drmModeGetPropertyBlob(card.fd.el, blob_id);
         if (hdr_metadata_blob == nullptr) {
           BOOST_LOG(error) << "Unable to get HDR metadata blob: "sv << strerror(errno);
           return false;
@@ -836,11 +957,12 @@ namespace platf {
 
       bool get_hdr_metadata(SS_HDR_METADATA &metadata) {
         // This performs all the metadata validation
-        if (!is_hdr()) {
+        auto blob_id = hdr_metadata_blob_id.load();
+        if (!is_hdr() || !is_hdr_blob(blob_id)) {
           return false;
         }
 
-        prop_blob_t hdr_metadata_blob = drmModeGetPropertyBlob(card.fd.el, *hdr_metadata_blob_id);
+        prop_blob_t hdr_metadata_blob = drmModeGetPropertyBlob(card.fd.el, blob_id);
         if (hdr_metadata_blob == nullptr) {
           BOOST_LOG(error) << "Unable to get HDR metadata blob: "sv << strerror(errno);
           return false;
@@ -868,40 +990,22 @@ namespace platf {
           return;
         }
 
-        plane_t plane = drmModeGetPlane(card.fd.el, cursor_plane_id);
+        // The atomic state of the plane has its framebuffer as well, so this is the only ioctl of an unchanged cursor
+        auto props = card.prop_values(cursor_plane_id, DRM_MODE_OBJECT_PLANE);
 
-        std::optional<std::int32_t> prop_crtc_x;
-        std::optional<std::int32_t> prop_crtc_y;
-        std::optional<std::uint32_t> prop_crtc_w;
-        std::optional<std::uint32_t> prop_crtc_h;
+        std::optional<std::uint32_t> prop_fb_id = props["FB_ID"sv];
 
-        std::optional<std::uint64_t> prop_src_x;
-        std::optional<std::uint64_t> prop_src_y;
-        std::optional<std::uint64_t> prop_src_w;
-        std::optional<std::uint64_t> prop_src_h;
+        std::optional<std::int32_t> prop_crtc_x = props["CRTC_X"sv];
+        std::optional<std::int32_t> prop_crtc_y = props["CRTC_Y"sv];
+        std::optional<std::uint32_t> prop_crtc_w = props["CRTC_W"sv];
+        std::optional<std::uint32_t> prop_crtc_h = props["CRTC_H"sv];
 
-        auto props = card.plane_props(cursor_plane_id);
-        for (auto &[prop, val] : props) {
-          if (prop->name == "CRTC_X"sv) {
-            prop_crtc_x = val;
-          } else if (prop->name == "CRTC_Y"sv) {
-            prop_crtc_y = val;
-          } else if (prop->name == "CRTC_W"sv) {
-            prop_crtc_w = val;
-          } else if (prop->name == "CRTC_H"sv) {
-            prop_crtc_h = val;
-          } else if (prop->name == "SRC_X"sv) {
-            prop_src_x = val;
-          } else if (prop->name == "SRC_Y"sv) {
-            prop_src_y = val;
-          } else if (prop->name == "SRC_W"sv) {
-            prop_src_w = val;
-          } else if (prop->name == "SRC_H"sv) {
-            prop_src_h = val;
-          }
-        }
+        std::optional<std::uint64_t> prop_src_x = props["SRC_X"sv];
+        std::optional<std::uint64_t> prop_src_y = props["SRC_Y"sv];
+        std::optional<std::uint64_t> prop_src_w = props["SRC_W"sv];
+        std::optional<std::uint64_t> prop_src_h = props["SRC_H"sv];
 
-        if (!prop_crtc_w || !prop_crtc_h || !prop_crtc_x || !prop_crtc_y) {
+        if (!prop_fb_id || !prop_crtc_w || !prop_crtc_h || !prop_crtc_x || !prop_crtc_y) {
           BOOST_LOG(error) << "Cursor plane is missing required plane CRTC properties!"sv;
           BOOST_LOG(error) << "Atomic mode-setting must be enabled to capture the cursor!"sv;
           cursor_plane_id = -1;
@@ -927,10 +1031,10 @@ namespace platf {
         // true, we'll really have to mmap() the dmabuf and draw that every time.
         bool cursor_dirty = false;
 
-        if (!plane->fb_id) {
+        if (!*prop_fb_id) {
           captured_cursor.visible = false;
           captured_cursor.fb_id = 0;
-        } else if (plane->fb_id != captured_cursor.fb_id) {
+        } else if (*prop_fb_id != captured_cursor.fb_id) {
           BOOST_LOG(debug) << "Refreshing cursor image after FB changed"sv;
           cursor_dirty = true;
         } else if (*prop_src_x != captured_cursor.prop_src_x ||
@@ -943,7 +1047,7 @@ namespace platf {
 
         // If the cursor is dirty, map it so we can download the new image
         if (cursor_dirty) {
-          auto fb = card.fb(plane.get());
+          auto fb = card.fb(*prop_fb_id);
           if (!fb || !fb->handles[0]) {
             // This means the cursor is not currently visible
             captured_cursor.visible = false;
@@ -1039,33 +1143,169 @@ namespace platf {
           captured_cursor.prop_src_y = *prop_src_y;
           captured_cursor.prop_src_w = *prop_src_w;
           captured_cursor.prop_src_h = *prop_src_h;
-          captured_cursor.fb_id = plane->fb_id;
+          captured_cursor.fb_id = *prop_fb_id;
           ++captured_cursor.serial;
         }
       }
 
+      /**
+       * @brief Check whether the dmabufs of a format can be imported as an RGB texture.
+       * @param fourcc The DRM format.
+       * @return true if they can.
+       */
+      static bool is_rgb(std::uint32_t fourcc) {
+        switch (fourcc) {
+          case DRM_FORMAT_XRGB8888:
+          case DRM_FORMAT_ARGB8888:
+          case DRM_FORMAT_XBGR8888:
+          case DRM_FORMAT_ABGR8888:
+          case DRM_FORMAT_XRGB2101010:
+          case DRM_FORMAT_ARGB2101010:
+          case DRM_FORMAT_XBGR2101010:
+          case DRM_FORMAT_ABGR2101010:
+            return true;
+          default:
+            return false;
+        }
+      }
+
+      /**
+       * @brief Collect the planes scanned out on top of the captured one.
+       * @details Compositors put fullscreen games and videos on planes of their own when the hardware
+       *          has them to spare, so the captured plane alone would miss them. YUV planes are left out,
+       *          since they can't be imported as RGB textures.
+       * @param overlays The planes from bottom to top, whose file descriptors belong to the caller.
+       */
+      void update_overlays(std::vector<egl::overlay_t> &overlays) {
+        if (overlay_plane_ids.empty()) {
+          return;
+        }
+
+        // Planes without a zpos are stacked by their ids
+        auto primary_props = card.prop_values(plane_id, DRM_MODE_OBJECT_PLANE);
+        std::pair<std::uint64_t, std::uint32_t> primary_key {primary_props["zpos"sv].value_or(0), plane_id};
+
+        std::vector<std::pair<std::pair<std::uint64_t, std::uint32_t>, egl::overlay_t>> planes;
+        for (auto id : overlay_plane_ids) {
+          // Without atomic mode-setting, there's no telling where the plane is
+          auto props = card.prop_values(id, DRM_MODE_OBJECT_PLANE);
+          auto fb_id = props["FB_ID"sv];
+          if (!fb_id || !*fb_id || props["CRTC_ID"sv] != (std::uint64_t) crtc_id) {
+            continue;
+          }
+
+          std::pair<std::uint64_t, std::uint32_t> key {props["zpos"sv].value_or(0), id};
+          if (key < primary_key) {
+            continue;
+          }
+
+          auto crtc_x = props["CRTC_X"sv];
+          auto crtc_y = props["CRTC_Y"sv];
+          auto crtc_w = props["CRTC_W"sv];
+          auto crtc_h = props["CRTC_H"sv];
+          auto src_x = props["SRC_X"sv];
+          auto src_y = props["SRC_Y"sv];
+          auto src_w = props["SRC_W"sv];
+          auto src_h = props["SRC_H"sv];
+          if (!crtc_x || !crtc_y || !crtc_w || !crtc_h || !src_x || !src_y || !src_w || !src_h) {
+            continue;
+          }
+
+          auto fb = card.cached_fb(*fb_id);
+          if (!fb || !fb->handles[0] || !is_rgb(fb->pixel_format)) {
+            continue;
+          }
+
+          file_t file[4];
+          egl::overlay_t overlay {};
+          bool exported = true;
+          for (int y = 0; y < 4; ++y) {
+            overlay.sd.fds[y] = -1;
+            if (!fb->handles[y]) {
+              continue;
+            }
+
+            file[y] = card.handleFD(fb->handles[y]);
+            if (file[y].el < 0) {
+              exported = false;
+              break;
+            }
+
+            overlay.sd.offsets[y] = fb->offsets[y];
+            overlay.sd.pitches[y] = fb->pitches[y];
+          }
+
+          if (!exported) {
+            continue;
+          }
+
+          for (int y = 0; y < 4; ++y) {
+            if (file[y].el >= 0) {
+              overlay.sd.fds[y] = file[y].release();
+            }
+          }
+
+          overlay.sd.width = fb->width;
+          overlay.sd.height = fb->height;
+          overlay.sd.modifier = fb->modifier;
+          overlay.sd.fourcc = fb->pixel_format;
+
+          // The SRC_* properties are in Q16.16 fixed point, the CRTC_* ones are integers
+          overlay.src_x = *src_x >> 16;
+          overlay.src_y = *src_y >> 16;
+          overlay.src_w = *src_w >> 16;
+          overlay.src_h = *src_h >> 16;
+          overlay.dst_x = (std::int32_t) *crtc_x;
+          overlay.dst_y = (std::int32_t) *crtc_y;
+          overlay.dst_w = *crtc_w;
+          overlay.dst_h = *crtc_h;
+
+          planes.emplace_back(key, overlay);
+        }
+
+        std::sort(std::begin(planes), std::end(planes), [](const auto &l, const auto &r) {
+          return l.first < r.first;
+        });
+
+        for (auto &[key, overlay] : planes) {
+          overlays.emplace_back(overlay);
+        }
+      }
+
       inline capture_e refresh(file_t *file, egl::surface_descriptor_t *sd, std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
         // Check for a change in HDR metadata
         if (connector_id) {
-          auto connector_props = card.connector_props(*connector_id);
-          if (hdr_metadata_blob_id != card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv)) {
-            BOOST_LOG(info) << "Reinitializing capture after HDR metadata change"sv;
-            return capture_e::reinit;
+          auto blob_id = card.prop_values(*connector_id, DRM_MODE_OBJECT_CONNECTOR)["HDR_OUTPUT_METADATA"sv].value_or(0);
+          if (blob_id != hdr_metadata_blob_id) {
+            // Games switching their mastering metadata leave the connector in HDR mode,
+            // so the encoder picks the new metadata up from get_hdr_metadata() without a reinit
+            if (!hdr_mode || !is_hdr_blob(blob_id)) {
+              BOOST_LOG(info) << "Reinitializing capture after HDR mode change"sv;
+              return capture_e::reinit;
+            }
+
+            BOOST_LOG(debug) << "HDR metadata changed"sv;
+            hdr_metadata_blob_id = blob_id;
           }
         }
 
-        plane_t plane = drmModeGetPlane(card.fd.el, plane_id);
-        frame_timestamp = std::chrono::steady_clock::now();
+        // Drivers without atomic mode-setting don't have the framebuffer among the properties of the plane
+        std::uint32_t fb_id = card.prop_values(plane_id, DRM_MODE_OBJECT_PLANE)["FB_ID"sv].value_or(0);
+        if (!fb_id) {
+          plane_t plane = drmModeGetPlane(card.fd.el, plane_id);
+          fb_id = plane ? plane->fb_id : 0;
+        }
+        frame_timestamp = scanout_time();
 
-        auto fb = card.fb(plane.get());
+        auto fb = card.cached_fb(fb_id);
         if (!fb) {
           // This can happen if the display is being reconfigured while streaming
-          BOOST_LOG(warning) << "Couldn't get drm fb for plane ["sv << plane->fb_id << "]: "sv << strerror(errno);
+          BOOST_LOG(warning) << "Couldn't get drm fb for plane ["sv << fb_id << "]: "sv << strerror(errno);
           return capture_e::timeout;
         }
 
         if (!fb->handles[0]) {
-          BOOST_LOG(error) << "Couldn't get handle for DRM Framebuffer ["sv << plane->fb_id << "]: Probably not permitted"sv;
+          BOOST_LOG(error) << "Couldn't get handle for DRM Framebuffer ["sv << fb_id << "]: Probably not permitted"sv;
           return capture_e::error;
         }
 
@@ -1091,6 +1331,10 @@ namespace platf {
           sd->pitches[y] = fb->pitches[y];
         }
 
+        if (vblank_sync) {
+          wait_for_render(file[0].el);
+        }
+
         sd->width = fb->width;
         sd->height = fb->height;
         sd->modifier = fb->modifier;
@@ -1108,9 +1352,102 @@ namespace platf {
         return capture_e::ok;
       }
 
+      /**
+       * @brief Sleep until the next frame should be captured.
+       * @details With vblank synchronization, this returns right after the first vblank past
+       *          the halfway point to the deadline, when a page flip has just become visible.
+       *          The deadlines still advance at the stream's framerate.
+       * @param next_frame The deadline of the next frame, advanced to the following one.
+       */
+      void wait_for_next_frame(std::chrono::steady_clock::time_point &next_frame) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (vblank_sync) {
+          auto wake = next_frame - delay / 2;
+          if (wake > now) {
+            std::this_thread::sleep_for(wake - now);
+          }
+
+          if (!wait_for_vblank()) {
+            BOOST_LOG(warning) << "Couldn't wait for vblank on crtc ["sv << crtc_id << "]: "sv << strerror(errno) << ", falling back to polling"sv;
+            vblank_sync = false;
+          }
+        }
+
+        if (!vblank_sync && next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+      }
+
+      /**
+       * @brief Get when the framebuffer on the plane started being scanned out.
+       * @details That's the last vblank of the captured crtc, which drivers timestamp on CLOCK_MONOTONIC.
+       *          Drivers that don't count vblanks get the current time instead.
+       */
+      std::chrono::steady_clock::time_point scanout_time() {
+        std::uint64_t sequence;
+        std::uint64_t ns;
+        if (drmCrtcGetSequence(card.fd.el, crtc_id, &sequence, &ns) || !ns) {
+          return std::chrono::steady_clock::now();
+        }
+
+        return platf::from_monotonic(std::chrono::nanoseconds {ns});
+      }
+
+      /**
+       * @brief Block until the next vblank of the captured crtc.
+       * @return true on success, false if the driver can't wait for vblanks.
+       */
+      bool wait_for_vblank() {
+        std::uint32_t type = DRM_VBLANK_RELATIVE;
+        if (crtc_index > 1) {
+          type |= (crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+        } else if (crtc_index == 1) {
+          type |= DRM_VBLANK_SECONDARY;
+        }
+
+        drmVBlank vbl {};
+        vbl.request.type = (drmVBlankSeqType) type;
+        vbl.request.sequence = 1;
+
+        return drmWaitVBlank(card.fd.el, &vbl) == 0;
+      }
+
+      /**
+       * @brief Wait for the GPU to finish rendering into a framebuffer.
+       * @details Kernels without DMA_BUF_IOCTL_EXPORT_SYNC_FILE (before 6.0) are skipped,
+       *          the importing driver still honors the implicit fences then.
+       * @param dmabuf_fd The dmabuf of the first plane of the framebuffer.
+       */
+      void wait_for_render(int dmabuf_fd) {
+#ifdef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+        dma_buf_export_sync_file sync_file {};
+        sync_file.flags = DMA_BUF_SYNC_READ;
+        sync_file.fd = -1;
+
+        if (drmIoctl(dmabuf_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &sync_file) < 0) {
+          return;
+        }
+
+        pollfd pfd {sync_file.fd, POLLIN, 0};
+        if (poll(&pfd, 1, (int) std::chrono::ceil<std::chrono::milliseconds>(delay).count()) == 0) {
+          BOOST_LOG(debug) << "Rendering of the captured framebuffer didn't finish within a frame"sv;
+        }
+        close(sync_file.fd);
+#endif
+      }
+
       mem_type_e mem_type;
 
       std::chrono::nanoseconds delay;
+      bool vblank_sync;
 
       int img_width, img_height;
       int img_offset_x, img_offset_y;
@@ -1120,11 +1457,16 @@ namespace platf {
       int crtc_index;
 
       std::optional<uint32_t> connector_id;
-      std::optional<uint64_t> hdr_metadata_blob_id;
+      // Changed by the capture thread while the encoder reads the metadata
+      std::atomic<std::uint64_t> hdr_metadata_blob_id {0};
+      bool hdr_mode = false;
 
       int cursor_plane_id;
       cursor_t captured_cursor {};
 
+      // The planes of the CRTC other than the captured one and the cursor
+      std::vector<std::uint32_t> overlay_plane_ids;
+
       card_t card;
     };
 
@@ -1171,18 +1513,7 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
-
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
-          }
+          wait_for_next_frame(next_frame);
 
           std::shared_ptr<platf::img_t> img_out;
           auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
@@ -1217,6 +1548,12 @@ namespace platf {
         }
 #endif
 
+#ifdef SUNSHINE_BUILD_VULKAN
+        if (mem_type == mem_type_e::vulkan) {
+          return vk::make_avcodec_encode_device(width, height, false);
+        }
+#endif
+
 #ifdef SUNSHINE_BUILD_CUDA
         if (mem_type == mem_type_e::cuda) {
           return cuda::make_avcodec_encode_device(width, height, false);
@@ -1285,15 +1622,12 @@ namespace platf {
           return status;
         }
 
-        auto rgb_opt = egl::import_source(display.get(), sd);
-
-        if (!rgb_opt) {
+        auto rgb = rgb_cache.import(display.get(), sd);
+        if (!rgb) {
           return capture_e::error;
         }
 
-        auto &rgb = *rgb_opt;
-
-        gl::ctx.BindTexture(GL_TEXTURE_2D, rgb->tex[0]);
+        gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
 
         // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
         int w, h;
@@ -1305,12 +1639,13 @@ namespace platf {
           return platf::capture_e::interrupted;
         }
 
-        gl::ctx.GetTextureSubImage(rgb->tex[0], 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+        gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, img_offset_x, img_offset_y, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
 
         img_out->frame_timestamp = frame_timestamp;
 
         if (cursor && captured_cursor.visible) {
           blend_cursor(*img_out);
+          img_out->cursor = platf::damage_rect_t {captured_cursor.x - img_offset_x, captured_cursor.y - img_offset_y, (std::int32_t) captured_cursor.src_w, (std::int32_t) captured_cursor.src_h};
         }
 
         return capture_e::ok;
@@ -1322,7 +1657,7 @@ namespace platf {
         img->height = height;
         img->pixel_pitch = 4;
         img->row_pitch = img->pixel_pitch * width;
-        img->data = new std::uint8_t[height * img->row_pitch];
+        img->data = util::alloc_image(height * img->row_pitch);
 
         return img;
       }
@@ -1334,6 +1669,9 @@ namespace platf {
       gbm::gbm_t gbm;
       egl::display_t display;
       egl::ctx_t ctx;
+
+      // Scanout buffers are reused, so each of them only needs to be imported once
+      egl::rgb_cache_t rgb_cache;
     };
 
     class display_vram_t: public display_t {
@@ -1349,6 +1687,12 @@ namespace platf {
         }
 #endif
 
+#ifdef SUNSHINE_BUILD_VULKAN
+        if (mem_type == mem_type_e::vulkan) {
+          return vk::make_avcodec_encode_device(width, height, "/proc/self/fd/"s + std::to_string(card.render_fd.el), img_offset_x, img_offset_y, true);
+        }
+#endif
+
 #ifdef SUNSHINE_BUILD_CUDA
         if (mem_type == mem_type_e::cuda) {
           return cuda::make_avcodec_gl_encode_device(width, height, img_offset_x, img_offset_y);
@@ -1385,18 +1729,7 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
-
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
-          }
+          wait_for_next_frame(next_frame);
 
           std::shared_ptr<platf::img_t> img_out;
           auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
@@ -1438,7 +1771,10 @@ namespace platf {
           return status;
         }
 
+        update_overlays(img->overlays);
+
         img->sequence = ++sequence;
+        img->recycled = true;
 
         if (cursor && captured_cursor.visible) {
           // Copy new cursor pixel data if it's been updated
@@ -1456,6 +1792,7 @@ namespace platf {
           img->pixel_pitch = 4;
           img->row_pitch = img->pixel_pitch * img->width;
           img->data = img->buffer.data();
+          img->cursor = platf::damage_rect_t {captured_cursor.x - img_offset_x, captured_cursor.y - img_offset_y, (std::int32_t) captured_cursor.dst_w, (std::int32_t) captured_cursor.dst_h};
         } else {
           img->data = nullptr;
         }
@@ -1494,7 +1831,7 @@ namespace platf {
   }  // namespace kms
 
   std::shared_ptr<display_t> kms_display(mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
-    if (hwdevice_type == mem_type_e::vaapi || hwdevice_type == mem_type_e::cuda) {
+    if (hwdevice_type == mem_type_e::vaapi || hwdevice_type == mem_type_e::vulkan || hwdevice_type == mem_type_e::cuda) {
       auto disp = std::make_shared<kms::display_vram_t>(hwdevice_type);
 
       if (!disp->init(display_name, config)) {
@@ -9,15 +9,41 @@
 #endif
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 // platform includes
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include <ifaddrs.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <net/if.h>
 #include <netinet/udp.h>
+#include <pthread.h>
+#include <poll.h>
 #include <pwd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
@@ -36,12 +62,17 @@
 // local includes
 #include "graphics.h"
 #include "misc.h"
+#include "rtkit.h"
 #include "src/config.h"
 #include "src/entry_handler.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/thread_affinity.h"
 #include "vaapi.h"
+#include "virtual_display.h"
+#include "xdp.h"
 
+#include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
 #ifdef __GNUC__
@@ -359,16 +390,435 @@ std::string get_local_ip_for_gateway() {
     }
   }
 
+  namespace {
+    // How long a real-time thread may run without blocking before it's demoted
+    constexpr rlim_t rttime_soft_limit_us = 100'000;
+
+    rlim_t rttime_soft_limit = RLIM_INFINITY;
+
+    /**
+     * @brief Demote the thread that ran past the soft RLIMIT_RTTIME to SCHED_OTHER.
+     * @details The kernel sends SIGXCPU to the process, and delivers it to the thread running over the limit
+     *          unless that one blocks it. Reaching the hard limit would kill Apollo instead.
+     */
+    void on_rttime_exceeded(int) {
+      auto saved_errno = errno;
+
+      auto policy = sched_getscheduler(0) & ~SCHED_RESET_ON_FORK;
+      if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        sched_param param {};
+        sched_setscheduler(0, SCHED_OTHER | SCHED_RESET_ON_FORK, &param);
+
+        constexpr char message[] = "Warning: a real-time thread ran too long without blocking, it now runs with SCHED_OTHER\n";
+        [[maybe_unused]] auto written = write(STDERR_FILENO, message, sizeof(message) - 1);
+      }
+
+      // The kernel raised the soft limit by a second, past the hard one
+      rlimit limit;
+      if (!getrlimit(RLIMIT_RTTIME, &limit)) {
+        limit.rlim_cur = rttime_soft_limit;
+        setrlimit(RLIMIT_RTTIME, &limit);
+      }
+
+      errno = saved_errno;
+    }
+
+    /**
+     * @brief Set a soft RLIMIT_RTTIME below the hard one, and demote the threads reaching it.
+     */
+    void bound_realtime_threads() {
+      static std::once_flag bound_once;
+      std::call_once(bound_once, []() {
+        rlimit limit;
+        if (getrlimit(RLIMIT_RTTIME, &limit)) {
+          return;
+        }
+
+        limit.rlim_cur = std::min(limit.rlim_cur, rttime_soft_limit_us);
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur >= limit.rlim_max) {
+          limit.rlim_cur = limit.rlim_max / 2;
+        }
+        if (setrlimit(RLIMIT_RTTIME, &limit)) {
+          return;
+        }
+        rttime_soft_limit = limit.rlim_cur;
+
+        struct sigaction action {};
+        action.sa_handler = on_rttime_exceeded;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGXCPU, &action, nullptr);
+      });
+    }
+  }  // namespace
+
   void adjust_thread_priority(thread_priority_e priority) {
-    // Unimplemented
+    // Only the critical threads, which block between short bursts of work, get a real-time policy.
+    // Busy ones like the encoders would starve the compositor and input otherwise.
+    // Real-time priorities stay below the ones of the audio servers, which start at 20
+    int policy = SCHED_OTHER;
+    int rt_priority = 0;
+    int nice = 0;
+
+    switch (priority) {
+      case thread_priority_e::low:
+        nice = 10;
+        break;
+      case thread_priority_e::normal:
+        break;
+      case thread_priority_e::high:
+        nice = -10;
+        break;
+      case thread_priority_e::critical:
+        policy = SCHED_FIFO;
+        rt_priority = 1;
+        nice = -15;
+        break;
+      default:
+        BOOST_LOG(error) << "Unknown thread priority: "sv << (int) priority;
+        return;
+    }
+
+    auto thread = (pid_t) syscall(SYS_gettid);
+
+    // The threads spawned by this one, like the ones of the encoders, don't inherit a real-time policy
+    sched_param param {};
+    param.sched_priority = rt_priority;
+    if (policy != SCHED_OTHER) {
+      bound_realtime_threads();
+      if (!sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param) || rtkit::make_thread_realtime(thread, rt_priority)) {
+        return;
+      }
+    } else {
+      sched_setscheduler(0, SCHED_OTHER | SCHED_RESET_ON_FORK, &param);
+    }
+
+    // Without CAP_SYS_NICE, a suitable RLIMIT_RTPRIO or RealtimeKit, settle for a lower nice value
+    if (!setpriority(PRIO_PROCESS, thread, nice) || (nice < 0 && rtkit::make_thread_high_priority(thread, nice))) {
+      return;
+    }
+
+    static std::once_flag warn_once;
+    std::call_once(warn_once, []() {
+      BOOST_LOG(warning) << "Unable to raise the priority of the streaming threads, grant Apollo CAP_SYS_NICE or install RealtimeKit"sv;
+    });
+  }
+
+  namespace {
+    std::string read_sysfs(const std::filesystem::path &file) {
+      std::ifstream in {file};
+      std::string value;
+      std::getline(in, value);
+      return value;
+    }
+
+    int read_sysfs_int(const std::filesystem::path &file, int fallback) {
+      auto value = read_sysfs(file);
+      try {
+        return value.empty() ? fallback : std::stoi(value);
+      } catch (const std::exception &) {
+        return fallback;
+      }
+    }
+  }  // namespace
+
+  std::vector<cpu_info_t> cpu_topology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+      return {};
+    }
+
+    // The P-cores of hybrid Intel CPUs have their own PMU, ARM reports the relative speed of each core
+    auto performance_cores = thread_affinity::parse_cpu_list(read_sysfs("/sys/devices/cpu_core/cpus"));
+
+    std::vector<cpu_info_t> cpus;
+    std::filesystem::path cpu_dir = "/sys/devices/system/cpu";
+    for (auto id : thread_affinity::parse_cpu_list(read_sysfs(cpu_dir / "online"))) {
+      if (id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed)) {
+        continue;
+      }
+
+      auto dir = cpu_dir / ("cpu"s + std::to_string(id));
+      cpu_info_t cpu {id, -1, -1, 0};
+
+      // The L3 domain is named after its first CPU, which is stable across reboots unlike the cache ids
+      std::error_code ec;
+      for (auto &index : std::filesystem::directory_iterator {dir / "cache", ec}) {
+        if (read_sysfs_int(index.path() / "level", 0) == 3) {
+          auto shared = thread_affinity::parse_cpu_list(read_sysfs(index.path() / "shared_cpu_list"));
+          if (!shared.empty()) {
+            cpu.l3_domain = shared.front();
+          }
+        }
+      }
+
+      // The core is named after its first SMT sibling, like the L3 domain
+      auto siblings = thread_affinity::parse_cpu_list(read_sysfs(dir / "topology/thread_siblings_list"));
+      if (!siblings.empty()) {
+        cpu.core = siblings.front();
+      }
+
+      for (auto &entry : std::filesystem::directory_iterator {dir, ec}) {
+        auto name = entry.path().filename().string();
+        if (name.starts_with("node") && name.size() > 4 && std::isdigit((unsigned char) name[4])) {
+          cpu.numa_node = std::atoi(name.c_str() + 4);
+        }
+      }
+
+      if (!performance_cores.empty()) {
+        cpu.efficiency_class = std::binary_search(std::begin(performance_cores), std::end(performance_cores), id) ? 1 : 0;
+      } else {
+        cpu.efficiency_class = read_sysfs_int(dir / "cpu_capacity", 0);
+      }
+
+      cpus.emplace_back(cpu);
+    }
+
+    return cpus;
+  }
+
+  int gpu_numa_node() {
+    std::filesystem::path render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name;
+
+    // The kernel reports -1 on hosts with a single node
+    return read_sysfs_int("/sys/class/drm" / render_device.filename() / "device/numa_node", -1);
+  }
+
+  std::vector<std::string> encode_gpus() {
+    std::vector<std::string> gpus;
+
+    std::error_code ec;
+    for (auto &entry : std::filesystem::directory_iterator {"/dev/dri", ec}) {
+      if (entry.path().filename().string().starts_with("renderD")) {
+        gpus.push_back(entry.path().string());
+      }
+    }
+
+    // renderD128 comes first, it's the default
+    std::sort(std::begin(gpus), std::end(gpus));
+    return gpus;
+  }
+
+  namespace {
+    std::int64_t read_sysfs_int64(const std::filesystem::path &file) {
+      auto value = read_sysfs(file);
+      try {
+        return value.empty() ? -1 : std::stoll(value);
+      } catch (const std::exception &) {
+        return -1;
+      }
+    }
+
+    /**
+     * @brief Get the clock amdgpu marks as current in one of its DPM tables, like `1: 1800Mhz *`.
+     */
+    int read_dpm_clock(const std::filesystem::path &file) {
+      std::ifstream in {file};
+      for (std::string line; std::getline(in, line);) {
+        if (!line.ends_with('*')) {
+          continue;
+        }
+
+        auto colon = line.find(':');
+        return colon == std::string::npos ? -1 : std::atoi(line.c_str() + colon + 1);
+      }
+
+      return -1;
+    }
+
+    /**
+     * @brief Get the card node sharing the device of a render node, which carries the sysfs files of i915.
+     */
+    std::filesystem::path card_of(const std::filesystem::path &device) {
+      std::error_code ec;
+      for (auto &entry : std::filesystem::directory_iterator {device / "drm", ec}) {
+        if (entry.path().filename().string().starts_with("card")) {
+          return entry.path();
+        }
+      }
+
+      return {};
+    }
+  }  // namespace
+
+  std::vector<metrics::gpu_metrics_t> sample_gpus() {
+    // i915 only reports how long the GPU has been idle, so the busy share comes from the last sample
+    struct rc6_sample_t {
+      std::chrono::steady_clock::time_point time;
+      std::int64_t residency_ms;
+    };
+
+    static std::map<std::string, rc6_sample_t> rc6_samples;
+
+    std::vector<metrics::gpu_metrics_t> gpus;
+    for (auto &gpu : encode_gpus()) {
+      auto device = "/sys/class/drm" / std::filesystem::path {gpu}.filename() / "device";
+
+      metrics::gpu_metrics_t sample;
+      sample.gpu = gpu;
+
+      // amdgpu
+      sample.busy_percent = read_sysfs_int(device / "gpu_busy_percent", -1);
+      sample.clock_mhz = read_dpm_clock(device / "pp_dpm_sclk");
+      sample.memory_used_bytes = read_sysfs_int64(device / "mem_info_vram_used");
+      sample.memory_budget_bytes = read_sysfs_int64(device / "mem_info_vram_total");
+
+      // i915
+      if (auto card = card_of(device); !card.empty() && sample.busy_percent < 0) {
+        auto now = std::chrono::steady_clock::now();
+        auto residency_ms = read_sysfs_int64(card / "gt/gt0/rc6_residency_ms");
+        if (residency_ms < 0) {
+          residency_ms = read_sysfs_int64(card / "power/rc6_residency_ms");
+        }
+
+        if (residency_ms >= 0) {
+          auto it = rc6_samples.find(gpu);
+          if (it != std::end(rc6_samples)) {
+            auto elapsed_ms = std::chrono::duration<double, std::milli>(now - it->second.time).count();
+            if (elapsed_ms > 0) {
+              auto idle = (residency_ms - it->second.residency_ms) / elapsed_ms;
+              sample.busy_percent = (int) std::lround(std::clamp(1.0 - idle, 0.0, 1.0) * 100);
+            }
+          }
+
+          rc6_samples[gpu] = {now, residency_ms};
+        }
+
+        if (sample.clock_mhz < 0) {
+          sample.clock_mhz = read_sysfs_int(card / "gt_act_freq_mhz", -1);
+        }
+      }
+
+      gpus.emplace_back(std::move(sample));
+    }
+
+    return gpus;
+  }
+
+  std::string gpu_by_pci_address(unsigned int domain, unsigned int bus, unsigned int device) {
+    for (auto &gpu : encode_gpus()) {
+      std::error_code ec;
+      auto address = std::filesystem::read_symlink("/sys/class/drm" / std::filesystem::path {gpu}.filename() / "device", ec).filename().string();
+
+      unsigned int gpu_domain, gpu_bus, gpu_device, gpu_function;
+      if (!ec && std::sscanf(address.c_str(), "%x:%x:%x.%x", &gpu_domain, &gpu_bus, &gpu_device, &gpu_function) == 4 &&
+          gpu_domain == domain && gpu_bus == bus && gpu_device == device) {
+        return gpu;
+      }
+    }
+
+    return {};
   }
 
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+
+    if (auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+      BOOST_LOG(debug) << "pthread_setaffinity_np() failed: "sv << std::strerror(err);
+      return false;
+    }
+
+    return true;
+  }
+
+  namespace {
+    // Shallow C-states like C1 and C1E are left within this, the deeper ones take tens of microseconds to exit
+    constexpr std::int32_t streaming_cpu_latency_us = 20;
+
+    // Held for the duration of the streams, closing it drops the request
+    file_t cpu_dma_latency;
+
+    // The sysfs attributes changed for the duration of the streams, with the values to restore, in the order they were changed
+    std::vector<std::pair<fs::path, std::string>> sysfs_overrides;
+
+    bool write_sysfs(const fs::path &file, const std::string &value) {
+      std::ofstream out {file};
+      out << value;
+      out.flush();
+
+      return (bool) out;
+    }
+
+    /**
+     * @brief Set a sysfs attribute until the streams stop.
+     * @return `true` if the attribute has the value, changed or not.
+     */
+    bool override_sysfs(const fs::path &file, const std::string &value) {
+      auto previous = read_sysfs(file);
+      if (previous.empty()) {
+        return false;
+      }
+
+      // amdgpu and others bracket the selected value among the available ones
+      if (previous == value || previous.find("["s + value + "]"s) != std::string::npos) {
+        return true;
+      }
+
+      if (!write_sysfs(file, value)) {
+        BOOST_LOG(debug) << "Couldn't set "sv << file.string() << " to "sv << value;
+        return false;
+      }
+
+      sysfs_overrides.emplace_back(file, previous);
+      return true;
+    }
+  }  // namespace
+
   void streaming_will_start() {
-    // Nothing to do
+    // Hold a PM QoS request keeping the CPUs out of deep C-states, which add latency to every wake-up
+    file_t latency_fd {open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC)};
+    if (latency_fd.el < 0 || write(latency_fd.el, &streaming_cpu_latency_us, sizeof(streaming_cpu_latency_us)) != sizeof(streaming_cpu_latency_us)) {
+      BOOST_LOG(debug) << "Couldn't request a CPU wake-up latency of "sv << streaming_cpu_latency_us << "us: "sv << std::strerror(errno);
+    } else {
+      cpu_dma_latency = std::move(latency_fd);
+    }
+
+    if (!config::stream.performance_mode) {
+      return;
+    }
+
+    bool overridden = true;
+
+    std::error_code ec;
+    for (auto &entry : fs::directory_iterator {"/sys/devices/system/cpu/cpufreq", ec}) {
+      if (entry.path().filename().string().starts_with("policy"sv)) {
+        // The performance governor of intel_pstate pins the EPP to performance on its own, and refuses writes to it
+        overridden &= override_sysfs(entry.path() / "scaling_governor", "performance");
+        if (fs::exists(entry.path() / "energy_performance_preference", ec)) {
+          overridden &= override_sysfs(entry.path() / "energy_performance_preference", "performance");
+        }
+      }
+    }
+
+    for (auto &entry : fs::directory_iterator {"/sys/class/drm", ec}) {
+      auto level = entry.path() / "device/power_dpm_force_performance_level";
+      if (fs::exists(level, ec)) {
+        overridden &= override_sysfs(level, "high");
+      }
+    }
+
+    if (!overridden) {
+      BOOST_LOG(warning) << "Unable to switch the CPUs and GPUs to their performance profile, that needs Apollo to run as root"sv;
+    }
   }
 
   void streaming_will_stop() {
-    // Nothing to do
+    cpu_dma_latency = file_t {};
+
+    // The governor is restored before the EPP, which it may have refused writes to
+    for (auto &[file, value] : sysfs_overrides) {
+      if (!write_sysfs(file, value)) {
+        BOOST_LOG(warning) << "Couldn't restore "sv << file.string() << " to "sv << value;
+      }
+    }
+    sysfs_overrides.clear();
   }
 
   void restart_on_exit() {
@@ -421,6 +871,180 @@ std::string get_local_ip_for_gateway() {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  namespace {
+    /**
+     * @brief Polls the pidfd of a process from its own thread, against an eventfd waking it up to stop.
+     */
+    class pidfd_watcher_t: public process_watcher_t {
+    public:
+      pidfd_watcher_t(file_t &&pidfd, file_t &&stop_fd, std::function<void()> &&exited):
+          _stop_fd {std::move(stop_fd)} {
+        _thread = std::thread {[pidfd = std::move(pidfd), stop_fd = _stop_fd.el, exited = std::move(exited)]() {
+          std::array<pollfd, 2> fds {{{pidfd.el, POLLIN, 0}, {stop_fd, POLLIN, 0}}};
+          while (poll(fds.data(), fds.size(), -1) < 0 && errno == EINTR) {}
+
+          // The pidfd turns readable once the process exited, it's still reaped by whoever waits for it
+          if (!(fds[1].revents & POLLIN) && (fds[0].revents & (POLLIN | POLLHUP))) {
+            exited();
+          }
+        }};
+      }
+
+      ~pidfd_watcher_t() override {
+        std::uint64_t one = 1;
+        if (write(_stop_fd.el, &one, sizeof(one)) < 0) {
+          BOOST_LOG(warning) << "Couldn't stop watching the app for its exit: "sv << std::strerror(errno);
+        }
+
+        _thread.join();
+      }
+
+    private:
+      file_t _stop_fd;
+      std::thread _thread;
+    };
+  }  // namespace
+
+  std::unique_ptr<process_watcher_t> watch_process_exit(std::uintptr_t process, std::uintptr_t group, std::function<void()> &&exited) {
+  #ifdef SYS_pidfd_open
+    // waitpid() only sees the children of Apollo in a group, and the leader is the only child in the group of an app.
+    // Watching it covers the group as far as process_group_running() can tell.
+    file_t pidfd {(int) syscall(SYS_pidfd_open, (pid_t) process, 0)};
+    if (pidfd.el < 0) {
+      BOOST_LOG(debug) << "pidfd_open() failed, polling the app for its exit: "sv << std::strerror(errno);
+      return nullptr;
+    }
+
+    file_t stop_fd {eventfd(0, EFD_CLOEXEC)};
+    if (stop_fd.el < 0) {
+      return nullptr;
+    }
+
+    return std::make_unique<pidfd_watcher_t>(std::move(pidfd), std::move(stop_fd), std::move(exited));
+  #else
+    return nullptr;
+  #endif
+  }
+
+  namespace {
+    /**
+     * @brief Removes the cgroup of an app once it's empty.
+     */
+    class cgroup_isolation_t: public app_isolation_t {
+    public:
+      explicit cgroup_isolation_t(fs::path &&dir):
+          _dir {std::move(dir)} {}
+
+      ~cgroup_isolation_t() override {
+        // Processes left behind by the app keep it alive, the cgroup goes away with them then
+        std::error_code ec;
+        if (!fs::remove(_dir, ec) && ec) {
+          BOOST_LOG(debug) << "Couldn't remove "sv << _dir << ": "sv << ec.message();
+        }
+      }
+
+    private:
+      fs::path _dir;
+    };
+
+    /**
+     * @brief Get the cgroup the apps are put below, preparing it on first use.
+     * @details Only the leaves of cgroup v2 may hold processes once controllers are enabled for the children,
+     *          so Apollo moves from its own cgroup to a child one, next to those of the apps.
+     * @return The cgroup, or an empty path if Apollo can't manage the cgroups of its children.
+     */
+    const fs::path &apps_cgroup() {
+      static std::once_flag setup_once;
+      static fs::path apps;
+
+      std::call_once(setup_once, []() {
+        std::ifstream in {"/proc/self/cgroup"};
+        fs::path own;
+        for (std::string line; std::getline(in, line);) {
+          if (line.starts_with("0::")) {
+            own = "/sys/fs/cgroup" + line.substr(3);
+          }
+        }
+
+        if (own.empty() || !fs::exists(own / "cgroup.subtree_control")) {
+          BOOST_LOG(warning) << "Apps can only be isolated with cgroup v2"sv;
+          return;
+        }
+
+        // After a restart within the same cgroup, Apollo is already in its own
+        auto parent = own.filename() == "apollo" ? own.parent_path() : own;
+        if (parent == own) {
+          std::error_code ec;
+          fs::create_directory(parent / "apollo", ec);
+
+          std::ifstream procs {parent / "cgroup.procs"};
+          for (std::string pid; std::getline(procs, pid);) {
+            write_sysfs(parent / "apollo/cgroup.procs", pid);
+          }
+        }
+
+        // cpuset may not be delegated even when cpu is
+        auto cpu = write_sysfs(parent / "cgroup.subtree_control", "+cpu");
+        auto cpuset = write_sysfs(parent / "cgroup.subtree_control", "+cpuset");
+        if (!cpu && !cpuset) {
+          BOOST_LOG(warning) << "Apps can't be isolated without the cpu and cpuset controllers delegated to Apollo, e.g. with Delegate=cpu cpuset in its unit"sv;
+          return;
+        }
+
+        apps = parent;
+      });
+
+      return apps;
+    }
+  }  // namespace
+
+  std::unique_ptr<app_isolation_t> isolate_app(std::uintptr_t process, std::uintptr_t group, const std::vector<int> &cpus, int cpu_weight) {
+    auto &apps = apps_cgroup();
+    if (apps.empty()) {
+      return nullptr;
+    }
+
+    auto dir = apps / ("app-"s + std::to_string((pid_t) process));
+    std::error_code ec;
+    if (!fs::create_directory(dir, ec) && ec) {
+      BOOST_LOG(warning) << "Couldn't create "sv << dir << ": "sv << ec.message();
+      return nullptr;
+    }
+
+    if (cpu_weight != 100 && !write_sysfs(dir / "cpu.weight", std::to_string(cpu_weight))) {
+      BOOST_LOG(warning) << "Couldn't set the CPU weight of the app"sv;
+    }
+    if (!cpus.empty() && !write_sysfs(dir / "cpuset.cpus", thread_affinity::format_cpu_list(cpus))) {
+      BOOST_LOG(warning) << "Couldn't keep the app on CPUs "sv << thread_affinity::format_cpu_list(cpus);
+    }
+
+    auto isolation = std::make_unique<cgroup_isolation_t>(fs::path {dir});
+    if (!write_sysfs(dir / "cgroup.procs", std::to_string((pid_t) process))) {
+      BOOST_LOG(warning) << "Couldn't move the app to "sv << dir;
+      return nullptr;
+    }
+
+    // Whatever the app started until now is in its group, later processes inherit the cgroup
+    if (group) {
+      for (auto &entry : fs::directory_iterator {"/proc", ec}) {
+        auto pid = entry.path().filename().string();
+        if (!std::isdigit(pid.front()) || std::stoi(pid) == (pid_t) process) {
+          continue;
+        }
+
+        // The process group is the 5th field, after the name which may contain spaces
+        auto stat = read_sysfs(entry.path() / "stat");
+        auto fields = stat.rfind(") ");
+        pid_t pgrp = 0;
+        if (fields != std::string::npos && std::sscanf(stat.c_str() + fields + 2, "%*c %*d %d", &pgrp) == 1 && pgrp == (pid_t) group) {
+          write_sysfs(dir / "cgroup.procs", pid);
+        }
+      }
+    }
+
+    return isolation;
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
@@ -446,14 +1070,252 @@ std::string get_local_ip_for_gateway() {
     return saddr_v6;
   }
 
+  namespace {
+    /**
+     * @brief Completion state of the MSG_ZEROCOPY sends on a socket.
+     */
+    struct zerocopy_socket_t {
+      // Held around each zero-copy send, so we know which id the kernel assigned to it
+      std::mutex send_lock;
+      std::uint64_t next_id = 0;
+
+      // Held while reading completions from the error queue
+      std::mutex completion_lock;
+
+      // Every send with a lower id has completed
+      std::uint64_t completed_below = 0;
+
+      // Completed ranges of ids above completed_below, as first -> last
+      std::map<std::uint64_t, std::uint64_t> completed_ranges;
+
+      bool warned_copied = false;
+    };
+
+    std::mutex zerocopy_sockets_lock;
+    std::map<int, std::shared_ptr<zerocopy_socket_t>> zerocopy_sockets;
+
+    std::shared_ptr<zerocopy_socket_t> get_zerocopy_socket(int sockfd) {
+      std::lock_guard lg {zerocopy_sockets_lock};
+
+      auto it = zerocopy_sockets.find(sockfd);
+      return it != std::end(zerocopy_sockets) ? it->second : nullptr;
+    }
+
+    /**
+     * @brief Read all pending zero-copy completions from the error queue of a socket.
+     * @param sockfd The socket.
+     * @param zc The completion state of the socket, with its completion_lock held.
+     * @return `true` if any completion was read.
+     */
+    bool read_zerocopy_completions(int sockfd, zerocopy_socket_t &zc) {
+      bool completed = false;
+
+      while (true) {
+        union {
+          char buf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+          struct cmsghdr alignment;
+        } cmbuf;
+
+        struct msghdr msg = {};
+        msg.msg_control = cmbuf.buf;
+        msg.msg_controllen = sizeof(cmbuf.buf);
+
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE) < 0) {
+          return completed;
+        }
+
+        for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+          if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+            continue;
+          }
+
+          struct sock_extended_err serr;
+          memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+          if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+          }
+
+          if ((serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && !zc.warned_copied) {
+            BOOST_LOG(warning) << "Zero-copy sends are being copied by the kernel, zero-copy won't reduce CPU usage on this route"sv;
+            zc.warned_copied = true;
+          }
+
+          // The kernel reports 32-bit ids, so extend them relative to the oldest pending send
+          auto first = zc.completed_below + (std::uint32_t) (serr.ee_info - (std::uint32_t) zc.completed_below);
+          auto last = first + (std::uint32_t) (serr.ee_data - serr.ee_info);
+          zc.completed_ranges[first] = last;
+          completed = true;
+        }
+
+        // Merge ranges that are now contiguous with the completed ids
+        for (auto it = std::begin(zc.completed_ranges); it != std::end(zc.completed_ranges) && it->first <= zc.completed_below;) {
+          zc.completed_below = std::max(zc.completed_below, it->second + 1);
+          it = zc.completed_ranges.erase(it);
+        }
+      }
+    }
+  }  // namespace
+
+  /**
+   * @brief Let other sockets bind the same local address and port as the given socket.
+   * @param native_socket The native socket handle, which must not be bound yet.
+   * @return `true` if the port can be shared.
+   */
+  bool enable_socket_reuseport(uintptr_t native_socket) {
+#ifdef SO_REUSEPORT
+    int enable = 1;
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+      BOOST_LOG(warning) << "Failed to enable SO_REUSEPORT: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Enable zero-copy sends on the given socket.
+   * @param native_socket The native socket handle.
+   * @return `true` if zero-copy sends are supported on this socket.
+   */
+  bool enable_socket_zerocopy(uintptr_t native_socket) {
+#ifdef SO_ZEROCOPY
+    auto sockfd = (int) native_socket;
+
+    int enable = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0) {
+      BOOST_LOG(warning) << "Failed to enable SO_ZEROCOPY: "sv << errno;
+      return false;
+    }
+
+    // File descriptors are reused, so any previous state belongs to a closed socket
+    std::lock_guard lg {zerocopy_sockets_lock};
+    zerocopy_sockets[sockfd] = std::make_shared<zerocopy_socket_t>();
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Open a UDP socket whose batches are sent through Registered I/O.
+   * @param v6 Whether the socket is IPv6.
+   * @param native_socket Set to the native socket handle.
+   * @return `nullptr`, since Registered I/O is specific to Windows.
+   */
+  std::unique_ptr<deinit_t> open_socket_registered_io(bool v6, std::uintptr_t &native_socket) {
+    // Not supported on this platform
+    return nullptr;
+  }
+
+  namespace {
+    std::mutex xdp_sockets_lock;
+    std::map<int, std::shared_ptr<xdp::socket_t>> xdp_sockets;
+
+    std::shared_ptr<xdp::socket_t> get_xdp_socket(int sockfd) {
+      std::lock_guard lg {xdp_sockets_lock};
+
+      auto it = xdp_sockets.find(sockfd);
+      return it != std::end(xdp_sockets) ? it->second : nullptr;
+    }
+
+    /**
+     * @brief Stops sending the batches of a socket through AF_XDP.
+     */
+    class xdp_deinit_t: public deinit_t {
+    public:
+      xdp_deinit_t(int sockfd):
+          sockfd(sockfd) {
+      }
+
+      virtual ~xdp_deinit_t() {
+        std::lock_guard lg {xdp_sockets_lock};
+        xdp_sockets.erase(sockfd);
+      }
+
+    private:
+      int sockfd;
+    };
+  }  // namespace
+
+  std::unique_ptr<deinit_t> enable_socket_xdp(uintptr_t native_socket, const std::string &interface) {
+    auto sockfd = (int) native_socket;
+
+    std::shared_ptr<xdp::socket_t> xsk = xdp::socket_t::make(interface, native_socket);
+    if (!xsk) {
+      return nullptr;
+    }
+
+    {
+      std::lock_guard lg {xdp_sockets_lock};
+      xdp_sockets[sockfd] = std::move(xsk);
+    }
+
+    return std::make_unique<xdp_deinit_t>(sockfd);
+  }
+
+  /**
+   * @brief Wait until the kernel no longer references the buffers of the sends made with a ticket.
+   * @param native_socket The native socket handle.
+   * @param ticket The ticket passed to `send_batch()`, which is cleared on return.
+   */
+  void wait_for_zerocopy(uintptr_t native_socket, zerocopy_ticket_t &ticket) {
+    if (!ticket.last_id) {
+      return;
+    }
+
+    auto sockfd = (int) native_socket;
+    auto zc = get_zerocopy_socket(sockfd);
+    if (!zc) {
+      ticket.last_id.reset();
+      return;
+    }
+
+    std::lock_guard lg {zc->completion_lock};
+
+    // Completions normally arrive within microseconds of the packets leaving the host,
+    // so only give up if the kernel seems to have lost track of them
+    auto deadline = std::chrono::steady_clock::now() + 100ms;
+    while (zc->completed_below <= *ticket.last_id) {
+      if (read_zerocopy_completions(sockfd, *zc)) {
+        continue;
+      }
+
+      if (std::chrono::steady_clock::now() > deadline) {
+        BOOST_LOG(warning) << "Timed out waiting for zero-copy send completions"sv;
+        zc->completed_below = *ticket.last_id + 1;
+        break;
+      }
+
+      // POLLERR is always reported, regardless of the requested events
+      struct pollfd pfd = {};
+      pfd.fd = sockfd;
+      poll(&pfd, 1, 1);
+    }
+
+    ticket.last_id.reset();
+  }
+
   bool send_batch(batched_send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
+
+    // Packets sent through AF_XDP are copied, so they never hold on to a zero-copy ticket
+    if (auto xsk = get_xdp_socket(sockfd); xsk && xsk->send(send_info)) {
+      return true;
+    }
     struct msghdr msg = {};
 
-    // Convert the target address into a sockaddr
+    // Convert the target address into a sockaddr, a connected socket already has it
     struct sockaddr_in taddr_v4 = {};
     struct sockaddr_in6 taddr_v6 = {};
-    if (send_info.target_address.is_v6()) {
+    if (send_info.connected) {
+      msg.msg_name = nullptr;
+      msg.msg_namelen = 0;
+    } else if (send_info.target_address.is_v6()) {
       taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
 
       msg.msg_name = (struct sockaddr *) &taddr_v6;
@@ -466,7 +1328,7 @@ std::string get_local_ip_for_gateway() {
     }
 
     union {
-      char buf[CMSG_SPACE(sizeof(uint16_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+      char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
       struct cmsghdr alignment;
     } cmbuf = {};  // Must be zeroed for CMSG_NXTHDR()
 
@@ -475,10 +1337,13 @@ std::string get_local_ip_for_gateway() {
     msg.msg_control = cmbuf.buf;
     msg.msg_controllen = sizeof(cmbuf.buf);
 
-    // The PKTINFO option will always be first, then we will conditionally
-    // append the UDP_SEGMENT option next if applicable.
+    // The PKTINFO option will be first unless the socket is bound to the source address, followed by
+    // the TXTIME option if requested, then we will conditionally append the UDP_SEGMENT option next if applicable.
+    struct cmsghdr *last_cm = nullptr;
     auto pktinfo_cm = CMSG_FIRSTHDR(&msg);
-    if (send_info.source_address.is_v6()) {
+    if (send_info.connected) {
+      // The source address was chosen when binding
+    } else if (send_info.source_address.is_v6()) {
       struct in6_pktinfo pktInfo;
 
       struct sockaddr_in6 saddr_v6 = to_sockaddr(send_info.source_address.to_v6(), 0);
@@ -506,6 +1371,24 @@ std::string get_local_ip_for_gateway() {
       memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
     }
 
+    if (!send_info.connected) {
+      last_cm = pktinfo_cm;
+    }
+#ifdef SCM_TXTIME
+    if (send_info.txtime) {
+      // steady_clock is CLOCK_MONOTONIC, which is also the clock passed to SO_TXTIME
+      uint64_t txtime = std::chrono::duration_cast<std::chrono::nanoseconds>(send_info.txtime->time_since_epoch()).count();
+
+      cmbuflen += CMSG_SPACE(sizeof(txtime));
+
+      last_cm = last_cm ? CMSG_NXTHDR(&msg, last_cm) : CMSG_FIRSTHDR(&msg);
+      last_cm->cmsg_level = SOL_SOCKET;
+      last_cm->cmsg_type = SCM_TXTIME;
+      last_cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+      memcpy(CMSG_DATA(last_cm), &txtime, sizeof(txtime));
+    }
+#endif
+
     auto const max_iovs_per_msg = send_info.payload_buffers.size() + (send_info.headers ? 1 : 0);
 
 #ifdef UDP_SEGMENT
@@ -515,6 +1398,8 @@ std::string get_local_ip_for_gateway() {
       const size_t seg_max = 65536 / 1500;
       struct iovec iovs[(send_info.headers ? std::min(seg_max, send_info.block_count) : 1) * max_iovs_per_msg];
       auto msg_size = send_info.header_size + send_info.payload_size;
+
+      auto zc = send_info.zerocopy ? get_zerocopy_socket(sockfd) : nullptr;
       while (seg_index < send_info.block_count) {
         int iovlen = 0;
         auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
@@ -550,7 +1435,7 @@ std::string get_local_ip_for_gateway() {
           msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t));
 
           // Enable GSO to perform segmentation of our buffer for us
-          auto cm = CMSG_NXTHDR(&msg, pktinfo_cm);
+          auto cm = last_cm ? CMSG_NXTHDR(&msg, last_cm) : CMSG_FIRSTHDR(&msg);
           cm->cmsg_level = SOL_UDP;
           cm->cmsg_type = UDP_SEGMENT;
           cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
@@ -562,7 +1447,23 @@ std::string get_local_ip_for_gateway() {
         // This will fail if GSO is not available, so we will fall back to non-GSO if
         // it's the first sendmsg() call. On subsequent calls, we will treat errors as
         // actual failures and return to the caller.
-        auto bytes_sent = sendmsg(sockfd, &msg, 0);
+        ssize_t bytes_sent;
+#ifdef MSG_ZEROCOPY
+        if (zc) {
+          std::lock_guard lg {zc->send_lock};
+
+          bytes_sent = sendmsg(sockfd, &msg, MSG_ZEROCOPY);
+          if (bytes_sent >= 0) {
+            send_info.zerocopy->last_id = zc->next_id++;
+          } else if (errno == ENOBUFS) {
+            // Out of option memory to track zero-copy sends, so just copy this one
+            bytes_sent = sendmsg(sockfd, &msg, 0);
+          }
+        } else
+#endif
+        {
+          bytes_sent = sendmsg(sockfd, &msg, 0);
+        }
         if (bytes_sent < 0) {
           // If there's no send buffer space, wait for some to be available
           if (errno == EAGAIN) {
@@ -580,7 +1481,7 @@ std::string get_local_ip_for_gateway() {
             continue;
           }
 
-          BOOST_LOG(verbose) << "sendmsg() failed: "sv << errno;
+          BOOST_LOG_HOT(verbose) << "sendmsg() failed: "sv << errno;
           break;
         }
 
@@ -653,96 +1554,129 @@ std::string get_local_ip_for_gateway() {
     }
   }
 
-  bool send(send_info_t &send_info) {
-    auto sockfd = (int) send_info.native_socket;
-    struct msghdr msg = {};
+  /**
+   * @brief The msghdr describing a single send_info_t, along with the buffers it points into.
+   */
+  struct send_msg_t {
+    struct msghdr msg;
+
+    union {
+      struct sockaddr_in v4;
+      struct sockaddr_in6 v6;
+    } taddr;
+
+    struct {
+      alignas(struct cmsghdr) char buf[std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+    } cmbuf;
+
+    struct iovec iovs[2];
+
+    void init(send_info_t &send_info) {
+      msg = {};
+
+      // Convert the target address into a sockaddr, a connected socket already has it
+      if (send_info.connected) {
+        msg.msg_name = nullptr;
+        msg.msg_namelen = 0;
+      } else if (send_info.target_address.is_v6()) {
+        taddr.v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+
+        msg.msg_name = (struct sockaddr *) &taddr.v6;
+        msg.msg_namelen = sizeof(taddr.v6);
+      } else {
+        taddr.v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
 
-    // Convert the target address into a sockaddr
-    struct sockaddr_in taddr_v4 = {};
-    struct sockaddr_in6 taddr_v6 = {};
-    if (send_info.target_address.is_v6()) {
-      taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+        msg.msg_name = (struct sockaddr *) &taddr.v4;
+        msg.msg_namelen = sizeof(taddr.v4);
+      }
 
-      msg.msg_name = (struct sockaddr *) &taddr_v6;
-      msg.msg_namelen = sizeof(taddr_v6);
-    } else {
-      taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
+      socklen_t cmbuflen = 0;
 
-      msg.msg_name = (struct sockaddr *) &taddr_v4;
-      msg.msg_namelen = sizeof(taddr_v4);
-    }
+      msg.msg_control = cmbuf.buf;
+      msg.msg_controllen = sizeof(cmbuf.buf);
 
-    union {
-      char buf[std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
-      struct cmsghdr alignment;
-    } cmbuf;
+      auto pktinfo_cm = CMSG_FIRSTHDR(&msg);
+      if (send_info.connected) {
+        // The source address was chosen when binding
+      } else if (send_info.source_address.is_v6()) {
+        struct in6_pktinfo pktInfo;
 
-    socklen_t cmbuflen = 0;
+        struct sockaddr_in6 saddr_v6 = to_sockaddr(send_info.source_address.to_v6(), 0);
+        pktInfo.ipi6_addr = saddr_v6.sin6_addr;
+        pktInfo.ipi6_ifindex = 0;
 
-    msg.msg_control = cmbuf.buf;
-    msg.msg_controllen = sizeof(cmbuf.buf);
+        cmbuflen += CMSG_SPACE(sizeof(pktInfo));
 
-    auto pktinfo_cm = CMSG_FIRSTHDR(&msg);
-    if (send_info.source_address.is_v6()) {
-      struct in6_pktinfo pktInfo;
+        pktinfo_cm->cmsg_level = IPPROTO_IPV6;
+        pktinfo_cm->cmsg_type = IPV6_PKTINFO;
+        pktinfo_cm->cmsg_len = CMSG_LEN(sizeof(pktInfo));
+        memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
+      } else {
+        struct in_pktinfo pktInfo;
 
-      struct sockaddr_in6 saddr_v6 = to_sockaddr(send_info.source_address.to_v6(), 0);
-      pktInfo.ipi6_addr = saddr_v6.sin6_addr;
-      pktInfo.ipi6_ifindex = 0;
+        struct sockaddr_in saddr_v4 = to_sockaddr(send_info.source_address.to_v4(), 0);
+        pktInfo.ipi_spec_dst = saddr_v4.sin_addr;
+        pktInfo.ipi_ifindex = 0;
 
-      cmbuflen += CMSG_SPACE(sizeof(pktInfo));
+        cmbuflen += CMSG_SPACE(sizeof(pktInfo));
 
-      pktinfo_cm->cmsg_level = IPPROTO_IPV6;
-      pktinfo_cm->cmsg_type = IPV6_PKTINFO;
-      pktinfo_cm->cmsg_len = CMSG_LEN(sizeof(pktInfo));
-      memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
-    } else {
-      struct in_pktinfo pktInfo;
+        pktinfo_cm->cmsg_level = IPPROTO_IP;
+        pktinfo_cm->cmsg_type = IP_PKTINFO;
+        pktinfo_cm->cmsg_len = CMSG_LEN(sizeof(pktInfo));
+        memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
+      }
 
-      struct sockaddr_in saddr_v4 = to_sockaddr(send_info.source_address.to_v4(), 0);
-      pktInfo.ipi_spec_dst = saddr_v4.sin_addr;
-      pktInfo.ipi_ifindex = 0;
+      int iovlen = 0;
+      if (send_info.header) {
+        iovs[iovlen].iov_base = (void *) send_info.header;
+        iovs[iovlen].iov_len = send_info.header_size;
+        iovlen++;
+      }
+      iovs[iovlen].iov_base = (void *) send_info.payload;
+      iovs[iovlen].iov_len = send_info.payload_size;
+      iovlen++;
 
-      cmbuflen += CMSG_SPACE(sizeof(pktInfo));
+      msg.msg_iov = iovs;
+      msg.msg_iovlen = iovlen;
 
-      pktinfo_cm->cmsg_level = IPPROTO_IP;
-      pktinfo_cm->cmsg_type = IP_PKTINFO;
-      pktinfo_cm->cmsg_len = CMSG_LEN(sizeof(pktInfo));
-      memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
+      msg.msg_controllen = cmbuflen;
     }
+  };
 
-    struct iovec iovs[2];
-    int iovlen = 0;
-    if (send_info.header) {
-      iovs[iovlen].iov_base = (void *) send_info.header;
-      iovs[iovlen].iov_len = send_info.header_size;
-      iovlen++;
+  /**
+   * @brief Wait for send buffer space to be available.
+   * @return `true` if there is space now.
+   */
+  static bool wait_for_send_space(int sockfd) {
+    struct pollfd pfd;
+
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+
+    if (poll(&pfd, 1, -1) != 1) {
+      BOOST_LOG(warning) << "poll() failed: "sv << errno;
+      return false;
     }
-    iovs[iovlen].iov_base = (void *) send_info.payload;
-    iovs[iovlen].iov_len = send_info.payload_size;
-    iovlen++;
 
-    msg.msg_iov = iovs;
-    msg.msg_iovlen = iovlen;
+    return true;
+  }
+
+  bool send(send_info_t &send_info) {
+    auto sockfd = (int) send_info.native_socket;
 
-    msg.msg_controllen = cmbuflen;
+    send_msg_t send_msg;
+    send_msg.init(send_info);
 
-    auto bytes_sent = sendmsg(sockfd, &msg, 0);
+    auto bytes_sent = sendmsg(sockfd, &send_msg.msg, 0);
 
     // If there's no send buffer space, wait for some to be available
     while (bytes_sent < 0 && errno == EAGAIN) {
-      struct pollfd pfd;
-
-      pfd.fd = sockfd;
-      pfd.events = POLLOUT;
-
-      if (poll(&pfd, 1, -1) != 1) {
-        BOOST_LOG(warning) << "poll() failed: "sv << errno;
+      if (!wait_for_send_space(sockfd)) {
         break;
       }
 
       // Try to send again
-      bytes_sent = sendmsg(sockfd, &msg, 0);
+      bytes_sent = sendmsg(sockfd, &send_msg.msg, 0);
     }
 
     if (bytes_sent < 0) {
@@ -753,6 +1687,53 @@ std::string get_local_ip_for_gateway() {
     return true;
   }
 
+  bool send_many(std::span<send_info_t> send_infos) {
+    // Enough for every audio packet and FEC shard the audio thread batches
+    constexpr std::size_t max_msgs = 64;
+
+    std::array<send_msg_t, max_msgs> send_msgs;
+    std::array<struct mmsghdr, max_msgs> mmsgs;
+
+    bool success = true;
+    while (!send_infos.empty()) {
+      // Each sendmmsg() call goes through one socket, so packets of other sockets wait for the next one
+      auto sockfd = (int) send_infos.front().native_socket;
+      std::size_t count = 1;
+      while (count < std::min(send_infos.size(), max_msgs) && (int) send_infos[count].native_socket == sockfd) {
+        ++count;
+      }
+
+      for (std::size_t x = 0; x < count; ++x) {
+        send_msgs[x].init(send_infos[x]);
+
+        mmsgs[x].msg_hdr = send_msgs[x].msg;
+        mmsgs[x].msg_len = 0;
+      }
+      send_infos = send_infos.subspan(count);
+
+      std::size_t sent = 0;
+      while (sent < count) {
+        auto msgs_sent = sendmmsg(sockfd, mmsgs.data() + sent, count - sent, 0);
+        if (msgs_sent >= 0) {
+          sent += msgs_sent;
+          continue;
+        }
+
+        // If there's no send buffer space, wait for some to be available and try to send again
+        if (errno == EAGAIN && wait_for_send_space(sockfd)) {
+          continue;
+        }
+
+        // Only the first message failed, so the rest still gets a chance
+        BOOST_LOG(warning) << "sendmmsg() failed: "sv << errno;
+        success = false;
+        ++sent;
+      }
+    }
+
+    return success;
+  }
+
   // We can't track QoS state separately for each destination on this OS,
   // so we keep a ref count to only disable QoS options when all clients
   // are disconnected.
@@ -853,6 +1834,122 @@ std::string get_local_ip_for_gateway() {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  /**
+   * @brief Get the largest IP packet that reaches an address without being fragmented.
+   * @param address The destination.
+   * @return The MTU in bytes, -1 if it's unknown.
+   */
+  int path_mtu(const boost::asio::ip::address &address) {
+    auto target = address;
+    if (target.is_v6() && target.to_v6().is_v4_mapped()) {
+      target = boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, target.to_v6());
+    }
+
+    // Connecting a datagram socket only looks up the route, which holds the path MTU
+    auto sockfd = socket(target.is_v6() ? AF_INET6 : AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+      return -1;
+    }
+
+    int status;
+    if (target.is_v6()) {
+      auto taddr = to_sockaddr(target.to_v6(), 9);
+      status = connect(sockfd, (struct sockaddr *) &taddr, sizeof(taddr));
+    } else {
+      auto taddr = to_sockaddr(target.to_v4(), 9);
+      status = connect(sockfd, (struct sockaddr *) &taddr, sizeof(taddr));
+    }
+
+    int mtu = -1;
+    socklen_t mtu_len = sizeof(mtu);
+    if (status < 0 || getsockopt(sockfd, target.is_v6() ? IPPROTO_IPV6 : IPPROTO_IP, target.is_v6() ? IPV6_MTU : IP_MTU, &mtu, &mtu_len) < 0) {
+      BOOST_LOG(debug) << "Couldn't get the path MTU to ["sv << target << "]: "sv << errno;
+      mtu = -1;
+    }
+
+    close(sockfd);
+    return mtu;
+  }
+
+  std::vector<interface_address_t> interface_addresses() {
+    std::vector<interface_address_t> addresses;
+
+    auto ifaddr = get_ifaddrs();
+    for (auto pos = ifaddr.get(); pos != nullptr; pos = pos->ifa_next) {
+      if (!pos->ifa_addr || !pos->ifa_netmask || !(pos->ifa_flags & IFF_UP) || (pos->ifa_flags & IFF_LOOPBACK)) {
+        continue;
+      }
+
+      int prefix_length = 0;
+      if (pos->ifa_addr->sa_family == AF_INET) {
+        prefix_length = std::popcount(((sockaddr_in *) pos->ifa_netmask)->sin_addr.s_addr);
+      } else if (pos->ifa_addr->sa_family == AF_INET6) {
+        for (auto byte : ((sockaddr_in6 *) pos->ifa_netmask)->sin6_addr.s6_addr) {
+          prefix_length += std::popcount(byte);
+        }
+      } else {
+        continue;
+      }
+
+      addresses.push_back({
+        pos->ifa_name,
+        boost::asio::ip::make_address(from_sockaddr(pos->ifa_addr)),
+        prefix_length,
+      });
+    }
+
+    return addresses;
+  }
+
+  std::optional<interface_stats_t> interface_stats(const std::string &name) {
+    auto dir = fs::path {"/sys/class/net"} / name;
+
+    auto read = [&dir](const char *file) -> std::optional<std::uint64_t> {
+      std::ifstream in {dir / file};
+      std::uint64_t value;
+      if (!(in >> value)) {
+        return std::nullopt;
+      }
+      return value;
+    };
+
+    auto tx_packets = read("statistics/tx_packets");
+    auto tx_dropped = read("statistics/tx_dropped");
+    auto tx_errors = read("statistics/tx_errors");
+    if (!tx_packets || !tx_dropped || !tx_errors) {
+      return std::nullopt;
+    }
+
+    // Reading the carrier of an interface that's down fails
+    return interface_stats_t {
+      read("carrier").value_or(0) == 1,
+      *tx_packets,
+      *tx_dropped,
+      *tx_errors,
+    };
+  }
+
+  /**
+   * @brief Enable kernel pacing of outgoing traffic on the given socket.
+   * @param native_socket The native socket handle.
+   * @return `true` if transmit times are supported on this socket.
+   */
+  bool enable_socket_txtime(uintptr_t native_socket) {
+#ifdef SO_TXTIME
+    struct sock_txtime txtime = {};
+    txtime.clockid = CLOCK_MONOTONIC;
+
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+      BOOST_LOG(warning) << "Failed to enable SO_TXTIME: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -873,6 +1970,9 @@ std::string get_local_ip_for_gateway() {
 #ifdef SUNSHINE_BUILD_DRM
       KMS,  ///< KMS
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+      PORTAL,  ///< XDG desktop portal
+#endif
 #ifdef SUNSHINE_BUILD_X11
       X11,  ///< X11
 #endif
@@ -882,6 +1982,14 @@ std::string get_local_ip_for_gateway() {
 
   static std::bitset<source::MAX_FLAGS> sources;
 
+  /**
+   * @brief Check if a source may be used for the current capture method.
+   * @details Several sources are enumerated when the methods are benchmarked, only the one picked is used.
+   */
+  static bool allowed(std::string_view method) {
+    return config::video.capture.empty() || config::video.capture == method;
+  }
+
 #ifdef SUNSHINE_BUILD_CUDA
   std::vector<std::string> nvfbc_display_names();
   std::shared_ptr<display_t> nvfbc_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
@@ -909,6 +2017,15 @@ std::string get_local_ip_for_gateway() {
   }
 #endif
 
+#ifdef SUNSHINE_BUILD_PORTAL
+  std::vector<std::string> portal_display_names();
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
+
+  bool verify_portal() {
+    return window_system == window_system_e::WAYLAND && !portal_display_names().empty();
+  }
+#endif
+
 #ifdef SUNSHINE_BUILD_X11
   std::vector<std::string> x11_display_names();
   std::shared_ptr<display_t> x11_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
@@ -918,31 +2035,99 @@ std::string get_local_ip_for_gateway() {
   }
 #endif
 
-  std::vector<std::string> display_names(mem_type_e hwdevice_type) {
+  static std::vector<std::string> source_display_names(mem_type_e hwdevice_type) {
 #ifdef SUNSHINE_BUILD_CUDA
     // display using NvFBC only supports mem_type_e::cuda
-    if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
+    if (sources[source::NVFBC] && allowed("nvfbc"sv) && hwdevice_type == mem_type_e::cuda) {
       return nvfbc_display_names();
     }
 #endif
 #ifdef SUNSHINE_BUILD_WAYLAND
-    if (sources[source::WAYLAND]) {
+    if (sources[source::WAYLAND] && allowed("wlr"sv)) {
       return wl_display_names();
     }
 #endif
 #ifdef SUNSHINE_BUILD_DRM
-    if (sources[source::KMS]) {
+    if (sources[source::KMS] && allowed("kms"sv)) {
       return kms_display_names(hwdevice_type);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL] && allowed("portal"sv)) {
+      return portal_display_names();
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
-    if (sources[source::X11]) {
+    if (sources[source::X11] && allowed("x11"sv)) {
       return x11_display_names();
     }
 #endif
     return {};
   }
 
+  std::vector<std::string> display_names(mem_type_e hwdevice_type) {
+    auto names = source_display_names(hwdevice_type);
+
+    // The framebuffers of EVDI virtual displays are captured directly, whichever source captures the others
+    auto evdi_names = VDISPLAY::evdiDisplayNames();
+    names.insert(std::end(names), std::begin(evdi_names), std::end(evdi_names));
+
+    return names;
+  }
+
+  std::uint64_t display_topology_generation() {
+    static std::mutex lock;
+    static std::uint64_t generation = 0;
+    static int fd = -2;
+
+    std::lock_guard lg {lock};
+
+    if (fd == -2) {
+      // The kernel broadcasts a uevent of the DRM subsystem for every connector hotplug, EVDI virtual displays included.
+      // Outputs a compositor enables or disables on its own are picked up once their capture fails, which always enumerates again.
+      fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+      if (fd >= 0) {
+        sockaddr_nl addr {};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1;
+        if (bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+          BOOST_LOG(warning) << "Couldn't listen for display hotplugs, displays are enumerated each time: "sv << strerror(errno);
+          close(fd);
+          fd = -1;
+        }
+      } else {
+        BOOST_LOG(warning) << "Couldn't listen for display hotplugs, displays are enumerated each time: "sv << strerror(errno);
+      }
+
+      return ++generation;
+    }
+
+    if (fd < 0) {
+      return ++generation;
+    }
+
+    // A uevent is "action@devpath" followed by NUL separated "KEY=value" pairs
+    std::array<char, 8192> buffer;
+    ssize_t size;
+    bool changed = false;
+    while ((size = recv(fd, buffer.data(), buffer.size(), 0)) > 0) {
+      std::string_view event {buffer.data(), (std::size_t) size};
+      if (event.find("\0SUBSYSTEM=drm\0"sv) != std::string_view::npos) {
+        changed = true;
+      }
+    }
+
+    // Events were lost, so anything may have changed
+    if (size < 0 && errno == ENOBUFS) {
+      changed = true;
+    }
+
+    if (changed) {
+      ++generation;
+    }
+    return generation;
+  }
+
   /**
    * @brief Returns if GPUs/drivers have changed since the last call to this function.
    * @return `true` if a change has occurred or if it is unknown whether a change occurred.
@@ -952,27 +2137,150 @@ std::string get_local_ip_for_gateway() {
     return true;
   }
 
+  std::string encoder_probe_fingerprint() {
+    auto read_line = [](const fs::path &path) {
+      std::ifstream in {path};
+      std::string line;
+      std::getline(in, line);
+      return line;
+    };
+
+    std::error_code ec;
+    fs::directory_iterator drm {"/sys/class/drm", ec};
+    if (ec) {
+      return {};
+    }
+
+    std::vector<std::string> lines;
+    for (auto &entry : drm) {
+      auto name = entry.path().filename().string();
+
+      // Connected outputs, e.g. card1-DP-2
+      if (name.starts_with("card"sv) && name.find('-') != std::string::npos) {
+        if (read_line(entry.path() / "status") == "connected"sv) {
+          lines.emplace_back("output "s + name);
+        }
+        continue;
+      }
+
+      if (!name.starts_with("renderD"sv)) {
+        continue;
+      }
+
+      auto device = entry.path() / "device";
+      auto driver = fs::read_symlink(device / "driver", ec).filename().string();
+
+      auto gpu = "gpu "s + fs::canonical(device, ec).filename().string();
+      for (auto attribute : {"vendor", "device", "subsystem_vendor", "subsystem_device", "revision"}) {
+        gpu += ' ' + read_line(device / attribute);
+      }
+
+      // Out-of-tree drivers like nvidia have their own version, in-tree drivers are versioned with the kernel
+      gpu += ' ' + driver + ' ' + read_line(fs::path {"/sys/module"} / driver / "version");
+      lines.emplace_back(std::move(gpu));
+    }
+
+    // Render node numbers aren't stable across boots, the PCI addresses are
+    std::sort(std::begin(lines), std::end(lines));
+
+    utsname kernel;
+    std::string fingerprint = uname(&kernel) ? "kernel unknown"s : "kernel "s + kernel.release;
+    for (auto &line : lines) {
+      fingerprint += '\n' + line;
+    }
+
+    // The userspace drivers and the session to capture are picked through the environment
+    for (auto var : {"LIBVA_DRIVER_NAME", "WAYLAND_DISPLAY", "DISPLAY"}) {
+      if (auto value = std::getenv(var)) {
+        fingerprint += '\n' + std::string {var} + '=' + value;
+      }
+    }
+
+    return fingerprint;
+  }
+
+  bool concurrent_encoder_probing() {
+#ifdef SUNSHINE_BUILD_PORTAL
+    // The displays of the portal take turns consuming the one PipeWire stream of each monitor
+    if (sources[source::PORTAL] && allowed("portal"sv)) {
+      return false;
+    }
+#endif
+
+    // Every other display_t has its own connection to X11, Wayland or KMS
+    return true;
+  }
+
+  std::vector<std::string> capture_methods() {
+    std::vector<std::string> methods;
+#ifdef SUNSHINE_BUILD_CUDA
+    if (sources[source::NVFBC]) {
+      methods.emplace_back("nvfbc"s);
+    }
+#endif
+#ifdef SUNSHINE_BUILD_WAYLAND
+    if (sources[source::WAYLAND]) {
+      methods.emplace_back("wlr"s);
+    }
+#endif
+#ifdef SUNSHINE_BUILD_DRM
+    if (sources[source::KMS]) {
+      methods.emplace_back("kms"s);
+    }
+#endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL]) {
+      methods.emplace_back("portal"s);
+    }
+#endif
+#ifdef SUNSHINE_BUILD_X11
+    if (sources[source::X11]) {
+      methods.emplace_back("x11"s);
+    }
+#endif
+    return methods;
+  }
+
+  std::chrono::nanoseconds process_cpu_time() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::seconds {ts.tv_sec} + std::chrono::nanoseconds {ts.tv_nsec};
+  }
+
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (VDISPLAY::isEvdiDisplay(display_name)) {
+      if (auto disp = VDISPLAY::evdiDisplay(hwdevice_type, display_name, config)) {
+        BOOST_LOG(info) << "Screencasting the framebuffer of EVDI virtual display ["sv << display_name << ']';
+        return disp;
+      }
+    }
+
 #ifdef SUNSHINE_BUILD_CUDA
-    if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
+    if (sources[source::NVFBC] && allowed("nvfbc"sv) && hwdevice_type == mem_type_e::cuda) {
       BOOST_LOG(info) << "Screencasting with NvFBC"sv;
       return nvfbc_display(hwdevice_type, display_name, config);
     }
 #endif
 #ifdef SUNSHINE_BUILD_WAYLAND
-    if (sources[source::WAYLAND]) {
+    if (sources[source::WAYLAND] && allowed("wlr"sv)) {
       BOOST_LOG(info) << "Screencasting with Wayland's protocol"sv;
       return wl_display(hwdevice_type, display_name, config);
     }
 #endif
 #ifdef SUNSHINE_BUILD_DRM
-    if (sources[source::KMS]) {
+    if (sources[source::KMS] && allowed("kms"sv)) {
       BOOST_LOG(info) << "Screencasting with KMS"sv;
       return kms_display(hwdevice_type, display_name, config);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL] && allowed("portal"sv)) {
+      BOOST_LOG(info) << "Screencasting with the XDG desktop portal"sv;
+      return portal_display(hwdevice_type, display_name, config);
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
-    if (sources[source::X11]) {
+    if (sources[source::X11] && allowed("x11"sv)) {
       BOOST_LOG(info) << "Screencasting with X11"sv;
       return x11_display(hwdevice_type, display_name, config);
     }
@@ -1005,27 +2313,36 @@ std::string get_local_ip_for_gateway() {
     }
 #endif
 
+    // When benchmarking, every source that works is enumerated so they can be compared
 #ifdef SUNSHINE_BUILD_CUDA
-    if ((config::video.capture.empty() && sources.none()) || config::video.capture == "nvfbc") {
+    if ((config::video.capture.empty() && (sources.none() || config::video.capture_benchmark)) || config::video.capture == "nvfbc") {
       if (verify_nvfbc()) {
         sources[source::NVFBC] = true;
       }
     }
 #endif
 #ifdef SUNSHINE_BUILD_WAYLAND
-    if ((config::video.capture.empty() && sources.none()) || config::video.capture == "wlr") {
+    if ((config::video.capture.empty() && (sources.none() || config::video.capture_benchmark)) || config::video.capture == "wlr") {
       if (verify_wl()) {
         sources[source::WAYLAND] = true;
       }
     }
 #endif
 #ifdef SUNSHINE_BUILD_DRM
-    if ((config::video.capture.empty() && sources.none()) || config::video.capture == "kms") {
+    if ((config::video.capture.empty() && (sources.none() || config::video.capture_benchmark)) || config::video.capture == "kms") {
       if (verify_kms()) {
         sources[source::KMS] = true;
       }
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    // Only tried once KMS isn't available, since the user may have to allow the screencast on the host
+    if ((config::video.capture.empty() && (sources.none() || config::video.capture_benchmark)) || config::video.capture == "portal") {
+      if (verify_portal()) {
+        sources[source::PORTAL] = true;
+      }
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     // We enumerate this capture backend regardless of other suitable sources,
     // since it may be needed as a NvFBC fallback for software encoding on X11.
@@ -1048,21 +2365,133 @@ std::string get_local_ip_for_gateway() {
     return std::make_unique<deinit_t>();
   }
 
+  namespace {
+    std::chrono::nanoseconds monotonic_now() {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return std::chrono::seconds {ts.tv_sec} + std::chrono::nanoseconds {ts.tv_nsec};
+    }
+
+    timespec to_timespec(const std::chrono::nanoseconds &time) {
+      auto sec = std::chrono::duration_cast<std::chrono::seconds>(time);
+
+      return {
+        (time_t) sec.count(),
+        (long) (time - sec).count(),
+      };
+    }
+
+    /**
+     * @brief Sleep until an absolute point in time on `CLOCK_MONOTONIC`.
+     * @param deadline The time to wake up at.
+     */
+    void sleep_until(const std::chrono::nanoseconds &deadline) {
+      auto ts = to_timespec(deadline);
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        // Interrupted by a signal, keep sleeping until the deadline
+      }
+    }
+
+    void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#elif defined(__aarch64__)
+      asm volatile("yield");
+#endif
+    }
+
+    /**
+     * @brief Measure how late `clock_nanosleep()` wakes up on this system.
+     * @return The length of the busy-wait tail that covers most wake-ups.
+     */
+    std::chrono::nanoseconds calibrate_spin_tail() {
+      constexpr auto samples = 50;
+      constexpr auto sleep_duration = 200us;
+
+      std::array<std::chrono::nanoseconds, samples> errors;
+      for (auto &error : errors) {
+        auto deadline = monotonic_now() + sleep_duration;
+        sleep_until(deadline);
+        error = monotonic_now() - deadline;
+      }
+
+      // Cover 90% of the wake-ups, but never spin for more than a fraction of a pacing group
+      std::sort(std::begin(errors), std::end(errors));
+      auto spin_tail = std::clamp<std::chrono::nanoseconds>(errors[samples * 9 / 10] + 10us, 10us, 200us);
+
+      BOOST_LOG(info) << "High precision timer: 90th percentile wake-up error of "sv
+                      << std::chrono::duration_cast<std::chrono::microseconds>(errors[samples * 9 / 10]).count()
+                      << "us, spinning for the last "sv << std::chrono::duration_cast<std::chrono::microseconds>(spin_tail).count() << "us"sv;
+
+      return spin_tail;
+    }
+  }  // namespace
+
   class linux_high_precision_timer: public high_precision_timer {
   public:
+    linux_high_precision_timer() {
+      // Timers are created by the thread that paces with them
+      if (config::stream.pacing_realtime) {
+        adjust_thread_priority(thread_priority_e::critical);
+      }
+
+      // A real-time thread spinning would keep everything else off its CPU
+      auto policy = sched_getscheduler(0) & ~SCHED_RESET_ON_FORK;
+      if (config::stream.pacing_spin && (policy == SCHED_FIFO || policy == SCHED_RR)) {
+        static std::once_flag warn_once;
+        std::call_once(warn_once, []() {
+          BOOST_LOG(warning) << "pacing_spin is ignored by the pacing threads running with a real-time policy"sv;
+        });
+      } else if (config::stream.pacing_spin) {
+        static std::once_flag calibrate_once;
+        static std::chrono::nanoseconds calibrated_spin_tail;
+
+        std::call_once(calibrate_once, []() {
+          calibrated_spin_tail = calibrate_spin_tail();
+        });
+
+        spin_tail = calibrated_spin_tail;
+      }
+    }
+
     void sleep_for(const std::chrono::nanoseconds &duration) override {
-      std::this_thread::sleep_for(duration);
+      if (duration <= 0ns) {
+        return;
+      }
+
+      auto deadline = monotonic_now() + duration;
+
+      // Use an absolute deadline so time spent getting here isn't slept again,
+      // then busy-wait through the part where the kernel tends to wake us late
+      if (duration > spin_tail) {
+        sleep_until(deadline - spin_tail);
+      }
+
+      while (monotonic_now() < deadline) {
+        cpu_relax();
+      }
     }
 
     operator bool() override {
       return true;
     }
+
+  private:
+    std::chrono::nanoseconds spin_tail {0};
   };
 
   std::unique_ptr<high_precision_timer> create_high_precision_timer() {
     return std::make_unique<linux_high_precision_timer>();
   }
 
+  std::chrono::steady_clock::time_point from_monotonic(std::chrono::nanoseconds timestamp) {
+    // steady_clock may not be CLOCK_MONOTONIC itself, so only the age of the timestamp is carried over
+    auto now = std::chrono::steady_clock::now();
+    auto age = monotonic_now() - timestamp;
+
+    return now - std::max(age, std::chrono::nanoseconds {0});
+  }
+
   std::string
   get_clipboard() {
     // Placeholder
@@ -5,6 +5,7 @@
 #pragma once
 
 // standard includes
+#include <chrono>
 #include <unistd.h>
 #include <vector>
 
@@ -32,3 +33,12 @@ namespace dyn {
   void *handle(const std::vector<const char *> &libs);
 
 }  // namespace dyn
+
+namespace platf {
+  /**
+   * @brief Convert a timestamp on `CLOCK_MONOTONIC`, like those of the kernel and the compositors, to steady_clock.
+   * @param timestamp The time since the epoch of `CLOCK_MONOTONIC`.
+   * @return The time, no later than now.
+   */
+  std::chrono::steady_clock::time_point from_monotonic(std::chrono::nanoseconds timestamp);
+}  // namespace platf
@@ -0,0 +1,298 @@
+/**
+ * @file src/platform/linux/pipewire.cpp
+ * @brief Definitions for native PipeWire audio capture.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <string_view>
+
+// lib includes
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+
+// local includes
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/spsc_ring.h"
+#include "src/utility.h"
+
+// Only available as of PipeWire 0.3.64
+#ifndef PW_KEY_TARGET_OBJECT
+  #define PW_KEY_TARGET_OBJECT "target.object"
+#endif
+
+namespace platf::pw {
+  using namespace std::literals;
+
+  constexpr spa_audio_channel position_mapping[] {
+    SPA_AUDIO_CHANNEL_FL,
+    SPA_AUDIO_CHANNEL_FR,
+    SPA_AUDIO_CHANNEL_FC,
+    SPA_AUDIO_CHANNEL_LFE,
+    SPA_AUDIO_CHANNEL_RL,
+    SPA_AUDIO_CHANNEL_RR,
+    SPA_AUDIO_CHANNEL_SL,
+    SPA_AUDIO_CHANNEL_SR,
+  };
+
+  struct frame_t {
+    std::vector<float> samples;
+
+    // When the last of the samples arrived
+    std::chrono::steady_clock::time_point completed;
+  };
+
+  using loop_t = util::safe_ptr<pw_thread_loop, pw_thread_loop_destroy>;
+  using stream_t = util::safe_ptr<pw_stream, pw_stream_destroy>;
+
+  /**
+   * @brief Captures from a PipeWire stream processed on the realtime data thread of PipeWire.
+   * @details The data thread copies the samples out of the shared memory of PipeWire into the slots of a ring,
+   *          which sample() swaps with the buffer of the caller rather than copying them again.
+   */
+  class mic_pw_t: public mic_t {
+  public:
+    explicit mic_pw_t(std::size_t samples_per_frame) {
+      // Size every slot up front, so the data thread never allocates
+      for (std::size_t x = 0; x < decltype(frames)::capacity; ++x) {
+        frames.back()->samples.resize(samples_per_frame);
+        frames.push();
+      }
+      while (!frames.empty()) {
+        frames.pop();
+      }
+    }
+
+    ~mic_pw_t() override {
+      if (loop) {
+        pw_thread_loop_lock(loop.get());
+        stream.reset();
+        pw_thread_loop_unlock(loop.get());
+
+        pw_thread_loop_stop(loop.get());
+      }
+    }
+
+    int start(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &source_name) {
+      loop.reset(pw_thread_loop_new("sunshine-audio", nullptr));
+      if (!loop) {
+        BOOST_LOG(error) << "pw_thread_loop_new() failed"sv;
+        return -1;
+      }
+
+      auto props = pw_properties_new(
+        PW_KEY_MEDIA_TYPE,
+        "Audio",
+        PW_KEY_MEDIA_CATEGORY,
+        "Capture",
+        PW_KEY_NODE_NAME,
+        "sunshine-record",
+        // Fail over to reinitializing capture rather than being moved to another device silently
+        PW_KEY_NODE_DONT_RECONNECT,
+        "true",
+        nullptr
+      );
+
+      // Ask the graph for a quantum of one packet, so a packet is complete as soon as PipeWire hands it over
+      pw_properties_setf(props, PW_KEY_NODE_LATENCY, "%u/%u", frame_size, sample_rate);
+
+      if (!source_name.empty()) {
+        // The monitor source of a sink is the sink node itself for PipeWire
+        constexpr auto monitor_suffix = ".monitor"sv;
+
+        std::string_view target = source_name;
+        if (target.ends_with(monitor_suffix)) {
+          target.remove_suffix(monitor_suffix.size());
+          pw_properties_set(props, PW_KEY_STREAM_CAPTURE_SINK, "true");
+        }
+
+        pw_properties_set(props, PW_KEY_TARGET_OBJECT, std::string {target}.c_str());
+      }
+
+      pw_thread_loop_lock(loop.get());
+      auto unlock = util::fail_guard([this]() {
+        pw_thread_loop_unlock(loop.get());
+      });
+
+      if (pw_thread_loop_start(loop.get())) {
+        BOOST_LOG(error) << "pw_thread_loop_start() failed"sv;
+        return -1;
+      }
+
+      // Takes ownership of the properties
+      stream.reset(pw_stream_new_simple(pw_thread_loop_get_loop(loop.get()), "sunshine-record", props, &stream_events, this));
+      if (!stream) {
+        BOOST_LOG(error) << "pw_stream_new_simple() failed"sv;
+        return -1;
+      }
+
+      spa_audio_info_raw info {};
+      info.format = SPA_AUDIO_FORMAT_F32;
+      info.rate = sample_rate;
+      info.channels = channels;
+      for (int x = 0; x < channels; ++x) {
+        info.position[x] = position_mapping[mapping[x]];
+      }
+
+      std::array<std::uint8_t, 1024> pod_buffer;
+      spa_pod_builder builder;
+      spa_pod_builder_init(&builder, pod_buffer.data(), pod_buffer.size());
+
+      const spa_pod *params[] {
+        spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info)
+      };
+
+      auto flags = (pw_stream_flags) (PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS);
+      if (auto status = pw_stream_connect(stream.get(), PW_DIRECTION_INPUT, PW_ID_ANY, flags, params, std::size(params))) {
+        BOOST_LOG(error) << "pw_stream_connect() failed: "sv << spa_strerror(status);
+        return -1;
+      }
+
+      // Connecting fails asynchronously, e.g. when the source doesn't exist
+      const char *error_str = nullptr;
+      auto state = pw_stream_get_state(stream.get(), &error_str);
+      auto deadline = std::chrono::steady_clock::now() + 2s;
+      while (state == PW_STREAM_STATE_CONNECTING && std::chrono::steady_clock::now() < deadline) {
+        pw_thread_loop_timed_wait(loop.get(), 1);
+        state = pw_stream_get_state(stream.get(), &error_str);
+      }
+
+      if (state != PW_STREAM_STATE_PAUSED && state != PW_STREAM_STATE_STREAMING) {
+        BOOST_LOG(error) << "Couldn't connect PipeWire stream to ["sv << source_name << "]: "sv << (error_str ? error_str : pw_stream_state_as_string(state));
+        return -1;
+      }
+
+      BOOST_LOG(info) << "Capturing audio from ["sv << source_name << "] with PipeWire, quantum of "sv << frame_size << '/' << sample_rate;
+      return 0;
+    }
+
+    capture_e sample(std::vector<float> &sample_buf) override {
+      frames.wait();
+      if (frames.empty()) {
+        // Closed when the stream went away
+        return capture_e::reinit;
+      }
+
+      auto &frame = frames.front();
+      if (frame.samples.size() == sample_buf.size()) {
+        // The slot gets the buffer of the caller, which has the same size
+        std::swap(frame.samples, sample_buf);
+      } else {
+        std::fill(std::copy_n(frame.samples.begin(), std::min(frame.samples.size(), sample_buf.size()), sample_buf.begin()), sample_buf.end(), 0.0f);
+      }
+
+      _latency = std::chrono::steady_clock::now() - frame.completed;
+      frames.pop();
+
+      return capture_e::ok;
+    }
+
+    std::chrono::nanoseconds latency() override {
+      return _latency;
+    }
+
+  private:
+    /**
+     * @brief Split the samples of a PipeWire buffer over the slots of the ring.
+     * @details Called on the data thread only.
+     */
+    void write(const float *samples, std::size_t count) {
+      while (count > 0) {
+        auto frame = frames.back();
+        if (!frame) {
+          // The capture thread is behind, so the newest samples are dropped
+          return;
+        }
+
+        auto copied = std::min(count, frame->samples.size() - _filled);
+        std::copy_n(samples, copied, frame->samples.data() + _filled);
+
+        samples += copied;
+        count -= copied;
+        _filled += copied;
+
+        if (_filled == frame->samples.size()) {
+          frame->completed = std::chrono::steady_clock::now();
+          frames.push();
+
+          _filled = 0;
+        }
+      }
+    }
+
+    static void on_process(void *userdata) {
+      auto mic = (mic_pw_t *) userdata;
+
+      auto buffer = pw_stream_dequeue_buffer(mic->stream.get());
+      if (!buffer) {
+        return;
+      }
+
+      auto &data = buffer->buffer->datas[0];
+      if (data.data && data.chunk) {
+        auto offset = std::min(data.chunk->offset, data.maxsize);
+        auto size = std::min(data.chunk->size, data.maxsize - offset);
+
+        mic->write((const float *) ((const std::uint8_t *) data.data + offset), size / sizeof(float));
+      }
+
+      pw_stream_queue_buffer(mic->stream.get(), buffer);
+    }
+
+    static void on_state_changed(void *userdata, pw_stream_state old, pw_stream_state state, const char *error_str) {
+      auto mic = (mic_pw_t *) userdata;
+
+      BOOST_LOG(debug) << "PipeWire stream: "sv << pw_stream_state_as_string(old) << " -> "sv << pw_stream_state_as_string(state);
+
+      if (state == PW_STREAM_STATE_ERROR) {
+        BOOST_LOG(error) << "PipeWire stream failed: "sv << (error_str ? error_str : "unknown error");
+      }
+
+      if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED) {
+        mic->frames.close();
+      }
+
+      // Wakes up start()
+      pw_thread_loop_signal(mic->loop.get(), false);
+    }
+
+    static const pw_stream_events stream_events;
+
+    // Declared before the stream, so the stream is destroyed first
+    loop_t loop;
+    stream_t stream;
+
+    util::spsc_ring_t<frame_t, 8> frames;
+
+    // Only touched by the data thread
+    std::size_t _filled = 0;
+
+    // Only touched by the capture thread
+    std::chrono::nanoseconds _latency {};
+  };
+
+  const pw_stream_events mic_pw_t::stream_events = [] {
+    pw_stream_events events {};
+    events.version = PW_VERSION_STREAM_EVENTS;
+    events.state_changed = on_state_changed;
+    events.process = on_process;
+
+    return events;
+  }();
+
+  std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, const std::string &source_name) {
+    static std::once_flag init_flag;
+    std::call_once(init_flag, []() {
+      pw_init(nullptr, nullptr);
+    });
+
+    auto mic = std::make_unique<mic_pw_t>(frame_size * channels);
+    if (mic->start(mapping, channels, sample_rate, frame_size, source_name)) {
+      return nullptr;
+    }
+
+    return mic;
+  }
+}  // namespace platf::pw
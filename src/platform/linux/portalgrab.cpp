@@ -0,0 +1,1519 @@
+/**
+ * @file src/platform/linux/portalgrab.cpp
+ * @brief Definitions for screencasting through the XDG desktop portal and PipeWire.
+ * @note The portal hands out PipeWire streams of the monitors on any compositor implementing
+ *       org.freedesktop.portal.ScreenCast, e.g. GNOME and KDE, which doesn't require cap_sys_admin.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <variant>
+
+// platform includes
+#include <fcntl.h>
+#include <unistd.h>
+
+// lib includes
+#include <drm_fourcc.h>
+#include <pipewire/pipewire.h>
+#include <spa/buffer/meta.h>
+#include <spa/param/video/format-utils.h>
+#include <spa/pod/builder.h>
+#include <spa/utils/result.h>
+
+// local includes
+#include "cuda.h"
+#include "dbus.h"
+#include "graphics.h"
+#include "misc.h"
+#include "src/config.h"
+#include "src/file_handler.h"
+#include "src/globals.h"
+#include "src/image_memory.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/video.h"
+#include "vaapi.h"
+#include "vulkan.h"
+
+using namespace std::literals;
+
+namespace portal {
+  constexpr auto bus_name = "org.freedesktop.portal.Desktop";
+  constexpr auto object_path = "/org/freedesktop/portal/desktop";
+  constexpr auto screencast_interface = "org.freedesktop.portal.ScreenCast";
+
+  // Flags of org.freedesktop.portal.ScreenCast
+  constexpr std::uint32_t SOURCE_MONITOR = 1;
+  constexpr std::uint32_t CURSOR_EMBEDDED = 2;
+  constexpr std::uint32_t CURSOR_METADATA = 4;
+  constexpr std::uint32_t PERSIST_UNTIL_REVOKED = 2;
+
+  // Start() waits for the user to pick the monitors when the permission wasn't granted before
+  constexpr auto start_timeout = 2min;
+  constexpr auto call_timeout = 10s;
+
+  // The displays are often recreated right after they're destroyed, e.g. when probing the encoders
+  constexpr auto session_linger = 10s;
+
+  using message_t = util::dyn_safe_ptr<dbus::Message, &dbus::message_unref>;
+  using loop_t = util::safe_ptr<pw_thread_loop, pw_thread_loop_destroy>;
+  using context_t = util::safe_ptr<pw_context, pw_context_destroy>;
+  using core_t = util::safe_ptr_v2<pw_core, int, pw_core_disconnect>;
+  using stream_t = util::safe_ptr<pw_stream, pw_stream_destroy>;
+
+  using variant_t = std::variant<bool, std::uint32_t, std::string>;
+  using vardict_t = std::vector<std::pair<const char *, variant_t>>;
+
+  /**
+   * @brief A format of the frames, as known to PipeWire and DRM.
+   */
+  struct format_t {
+    spa_video_format spa;
+    std::uint32_t fourcc;
+  };
+
+  // The ones matching the BGRA layout of the images in system memory come first
+  constexpr format_t formats[] {
+    {SPA_VIDEO_FORMAT_BGRx, DRM_FORMAT_XRGB8888},
+    {SPA_VIDEO_FORMAT_BGRA, DRM_FORMAT_ARGB8888},
+    {SPA_VIDEO_FORMAT_RGBx, DRM_FORMAT_XBGR8888},
+    {SPA_VIDEO_FORMAT_RGBA, DRM_FORMAT_ABGR8888},
+  };
+  constexpr std::size_t ram_formats = 2;
+
+  // Serializes the calls over the session bus, which all sessions share
+  std::mutex bus_mutex;
+
+  // Makes sure only one session is started at a time
+  std::mutex session_mutex;
+
+  std::filesystem::path restore_token_path() {
+    return platf::appdata() / "portal_restore_token";
+  }
+
+  void append_vardict(dbus::MessageIter *iter, const vardict_t &vardict) {
+    dbus::MessageIter array;
+    dbus::message_iter_open_container(iter, dbus::TYPE_ARRAY, "{sv}", &array);
+    for (auto &[key, value] : vardict) {
+      dbus::MessageIter entry;
+      dbus::message_iter_open_container(&array, dbus::TYPE_DICT_ENTRY, nullptr, &entry);
+      dbus::message_iter_append_basic(&entry, dbus::TYPE_STRING, &key);
+
+      dbus::MessageIter variant;
+      if (auto boolean = std::get_if<bool>(&value)) {
+        dbus::bool_t basic = *boolean;
+        dbus::message_iter_open_container(&entry, dbus::TYPE_VARIANT, "b", &variant);
+        dbus::message_iter_append_basic(&variant, dbus::TYPE_BOOLEAN, &basic);
+      } else if (auto number = std::get_if<std::uint32_t>(&value)) {
+        dbus::message_iter_open_container(&entry, dbus::TYPE_VARIANT, "u", &variant);
+        dbus::message_iter_append_basic(&variant, dbus::TYPE_UINT32, number);
+      } else {
+        auto string = std::get<std::string>(value).c_str();
+        dbus::message_iter_open_container(&entry, dbus::TYPE_VARIANT, "s", &variant);
+        dbus::message_iter_append_basic(&variant, dbus::TYPE_STRING, &string);
+      }
+      dbus::message_iter_close_container(&entry, &variant);
+      dbus::message_iter_close_container(&array, &entry);
+    }
+    dbus::message_iter_close_container(iter, &array);
+  }
+
+  /**
+   * @brief Call a function for every entry of a vardict.
+   * @param iter The iterator at the a{sv}.
+   * @param on_entry Called with the key and an iterator at the value inside the variant.
+   */
+  void for_each_entry(dbus::MessageIter *iter, const std::function<void(std::string_view, dbus::MessageIter *)> &on_entry) {
+    if (dbus::message_iter_get_arg_type(iter) != dbus::TYPE_ARRAY) {
+      return;
+    }
+
+    dbus::MessageIter array;
+    dbus::message_iter_recurse(iter, &array);
+    for (; dbus::message_iter_get_arg_type(&array) == dbus::TYPE_DICT_ENTRY; dbus::message_iter_next(&array)) {
+      dbus::MessageIter entry;
+      dbus::message_iter_recurse(&array, &entry);
+
+      const char *key;
+      dbus::message_iter_get_basic(&entry, &key);
+      dbus::message_iter_next(&entry);
+
+      dbus::MessageIter value;
+      dbus::message_iter_recurse(&entry, &value);
+      on_entry(key, &value);
+    }
+  }
+
+  template<class T>
+  std::optional<T> get_basic(dbus::MessageIter *iter, int type) {
+    if (dbus::message_iter_get_arg_type(iter) != type) {
+      return std::nullopt;
+    }
+
+    T value;
+    dbus::message_iter_get_basic(iter, &value);
+    return value;
+  }
+
+  /**
+   * @brief Read a pair of integers, like the position and the size of a stream.
+   */
+  std::optional<std::pair<int, int>> get_pair(dbus::MessageIter *iter) {
+    if (dbus::message_iter_get_arg_type(iter) != dbus::TYPE_STRUCT) {
+      return std::nullopt;
+    }
+
+    dbus::MessageIter members;
+    dbus::message_iter_recurse(iter, &members);
+    auto first = get_basic<std::int32_t>(&members, dbus::TYPE_INT32);
+    dbus::message_iter_next(&members);
+    auto second = get_basic<std::int32_t>(&members, dbus::TYPE_INT32);
+    if (!first || !second) {
+      return std::nullopt;
+    }
+
+    return std::pair {*first, *second};
+  }
+
+  message_t call(dbus::Connection *connection, dbus::Message *message, std::chrono::milliseconds timeout) {
+    dbus::Error error;
+    dbus::error_init(&error);
+    message_t reply {dbus::connection_send_with_reply_and_block(connection, message, (int) timeout.count(), &error)};
+    if (dbus::error_is_set(&error)) {
+      BOOST_LOG(error) << "Portal call failed: "sv << error.message;
+      dbus::error_free(&error);
+      return nullptr;
+    }
+
+    return reply;
+  }
+
+  /**
+   * @brief Get an unsigned property of the ScreenCast portal.
+   * @return The value, or nothing if there is no such portal.
+   */
+  std::optional<std::uint32_t> screencast_property(dbus::Connection *connection, const char *name) {
+    message_t message {dbus::message_new_method_call(bus_name, object_path, "org.freedesktop.DBus.Properties", "Get")};
+    if (!message || !dbus::message_append_args(message.get(), dbus::TYPE_STRING, &screencast_interface, dbus::TYPE_STRING, &name, dbus::TYPE_INVALID)) {
+      return std::nullopt;
+    }
+
+    auto reply = call(connection, message.get(), call_timeout);
+    dbus::MessageIter iter;
+    if (!reply || !dbus::message_iter_init(reply.get(), &iter) || dbus::message_iter_get_arg_type(&iter) != dbus::TYPE_VARIANT) {
+      return std::nullopt;
+    }
+
+    dbus::MessageIter value;
+    dbus::message_iter_recurse(&iter, &value);
+    return get_basic<std::uint32_t>(&value, dbus::TYPE_UINT32);
+  }
+
+  /**
+   * @brief A screencast session of the portal, with the PipeWire streams of the monitors the user picked.
+   */
+  class session_t {
+  public:
+    struct stream_t {
+      std::uint32_t node_id;
+
+      // In the logical coordinates of the desktop
+      int x, y;
+      int width, height;
+    };
+
+    ~session_t() {
+      if (handle.empty()) {
+        return;
+      }
+
+      std::lock_guard lg {bus_mutex};
+      message_t message {dbus::message_new_method_call(bus_name, handle.c_str(), "org.freedesktop.portal.Session", "Close")};
+      if (message) {
+        call(connection, message.get(), call_timeout);
+      }
+    }
+
+    int init() {
+      std::lock_guard lg {bus_mutex};
+
+      connection = dbus::connect(dbus::BUS_SESSION);
+      if (!connection) {
+        return -1;
+      }
+
+      auto version = screencast_property(connection, "version");
+      auto source_types = screencast_property(connection, "AvailableSourceTypes");
+      if (!version || !source_types || !(*source_types & SOURCE_MONITOR)) {
+        BOOST_LOG(warning) << "The XDG desktop portal can't screencast monitors"sv;
+        return -1;
+      }
+
+      // The request objects are named after the unique name of the connection
+      sender = dbus::bus_get_unique_name(connection);
+      if (sender.starts_with(':')) {
+        sender.erase(0, 1);
+      }
+      std::replace(std::begin(sender), std::end(sender), '.', '_');
+
+      auto status = request("CreateSession", {}, {{"session_handle_token", "sunshine"s}}, call_timeout, [this](std::string_view key, dbus::MessageIter *value) {
+        if (key == "session_handle"sv) {
+          auto session_handle = get_basic<const char *>(value, dbus::TYPE_STRING);
+          handle = session_handle ? *session_handle : "";
+        }
+      });
+      if (status || handle.empty()) {
+        BOOST_LOG(error) << "Couldn't create a screencast session of the XDG desktop portal"sv;
+        return -1;
+      }
+
+      vardict_t options {
+        {"types", SOURCE_MONITOR},
+        {"multiple", true},
+      };
+
+      if (*version >= 2) {
+        // Metadata lets the cursor be toggled while streaming, it's blended in when encoding
+        auto cursor_modes = screencast_property(connection, "AvailableCursorModes").value_or(0);
+        if (cursor_modes & CURSOR_METADATA) {
+          options.emplace_back("cursor_mode", CURSOR_METADATA);
+        } else if (cursor_modes & CURSOR_EMBEDDED) {
+          options.emplace_back("cursor_mode", CURSOR_EMBEDDED);
+        }
+      }
+
+      if (*version >= 4) {
+        // The user isn't asked again as long as the previous permission is passed along
+        options.emplace_back("persist_mode", PERSIST_UNTIL_REVOKED);
+
+        auto restore_token = file_handler::read_file(restore_token_path().c_str());
+        if (!restore_token.empty()) {
+          options.emplace_back("restore_token", std::move(restore_token));
+        }
+      }
+
+      if (request("SelectSources", handle, std::move(options), call_timeout, nullptr)) {
+        BOOST_LOG(error) << "Couldn't select the monitors to screencast"sv;
+        return -1;
+      }
+
+      BOOST_LOG(info) << "Waiting for the XDG desktop portal to start screencasting, the monitors may have to be picked on the host"sv;
+
+      status = request("Start", handle, {}, start_timeout, [this](std::string_view key, dbus::MessageIter *value) {
+        if (key == "restore_token"sv) {
+          if (auto restore_token = get_basic<const char *>(value, dbus::TYPE_STRING)) {
+            file_handler::write_file_atomic(restore_token_path().c_str(), *restore_token);
+          }
+        } else if (key == "streams"sv) {
+          parse_streams(value);
+        }
+      });
+      if (status || streams.empty()) {
+        BOOST_LOG(error) << "The XDG desktop portal didn't start screencasting"sv;
+        return -1;
+      }
+
+      message_t message {dbus::message_new_method_call(bus_name, object_path, screencast_interface, "OpenPipeWireRemote")};
+      if (!message) {
+        return -1;
+      }
+
+      dbus::MessageIter iter;
+      auto handle_str = handle.c_str();
+      dbus::message_iter_init_append(message.get(), &iter);
+      dbus::message_iter_append_basic(&iter, dbus::TYPE_OBJECT_PATH, &handle_str);
+      append_vardict(&iter, {});
+
+      auto reply = call(connection, message.get(), call_timeout);
+      int fd = -1;
+      if (!reply || !dbus::message_get_args(reply.get(), nullptr, dbus::TYPE_UNIX_FD, &fd, dbus::TYPE_INVALID) || fd < 0) {
+        BOOST_LOG(error) << "Couldn't open the PipeWire remote of the screencast"sv;
+        return -1;
+      }
+      remote.el = fd;
+
+      return 0;
+    }
+
+    // Owned by the session, every stream connects with a duplicate of it
+    file_t remote;
+
+    std::vector<stream_t> streams;
+
+    // Set once a stream of the session failed, e.g. when the user stopped sharing the screen
+    std::atomic_bool closed {false};
+
+  private:
+    /**
+     * @brief Call a method of the portal that answers through a org.freedesktop.portal.Request, and wait for the answer.
+     * @param method The method of the ScreenCast portal.
+     * @param session_handle The session to pass as first argument, if any.
+     * @param options The options, to which the token of the request is added.
+     * @param timeout How long to wait for the answer.
+     * @param on_result Called for every entry of the results.
+     * @return 0 if the request succeeded.
+     */
+    int request(const char *method, const std::string &session_handle, vardict_t options, std::chrono::milliseconds timeout, const std::function<void(std::string_view, dbus::MessageIter *)> &on_result) {
+      auto token = "sunshine"s + std::to_string(++requests);
+      auto path = "/org/freedesktop/portal/desktop/request/"s + sender + '/' + token;
+      options.emplace_back("handle_token", token);
+
+      // Subscribe before calling, the answer may come before the reply
+      auto match_rule = "type='signal',interface='org.freedesktop.portal.Request',member='Response',path='"s + path + '\'';
+      dbus::bus_add_match(connection, match_rule.c_str(), nullptr);
+      auto remove_match = util::fail_guard([&]() {
+        dbus::bus_remove_match(connection, match_rule.c_str(), nullptr);
+      });
+
+      message_t message {dbus::message_new_method_call(bus_name, object_path, screencast_interface, method)};
+      if (!message) {
+        return -1;
+      }
+
+      dbus::MessageIter iter;
+      dbus::message_iter_init_append(message.get(), &iter);
+      if (!session_handle.empty()) {
+        auto handle_str = session_handle.c_str();
+        dbus::message_iter_append_basic(&iter, dbus::TYPE_OBJECT_PATH, &handle_str);
+      }
+      if (method == "Start"sv) {
+        // No parent window
+        auto parent_window = "";
+        dbus::message_iter_append_basic(&iter, dbus::TYPE_STRING, &parent_window);
+      }
+      append_vardict(&iter, options);
+
+      auto reply = call(connection, message.get(), call_timeout);
+      if (!reply) {
+        return -1;
+      }
+
+      // Portals older than 0.9 don't name the request after the token
+      const char *request_path = nullptr;
+      if (dbus::message_get_args(reply.get(), nullptr, dbus::TYPE_OBJECT_PATH, &request_path, dbus::TYPE_INVALID) && request_path && path != request_path) {
+        path = request_path;
+        match_rule = "type='signal',interface='org.freedesktop.portal.Request',member='Response',path='"s + path + '\'';
+        dbus::bus_add_match(connection, match_rule.c_str(), nullptr);
+      }
+
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while (true) {
+        message_t response {dbus::connection_pop_message(connection)};
+        if (!response) {
+          auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+          if (remaining.count() <= 0) {
+            BOOST_LOG(error) << "Timed out waiting for the XDG desktop portal to answer "sv << method;
+            return -1;
+          }
+
+          if (!dbus::connection_read_write(connection, (int) remaining.count())) {
+            BOOST_LOG(error) << "Lost the connection to the session bus"sv;
+            return -1;
+          }
+          continue;
+        }
+
+        // Anything else on the bus is of no interest
+        if (!dbus::message_is_signal(response.get(), "org.freedesktop.portal.Request", "Response") || path != dbus::message_get_path(response.get())) {
+          continue;
+        }
+
+        dbus::MessageIter results;
+        if (!dbus::message_iter_init(response.get(), &results)) {
+          return -1;
+        }
+
+        auto code = get_basic<std::uint32_t>(&results, dbus::TYPE_UINT32);
+        if (code != 0u) {
+          // 1 when the user cancelled, 2 otherwise
+          BOOST_LOG(error) << "The XDG desktop portal rejected "sv << method << " ["sv << code.value_or(2) << ']';
+          return -1;
+        }
+
+        dbus::message_iter_next(&results);
+        if (on_result) {
+          for_each_entry(&results, on_result);
+        }
+
+        return 0;
+      }
+    }
+
+    void parse_streams(dbus::MessageIter *value) {
+      if (dbus::message_iter_get_arg_type(value) != dbus::TYPE_ARRAY) {
+        return;
+      }
+
+      dbus::MessageIter array;
+      dbus::message_iter_recurse(value, &array);
+      for (; dbus::message_iter_get_arg_type(&array) == dbus::TYPE_STRUCT; dbus::message_iter_next(&array)) {
+        dbus::MessageIter members;
+        dbus::message_iter_recurse(&array, &members);
+
+        auto node_id = get_basic<std::uint32_t>(&members, dbus::TYPE_UINT32);
+        if (!node_id) {
+          continue;
+        }
+        dbus::message_iter_next(&members);
+
+        stream_t stream {*node_id, 0, 0, 0, 0};
+        for_each_entry(&members, [&stream](std::string_view key, dbus::MessageIter *property) {
+          if (key == "position"sv) {
+            std::tie(stream.x, stream.y) = get_pair(property).value_or(std::pair {0, 0});
+          } else if (key == "size"sv) {
+            std::tie(stream.width, stream.height) = get_pair(property).value_or(std::pair {0, 0});
+          }
+        });
+
+        streams.emplace_back(stream);
+      }
+    }
+
+    dbus::Connection *connection {nullptr};
+    std::string sender;
+    std::string handle;
+    std::uint32_t requests {};
+  };
+
+  /**
+   * @brief Get the running screencast session, starting one if there is none.
+   */
+  std::shared_ptr<session_t> get_session() {
+    static std::weak_ptr<session_t> running;
+
+    std::lock_guard lg {session_mutex};
+
+    auto session = running.lock();
+    if (session && !session->closed) {
+      return session;
+    }
+
+    session = std::make_shared<session_t>();
+    if (session->init()) {
+      return nullptr;
+    }
+    running = session;
+
+    return session;
+  }
+
+  /**
+   * @brief Keep a session running for a while after it was last used.
+   */
+  void linger(std::shared_ptr<session_t> &&session) {
+    if (session && !session->closed) {
+      task_pool.pushDelayed([session = std::move(session)]() {}, session_linger);
+    }
+  }
+
+  /**
+   * @brief The state of the cursor, as reported by the metadata of the buffers.
+   */
+  struct cursor_t {
+    bool visible = false;
+
+    // The top left corner, within the frame
+    int x = 0, y = 0;
+    int hotspot_x = 0, hotspot_y = 0;
+
+    int width = 0, height = 0;
+
+    // BGRA with premultiplied alpha
+    std::vector<std::uint8_t> pixels;
+
+    // Incremented when the pixels change
+    unsigned long serial = 0;
+
+    std::optional<platf::damage_rect_t> rect() const {
+      if (!visible || pixels.empty()) {
+        return std::nullopt;
+      }
+
+      return platf::damage_rect_t {x, y, width, height};
+    }
+  };
+
+  class portal_t: public platf::display_t {
+  public:
+    ~portal_t() override {
+      if (loop) {
+        pw_thread_loop_lock(loop.get());
+        for (auto &held_buffer : held) {
+          pw_stream_queue_buffer(stream.get(), held_buffer.buffer);
+        }
+        held.clear();
+        stream.reset();
+        core.reset();
+        pw_thread_loop_unlock(loop.get());
+
+        pw_thread_loop_stop(loop.get());
+      }
+
+      linger(std::move(session));
+    }
+
+    int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+      delay = std::chrono::nanoseconds {1s} / config.framerate;
+      mem_type = hwdevice_type;
+
+      session = get_session();
+      if (!session) {
+        return -1;
+      }
+
+      auto streamed = 0;
+      if (!display_name.empty() && display_name.rfind("VIRTUAL-", 0) != 0) {
+        streamed = util::from_view(display_name);
+        if (streamed < 0 || streamed >= session->streams.size()) {
+          streamed = 0;
+        }
+      }
+
+      auto &info = session->streams[streamed];
+      offset_x = info.x;
+      offset_y = info.y;
+
+      env_width = 0;
+      env_height = 0;
+      for (auto &other : session->streams) {
+        env_width = std::max(env_width, other.x + other.width);
+        env_height = std::max(env_height, other.y + other.height);
+      }
+
+      loop.reset(pw_thread_loop_new("sunshine-video", nullptr));
+      if (!loop) {
+        BOOST_LOG(error) << "pw_thread_loop_new() failed"sv;
+        return -1;
+      }
+
+      context.reset(pw_context_new(pw_thread_loop_get_loop(loop.get()), nullptr, 0));
+      if (!context) {
+        BOOST_LOG(error) << "pw_context_new() failed"sv;
+        return -1;
+      }
+
+      pw_thread_loop_lock(loop.get());
+      auto unlock = util::fail_guard([this]() {
+        pw_thread_loop_unlock(loop.get());
+      });
+
+      if (pw_thread_loop_start(loop.get())) {
+        BOOST_LOG(error) << "pw_thread_loop_start() failed"sv;
+        return -1;
+      }
+
+      // Takes ownership of the duplicate
+      core.reset(pw_context_connect_fd(context.get(), fcntl(session->remote.el, F_DUPFD_CLOEXEC, 3), nullptr, 0));
+      if (!core) {
+        BOOST_LOG(error) << "Couldn't connect to the PipeWire remote of the screencast"sv;
+        session->closed = true;
+        return -1;
+      }
+
+      auto props = pw_properties_new(
+        PW_KEY_MEDIA_TYPE,
+        "Video",
+        PW_KEY_MEDIA_CATEGORY,
+        "Capture",
+        PW_KEY_MEDIA_ROLE,
+        "Screen",
+        nullptr
+      );
+
+      stream.reset(pw_stream_new(core.get(), "sunshine-video", props));
+      if (!stream) {
+        BOOST_LOG(error) << "pw_stream_new() failed"sv;
+        return -1;
+      }
+      pw_stream_add_listener(stream.get(), &listener, &stream_events, this);
+
+      framerate = config.framerate;
+
+      std::array<std::uint8_t, 8192> pod_buffer;
+      spa_pod_builder builder;
+      spa_pod_builder_init(&builder, pod_buffer.data(), pod_buffer.size());
+
+      std::vector<const spa_pod *> params;
+      build_offers(&builder, params);
+      if (params.empty()) {
+        BOOST_LOG(error) << "No format to negotiate with the screencast"sv;
+        return -1;
+      }
+
+      auto flags = (pw_stream_flags) (PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS);
+      if (auto status = pw_stream_connect(stream.get(), PW_DIRECTION_INPUT, info.node_id, flags, params.data(), params.size())) {
+        BOOST_LOG(error) << "pw_stream_connect() failed: "sv << spa_strerror(status);
+        return -1;
+      }
+
+      // The size of the frames is only known once the format is negotiated
+      auto deadline = std::chrono::steady_clock::now() + 2s;
+      while (!negotiated && !failed && std::chrono::steady_clock::now() < deadline) {
+        pw_thread_loop_timed_wait(loop.get(), 1);
+      }
+
+      if (!negotiated) {
+        BOOST_LOG(error) << "Couldn't negotiate a format with the screencast of node "sv << info.node_id;
+        return -1;
+      }
+
+      width = negotiated->width;
+      height = negotiated->height;
+
+      BOOST_LOG(info) << "Screencasting PipeWire node "sv << info.node_id << " of the XDG desktop portal, "sv
+                      << (negotiated->dmabuf ? "dmabuf"sv : "shared memory"sv);
+      BOOST_LOG(debug) << "Offset: "sv << offset_x << 'x' << offset_y;
+      BOOST_LOG(debug) << "Resolution: "sv << width << 'x' << height;
+      BOOST_LOG(debug) << "Desktop Resolution: "sv << env_width << 'x' << env_height;
+
+      return 0;
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+        switch (status) {
+          case platf::capture_e::reinit:
+          case platf::capture_e::error:
+          case platf::capture_e::interrupted:
+            return status;
+          case platf::capture_e::timeout:
+            if (!push_captured_image_cb(std::move(img_out), false)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          case platf::capture_e::ok:
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          default:
+            BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+            return status;
+        }
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    /**
+     * @brief Wait for a frame or a cursor update, then fill the image with it.
+     */
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+
+      pw_thread_loop_lock(loop.get());
+      auto unlock = util::fail_guard([this]() {
+        pw_thread_loop_unlock(loop.get());
+      });
+
+      release_buffers();
+
+      timespec abstime;
+      pw_thread_loop_get_time(loop.get(), &abstime, std::chrono::nanoseconds {timeout}.count());
+      while (!pending && !(cursor && cursor_changed) && !failed) {
+        if (pw_thread_loop_timed_wait_full(loop.get(), &abstime) == -ETIMEDOUT) {
+          return platf::capture_e::timeout;
+        }
+      }
+
+      if (failed || !negotiated || negotiated->width != width || negotiated->height != height) {
+        return platf::capture_e::reinit;
+      }
+
+      std::optional<std::vector<platf::damage_rect_t>> damage;
+      if (pending) {
+        held.emplace_back(held_t {pending->buffer, {}});
+        damage = std::move(pending->damage);
+        img_out->frame_timestamp = pending->timestamp;
+        pending.reset();
+      } else {
+        // Only the cursor moved
+        damage.emplace();
+      }
+      cursor_changed = false;
+
+      if (held.empty()) {
+        // No frame arrived yet
+        return platf::capture_e::timeout;
+      }
+
+      auto drawn_cursor = cursor ? this->cursor.rect() : std::nullopt;
+      if (damage && (drawn_cursor != last_cursor || (drawn_cursor && this->cursor.serial != last_cursor_serial))) {
+        for (auto &rect : {last_cursor, drawn_cursor}) {
+          if (rect) {
+            damage->emplace_back(*rect);
+          }
+        }
+      }
+      last_cursor = drawn_cursor;
+      last_cursor_serial = this->cursor.serial;
+
+      // The first image has nothing to be compared with
+      if (first_frame) {
+        damage.reset();
+        first_frame = false;
+      }
+
+      if (fill(img_out, held.back().buffer->buffer, drawn_cursor.has_value())) {
+        return platf::capture_e::error;
+      }
+      img_out->damage = std::move(damage);
+      img_out->cursor = drawn_cursor;
+
+      return platf::capture_e::ok;
+    }
+
+  protected:
+    /**
+     * @brief A frame, along with what changed since the previous frame taken by the capture thread.
+     */
+    struct frame_t {
+      pw_buffer *buffer;
+      std::optional<std::vector<platf::damage_rect_t>> damage;
+      std::chrono::steady_clock::time_point timestamp;
+    };
+
+    /**
+     * @brief A buffer taken out of the stream, given back once nothing reads from it anymore.
+     */
+    struct held_t {
+      pw_buffer *buffer;
+
+      // The images the buffer was handed out with
+      std::vector<std::weak_ptr<platf::img_t>> readers;
+    };
+
+    /**
+     * @brief Add the formats the stream may be negotiated with.
+     */
+    virtual void build_offers(spa_pod_builder *builder, std::vector<const spa_pod *> &params) = 0;
+
+    /**
+     * @brief Fill the image with a buffer of the stream, called with the loop locked.
+     * @return 0 on success.
+     */
+    virtual int fill(const std::shared_ptr<platf::img_t> &img_out, spa_buffer *buffer, bool draw_cursor) = 0;
+
+    /**
+     * @brief Build an offer of a format.
+     * @param modifiers The modifiers of the dmabufs, the buffers are in shared memory if empty.
+     * @param size The size the format was fixated with, any size is offered if unset.
+     */
+    const spa_pod *build_format(spa_pod_builder *builder, const format_t &format, const std::vector<std::uint64_t> &modifiers, std::optional<spa_rectangle> size = std::nullopt) {
+      spa_pod_frame frame[2];
+      spa_pod_builder_push_object(builder, &frame[0], SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+      spa_pod_builder_add(builder, SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_format, SPA_POD_Id(format.spa), 0);
+
+      if (!modifiers.empty()) {
+        if (modifiers.size() == 1) {
+          spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY);
+          spa_pod_builder_long(builder, (std::int64_t) modifiers[0]);
+        } else {
+          // Lets the producer pick the modifiers it can allocate, the consumer fixates one of them
+          spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY | SPA_POD_PROP_FLAG_DONT_FIXATE);
+          spa_pod_builder_push_choice(builder, &frame[1], SPA_CHOICE_Enum, 0);
+
+          // The first value is the default one
+          spa_pod_builder_long(builder, (std::int64_t) modifiers[0]);
+          for (auto modifier : modifiers) {
+            spa_pod_builder_long(builder, (std::int64_t) modifier);
+          }
+          spa_pod_builder_pop(builder, &frame[1]);
+        }
+      }
+
+      spa_rectangle default_size {1920, 1080}, min_size {1, 1}, max_size {16384, 16384};
+      if (size) {
+        spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_size, SPA_POD_Rectangle(&*size), 0);
+      } else {
+        spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_size, SPA_POD_CHOICE_RANGE_Rectangle(&default_size, &min_size, &max_size), 0);
+      }
+
+      // Frames come as the screen changes, up to the framerate of the stream
+      spa_fraction variable {0, 1}, max_framerate {(std::uint32_t) framerate, 1}, min_framerate {0, 1};
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_framerate, SPA_POD_Fraction(&variable), 0);
+      spa_pod_builder_add(builder, SPA_FORMAT_VIDEO_maxFramerate, SPA_POD_CHOICE_RANGE_Fraction(&max_framerate, &min_framerate, &max_framerate), 0);
+
+      return (const spa_pod *) spa_pod_builder_pop(builder, &frame[0]);
+    }
+
+    /**
+     * @brief Give back the buffers no image reads from anymore, except the one of the newest frame.
+     * @details The newest frame is kept, so it can be drawn again when only the cursor changed.
+     */
+    void release_buffers() {
+      for (auto &held_buffer : held) {
+        std::erase_if(held_buffer.readers, [](auto &reader) {
+          return reader.expired();
+        });
+      }
+
+      for (auto it = std::begin(held); it != std::end(held) && std::next(it) != std::end(held);) {
+        if (!it->readers.empty()) {
+          ++it;
+          continue;
+        }
+
+        pw_stream_queue_buffer(stream.get(), it->buffer);
+        it = held.erase(it);
+      }
+    }
+
+    /**
+     * @brief Update the cursor with the metadata of a buffer, called on the loop thread.
+     */
+    void update_cursor(spa_buffer *buffer) {
+      auto meta = (spa_meta_cursor *) spa_buffer_find_meta_data(buffer, SPA_META_Cursor, sizeof(spa_meta_cursor));
+      if (!meta) {
+        return;
+      }
+
+      if (!spa_meta_cursor_is_valid(meta)) {
+        cursor_changed |= cursor.visible;
+        cursor.visible = false;
+        return;
+      }
+
+      // The bitmap is only sent along when it changed
+      if (meta->bitmap_offset >= sizeof(spa_meta_cursor)) {
+        auto bitmap = (spa_meta_bitmap *) ((std::uint8_t *) meta + meta->bitmap_offset);
+        auto swap_red_blue = bitmap->format == SPA_VIDEO_FORMAT_RGBA;
+        if (bitmap->size.width > 0 && bitmap->size.height > 0 && (swap_red_blue || bitmap->format == SPA_VIDEO_FORMAT_BGRA)) {
+          cursor.width = bitmap->size.width;
+          cursor.height = bitmap->size.height;
+          cursor.pixels.resize(cursor.width * cursor.height * 4);
+
+          auto src = (const std::uint8_t *) bitmap + bitmap->offset;
+          for (int y = 0; y < cursor.height; ++y) {
+            auto row = src + y * bitmap->stride;
+            auto out = cursor.pixels.data() + y * cursor.width * 4;
+            std::copy_n(row, cursor.width * 4, out);
+
+            if (swap_red_blue) {
+              for (int x = 0; x < cursor.width; ++x) {
+                std::swap(out[x * 4], out[x * 4 + 2]);
+              }
+            }
+          }
+
+          cursor.hotspot_x = meta->hotspot.x;
+          cursor.hotspot_y = meta->hotspot.y;
+          ++cursor.serial;
+          cursor_changed = true;
+        }
+      }
+
+      auto x = meta->position.x - cursor.hotspot_x;
+      auto y = meta->position.y - cursor.hotspot_y;
+      if (!cursor.visible || x != cursor.x || y != cursor.y) {
+        cursor.visible = true;
+        cursor.x = x;
+        cursor.y = y;
+        cursor_changed = true;
+      }
+    }
+
+    /**
+     * @brief Take the newest frames out of the stream, called on the loop thread.
+     * @details Frames the capture thread didn't get to are given back right away, their damage is kept.
+     */
+    static void on_process(void *userdata) {
+      auto self = (portal_t *) userdata;
+
+      auto signal = false;
+      while (auto buffer = pw_stream_dequeue_buffer(self->stream.get())) {
+        auto spa_buf = buffer->buffer;
+
+        auto cursor_changed = self->cursor_changed;
+        self->update_cursor(spa_buf);
+        signal |= self->cursor_changed && !cursor_changed;
+
+        auto header = (spa_meta_header *) spa_buffer_find_meta_data(spa_buf, SPA_META_Header, sizeof(spa_meta_header));
+        auto &data = spa_buf->datas[0];
+
+        // Buffers that only update the cursor carry no frame
+        if (
+          (header && (header->flags & SPA_META_HEADER_FLAG_CORRUPTED)) ||
+          !data.chunk || (data.chunk->flags & SPA_CHUNK_FLAG_CORRUPTED) || data.chunk->size == 0
+        ) {
+          pw_stream_queue_buffer(self->stream.get(), buffer);
+          continue;
+        }
+
+        std::optional<std::vector<platf::damage_rect_t>> damage;
+        if (auto meta = spa_buffer_find_meta(spa_buf, SPA_META_VideoDamage)) {
+          damage.emplace();
+
+          auto regions = (const spa_meta_region *) meta->data;
+          for (std::size_t x = 0; x < meta->size / sizeof(spa_meta_region) && spa_meta_region_is_valid(&regions[x]); ++x) {
+            auto &region = regions[x].region;
+            damage->emplace_back(platf::damage_rect_t {region.position.x, region.position.y, (std::int32_t) region.size.width, (std::int32_t) region.size.height});
+          }
+        }
+
+        if (self->pending) {
+          // The skipped frame changed what the newer one doesn't repeat
+          if (damage && self->pending->damage) {
+            damage->insert(std::end(*damage), std::begin(*self->pending->damage), std::end(*self->pending->damage));
+          } else {
+            damage.reset();
+          }
+
+          pw_stream_queue_buffer(self->stream.get(), self->pending->buffer);
+        }
+
+        // Compositors stamp the buffers with the time they were presented at, on CLOCK_MONOTONIC
+        auto timestamp = header && header->pts > 0 ? platf::from_monotonic(std::chrono::nanoseconds {header->pts}) : std::chrono::steady_clock::now();
+
+        self->pending = frame_t {buffer, std::move(damage), timestamp};
+        signal = true;
+      }
+
+      if (signal) {
+        pw_thread_loop_signal(self->loop.get(), false);
+      }
+    }
+
+    static void on_state_changed(void *userdata, pw_stream_state old, pw_stream_state state, const char *error_str) {
+      auto self = (portal_t *) userdata;
+
+      BOOST_LOG(debug) << "PipeWire video stream: "sv << pw_stream_state_as_string(old) << " -> "sv << pw_stream_state_as_string(state);
+
+      if (state == PW_STREAM_STATE_ERROR) {
+        BOOST_LOG(error) << "PipeWire video stream failed: "sv << (error_str ? error_str : "unknown error");
+      }
+
+      if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED) {
+        self->failed = true;
+
+        // Most likely the user stopped sharing the screen, the next display needs a new session
+        self->session->closed = true;
+      }
+
+      pw_thread_loop_signal(self->loop.get(), false);
+    }
+
+    static void on_param_changed(void *userdata, std::uint32_t id, const spa_pod *param) {
+      auto self = (portal_t *) userdata;
+
+      if (!param || id != SPA_PARAM_Format) {
+        return;
+      }
+
+      std::uint32_t media_type, media_subtype;
+      if (spa_format_parse(param, &media_type, &media_subtype) < 0 || media_type != SPA_MEDIA_TYPE_video || media_subtype != SPA_MEDIA_SUBTYPE_raw) {
+        return;
+      }
+
+      spa_video_info_raw info {};
+      if (spa_format_video_raw_parse(param, &info) < 0) {
+        return;
+      }
+
+      auto format = std::find_if(std::begin(formats), std::end(formats), [&info](auto &format) {
+        return format.spa == info.format;
+      });
+      if (format == std::end(formats)) {
+        return;
+      }
+
+      std::array<std::uint8_t, 8192> pod_buffer;
+      spa_pod_builder builder;
+      spa_pod_builder_init(&builder, pod_buffer.data(), pod_buffer.size());
+
+      auto modifier_prop = spa_pod_find_prop(param, nullptr, SPA_FORMAT_VIDEO_modifier);
+      if (modifier_prop && (modifier_prop->flags & SPA_POD_PROP_FLAG_DONT_FIXATE)) {
+        // The producer picked the modifiers it can allocate, the first of them is the one it prefers
+        std::uint32_t count, choice;
+        auto values = spa_pod_get_values(&modifier_prop->value, &count, &choice);
+        if (count == 0) {
+          return;
+        }
+        auto modifier = ((const std::uint64_t *) SPA_POD_BODY(values))[0];
+
+        std::vector<const spa_pod *> params {
+          self->build_format(&builder, *format, {modifier}, info.size)
+        };
+        self->build_offers(&builder, params);
+
+        // Negotiates again, with the fixated format first
+        pw_stream_update_params(self->stream.get(), params.data(), params.size());
+        return;
+      }
+
+      auto dmabuf = modifier_prop != nullptr;
+      self->negotiated = negotiated_t {
+        format->fourcc,
+        dmabuf ? info.modifier : DRM_FORMAT_MOD_INVALID,
+        (int) info.size.width,
+        (int) info.size.height,
+        dmabuf,
+      };
+
+      auto data_types = dmabuf ? (1 << SPA_DATA_DmaBuf) : ((1 << SPA_DATA_MemFd) | (1 << SPA_DATA_MemPtr));
+
+      // The images hold on to the buffers of the stream while they're encoded
+      std::vector<const spa_pod *> params {
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamBuffers,
+          SPA_PARAM_Buffers,
+          SPA_PARAM_BUFFERS_buffers,
+          SPA_POD_CHOICE_RANGE_Int(6, 2, 16),
+          SPA_PARAM_BUFFERS_dataType,
+          SPA_POD_CHOICE_FLAGS_Int(data_types)
+        ),
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamMeta,
+          SPA_PARAM_Meta,
+          SPA_PARAM_META_type,
+          SPA_POD_Id(SPA_META_Header),
+          SPA_PARAM_META_size,
+          SPA_POD_Int((int) sizeof(spa_meta_header))
+        ),
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamMeta,
+          SPA_PARAM_Meta,
+          SPA_PARAM_META_type,
+          SPA_POD_Id(SPA_META_VideoDamage),
+          SPA_PARAM_META_size,
+          SPA_POD_CHOICE_RANGE_Int((int) sizeof(spa_meta_region) * 16, (int) sizeof(spa_meta_region), (int) sizeof(spa_meta_region) * 16)
+        ),
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamMeta,
+          SPA_PARAM_Meta,
+          SPA_PARAM_META_type,
+          SPA_POD_Id(SPA_META_Cursor),
+          SPA_PARAM_META_size,
+          SPA_POD_CHOICE_RANGE_Int(cursor_meta_size(64), cursor_meta_size(1), cursor_meta_size(512))
+        ),
+      };
+      pw_stream_update_params(self->stream.get(), params.data(), params.size());
+
+      pw_thread_loop_signal(self->loop.get(), false);
+    }
+
+    static void on_remove_buffer(void *userdata, pw_buffer *buffer) {
+      auto self = (portal_t *) userdata;
+
+      if (self->pending && self->pending->buffer == buffer) {
+        self->pending.reset();
+      }
+
+      std::erase_if(self->held, [buffer](auto &held_buffer) {
+        return held_buffer.buffer == buffer;
+      });
+    }
+
+    static constexpr int cursor_meta_size(int size) {
+      return sizeof(spa_meta_cursor) + sizeof(spa_meta_bitmap) + size * size * 4;
+    }
+
+    static const pw_stream_events stream_events;
+
+    /**
+     * @brief The format of the frames.
+     */
+    struct negotiated_t {
+      std::uint32_t fourcc;
+      std::uint64_t modifier;
+      int width;
+      int height;
+      bool dmabuf;
+    };
+
+    platf::mem_type_e mem_type;
+
+    std::chrono::nanoseconds delay;
+    int framerate;
+
+    std::shared_ptr<session_t> session;
+
+    // Declared before the stream, so the stream is destroyed first
+    loop_t loop;
+    context_t context;
+    core_t core;
+    stream_t stream;
+    spa_hook listener {};
+
+    // Shared between the loop thread and the capture thread, accessed with the loop locked
+    std::optional<negotiated_t> negotiated;
+    std::optional<frame_t> pending;
+    cursor_t cursor;
+    bool cursor_changed = false;
+    bool failed = false;
+    std::vector<held_t> held;
+
+    // Only touched by the capture thread
+    std::optional<platf::damage_rect_t> last_cursor;
+    unsigned long last_cursor_serial = 0;
+    bool first_frame = true;
+  };
+
+  const pw_stream_events portal_t::stream_events = [] {
+    pw_stream_events events {};
+    events.version = PW_VERSION_STREAM_EVENTS;
+    events.state_changed = on_state_changed;
+    events.param_changed = on_param_changed;
+    events.remove_buffer = on_remove_buffer;
+    events.process = on_process;
+
+    return events;
+  }();
+
+  /**
+   * @brief Copies the frames out of shared memory into system memory.
+   */
+  class portal_ram_t: public portal_t {
+  public:
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->data = util::alloc_image(height * img->row_pitch);
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      std::fill_n(img->data, img->height * img->row_pitch, 0);
+      return 0;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_VULKAN
+      if (mem_type == platf::mem_type_e::vulkan) {
+        return vk::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+  protected:
+    struct img_t: public platf::img_t {
+      ~img_t() override {
+        util::free_image(data);
+        data = nullptr;
+      }
+    };
+
+    void build_offers(spa_pod_builder *builder, std::vector<const spa_pod *> &params) override {
+      for (std::size_t x = 0; x < ram_formats; ++x) {
+        params.emplace_back(build_format(builder, formats[x], {}));
+      }
+    }
+
+    int fill(const std::shared_ptr<platf::img_t> &img_out, spa_buffer *buffer, bool draw_cursor) override {
+      auto &img = *img_out;
+      auto &data = buffer->datas[0];
+      if (!data.data) {
+        BOOST_LOG(error) << "The buffers of the screencast aren't mapped"sv;
+        return -1;
+      }
+
+      auto src = (const std::uint8_t *) data.data + std::min(data.chunk->offset, data.maxsize);
+      auto stride = data.chunk->stride > 0 ? data.chunk->stride : img.row_pitch;
+      auto row_size = std::min(img.row_pitch, stride);
+      for (int y = 0; y < img.height; ++y) {
+        std::copy_n(src + y * stride, row_size, img.data + y * img.row_pitch);
+      }
+
+      if (draw_cursor) {
+        blend_cursor(img);
+      }
+
+      return 0;
+    }
+
+    /**
+     * @brief Draw the cursor over the image, clipped to the image.
+     */
+    void blend_cursor(platf::img_t &img) {
+      auto x_begin = std::max(0, -cursor.x);
+      auto y_begin = std::max(0, -cursor.y);
+      auto x_end = std::min(cursor.width, img.width - cursor.x);
+      auto y_end = std::min(cursor.height, img.height - cursor.y);
+
+      for (auto y = y_begin; y < y_end; ++y) {
+        auto colors_out = cursor.pixels.data() + (y * cursor.width + x_begin) * 4;
+        auto colors_in = img.data + (cursor.y + y) * img.row_pitch + (cursor.x + x_begin) * img.pixel_pitch;
+
+        for (auto x = x_begin; x < x_end; ++x, colors_out += 4, colors_in += 4) {
+          auto alpha = colors_out[3];
+          if (alpha == 255) {
+            std::copy_n(colors_out, 4, colors_in);
+          } else {
+            colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
+            colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
+            colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
+          }
+        }
+      }
+    }
+  };
+
+  /**
+   * @brief Hands the dmabufs of the stream to the encoder, the buffers of the stream are the images.
+   */
+  class portal_vram_t: public portal_t {
+  public:
+    int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+      if (!gbm::create_device) {
+        BOOST_LOG(warning) << "libgbm not initialized"sv;
+        return -1;
+      }
+
+      // Only the modifiers the encoder can import are offered
+      std::string render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128"s : config::video.adapter_name;
+      file_t render_fd {open(render_device.c_str(), O_RDWR | O_CLOEXEC)};
+      if (render_fd.el < 0) {
+        BOOST_LOG(error) << "Couldn't open "sv << render_device << ": "sv << strerror(errno);
+        return -1;
+      }
+
+      gbm::gbm_t gbm {gbm::create_device(render_fd.el)};
+      if (!gbm) {
+        BOOST_LOG(error) << "Couldn't create GBM device"sv;
+        return -1;
+      }
+
+      auto egl_display = egl::make_display(gbm.get());
+      if (!egl_display) {
+        return -1;
+      }
+
+      for (auto &format : formats) {
+        auto modifiers = egl::query_modifiers(egl_display.get(), format.fourcc);
+        if (!modifiers.empty()) {
+          offers.emplace_back(format, std::move(modifiers));
+        }
+      }
+
+      if (offers.empty()) {
+        BOOST_LOG(warning) << "The encoder can't import dmabufs of any format the screencast may have"sv;
+        return -1;
+      }
+
+      return portal_t::init(hwdevice_type, display_name, config);
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<egl::img_descriptor_t>();
+
+      img->width = width;
+      img->height = height;
+      img->sequence = 0;
+      img->serial = std::numeric_limits<decltype(img->serial)>::max();
+      img->data = nullptr;
+
+      // File descriptors aren't open
+      std::fill_n(img->sd.fds, 4, -1);
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      // Empty images are recognized as dummies by the zero sequence number
+      return 0;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_VULKAN
+      if (mem_type == platf::mem_type_e::vulkan) {
+        return vk::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_gl_encode_device(width, height, 0, 0);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+  protected:
+    void build_offers(spa_pod_builder *builder, std::vector<const spa_pod *> &params) override {
+      for (auto &[format, modifiers] : offers) {
+        params.emplace_back(build_format(builder, format, modifiers));
+      }
+    }
+
+    int fill(const std::shared_ptr<platf::img_t> &img_out, spa_buffer *buffer, bool draw_cursor) override {
+      auto img = (egl::img_descriptor_t *) img_out.get();
+      img->reset();
+
+      img->sd.width = width;
+      img->sd.height = height;
+      img->sd.fourcc = negotiated->fourcc;
+      img->sd.modifier = negotiated->modifier;
+
+      // The buffer goes back to the stream once the encoder is done, so the image gets its own file descriptors
+      for (std::uint32_t x = 0; x < 4; ++x) {
+        if (x >= buffer->n_datas || buffer->datas[x].type != SPA_DATA_DmaBuf) {
+          img->sd.pitches[x] = 0;
+          img->sd.offsets[x] = 0;
+          continue;
+        }
+
+        auto &data = buffer->datas[x];
+        img->sd.fds[x] = dup((int) data.fd);
+        img->sd.pitches[x] = data.chunk->stride;
+        img->sd.offsets[x] = data.chunk->offset;
+      }
+
+      if (img->sd.fds[0] < 0) {
+        BOOST_LOG(error) << "The screencast didn't hand out a dmabuf"sv;
+        return -1;
+      }
+
+      img->sequence = ++sequence;
+
+      // The stream cycles through the few buffers it allocated
+      img->recycled = true;
+
+      held.back().readers.emplace_back(img_out);
+
+      if (draw_cursor) {
+        // Copy new cursor pixel data if it's been updated
+        if (img->serial != cursor.serial) {
+          img->buffer = cursor.pixels;
+          img->serial = cursor.serial;
+        }
+
+        img->x = cursor.x;
+        img->y = cursor.y;
+        img->src_w = cursor.width;
+        img->src_h = cursor.height;
+        img->width = cursor.width;
+        img->height = cursor.height;
+        img->pixel_pitch = 4;
+        img->row_pitch = img->pixel_pitch * img->width;
+        img->data = img->buffer.data();
+      } else {
+        img->data = nullptr;
+      }
+
+      return 0;
+    }
+
+    std::vector<std::pair<format_t, std::vector<std::uint64_t>>> offers;
+
+    std::uint64_t sequence {};
+  };
+}  // namespace portal
+
+namespace platf {
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::vulkan && hwdevice_type != platf::mem_type_e::cuda) {
+      BOOST_LOG(error) << "Could not initialize display with the given hw device type."sv;
+      return nullptr;
+    }
+
+    static std::once_flag init_flag;
+    std::call_once(init_flag, []() {
+      pw_init(nullptr, nullptr);
+    });
+
+    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::vulkan || hwdevice_type == platf::mem_type_e::cuda) {
+      auto portal = std::make_shared<portal::portal_vram_t>();
+      if (!portal->init(hwdevice_type, display_name, config)) {
+        return portal;
+      }
+
+      // In the case of failure, fall back to copying through system memory
+    }
+
+    auto portal = std::make_shared<portal::portal_ram_t>();
+    if (portal->init(hwdevice_type, display_name, config)) {
+      return nullptr;
+    }
+
+    return portal;
+  }
+
+  std::vector<std::string> portal_display_names() {
+    if (window_system != window_system_e::WAYLAND) {
+      return {};
+    }
+
+    auto session = portal::get_session();
+    if (!session) {
+      return {};
+    }
+
+    std::vector<std::string> display_names;
+
+    BOOST_LOG(info) << "-------- Start of XDG desktop portal monitor list --------"sv;
+
+    for (int x = 0; x < session->streams.size(); ++x) {
+      auto &stream = session->streams[x];
+
+      BOOST_LOG(info) << "Monitor "sv << x << " is PipeWire node "sv << stream.node_id << ": "sv << stream.width << 'x' << stream.height << '+' << stream.x << '+' << stream.y;
+
+      display_names.emplace_back(std::to_string(x));
+    }
+
+    BOOST_LOG(info) << "--------- End of XDG desktop portal monitor list ---------"sv;
+
+    portal::linger(std::move(session));
+
+    return display_names;
+  }
+}  // namespace platf
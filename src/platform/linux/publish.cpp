@@ -4,6 +4,9 @@
  * @note Adapted from https://www.avahi.org/doxygen/html/client-publish-service_8c-example.html
  */
 // standard includes
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 // local includes
@@ -290,6 +293,11 @@ namespace platf::publish {
   using client_t = util::dyn_safe_ptr<avahi::Client, &avahi::client_free>;
   using poll_t = util::dyn_safe_ptr<avahi::SimplePoll, &avahi::simple_poll_free>;
 
+  // How long to wait before publishing again once the Avahi daemon failed
+  constexpr auto RETRY_INTERVAL = 10s;
+
+  std::atomic<status_e> publish_status {status_e::disabled};
+
   avahi::EntryGroup *group = nullptr;
 
   poll_t poll;
@@ -305,6 +313,7 @@ namespace platf::publish {
     switch (state) {
       case avahi::ENTRY_GROUP_ESTABLISHED:
         BOOST_LOG(info) << "Avahi service " << name.get() << " successfully established.";
+        publish_status = status_e::published;
         break;
       case avahi::ENTRY_GROUP_COLLISION:
         name.reset(avahi::alternative_service_name(name.get()));
@@ -315,6 +324,7 @@ namespace platf::publish {
         break;
       case avahi::ENTRY_GROUP_FAILURE:
         BOOST_LOG(error) << "Avahi entry group failure: " << avahi::strerror(avahi::client_errno(avahi::entry_group_get_client(g)));
+        publish_status = status_e::failed;
         avahi::simple_poll_quit(poll.get());
         break;
       case avahi::ENTRY_GROUP_UNCOMMITED:
@@ -326,6 +336,7 @@ namespace platf::publish {
     int ret;
 
     auto fg = util::fail_guard([]() {
+      publish_status = status_e::failed;
       avahi::simple_poll_quit(poll.get());
     });
 
@@ -387,62 +398,122 @@ namespace platf::publish {
         break;
       case avahi::CLIENT_FAILURE:
         BOOST_LOG(error) << "Client failure: "sv << avahi::strerror(avahi::client_errno(c));
+        publish_status = status_e::failed;
         avahi::simple_poll_quit(poll.get());
         break;
       case avahi::CLIENT_S_COLLISION:
       case avahi::CLIENT_S_REGISTERING:
+        publish_status = status_e::pending;
         if (group) {
           avahi::entry_group_reset(group);
         }
         break;
-      case avahi::CLIENT_CONNECTING:;
+      case avahi::CLIENT_CONNECTING:
+        // The daemon isn't running yet, the client connects once it is
+        publish_status = status_e::pending;
+        break;
     }
   }
 
+  /**
+   * @brief Publishes the host from a background thread, which starts over whenever the Avahi daemon fails.
+   */
   class deinit_t: public ::platf::deinit_t {
   public:
-    std::thread poll_thread;
-
-    deinit_t(std::thread poll_thread):
-        poll_thread {std::move(poll_thread)} {
+    deinit_t():
+        poll_thread {&deinit_t::poll_thread_proc, this} {
     }
 
     ~deinit_t() override {
-      if (avahi::simple_poll_quit && poll) {
-        avahi::simple_poll_quit(poll.get());
-      }
+      {
+        std::lock_guard lg {poll_lock};
 
-      if (poll_thread.joinable()) {
-        poll_thread.join();
+        stop_requested = true;
+        if (poll) {
+          avahi::simple_poll_quit(poll.get());
+        }
       }
+
+      stop_cv.notify_all();
+      poll_thread.join();
+
+      publish_status = status_e::disabled;
     }
-  };
 
-  [[nodiscard]] std::unique_ptr<::platf::deinit_t> start() {
-    if (avahi::init_client()) {
-      return nullptr;
+  private:
+    /**
+     * @brief Create the client, which publishes the host once the Avahi daemon runs.
+     * @return `true` if the client was created.
+     */
+    bool connect() {
+      poll.reset(avahi::simple_poll_new());
+      if (!poll) {
+        BOOST_LOG(error) << "Failed to create simple poll object."sv;
+        return false;
+      }
+
+      auto instance_name = net::mdns_instance_name(platf::get_host_name());
+      name.reset(avahi::strdup(instance_name.c_str()));
+
+      int avhi_error;
+      client.reset(
+        avahi::client_new(avahi::simple_poll_get(poll.get()), avahi::CLIENT_NO_FAIL, client_callback, nullptr, &avhi_error)
+      );
+
+      if (!client) {
+        BOOST_LOG(error) << "Failed to create client: "sv << avahi::strerror(avhi_error);
+        return false;
+      }
+
+      return true;
     }
 
-    int avhi_error;
+    void poll_thread_proc() {
+      std::unique_lock ul {poll_lock};
 
-    poll.reset(avahi::simple_poll_new());
-    if (!poll) {
-      BOOST_LOG(error) << "Failed to create simple poll object."sv;
-      return nullptr;
+      while (!stop_requested) {
+        publish_status = status_e::pending;
+
+        if (connect()) {
+          ul.unlock();
+          avahi::simple_poll_loop(poll.get());
+          ul.lock();
+        }
+
+        // The entry group is freed along with its client
+        group = nullptr;
+        client.reset();
+        poll.reset();
+
+        if (stop_requested) {
+          break;
+        }
+
+        publish_status = status_e::failed;
+        BOOST_LOG(info) << "Publishing Avahi service again in "sv << RETRY_INTERVAL.count() << 's';
+
+        stop_cv.wait_for(ul, RETRY_INTERVAL, [this]() {
+          return stop_requested;
+        });
+      }
     }
 
-    auto instance_name = net::mdns_instance_name(platf::get_host_name());
-    name.reset(avahi::strdup(instance_name.c_str()));
+    std::mutex poll_lock;
+    std::condition_variable stop_cv;
+    bool stop_requested = false;
 
-    client.reset(
-      avahi::client_new(avahi::simple_poll_get(poll.get()), avahi::ClientFlags(0), client_callback, nullptr, &avhi_error)
-    );
+    std::thread poll_thread;
+  };
 
-    if (!client) {
-      BOOST_LOG(error) << "Failed to create client: "sv << avahi::strerror(avhi_error);
+  [[nodiscard]] std::unique_ptr<::platf::deinit_t> start() {
+    if (avahi::init_client()) {
       return nullptr;
     }
 
-    return std::make_unique<deinit_t>(std::thread {avahi::simple_poll_loop, poll.get()});
+    return std::make_unique<deinit_t>();
+  }
+
+  status_e status() {
+    return publish_status;
   }
 }  // namespace platf::publish
@@ -0,0 +1,88 @@
+/**
+ * @file src/platform/linux/rtkit.cpp
+ * @brief Definitions for raising thread priorities through RealtimeKit.
+ * @note Talks to org.freedesktop.RealtimeKit1 over the system bus with a dynamically loaded libdbus-1.
+ */
+// standard includes
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+// platform includes
+#include <sys/resource.h>
+
+// local includes
+#include "dbus.h"
+#include "rtkit.h"
+#include "src/logging.h"
+
+using namespace std::literals;
+
+namespace rtkit {
+  namespace {
+    // The longest RLIMIT_RTTIME RealtimeKit accepts by default
+    constexpr rlim_t max_rttime_us = 200'000;
+
+    std::mutex mutex;
+
+    /**
+     * @brief Call a method of RealtimeKit taking a thread id and a 32-bit argument.
+     */
+    template<class T>
+    bool call(const char *method, pid_t thread, int dbus_type, T value) {
+      std::lock_guard lg {mutex};
+
+      auto connection = dbus::connect(dbus::BUS_SYSTEM);
+      if (!connection) {
+        return false;
+      }
+
+      auto message = dbus::message_new_method_call("org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1", "org.freedesktop.RealtimeKit1", method);
+      if (!message) {
+        return false;
+      }
+
+      std::uint64_t thread_id = thread;
+      if (!dbus::message_append_args(message, dbus::TYPE_UINT64, &thread_id, dbus_type, &value, dbus::TYPE_INVALID)) {
+        dbus::message_unref(message);
+        return false;
+      }
+
+      dbus::Error error;
+      dbus::error_init(&error);
+      auto reply = dbus::connection_send_with_reply_and_block(connection, message, 1000, &error);
+      dbus::message_unref(message);
+
+      if (dbus::error_is_set(&error)) {
+        BOOST_LOG(debug) << "RealtimeKit "sv << method << " failed: "sv << error.message;
+        dbus::error_free(&error);
+        return false;
+      }
+
+      dbus::message_unref(reply);
+      return true;
+    }
+  }  // namespace
+
+  bool make_thread_realtime(pid_t thread, int priority) {
+    rlimit limit;
+    if (getrlimit(RLIMIT_RTTIME, &limit)) {
+      return false;
+    }
+
+    // The soft limit stays where it was, below the hard one, so reaching it only sends SIGXCPU
+    if (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > max_rttime_us) {
+      limit.rlim_max = max_rttime_us;
+      limit.rlim_cur = std::min(limit.rlim_cur, max_rttime_us / 2);
+      if (setrlimit(RLIMIT_RTTIME, &limit)) {
+        return false;
+      }
+    }
+
+    return call("MakeThreadRealtime", thread, dbus::TYPE_UINT32, (std::uint32_t) priority);
+  }
+
+  bool make_thread_high_priority(pid_t thread, int nice) {
+    return call("MakeThreadHighPriority", thread, dbus::TYPE_INT32, (std::int32_t) nice);
+  }
+}  // namespace rtkit
@@ -0,0 +1,30 @@
+/**
+ * @file src/platform/linux/rtkit.h
+ * @brief Declarations for raising thread priorities through RealtimeKit.
+ */
+#pragma once
+
+// platform includes
+#include <sys/types.h>
+
+namespace rtkit {
+  /**
+   * @brief Ask RealtimeKit to run a thread of this process with SCHED_RR.
+   * @details RealtimeKit only grants real-time priorities to processes bounding their real-time CPU time,
+   *          so this lowers the hard RLIMIT_RTTIME first. A real-time thread running longer than that without
+   *          blocking gets the process killed, so callers keep the soft limit below it and handle SIGXCPU.
+   *          The thread also gets SCHED_RESET_ON_FORK.
+   * @param thread The id of the thread, as returned by gettid().
+   * @param priority The real-time priority, capped by RealtimeKit.
+   * @return `true` if the thread now runs with a real-time policy.
+   */
+  bool make_thread_realtime(pid_t thread, int priority);
+
+  /**
+   * @brief Ask RealtimeKit to lower the nice value of a thread of this process.
+   * @param thread The id of the thread, as returned by gettid().
+   * @param nice The nice value, capped by RealtimeKit.
+   * @return `true` if the thread now has that nice value.
+   */
+  bool make_thread_high_priority(pid_t thread, int nice);
+}  // namespace rtkit
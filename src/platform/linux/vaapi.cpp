@@ -3,6 +3,8 @@
  * @brief Definitions for VA-API hardware accelerated capture.
  */
 // standard includes
+#include <algorithm>
+#include <cstring>
 #include <fcntl.h>
 #include <format>
 #include <sstream>
@@ -13,6 +15,7 @@ extern "C" {
 #include <libavutil/pixdesc.h>
 #include <va/va.h>
 #include <va/va_drm.h>
+#include <va/va_vpp.h>
 #if !VA_CHECK_VERSION(1, 9, 0)
   // vaSyncBuffer stub allows Sunshine built against libva <2.9.0 to link against ffmpeg on libva 2.9.0 or later
   VAStatus
@@ -30,6 +33,7 @@ extern "C" {
 #include "graphics.h"
 #include "misc.h"
 #include "src/config.h"
+#include "src/gpu_scheduler.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
@@ -93,6 +97,9 @@ namespace va {
 
   using display_t = util::safe_ptr_v2<void, VAStatus, vaTerminate>;
 
+  // One surface is converted into while the encoder reads the other
+  constexpr std::size_t surface_count = 2;
+
   int vaapi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *encode_device, AVBufferRef **hw_device_buf);
 
   class va_t: public platf::avcodec_encode_device_t {
@@ -132,6 +139,15 @@ namespace va {
       return 0;
     }
 
+    bool detach_display() override {
+      // The images are imported when they're converted, nothing refers to the display
+      return true;
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &) override {
+      return true;
+    }
+
     /**
      * @brief Finds a supported VA entrypoint for the given VA profile.
      * @param profile The profile to match.
@@ -292,19 +308,57 @@ namespace va {
     }
 
     int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx_buf) override {
-      this->hwframe.reset(frame);
       this->frame = frame;
 
-      if (!frame->buf[0]) {
-        if (av_hwframe_get_buffer(hw_frames_ctx_buf, frame, 0)) {
-          BOOST_LOG(error) << "Couldn't get hwframe for VAAPI"sv;
+      // The first surface is the frame, the others get a copy of its properties and side data
+      surfaces.clear();
+      surfaces.resize(surface_count);
+      surfaces[0].frame.reset(frame);
+      current_surface = 0;
+
+      for (std::size_t x = 0; x < surfaces.size(); ++x) {
+        auto &surface = surfaces[x];
+
+        if (x > 0) {
+          surface.frame.reset(av_frame_alloc());
+          if (!surface.frame || av_frame_copy_props(surface.frame.get(), frame)) {
+            return -1;
+          }
+        }
+
+        if (!surface.frame->buf[0]) {
+          if (av_hwframe_get_buffer(hw_frames_ctx_buf, surface.frame.get(), 0)) {
+            BOOST_LOG(error) << "Couldn't get hwframe for VAAPI"sv;
+            return -1;
+          }
+        }
+
+        auto nv12_opt = import_surface(surface.frame.get());
+        if (!nv12_opt) {
           return -1;
         }
+
+        surface.nv12 = std::move(*nv12_opt);
+      }
+
+      auto hw_frames_ctx = (AVHWFramesContext *) hw_frames_ctx_buf->data;
+      auto sws_opt = egl::sws_t::make(width, height, frame->width, frame->height, hw_frames_ctx->sw_format);
+      if (!sws_opt) {
+        return -1;
       }
 
+      this->sws = std::move(*sws_opt);
+      this->sw_format = hw_frames_ctx->sw_format;
+
+      return 0;
+    }
+
+    /**
+     * @brief Import the VA surface of a frame as the target of the OpenGL conversion.
+     */
+    std::optional<egl::nv12_t> import_surface(AVFrame *frame) {
       va::DRMPRIMESurfaceDescriptor prime;
       va::VASurfaceID surface = (std::uintptr_t) frame->data[3];
-      auto hw_frames_ctx = (AVHWFramesContext *) hw_frames_ctx_buf->data;
 
       auto status = vaExportSurfaceHandle(
         this->va_display,
@@ -316,7 +370,7 @@ namespace va {
       if (status) {
         BOOST_LOG(error) << "Couldn't export va surface handle: ["sv << (int) surface << "]: "sv << vaErrorStr(status);
 
-        return -1;
+        return std::nullopt;
       }
 
       // Keep track of file descriptors
@@ -327,7 +381,7 @@ namespace va {
 
       if (prime.num_layers != 2) {
         BOOST_LOG(error) << "Invalid layer count for VA surface: expected 2, got "sv << prime.num_layers;
-        return -1;
+        return std::nullopt;
       }
 
       egl::surface_descriptor_t sds[2] = {};
@@ -352,24 +406,68 @@ namespace va {
         }
       }
 
-      auto nv12_opt = egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
-      if (!nv12_opt) {
-        return -1;
+      return egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
+    }
+
+    bool resize_input(int in_width, int in_height) override {
+      if (!frame) {
+        return false;
       }
 
-      auto sws_opt = egl::sws_t::make(width, height, frame->width, frame->height, hw_frames_ctx->sw_format);
+      // The surfaces and their imports stay, only the scaling into them changes
+      auto sws_opt = egl::sws_t::make(in_width, in_height, frame->width, frame->height, sw_format);
       if (!sws_opt) {
-        return -1;
+        return false;
       }
 
-      this->sws = std::move(*sws_opt);
-      this->nv12 = std::move(*nv12_opt);
+      sws = std::move(*sws_opt);
+      sws.apply_colorspace(colorspace);
+      sws.apply_tone_mapping(tone_mapping);
 
-      return 0;
+      width = in_width;
+      height = in_height;
+
+      return true;
     }
 
     void apply_colorspace() override {
       sws.apply_colorspace(colorspace);
+      sws.apply_tone_mapping(tone_mapping);
+    }
+
+    bool can_convert_while_encoding() const override {
+      // The next image goes into another surface than the one the encoder is reading
+      return surfaces.size() > 1;
+    }
+
+    /**
+     * @brief Pick the surface to convert the next image into, and make it the frame to encode.
+     * @details Surfaces the encoder still holds a reference to are skipped, so the conversion never
+     *          overwrites a frame that's still being encoded. When all of them are in use,
+     *          the current surface is converted into again, like with a single surface.
+     * @return The surface to convert into.
+     */
+    egl::nv12_t &begin_convert() {
+      auto next = current_surface;
+      for (std::size_t x = 1; x < surfaces.size(); ++x) {
+        auto index = (current_surface + x) % surfaces.size();
+        if (av_buffer_get_ref_count(surfaces[index].frame->buf[0]) == 1) {
+          next = index;
+          break;
+        }
+      }
+
+      // Keyframe requests are made on the frame to encode
+      auto next_frame = surfaces[next].frame.get();
+      if (next_frame != frame) {
+        next_frame->pict_type = frame->pict_type;
+        next_frame->flags = (next_frame->flags & ~AV_FRAME_FLAG_KEY) | (frame->flags & AV_FRAME_FLAG_KEY);
+
+        frame = next_frame;
+        current_surface = next;
+      }
+
+      return surfaces[current_surface].nv12;
     }
 
     va::display_t::pointer va_display;
@@ -379,54 +477,341 @@ namespace va {
     egl::display_t display;
     egl::ctx_t ctx;
 
+    struct surface_t {
+      frame_t frame;
+      egl::nv12_t nv12;
+    };
+
     // This must be destroyed before display_t to ensure the GPU
     // driver is still loaded when vaDestroySurfaces() is called.
-    frame_t hwframe;
+    std::vector<surface_t> surfaces;
+    std::size_t current_surface = 0;
 
     egl::sws_t sws;
-    egl::nv12_t nv12;
+    AVPixelFormat sw_format;
 
     int width, height;
   };
 
+  /**
+   * @brief Converts BGRA images in system memory into a VA surface with the video processing pipeline of the GPU.
+   * @details The images are written into a BGRX surface, which the pipeline scales and converts into the surface
+   *          of the frame. Nothing but the write into the mapped surface runs on the CPU, unlike a texture upload,
+   *          which the GL driver may have to swizzle and tile on the CPU first.
+   */
+  class vpp_t {
+  public:
+    vpp_t() = default;
+    vpp_t(const vpp_t &) = delete;
+    vpp_t &operator=(const vpp_t &) = delete;
+
+    ~vpp_t() {
+      reset();
+    }
+
+    /**
+     * @brief Set up the pipeline.
+     * @param va_display The display the frame was allocated on.
+     * @param in_width The width of the images.
+     * @param in_height The height of the images.
+     * @param frames The frames to convert into, all of the same size.
+     * @return 0 on success, or the pipeline isn't supported by the driver.
+     */
+    int init(VADisplay va_display, int in_width, int in_height, const std::vector<AVFrame *> &frames) {
+      reset();
+
+      display = va_display;
+
+      std::vector<VASurfaceID> targets;
+      for (auto frame : frames) {
+        targets.push_back((VASurfaceID) (std::uintptr_t) frame->data[3]);
+      }
+      auto frame = frames[0];
+
+      auto status = vaCreateConfig(display, VAProfileNone, VAEntrypointVideoProc, nullptr, 0, &config);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(debug) << "No VA video processing pipeline: "sv << vaErrorStr(status);
+        config = VA_INVALID_ID;
+        return -1;
+      }
+
+      VASurfaceAttrib attrib {};
+      attrib.type = VASurfaceAttribPixelFormat;
+      attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
+      attrib.value.type = VAGenericValueTypeInteger;
+      attrib.value.value.i = VA_FOURCC_BGRX;
+
+      status = vaCreateSurfaces(display, VA_RT_FORMAT_RGB32, in_width, in_height, &source, 1, &attrib, 1);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(debug) << "Couldn't create a BGRX VA surface: "sv << vaErrorStr(status);
+        source = VA_INVALID_ID;
+        return -1;
+      }
+
+      status = vaCreateContext(display, config, frame->width, frame->height, VA_PROGRESSIVE, targets.data(), targets.size(), &context);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(debug) << "Couldn't create a VA video processing context: "sv << vaErrorStr(status);
+        context = VA_INVALID_ID;
+        return -1;
+      }
+
+      // Write into the surface itself where the driver allows it, or else into an image that's put into it
+      status = vaDeriveImage(display, source, &image);
+      derived = status == VA_STATUS_SUCCESS;
+      if (!derived) {
+        VAImageFormat format {};
+        format.fourcc = VA_FOURCC_BGRX;
+        format.byte_order = VA_LSB_FIRST;
+        format.bits_per_pixel = 32;
+        format.depth = 24;
+        format.red_mask = 0x00ff0000;
+        format.green_mask = 0x0000ff00;
+        format.blue_mask = 0x000000ff;
+
+        status = vaCreateImage(display, &format, in_width, in_height, &image);
+        if (status != VA_STATUS_SUCCESS) {
+          BOOST_LOG(debug) << "Couldn't create a BGRX VA image: "sv << vaErrorStr(status);
+          image.image_id = VA_INVALID_ID;
+          return -1;
+        }
+      }
+
+      width = in_width;
+      height = in_height;
+
+      // Keep the aspect ratio, like egl::sws_t
+      auto scalar = std::fminf(frame->width / (float) in_width, frame->height / (float) in_height);
+      output_region.width = (std::uint16_t) (in_width * scalar);
+      output_region.height = (std::uint16_t) (in_height * scalar);
+      output_region.x = (std::int16_t) ((frame->width - output_region.width) / 2);
+      output_region.y = (std::int16_t) ((frame->height - output_region.height) / 2);
+
+      return 0;
+    }
+
+    /**
+     * @brief Convert an image into a frame.
+     * @param img The BGRA image.
+     * @param colorspace The colorspace of the frame.
+     * @param frame The frame to convert into, one of those the pipeline was set up with.
+     * @return 0 on success.
+     */
+    int convert(const platf::img_t &img, const video::sunshine_colorspace_t &colorspace, AVFrame *frame) {
+      // The previous image may still be read by the pipeline
+      auto status = vaSyncSurface(display, source);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(error) << "Couldn't sync VA surface: "sv << vaErrorStr(status);
+        return -1;
+      }
+
+      std::uint8_t *data;
+      status = vaMapBuffer(display, image.buf, (void **) &data);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(error) << "Couldn't map VA image: "sv << vaErrorStr(status);
+        return -1;
+      }
+
+      auto row_bytes = std::min(img.width, width) * 4;
+      auto rows = std::min(img.height, height);
+      for (int y = 0; y < rows; ++y) {
+        std::memcpy(data + image.offsets[0] + y * image.pitches[0], img.data + y * img.row_pitch, row_bytes);
+      }
+
+      vaUnmapBuffer(display, image.buf);
+
+      if (!derived) {
+        status = vaPutImage(display, source, image.image_id, 0, 0, width, height, 0, 0, width, height);
+        if (status != VA_STATUS_SUCCESS) {
+          BOOST_LOG(error) << "Couldn't put VA image: "sv << vaErrorStr(status);
+          return -1;
+        }
+      }
+
+      VARectangle surface_region {0, 0, (std::uint16_t) width, (std::uint16_t) height};
+
+      VAProcPipelineParameterBuffer params {};
+      params.surface = source;
+      params.surface_region = &surface_region;
+      params.surface_color_standard = VAProcColorStandardSRGB;
+      params.output_region = &output_region;
+      params.output_background_color = 0xff000000;
+      params.filter_flags = VA_FILTER_SCALING_FAST;
+      params.input_color_properties.color_range = VA_SOURCE_RANGE_FULL;
+      params.output_color_properties.color_range = colorspace.full_range ? VA_SOURCE_RANGE_FULL : VA_SOURCE_RANGE_REDUCED;
+      switch (colorspace.colorspace) {
+        case video::colorspace_e::rec601:
+          params.output_color_standard = VAProcColorStandardBT601;
+          break;
+        case video::colorspace_e::rec709:
+          params.output_color_standard = VAProcColorStandardBT709;
+          break;
+        case video::colorspace_e::bt2020sdr:
+        case video::colorspace_e::bt2020:
+          params.output_color_standard = VAProcColorStandardBT2020;
+          break;
+      }
+
+      VABufferID params_buf;
+      status = vaCreateBuffer(display, context, VAProcPipelineParameterBufferType, sizeof(params), 1, &params, &params_buf);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(error) << "Couldn't create VA pipeline parameters: "sv << vaErrorStr(status);
+        return -1;
+      }
+      auto fg = util::fail_guard([&]() {
+        vaDestroyBuffer(display, params_buf);
+      });
+
+      // The encoder waits for the pipeline to be done with the surface before it reads it
+      status = vaBeginPicture(display, context, (VASurfaceID) (std::uintptr_t) frame->data[3]);
+      if (status == VA_STATUS_SUCCESS) {
+        status = vaRenderPicture(display, context, &params_buf, 1);
+        auto end_status = vaEndPicture(display, context);
+        status = status != VA_STATUS_SUCCESS ? status : end_status;
+      }
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(error) << "Couldn't run VA video processing pipeline: "sv << vaErrorStr(status);
+        return -1;
+      }
+
+      return 0;
+    }
+
+    explicit operator bool() const {
+      return context != VA_INVALID_ID;
+    }
+
+    void reset() {
+      if (!display) {
+        return;
+      }
+
+      if (image.image_id != VA_INVALID_ID) {
+        vaDestroyImage(display, image.image_id);
+        image.image_id = VA_INVALID_ID;
+      }
+      if (context != VA_INVALID_ID) {
+        vaDestroyContext(display, context);
+        context = VA_INVALID_ID;
+      }
+      if (source != VA_INVALID_ID) {
+        vaDestroySurfaces(display, &source, 1);
+        source = VA_INVALID_ID;
+      }
+      if (config != VA_INVALID_ID) {
+        vaDestroyConfig(display, config);
+        config = VA_INVALID_ID;
+      }
+      display = nullptr;
+    }
+
+  private:
+    VADisplay display = nullptr;
+    VAConfigID config = VA_INVALID_ID;
+    VAContextID context = VA_INVALID_ID;
+    VASurfaceID source = VA_INVALID_ID;
+    VAImage image {.image_id = VA_INVALID_ID};
+    bool derived = false;
+
+    VARectangle output_region {};
+    int width = 0;
+    int height = 0;
+  };
+
   class va_ram_t: public va_t {
   public:
     int convert(platf::img_t &img) override {
+      auto &nv12 = begin_convert();
+
+      // HDR needs the transfer function of the shaders
+      if (vpp && !video::colorspace_is_hdr(colorspace)) {
+        if (!vpp.convert(img, colorspace, frame)) {
+          return 0;
+        }
+
+        BOOST_LOG(warning) << "Falling back to converting images with OpenGL"sv;
+        vpp.reset();
+      }
+
       sws.load_ram(img);
 
       sws.convert(nv12->buf);
       return 0;
     }
+
+    int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx_buf) override {
+      if (va_t::set_frame(frame, hw_frames_ctx_buf)) {
+        return -1;
+      }
+
+      init_vpp();
+      return 0;
+    }
+
+    bool resize_input(int in_width, int in_height) override {
+      if (!va_t::resize_input(in_width, in_height)) {
+        return false;
+      }
+
+      init_vpp();
+      return true;
+    }
+
+  private:
+    void init_vpp() {
+      std::vector<AVFrame *> frames;
+      for (auto &surface : surfaces) {
+        frames.push_back(surface.frame.get());
+      }
+
+      if (vpp.init(va_display, width, height, frames)) {
+        vpp.reset();
+        BOOST_LOG(info) << "Converting images with OpenGL, the VA video processing pipeline isn't available"sv;
+      } else {
+        BOOST_LOG(info) << "Converting images with the VA video processing pipeline"sv;
+      }
+    }
+
+    // Destroyed before the frame it converts into
+    vpp_t vpp;
   };
 
   class va_vram_t: public va_t {
   public:
     int convert(platf::img_t &img) override {
       auto &descriptor = (egl::img_descriptor_t &) img;
+      auto &nv12 = begin_convert();
 
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank_rgb = egl::create_blank(img);
+        rgb = &blank_rgb;
+        overlay_cache.textures.clear();
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
-
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        rgb = rgb_cache.import(display.get(), descriptor.sd, descriptor.recycled);
+        if (!rgb) {
           return -1;
         }
 
-        rgb = std::move(*rgb_opt);
+        overlay_cache.import(display.get(), descriptor.overlays, descriptor.recycled);
       }
 
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0], overlay_cache.textures);
 
       sws.convert(nv12->buf);
       return 0;
     }
 
+    bool attach_display(const std::shared_ptr<platf::display_t> &) override {
+      // The sequence numbers and dmabufs of the new display have nothing in common with the old one
+      sequence = 0;
+      rgb = nullptr;
+      rgb_cache.clear();
+      overlay_cache.clear();
+      return true;
+    }
+
     int init(int in_width, int in_height, file_t &&render_device, int offset_x, int offset_y) {
       if (va_t::init(in_width, in_height, std::move(render_device))) {
         return -1;
@@ -441,7 +826,10 @@ namespace va {
     }
 
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::rgb_cache_t rgb_cache;
+    egl::overlay_cache_t overlay_cache;
+    egl::rgb_t blank_rgb;
+    egl::rgb_t *rgb = nullptr;
 
     int offset_x, offset_y;
   };
@@ -508,9 +896,9 @@ namespace va {
 
     va::display_t display {vaGetDisplayDRM(fd)};
     if (!display) {
-      auto render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name.c_str();
+      auto render_device = gpu_scheduler::render_device();
 
-      BOOST_LOG(error) << "Couldn't open a va display from DRM with device: "sv << render_device;
+      BOOST_LOG(error) << "Couldn't open a va display from DRM with device: "sv << (render_device.empty() ? "/dev/dri/renderD128"s : render_device);
       return -1;
     }
 
@@ -626,7 +1014,9 @@ namespace va {
   }
 
   std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, int offset_x, int offset_y, bool vram) {
-    auto render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name.c_str();
+    // The scheduler may have placed the session on another GPU than the configured one
+    auto gpu = gpu_scheduler::render_device();
+    auto render_device = gpu.empty() ? "/dev/dri/renderD128" : gpu.c_str();
 
     file_t file = open(render_device, O_RDWR);
     if (file.el < 0) {
@@ -11,7 +11,10 @@
  */
 
 // standard includes
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cerrno>
 #include <cstring>
 #include <dlfcn.h>
 #include <filesystem>
@@ -23,15 +26,21 @@
 
 // platform includes
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
 // local includes
+#include "cuda.h"
 #include "misc.h"
 #include "src/config.h"
+#include "src/image_memory.h"
 #include "src/logging.h"
+#include "src/video.h"
+#include "vaapi.h"
+#include "vulkan.h"
 #include "virtual_display.h"
 
 using namespace std::literals;
@@ -203,6 +212,22 @@ namespace VDISPLAY {
   static std::thread watchdog_thread;
   static bool evdi_available = false;
 
+  /**
+   * @brief State shared between an EVDI virtual display and the capture of its framebuffer.
+   * @details The virtual display clears the handle under the lock before closing it,
+   *          so neither the capture nor an image outliving it touches a closed handle.
+   */
+  struct evdi_capture_t {
+    std::mutex lock;
+    evdi_handle handle;
+
+    // The mode last set by the compositor, the requested resolution until it sets one
+    int width;
+    int height;
+
+    int last_buffer_id = 0;
+  };
+
   // Virtual display info structure
   struct VirtualDisplayInfo {
     std::string name;
@@ -215,10 +240,20 @@ namespace VDISPLAY {
     int drm_fd;            // DRM fd for card
     bool active;
     bool using_evdi;       // true if using EVDI, false if passthrough
+    std::shared_ptr<evdi_capture_t> capture;  // Set if using EVDI
   };
 
   static std::map<std::string, VirtualDisplayInfo> virtual_displays;
 
+  // EVDI device opened ahead of time, disconnected until a virtual display takes it
+  struct PooledDevice {
+    int device_index;
+    evdi_handle handle;
+  };
+
+  // See config::video_t::vdisplay_pool_size
+  static std::vector<PooledDevice> device_pool;
+
   // ============================================================================
   // EVDI Library Loading
   // ============================================================================
@@ -329,13 +364,41 @@ namespace VDISPLAY {
   // Utility Functions
   // ============================================================================
 
+  /**
+   * @brief Detach the capture of a virtual display from its EVDI handle, before the handle is closed.
+   */
+  static void release_capture(VirtualDisplayInfo &vdinfo) {
+    if (!vdinfo.capture) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(vdinfo.capture->lock);
+    vdinfo.capture->handle = nullptr;
+  }
+
   static std::string generate_display_name(const uuid_util::uuid_t &guid) {
     return "VIRTUAL-" + guid.string().substr(0, 8);
   }
 
+  static bool is_evdi_device_in_use(int device) {
+    for (const auto &[guid, vdinfo] : virtual_displays) {
+      if (vdinfo.using_evdi && vdinfo.device_index == device) {
+        return true;
+      }
+    }
+
+    return std::any_of(device_pool.begin(), device_pool.end(), [device](const PooledDevice &pooled) {
+      return pooled.device_index == device;
+    });
+  }
+
   static int find_available_evdi_device() {
     // Find next available EVDI device
     for (int i = 0; i < 16; i++) {
+      if (is_evdi_device_in_use(i)) {
+        continue;
+      }
+
       auto status = evdi.check_device(i);
       if (status == EVDI_AVAILABLE) {
         return i;
@@ -351,6 +414,39 @@ namespace VDISPLAY {
     return -1;
   }
 
+  /**
+   * @brief Open EVDI devices until the pool has as many as configured.
+   * @details Must be called with vdisplay_mutex held.
+   */
+  static void fill_device_pool() {
+    while (driver_status == DRIVER_STATUS::OK && evdi_available && device_pool.size() < (std::size_t) config::video.vdisplay_pool_size) {
+      int device = find_available_evdi_device();
+      if (device < 0) {
+        BOOST_LOG(warning) << "[VDISPLAY] No available EVDI device for the pool.";
+        return;
+      }
+
+      evdi_handle handle = evdi.open(device);
+      if (!handle) {
+        BOOST_LOG(warning) << "[VDISPLAY] Failed to open EVDI device " << device << " for the pool.";
+        return;
+      }
+
+      BOOST_LOG(debug) << "[VDISPLAY] Pooled EVDI device " << device;
+      device_pool.push_back({device, handle});
+    }
+  }
+
+  /**
+   * @brief Refill the pool without holding up the caller, which just took a device from it.
+   */
+  static void refill_device_pool_async() {
+    std::thread([]() {
+      std::lock_guard<std::mutex> lock(vdisplay_mutex);
+      fill_device_pool();
+    }).detach();
+  }
+
   static void calculate_edid_checksum(unsigned char *edid, size_t block_size = 128) {
     uint8_t checksum = 0;
     for (size_t i = 0; i < block_size - 1; i++) {
@@ -617,6 +713,8 @@ namespace VDISPLAY {
     driver_status = DRIVER_STATUS::OK;
     BOOST_LOG(info) << "[VDISPLAY] Linux virtual display driver initialized successfully.";
 
+    fill_device_pool();
+
     return driver_status;
   }
 
@@ -635,6 +733,7 @@ namespace VDISPLAY {
     for (auto &[guid, vdinfo] : virtual_displays) {
       if (vdinfo.active) {
         if (vdinfo.using_evdi && vdinfo.handle) {
+          release_capture(vdinfo);
           evdi.disconnect(vdinfo.handle);
           evdi.close(vdinfo.handle);
         }
@@ -645,6 +744,11 @@ namespace VDISPLAY {
     }
     virtual_displays.clear();
 
+    for (auto &pooled : device_pool) {
+      evdi.close(pooled.handle);
+    }
+    device_pool.clear();
+
     // Unload EVDI library
     unload_evdi_library();
 
@@ -745,10 +849,24 @@ namespace VDISPLAY {
     vdinfo.using_evdi = false;
 
     if (evdi_available) {
-      // Create real virtual display using EVDI
-      int device = find_available_evdi_device();
+      // Create real virtual display using EVDI, with a device of the pool when there's one left
+      int device = -1;
+      evdi_handle handle = nullptr;
+      if (!device_pool.empty()) {
+        device = device_pool.back().device_index;
+        handle = device_pool.back().handle;
+        device_pool.pop_back();
+
+        BOOST_LOG(info) << "[VDISPLAY] Using pooled EVDI device " << device;
+        refill_device_pool_async();
+      } else {
+        device = find_available_evdi_device();
+        if (device >= 0) {
+          handle = evdi.open(device);
+        }
+      }
+
       if (device >= 0) {
-        evdi_handle handle = evdi.open(device);
         if (handle) {
           // Generate EDID for requested resolution
           unsigned char *edid = generate_edid_for_resolution(width, height, fps_hz);
@@ -764,6 +882,11 @@ namespace VDISPLAY {
           vdinfo.handle = handle;
           vdinfo.using_evdi = true;
 
+          vdinfo.capture = std::make_shared<evdi_capture_t>();
+          vdinfo.capture->handle = handle;
+          vdinfo.capture->width = width;
+          vdinfo.capture->height = height;
+
           // Find the DRM card for this EVDI device
           std::string card_path = "/dev/dri/card" + std::to_string(device);
           vdinfo.drm_fd = ::open(card_path.c_str(), O_RDWR);
@@ -806,8 +929,15 @@ namespace VDISPLAY {
     BOOST_LOG(info) << "[VDISPLAY] Removing virtual display: " << vdinfo.name;
 
     if (vdinfo.using_evdi && vdinfo.handle) {
+      release_capture(vdinfo);
       evdi.disconnect(vdinfo.handle);
-      evdi.close(vdinfo.handle);
+
+      // A disconnected device is as good as a new one for the next virtual display
+      if (device_pool.size() < (std::size_t) config::video.vdisplay_pool_size) {
+        device_pool.push_back({vdinfo.device_index, vdinfo.handle});
+      } else {
+        evdi.close(vdinfo.handle);
+      }
     }
 
     if (vdinfo.drm_fd >= 0) {
@@ -923,6 +1053,262 @@ namespace VDISPLAY {
     return matches;
   }
 
+  // ============================================================================
+  // EVDI Framebuffer Capture
+  // ============================================================================
+
+  /**
+   * @brief An image registered with EVDI as a buffer, so EVDI copies the framebuffer straight into it.
+   */
+  struct evdi_img_t: public platf::img_t {
+    ~evdi_img_t() override {
+      {
+        std::lock_guard<std::mutex> lock(capture->lock);
+        if (capture->handle) {
+          evdi.unregister_buffer(capture->handle, buffer_id);
+        }
+      }
+
+      util::free_image(data);
+      data = nullptr;
+    }
+
+    std::shared_ptr<evdi_capture_t> capture;
+    int buffer_id;
+  };
+
+  /**
+   * @brief Captures the framebuffer of an EVDI virtual display, without going through the compositor or KMS.
+   * @details Every image of the pool is an EVDI buffer. A frame is requested for the free image, and when
+   *          nothing changed since the previous one, the update ready event of EVDI wakes the capture up
+   *          once something does. The rectangles EVDI reports as changed become the damage of the image.
+   */
+  class evdi_display_t: public platf::display_t {
+  public:
+    int init(platf::mem_type_e hwdevice_type, std::shared_ptr<evdi_capture_t> capture, const video::config_t &config) {
+      delay = std::chrono::nanoseconds {1s} / config.framerate;
+      mem_type = hwdevice_type;
+      _capture = std::move(capture);
+
+      std::lock_guard<std::mutex> lock(_capture->lock);
+      if (!_capture->handle) {
+        return -1;
+      }
+
+      _event_fd = evdi.get_event_ready(_capture->handle);
+      if (_event_fd < 0) {
+        BOOST_LOG(error) << "[VDISPLAY] Couldn't get the event fd of the EVDI device";
+        return -1;
+      }
+
+      width = _capture->width;
+      height = _capture->height;
+      env_width = width;
+      env_height = height;
+
+      _events.mode_changed_handler = on_mode_changed;
+      _events.update_ready_handler = on_update_ready;
+      _events.user_data = this;
+
+      return 0;
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        auto status = snapshot(pull_free_image_cb, img_out, 1000ms);
+        switch (status) {
+          case platf::capture_e::reinit:
+          case platf::capture_e::error:
+          case platf::capture_e::interrupted:
+            return status;
+          case platf::capture_e::timeout:
+            if (!push_captured_image_cb(std::move(img_out), false)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          case platf::capture_e::ok:
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          default:
+            BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+            return status;
+        }
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout) {
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+
+      // Every image of the pool comes from alloc_img()
+      auto img = (evdi_img_t *) img_out.get();
+
+      std::unique_lock<std::mutex> lock(_capture->lock);
+      if (!_capture->handle) {
+        return platf::capture_e::reinit;
+      }
+
+      _update_ready = -1;
+      if (!evdi.request_update(_capture->handle, img->buffer_id)) {
+        // Nothing changed since the previous frame, so wait for EVDI to report a change
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (_update_ready != img->buffer_id) {
+          auto now = std::chrono::steady_clock::now();
+          if (now >= deadline) {
+            return platf::capture_e::timeout;
+          }
+
+          lock.unlock();
+          pollfd pfd {_event_fd, POLLIN, 0};
+          auto ready = poll(&pfd, 1, std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
+          lock.lock();
+
+          if (!_capture->handle) {
+            return platf::capture_e::reinit;
+          }
+
+          if (ready < 0 && errno != EINTR) {
+            BOOST_LOG(error) << "[VDISPLAY] Couldn't wait for EVDI events: " << strerror(errno);
+            return platf::capture_e::error;
+          }
+
+          if (ready > 0) {
+            evdi.handle_events(_capture->handle, &_events);
+          }
+
+          if (_mode_changed) {
+            return platf::capture_e::reinit;
+          }
+        }
+      }
+
+      // EVDI reports at most 16 rectangles
+      std::array<evdi_rect, 16> rects;
+      int rect_count = rects.size();
+      evdi.grab_pixels(_capture->handle, rects.data(), &rect_count);
+      lock.unlock();
+
+      img_out->frame_timestamp = std::chrono::steady_clock::now();
+
+      if (!_grabbed) {
+        // There's no previous frame the rectangles are relative to
+        _grabbed = true;
+        img_out->damage.reset();
+        return platf::capture_e::ok;
+      }
+
+      auto &damage = img_out->damage.emplace();
+      for (int x = 0; x < std::min<int>(rect_count, rects.size()); ++x) {
+        auto left = std::max(rects[x].x1, 0);
+        auto top = std::max(rects[x].y1, 0);
+        auto right = std::min(rects[x].x2, width);
+        auto bottom = std::min(rects[x].y2, height);
+
+        if (left < right && top < bottom) {
+          damage.push_back({left, top, right - left, bottom - top});
+        }
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_VULKAN
+      if (mem_type == platf::mem_type_e::vulkan) {
+        return vk::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<evdi_img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->data = util::alloc_image(height * img->row_pitch);
+      img->capture = _capture;
+
+      std::lock_guard<std::mutex> lock(_capture->lock);
+      img->buffer_id = ++_capture->last_buffer_id;
+      if (_capture->handle) {
+        evdi.register_buffer(_capture->handle, {img->buffer_id, img->data, width, height, img->row_pitch, nullptr, 0});
+      }
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      std::fill_n(img->data, img->height * img->row_pitch, 0);
+      return 0;
+    }
+
+  private:
+    // Called by evdi.handle_events() with the lock of the capture held
+    static void on_update_ready(int buffer_id, void *user_data) {
+      ((evdi_display_t *) user_data)->_update_ready = buffer_id;
+    }
+
+    static void on_mode_changed(evdi_mode mode, void *user_data) {
+      auto display = (evdi_display_t *) user_data;
+
+      BOOST_LOG(info) << "[VDISPLAY] EVDI mode changed to " << mode.width << "x" << mode.height << "@" << mode.refresh_rate << "Hz";
+      if (mode.width != display->width || mode.height != display->height) {
+        display->_capture->width = mode.width;
+        display->_capture->height = mode.height;
+        display->_mode_changed = true;
+      }
+    }
+
+    std::chrono::nanoseconds delay;
+    platf::mem_type_e mem_type;
+
+    std::shared_ptr<evdi_capture_t> _capture;
+    int _event_fd = -1;
+    evdi_event_context _events {};
+
+    int _update_ready = -1;
+    bool _mode_changed = false;
+    bool _grabbed = false;
+  };
+
   // ============================================================================
   // EVDI-specific functions for KMS integration
   // ============================================================================
@@ -958,4 +1344,44 @@ namespace VDISPLAY {
     return -1;
   }
 
+  std::vector<std::string> evdiDisplayNames() {
+    std::vector<std::string> names;
+
+    std::lock_guard<std::mutex> lock(vdisplay_mutex);
+    for (const auto &[guid, vdinfo] : virtual_displays) {
+      if (vdinfo.using_evdi) {
+        names.push_back(vdinfo.name);
+      }
+    }
+    return names;
+  }
+
+  std::shared_ptr<platf::display_t> evdiDisplay(platf::mem_type_e hwdevice_type, const std::string &displayName, const video::config_t &config) {
+    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::vulkan && hwdevice_type != platf::mem_type_e::cuda) {
+      return nullptr;
+    }
+
+    std::shared_ptr<evdi_capture_t> capture;
+    {
+      std::lock_guard<std::mutex> lock(vdisplay_mutex);
+      for (const auto &[guid, vdinfo] : virtual_displays) {
+        if (vdinfo.name == displayName && vdinfo.capture) {
+          capture = vdinfo.capture;
+          break;
+        }
+      }
+    }
+
+    if (!capture) {
+      return nullptr;
+    }
+
+    auto display = std::make_shared<evdi_display_t>();
+    if (display->init(hwdevice_type, std::move(capture), config)) {
+      return nullptr;
+    }
+
+    return display;
+  }
+
 }  // namespace VDISPLAY
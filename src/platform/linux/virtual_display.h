@@ -6,10 +6,12 @@
 
 // standard includes
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 // local includes
+#include "src/platform/common.h"
 #include "src/uuid.h"
 
 namespace VDISPLAY {
@@ -147,4 +149,19 @@ namespace VDISPLAY {
    */
   int getEvdiCardIndex(const std::string &displayName);
 
+  /**
+   * @brief Get the names of the EVDI virtual displays.
+   * @return The names of the displays whose framebuffer can be captured with evdiDisplay().
+   */
+  std::vector<std::string> evdiDisplayNames();
+
+  /**
+   * @brief Capture the framebuffer of an EVDI virtual display directly.
+   * @param hwdevice_type The memory type of the encoder.
+   * @param displayName The name of the EVDI display.
+   * @param config The video configuration of the stream.
+   * @return The display, or nullptr if it isn't an EVDI display or can't be captured.
+   */
+  std::shared_ptr<platf::display_t> evdiDisplay(platf::mem_type_e hwdevice_type, const std::string &displayName, const video::config_t &config);
+
 }  // namespace VDISPLAY
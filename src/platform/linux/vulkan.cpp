@@ -0,0 +1,347 @@
+/**
+ * @file src/platform/linux/vulkan.cpp
+ * @brief Definitions for Vulkan Video hardware accelerated encoding.
+ */
+// standard includes
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext_drm.h>
+#include <libavutil/hwcontext_vulkan.h>
+}
+
+// local includes
+#include "graphics.h"
+#include "misc.h"
+#include "src/config.h"
+#include "src/gpu_scheduler.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/utility.h"
+#include "src/video.h"
+#include "vulkan.h"
+
+using namespace std::literals;
+
+namespace vk {
+  int vulkan_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *encode_device, AVBufferRef **hw_device_buf);
+
+  /**
+   * @brief Converts images with OpenGL into frames of FFmpeg's Vulkan Video encoders.
+   * @details The frames are allocated by FFmpeg and exported as dmabufs, which EGL renders into.
+   *          The encoder reads them on the same GPU, so the pixels never leave it.
+   */
+  class vk_t: public platf::avcodec_encode_device_t {
+  public:
+    int init(int in_width, int in_height, std::string in_render_device) {
+      render_device = std::move(in_render_device);
+
+      file = open(render_device.c_str(), O_RDWR);
+      if (file.el < 0) {
+        char string[1024];
+        BOOST_LOG(error) << "Couldn't open "sv << render_device << ": " << strerror_r(errno, string, sizeof(string));
+        return -1;
+      }
+
+      if (!gbm::create_device) {
+        BOOST_LOG(warning) << "libgbm not initialized"sv;
+        return -1;
+      }
+
+      this->data = (void *) vulkan_init_avcodec_hardware_input_buffer;
+
+      gbm.reset(gbm::create_device(file.el));
+      if (!gbm) {
+        char string[1024];
+        BOOST_LOG(error) << "Couldn't create GBM device: ["sv << strerror_r(errno, string, sizeof(string)) << ']';
+        return -1;
+      }
+
+      display = egl::make_display(gbm.get());
+      if (!display) {
+        return -1;
+      }
+
+      auto ctx_opt = egl::make_ctx(display.get());
+      if (!ctx_opt) {
+        return -1;
+      }
+
+      ctx = std::move(*ctx_opt);
+
+      width = in_width;
+      height = in_height;
+
+      return 0;
+    }
+
+    bool detach_display() override {
+      // The images are imported when they're converted, nothing refers to the display
+      return true;
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &) override {
+      return true;
+    }
+
+    void init_hwframes(AVHWFramesContext *frames) override {
+      // Only images with an explicit modifier can be exported as dmabufs
+      auto vk_frames = (AVVulkanFramesContext *) frames->hwctx;
+      vk_frames->tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+    }
+
+    int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx_buf) override {
+      this->hwframe.reset(frame);
+      this->frame = frame;
+
+      if (!frame->buf[0]) {
+        if (av_hwframe_get_buffer(hw_frames_ctx_buf, frame, 0)) {
+          BOOST_LOG(error) << "Couldn't get hwframe for Vulkan"sv;
+          return -1;
+        }
+      }
+
+      auto hw_frames_ctx = (AVHWFramesContext *) hw_frames_ctx_buf->data;
+
+      // The mapping stays for as long as the frame is encoded into, its dmabufs are closed with it
+      drm_frame.reset(av_frame_alloc());
+      drm_frame->format = AV_PIX_FMT_DRM_PRIME;
+      if (auto err = av_hwframe_map(drm_frame.get(), frame, AV_HWFRAME_MAP_WRITE | AV_HWFRAME_MAP_OVERWRITE); err < 0) {
+        char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+        BOOST_LOG(error) << "Couldn't export Vulkan frame as dmabuf: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, err);
+        return -1;
+      }
+
+      auto prime = (AVDRMFrameDescriptor *) drm_frame->data[0];
+      if (prime->nb_layers != 2) {
+        BOOST_LOG(error) << "Invalid layer count for Vulkan frame: expected 2, got "sv << prime->nb_layers;
+        return -1;
+      }
+
+      // EGL takes ownership of its own copies of the file descriptors
+      std::array<file_t, egl::nv12_img_t::num_fds> fds;
+      for (int x = 0; x < prime->nb_objects; ++x) {
+        fds[x] = dup(prime->objects[x].fd);
+      }
+
+      egl::surface_descriptor_t sds[2] = {};
+      for (int plane = 0; plane < 2; ++plane) {
+        auto &sd = sds[plane];
+        auto &layer = prime->layers[plane];
+
+        sd.fourcc = layer.format;
+
+        // UV plane is subsampled
+        sd.width = frame->width / (plane == 0 ? 1 : 2);
+        sd.height = frame->height / (plane == 0 ? 1 : 2);
+
+        // The modifier must be the same for all planes
+        sd.modifier = prime->objects[layer.planes[0].object_index].format_modifier;
+
+        std::fill_n(sd.fds, 4, -1);
+        for (int x = 0; x < layer.nb_planes; ++x) {
+          sd.fds[x] = fds[layer.planes[x].object_index].el;
+          sd.pitches[x] = layer.planes[x].pitch;
+          sd.offsets[x] = layer.planes[x].offset;
+        }
+      }
+
+      auto nv12_opt = egl::import_target(display.get(), std::move(fds), sds[0], sds[1]);
+      if (!nv12_opt) {
+        return -1;
+      }
+
+      auto sws_opt = egl::sws_t::make(width, height, frame->width, frame->height, hw_frames_ctx->sw_format);
+      if (!sws_opt) {
+        return -1;
+      }
+
+      this->sws = std::move(*sws_opt);
+      this->nv12 = std::move(*nv12_opt);
+      this->sw_format = hw_frames_ctx->sw_format;
+
+      return 0;
+    }
+
+    bool resize_input(int in_width, int in_height) override {
+      if (!frame) {
+        return false;
+      }
+
+      // The frame and its import stay, only the scaling into it changes
+      auto sws_opt = egl::sws_t::make(in_width, in_height, frame->width, frame->height, sw_format);
+      if (!sws_opt) {
+        return false;
+      }
+
+      sws = std::move(*sws_opt);
+      sws.apply_colorspace(colorspace);
+      sws.apply_tone_mapping(tone_mapping);
+
+      width = in_width;
+      height = in_height;
+
+      return true;
+    }
+
+    void apply_colorspace() override {
+      sws.apply_colorspace(colorspace);
+      sws.apply_tone_mapping(tone_mapping);
+    }
+
+    std::string render_device;
+    file_t file;
+
+    gbm::gbm_t gbm;
+    egl::display_t display;
+    egl::ctx_t ctx;
+
+    // The Vulkan images must outlive their import into EGL, and the mapping outlive neither
+    frame_t hwframe;
+    frame_t drm_frame;
+
+    egl::sws_t sws;
+    egl::nv12_t nv12;
+    AVPixelFormat sw_format;
+
+    int width, height;
+
+  protected:
+    /**
+     * @brief Wait for OpenGL to be done with the frame.
+     * @details Unlike VA-API drivers, Vulkan doesn't wait for the implicit fences of the memory it allocated itself.
+     */
+    void finish() {
+      gl::ctx.Finish();
+    }
+  };
+
+  class vk_ram_t: public vk_t {
+  public:
+    int convert(platf::img_t &img) override {
+      sws.load_ram(img);
+
+      sws.convert(nv12->buf);
+      finish();
+      return 0;
+    }
+  };
+
+  class vk_vram_t: public vk_t {
+  public:
+    int convert(platf::img_t &img) override {
+      auto &descriptor = (egl::img_descriptor_t &) img;
+
+      if (descriptor.sequence == 0) {
+        // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
+        blank_rgb = egl::create_blank(img);
+        rgb = &blank_rgb;
+        overlay_cache.textures.clear();
+      } else if (descriptor.sequence > sequence) {
+        sequence = descriptor.sequence;
+
+        rgb = rgb_cache.import(display.get(), descriptor.sd, descriptor.recycled);
+        if (!rgb) {
+          return -1;
+        }
+
+        overlay_cache.import(display.get(), descriptor.overlays, descriptor.recycled);
+      }
+
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0], overlay_cache.textures);
+
+      sws.convert(nv12->buf);
+      finish();
+      return 0;
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &) override {
+      // The sequence numbers and dmabufs of the new display have nothing in common with the old one
+      sequence = 0;
+      rgb = nullptr;
+      rgb_cache.clear();
+      overlay_cache.clear();
+      return true;
+    }
+
+    int init(int in_width, int in_height, std::string render_device, int offset_x, int offset_y) {
+      if (vk_t::init(in_width, in_height, std::move(render_device))) {
+        return -1;
+      }
+
+      sequence = 0;
+
+      this->offset_x = offset_x;
+      this->offset_y = offset_y;
+
+      return 0;
+    }
+
+    std::uint64_t sequence;
+    egl::rgb_cache_t rgb_cache;
+    egl::overlay_cache_t overlay_cache;
+    egl::rgb_t blank_rgb;
+    egl::rgb_t *rgb = nullptr;
+
+    int offset_x, offset_y;
+  };
+
+  int vulkan_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *base, AVBufferRef **hw_device_buf) {
+    auto device = (vk_t *) base;
+
+    // Derived from the render node EGL renders with, so the frames are exported on the GPU that encodes them
+    AVBufferRef *drm_device = nullptr;
+    auto err = av_hwdevice_ctx_create(&drm_device, AV_HWDEVICE_TYPE_DRM, device->render_device.c_str(), nullptr, 0);
+    if (err < 0) {
+      char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+      BOOST_LOG(error) << "Couldn't open DRM device "sv << device->render_device << ": "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, err);
+      return err;
+    }
+
+    auto fg = util::fail_guard([&drm_device]() {
+      av_buffer_unref(&drm_device);
+    });
+
+    err = av_hwdevice_ctx_create_derived(hw_device_buf, AV_HWDEVICE_TYPE_VULKAN, drm_device, 0);
+    if (err < 0) {
+      char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+      BOOST_LOG(error) << "Couldn't create a Vulkan device for "sv << device->render_device << ": "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, err);
+      return err;
+    }
+
+    return 0;
+  }
+
+  std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, std::string render_device, int offset_x, int offset_y, bool vram) {
+    if (vram) {
+      auto egl = std::make_unique<vk::vk_vram_t>();
+      if (egl->init(width, height, std::move(render_device), offset_x, offset_y)) {
+        return nullptr;
+      }
+
+      return egl;
+    }
+
+    auto egl = std::make_unique<vk::vk_ram_t>();
+    if (egl->init(width, height, std::move(render_device))) {
+      return nullptr;
+    }
+
+    return egl;
+  }
+
+  std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, int offset_x, int offset_y, bool vram) {
+    // The scheduler may have placed the session on another GPU than the configured one
+    auto gpu = gpu_scheduler::render_device();
+    auto render_device = gpu.empty() ? "/dev/dri/renderD128"s : gpu;
+
+    return make_avcodec_encode_device(width, height, std::move(render_device), offset_x, offset_y, vram);
+  }
+
+  std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, bool vram) {
+    return make_avcodec_encode_device(width, height, 0, 0, vram);
+  }
+}  // namespace vk
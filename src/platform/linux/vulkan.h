@@ -0,0 +1,26 @@
+/**
+ * @file src/platform/linux/vulkan.h
+ * @brief Declarations for Vulkan Video hardware accelerated encoding.
+ */
+#pragma once
+
+// standard includes
+#include <string>
+
+// local includes
+#include "misc.h"
+#include "src/platform/common.h"
+
+namespace vk {
+  /**
+   * Width --> Width of the image
+   * Height --> Height of the image
+   * offset_x --> Horizontal offset of the image in the texture
+   * offset_y --> Vertical offset of the image in the texture
+   * render_device --> The path of the render device used for encoding
+   * vram --> Whether the images are dmabufs rather than in system memory
+   */
+  std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, bool vram);
+  std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, int offset_x, int offset_y, bool vram);
+  std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, std::string render_device, int offset_x, int offset_y, bool vram);
+}  // namespace vk
@@ -3,13 +3,18 @@
  * @brief Definitions for Wayland capture.
  */
 // standard includes
+#include <algorithm>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <iterator>
 
 // platform includes
 #include <drm_fourcc.h>
 #include <fcntl.h>
 #include <gbm.h>
 #include <poll.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <wayland-client.h>
 #include <wayland-util.h>
@@ -17,6 +22,8 @@
 
 // local includes
 #include "graphics.h"
+#include "misc.h"
+#include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/round_robin.h"
@@ -211,7 +218,25 @@ namespace wl {
       dmabuf_interface = (zwp_linux_dmabuf_v1 *) wl_registry_bind(registry, id, &zwp_linux_dmabuf_v1_interface, version);
 
       this->interface[LINUX_DMABUF] = true;
+    } else if (!std::strcmp(interface, wl_shm_interface.name)) {
+      BOOST_LOG(info) << "Found interface: "sv << interface << '(' << id << ") version "sv << version;
+      shm = (wl_shm *) wl_registry_bind(registry, id, &wl_shm_interface, 1);
+
+      this->interface[WL_SHM] = true;
+    }
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    else if (!std::strcmp(interface, ext_image_copy_capture_manager_v1_interface.name)) {
+      BOOST_LOG(info) << "Found interface: "sv << interface << '(' << id << ") version "sv << version;
+      image_copy_capture_manager = (ext_image_copy_capture_manager_v1 *) wl_registry_bind(registry, id, &ext_image_copy_capture_manager_v1_interface, 1);
+
+      this->interface[EXT_IMAGE_COPY_CAPTURE] = true;
+    } else if (!std::strcmp(interface, ext_output_image_capture_source_manager_v1_interface.name)) {
+      BOOST_LOG(info) << "Found interface: "sv << interface << '(' << id << ") version "sv << version;
+      output_image_capture_source_manager = (ext_output_image_capture_source_manager_v1 *) wl_registry_bind(registry, id, &ext_output_image_capture_source_manager_v1_interface, 1);
+
+      this->interface[EXT_OUTPUT_IMAGE_CAPTURE_SOURCE] = true;
     }
+#endif
   }
 
   void interface_t::del_interface(wl_registry *registry, uint32_t id) {
@@ -258,22 +283,115 @@ namespace wl {
     return true;
   }
 
-  // Cleanup GBM
-  void dmabuf_t::cleanup_gbm() {
-    if (current_bo) {
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
+  // Allocate the GBM buffer of a frame, it's kept for as long as the format and size don't change
+  bool dmabuf_t::alloc_buffer(frame_t &frame) {
+    if (
+      frame.bo &&
+      frame.sd.fourcc == dmabuf_info.format &&
+      frame.sd.width == (int) dmabuf_info.width &&
+      frame.sd.height == (int) dmabuf_info.height
+    ) {
+      return true;
+    }
+
+    frame.destroy();
+
+    if (!init_gbm()) {
+      BOOST_LOG(error) << "Failed to initialize GBM"sv;
+      return false;
+    }
+
+    // Create GBM buffer
+    if (dmabuf_info.modifiers.empty()) {
+      frame.bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
+    } else {
+      frame.bo = gbm_bo_create_with_modifiers(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, dmabuf_info.modifiers.data(), dmabuf_info.modifiers.size());
+    }
+    if (!frame.bo) {
+      BOOST_LOG(error) << "Failed to create GBM buffer"sv;
+      return false;
+    }
+
+    // Get buffer info
+    int fd = gbm_bo_get_fd(frame.bo);
+    if (fd < 0) {
+      BOOST_LOG(error) << "Failed to get buffer FD"sv;
+      gbm_bo_destroy(frame.bo);
+      frame.bo = nullptr;
+      return false;
+    }
+
+    // Store in surface descriptor for later use
+    frame.sd.fourcc = dmabuf_info.format;
+    frame.sd.width = dmabuf_info.width;
+    frame.sd.height = dmabuf_info.height;
+    frame.sd.fds[0] = fd;
+    frame.sd.pitches[0] = gbm_bo_get_stride(frame.bo);
+    frame.sd.offsets[0] = 0;
+    frame.sd.modifier = gbm_bo_get_modifier(frame.bo);
+
+    return true;
+  }
+
+  // Allocate the wl_shm buffer of a frame, it's kept for as long as the format and size don't change
+  bool dmabuf_t::alloc_shm_buffer(frame_t &frame) {
+    if (
+      frame.shm_data &&
+      frame.sd.fourcc == shm_info.format &&
+      frame.sd.width == (int) shm_info.width &&
+      frame.sd.height == (int) shm_info.height &&
+      frame.sd.pitches[0] == shm_info.stride
+    ) {
+      return true;
     }
 
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
+    frame.destroy();
+
+    std::size_t size = (std::size_t) shm_info.stride * shm_info.height;
+
+    int fd = memfd_create("sunshine-capture", MFD_CLOEXEC);
+    if (fd < 0) {
+      BOOST_LOG(error) << "Failed to create shared memory for capture: "sv << std::strerror(errno);
+      return false;
+    }
+
+    if (ftruncate(fd, size) < 0) {
+      BOOST_LOG(error) << "Failed to size shared memory for capture: "sv << std::strerror(errno);
+      close(fd);
+      return false;
+    }
+
+    auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      BOOST_LOG(error) << "Failed to map shared memory for capture: "sv << std::strerror(errno);
+      close(fd);
+      return false;
     }
+
+    // Images encoded from the buffer keep it mapped after the ring let go of it
+    frame.shm_data = std::shared_ptr<std::uint8_t> {(std::uint8_t *) data, [size](std::uint8_t *data) {
+                                                      munmap(data, size);
+                                                    }};
+
+    // The buffer keeps the pool, which no longer needs the file descriptor once it's sent
+    auto pool = wl_shm_create_pool(shm_interface, fd, size);
+    frame.wl_buffer = wl_shm_pool_create_buffer(pool, 0, shm_info.width, shm_info.height, shm_info.stride, shm_info.format);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    frame.sd.fourcc = shm_info.format;
+    frame.sd.width = shm_info.width;
+    frame.sd.height = shm_info.height;
+    frame.sd.pitches[0] = shm_info.stride;
+    frame.sd.offsets[0] = 0;
+    frame.sd.modifier = DRM_FORMAT_MOD_INVALID;
+
+    return true;
   }
 
   dmabuf_t::dmabuf_t():
-      status {READY},
-      frames {},
+      status {IDLE},
+      frames(std::max(config::video.wayland_capture_buffers, 1)),
       current_frame {&frames[0]},
       listener {
         &CLASS_CALL(dmabuf_t, buffer),
@@ -283,39 +401,116 @@ namespace wl {
         &CLASS_CALL(dmabuf_t, damage),
         &CLASS_CALL(dmabuf_t, linux_dmabuf),
         &CLASS_CALL(dmabuf_t, buffer_done),
-      } {
+      }
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+      ,
+      session_listener {
+        &CLASS_CALL(dmabuf_t, session_buffer_size),
+        &CLASS_CALL(dmabuf_t, session_shm_format),
+        &CLASS_CALL(dmabuf_t, session_dmabuf_device),
+        &CLASS_CALL(dmabuf_t, session_dmabuf_format),
+        &CLASS_CALL(dmabuf_t, session_done),
+        &CLASS_CALL(dmabuf_t, session_stopped),
+      },
+      ext_frame_listener {
+        &CLASS_CALL(dmabuf_t, ext_transform),
+        &CLASS_CALL(dmabuf_t, ext_damage),
+        &CLASS_CALL(dmabuf_t, ext_presentation_time),
+        &CLASS_CALL(dmabuf_t, ext_ready),
+        &CLASS_CALL(dmabuf_t, ext_failed),
+      }
+#endif
+  {
   }
 
   // Start capture
-  void dmabuf_t::listen(
-    zwlr_screencopy_manager_v1 *screencopy_manager,
-    zwp_linux_dmabuf_v1 *dmabuf_interface,
-    wl_output *output,
-    bool blend_cursor
-  ) {
-    this->dmabuf_interface = dmabuf_interface;
+  bool dmabuf_t::listen(interface_t &interface, wl_output *output, bool blend_cursor) {
+    dmabuf_interface = interface.dmabuf_interface;
+    shm_interface = interface.shm;
+
+    // The frame that was just captured may still be read, unless there's no other buffer
+    auto it = std::find_if(std::begin(frames), std::end(frames), [&](const frame_t &frame) {
+      return (frames.size() == 1 || &frame != current_frame) && !frame.busy();
+    });
+    if (it == std::end(frames)) {
+      status = IDLE;
+      return false;
+    }
+
+    next_frame = &*it;
+    next_frame->damage.reset();
+    next_frame->timestamp.reset();
+    status = WAITING;
+
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    if (interface.has_ext_capture()) {
+      // Painting the cursor is an option of the session
+      if (ext_session && session_blend_cursor != blend_cursor) {
+        ext_image_copy_capture_session_v1_destroy(ext_session);
+        ext_image_capture_source_v1_destroy(ext_source);
+        ext_session = nullptr;
+        ext_source = nullptr;
+      }
+
+      if (!ext_session) {
+        shm_info.supported = false;
+        dmabuf_info.supported = false;
+        dmabuf_info.modifiers.clear();
+        session_done_received = false;
+        session_blend_cursor = blend_cursor;
+
+        ext_source = ext_output_image_capture_source_manager_v1_create_source(interface.output_image_capture_source_manager, output);
+        ext_session = ext_image_copy_capture_manager_v1_create_session(
+          interface.image_copy_capture_manager,
+          ext_source,
+          blend_cursor ? EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS : 0
+        );
+        ext_image_copy_capture_session_v1_add_listener(ext_session, &session_listener, this);
+      }
+
+      // Otherwise, the copy starts once the session has sent its buffer constraints
+      if (session_done_received) {
+        start_copy();
+      }
+
+      return true;
+    }
+#endif
+
     // Reset state
     shm_info.supported = false;
     dmabuf_info.supported = false;
+    dmabuf_info.modifiers.clear();
 
     // Create new frame
-    auto frame = zwlr_screencopy_manager_v1_capture_output(
-      screencopy_manager,
+    wlr_frame = zwlr_screencopy_manager_v1_capture_output(
+      interface.screencopy_manager,
       blend_cursor ? 1 : 0,
       output
     );
 
-    // Store frame data pointer for callbacks
-    zwlr_screencopy_frame_v1_set_user_data(frame, this);
-
     // Add listener
-    zwlr_screencopy_frame_v1_add_listener(frame, &listener, this);
+    zwlr_screencopy_frame_v1_add_listener(wlr_frame, &listener, this);
 
-    status = WAITING;
+    return true;
   }
 
   dmabuf_t::~dmabuf_t() {
-    cleanup_gbm();
+    if (wlr_frame) {
+      zwlr_screencopy_frame_v1_destroy(wlr_frame);
+    }
+
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    if (ext_frame) {
+      ext_image_copy_capture_frame_v1_destroy(ext_frame);
+    }
+    if (ext_session) {
+      ext_image_copy_capture_session_v1_destroy(ext_session);
+    }
+    if (ext_source) {
+      ext_image_capture_source_v1_destroy(ext_source);
+    }
+#endif
 
     for (auto &frame : frames) {
       frame.destroy();
@@ -366,79 +561,141 @@ namespace wl {
     BOOST_LOG(debug) << "Frame flags: "sv << flags << (y_invert ? " (y_invert)" : "");
   }
 
-  // DMA-BUF creation helper
-  void dmabuf_t::create_and_copy_dmabuf(zwlr_screencopy_frame_v1 *frame) {
-    if (!init_gbm()) {
-      BOOST_LOG(error) << "Failed to initialize GBM"sv;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
-      return;
+  // Allocate the buffer of the copy in flight if needed, then copy into it
+  void dmabuf_t::start_copy() {
+    // Only 32-bit BGRA memory is encoded without a conversion on the GPU
+    auto shm_usable = shm_info.supported && shm_interface && (shm_info.format == WL_SHM_FORMAT_XRGB8888 || shm_info.format == WL_SHM_FORMAT_ARGB8888);
+
+    if (prefer_shm && shm_usable) {
+      if (!alloc_shm_buffer(*next_frame)) {
+        frame_failed();
+        return;
+      }
+
+      copy();
+    } else if (dmabuf_info.supported && dmabuf_interface) {
+      // Prefer DMA-BUF if supported
+      if (!alloc_buffer(*next_frame)) {
+        frame_failed();
+        return;
+      }
+
+      copy();
+    } else if (shm_info.supported) {
+      BOOST_LOG(warning) << "Compositor only copies into shared memory, which is only captured when encoding on the CPU"sv;
+      frame_failed();
+    } else {
+      BOOST_LOG(error) << "No supported buffer types"sv;
+      frame_failed();
     }
+  }
 
-    // Create GBM buffer
-    current_bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
-    if (!current_bo) {
-      BOOST_LOG(error) << "Failed to create GBM buffer"sv;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
+  // Copy into the buffer of the copy in flight, creating its Wayland buffer the first time
+  void dmabuf_t::copy() {
+    if (!next_frame->wl_buffer) {
+      auto &sd = next_frame->sd;
+
+      // Create linux-dmabuf buffer
+      auto params = zwp_linux_dmabuf_v1_create_params(dmabuf_interface);
+      zwp_linux_buffer_params_v1_add(params, sd.fds[0], 0, sd.offsets[0], sd.pitches[0], sd.modifier >> 32, sd.modifier & 0xffffffff);
+
+      // Add listener for buffer creation
+      zwp_linux_buffer_params_v1_add_listener(params, &params_listener, this);
+
+      // Create Wayland buffer (async - callback will handle copy)
+      zwp_linux_buffer_params_v1_create(params, sd.width, sd.height, sd.fourcc, 0);
       return;
     }
 
-    // Get buffer info
-    int fd = gbm_bo_get_fd(current_bo);
-    if (fd < 0) {
-      BOOST_LOG(error) << "Failed to get buffer FD"sv;
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    if (ext_session) {
+      // Only one frame of a session may exist at a time
+      if (ext_frame) {
+        return;
+      }
+
+      ext_frame = ext_image_copy_capture_session_v1_create_frame(ext_session);
+      ext_image_copy_capture_frame_v1_add_listener(ext_frame, &ext_frame_listener, this);
+      ext_image_copy_capture_frame_v1_attach_buffer(ext_frame, next_frame->wl_buffer);
+
+      // The buffer holds an older frame of the ring, so all of it is out of date
+      ext_image_copy_capture_frame_v1_damage_buffer(ext_frame, 0, 0, next_frame->sd.width, next_frame->sd.height);
+
+      // The compositor always reports damage
+      next_frame->damage.emplace();
+      ext_image_copy_capture_frame_v1_capture(ext_frame);
       return;
     }
+#endif
 
-    uint32_t stride = gbm_bo_get_stride(current_bo);
-    uint64_t modifier = gbm_bo_get_modifier(current_bo);
-
-    // Store in surface descriptor for later use
-    auto next_frame = get_next_frame();
-    next_frame->sd.fds[0] = fd;
-    next_frame->sd.pitches[0] = stride;
-    next_frame->sd.offsets[0] = 0;
-    next_frame->sd.modifier = modifier;
+    // Start the actual copy, waiting for damage when the compositor can report it
+    // so static screens don't produce any frames
+    if (zwlr_screencopy_frame_v1_get_version(wlr_frame) >= ZWLR_SCREENCOPY_FRAME_V1_COPY_WITH_DAMAGE_SINCE_VERSION) {
+      next_frame->damage.emplace();
+      zwlr_screencopy_frame_v1_copy_with_damage(wlr_frame, next_frame->wl_buffer);
+    } else {
+      zwlr_screencopy_frame_v1_copy(wlr_frame, next_frame->wl_buffer);
+    }
+  }
 
-    // Create linux-dmabuf buffer
-    auto params = zwp_linux_dmabuf_v1_create_params(dmabuf_interface);
-    zwp_linux_buffer_params_v1_add(params, fd, 0, 0, stride, modifier >> 32, modifier & 0xffffffff);
+  // The copy in flight is done, the buffer now contains screen content
+  void dmabuf_t::frame_ready() {
+    if (wlr_frame) {
+      zwlr_screencopy_frame_v1_destroy(wlr_frame);
+      wlr_frame = nullptr;
+    }
 
-    // Add listener for buffer creation
-    zwp_linux_buffer_params_v1_add_listener(params, &params_listener, frame);
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    if (ext_frame) {
+      ext_image_copy_capture_frame_v1_destroy(ext_frame);
+      ext_frame = nullptr;
+    }
+#endif
 
-    // Create Wayland buffer (async - callback will handle copy)
-    zwp_linux_buffer_params_v1_create(params, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, 0);
+    current_frame = next_frame;
+    next_frame = nullptr;
+    status = READY;
   }
 
-  // Buffer done callback - time to create buffer
-  void dmabuf_t::buffer_done(zwlr_screencopy_frame_v1 *frame) {
-    auto next_frame = get_next_frame();
+  /**
+   * @brief Take the time the content of the frame in flight was presented at.
+   * @details Both capture protocols report it on the clock of wp_presentation, which is CLOCK_MONOTONIC.
+   *          A copy of content that wasn't presented again carries the time of the last presentation,
+   *          it's left without a timestamp so it isn't taken for a late frame.
+   */
+  void dmabuf_t::presented(std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec) {
+    if (!next_frame) {
+      return;
+    }
 
-    // Prefer DMA-BUF if supported
-    if (dmabuf_info.supported && dmabuf_interface) {
-      // Store format info first
-      next_frame->sd.fourcc = dmabuf_info.format;
-      next_frame->sd.width = dmabuf_info.width;
-      next_frame->sd.height = dmabuf_info.height;
+    auto sec = ((std::uint64_t) tv_sec_hi << 32) | tv_sec_lo;
+    auto timestamp = std::chrono::seconds {sec} + std::chrono::nanoseconds {tv_nsec};
+    if (timestamp > last_presentation) {
+      next_frame->timestamp = platf::from_monotonic(timestamp);
+      last_presentation = timestamp;
+    }
+  }
 
-      // Create and start copy
-      create_and_copy_dmabuf(frame);
-    } else if (shm_info.supported) {
-      // SHM fallback would go here
-      BOOST_LOG(warning) << "SHM capture not implemented"sv;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
-    } else {
-      BOOST_LOG(error) << "No supported buffer types"sv;
-      zwlr_screencopy_frame_v1_destroy(frame);
-      status = REINIT;
+  void dmabuf_t::frame_failed() {
+    if (wlr_frame) {
+      zwlr_screencopy_frame_v1_destroy(wlr_frame);
+      wlr_frame = nullptr;
+    }
+
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    if (ext_frame) {
+      ext_image_copy_capture_frame_v1_destroy(ext_frame);
+      ext_frame = nullptr;
     }
+#endif
+
+    next_frame = nullptr;
+    status = REINIT;
+  }
+
+  // Buffer done callback - time to create buffer
+  void dmabuf_t::buffer_done(zwlr_screencopy_frame_v1 *frame) {
+    start_copy();
   }
 
   // Buffer params created callback
@@ -447,14 +704,18 @@ namespace wl {
     struct zwp_linux_buffer_params_v1 *params,
     struct wl_buffer *buffer
   ) {
-    auto frame = static_cast<zwlr_screencopy_frame_v1 *>(data);
-    auto self = static_cast<dmabuf_t *>(zwlr_screencopy_frame_v1_get_user_data(frame));
+    auto self = static_cast<dmabuf_t *>(data);
+    zwp_linux_buffer_params_v1_destroy(params);
 
-    // Store for cleanup
-    self->current_wl_buffer = buffer;
+    // The copy was abandoned, or the buffer was created twice
+    if (self->status != WAITING || self->next_frame->wl_buffer) {
+      wl_buffer_destroy(buffer);
+      return;
+    }
 
-    // Start the actual copy
-    zwlr_screencopy_frame_v1_copy(frame, buffer);
+    // Kept with the GBM buffer, for every copy into it
+    self->next_frame->wl_buffer = buffer;
+    self->copy();
   }
 
   // Buffer params failed callback
@@ -462,14 +723,15 @@ namespace wl {
     void *data,
     struct zwp_linux_buffer_params_v1 *params
   ) {
-    auto frame = static_cast<zwlr_screencopy_frame_v1 *>(data);
-    auto self = static_cast<dmabuf_t *>(zwlr_screencopy_frame_v1_get_user_data(frame));
+    auto self = static_cast<dmabuf_t *>(data);
+    zwp_linux_buffer_params_v1_destroy(params);
 
     BOOST_LOG(error) << "Failed to create buffer from params"sv;
-    self->cleanup_gbm();
+    if (self->next_frame) {
+      self->next_frame->destroy();
+    }
 
-    zwlr_screencopy_frame_v1_destroy(frame);
-    self->status = REINIT;
+    self->frame_failed();
   }
 
   // Ready callback
@@ -481,33 +743,15 @@ namespace wl {
   ) {
     BOOST_LOG(debug) << "Frame ready"sv;
 
-    // Frame is ready for use, GBM buffer now contains screen content
-    current_frame->destroy();
-    current_frame = get_next_frame();
-
-    // Keep the GBM buffer alive but destroy the Wayland objects
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
-    }
-
-    cleanup_gbm();
-
-    zwlr_screencopy_frame_v1_destroy(frame);
-    status = READY;
+    presented(tv_sec_hi, tv_sec_lo, tv_nsec);
+    frame_ready();
   }
 
   // Failed callback
   void dmabuf_t::failed(zwlr_screencopy_frame_v1 *frame) {
     BOOST_LOG(error) << "Frame capture failed"sv;
 
-    // Clean up resources
-    cleanup_gbm();
-    auto next_frame = get_next_frame();
-    next_frame->destroy();
-
-    zwlr_screencopy_frame_v1_destroy(frame);
-    status = REINIT;
+    frame_failed();
   }
 
   void dmabuf_t::damage(
@@ -516,9 +760,130 @@ namespace wl {
     std::uint32_t y,
     std::uint32_t width,
     std::uint32_t height
-  ) {};
+  ) {
+    if (next_frame && next_frame->damage) {
+      next_frame->damage->push_back({(std::int32_t) x, (std::int32_t) y, (std::int32_t) width, (std::int32_t) height});
+    }
+  };
+
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+  // The constraints are sent again, followed by another done event, whenever they change
+  void dmabuf_t::constraints_changing() {
+    if (!session_done_received) {
+      return;
+    }
+
+    session_done_received = false;
+    shm_info.supported = false;
+    dmabuf_info.supported = false;
+    dmabuf_info.modifiers.clear();
+  }
+
+  void dmabuf_t::session_buffer_size(ext_image_copy_capture_session_v1 *session, std::uint32_t width, std::uint32_t height) {
+    constraints_changing();
+
+    shm_info.width = dmabuf_info.width = width;
+    shm_info.height = dmabuf_info.height = height;
+
+    // The client picks the stride, rows are packed for the 32-bit formats
+    shm_info.stride = width * 4;
+  }
+
+  void dmabuf_t::session_shm_format(ext_image_copy_capture_session_v1 *session, std::uint32_t format) {
+    constraints_changing();
+
+    // Stick to the formats wlr-screencopy hands out, the first one offered wins
+    if (shm_info.supported || (format != WL_SHM_FORMAT_XRGB8888 && format != WL_SHM_FORMAT_ARGB8888)) {
+      return;
+    }
+
+    shm_info.supported = true;
+    shm_info.format = format;
+
+    BOOST_LOG(debug) << "Image copy capture supports SHM format: "sv << format;
+  }
+
+  void dmabuf_t::session_dmabuf_device(ext_image_copy_capture_session_v1 *session, wl_array *device) {
+    constraints_changing();
+
+    // The buffers are allocated on the first render node, like for wlr-screencopy
+  }
+
+  void dmabuf_t::session_dmabuf_format(ext_image_copy_capture_session_v1 *session, std::uint32_t format, wl_array *modifiers) {
+    constraints_changing();
+
+    BOOST_LOG(debug) << "Image copy capture supports DMA-BUF format: "sv << format;
+
+    // Stick to the formats wlr-screencopy hands out, the first one offered wins
+    if (dmabuf_info.supported || (format != DRM_FORMAT_XRGB8888 && format != DRM_FORMAT_ARGB8888)) {
+      return;
+    }
+
+    dmabuf_info.supported = true;
+    dmabuf_info.format = format;
+
+    // An invalid modifier lets the driver pick an implicit layout
+    auto begin = (const std::uint64_t *) modifiers->data;
+    std::copy_if(begin, begin + modifiers->size / sizeof(std::uint64_t), std::back_inserter(dmabuf_info.modifiers), [](std::uint64_t modifier) {
+      return modifier != DRM_FORMAT_MOD_INVALID;
+    });
+  }
+
+  void dmabuf_t::session_done(ext_image_copy_capture_session_v1 *session) {
+    session_done_received = true;
+
+    // A copy was requested before the constraints were known
+    if (status == WAITING && next_frame && !ext_frame) {
+      start_copy();
+    }
+  }
+
+  void dmabuf_t::session_stopped(ext_image_copy_capture_session_v1 *session) {
+    BOOST_LOG(warning) << "Image copy capture session stopped"sv;
+
+    frame_failed();
+  }
+
+  void dmabuf_t::ext_transform(ext_image_copy_capture_frame_v1 *frame, std::uint32_t transform) {
+    BOOST_LOG(debug) << "Frame transform: "sv << transform;
+  }
+
+  void dmabuf_t::ext_damage(ext_image_copy_capture_frame_v1 *frame, std::int32_t x, std::int32_t y, std::int32_t width, std::int32_t height) {
+    if (next_frame && next_frame->damage) {
+      next_frame->damage->push_back({x, y, width, height});
+    }
+  }
+
+  void dmabuf_t::ext_presentation_time(ext_image_copy_capture_frame_v1 *frame, std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec) {
+    presented(tv_sec_hi, tv_sec_lo, tv_nsec);
+  }
+
+  void dmabuf_t::ext_ready(ext_image_copy_capture_frame_v1 *frame) {
+    BOOST_LOG(debug) << "Frame ready"sv;
+
+    frame_ready();
+  }
+
+  void dmabuf_t::ext_failed(ext_image_copy_capture_frame_v1 *frame, std::uint32_t reason) {
+    BOOST_LOG(error) << "Frame capture failed: "sv << reason;
+
+    frame_failed();
+  }
+#endif
 
   void frame_t::destroy() {
+    if (wl_buffer) {
+      wl_buffer_destroy(wl_buffer);
+      wl_buffer = nullptr;
+    }
+
+    if (bo) {
+      gbm_bo_destroy(bo);
+      bo = nullptr;
+    }
+
+    shm_data.reset();
+
     for (auto x = 0; x < 4; ++x) {
       if (sd.fds[x] >= 0) {
         close(sd.fds[x]);
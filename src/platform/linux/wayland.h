@@ -6,11 +6,19 @@
 
 // standard includes
 #include <bitset>
+#include <chrono>
+#include <memory>
+#include <optional>
 
 #ifdef SUNSHINE_BUILD_WAYLAND
   #include <linux-dmabuf-unstable-v1.h>
   #include <wlr-screencopy-unstable-v1.h>
   #include <xdg-output-unstable-v1.h>
+
+  #ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    #include <ext-image-capture-source-v1.h>
+    #include <ext-image-copy-capture-v1.h>
+  #endif
 #endif
 
 // local includes
@@ -25,17 +33,47 @@
 namespace wl {
   using display_internal_t = util::safe_ptr<wl_display, wl_display_disconnect>;
 
+  class interface_t;
+
+  /**
+   * @brief A GBM or wl_shm buffer of the capture ring.
+   * @details The buffer and its Wayland object are kept across frames, so the compositor
+   *          always copies into buffers it has seen before.
+   */
   class frame_t {
   public:
     frame_t();
     void destroy();
 
+    /**
+     * @brief Check whether an image handed out for encoding still reads from the buffer.
+     */
+    bool busy() const {
+      return !reader.expired();
+    }
+
     egl::surface_descriptor_t sd;
+
+    // Damage reported by the compositor, only set for frames copied with damage
+    std::optional<std::vector<platf::damage_rect_t>> damage;
+
+    // When the compositor presented the content, if it said so
+    std::optional<std::chrono::steady_clock::time_point> timestamp;
+
+    struct gbm_bo *bo {nullptr};
+    struct wl_buffer *wl_buffer {nullptr};
+
+    // The mapping of a wl_shm buffer, shared with the images encoded straight from it
+    std::shared_ptr<std::uint8_t> shm_data;
+
+    // The image the buffer was last handed out with
+    std::weak_ptr<platf::img_t> reader;
   };
 
   class dmabuf_t {
   public:
     enum status_e {
+      IDLE,  ///< No copy in flight
       WAITING,  ///< Waiting for a frame
       READY,  ///< Frame is ready
       REINIT,  ///< Reinitialize the frame
@@ -49,7 +87,16 @@ namespace wl {
     dmabuf_t &operator=(const dmabuf_t &) = delete;
     dmabuf_t &operator=(dmabuf_t &&) = delete;
 
-    void listen(zwlr_screencopy_manager_v1 *screencopy_manager, zwp_linux_dmabuf_v1 *dmabuf_interface, wl_output *output, bool blend_cursor = false);
+    /**
+     * @brief Start copying the output into the next free buffer of the ring.
+     * @details ext-image-copy-capture is used when the compositor supports it, wlr-screencopy otherwise.
+     * @param interface The bound globals.
+     * @param output The output to capture.
+     * @param blend_cursor Whether the compositor should paint the cursor into the frame.
+     * @return `false` if every other buffer is still being read, leaving the status at `IDLE`.
+     */
+    bool listen(interface_t &interface, wl_output *output, bool blend_cursor = false);
+
     static void buffer_params_created(void *data, struct zwp_linux_buffer_params_v1 *params, struct wl_buffer *wl_buffer);
     static void buffer_params_failed(void *data, struct zwp_linux_buffer_params_v1 *params);
     void buffer(zwlr_screencopy_frame_v1 *frame, std::uint32_t format, std::uint32_t width, std::uint32_t height, std::uint32_t stride);
@@ -60,21 +107,64 @@ namespace wl {
     void ready(zwlr_screencopy_frame_v1 *frame, std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec);
     void failed(zwlr_screencopy_frame_v1 *frame);
 
-    frame_t *get_next_frame() {
-      return current_frame == &frames[0] ? &frames[1] : &frames[0];
-    }
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    void session_buffer_size(ext_image_copy_capture_session_v1 *session, std::uint32_t width, std::uint32_t height);
+    void session_shm_format(ext_image_copy_capture_session_v1 *session, std::uint32_t format);
+    void session_dmabuf_device(ext_image_copy_capture_session_v1 *session, wl_array *device);
+    void session_dmabuf_format(ext_image_copy_capture_session_v1 *session, std::uint32_t format, wl_array *modifiers);
+    void session_done(ext_image_copy_capture_session_v1 *session);
+    void session_stopped(ext_image_copy_capture_session_v1 *session);
+    void ext_transform(ext_image_copy_capture_frame_v1 *frame, std::uint32_t transform);
+    void ext_damage(ext_image_copy_capture_frame_v1 *frame, std::int32_t x, std::int32_t y, std::int32_t width, std::int32_t height);
+    void ext_presentation_time(ext_image_copy_capture_frame_v1 *frame, std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec);
+    void ext_ready(ext_image_copy_capture_frame_v1 *frame);
+    void ext_failed(ext_image_copy_capture_frame_v1 *frame, std::uint32_t reason);
+#endif
 
     status_e status;
-    std::array<frame_t, 2> frames;
+
+    // Copy into wl_shm buffers the CPU reads from, rather than into GBM buffers
+    bool prefer_shm {false};
+
+    // The ring of buffers, sized by the wayland_capture_buffers option
+    std::vector<frame_t> frames;
     frame_t *current_frame;
     zwlr_screencopy_frame_v1_listener listener;
 
   private:
     bool init_gbm();
-    void cleanup_gbm();
-    void create_and_copy_dmabuf(zwlr_screencopy_frame_v1 *frame);
+    bool alloc_buffer(frame_t &frame);
+    bool alloc_shm_buffer(frame_t &frame);
+    void start_copy();
+    void copy();
+    void frame_ready();
+    void frame_failed();
+    void presented(std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec);
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    void constraints_changing();
+#endif
 
     zwp_linux_dmabuf_v1 *dmabuf_interface {nullptr};
+    wl_shm *shm_interface {nullptr};
+
+    // The buffer of the copy in flight
+    frame_t *next_frame {nullptr};
+
+    // When the content of the last frame was presented on CLOCK_MONOTONIC, as the compositor reported it
+    std::chrono::nanoseconds last_presentation {};
+    zwlr_screencopy_frame_v1 *wlr_frame {nullptr};
+
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    ext_image_capture_source_v1 *ext_source {nullptr};
+    ext_image_copy_capture_session_v1 *ext_session {nullptr};
+    ext_image_copy_capture_frame_v1 *ext_frame {nullptr};
+    ext_image_copy_capture_session_v1_listener session_listener;
+    ext_image_copy_capture_frame_v1_listener ext_frame_listener;
+
+    // Whether the session has sent its buffer constraints
+    bool session_done_received {false};
+    bool session_blend_cursor {false};
+#endif
 
     struct {
       bool supported {false};
@@ -89,11 +179,12 @@ namespace wl {
       std::uint32_t format;
       std::uint32_t width;
       std::uint32_t height;
+
+      // Empty when the compositor doesn't restrict the modifiers
+      std::vector<std::uint64_t> modifiers;
     } dmabuf_info;
 
     struct gbm_device *gbm_device {nullptr};
-    struct gbm_bo *current_bo {nullptr};
-    struct wl_buffer *current_wl_buffer {nullptr};
     bool y_invert {false};
   };
 
@@ -141,6 +232,9 @@ namespace wl {
       XDG_OUTPUT,  ///< xdg-output
       WLR_EXPORT_DMABUF,  ///< screencopy manager
       LINUX_DMABUF,  ///< linux-dmabuf protocol
+      EXT_IMAGE_COPY_CAPTURE,  ///< ext-image-copy-capture manager
+      EXT_OUTPUT_IMAGE_CAPTURE_SOURCE,  ///< ext-image-capture-source manager for outputs
+      WL_SHM,  ///< wl_shm
       MAX_INTERFACES,  ///< Maximum number of interfaces
     };
 
@@ -161,6 +255,19 @@ namespace wl {
     zwlr_screencopy_manager_v1 *screencopy_manager {nullptr};
     zwp_linux_dmabuf_v1 *dmabuf_interface {nullptr};
     zxdg_output_manager_v1 *output_manager {nullptr};
+    wl_shm *shm {nullptr};
+
+#ifdef SUNSHINE_BUILD_WAYLAND_EXT_CAPTURE
+    ext_image_copy_capture_manager_v1 *image_copy_capture_manager {nullptr};
+    ext_output_image_capture_source_manager_v1 *output_image_capture_source_manager {nullptr};
+#endif
+
+    /**
+     * @brief Check whether outputs can be captured through ext-image-copy-capture.
+     */
+    bool has_ext_capture() const {
+      return interface[EXT_IMAGE_COPY_CAPTURE] && interface[EXT_OUTPUT_IMAGE_CAPTURE_SOURCE];
+    }
 
   private:
     void add_interface(wl_registry *registry, std::uint32_t id, const char *interface, std::uint32_t version);
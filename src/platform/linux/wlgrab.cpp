@@ -5,12 +5,17 @@
 // standard includes
 #include <thread>
 
+// platform includes
+#include <unistd.h>
+
 // local includes
 #include "cuda.h"
+#include "src/image_memory.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/video.h"
 #include "vaapi.h"
+#include "vulkan.h"
 #include "wayland.h"
 
 using namespace std::literals;
@@ -21,9 +26,27 @@ namespace wl {
 
   struct img_t: public platf::img_t {
     ~img_t() override {
-      delete[] data;
+      util::free_image(buffer);
       data = nullptr;
     }
+
+    /**
+     * @brief Point the image at its own memory, allocating it the first time.
+     */
+    void own_data() {
+      shm_data.reset();
+
+      if (!buffer) {
+        buffer = util::alloc_image(height * row_pitch);
+      }
+      data = buffer;
+    }
+
+    // Only allocated for frames read back from the GPU
+    std::uint8_t *buffer {};
+
+    // The wl_shm buffer of the capture ring the compositor copied the frame into
+    std::shared_ptr<std::uint8_t> shm_data;
   };
 
   class wlr_t: public platf::display_t {
@@ -45,8 +68,8 @@ namespace wl {
         return -1;
       }
 
-      if (!interface[wl::interface_t::WLR_EXPORT_DMABUF]) {
-        BOOST_LOG(error) << "Missing Wayland wire for wlr-export-dmabuf"sv;
+      if (!interface[wl::interface_t::WLR_EXPORT_DMABUF] && !interface.has_ext_capture()) {
+        BOOST_LOG(error) << "Missing Wayland wire for wlr-screencopy or ext-image-copy-capture"sv;
         return -1;
       }
 
@@ -92,14 +115,19 @@ namespace wl {
     inline platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
       auto to = std::chrono::steady_clock::now() + timeout;
 
-      // Dispatch events until we get a new frame or the timeout expires
-      dmabuf.listen(interface.screencopy_manager, interface.dmabuf_interface, output, cursor);
-      do {
+      // Dispatch events until we get a new frame or the timeout expires.
+      // The copy may have been requested along with the previous frame,
+      // and a frame copied with damage may still be pending from a previous timeout.
+      if (dmabuf.status == dmabuf_t::IDLE && !dmabuf.listen(interface, output, cursor)) {
+        // Every other buffer is still waiting to be encoded
+        return platf::capture_e::timeout;
+      }
+      while (dmabuf.status == dmabuf_t::WAITING) {
         auto remaining_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(to - std::chrono::steady_clock::now());
         if (remaining_time_ms.count() < 0 || !display.dispatch(remaining_time_ms)) {
           return platf::capture_e::timeout;
         }
-      } while (dmabuf.status == dmabuf_t::WAITING);
+      }
 
       auto current_frame = dmabuf.current_frame;
 
@@ -111,6 +139,14 @@ namespace wl {
         return platf::capture_e::reinit;
       }
 
+      // Keep the copy of the next frame in flight while this one is encoded
+      if (dmabuf.frames.size() > 1) {
+        dmabuf.listen(interface, output, cursor);
+        wl_display_flush(display.get());
+      } else {
+        dmabuf.status = dmabuf_t::IDLE;
+      }
+
       return platf::capture_e::ok;
     }
 
@@ -180,6 +216,25 @@ namespace wl {
 
       auto current_frame = dmabuf.current_frame;
 
+      // The compositor copied into memory the encoder reads straight from
+      if (current_frame->shm_data) {
+        if (!pull_free_image_cb(img_out)) {
+          return platf::capture_e::interrupted;
+        }
+        auto img = (img_t *) img_out.get();
+
+        img->shm_data = current_frame->shm_data;
+        img->data = img->shm_data.get();
+        img->row_pitch = current_frame->sd.pitches[0];
+        img->damage = current_frame->damage;
+        img->frame_timestamp = current_frame->timestamp;
+
+        // The buffer isn't copied into again until the encoder is done with the image
+        current_frame->reader = img_out;
+
+        return platf::capture_e::ok;
+      }
+
       auto rgb_opt = egl::import_source(egl_display.get(), current_frame->sd);
 
       if (!rgb_opt) {
@@ -189,6 +244,9 @@ namespace wl {
       if (!pull_free_image_cb(img_out)) {
         return platf::capture_e::interrupted;
       }
+      auto img = (img_t *) img_out.get();
+      img->row_pitch = img->pixel_pitch * width;
+      img->own_data();
 
       gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb_opt)->tex[0]);
 
@@ -201,6 +259,9 @@ namespace wl {
       gl::ctx.GetTextureSubImage((*rgb_opt)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
       gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
 
+      img_out->damage = current_frame->damage;
+      img_out->frame_timestamp = current_frame->timestamp;
+
       return platf::capture_e::ok;
     }
 
@@ -221,6 +282,9 @@ namespace wl {
 
       ctx = std::move(*ctx_opt);
 
+      // Frames in shared memory are encoded without a copy
+      dmabuf.prefer_shm = true;
+
       return 0;
     }
 
@@ -231,6 +295,12 @@ namespace wl {
       }
 #endif
 
+#ifdef SUNSHINE_BUILD_VULKAN
+      if (mem_type == platf::mem_type_e::vulkan) {
+        return vk::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
 #ifdef SUNSHINE_BUILD_CUDA
       if (mem_type == platf::mem_type_e::cuda) {
         return cuda::make_avcodec_encode_device(width, height, false);
@@ -246,11 +316,22 @@ namespace wl {
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+
+      // The memory is taken from the capture ring, or allocated once a frame is read back
+      img->data = nullptr;
 
       return img;
     }
 
+    int dummy_img(platf::img_t *img) override {
+      auto wl_img = (img_t *) img;
+      wl_img->row_pitch = wl_img->pixel_pitch * width;
+      wl_img->own_data();
+
+      std::fill_n(wl_img->data, wl_img->height * wl_img->row_pitch, 0);
+      return 0;
+    }
+
     egl::display_t egl_display;
     egl::ctx_t ctx;
   };
@@ -320,9 +401,18 @@ namespace wl {
       img->sequence = sequence;
 
       img->sd = current_frame->sd;
+      img->damage = current_frame->damage;
+      img->frame_timestamp = current_frame->timestamp;
 
-      // Prevent dmabuf from closing the file descriptors.
-      std::fill_n(current_frame->sd.fds, 4, -1);
+      // The buffer stays in the capture ring, so the image gets its own file descriptors
+      for (auto &fd : img->sd.fds) {
+        if (fd >= 0) {
+          fd = dup(fd);
+        }
+      }
+
+      // The buffer isn't copied into again until the encoder is done with the image
+      current_frame->reader = img_out;
 
       return platf::capture_e::ok;
     }
@@ -349,6 +439,12 @@ namespace wl {
       }
 #endif
 
+#ifdef SUNSHINE_BUILD_VULKAN
+      if (mem_type == platf::mem_type_e::vulkan) {
+        return vk::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+#endif
+
 #ifdef SUNSHINE_BUILD_CUDA
       if (mem_type == platf::mem_type_e::cuda) {
         return cuda::make_avcodec_gl_encode_device(width, height, 0, 0);
@@ -370,12 +466,12 @@ namespace wl {
 
 namespace platf {
   std::shared_ptr<display_t> wl_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
-    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::cuda) {
+    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::vulkan && hwdevice_type != platf::mem_type_e::cuda) {
       BOOST_LOG(error) << "Could not initialize display with the given hw device type."sv;
       return nullptr;
     }
 
-    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::cuda) {
+    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::vulkan || hwdevice_type == platf::mem_type_e::cuda) {
       auto wlr = std::make_shared<wl::wlr_vram_t>();
       if (wlr->init(hwdevice_type, display_name, config)) {
         return nullptr;
@@ -410,8 +506,8 @@ namespace platf {
       return {};
     }
 
-    if (!interface[wl::interface_t::WLR_EXPORT_DMABUF]) {
-      BOOST_LOG(warning) << "Missing Wayland wire for wlr-export-dmabuf"sv;
+    if (!interface[wl::interface_t::WLR_EXPORT_DMABUF] && !interface.has_ext_capture()) {
+      BOOST_LOG(warning) << "Missing Wayland wire for wlr-screencopy or ext-image-copy-capture"sv;
       return {};
     }
 
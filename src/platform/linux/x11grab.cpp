@@ -3,17 +3,21 @@
  * @brief Definitions for x11 capture.
  */
 // standard includes
+#include <array>
 #include <fstream>
+#include <limits>
 #include <thread>
 
 // plaform includes
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <unistd.h>
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrandr.h>
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <xcb/dri3.h>
 #include <xcb/shm.h>
 #include <xcb/xfixes.h>
 
@@ -23,11 +27,13 @@
 #include "misc.h"
 #include "src/config.h"
 #include "src/globals.h"
+#include "src/image_memory.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/task_pool.h"
 #include "src/video.h"
 #include "vaapi.h"
+#include "vulkan.h"
 #include "x11grab.h"
 
 using namespace std::literals;
@@ -49,6 +55,9 @@ namespace platf {
     _FN(CloseDisplay, int, (Display * display));
     _FN(Free, int, (void *data));
     _FN(InitThreads, Status, (void) );
+    _FN(Pending, int, (Display * display));
+    _FN(NextEvent, int, (Display * display, XEvent *event_return));
+    _FN(QueryPointer, Bool, (Display * display, Window w, Window *root_return, Window *child_return, int *root_x_return, int *root_y_return, int *win_x_return, int *win_y_return, unsigned int *mask_return));
 
     namespace rr {
       _FN(GetScreenResources, XRRScreenResources *, (Display * dpy, Window window));
@@ -94,6 +103,11 @@ namespace platf {
 
     namespace fix {
       _FN(GetCursorImage, XFixesCursorImage *, (Display * dpy));
+      _FN(CreateRegion, XserverRegion, (Display * dpy, XRectangle *rectangles, int nrectangles));
+      _FN(DestroyRegion, void, (Display * dpy, XserverRegion region));
+      _FN(FetchRegion, XRectangle *, (Display * dpy, XserverRegion region, int *nrectanglesRet));
+      _FN(QueryExtension, Bool, (Display * dpy, int *event_base_return, int *error_base_return));
+      _FN(SelectCursorInput, void, (Display * dpy, Window win, unsigned long eventMask));
 
       static int init() {
         static void *handle {nullptr};
@@ -112,6 +126,11 @@ namespace platf {
 
         std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
           {(dyn::apiproc *) &GetCursorImage, "XFixesGetCursorImage"},
+          {(dyn::apiproc *) &CreateRegion, "XFixesCreateRegion"},
+          {(dyn::apiproc *) &DestroyRegion, "XFixesDestroyRegion"},
+          {(dyn::apiproc *) &FetchRegion, "XFixesFetchRegion"},
+          {(dyn::apiproc *) &QueryExtension, "XFixesQueryExtension"},
+          {(dyn::apiproc *) &SelectCursorInput, "XFixesSelectCursorInput"},
         };
 
         if (dyn::load(handle, funcs)) {
@@ -123,6 +142,47 @@ namespace platf {
       }
     }  // namespace fix
 
+    namespace damage {
+      // The extension is optional, so don't depend on its headers
+      using Damage = XID;
+      constexpr int ReportNonEmpty = 3;
+
+      _FN(QueryExtension, Bool, (Display * dpy, int *event_base_return, int *error_base_return));
+      _FN(Create, Damage, (Display * dpy, Drawable drawable, int level));
+      _FN(Destroy, void, (Display * dpy, Damage damage));
+      _FN(Subtract, void, (Display * dpy, Damage damage, XserverRegion repair, XserverRegion parts));
+
+      static int init() {
+        static void *handle {nullptr};
+        static bool funcs_loaded = false;
+
+        if (funcs_loaded) {
+          return 0;
+        }
+
+        if (!handle) {
+          handle = dyn::handle({"libXdamage.so.1", "libXdamage.so"});
+          if (!handle) {
+            return -1;
+          }
+        }
+
+        std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+          {(dyn::apiproc *) &QueryExtension, "XDamageQueryExtension"},
+          {(dyn::apiproc *) &Create, "XDamageCreate"},
+          {(dyn::apiproc *) &Destroy, "XDamageDestroy"},
+          {(dyn::apiproc *) &Subtract, "XDamageSubtract"},
+        };
+
+        if (dyn::load(handle, funcs)) {
+          return -1;
+        }
+
+        funcs_loaded = true;
+        return 0;
+      }
+    }  // namespace damage
+
     static int init() {
       static void *handle {nullptr};
       static bool funcs_loaded = false;
@@ -145,6 +205,9 @@ namespace platf {
         {(dyn::apiproc *) &Free, "XFree"},
         {(dyn::apiproc *) &CloseDisplay, "XCloseDisplay"},
         {(dyn::apiproc *) &InitThreads, "XInitThreads"},
+        {(dyn::apiproc *) &Pending, "XPending"},
+        {(dyn::apiproc *) &NextEvent, "XNextEvent"},
+        {(dyn::apiproc *) &QueryPointer, "XQueryPointer"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -173,6 +236,63 @@ namespace platf {
     _FN(connect, xcb_connection_t *, (const char *displayname, int *screenp));
     _FN(setup_roots_iterator, xcb_screen_iterator_t, (const xcb_setup_t *R));
     _FN(generate_id, std::uint32_t, (xcb_connection_t * c));
+    _FN(create_pixmap, xcb_void_cookie_t, (xcb_connection_t * c, uint8_t depth, xcb_pixmap_t pid, xcb_drawable_t drawable, uint16_t width, uint16_t height));
+    _FN(free_pixmap, xcb_void_cookie_t, (xcb_connection_t * c, xcb_pixmap_t pixmap));
+    _FN(create_gc, xcb_void_cookie_t, (xcb_connection_t * c, xcb_gcontext_t cid, xcb_drawable_t drawable, uint32_t value_mask, const void *value_list));
+    _FN(free_gc, xcb_void_cookie_t, (xcb_connection_t * c, xcb_gcontext_t gc));
+    _FN(copy_area, xcb_void_cookie_t, (xcb_connection_t * c, xcb_drawable_t src_drawable, xcb_drawable_t dst_drawable, xcb_gcontext_t gc, int16_t src_x, int16_t src_y, int16_t dst_x, int16_t dst_y, uint16_t width, uint16_t height));
+    _FN(get_input_focus, xcb_get_input_focus_cookie_t, (xcb_connection_t * c));
+    _FN(get_input_focus_reply, xcb_get_input_focus_reply_t *, (xcb_connection_t * c, xcb_get_input_focus_cookie_t cookie, xcb_generic_error_t **e));
+
+    static xcb_extension_t *dri3_id;
+
+    _FN(dri3_query_version, xcb_dri3_query_version_cookie_t, (xcb_connection_t * c, uint32_t major_version, uint32_t minor_version));
+    _FN(dri3_query_version_reply, xcb_dri3_query_version_reply_t *, (xcb_connection_t * c, xcb_dri3_query_version_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(dri3_buffer_from_pixmap, xcb_dri3_buffer_from_pixmap_cookie_t, (xcb_connection_t * c, xcb_pixmap_t pixmap));
+    _FN(dri3_buffer_from_pixmap_reply, xcb_dri3_buffer_from_pixmap_reply_t *, (xcb_connection_t * c, xcb_dri3_buffer_from_pixmap_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(dri3_buffer_from_pixmap_reply_fds, int *, (xcb_connection_t * c, xcb_dri3_buffer_from_pixmap_reply_t *reply));
+    _FN(dri3_buffers_from_pixmap, xcb_dri3_buffers_from_pixmap_cookie_t, (xcb_connection_t * c, xcb_pixmap_t pixmap));
+    _FN(dri3_buffers_from_pixmap_reply, xcb_dri3_buffers_from_pixmap_reply_t *, (xcb_connection_t * c, xcb_dri3_buffers_from_pixmap_cookie_t cookie, xcb_generic_error_t **e));
+    _FN(dri3_buffers_from_pixmap_strides, uint32_t *, (const xcb_dri3_buffers_from_pixmap_reply_t *R));
+    _FN(dri3_buffers_from_pixmap_offsets, uint32_t *, (const xcb_dri3_buffers_from_pixmap_reply_t *R));
+    _FN(dri3_buffers_from_pixmap_reply_fds, int *, (xcb_connection_t * c, xcb_dri3_buffers_from_pixmap_reply_t *reply));
+
+    int init_dri3() {
+      static void *handle {nullptr};
+      static bool funcs_loaded = false;
+
+      if (funcs_loaded) {
+        return 0;
+      }
+
+      if (!handle) {
+        handle = dyn::handle({"libxcb-dri3.so.0", "libxcb-dri3.so"});
+        if (!handle) {
+          return -1;
+        }
+      }
+
+      std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+        {(dyn::apiproc *) &dri3_id, "xcb_dri3_id"},
+        {(dyn::apiproc *) &dri3_query_version, "xcb_dri3_query_version"},
+        {(dyn::apiproc *) &dri3_query_version_reply, "xcb_dri3_query_version_reply"},
+        {(dyn::apiproc *) &dri3_buffer_from_pixmap, "xcb_dri3_buffer_from_pixmap"},
+        {(dyn::apiproc *) &dri3_buffer_from_pixmap_reply, "xcb_dri3_buffer_from_pixmap_reply"},
+        {(dyn::apiproc *) &dri3_buffer_from_pixmap_reply_fds, "xcb_dri3_buffer_from_pixmap_reply_fds"},
+        {(dyn::apiproc *) &dri3_buffers_from_pixmap, "xcb_dri3_buffers_from_pixmap"},
+        {(dyn::apiproc *) &dri3_buffers_from_pixmap_reply, "xcb_dri3_buffers_from_pixmap_reply"},
+        {(dyn::apiproc *) &dri3_buffers_from_pixmap_strides, "xcb_dri3_buffers_from_pixmap_strides"},
+        {(dyn::apiproc *) &dri3_buffers_from_pixmap_offsets, "xcb_dri3_buffers_from_pixmap_offsets"},
+        {(dyn::apiproc *) &dri3_buffers_from_pixmap_reply_fds, "xcb_dri3_buffers_from_pixmap_reply_fds"},
+      };
+
+      if (dyn::load(handle, funcs)) {
+        return -1;
+      }
+
+      funcs_loaded = true;
+      return 0;
+    }
 
     int init_shm() {
       static void *handle {nullptr};
@@ -227,6 +347,13 @@ namespace platf {
         {(dyn::apiproc *) &connect, "xcb_connect"},
         {(dyn::apiproc *) &setup_roots_iterator, "xcb_setup_roots_iterator"},
         {(dyn::apiproc *) &generate_id, "xcb_generate_id"},
+        {(dyn::apiproc *) &create_pixmap, "xcb_create_pixmap"},
+        {(dyn::apiproc *) &free_pixmap, "xcb_free_pixmap"},
+        {(dyn::apiproc *) &create_gc, "xcb_create_gc"},
+        {(dyn::apiproc *) &free_gc, "xcb_free_gc"},
+        {(dyn::apiproc *) &copy_area, "xcb_copy_area"},
+        {(dyn::apiproc *) &get_input_focus, "xcb_get_input_focus"},
+        {(dyn::apiproc *) &get_input_focus_reply, "xcb_get_input_focus_reply"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -308,59 +435,290 @@ namespace platf {
 
   struct shm_img_t: public img_t {
     ~shm_img_t() override {
-      delete[] data;
+      util::free_image(data);
       data = nullptr;
     }
   };
 
-  static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
+  /**
+   * @brief Where a cursor was blended into an image.
+   */
+  struct drawn_cursor_t {
+    damage_rect_t rect;
+    unsigned long serial;
+
+    bool operator==(const drawn_cursor_t &) const = default;
+  };
+
+  /**
+   * @brief Blend premultiplied ARGB cursor pixels into an image.
+   * @param img The image to draw into.
+   * @param cursor The pixels of the cursor.
+   * @param cursor_width The width of the cursor.
+   * @param cursor_height The height of the cursor.
+   * @param x The left edge of the cursor in the image, whatever lies outside of the image is clipped.
+   * @param y The top edge of the cursor in the image.
+   * @return Where the cursor was blended.
+   */
+  static damage_rect_t blend_pixels(img_t &img, const std::uint32_t *cursor, int cursor_width, int cursor_height, int x, int y) {
+    auto left = std::max(x, 0);
+    auto top = std::max(y, 0);
+    auto right = std::min(x + cursor_width, img.width);
+    auto bottom = std::min(y + cursor_height, img.height);
+
+    if (left >= right || top >= bottom) {
+      return {};
+    }
+
+    for (auto row = top; row < bottom; ++row) {
+      auto src = &cursor[(row - y) * cursor_width + (left - x)];
+      auto dst = (std::uint32_t *) (img.data + row * img.row_pitch) + left;
+
+      for (auto col = 0; col < right - left; ++col) {
+        auto pixel = src[col];
+        auto alpha = pixel >> 24u;
+
+        if (alpha == 255) {
+          dst[col] = pixel;
+        } else if (pixel) {
+          auto colors_in = (std::uint8_t *) &dst[col];
+          auto colors_out = (std::uint8_t *) &pixel;
+          colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
+          colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
+          colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
+        }
+      }
+    }
+
+    return {left, top, right - left, bottom - top};
+  }
+
+  static std::optional<drawn_cursor_t> blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
     xcursor_t overlay {x11::fix::GetCursorImage(display)};
 
     if (!overlay) {
       BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
-      return;
+      return std::nullopt;
     }
 
-    overlay->x -= overlay->xhot;
-    overlay->y -= overlay->yhot;
+    // XFixes hands out the pixels as longs
+    std::vector<std::uint32_t> pixels(overlay->pixels, overlay->pixels + overlay->width * overlay->height);
 
-    overlay->x -= offsetX;
-    overlay->y -= offsetY;
+    auto rect = blend_pixels(img, pixels.data(), overlay->width, overlay->height, overlay->x - overlay->xhot - offsetX, overlay->y - overlay->yhot - offsetY);
+    return drawn_cursor_t {rect, overlay->cursor_serial};
+  }
 
-    overlay->x = std::max((short) 0, overlay->x);
-    overlay->y = std::max((short) 0, overlay->y);
+  /**
+   * @brief The cursor of the X server, fetched again only when its image changes.
+   * @details XFixes reports changes of the cursor image as events, so most frames only need to query
+   *          where the pointer is instead of transferring the whole cursor image.
+   */
+  class cursor_cache_t {
+  public:
+    /**
+     * @brief Start listening for cursor changes, without it the image is fetched for every frame.
+     */
+    void init() {
+      int error_base;
+
+      // The events are drained on the capture thread, so they get their own connection
+      xdisplay.reset(x11::OpenDisplay(nullptr));
+      if (!xdisplay || !x11::fix::QueryExtension(xdisplay.get(), &event_base, &error_base)) {
+        event_base = -1;
+        return;
+      }
 
-    auto pixels = (int *) img.data;
+      x11::fix::SelectCursorInput(xdisplay.get(), DefaultRootWindow(xdisplay.get()), XFixesDisplayCursorNotifyMask);
+    }
 
-    auto screen_height = img.height;
-    auto screen_width = img.width;
+    /**
+     * @brief Blend the cursor into an image.
+     * @param display The connection to fetch the cursor with when nobody is listening for changes.
+     * @param img The image to draw into.
+     * @param offset_x The left edge of the image on the X screen.
+     * @param offset_y The top edge of the image on the X screen.
+     * @return Where the cursor was blended, or std::nullopt if it couldn't be drawn.
+     */
+    std::optional<drawn_cursor_t> blend(Display *display, img_t &img, int offset_x, int offset_y) {
+      if (event_base < 0) {
+        return blend_cursor(display, img, offset_x, offset_y);
+      }
 
-    auto delta_height = std::min<uint16_t>(overlay->height, std::max(0, screen_height - overlay->y));
-    auto delta_width = std::min<uint16_t>(overlay->width, std::max(0, screen_width - overlay->x));
-    for (auto y = 0; y < delta_height; ++y) {
-      auto overlay_begin = &overlay->pixels[y * overlay->width];
-      auto overlay_end = &overlay->pixels[y * overlay->width + delta_width];
+      while (x11::Pending(xdisplay.get())) {
+        XEvent event;
+        x11::NextEvent(xdisplay.get(), &event);
 
-      auto pixels_begin = &pixels[(y + overlay->y) * (img.row_pitch / img.pixel_pitch) + overlay->x];
+        if (event.type == event_base + XFixesCursorNotify) {
+          changed = true;
+        }
+      }
 
-      std::for_each(overlay_begin, overlay_end, [&](long pixel) {
-        int *pixel_p = (int *) &pixel;
+      if (changed) {
+        xcursor_t overlay {x11::fix::GetCursorImage(xdisplay.get())};
+        if (!overlay) {
+          BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+          return std::nullopt;
+        }
 
-        auto colors_in = (uint8_t *) pixels_begin;
+        pixels.assign(overlay->pixels, overlay->pixels + overlay->width * overlay->height);
+        width = overlay->width;
+        height = overlay->height;
+        xhot = overlay->xhot;
+        yhot = overlay->yhot;
+        serial = overlay->cursor_serial;
+        x = overlay->x;
+        y = overlay->y;
 
-        auto alpha = (*(uint *) pixel_p) >> 24u;
-        if (alpha == 255) {
-          *pixels_begin = *pixel_p;
-        } else {
-          auto colors_out = (uint8_t *) pixel_p;
-          colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
-          colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
-          colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
+        changed = false;
+      } else {
+        Window root;
+        Window child;
+        int win_x;
+        int win_y;
+        unsigned int mask;
+
+        if (!x11::QueryPointer(xdisplay.get(), DefaultRootWindow(xdisplay.get()), &root, &child, &x, &y, &win_x, &win_y, &mask)) {
+          // The pointer is on another screen
+          return std::nullopt;
         }
-        ++pixels_begin;
-      });
+      }
+
+      auto rect = blend_pixels(img, pixels.data(), width, height, x - xhot - offset_x, y - yhot - offset_y);
+      return drawn_cursor_t {rect, serial};
     }
-  }
+
+  private:
+    x11::xdisplay_t xdisplay;
+    int event_base = -1;
+    bool changed = true;
+
+    std::vector<std::uint32_t> pixels;
+    int width = 0;
+    int height = 0;
+    int xhot = 0;
+    int yhot = 0;
+    unsigned long serial = 0;
+
+    // Position of the pointer on the X screen
+    int x = 0;
+    int y = 0;
+  };
+
+  /**
+   * @brief Collects the parts of the root window that changed between snapshots with XDamage.
+   * @details The damage is taken before the image is grabbed, so anything that changes while grabbing
+   *          is reported again with the next snapshot. The cursor isn't part of the window contents,
+   *          so where it was blended is tracked separately.
+   */
+  class damage_tracker_t {
+  public:
+    damage_tracker_t() = default;
+    damage_tracker_t(const damage_tracker_t &) = delete;
+    damage_tracker_t &operator=(const damage_tracker_t &) = delete;
+
+    ~damage_tracker_t() {
+      if (region) {
+        x11::fix::DestroyRegion(xdisplay.get(), region);
+      }
+      if (damage) {
+        x11::damage::Destroy(xdisplay.get(), damage);
+      }
+    }
+
+    /**
+     * @brief Start tracking the damage, without it every snapshot is reported as fully changed.
+     */
+    void init() {
+      int event_base;
+      int error_base;
+
+      // The events are drained on the capture thread, so they get their own connection
+      xdisplay.reset(x11::OpenDisplay(nullptr));
+      if (!xdisplay || x11::damage::init() || !x11::damage::QueryExtension(xdisplay.get(), &event_base, &error_base)) {
+        BOOST_LOG(info) << "XDamage is unavailable, static frames will be encoded"sv;
+        return;
+      }
+
+      damage = x11::damage::Create(xdisplay.get(), DefaultRootWindow(xdisplay.get()), x11::damage::ReportNonEmpty);
+      region = x11::fix::CreateRegion(xdisplay.get(), nullptr, 0);
+    }
+
+    /**
+     * @brief Make the next snapshot report the whole image as changed.
+     */
+    void invalidate() {
+      valid = false;
+    }
+
+    /**
+     * @brief Take the damage since the previous call, relative to the captured area.
+     * @return The damaged rectangles, or std::nullopt if the damage isn't known.
+     */
+    std::optional<std::vector<damage_rect_t>> collect(int offset_x, int offset_y, int width, int height) {
+      if (!damage) {
+        return std::nullopt;
+      }
+
+      // Only the damaged region is of interest, the events just need to be drained
+      while (x11::Pending(xdisplay.get())) {
+        XEvent event;
+        x11::NextEvent(xdisplay.get(), &event);
+      }
+
+      x11::damage::Subtract(xdisplay.get(), damage, None, region);
+
+      int count = 0;
+      auto rects = x11::fix::FetchRegion(xdisplay.get(), region, &count);
+
+      std::vector<damage_rect_t> result;
+      for (int x = 0; x < count; ++x) {
+        auto left = std::max<int>(rects[x].x - offset_x, 0);
+        auto top = std::max<int>(rects[x].y - offset_y, 0);
+        auto right = std::min<int>(rects[x].x + rects[x].width - offset_x, width);
+        auto bottom = std::min<int>(rects[x].y + rects[x].height - offset_y, height);
+
+        if (left < right && top < bottom) {
+          result.push_back({left, top, right - left, bottom - top});
+        }
+      }
+
+      if (rects) {
+        x11::Free(rects);
+      }
+
+      if (!valid) {
+        valid = true;
+        return std::nullopt;
+      }
+
+      return result;
+    }
+
+    /**
+     * @brief Add where the cursor was redrawn to the damage of a snapshot.
+     * @param damage The damage of the snapshot.
+     * @param cursor Where the cursor was blended, or std::nullopt if it wasn't.
+     */
+    void add_cursor(std::optional<std::vector<damage_rect_t>> &damage, const std::optional<drawn_cursor_t> &cursor) {
+      if (damage && cursor != last_cursor) {
+        for (auto &drawn : {last_cursor, cursor}) {
+          if (drawn && drawn->rect.width > 0 && drawn->rect.height > 0) {
+            damage->push_back(drawn->rect);
+          }
+        }
+      }
+
+      last_cursor = cursor;
+    }
+
+  private:
+    x11::xdisplay_t xdisplay;
+    x11::damage::Damage damage {};
+    XserverRegion region {};
+    bool valid = false;
+
+    std::optional<drawn_cursor_t> last_cursor;
+  };
 
   struct x11_attr_t: public display_t {
     std::chrono::nanoseconds delay;
@@ -371,6 +729,9 @@ namespace platf {
 
     mem_type_e mem_type;
 
+    damage_tracker_t damage_tracker;
+    cursor_cache_t cursor_cache;
+
     /**
      * Last X (NOT the streamed monitor!) size.
      * This way we can trigger reinitialization if the dimensions changed while streaming
@@ -449,6 +810,9 @@ namespace platf {
       env_width = xattr.width;
       env_height = xattr.height;
 
+      damage_tracker.init();
+      cursor_cache.init();
+
       return 0;
     }
 
@@ -518,6 +882,8 @@ namespace platf {
       }
       auto img = (x11_img_t *) img_out.get();
 
+      img->damage = damage_tracker.collect(offset_x, offset_y, width, height);
+
       XImage *x_img {x11::GetImage(xdisplay.get(), xwindow, offset_x, offset_y, width, height, AllPlanes, ZPixmap)};
       img->frame_timestamp = std::chrono::steady_clock::now();
 
@@ -528,8 +894,13 @@ namespace platf {
       img->pixel_pitch = x_img->bits_per_pixel / 8;
       img->img.reset(x_img);
 
+      std::optional<drawn_cursor_t> drawn_cursor;
       if (cursor) {
-        blend_cursor(xdisplay.get(), *img, offset_x, offset_y);
+        drawn_cursor = cursor_cache.blend(xdisplay.get(), *img, offset_x, offset_y);
+      }
+      damage_tracker.add_cursor(img->damage, drawn_cursor);
+      if (drawn_cursor) {
+        img->cursor = drawn_cursor->rect;
       }
 
       return capture_e::ok;
@@ -546,6 +917,12 @@ namespace platf {
       }
 #endif
 
+#ifdef SUNSHINE_BUILD_VULKAN
+      if (mem_type == mem_type_e::vulkan) {
+        return vk::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
 #ifdef SUNSHINE_BUILD_CUDA
       if (mem_type == mem_type_e::cuda) {
         return cuda::make_avcodec_encode_device(width, height, false);
@@ -566,19 +943,46 @@ namespace platf {
       };
       std::shared_ptr<platf::img_t> img_out;
       snapshot(pull_dummy_img_callback, img_out, 0s, true);
+
+      // The damage was consumed by an image that won't be streamed
+      damage_tracker.invalidate();
       return 0;
     }
   };
 
   struct shm_attr_t: public x11_attr_t {
+    /**
+     * @brief A shared memory segment the X server copies the screen into.
+     */
+    struct segment_t {
+      std::uint32_t seg;
+      shm_id_t shm_id;
+      shm_data_t data;
+    };
+
+    /**
+     * @brief A grab of the screen, which may still be in flight.
+     */
+    struct request_t {
+      std::optional<std::vector<damage_rect_t>> damage;
+      std::chrono::steady_clock::time_point timestamp;
+
+      // Nothing changed since the last grab when no request was sent
+      std::optional<xcb_shm_get_image_cookie_t> cookie;
+      int segment;
+    };
+
     x11::xdisplay_t shm_xdisplay;  // Prevent race condition with x11_attr_t::xdisplay
     xcb_connect_t xcb;
     xcb_screen_t *display;
-    std::uint32_t seg;
 
-    shm_id_t shm_id;
+    // While the screen is copied into one, the last grab is read from the other
+    std::array<segment_t, 2> segments;
+    int last_segment = -1;
 
-    shm_data_t data;
+    // The grab of the next frame, sent early when the X server takes most of a frame to copy the screen
+    std::optional<request_t> pending;
+    std::chrono::steady_clock::duration grab_time {};
 
     task_pool_util::TaskPool::task_id_t refresh_task_id;
 
@@ -649,37 +1053,70 @@ namespace platf {
         BOOST_LOG(warning) << "X dimensions changed in SHM mode, request reinit"sv;
         return capture_e::reinit;
       } else {
-        auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
-        auto frame_timestamp = std::chrono::steady_clock::now();
+        auto request = pending ? std::move(*pending) : grab();
+        pending.reset();
+
+        if (request.cookie) {
+          xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), *request.cookie, nullptr)};
+          if (!img_reply) {
+            BOOST_LOG(error) << "Could not get image reply"sv;
+            return capture_e::reinit;
+          }
 
-        xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), img_cookie, nullptr)};
-        if (!img_reply) {
-          BOOST_LOG(error) << "Could not get image reply"sv;
-          return capture_e::reinit;
+          last_segment = request.segment;
+          grab_time = std::chrono::steady_clock::now() - request.timestamp;
         }
 
         if (!pull_free_image_cb(img_out)) {
           return platf::capture_e::interrupted;
         }
 
-        std::copy_n((std::uint8_t *) data.data, frame_size(), img_out->data);
-        img_out->frame_timestamp = frame_timestamp;
+        std::copy_n((std::uint8_t *) segments[last_segment].data.data, frame_size(), img_out->data);
+        img_out->frame_timestamp = request.timestamp;
+        img_out->damage = std::move(request.damage);
 
+        // The next frame is copied by the X server while this one is encoded, which costs latency otherwise
+        if (grab_time > delay / 2) {
+          pending = grab();
+        }
+
+        std::optional<drawn_cursor_t> drawn_cursor;
         if (cursor) {
-          blend_cursor(shm_xdisplay.get(), *img_out, offset_x, offset_y);
+          drawn_cursor = cursor_cache.blend(shm_xdisplay.get(), *img_out, offset_x, offset_y);
+        }
+        damage_tracker.add_cursor(img_out->damage, drawn_cursor);
+        if (drawn_cursor) {
+          img_out->cursor = drawn_cursor->rect;
         }
 
         return capture_e::ok;
       }
     }
 
+    /**
+     * @brief Send a grab of the screen into the segment that isn't read from, unless nothing changed.
+     */
+    request_t grab() {
+      request_t request;
+      request.damage = damage_tracker.collect(offset_x, offset_y, width, height);
+      request.timestamp = std::chrono::steady_clock::now();
+      request.segment = last_segment < 0 ? 0 : 1 - last_segment;
+
+      // The last grab is still the screen when XDamage saw nothing change
+      if (last_segment < 0 || !request.damage || !request.damage->empty()) {
+        request.cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, segments[request.segment].seg, 0);
+      }
+
+      return request;
+    }
+
     std::shared_ptr<img_t> alloc_img() override {
       auto img = std::make_shared<shm_img_t>();
       img->width = width;
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+      img->data = util::alloc_image(height * img->row_pitch);
 
       return img;
     }
@@ -707,21 +1144,24 @@ namespace platf {
 
       auto iter = xcb::setup_roots_iterator(xcb::get_setup(xcb.get()));
       display = iter.data;
-      seg = xcb::generate_id(xcb.get());
 
-      shm_id.id = shmget(IPC_PRIVATE, frame_size(), IPC_CREAT | 0777);
-      if (shm_id.id == -1) {
-        BOOST_LOG(error) << "shmget failed"sv;
-        return -1;
-      }
+      for (auto &segment : segments) {
+        segment.seg = xcb::generate_id(xcb.get());
+
+        segment.shm_id.id = shmget(IPC_PRIVATE, frame_size(), IPC_CREAT | 0777);
+        if (segment.shm_id.id == -1) {
+          BOOST_LOG(error) << "shmget failed"sv;
+          return -1;
+        }
 
-      xcb::shm_attach(xcb.get(), seg, shm_id.id, false);
-      data.data = shmat(shm_id.id, nullptr, 0);
+        xcb::shm_attach(xcb.get(), segment.seg, segment.shm_id.id, false);
+        segment.data.data = shmat(segment.shm_id.id, nullptr, 0);
 
-      if ((uintptr_t) data.data == -1) {
-        BOOST_LOG(error) << "shmat failed"sv;
+        if ((uintptr_t) segment.data.data == -1) {
+          BOOST_LOG(error) << "shmat failed"sv;
 
-        return -1;
+          return -1;
+        }
       }
 
       return 0;
@@ -732,8 +1172,355 @@ namespace platf {
     }
   };
 
+  namespace {
+    // There aren't that many DRM formats an X server shares its pixmaps in
+    constexpr std::uint32_t fourcc_code(char a, char b, char c, char d) {
+      return (std::uint32_t) a | ((std::uint32_t) b << 8) | ((std::uint32_t) c << 16) | ((std::uint32_t) d << 24);
+    }
+
+    constexpr std::uint32_t drm_format_xrgb8888 = fourcc_code('X', 'R', '2', '4');
+    constexpr std::uint32_t drm_format_xrgb2101010 = fourcc_code('X', 'R', '3', '0');
+    constexpr std::uint64_t drm_format_mod_invalid = (1ULL << 56) - 1;
+  }  // namespace
+
+  /**
+   * @brief Captures into pixmaps the X server shares as dmabufs through DRI3, so frames never leave VRAM.
+   * @details The X server copies the screen into a pixmap on the GPU, which the encoder imports like a KMS
+   *          framebuffer. A few pixmaps are cycled through, so the server never copies into one the encoder
+   *          still reads from. Unlike KMS, this needs neither CAP_SYS_ADMIN nor a compositor, only a DRI3
+   *          X server that renders on the GPU, like the modesetting driver with glamor.
+   */
+  struct vram_attr_t: public x11_attr_t {
+    /**
+     * @brief A pixmap the screen is copied into, and the dmabuf it's shared as.
+     */
+    struct buffer_t {
+      xcb_pixmap_t pixmap {};
+      egl::surface_descriptor_t sd;
+
+      // The image the buffer was last handed out with
+      std::weak_ptr<platf::img_t> reader;
+
+      bool busy() const {
+        return !reader.expired();
+      }
+    };
+
+    xcb_connect_t xcb;
+    xcb_screen_t *screen {};
+    xcb_gcontext_t gc {};
+
+    std::array<buffer_t, 3> buffers;
+    buffer_t *last_buffer {};
+    std::uint64_t sequence {};
+
+    std::optional<x11::cursor_t> cursor_ctx;
+
+    vram_attr_t(mem_type_e mem_type):
+        x11_attr_t(mem_type) {
+      for (auto &buffer : buffers) {
+        std::fill_n(buffer.sd.fds, 4, -1);
+      }
+    }
+
+    ~vram_attr_t() override {
+      for (auto &buffer : buffers) {
+        for (auto &fd : buffer.sd.fds) {
+          if (fd >= 0) {
+            close(fd);
+          }
+        }
+
+        if (xcb && buffer.pixmap) {
+          xcb::free_pixmap(xcb.get(), buffer.pixmap);
+        }
+      }
+
+      if (xcb && gc) {
+        xcb::free_gc(xcb.get(), gc);
+      }
+    }
+
+    capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        auto status = snapshot(pull_free_image_cb, img_out, *cursor);
+        switch (status) {
+          case platf::capture_e::reinit:
+          case platf::capture_e::error:
+          case platf::capture_e::interrupted:
+            return status;
+          case platf::capture_e::timeout:
+            if (!push_captured_image_cb(std::move(img_out), false)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          case platf::capture_e::ok:
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          default:
+            BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+            return status;
+        }
+      }
+
+      return capture_e::ok;
+    }
+
+    capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, bool cursor) {
+      refresh();
+
+      // The pixmaps are the size of the screen they were created for
+      if (xattr.width != env_width || xattr.height != env_height) {
+        BOOST_LOG(warning) << "X dimensions changed in VRAM mode, request reinit"sv;
+        return capture_e::reinit;
+      }
+
+      auto damage = damage_tracker.collect(offset_x, offset_y, width, height);
+
+      // The last copy is still the screen when XDamage saw nothing change
+      auto buffer = last_buffer;
+      if (!buffer || !damage || !damage->empty()) {
+        // The copy that was just handed out may still be read, unless it isn't anymore
+        auto it = std::find_if(std::begin(buffers), std::end(buffers), [&](const buffer_t &candidate) {
+          return &candidate != last_buffer && !candidate.busy();
+        });
+        if (it == std::end(buffers)) {
+          return capture_e::timeout;
+        }
+        buffer = &*it;
+
+        xcb::copy_area(xcb.get(), screen->root, buffer->pixmap, gc, offset_x, offset_y, 0, 0, width, height);
+
+        // The X server flushes the copy to the GPU before it answers, and the implicit fence of the
+        // dmabuf keeps the encoder from reading the pixmap before the copy landed
+        util::c_ptr<xcb_get_input_focus_reply_t> sync {xcb::get_input_focus_reply(xcb.get(), xcb::get_input_focus(xcb.get()), nullptr)};
+        if (!sync) {
+          BOOST_LOG(error) << "Lost the connection to the X server"sv;
+          return capture_e::reinit;
+        }
+
+        last_buffer = buffer;
+        ++sequence;
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+      auto img = (egl::img_descriptor_t *) img_out.get();
+      img->reset();
+
+      img->frame_timestamp = std::chrono::steady_clock::now();
+      img->damage = std::move(damage);
+      img->sequence = sequence;
+      img->recycled = true;
+
+      // The buffer stays in the ring, so the image gets its own file descriptors
+      img->sd = buffer->sd;
+      for (auto &fd : img->sd.fds) {
+        if (fd >= 0) {
+          fd = dup(fd);
+        }
+      }
+
+      // The pixmap isn't copied into again until the encoder is done with the image
+      buffer->reader = img_out;
+
+      // The pixmap starts at the corner of the captured region
+      std::optional<drawn_cursor_t> drawn_cursor;
+      if (cursor && cursor_ctx) {
+        cursor_ctx->capture(*img);
+
+        img->x -= offset_x;
+        img->y -= offset_y;
+        drawn_cursor = drawn_cursor_t {{img->x, img->y, img->width, img->height}, img->serial};
+      } else {
+        img->data = nullptr;
+      }
+      damage_tracker.add_cursor(img->damage, drawn_cursor);
+      if (drawn_cursor) {
+        img->cursor = drawn_cursor->rect;
+      }
+
+      return capture_e::ok;
+    }
+
+    std::shared_ptr<img_t> alloc_img() override {
+      auto img = std::make_shared<egl::img_descriptor_t>();
+
+      img->width = width;
+      img->height = height;
+      img->sequence = 0;
+      img->serial = std::numeric_limits<decltype(img->serial)>::max();
+      img->data = nullptr;
+
+      // File descriptors aren't open
+      std::fill_n(img->sd.fds, 4, -1);
+
+      return img;
+    }
+
+    std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_VULKAN
+      if (mem_type == mem_type_e::vulkan) {
+        return vk::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == mem_type_e::cuda) {
+        return cuda::make_avcodec_gl_encode_device(width, height, 0, 0);
+      }
+#endif
+
+      return std::make_unique<avcodec_encode_device_t>();
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      // Empty images are recognized as dummies by the zero sequence number
+      return 0;
+    }
+
+    /**
+     * @brief Share a pixmap as a dmabuf.
+     * @param buffer The buffer of the pixmap.
+     * @param modifiers Whether the X server shares pixmaps with modifiers and several planes, DRI3 1.2.
+     * @return `true` if the pixmap is shared in a format the encoder imports.
+     */
+    bool export_buffer(buffer_t &buffer, bool modifiers) {
+      auto &sd = buffer.sd;
+
+      int depth;
+      int bpp;
+      if (modifiers) {
+        util::c_ptr<xcb_dri3_buffers_from_pixmap_reply_t> reply {xcb::dri3_buffers_from_pixmap_reply(xcb.get(), xcb::dri3_buffers_from_pixmap(xcb.get(), buffer.pixmap), nullptr)};
+        if (!reply) {
+          return false;
+        }
+
+        auto fds = xcb::dri3_buffers_from_pixmap_reply_fds(xcb.get(), reply.get());
+        auto strides = xcb::dri3_buffers_from_pixmap_strides(reply.get());
+        auto offsets = xcb::dri3_buffers_from_pixmap_offsets(reply.get());
+        for (int x = 0; x < reply->nfd; ++x) {
+          if (x >= 4) {
+            close(fds[x]);
+            continue;
+          }
+
+          sd.fds[x] = fds[x];
+          sd.pitches[x] = strides[x];
+          sd.offsets[x] = offsets[x];
+        }
+
+        sd.width = reply->width;
+        sd.height = reply->height;
+        sd.modifier = reply->modifier;
+        depth = reply->depth;
+        bpp = reply->bpp;
+      } else {
+        util::c_ptr<xcb_dri3_buffer_from_pixmap_reply_t> reply {xcb::dri3_buffer_from_pixmap_reply(xcb.get(), xcb::dri3_buffer_from_pixmap(xcb.get(), buffer.pixmap), nullptr)};
+        if (!reply) {
+          return false;
+        }
+
+        sd.fds[0] = xcb::dri3_buffer_from_pixmap_reply_fds(xcb.get(), reply.get())[0];
+        sd.pitches[0] = reply->stride;
+        sd.offsets[0] = 0;
+
+        sd.width = reply->width;
+        sd.height = reply->height;
+        sd.modifier = drm_format_mod_invalid;
+        depth = reply->depth;
+        bpp = reply->bpp;
+      }
+
+      if (bpp != 32 || (depth != 24 && depth != 30)) {
+        BOOST_LOG(warning) << "X server shares pixmaps of depth "sv << depth << " at "sv << bpp << " bits per pixel, which can't be encoded from VRAM"sv;
+        return false;
+      }
+      sd.fourcc = depth == 30 ? drm_format_xrgb2101010 : drm_format_xrgb8888;
+
+      return sd.fds[0] >= 0;
+    }
+
+    int init(const std::string &display_name, const ::video::config_t &config) {
+      if (x11_attr_t::init(display_name, config)) {
+        return 1;
+      }
+
+      if (xcb::init_dri3()) {
+        BOOST_LOG(info) << "Couldn't load libxcb-dri3, capturing X11 through system memory"sv;
+        return -1;
+      }
+
+      xcb.reset(xcb::connect(nullptr, nullptr));
+      if (xcb::connection_has_error(xcb.get())) {
+        return -1;
+      }
+
+      auto dri3 = xcb::get_extension_data(xcb.get(), xcb::dri3_id);
+      if (!dri3 || !dri3->present) {
+        BOOST_LOG(info) << "X server doesn't support DRI3, capturing X11 through system memory"sv;
+        return -1;
+      }
+
+      util::c_ptr<xcb_dri3_query_version_reply_t> version {xcb::dri3_query_version_reply(xcb.get(), xcb::dri3_query_version(xcb.get(), 1, 2), nullptr)};
+      if (!version) {
+        return -1;
+      }
+      auto modifiers = version->major_version > 1 || version->minor_version >= 2;
+
+      screen = xcb::setup_roots_iterator(xcb::get_setup(xcb.get())).data;
+
+      // The windows on top of the root window are part of what's on the screen
+      std::uint32_t gc_values[] {XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS, 0};
+      gc = xcb::generate_id(xcb.get());
+      xcb::create_gc(xcb.get(), gc, screen->root, XCB_GC_SUBWINDOW_MODE | XCB_GC_GRAPHICS_EXPOSURES, gc_values);
+
+      for (auto &buffer : buffers) {
+        buffer.pixmap = xcb::generate_id(xcb.get());
+        xcb::create_pixmap(xcb.get(), screen->root_depth, buffer.pixmap, screen->root, width, height);
+
+        if (!export_buffer(buffer, modifiers)) {
+          BOOST_LOG(info) << "X server doesn't share its pixmaps as dmabufs, capturing X11 through system memory"sv;
+          return -1;
+        }
+      }
+
+      cursor_ctx = x11::cursor_t::make();
+
+      BOOST_LOG(info) << "Capturing X11 in VRAM through DRI3"sv;
+      return 0;
+    }
+  };
+
   std::shared_ptr<display_t> x11_display(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
-    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::cuda) {
+    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::vulkan && hwdevice_type != platf::mem_type_e::cuda) {
       BOOST_LOG(error) << "Could not initialize x11 display with the given hw device type"sv;
       return nullptr;
     }
@@ -744,6 +1531,21 @@ namespace platf {
       return nullptr;
     }
 
+    // Keep the frames on the GPU the encoder runs on
+    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::vulkan || hwdevice_type == platf::mem_type_e::cuda) {
+      auto vram_disp = std::make_shared<vram_attr_t>(hwdevice_type);
+
+      auto status = vram_disp->init(display_name, config);
+      if (status > 0) {
+        // x11_attr_t::init() failed, don't bother trying again.
+        return nullptr;
+      }
+
+      if (status == 0) {
+        return vram_disp;
+      }
+    }
+
     // Attempt to use shared memory X11 to avoid copying the frame
     auto shm_disp = std::make_shared<shm_attr_t>(hwdevice_type);
 
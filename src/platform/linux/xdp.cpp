@@ -0,0 +1,610 @@
+/**
+ * @file src/platform/linux/xdp.cpp
+ * @brief Definitions for sending video through AF_XDP sockets, bypassing the network stack of the kernel.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+// platform includes
+#include <arpa/inet.h>
+#include <linux/if_xdp.h>
+#include <linux/neighbour.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// local includes
+#include "src/logging.h"
+#include "src/utility.h"
+#include "xdp.h"
+
+#ifndef SOL_XDP
+  #define SOL_XDP 283
+#endif
+
+using namespace std::literals;
+
+namespace xdp {
+  namespace {
+    constexpr std::size_t ethernet_header_size = 14;
+    constexpr std::size_t ipv4_header_size = 20;
+    constexpr std::size_t ipv6_header_size = 40;
+    constexpr std::size_t udp_header_size = 8;
+
+    // Each packet is written into a frame of the memory shared with the driver
+    constexpr std::uint32_t frame_size = 2048;
+    constexpr std::uint32_t frame_count = 4096;
+
+    constexpr std::uint32_t tx_ring_size = 2048;
+    constexpr std::uint32_t completion_ring_size = frame_count;
+
+    // Nothing is received, but the kernel won't bind a socket without a fill ring
+    constexpr std::uint32_t fill_ring_size = 64;
+
+    // How long the next hop to a destination is trusted before it's resolved again
+    constexpr auto route_lifetime = 5s;
+
+    // How long a batch waits for the frames of earlier packets before it's sent through the regular socket
+    constexpr auto frame_timeout = 10ms;
+
+    void write_u16(std::uint8_t *dest, std::uint16_t value) {
+      dest[0] = value >> 8;
+      dest[1] = value & 0xFF;
+    }
+
+    void write_u32(std::uint8_t *dest, std::uint32_t value) {
+      write_u16(dest, value >> 16);
+      write_u16(dest + 2, value & 0xFFFF);
+    }
+
+    /**
+     * @brief Add big-endian 16-bit words to a checksum that hasn't been folded yet.
+     */
+    std::uint32_t checksum_add(std::uint32_t sum, const std::uint8_t *data, std::size_t size) {
+      for (std::size_t x = 0; x + 1 < size; x += 2) {
+        sum += (data[x] << 8) | data[x + 1];
+      }
+
+      if (size % 2) {
+        sum += data[size - 1] << 8;
+      }
+
+      return sum;
+    }
+
+    std::uint16_t checksum_fold(std::uint32_t sum) {
+      while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+      }
+
+      return ~sum & 0xFFFF;
+    }
+
+    boost::asio::ip::address unmapped(const boost::asio::ip::address &address) {
+      if (address.is_v6() && address.to_v6().is_v4_mapped()) {
+        return boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6());
+      }
+
+      return address;
+    }
+
+    /**
+     * @brief Send a request to the routing netlink socket and read every message of the reply.
+     * @param request The request, starting with its nlmsghdr.
+     * @param callback Called with each message of the reply.
+     * @return `true` if the whole reply was read.
+     */
+    template<class F>
+    bool netlink_request(nlmsghdr *request, F &&callback) {
+      int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+      if (fd < 0) {
+        return false;
+      }
+      auto fg = util::fail_guard([fd]() {
+        close(fd);
+      });
+
+      if (::send(fd, request, request->nlmsg_len, 0) < 0) {
+        return false;
+      }
+
+      std::vector<char> buf(32 * 1024);
+      while (true) {
+        auto len = recv(fd, buf.data(), buf.size(), 0);
+        if (len <= 0) {
+          return false;
+        }
+
+        for (auto msg = (nlmsghdr *) buf.data(); NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+          if (msg->nlmsg_type == NLMSG_DONE) {
+            return true;
+          }
+
+          if (msg->nlmsg_type == NLMSG_ERROR) {
+            return ((nlmsgerr *) NLMSG_DATA(msg))->error == 0;
+          }
+
+          callback(msg);
+
+          // A request that isn't a dump is answered with a single message
+          if (!(msg->nlmsg_flags & NLM_F_MULTI)) {
+            return true;
+          }
+        }
+      }
+    }
+
+    /**
+     * @brief Append an attribute to a netlink request.
+     */
+    void add_attribute(nlmsghdr *request, std::size_t capacity, int type, const void *data, std::size_t size) {
+      auto attr = (rtattr *) ((char *) request + NLMSG_ALIGN(request->nlmsg_len));
+      if (NLMSG_ALIGN(request->nlmsg_len) + RTA_LENGTH(size) > capacity) {
+        return;
+      }
+
+      attr->rta_type = type;
+      attr->rta_len = RTA_LENGTH(size);
+      std::memcpy(RTA_DATA(attr), data, size);
+
+      request->nlmsg_len = NLMSG_ALIGN(request->nlmsg_len) + RTA_ALIGN(attr->rta_len);
+    }
+
+    std::vector<std::uint8_t> address_bytes(const boost::asio::ip::address &address) {
+      if (address.is_v6()) {
+        auto bytes = address.to_v6().to_bytes();
+        return {std::begin(bytes), std::end(bytes)};
+      }
+
+      auto bytes = address.to_v4().to_bytes();
+      return {std::begin(bytes), std::end(bytes)};
+    }
+
+    template<class T>
+    std::atomic_ref<T> atomic(T *value) {
+      return std::atomic_ref<T> {*value};
+    }
+  }  // namespace
+
+  std::size_t header_size(bool v6) {
+    return ethernet_header_size + (v6 ? ipv6_header_size : ipv4_header_size) + udp_header_size;
+  }
+
+  void write_headers(std::uint8_t *frame, const route_t &route, std::size_t payload_size) {
+    auto v6 = route.target_address.is_v6();
+
+    std::memcpy(frame, route.target_mac.data(), 6);
+    std::memcpy(frame + 6, route.source_mac.data(), 6);
+    write_u16(frame + 12, v6 ? 0x86DD : 0x0800);
+
+    auto ip = frame + ethernet_header_size;
+    auto udp = ip + (v6 ? ipv6_header_size : ipv4_header_size);
+    auto udp_size = udp_header_size + payload_size;
+
+    write_u16(udp, route.source_port);
+    write_u16(udp + 2, route.target_port);
+    write_u16(udp + 4, udp_size);
+    write_u16(udp + 6, 0);
+
+    if (v6) {
+      auto source = route.source_address.to_v6().to_bytes();
+      auto target = route.target_address.to_v6().to_bytes();
+
+      write_u32(ip, (6u << 28) | ((std::uint32_t) route.traffic_class << 20));
+      write_u16(ip + 4, udp_size);
+      ip[6] = IPPROTO_UDP;
+      ip[7] = 64;
+      std::memcpy(ip + 8, source.data(), source.size());
+      std::memcpy(ip + 24, target.data(), target.size());
+
+      // The checksum is mandatory for UDP over IPv6, and covers a pseudo-header of the addresses
+      std::uint8_t pseudo_header[8] {};
+      write_u32(pseudo_header, udp_size);
+      pseudo_header[7] = IPPROTO_UDP;
+
+      auto sum = checksum_add(0, ip + 8, 32);
+      sum = checksum_add(sum, pseudo_header, sizeof(pseudo_header));
+      sum = checksum_add(sum, udp, udp_size);
+
+      auto checksum = checksum_fold(sum);
+      write_u16(udp + 6, checksum ? checksum : 0xFFFF);
+    } else {
+      auto source = route.source_address.to_v4().to_bytes();
+      auto target = route.target_address.to_v4().to_bytes();
+
+      ip[0] = 0x45;
+      ip[1] = route.traffic_class;
+      write_u16(ip + 2, ipv4_header_size + udp_size);
+      write_u16(ip + 4, 0);
+
+      // Don't fragment
+      write_u16(ip + 6, 0x4000);
+      ip[8] = 64;
+      ip[9] = IPPROTO_UDP;
+      write_u16(ip + 10, 0);
+      std::memcpy(ip + 12, source.data(), source.size());
+      std::memcpy(ip + 16, target.data(), target.size());
+
+      write_u16(ip + 10, checksum_fold(checksum_add(0, ip, ipv4_header_size)));
+    }
+  }
+
+  std::unique_ptr<socket_t> socket_t::make(const std::string &interface, std::uintptr_t native_socket) {
+    std::unique_ptr<socket_t> xsk {new socket_t};
+
+    xsk->_udp_fd = (int) native_socket;
+
+    sockaddr_storage local {};
+    socklen_t local_len = sizeof(local);
+    if (getsockname(xsk->_udp_fd, (sockaddr *) &local, &local_len) < 0) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't get the port of the video socket: "sv << errno;
+      return nullptr;
+    }
+    xsk->_source_port = ntohs(local.ss_family == AF_INET6 ? ((sockaddr_in6 *) &local)->sin6_port : ((sockaddr_in *) &local)->sin_port);
+
+    xsk->_ifindex = if_nametoindex(interface.c_str());
+    if (!xsk->_ifindex) {
+      BOOST_LOG(warning) << "AF_XDP: no interface named ["sv << interface << ']';
+      return nullptr;
+    }
+
+    xsk->_fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (xsk->_fd < 0) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't create a socket, it requires CAP_NET_RAW and Linux 5.4 or newer: "sv << errno;
+      return nullptr;
+    }
+
+    ifreq ifr {};
+    std::strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+    if (ioctl(xsk->_udp_fd, SIOCGIFHWADDR, &ifr) < 0 || ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+      BOOST_LOG(warning) << "AF_XDP: ["sv << interface << "] isn't an Ethernet interface"sv;
+      return nullptr;
+    }
+    std::memcpy(xsk->_mac.data(), ifr.ifr_hwaddr.sa_data, xsk->_mac.size());
+
+    if (ioctl(xsk->_udp_fd, SIOCGIFMTU, &ifr) < 0) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't get the MTU of ["sv << interface << "]: "sv << errno;
+      return nullptr;
+    }
+    xsk->_mtu = ifr.ifr_mtu;
+
+    xsk->_umem_size = (std::size_t) frame_size * frame_count;
+    auto umem = mmap(nullptr, xsk->_umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't allocate the frames: "sv << errno;
+      return nullptr;
+    }
+    xsk->_umem = (std::uint8_t *) umem;
+
+    xdp_umem_reg umem_reg {};
+    umem_reg.addr = (std::uintptr_t) xsk->_umem;
+    umem_reg.len = xsk->_umem_size;
+    umem_reg.chunk_size = frame_size;
+    umem_reg.headroom = 0;
+    if (setsockopt(xsk->_fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) < 0) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't register the frames, RLIMIT_MEMLOCK may be too low: "sv << errno;
+      return nullptr;
+    }
+
+    if (setsockopt(xsk->_fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_ring_size, sizeof(fill_ring_size)) < 0 ||
+        setsockopt(xsk->_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completion_ring_size, sizeof(completion_ring_size)) < 0 ||
+        setsockopt(xsk->_fd, SOL_XDP, XDP_TX_RING, &tx_ring_size, sizeof(tx_ring_size)) < 0) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't create the rings: "sv << errno;
+      return nullptr;
+    }
+
+    xdp_mmap_offsets offsets {};
+    socklen_t offsets_len = sizeof(offsets);
+    if (getsockopt(xsk->_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_len) < 0) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't get the layout of the rings: "sv << errno;
+      return nullptr;
+    }
+
+    auto map_ring = [&](ring_t &ring, const xdp_ring_offset &offset, std::size_t desc_size, std::uint32_t size, off_t pgoff) {
+      ring.map_size = offset.desc + desc_size * size;
+      ring.map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xsk->_fd, pgoff);
+      if (ring.map == MAP_FAILED) {
+        ring.map = nullptr;
+        return false;
+      }
+
+      auto base = (std::uint8_t *) ring.map;
+      ring.producer = (std::uint32_t *) (base + offset.producer);
+      ring.consumer = (std::uint32_t *) (base + offset.consumer);
+      ring.flags = (std::uint32_t *) (base + offset.flags);
+      ring.descs = base + offset.desc;
+
+      return true;
+    };
+
+    if (!map_ring(xsk->_tx, offsets.tx, sizeof(xdp_desc), tx_ring_size, XDP_PGOFF_TX_RING) ||
+        !map_ring(xsk->_completion, offsets.cr, sizeof(std::uint64_t), completion_ring_size, XDP_UMEM_PGOFF_COMPLETION_RING)) {
+      BOOST_LOG(warning) << "AF_XDP: couldn't map the rings: "sv << errno;
+      return nullptr;
+    }
+
+    sockaddr_xdp sxdp {};
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xsk->_ifindex;
+    sxdp.sxdp_queue_id = 0;
+
+    // Prefer the driver sending straight from the frames, copying them is still faster than the UDP stack
+    bool zerocopy = true;
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
+    if (bind(xsk->_fd, (sockaddr *) &sxdp, sizeof(sxdp)) < 0) {
+      zerocopy = false;
+      sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+      if (bind(xsk->_fd, (sockaddr *) &sxdp, sizeof(sxdp)) < 0) {
+        BOOST_LOG(warning) << "AF_XDP: couldn't bind to the first queue of ["sv << interface << "]: "sv << errno;
+        return nullptr;
+      }
+    }
+    xsk->_need_wakeup = true;
+
+    xsk->_free_frames.reserve(frame_count);
+    for (std::uint32_t x = 0; x < frame_count; ++x) {
+      xsk->_free_frames.push_back((std::uint64_t) (frame_count - x - 1) * frame_size);
+    }
+
+    BOOST_LOG(info) << "AF_XDP: sending video through ["sv << interface << "] in "sv << (zerocopy ? "zero-copy"sv : "copy"sv) << " mode"sv;
+
+    return xsk;
+  }
+
+  socket_t::~socket_t() {
+    for (auto ring : {&_tx, &_completion}) {
+      if (ring->map) {
+        munmap(ring->map, ring->map_size);
+      }
+    }
+
+    if (_fd >= 0) {
+      close(_fd);
+    }
+
+    if (_umem) {
+      munmap(_umem, _umem_size);
+    }
+  }
+
+  bool socket_t::send(platf::batched_send_info_t &send_info) {
+    std::lock_guard lg {_lock};
+
+    auto route = this->route(send_info);
+    if (!route) {
+      return false;
+    }
+
+    auto headers = header_size(route->target_address.is_v6());
+    auto payload_size = send_info.header_size + send_info.payload_size;
+    auto ip_size = headers - ethernet_header_size + payload_size;
+    if (headers + payload_size > frame_size || ip_size > (std::size_t) _mtu || send_info.block_count > tx_ring_size) {
+      return false;
+    }
+
+    if (!wait_for_frames(send_info.block_count)) {
+      BOOST_LOG_HOT(verbose) << "AF_XDP: frames are full"sv;
+      return false;
+    }
+
+    auto descs = (xdp_desc *) _tx.descs;
+    auto producer = *_tx.producer;
+
+    for (std::size_t x = 0; x < send_info.block_count; ++x) {
+      auto block = send_info.block_offset + x;
+
+      auto addr = _free_frames.back();
+      _free_frames.pop_back();
+
+      auto frame = _umem + addr;
+      auto payload = frame + headers;
+      if (send_info.headers) {
+        std::memcpy(payload, &send_info.headers[block * send_info.header_size], send_info.header_size);
+      }
+      auto payload_desc = send_info.buffer_for_payload_offset(block * send_info.payload_size);
+      std::memcpy(payload + send_info.header_size, payload_desc.buffer, send_info.payload_size);
+
+      write_headers(frame, *route, payload_size);
+
+      auto &desc = descs[(producer + x) & (tx_ring_size - 1)];
+      desc.addr = addr;
+      desc.len = headers + payload_size;
+      desc.options = 0;
+    }
+
+    atomic(_tx.producer).store(producer + send_info.block_count, std::memory_order_release);
+    kick();
+
+    return true;
+  }
+
+  std::optional<route_t> socket_t::route(const platf::batched_send_info_t &send_info) {
+    auto source_address = unmapped(send_info.source_address);
+    auto target_address = unmapped(send_info.target_address);
+    if (source_address.is_v6() != target_address.is_v6() || source_address.is_unspecified()) {
+      return std::nullopt;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    auto it = _routes.find(target_address);
+    if (it == std::end(_routes) || now - it->second.resolved > route_lifetime) {
+      // The traffic class QoS set on the regular socket applies to these packets too
+      int traffic_class = 0;
+      socklen_t traffic_class_len = sizeof(traffic_class);
+      if (target_address.is_v6()) {
+        getsockopt(_udp_fd, IPPROTO_IPV6, IPV6_TCLASS, &traffic_class, &traffic_class_len);
+      } else {
+        getsockopt(_udp_fd, IPPROTO_IP, IP_TOS, &traffic_class, &traffic_class_len);
+      }
+
+      cached_route_t cached {
+        resolve(target_address),
+        (std::uint8_t) std::max(traffic_class, 0),
+        now,
+      };
+
+      if (!cached.target_mac) {
+        BOOST_LOG(debug) << "AF_XDP: the next hop to ["sv << target_address.to_string() << "] is unknown, sending through the regular socket"sv;
+      }
+
+      it = _routes.insert_or_assign(target_address, cached).first;
+    }
+
+    if (!it->second.target_mac) {
+      return std::nullopt;
+    }
+
+    return route_t {
+      _mac,
+      *it->second.target_mac,
+      source_address,
+      _source_port,
+      target_address,
+      send_info.target_port,
+      it->second.traffic_class,
+    };
+  }
+
+  std::optional<std::array<std::uint8_t, 6>> socket_t::resolve(const boost::asio::ip::address &target_address) {
+    auto family = target_address.is_v6() ? AF_INET6 : AF_INET;
+    auto target = address_bytes(target_address);
+
+    // Find the interface and gateway leading to the destination
+    struct {
+      nlmsghdr header;
+      rtmsg msg;
+      char attributes[64];
+    } route_request {};
+
+    route_request.header.nlmsg_len = NLMSG_LENGTH(sizeof(rtmsg));
+    route_request.header.nlmsg_type = RTM_GETROUTE;
+    route_request.header.nlmsg_flags = NLM_F_REQUEST;
+    route_request.msg.rtm_family = family;
+    route_request.msg.rtm_dst_len = target.size() * 8;
+    add_attribute(&route_request.header, sizeof(route_request), RTA_DST, target.data(), target.size());
+
+    int oif = 0;
+    auto next_hop = target;
+    auto routed = netlink_request(&route_request.header, [&](nlmsghdr *msg) {
+      if (msg->nlmsg_type != RTM_NEWROUTE) {
+        return;
+      }
+
+      auto len = RTM_PAYLOAD(msg);
+      for (auto attr = RTM_RTA(NLMSG_DATA(msg)); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        if (attr->rta_type == RTA_OIF) {
+          oif = *(int *) RTA_DATA(attr);
+        } else if (attr->rta_type == RTA_GATEWAY && RTA_PAYLOAD(attr) == target.size()) {
+          std::memcpy(next_hop.data(), RTA_DATA(attr), target.size());
+        }
+      }
+    });
+
+    if (!routed || oif != _ifindex) {
+      return std::nullopt;
+    }
+
+    // Find the MAC address of the next hop in the neighbour table
+    struct {
+      nlmsghdr header;
+      ndmsg msg;
+    } neigh_request {};
+
+    neigh_request.header.nlmsg_len = NLMSG_LENGTH(sizeof(ndmsg));
+    neigh_request.header.nlmsg_type = RTM_GETNEIGH;
+    neigh_request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    neigh_request.msg.ndm_family = family;
+
+    std::optional<std::array<std::uint8_t, 6>> mac;
+    netlink_request(&neigh_request.header, [&](nlmsghdr *msg) {
+      if (msg->nlmsg_type != RTM_NEWNEIGH || mac) {
+        return;
+      }
+
+      auto ndm = (ndmsg *) NLMSG_DATA(msg);
+      constexpr auto usable = NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | NUD_PERMANENT | NUD_NOARP;
+      if (ndm->ndm_ifindex != _ifindex || !(ndm->ndm_state & usable)) {
+        return;
+      }
+
+      bool matches = false;
+      std::optional<std::array<std::uint8_t, 6>> lladdr;
+
+      int len = msg->nlmsg_len - NLMSG_LENGTH(sizeof(ndmsg));
+      for (auto attr = (rtattr *) ((char *) ndm + NLMSG_ALIGN(sizeof(ndmsg))); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        if (attr->rta_type == NDA_DST && RTA_PAYLOAD(attr) == next_hop.size()) {
+          matches = std::memcmp(RTA_DATA(attr), next_hop.data(), next_hop.size()) == 0;
+        } else if (attr->rta_type == NDA_LLADDR && RTA_PAYLOAD(attr) == 6) {
+          lladdr.emplace();
+          std::memcpy(lladdr->data(), RTA_DATA(attr), 6);
+        }
+      }
+
+      if (matches && lladdr) {
+        mac = lladdr;
+      }
+    });
+
+    return mac;
+  }
+
+  void socket_t::reap() {
+    auto consumer = *_completion.consumer;
+    auto producer = atomic(_completion.producer).load(std::memory_order_acquire);
+    if (consumer == producer) {
+      return;
+    }
+
+    auto addrs = (std::uint64_t *) _completion.descs;
+    for (auto x = consumer; x != producer; ++x) {
+      _free_frames.push_back(addrs[x & (completion_ring_size - 1)]);
+    }
+
+    atomic(_completion.consumer).store(producer, std::memory_order_release);
+  }
+
+  bool socket_t::wait_for_frames(std::size_t count) {
+    auto room = [&]() {
+      auto used = *_tx.producer - atomic(_tx.consumer).load(std::memory_order_acquire);
+      return _free_frames.size() >= count && tx_ring_size - used >= count;
+    };
+
+    reap();
+
+    auto timeout = std::chrono::steady_clock::now() + frame_timeout;
+    while (!room()) {
+      if (std::chrono::steady_clock::now() > timeout) {
+        return false;
+      }
+
+      // In copy mode, the kernel only sends and completes frames when asked to
+      kick();
+      std::this_thread::yield();
+      reap();
+    }
+
+    return true;
+  }
+
+  void socket_t::kick() {
+    if (_need_wakeup && !(atomic(_tx.flags).load(std::memory_order_relaxed) & XDP_RING_NEED_WAKEUP)) {
+      return;
+    }
+
+    if (sendto(_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0) {
+      if (errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN) {
+        BOOST_LOG(warning) << "AF_XDP: couldn't wake up the kernel: "sv << errno;
+      }
+    }
+  }
+}  // namespace xdp
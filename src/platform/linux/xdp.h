@@ -0,0 +1,161 @@
+/**
+ * @file src/platform/linux/xdp.h
+ * @brief Declarations for sending video through AF_XDP sockets, bypassing the network stack of the kernel.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// lib includes
+#include <boost/asio/ip/address.hpp>
+
+// local includes
+#include "src/platform/common.h"
+
+namespace xdp {
+  /**
+   * @brief Where the packets to a destination go, and the headers they get.
+   */
+  struct route_t {
+    std::array<std::uint8_t, 6> source_mac;
+    std::array<std::uint8_t, 6> target_mac;
+
+    boost::asio::ip::address source_address;  ///< IPv4 or IPv6, never a v4-mapped address.
+    std::uint16_t source_port;
+    boost::asio::ip::address target_address;  ///< The same family as the source address.
+    std::uint16_t target_port;
+
+    std::uint8_t traffic_class;  ///< The DSCP and ECN bits.
+  };
+
+  /**
+   * @brief Get the size of the Ethernet, IP and UDP headers in front of the payload of a packet.
+   * @param v6 Whether the packet is IPv6.
+   * @return The size in bytes.
+   */
+  std::size_t header_size(bool v6);
+
+  /**
+   * @brief Write the Ethernet, IP and UDP headers of a packet.
+   * @details The payload must already follow the headers, since the UDP checksum of IPv6 covers it.
+   *          IPv4 packets are sent without a UDP checksum.
+   * @param frame The packet, with `header_size()` bytes of room in front of the payload.
+   * @param route The route of the packet.
+   * @param payload_size The size of the UDP payload.
+   */
+  void write_headers(std::uint8_t *frame, const route_t &route, std::size_t payload_size);
+
+  /**
+   * @brief An AF_XDP socket sending from a queue of a network interface.
+   * @details Packets are written into frames of memory shared with the driver, which sends them
+   *          without a copy where it supports zero-copy mode. Only destinations reached through the
+   *          interface whose neighbour is known can be sent to, anything else goes through the
+   *          regular socket. All methods are thread-safe.
+   */
+  class socket_t {
+  public:
+    /**
+     * @brief Open an AF_XDP socket on an interface.
+     * @param interface The name of the interface, which must be an Ethernet interface.
+     * @param native_socket The UDP socket the packets appear to be sent from, which must be bound.
+     * @return The socket, or `nullptr` if AF_XDP isn't available on the interface.
+     */
+    static std::unique_ptr<socket_t> make(const std::string &interface, std::uintptr_t native_socket);
+
+    ~socket_t();
+
+    /**
+     * @brief Send a batch of packets.
+     * @param send_info The batch.
+     * @return `false` if nothing was sent, and the batch has to be sent through the regular socket.
+     */
+    bool send(platf::batched_send_info_t &send_info);
+
+  private:
+    socket_t() = default;
+
+    /**
+     * @brief The next hop to a destination, as last resolved.
+     */
+    struct cached_route_t {
+      std::optional<std::array<std::uint8_t, 6>> target_mac;  ///< Empty if it isn't reached through the interface.
+      std::uint8_t traffic_class;
+      std::chrono::steady_clock::time_point resolved;
+    };
+
+    /**
+     * @brief Get the route of a batch, resolving its destination again once that's older than a few seconds.
+     * @param send_info The batch.
+     * @return The route, or `std::nullopt` if the destination isn't reached through the interface.
+     */
+    std::optional<route_t> route(const platf::batched_send_info_t &send_info);
+
+    /**
+     * @brief Resolve the next hop to a destination through the routing and neighbour tables.
+     * @param target_address The destination.
+     * @return The MAC address of the next hop, or `std::nullopt` if it isn't reached through the interface or unknown.
+     */
+    std::optional<std::array<std::uint8_t, 6>> resolve(const boost::asio::ip::address &target_address);
+
+    /**
+     * @brief Free the frames of the packets the driver has sent.
+     */
+    void reap();
+
+    /**
+     * @brief Wait until enough frames and room in the transmit ring are free for a batch.
+     * @param count The number of packets in the batch.
+     * @return `true` if they're free.
+     */
+    bool wait_for_frames(std::size_t count);
+
+    /**
+     * @brief Ask the kernel to send the packets in the transmit ring, if it waits for that.
+     */
+    void kick();
+
+    // Held around each send, since the rings have a single producer
+    std::mutex _lock;
+
+    int _fd = -1;
+    int _ifindex = 0;
+    int _mtu = 0;
+    std::array<std::uint8_t, 6> _mac {};
+
+    // The regular UDP socket, whose port and traffic class the packets use
+    int _udp_fd = -1;
+    std::uint16_t _source_port = 0;
+
+    // Whether the kernel only sends the transmit ring when asked to
+    bool _need_wakeup = false;
+
+    std::uint8_t *_umem = nullptr;
+    std::size_t _umem_size = 0;
+    std::vector<std::uint64_t> _free_frames;
+
+    struct ring_t {
+      void *map = nullptr;
+      std::size_t map_size = 0;
+
+      std::uint32_t *producer;
+      std::uint32_t *consumer;
+      std::uint32_t *flags;
+      void *descs;
+    };
+
+    ring_t _tx;
+    ring_t _completion;
+
+    std::map<boost::asio::ip::address, cached_route_t> _routes;
+  };
+}  // namespace xdp
@@ -0,0 +1,334 @@
+/**
+ * @file src/platform/macos/audio_unit.cpp
+ * @brief Definitions for audio capture through a Core Audio AUHAL unit on macOS.
+ */
+// standard includes
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// platform includes
+#include <AudioToolbox/AudioToolbox.h>
+#include <CoreAudio/CoreAudio.h>
+
+// local includes
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/spsc_ring.h"
+
+namespace platf::au {
+  using namespace std::literals;
+
+  // kAudioObjectPropertyElementMain, which is only declared as of macOS 12
+  constexpr AudioObjectPropertyElement element_main = 0;
+
+  // The buses of an AUHAL unit
+  constexpr AudioUnitElement output_bus = 0;
+  constexpr AudioUnitElement input_bus = 1;
+
+  struct frame_t {
+    std::vector<float> samples;
+
+    // When the last of the samples arrived
+    std::chrono::steady_clock::time_point completed;
+  };
+
+  namespace {
+    template<class T>
+    OSStatus get_property(AudioObjectID object, AudioObjectPropertySelector selector, AudioObjectPropertyScope scope, T &value) {
+      AudioObjectPropertyAddress address {selector, scope, element_main};
+      UInt32 size = sizeof(T);
+      return AudioObjectGetPropertyData(object, &address, 0, nullptr, &size, &value);
+    }
+
+    /**
+     * @brief Find the Core Audio device of an AVFoundation device, whose unique ID is the UID of the device.
+     */
+    AudioDeviceID find_device(const std::string &uid) {
+      AudioObjectPropertyAddress address {kAudioHardwarePropertyDevices, kAudioObjectPropertyScopeGlobal, element_main};
+
+      UInt32 size = 0;
+      if (AudioObjectGetPropertyDataSize(kAudioObjectSystemObject, &address, 0, nullptr, &size)) {
+        return kAudioObjectUnknown;
+      }
+
+      std::vector<AudioDeviceID> devices(size / sizeof(AudioDeviceID));
+      if (AudioObjectGetPropertyData(kAudioObjectSystemObject, &address, 0, nullptr, &size, devices.data())) {
+        return kAudioObjectUnknown;
+      }
+
+      for (auto device : devices) {
+        CFStringRef device_uid = nullptr;
+        if (get_property(device, kAudioDevicePropertyDeviceUID, kAudioObjectPropertyScopeGlobal, device_uid) || !device_uid) {
+          continue;
+        }
+
+        char buffer[256];
+        auto converted = CFStringGetCString(device_uid, buffer, sizeof(buffer), kCFStringEncodingUTF8);
+        CFRelease(device_uid);
+
+        if (converted && uid == buffer) {
+          return device;
+        }
+      }
+
+      return kAudioObjectUnknown;
+    }
+  }  // namespace
+
+  /**
+   * @brief Captures from the input bus of an AUHAL unit, rendered on the realtime IO thread of Core Audio.
+   * @details The IO thread renders into a buffer sized up front and splits the samples over the slots of a ring,
+   *          which sample() swaps with the buffer of the caller, so nothing is allocated or locked on the IO thread.
+   */
+  class mic_au_t: public mic_t {
+  public:
+    mic_au_t(int channels, std::size_t samples_per_frame):
+        _channels {channels} {
+      // Size every slot up front, so the IO thread never allocates
+      for (std::size_t x = 0; x < decltype(frames)::capacity; ++x) {
+        frames.back()->samples.resize(samples_per_frame);
+        frames.push();
+      }
+      while (!frames.empty()) {
+        frames.pop();
+      }
+    }
+
+    ~mic_au_t() override {
+      if (unit) {
+        AudioOutputUnitStop(unit);
+        AudioUnitUninitialize(unit);
+        AudioComponentInstanceDispose(unit);
+      }
+
+      if (device != kAudioObjectUnknown) {
+        for (auto &address : watched) {
+          AudioObjectRemovePropertyListener(device, &address, on_device_changed, this);
+        }
+      }
+    }
+
+    int start(AudioDeviceID device, std::uint32_t sample_rate, std::uint32_t frame_size) {
+      // AUHAL doesn't resample its input, so the device has to run at the rate of the stream already
+      Float64 device_rate = 0;
+      if (get_property(device, kAudioDevicePropertyNominalSampleRate, kAudioObjectPropertyScopeGlobal, device_rate)) {
+        BOOST_LOG(error) << "Couldn't get the sample rate of the audio device"sv;
+        return -1;
+      }
+
+      if ((std::uint32_t) device_rate != sample_rate) {
+        BOOST_LOG(info) << "The audio device runs at "sv << device_rate << " Hz rather than "sv << sample_rate << " Hz"sv;
+        return -1;
+      }
+
+      AudioComponentDescription description {kAudioUnitType_Output, kAudioUnitSubType_HALOutput, kAudioUnitManufacturer_Apple, 0, 0};
+      auto component = AudioComponentFindNext(nullptr, &description);
+      if (!component || AudioComponentInstanceNew(component, &unit)) {
+        BOOST_LOG(error) << "Couldn't create an AUHAL unit"sv;
+        return -1;
+      }
+
+      UInt32 enable = 1;
+      UInt32 disable = 0;
+      if (
+        AudioUnitSetProperty(unit, kAudioOutputUnitProperty_EnableIO, kAudioUnitScope_Input, input_bus, &enable, sizeof(enable)) ||
+        AudioUnitSetProperty(unit, kAudioOutputUnitProperty_EnableIO, kAudioUnitScope_Output, output_bus, &disable, sizeof(disable)) ||
+        AudioUnitSetProperty(unit, kAudioOutputUnitProperty_CurrentDevice, kAudioUnitScope_Global, output_bus, &device, sizeof(device))
+      ) {
+        BOOST_LOG(error) << "Couldn't capture from the audio device"sv;
+        return -1;
+      }
+      this->device = device;
+      _sample_rate = device_rate;
+
+      // Ask for one packet per IO cycle, so a packet is complete as soon as the device hands it over
+      UInt32 buffer_frames = frame_size;
+      if (AudioUnitSetProperty(unit, kAudioDevicePropertyBufferFrameSize, kAudioUnitScope_Global, output_bus, &buffer_frames, sizeof(buffer_frames))) {
+        BOOST_LOG(warning) << "Couldn't set the IO buffer of the audio device to "sv << frame_size << " frames"sv;
+      }
+
+      AudioStreamBasicDescription format {};
+      format.mSampleRate = sample_rate;
+      format.mFormatID = kAudioFormatLinearPCM;
+      format.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+      format.mFramesPerPacket = 1;
+      format.mChannelsPerFrame = _channels;
+      format.mBitsPerChannel = sizeof(float) * 8;
+      format.mBytesPerFrame = sizeof(float) * _channels;
+      format.mBytesPerPacket = format.mBytesPerFrame;
+      if (AudioUnitSetProperty(unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, input_bus, &format, sizeof(format))) {
+        BOOST_LOG(error) << "Couldn't capture "sv << _channels << " channels of float samples from the audio device"sv;
+        return -1;
+      }
+
+      AURenderCallbackStruct callback {on_input, this};
+      if (AudioUnitSetProperty(unit, kAudioOutputUnitProperty_SetInputCallback, kAudioUnitScope_Global, output_bus, &callback, sizeof(callback))) {
+        BOOST_LOG(error) << "Couldn't set the input callback of the AUHAL unit"sv;
+        return -1;
+      }
+
+      if (AudioUnitInitialize(unit)) {
+        BOOST_LOG(error) << "Couldn't initialize the AUHAL unit"sv;
+        return -1;
+      }
+
+      // Size the render buffer for the largest IO cycle up front
+      UInt32 max_frames = 0;
+      UInt32 size = sizeof(max_frames);
+      if (AudioUnitGetProperty(unit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, output_bus, &max_frames, &size) || !max_frames) {
+        max_frames = 4096;
+      }
+      _max_frames = max_frames;
+      _render_buffer.resize((std::size_t) max_frames * _channels);
+
+      // The samples spend the latency of the device and its safety offset in the hardware before the IO cycle
+      UInt32 latency_frames = 0;
+      UInt32 safety_frames = 0;
+      get_property(device, kAudioDevicePropertyLatency, kAudioObjectPropertyScopeInput, latency_frames);
+      get_property(device, kAudioDevicePropertySafetyOffset, kAudioObjectPropertyScopeInput, safety_frames);
+      _device_latency = std::chrono::nanoseconds {std::chrono::seconds {latency_frames + safety_frames}} / sample_rate;
+
+      // Capture is reinitialized when the device goes away, or stops running at the rate of the stream
+      for (auto &address : watched) {
+        AudioObjectAddPropertyListener(device, &address, on_device_changed, this);
+      }
+
+      if (AudioOutputUnitStart(unit)) {
+        BOOST_LOG(error) << "Couldn't start the AUHAL unit"sv;
+        return -1;
+      }
+
+      BOOST_LOG(info) << "Capturing audio with Core Audio, IO buffer of "sv << buffer_frames << '/' << sample_rate
+                      << ", device latency of "sv << std::chrono::duration_cast<std::chrono::microseconds>(_device_latency).count() << "us"sv;
+      return 0;
+    }
+
+    capture_e sample(std::vector<float> &sample_buf) override {
+      frames.wait();
+      if (frames.empty()) {
+        // Closed when the device went away
+        return capture_e::reinit;
+      }
+
+      auto &frame = frames.front();
+      if (frame.samples.size() == sample_buf.size()) {
+        // The slot gets the buffer of the caller, which has the same size
+        std::swap(frame.samples, sample_buf);
+      } else {
+        std::fill(std::copy_n(frame.samples.begin(), std::min(frame.samples.size(), sample_buf.size()), sample_buf.begin()), sample_buf.end(), 0.0f);
+      }
+
+      _latency = std::chrono::steady_clock::now() - frame.completed + _device_latency;
+      frames.pop();
+
+      return capture_e::ok;
+    }
+
+    std::chrono::nanoseconds latency() override {
+      return _latency;
+    }
+
+  private:
+    /**
+     * @brief Split the rendered samples over the slots of the ring.
+     * @details Called on the IO thread only.
+     */
+    void write(const float *samples, std::size_t count) {
+      while (count > 0) {
+        auto frame = frames.back();
+        if (!frame) {
+          // The capture thread is behind, so the newest samples are dropped
+          return;
+        }
+
+        auto copied = std::min(count, frame->samples.size() - _filled);
+        std::copy_n(samples, copied, frame->samples.data() + _filled);
+
+        samples += copied;
+        count -= copied;
+        _filled += copied;
+
+        if (_filled == frame->samples.size()) {
+          frame->completed = std::chrono::steady_clock::now();
+          frames.push();
+
+          _filled = 0;
+        }
+      }
+    }
+
+    static OSStatus on_input(void *userdata, AudioUnitRenderActionFlags *flags, const AudioTimeStamp *timestamp, UInt32 bus, UInt32 frame_count, AudioBufferList *) {
+      auto mic = (mic_au_t *) userdata;
+
+      if (frame_count > mic->_max_frames) {
+        return kAudioUnitErr_TooManyFramesToProcess;
+      }
+
+      AudioBufferList buffers;
+      buffers.mNumberBuffers = 1;
+      buffers.mBuffers[0].mNumberChannels = mic->_channels;
+      buffers.mBuffers[0].mDataByteSize = frame_count * mic->_channels * sizeof(float);
+      buffers.mBuffers[0].mData = mic->_render_buffer.data();
+
+      auto status = AudioUnitRender(mic->unit, flags, timestamp, bus, frame_count, &buffers);
+      if (status == noErr) {
+        mic->write(mic->_render_buffer.data(), buffers.mBuffers[0].mDataByteSize / sizeof(float));
+      }
+
+      return status;
+    }
+
+    static OSStatus on_device_changed(AudioObjectID, UInt32, const AudioObjectPropertyAddress *, void *userdata) {
+      auto mic = (mic_au_t *) userdata;
+
+      UInt32 alive = 0;
+      Float64 device_rate = 0;
+      get_property(mic->device, kAudioDevicePropertyDeviceIsAlive, kAudioObjectPropertyScopeGlobal, alive);
+      get_property(mic->device, kAudioDevicePropertyNominalSampleRate, kAudioObjectPropertyScopeGlobal, device_rate);
+
+      if (!alive || device_rate != mic->_sample_rate) {
+        mic->frames.close();
+      }
+
+      return noErr;
+    }
+
+    const AudioObjectPropertyAddress watched[2] {
+      {kAudioDevicePropertyDeviceIsAlive, kAudioObjectPropertyScopeGlobal, element_main},
+      {kAudioDevicePropertyNominalSampleRate, kAudioObjectPropertyScopeGlobal, element_main},
+    };
+
+    AudioDeviceID device = kAudioObjectUnknown;
+    AudioComponentInstance unit {};
+
+    util::spsc_ring_t<frame_t, 8> frames;
+
+    int _channels;
+    Float64 _sample_rate = 0;
+    UInt32 _max_frames = 0;
+    std::chrono::nanoseconds _device_latency {};
+
+    // Only touched by the IO thread
+    std::vector<float> _render_buffer;
+    std::size_t _filled = 0;
+
+    // Only touched by the capture thread
+    std::chrono::nanoseconds _latency {};
+  };
+
+  std::unique_ptr<mic_t> microphone(const std::string &uid, int channels, std::uint32_t sample_rate, std::uint32_t frame_size) {
+    auto device = find_device(uid);
+    if (device == kAudioObjectUnknown) {
+      BOOST_LOG(warning) << "Couldn't find the Core Audio device ["sv << uid << ']';
+      return nullptr;
+    }
+
+    auto mic = std::make_unique<mic_au_t>(channels, frame_size * channels);
+    if (mic->start(device, sample_rate, frame_size)) {
+      return nullptr;
+    }
+
+    return mic;
+  }
+}  // namespace platf::au
@@ -2,6 +2,9 @@
  * @file src/platform/macos/display.mm
  * @brief Definitions for display capture on macOS.
  */
+// standard includes
+#include <atomic>
+
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
@@ -9,6 +12,7 @@
 #include "src/platform/macos/av_img_t.h"
 #include "src/platform/macos/av_video.h"
 #include "src/platform/macos/misc.h"
+#include "src/platform/macos/sc_video.h"
 #include "src/platform/macos/nv12_zero_device.h"
 
 // Avoid conflict between AVFoundation and libavutil both defining AVMediaType
@@ -22,7 +26,7 @@ namespace platf {
   using namespace std::literals;
 
   struct av_display_t: public display_t {
-    AVVideo *av_capture {};
+    NSObject<VideoCapture> *av_capture {};
     CGDirectDisplayID display_id {};
 
     ~av_display_t() override {
@@ -68,6 +72,11 @@ namespace platf {
         return true;
       }];
 
+      if (!signal) {
+        BOOST_LOG(error) << "Couldn't start display capture"sv;
+        return capture_e::error;
+      }
+
       // FIXME: We should time out if an image isn't returned for a while
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
@@ -130,6 +139,10 @@ namespace platf {
         return false;
       }];
 
+      if (!signal) {
+        return 1;
+      }
+
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
       return 0;
@@ -143,11 +156,11 @@ namespace platf {
      * height --> the intended capture height
      */
     static void setResolution(void *display, int width, int height) {
-      [static_cast<AVVideo *>(display) setFrameWidth:width frameHeight:height];
+      [static_cast<id<VideoCapture>>(display) setFrameWidth:width frameHeight:height];
     }
 
     static void setPixelFormat(void *display, OSType pixelFormat) {
-      static_cast<AVVideo *>(display).pixelFormat = pixelFormat;
+      static_cast<id<VideoCapture>>(display).pixelFormat = pixelFormat;
     }
   };
 
@@ -177,7 +190,33 @@ namespace platf {
     }
     BOOST_LOG(info) << "Configuring selected display ("sv << display->display_id << ") to stream"sv;
 
-    display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+    // ScreenCaptureKit doesn't produce the 10-bit biplanar buffers that HDR streams are encoded from
+    bool use_screen_capture_kit = false;
+    if (config::video.capture == "sck" || config::video.capture.empty()) {
+      if (![SCVideo isAvailable]) {
+        BOOST_LOG(info) << "ScreenCaptureKit requires macOS 12.3 or later, falling back to AVFoundation"sv;
+      } else if (config.dynamicRange) {
+        BOOST_LOG(info) << "ScreenCaptureKit doesn't capture in 10-bit, falling back to AVFoundation"sv;
+      } else {
+        use_screen_capture_kit = true;
+      }
+    }
+
+    if (use_screen_capture_kit) {
+      if (@available(macOS 12.3, *)) {
+        display->av_capture = [[SCVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate queueDepth:config::video.sck_capture_buffers];
+      }
+
+      if (display->av_capture) {
+        BOOST_LOG(info) << "Capturing with ScreenCaptureKit"sv;
+      } else {
+        BOOST_LOG(warning) << "Couldn't capture the display with ScreenCaptureKit, falling back to AVFoundation"sv;
+      }
+    }
+
+    if (!display->av_capture) {
+      display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+    }
 
     if (!display->av_capture) {
       BOOST_LOG(error) << "Video setup failed."sv;
@@ -207,6 +246,12 @@ namespace platf {
     return display_names;
   }
 
+  std::uint64_t display_topology_generation() {
+    // Enumerating is fast enough on macOS not to track the displays
+    static std::atomic_uint64_t generation = 0;
+    return ++generation;
+  }
+
   /**
    * @brief Returns if GPUs/drivers have changed since the last call to this function.
    * @return `true` if a change has occurred or if it is unknown whether a change occurred.
@@ -215,4 +260,25 @@ namespace platf {
     // We don't track GPU state, so we will always reenumerate. Fortunately, it is fast on macOS.
     return true;
   }
+
+  std::string encoder_probe_fingerprint() {
+    // There's only VideoToolbox and the software encoder to probe, the cache isn't worth it
+    return {};
+  }
+
+  bool concurrent_encoder_probing() {
+    return false;
+  }
+
+  std::vector<std::string> capture_methods() {
+    // Neither ScreenCaptureKit nor AVFoundation delivers frames while nothing changes on the display,
+    // so a benchmark of an idle desktop can't tell them apart
+    return {};
+  }
+
+  std::chrono::nanoseconds process_cpu_time() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::seconds {ts.tv_sec} + std::chrono::nanoseconds {ts.tv_nsec};
+  }
 }  // namespace platf
@@ -40,6 +40,10 @@ namespace platf {
     }
   };
 
+  namespace au {
+    std::unique_ptr<mic_t> microphone(const std::string &uid, int channels, std::uint32_t sample_rate, std::uint32_t frame_size);
+  }  // namespace au
+
   struct macos_audio_control_t: public audio_control_t {
     AVCaptureDevice *audio_capture_device {};
 
@@ -68,6 +72,12 @@ namespace platf {
         return nullptr;
       }
 
+      if (auto au_mic = au::microphone([[audio_capture_device uniqueID] UTF8String], channels, sample_rate, frame_size)) {
+        return au_mic;
+      }
+
+      BOOST_LOG(warning) << "Falling back to capturing audio through AVFoundation"sv;
+
       mic->av_audio_capture = [[AVAudio alloc] init];
 
       if ([mic->av_audio_capture setupMicrophone:audio_capture_device sampleRate:sample_rate frameSize:frame_size channels:channels]) {
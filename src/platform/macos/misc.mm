@@ -219,6 +219,33 @@ namespace platf {
     // Unimplemented
   }
 
+  std::vector<cpu_info_t> cpu_topology() {
+    // Threads can't be bound to CPUs on macOS, affinity tags are only hints
+    return {};
+  }
+
+  int gpu_numa_node() {
+    return -1;
+  }
+
+  std::vector<std::string> encode_gpus() {
+    // Not supported on this platform
+    return {};
+  }
+
+  std::vector<metrics::gpu_metrics_t> sample_gpus() {
+    // Not supported on this platform
+    return {};
+  }
+
+  std::string gpu_by_pci_address(unsigned int, unsigned int, unsigned int) {
+    return {};
+  }
+
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    return false;
+  }
+
   void streaming_will_start() {
     // Nothing to do
   }
@@ -276,6 +303,16 @@ namespace platf {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  std::unique_ptr<process_watcher_t> watch_process_exit(std::uintptr_t process, std::uintptr_t group, std::function<void()> &&exited) {
+    // Not implemented, exits are polled for
+    return nullptr;
+  }
+
+  std::unique_ptr<app_isolation_t> isolate_app(std::uintptr_t process, std::uintptr_t group, const std::vector<int> &cpus, int cpu_weight) {
+    // Not implemented, apps share every CPU with Apollo
+    return nullptr;
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
@@ -406,6 +443,16 @@ namespace platf {
     return true;
   }
 
+  bool send_many(std::span<send_info_t> send_infos) {
+    // There's no way to send several messages with a single call, so they're sent one by one
+    bool success = true;
+    for (auto &send_info : send_infos) {
+      success = send(send_info) && success;
+    }
+
+    return success;
+  }
+
   // We can't track QoS state separately for each destination on this OS,
   // so we keep a ref count to only disable QoS options when all clients
   // are disconnected.
@@ -512,6 +559,88 @@ namespace platf {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  /**
+   * @brief Enable kernel pacing of outgoing traffic on the given socket.
+   * @param native_socket The native socket handle.
+   * @return `true` if transmit times are supported on this socket.
+   */
+  bool enable_socket_txtime(uintptr_t native_socket) {
+    // Not supported on this platform
+    return false;
+  }
+
+  /**
+   * @brief Enable zero-copy sends on the given socket.
+   * @param native_socket The native socket handle.
+   * @return `true` if zero-copy sends are supported on this socket.
+   */
+  bool enable_socket_zerocopy(uintptr_t native_socket) {
+    // Not supported on this platform
+    return false;
+  }
+
+  /**
+   * @brief Open a UDP socket whose batches are sent through Registered I/O.
+   * @param v6 Whether the socket is IPv6.
+   * @param native_socket Set to the native socket handle.
+   * @return `nullptr`, since Registered I/O is specific to Windows.
+   */
+  std::unique_ptr<deinit_t> open_socket_registered_io(bool v6, std::uintptr_t &native_socket) {
+    // Not supported on this platform
+    return nullptr;
+  }
+
+  /**
+   * @brief Send the batches of a socket through an AF_XDP socket on a network interface.
+   * @param native_socket The native socket handle.
+   * @param interface The name of the interface.
+   * @return `nullptr`, since AF_XDP is specific to Linux.
+   */
+  std::unique_ptr<deinit_t> enable_socket_xdp(uintptr_t native_socket, const std::string &interface) {
+    // Not supported on this platform
+    return nullptr;
+  }
+
+  /**
+   * @brief Let other sockets bind the same local address and port as the given socket.
+   * @param native_socket The native socket handle, which must not be bound yet.
+   * @return `true` if the port can be shared.
+   */
+  bool enable_socket_reuseport(uintptr_t native_socket) {
+    // Not supported on this platform
+    return false;
+  }
+
+  /**
+   * @brief Get the largest IP packet that reaches an address without being fragmented.
+   * @param address The destination.
+   * @return The MTU in bytes, -1 if it's unknown.
+   */
+  int path_mtu(const boost::asio::ip::address &address) {
+    // Not supported on this platform
+    return -1;
+  }
+
+  std::vector<interface_address_t> interface_addresses() {
+    // Not supported on this platform
+    return {};
+  }
+
+  std::optional<interface_stats_t> interface_stats(const std::string &name) {
+    // Not supported on this platform
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Wait until the kernel no longer references the buffers of the sends made with a ticket.
+   * @param native_socket The native socket handle.
+   * @param ticket The ticket passed to `send_batch()`, which is cleared on return.
+   */
+  void wait_for_zerocopy(uintptr_t native_socket, zerocopy_ticket_t &ticket) {
+    // Buffers are always copied on this platform
+    ticket.last_id.reset();
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -3,6 +3,7 @@
  * @brief Definitions for publishing services on macOS.
  */
 // standard includes
+#include <atomic>
 #include <thread>
 
 // platform includes
@@ -18,6 +19,8 @@ using namespace std::literals;
 
 namespace platf::publish {
   namespace {
+    std::atomic<status_e> publish_status {status_e::disabled};
+
     /** @brief Custom deleter intended to be used for `std::unique_ptr<DNSServiceRef>`. */
     struct ServiceRefDeleter {
       typedef DNSServiceRef pointer;  ///< Type of object to be deleted.
@@ -67,6 +70,7 @@ namespace platf::publish {
       ~deinit_t() override {
         _stopRequested = true;
         _thread.join();
+        publish_status = status_e::disabled;
       }
 
       deinit_t(const deinit_t &) = delete;
@@ -83,9 +87,11 @@ namespace platf::publish {
     void registrationCallback(DNSServiceRef /*serviceRef*/, DNSServiceFlags /*flags*/, DNSServiceErrorType errorCode, const char * /*name*/, const char * /*regtype*/, const char * /*domain*/, void * /*context*/) {
       if (errorCode != kDNSServiceErr_NoError) {
         BOOST_LOG(error) << "Failed to register DNS service: Error "sv << errorCode;
+        publish_status = status_e::failed;
         return;
       }
       BOOST_LOG(info) << "Successfully registered DNS service."sv;
+      publish_status = status_e::published;
     }
   }  // anonymous namespace
 
@@ -118,8 +124,14 @@ namespace platf::publish {
     );
     if (status != kDNSServiceErr_NoError) {
       BOOST_LOG(error) << "Failed immediately to register DNS service: Error "sv << status;
+      publish_status = status_e::failed;
       return nullptr;
     }
+    publish_status = status_e::pending;
     return std::make_unique<deinit_t>(serviceRef);
   }
+
+  status_e status() {
+    return publish_status;
+  }
 }  // namespace platf::publish
@@ -0,0 +1,40 @@
+/**
+ * @file src/platform/macos/sc_video.h
+ * @brief Declarations for video capture with ScreenCaptureKit on macOS.
+ */
+#pragma once
+
+// platform includes
+#import <ScreenCaptureKit/ScreenCaptureKit.h>
+
+// local includes
+#import "av_video.h"
+
+/**
+ * Captures a display with ScreenCaptureKit, which hands over the IOSurface-backed pixel buffers
+ * the window server composited into, so they go to VideoToolbox without a copy.
+ */
+API_AVAILABLE(macos(12.3))
+@interface SCVideo: NSObject <SCStreamOutput, SCStreamDelegate, VideoCapture>
+
+@property (nonatomic, assign) CGDirectDisplayID displayID;
+@property (nonatomic, assign) CMTime minFrameDuration;
+@property (nonatomic, assign) OSType pixelFormat;
+@property (nonatomic, assign) int frameWidth;
+@property (nonatomic, assign) int frameHeight;
+@property (nonatomic, assign) int queueDepth;
+
+@property (nonatomic, retain) SCContentFilter *filter;
+@property (nonatomic, retain) SCStream *stream;
+@property (nonatomic, copy) FrameCallbackBlock frameCallback;
+@property (nonatomic, assign) dispatch_semaphore_t captureSignal;
+@property (nonatomic, assign) dispatch_queue_t sampleQueue;
+
++ (BOOL)isAvailable;
+
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate queueDepth:(int)queueDepth;
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight;
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback;
+
+@end
@@ -0,0 +1,177 @@
+/**
+ * @file src/platform/macos/sc_video.m
+ * @brief Definitions for video capture with ScreenCaptureKit on macOS.
+ */
+// local includes
+#import "sc_video.h"
+
+@implementation SCVideo
+
++ (BOOL)isAvailable {
+  if (@available(macOS 12.3, *)) {
+    return YES;
+  }
+  return NO;
+}
+
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate queueDepth:(int)queueDepth {
+  self = [super init];
+
+  CGDisplayModeRef mode = CGDisplayCopyDisplayMode(displayID);
+
+  self.displayID = displayID;
+  self.pixelFormat = kCVPixelFormatType_32BGRA;
+  self.frameWidth = (int) CGDisplayModeGetPixelWidth(mode);
+  self.frameHeight = (int) CGDisplayModeGetPixelHeight(mode);
+  self.minFrameDuration = CMTimeMake(1, frameRate);
+  self.queueDepth = queueDepth;
+
+  CFRelease(mode);
+
+  // The list of shareable displays is only handed out asynchronously
+  __block SCDisplay *display = nil;
+  dispatch_semaphore_t content_ready = dispatch_semaphore_create(0);
+  [SCShareableContent getShareableContentWithCompletionHandler:^(SCShareableContent *content, NSError *error) {
+    for (SCDisplay *candidate in content.displays) {
+      if (candidate.displayID == displayID) {
+        display = [candidate retain];
+        break;
+      }
+    }
+    dispatch_semaphore_signal(content_ready);
+  }];
+  dispatch_semaphore_wait(content_ready, DISPATCH_TIME_FOREVER);
+  dispatch_release(content_ready);
+
+  if (display == nil) {
+    [self release];
+    return nil;
+  }
+
+  SCContentFilter *filter = [[SCContentFilter alloc] initWithDisplay:display excludingWindows:@[]];
+  self.filter = filter;
+  [filter release];
+  [display release];
+
+  dispatch_queue_attr_t qos = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, DISPATCH_QUEUE_PRIORITY_HIGH);
+  self.sampleQueue = dispatch_queue_create("screenCaptureQueue", qos);
+
+  return self;
+}
+
+- (void)dealloc {
+  [self finishCapture:self.stream];
+  [self.filter release];
+  [self.frameCallback release];
+  dispatch_release(self.sampleQueue);
+  [super dealloc];
+}
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight {
+  self.frameWidth = frameWidth;
+  self.frameHeight = frameHeight;
+}
+
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback {
+  // Only one stream runs at a time, a new capture takes over from the previous one
+  [self finishCapture:self.stream];
+
+  @synchronized(self) {
+    SCStreamConfiguration *configuration = [[SCStreamConfiguration alloc] init];
+    configuration.width = self.frameWidth;
+    configuration.height = self.frameHeight;
+    configuration.pixelFormat = self.pixelFormat;
+    configuration.minimumFrameInterval = self.minFrameDuration;
+    configuration.queueDepth = self.queueDepth;
+    configuration.showsCursor = YES;
+
+    SCStream *stream = [[SCStream alloc] initWithFilter:self.filter configuration:configuration delegate:self];
+    [configuration release];
+
+    NSError *error = nil;
+    if (![stream addStreamOutput:self type:SCStreamOutputTypeScreen sampleHandlerQueue:self.sampleQueue error:&error]) {
+      NSLog(@"Couldn't add ScreenCaptureKit stream output: %@", error);
+      [stream release];
+      return nil;
+    }
+
+    dispatch_semaphore_t signal = dispatch_semaphore_create(0);
+
+    self.frameCallback = frameCallback;
+    self.captureSignal = signal;
+    self.stream = stream;
+    [stream release];
+
+    [stream startCaptureWithCompletionHandler:^(NSError *error) {
+      if (error != nil) {
+        NSLog(@"Couldn't start ScreenCaptureKit stream: %@", error);
+        [self finishCapture:stream];
+      }
+    }];
+
+    return signal;
+  }
+}
+
+/**
+ * Stop a stream and wake up whoever waits for its capture to end.
+ * Does nothing if the stream has already been replaced or finished.
+ */
+- (void)finishCapture:(SCStream *)stream {
+  dispatch_semaphore_t signal;
+
+  @synchronized(self) {
+    if (stream == nil || stream != self.stream) {
+      return;
+    }
+
+    [stream retain];
+    self.stream = nil;
+    self.frameCallback = nil;
+
+    signal = self.captureSignal;
+    self.captureSignal = nil;
+  }
+
+  [stream stopCaptureWithCompletionHandler:nil];
+  [stream release];
+
+  dispatch_semaphore_signal(signal);
+}
+
+- (void)stream:(SCStream *)stream didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer ofType:(SCStreamOutputType)type {
+  if (type != SCStreamOutputTypeScreen || !CMSampleBufferIsValid(sampleBuffer)) {
+    return;
+  }
+
+  // Only complete frames carry an image, idle ones just report that nothing changed
+  CFArrayRef attachments = CMSampleBufferGetSampleAttachmentsArray(sampleBuffer, false);
+  if (attachments == nil || CFArrayGetCount(attachments) == 0) {
+    return;
+  }
+
+  NSDictionary *frameInfo = (NSDictionary *) CFArrayGetValueAtIndex(attachments, 0);
+  NSNumber *status = frameInfo[SCStreamFrameInfoStatus];
+  if (status == nil || status.integerValue != SCFrameStatusComplete) {
+    return;
+  }
+
+  FrameCallbackBlock callback;
+  @synchronized(self) {
+    if (stream != self.stream) {
+      return;
+    }
+    callback = [[self.frameCallback retain] autorelease];
+  }
+
+  if (callback != nil && !callback(sampleBuffer)) {
+    [self finishCapture:stream];
+  }
+}
+
+- (void)stream:(SCStream *)stream didStopWithError:(NSError *)error {
+  NSLog(@"ScreenCaptureKit stream stopped: %@", error);
+  [self finishCapture:stream];
+}
+
+@end
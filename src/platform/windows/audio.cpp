@@ -217,6 +217,7 @@ namespace platf::audio {
   using device_t = util::safe_ptr<IMMDevice, Release<IMMDevice>>;
   using collection_t = util::safe_ptr<IMMDeviceCollection, Release<IMMDeviceCollection>>;
   using audio_client_t = util::safe_ptr<IAudioClient, Release<IAudioClient>>;
+  using audio_client3_t = util::safe_ptr<IAudioClient3, Release<IAudioClient3>>;
   using audio_capture_t = util::safe_ptr<IAudioCaptureClient, Release<IAudioCaptureClient>>;
   using wave_format_t = util::safe_ptr<WAVEFORMATEX, co_task_free<WAVEFORMATEX>>;
   using wstring_t = util::safe_ptr<WCHAR, co_task_free<WCHAR>>;
@@ -276,7 +277,88 @@ namespace platf::audio {
     },
   };
 
-  audio_client_t make_audio_client(device_t &device, const format_t &format) {
+  /**
+   * @brief Check whether the mixer already produces what we capture, so no conversion is needed.
+   * @param mixer_waveformat The mix format of the audio device.
+   * @param channel_count The number of channels captured.
+   */
+  bool is_capture_waveformat(const WAVEFORMATEX &mixer_waveformat, WORD channel_count) {
+    if (mixer_waveformat.nSamplesPerSec != 48000 || mixer_waveformat.nChannels != channel_count || mixer_waveformat.wBitsPerSample != 32) {
+      return false;
+    }
+
+    if (mixer_waveformat.wFormatTag == WAVE_FORMAT_IEEE_FLOAT) {
+      return true;
+    }
+
+    return mixer_waveformat.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+           mixer_waveformat.cbSize >= 22 &&
+           reinterpret_cast<const WAVEFORMATEXTENSIBLE &>(mixer_waveformat).SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+  }
+
+  /**
+   * @brief Initialize a low latency shared stream with the smallest engine period that divides the frame size.
+   * @details The engine then completes frames right at the end of a period. This only works in the mix format,
+   *          so it's used when the mixer already runs at 48 KHz in 32-bit float.
+   * @param device The audio device.
+   * @param mixer_waveformat The mix format of the audio device.
+   * @param frame_size The number of samples per channel in a frame of the encoder.
+   * @return The audio client, or nullptr if the device or Windows doesn't support it.
+   */
+  audio_client_t make_low_latency_audio_client(device_t &device, WAVEFORMATEX *mixer_waveformat, std::uint32_t frame_size) {
+    audio_client3_t audio_client;
+    auto status = device->Activate(
+      __uuidof(IAudioClient3),
+      CLSCTX_ALL,
+      nullptr,
+      (void **) &audio_client
+    );
+
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "IAudioClient3 isn't available: [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    UINT32 default_period, fundamental_period, min_period, max_period;
+    status = audio_client->GetSharedModeEnginePeriod(mixer_waveformat, &default_period, &fundamental_period, &min_period, &max_period);
+    if (FAILED(status) || fundamental_period == 0) {
+      BOOST_LOG(debug) << "Couldn't get shared mode engine periods: [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    auto period = min_period;
+    for (auto candidate = min_period; candidate <= std::min(max_period, frame_size); candidate += fundamental_period) {
+      if (frame_size % candidate == 0) {
+        period = candidate;
+        break;
+      }
+    }
+
+    // Only the default period is available when the driver doesn't support smaller ones
+    if (period >= default_period) {
+      BOOST_LOG(debug) << "Audio device doesn't support an engine period below "sv << default_period << " frames"sv;
+      return nullptr;
+    }
+
+    status = audio_client->InitializeSharedAudioStream(
+      AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+      period,
+      mixer_waveformat,
+      nullptr
+    );
+
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Couldn't initialize low latency audio stream: [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    BOOST_LOG(info) << "Audio capture uses an engine period of "sv << period << " frames, "sv
+                    << default_period << " by default"sv;
+
+    return audio_client_t {audio_client.release()};
+  }
+
+  audio_client_t make_audio_client(device_t &device, const format_t &format, std::uint32_t frame_size) {
     audio_client_t audio_client;
     auto status = device->Activate(
       IID_IAudioClient,
@@ -313,6 +395,13 @@ namespace platf::audio {
       BOOST_LOG(info) << "Audio mixer format is "sv << mixer_waveformat->wBitsPerSample << "-bit, "sv
                       << mixer_waveformat->nSamplesPerSec << " Hz, "sv
                       << ((mixer_waveformat->nSamplesPerSec != 48000) ? "will be resampled to 48000 by Windows"sv : "no resampling needed"sv);
+
+      // Capture in the mix format with a small engine period when it doesn't need converting at all
+      if (is_capture_waveformat(*mixer_waveformat, format.channel_count)) {
+        if (auto low_latency_client = make_low_latency_audio_client(device, mixer_waveformat.get(), frame_size)) {
+          return low_latency_client;
+        }
+      }
     }
 
     status = audio_client->Initialize(
@@ -491,7 +580,7 @@ namespace platf::audio {
         }
 
         BOOST_LOG(debug) << "Trying audio format ["sv << format.name << ']';
-        audio_client = make_audio_client(device, format);
+        audio_client = make_audio_client(device, format, frame_size);
 
         if (audio_client) {
           BOOST_LOG(debug) << "Found audio format ["sv << format.name << ']';
@@ -4,6 +4,9 @@
  */
 #pragma once
 
+// standard includes
+#include <algorithm>
+
 // platform includes
 #include <d3d11.h>
 #include <d3d11_4.h>
@@ -15,6 +18,8 @@
 #include <winrt/windows.graphics.capture.h>
 
 // local includes
+#include "src/config.h"
+#include "src/image_memory.h"
 #include "src/platform/common.h"
 #include "src/utility.h"
 #include "src/video.h"
@@ -243,6 +248,8 @@ namespace platf::dxgi {
     virtual capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) = 0;
     virtual capture_e release_snapshot() = 0;
     virtual int complete_img(img_t *img, bool dummy) = 0;
+
+    capture_e wait_for_vblank(std::chrono::steady_clock::time_point &next_frame, std::chrono::nanoseconds frame_interval);
   };
 
   /**
@@ -259,6 +266,9 @@ namespace platf::dxgi {
 
     D3D11_MAPPED_SUBRESOURCE img_info;
     texture2d_t texture;
+
+    // The copy out of the staging texture is bound by memory bandwidth, a few threads saturate it
+    util::image_copy_t image_copy {std::clamp(config::video.min_threads, 1, 4)};
   };
 
   /**
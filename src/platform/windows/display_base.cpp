@@ -4,6 +4,7 @@
  */
 // standard includes
 #include <cmath>
+#include <sstream>
 #include <thread>
 
 // platform includes
@@ -192,6 +193,35 @@ namespace platf::dxgi {
     release_frame();
   }
 
+  /**
+   * @brief Sleep until right after the first vblank past the halfway point to the deadline of the next frame.
+   * @details The deadlines advance at the client's framerate, so vblanks of a display with a higher
+   *          refresh rate are skipped. A deadline that was missed by more than a frame is moved up to now.
+   * @param next_frame The deadline of the next frame, advanced to the following one.
+   * @param frame_interval The time between two deadlines.
+   * @return `capture_e::ok` after the vblank, `capture_e::error` if the output doesn't support waiting for vblanks.
+   */
+  capture_e display_base_t::wait_for_vblank(std::chrono::steady_clock::time_point &next_frame, std::chrono::nanoseconds frame_interval) {
+    auto now = std::chrono::steady_clock::now();
+    if (next_frame + frame_interval < now) {
+      next_frame = now;
+    }
+
+    auto wake = next_frame - frame_interval / 2;
+    if (wake > now) {
+      timer->sleep_for(wake - now);
+    }
+
+    auto hr = output->WaitForVBlank();
+    if (FAILED(hr)) {
+      BOOST_LOG(warning) << "Couldn't wait for vblank [0x"sv << util::hex(hr).to_string_view() << "], falling back to timer pacing"sv;
+      return capture_e::error;
+    }
+
+    next_frame += frame_interval;
+    return capture_e::ok;
+  }
+
   capture_e display_base_t::capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) {
     auto adjust_client_frame_rate = [&]() -> DXGI_RATIONAL {
       // Adjust capture frame interval when display refresh rate is not integral but very close to requested fps.
@@ -217,6 +247,11 @@ namespace platf::dxgi {
     std::optional<std::chrono::steady_clock::time_point> frame_pacing_group_start;
     uint32_t frame_pacing_group_frames = 0;
 
+    // With vblank synchronization, frames are captured right after the vblank closest to their deadline instead
+    const std::chrono::nanoseconds client_frame_interval = std::chrono::nanoseconds(1s) * client_frame_rate_adjusted.Denominator / client_frame_rate_adjusted.Numerator;
+    std::chrono::steady_clock::time_point vblank_next_frame = std::chrono::steady_clock::now();
+    bool vblank_sync = config::video.dxgi_vblank;
+
     // Keep the display awake during capture. If the display goes to sleep during
     // capture, best case is that capture stops until it powers back on. However,
     // worst case it will trigger us to reinit DD, waking the display back up in
@@ -239,72 +274,85 @@ namespace platf::dxgi {
       platf::capture_e status = capture_e::ok;
       std::shared_ptr<img_t> img_out;
 
-      // Try to continue frame pacing group, snapshot() is called with zero timeout after waiting for client frame interval
-      if (frame_pacing_group_start) {
-        const uint32_t seconds = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator / client_frame_rate_adjusted.Numerator;
-        const uint32_t remainder = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator % client_frame_rate_adjusted.Numerator;
-        const auto sleep_target = *frame_pacing_group_start +
-                                  std::chrono::nanoseconds(1s) * seconds +
-                                  std::chrono::nanoseconds(1s) * remainder / client_frame_rate_adjusted.Numerator;
-        const auto sleep_period = sleep_target - std::chrono::steady_clock::now();
-
-        if (sleep_period <= 0ns) {
-          // We missed next frame time, invalidating current frame pacing group
-          frame_pacing_group_start = std::nullopt;
-          frame_pacing_group_frames = 0;
-          status = capture_e::timeout;
+      if (vblank_sync) {
+        status = wait_for_vblank(vblank_next_frame, client_frame_interval);
+        if (status == capture_e::ok) {
+          // The device lock isn't held while waiting for the vblank, so there's no need to back off on timeouts
+          status = snapshot(pull_free_image_cb, img_out, 0ms, *cursor);
         } else {
-          bool elastic = false;
-          if (sleep_period >= 2ms) {
-            elastic = true;
-            timer->sleep_for(sleep_period - 2ms);
-            sleep_overshoot_logger.first_point(sleep_target);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
-
-          status = snapshot(pull_free_image_cb, img_out, elastic ? 2ms : std::chrono::duration_cast<std::chrono::milliseconds>(sleep_period), *cursor);
+          vblank_sync = false;
+          status = capture_e::ok;
+        }
+      }
 
-          if (status == capture_e::ok && img_out) {
-            frame_pacing_group_frames += 1;
-          } else {
+      if (!vblank_sync) {
+        // Try to continue frame pacing group, snapshot() is called with zero timeout after waiting for client frame interval
+        if (frame_pacing_group_start) {
+          const uint32_t seconds = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator / client_frame_rate_adjusted.Numerator;
+          const uint32_t remainder = (uint64_t) frame_pacing_group_frames * client_frame_rate_adjusted.Denominator % client_frame_rate_adjusted.Numerator;
+          const auto sleep_target = *frame_pacing_group_start +
+                                    std::chrono::nanoseconds(1s) * seconds +
+                                    std::chrono::nanoseconds(1s) * remainder / client_frame_rate_adjusted.Numerator;
+          const auto sleep_period = sleep_target - std::chrono::steady_clock::now();
+
+          if (sleep_period <= 0ns) {
+            // We missed next frame time, invalidating current frame pacing group
             frame_pacing_group_start = std::nullopt;
             frame_pacing_group_frames = 0;
+            status = capture_e::timeout;
+          } else {
+            bool elastic = false;
+            if (sleep_period >= 2ms) {
+              elastic = true;
+              timer->sleep_for(sleep_period - 2ms);
+              sleep_overshoot_logger.first_point(sleep_target);
+              sleep_overshoot_logger.second_point_now_and_log();
+            }
+
+            status = snapshot(pull_free_image_cb, img_out, elastic ? 2ms : std::chrono::duration_cast<std::chrono::milliseconds>(sleep_period), *cursor);
+
+            if (status == capture_e::ok && img_out) {
+              frame_pacing_group_frames += 1;
+            } else {
+              frame_pacing_group_start = std::nullopt;
+              frame_pacing_group_frames = 0;
+            }
           }
         }
-      }
 
-      // Start new frame pacing group if necessary, snapshot() is called with non-zero timeout
-      if (status == capture_e::timeout || (status == capture_e::ok && !frame_pacing_group_start)) {
-        status = snapshot(pull_free_image_cb, img_out, 200ms, *cursor);
+        // Start new frame pacing group if necessary, snapshot() is called with non-zero timeout
+        if (status == capture_e::timeout || (status == capture_e::ok && !frame_pacing_group_start)) {
+          status = snapshot(pull_free_image_cb, img_out, 200ms, *cursor);
 
-        if (status == capture_e::ok && img_out) {
-          frame_pacing_group_start = img_out->frame_timestamp;
+          if (status == capture_e::ok && img_out) {
+            frame_pacing_group_start = img_out->frame_timestamp;
 
-          if (!frame_pacing_group_start) {
-            BOOST_LOG(warning) << "snapshot() provided image without timestamp";
-            frame_pacing_group_start = std::chrono::steady_clock::now();
-          }
+            if (!frame_pacing_group_start) {
+              BOOST_LOG(warning) << "snapshot() provided image without timestamp";
+              frame_pacing_group_start = std::chrono::steady_clock::now();
+            }
 
-          frame_pacing_group_frames = 1;
-        } else if (status == platf::capture_e::timeout) {
-          // The D3D11 device is protected by an unfair lock that is held the entire time that
-          // IDXGIOutputDuplication::AcquireNextFrame() is running. This is normally harmless,
-          // however sometimes the encoding thread needs to interact with our ID3D11Device to
-          // create dummy images or initialize the shared state that is used to pass textures
-          // between the capture and encoding ID3D11Devices.
-          //
-          // When we're in a state where we're not actively receiving frames regularly, we will
-          // spend almost 100% of our time in AcquireNextFrame() holding that critical lock.
-          // Worse still, since it's unfair, we can monopolize it while the encoding thread
-          // is starved. The encoding thread may acquire it for a few moments across a few
-          // ID3D11Device calls before losing it again to us for another long time waiting in
-          // AcquireNextFrame(). The starvation caused by this lock contention causes encoder
-          // reinitialization to take several seconds instead of a fraction of a second.
-          //
-          // To avoid starving the encoding thread, sleep without the lock held for a little
-          // while each time we reach our max frame timeout. This will only happen when nothing
-          // is updating the display, so no visible stutter should be introduced by the sleep.
-          std::this_thread::sleep_for(10ms);
+            frame_pacing_group_frames = 1;
+          } else if (status == platf::capture_e::timeout) {
+            // The D3D11 device is protected by an unfair lock that is held the entire time that
+            // IDXGIOutputDuplication::AcquireNextFrame() is running. This is normally harmless,
+            // however sometimes the encoding thread needs to interact with our ID3D11Device to
+            // create dummy images or initialize the shared state that is used to pass textures
+            // between the capture and encoding ID3D11Devices.
+            //
+            // When we're in a state where we're not actively receiving frames regularly, we will
+            // spend almost 100% of our time in AcquireNextFrame() holding that critical lock.
+            // Worse still, since it's unfair, we can monopolize it while the encoding thread
+            // is starved. The encoding thread may acquire it for a few moments across a few
+            // ID3D11Device calls before losing it again to us for another long time waiting in
+            // AcquireNextFrame(). The starvation caused by this lock contention causes encoder
+            // reinitialization to take several seconds instead of a fraction of a second.
+            //
+            // To avoid starving the encoding thread, sleep without the lock held for a little
+            // while each time we reach our max frame timeout. This will only happen when nothing
+            // is updating the display, so no visible stutter should be introduced by the sleep.
+            std::this_thread::sleep_for(10ms);
+          }
         }
       }
 
@@ -1096,6 +1144,29 @@ namespace platf {
     return display_names;
   }
 
+  std::uint64_t display_topology_generation() {
+    static std::mutex lock;
+    static std::uint64_t generation = 0;
+    static dxgi::factory1_t factory;
+
+    auto lg = std::lock_guard(lock);
+
+    // A factory stops being current once an adapter or output is added or removed, or the desktop is reconfigured
+    if (!factory || !factory->IsCurrent()) {
+      factory.reset();
+
+      auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to create DXGIFactory1 [0x"sv << util::hex(status).to_string_view() << ']';
+        factory.release();
+      }
+
+      ++generation;
+    }
+
+    return generation;
+  }
+
   /**
    * @brief Returns if GPUs/drivers have changed since the last call to this function.
    * @return `true` if a change has occurred or if it is unknown whether a change occurred.
@@ -1125,4 +1196,60 @@ namespace platf {
       return false;
     }
   }
+
+  std::string encoder_probe_fingerprint() {
+    dxgi::factory1_t factory;
+    auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to create DXGIFactory1 [0x"sv << util::hex(status).to_string_view() << ']';
+      return {};
+    }
+
+    std::stringstream fingerprint;
+
+    dxgi::adapter_t adapter;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter) != DXGI_ERROR_NOT_FOUND; ++x) {
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter->GetDesc1(&adapter_desc);
+
+      if (adapter_desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) {
+        continue;
+      }
+
+      // The version of the user mode driver
+      LARGE_INTEGER umd_version {};
+      adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umd_version);
+
+      fingerprint
+        << "gpu "sv << util::hex(adapter_desc.VendorId).to_string_view()
+        << ' ' << util::hex(adapter_desc.DeviceId).to_string_view()
+        << ' ' << util::hex(adapter_desc.SubSysId).to_string_view()
+        << ' ' << util::hex(adapter_desc.Revision).to_string_view()
+        << ' ' << util::hex(umd_version.QuadPart).to_string_view() << '\n';
+
+      dxgi::output_t::pointer output_p {};
+      for (int y = 0; adapter->EnumOutputs(y, &output_p) != DXGI_ERROR_NOT_FOUND; ++y) {
+        dxgi::output_t output {output_p};
+
+        DXGI_OUTPUT_DESC desc;
+        output->GetDesc(&desc);
+
+        if (desc.AttachedToDesktop) {
+          fingerprint << "output "sv << to_utf8(desc.DeviceName) << '\n';
+        }
+      }
+    }
+
+    return fingerprint.str();
+  }
+
+  bool concurrent_encoder_probing() {
+    // Desktop duplication is limited per output, so concurrent probes would fail each other
+    return false;
+  }
+
+  std::vector<std::string> capture_methods() {
+    // A method that can't capture from the current session fails to initialize and loses the benchmark
+    return {"ddx"s, "wgc"s};
+  }
 }  // namespace platf
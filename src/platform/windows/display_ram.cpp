@@ -5,6 +5,7 @@
 // local includes
 #include "display.h"
 #include "misc.h"
+#include "src/image_memory.h"
 #include "src/logging.h"
 
 namespace platf {
@@ -14,7 +15,7 @@ namespace platf {
 namespace platf::dxgi {
   struct img_t: public ::platf::img_t {
     ~img_t() override {
-      delete[] data;
+      util::free_image(data);
       data = nullptr;
     }
   };
@@ -297,7 +298,7 @@ namespace platf::dxgi {
         return capture_e::error;
       }
 
-      std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
+      image_copy.copy((const std::uint8_t *) img_info.pData, img->data, (std::size_t) height * img_info.RowPitch);
 
       // Unmap the staging texture to allow GPU access again
       device_ctx->Unmap(texture.get(), 0);
@@ -346,12 +347,12 @@ namespace platf::dxgi {
     // Reallocate the image buffer if the pitch changes
     if (!dummy && img->row_pitch != img_info.RowPitch) {
       img->row_pitch = img_info.RowPitch;
-      delete img->data;
+      util::free_image(img->data);
       img->data = nullptr;
     }
 
     if (!img->data) {
-      img->data = new std::uint8_t[img->row_pitch * height];
+      img->data = util::alloc_image(img->row_pitch * height);
     }
 
     return 0;
@@ -4,6 +4,7 @@
  */
 // standard includes
 #include <cmath>
+#include <tuple>
 
 // platform includes
 #include <d3dcompiler.h>
@@ -105,17 +106,21 @@ namespace platf::dxgi {
   blob_t convert_yuv420_packed_uv_type0_ps_hlsl;
   blob_t convert_yuv420_packed_uv_type0_ps_linear_hlsl;
   blob_t convert_yuv420_packed_uv_type0_ps_perceptual_quantizer_hlsl;
+  blob_t convert_yuv420_packed_uv_type0_ps_tone_mapped_hlsl;
   blob_t convert_yuv420_packed_uv_type0_vs_hlsl;
   blob_t convert_yuv420_packed_uv_type0s_ps_hlsl;
   blob_t convert_yuv420_packed_uv_type0s_ps_linear_hlsl;
   blob_t convert_yuv420_packed_uv_type0s_ps_perceptual_quantizer_hlsl;
+  blob_t convert_yuv420_packed_uv_type0s_ps_tone_mapped_hlsl;
   blob_t convert_yuv420_packed_uv_type0s_vs_hlsl;
   blob_t convert_yuv420_planar_y_ps_hlsl;
   blob_t convert_yuv420_planar_y_ps_linear_hlsl;
   blob_t convert_yuv420_planar_y_ps_perceptual_quantizer_hlsl;
+  blob_t convert_yuv420_planar_y_ps_tone_mapped_hlsl;
   blob_t convert_yuv420_planar_y_vs_hlsl;
   blob_t convert_yuv444_packed_ayuv_ps_hlsl;
   blob_t convert_yuv444_packed_ayuv_ps_linear_hlsl;
+  blob_t convert_yuv444_packed_ayuv_ps_tone_mapped_hlsl;
   blob_t convert_yuv444_packed_vs_hlsl;
   blob_t convert_yuv444_planar_ps_hlsl;
   blob_t convert_yuv444_planar_ps_linear_hlsl;
@@ -501,20 +506,35 @@ namespace platf::dxgi {
 
       const bool downscaling = display->width > width || display->height > height;
 
+      // The 8-bit formats are only streamed in SDR, which may come from an HDR display
+      const bool tone_mapping = display->is_hdr() && config::video.hdr_tone_mapping;
+
       switch (format) {
         case DXGI_FORMAT_NV12:
           // Semi-planar 8-bit YUV 4:2:0
           create_vertex_shader_helper(convert_yuv420_planar_y_vs_hlsl, convert_Y_or_YUV_vs);
           create_pixel_shader_helper(convert_yuv420_planar_y_ps_hlsl, convert_Y_or_YUV_ps);
-          create_pixel_shader_helper(convert_yuv420_planar_y_ps_linear_hlsl, convert_Y_or_YUV_fp16_ps);
+          if (tone_mapping) {
+            create_pixel_shader_helper(convert_yuv420_planar_y_ps_tone_mapped_hlsl, convert_Y_or_YUV_fp16_ps);
+          } else {
+            create_pixel_shader_helper(convert_yuv420_planar_y_ps_linear_hlsl, convert_Y_or_YUV_fp16_ps);
+          }
           if (downscaling) {
             create_vertex_shader_helper(convert_yuv420_packed_uv_type0s_vs_hlsl, convert_UV_vs);
             create_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps_hlsl, convert_UV_ps);
-            create_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps_linear_hlsl, convert_UV_fp16_ps);
+            if (tone_mapping) {
+              create_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps_tone_mapped_hlsl, convert_UV_fp16_ps);
+            } else {
+              create_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps_linear_hlsl, convert_UV_fp16_ps);
+            }
           } else {
             create_vertex_shader_helper(convert_yuv420_packed_uv_type0_vs_hlsl, convert_UV_vs);
             create_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_hlsl, convert_UV_ps);
-            create_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_linear_hlsl, convert_UV_fp16_ps);
+            if (tone_mapping) {
+              create_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_tone_mapped_hlsl, convert_UV_fp16_ps);
+            } else {
+              create_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_linear_hlsl, convert_UV_fp16_ps);
+            }
           }
           break;
 
@@ -561,7 +581,11 @@ namespace platf::dxgi {
           // Packed 8-bit YUV 4:4:4
           create_vertex_shader_helper(convert_yuv444_packed_vs_hlsl, convert_Y_or_YUV_vs);
           create_pixel_shader_helper(convert_yuv444_packed_ayuv_ps_hlsl, convert_Y_or_YUV_ps);
-          create_pixel_shader_helper(convert_yuv444_packed_ayuv_ps_linear_hlsl, convert_Y_or_YUV_fp16_ps);
+          if (tone_mapping) {
+            create_pixel_shader_helper(convert_yuv444_packed_ayuv_ps_tone_mapped_hlsl, convert_Y_or_YUV_fp16_ps);
+          } else {
+            create_pixel_shader_helper(convert_yuv444_packed_ayuv_ps_linear_hlsl, convert_Y_or_YUV_fp16_ps);
+          }
           break;
 
         case DXGI_FORMAT_Y410:
@@ -583,6 +607,21 @@ namespace platf::dxgi {
 #undef create_vertex_shader_helper
 #undef create_pixel_shader_helper
 
+      if (tone_mapping) {
+        // The highlights are rolled off from the SDR white level to the peak of the display
+        SS_HDR_METADATA metadata;
+        float peak_nits = display->get_hdr_metadata(metadata) && metadata.maxDisplayLuminance ? metadata.maxDisplayLuminance : 1000.0f;
+        float tone_map_data[16 / sizeof(float)] {(float) config::video.sdr_white_level, peak_nits};  // aligned to 16-byte
+        tone_map = make_buffer(device.get(), tone_map_data);
+        if (!tone_map) {
+          BOOST_LOG(error) << "Failed to create tone mapping pixel constant buffer";
+          return -1;
+        }
+        device_ctx->PSSetConstantBuffers(1, 1, &tone_map);
+
+        BOOST_LOG(info) << "Tone mapping the HDR display to SDR, from "sv << peak_nits << " to "sv << config::video.sdr_white_level << " nits"sv;
+      }
+
       auto out_width = width;
       auto out_height = height;
 
@@ -825,9 +864,45 @@ namespace platf::dxgi {
       device_ctx->PSSetSamplers(0, 1, &sampler_linear);
       device_ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
+      DXGI_ADAPTER_DESC adapter_desc;
+      adapter_p->GetDesc(&adapter_desc);
+      adapter_luid = adapter_desc.AdapterLuid;
+
       return 0;
     }
 
+    /**
+     * @brief Release the display, which can't be duplicated twice, while the device is pooled.
+     */
+    bool detach_display() {
+      detached_mode = {display->width, display->height, display->display_rotation, display->is_hdr()};
+
+      // The shared textures belong to the display
+      img_ctx_map.clear();
+      display.reset();
+
+      return true;
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &display) {
+      auto new_display = std::dynamic_pointer_cast<display_base_t>(display);
+      if (!new_display) {
+        return false;
+      }
+
+      DXGI_ADAPTER_DESC adapter_desc;
+      new_display->adapter->GetDesc(&adapter_desc);
+
+      // The shaders and viewports were set up for the mode of the old display, on its adapter
+      if (adapter_desc.AdapterLuid.LowPart != adapter_luid.LowPart || adapter_desc.AdapterLuid.HighPart != adapter_luid.HighPart ||
+          detached_mode != std::tuple {new_display->width, new_display->height, new_display->display_rotation, new_display->is_hdr()}) {
+        return false;
+      }
+
+      this->display = std::move(new_display);
+      return true;
+    }
+
     struct encoder_img_ctx_t {
       // Used to determine if the underlying texture changes.
       // Not safe for actual use by the encoder!
@@ -931,6 +1006,7 @@ namespace platf::dxgi {
 
     buf_t subsample_offset;
     buf_t color_matrix;
+    buf_t tone_map;
 
     blend_t blend_disable;
     sampler_state_t sampler_linear;
@@ -946,6 +1022,8 @@ namespace platf::dxgi {
     std::map<uint32_t, encoder_img_ctx_t> img_ctx_map;
 
     std::shared_ptr<display_base_t> display;
+    LUID adapter_luid {};
+    std::tuple<int, int, DXGI_MODE_ROTATION, bool> detached_mode;
 
     vs_t convert_Y_or_YUV_vs;
     ps_t convert_Y_or_YUV_ps;
@@ -978,6 +1056,14 @@ namespace platf::dxgi {
       return base.convert(img_base);
     }
 
+    bool detach_display() override {
+      return base.detach_display();
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &display) override {
+      return base.attach_display(display);
+    }
+
     void apply_colorspace() override {
       base.apply_colorspace(colorspace);
     }
@@ -1070,8 +1156,11 @@ namespace platf::dxgi {
       }
 
       if (pix_fmt == pix_fmt_e::yuv444p16) {
+        // NVENC takes no Direct3D11 surface format for planar 16-bit 4:4:4
+        BOOST_LOG(info) << "NvENC: 10-bit 4:4:4 is copied from Direct3D11 to CUDA for encoding"sv;
         nvenc_d3d = std::make_unique<nvenc::nvenc_d3d11_on_cuda>(base.device.get());
       } else {
+        BOOST_LOG(debug) << "NvENC: encoding the Direct3D11 surface natively"sv;
         nvenc_d3d = std::make_unique<nvenc::nvenc_d3d11_native>(base.device.get());
       }
       nvenc = nvenc_d3d.get();
@@ -1085,7 +1174,9 @@ namespace platf::dxgi {
       }
 
       auto nvenc_colorspace = nvenc::nvenc_colorspace_from_sunshine_colorspace(colorspace);
-      if (!nvenc_d3d->create_encoder(config::video.nv, client_config, nvenc_colorspace, buffer_format)) {
+      // Encoders that overran their frame time are opened a few quality levels down
+      auto nvenc_config = nvenc::at_quality_level(config::video.nv, client_config.quality_level);
+      if (!nvenc_d3d->create_encoder(nvenc_config, client_config, nvenc_colorspace, buffer_format)) {
         return false;
       }
 
@@ -1097,6 +1188,14 @@ namespace platf::dxgi {
       return base.convert(img_base);
     }
 
+    bool detach_display() override {
+      return base.detach_display();
+    }
+
+    bool attach_display(const std::shared_ptr<platf::display_t> &display) override {
+      return base.attach_display(display);
+    }
+
   private:
     d3d_base_encode_device base;
     std::unique_ptr<nvenc::nvenc_d3d11> nvenc_d3d;
@@ -1203,6 +1302,13 @@ namespace platf::dxgi {
 
     const bool blend_mouse_cursor_flag = (cursor_alpha.visible || cursor_xor.visible) && cursor_visible;
 
+    // With the mouse cursor hidden or drawn by the client, a pointer update without a new frame
+    // leaves the last image as it was sent, so there's nothing to convert and encode again.
+    // The last image never has the mouse cursor blended onto it, only the intermediate surface does.
+    if (!frame_update_flag && !blend_mouse_cursor_flag && std::holds_alternative<std::shared_ptr<platf::img_t>>(last_frame_variant)) {
+      return capture_e::timeout;
+    }
+
     texture2d_t src {};
     if (frame_update_flag) {
       // Get the texture object from this frame
@@ -1597,7 +1703,8 @@ namespace platf::dxgi {
       device_ctx->VSSetConstantBuffers(2, 1, &rotation);
     }
 
-    if (config.dynamicRange && is_hdr()) {
+    const bool tone_mapping = !config.dynamicRange && is_hdr() && config::video.hdr_tone_mapping;
+    if ((config.dynamicRange || tone_mapping) && is_hdr()) {
       // This shader will normalize scRGB white levels to a user-defined white level
       status = device->CreatePixelShader(cursor_ps_normalize_white_hlsl->GetBufferPointer(), cursor_ps_normalize_white_hlsl->GetBufferSize(), nullptr, &cursor_ps);
       if (status) {
@@ -1608,7 +1715,9 @@ namespace platf::dxgi {
       // Use a 300 nit target for the mouse cursor. We should really get
       // the user's SDR white level in nits, but there is no API that
       // provides that information to Win32 apps.
-      float white_multiplier_data[16 / sizeof(float)] {300.0f / 80.f};  // aligned to 16-byte
+      // Tone mapping maps the SDR white level to SDR white, so the cursor is drawn at that level.
+      float white_nits = tone_mapping ? (float) config::video.sdr_white_level : 300.0f;
+      float white_multiplier_data[16 / sizeof(float)] {white_nits / 80.f};  // aligned to 16-byte
       auto white_multiplier = make_buffer(device.get(), white_multiplier_data);
       if (!white_multiplier) {
         BOOST_LOG(warning) << "Failed to create cursor blending (normalized white) white multiplier constant buffer";
@@ -1948,17 +2057,21 @@ namespace platf::dxgi {
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps);
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_linear);
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_perceptual_quantizer);
+    compile_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps_tone_mapped);
     compile_vertex_shader_helper(convert_yuv420_packed_uv_type0_vs);
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps);
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps_linear);
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps_perceptual_quantizer);
+    compile_pixel_shader_helper(convert_yuv420_packed_uv_type0s_ps_tone_mapped);
     compile_vertex_shader_helper(convert_yuv420_packed_uv_type0s_vs);
     compile_pixel_shader_helper(convert_yuv420_planar_y_ps);
     compile_pixel_shader_helper(convert_yuv420_planar_y_ps_linear);
     compile_pixel_shader_helper(convert_yuv420_planar_y_ps_perceptual_quantizer);
+    compile_pixel_shader_helper(convert_yuv420_planar_y_ps_tone_mapped);
     compile_vertex_shader_helper(convert_yuv420_planar_y_vs);
     compile_pixel_shader_helper(convert_yuv444_packed_ayuv_ps);
     compile_pixel_shader_helper(convert_yuv444_packed_ayuv_ps_linear);
+    compile_pixel_shader_helper(convert_yuv444_packed_ayuv_ps_tone_mapped);
     compile_vertex_shader_helper(convert_yuv444_packed_vs);
     compile_pixel_shader_helper(convert_yuv444_planar_ps);
     compile_pixel_shader_helper(convert_yuv444_planar_ps_linear);
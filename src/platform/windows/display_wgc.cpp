@@ -16,6 +16,7 @@
 // local includes
 #include "display.h"
 #include "misc.h"
+#include "src/config.h"
 #include "src/logging.h"
 
 namespace platf {
@@ -121,7 +122,8 @@ namespace platf::dxgi {
     }
 
     try {
-      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), 2, item.Size());
+      // The compositor renders into a free buffer of the pool while the capture thread holds on to the frame it's encoding
+      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), config::video.wgc_capture_buffers, item.Size());
       capture_session = frame_pool.CreateCaptureSession(item);
       frame_pool.FrameArrived({this, &wgc_capture_t::on_frame_arrived});
     } catch (winrt::hresult_error &e) {
@@ -327,7 +329,7 @@ namespace platf::dxgi {
       return capture_e::error;
     }
 
-    std::copy_n((std::uint8_t *) img_info.pData, height * img_info.RowPitch, (std::uint8_t *) img->data);
+    image_copy.copy((const std::uint8_t *) img_info.pData, img->data, (std::size_t) height * img_info.RowPitch);
 
     // Unmap the staging texture to allow GPU access again
     device_ctx->Unmap(texture.get(), 0);
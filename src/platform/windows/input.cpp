@@ -9,7 +9,9 @@
 
 // standard includes
 #include <cmath>
+#include <cstring>
 #include <thread>
+#include <vector>
 
 // lib includes
 #include <ViGEm/Client.h>
@@ -83,6 +85,7 @@ namespace platf {
 
     uint8_t client_relative_index;
 
+    // The next report queued on the task_pool, a DS4 timestamp repeat or a coalesced report
     thread_pool_util::ThreadPool::task_id_t repeat_task {};
     std::chrono::steady_clock::time_point last_report_ts;
 
@@ -470,14 +473,23 @@ namespace platf {
     return result;
   }
 
+  // The input queued by this thread between begin_input_batch() and end_input_batch()
+  thread_local bool batching_input = false;
+  thread_local std::vector<INPUT> input_batch;
+
   /**
    * @brief Calls SendInput() and switches input desktops if required.
-   * @param i The `INPUT` struct to send.
+   * @param inputs The `INPUT` structs to send.
+   * @param count The number of elements in `inputs`.
    */
-  void send_input(INPUT &i) {
+  void send_inputs(INPUT *inputs, UINT count) {
   retry:
-    auto send = SendInput(1, &i, sizeof(INPUT));
-    if (send != 1) {
+    auto send = SendInput(count, inputs, sizeof(INPUT));
+    if (send != count) {
+      // SendInput() stops at the first input blocked, send the rest on the new desktop
+      inputs += send;
+      count -= send;
+
       auto hDesk = syncThreadDesktop();
       if (_lastKnownInputDesktop != hDesk) {
         _lastKnownInputDesktop = hDesk;
@@ -487,6 +499,32 @@ namespace platf {
     }
   }
 
+  /**
+   * @brief Calls SendInput(), or queues the input while this thread is batching input.
+   * @param i The `INPUT` struct to send.
+   */
+  void send_input(INPUT &i) {
+    if (batching_input) {
+      input_batch.push_back(i);
+      return;
+    }
+
+    send_inputs(&i, 1);
+  }
+
+  void begin_input_batch(input_t &input) {
+    batching_input = true;
+  }
+
+  void end_input_batch(input_t &input) {
+    batching_input = false;
+
+    if (!input_batch.empty()) {
+      send_inputs(input_batch.data(), input_batch.size());
+      input_batch.clear();
+    }
+  }
+
   /**
    * @brief Calls InjectSyntheticPointerInput() and switches input desktops if required.
    * @details Must only be called if InjectSyntheticPointerInput() is available.
@@ -849,7 +887,7 @@ namespace platf {
       BOOST_LOG(warning) << "Failed to refresh virtual touch input: "sv << err;
     }
 
-    raw->touchRepeatTask = task_pool.pushDelayed(repeat_touch, ISPI_REPEAT_INTERVAL, raw).task_id;
+    raw->touchRepeatTask = task_pool.pushDelayed(thread_pool_util::priority_e::high, repeat_touch, ISPI_REPEAT_INTERVAL, raw).task_id;
   }
 
   /**
@@ -862,7 +900,7 @@ namespace platf {
       BOOST_LOG(warning) << "Failed to refresh virtual pen input: "sv << err;
     }
 
-    raw->penRepeatTask = task_pool.pushDelayed(repeat_pen, ISPI_REPEAT_INTERVAL, raw).task_id;
+    raw->penRepeatTask = task_pool.pushDelayed(thread_pool_util::priority_e::high, repeat_pen, ISPI_REPEAT_INTERVAL, raw).task_id;
   }
 
   /**
@@ -1021,7 +1059,7 @@ namespace platf {
 
     // If we still have an active touch, refresh the touch state periodically
     if (raw->activeTouchSlots > 1 || touchInfo.pointerInfo.pointerFlags != POINTER_FLAG_NONE) {
-      raw->touchRepeatTask = task_pool.pushDelayed(repeat_touch, ISPI_REPEAT_INTERVAL, raw).task_id;
+      raw->touchRepeatTask = task_pool.pushDelayed(thread_pool_util::priority_e::high, repeat_touch, ISPI_REPEAT_INTERVAL, raw).task_id;
     }
   }
 
@@ -1140,7 +1178,7 @@ namespace platf {
 
     // If we still have an active pen interaction, refresh the pen state periodically
     if (penInfo.pointerInfo.pointerFlags != POINTER_FLAG_NONE) {
-      raw->penRepeatTask = task_pool.pushDelayed(repeat_pen, ISPI_REPEAT_INTERVAL, raw).task_id;
+      raw->penRepeatTask = task_pool.pushDelayed(thread_pool_util::priority_e::high, repeat_pen, ISPI_REPEAT_INTERVAL, raw).task_id;
     }
   }
 
@@ -1462,6 +1500,13 @@ namespace platf {
 
     if (gamepad.gp && vigem_target_is_attached(gamepad.gp.get())) {
       auto now = std::chrono::steady_clock::now();
+
+      // Coalesce faster reports into the latest one, sent once the interval is over
+      if (now - gamepad.last_report_ts < config::input.gamepad_report_interval) {
+        gamepad.repeat_task = task_pool.pushDelayed(thread_pool_util::priority_e::high, ds4_update_ts_and_send, gamepad.last_report_ts + config::input.gamepad_report_interval - now, vigem, nr).task_id;
+        return;
+      }
+
       auto delta_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - gamepad.last_report_ts);
 
       // Timestamp is reported in 5.333us units
@@ -1476,7 +1521,27 @@ namespace platf {
 
       // Repeat at least every 100ms to keep the 16-bit timestamp field from overflowing
       gamepad.last_report_ts = now;
-      gamepad.repeat_task = task_pool.pushDelayed(ds4_update_ts_and_send, 100ms, vigem, nr).task_id;
+      gamepad.repeat_task = task_pool.pushDelayed(thread_pool_util::priority_e::high, ds4_update_ts_and_send, 100ms, vigem, nr).task_id;
+    }
+  }
+
+  /**
+   * @brief Sends the X360 report of a gamepad, which may be queued on the task_pool.
+   * @param vigem The global ViGEm context object.
+   * @param nr The global gamepad index.
+   */
+  void x360_send(vigem_t *vigem, int nr) {
+    auto &gamepad = vigem->gamepads[nr];
+
+    gamepad.repeat_task = nullptr;
+    if (!gamepad.gp) {
+      return;
+    }
+
+    gamepad.last_report_ts = std::chrono::steady_clock::now();
+    auto status = vigem_target_x360_update(vigem->client.get(), gamepad.gp.get(), gamepad.report.x360);
+    if (!VIGEM_SUCCESS(status)) {
+      BOOST_LOG(warning) << "Couldn't send gamepad input to ViGEm ["sv << util::hex(status).to_string_view() << ']';
     }
   }
 
@@ -1499,16 +1564,34 @@ namespace platf {
       return;
     }
 
-    VIGEM_ERROR status;
+    // A report identical to the last one was sent already, or is about to be
+    auto last_report = gamepad.report;
 
     if (vigem_target_get_type(gamepad.gp.get()) == Xbox360Wired) {
       x360_update_state(gamepad, gamepad_state);
-      status = vigem_target_x360_update(vigem->client.get(), gamepad.gp.get(), gamepad.report.x360);
-      if (!VIGEM_SUCCESS(status)) {
-        BOOST_LOG(warning) << "Couldn't send gamepad input to ViGEm ["sv << util::hex(status).to_string_view() << ']';
+      if (!std::memcmp(&last_report.x360, &gamepad.report.x360, sizeof(XUSB_REPORT))) {
+        return;
       }
+
+      // A pending report sends the latest state
+      if (gamepad.repeat_task) {
+        return;
+      }
+
+      // Coalesce faster reports into the latest one, sent once the interval is over
+      auto now = std::chrono::steady_clock::now();
+      if (now - gamepad.last_report_ts < config::input.gamepad_report_interval) {
+        gamepad.repeat_task = task_pool.pushDelayed(thread_pool_util::priority_e::high, x360_send, gamepad.last_report_ts + config::input.gamepad_report_interval - now, vigem, nr).task_id;
+        return;
+      }
+
+      x360_send(vigem, nr);
     } else {
       ds4_update_state(gamepad, gamepad_state);
+      if (!std::memcmp(&last_report.ds4, &gamepad.report.ds4, sizeof(DS4_REPORT_EX))) {
+        return;
+      }
+
       ds4_update_ts_and_send(vigem, nr);
     }
   }
@@ -3,12 +3,17 @@
  * @brief Miscellaneous definitions for Windows.
  */
 // standard includes
+#include <algorithm>
 #include <csignal>
 #include <filesystem>
 #include <iomanip>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
+#include <thread>
 
 #ifndef BOOST_PROCESS_VERSION
  #define BOOST_PROCESS_VERSION 1
@@ -25,7 +30,9 @@
 // prevent clang format from "optimizing" the header include order
 // clang-format off
 #include <dwmapi.h>
+#include <dxgi1_4.h>
 #include <iphlpapi.h>
+#include <MSWSock.h>
 #include <iterator>
 #include <timeapi.h>
 #include <UserEnv.h>
@@ -1105,6 +1112,186 @@ namespace platf {
     }
   }
 
+  namespace {
+    /**
+     * @brief Call a function with the logical CPU number of each processor in a group affinity.
+     * @details Logical CPUs are numbered across processor groups of 64.
+     */
+    template<class F>
+    void for_each_cpu(const GROUP_AFFINITY &affinity, F &&f) {
+      for (int bit = 0; bit < 64; ++bit) {
+        if (affinity.Mask & ((KAFFINITY) 1 << bit)) {
+          f(affinity.Group * 64 + bit);
+        }
+      }
+    }
+  }  // namespace
+
+  std::vector<cpu_info_t> cpu_topology() {
+    DWORD size = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &size);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+      return {};
+    }
+
+    std::vector<std::uint8_t> buffer(size);
+    if (!GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) buffer.data(), &size)) {
+      auto winerr = GetLastError();
+      BOOST_LOG(warning) << "GetLogicalProcessorInformationEx() failed: "sv << winerr;
+      return {};
+    }
+
+    std::map<int, cpu_info_t> cpus;
+    std::map<int, int> l3_domains;
+    std::map<int, int> numa_nodes;
+    for (DWORD offset = 0; offset < size;) {
+      auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX) (buffer.data() + offset);
+      offset += info->Size;
+
+      switch (info->Relationship) {
+        case RelationProcessorCore:
+          {
+            // The core is named after its first CPU
+            int first = -1;
+            for (WORD group = 0; group < info->Processor.GroupCount; ++group) {
+              for_each_cpu(info->Processor.GroupMask[group], [&](int id) {
+                if (first < 0) {
+                  first = id;
+                }
+                cpus[id] = cpu_info_t {id, -1, -1, info->Processor.EfficiencyClass, first};
+              });
+            }
+          }
+          break;
+        case RelationCache:
+          if (info->Cache.Level == 3) {
+            // The L3 domain is named after its first CPU
+            int first = -1;
+            for_each_cpu(info->Cache.GroupMask, [&](int id) {
+              if (first < 0) {
+                first = id;
+              }
+              l3_domains[id] = first;
+            });
+          }
+          break;
+        case RelationNumaNode:
+          for_each_cpu(info->NumaNode.GroupMask, [&](int id) {
+            numa_nodes[id] = (int) info->NumaNode.NodeNumber;
+          });
+          break;
+        default:
+          break;
+      }
+    }
+
+    // Leave out the CPUs the process may not run on, which is only known for hosts with a single processor group
+    DWORD_PTR process_mask = ~(DWORD_PTR) 0;
+    DWORD_PTR system_mask;
+    if (GetActiveProcessorGroupCount() > 1 || !GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+      process_mask = ~(DWORD_PTR) 0;
+    }
+
+    std::vector<cpu_info_t> topology;
+    for (auto &[id, cpu] : cpus) {
+      if (id < 64 && !(process_mask & ((DWORD_PTR) 1 << id))) {
+        continue;
+      }
+
+      if (auto it = l3_domains.find(id); it != std::end(l3_domains)) {
+        cpu.l3_domain = it->second;
+      }
+      if (auto it = numa_nodes.find(id); it != std::end(numa_nodes)) {
+        cpu.numa_node = it->second;
+      }
+      topology.emplace_back(cpu);
+    }
+
+    return topology;
+  }
+
+  int gpu_numa_node() {
+    // DXGI doesn't report which node an adapter is attached to
+    return -1;
+  }
+
+  std::vector<std::string> encode_gpus() {
+    // The encoders take the adapter their display duplicates on
+    return {};
+  }
+
+  std::vector<metrics::gpu_metrics_t> sample_gpus() {
+    auto release = [](auto *p) {
+      p->Release();
+    };
+
+    std::vector<metrics::gpu_metrics_t> gpus;
+
+    IDXGIFactory1 *factory_p;
+    if (FAILED(CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory_p))) {
+      return gpus;
+    }
+    std::unique_ptr<IDXGIFactory1, decltype(release)> factory {factory_p, release};
+
+    IDXGIAdapter1 *adapter_p;
+    for (UINT x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+      std::unique_ptr<IDXGIAdapter1, decltype(release)> adapter {adapter_p, release};
+
+      DXGI_ADAPTER_DESC1 desc;
+      if (FAILED(adapter->GetDesc1(&desc)) || desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) {
+        continue;
+      }
+
+      // The budget is what the OS lets this process have of the dedicated memory
+      IDXGIAdapter3 *adapter3_p;
+      if (FAILED(adapter->QueryInterface(IID_IDXGIAdapter3, (void **) &adapter3_p))) {
+        continue;
+      }
+      std::unique_ptr<IDXGIAdapter3, decltype(release)> adapter3 {adapter3_p, release};
+
+      DXGI_QUERY_VIDEO_MEMORY_INFO info;
+      if (FAILED(adapter3->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info))) {
+        continue;
+      }
+
+      metrics::gpu_metrics_t sample;
+      sample.gpu = to_utf8(desc.Description);
+      sample.memory_used_bytes = (std::int64_t) info.CurrentUsage;
+      sample.memory_budget_bytes = (std::int64_t) info.Budget;
+      gpus.emplace_back(std::move(sample));
+    }
+
+    return gpus;
+  }
+
+  std::string gpu_by_pci_address(unsigned int, unsigned int, unsigned int) {
+    // DXGI names adapters by their description, as NVML does
+    return {};
+  }
+
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    if (cpus.empty()) {
+      return false;
+    }
+
+    // A thread runs in a single processor group, the one of the first CPU
+    GROUP_AFFINITY affinity {};
+    affinity.Group = (WORD) (cpus.front() / 64);
+    for (auto cpu : cpus) {
+      if (cpu / 64 == affinity.Group) {
+        affinity.Mask |= (KAFFINITY) 1 << (cpu % 64);
+      }
+    }
+
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr)) {
+      auto winerr = GetLastError();
+      BOOST_LOG(debug) << "SetThreadGroupAffinity() failed: "sv << winerr;
+      return false;
+    }
+
+    return true;
+  }
+
   void streaming_will_start() {
     static std::once_flag load_wlanapi_once_flag;
     std::call_once(load_wlanapi_once_flag, []() {
@@ -1378,6 +1565,143 @@ namespace platf {
     return accounting_info.ActiveProcesses != 0;
   }
 
+  namespace {
+    /**
+     * @brief Waits for a process handle to be signaled on the thread pool.
+     */
+    class process_wait_t: public process_watcher_t {
+    public:
+      explicit process_wait_t(std::function<void()> &&exited):
+          _exited {std::move(exited)} {
+      }
+
+      bool wait(HANDLE process) {
+        return RegisterWaitForSingleObject(&_wait, process, &process_wait_t::signaled, this, INFINITE, WT_EXECUTEONLYONCE);
+      }
+
+      ~process_wait_t() override {
+        // Also waits for a callback that already started
+        if (_wait) {
+          UnregisterWaitEx(_wait, INVALID_HANDLE_VALUE);
+        }
+      }
+
+    private:
+      static VOID CALLBACK signaled(PVOID context, BOOLEAN) {
+        ((process_wait_t *) context)->_exited();
+      }
+
+      HANDLE _wait {nullptr};
+      std::function<void()> _exited;
+    };
+
+    /**
+     * @brief Waits on the completion port of a job object for its last process to exit.
+     */
+    class job_watcher_t: public process_watcher_t {
+    public:
+      job_watcher_t(HANDLE port, HANDLE job, std::function<void()> &&exited):
+          _port {port} {
+        _thread = std::thread {[port, job, exited = std::move(exited)]() {
+          // The job may have emptied before the port was associated with it
+          if (!process_group_running((std::uintptr_t) job)) {
+            exited();
+            return;
+          }
+
+          DWORD message;
+          ULONG_PTR key;
+          LPOVERLAPPED overlapped;
+          while (GetQueuedCompletionStatus(port, &message, &key, &overlapped, INFINITE)) {
+            // Anything but job notifications comes from the destructor
+            if (key != (ULONG_PTR) job) {
+              return;
+            }
+
+            if (message == JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO) {
+              exited();
+              return;
+            }
+          }
+        }};
+      }
+
+      ~job_watcher_t() override {
+        PostQueuedCompletionStatus(_port, 0, 0, nullptr);
+        _thread.join();
+
+        CloseHandle(_port);
+      }
+
+    private:
+      HANDLE _port;
+      std::thread _thread;
+    };
+  }  // namespace
+
+  std::unique_ptr<process_watcher_t> watch_process_exit(std::uintptr_t process, std::uintptr_t group, std::function<void()> &&exited) {
+    if (!group) {
+      auto watcher = std::make_unique<process_wait_t>(std::move(exited));
+      if (!watcher->wait((HANDLE) process)) {
+        BOOST_LOG(warning) << "Couldn't wait for the app to exit: "sv << GetLastError();
+        return nullptr;
+      }
+
+      return watcher;
+    }
+
+    auto port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (!port) {
+      BOOST_LOG(warning) << "Couldn't create a completion port for the app: "sv << GetLastError();
+      return nullptr;
+    }
+
+    // A job reports to a single completion port, keyed with its handle
+    JOBOBJECT_ASSOCIATE_COMPLETION_PORT association {(PVOID) group, port};
+    if (!SetInformationJobObject((HANDLE) group, JobObjectAssociateCompletionPortInformation, &association, sizeof(association))) {
+      BOOST_LOG(warning) << "Couldn't associate the job of the app with a completion port: "sv << GetLastError();
+      CloseHandle(port);
+      return nullptr;
+    }
+
+    return std::make_unique<job_watcher_t>(port, (HANDLE) group, std::move(exited));
+  }
+
+  std::unique_ptr<app_isolation_t> isolate_app(std::uintptr_t process, std::uintptr_t group, const std::vector<int> &cpus, int cpu_weight) {
+    // The restrictions apply to the job, which lives as long as the app
+    if (!group) {
+      return nullptr;
+    }
+
+    if (cpu_weight != 100) {
+      // Jobs weigh 1 to 9 against the 5 of processes outside of one
+      JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate {};
+      rate.ControlFlags = JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_WEIGHT_BASED;
+      rate.Weight = std::clamp((cpu_weight * 5 + 50) / 100, 1, 9);
+      if (!SetInformationJobObject((HANDLE) group, JobObjectCpuRateControlInformation, &rate, sizeof(rate))) {
+        BOOST_LOG(warning) << "Couldn't set the CPU weight of the app: "sv << GetLastError();
+      }
+    }
+
+    // The affinity of a job is limited to the processor group Apollo runs in
+    if (!cpus.empty() && cpus.back() < 64) {
+      JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits {};
+      if (QueryInformationJobObject((HANDLE) group, JobObjectExtendedLimitInformation, &limits, sizeof(limits), nullptr)) {
+        limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_AFFINITY;
+        limits.BasicLimitInformation.Affinity = 0;
+        for (auto cpu : cpus) {
+          limits.BasicLimitInformation.Affinity |= (ULONG_PTR) 1 << cpu;
+        }
+
+        if (!SetInformationJobObject((HANDLE) group, JobObjectExtendedLimitInformation, &limits, sizeof(limits))) {
+          BOOST_LOG(warning) << "Couldn't keep the app off the reserved CPUs: "sv << GetLastError();
+        }
+      }
+    }
+
+    return std::make_unique<app_isolation_t>();
+  }
+
   SOCKADDR_IN to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     SOCKADDR_IN saddr_v4 = {};
 
@@ -1403,9 +1727,316 @@ namespace platf {
     return saddr_v6;
   }
 
-  // Use UDP segmentation offload if it is supported by the OS. If the NIC is capable, this will use
-  // hardware acceleration to reduce CPU usage. Support for USO was introduced in Windows 10 20H1.
+  namespace {
+    // Each packet of a Registered I/O send is copied into a slot of registered memory,
+    // which holds its destination and source address in front of it
+    constexpr std::size_t rio_address_size = 32;
+    constexpr std::size_t rio_control_size = 64;
+    constexpr std::size_t rio_packet_offset = rio_address_size + rio_control_size;
+    constexpr std::size_t rio_slot_size = 2048;
+    constexpr std::size_t rio_slot_count = 4096;
+
+    static_assert(sizeof(SOCKADDR_INET) <= rio_address_size);
+    static_assert(WSA_CMSG_SPACE(sizeof(IN6_PKTINFO)) <= rio_control_size);
+
+    // How long a batch waits for the slots of earlier sends to complete before it's sent without Registered I/O
+    constexpr auto rio_slot_timeout = 10ms;
+
+    /**
+     * @brief The queues and registered send buffers of a socket opened for Registered I/O.
+     */
+    class rio_socket_t {
+    public:
+      ~rio_socket_t() {
+        if (cq != RIO_INVALID_CQ) {
+          rio.RIOCloseCompletionQueue(cq);
+        }
+
+        if (buffer_id != RIO_INVALID_BUFFERID) {
+          rio.RIODeregisterBuffer(buffer_id);
+        }
+
+        if (memory) {
+          VirtualFree(memory, 0, MEM_RELEASE);
+        }
+      }
+
+      /**
+       * @brief Create the queues of a socket and register its send buffers.
+       * @param sock The socket, which must have been created with `WSA_FLAG_REGISTERED_IO`.
+       * @return `true` on success.
+       */
+      bool init(SOCKET sock) {
+        GUID guid = WSAID_MULTIPLE_RIO;
+        DWORD bytes = 0;
+        if (WSAIoctl(sock, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &rio, sizeof(rio), &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+          BOOST_LOG(warning) << "Couldn't get the Registered I/O functions: "sv << WSAGetLastError();
+          return false;
+        }
+
+        memory = (char *) VirtualAlloc(nullptr, rio_slot_size * rio_slot_count, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!memory) {
+          BOOST_LOG(warning) << "Couldn't allocate Registered I/O buffers: "sv << GetLastError();
+          return false;
+        }
+
+        buffer_id = rio.RIORegisterBuffer(memory, rio_slot_size * rio_slot_count);
+        if (buffer_id == RIO_INVALID_BUFFERID) {
+          BOOST_LOG(warning) << "RIORegisterBuffer() failed: "sv << WSAGetLastError();
+          return false;
+        }
+
+        // Completions are polled by the sending threads, so no notification is needed
+        cq = rio.RIOCreateCompletionQueue(rio_slot_count + 1, nullptr);
+        if (cq == RIO_INVALID_CQ) {
+          BOOST_LOG(warning) << "RIOCreateCompletionQueue() failed: "sv << WSAGetLastError();
+          return false;
+        }
+
+        // Nothing is received through Registered I/O, but the queue needs room for one receive
+        rq = rio.RIOCreateRequestQueue(sock, 1, 1, rio_slot_count, 1, cq, cq, nullptr);
+        if (rq == RIO_INVALID_RQ) {
+          BOOST_LOG(warning) << "RIOCreateRequestQueue() failed: "sv << WSAGetLastError();
+          return false;
+        }
+
+        free_slots.reserve(rio_slot_count);
+        for (ULONG x = 0; x < rio_slot_count; ++x) {
+          free_slots.push_back(x);
+        }
+
+        return true;
+      }
+
+      /**
+       * @brief Send a batch of packets with a single kernel transition.
+       * @param send_info The batch.
+       * @return `false` if nothing was sent, and the batch has to be sent another way.
+       */
+      bool send(batched_send_info_t &send_info) {
+        auto packet_size = send_info.header_size + send_info.payload_size;
+        if (packet_size > rio_slot_size - rio_packet_offset || send_info.block_count > rio_slot_count) {
+          return false;
+        }
+
+        char address[rio_address_size] {};
+        if (send_info.target_address.is_v6()) {
+          auto taddr = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+          memcpy(address, &taddr, sizeof(taddr));
+        } else {
+          auto taddr = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
+          memcpy(address, &taddr, sizeof(taddr));
+        }
+
+        char control[rio_control_size] {};
+        auto cm = (WSACMSGHDR *) control;
+        ULONG control_len;
+        if (send_info.source_address.is_v6()) {
+          IN6_PKTINFO pktInfo {};
+          pktInfo.ipi6_addr = to_sockaddr(send_info.source_address.to_v6(), 0).sin6_addr;
+
+          cm->cmsg_level = IPPROTO_IPV6;
+          cm->cmsg_type = IPV6_PKTINFO;
+          cm->cmsg_len = WSA_CMSG_LEN(sizeof(pktInfo));
+          memcpy(WSA_CMSG_DATA(cm), &pktInfo, sizeof(pktInfo));
+          control_len = WSA_CMSG_SPACE(sizeof(pktInfo));
+        } else {
+          IN_PKTINFO pktInfo {};
+          pktInfo.ipi_addr = to_sockaddr(send_info.source_address.to_v4(), 0).sin_addr;
+
+          cm->cmsg_level = IPPROTO_IP;
+          cm->cmsg_type = IP_PKTINFO;
+          cm->cmsg_len = WSA_CMSG_LEN(sizeof(pktInfo));
+          memcpy(WSA_CMSG_DATA(cm), &pktInfo, sizeof(pktInfo));
+          control_len = WSA_CMSG_SPACE(sizeof(pktInfo));
+        }
+
+        std::lock_guard lg {lock};
+
+        if (!wait_for_slots(send_info.block_count)) {
+          BOOST_LOG_HOT(verbose) << "Registered I/O send buffers are full"sv;
+          return false;
+        }
+
+        for (std::size_t x = 0; x < send_info.block_count; ++x) {
+          auto block = send_info.block_offset + x;
+
+          auto slot = free_slots.back();
+          auto slot_offset = (ULONG) (slot * rio_slot_size);
+          auto data = memory + slot_offset;
+
+          memcpy(data, address, rio_address_size);
+          memcpy(data + rio_address_size, control, control_len);
+
+          auto packet = data + rio_packet_offset;
+          if (send_info.headers) {
+            memcpy(packet, &send_info.headers[block * send_info.header_size], send_info.header_size);
+          }
+          auto payload_desc = send_info.buffer_for_payload_offset(block * send_info.payload_size);
+          memcpy(packet + send_info.header_size, payload_desc.buffer, send_info.payload_size);
+
+          RIO_BUF remote_buf {buffer_id, slot_offset, sizeof(SOCKADDR_INET)};
+          RIO_BUF control_buf {buffer_id, slot_offset + (ULONG) rio_address_size, control_len};
+          RIO_BUF packet_buf {buffer_id, slot_offset + (ULONG) rio_packet_offset, (ULONG) packet_size};
+
+          // Only the last send of the batch enters the kernel, and takes the deferred ones along
+          DWORD flags = x + 1 < send_info.block_count ? RIO_MSG_DEFER : 0;
+          if (!rio.RIOSendEx(rq, &packet_buf, 1, nullptr, &remote_buf, &control_buf, nullptr, flags, (PVOID) (std::uintptr_t) slot)) {
+            BOOST_LOG(warning) << "RIOSendEx() failed: "sv << WSAGetLastError();
+
+            if (x == 0) {
+              return false;
+            }
+
+            // Don't send the packets queued so far twice
+            rio.RIOSendEx(rq, nullptr, 0, nullptr, nullptr, nullptr, nullptr, RIO_MSG_COMMIT_ONLY, nullptr);
+            return true;
+          }
+
+          free_slots.pop_back();
+        }
+
+        return true;
+      }
+
+    private:
+      /**
+       * @brief Free the slots of the sends that completed.
+       */
+      void reap() {
+        RIORESULT results[256];
+
+        while (true) {
+          auto count = rio.RIODequeueCompletion(cq, results, sizeof(results) / sizeof(results[0]));
+          if (count == RIO_CORRUPT_CQ) {
+            BOOST_LOG(error) << "Registered I/O completion queue is corrupt"sv;
+            return;
+          }
+
+          for (ULONG x = 0; x < count; ++x) {
+            free_slots.push_back((ULONG) results[x].RequestContext);
+          }
+
+          if (count < sizeof(results) / sizeof(results[0])) {
+            return;
+          }
+        }
+      }
+
+      /**
+       * @brief Wait until enough slots are free for a batch.
+       * @param count The number of packets in the batch.
+       * @return `true` if the slots are free.
+       */
+      bool wait_for_slots(std::size_t count) {
+        reap();
+
+        auto timeout = std::chrono::steady_clock::now() + rio_slot_timeout;
+        while (free_slots.size() < count) {
+          if (std::chrono::steady_clock::now() > timeout) {
+            return false;
+          }
+
+          std::this_thread::yield();
+          reap();
+        }
+
+        return true;
+      }
+
+      // Held around each send, since the queues aren't thread-safe
+      std::mutex lock;
+
+      RIO_EXTENSION_FUNCTION_TABLE rio {};
+      RIO_CQ cq = RIO_INVALID_CQ;
+      RIO_RQ rq = RIO_INVALID_RQ;
+      RIO_BUFFERID buffer_id = RIO_INVALID_BUFFERID;
+
+      char *memory = nullptr;
+      std::vector<ULONG> free_slots;
+    };
+
+    std::mutex rio_sockets_lock;
+    std::map<SOCKET, std::shared_ptr<rio_socket_t>> rio_sockets;
+
+    std::shared_ptr<rio_socket_t> get_rio_socket(SOCKET sock) {
+      std::lock_guard lg {rio_sockets_lock};
+
+      auto it = rio_sockets.find(sock);
+      return it != std::end(rio_sockets) ? it->second : nullptr;
+    }
+
+    /**
+     * @brief Stops sending from a socket through Registered I/O.
+     */
+    class rio_deinit_t: public deinit_t {
+    public:
+      rio_deinit_t(SOCKET sock):
+          sock(sock) {
+      }
+
+      virtual ~rio_deinit_t() {
+        std::lock_guard lg {rio_sockets_lock};
+        rio_sockets.erase(sock);
+      }
+
+    private:
+      SOCKET sock;
+    };
+  }  // namespace
+
+  /**
+   * @brief Open a UDP socket whose batches are sent through Registered I/O.
+   * @param v6 Whether the socket is IPv6.
+   * @param native_socket Set to the native socket handle.
+   * @return Stops using Registered I/O for the socket once destroyed, `nullptr` if the socket couldn't be set up.
+   */
+  std::unique_ptr<deinit_t> open_socket_registered_io(bool v6, std::uintptr_t &native_socket) {
+    auto sock = WSASocketW(v6 ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+    if (sock == INVALID_SOCKET) {
+      BOOST_LOG(warning) << "Couldn't create a socket for Registered I/O: "sv << WSAGetLastError();
+      return nullptr;
+    }
+
+    auto fg = util::fail_guard([sock]() {
+      closesocket(sock);
+    });
+
+    auto rio_socket = std::make_shared<rio_socket_t>();
+    if (!rio_socket->init(sock)) {
+      return nullptr;
+    }
+
+    {
+      std::lock_guard lg {rio_sockets_lock};
+      rio_sockets[sock] = std::move(rio_socket);
+    }
+
+    fg.disable();
+
+    native_socket = (std::uintptr_t) sock;
+    return std::make_unique<rio_deinit_t>(sock);
+  }
+
+  /**
+   * @brief Send the batches of a socket through an AF_XDP socket on a network interface.
+   * @param native_socket The native socket handle.
+   * @param interface The name of the interface.
+   * @return `nullptr`, since AF_XDP is specific to Linux.
+   */
+  std::unique_ptr<deinit_t> enable_socket_xdp(uintptr_t native_socket, const std::string &interface) {
+    // Not supported on this platform
+    return nullptr;
+  }
+
+  // Use Registered I/O if the socket was opened for it. Otherwise use UDP segmentation offload if it is
+  // supported by the OS. If the NIC is capable, this will use hardware acceleration to reduce CPU usage.
+  // Support for USO was introduced in Windows 10 20H1.
   bool send_batch(batched_send_info_t &send_info) {
+    if (auto rio_socket = get_rio_socket((SOCKET) send_info.native_socket)) {
+      return rio_socket->send(send_info);
+    }
+
     WSAMSG msg;
 
     // Convert the target address into a SOCKADDR
@@ -1588,6 +2219,16 @@ namespace platf {
     return true;
   }
 
+  bool send_many(std::span<send_info_t> send_infos) {
+    // There's no way to send several messages with a single call, so they're sent one by one
+    bool success = true;
+    for (auto &send_info : send_infos) {
+      success = send(send_info) && success;
+    }
+
+    return success;
+  }
+
   class qos_t: public deinit_t {
   public:
     qos_t(QOS_FLOWID flow_id):
@@ -1722,6 +2363,90 @@ namespace platf {
     return std::make_unique<qos_t>(flow_id);
   }
 
+  /**
+   * @brief Enable kernel pacing of outgoing traffic on the given socket.
+   * @param native_socket The native socket handle.
+   * @return `true` if transmit times are supported on this socket.
+   */
+  bool enable_socket_txtime(uintptr_t native_socket) {
+    // Not supported on this platform
+    return false;
+  }
+
+  /**
+   * @brief Enable zero-copy sends on the given socket.
+   * @param native_socket The native socket handle.
+   * @return `true` if zero-copy sends are supported on this socket.
+   */
+  bool enable_socket_zerocopy(uintptr_t native_socket) {
+    // Not supported on this platform
+    return false;
+  }
+
+  /**
+   * @brief Let other sockets bind the same local address and port as the given socket.
+   * @param native_socket The native socket handle, which must not be bound yet.
+   * @return `true` if the port can be shared.
+   */
+  bool enable_socket_reuseport(uintptr_t native_socket) {
+    // Not supported on this platform
+    return false;
+  }
+
+  /**
+   * @brief Get the largest IP packet that reaches an address without being fragmented.
+   * @details Windows doesn't expose what it learned about the path, so this is the MTU of the interface leading there.
+   * @param address The destination.
+   * @return The MTU in bytes, -1 if it's unknown.
+   */
+  int path_mtu(const boost::asio::ip::address &address) {
+    auto target = address;
+    if (target.is_v6() && target.to_v6().is_v4_mapped()) {
+      target = boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, target.to_v6());
+    }
+
+    MIB_IPINTERFACE_ROW row;
+    InitializeIpInterfaceEntry(&row);
+
+    DWORD status;
+    if (target.is_v6()) {
+      auto taddr = to_sockaddr(target.to_v6(), 0);
+      status = GetBestInterfaceEx((SOCKADDR *) &taddr, &row.InterfaceIndex);
+      row.Family = AF_INET6;
+    } else {
+      auto taddr = to_sockaddr(target.to_v4(), 0);
+      status = GetBestInterfaceEx((SOCKADDR *) &taddr, &row.InterfaceIndex);
+      row.Family = AF_INET;
+    }
+
+    if (status != NO_ERROR || GetIpInterfaceEntry(&row) != NO_ERROR) {
+      BOOST_LOG(debug) << "Couldn't get the MTU of the interface leading to ["sv << target << "]"sv;
+      return -1;
+    }
+
+    return (int) row.NlMtu;
+  }
+
+  std::vector<interface_address_t> interface_addresses() {
+    // Not supported on this platform
+    return {};
+  }
+
+  std::optional<interface_stats_t> interface_stats(const std::string &name) {
+    // Not supported on this platform
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Wait until the kernel no longer references the buffers of the sends made with a ticket.
+   * @param native_socket The native socket handle.
+   * @param ticket The ticket passed to `send_batch()`, which is cleared on return.
+   */
+  void wait_for_zerocopy(uintptr_t native_socket, zerocopy_ticket_t &ticket) {
+    // Buffers are always copied on this platform
+    ticket.last_id.reset();
+  }
+
   int64_t qpc_counter() {
     LARGE_INTEGER performance_counter;
     if (QueryPerformanceCounter(&performance_counter)) {
@@ -1796,6 +2521,20 @@ namespace platf {
     return output;
   }
 
+  std::chrono::nanoseconds process_cpu_time() {
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+      return {};
+    }
+
+    auto to_ns = [](const FILETIME &time) {
+      // FILETIME counts in 100ns intervals
+      return std::chrono::nanoseconds {(((uint64_t) time.dwHighDateTime << 32) | time.dwLowDateTime) * 100};
+    };
+
+    return to_ns(kernel_time) + to_ns(user_time);
+  }
+
   std::string get_host_name() {
     WCHAR hostname[256];
     if (GetHostNameW(hostname, ARRAYSIZE(hostname)) == SOCKET_ERROR) {
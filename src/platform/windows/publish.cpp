@@ -2,6 +2,9 @@
  * @file src/platform/windows/publish.cpp
  * @brief Definitions for Windows mDNS service registration.
  */
+// standard includes
+#include <atomic>
+
 // platform includes
 // WinSock2.h must be included before Windows.h
 // clang-format off
@@ -93,6 +96,8 @@ extern "C" {
 } /* extern "C" */
 
 namespace platf::publish {
+  std::atomic<status_e> publish_status {status_e::disabled};
+
   VOID WINAPI register_cb(DWORD status, PVOID pQueryContext, PDNS_SERVICE_INSTANCE pInstance) {
     auto alarm = (safe::alarm_t<PDNS_SERVICE_INSTANCE>::element_type *) pQueryContext;
 
@@ -173,15 +178,19 @@ namespace platf::publish {
   public:
     mdns_registration_t():
         existing_instance(nullptr) {
+      publish_status = status_e::pending;
       if (service(true, existing_instance)) {
         BOOST_LOG(error) << "Unable to register Apollo mDNS service"sv;
+        publish_status = status_e::failed;
         return;
       }
 
       BOOST_LOG(info) << "Registered Apollo mDNS service"sv;
+      publish_status = status_e::published;
     }
 
     ~mdns_registration_t() override {
+      publish_status = status_e::disabled;
       if (existing_instance) {
         if (service(false, existing_instance)) {
           BOOST_LOG(error) << "Unable to unregister Apollo mDNS service"sv;
@@ -224,4 +233,8 @@ namespace platf::publish {
 
     return std::make_unique<mdns_registration_t>();
   }
+
+  status_e status() {
+    return publish_status;
+  }
 }  // namespace platf::publish
@@ -8,9 +8,14 @@
  #define BOOST_PROCESS_VERSION 1
 #endif
 // standard includes
+#include <algorithm>
 #include <filesystem>
+#include <future>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 // lib includes
@@ -29,10 +34,12 @@
 #include "display_device.h"
 #include "file_handler.h"
 #include "logging.h"
+#include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
 #include "httpcommon.h"
 #include "system_tray.h"
+#include "thread_affinity.h"
 #include "utility.h"
 #include "video.h"
 #include "uuid.h"
@@ -56,6 +63,7 @@ namespace proc {
   namespace pt = boost::property_tree;
 
   proc_t proc;
+  instances_t instances;
 
   int input_only_app_id = -1;
   std::string input_only_app_id_str;
@@ -82,6 +90,7 @@ namespace proc {
   class deinit_t: public platf::deinit_t {
   public:
     ~deinit_t() {
+      instances.terminate_all();
       proc.terminate();
     }
   };
@@ -90,7 +99,17 @@ namespace proc {
     return std::make_unique<deinit_t>();
   }
 
-  void terminate_process_group(boost::process::v1::child &proc, boost::process::v1::group &group, std::chrono::seconds exit_timeout) {
+  namespace {
+    std::mutex exit_listener_mutex;
+    std::function<void()> exit_listener;
+  }  // namespace
+
+  void set_exit_listener(std::function<void()> listener) {
+    std::lock_guard lg {exit_listener_mutex};
+    exit_listener = std::move(listener);
+  }
+
+  void terminate_process_group(boost::process::v1::child &proc, boost::process::v1::group &group, std::chrono::seconds exit_timeout, exit_signal_t *group_exit) {
     if (group.valid() && platf::process_group_running((std::uintptr_t) group.native_handle())) {
       if (exit_timeout.count() > 0) {
         // Request processes in the group to exit gracefully
@@ -98,12 +117,22 @@ namespace proc {
           // If the request was successful, wait for a little while for them to exit.
           BOOST_LOG(info) << "Successfully requested the app to exit. Waiting up to "sv << exit_timeout.count() << " seconds for it to close."sv;
 
-          // group::wait_for() and similar functions are broken and deprecated, so we use a simple polling loop
-          while (platf::process_group_running((std::uintptr_t) group.native_handle()) && (--exit_timeout).count() >= 0) {
-            std::this_thread::sleep_for(1s);
+          // group::wait_for() and similar functions are broken and deprecated, so we wait for the exit watcher or poll
+          auto deadline = std::chrono::steady_clock::now() + exit_timeout;
+          bool exited;
+          if (group_exit) {
+            std::unique_lock ul {group_exit->mutex};
+            exited = group_exit->cv.wait_until(ul, deadline, [group_exit]() {
+              return group_exit->exited;
+            });
+          } else {
+            while (platf::process_group_running((std::uintptr_t) group.native_handle()) && std::chrono::steady_clock::now() < deadline) {
+              std::this_thread::sleep_for(100ms);
+            }
+            exited = std::chrono::steady_clock::now() < deadline;
           }
 
-          if (exit_timeout.count() < 0) {
+          if (!exited) {
             BOOST_LOG(warning) << "App did not fully exit within the timeout. Terminating the app's remaining processes."sv;
           } else {
             BOOST_LOG(info) << "All app processes have successfully exited."sv;
@@ -176,6 +205,131 @@ namespace proc {
 #endif
   }
 
+  std::vector<cmd_t>::const_iterator prep_group_end(std::vector<cmd_t>::const_iterator it, std::vector<cmd_t>::const_iterator end) {
+    if (it == end || !it->parallel) {
+      return it == end ? end : std::next(it);
+    }
+
+    while (it != end && it->parallel) {
+      ++it;
+    }
+    return it;
+  }
+
+  std::vector<cmd_t>::const_iterator prep_group_begin(std::vector<cmd_t>::const_iterator begin, std::vector<cmd_t>::const_iterator it) {
+    if (it == begin || !std::prev(it)->parallel) {
+      return it == begin ? begin : std::prev(it);
+    }
+
+    while (it != begin && std::prev(it)->parallel) {
+      --it;
+    }
+    return it;
+  }
+
+  /**
+   * @brief Run a group of prep commands at the same time and wait for all of them.
+   * @param begin The first command of the group.
+   * @param end The command after the group.
+   * @param undo Whether to run the undo commands instead of the do commands.
+   * @param app_working_dir The working directory of the app, empty to use the one of each command.
+   * @param env The environment of the commands.
+   * @param pipe Where the output of the commands goes.
+   * @param ignore_permission_denied Whether a command failing to impersonate the user still counts as succeeded.
+   * @return `true` if every command of the group succeeded.
+   */
+  bool run_prep_group(
+    std::vector<cmd_t>::const_iterator begin,
+    std::vector<cmd_t>::const_iterator end,
+    bool undo,
+    const std::string &app_working_dir,
+    boost::process::v1::environment &env,
+    FILE *pipe,
+    bool ignore_permission_denied
+  ) {
+    struct running_t {
+      const cmd_t *cmd;
+      boost::process::v1::child child;
+    };
+
+    bool succeeded = true;
+    std::vector<running_t> running;
+
+    for (auto it = begin; it != end; ++it) {
+      auto &command = undo ? it->undo_cmd : it->do_cmd;
+
+      // Skip empty commands
+      if (command.empty()) {
+        continue;
+      }
+
+      boost::filesystem::path working_dir = app_working_dir.empty() ?
+                                              find_working_directory(command, env) :
+                                              boost::filesystem::path(app_working_dir);
+
+      std::error_code ec;
+      if (undo) {
+        BOOST_LOG(info) << "Executing Undo Cmd: ["sv << command << ']';
+      } else {
+        BOOST_LOG(info) << "Executing Do Cmd: ["sv << command << "] elevated: " << it->elevated;
+      }
+      auto child = platf::run_command(it->elevated, true, command, working_dir, env, pipe, ec, nullptr);
+
+      if (ec) {
+        if (undo) {
+          BOOST_LOG(warning) << "System: "sv << ec.message();
+          continue;
+        }
+
+        BOOST_LOG(error) << "Couldn't run ["sv << command << "]: System: "sv << ec.message();
+        // We don't want any prep commands failing launch of the desktop.
+        // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
+        // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
+        if (!(ignore_permission_denied && ec == std::errc::permission_denied)) {
+          succeeded = false;
+        }
+        continue;
+      }
+
+      running.emplace_back(running_t {&*it, std::move(child)});
+    }
+
+    // The timeouts of a group all count from when it started
+    auto start = std::chrono::steady_clock::now();
+    for (auto &[cmd, child] : running) {
+      auto &command = undo ? cmd->undo_cmd : cmd->do_cmd;
+
+      if (cmd->timeout.count() > 0) {
+        std::error_code ec;
+        while (child.running(ec) && std::chrono::steady_clock::now() - start < cmd->timeout) {
+          std::this_thread::sleep_for(50ms);
+        }
+
+        if (child.running(ec)) {
+          BOOST_LOG(warning) << '[' << command << "] didn't finish within "sv << cmd->timeout.count() << " seconds, terminating it"sv;
+          child.terminate(ec);
+          if (!undo) {
+            succeeded = false;
+          }
+          continue;
+        }
+      }
+
+      child.wait();
+      auto ret = child.exit_code();
+      if (ret != 0) {
+        if (undo) {
+          BOOST_LOG(warning) << "Return code ["sv << ret << ']';
+        } else {
+          BOOST_LOG(error) << '[' << command << "] failed with code ["sv << ret << ']';
+          succeeded = false;
+        }
+      }
+    }
+
+    return succeeded;
+  }
+
   int proc_t::execute(const ctx_t& app, std::shared_ptr<rtsp_stream::launch_session_t> launch_session) {
     if (_app_id == input_only_app_id) {
       terminate(false, false);
@@ -215,16 +369,16 @@ namespace proc {
     launch_session->width = render_width;
     launch_session->height = render_height;
 
-    this->initial_display = config::video.output_name;
+    if (!secondary) {
+      this->initial_display = config::video.output_name;
+    }
     // Executed when returning from function
     auto fg = util::fail_guard([&]() {
-      // Restore to user defined output name
-      config::video.output_name = this->initial_display;
-      terminate();
-      display_device::revert_configuration();
+      abort_launch();
     });
 
-    if (!app.gamepad.empty()) {
+    // The input settings are shared with every other instance
+    if (!app.gamepad.empty() && !secondary) {
       _saved_input_config = std::make_shared<config::input_t>(config::input);
       if (app.gamepad == "disabled") {
         config::input.controller = false;
@@ -235,7 +389,8 @@ namespace proc {
     }
 
     if (
-      config::video.headless_mode        // Headless mode
+      secondary                          // Instances next to proc stream a display of their own
+      || config::video.headless_mode     // Headless mode
       || launch_session->virtual_display // User requested virtual display
       || _app.virtual_display            // App is configured to use virtual display
       || !video::allow_encoder_probing() // No active display presents
@@ -278,6 +433,15 @@ namespace proc {
           device_name = launch_session->device_name;
           device_uuid_str = launch_session->unique_id;
           device_uuid = uuid_util::uuid_t::parse(launch_session->unique_id);
+
+          // A client may run several instances, each needs a display of its own
+          if (secondary) {
+            auto app_uuid = uuid_util::uuid_t::parse(_app.uuid);
+            device_uuid.b64[0] ^= app_uuid.b64[0];
+            device_uuid.b64[1] ^= app_uuid.b64[1];
+
+            device_uuid_str = device_uuid.string();
+          }
         }
 
 #ifdef _WIN32
@@ -334,7 +498,7 @@ namespace proc {
           }
 
           // Check the ISOLATED DISPLAY configuration setting and rearrange the displays
-          if (config::video.isolated_virtual_display_option == true) {
+          if (config::video.isolated_virtual_display_option == true && !secondary) {
             // Apply the isolated display settings
 #ifdef _WIN32
             VDISPLAY::changeDisplaySettings2(vdisplayName.c_str(), render_width, render_height, target_fps, true);
@@ -354,8 +518,9 @@ namespace proc {
           // When using virtual display, we don't care which display user configured to use.
           // So we always set output_name to the newly created virtual display as a workaround for
           // empty name when probing graphics cards.
-
-          config::video.output_name = display_device::map_display_name(this->display_name);
+          if (!secondary) {
+            config::video.output_name = display_device::map_display_name(this->display_name);
+          }
         } else {
           BOOST_LOG(warning) << "Virtual Display creation failed, or cannot get created display name in time!";
         }
@@ -365,12 +530,20 @@ namespace proc {
       }
     }
 
-    display_device::configure_display(config::video, *launch_session);
+    if (secondary) {
+      // Without a display of its own, the instance would stream the display of proc
+      if (!this->virtual_display) {
+        BOOST_LOG(error) << "Couldn't create a virtual display for another instance of an app"sv;
+        return 503;
+      }
+    } else {
+      display_device::configure_display(config::video, *launch_session);
 
-    // We should not preserve display state when using virtual display.
-    // It is already handled by Windows properly.
-    if (this->virtual_display) {
-      display_device::reset_persistence();
+      // We should not preserve display state when using virtual display.
+      // It is already handled by Windows properly.
+      if (this->virtual_display) {
+        display_device::reset_persistence();
+      }
     }
 
     // Probe encoders again before streaming to ensure our chosen
@@ -385,6 +558,54 @@ namespace proc {
       }
     }
 
+    // The display and the encoders the client negotiates the stream for are final, the app starts while it does
+    if (config::stream.async_app_launch && !secondary) {
+      if (!_start) {
+        _start = std::make_unique<app_start_t>();
+      }
+
+      std::promise<int> started;
+      launch_session->app_started = started.get_future().share();
+
+      _start->starting = true;
+      _start->cancelled = false;
+      _start->resume_pending = false;
+      _start->thread = std::thread([this, launch_session, scale_factor, started = std::move(started)]() mutable {
+        auto err = start_app(launch_session, scale_factor);
+        if (err) {
+          abort_launch();
+        }
+
+        bool resume_pending;
+        {
+          std::lock_guard lg {_start->lock};
+          _start->starting = false;
+          resume_pending = std::exchange(_start->resume_pending, false);
+        }
+        started.set_value(err);
+
+        // The first session started before the app did
+        if (resume_pending && !err) {
+          resume();
+        }
+      });
+
+      fg.disable();
+      return 0;
+    }
+
+    if (auto err = start_app(launch_session, scale_factor)) {
+      return err;
+    }
+
+    fg.disable();
+    return 0;
+  }
+
+  int proc_t::start_app(const std::shared_ptr<rtsp_stream::launch_session_t> &launch_session, int scale_factor) {
+    auto render_width = launch_session->width;
+    auto render_height = launch_session->height;
+
     std::string fps_str;
     char fps_buf[8];
     snprintf(fps_buf, sizeof(fps_buf), "%.3f", (float)launch_session->fps / 1000.0f);
@@ -456,34 +677,19 @@ namespace proc {
     _app_prep_begin = std::begin(_app.prep_cmds);
     _app_prep_it = _app_prep_begin;
 
-    for (; _app_prep_it != std::end(_app.prep_cmds); ++_app_prep_it) {
-      auto &cmd = *_app_prep_it;
-
-      // Skip empty commands
-      if (cmd.do_cmd.empty()) {
-        continue;
+    // Commands flagged parallel start together, every other command waits for the ones before it
+    while (_app_prep_it != std::end(_app.prep_cmds)) {
+      if (_start && _start->cancelled) {
+        BOOST_LOG(info) << "Launch of ["sv << _app.name << "] cancelled"sv;
+        return -1;
       }
 
-      boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.do_cmd, _env) :
-                                              boost::filesystem::path(_app.working_dir);
-      BOOST_LOG(info) << "Executing Do Cmd: ["sv << cmd.do_cmd << "] elevated: " << cmd.elevated;
-      auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
-
-      if (ec) {
-        BOOST_LOG(error) << "Couldn't run ["sv << cmd.do_cmd << "]: System: "sv << ec.message();
-        // We don't want any prep commands failing launch of the desktop.
-        // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
-        // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
-        if (!(_app.cmd.empty() && ec == std::errc::permission_denied)) {
-          return -1;
-        }
-      }
+      auto group_end = prep_group_end(_app_prep_it, std::end(_app.prep_cmds));
+      auto succeeded = run_prep_group(_app_prep_it, group_end, false, _app.working_dir, _env, _pipe.get(), _app.cmd.empty());
 
-      child.wait();
-      auto ret = child.exit_code();
-      if (ret != 0 && ec != std::errc::permission_denied) {
-        BOOST_LOG(error) << '[' << cmd.do_cmd << "] failed with code ["sv << ret << ']';
+      // Every command of the group has run, so each gets undone
+      _app_prep_it = group_end;
+      if (!succeeded) {
         return -1;
       }
     }
@@ -516,6 +722,31 @@ namespace proc {
         BOOST_LOG(warning) << "Couldn't run ["sv << _app.cmd << "]: System: "sv << ec.message();
         return -1;
       }
+
+      auto app_cpus = thread_affinity::app_cpus();
+      if (!app_cpus.empty() || config::stream.app_cpu_weight != 100) {
+        auto group = _process_group ? (std::uintptr_t) _process_group.native_handle() : 0;
+        _app_isolation = platf::isolate_app((std::uintptr_t) _process.native_handle(), group, app_cpus, config::stream.app_cpu_weight);
+        if (!_app_isolation) {
+          BOOST_LOG(warning) << "Couldn't isolate ["sv << _app.cmd << "] from the streaming threads"sv;
+        }
+      }
+
+      // Streams end as soon as the app exits, instead of when running() is next polled
+      _exit_signal = std::make_shared<exit_signal_t>();
+      auto group = _app.wait_all && _process_group ? (std::uintptr_t) _process_group.native_handle() : 0;
+      _exit_watcher = platf::watch_process_exit((std::uintptr_t) _process.native_handle(), group, [exit_signal = _exit_signal]() {
+        {
+          std::lock_guard lg {exit_signal->mutex};
+          exit_signal->exited = true;
+        }
+        exit_signal->cv.notify_all();
+
+        std::lock_guard lg {exit_listener_mutex};
+        if (exit_listener) {
+          exit_listener();
+        }
+      });
     }
 
     _app_launch_time = std::chrono::steady_clock::now();
@@ -576,16 +807,39 @@ namespace proc {
     resetHDRThread.detach();
   #endif
 
-    fg.disable();
-
 #if defined SUNSHINE_TRAY && SUNSHINE_TRAY >= 1
-    system_tray::update_tray_playing(_app.name);
+    if (!secondary) {
+      system_tray::update_tray_playing(_app.name);
+    }
 #endif
 
     return 0;
   }
 
+  void proc_t::abort_launch() {
+    if (secondary) {
+      terminate(false, false);
+      return;
+    }
+
+    // Restore to user defined output name
+    config::video.output_name = this->initial_display;
+    terminate();
+    display_device::revert_configuration();
+  }
+
+  void proc_t::wait_started() {
+    if (_start && _start->thread.joinable() && _start->thread.get_id() != std::this_thread::get_id()) {
+      _start->thread.join();
+    }
+  }
+
   int proc_t::running() {
+    // Streams of an app that fails to start end with it, and the commands starting it are left to be waited for
+    if (_start && _start->starting) {
+      return _app_id;
+    }
+
 #ifndef _WIN32
     // On POSIX OSes, we must periodically wait for our children to avoid
     // them becoming zombies. This must be synchronized carefully with
@@ -627,6 +881,16 @@ namespace proc {
   }
 
   void proc_t::resume() {
+    // Sessions don't wait for the app to start, it resumes once it did
+    if (_start) {
+      std::lock_guard lg {_start->lock};
+      if (_start->starting) {
+        _start->resume_pending = true;
+        return;
+      }
+    }
+    wait_started();
+
     BOOST_LOG(info) << "Session resuming for app [" << _app_name << "].";
 
     if (!_app.state_cmds.empty()) {
@@ -671,6 +935,8 @@ namespace proc {
   }
 
   void proc_t::pause() {
+    wait_started();
+
     if (!running()) {
       BOOST_LOG(info) << "Session already stopped, do not run pause commands.";
       return;
@@ -724,46 +990,40 @@ namespace proc {
     }
 
 #if defined SUNSHINE_TRAY && SUNSHINE_TRAY >= 1
-    system_tray::update_tray_pausing(proc::proc.get_last_run_app_name());
+    if (!secondary) {
+      system_tray::update_tray_pausing(proc::proc.get_last_run_app_name());
+    }
 #endif
   }
 
   void proc_t::terminate(bool immediate, bool needs_refresh) {
-    std::error_code ec;
+    if (_start) {
+      _start->cancelled = true;
+    }
+    wait_started();
+
     placebo = false;
 
     if (!immediate) {
-      terminate_process_group(_process, _process_group, _app.exit_timeout);
+      auto group_exit = _exit_watcher && _app.wait_all ? _exit_signal.get() : nullptr;
+      terminate_process_group(_process, _process_group, _app.exit_timeout, group_exit);
     }
 
+    // The watcher waits on the handles of the process and group
+    _exit_watcher.reset();
+    _exit_signal.reset();
+    _app_isolation.reset();
+
     _process = boost::process::v1::child();
     _process_group = boost::process::v1::group();
 
     _env["APOLLO_APP_STATUS"] = "TERMINATING";
 
-    for (; _app_prep_it != _app_prep_begin; --_app_prep_it) {
-      auto &cmd = *(_app_prep_it - 1);
-
-      if (cmd.undo_cmd.empty()) {
-        continue;
-      }
-
-      boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.undo_cmd, _env) :
-                                              boost::filesystem::path(_app.working_dir);
-      BOOST_LOG(info) << "Executing Undo Cmd: ["sv << cmd.undo_cmd << ']';
-      auto child = platf::run_command(cmd.elevated, true, cmd.undo_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
-
-      if (ec) {
-        BOOST_LOG(warning) << "System: "sv << ec.message();
-      }
-
-      child.wait();
-      auto ret = child.exit_code();
-
-      if (ret != 0) {
-        BOOST_LOG(warning) << "Return code ["sv << ret << ']';
-      }
+    // Undo in reverse order, with the same groups that started together
+    while (_app_prep_it != _app_prep_begin) {
+      auto group_begin = prep_group_begin(_app_prep_begin, _app_prep_it);
+      run_prep_group(group_begin, _app_prep_it, true, _app.working_dir, _env, _pipe.get(), false);
+      _app_prep_it = group_begin;
     }
 
     _pipe.reset();
@@ -797,7 +1057,7 @@ namespace proc {
 
     // Only show the Stopped notification if we actually have an app to stop
     // Since terminate() is always run when a new app has started
-    if (proc::proc.get_last_run_app_name().length() > 0 && has_run) {
+    if (proc::proc.get_last_run_app_name().length() > 0 && has_run && !secondary) {
       if (used_virtual_display) {
         display_device::reset_persistence();
       } else {
@@ -811,11 +1071,14 @@ namespace proc {
 
     // Load the configured output_name first
     // to prevent the value being write to empty when the initial terminate happens
-    if (!has_run && initial_display.empty()) {
-      initial_display = config::video.output_name;
-    } else {
-      // Restore output name to its original value
-      config::video.output_name = initial_display;
+    // The output name of instances next to proc is the one of proc
+    if (!secondary) {
+      if (!has_run && initial_display.empty()) {
+        initial_display = config::video.output_name;
+      } else {
+        // Restore output name to its original value
+        config::video.output_name = initial_display;
+      }
     }
 
     _app_id = -1;
@@ -833,11 +1096,26 @@ namespace proc {
       _saved_input_config.reset();
     }
 
-    if (needs_refresh) {
+    if (needs_refresh && !secondary) {
       refresh(config::stream.file_apps, false);
     }
   }
 
+  void proc_t::update_apps(proc_t &&parsed) {
+    wait_started();
+
+    _env = std::move(parsed._env);
+    _apps = std::move(parsed._apps);
+
+    // The id of the running app follows its name and image
+    auto app = std::find_if(_apps.begin(), _apps.end(), [this](const ctx_t &app) {
+      return app.uuid == _app.uuid;
+    });
+    if (app != _apps.end()) {
+      _app_id = util::from_view(app->id);
+    }
+  }
+
   const std::vector<ctx_t> &proc_t::get_apps() const {
     return _apps;
   }
@@ -851,7 +1129,7 @@ namespace proc {
   // Returns default image if image configuration is not set.
   // Returns http content-type header compatible image type.
   std::string proc_t::get_app_image(int app_id) {
-    auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto app) {
+    auto iter = std::find_if(_apps.begin(), _apps.end(), [&app_id](const auto &app) {
       return app.id == std::to_string(app_id);
     });
     auto app_image_path = iter == _apps.end() ? std::string() : iter->image_path;
@@ -868,6 +1146,8 @@ namespace proc {
   }
 
   boost::process::environment proc_t::get_env() {
+    wait_started();
+
     return _env;
   }
 
@@ -880,6 +1160,106 @@ namespace proc {
     assert(!_process.running());
   }
 
+  int instances_t::launch(const ctx_t &app, std::shared_ptr<rtsp_stream::launch_session_t> launch_session) {
+    {
+      std::lock_guard lg {_lock};
+
+      // proc is an instance too
+      if ((int) _instances.size() + _launching + 1 >= config::video.max_app_instances) {
+        BOOST_LOG(warning) << "Can't launch ["sv << app.name << "] next to the running apps, "sv << config::video.max_app_instances << " are running already"sv;
+        return 503;
+      }
+      ++_launching;
+    }
+    auto launching_fg = util::fail_guard([this]() {
+      std::lock_guard lg {_lock};
+      --_launching;
+    });
+
+    auto instance = std::make_unique<proc_t>(proc.get_env(), std::vector<ctx_t> {app});
+    instance->secondary = true;
+
+    // The other instances keep running while the app starts
+    if (auto err = instance->execute(app, launch_session)) {
+      return err;
+    }
+
+    std::lock_guard lg {_lock};
+    auto id = _next_id++;
+    BOOST_LOG(info) << "Running ["sv << app.name << "] as instance "sv << id << " on ["sv << instance->display_name << ']';
+
+    launch_session->app_instance = id;
+    launch_session->display_name = instance->display_name;
+    _instances.push_back({id, std::move(instance)});
+    return 0;
+  }
+
+  int instances_t::find(const std::string &app_uuid) {
+    std::lock_guard lg {_lock};
+    for (auto &instance : _instances) {
+      if (instance.proc->get_running_app_uuid() == app_uuid && instance.proc->running()) {
+        return instance.id;
+      }
+    }
+
+    return 0;
+  }
+
+  std::string instances_t::display_name(int instance) {
+    std::lock_guard lg {_lock};
+    auto it = find(instance);
+    return it ? it->proc->display_name : std::string {};
+  }
+
+  bool instances_t::running(int instance) {
+    std::lock_guard lg {_lock};
+    auto it = find(instance);
+    return it && it->proc->running();
+  }
+
+  int instances_t::count() {
+    std::lock_guard lg {_lock};
+    return (int) _instances.size() + _launching;
+  }
+
+  void instances_t::session_started(int instance) {
+    std::lock_guard lg {_lock};
+    auto it = find(instance);
+    if (it && ++it->sessions == 1) {
+      it->proc->resume();
+    }
+  }
+
+  void instances_t::session_ended(int instance) {
+    std::lock_guard lg {_lock};
+    auto it = find(instance);
+    if (!it || --it->sessions > 0) {
+      return;
+    }
+
+    it->proc->pause();
+
+    // Nothing can stream an instance whose app is gone, running() cleaned up after it
+    std::erase_if(_instances, [](instance_t &instance) {
+      return instance.sessions == 0 && !instance.proc->running();
+    });
+  }
+
+  void instances_t::terminate_all() {
+    std::lock_guard lg {_lock};
+    for (auto &instance : _instances) {
+      instance.proc->terminate(false, false);
+    }
+    _instances.clear();
+  }
+
+  instances_t::instance_t *instances_t::find(int instance) {
+    auto it = std::find_if(std::begin(_instances), std::end(_instances), [instance](const instance_t &x) {
+      return x.id == instance;
+    });
+    return it == std::end(_instances) ? nullptr : &*it;
+  }
+
   std::string_view::iterator find_match(std::string_view::iterator begin, std::string_view::iterator end) {
     int stack = 0;
 
@@ -1027,6 +1407,43 @@ namespace proc {
     return ss.str();
   }
 
+  /**
+   * @brief Calculate the SHA-256 of an app image, reusing the result while the file is unchanged.
+   * @details Refreshing the apps hashes every image again otherwise, which takes seconds with many large covers.
+   */
+  std::optional<std::string> cached_image_sha256(const std::string &file_path) {
+    struct hash_entry_t {
+      std::filesystem::file_time_type mtime;
+      std::uintmax_t size;
+      std::string hash;
+    };
+
+    static std::mutex cache_lock;
+    static std::unordered_map<std::string, hash_entry_t> cache;
+
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(file_path, ec);
+    auto size = ec ? 0 : std::filesystem::file_size(file_path, ec);
+    if (ec) {
+      return calculate_sha256(file_path);
+    }
+
+    {
+      std::lock_guard lg {cache_lock};
+      if (auto it = cache.find(file_path); it != cache.end() && it->second.mtime == mtime && it->second.size == size) {
+        return it->second.hash;
+      }
+    }
+
+    auto hash = calculate_sha256(file_path);
+    if (hash) {
+      std::lock_guard lg {cache_lock};
+      cache.insert_or_assign(file_path, hash_entry_t {mtime, size, *hash});
+    }
+
+    return hash;
+  }
+
   uint32_t calculate_crc32(const std::string &input) {
     boost::crc_32_type result;
     result.process_bytes(input.data(), input.length());
@@ -1039,7 +1456,7 @@ namespace proc {
     to_hash.push_back(app_name);
     auto file_path = validate_app_image_path(app_image_path);
     if (file_path != DEFAULT_APP_IMAGE_PATH) {
-      auto file_hash = calculate_sha256(file_path);
+      auto file_hash = cached_image_sha256(file_path);
       if (file_hash) {
         to_hash.push_back(file_hash.value());
       } else {
@@ -1301,11 +1718,13 @@ namespace proc {
             for (auto &prep_cmd : config::sunshine.prep_cmds) {
               auto do_cmd = parse_env_val(this_env, prep_cmd.do_cmd);
               auto undo_cmd = parse_env_val(this_env, prep_cmd.undo_cmd);
-              prep_cmds.emplace_back(
+              auto &cmd = prep_cmds.emplace_back(
                 std::move(do_cmd),
                 std::move(undo_cmd),
                 std::move(prep_cmd.elevated)
               );
+              cmd.parallel = prep_cmd.parallel;
+              cmd.timeout = prep_cmd.timeout;
             }
           }
           if (app_node.contains("prep-cmd") && app_node["prep-cmd"].is_array()) {
@@ -1313,11 +1732,19 @@ namespace proc {
               std::string do_cmd = parse_env_val(this_env, prep_node.value("do", ""));
               std::string undo_cmd = parse_env_val(this_env, prep_node.value("undo", ""));
               bool elevated = prep_node.value("elevated", false);
-              prep_cmds.emplace_back(
+              auto &cmd = prep_cmds.emplace_back(
                 std::move(do_cmd),
                 std::move(undo_cmd),
                 std::move(elevated)
               );
+
+              // The web UI may store these as strings, or leave the timeout empty
+              if (auto parallel = prep_node.find("parallel"); parallel != prep_node.end()) {
+                cmd.parallel = parallel->is_boolean() ? parallel->get<bool>() : *parallel == "true";
+              }
+              if (auto timeout = prep_node.find("timeout"); timeout != prep_node.end() && timeout->is_number_integer()) {
+                cmd.timeout = std::chrono::seconds {std::max(timeout->get<int>(), 0)};
+              }
             }
           }
 
@@ -1587,10 +2014,6 @@ namespace proc {
   }
 
   void refresh(const std::string &file_name, bool needs_terminate) {
-    if (needs_terminate) {
-      proc.terminate(false, false);
-    }
-
   #ifdef _WIN32
     size_t fail_count = 0;
     while (fail_count < 5 && vDisplayDriverStatus != VDISPLAY::DRIVER_STATUS::OK) {
@@ -1606,8 +2029,26 @@ namespace proc {
 
     auto proc_opt = proc::parse(file_name);
 
+    // Editing the apps keeps the running app going, unless the running app itself was removed
+    if (proc_opt && proc.running()) {
+      const auto &apps = proc_opt->get_apps();
+      auto uuid = proc.get_running_app_uuid();
+      if (std::any_of(apps.begin(), apps.end(), [&uuid](const ctx_t &app) { return app.uuid == uuid; })) {
+        proc.update_apps(std::move(*proc_opt));
+        nvhttp::invalidate_response_cache();
+        return;
+      }
+    }
+
+    if (needs_terminate) {
+      proc.terminate(false, false);
+    }
+
     if (proc_opt) {
       proc = std::move(*proc_opt);
     }
+
+    // The app list served to clients is built from the apps
+    nvhttp::invalidate_response_cache();
   }
 }  // namespace proc
@@ -13,8 +13,16 @@
 #endif
 
 // standard includes
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 // lib includes
 #include <boost/process/v1/child.hpp>
@@ -100,6 +108,30 @@ namespace proc {
     std::chrono::seconds exit_timeout;
   };
 
+  /**
+   * @brief Raised by the exit watcher of an app.
+   */
+  struct exit_signal_t {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool exited = false;
+  };
+
+  /**
+   * @brief The start of an app that goes on after its launch was answered.
+   */
+  struct app_start_t {
+    std::thread thread;
+    std::atomic_bool starting {false};
+
+    // Raised by terminate(), the start stops at the next prep command
+    std::atomic_bool cancelled {false};
+
+    // Raised by resume() while starting, which the start leaves to run once the app is up
+    std::mutex lock;
+    bool resume_pending = false;
+  };
+
   class proc_t {
   public:
     KITTY_DEFAULT_CONSTR_MOVE_THROW(proc_t)
@@ -111,6 +143,9 @@ namespace proc {
     bool virtual_display = false;
     bool allow_client_commands = false;
 
+    // Runs next to proc on a virtual display of its own, leaving the displays, output name and input settings to proc
+    bool secondary = false;
+
     proc_t(
       boost::process::v1::environment &&env,
       std::vector<ctx_t> &&apps
@@ -121,10 +156,17 @@ namespace proc {
 
     void launch_input_only();
 
+    /**
+     * @brief Launch an app.
+     * @details With `config::stream_t::async_app_launch`, this returns once the display is set up and the encoders
+     *          are probed, and the prep commands and the app start on a thread of their own while the client
+     *          negotiates the stream. `launch_session->app_started` then tells how that went.
+     * @return 0 on success, or the status code the launch fails with.
+     */
     int execute(const ctx_t& _app, std::shared_ptr<rtsp_stream::launch_session_t> launch_session);
 
     /**
-     * @return `_app_id` if a process is running, otherwise returns `0`
+     * @return `_app_id` if a process is running or still starting, otherwise returns `0`
      */
     int running();
 
@@ -140,7 +182,29 @@ namespace proc {
     void pause();
     void terminate(bool immediate = false, bool needs_refresh = true);
 
+    /**
+     * @brief Take over the environment and the apps of a freshly parsed proc_t, keeping the running app.
+     * @param parsed The result of parse().
+     */
+    void update_apps(proc_t &&parsed);
+
   private:
+    /**
+     * @brief Run the prep commands and start the app, the part of execute() the client may not wait for.
+     * @return 0 on success, or -1 if a prep command or the app failed.
+     */
+    int start_app(const std::shared_ptr<rtsp_stream::launch_session_t> &launch_session, int scale_factor);
+
+    /**
+     * @brief Undo a launch that failed.
+     */
+    void abort_launch();
+
+    /**
+     * @brief Wait for a start that goes on after the launch was answered, unless called from it.
+     */
+    void wait_started();
+
     int _app_id = 0;
     std::string _app_name;
 
@@ -159,6 +223,16 @@ namespace proc {
     boost::process::v1::child _process;
     boost::process::v1::group _process_group;
 
+    // Watches for what running() checks, the group with wait-all and the process otherwise, where possible
+    std::shared_ptr<exit_signal_t> _exit_signal;
+    std::unique_ptr<platf::process_watcher_t> _exit_watcher;
+
+    // Keeps the app off the cores reserved for the streaming threads
+    std::unique_ptr<platf::app_isolation_t> _app_isolation;
+
+    // Created by the first execute() that starts its app on a thread, then kept for the next ones
+    std::unique_ptr<app_start_t> _start;
+
     file_t _pipe;
     std::vector<cmd_t>::const_iterator _app_prep_it;
     std::vector<cmd_t>::const_iterator _app_prep_begin;
@@ -195,10 +269,88 @@ namespace proc {
    * @param proc The child process itself.
    * @param group The group of all children in the process tree.
    * @param exit_timeout The timeout to wait for the process group to gracefully exit.
+   * @param group_exit Raised once the group exited, nullptr to poll the group instead.
+   */
+  void terminate_process_group(boost::process::v1::child &proc, boost::process::v1::group &group, std::chrono::seconds exit_timeout, exit_signal_t *group_exit = nullptr);
+
+  /**
+   * @brief Get called back as soon as the running app exits, where its exit can be watched for.
+   * @param listener Called from another thread, empty to stop.
    */
-  void terminate_process_group(boost::process::v1::child &proc, boost::process::v1::group &group, std::chrono::seconds exit_timeout);
+  void set_exit_listener(std::function<void()> listener);
+
+  /**
+   * @brief Apps running next to the one of `proc`, each on a virtual display of its own, so each has its own
+   *        capture and its own sessions. See `config::video_t::max_app_instances`.
+   * @details Instances are numbered from 1, 0 stands for `proc`. An instance goes away once its app exited and
+   *          its last session ended. The host's input devices and audio are shared by every instance. All methods
+   *          are thread-safe.
+   */
+  class instances_t {
+  public:
+    /**
+     * @brief Launch an app in a new instance.
+     * @param app The app.
+     * @param launch_session The session launching it, which gets the instance and the virtual display to capture.
+     * @return 0 on success, or the status code the launch fails with.
+     */
+    int launch(const ctx_t &app, std::shared_ptr<rtsp_stream::launch_session_t> launch_session);
+
+    /**
+     * @brief Get the instance running an app.
+     * @param app_uuid The UUID of the app.
+     * @return The instance, or 0 if none runs it.
+     */
+    int find(const std::string &app_uuid);
+
+    /**
+     * @brief Get the virtual display of an instance.
+     * @return The name of the display, or an empty string if the instance is gone.
+     */
+    std::string display_name(int instance);
+
+    /**
+     * @brief Get whether the app of an instance is still running.
+     */
+    bool running(int instance);
+
+    /**
+     * @brief Get how many instances there are, launching ones included.
+     */
+    int count();
+
+    /**
+     * @brief Account for a session of an instance starting, which resumes its app.
+     */
+    void session_started(int instance);
+
+    /**
+     * @brief Account for a session of an instance ending, which pauses its app when it was the last one.
+     */
+    void session_ended(int instance);
+
+    /**
+     * @brief Terminate the app of every instance.
+     */
+    void terminate_all();
+
+  private:
+    struct instance_t {
+      int id;
+      std::unique_ptr<proc_t> proc;
+      int sessions = 0;
+    };
+
+    instance_t *find(int instance);
+
+    std::mutex _lock;
+    std::vector<instance_t> _instances;
+    int _launching = 0;
+    int _next_id = 1;
+  };
 
   extern proc_t proc;
+  extern instances_t instances;
 
   extern int input_only_app_id;
   extern std::string input_only_app_id_str;
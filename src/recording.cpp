@@ -0,0 +1,884 @@
+/**
+ * @file src/recording.cpp
+ * @brief Definitions for recording the encoded video and audio of a session to a Matroska file.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <limits>
+#include <string_view>
+
+// local includes
+#include "logging.h"
+#include "platform/common.h"
+#include "recording.h"
+
+using namespace std::literals;
+
+namespace recording {
+  namespace mkv {
+    namespace {
+      // A cluster starts with each keyframe, and at least this often in milliseconds, so the
+      // times of its blocks fit their 16 bits
+      constexpr std::uint64_t max_cluster_duration = 30000;
+
+      // The samples Opus looks ahead with OPUS_APPLICATION_RESTRICTED_LOWDELAY at 48 kHz
+      constexpr std::uint16_t opus_pre_skip = 120;
+
+      enum element_e : std::uint32_t {
+        EBML = 0x1A45DFA3,
+        EBMLVersion = 0x4286,
+        EBMLReadVersion = 0x42F7,
+        EBMLMaxIDLength = 0x42F2,
+        EBMLMaxSizeLength = 0x42F3,
+        DocType = 0x4282,
+        DocTypeVersion = 0x4287,
+        DocTypeReadVersion = 0x4285,
+        Segment = 0x18538067,
+        Info = 0x1549A966,
+        TimestampScale = 0x2AD7B1,
+        MuxingApp = 0x4D80,
+        WritingApp = 0x5741,
+        Tracks = 0x1654AE6B,
+        TrackEntry = 0xAE,
+        TrackNumber = 0xD7,
+        TrackUID = 0x73C5,
+        TrackType = 0x83,
+        FlagLacing = 0x9C,
+        DefaultDuration = 0x23E383,
+        CodecID = 0x86,
+        CodecPrivate = 0x63A2,
+        CodecDelay = 0x56AA,
+        SeekPreRoll = 0x56BB,
+        Video = 0xE0,
+        PixelWidth = 0xB0,
+        PixelHeight = 0xBA,
+        Audio = 0xE1,
+        SamplingFrequency = 0xB5,
+        Channels = 0x9F,
+        Cluster = 0x1F43B675,
+        Timestamp = 0xE7,
+        SimpleBlock = 0xA3,
+      };
+
+      // The size of an element written while its content is still coming
+      constexpr std::uint64_t unknown_size = 0x01FFFFFFFFFFFFFF;
+
+      void put_id(std::vector<std::uint8_t> &buffer, std::uint32_t id) {
+        // The length of an ID is part of its value
+        for (int shift = std::max(0, (int) std::bit_width(id) - 1) / 8 * 8; shift >= 0; shift -= 8) {
+          buffer.push_back((std::uint8_t) (id >> shift));
+        }
+      }
+
+      void put_size(std::vector<std::uint8_t> &buffer, std::uint64_t size) {
+        if (size == unknown_size) {
+          for (int shift = 56; shift >= 0; shift -= 8) {
+            buffer.push_back((std::uint8_t) (size >> shift));
+          }
+          return;
+        }
+
+        // A size of all ones is reserved for unknown sizes
+        int length = 1;
+        while (length < 8 && size >= (1ull << (7 * length)) - 1) {
+          ++length;
+        }
+
+        auto vint = size | 1ull << (7 * length);
+        for (int shift = (length - 1) * 8; shift >= 0; shift -= 8) {
+          buffer.push_back((std::uint8_t) (vint >> shift));
+        }
+      }
+
+      void put_uint(std::vector<std::uint8_t> &buffer, std::uint32_t id, std::uint64_t value) {
+        int length = std::max(1, (int) (std::bit_width(value) + 7) / 8);
+
+        put_id(buffer, id);
+        put_size(buffer, length);
+        for (int shift = (length - 1) * 8; shift >= 0; shift -= 8) {
+          buffer.push_back((std::uint8_t) (value >> shift));
+        }
+      }
+
+      void put_float(std::vector<std::uint8_t> &buffer, std::uint32_t id, double value) {
+        auto bits = std::bit_cast<std::uint64_t>(value);
+
+        put_id(buffer, id);
+        put_size(buffer, 8);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+          buffer.push_back((std::uint8_t) (bits >> shift));
+        }
+      }
+
+      void put_binary(std::vector<std::uint8_t> &buffer, std::uint32_t id, const std::vector<std::uint8_t> &data) {
+        put_id(buffer, id);
+        put_size(buffer, data.size());
+        buffer.insert(std::end(buffer), std::begin(data), std::end(data));
+      }
+
+      void put_string(std::vector<std::uint8_t> &buffer, std::uint32_t id, std::string_view value) {
+        put_binary(buffer, id, std::vector<std::uint8_t> {std::begin(value), std::end(value)});
+      }
+
+      template<class T>
+      void put_le(std::vector<std::uint8_t> &buffer, T value) {
+        for (std::size_t x = 0; x < sizeof(T); ++x) {
+          buffer.push_back((std::uint8_t) (value >> (x * 8)));
+        }
+      }
+
+      template<class T>
+      void put_be(std::vector<std::uint8_t> &buffer, T value) {
+        for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+          buffer.push_back((std::uint8_t) (value >> shift));
+        }
+      }
+
+      /**
+       * @brief Reads the fields of a parameter set or sequence header, most significant bit first.
+       * @details Reading past the end gives zeroes and marks the reader as overrun.
+       */
+      class bit_reader_t {
+      public:
+        explicit bit_reader_t(std::vector<std::uint8_t> data):
+            _data {std::move(data)} {
+        }
+
+        std::uint32_t read(int bits) {
+          std::uint32_t value = 0;
+          for (int x = 0; x < bits; ++x, ++_pos) {
+            if (_pos >= _data.size() * 8) {
+              _overrun = true;
+              value <<= 1;
+              continue;
+            }
+
+            value = value << 1 | ((_data[_pos / 8] >> (7 - _pos % 8)) & 1);
+          }
+
+          return value;
+        }
+
+        void skip(int bits) {
+          _pos += bits;
+          _overrun = _overrun || _pos > _data.size() * 8;
+        }
+
+        /**
+         * @brief Read an Exp-Golomb coded value, ue(v) of H.264 and HEVC.
+         */
+        std::uint32_t ue() {
+          int zeroes = 0;
+          while (!read(1) && !_overrun && zeroes < 32) {
+            ++zeroes;
+          }
+
+          return (std::uint32_t) ((1ull << zeroes) - 1 + read(zeroes));
+        }
+
+        /**
+         * @brief Read a variable length value, uvlc() of AV1.
+         */
+        std::uint32_t uvlc() {
+          int zeroes = 0;
+          while (!read(1) && !_overrun && zeroes < 32) {
+            ++zeroes;
+          }
+
+          return zeroes >= 32 ? std::numeric_limits<std::uint32_t>::max() : (std::uint32_t) ((1ull << zeroes) - 1 + read(zeroes));
+        }
+
+        bool overrun() const {
+          return _overrun;
+        }
+
+      private:
+        std::vector<std::uint8_t> _data;
+        std::size_t _pos = 0;
+        bool _overrun = false;
+      };
+
+      /**
+       * @brief Get the payload of a NAL unit without its emulation prevention bytes.
+       */
+      std::vector<std::uint8_t> rbsp(std::span<const std::uint8_t> nal) {
+        std::vector<std::uint8_t> payload;
+        payload.reserve(nal.size());
+
+        int zeroes = 0;
+        for (auto byte : nal) {
+          if (zeroes >= 2 && byte == 3) {
+            zeroes = 0;
+            continue;
+          }
+
+          zeroes = byte ? 0 : zeroes + 1;
+          payload.push_back(byte);
+        }
+
+        return payload;
+      }
+
+      /**
+       * @brief Split an Annex B frame into its NAL units, without their start codes.
+       */
+      std::vector<std::span<const std::uint8_t>> nal_units(std::span<const std::uint8_t> frame) {
+        constexpr std::array<std::uint8_t, 3> start_code {0, 0, 1};
+
+        std::vector<std::span<const std::uint8_t>> units;
+        auto next = std::search(std::begin(frame), std::end(frame), std::begin(start_code), std::end(start_code));
+        while (next != std::end(frame)) {
+          auto unit = next + start_code.size();
+          next = std::search(unit, std::end(frame), std::begin(start_code), std::end(start_code));
+
+          // The zeroes before a start code are trailing_zero_8bits, or the first byte of a 4 byte start code
+          auto unit_end = next;
+          while (unit_end != unit && *(unit_end - 1) == 0) {
+            --unit_end;
+          }
+
+          if (unit_end != unit) {
+            units.emplace_back(unit, unit_end);
+          }
+        }
+
+        return units;
+      }
+
+      struct obu_t {
+        int type;
+        std::span<const std::uint8_t> data;  ///< The whole OBU, with its header.
+        std::span<const std::uint8_t> payload;
+      };
+
+      constexpr int obu_sequence_header = 1;
+      constexpr int obu_temporal_delimiter = 2;
+
+      /**
+       * @brief Split a temporal unit of AV1 into its OBUs.
+       */
+      std::vector<obu_t> obus(std::span<const std::uint8_t> frame) {
+        std::vector<obu_t> units;
+
+        std::size_t pos = 0;
+        while (pos < frame.size()) {
+          auto header = frame[pos];
+          std::size_t header_size = 1 + ((header >> 2) & 1);
+
+          // Without obu_has_size_field, the OBU takes the rest of the frame
+          std::size_t size = frame.size() - std::min(frame.size(), pos + header_size);
+          if (header & 0x02) {
+            size = 0;
+            for (int x = 0; x < 8; ++x) {
+              if (pos + header_size >= frame.size()) {
+                return units;
+              }
+
+              auto byte = frame[pos + header_size++];
+              size |= (std::size_t) (byte & 0x7F) << (x * 7);
+              if (!(byte & 0x80)) {
+                break;
+              }
+            }
+          }
+
+          if (pos + header_size + size > frame.size()) {
+            break;
+          }
+
+          units.push_back(obu_t {(header >> 3) & 0x0F, frame.subspan(pos, header_size + size), frame.subspan(pos + header_size, size)});
+          pos += header_size + size;
+        }
+
+        return units;
+      }
+
+      /**
+       * @brief Build the AVCDecoderConfigurationRecord of ISO/IEC 14496-15.
+       */
+      std::vector<std::uint8_t> avc_configuration(std::span<const std::uint8_t> frame) {
+        std::vector<std::span<const std::uint8_t>> sps_list, pps_list;
+        for (auto unit : nal_units(frame)) {
+          switch (unit[0] & 0x1F) {
+            case 7:
+              sps_list.push_back(unit);
+              break;
+            case 8:
+              pps_list.push_back(unit);
+              break;
+          }
+        }
+
+        if (sps_list.empty() || pps_list.empty() || sps_list[0].size() < 4) {
+          return {};
+        }
+
+        auto sps = sps_list[0];
+        std::vector<std::uint8_t> record {1, sps[1], sps[2], sps[3], 0xFF, (std::uint8_t) (0xE0 | sps_list.size())};
+        for (auto unit : sps_list) {
+          put_be<std::uint16_t>(record, unit.size());
+          record.insert(std::end(record), std::begin(unit), std::end(unit));
+        }
+
+        record.push_back((std::uint8_t) pps_list.size());
+        for (auto unit : pps_list) {
+          put_be<std::uint16_t>(record, unit.size());
+          record.insert(std::end(record), std::begin(unit), std::end(unit));
+        }
+
+        // The profiles with chroma_format_idc in their SPS also describe the chroma and bit depths here
+        constexpr std::array<std::uint8_t, 13> high_profiles {100, 110, 122, 244, 44, 83, 86, 118, 128, 138, 139, 134, 135};
+        if (std::find(std::begin(high_profiles), std::end(high_profiles), sps[1]) != std::end(high_profiles)) {
+          bit_reader_t bits {rbsp(sps.subspan(4))};
+          bits.ue();  // seq_parameter_set_id
+          auto chroma_format_idc = bits.ue();
+          if (chroma_format_idc == 3) {
+            bits.skip(1);  // separate_colour_plane_flag
+          }
+          auto bit_depth_luma_minus8 = bits.ue();
+          auto bit_depth_chroma_minus8 = bits.ue();
+
+          record.push_back((std::uint8_t) (0xFC | (chroma_format_idc & 3)));
+          record.push_back((std::uint8_t) (0xF8 | (bit_depth_luma_minus8 & 7)));
+          record.push_back((std::uint8_t) (0xF8 | (bit_depth_chroma_minus8 & 7)));
+          record.push_back(0);  // numOfSequenceParameterSetExt
+        }
+
+        return record;
+      }
+
+      /**
+       * @brief Build the HEVCDecoderConfigurationRecord of ISO/IEC 14496-15.
+       */
+      std::vector<std::uint8_t> hevc_configuration(std::span<const std::uint8_t> frame) {
+        // VPS, SPS and PPS
+        std::array<std::vector<std::span<const std::uint8_t>>, 3> arrays;
+        for (auto unit : nal_units(frame)) {
+          auto type = (unit[0] >> 1) & 0x3F;
+          if (type >= 32 && type <= 34 && unit.size() > 2) {
+            arrays[type - 32].push_back(unit);
+          }
+        }
+
+        if (std::any_of(std::begin(arrays), std::end(arrays), [](auto &units) {
+              return units.empty();
+            })) {
+          return {};
+        }
+
+        bit_reader_t bits {rbsp(arrays[1][0].subspan(2))};
+        bits.skip(4);  // sps_video_parameter_set_id
+        auto max_sub_layers_minus1 = bits.read(3);
+        auto temporal_id_nesting = bits.read(1);
+
+        // general_profile_space to general_level_idc
+        std::array<std::uint8_t, 12> general_profile_tier_level;
+        for (auto &byte : general_profile_tier_level) {
+          byte = (std::uint8_t) bits.read(8);
+        }
+
+        std::array<bool, 8> sub_layer_profile_present {}, sub_layer_level_present {};
+        for (std::uint32_t x = 0; x < max_sub_layers_minus1; ++x) {
+          sub_layer_profile_present[x] = bits.read(1);
+          sub_layer_level_present[x] = bits.read(1);
+        }
+        if (max_sub_layers_minus1 > 0) {
+          bits.skip(2 * (8 - max_sub_layers_minus1));
+        }
+        for (std::uint32_t x = 0; x < max_sub_layers_minus1; ++x) {
+          bits.skip((sub_layer_profile_present[x] ? 88 : 0) + (sub_layer_level_present[x] ? 8 : 0));
+        }
+
+        bits.ue();  // sps_seq_parameter_set_id
+        auto chroma_format_idc = bits.ue();
+        if (chroma_format_idc == 3) {
+          bits.skip(1);  // separate_colour_plane_flag
+        }
+        bits.ue();  // pic_width_in_luma_samples
+        bits.ue();  // pic_height_in_luma_samples
+        if (bits.read(1)) {
+          // conf_win_left_offset to conf_win_bottom_offset
+          for (int x = 0; x < 4; ++x) {
+            bits.ue();
+          }
+        }
+        auto bit_depth_luma_minus8 = bits.ue();
+        auto bit_depth_chroma_minus8 = bits.ue();
+
+        if (bits.overrun()) {
+          return {};
+        }
+
+        std::vector<std::uint8_t> record {1};
+        record.insert(std::end(record), std::begin(general_profile_tier_level), std::end(general_profile_tier_level));
+        put_be<std::uint16_t>(record, 0xF000);  // min_spatial_segmentation_idc
+        record.push_back(0xFC);  // parallelismType
+        record.push_back((std::uint8_t) (0xFC | (chroma_format_idc & 3)));
+        record.push_back((std::uint8_t) (0xF8 | (bit_depth_luma_minus8 & 7)));
+        record.push_back((std::uint8_t) (0xF8 | (bit_depth_chroma_minus8 & 7)));
+        put_be<std::uint16_t>(record, 0);  // avgFrameRate
+        record.push_back((std::uint8_t) ((max_sub_layers_minus1 + 1) << 3 | temporal_id_nesting << 2 | 3));
+        record.push_back((std::uint8_t) arrays.size());
+
+        // The parameter sets stay in the frames as well, so the arrays aren't complete
+        for (std::size_t x = 0; x < arrays.size(); ++x) {
+          record.push_back((std::uint8_t) (32 + x));
+          put_be<std::uint16_t>(record, arrays[x].size());
+          for (auto unit : arrays[x]) {
+            put_be<std::uint16_t>(record, unit.size());
+            record.insert(std::end(record), std::begin(unit), std::end(unit));
+          }
+        }
+
+        return record;
+      }
+
+      /**
+       * @brief Build the AV1CodecConfigurationRecord of the AV1 Codec ISO Media File Format Binding.
+       */
+      std::vector<std::uint8_t> av1_configuration(std::span<const std::uint8_t> frame) {
+        auto units = obus(frame);
+        auto sequence_header = std::find_if(std::begin(units), std::end(units), [](const obu_t &obu) {
+          return obu.type == obu_sequence_header;
+        });
+        if (sequence_header == std::end(units)) {
+          return {};
+        }
+
+        bit_reader_t bits {std::vector<std::uint8_t> {std::begin(sequence_header->payload), std::end(sequence_header->payload)}};
+        auto seq_profile = bits.read(3);
+        bits.skip(1);  // still_picture
+        auto reduced_still_picture_header = bits.read(1);
+
+        std::uint32_t seq_level_idx_0 = 0;
+        std::uint32_t seq_tier_0 = 0;
+        if (reduced_still_picture_header) {
+          seq_level_idx_0 = bits.read(5);
+        } else {
+          if (bits.read(1)) {
+            // timing_info
+            bits.skip(64);
+            if (bits.read(1)) {
+              bits.uvlc();
+            }
+          }
+
+          std::uint32_t buffer_delay_length = 0;
+          auto decoder_model_info_present = bits.read(1);
+          if (decoder_model_info_present) {
+            buffer_delay_length = bits.read(5) + 1;
+            bits.skip(32 + 5 + 5);
+          }
+
+          auto initial_display_delay_present = bits.read(1);
+          auto operating_points = bits.read(5) + 1;
+          for (std::uint32_t x = 0; x < operating_points; ++x) {
+            bits.skip(12);  // operating_point_idc
+            auto seq_level_idx = bits.read(5);
+            auto seq_tier = seq_level_idx > 7 ? bits.read(1) : 0;
+            if (x == 0) {
+              seq_level_idx_0 = seq_level_idx;
+              seq_tier_0 = seq_tier;
+            }
+
+            if (decoder_model_info_present && bits.read(1)) {
+              bits.skip(2 * buffer_delay_length + 1);
+            }
+            if (initial_display_delay_present && bits.read(1)) {
+              bits.skip(4);
+            }
+          }
+        }
+
+        auto frame_width_bits = bits.read(4) + 1;
+        auto frame_height_bits = bits.read(4) + 1;
+        bits.skip(frame_width_bits + frame_height_bits);
+        if (!reduced_still_picture_header && bits.read(1)) {
+          // delta_frame_id_length_minus_2 and additional_frame_id_length_minus_1
+          bits.skip(4 + 3);
+        }
+
+        // use_128x128_superblock, enable_filter_intra and enable_intra_edge_filter
+        bits.skip(3);
+        if (!reduced_still_picture_header) {
+          // enable_interintra_compound, enable_masked_compound, enable_warped_motion and enable_dual_filter
+          bits.skip(4);
+          auto enable_order_hint = bits.read(1);
+          if (enable_order_hint) {
+            // enable_jnt_comp and enable_ref_frame_mvs
+            bits.skip(2);
+          }
+
+          // SELECT_SCREEN_CONTENT_TOOLS when seq_choose_screen_content_tools is set
+          auto seq_force_screen_content_tools = bits.read(1) ? 2 : bits.read(1);
+          if (seq_force_screen_content_tools > 0 && !bits.read(1)) {
+            bits.skip(1);  // seq_force_integer_mv
+          }
+          if (enable_order_hint) {
+            bits.skip(3);  // order_hint_bits_minus_1
+          }
+        }
+
+        // enable_superres, enable_cdef and enable_restoration
+        bits.skip(3);
+
+        auto high_bitdepth = bits.read(1);
+        auto twelve_bit = seq_profile == 2 && high_bitdepth ? bits.read(1) : 0;
+        auto mono_chrome = seq_profile == 1 ? 0 : bits.read(1);
+
+        std::uint32_t color_primaries = 2, transfer_characteristics = 2, matrix_coefficients = 2;
+        if (bits.read(1)) {
+          color_primaries = bits.read(8);
+          transfer_characteristics = bits.read(8);
+          matrix_coefficients = bits.read(8);
+        }
+
+        std::uint32_t subsampling_x = 1, subsampling_y = 1, chroma_sample_position = 0;
+        if (!mono_chrome) {
+          // sRGB is always 4:4:4
+          if (color_primaries == 1 && transfer_characteristics == 13 && matrix_coefficients == 0) {
+            subsampling_x = subsampling_y = 0;
+          } else {
+            bits.skip(1);  // color_range
+            if (seq_profile == 1) {
+              subsampling_x = subsampling_y = 0;
+            } else if (seq_profile == 2) {
+              subsampling_x = twelve_bit ? bits.read(1) : 1;
+              subsampling_y = twelve_bit && subsampling_x ? bits.read(1) : 0;
+            }
+
+            if (subsampling_x && subsampling_y) {
+              chroma_sample_position = bits.read(2);
+            }
+          }
+        }
+
+        if (bits.overrun()) {
+          return {};
+        }
+
+        std::vector<std::uint8_t> record {
+          0x81,  // marker and version
+          (std::uint8_t) (seq_profile << 5 | seq_level_idx_0),
+          (std::uint8_t) (seq_tier_0 << 7 | high_bitdepth << 6 | twelve_bit << 5 | mono_chrome << 4 | subsampling_x << 3 | subsampling_y << 2 | chroma_sample_position),
+          0,  // No initial_presentation_delay
+        };
+        record.insert(std::end(record), std::begin(sequence_header->data), std::end(sequence_header->data));
+
+        return record;
+      }
+
+      std::string_view codec_id(int videoFormat) {
+        switch (videoFormat) {
+          case 1:
+            return "V_MPEGH/ISO/HEVC"sv;
+          case 2:
+            return "V_AV1"sv;
+          default:
+            return "V_MPEG4/ISO/AVC"sv;
+        }
+      }
+
+      /**
+       * @brief The identification header of an Opus stream, from RFC 7845.
+       */
+      std::vector<std::uint8_t> opus_head(const config_t &config) {
+        std::vector<std::uint8_t> head {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd'};
+
+        // Mapping family 0 only describes a single mono or stereo stream. The surround layouts of
+        // the clients aren't in the Vorbis channel order of family 1, so theirs is left undefined.
+        bool single_stream = config.channels <= 2 && config.streams == 1;
+
+        head.push_back(1);
+        head.push_back((std::uint8_t) config.channels);
+        put_le<std::uint16_t>(head, opus_pre_skip);
+        put_le<std::uint32_t>(head, config.sampleRate);
+        put_le<std::uint16_t>(head, 0);
+        head.push_back(single_stream ? 0 : 255);
+
+        if (!single_stream) {
+          head.push_back((std::uint8_t) config.streams);
+          head.push_back((std::uint8_t) config.coupledStreams);
+          head.insert(std::end(head), config.mapping, config.mapping + std::min(config.channels, 8));
+        }
+
+        return head;
+      }
+    }  // namespace
+
+    void put_header(std::vector<std::uint8_t> &buffer) {
+      std::vector<std::uint8_t> ebml;
+      put_uint(ebml, EBMLVersion, 1);
+      put_uint(ebml, EBMLReadVersion, 1);
+      put_uint(ebml, EBMLMaxIDLength, 4);
+      put_uint(ebml, EBMLMaxSizeLength, 8);
+      put_string(ebml, DocType, "matroska"sv);
+      put_uint(ebml, DocTypeVersion, 4);
+      put_uint(ebml, DocTypeReadVersion, 2);
+      put_binary(buffer, EBML, ebml);
+
+      // The segment grows for as long as the session is recorded
+      put_id(buffer, Segment);
+      put_size(buffer, unknown_size);
+
+      std::vector<std::uint8_t> info;
+      put_uint(info, TimestampScale, 1000000);
+      put_string(info, MuxingApp, "Apollo"sv);
+      put_string(info, WritingApp, "Apollo"sv);
+      put_binary(buffer, Info, info);
+    }
+
+    void put_tracks(std::vector<std::uint8_t> &buffer, const config_t &config, const std::vector<std::uint8_t> &video_private) {
+      std::vector<std::uint8_t> video;
+      put_uint(video, PixelWidth, config.width);
+      put_uint(video, PixelHeight, config.height);
+
+      std::vector<std::uint8_t> video_track_entry;
+      put_uint(video_track_entry, TrackNumber, video_track);
+      put_uint(video_track_entry, TrackUID, video_track);
+      put_uint(video_track_entry, TrackType, 1);
+      put_uint(video_track_entry, FlagLacing, 0);
+      if (config.framerate > 0) {
+        put_uint(video_track_entry, DefaultDuration, 1000000000 / config.framerate);
+      }
+      put_string(video_track_entry, CodecID, codec_id(config.videoFormat));
+      if (!video_private.empty()) {
+        put_binary(video_track_entry, CodecPrivate, video_private);
+      }
+      put_binary(video_track_entry, Video, video);
+
+      std::vector<std::uint8_t> audio;
+      put_float(audio, SamplingFrequency, config.sampleRate);
+      put_uint(audio, Channels, config.channels);
+
+      std::vector<std::uint8_t> audio_track_entry;
+      put_uint(audio_track_entry, TrackNumber, audio_track);
+      put_uint(audio_track_entry, TrackUID, audio_track);
+      put_uint(audio_track_entry, TrackType, 2);
+      put_uint(audio_track_entry, FlagLacing, 0);
+      put_uint(audio_track_entry, DefaultDuration, (std::uint64_t) config.packetDuration * 1000000);
+      put_string(audio_track_entry, CodecID, "A_OPUS"sv);
+      put_binary(audio_track_entry, CodecPrivate, opus_head(config));
+      put_uint(audio_track_entry, CodecDelay, (std::uint64_t) opus_pre_skip * 1000000000 / config.sampleRate);
+      put_uint(audio_track_entry, SeekPreRoll, 80000000);
+      put_binary(audio_track_entry, Audio, audio);
+
+      std::vector<std::uint8_t> tracks;
+      put_binary(tracks, TrackEntry, video_track_entry);
+      put_binary(tracks, TrackEntry, audio_track_entry);
+      put_binary(buffer, Tracks, tracks);
+    }
+
+    std::vector<std::uint8_t> video_private(int videoFormat, std::span<const std::uint8_t> keyframe) {
+      switch (videoFormat) {
+        case 1:
+          return hevc_configuration(keyframe);
+        case 2:
+          return av1_configuration(keyframe);
+        default:
+          return avc_configuration(keyframe);
+      }
+    }
+
+    std::vector<std::uint8_t> video_block(int videoFormat, std::span<const std::uint8_t> frame) {
+      std::vector<std::uint8_t> block;
+      block.reserve(frame.size() + 16);
+
+      if (videoFormat == 2) {
+        for (auto &obu : obus(frame)) {
+          if (obu.type != obu_temporal_delimiter) {
+            block.insert(std::end(block), std::begin(obu.data), std::end(obu.data));
+          }
+        }
+
+        return block;
+      }
+
+      // The length of the NAL units takes 4 bytes, as the decoder configuration says
+      for (auto unit : nal_units(frame)) {
+        put_be<std::uint32_t>(block, unit.size());
+        block.insert(std::end(block), std::begin(unit), std::end(unit));
+      }
+
+      return block;
+    }
+
+    void put_cluster(std::vector<std::uint8_t> &buffer, std::uint64_t timestamp) {
+      put_id(buffer, Cluster);
+      put_size(buffer, unknown_size);
+      put_uint(buffer, Timestamp, timestamp);
+    }
+
+    void put_simple_block(std::vector<std::uint8_t> &buffer, std::uint64_t track, std::int16_t relative, bool keyframe, const std::vector<std::uint8_t> &data) {
+      std::vector<std::uint8_t> track_number;
+      put_size(track_number, track);
+
+      put_id(buffer, SimpleBlock);
+      put_size(buffer, track_number.size() + 3 + data.size());
+      buffer.insert(std::end(buffer), std::begin(track_number), std::end(track_number));
+      buffer.push_back((std::uint8_t) ((std::uint16_t) relative >> 8));
+      buffer.push_back((std::uint8_t) relative);
+      buffer.push_back(keyframe ? 0x80 : 0x00);
+      buffer.insert(std::end(buffer), std::begin(data), std::end(data));
+    }
+  }  // namespace mkv
+
+  recorder_t::recorder_t(const std::filesystem::path &file, const config_t &config, std::size_t max_queued):
+      _out {file, std::ios::binary | std::ios::trunc},
+      _config {config},
+      _max_queued {max_queued} {
+    if (!_out) {
+      _failed = true;
+      return;
+    }
+
+    mkv::put_header(_buffer);
+    _out.write((const char *) _buffer.data(), _buffer.size());
+
+    _writer = std::thread {&recorder_t::writer, this};
+  }
+
+  recorder_t::~recorder_t() {
+    if (!_writer.joinable()) {
+      return;
+    }
+
+    {
+      std::lock_guard lg {_lock};
+      _stopping = true;
+    }
+    _cv.notify_one();
+    _writer.join();
+
+    if (auto dropped = _dropped.load(std::memory_order_relaxed)) {
+      BOOST_LOG(warning) << "The recording couldn't keep up with the stream, "sv << dropped << " frames and packets weren't recorded"sv;
+    }
+  }
+
+  recorder_t::operator bool() const {
+    return !_failed.load(std::memory_order_relaxed);
+  }
+
+  bool recorder_t::video(const std::uint8_t *data, std::size_t size, bool keyframe, std::chrono::steady_clock::time_point captured) {
+    return push(mkv::video_track, data, size, keyframe, captured);
+  }
+
+  bool recorder_t::audio(const std::uint8_t *data, std::size_t size, std::chrono::steady_clock::time_point captured) {
+    // Every Opus packet can be decoded on its own
+    return push(mkv::audio_track, data, size, true, captured);
+  }
+
+  std::uint64_t recorder_t::dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  bool recorder_t::push(std::uint64_t track, const std::uint8_t *data, std::size_t size, bool keyframe, std::chrono::steady_clock::time_point captured) {
+    if (_failed.load(std::memory_order_relaxed)) {
+      return false;
+    }
+
+    bool video = track == mkv::video_track;
+
+    std::lock_guard lg {_lock};
+
+    // Until the next keyframe, video frames depend on one that wasn't recorded
+    if (video && !keyframe && _waiting_keyframe) {
+      if (_started) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+      return false;
+    }
+
+    // The audio before the first keyframe has no video to go with
+    if (!video && !_started) {
+      return false;
+    }
+
+    if (_queued + size > _max_queued) {
+      _waiting_keyframe = _waiting_keyframe || video;
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    if (video) {
+      _started = true;
+      _waiting_keyframe = false;
+    }
+
+    _queue.push_back(frame_t {track, keyframe, captured, std::vector<std::uint8_t> {data, data + size}});
+    _queued += size;
+    _cv.notify_one();
+
+    return true;
+  }
+
+  void recorder_t::write(frame_t &frame) {
+    _buffer.clear();
+
+    // Nothing is queued before the first keyframe, which has the parameter sets of the video
+    if (!_start) {
+      _start = frame.captured;
+
+      auto video_private = mkv::video_private(_config.videoFormat, frame.data);
+      if (video_private.empty()) {
+        BOOST_LOG(warning) << "No parameter sets in the first keyframe, the recording may not play back"sv;
+      }
+      mkv::put_tracks(_buffer, _config, video_private);
+    }
+
+    // The audio captured just before the first keyframe starts with it
+    auto timestamp = (std::uint64_t) std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(frame.captured - *_start).count(), 0);
+
+    if (!_cluster || (frame.track == mkv::video_track && frame.keyframe) || timestamp > *_cluster + mkv::max_cluster_duration) {
+      // What was written of the previous cluster can be played back from here on, even if the host stops
+      _out.flush();
+
+      // The clusters of a segment can't go back in time
+      _cluster = std::max(timestamp, _cluster.value_or(0));
+      mkv::put_cluster(_buffer, *_cluster);
+    }
+
+    auto relative = std::clamp<std::int64_t>((std::int64_t) timestamp - (std::int64_t) *_cluster, std::numeric_limits<std::int16_t>::min(), std::numeric_limits<std::int16_t>::max());
+    if (frame.track == mkv::video_track) {
+      frame.data = mkv::video_block(_config.videoFormat, frame.data);
+    }
+    mkv::put_simple_block(_buffer, frame.track, (std::int16_t) relative, frame.keyframe, frame.data);
+
+    _out.write((const char *) _buffer.data(), _buffer.size());
+    if (!_out) {
+      BOOST_LOG(error) << "Couldn't write to the recording, recording stopped"sv;
+      _failed = true;
+    }
+  }
+
+  void recorder_t::writer() {
+    // The recording only gets the time the stream leaves over
+    platf::adjust_thread_priority(platf::thread_priority_e::low);
+
+    std::unique_lock ul {_lock};
+    while (true) {
+      _cv.wait(ul, [this]() {
+        return _stopping || !_queue.empty();
+      });
+
+      // What was queued before stopping is still written
+      if (_queue.empty()) {
+        break;
+      }
+
+      auto frame = std::move(_queue.front());
+      _queue.pop_front();
+      _queued -= frame.data.size();
+
+      ul.unlock();
+      if (!_failed.load(std::memory_order_relaxed)) {
+        write(frame);
+      }
+      ul.lock();
+    }
+
+    _out.flush();
+  }
+}  // namespace recording
@@ -0,0 +1,182 @@
+/**
+ * @file src/recording.h
+ * @brief Declarations for recording the encoded video and audio of a session to a Matroska file.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace recording {
+  /**
+   * @brief The streams of a recording.
+   */
+  struct config_t {
+    int videoFormat;  ///< 0 - H.264, 1 - HEVC, 2 - AV1
+    int width;
+    int height;
+    int framerate;
+
+    int sampleRate;
+    int channels;
+    int streams;
+    int coupledStreams;
+    std::uint8_t mapping[8];  ///< The Opus stream of each channel.
+    int packetDuration;  ///< The duration of an audio packet in milliseconds.
+  };
+
+  namespace mkv {
+    constexpr std::uint64_t video_track = 1;
+    constexpr std::uint64_t audio_track = 2;
+
+    /**
+     * @brief Append the EBML header and the start of a live segment of unknown size.
+     * @param buffer The buffer to append to.
+     */
+    void put_header(std::vector<std::uint8_t> &buffer);
+
+    /**
+     * @brief Append the tracks of the segment.
+     * @param buffer The buffer to append to.
+     * @param config The streams of the recording.
+     * @param video_private The decoder configuration of the video, see video_private().
+     */
+    void put_tracks(std::vector<std::uint8_t> &buffer, const config_t &config, const std::vector<std::uint8_t> &video_private);
+
+    /**
+     * @brief Get the decoder configuration of the video from the parameter sets of a keyframe.
+     * @details That's an AVCDecoderConfigurationRecord for H.264, an HEVCDecoderConfigurationRecord for HEVC
+     *          and an AV1CodecConfigurationRecord for AV1.
+     * @param videoFormat 0 - H.264, 1 - HEVC, 2 - AV1
+     * @param keyframe The keyframe, in Annex B for H.264 and HEVC or as OBUs for AV1.
+     * @return The decoder configuration, empty if the keyframe lacks the parameter sets.
+     */
+    std::vector<std::uint8_t> video_private(int videoFormat, std::span<const std::uint8_t> keyframe);
+
+    /**
+     * @brief Get a video frame as Matroska stores it.
+     * @details The NAL units of H.264 and HEVC are prefixed with their size instead of a start code,
+     *          and the temporal delimiters of AV1 are left out.
+     * @param videoFormat 0 - H.264, 1 - HEVC, 2 - AV1
+     * @param frame The frame, as it's sent.
+     * @return The frame to store in a block.
+     */
+    std::vector<std::uint8_t> video_block(int videoFormat, std::span<const std::uint8_t> frame);
+
+    /**
+     * @brief Append the start of a cluster of unknown size.
+     * @param buffer The buffer to append to.
+     * @param timestamp The time of the cluster in milliseconds, from the start of the segment.
+     */
+    void put_cluster(std::vector<std::uint8_t> &buffer, std::uint64_t timestamp);
+
+    /**
+     * @brief Append a frame as a SimpleBlock of the current cluster.
+     * @param buffer The buffer to append to.
+     * @param track The track of the frame.
+     * @param relative The time of the frame in milliseconds, from the start of the cluster.
+     * @param keyframe Whether the frame doesn't depend on previous ones.
+     * @param data The frame.
+     */
+    void put_simple_block(std::vector<std::uint8_t> &buffer, std::uint64_t track, std::int16_t relative, bool keyframe, const std::vector<std::uint8_t> &data);
+  }  // namespace mkv
+
+  /**
+   * @brief Writes the encoded video and audio of a session to a Matroska file, off the threads sending them.
+   * @details The frames are copied into a queue of bounded size a low priority thread writes from, so a slow disk
+   *          drops frames from the recording rather than delaying the stream. Once a video frame is dropped, the
+   *          following ones are too until the next keyframe, as they can't be decoded without it.
+   */
+  class recorder_t {
+  public:
+    /**
+     * @brief Create the recording file and start writing to it.
+     * @param file The recording file, which is overwritten.
+     * @param config The streams of the session.
+     * @param max_queued The number of bytes queued before frames are dropped.
+     */
+    recorder_t(const std::filesystem::path &file, const config_t &config, std::size_t max_queued = 64 * 1024 * 1024);
+
+    /**
+     * @brief Write what's queued, then close the recording.
+     */
+    ~recorder_t();
+
+    /**
+     * @brief Check if the recording file could be created, and no write failed since.
+     */
+    explicit operator bool() const;
+
+    /**
+     * @brief Queue an encoded video frame.
+     * @details Nothing is recorded until the first keyframe.
+     * @param data The frame.
+     * @param size The size of the frame.
+     * @param keyframe Whether the frame doesn't depend on previous ones.
+     * @param captured When the frame was captured.
+     * @return false if the frame was dropped.
+     */
+    bool video(const std::uint8_t *data, std::size_t size, bool keyframe, std::chrono::steady_clock::time_point captured);
+
+    /**
+     * @brief Queue an encoded audio packet.
+     * @details Nothing is recorded until the first video keyframe.
+     * @param data The packet.
+     * @param size The size of the packet.
+     * @param captured When the samples of the packet were captured.
+     * @return false if the packet was dropped.
+     */
+    bool audio(const std::uint8_t *data, std::size_t size, std::chrono::steady_clock::time_point captured);
+
+    /**
+     * @brief Get the number of frames and packets dropped so far.
+     */
+    std::uint64_t dropped() const;
+
+  private:
+    struct frame_t {
+      std::uint64_t track;
+      bool keyframe;
+      std::chrono::steady_clock::time_point captured;
+      std::vector<std::uint8_t> data;
+    };
+
+    bool push(std::uint64_t track, const std::uint8_t *data, std::size_t size, bool keyframe, std::chrono::steady_clock::time_point captured);
+    void write(frame_t &frame);
+    void writer();
+
+    std::ofstream _out;
+    config_t _config;
+    std::atomic_bool _failed {false};
+    std::vector<std::uint8_t> _buffer;
+
+    // When the first frame written was captured, and the time of the cluster written to. Only touched by the writer,
+    // which writes the tracks along with the first frame, the keyframe the video track is configured from.
+    std::optional<std::chrono::steady_clock::time_point> _start;
+    std::optional<std::uint64_t> _cluster;
+
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::deque<frame_t> _queue;
+    std::size_t _queued = 0;
+    std::size_t _max_queued;
+    bool _started = false;
+    bool _waiting_keyframe = true;
+    bool _stopping = false;
+    std::atomic_uint64_t _dropped {0};
+
+    std::thread _writer;
+  };
+}  // namespace recording
@@ -0,0 +1,117 @@
+/**
+ * @file src/region_of_interest.cpp
+ * @brief Definitions for the regions of a frame the encoder spends more bits on.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
+// local includes
+#include "region_of_interest.h"
+
+namespace video {
+  namespace {
+    // The eyes follow the cursor, and the text next to it is what's read
+    constexpr int cursor_margin = 128;
+
+    // Damage this large is video or scrolling, where emphasis doesn't pay off
+    constexpr double max_damage_share = 0.5;
+
+    // Encoders handle only a few regions well, so the damage is merged beyond this
+    constexpr std::size_t max_damage_regions = 8;
+
+    platf::damage_rect_t bounding_box(const platf::damage_rect_t &a, const platf::damage_rect_t &b) {
+      auto left = std::min(a.x, b.x);
+      auto top = std::min(a.y, b.y);
+      auto right = std::max(a.x + a.width, b.x + b.width);
+      auto bottom = std::max(a.y + a.height, b.y + b.height);
+
+      return {left, top, right - left, bottom - top};
+    }
+  }  // namespace
+
+  std::vector<region_of_interest_t> make_regions_of_interest(
+    const std::optional<platf::damage_rect_t> &cursor,
+    const std::optional<std::vector<platf::damage_rect_t>> &damage,
+    const std::vector<platf::damage_rect_t> &hints,
+    int in_width,
+    int in_height,
+    int out_width,
+    int out_height,
+    int qp_offset
+  ) {
+    std::vector<region_of_interest_t> regions;
+    if (qp_offset == 0 || in_width <= 0 || in_height <= 0 || out_width <= 0 || out_height <= 0) {
+      return regions;
+    }
+
+    // Same scaling as the encode devices, the image is centered in the frame
+    auto scale = std::min(out_width / (double) in_width, out_height / (double) in_height);
+    auto offset_x = (out_width - in_width * scale) / 2;
+    auto offset_y = (out_height - in_height * scale) / 2;
+
+    auto add = [&](const platf::damage_rect_t &rect, int offset) {
+      auto left = std::clamp((int) std::floor(rect.x * scale + offset_x), 0, out_width);
+      auto top = std::clamp((int) std::floor(rect.y * scale + offset_y), 0, out_height);
+      auto right = std::clamp((int) std::ceil((rect.x + rect.width) * scale + offset_x), 0, out_width);
+      auto bottom = std::clamp((int) std::ceil((rect.y + rect.height) * scale + offset_y), 0, out_height);
+
+      if (left < right && top < bottom) {
+        regions.push_back({{left, top, right - left, bottom - top}, offset});
+      }
+    };
+
+    for (auto &hint : hints) {
+      add(hint, qp_offset);
+    }
+
+    if (cursor && cursor->width > 0 && cursor->height > 0) {
+      add({cursor->x - cursor_margin, cursor->y - cursor_margin, cursor->width + cursor_margin * 2, cursor->height + cursor_margin * 2}, qp_offset);
+    }
+
+    if (damage && !damage->empty()) {
+      std::int64_t area = 0;
+      for (auto &rect : *damage) {
+        area += (std::int64_t) rect.width * rect.height;
+      }
+
+      if (area <= in_width * (std::int64_t) in_height * max_damage_share) {
+        auto rects = *damage;
+        while (rects.size() > max_damage_regions) {
+          auto last = rects.back();
+          rects.pop_back();
+          rects.back() = bounding_box(rects.back(), last);
+        }
+
+        for (auto &rect : rects) {
+          add(rect, qp_offset / 2);
+        }
+      }
+    }
+
+    return regions;
+  }
+
+  std::vector<std::int8_t> make_qp_delta_map(const std::vector<region_of_interest_t> &regions, int width, int height, int block_size) {
+    auto columns = (width + block_size - 1) / block_size;
+    auto rows = (height + block_size - 1) / block_size;
+    std::vector<std::int8_t> map((std::size_t) columns * rows, 0);
+
+    // Earlier regions are drawn last, so they take precedence
+    for (auto it = std::rbegin(regions); it != std::rend(regions); ++it) {
+      auto &rect = it->rect;
+      auto offset = (std::int8_t) std::clamp(it->qp_offset, -51, 51);
+
+      auto left = std::clamp(rect.x / block_size, 0, columns);
+      auto top = std::clamp(rect.y / block_size, 0, rows);
+      auto right = std::clamp((rect.x + rect.width + block_size - 1) / block_size, 0, columns);
+      auto bottom = std::clamp((rect.y + rect.height + block_size - 1) / block_size, 0, rows);
+
+      for (auto y = top; y < bottom; ++y) {
+        std::fill(std::begin(map) + y * columns + left, std::begin(map) + y * columns + right, offset);
+      }
+    }
+
+    return map;
+  }
+}  // namespace video
@@ -0,0 +1,61 @@
+/**
+ * @file src/region_of_interest.h
+ * @brief Declarations for the regions of a frame the encoder spends more bits on.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace video {
+  /**
+   * @brief A region of the frame to encode at a different quality than the rest.
+   */
+  struct region_of_interest_t {
+    platf::damage_rect_t rect;  ///< In pixels of the encoded frame.
+    int qp_offset;  ///< Added to the QP of the region, negative values spend more bits on it.
+
+    bool operator==(const region_of_interest_t &) const = default;
+  };
+
+  /**
+   * @brief Pick the regions of a captured image the viewer is likely to look at.
+   * @details The hints come first, then the surroundings of the cursor, then what changed since the
+   *          previous image, which gets half the offset. Where regions overlap, the first one takes precedence.
+   *          The image is scaled into the frame the way the encode devices do, keeping the aspect ratio.
+   * @param cursor Where the cursor was drawn into the image, if anywhere.
+   * @param damage What changed since the previous image, if known.
+   * @param hints Regions with text or UI in pixels of the image.
+   * @param in_width The width of the image.
+   * @param in_height The height of the image.
+   * @param out_width The width of the encoded frame.
+   * @param out_height The height of the encoded frame.
+   * @param qp_offset The QP offset of the regions, negative.
+   * @return The regions in pixels of the encoded frame.
+   */
+  std::vector<region_of_interest_t> make_regions_of_interest(
+    const std::optional<platf::damage_rect_t> &cursor,
+    const std::optional<std::vector<platf::damage_rect_t>> &damage,
+    const std::vector<platf::damage_rect_t> &hints,
+    int in_width,
+    int in_height,
+    int out_width,
+    int out_height,
+    int qp_offset
+  );
+
+  /**
+   * @brief Rasterize regions of interest into a map of QP offsets per block, in raster scan order.
+   * @param regions The regions, where the first one takes precedence where they overlap.
+   * @param width The width of the frame.
+   * @param height The height of the frame.
+   * @param block_size The width and height of a block, e.g. 16 for H.264 macroblocks.
+   * @return The QP offset of each block, partially covered blocks included.
+   */
+  std::vector<std::int8_t> make_qp_delta_map(const std::vector<region_of_interest_t> &regions, int width, int height, int block_size);
+}  // namespace video
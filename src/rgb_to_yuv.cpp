@@ -0,0 +1,234 @@
+/**
+ * @file src/rgb_to_yuv.cpp
+ * @brief Definitions for the vectorized RGB to YUV 4:2:0 software conversion.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <vector>
+
+// local includes
+#include "rgb_to_yuv.h"
+
+namespace video {
+  namespace {
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define RGB_TO_YUV_X86 1
+#endif
+
+    /**
+     * @brief Convert a pair of rows.
+     * @details Written so the compiler can vectorize it for the ISA of the caller:
+     *          every pixel is independent, and the planes never alias.
+     * @tparam T The type of a sample.
+     * @tparam interleaved Whether U and V share a plane, like NV12 and P010.
+     * @tparam shift The shift of the samples in the MSBs, like P010.
+     */
+    template<class T, bool interleaved, int shift>
+    [[gnu::always_inline]] inline void convert_row_pair(const rgb_to_yuv_t::coefficients_t &c, const std::uint8_t *__restrict src0, const std::uint8_t *__restrict src1, T *__restrict y0, T *__restrict y1, T *__restrict u, T *__restrict v, int pairs) {
+      const auto cy0 = c.y[0], cy1 = c.y[1], cy2 = c.y[2], y_offset = c.y_offset;
+      const auto cu0 = c.u[0], cu1 = c.u[1], cu2 = c.u[2], u_offset = c.u_offset;
+      const auto cv0 = c.v[0], cv1 = c.v[1], cv2 = c.v[2], v_offset = c.v_offset;
+      const auto max = c.max;
+
+      for (int x = 0; x < pairs; ++x) {
+        // BGR0, two pixels wide on two rows
+        const auto *p00 = src0 + x * 8;
+        const auto *p10 = src1 + x * 8;
+
+        std::int32_t b00 = p00[0], g00 = p00[1], r00 = p00[2];
+        std::int32_t b01 = p00[4], g01 = p00[5], r01 = p00[6];
+        std::int32_t b10 = p10[0], g10 = p10[1], r10 = p10[2];
+        std::int32_t b11 = p10[4], g11 = p10[5], r11 = p10[6];
+
+        y0[x * 2] = (T) (std::min((cy0 * r00 + cy1 * g00 + cy2 * b00 + y_offset) >> 16, max) << shift);
+        y0[x * 2 + 1] = (T) (std::min((cy0 * r01 + cy1 * g01 + cy2 * b01 + y_offset) >> 16, max) << shift);
+        y1[x * 2] = (T) (std::min((cy0 * r10 + cy1 * g10 + cy2 * b10 + y_offset) >> 16, max) << shift);
+        y1[x * 2 + 1] = (T) (std::min((cy0 * r11 + cy1 * g11 + cy2 * b11 + y_offset) >> 16, max) << shift);
+
+        // Chroma of the average of the 4 pixels, the 2 extra bits of the sum are folded into the shift
+        auto r = r00 + r01 + r10 + r11;
+        auto g = g00 + g01 + g10 + g11;
+        auto b = b00 + b01 + b10 + b11;
+
+        auto cb = std::clamp((cu0 * r + cu1 * g + cu2 * b + u_offset) >> 18, 0, max) << shift;
+        auto cr = std::clamp((cv0 * r + cv1 * g + cv2 * b + v_offset) >> 18, 0, max) << shift;
+        if constexpr (interleaved) {
+          u[x * 2] = (T) cb;
+          v[x * 2] = (T) cr;
+        } else {
+          u[x] = (T) cb;
+          v[x] = (T) cr;
+        }
+      }
+    }
+
+    template<class T, bool interleaved, int shift>
+    [[gnu::always_inline]] inline void convert_rows(const rgb_to_yuv_t::coefficients_t &c, const rgb_to_yuv_t::band_t &band) {
+      for (int row = band.first_row; row < band.last_row; row += 2) {
+        auto src = band.src + (std::ptrdiff_t) row * band.src_pitch;
+
+        auto y_row = row + band.offset_y;
+        auto y = band.data[0] + (std::ptrdiff_t) y_row * band.linesize[0];
+        auto u = (T *) (band.data[1] + (std::ptrdiff_t) (y_row / 2) * band.linesize[1]) + (interleaved ? band.offset_x : band.offset_x / 2);
+        auto v = interleaved ? u + 1 : (T *) (band.data[2] + (std::ptrdiff_t) (y_row / 2) * band.linesize[2]) + band.offset_x / 2;
+
+        convert_row_pair<T, interleaved, shift>(c, src, src + band.src_pitch, (T *) y + band.offset_x, (T *) (y + band.linesize[0]) + band.offset_x, u, v, band.width / 2);
+      }
+    }
+
+    template<class isa_t>
+    rgb_to_yuv_t::convert_band_fn convert_band_for(AVPixelFormat format) {
+      switch (format) {
+        case AV_PIX_FMT_NV12:
+          return isa_t::template convert_band<std::uint8_t, true, 0>;
+        case AV_PIX_FMT_P010:
+          return isa_t::template convert_band<std::uint16_t, true, 6>;
+        case AV_PIX_FMT_YUV420P:
+          return isa_t::template convert_band<std::uint8_t, false, 0>;
+        case AV_PIX_FMT_YUV420P10:
+          return isa_t::template convert_band<std::uint16_t, false, 0>;
+        default:
+          return nullptr;
+      }
+    }
+
+#ifdef RGB_TO_YUV_X86
+    struct avx512_t {
+      static constexpr auto name = "AVX-512";
+
+      template<class T, bool interleaved, int shift>
+      [[gnu::target("avx512f,avx512bw")]] static void convert_band(const rgb_to_yuv_t::coefficients_t &c, const rgb_to_yuv_t::band_t &band) {
+        convert_rows<T, interleaved, shift>(c, band);
+      }
+    };
+
+    struct avx2_t {
+      static constexpr auto name = "AVX2";
+
+      template<class T, bool interleaved, int shift>
+      [[gnu::target("avx2")]] static void convert_band(const rgb_to_yuv_t::coefficients_t &c, const rgb_to_yuv_t::band_t &band) {
+        convert_rows<T, interleaved, shift>(c, band);
+      }
+    };
+#endif
+
+    // NEON is part of the baseline on aarch64
+    struct def_t {
+#if defined(__aarch64__) || defined(_M_ARM64)
+      static constexpr auto name = "NEON";
+#else
+      static constexpr auto name = "default";
+#endif
+
+      template<class T, bool interleaved, int shift>
+      static void convert_band(const rgb_to_yuv_t::coefficients_t &c, const rgb_to_yuv_t::band_t &band) {
+        convert_rows<T, interleaved, shift>(c, band);
+      }
+    };
+
+    int bit_depth(AVPixelFormat format) {
+      return format == AV_PIX_FMT_P010 || format == AV_PIX_FMT_YUV420P10 ? 10 : 8;
+    }
+  }  // namespace
+
+  std::unique_ptr<rgb_to_yuv_t> rgb_to_yuv_t::make(AVPixelFormat format, int width, int height, int threads) {
+    if (width <= 0 || height <= 0 || width % 2 || height % 2) {
+      return nullptr;
+    }
+
+    // Copy of reed_solomon_init()
+    convert_band_fn convert_band;
+    const char *isa;
+#ifdef RGB_TO_YUV_X86
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+      convert_band = convert_band_for<avx512_t>(format);
+      isa = avx512_t::name;
+    } else if (__builtin_cpu_supports("avx2")) {
+      convert_band = convert_band_for<avx2_t>(format);
+      isa = avx2_t::name;
+    } else
+#endif
+    {
+      convert_band = convert_band_for<def_t>(format);
+      isa = def_t::name;
+    }
+
+    if (!convert_band) {
+      return nullptr;
+    }
+
+    // Bands of fewer than 16 row pairs aren't worth a thread
+    threads = std::clamp(threads, 1, std::max(1, height / 32));
+
+    return std::unique_ptr<rgb_to_yuv_t> {new rgb_to_yuv_t {format, width, height, threads, convert_band, isa}};
+  }
+
+  rgb_to_yuv_t::rgb_to_yuv_t(AVPixelFormat format, int width, int height, int threads, convert_band_fn convert_band, const char *isa):
+      _format {format},
+      _width {width},
+      _height {height},
+      _bands {threads},
+      _convert_band {convert_band},
+      _isa {isa},
+      _pool {threads - 1} {
+    set_colorspace({colorspace_e::rec601, false, (unsigned) bit_depth(format)});
+  }
+
+  const char *rgb_to_yuv_t::isa() const {
+    return _isa;
+  }
+
+  void rgb_to_yuv_t::set_colorspace(const sunshine_colorspace_t &colorspace) {
+    auto adjusted = colorspace;
+    adjusted.bit_depth = bit_depth(_format);
+
+    // The vectors take UNORM input, while the kernels take 8-bit integers
+    auto color_vectors = new_color_vectors_from_colorspace(adjusted);
+    auto fixed = [](float value, int bits) {
+      return (std::int32_t) std::lround(value * (1 << bits));
+    };
+
+    for (int x = 0; x < 3; ++x) {
+      _coefficients.y[x] = fixed(color_vectors->color_vec_y[x] / 255, 16);
+      _coefficients.u[x] = fixed(color_vectors->color_vec_u[x] / 255, 16);
+      _coefficients.v[x] = fixed(color_vectors->color_vec_v[x] / 255, 16);
+    }
+
+    // The chroma is computed from the sum of 4 pixels
+    _coefficients.y_offset = fixed(color_vectors->color_vec_y[3], 16);
+    _coefficients.u_offset = fixed(color_vectors->color_vec_u[3], 18);
+    _coefficients.v_offset = fixed(color_vectors->color_vec_v[3], 18);
+    _coefficients.max = (1 << adjusted.bit_depth) - 1;
+  }
+
+  void rgb_to_yuv_t::convert(const std::uint8_t *src, int src_pitch, std::uint8_t *const *data, const int *linesize, int offset_x, int offset_y) {
+    auto band_for = [&](int index) {
+      auto pairs = _height / 2;
+      return band_t {
+        src,
+        src_pitch,
+        data,
+        linesize,
+        offset_x,
+        offset_y,
+        _width,
+        pairs * index / _bands * 2,
+        pairs * (index + 1) / _bands * 2,
+      };
+    };
+
+    std::vector<std::future<void>> futures;
+    futures.reserve(_bands - 1);
+    for (int x = 0; x < _bands - 1; ++x) {
+      futures.emplace_back(_pool.push(_convert_band, std::cref(_coefficients), band_for(x)));
+    }
+
+    _convert_band(_coefficients, band_for(_bands - 1));
+
+    for (auto &future : futures) {
+      future.wait();
+    }
+  }
+}  // namespace video
@@ -0,0 +1,97 @@
+/**
+ * @file src/rgb_to_yuv.h
+ * @brief Declarations for the vectorized RGB to YUV 4:2:0 software conversion.
+ */
+#pragma once
+
+// standard includes
+#include <cstdint>
+#include <memory>
+
+// local includes
+#include "thread_pool.h"
+#include "video_colorspace.h"
+
+namespace video {
+  /**
+   * @brief Converts BGR0 images to YUV 4:2:0 without scaling.
+   * @details The kernels are compiled for AVX-512, AVX2 and the baseline ISA (NEON on aarch64),
+   *          and the best one the CPU supports is picked at runtime, the same way `rswrapper.c` does for nanors.
+   *          Rows are split in bands that are converted in parallel.
+   */
+  class rgb_to_yuv_t {
+  public:
+    // Fixed-point coefficients with 16 fractional bits
+    struct coefficients_t {
+      std::int32_t y[3];
+      std::int32_t y_offset;
+      std::int32_t u[3];
+      std::int32_t u_offset;
+      std::int32_t v[3];
+      std::int32_t v_offset;
+      std::int32_t max;
+    };
+
+    // A band of rows to convert
+    struct band_t {
+      const std::uint8_t *src;
+      int src_pitch;
+      std::uint8_t *const *data;
+      const int *linesize;
+      int offset_x;
+      int offset_y;
+      int width;
+      int first_row;
+      int last_row;
+    };
+
+    using convert_band_fn = void (*)(const coefficients_t &coefficients, const band_t &band);
+
+    /**
+     * @brief Create a converter for the given output format.
+     * @param format NV12, P010, YUV420P or YUV420P10.
+     * @param width The width of the images, which must be even.
+     * @param height The height of the images, which must be even.
+     * @param threads The number of threads to convert with, including the calling thread.
+     * @return The converter, or nullptr if the format or size isn't supported.
+     */
+    static std::unique_ptr<rgb_to_yuv_t> make(AVPixelFormat format, int width, int height, int threads);
+
+    /**
+     * @brief Get the name of the ISA the kernels were picked for.
+     */
+    const char *isa() const;
+
+    /**
+     * @brief Update the coefficients for a new colorspace.
+     * @details The bit depth is taken from the output format.
+     */
+    void set_colorspace(const sunshine_colorspace_t &colorspace);
+
+    /**
+     * @brief Convert an image into the planes of a frame.
+     * @param src The BGR0 image.
+     * @param src_pitch The size of a row of the image in bytes.
+     * @param data The planes of the frame.
+     * @param linesize The size of a row of each plane in bytes.
+     * @param offset_x The horizontal offset of the image in the frame, which must be even.
+     * @param offset_y The vertical offset of the image in the frame, which must be even.
+     */
+    void convert(const std::uint8_t *src, int src_pitch, std::uint8_t *const *data, const int *linesize, int offset_x, int offset_y);
+
+  private:
+    rgb_to_yuv_t(AVPixelFormat format, int width, int height, int threads, convert_band_fn convert_band, const char *isa);
+
+    AVPixelFormat _format;
+    int _width;
+    int _height;
+    int _bands;
+
+    convert_band_fn _convert_band;
+    const char *_isa;
+    coefficients_t _coefficients;
+
+    // The calling thread converts the last band
+    thread_pool_util::ThreadPool _pool;
+  };
+}  // namespace video
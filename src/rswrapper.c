@@ -95,6 +95,35 @@
     #pragma GCC pop_options
   #endif
 
+#elif defined(__aarch64__) || defined(_M_ARM64)
+
+  #if defined(__linux__)
+    #include <sys/auxv.h>
+
+    #ifndef HWCAP_ASIMD
+      #define HWCAP_ASIMD (1 << 1)
+    #endif
+  #endif
+
+  // Compile a variant for NEON, which every AArch64 compiler targets without extra options
+  #define ISA_SUFFIX _neon
+  #define OBLAS_NEON
+  #include "../third-party/nanors/rs.c"
+  #undef OBLAS_NEON
+  #undef ISA_SUFFIX
+
+/**
+ * @brief Check whether the CPU has NEON, which only Linux reports as an optional feature.
+ * @return 1 if it does.
+ */
+static int cpu_supports_neon(void) {
+  #if defined(__linux__)
+  return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+  #else
+  return 1;
+  #endif
+}
+
 #endif
 
 // Compile a default variant
@@ -117,37 +146,270 @@ reed_solomon_release_t reed_solomon_release_fn;
 reed_solomon_encode_t reed_solomon_encode_fn;
 reed_solomon_decode_t reed_solomon_decode_fn;
 
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #include <immintrin.h>
+  #include <stdlib.h>
+  #include <string.h>
+
+  // nanors is limited to 255 shards per block, the tail of the shards takes 4 more for the parity
+  #define GFNI_SHARDS_MAX (255 + 4)
+
+/**
+ * @brief A context encoding with GFNI, around a context of the AVX2 variant which decodes.
+ * @details Multiplying a byte by a constant of GF(2^8) is linear over GF(2), so it's an 8x8 bit matrix,
+ *          which vgf2p8affineqb applies to every byte of a vector at once. The matrices are read off
+ *          the AVX2 variant by encoding the powers of 2, so the parity doesn't change.
+ */
+typedef struct {
+  reed_solomon *rs;
+  int data_shards;
+  int parity_shards;
+
+  // The matrix of every coefficient, a row of data_shards for every parity shard
+  uint64_t matrices[];
+} reed_solomon_gfni;
+
+static reed_solomon *reed_solomon_new_gfni(int data_shards, int parity_shards) {
+  reed_solomon *rs = reed_solomon_new_avx2(data_shards, parity_shards);
+  if (!rs) {
+    return NULL;
+  }
+
+  int nr_shards = data_shards + parity_shards;
+  int bs = 8 * data_shards;
+
+  reed_solomon_gfni *gfni = malloc(sizeof(reed_solomon_gfni) + sizeof(uint64_t) * data_shards * parity_shards);
+  uint8_t *shards = calloc(nr_shards, bs);
+  uint8_t **shards_p = malloc(sizeof(uint8_t *) * nr_shards);
+  if (!gfni || !shards || !shards_p) {
+    free(gfni);
+    free(shards);
+    free(shards_p);
+    reed_solomon_release_avx2(rs);
+    return NULL;
+  }
+
+  // Data shard x holds the powers of 2 at bytes 8x to 8x + 7,
+  // so those bytes of a parity shard are its coefficient for data shard x times them
+  for (int x = 0; x < nr_shards; ++x) {
+    shards_p[x] = &shards[x * bs];
+  }
+  for (int x = 0; x < data_shards; ++x) {
+    for (int y = 0; y < 8; ++y) {
+      shards_p[x][8 * x + y] = (uint8_t) (1 << y);
+    }
+  }
+  reed_solomon_encode_avx2(rs, shards_p, nr_shards, bs);
+
+  // Bit y of a product goes to row y of the matrix, which is byte 7 - y
+  for (int z = 0; z < parity_shards; ++z) {
+    const uint8_t *products = shards_p[data_shards + z];
+    for (int x = 0; x < data_shards; ++x) {
+      uint64_t matrix = 0;
+      for (int y = 0; y < 8; ++y) {
+        uint64_t row = 0;
+        for (int bit = 0; bit < 8; ++bit) {
+          row |= (uint64_t) ((products[8 * x + bit] >> y) & 1) << bit;
+        }
+        matrix |= row << (8 * (7 - y));
+      }
+      gfni->matrices[z * data_shards + x] = matrix;
+    }
+  }
+
+  free(shards);
+  free(shards_p);
+
+  gfni->rs = rs;
+  gfni->data_shards = data_shards;
+  gfni->parity_shards = parity_shards;
+  return (reed_solomon *) gfni;
+}
+
+static void reed_solomon_release_gfni(reed_solomon *rs) {
+  reed_solomon_gfni *gfni = (reed_solomon_gfni *) rs;
+  if (!gfni) {
+    return;
+  }
+
+  reed_solomon_release_avx2(gfni->rs);
+  free(gfni);
+}
+
+/**
+ * @brief Encode a vector of up to 4 parity shards, loading the vector of every data shard once.
+ * @details It's inlined for every number of rows, so the accumulators stay in registers.
+ */
+__attribute__((target("gfni,avx2"), always_inline)) static inline void gfni_encode_rows(const uint64_t *matrices, int data_shards, int rows, uint8_t **shards, uint8_t **parity, int offset) {
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256();
+  __m256i acc3 = _mm256_setzero_si256();
+
+  for (int x = 0; x < data_shards; ++x) {
+    __m256i data = _mm256_loadu_si256((const __m256i *) &shards[x][offset]);
+    acc0 = _mm256_xor_si256(acc0, _mm256_gf2p8affine_epi64_epi8(data, _mm256_set1_epi64x((long long) matrices[x]), 0));
+    if (rows > 1) {
+      acc1 = _mm256_xor_si256(acc1, _mm256_gf2p8affine_epi64_epi8(data, _mm256_set1_epi64x((long long) matrices[data_shards + x]), 0));
+    }
+    if (rows > 2) {
+      acc2 = _mm256_xor_si256(acc2, _mm256_gf2p8affine_epi64_epi8(data, _mm256_set1_epi64x((long long) matrices[2 * data_shards + x]), 0));
+    }
+    if (rows > 3) {
+      acc3 = _mm256_xor_si256(acc3, _mm256_gf2p8affine_epi64_epi8(data, _mm256_set1_epi64x((long long) matrices[3 * data_shards + x]), 0));
+    }
+  }
+
+  _mm256_storeu_si256((__m256i *) &parity[0][offset], acc0);
+  if (rows > 1) {
+    _mm256_storeu_si256((__m256i *) &parity[1][offset], acc1);
+  }
+  if (rows > 2) {
+    _mm256_storeu_si256((__m256i *) &parity[2][offset], acc2);
+  }
+  if (rows > 3) {
+    _mm256_storeu_si256((__m256i *) &parity[3][offset], acc3);
+  }
+}
+
+__attribute__((target("gfni,avx2"))) static int reed_solomon_encode_gfni(reed_solomon *rs, uint8_t **shards, int nr_shards, int bs) {
+  reed_solomon_gfni *gfni = (reed_solomon_gfni *) rs;
+  int data_shards = gfni->data_shards;
+  int parity_shards = gfni->parity_shards;
+  if (nr_shards != data_shards + parity_shards) {
+    return reed_solomon_encode_avx2(gfni->rs, shards, nr_shards, bs);
+  }
+
+  int offset = 0;
+  for (; offset + 32 <= bs; offset += 32) {
+    for (int z = 0; z < parity_shards; z += 4) {
+      switch (parity_shards - z) {
+        case 1:
+          gfni_encode_rows(&gfni->matrices[z * data_shards], data_shards, 1, shards, &shards[data_shards + z], offset);
+          break;
+        case 2:
+          gfni_encode_rows(&gfni->matrices[z * data_shards], data_shards, 2, shards, &shards[data_shards + z], offset);
+          break;
+        case 3:
+          gfni_encode_rows(&gfni->matrices[z * data_shards], data_shards, 3, shards, &shards[data_shards + z], offset);
+          break;
+        default:
+          gfni_encode_rows(&gfni->matrices[z * data_shards], data_shards, 4, shards, &shards[data_shards + z], offset);
+          break;
+      }
+    }
+  }
+
+  // The end of the shards goes through vectors of their own, so nothing past them is read or written
+  int tail = bs - offset;
+  if (tail) {
+    uint8_t tail_shards[(GFNI_SHARDS_MAX) * 32];
+    uint8_t *tail_p[GFNI_SHARDS_MAX];
+    for (int x = 0; x < data_shards + 4; ++x) {
+      tail_p[x] = &tail_shards[x * 32];
+      memset(tail_p[x], 0, 32);
+      if (x < data_shards) {
+        memcpy(tail_p[x], &shards[x][offset], tail);
+      }
+    }
+
+    for (int z = 0; z < parity_shards; z += 4) {
+      int rows = parity_shards - z < 4 ? parity_shards - z : 4;
+      gfni_encode_rows(&gfni->matrices[z * data_shards], data_shards, rows, tail_p, &tail_p[data_shards], 0);
+      for (int y = 0; y < rows; ++y) {
+        memcpy(&shards[data_shards + z + y][offset], tail_p[data_shards + y], tail);
+      }
+    }
+  }
+
+  return 0;
+}
+
+static int reed_solomon_decode_gfni(reed_solomon *rs, uint8_t **shards, uint8_t *marks, int nr_shards, int bs) {
+  return reed_solomon_decode_avx2(((reed_solomon_gfni *) rs)->rs, shards, marks, nr_shards, bs);
+}
+#endif
+
+/**
+ * @brief This initializes the RS function pointers to a specific vectorized version.
+ * @param isa The version.
+ * @return 1 on success, 0 if the version isn't compiled in or the CPU doesn't support it.
+ */
+int reed_solomon_init_isa(reed_solomon_isa isa) {
+  switch (isa) {
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+    case REED_SOLOMON_ISA_GFNI:
+      if (!__builtin_cpu_supports("gfni") || !__builtin_cpu_supports("avx2")) {
+        return 0;
+      }
+      reed_solomon_new_fn = reed_solomon_new_gfni;
+      reed_solomon_release_fn = reed_solomon_release_gfni;
+      reed_solomon_encode_fn = reed_solomon_encode_gfni;
+      reed_solomon_decode_fn = reed_solomon_decode_gfni;
+      reed_solomon_init_avx2();
+      return 1;
+    case REED_SOLOMON_ISA_AVX512:
+      if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw")) {
+        return 0;
+      }
+      reed_solomon_new_fn = reed_solomon_new_avx512;
+      reed_solomon_release_fn = reed_solomon_release_avx512;
+      reed_solomon_encode_fn = reed_solomon_encode_avx512;
+      reed_solomon_decode_fn = reed_solomon_decode_avx512;
+      reed_solomon_init_avx512();
+      return 1;
+    case REED_SOLOMON_ISA_AVX2:
+      if (!__builtin_cpu_supports("avx2")) {
+        return 0;
+      }
+      reed_solomon_new_fn = reed_solomon_new_avx2;
+      reed_solomon_release_fn = reed_solomon_release_avx2;
+      reed_solomon_encode_fn = reed_solomon_encode_avx2;
+      reed_solomon_decode_fn = reed_solomon_decode_avx2;
+      reed_solomon_init_avx2();
+      return 1;
+    case REED_SOLOMON_ISA_SSSE3:
+      if (!__builtin_cpu_supports("ssse3")) {
+        return 0;
+      }
+      reed_solomon_new_fn = reed_solomon_new_ssse3;
+      reed_solomon_release_fn = reed_solomon_release_ssse3;
+      reed_solomon_encode_fn = reed_solomon_encode_ssse3;
+      reed_solomon_decode_fn = reed_solomon_decode_ssse3;
+      reed_solomon_init_ssse3();
+      return 1;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    case REED_SOLOMON_ISA_NEON:
+      if (!cpu_supports_neon()) {
+        return 0;
+      }
+      reed_solomon_new_fn = reed_solomon_new_neon;
+      reed_solomon_release_fn = reed_solomon_release_neon;
+      reed_solomon_encode_fn = reed_solomon_encode_neon;
+      reed_solomon_decode_fn = reed_solomon_decode_neon;
+      reed_solomon_init_neon();
+      return 1;
+#endif
+    case REED_SOLOMON_ISA_DEFAULT:
+      reed_solomon_new_fn = reed_solomon_new_def;
+      reed_solomon_release_fn = reed_solomon_release_def;
+      reed_solomon_encode_fn = reed_solomon_encode_def;
+      reed_solomon_decode_fn = reed_solomon_decode_def;
+      reed_solomon_init_def();
+      return 1;
+    default:
+      return 0;
+  }
+}
+
 /**
  * @brief This initializes the RS function pointers to the best vectorized version available.
  * @details The streaming code will directly invoke these function pointers during encoding.
  */
 void reed_solomon_init(void) {
-#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
-  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
-    reed_solomon_new_fn = reed_solomon_new_avx512;
-    reed_solomon_release_fn = reed_solomon_release_avx512;
-    reed_solomon_encode_fn = reed_solomon_encode_avx512;
-    reed_solomon_decode_fn = reed_solomon_decode_avx512;
-    reed_solomon_init_avx512();
-  } else if (__builtin_cpu_supports("avx2")) {
-    reed_solomon_new_fn = reed_solomon_new_avx2;
-    reed_solomon_release_fn = reed_solomon_release_avx2;
-    reed_solomon_encode_fn = reed_solomon_encode_avx2;
-    reed_solomon_decode_fn = reed_solomon_decode_avx2;
-    reed_solomon_init_avx2();
-  } else if (__builtin_cpu_supports("ssse3")) {
-    reed_solomon_new_fn = reed_solomon_new_ssse3;
-    reed_solomon_release_fn = reed_solomon_release_ssse3;
-    reed_solomon_encode_fn = reed_solomon_encode_ssse3;
-    reed_solomon_decode_fn = reed_solomon_decode_ssse3;
-    reed_solomon_init_ssse3();
-  } else
-#endif
-  {
-    reed_solomon_new_fn = reed_solomon_new_def;
-    reed_solomon_release_fn = reed_solomon_release_def;
-    reed_solomon_encode_fn = reed_solomon_encode_def;
-    reed_solomon_decode_fn = reed_solomon_decode_def;
-    reed_solomon_init_def();
+  if (reed_solomon_init_isa(REED_SOLOMON_ISA_GFNI) || reed_solomon_init_isa(REED_SOLOMON_ISA_AVX512) || reed_solomon_init_isa(REED_SOLOMON_ISA_AVX2) || reed_solomon_init_isa(REED_SOLOMON_ISA_SSSE3) || reed_solomon_init_isa(REED_SOLOMON_ISA_NEON)) {
+    return;
   }
+
+  reed_solomon_init_isa(REED_SOLOMON_ISA_DEFAULT);
 }
@@ -30,3 +30,23 @@ extern reed_solomon_decode_t reed_solomon_decode_fn;
  * @details The streaming code will directly invoke these function pointers during encoding.
  */
 void reed_solomon_init(void);
+
+/**
+ * @brief The vectorized versions of the RS functions.
+ */
+typedef enum {
+  REED_SOLOMON_ISA_DEFAULT,  ///< Plain C
+  REED_SOLOMON_ISA_SSSE3,  ///< SSSE3
+  REED_SOLOMON_ISA_AVX2,  ///< AVX2
+  REED_SOLOMON_ISA_AVX512,  ///< AVX-512 F and BW
+  REED_SOLOMON_ISA_NEON,  ///< NEON on AArch64
+  REED_SOLOMON_ISA_GFNI,  ///< GFNI with AVX2, encoding only
+} reed_solomon_isa;
+
+/**
+ * @brief This initializes the RS function pointers to a specific vectorized version.
+ * @details For benchmarking the versions against each other, the streaming code uses reed_solomon_init().
+ * @param isa The version.
+ * @return 1 on success, 0 if the version isn't compiled in or the CPU doesn't support it.
+ */
+int reed_solomon_init_isa(reed_solomon_isa isa);
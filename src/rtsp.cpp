@@ -12,16 +12,19 @@ extern "C" {
 // standard includes
 #include <array>
 #include <cctype>
+#include <cmath>
 #include <format>
 #include <set>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 // lib includes
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
 // local includes
+#include "admission.h"
 #include "config.h"
 #include "globals.h"
 #include "input.h"
@@ -77,20 +80,72 @@ namespace rtsp_stream {
 
 #pragma pack(pop)
 
+  // How long a client has to send a request and take the response before the connection is dropped
+  constexpr auto RTSP_CONNECTION_TIMEOUT = 10s;
+
+  // Negotiation mostly waits on clients, so a few threads keep one slow client from holding up the others
+  constexpr int RTSP_WORKER_THREADS = 4;
+
   class rtsp_server_t;
+  class socket_t;
 
   using msg_t = util::safe_ptr<RTSP_MESSAGE, free_msg>;
-  using cmd_func_t = std::function<void(rtsp_server_t *server, tcp::socket &, launch_session_t &, msg_t &&)>;
+  using cmd_func_t = std::function<void(rtsp_server_t *server, socket_t &, launch_session_t &, msg_t &&)>;
 
   void print_msg(PRTSP_MESSAGE msg);
-  void cmd_not_found(tcp::socket &sock, launch_session_t &, msg_t &&req);
-  void respond(tcp::socket &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload);
+  void cmd_not_found(socket_t &sock, launch_session_t &, msg_t &&req);
+  void respond(socket_t &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload);
 
   class socket_t: public std::enable_shared_from_this<socket_t> {
   public:
-    socket_t(boost::asio::io_context &io_context, std::function<void(tcp::socket &sock, launch_session_t &, msg_t &&)> &&handle_data_fn):
+    socket_t(boost::asio::io_context &io_context, std::function<void(socket_t &sock, launch_session_t &, msg_t &&)> &&handle_data_fn):
         handle_data_fn {std::move(handle_data_fn)},
-        sock {io_context} {
+        sock {boost::asio::make_strand(io_context)},
+        deadline {sock.get_executor()} {
+    }
+
+    /**
+     * @brief Drop the connection if the client doesn't finish the exchange in time.
+     * @details Keeps a client that goes quiet, or never reads the response, from holding on to the connection.
+     */
+    void arm_deadline() {
+      deadline.expires_after(RTSP_CONNECTION_TIMEOUT);
+      deadline.async_wait([weak_socket = weak_from_this()](const boost::system::error_code &ec) {
+        auto socket = weak_socket.lock();
+        if (ec || !socket) {
+          return;
+        }
+
+        BOOST_LOG(debug) << "RTSP: Closing connection that didn't finish within "sv << RTSP_CONNECTION_TIMEOUT.count() << 's';
+
+        boost::system::error_code close_ec;
+        socket->sock.close(close_ec);
+      });
+    }
+
+    /**
+     * @brief Send the responses queued by respond() without blocking, then shut the connection down.
+     */
+    void finish() {
+      if (response.empty()) {
+        deadline.cancel();
+
+        boost::system::error_code ec;
+        sock.close(ec);
+
+        return;
+      }
+
+      boost::asio::async_write(sock, boost::asio::buffer(response), [socket = shared_from_this()](const boost::system::error_code &ec, std::size_t) {
+        if (ec) {
+          BOOST_LOG(error) << "RTSP: Couldn't send data over tcp socket: "sv << ec.message();
+        }
+
+        socket->deadline.cancel();
+
+        boost::system::error_code shutdown_ec;
+        socket->sock.shutdown(boost::asio::socket_base::shutdown_type::shutdown_both, shutdown_ec);
+      });
     }
 
     /**
@@ -100,10 +155,8 @@ namespace rtsp_stream {
       if (begin == std::end(msg_buf) || (session->rtsp_cipher && begin + sizeof(encrypted_rtsp_header_t) >= std::end(msg_buf))) {
         BOOST_LOG(error) << "RTSP: read(): Exceeded maximum rtsp packet size: "sv << msg_buf.size();
 
-        respond(sock, *session, nullptr, 400, "BAD REQUEST", 0, {});
-
-        boost::system::error_code ec;
-        sock.close(ec);
+        respond(*this, *session, nullptr, 400, "BAD REQUEST", 0, {});
+        finish();
 
         return;
       }
@@ -133,19 +186,15 @@ namespace rtsp_stream {
     static void handle_read_encrypted_header(std::shared_ptr<socket_t> &socket, const boost::system::error_code &ec, std::size_t bytes) {
       BOOST_LOG(debug) << "handle_read_encrypted_header(): Handle read of size: "sv << bytes << " bytes"sv;
 
+      // Sends any error response before the connection goes away
       auto sock_close = util::fail_guard([&socket]() {
-        boost::system::error_code ec;
-        socket->sock.close(ec);
-
-        if (ec) {
-          BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Couldn't close tcp socket: "sv << ec.message();
-        }
+        socket->finish();
       });
 
       if (ec || bytes < sizeof(encrypted_rtsp_header_t)) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Couldn't read from tcp socket: "sv << ec.message();
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -153,7 +202,7 @@ namespace rtsp_stream {
       if (!header->is_encrypted()) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Rejecting unencrypted RTSP message"sv;
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -163,7 +212,7 @@ namespace rtsp_stream {
       if (socket->begin + sizeof(*header) + payload_length >= std::end(socket->msg_buf)) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted_header(): Exceeded maximum rtsp packet size: "sv << socket->msg_buf.size();
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -182,13 +231,9 @@ namespace rtsp_stream {
     static void handle_read_encrypted_message(std::shared_ptr<socket_t> &socket, const boost::system::error_code &ec, std::size_t bytes) {
       BOOST_LOG(debug) << "handle_read_encrypted(): Handle read of size: "sv << bytes << " bytes"sv;
 
+      // Sends any error response before the connection goes away
       auto sock_close = util::fail_guard([&socket]() {
-        boost::system::error_code ec;
-        socket->sock.close(ec);
-
-        if (ec) {
-          BOOST_LOG(error) << "RTSP: handle_read_encrypted_message(): Couldn't close tcp socket: "sv << ec.message();
-        }
+        socket->finish();
       });
 
       auto header = (encrypted_rtsp_header_t *) socket->begin;
@@ -198,7 +243,7 @@ namespace rtsp_stream {
       if (ec || bytes < payload_length) {
         BOOST_LOG(error) << "RTSP: handle_read_encrypted(): Couldn't read from tcp socket: "sv << ec.message();
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -219,7 +264,7 @@ namespace rtsp_stream {
       if (socket->session->rtsp_cipher->decrypt(std::string_view {(const char *) header->tag, sizeof(header->tag) + bytes}, plaintext, &iv)) {
         BOOST_LOG(error) << "Failed to verify RTSP message tag"sv;
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -227,7 +272,7 @@ namespace rtsp_stream {
       if (auto status = parseRtspMessage(req.get(), (char *) plaintext.data(), plaintext.size())) {
         BOOST_LOG(error) << "Malformed RTSP message: ["sv << status << ']';
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -245,10 +290,8 @@ namespace rtsp_stream {
       if (begin == std::end(msg_buf)) {
         BOOST_LOG(error) << "RTSP: read_plaintext_payload(): Exceeded maximum rtsp packet size: "sv << msg_buf.size();
 
-        respond(sock, *session, nullptr, 400, "BAD REQUEST", 0, {});
-
-        boost::system::error_code ec;
-        sock.close(ec);
+        respond(*this, *session, nullptr, 400, "BAD REQUEST", 0, {});
+        finish();
 
         return;
       }
@@ -273,13 +316,9 @@ namespace rtsp_stream {
     static void handle_plaintext_payload(std::shared_ptr<socket_t> &socket, const boost::system::error_code &ec, std::size_t bytes) {
       BOOST_LOG(debug) << "handle_plaintext_payload(): Handle read of size: "sv << bytes << " bytes"sv;
 
+      // Sends any error response before the connection goes away
       auto sock_close = util::fail_guard([&socket]() {
-        boost::system::error_code ec;
-        socket->sock.close(ec);
-
-        if (ec) {
-          BOOST_LOG(error) << "RTSP: handle_plaintext_payload(): Couldn't close tcp socket: "sv << ec.message();
-        }
+        socket->finish();
       });
 
       if (ec) {
@@ -293,7 +332,7 @@ namespace rtsp_stream {
       if (auto status = parseRtspMessage(req.get(), socket->msg_buf.data(), (std::size_t) (end - socket->msg_buf.data()))) {
         BOOST_LOG(error) << "Malformed RTSP message: ["sv << status << ']';
 
-        respond(socket->sock, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
+        respond(*socket, *socket->session, nullptr, 400, "BAD REQUEST", 0, {});
         return;
       }
 
@@ -383,12 +422,16 @@ namespace rtsp_stream {
     }
 
     void handle_data(msg_t &&req) {
-      handle_data_fn(sock, *session, std::move(req));
+      handle_data_fn(*this, *session, std::move(req));
     }
 
-    std::function<void(tcp::socket &sock, launch_session_t &, msg_t &&)> handle_data_fn;
+    std::function<void(socket_t &sock, launch_session_t &, msg_t &&)> handle_data_fn;
 
     tcp::socket sock;
+    boost::asio::steady_timer deadline;
+
+    // Responses to send once the request is handled
+    std::string response;
 
     std::array<char, 2048> msg_buf;
 
@@ -422,7 +465,7 @@ namespace rtsp_stream {
         return -1;
       }
 
-      next_socket = std::make_shared<socket_t>(io_context, [this](tcp::socket &sock, launch_session_t &session, msg_t &&msg) {
+      next_socket = std::make_shared<socket_t>(io_context, [this](socket_t &sock, launch_session_t &session, msg_t &&msg) {
         handle_msg(sock, session, std::move(msg));
       });
 
@@ -433,7 +476,7 @@ namespace rtsp_stream {
       return 0;
     }
 
-    void handle_msg(tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+    void handle_msg(socket_t &sock, launch_session_t &session, msg_t &&req) {
       auto func = _map_cmd_cb.find(req->message.request.command);
       if (func != std::end(_map_cmd_cb)) {
         func->second(this, sock, session, std::move(req));
@@ -441,8 +484,7 @@ namespace rtsp_stream {
         cmd_not_found(sock, session, std::move(req));
       }
 
-      boost::system::error_code ec;
-      sock.shutdown(boost::asio::socket_base::shutdown_type::shutdown_both, ec);
+      sock.finish();
     }
 
     void handle_accept(const boost::system::error_code &ec) {
@@ -460,6 +502,7 @@ namespace rtsp_stream {
       if (launch_session) {
         // Associate the current RTSP session with this socket and start reading
         socket->session = launch_session;
+        socket->arm_deadline();
         socket->read();
       } else {
         // This can happen due to normal things like port scanning, so let's not make these visible by default
@@ -471,7 +514,7 @@ namespace rtsp_stream {
       }
 
       // Queue another asynchronous accept for the next incoming connection
-      next_socket = std::make_shared<socket_t>(io_context, [this](tcp::socket &sock, launch_session_t &session, msg_t &&msg) {
+      next_socket = std::make_shared<socket_t>(io_context, [this](socket_t &sock, launch_session_t &session, msg_t &&msg) {
         handle_msg(sock, session, std::move(msg));
       });
       acceptor.async_accept(next_socket->sock, [this](const auto &ec) {
@@ -582,16 +625,11 @@ namespace rtsp_stream {
     }
 
     /**
-     * @brief Runs an iteration of the RTSP server loop
+     * @brief Handle connections until the server is stopped.
+     * @details Any number of threads can run the server, the handlers of each connection run on a strand of their own.
      */
-    void iterate() {
-      // If we have a session, we will return to the server loop every
-      // 500ms to allow session cleanup to happen.
-      if (session_count() > 0) {
-        io_context.run_one_for(500ms);
-      } else {
-        io_context.run_one();
-      }
+    void run() {
+      io_context.run();
     }
 
     /**
@@ -599,6 +637,7 @@ namespace rtsp_stream {
      */
     void stop() {
       acceptor.close();
+      work_guard.reset();
       io_context.stop();
       clear();
     }
@@ -637,6 +676,9 @@ namespace rtsp_stream {
     tcp::acceptor acceptor {io_context};
     boost::asio::steady_timer raised_timer {io_context};
 
+    // Keeps run() from returning while there's nothing to do
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard {io_context.get_executor()};
+
     std::shared_ptr<socket_t> next_socket;
   };
 
@@ -667,25 +709,10 @@ namespace rtsp_stream {
 
   void terminate_sessions() {
     server.clear(true);
+    stream::session::end_suspended();
   }
 
-  int send(tcp::socket &sock, const std::string_view &sv) {
-    std::size_t bytes_send = 0;
-
-    while (bytes_send != sv.size()) {
-      boost::system::error_code ec;
-      bytes_send += sock.send(boost::asio::buffer(sv.substr(bytes_send)), 0, ec);
-
-      if (ec) {
-        BOOST_LOG(error) << "RTSP: Couldn't send data over tcp socket: "sv << ec.message();
-        return -1;
-      }
-    }
-
-    return 0;
-  }
-
-  void respond(tcp::socket &sock, launch_session_t &session, msg_t &resp) {
+  void respond(socket_t &sock, launch_session_t &session, msg_t &resp) {
     auto payload = std::make_pair(resp->payload, resp->payloadLength);
 
     // Restore response message for proper destruction
@@ -738,33 +765,27 @@ namespace rtsp_stream {
       // Encrypt the RTSP message in place
       session.rtsp_cipher->encrypt(std::string_view {(const char *) header->payload(), (std::size_t) payload_length}, header->tag, &iv);
 
-      // Send the full encrypted message
-      send(sock, std::string_view {(char *) message.data(), message.size()});
+      // Queue the full encrypted message
+      sock.response.append((char *) message.data(), message.size());
     } else {
-      std::string_view tmp_resp {raw_resp.get(), (size_t) serialized_len};
-
-      // Send the plaintext RTSP message header
-      if (send(sock, tmp_resp)) {
-        return;
-      }
-
-      // Send the plaintext RTSP message payload (if present)
-      send(sock, std::string_view {payload.first, (std::size_t) payload.second});
+      // Queue the plaintext RTSP message header and payload (if present)
+      sock.response.append(raw_resp.get(), serialized_len);
+      sock.response.append(payload.first, payload.second);
     }
   }
 
-  void respond(tcp::socket &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload) {
+  void respond(socket_t &sock, launch_session_t &session, POPTION_ITEM options, int statuscode, const char *status_msg, int seqn, const std::string_view &payload) {
     msg_t resp {new msg_t::element_type};
     createRtspResponse(resp.get(), nullptr, 0, const_cast<char *>("RTSP/1.0"), statuscode, const_cast<char *>(status_msg), seqn, options, const_cast<char *>(payload.data()), (int) payload.size());
 
     respond(sock, session, resp);
   }
 
-  void cmd_not_found(tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_not_found(socket_t &sock, launch_session_t &session, msg_t &&req) {
     respond(sock, session, nullptr, 404, "NOT FOUND", req->sequenceNumber, {});
   }
 
-  void cmd_option(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_option(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -776,7 +797,7 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_describe(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_describe(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -795,7 +816,7 @@ namespace rtsp_stream {
     uint32_t encryption_flags_requested = SS_ENC_CONTROL_V2;
 
     // Determine the encryption desired for this remote endpoint
-    auto encryption_mode = net::encryption_mode_for_address(sock.remote_endpoint().address());
+    auto encryption_mode = net::encryption_mode_for_address(sock.sock.remote_endpoint().address());
     if (encryption_mode != config::ENCRYPTION_MODE_NEVER) {
       // Advertise support for video encryption if it's not disabled
       encryption_flags_supported |= SS_ENC_VIDEO;
@@ -859,7 +880,7 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, ss.str());
   }
 
-  void cmd_setup(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_setup(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM options[4] {};
 
     auto &seqn = options[0];
@@ -918,7 +939,7 @@ namespace rtsp_stream {
     respond(sock, session, &seqn, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_announce(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_announce(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -987,6 +1008,7 @@ namespace rtsp_stream {
     args.try_emplace("x-ss-video[0].intraRefresh"sv, "0"sv);
 
     stream::config_t config;
+    auto runtime = config::runtime();
 
     std::int64_t configuredBitrateKbps;
     config.audio.flags[audio::config_t::HOST_AUDIO] = session.host_audio;
@@ -1040,6 +1062,7 @@ namespace rtsp_stream {
       }
 
       config.monitor.input_only = session.input_only;
+      config.monitor.display_name = session.display_name;
 
       configuredBitrateKbps = util::from_view(args.at("x-ml-video.configuredBitrateKbps"sv));
 
@@ -1049,9 +1072,9 @@ namespace rtsp_stream {
 
       BOOST_LOG(info) << "Client Requested bitrate is [" << configuredBitrateKbps << "kbps]";
 
-      if (config::video.max_bitrate > 0) {
-        if (config::video.max_bitrate < configuredBitrateKbps) {
-          configuredBitrateKbps = config::video.max_bitrate;
+      if (runtime->max_bitrate > 0) {
+        if (runtime->max_bitrate < configuredBitrateKbps) {
+          configuredBitrateKbps = runtime->max_bitrate;
         }
       }
 
@@ -1115,8 +1138,8 @@ namespace rtsp_stream {
 
       // If the FEC percentage isn't too high, adjust the configured bitrate to ensure video
       // traffic doesn't exceed the user's selected bitrate when the FEC shards are included.
-      if (config::stream.fec_percentage <= 80) {
-        configuredBitrateKbps /= 100.f / (100 - config::stream.fec_percentage);
+      if (runtime->fec_percentage <= 80) {
+        configuredBitrateKbps /= 100.f / (100 - runtime->fec_percentage);
       }
 
       // Adjust the bitrate to account for audio traffic bandwidth usage (capped at 20% reduction).
@@ -1147,7 +1170,7 @@ namespace rtsp_stream {
     }
 
     // Check that any required encryption is enabled
-    auto encryption_mode = net::encryption_mode_for_address(sock.remote_endpoint().address());
+    auto encryption_mode = net::encryption_mode_for_address(sock.sock.remote_endpoint().address());
     if (encryption_mode == config::ENCRYPTION_MODE_MANDATORY &&
         (config.encryptionFlagsEnabled & (SS_ENC_VIDEO | SS_ENC_AUDIO)) != (SS_ENC_VIDEO | SS_ENC_AUDIO)) {
       BOOST_LOG(error) << "Rejecting client that cannot comply with mandatory encryption requirement"sv;
@@ -1156,10 +1179,46 @@ namespace rtsp_stream {
       return;
     }
 
+    // The app starts while the stream is negotiated, one that failed to already has nothing to stream
+    if (session.app_started.valid() && session.app_started.wait_for(0s) == std::future_status::ready && session.app_started.get()) {
+      BOOST_LOG(error) << "Refusing the stream, the app failed to start"sv;
+
+      respond(sock, session, &option, 503, "Service Unavailable", req->sequenceNumber, {});
+      return;
+    }
+
+    // Streams that don't fit in what the running ones leave of the host are lowered or refused up front
+    if (!config.monitor.input_only) {
+      auto decision = admission::instance().decide({
+        config.monitor.width,
+        config.monitor.height,
+        config.monitor.encodingFramerate / 1000.0,
+        config.monitor.bitrate,
+      });
+
+      if (decision.verdict == admission::decision_t::verdict_e::reject) {
+        BOOST_LOG(warning) << "Refusing the stream, "sv << decision.reason;
+
+        respond(sock, session, &option, 503, "Service Unavailable", req->sequenceNumber, {});
+        return;
+      }
+
+      if (decision.verdict == admission::decision_t::verdict_e::downgrade) {
+        BOOST_LOG(info) << "Streaming at "sv << decision.stream.framerate << " FPS and "sv << decision.stream.bitrate << " Kbps, "sv << decision.reason;
+
+        // Capture paces itself to the framerate, and encoding to the encoding framerate
+        if (decision.stream.framerate < config.monitor.encodingFramerate / 1000.0) {
+          config.monitor.framerate = std::min(config.monitor.framerate, (int) std::lround(decision.stream.framerate));
+          config.monitor.encodingFramerate = (int) std::lround(decision.stream.framerate * 1000);
+        }
+        config.monitor.bitrate = decision.stream.bitrate;
+      }
+    }
+
     auto stream_session = stream::session::alloc(config, session);
     server->insert(stream_session);
 
-    if (stream::session::start(*stream_session, sock.remote_endpoint().address().to_string())) {
+    if (stream::session::start(*stream_session, sock.sock.remote_endpoint().address().to_string())) {
       BOOST_LOG(error) << "Failed to start a streaming session"sv;
 
       server->remove(stream_session);
@@ -1170,7 +1229,7 @@ namespace rtsp_stream {
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
-  void cmd_play(rtsp_server_t *server, tcp::socket &sock, launch_session_t &session, msg_t &&req) {
+  void cmd_play(rtsp_server_t *server, socket_t &sock, launch_session_t &session, msg_t &&req) {
     OPTION_ITEM option {};
 
     // I know these string literals will not be modified
@@ -1199,12 +1258,18 @@ namespace rtsp_stream {
       return;
     }
 
-    std::thread rtsp_thread {[&shutdown_event] {
-      auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    std::vector<std::thread> rtsp_threads;
+    for (int x = 0; x < RTSP_WORKER_THREADS; ++x) {
+      rtsp_threads.emplace_back([] {
+        server.run();
+      });
+    }
 
-      while (!shutdown_event->peek()) {
-        server.iterate();
+    // Joining a session blocks, so it's kept off the threads handling connections
+    std::thread cleanup_thread {[&shutdown_event] {
+      auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
 
+      while (!shutdown_event->view(500ms)) {
         if (broadcast_shutdown_event->peek()) {
           server.clear();
         } else {
@@ -1214,14 +1279,18 @@ namespace rtsp_stream {
       }
 
       server.clear();
+      stream::session::end_suspended();
     }};
 
     // Wait for shutdown
     shutdown_event->view();
 
-    // Stop the server and join the server thread
+    // Stop the server and join the server threads
     server.stop();
-    rtsp_thread.join();
+    for (auto &rtsp_thread : rtsp_threads) {
+      rtsp_thread.join();
+    }
+    cleanup_thread.join();
   }
 
   void print_msg(PRTSP_MESSAGE msg) {
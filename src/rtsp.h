@@ -6,11 +6,13 @@
 
 // standard includes
 #include <atomic>
+#include <future>
 #include <memory>
 #include <list>
 
 // local includes
 #include "crypto.h"
+#include "network_profile.h"
 #include "thread_safe.h"
 #include "uuid.h"
 
@@ -51,6 +53,9 @@ namespace rtsp_stream {
     bool enable_sops;
     bool virtual_display;
     uint32_t scale_factor;
+    std::string display_name;
+    int app_instance = 0;  ///< The instance of proc::instances the session streams, 0 for proc::proc.
+    std::shared_future<int> app_started;  ///< Ready once proc::proc started the app it answered the launch before, with 0 or the status code it failed with.
 
     std::optional<crypto::cipher::gcm_t> rtsp_cipher;
     std::string rtsp_url_scheme;
@@ -59,6 +64,8 @@ namespace rtsp_stream {
     std::list<crypto::command_entry_t> client_do_cmds;
     std::list<crypto::command_entry_t> client_undo_cmds;
 
+    std::optional<stream::network_profile_t> network_profile;  ///< What the last sessions of the client learned about the path to it.
+
 #ifdef _WIN32
     GUID display_guid{};
 #else
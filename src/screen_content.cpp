@@ -0,0 +1,90 @@
+/**
+ * @file src/screen_content.cpp
+ * @brief Definitions for detecting streams of mostly static text and UI, which are encoded with screen content tools.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "screen_content.h"
+
+using namespace std::literals;
+
+namespace screen_content {
+  namespace {
+    // A window is static when less than this of each frame changed on average, like typing or a moving cursor,
+    // and moving when more than this did, like a video or scrolling
+    constexpr double static_area = 0.02;
+    constexpr double moving_area = 0.15;
+
+    // Windows in a row before switching, static content has to last before it's worth an IDR frame
+    constexpr int static_updates = 5;
+    constexpr int moving_updates = 2;
+
+    // The encoder isn't reopened again before this
+    constexpr auto settle_time = 10s;
+  }  // namespace
+
+  double changed_area(const std::optional<std::vector<platf::damage_rect_t>> &damage, int width, int height) {
+    if (!damage || width <= 0 || height <= 0) {
+      return 1.0;
+    }
+
+    double area = 0;
+    for (auto &rect : *damage) {
+      auto rect_width = std::min(rect.x + rect.width, width) - std::max(rect.x, 0);
+      auto rect_height = std::min(rect.y + rect.height, height) - std::max(rect.y, 0);
+      if (rect_width > 0 && rect_height > 0) {
+        area += (double) rect_width * rect_height;
+      }
+    }
+
+    return std::min(area / ((double) width * height), 1.0);
+  }
+
+  void detector_t::set_active(bool active) {
+    _active = active;
+    _changed_area = 0;
+    _frames = 0;
+    _static_updates = 0;
+    _moving_updates = 0;
+    _settled.reset();
+    _last_update.reset();
+  }
+
+  std::optional<bool> detector_t::update(double changed_area, clock::time_point now) {
+    if (!_last_update) {
+      _last_update = now;
+      _settled = now + settle_time;
+      return std::nullopt;
+    }
+
+    _changed_area += changed_area;
+    ++_frames;
+
+    if (now - *_last_update < update_interval) {
+      return std::nullopt;
+    }
+    _last_update = now;
+
+    auto average = _changed_area / _frames;
+    _changed_area = 0;
+    _frames = 0;
+
+    _static_updates = average < static_area ? _static_updates + 1 : 0;
+    _moving_updates = average > moving_area ? _moving_updates + 1 : 0;
+
+    if (now < *_settled) {
+      return std::nullopt;
+    }
+
+    if (!_active && _static_updates >= static_updates) {
+      return true;
+    }
+    if (_active && _moving_updates >= moving_updates) {
+      return false;
+    }
+
+    return std::nullopt;
+  }
+}  // namespace screen_content
@@ -0,0 +1,74 @@
+/**
+ * @file src/screen_content.h
+ * @brief Declarations for detecting streams of mostly static text and UI, which are encoded with screen content tools.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <optional>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace screen_content {
+  /**
+   * @brief Get the share of an image that changed since the previous one.
+   * @param damage What changed, or unset if the whole image must be assumed to have changed.
+   * @param width The width of the image.
+   * @param height The height of the image.
+   * @return The share from 0 to 1, overlapping rectangles count twice.
+   */
+  double changed_area(const std::optional<std::vector<platf::damage_rect_t>> &damage, int width, int height);
+
+  /**
+   * @brief Decides whether a stream is mostly static, like a desktop or a document, from how much of its frames change.
+   * @details A stream turns static after a long run of windows in which little of each frame changed, and turns
+   *          back after a few windows in which much of each frame changed, like a video or a game. Each switch
+   *          reopens the encoder, so the stream stays in a mode for a while. Only the encoding thread may call it.
+   */
+  class detector_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param active Whether the stream starts as static.
+     */
+    explicit detector_t(bool active = false):
+        _active {active} {
+    }
+
+    /**
+     * @brief Account for an encoded frame.
+     * @param changed_area The share of the frame that changed, see `changed_area()`, 0 for a repeated frame.
+     * @param now The current time.
+     * @return Whether the stream is static, if it should change.
+     */
+    std::optional<bool> update(double changed_area, clock::time_point now = clock::now());
+
+    /**
+     * @brief Set whether the stream is encoded as static.
+     */
+    void set_active(bool active);
+
+    bool active() const {
+      return _active;
+    }
+
+    // How often the stream is judged
+    static constexpr auto update_interval = std::chrono::seconds {1};
+
+  private:
+    bool _active;
+
+    double _changed_area = 0;
+    int _frames = 0;
+
+    int _static_updates = 0;
+    int _moving_updates = 0;
+
+    std::optional<clock::time_point> _last_update;
+    std::optional<clock::time_point> _settled;
+  };
+}  // namespace screen_content
@@ -0,0 +1,125 @@
+/**
+ * @file src/spsc_ring.h
+ * @brief Declarations for a lock-free ring buffer with a single producer and a single consumer.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// local includes
+#include "consumer_signal.h"
+
+namespace util {
+  /**
+   * @brief Fixed-size ring of slots handed from one producer thread to one consumer thread without locking.
+   * @details The producer fills the slot returned by back() in place and publishes it with push().
+   *          The consumer may look at every published slot before popping the oldest one,
+   *          and can sleep in wait() until the producer publishes more or closes the ring.
+   *          The slots are reused in place, so a slot holding buffers keeps them from one value to the next.
+   *          The multi-producer mail queues of safe::lockfree_queue_t move values into cells they claim instead,
+   *          which takes a sequence number per cell that a single producer doesn't need.
+   * @tparam T The slot type.
+   * @tparam N The number of slots, a power of two.
+   */
+  template<class T, std::size_t N>
+  class spsc_ring_t {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "The number of slots must be a power of two");
+
+  public:
+    static constexpr std::size_t capacity = N;
+
+    spsc_ring_t() = default;
+
+    spsc_ring_t(const spsc_ring_t &) = delete;
+    spsc_ring_t &operator=(const spsc_ring_t &) = delete;
+
+    /**
+     * @brief Get the slot the producer fills next.
+     * @return The slot, or nullptr if the ring is full.
+     */
+    T *back() {
+      auto head = _head.load(std::memory_order_relaxed);
+      if (head - _tail.load(std::memory_order_acquire) == N) {
+        return nullptr;
+      }
+
+      return &_slots[head & (N - 1)];
+    }
+
+    /**
+     * @brief Publish the slot returned by back() to the consumer.
+     */
+    void push() {
+      _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      _signal.notify();
+    }
+
+    /**
+     * @brief Get the number of slots published to the consumer.
+     */
+    std::size_t size() const {
+      return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+      return size() == 0;
+    }
+
+    /**
+     * @brief Get a published slot, with 0 being the oldest.
+     * @param index The index, less than size().
+     */
+    T &operator[](std::size_t index) {
+      return _slots[(_tail.load(std::memory_order_relaxed) + index) & (N - 1)];
+    }
+
+    T &front() {
+      return (*this)[0];
+    }
+
+    /**
+     * @brief Hand the oldest slot back to the producer.
+     */
+    void pop() {
+      _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Block the consumer until a slot is published or the ring is closed.
+     */
+    void wait() {
+      auto seen = _signal.prepare();
+      if (!empty() || closed()) {
+        return;
+      }
+
+      _signal.wait(seen);
+    }
+
+    /**
+     * @brief Wake the consumer up for good.
+     */
+    void close() {
+      _closed.store(true, std::memory_order_release);
+      _signal.notify();
+    }
+
+    bool closed() const {
+      return _closed.load(std::memory_order_acquire);
+    }
+
+  private:
+    // Written by the producer and the consumer respectively, kept apart so they don't share a cache line
+    alignas(64) std::atomic<std::size_t> _head {};
+    alignas(64) std::atomic<std::size_t> _tail {};
+
+    alignas(64) consumer_signal_t _signal;
+    std::atomic<bool> _closed {};
+
+    std::array<T, N> _slots {};
+  };
+}  // namespace util
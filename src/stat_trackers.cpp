@@ -2,6 +2,10 @@
  * @file src/stat_trackers.cpp
  * @brief Definitions for streaming statistic tracking.
  */
+// standard includes
+#include <algorithm>
+#include <bit>
+
 // local includes
 #include "stat_trackers.h"
 
@@ -15,4 +19,77 @@ namespace stat_trackers {
     return boost::format("%1$.2f");
   }
 
+  std::uint64_t log_linear_histogram::snapshot_t::percentile(double percentile) const {
+    if (!count) {
+      return 0;
+    }
+
+    auto target = std::max<std::uint64_t>(1, (std::uint64_t) std::ceil(percentile / 100.0 * count));
+    if (target >= count) {
+      return max;
+    }
+
+    std::uint64_t seen = 0;
+    for (std::size_t x = 0; x < buckets.size(); ++x) {
+      seen += buckets[x];
+      if (seen >= target) {
+        return std::clamp(value_of(x), min, max);
+      }
+    }
+
+    return max;
+  }
+
+  void log_linear_histogram::record(std::uint64_t value) {
+    buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(value, std::memory_order_relaxed);
+
+    auto current = min.load(std::memory_order_relaxed);
+    while (value < current && !min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+
+    current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+  }
+
+  log_linear_histogram::snapshot_t log_linear_histogram::snapshot_and_reset() {
+    snapshot_t snapshot;
+
+    // Counted from the buckets, so the count matches what the percentiles are estimated from
+    for (std::size_t x = 0; x < buckets.size(); ++x) {
+      snapshot.buckets[x] = buckets[x].exchange(0, std::memory_order_relaxed);
+      snapshot.count += snapshot.buckets[x];
+    }
+
+    snapshot.total = (double) total.exchange(0, std::memory_order_relaxed);
+    snapshot.min = min.exchange(std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+    snapshot.max = max.exchange(0, std::memory_order_relaxed);
+
+    if (!snapshot.count) {
+      snapshot.min = 0;
+    }
+
+    return snapshot;
+  }
+
+  std::size_t log_linear_histogram::bucket_of(std::uint64_t value) {
+    value = std::min(value, (std::uint64_t {1} << max_bits) - 1);
+    if (value < sub_buckets) {
+      return value;
+    }
+
+    // The top bits of the value pick the bucket within its power of two
+    auto shift = std::bit_width(value) - sub_bucket_bits;
+    return sub_buckets + (shift - 1) * half_sub_buckets + ((value >> shift) - half_sub_buckets);
+  }
+
+  std::uint64_t log_linear_histogram::value_of(std::size_t bucket) {
+    if (bucket < sub_buckets) {
+      return bucket;
+    }
+
+    auto shift = (bucket - sub_buckets) / half_sub_buckets + 1;
+    auto lower = ((bucket - sub_buckets) % half_sub_buckets + half_sub_buckets) << shift;
+    return lower + (std::uint64_t {1} << (shift - 1));
+  }
+
 }  // namespace stat_trackers
@@ -5,9 +5,14 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <functional>
 #include <limits>
+#include <type_traits>
 
 // lib includes
 #include <boost/format.hpp>
@@ -50,4 +55,115 @@ namespace stat_trackers {
     } data;
   };
 
+  /**
+   * @brief Fixed memory log-linear histogram of non-negative integers, in the spirit of HdrHistogram.
+   * @details Values below 32 get a bucket each, larger ones 16 buckets per power of two up to 2^40,
+   *          which keeps any percentile within about 3% of the recorded values. Recording is a few
+   *          relaxed atomic operations, so any thread may record while another takes snapshots.
+   */
+  class log_linear_histogram {
+  public:
+    static constexpr int sub_bucket_bits = 5;
+    static constexpr std::uint64_t sub_buckets = 1 << sub_bucket_bits;
+    static constexpr std::uint64_t half_sub_buckets = sub_buckets / 2;
+
+    // Larger values are recorded as the largest one below 2^max_bits
+    static constexpr int max_bits = 40;
+    static constexpr std::size_t bucket_count = sub_buckets + (max_bits - sub_bucket_bits) * half_sub_buckets;
+
+    struct snapshot_t {
+      std::uint64_t count = 0;
+      std::uint64_t min = 0;
+      std::uint64_t max = 0;
+      double total = 0;
+      std::array<std::uint64_t, bucket_count> buckets {};
+
+      /**
+       * @brief Estimate a percentile from the buckets.
+       * @param percentile The percentile, between 0 and 100.
+       * @return The middle of the bucket holding the percentile, within the recorded range, or zero if nothing was recorded.
+       */
+      std::uint64_t percentile(double percentile) const;
+    };
+
+    void record(std::uint64_t value);
+
+    /**
+     * @brief Take the values recorded since the last call.
+     * @details Values recorded concurrently end up in this snapshot or the next one.
+     * @return The values.
+     */
+    snapshot_t snapshot_and_reset();
+
+    static std::size_t bucket_of(std::uint64_t value);
+
+    /**
+     * @brief Get the value a bucket stands for.
+     * @param bucket The bucket.
+     * @return The middle of the values in the bucket.
+     */
+    static std::uint64_t value_of(std::size_t bucket);
+
+  private:
+    std::array<std::atomic_uint64_t, bucket_count> buckets {};
+    std::atomic_uint64_t total {};
+    std::atomic_uint64_t min {std::numeric_limits<std::uint64_t>::max()};
+    std::atomic_uint64_t max {};
+  };
+
+  /**
+   * @brief Tracks the distribution of a statistic over intervals, down to its tail percentiles.
+   * @details Floating point statistics are kept to three decimals.
+   */
+  template<typename T>
+  class percentile_tracker {
+  public:
+    struct stats_t {
+      double min;
+      double max;
+      double avg;
+      double p50;
+      double p90;
+      double p99;
+      double p999;
+    };
+
+    using callback_function = std::function<void(const stats_t &stats)>;
+
+    void collect_and_callback_on_interval(T stat, const callback_function &callback, std::chrono::seconds interval_in_seconds) {
+      if (!started) {
+        last_callback_time = std::chrono::steady_clock::now();
+        started = true;
+      } else if (std::chrono::steady_clock::now() > last_callback_time + interval_in_seconds) {
+        auto snapshot = histogram.snapshot_and_reset();
+        if (snapshot.count) {
+          callback(stats_t {
+            snapshot.min / scale,
+            snapshot.max / scale,
+            snapshot.total / snapshot.count / scale,
+            snapshot.percentile(50) / scale,
+            snapshot.percentile(90) / scale,
+            snapshot.percentile(99) / scale,
+            snapshot.percentile(99.9) / scale,
+          });
+        }
+        last_callback_time = std::chrono::steady_clock::now();
+      }
+
+      histogram.record(stat > T {} ? (std::uint64_t) std::llround(stat * scale) : 0);
+    }
+
+    void reset() {
+      histogram.snapshot_and_reset();
+      started = false;
+    }
+
+  private:
+    static constexpr double scale = std::is_floating_point_v<T> ? 1000.0 : 1.0;
+
+    log_linear_histogram histogram;
+    std::chrono::steady_clock::time_point last_callback_time;
+    bool started = false;
+  };
+
 }  // namespace stat_trackers
@@ -4,9 +4,13 @@
  */
 
 // standard includes
+#include <ctime>
+#include <filesystem>
 #include <fstream>
 #include <future>
+#include <list>
 #include <queue>
+#include <stdexcept>
 
 // lib includes
 #include <boost/endian/arithmetic.hpp>
@@ -20,20 +24,34 @@ extern "C" {
 }
 
 // local includes
+#include "admission.h"
+#include "bandwidth_probe.h"
+#include "audio_loss.h"
+#include "bitrate_controller.h"
 #include "config.h"
 #include "crypto.h"
 #include "display_device.h"
+#include "flight_recorder.h"
+#include "frame_arena.h"
 #include "globals.h"
 #include "input.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
+#include "network_estimator.h"
+#include "network_profile.h"
+#include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
+#include "recording.h"
 #include "stream.h"
 #include "sync.h"
+#include "thread_affinity.h"
 #include "system_tray.h"
 #include "thread_safe.h"
+#include "tracing.h"
 #include "utility.h"
+#include "video_trace.h"
 
 #define IDX_START_A 0
 #define IDX_START_B 1
@@ -53,6 +71,7 @@ extern "C" {
 #define IDX_SET_CLIPBOARD 16
 #define IDX_FILE_TRANSFER_NONCE_REQUEST 17
 #define IDX_SET_ADAPTIVE_TRIGGERS 18
+#define IDX_BANDWIDTH_PROBE 19
 
 static const short packetTypes[] = {
   0x0305,  // Start A
@@ -74,6 +93,7 @@ static const short packetTypes[] = {
   0x3001,  // Set Clipboard (Apollo protocol extension)
   0x3002,  // File transfer nonce request (Apollo protocol extension)
   0x5503,  // Set Adaptive triggers (Sunshine protocol extension)
+  0x3004,  // Bandwidth probe padding (Apollo protocol extension)
 };
 
 namespace asio = boost::asio;
@@ -135,12 +155,6 @@ namespace stream {
     NV_VIDEO_PACKET packet;
   };
 
-  struct video_packet_enc_prefix_t {
-    std::uint8_t iv[12];  // 12-byte IV is ideal for AES-GCM
-    std::uint32_t frameNumber;
-    std::uint8_t tag[16];
-  };
-
   struct audio_packet_t {
     RTP_PACKET rtp;
   };
@@ -210,6 +224,13 @@ namespace stream {
     std::uint8_t right[DS_EFFECT_PAYLOAD_SIZE];
   };
 
+  struct control_bandwidth_probe_t {
+    control_header_v2 header;
+
+    // Apollo protocol extension, discarded by the client
+    std::array<std::uint8_t, 1024> padding;
+  };
+
   struct control_hdr_mode_t {
     control_header_v2 header;
 
@@ -270,12 +291,101 @@ namespace stream {
     }
   }
 
+  /**
+   * @brief Buffers of the packets of the control stream that are reused once ENet is done with them.
+   * @details Reliable packets are kept until the client acknowledges them, so rumble sent every frame
+   *          keeps a handful of buffers in flight. The packets point into the buffers instead of ENet
+   *          copying every payload into an allocation of its own. Safe to use from any thread.
+   */
+  class control_packet_pool_t {
+  public:
+    // Fits every message of the control stream, the padding of the bandwidth probe included
+    static constexpr std::size_t buffer_size = 1536;
+
+    // Buffers above this are freed, once a burst like the bandwidth probe is over
+    static constexpr std::size_t max_free_buffers = 64;
+
+    /**
+     * @brief Create a reliable packet holding a copy of the payload.
+     * @param payload The payload.
+     * @return The packet, which is destroyed by ENet once it's sent, or by enet_packet_destroy().
+     */
+    ENetPacket *create(const std::string_view &payload) {
+      // Larger payloads are rare enough to be copied by ENet
+      if (payload.size() > buffer_size) {
+        return enet_packet_create(payload.data(), payload.size(), ENET_PACKET_FLAG_RELIABLE);
+      }
+
+      auto buffer = take();
+      std::memcpy(buffer->data(), payload.data(), payload.size());
+
+      auto packet = enet_packet_create(buffer->data(), payload.size(), ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_NO_ALLOCATE);
+      if (!packet) {
+        release(buffer);
+        return nullptr;
+      }
+
+      packet->userData = this;
+      packet->freeCallback = [](ENetPacket *packet) {
+        ((control_packet_pool_t *) packet->userData)->release((buffer_t *) packet->data);
+      };
+
+      return packet;
+    }
+
+  private:
+    using buffer_t = std::array<std::uint8_t, buffer_size>;
+
+    buffer_t *take() {
+      std::lock_guard lg {_lock};
+      if (_free.empty()) {
+        return new buffer_t;
+      }
+
+      auto buffer = _free.back().release();
+      _free.pop_back();
+      return buffer;
+    }
+
+    void release(buffer_t *buffer) {
+      std::lock_guard lg {_lock};
+      if (_free.size() < max_free_buffers) {
+        _free.emplace_back(buffer);
+      } else {
+        delete buffer;
+      }
+    }
+
+    std::mutex _lock;
+    std::vector<std::unique_ptr<buffer_t>> _free;
+  };
+
   class control_server_t {
   public:
     int bind(net::af_e address_family, std::uint16_t port) {
       _host = net::host_create(address_family, _addr, port);
+      if (!_host) {
+        return -1;
+      }
+
+      // Only ever receives from wake(), so wait() can sleep on it together with the host
+      boost::system::error_code ec;
+      _wake_sock.open(udp::v4(), ec);
+      if (!ec) {
+        _wake_sock.bind(udp::endpoint {asio::ip::address_v4::loopback(), 0}, ec);
+      }
+      if (!ec) {
+        _wake_sock.non_blocking(true, ec);
+      }
+      if (!ec) {
+        _wake_endpoint = _wake_sock.local_endpoint(ec);
+      }
+      if (ec) {
+        BOOST_LOG(error) << "Couldn't set up the wake up socket of the control stream: "sv << ec.message();
+        return -1;
+      }
 
-      return !(bool) _host;
+      return 0;
     }
 
     // Get session associated with address.
@@ -288,7 +398,48 @@ namespace stream {
     //   session refers to broadcast_ctx_t
     //   broadcast_ctx_t refers to control_server_t
     // Therefore, iterate is implemented further down the source file
-    void iterate(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Handle every event of the host that is ready, without blocking.
+     */
+    void iterate();
+
+    /**
+     * @brief Sleep until a client sends something, wake() is called or the deadline passes.
+     * @param deadline When to return at the latest.
+     */
+    void wait(std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @brief Get wait() to return right away. Safe to call from any thread.
+     */
+    void wake();
+
+    /**
+     * @brief Have the control thread process a session. Safe to call from any thread.
+     * @details Called when a queue of the session gets a message or the state of it changes.
+     * @param session The session.
+     */
+    void notify(session_t *session) {
+      {
+        auto lg = _pending.lock();
+        _pending->push_back(session);
+      }
+
+      wake();
+    }
+
+    /**
+     * @brief Start notifying the control thread of the messages raised for a session.
+     * @param session The session.
+     */
+    void watch(session_t *session);
+
+    /**
+     * @brief Stop notifying the control thread about a session, before the session is destroyed.
+     * @param session The session.
+     */
+    void unwatch(session_t *session);
 
     /**
      * @brief Call the handler for a given control stream message.
@@ -304,7 +455,11 @@ namespace stream {
     }
 
     int send(const std::string_view &payload, net::peer_t peer) {
-      auto packet = enet_packet_create(payload.data(), payload.size(), ENET_PACKET_FLAG_RELIABLE);
+      auto packet = _packet_pool.create(payload);
+      if (!packet) {
+        return -1;
+      }
+
       if (enet_peer_send(peer, 0, packet)) {
         enet_packet_destroy(packet);
 
@@ -327,8 +482,34 @@ namespace stream {
     // ENet peer to session mapping for sessions with a peer connected
     sync_util::sync_t<std::map<net::peer_t, session_t *>> _peer_to_session;
 
+    // Sessions the control thread has yet to process
+    sync_util::sync_t<std::vector<session_t *>> _pending;
+
     ENetAddress _addr;
+
+    // Destroyed after the host, which destroys the packets still queued
+    control_packet_pool_t _packet_pool;
     net::host_t _host;
+
+    asio::io_context _io_context;
+    udp::socket _wake_sock {_io_context};
+    udp::endpoint _wake_endpoint;
+
+    // Set while a wake up is on its way, so a burst of messages sends only one
+    std::atomic_bool _wake_pending {false};
+  };
+
+  /**
+   * @brief A video sending thread serving a subset of the sessions.
+   */
+  struct video_shard_t {
+    // Only the video broadcast thread raises packets for a shard
+    safe::spsc_queue_t<video::packet_t> packets;
+
+    // Number of sessions currently assigned to this shard
+    std::atomic_int sessions {0};
+
+    std::thread thread;
   };
 
   struct broadcast_ctx_t {
@@ -345,6 +526,54 @@ namespace stream {
     udp::socket audio_sock {io_context};
 
     control_server_t control_server;
+
+    // Reference point of the RTP video timestamps, shared by all video sending threads
+    std::chrono::steady_clock::time_point video_epoch;
+
+    // Empty when all video traffic is sent by video_thread itself
+    std::vector<std::unique_ptr<video_shard_t>> video_shards;
+
+    // Pipelines FEC and encryption of multi-block frames, if enabled
+    std::unique_ptr<thread_pool_util::ThreadPool> video_fec_pool;
+
+    // Video pacing is done by the kernel using transmit times rather than by sleeping
+    bool video_txtime;
+
+    // Video payloads are sent without copying them into the kernel
+    bool video_zerocopy;
+
+    // Batches of video_sock are sent through Registered I/O while this is held
+    std::unique_ptr<platf::deinit_t> video_registered_io;
+
+    // Batches of video_sock are sent through AF_XDP while this is held
+    std::unique_ptr<platf::deinit_t> video_xdp;
+
+    // Each session may send from a socket of its own sharing the ports of video_sock and audio_sock
+    bool session_sockets;
+  };
+
+  /**
+   * @brief How an interface a session may send from has been doing.
+   */
+  struct source_health_t {
+    std::optional<platf::interface_stats_t> last_stats;
+
+    // Consecutive checks the interface passed
+    int healthy_checks = 0;
+  };
+
+  /**
+   * @brief What a session that lost its client keeps running until the client reconnects, or its grace period ends.
+   * @details The app stays resumed and the displays stay configured, so a session resuming the client only
+   *          pays for a new encoder, which always starts with an IDR frame.
+   */
+  struct suspended_session_t {
+    std::string device_uuid;
+    int app_instance;  ///< The instance of proc::instances the session streamed, 0 for proc::proc.
+
+    // The sockets and threads of the broadcast, and the capture of the display
+    safe::shared_t<broadcast_ctx_t>::ptr_t broadcast_ref;
+    std::unique_ptr<platf::deinit_t> capture;
   };
 
   struct session_t {
@@ -363,17 +592,72 @@ namespace stream {
 
     boost::asio::ip::address localAddress;
 
+    // With interface failover, the addresses video and audio may be sent from, most preferred first.
+    // Set by the control thread before source_index, and never changed afterwards.
+    std::vector<platf::interface_address_t> source_addresses;
+
+    // The address of source_addresses video and audio are sent from, -1 for localAddress
+    std::atomic_int source_index {-1};
+
     struct {
       std::string ping_payload;
 
       int lowseq;
       udp::endpoint peer;
 
+      // Backs the buffers of the frame currently being sent
+      util::frame_arena_t arena;
+
+      // Zero-copy sends still referencing the arena
+      platf::zerocopy_ticket_t zerocopy_ticket;
+
+      // Zero-copy sends still referencing the buffer of a frame the encoder laid out
+      video::frame_buffer_pool_t::buffer_t zerocopy_buffer;
+
+      // Index into broadcast_ctx_t::video_shards, if any
+      int shard;
+
       std::optional<crypto::cipher::gcm_t> cipher;
       std::uint64_t gcm_iv_counter;
 
       safe::mail_raw_t::event_t<bool> idr_events;
       safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
+      safe::mail_raw_t::event_t<int> bitrate_events;
+
+      // The runtime settings the video of this session follows, and the bitrate negotiated at its start
+      std::shared_ptr<const config::runtime_t> runtime;
+      int negotiated_bitrate;
+
+      // Only set with adaptive bitrate or dynamic FEC, fed by the control and video threads
+      std::unique_ptr<bitrate_controller_t> bitrate_controller;
+
+      // Only set with adaptive pacing, fed by the control and video threads
+      std::unique_ptr<network_estimator_t> network_estimator;
+
+      // The last bitrate the bitrate controller held, fed by the thread sending the video of this session
+      stable_bitrate_t stable_bitrate;
+
+      // Set by the video thread once the client pinged, 0 if unknown
+      int path_mtu = 0;
+
+      // Only set with the bandwidth probe, fed by the control thread until the video thread starts the stream
+      std::unique_ptr<bandwidth_probe_t> bandwidth_probe;
+
+      // Set while frames are dropped for being late, until a frame that doesn't reference them arrives.
+      // Only touched by the thread sending the video of this session.
+      std::optional<std::chrono::steady_clock::time_point> late_frames_since;
+      std::int64_t first_late_frame;
+      bool late_frames_idr_requested;
+
+      // Set while the frames of this session are dropped until a recovery point, in the video packet queue
+      // and in the queue of its shard. Each is only touched by the thread raising the frames into the queue.
+      std::array<std::atomic_bool, 2> cutting {};
+
+      // Only set while recording the frames of this session, written by the thread sending its video
+      std::unique_ptr<video::trace_writer_t> trace;
+
+      // Only set with session_sockets, connected to the peer
+      std::unique_ptr<udp::socket> sock;
 
       std::unique_ptr<platf::deinit_t> qos;
     } video;
@@ -392,6 +676,14 @@ namespace stream {
       util::buffer_t<uint8_t *> shards_p;
 
       audio_fec_packet_t fec_packet;
+
+      // Only set with adaptive audio, fed by the control and video threads
+      std::unique_ptr<audio::loss_monitor_t> loss_monitor;
+      safe::mail_raw_t::event_t<int> loss_events;
+
+      // Only set with session_sockets, connected to the peer
+      std::unique_ptr<udp::socket> sock;
+
       std::unique_ptr<platf::deinit_t> qos;
     } audio;
 
@@ -401,6 +693,9 @@ namespace stream {
       crypto::aes_t incoming_iv;
       crypto::aes_t outgoing_iv;
 
+      // Reused for every message, so decrypting the control stream doesn't allocate
+      std::vector<std::uint8_t> plaintext;
+
       std::uint32_t connect_data;  // Used for new clients with ML_FF_SESSION_ID_V1
       std::string expected_peer_address;  // Only used for legacy clients without ML_FF_SESSION_ID_V1
 
@@ -409,6 +704,12 @@ namespace stream {
 
       platf::feedback_queue_t feedback_queue;
       safe::mail_raw_t::event_t<video::hdr_info_t> hdr_queue;
+
+      // Only touched by the control thread
+      bool ping_timer_armed {false};
+
+      // Only touched by the control thread, one for each of source_addresses
+      std::vector<source_health_t> source_health;
     } control;
 
     std::uint32_t launch_session_id;
@@ -416,6 +717,26 @@ namespace stream {
     std::string device_uuid;
     crypto::PERM permission;
 
+    // What the last sessions of the client learned about the path to it
+    std::optional<network_profile_t> network_profile;
+
+    std::shared_ptr<metrics::session_metrics_t> metrics;
+
+    // Only set while recording the session, fed by the threads sending its video and audio
+    std::unique_ptr<recording::recorder_t> recording;
+
+    // Set by the control thread when the session stops because it lost its client
+    std::atomic_bool lost_client {false};
+
+    // What the suspended session this one resumed kept running, held until this one runs it itself
+    std::shared_ptr<suspended_session_t> resumed;
+
+    // Counts what the stream takes toward the capacity of the host, see admission::model_t
+    admission::model_t::lease_t admission;
+
+    // The instance of proc::instances streamed, 0 for proc::proc
+    int app_instance;
+
     std::list<crypto::command_entry_t> do_cmds;
     std::list<crypto::command_entry_t> undo_cmds;
 
@@ -425,6 +746,39 @@ namespace stream {
     std::atomic<session::state_e> state;
   };
 
+  bool is_keyframe(const video::packet_t &packet) {
+    // A frame after reference frame invalidation doesn't reference the frames that were dropped either
+    return packet->is_idr() || packet->after_ref_frame_invalidation;
+  }
+
+  bool is_droppable(const video::packet_t &packet) {
+    return packet->non_reference;
+  }
+
+  /**
+   * @brief Get the flag set while the frames of the session of a packet are cut in a video queue.
+   * @tparam queue 0 for the video packet queue, 1 for the queue of a shard, which cut on their own.
+   */
+  template<int queue>
+  std::atomic_bool &cutting(const video::packet_t &packet) {
+    return ((session_t *) packet->channel_data)->video.cutting[queue];
+  }
+
+  /**
+   * @brief Ask the encoder of a session for a recovery point, as a frame its next frames depend on was dropped.
+   * @details The encoder would otherwise keep referencing the dropped frame, and the cut would never end.
+   */
+  void request_recovery(const video::packet_t &packet) {
+    auto &video = ((session_t *) packet->channel_data)->video;
+
+    BOOST_LOG(debug) << "Frame "sv << packet->frame_index() << " dropped on a full queue, dropping frames until a recovery point"sv;
+    if (video::last_encoder_probe_supported_ref_frames_invalidation) {
+      video.invalidate_ref_frames_events->raise(std::make_pair(packet->frame_index(), packet->frame_index()));
+    } else {
+      video.idr_events->raise(true);
+    }
+  }
+
   /**
    * First part of cipher must be struct of type control_encrypted_t
    *
@@ -454,14 +808,10 @@ namespace stream {
       //
       // The sequence number is 32 bits long which allows for 2^32 control stream messages
       // to be sent to each client before the IV repeats.
-      iv.resize(12);
       std::copy_n((uint8_t *) &seq, sizeof(seq), std::begin(iv));
       iv[10] = 'H';  // Host originated
       iv[11] = 'C';  // Control stream
     } else {
-      // Nvidia's old style encryption uses a 16-byte IV
-      iv.resize(16);
-
       iv[0] = (std::uint8_t) seq;
     }
 
@@ -487,6 +837,115 @@ namespace stream {
 
   static auto broadcast = safe::make_shared<broadcast_ctx_t>(start_broadcast, end_broadcast);
 
+  // How often the interfaces of sessions that may fail over are checked
+  constexpr auto source_check_interval = 1s;
+
+  // An interface dropping or failing more packets than this between checks is considered congested
+  constexpr std::uint64_t max_source_tx_failures = 10;
+
+  // How many checks an interface preferred over the current one must pass before switching back to it
+  constexpr int source_failback_checks = 5;
+
+  /**
+   * @brief Get the address the video and audio of a session are sent from.
+   */
+  boost::asio::ip::address &source_address(session_t &session) {
+    auto index = session.source_index.load(std::memory_order_acquire);
+    return index < 0 ? session.localAddress : session.source_addresses[index].address;
+  }
+
+  /**
+   * @brief Find the interfaces the video and audio of a session can fail over to.
+   * @details Only the control thread may call this, once the control stream of the session connected.
+   * @param session The session.
+   * @param client_address The address of the client.
+   */
+  void init_source_failover(session_t &session, const boost::asio::ip::address &client_address) {
+    // Sockets connected to the client are bound to the address it reached
+    if (config::stream.session_sockets) {
+      BOOST_LOG(info) << "Interface failover doesn't work with per-session sockets"sv;
+      return;
+    }
+
+    auto sources = net::source_interfaces(platf::interface_addresses(), session.localAddress, client_address);
+    if (sources.size() < 2) {
+      BOOST_LOG(debug) << "No other interface reaches ["sv << client_address << "], there's nothing to fail over to"sv;
+      return;
+    }
+
+    // Start from the interface the last session to the client ended up on
+    if (auto &profile = session.network_profile; profile && !profile->interface.empty()) {
+      auto preferred = std::find_if(std::begin(sources), std::end(sources), [&](const auto &source) {
+        return source.name == profile->interface;
+      });
+      if (preferred != std::end(sources)) {
+        std::rotate(std::begin(sources), preferred, std::next(preferred));
+      }
+    }
+
+    std::string names;
+    for (auto &source : sources) {
+      names += (names.empty() ? ""s : ", "s) + source.name + " ("s + source.address.to_string() + ')';
+    }
+    BOOST_LOG(info) << "Video and audio to ["sv << client_address << "] can be sent from "sv << names;
+
+    session.control.source_health.resize(sources.size());
+    session.source_addresses = std::move(sources);
+    session.source_index.store(0, std::memory_order_release);
+  }
+
+  /**
+   * @brief Switch the video and audio of a session to another interface if the current one lost its link or is congested.
+   * @details The first interface that's healthy is used, but the current one is only left for an interface
+   *          preferred over it once that one stayed healthy for a while. Only the control thread may call this.
+   * @param session The session.
+   */
+  void check_source_failover(session_t &session) {
+    auto &sources = session.source_addresses;
+    auto &health = session.control.source_health;
+
+    for (std::size_t x = 0; x < sources.size(); ++x) {
+      auto stats = platf::interface_stats(sources[x].name);
+
+      auto healthy = stats && stats->carrier;
+      if (healthy && health[x].last_stats) {
+        auto &last = *health[x].last_stats;
+        healthy = (stats->tx_dropped - last.tx_dropped) + (stats->tx_errors - last.tx_errors) <= max_source_tx_failures;
+      }
+
+      health[x].healthy_checks = healthy ? health[x].healthy_checks + 1 : 0;
+      health[x].last_stats = stats;
+    }
+
+    auto current = session.source_index.load(std::memory_order_relaxed);
+    int chosen = -1;
+    for (int x = 0; x < (int) sources.size(); ++x) {
+      if (x == current ? health[x].healthy_checks > 0 : health[x].healthy_checks >= source_failback_checks) {
+        chosen = x;
+        break;
+      }
+    }
+
+    // With the current interface down and the others only just up, take whichever is up
+    if (chosen < 0) {
+      for (int x = 0; x < (int) sources.size() && chosen < 0; ++x) {
+        if (health[x].healthy_checks > 0) {
+          chosen = x;
+        }
+      }
+    }
+
+    if (chosen < 0 || chosen == current) {
+      return;
+    }
+
+    BOOST_LOG(warning) << "Sending video and audio from "sv << sources[chosen].name << " ("sv << sources[chosen].address
+                       << ") instead of "sv << sources[current].name << " ("sv << sources[current].address << ')';
+
+    session.source_index.store(chosen, std::memory_order_release);
+    ++session.metrics->source_failovers;
+  }
+
   session_t *control_server_t::get_session(const net::peer_t peer, uint32_t connect_data) {
     {
       // Fast path - look up existing session by peer
@@ -538,9 +997,18 @@ namespace stream {
       BOOST_LOG(debug) << "Control local address ["sv << local_address << ']';
       BOOST_LOG(debug) << "Control peer address ["sv << peer_addr << ':' << peer_port << ']';
 
+      if (config::stream.interface_failover) {
+        init_source_failover(*session_p, boost::asio::ip::make_address(peer_addr));
+      }
+
       // Insert this into the map for O(1) lookups in the future
-      auto ptslg = _peer_to_session.lock();
-      _peer_to_session->emplace(peer, session_p);
+      {
+        auto ptslg = _peer_to_session.lock();
+        _peer_to_session->emplace(peer, session_p);
+      }
+
+      // Messages raised before the client connected can be sent now
+      notify(session_p);
       return session_p;
     }
 
@@ -573,17 +1041,15 @@ namespace stream {
     }
   }
 
-  void control_server_t::iterate(std::chrono::milliseconds timeout) {
+  void control_server_t::iterate() {
     ENetEvent event;
-    auto res = enet_host_service(_host.get(), &event, timeout.count());
-
-    if (res > 0) {
+    while (enet_host_service(_host.get(), &event, 0) > 0) {
       auto session = get_session(event.peer, event.data);
       if (!session) {
         BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
         enet_peer_disconnect_now(event.peer, 0);
 
-        return;
+        continue;
       }
 
       session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
@@ -591,6 +1057,7 @@ namespace stream {
       switch (event.type) {
         case ENET_EVENT_TYPE_RECEIVE:
           {
+            TRACE_SCOPE("control: message");
             net::packet_t packet {event.packet};
 
             auto type = *(std::uint16_t *) packet->data;
@@ -606,6 +1073,7 @@ namespace stream {
           BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
           // No more clients to send video data to ^_^
           if (session->state == session::state_e::RUNNING) {
+            session->lost_client = true;
             session::stop(*session);
           }
           break;
@@ -615,11 +1083,113 @@ namespace stream {
     }
   }
 
+  void control_server_t::wait(std::chrono::steady_clock::time_point deadline) {
+    auto timeout = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+    auto wake_sock = (ENetSocket) _wake_sock.native_handle();
+
+    ENetSocketSet read_set;
+    ENET_SOCKETSET_EMPTY(read_set);
+    ENET_SOCKETSET_ADD(read_set, _host->socket);
+    ENET_SOCKETSET_ADD(read_set, wake_sock);
+
+    auto res = enet_socketset_select(std::max(_host->socket, wake_sock), &read_set, nullptr, std::max<std::int64_t>(timeout.count(), 0));
+    if (res <= 0 || !ENET_SOCKETSET_CHECK(read_set, wake_sock)) {
+      return;
+    }
+
+    // Cleared first, so a wake up while draining sends another one rather than getting lost
+    _wake_pending.store(false, std::memory_order_release);
+
+    std::array<char, 16> buf;
+    boost::system::error_code ec;
+    while (_wake_sock.receive(asio::buffer(buf), 0, ec) > 0 && !ec) {}
+  }
+
+  void control_server_t::wake() {
+    if (_wake_pending.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+
+    char wake_byte = 0;
+    boost::system::error_code ec;
+    _wake_sock.send_to(asio::buffer(&wake_byte, sizeof(wake_byte)), _wake_endpoint, 0, ec);
+  }
+
+  void control_server_t::watch(session_t *session) {
+    auto notify = [this, session]() {
+      this->notify(session);
+    };
+
+    session->control.feedback_queue->on_raise(notify);
+    session->control.hdr_queue->on_raise(notify);
+    session->shutdown_event->on_raise(notify);
+
+    // The control thread arms the ping timer of the session when it first sees it
+    this->notify(session);
+  }
+
+  void control_server_t::unwatch(session_t *session) {
+    session->control.feedback_queue->on_raise(nullptr);
+    session->control.hdr_queue->on_raise(nullptr);
+    session->shutdown_event->on_raise(nullptr);
+
+    auto lg = _pending.lock();
+    std::erase(*_pending, session);
+  }
+
   namespace fec {
     using rs_t = util::safe_ptr<reed_solomon, [](reed_solomon *rs) {
       reed_solomon_release(rs);
     }>;
 
+    // Number of reed_solomon contexts kept by each sending thread
+    constexpr size_t MAX_CACHED_RS_CONTEXTS = 8;
+
+    // Shards that start on a cache line don't split the vector loads and stores of nanors across two of them.
+    // Only the start of each buffer of shards is aligned, every shard is when the block size is a multiple of it,
+    // like with the default packet size of Moonlight, since the shards are sent from the buffers as they are.
+    constexpr size_t SHARD_ALIGNMENT = util::frame_arena_t::max_alignment;
+
+    /**
+     * @brief Get a reed_solomon context for the given shard counts.
+     * @details Building the encoding matrix is expensive, and the shard counts rarely change
+     *          at a fixed bitrate and packet size, so the most recently used contexts are kept
+     *          in a per-thread LRU cache.
+     * @param data_shards The number of data shards.
+     * @param parity_shards The number of parity shards.
+     * @return The cached context, owned by the cache of the calling thread.
+     */
+    static reed_solomon *get_rs(size_t data_shards, size_t parity_shards) {
+      struct cached_rs_t {
+        size_t data_shards;
+        size_t parity_shards;
+        rs_t rs;
+      };
+
+      // Most recently used at the front
+      thread_local std::list<cached_rs_t> cache;
+
+      auto it = std::find_if(std::begin(cache), std::end(cache), [&](const cached_rs_t &cached) {
+        return cached.data_shards == data_shards && cached.parity_shards == parity_shards;
+      });
+      if (it != std::end(cache)) {
+        cache.splice(std::begin(cache), cache, it);
+        return cache.front().rs.get();
+      }
+
+      rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+      if (!rs) {
+        return nullptr;
+      }
+
+      if (cache.size() == MAX_CACHED_RS_CONTEXTS) {
+        cache.pop_back();
+      }
+
+      return cache.emplace_front(cached_rs_t {data_shards, parity_shards, std::move(rs)}).rs.get();
+    }
+
     struct fec_t {
       size_t data_shards;
       size_t nr_shards;
@@ -627,11 +1197,13 @@ namespace stream {
 
       size_t blocksize;
       size_t prefixsize;
-      util::buffer_t<char> shards;
-      util::buffer_t<char> headers;
-      util::buffer_t<uint8_t *> shards_p;
 
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
+      // Allocated from the frame arena of the session
+      std::span<char> shards;
+      std::span<char> headers;
+      std::span<uint8_t *> shards_p;
+
+      std::span<platf::buffer_descriptor_t> payload_buffers;
 
       char *data(size_t el) {
         return (char *) shards_p[el];
@@ -646,7 +1218,7 @@ namespace stream {
       }
     };
 
-    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
+    static fec_t encode(util::frame_arena_t &arena, const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
       auto payload_size = payload.size();
 
       auto pad = payload_size % blocksize != 0;
@@ -660,7 +1232,7 @@ namespace stream {
         parity_shards = minparityshards;
         fecpercentage = (100 * parity_shards) / data_shards;
 
-        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
+        BOOST_LOG_HOT(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
       }
 
       auto nr_shards = data_shards + parity_shards;
@@ -668,10 +1240,9 @@ namespace stream {
       // If we need to store a zero-padded data shard, allocate that first to
       // to keep the shards in order and reduce buffer fragmentation
       auto parity_shard_offset = pad ? 1 : 0;
-      util::buffer_t<char> shards {(parity_shard_offset + parity_shards) * blocksize};
-      util::buffer_t<uint8_t *> shards_p {nr_shards};
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
-      payload_buffers.reserve(2);
+      auto shards = arena.alloc<char>((parity_shard_offset + parity_shards) * blocksize, SHARD_ALIGNMENT);
+      auto shards_p = arena.alloc<uint8_t *>(nr_shards);
+      auto payload_buffers = arena.alloc<platf::buffer_descriptor_t>(2);
 
       // Point into the payload buffer for all except the final padded data shard
       auto next = std::begin(payload);
@@ -679,7 +1250,7 @@ namespace stream {
         shards_p[x] = (uint8_t *) next;
         next += blocksize;
       }
-      payload_buffers.emplace_back(std::begin(payload), aligned_data_shards * blocksize);
+      std::construct_at(&payload_buffers[0], std::begin(payload), aligned_data_shards * blocksize);
 
       // If the last data shard needs to be zero-padded, we must use the shards buffer
       if (pad) {
@@ -697,7 +1268,7 @@ namespace stream {
       }
 
       // Add a payload buffer describing the shard buffer
-      payload_buffers.emplace_back(std::begin(shards), shards.size());
+      std::construct_at(&payload_buffers[1], shards.data(), shards.size());
 
       if (fecpercentage != 0) {
         // Point into our allocated buffer for the parity shards
@@ -706,9 +1277,9 @@ namespace stream {
         }
 
         // packets = parity_shards + data_shards
-        rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+        auto rs = get_rs(data_shards, parity_shards);
 
-        reed_solomon_encode(rs.get(), shards_p.begin(), nr_shards, blocksize);
+        reed_solomon_encode(rs, shards_p.data(), nr_shards, blocksize);
       }
 
       return {
@@ -717,78 +1288,155 @@ namespace stream {
         fecpercentage,
         blocksize,
         prefixsize,
-        std::move(shards),
-        util::buffer_t<char> {nr_shards * prefixsize},
-        std::move(shards_p),
-        std::move(payload_buffers),
+        shards,
+        arena.alloc<char>(nr_shards * prefixsize),
+        shards_p,
+        payload_buffers,
       };
     }
   }  // namespace fec
 
   /**
-   * @brief Combines two buffers and inserts new buffers at each slice boundary of the result.
+   * @brief Combines a list of buffers and inserts new buffers at each slice boundary of the result.
+   * @param alloc The allocator of the result.
    * @param insert_size The number of bytes to insert.
    * @param slice_size The number of bytes between insertions.
-   * @param data1 The first data buffer.
-   * @param data2 The second data buffer.
+   * @param segments The data buffers, in order.
    */
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
-    auto data_size = data1.size() + data2.size();
+  template<class Alloc>
+  std::vector<uint8_t, Alloc> concat_and_insert(const Alloc &alloc, uint64_t insert_size, uint64_t slice_size, std::span<const std::string_view> segments) {
+    uint64_t data_size = 0;
+    for (auto &segment : segments) {
+      data_size += segment.size();
+    }
+
     auto pad = data_size % slice_size != 0;
     auto elements = data_size / slice_size + (pad ? 1 : 0);
 
-    std::vector<uint8_t> result;
+    std::vector<uint8_t, Alloc> result {alloc};
     result.resize(elements * insert_size + data_size);
 
-    auto next = std::begin(data1);
-    auto end = std::end(data1);
+    auto segment = std::begin(segments);
+    std::size_t offset = 0;
     for (auto x = 0; x < elements; ++x) {
-      void *p = &result[x * (insert_size + slice_size)];
+      auto *p = &result[x * (insert_size + slice_size)] + insert_size;
 
       // For the last iteration, only copy to the end of the data
-      if (x == elements - 1) {
-        slice_size = data_size - (x * slice_size);
-      }
+      auto remaining = x == elements - 1 ? data_size - (x * slice_size) : slice_size;
 
-      // Test if this slice will extend into the next buffer
-      if (next + slice_size > end) {
-        // Copy the first portion from the first buffer
-        auto copy_len = end - next;
-        std::copy(next, end, (char *) p + insert_size);
+      // Gather the slice from every buffer it spans
+      while (remaining > 0) {
+        auto copy_len = std::min<uint64_t>(remaining, segment->size() - offset);
+        std::memcpy(p, segment->data() + offset, copy_len);
 
-        // Copy the remaining portion from the second buffer
-        next = std::begin(data2);
-        end = std::end(data2);
-        std::copy(next, next + (slice_size - copy_len), (char *) p + copy_len + insert_size);
-        next += slice_size - copy_len;
-      } else {
-        std::copy(next, next + slice_size, (char *) p + insert_size);
-        next += slice_size;
+        p += copy_len;
+        remaining -= copy_len;
+        offset += copy_len;
+
+        if (offset == segment->size()) {
+          ++segment;
+          offset = 0;
+        }
       }
     }
 
     return result;
   }
 
-  std::vector<uint8_t> replace(const std::string_view &original, const std::string_view &old, const std::string_view &_new) {
-    std::vector<uint8_t> replaced;
-    replaced.reserve(original.size() + _new.size() - old.size());
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments) {
+    return concat_and_insert(std::allocator<uint8_t> {}, insert_size, slice_size, segments);
+  }
+
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
+    return concat_and_insert(insert_size, slice_size, {data1, data2});
+  }
 
-    auto begin = std::begin(original);
-    auto end = std::end(original);
-    auto next = std::search(begin, end, std::begin(old), std::end(old));
+  /**
+   * @brief Replaces the first occurrence of a buffer in a list of buffers without copying any data.
+   * @details The buffer holding the match is split around it and `_new` is referenced in between,
+   *          so `_new` must outlive the segments. Matches spanning two buffers are not found.
+   * @param segments The data buffers, in order.
+   * @param old The data to replace.
+   * @param _new The replacement data.
+   */
+  template<class Alloc>
+  void replace(std::vector<std::string_view, Alloc> &segments, const std::string_view &old, const std::string_view &_new) {
+    for (auto it = std::begin(segments); it != std::end(segments); ++it) {
+      auto next = it->find(old);
+      if (next == std::string_view::npos) {
+        continue;
+      }
 
-    std::copy(begin, next, std::back_inserter(replaced));
-    if (next != end) {
-      std::copy(std::begin(_new), std::end(_new), std::back_inserter(replaced));
-      std::copy(next + old.size(), end, std::back_inserter(replaced));
+      auto after = it->substr(next + old.size());
+      *it = it->substr(0, next);
+      segments.insert(std::next(it), {_new, after});
+      return;
     }
+  }
 
-    return replaced;
+  void replace(std::vector<std::string_view> &segments, const std::string_view &old, const std::string_view &_new) {
+    replace<std::allocator<std::string_view>>(segments, old, _new);
   }
 
   /**
-   * @brief Pass gamepad feedback data back to the client.
+   * @brief Find where the NAL units before the first slice of an Annex B frame end.
+   * @details Parameter sets always precede the slices of a keyframe, so they're found without searching
+   *          the slices, which make up nearly all of it.
+   * @param frame The frame.
+   * @param video_format The codec of the frame, 0 for H.264 and 1 for HEVC.
+   * @return The offset of the start code of the first slice, or the size of the frame if it has none or the codec isn't known.
+   */
+  std::size_t parameter_sets_size(const std::string_view &frame, int video_format) {
+    constexpr auto start_code = "\0\0\1"sv;
+
+    if (video_format != 0 && video_format != 1) {
+      return frame.size();
+    }
+
+    for (auto pos = frame.find(start_code); pos != std::string_view::npos && pos + start_code.size() < frame.size(); pos = frame.find(start_code, pos + start_code.size())) {
+      auto header = (std::uint8_t) frame[pos + start_code.size()];
+
+      auto is_slice = video_format == 0 ? (header & 0x1F) >= 1 && (header & 0x1F) <= 5 : ((header >> 1) & 0x3F) < 32;
+      if (is_slice) {
+        return pos;
+      }
+    }
+
+    return frame.size();
+  }
+
+  /**
+   * @brief Add a gamepad feedback message to the ones to send, replacing an older state of the same thing.
+   * @details Only the newest rumble, trigger rumble or RGB LED state of a gamepad matters to the client.
+   *          Motion event states are kept per sensor, and adaptive trigger effects per set of triggers they apply to.
+   * @param pending The messages to send, in the order they were first raised.
+   * @param msg The message to add.
+   */
+  void coalesce_feedback(std::vector<platf::gamepad_feedback_msg_t> &pending, const platf::gamepad_feedback_msg_t &msg) {
+    auto it = std::find_if(std::begin(pending), std::end(pending), [&msg](const platf::gamepad_feedback_msg_t &other) {
+      if (other.id != msg.id || other.type != msg.type) {
+        return false;
+      }
+
+      switch (msg.type) {
+        case platf::gamepad_feedback_e::set_motion_event_state:
+          return other.data.motion_event_state.motion_type == msg.data.motion_event_state.motion_type;
+        case platf::gamepad_feedback_e::set_adaptive_triggers:
+          return other.data.adaptive_triggers.event_flags == msg.data.adaptive_triggers.event_flags;
+        default:
+          return true;
+      }
+    });
+
+    if (it == std::end(pending)) {
+      pending.push_back(msg);
+    } else {
+      *it = msg;
+    }
+  }
+
+  /**
+   * @brief Pass gamepad feedback data back to the client.
    * @param session The session object.
    * @param msg The message to pass.
    * @return 0 on success.
@@ -800,7 +1448,16 @@ namespace stream {
       return -1;
     }
 
-    std::string payload;
+    // The payload points into the plaintext or its encrypted copy, both on the stack
+    auto send = [session](const auto &plaintext) {
+      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+        encrypted_payload;
+
+      auto payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      return session->broadcast_ref->control_server.send(payload, session->control.peer);
+    };
+
+    int err;
     if (msg.type == platf::gamepad_feedback_e::rumble) {
       control_rumble_t plaintext;
       plaintext.header.type = packetTypes[IDX_RUMBLE_DATA];
@@ -813,11 +1470,8 @@ namespace stream {
       plaintext.lowfreq = util::endian::little(data.lowfreq);
       plaintext.highfreq = util::endian::little(data.highfreq);
 
-      BOOST_LOG(verbose) << "Rumble: "sv << msg.id << " :: "sv << util::hex(data.lowfreq).to_string_view() << " :: "sv << util::hex(data.highfreq).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      BOOST_LOG_HOT(verbose) << "Rumble: "sv << msg.id << " :: "sv << util::hex(data.lowfreq).to_string_view() << " :: "sv << util::hex(data.highfreq).to_string_view();
+      err = send(plaintext);
     } else if (msg.type == platf::gamepad_feedback_e::rumble_triggers) {
       control_rumble_triggers_t plaintext;
       plaintext.header.type = packetTypes[IDX_RUMBLE_TRIGGER_DATA];
@@ -829,11 +1483,8 @@ namespace stream {
       plaintext.left = util::endian::little(data.left_trigger);
       plaintext.right = util::endian::little(data.right_trigger);
 
-      BOOST_LOG(verbose) << "Rumble triggers: "sv << msg.id << " :: "sv << util::hex(data.left_trigger).to_string_view() << " :: "sv << util::hex(data.right_trigger).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      BOOST_LOG_HOT(verbose) << "Rumble triggers: "sv << msg.id << " :: "sv << util::hex(data.left_trigger).to_string_view() << " :: "sv << util::hex(data.right_trigger).to_string_view();
+      err = send(plaintext);
     } else if (msg.type == platf::gamepad_feedback_e::set_motion_event_state) {
       control_set_motion_event_t plaintext;
       plaintext.header.type = packetTypes[IDX_SET_MOTION_EVENT];
@@ -845,11 +1496,8 @@ namespace stream {
       plaintext.reportrate = util::endian::little(data.report_rate);
       plaintext.type = data.motion_type;
 
-      BOOST_LOG(verbose) << "Motion event state: "sv << msg.id << " :: "sv << util::hex(data.report_rate).to_string_view() << " :: "sv << util::hex(data.motion_type).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      BOOST_LOG_HOT(verbose) << "Motion event state: "sv << msg.id << " :: "sv << util::hex(data.report_rate).to_string_view() << " :: "sv << util::hex(data.motion_type).to_string_view();
+      err = send(plaintext);
     } else if (msg.type == platf::gamepad_feedback_e::set_rgb_led) {
       control_set_rgb_led_t plaintext;
       plaintext.header.type = packetTypes[IDX_SET_RGB_LED];
@@ -862,11 +1510,8 @@ namespace stream {
       plaintext.g = data.g;
       plaintext.b = data.b;
 
-      BOOST_LOG(verbose) << "RGB: "sv << msg.id << " :: "sv << util::hex(data.r).to_string_view() << util::hex(data.g).to_string_view() << util::hex(data.b).to_string_view();
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      BOOST_LOG_HOT(verbose) << "RGB: "sv << msg.id << " :: "sv << util::hex(data.r).to_string_view() << util::hex(data.g).to_string_view() << util::hex(data.b).to_string_view();
+      err = send(plaintext);
     } else if (msg.type == platf::gamepad_feedback_e::set_adaptive_triggers) {
       control_adaptive_triggers_t plaintext;
       plaintext.header.type = packetTypes[IDX_SET_ADAPTIVE_TRIGGERS];
@@ -879,16 +1524,13 @@ namespace stream {
       plaintext.type_right = msg.data.adaptive_triggers.type_right;
       std::ranges::copy(msg.data.adaptive_triggers.right, plaintext.right);
 
-      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
-        encrypted_payload;
-
-      payload = encode_control(session, util::view(plaintext), encrypted_payload);
+      err = send(plaintext);
     } else {
       BOOST_LOG(error) << "Unknown gamepad feedback message type"sv;
       return -1;
     }
 
-    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
+    if (err) {
       TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
       BOOST_LOG(warning) << "Couldn't send gamepad feedback to ["sv << addr << ':' << port << ']';
 
@@ -927,9 +1569,67 @@ namespace stream {
     return 0;
   }
 
+  // The padding probing the network path to a client, encrypted
+  constexpr std::size_t bandwidth_probe_packet_size = sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(control_bandwidth_probe_t)) + crypto::cipher::tag_size;
+
+  /**
+   * @brief Send a packet of the padding probing the network path to the client.
+   * @return The bytes handed to the control stream, or -1 if they couldn't be.
+   */
+  int send_bandwidth_probe(session_t *session) {
+    control_bandwidth_probe_t plaintext {};
+    plaintext.header.type = packetTypes[IDX_BANDWIDTH_PROBE];
+    plaintext.header.payloadLength = sizeof(plaintext.padding);
+
+    std::array<std::uint8_t, bandwidth_probe_packet_size> encrypted_payload;
+
+    auto payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
+      return -1;
+    }
+
+    return (int) payload.size();
+  }
+
+  /**
+   * @brief Send the padding of the bandwidth probe of a session that's due by now.
+   * @return `true` while the probe goes on.
+   */
+  bool probe_bandwidth(session_t &session) {
+    auto &probe = *session.video.bandwidth_probe;
+    auto peer = session.control.peer;
+
+    // ENet shrinks the window while the round-trip time is unstable
+    std::uint32_t window = peer->windowSize * peer->packetThrottle / ENET_PEER_PACKET_THROTTLE_SCALE;
+    bandwidth_probe_t::sample_t sample {
+      peer->reliableDataInTransit,
+      std::chrono::milliseconds {peer->roundTripTime},
+      peer->packetsLost,
+      window,
+    };
+
+    auto due = probe.update(sample);
+
+    // Padding beyond the window would wait in the queue of the peer, and go out as acknowledgements come in
+    std::size_t bytes = 0;
+    int packets = 0;
+    while (bytes + bandwidth_probe_packet_size <= due && sample.bytes_in_flight + bytes + bandwidth_probe_packet_size <= window) {
+      auto sent = send_bandwidth_probe(&session);
+      if (sent < 0) {
+        break;
+      }
+
+      bytes += sent;
+      ++packets;
+    }
+    probe.sent(bytes, packets);
+
+    return !probe.done();
+  }
+
   void controlBroadcastThread(control_server_t *server) {
     server->map(packetTypes[IDX_PERIODIC_PING], [](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
+      BOOST_LOG_HOT(verbose) << "type [IDX_PERIODIC_PING]"sv;
     });
 
     server->map(packetTypes[IDX_START_A], [&](session_t *session, const std::string_view &payload) {
@@ -947,18 +1647,40 @@ namespace stream {
 
       auto lastGoodFrame = stats[3];
 
-      BOOST_LOG(verbose)
+      BOOST_LOG_HOT(verbose)
         << "type [IDX_LOSS_STATS]"sv << std::endl
         << "---begin stats---" << std::endl
         << "loss count since last report [" << count << ']' << std::endl
         << "time in milli since last report [" << t.count() << ']' << std::endl
         << "last good frame [" << lastGoodFrame << ']' << std::endl
         << "---end stats---";
+
+      if (session->video.bitrate_controller) {
+        session->video.bitrate_controller->packets_lost(count);
+      }
+
+      // The client reports periodically, so this samples the round-trip time ENet measures on the control stream too
+      if (session->video.network_estimator) {
+        session->video.network_estimator->packets_lost(count);
+        if (session->control.peer) {
+          session->video.network_estimator->rtt_sampled(std::chrono::milliseconds {session->control.peer->roundTripTime}, std::chrono::milliseconds {session->control.peer->roundTripTimeVariance});
+        }
+      }
+
+      if (session->audio.loss_monitor) {
+        if (auto loss_percentage = session->audio.loss_monitor->packets_lost(count)) {
+          session->audio.loss_events->raise(*loss_percentage);
+        }
+      }
     });
 
     server->map(packetTypes[IDX_REQUEST_IDR_FRAME], [&](session_t *session, const std::string_view &payload) {
       BOOST_LOG(debug) << "type [IDX_REQUEST_IDR_FRAME]"sv;
 
+      if (session->video.bitrate_controller) {
+        session->video.bitrate_controller->frames_lost(1);
+      }
+
       session->video.idr_events->raise(true);
     });
 
@@ -972,6 +1694,10 @@ namespace stream {
         << "firstFrame [" << firstFrame << ']' << std::endl
         << "lastFrame [" << lastFrame << ']';
 
+      if (session->video.bitrate_controller) {
+        session->video.bitrate_controller->frames_lost((int) std::clamp<std::int64_t>(lastFrame - firstFrame + 1, 1, 100));
+      }
+
       session->video.invalidate_ref_frames_events->raise(std::make_pair(firstFrame, lastFrame));
     });
 
@@ -981,7 +1707,7 @@ namespace stream {
       auto tagged_cipher_length = util::endian::big(*(int32_t *) payload.data());
       std::string_view tagged_cipher {payload.data() + sizeof(tagged_cipher_length), (size_t) tagged_cipher_length};
 
-      std::vector<uint8_t> plaintext;
+      auto &plaintext = session->control.plaintext;
 
       auto &cipher = session->control.cipher;
       auto &iv = session->control.legacy_input_enc_iv;
@@ -998,7 +1724,8 @@ namespace stream {
         std::copy(payload.end() - 16, payload.end(), std::begin(iv));
       }
 
-      input::passthrough(session->input, std::move(plaintext), session->permission);
+      flight_recorder::record(flight_recorder::event_e::input, session, 0, (std::int64_t) plaintext.size());
+      input::passthrough(session->input, plaintext, session->permission);
     });
 
     server->map(packetTypes[IDX_EXEC_SERVER_CMD], [server](session_t *session, const std::string_view &payload) {
@@ -1053,7 +1780,7 @@ namespace stream {
     });
 
     server->map(packetTypes[IDX_ENCRYPTED], [server](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
+      BOOST_LOG_HOT(verbose) << "type [IDX_ENCRYPTED]"sv;
 
       auto header = (control_encrypted_p) (payload.data() - 2);
 
@@ -1090,7 +1817,7 @@ namespace stream {
         iv[0] = (std::uint8_t) seq;
       }
 
-      std::vector<uint8_t> plaintext;
+      auto &plaintext = session->control.plaintext;
       if (cipher.decrypt(tagged_cipher, plaintext, &iv)) {
         // something went wrong :(
 
@@ -1111,8 +1838,8 @@ namespace stream {
 
       // IDX_INPUT_DATA callback will attempt to decrypt unencrypted data, therefore we need pass it directly
       if (type == packetTypes[IDX_INPUT_DATA]) {
-        plaintext.erase(std::begin(plaintext), std::begin(plaintext) + 4);
-        input::passthrough(session->input, std::move(plaintext), session->permission);
+        flight_recorder::record(flight_recorder::event_e::input, session, 0, (std::int64_t) plaintext.size() - 4);
+        input::passthrough(session->input, std::span {plaintext}.subspan(4), session->permission);
       } else {
         server->call(type, session, next_payload, true);
       }
@@ -1120,82 +1847,214 @@ namespace stream {
 
     // This thread handles latency-sensitive control messages
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_affinity::pin_current_thread("control"sv);
 
     // Check for both the full shutdown event and the shutdown event for this
     // broadcast to ensure we can inform connected clients of our graceful
     // termination when we shut down.
     auto shutdown_event = mail::man->event<bool>(mail::shutdown);
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
-      bool has_session_awaiting_peer = false;
+    // Min-heap of the ping deadlines of the sessions. Every message from a client pushes its deadline back,
+    // so an entry may be out of date and is only checked against the session once it expires.
+    using ping_timer_t = std::pair<std::chrono::steady_clock::time_point, session_t *>;
+    std::vector<ping_timer_t> ping_timers;
+    constexpr auto earliest_first = std::greater<> {};
+
+    // Sessions sending the padding of their bandwidth probe
+    std::vector<session_t *> probing;
 
+    // Removes a session that stopped, without holding the session list any longer than it takes to erase it
+    auto remove_session = [&](session_t *session) {
       {
         auto lg = server->_sessions.lock();
+        std::erase(*server->_sessions, session);
+      }
 
-        auto now = std::chrono::steady_clock::now();
+      server->unwatch(session);
+      std::erase(probing, session);
 
-        KITTY_WHILE_LOOP(auto pos = std::begin(*server->_sessions), pos != std::end(*server->_sessions), {
-          // Don't perform additional session processing if we're shutting down
-          if (shutdown_event->peek() || broadcast_shutdown_event->peek()) {
-            break;
-          }
+      if (std::erase_if(ping_timers, [session](const ping_timer_t &timer) {
+            return timer.second == session;
+          })) {
+        std::make_heap(std::begin(ping_timers), std::end(ping_timers), earliest_first);
+      }
 
-          auto session = *pos;
+      if (session->control.peer) {
+        {
+          auto ptslg = server->_peer_to_session.lock();
+          server->_peer_to_session->erase(session->control.peer);
+        }
 
-          if (now > session->pingTimeout) {
-            auto address = session->control.peer ? platf::from_sockaddr((sockaddr *) &session->control.peer->address.address) : session->control.expected_peer_address;
-            BOOST_LOG(info) << address << ": Ping Timeout"sv;
-            session::stop(*session);
-          }
+        enet_peer_disconnect_now(session->control.peer, 0);
+      }
 
-          if (session->state.load(std::memory_order_acquire) == session::state_e::STOPPING) {
-            pos = server->_sessions->erase(pos);
+      session->controlEnd.raise(true);
+    };
 
-            if (session->control.peer) {
-              {
-                auto ptslg = server->_peer_to_session.lock();
-                server->_peer_to_session->erase(session->control.peer);
-              }
+    // The app exiting wakes us up to end the streams
+    proc::set_exit_listener([server]() {
+      server->wake();
+    });
+    auto exit_listener_fg = util::fail_guard([]() {
+      proc::set_exit_listener(nullptr);
+    });
 
-              enet_peer_disconnect_now(session->control.peer, 0);
-            }
+    std::vector<session_t *> ready;
+    std::vector<platf::gamepad_feedback_msg_t> feedback_msgs;
+    auto next_source_check = std::chrono::steady_clock::now();
+    while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
+      auto now = std::chrono::steady_clock::now();
 
-            session->controlEnd.raise(true);
-            continue;
-          }
+      while (!ping_timers.empty() && ping_timers.front().first <= now) {
+        std::pop_heap(std::begin(ping_timers), std::end(ping_timers), earliest_first);
+        auto session = ping_timers.back().second;
 
-          // Remember if we have a session that's waiting for a peer to connect to the
-          // control stream. This ensures the clients are properly notified even when
-          // the app terminates before they finish connecting.
-          if (!session->control.peer) {
-            has_session_awaiting_peer = true;
-          } else {
-            auto &feedback_queue = session->control.feedback_queue;
-            while (feedback_queue->peek()) {
-              auto feedback_msg = feedback_queue->pop();
+        if (now <= session->pingTimeout) {
+          ping_timers.back().first = session->pingTimeout;
+          std::push_heap(std::begin(ping_timers), std::end(ping_timers), earliest_first);
+          continue;
+        }
+        ping_timers.pop_back();
 
-              send_feedback_msg(session, *feedback_msg);
-            }
+        auto address = session->control.peer ? platf::from_sockaddr((sockaddr *) &session->control.peer->address.address) : session->control.expected_peer_address;
+        BOOST_LOG(info) << address << ": Ping Timeout"sv;
+        session->lost_client = session->control.peer != nullptr;
+        session::stop(*session);
+
+        ready.push_back(session);
+      }
+
+      {
+        auto lg = server->_pending.lock();
+        ready.insert(std::end(ready), std::begin(*server->_pending), std::end(*server->_pending));
+        server->_pending->clear();
+      }
+
+      // A session may have been notified of several times since the last iteration
+      std::sort(std::begin(ready), std::end(ready));
+      ready.erase(std::unique(std::begin(ready), std::end(ready)), std::end(ready));
+
+      for (auto session : ready) {
+        // Don't perform additional session processing if we're shutting down
+        if (shutdown_event->peek() || broadcast_shutdown_event->peek()) {
+          break;
+        }
+
+        if (session->state.load(std::memory_order_acquire) == session::state_e::STOPPING) {
+          remove_session(session);
+          continue;
+        }
+
+        if (!session->control.ping_timer_armed) {
+          session->control.ping_timer_armed = true;
+
+          ping_timers.emplace_back(session->pingTimeout, session);
+          std::push_heap(std::begin(ping_timers), std::end(ping_timers), earliest_first);
+        }
+
+        // Anything raised before the client connects is sent once it does
+        if (!session->control.peer) {
+          continue;
+        }
+
+        // The bandwidth probe runs while the client sets up the video stream
+        auto &probe = session->video.bandwidth_probe;
+        if (probe && !probe->done() && std::find(std::begin(probing), std::end(probing), session) == std::end(probing)) {
+          probing.push_back(session);
+        }
+
+        // Games tend to update rumble every frame, so only the newest state of each is sent
+        auto &feedback_queue = session->control.feedback_queue;
+        while (feedback_queue->peek()) {
+          auto feedback_msg = feedback_queue->pop();
+
+          coalesce_feedback(feedback_msgs, *feedback_msg);
+        }
 
-            auto &hdr_queue = session->control.hdr_queue;
-            while (session->control.peer && hdr_queue->peek()) {
-              auto hdr_info = hdr_queue->pop();
+        for (auto &feedback_msg : feedback_msgs) {
+          send_feedback_msg(session, feedback_msg);
+        }
+        feedback_msgs.clear();
+
+        auto &hdr_queue = session->control.hdr_queue;
+        while (session->control.peer && hdr_queue->peek()) {
+          auto hdr_info = hdr_queue->pop();
+
+          send_hdr_mode(session, std::move(hdr_info));
+        }
+      }
+      ready.clear();
+
+      std::erase_if(probing, [](session_t *session) {
+        return !probe_bandwidth(*session);
+      });
+
+      if (config::stream.interface_failover && now >= next_source_check) {
+        next_source_check = now + source_check_interval;
 
-              send_hdr_mode(session, std::move(hdr_info));
+        auto lg = server->_sessions.lock();
+        for (auto session : *server->_sessions) {
+          if (session->control.peer && session->source_index.load(std::memory_order_relaxed) >= 0) {
+            check_source_failover(*session);
+          }
+        }
+      }
+
+      server->flush();
+
+      // Don't break until any pending sessions either expire or connect.
+      // Remember if we have a session that's waiting for a peer to connect to the
+      // control stream. This ensures the clients are properly notified even when
+      // the app terminates before they finish connecting.
+      // Sessions of an instance next to proc::proc end with its app, the others with the app of proc::proc
+      auto primary_running = proc::proc.running() != 0;
+      if (!primary_running || proc::instances.count()) {
+        std::vector<session_t *> app_exited;
+        bool has_session_awaiting_peer = false;
+        bool has_instance_session = false;
+        {
+          auto lg = server->_sessions.lock();
+          for (auto session : *server->_sessions) {
+            has_instance_session = has_instance_session || session->app_instance;
+
+            if (session->app_instance ? proc::instances.running(session->app_instance) : primary_running) {
+              continue;
+            }
+
+            // Sessions still waiting for their client are told once it connects
+            has_session_awaiting_peer = has_session_awaiting_peer || !session->control.peer;
+            if (session->control.peer) {
+              app_exited.push_back(session);
             }
           }
+        }
 
-          ++pos;
-        })
+        if (!primary_running && !has_instance_session) {
+          if (!has_session_awaiting_peer) {
+            BOOST_LOG(info) << "Process terminated"sv;
+            break;
+          }
+        } else {
+          for (auto session : app_exited) {
+            BOOST_LOG(info) << "Process terminated, ending the stream of ["sv << session->device_name << ']';
+            session::graceful_stop(*session);
+          }
+        }
       }
 
-      // Don't break until any pending sessions either expire or connect
-      if (proc::proc.running() == 0 && !has_session_awaiting_peer) {
-        BOOST_LOG(info) << "Process terminated"sv;
-        break;
+      // Messages, state changes of the sessions and the app exiting wake us up right away,
+      // so this only bounds how long it takes to notice an app whose exit isn't watched for terminating
+      auto deadline = std::chrono::steady_clock::now() + 150ms;
+      if (!ping_timers.empty()) {
+        deadline = std::min(deadline, ping_timers.front().first);
+      }
+      if (!probing.empty()) {
+        // The padding goes out in bursts of a millisecond or so
+        deadline = std::min(deadline, std::chrono::steady_clock::now() + 1ms);
       }
 
-      server->iterate(150ms);
+      server->wait(deadline);
+      server->iterate();
     }
 
     // Let all remaining connections know the server is shutting down
@@ -1224,6 +2083,8 @@ namespace stream {
         }
       }
 
+      server->unwatch(session);
+
       session->shutdown_event->raise(true);
       session->controlEnd.raise(true);
     }
@@ -1279,7 +2140,7 @@ namespace stream {
         });
 
         auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
-        BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+        BOOST_LOG_HOT(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
 
         populate_peer_to_session();
 
@@ -1324,104 +2185,334 @@ namespace stream {
     }
   }
 
-  void videoBroadcastThread(udp::socket &sock) {
-    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
-    auto video_epoch = std::chrono::steady_clock::now();
+  /**
+   * @brief Per-thread state used to protect, encrypt and pace outgoing video frames.
+   */
+  struct video_sender_t {
+    explicit video_sender_t(const broadcast_ctx_t &ctx):
+        video_epoch {ctx.video_epoch},
+        fec_pool {ctx.video_fec_pool.get()},
+        txtime {ctx.video_txtime},
+        zerocopy {ctx.video_zerocopy},
+        ratecontrol_next_frame_start {std::chrono::steady_clock::now()},
+        iv(12),
+        timer {platf::create_high_precision_timer()},
+        frame_processing_latency_logger {debug, "Frame processing latency", "ms"},
+        frame_send_batch_latency_logger {debug, ctx.video_zerocopy ? "Network: each zero-copy send_batch() latency" : "Network: each send_batch() latency"},
+        frame_fec_latency_logger {debug, "Network: each FEC block latency"},
+        frame_network_latency_logger {debug, "Network: frame's overall network latency"} {
+    }
 
-    // Video traffic is sent on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    std::chrono::steady_clock::time_point video_epoch;
 
-    logging::min_max_avg_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms");
+    // Prepares the next FEC block of a frame while the current one is sent, if any
+    thread_pool_util::ThreadPool *fec_pool;
 
-    logging::time_delta_periodic_logger frame_send_batch_latency_logger(debug, "Network: each send_batch() latency");
-    logging::time_delta_periodic_logger frame_fec_latency_logger(debug, "Network: each FEC block latency");
-    logging::time_delta_periodic_logger frame_network_latency_logger(debug, "Network: frame's overall network latency");
+    // Hand the pacing deadlines to the kernel instead of sleeping until them
+    bool txtime;
 
-    crypto::aes_t iv(12);
+    // Send payloads without copying them into the kernel
+    bool zerocopy;
 
-    auto timer = platf::create_high_precision_timer();
-    if (!timer || !*timer) {
-      BOOST_LOG(error) << "Failed to create timer, aborting video broadcast thread";
+    std::chrono::steady_clock::time_point ratecontrol_next_frame_start;
+
+    crypto::aes_t iv;
+    std::unique_ptr<platf::high_precision_timer> timer;
+
+    logging::percentile_periodic_logger<double> frame_processing_latency_logger;
+    logging::time_delta_periodic_logger frame_send_batch_latency_logger;
+    logging::time_delta_periodic_logger frame_fec_latency_logger;
+    logging::time_delta_periodic_logger frame_network_latency_logger;
+  };
+
+  /**
+   * @brief Check if a frame must be dropped because it, or a frame it may reference, waited too long to be sent.
+   * @details Dropping starts with a frame captured longer than `max_frame_latency` ago, and asks the encoder
+   *          for a frame that doesn't reference the dropped ones. Every frame is dropped until that frame or
+   *          a keyframe arrives, so the client never decodes against a missing reference.
+   *          Only the thread sending the video of the session may call this.
+   * @param session The session the frame is for.
+   * @param packet The frame.
+   * @return `true` if the frame must not be sent.
+   */
+  bool drop_late_frame(session_t &session, video::packet_raw_t &packet) {
+    auto &video = session.video;
+    auto max_latency = config::stream.max_frame_latency;
+    auto now = std::chrono::steady_clock::now();
+
+    if (video.late_frames_since) {
+      if (!packet.is_idr() && !packet.after_ref_frame_invalidation) {
+        // The encoder had its chance at recovering through reference frame invalidation
+        if (!video.late_frames_idr_requested && now - *video.late_frames_since > std::max(max_latency, 100ms)) {
+          BOOST_LOG(debug) << "No recovery frame since late frame "sv << video.first_late_frame << ", requesting an IDR frame"sv;
+          video.idr_events->raise(true);
+          video.late_frames_idr_requested = true;
+        }
+
+        return true;
+      }
+
+      BOOST_LOG(debug) << "Frames "sv << video.first_late_frame << '-' << packet.frame_index() - 1 << " dropped for being late"sv;
+      video.late_frames_since.reset();
+    }
+
+    if (max_latency == 0ms || !packet.frame_timestamp || now - *packet.frame_timestamp <= max_latency) {
+      return false;
+    }
+
+    video.late_frames_since = now;
+    video.first_late_frame = packet.frame_index();
+
+    // Frames encoded until the encoder handles this reference the dropped ones, and are dropped as well
+    video.late_frames_idr_requested = !video::last_encoder_probe_supported_ref_frames_invalidation;
+    if (video.late_frames_idr_requested) {
+      video.idr_events->raise(true);
+    } else {
+      video.invalidate_ref_frames_events->raise(std::make_pair(packet.frame_index(), packet.frame_index()));
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Get the layout for the encoder to copy frames in, so they're split into packets in place.
+   * @param packetsize The size of the video packets the client asked for.
+   * @return The layout.
+   */
+  static video::packet_layout_t video_packet_layout(int packetsize) {
+    auto blocksize = packetsize + MAX_RTP_HEADER_SIZE;
+    return {sizeof(video_short_frame_header_t), sizeof(video_packet_raw_t), blocksize - sizeof(video_packet_raw_t)};
+  }
+
+  /**
+   * @brief Follow the runtime settings published since the previous frame of a session.
+   */
+  static void update_runtime(session_t &session) {
+    auto previous = std::move(session.video.runtime);
+    session.video.runtime = config::runtime();
+    auto &current = *session.video.runtime;
+
+    // The limit only lowers the bitrate below the one negotiated with the client
+    auto limit = [&](const config::runtime_t &runtime) {
+      return runtime.max_bitrate > 0 ? std::min(session.video.negotiated_bitrate, runtime.max_bitrate) : session.video.negotiated_bitrate;
+    };
+
+    if (limit(*previous) == limit(current) && previous->fec_percentage == current.fec_percentage) {
       return;
     }
 
-    auto ratecontrol_next_frame_start = std::chrono::steady_clock::now();
+    BOOST_LOG(info) << "Streaming at up to "sv << limit(current) << " Kbps with "sv << current.fec_percentage << "% FEC from now on"sv;
+    if (session.video.bitrate_controller) {
+      // It tells the encoder about the bitrate with its next update
+      session.video.bitrate_controller->reconfigure(limit(current), current.fec_percentage);
+    } else if (limit(*previous) != limit(current)) {
+      session.video.bitrate_events->raise(limit(current));
+    }
+  }
+
+  /**
+   * @brief Apply FEC, encryption and pacing to a single encoded frame and send it to its session.
+   * @param sender The state of the sending thread.
+   * @param sock The video socket.
+   * @param packet The encoded frame.
+   */
+  void send_video_packet(video_sender_t &sender, udp::socket &sock, video::packet_t &packet) {
+    auto &video_epoch = sender.video_epoch;
+    auto &ratecontrol_next_frame_start = sender.ratecontrol_next_frame_start;
+    auto &iv = sender.iv;
+    auto &timer = sender.timer;
+    auto &frame_processing_latency_logger = sender.frame_processing_latency_logger;
+    auto &frame_send_batch_latency_logger = sender.frame_send_batch_latency_logger;
+    auto &frame_fec_latency_logger = sender.frame_fec_latency_logger;
+    auto &frame_network_latency_logger = sender.frame_network_latency_logger;
+
+    frame_network_latency_logger.first_point_now();
+
+    auto session = (session_t *) packet->channel_data;
+    TRACE_FRAME_SCOPE("video: send frame", session, packet->frame_index());
+
+    // Recorded once sent, as the slices of a frame may still be encoding
+    auto sent = std::chrono::steady_clock::now();
+    auto record_trace = util::fail_guard([&]() {
+      if (session->video.trace) {
+        session->video.trace->record(*packet, sent);
+      }
 
-    while (auto packet = packets->pop()) {
-      if (shutdown_event->peek()) {
-        break;
+      // Frames dropped for being late are still recorded, as the frames after them reference them
+      if (session->recording) {
+        session->recording->video(packet->data(), packet->data_size(), packet->is_idr(), packet->frame_timestamp.value_or(sent));
       }
+    });
 
-      frame_network_latency_logger.first_point_now();
+    if (drop_late_frame(*session, *packet)) {
+      return;
+    }
 
-      auto session = (session_t *) packet->channel_data;
-      auto lowseq = session->video.lowseq;
+    // Settings reloaded since the previous frame apply from this one on
+    if (config::runtime_version() != session->video.runtime->version) {
+      update_runtime(*session);
+    }
+    auto &runtime = *session->video.runtime;
+
+    auto lowseq = session->video.lowseq;
+
+    // A socket connected to the peer sends without addressing each packet
+    auto &video_sock = session->video.sock ? *session->video.sock : sock;
+    bool connected = (bool) session->video.sock;
+
+    auto &session_metrics = *session->metrics;
+    auto frame_start = std::chrono::steady_clock::now();
+    session_metrics.frame_started(packet->frame_index(), packet->is_idr());
+
+    // Nothing from the previous frame of this session is still in use once the kernel
+    // is done with its zero-copy sends
+    if (sender.zerocopy) {
+      platf::wait_for_zerocopy(video_sock.native_handle(), session->video.zerocopy_ticket);
+      session->video.zerocopy_buffer.reset();
+    }
+    auto &arena = session->video.arena;
+    arena.reset();
+    util::arena_allocator_t<uint8_t> arena_alloc {arena};
+
+    // The payload holds the data shards
+    util::arena_allocator_t<uint8_t> shard_alloc {arena, fec::SHARD_ALIGNMENT};
+
+    // A frame handed over with its first slices is sent block by block as the encoder finishes it.
+    // NVENC, the only encoder doing this, doesn't need replacements.
+    auto partial = dynamic_cast<video::packet_raw_partial *>(packet.get());
+
+    std::string_view payload;
+
+    // The frame is kept as a list of segments of the packet and replacement data, so
+    // replacing parameter sets in keyframes doesn't copy the frame until it's split
+    // into shards, like any other frame.
+    std::vector<std::string_view, util::arena_allocator_t<std::string_view>> payload_segments {arena_alloc};
+    std::size_t payload_size = 0;
+
+    // A frame the encoder copied in the layout it's sent in only gets its frame header, unless parameter sets are replaced
+    auto laid_out = dynamic_cast<video::packet_raw_pooled *>(packet.get());
+    if (laid_out && (laid_out->layout != video_packet_layout(session->config.packetsize) || (packet->is_idr() && packet->replacements))) {
+      laid_out = nullptr;
+    }
+
+    if (laid_out) {
+      payload_size = laid_out->frame_size;
+    } else if (!partial) {
+      payload = std::string_view {(char *) packet->data(), packet->data_size()};
 
-      std::string_view payload {(char *) packet->data(), packet->data_size()};
-      std::vector<uint8_t> payload_with_replacements;
+      payload_segments.reserve(3 + (packet->replacements ? packet->replacements->size() * 2 : 0));
 
       // Apply replacements on the packet payload before performing any other operations.
       // We need to know the final frame size to calculate the last packet size, and we
       // must avoid matching replacements against the frame header or any other non-video
-      // part of the payload.
+      // part of the payload. Only the NAL units before the first slice are searched.
       if (packet->is_idr() && packet->replacements) {
-        for (auto &replacement : *packet->replacements) {
-          auto frame_old = replacement.old;
-          auto frame_new = replacement._new;
+        auto headers_size = parameter_sets_size(payload, session->config.monitor.videoFormat);
+        payload_segments.emplace_back(payload.substr(0, headers_size));
 
-          payload_with_replacements = replace(payload, frame_old, frame_new);
-          payload = {(char *) payload_with_replacements.data(), payload_with_replacements.size()};
+        for (auto &replacement : *packet->replacements) {
+          replace(payload_segments, replacement.old, replacement._new);
         }
+
+        payload_segments.emplace_back(payload.substr(headers_size));
+      } else {
+        payload_segments.emplace_back(payload);
       }
 
-      video_short_frame_header_t frame_header = {};
-      frame_header.headerType = 0x01;  // Short header type
-      frame_header.frameType = packet->is_idr()                     ? 2 :
-                               packet->after_ref_frame_invalidation ? 5 :
-                                                                      1;
-      frame_header.lastPayloadLen = (payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
-      if (frame_header.lastPayloadLen == 0) {
-        frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
+      for (auto &segment : payload_segments) {
+        payload_size += segment.size();
       }
+    }
 
-      if (packet->frame_timestamp) {
-        auto duration_to_latency = [](const std::chrono::steady_clock::duration &duration) {
-          const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-          return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
-        };
+    video_short_frame_header_t frame_header = {};
+    frame_header.headerType = 0x01;  // Short header type
+    frame_header.frameType = packet->is_idr()                     ? 2 :
+                             packet->after_ref_frame_invalidation ? 5 :
+                             packet->intra_refresh                ? 4 :
+                                                                    1;
+    frame_header.lastPayloadLen = (payload_size + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
+    if (frame_header.lastPayloadLen == 0 || partial) {
+      // The size of a partial frame isn't known yet, so its last packet is padded with zeros,
+      // which H.264 and HEVC decoders take as trailing zero bytes of the last NAL unit
+      frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
+    }
 
-        uint16_t latency = duration_to_latency(std::chrono::steady_clock::now() - *packet->frame_timestamp);
-        frame_header.frame_processing_latency = latency;
-        frame_processing_latency_logger.collect_and_log(latency / 10.);
-      } else {
-        frame_header.frame_processing_latency = 0;
-      }
+    std::optional<std::chrono::nanoseconds> queue_delay;
+    if (packet->frame_timestamp) {
+      auto duration_to_latency = [](const std::chrono::steady_clock::duration &duration) {
+        const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
+      };
+
+      auto processing_latency = std::chrono::steady_clock::now() - *packet->frame_timestamp;
+      session_metrics.capture_to_send.record(processing_latency);
+      queue_delay = processing_latency;
+
+      uint16_t latency = duration_to_latency(processing_latency);
+      frame_header.frame_processing_latency = latency;
+      frame_processing_latency_logger.collect_and_log(latency / 10.);
+    } else {
+      frame_header.frame_processing_latency = 0;
+    }
 
-      auto fecPercentage = config::stream.fec_percentage;
+    auto &bitrate_controller = session->video.bitrate_controller;
+    auto fecPercentage = bitrate_controller ? bitrate_controller->fec_percentage(packet->is_idr() || packet->after_ref_frame_invalidation || packet->intra_refresh) : runtime.fec_percentage;
+
+    // The FEC adapted by the bitrate controller already follows the loss jitter causes
+    auto &network_estimator = session->video.network_estimator;
+    if (network_estimator && !bitrate_controller) {
+      fecPercentage = network_estimator->fec_percentage(fecPercentage);
+    }
 
-      // Insert space for packet headers
-      auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
-      auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
-      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, std::string_view {(char *) &frame_header, sizeof(frame_header)}, payload);
+    // Losing a non-reference frame costs only that frame
+    if (packet->non_reference) {
+      fecPercentage /= 2;
+    }
 
-      payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
+    // Insert space for packet headers
+    auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
+    auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
+    payload_segments.emplace(std::begin(payload_segments), (char *) &frame_header, sizeof(frame_header));
+
+    // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
+    constexpr auto MAX_FEC_BLOCKS = 4;
+
+    // The max number of data shards per block is found by solving this system of equations for D:
+    // D = 255 - P
+    // P = D * F
+    // which results in the solution:
+    // D = 255 / (1 + F)
+    // multiplied by 100 since F is the percentage as an integer:
+    // D = (255 * 100) / (100 + F)
+    auto max_data_shards_per_fec_block = (DATA_SHARDS_MAX * 100) / (100 + fecPercentage);
+
+    std::array<std::string_view, MAX_FEC_BLOCKS> fec_blocks;
+    std::array<int, MAX_FEC_BLOCKS> fec_block_percentages;
+
+    std::size_t fec_blocks_needed;
+    if (partial) {
+      // The blocks are filled as the slices come in, as many blocks as slices up to the protocol limit.
+      // The block count is in every packet, so it's settled before anything is known about the frame.
+      fec_blocks_needed = std::clamp(partial->total_slices, 1, MAX_FEC_BLOCKS);
+      fec_block_percentages.fill(fecPercentage);
+    } else {
+      if (laid_out) {
+        auto &buffer = *laid_out->buffer;
+        std::memcpy(buffer.data() + sizeof(video_packet_raw_t), &frame_header, sizeof(frame_header));
 
-      // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
-      constexpr auto MAX_FEC_BLOCKS = 4;
+        payload = std::string_view {(char *) buffer.data(), buffer.size()};
+        if (sender.zerocopy) {
+          session->video.zerocopy_buffer = laid_out->buffer;
+        }
+      } else {
+        auto payload_new = concat_and_insert(shard_alloc, sizeof(video_packet_raw_t), payload_blocksize, payload_segments);
 
-      // The max number of data shards per block is found by solving this system of equations for D:
-      // D = 255 - P
-      // P = D * F
-      // which results in the solution:
-      // D = 255 / (1 + F)
-      // multiplied by 100 since F is the percentage as an integer:
-      // D = (255 * 100) / (100 + F)
-      auto max_data_shards_per_fec_block = (DATA_SHARDS_MAX * 100) / (100 + fecPercentage);
+        payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
+      }
 
       // Compute the number of FEC blocks needed for this frame using the block size and max shards
       auto max_data_per_fec_block = max_data_shards_per_fec_block * blocksize;
-      auto fec_blocks_needed = (payload.size() + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
+      fec_blocks_needed = (payload.size() + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
 
       // If the number of FEC blocks needed exceeds the protocol limit, turn off FEC for this frame.
       // For normal FEC percentages, this should only happen for enormous frames (over 800 packets at 20%).
@@ -1430,13 +2521,9 @@ namespace stream {
         fecPercentage = 0;
         fec_blocks_needed = MAX_FEC_BLOCKS;
       }
+      fec_block_percentages.fill(fecPercentage);
 
-      std::array<std::string_view, MAX_FEC_BLOCKS> fec_blocks;
-      decltype(fec_blocks)::iterator
-        fec_blocks_begin = std::begin(fec_blocks),
-        fec_blocks_end = std::begin(fec_blocks) + fec_blocks_needed;
-
-      BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
+      BOOST_LOG_HOT(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
 
       // Align individual FEC blocks to blocksize
       auto unaligned_size = payload.size() / fec_blocks_needed;
@@ -1458,191 +2545,455 @@ namespace stream {
           fec_blocks[x] = payload.substr(x * aligned_size, aligned_size);
         }
       }
+    }
 
-      try {
-        // Use around 80% of 1Gbps          1Gbps            percent    ms     packet      byte
-        size_t ratecontrol_packets_in_1ms = std::giga::num * 80 / 100 / 1000 / blocksize / 8;
-
-        // Send less than 64K in a single batch.
-        // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
-        // appear in "Other I/O" and begin waiting for interrupts.
-        // This gives inconsistent performance so we'd rather avoid it.
-        size_t send_batch_size = 64 * 1024 / blocksize;
-        // Also don't exceed 64 packets, which can happen when Moonlight requests
-        // unusually small packet size.
-        // Generic Segmentation Offload on Linux can't do more than 64.
-        send_batch_size = std::min<size_t>(64, send_batch_size);
-
-        // Don't ignore the last ratecontrol group of the previous frame
-        auto ratecontrol_frame_start = std::max(ratecontrol_next_frame_start, std::chrono::steady_clock::now());
-
-        size_t ratecontrol_frame_packets_sent = 0;
-        size_t ratecontrol_group_packets_sent = 0;
-
-        auto blockIndex = 0;
-        std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &current_payload) {
-          auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
-
-          for (int x = 0; x < packets; ++x) {
-            auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
-
-            inspect->packet.frameIndex = packet->frame_index();
-            inspect->packet.streamPacketIndex = ((uint32_t) lowseq + x) << 8;
-
-            // Match multiFecFlags with Moonlight
-            inspect->packet.multiFecFlags = 0x10;
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-
-            inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
-            if (x == 0) {
-              inspect->packet.flags |= FLAG_SOF;
-            }
-            if (x == packets - 1) {
-              inspect->packet.flags |= FLAG_EOF;
-            }
-          }
+    // Bytes of a partial frame that aren't in a block yet, counting the frame header, and the slices taken so far
+    std::size_t partial_pending_size = sizeof(frame_header);
+    int partial_slices = 0;
+    bool partial_complete = false;
+
+    // Fills the next FEC block of a partial frame, waiting for the encoder as needed. Every block
+    // but the last one waits for its share of the slices, and holds the whole packets that are done.
+    // Once the frame is complete, the rest of it is padded to whole packets and spread over the remaining
+    // blocks, at least one packet each.
+    auto fill_partial_block = [&](int blockIndex) {
+      auto remaining_blocks = fec_blocks_needed - blockIndex;
+
+      while (!partial_complete) {
+        auto min_slices = remaining_blocks == 1 ?
+                            partial->total_slices :
+                            std::max(partial_slices + 1, (int) (partial->total_slices * (blockIndex + 1) / fec_blocks_needed));
+
+        TRACE_FRAME_SCOPE("video: wait for slices", session, packet->frame_index());
+        auto taken = partial->slices->take(min_slices, 100ms);
+        if (!taken) {
+          return false;
+        }
 
-          frame_fec_latency_logger.first_point_now();
-          // If video encryption is enabled, we allocate space for the encryption header before each shard
-          auto shards = fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
-          frame_fec_latency_logger.second_point_now_and_log();
-
-          auto peer_address = session->video.peer.address();
-          auto batch_info = platf::batched_send_info_t {
-            shards.headers.begin(),
-            shards.prefixsize,
-            shards.payload_buffers,
-            shards.blocksize,
-            0,
-            0,
-            (uintptr_t) sock.native_handle(),
-            peer_address,
-            session->video.peer.port(),
-            session->localAddress,
-          };
-
-          size_t next_shard_to_send = 0;
-
-          // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
-          // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
-          bool frame_is_dupe = false;
-          if (!packet->frame_timestamp) {
-            packet->frame_timestamp = ratecontrol_next_frame_start;
-            frame_is_dupe = true;
-          }
-          using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
-          uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
-
-          // set FEC info now that we know for sure what our percentage will be for this frame
-          for (auto x = 0; x < shards.size(); ++x) {
-            auto *inspect = (video_packet_raw_t *) shards.data(x);
-
-            inspect->packet.fecInfo =
-              (x << 12 |
-               shards.data_shards << 22 |
-               shards.percentage << 4);
-
-            inspect->rtp.header = 0x80 | FLAG_EXTENSION;
-            inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
-            inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
-
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-            inspect->packet.frameIndex = packet->frame_index();
-
-            // Encrypt this shard if video encryption is enabled
-            if (session->video.cipher) {
-              // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-              // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
-              // high bytes is the "fixed" field. Because each client provides their own unique
-              // key, our values in the fixed field need only uniquely identify each independent
-              // use of the client's key with AES-GCM in our code.
-              //
-              // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
-              // to be sent to each client before the IV repeats.
-              std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), std::begin(iv));
-              iv[11] = 'V';  // Video stream
-              session->video.gcm_iv_counter++;
-
-              // Encrypt the target buffer in place
-              auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
-              prefix->frameNumber = packet->frame_index();
-              std::copy(std::begin(iv), std::end(iv), prefix->iv);
-              session->video.cipher->encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv);
-            }
+        for (auto &data : taken->data) {
+          payload_segments.emplace_back(data);
+          partial_pending_size += data.size();
+        }
+        partial_slices = taken->slices;
+        partial_complete = taken->complete;
 
-            if (x - next_shard_to_send + 1 >= send_batch_size ||
-                x + 1 == shards.size()) {
-              // Do pacing within the frame.
-              // Also trigger pacing before the first send_batch() of the frame
-              // to account for the last send_batch() of the previous frame.
-              if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
-                  ratecontrol_frame_packets_sent == 0) {
-                auto due = ratecontrol_frame_start +
-                           std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                             ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+        if (partial_complete) {
+          auto packets = std::max<std::size_t>(remaining_blocks, (partial_pending_size + (payload_blocksize - 1)) / payload_blocksize);
 
-                auto now = std::chrono::steady_clock::now();
-                if (now < due) {
-                  timer->sleep_for(due - now);
-                }
+          auto padding = packets * payload_blocksize - partial_pending_size;
+          if (padding > 0) {
+            auto zeros = arena.alloc<char>(padding);
+            std::fill(std::begin(zeros), std::end(zeros), 0);
 
-                ratecontrol_group_packets_sent = 0;
-              }
+            payload_segments.emplace_back(zeros.data(), zeros.size());
+            partial_pending_size += padding;
+          }
+        } else if (remaining_blocks > 1 && partial_pending_size >= payload_blocksize) {
+          break;
+        }
+      }
 
-              size_t current_batch_size = x - next_shard_to_send + 1;
-              batch_info.block_offset = next_shard_to_send;
-              batch_info.block_count = current_batch_size;
-
-              frame_send_batch_latency_logger.first_point_now();
-              // Use a batched send if it's supported on this platform
-              if (!platf::send_batch(batch_info)) {
-                // Batched send is not available, so send each packet individually
-                BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
-                for (auto y = 0; y < current_batch_size; y++) {
-                  auto send_info = platf::send_info_t {
-                    shards.prefix(next_shard_to_send + y),
-                    shards.prefixsize,
-                    shards.data(next_shard_to_send + y),
-                    shards.blocksize,
-                    (uintptr_t) sock.native_handle(),
-                    peer_address,
-                    session->video.peer.port(),
-                    session->localAddress,
-                  };
-
-                  platf::send(send_info);
+      auto block_packets = partial_complete ? partial_pending_size / payload_blocksize / remaining_blocks : partial_pending_size / payload_blocksize;
+
+      // Move the packets of the block out of the pending segments
+      std::vector<std::string_view, util::arena_allocator_t<std::string_view>> block_segments {arena_alloc};
+      auto block_size = block_packets * payload_blocksize;
+      partial_pending_size -= block_size;
+      while (block_size > 0) {
+        auto &segment = payload_segments.front();
+        if (segment.size() > block_size) {
+          block_segments.emplace_back(segment.substr(0, block_size));
+          segment.remove_prefix(block_size);
+          break;
+        }
+
+        block_segments.emplace_back(segment);
+        block_size -= segment.size();
+        payload_segments.erase(std::begin(payload_segments));
+      }
+
+      // The arena keeps the block alive until the next frame
+      auto block = concat_and_insert(shard_alloc, sizeof(video_packet_raw_t), payload_blocksize, block_segments);
+      fec_blocks[blockIndex] = std::string_view {(char *) block.data(), block.size()};
+
+      if ((int) block_packets > max_data_shards_per_fec_block) {
+        BOOST_LOG(warning) << "Skipping FEC for abnormally large block of a partial frame ("sv << block_packets << " packets)"sv;
+        fec_block_percentages[blockIndex] = 0;
+      }
+
+      return true;
+    };
+
+    // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
+    // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
+    bool frame_is_dupe = false;
+    if (!packet->frame_timestamp) {
+      packet->frame_timestamp = ratecontrol_next_frame_start;
+      frame_is_dupe = true;
+    }
+    using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
+    uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
+
+    // Stamps the packet headers of a FEC block, generates its parity shards and encrypts them.
+    // Blocks are always prepared one at a time and in order, so sequence numbers and IVs
+    // are identical whether or not this runs on the FEC worker pool.
+    auto prepare_block = [&](std::string_view current_payload, int blockIndex, int block_lowseq, int percentage) {
+      auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
+
+      for (int x = 0; x < packets; ++x) {
+        auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
+
+        inspect->packet.frameIndex = packet->frame_index();
+        inspect->packet.streamPacketIndex = ((uint32_t) block_lowseq + x) << 8;
+
+        // Match multiFecFlags with Moonlight
+        inspect->packet.multiFecFlags = 0x10;
+        inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+
+        inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
+        if (x == 0) {
+          inspect->packet.flags |= FLAG_SOF;
+        }
+        if (x == packets - 1) {
+          inspect->packet.flags |= FLAG_EOF;
+        }
+      }
+
+      auto fec_start = std::chrono::steady_clock::now();
+      frame_fec_latency_logger.first_point_now();
+      // If video encryption is enabled, we allocate space for the encryption header before each shard
+      auto shards = [&]() {
+        TRACE_FRAME_SCOPE("video: fec", session, packet->frame_index());
+        return fec::encode(arena, current_payload, blocksize, percentage, session->config.minRequiredFecPackets, session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
+      }();
+      frame_fec_latency_logger.second_point_now_and_log();
+
+      // set FEC info now that we know for sure what our percentage will be for this frame
+      for (auto x = 0; x < shards.size(); ++x) {
+        auto *inspect = (video_packet_raw_t *) shards.data(x);
+
+        inspect->packet.fecInfo =
+          (x << 12 |
+           shards.data_shards << 22 |
+           shards.percentage << 4);
+
+        inspect->rtp.header = 0x80 | FLAG_EXTENSION;
+        inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(block_lowseq + x);
+        inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
+
+        inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+        inspect->packet.frameIndex = packet->frame_index();
+      }
+
+      // Encrypt the whole block in place if video encryption is enabled
+      if (session->video.cipher) {
+        TRACE_FRAME_SCOPE("video: encrypt", session, packet->frame_index());
+
+        for (auto x = 0; x < shards.size(); ++x) {
+          // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+          // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
+          // high bytes is the "fixed" field. Because each client provides their own unique
+          // key, our values in the fixed field need only uniquely identify each independent
+          // use of the client's key with AES-GCM in our code.
+          //
+          // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
+          // to be sent to each client before the IV repeats.
+          std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), std::begin(iv));
+          iv[11] = 'V';  // Video stream
+          session->video.gcm_iv_counter++;
+
+          // Encrypt the target buffer in place
+          auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
+          prefix->frameNumber = packet->frame_index();
+          std::copy(std::begin(iv), std::end(iv), prefix->iv);
+
+          // Sending the block unencrypted would leak the frame, so the rest of it is dropped
+          auto *shard = (uint8_t *) shards.data(x);
+          if (session->video.cipher->encrypt(std::string_view {(char *) shard, (size_t) blocksize}, prefix->tag, shard, &iv) < 0) {
+            throw std::runtime_error("Unable to encrypt frame "s + std::to_string(packet->frame_index()));
+          }
+        }
+      }
+
+      auto fec_time = std::chrono::steady_clock::now() - fec_start;
+      session_metrics.fec.record(fec_time);
+      session_metrics.fec_percentage = shards.percentage;
+      flight_recorder::record(flight_recorder::event_e::fec, session, packet->frame_index(), fec_time.count(), blockIndex);
+
+      return shards;
+    };
+
+    // The next FEC block, when it's being prepared on the FEC worker pool
+    std::future<fec::fec_t> next_shards;
+
+    // The pending block references the payload, so it must finish before the payload goes away
+    auto fg = util::fail_guard([&next_shards]() {
+      if (next_shards.valid()) {
+        next_shards.wait();
+      }
+    });
+
+    try {
+      // Use around 80% of 1Gbps          1Gbps            percent    ms     packet      byte
+      size_t ratecontrol_packets_in_1ms = std::giga::num * 80 / 100 / 1000 / blocksize / 8;
+      if (network_estimator) {
+        //                                                      Mbps                     ms     packet      byte
+        ratecontrol_packets_in_1ms = std::max<size_t>(1, (size_t) network_estimator->pacing_rate() * std::mega::num / 1000 / blocksize / 8);
+      }
+
+      // Spread the frame over part of the frame interval instead of sending it in a burst at the pacing rate,
+      // which overflows the shallow buffers of Wi-Fi access points. The size of a partial frame isn't known yet.
+      auto spread = packet->is_idr() ? runtime.pacing_spread_idr : runtime.pacing_spread;
+      auto framerate = session->config.monitor.framerate;
+      bool spread_frame = spread > 0 && !partial && framerate > 0;
+      if (spread_frame) {
+        auto data_packets = payload.size() / blocksize;
+        auto frame_packets = data_packets + (data_packets * fecPercentage + 99) / 100;
+
+        //                      percent    ms          us
+        auto spread_us = (size_t) spread * 1000 * 1000 / 100 / framerate;
+        auto spread_packets_in_1ms = (frame_packets * 1000 + spread_us - 1) / spread_us;
+        ratecontrol_packets_in_1ms = std::clamp<size_t>(spread_packets_in_1ms, 1, ratecontrol_packets_in_1ms);
+      }
+
+      // Send less than 64K in a single batch.
+      // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
+      // appear in "Other I/O" and begin waiting for interrupts.
+      // This gives inconsistent performance so we'd rather avoid it.
+      size_t send_batch_size = 64 * 1024 / blocksize;
+      // Also don't exceed 64 packets, which can happen when Moonlight requests
+      // unusually small packet size.
+      // Generic Segmentation Offload on Linux can't do more than 64.
+      send_batch_size = std::min<size_t>(64, send_batch_size);
+      // A batch leaves the host in a single burst, so it shouldn't hold more than the pacing rate allows in 1ms
+      if (network_estimator || spread_frame) {
+        send_batch_size = std::min(send_batch_size, ratecontrol_packets_in_1ms);
+      }
+
+      // Don't ignore the last ratecontrol group of the previous frame
+      auto ratecontrol_frame_start = std::max(ratecontrol_next_frame_start, std::chrono::steady_clock::now());
+
+      size_t ratecontrol_frame_packets_sent = 0;
+      size_t ratecontrol_group_packets_sent = 0;
+      size_t frame_bytes_sent = 0;
+
+      // Transmit time of the current ratecontrol group when the kernel does the pacing
+      std::optional<std::chrono::steady_clock::time_point> ratecontrol_group_txtime;
+
+      for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+        // The client recovers from the part of the frame it got like from any lost frame
+        if (partial && !fill_partial_block(blockIndex)) {
+          BOOST_LOG(warning) << "Encoder didn't finish frame "sv << packet->frame_index() << " after "sv << blockIndex << " FEC block(s) were sent"sv;
+          break;
+        }
+
+        auto shards = next_shards.valid() ? next_shards.get() : prepare_block(fec_blocks[blockIndex], blockIndex, lowseq, fec_block_percentages[blockIndex]);
+        lowseq += shards.size();
+
+        // Prepare the next block while this one goes out on the wire, unless it isn't encoded yet
+        if (sender.fec_pool && !partial && blockIndex + 1 < fec_blocks_needed) {
+          next_shards = sender.fec_pool->push(prepare_block, fec_blocks[blockIndex + 1], blockIndex + 1, lowseq, fec_block_percentages[blockIndex + 1]);
+        }
+
+        auto peer_address = session->video.peer.address();
+        auto batch_info = platf::batched_send_info_t {
+          shards.headers.data(),
+          shards.prefixsize,
+          shards.payload_buffers,
+          shards.blocksize,
+          0,
+          0,
+          (uintptr_t) video_sock.native_handle(),
+          peer_address,
+          session->video.peer.port(),
+          source_address(*session),
+        };
+        batch_info.connected = connected;
+
+        size_t next_shard_to_send = 0;
+
+        for (auto x = 0; x < shards.size(); ++x) {
+          if (x - next_shard_to_send + 1 >= send_batch_size ||
+              x + 1 == shards.size()) {
+            // Do pacing within the frame.
+            // Also trigger pacing before the first send_batch() of the frame
+            // to account for the last send_batch() of the previous frame.
+            std::chrono::nanoseconds pace_time {};
+            if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
+                ratecontrol_frame_packets_sent == 0) {
+              auto due = ratecontrol_frame_start +
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                           ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+
+              if (sender.txtime) {
+                // Let the kernel hold the batches of this group until they're due
+                ratecontrol_group_txtime = due;
+              } else {
+                auto now = std::chrono::steady_clock::now();
+                if (now < due) {
+                  TRACE_FRAME_SCOPE("video: pace", session, packet->frame_index());
+                  timer->sleep_for(due - now);
+                  pace_time = std::chrono::steady_clock::now() - now;
                 }
               }
-              frame_send_batch_latency_logger.second_point_now_and_log();
 
-              ratecontrol_group_packets_sent += current_batch_size;
-              ratecontrol_frame_packets_sent += current_batch_size;
-              next_shard_to_send = x + 1;
+              ratecontrol_group_packets_sent = 0;
+            }
+
+            size_t current_batch_size = x - next_shard_to_send + 1;
+            batch_info.block_offset = next_shard_to_send;
+            batch_info.block_count = current_batch_size;
+            batch_info.txtime = ratecontrol_group_txtime;
+            batch_info.zerocopy = sender.zerocopy ? &session->video.zerocopy_ticket : nullptr;
+
+            TRACE_FRAME_SCOPE("video: send batch", session, packet->frame_index());
+            auto send_start = std::chrono::steady_clock::now();
+            frame_send_batch_latency_logger.first_point_now();
+            // Use a batched send if it's supported on this platform
+            if (!platf::send_batch(batch_info)) {
+              // Batched send is not available, so send each packet individually
+              BOOST_LOG_HOT(verbose) << "Falling back to unbatched send"sv;
+              for (auto y = 0; y < current_batch_size; y++) {
+                auto send_info = platf::send_info_t {
+                  shards.prefix(next_shard_to_send + y),
+                  shards.prefixsize,
+                  shards.data(next_shard_to_send + y),
+                  shards.blocksize,
+                  (uintptr_t) video_sock.native_handle(),
+                  peer_address,
+                  session->video.peer.port(),
+                  source_address(*session),
+                  connected,
+                };
+
+                platf::send(send_info);
+              }
+            }
+            frame_send_batch_latency_logger.second_point_now_and_log();
+            session_metrics.send.record(std::chrono::steady_clock::now() - send_start);
+            flight_recorder::record(flight_recorder::event_e::send_batch, session, packet->frame_index(), (std::int64_t) current_batch_size, pace_time.count());
+            if (network_estimator) {
+              network_estimator->batch_sent(current_batch_size * (shards.prefixsize + shards.blocksize), std::chrono::steady_clock::now() - send_start);
             }
+            if (packet->frame_timestamp) {
+              session_metrics.frame_on_wire(*packet->frame_timestamp);
+            }
+
+            frame_bytes_sent += current_batch_size * (shards.prefixsize + shards.blocksize);
+            ratecontrol_group_packets_sent += current_batch_size;
+            ratecontrol_frame_packets_sent += current_batch_size;
+            next_shard_to_send = x + 1;
           }
+        }
 
-          // remember this in case the next frame comes immediately
-          ratecontrol_next_frame_start = ratecontrol_frame_start +
-                                         std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                                           ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+        // remember this in case the next frame comes immediately
+        ratecontrol_next_frame_start = ratecontrol_frame_start +
+                                       std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                                         ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
 
-          frame_network_latency_logger.second_point_now_and_log();
+        frame_network_latency_logger.second_point_now_and_log();
 
-          BOOST_LOG(verbose) << "Sent Frame seq ["sv << packet->frame_index() << "] pts ["sv << timestamp
-                             << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
-                             << (frame_is_dupe ? " Dupe" : "")
-                             << (packet->is_idr() ? " Key" : "")
-                             << (packet->after_ref_frame_invalidation ? " RFI" : "");
+        BOOST_LOG_HOT(verbose) << "Sent Frame seq ["sv << packet->frame_index() << "] pts ["sv << timestamp
+                           << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
+                           << (frame_is_dupe ? " Dupe" : "")
+                           << (packet->is_idr() ? " Key" : "")
+                           << (packet->after_ref_frame_invalidation ? " RFI" : "")
+                           << (packet->intra_refresh ? " IR" : "");
+      }
 
-          ++blockIndex;
-          lowseq += shards.size();
-        });
+      session->video.lowseq = lowseq;
 
-        session->video.lowseq = lowseq;
-      } catch (const std::exception &e) {
-        BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
-        std::this_thread::sleep_for(100ms);
+      session_metrics.frame_sent(frame_bytes_sent);
+      session_metrics.frame.record(std::chrono::steady_clock::now() - frame_start);
+
+      if (bitrate_controller) {
+        if (auto bitrate = bitrate_controller->frame_sent(ratecontrol_frame_packets_sent, queue_delay)) {
+          BOOST_LOG(info) << "Adapting video bitrate to "sv << *bitrate << " Kbps"sv;
+          session->video.bitrate_events->raise(*bitrate);
+          session->admission.set_bitrate(*bitrate);
+        }
+
+        session->video.stable_bitrate.sample(bitrate_controller->bitrate(), bitrate_controller->loss());
+      }
+
+      if (session->audio.loss_monitor) {
+        session->audio.loss_monitor->packets_sent(ratecontrol_frame_packets_sent);
       }
+
+      if (network_estimator && network_estimator->frame_sent(ratecontrol_frame_packets_sent, frame_bytes_sent)) {
+        auto estimates = network_estimator->estimates();
+        session_metrics.rtt_ms = estimates.rtt ? estimates.rtt->count() : 0;
+        session_metrics.jitter_ms = estimates.jitter ? estimates.jitter->count() : 0;
+        session_metrics.pacing_rate_mbps = estimates.pacing_rate_mbps;
+
+        BOOST_LOG(debug) << "Pacing video at "sv << estimates.pacing_rate_mbps << " Mbps, RTT "sv << session_metrics.rtt_ms << "ms, jitter "sv
+                         << session_metrics.jitter_ms << "ms, loss "sv << estimates.loss * 100 << '%'
+                         << (estimates.drain_rate_mbps ? ", socket drains at "s + std::to_string(estimates.drain_rate_mbps) + " Mbps"s : ""s);
+      }
+    } catch (const std::exception &e) {
+      BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
+      std::this_thread::sleep_for(100ms);
+    }
+  }
+
+  /**
+   * @brief Send the frames of every session assigned to a video shard.
+   * @param shard The shard to service.
+   * @param ctx The broadcast context owning the shard.
+   */
+  void videoShardThread(video_shard_t *shard, broadcast_ctx_t &ctx) {
+    // Video traffic of the sessions assigned to this shard is sent on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin_current_thread("video send"sv);
+
+    video_sender_t sender {ctx};
+    if (!sender.timer || !*sender.timer) {
+      BOOST_LOG(error) << "Failed to create timer, aborting video shard thread";
+      return;
+    }
+
+    while (auto packet = shard->packets.pop()) {
+      ((session_t *) packet->channel_data)->metrics->queue_depth = shard->packets.size();
+      send_video_packet(sender, ctx.video_sock, packet);
+    }
+  }
+
+  void videoBroadcastThread(broadcast_ctx_t &ctx) {
+    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
+
+    // A frame is useless without the ones before it up to a recovery point, so the frames of a session are
+    // dropped until its encoder sends one. Non-reference frames are dropped alone, since no frame after them misses them.
+    packets->overflow(safe::overflow_e::drop_to_keyframe, is_keyframe, is_droppable, cutting<0>, request_recovery);
+    packets->count_drops_in(&metrics::queues().video_packets_dropped);
+
+    // Without shards, all video traffic is sent on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin_current_thread("video send"sv);
+
+    video_sender_t sender {ctx};
+    if (!sender.timer || !*sender.timer) {
+      BOOST_LOG(error) << "Failed to create timer, aborting video broadcast thread";
+      return;
+    }
+
+    while (auto packet = packets->pop()) {
+      if (shutdown_event->peek()) {
+        break;
+      }
+
+      flight_recorder::record(flight_recorder::event_e::queue_depth, packet->channel_data, packet->frame_index(), (std::int64_t) packets->size());
+
+      if (ctx.video_shards.empty()) {
+        ((session_t *) packet->channel_data)->metrics->queue_depth = packets->size();
+        send_video_packet(sender, ctx.video_sock, packet);
+        continue;
+      }
+
+      // Hand the frame off to the shard owning the session, so a session with
+      // large frames can't delay the frames of sessions served by other shards
+      auto session = (session_t *) packet->channel_data;
+      ctx.video_shards[session->video.shard]->packets.raise(std::move(packet));
     }
 
     shutdown_event->raise(true);
@@ -1651,6 +3002,7 @@ namespace stream {
   void audioBroadcastThread(udp::socket &sock) {
     auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
     auto packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
+    packets->count_drops_in(&metrics::queues().audio_packets_dropped);
 
     audio_packet_t audio_packet;
     fec::rs_t rs {reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS)};
@@ -1670,15 +3022,42 @@ namespace stream {
 
     // Audio traffic is sent on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin_current_thread("audio send"sv);
+
+    // Everything queued is sent with a single call, so the packets of concurrent sessions
+    // and the FEC shards ending a block share a syscall. Each packet needs its own header,
+    // and the storage is reserved up front since the send infos point into it.
+    constexpr std::size_t max_batch_packets = 32;
+
+    std::vector<audio_packet_t> headers;
+    std::vector<audio_fec_packet_t> fec_headers;
+    std::vector<asio::ip::address> peer_addresses;
+    std::vector<platf::send_info_t> send_infos;
+    std::vector<std::pair<session_t *, std::chrono::steady_clock::time_point>> batched_sessions;
+
+    headers.reserve(max_batch_packets);
+    fec_headers.reserve(RTPA_FEC_SHARDS);
+    peer_addresses.reserve(max_batch_packets);
+    send_infos.reserve(max_batch_packets + RTPA_FEC_SHARDS);
+    batched_sessions.reserve(max_batch_packets);
+
+    auto clear_batch = [&]() {
+      send_infos.clear();
+      headers.clear();
+      fec_headers.clear();
+      peer_addresses.clear();
+      batched_sessions.clear();
+    };
 
-    while (auto packet = packets->pop()) {
-      if (shutdown_event->peek()) {
-        break;
-      }
-
-      TUPLE_2D_REF(channel_data, packet_data, *packet);
+    // Returns -1 on error, 1 if the packet ended a FEC block and 0 otherwise
+    auto batch_packet = [&](audio::packet_t &packet) -> int {
+      TUPLE_3D_REF(channel_data, packet_data, captured, packet);
       auto session = (session_t *) channel_data;
 
+      if (session->recording) {
+        session->recording->audio(packet_data.begin(), packet_data.size(), captured);
+      }
+
       auto sequenceNumber = session->audio.sequenceNumber;
       auto timestamp = session->audio.timestamp;
 
@@ -1689,64 +3068,105 @@ namespace stream {
       auto bytes = encode_audio(session->config.encryptionFlagsEnabled & SS_ENC_AUDIO, packet_data, shards_p[sequenceNumber % RTPA_DATA_SHARDS], iv, session->audio.cipher);
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio packet"sv;
-        break;
+        return -1;
       }
 
-      BOOST_LOG(verbose) << "Audio [seq "sv << sequenceNumber << ", pts "sv << timestamp << "] ::  send..."sv;
+      BOOST_LOG_HOT(verbose) << "Audio [seq "sv << sequenceNumber << ", pts "sv << timestamp << "] ::  send..."sv;
 
-      audio_packet.rtp.sequenceNumber = util::endian::big(sequenceNumber);
-      audio_packet.rtp.timestamp = util::endian::big(timestamp);
+      auto &audio_sock = session->audio.sock ? *session->audio.sock : sock;
+      bool connected = (bool) session->audio.sock;
+
+      auto &header = headers.emplace_back(audio_packet);
+      header.rtp.sequenceNumber = util::endian::big(sequenceNumber);
+      header.rtp.timestamp = util::endian::big(timestamp);
 
       session->audio.sequenceNumber++;
       session->audio.timestamp += session->config.audio.packetDuration;
 
-      auto peer_address = session->audio.peer.address();
-      try {
-        auto send_info = platf::send_info_t {
-          (const char *) &audio_packet,
-          sizeof(audio_packet),
-          (const char *) shards_p[sequenceNumber % RTPA_DATA_SHARDS],
+      auto &peer_address = peer_addresses.emplace_back(session->audio.peer.address());
+      send_infos.push_back(platf::send_info_t {
+        (const char *) &header,
+        sizeof(header),
+        (const char *) shards_p[sequenceNumber % RTPA_DATA_SHARDS],
+        (size_t) bytes,
+        (uintptr_t) audio_sock.native_handle(),
+        peer_address,
+        session->audio.peer.port(),
+        source_address(*session),
+        connected,
+      });
+      batched_sessions.emplace_back(session, captured);
+
+      auto &fec_packet = session->audio.fec_packet;
+      // initialize the FEC header at the beginning of the FEC block
+      if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
+        fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
+        fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+      }
+
+      if ((sequenceNumber + 1) % RTPA_DATA_SHARDS != 0) {
+        return 0;
+      }
+
+      // generate parity shards at the end of the FEC block
+      reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
+
+      for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+        auto &fec_header = fec_headers.emplace_back(fec_packet);
+        fec_header.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
+        fec_header.fecHeader.fecShardIndex = x;
+
+        send_infos.push_back(platf::send_info_t {
+          (const char *) &fec_header,
+          sizeof(fec_header),
+          (const char *) shards_p[RTPA_DATA_SHARDS + x],
           (size_t) bytes,
-          (uintptr_t) sock.native_handle(),
+          (uintptr_t) audio_sock.native_handle(),
           peer_address,
           session->audio.peer.port(),
-          session->localAddress,
-        };
-        platf::send(send_info);
+          source_address(*session),
+          connected,
+        });
+        BOOST_LOG_HOT(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+      }
 
-        auto &fec_packet = session->audio.fec_packet;
-        // initialize the FEC header at the beginning of the FEC block
-        if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
-          fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
-          fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+      return 1;
+    };
+
+    while (auto packet = packets->pop()) {
+      if (shutdown_event->peek()) {
+        break;
+      }
+
+      TRACE_SCOPE("audio: send batch");
+
+      int status = 0;
+      try {
+        // A batch ends with the first FEC block that ends, as the next packet of its session reuses the shards
+        while ((status = batch_packet(*packet)) == 0 && headers.size() < max_batch_packets && packets->peek()) {
+          packet = packets->pop();
+          if (!packet) {
+            break;
+          }
         }
 
-        // generate parity shards at the end of the FEC block
-        if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
-          reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
-
-          for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
-            fec_packet.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
-            fec_packet.fecHeader.fecShardIndex = x;
-
-            auto send_info = platf::send_info_t {
-              (const char *) &fec_packet,
-              sizeof(fec_packet),
-              (const char *) shards_p[RTPA_DATA_SHARDS + x],
-              (size_t) bytes,
-              (uintptr_t) sock.native_handle(),
-              peer_address,
-              session->audio.peer.port(),
-              session->localAddress,
-            };
-            platf::send(send_info);
-            BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+        if (!send_infos.empty()) {
+          platf::send_many(send_infos);
+
+          auto now = std::chrono::steady_clock::now();
+          for (auto &[session, captured] : batched_sessions) {
+            session->metrics->audio_capture_to_send.record(now - captured);
           }
         }
       } catch (const std::exception &e) {
         BOOST_LOG(error) << "Broadcast audio failed "sv << e.what();
         std::this_thread::sleep_for(100ms);
       }
+
+      clear_batch();
+      if (status < 0) {
+        break;
+      }
     }
 
     shutdown_event->raise(true);
@@ -1766,7 +3186,19 @@ namespace stream {
     }
 
     boost::system::error_code ec;
-    ctx.video_sock.open(protocol, ec);
+    if (config::stream.registered_io) {
+      std::uintptr_t native_socket;
+      ctx.video_registered_io = platf::open_socket_registered_io(protocol == udp::v6(), native_socket);
+      if (ctx.video_registered_io) {
+        ctx.video_sock.assign(protocol, native_socket, ec);
+      } else {
+        BOOST_LOG(warning) << "Registered I/O isn't available, falling back to regular sends"sv;
+      }
+    }
+
+    if (!ctx.video_sock.is_open() && !ec) {
+      ctx.video_sock.open(protocol, ec);
+    }
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't open socket for Video server: "sv << ec.message();
 
@@ -1780,6 +3212,9 @@ namespace stream {
       BOOST_LOG(error) << "Failed to set video socket send buffer size (SO_SENDBUF)";
     }
 
+    // The ports can only be shared if the first socket bound to them allows it
+    ctx.session_sockets = config::stream.session_sockets && platf::enable_socket_reuseport(ctx.video_sock.native_handle());
+
     ctx.video_sock.bind(udp::endpoint(protocol, video_port), ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't bind Video server to port ["sv << video_port << "]: "sv << ec.message();
@@ -1787,6 +3222,24 @@ namespace stream {
       return -1;
     }
 
+    if (!config::stream.xdp_interface.empty()) {
+      ctx.video_xdp = platf::enable_socket_xdp(ctx.video_sock.native_handle(), config::stream.xdp_interface);
+      if (!ctx.video_xdp) {
+        BOOST_LOG(warning) << "AF_XDP isn't available on ["sv << config::stream.xdp_interface << "], falling back to regular sends"sv;
+      }
+    }
+
+    // Packets sent through AF_XDP skip the qdisc that would hold them until their transmit time
+    ctx.video_txtime = config::stream.kernel_pacing && !ctx.video_xdp && platf::enable_socket_txtime(ctx.video_sock.native_handle());
+    if (config::stream.kernel_pacing && !ctx.video_txtime) {
+      BOOST_LOG(warning) << "Kernel pacing isn't available, falling back to pacing with timers"sv;
+    }
+
+    ctx.video_zerocopy = config::stream.video_zerocopy && platf::enable_socket_zerocopy(ctx.video_sock.native_handle());
+    if (config::stream.video_zerocopy && !ctx.video_zerocopy) {
+      BOOST_LOG(warning) << "Zero-copy video sends aren't available, falling back to regular sends"sv;
+    }
+
     ctx.audio_sock.open(protocol, ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't open socket for Audio server: "sv << ec.message();
@@ -1794,6 +3247,11 @@ namespace stream {
       return -1;
     }
 
+    ctx.session_sockets = ctx.session_sockets && platf::enable_socket_reuseport(ctx.audio_sock.native_handle());
+    if (config::stream.session_sockets && !ctx.session_sockets) {
+      BOOST_LOG(warning) << "Per-session sockets aren't available, all sessions send from the same sockets"sv;
+    }
+
     ctx.audio_sock.bind(udp::endpoint(protocol, audio_port), ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't bind Audio server to port ["sv << audio_port << "]: "sv << ec.message();
@@ -1803,7 +3261,30 @@ namespace stream {
 
     ctx.message_queue_queue = std::make_shared<message_queue_queue_t::element_type>(30);
 
-    ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock)};
+    ctx.video_epoch = std::chrono::steady_clock::now();
+
+    if (config::stream.fec_worker_threads > 0) {
+      ctx.video_fec_pool = std::make_unique<thread_pool_util::ThreadPool>(config::stream.fec_worker_threads);
+    }
+
+    auto video_send_threads = config::stream.video_send_threads;
+    if (video_send_threads == 0) {
+      // Leave most of the cores to capture and encoding
+      video_send_threads = std::clamp<int>(std::thread::hardware_concurrency() / 4, 1, 4);
+    }
+
+    if (video_send_threads > 1) {
+      BOOST_LOG(info) << "Sending video on "sv << video_send_threads << " threads"sv;
+
+      for (int x = 0; x < video_send_threads; ++x) {
+        auto &shard = ctx.video_shards.emplace_back(std::make_unique<video_shard_t>());
+        shard->packets.overflow(safe::overflow_e::drop_to_keyframe, is_keyframe, is_droppable, cutting<1>, request_recovery);
+        shard->packets.count_drops_in(&metrics::queues().video_packets_dropped);
+        shard->thread = std::thread {videoShardThread, shard.get(), std::ref(ctx)};
+      }
+    }
+
+    ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx)};
     ctx.audio_thread = std::thread {audioBroadcastThread, std::ref(ctx.audio_sock)};
     ctx.control_thread = std::thread {controlBroadcastThread, &ctx.control_server};
 
@@ -1816,6 +3297,7 @@ namespace stream {
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
 
     broadcast_shutdown_event->raise(true);
+    ctx.control_server.wake();
 
     auto video_packets = mail::man->queue<video::packet_t>(mail::video_packets);
     auto audio_packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
@@ -1823,6 +3305,9 @@ namespace stream {
     // Minimize delay stopping video/audio threads
     video_packets->stop();
     audio_packets->stop();
+    for (auto &shard : ctx.video_shards) {
+      shard->packets.stop();
+    }
 
     ctx.message_queue_queue->stop();
     ctx.io_context.stop();
@@ -1837,6 +3322,13 @@ namespace stream {
     ctx.recv_thread.join();
     BOOST_LOG(debug) << "Waiting for main video thread to end..."sv;
     ctx.video_thread.join();
+    for (auto &shard : ctx.video_shards) {
+      shard->thread.join();
+    }
+    ctx.video_shards.clear();
+    ctx.video_fec_pool.reset();
+    ctx.video_registered_io.reset();
+    ctx.video_xdp.reset();
     BOOST_LOG(debug) << "Waiting for main audio thread to end..."sv;
     ctx.audio_thread.join();
     BOOST_LOG(debug) << "Waiting for main control thread to end..."sv;
@@ -1899,6 +3391,257 @@ namespace stream {
     return -1;
   }
 
+  /**
+   * @brief Start recording the frames sent to a session in the trace directory.
+   * @param session The session, whose video isn't being sent yet.
+   */
+  void start_video_trace(session_t &session) {
+    std::filesystem::path dir = config::stream.video_trace_dir;
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", std::localtime(&now));
+    auto file = dir / (std::string {timestamp} + '-' + std::to_string(session.launch_session_id) + ".svtr");
+
+    auto &monitor = session.config.monitor;
+    auto trace = std::make_unique<video::trace_writer_t>(file, video::trace_config_t {
+      monitor.width,
+      monitor.height,
+      monitor.framerate,
+      monitor.videoFormat,
+      monitor.dynamicRange,
+      monitor.chromaSamplingType,
+    });
+    if (!*trace) {
+      BOOST_LOG(error) << "Couldn't create the video trace "sv << file.string();
+      return;
+    }
+
+    BOOST_LOG(info) << "Recording the video of the session to "sv << file.string();
+    session.video.trace = std::move(trace);
+  }
+
+  void start_recording(session_t &session) {
+    std::filesystem::path dir = config::stream.recording_dir;
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", std::localtime(&now));
+    auto file = dir / (std::string {timestamp} + '-' + std::to_string(session.launch_session_id) + ".mkv");
+
+    auto &monitor = session.config.monitor;
+    auto &audio = session.config.audio;
+    auto stream = audio::stream_config(audio);
+
+    recording::config_t config {
+      monitor.videoFormat,
+      monitor.width,
+      monitor.height,
+      monitor.framerate,
+      stream.sampleRate,
+      stream.channelCount,
+      stream.streams,
+      stream.coupledStreams,
+      {},
+      audio.packetDuration,
+    };
+    std::copy_n(stream.mapping, std::min(stream.channelCount, 8), config.mapping);
+
+    auto recording = std::make_unique<recording::recorder_t>(file, config);
+    if (!*recording) {
+      BOOST_LOG(error) << "Couldn't create the recording "sv << file.string();
+      return;
+    }
+
+    BOOST_LOG(info) << "Recording the session to "sv << file.string();
+    session.recording = std::move(recording);
+  }
+
+  /**
+   * @brief Open a socket sending to a single peer from the port of a shared socket.
+   * @details The socket is bound to the local address of the session and connected to the peer, so its
+   *          packets aren't addressed one by one and fill a send buffer of their own. The kernel delivers
+   *          the pings of the peer to it from then on, which are no longer needed once it's streaming.
+   * @param shared The socket the peer pinged, which must allow sharing its port.
+   * @param local_address The address the peer reached the host at.
+   * @param peer The peer.
+   * @return The socket, or `nullptr` to keep sending from the shared socket.
+   */
+  std::unique_ptr<udp::socket> open_session_socket(udp::socket &shared, const asio::ip::address &local_address, const udp::endpoint &peer) {
+    boost::system::error_code ec;
+    auto local = shared.local_endpoint(ec);
+    if (ec) {
+      return nullptr;
+    }
+
+    // Dual-stack sockets see IPv4 peers as IPv4-mapped IPv6 addresses
+    auto address = net::normalize_address(local_address);
+    if (local.protocol() == udp::v6() && address.is_v4()) {
+      address = asio::ip::make_address_v6(asio::ip::v4_mapped, address.to_v4());
+    }
+
+    auto sock = std::make_unique<udp::socket>(shared.get_executor());
+    sock->open(local.protocol(), ec);
+    if (ec || !platf::enable_socket_reuseport(sock->native_handle())) {
+      BOOST_LOG(warning) << "Couldn't open a socket for ["sv << peer << "], sending from the shared socket: "sv << ec.message();
+      return nullptr;
+    }
+
+    udp::socket::send_buffer_size send_buffer_size;
+    shared.get_option(send_buffer_size, ec);
+    if (!ec) {
+      sock->set_option(send_buffer_size, ec);
+    }
+
+    // Only pings arrive here, so don't hold on to many of them
+    sock->set_option(udp::socket::receive_buffer_size(4096), ec);
+
+    sock->bind(udp::endpoint(address, local.port()), ec);
+    if (!ec) {
+      sock->connect(peer, ec);
+    }
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't connect a socket from ["sv << address << ':' << local.port() << "] to ["sv << peer << "], sending from the shared socket: "sv << ec.message();
+      return nullptr;
+    }
+
+    BOOST_LOG(debug) << "Sending from a socket connected to ["sv << peer << ']';
+    return sock;
+  }
+
+  /**
+   * @brief Log whether the video packets of a session fit the path to its client.
+   * @details Fragmented packets are lost whenever any of their fragments is. The client picks the packet
+   *          size and reassembles frames from packets of exactly that size, so it can't be raised by the host,
+   *          but the log tells when a larger one would fit, e.g. with jumbo frames.
+   * @param session The session, once the client pinged.
+   * @return The path MTU, or 0 if it's unknown.
+   */
+  int check_path_mtu(const session_t &session) {
+    auto address = net::normalize_address(session.video.peer.address());
+    auto mtu = platf::path_mtu(address);
+    if (mtu < 0) {
+      return 0;
+    }
+
+    // IP and UDP headers, then the headers of each video packet
+    int overhead = (address.is_v6() ? 40 : 20) + 8 + MAX_RTP_HEADER_SIZE + (session.video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
+    auto max_packetsize = mtu - overhead;
+
+    if (session.config.packetsize > max_packetsize) {
+      BOOST_LOG(warning) << "Video packets of "sv << session.config.packetsize << " bytes don't fit the path MTU of "sv << mtu
+                         << " bytes to ["sv << address << "], they'll be fragmented"sv;
+      return mtu;
+    }
+
+    BOOST_LOG(info) << "Path MTU to ["sv << address << "] is "sv << mtu << " bytes, fitting video packets of up to "sv << max_packetsize
+                    << " bytes, the client asked for "sv << session.config.packetsize;
+    return mtu;
+  }
+
+  /**
+   * @brief Start the video of a session at the bitrate and FEC the last session to its client settled on.
+   * @details A bitrate is only learned while the path held the stream below what the client asked for,
+   *          and only taken while adapting the bitrate, which climbs from it once the path keeps up.
+   * @param session The session.
+   * @return `true` if the session started from its profile.
+   */
+  bool start_from_network_profile(session_t &session) {
+    auto &profile = session.network_profile;
+    auto &controller = session.video.bitrate_controller;
+    if (!profile || !controller) {
+      return false;
+    }
+
+    auto &monitor = session.config.monitor;
+    auto bitrate = config::stream.adaptive_bitrate && profile->bitrate > 0 ? std::min(profile->bitrate, monitor.bitrate) : monitor.bitrate;
+    BOOST_LOG(info) << "Starting at "sv << bitrate << " Kbps with "sv << profile->loss * 100 << "% loss, where the last session to the client settled"sv;
+
+    monitor.bitrate = bitrate;
+    controller->start_from(bitrate, profile->loss);
+    return true;
+  }
+
+  /**
+   * @brief Remember what a session learned about the path to its client for its next session.
+   * @details Only called once the video of the session ended. What the session didn't learn is kept from before.
+   * @param session The session.
+   */
+  void store_network_profile(session_t &session) {
+    auto profile = session.network_profile.value_or(network_profile_t {});
+
+    if (auto stable = session.video.stable_bitrate.stable()) {
+      // A stream holding what the client asked for didn't find what the path carries
+      profile.bitrate = stable->bitrate < session.video.negotiated_bitrate ? stable->bitrate : 0;
+      profile.loss = stable->loss;
+    }
+
+    if (auto &estimator = session.video.network_estimator) {
+      auto estimates = estimator->estimates();
+      if (estimates.min_rtt) {
+        profile.rtt = *estimates.min_rtt;
+      }
+      profile.pacing_rate_mbps = estimates.pacing_rate_mbps;
+    }
+
+    if (session.video.path_mtu > 0) {
+      profile.mtu = session.video.path_mtu;
+    }
+
+    if (auto index = session.source_index.load(std::memory_order_acquire); index >= 0) {
+      profile.interface = session.source_addresses[index].name;
+    }
+
+    nvhttp::store_network_profile(session.device_uuid, profile);
+  }
+
+  // The probe takes about half a second once the client connected its control stream
+  constexpr auto bandwidth_probe_timeout = 1500ms;
+
+  /**
+   * @brief Start the video of a session at the bitrate and FEC its bandwidth probe found.
+   * @param session The session.
+   * @param result What the probe found, if it finished in time.
+   */
+  void start_from_bandwidth_probe(session_t &session, const std::optional<bandwidth_probe_t::result_t> &result) {
+    auto &monitor = session.config.monitor;
+    if (!result) {
+      if (!start_from_network_profile(session)) {
+        BOOST_LOG(info) << "Bandwidth probe didn't finish in time, starting at "sv << monitor.bitrate << " Kbps"sv;
+      }
+      return;
+    }
+
+    auto bitrate = result->bitrate(monitor.bitrate, session.video.runtime->fec_percentage);
+    if (result->capacity) {
+      BOOST_LOG(info) << "Bandwidth probe: the path carried "sv << *result->capacity << " Kbps with "sv << result->loss * 100 << "% loss and a round-trip time of "sv
+                      << result->rtt.count() << "ms, starting at "sv << bitrate << " Kbps instead of "sv << monitor.bitrate << " Kbps"sv;
+    } else {
+      BOOST_LOG(info) << "Bandwidth probe: the path kept up with "sv << result->loss * 100 << "% loss and a round-trip time of "sv << result->rtt.count()
+                      << "ms, starting at "sv << bitrate << " Kbps"sv;
+    }
+
+    auto &controller = session.video.bitrate_controller;
+    if (!config::stream.adaptive_bitrate && bitrate < monitor.bitrate) {
+      // Without adapting, the bitrate the stream starts at is the one it keeps
+      session.video.negotiated_bitrate = bitrate;
+      if (controller) {
+        controller->reconfigure(bitrate, session.video.runtime->fec_percentage);
+      }
+    }
+
+    monitor.bitrate = bitrate;
+    if (controller) {
+      controller->start_from(bitrate, result->loss);
+    }
+  }
+
   void videoThread(session_t *session) {
     auto fg = util::fail_guard([&]() {
       session::stop(*session);
@@ -1912,9 +3655,41 @@ namespace stream {
       return;
     }
 
+    if (ref->session_sockets) {
+      session->video.sock = open_session_socket(ref->video_sock, session->localAddress, session->video.peer);
+
+      // The video sending threads expect the same socket options from every socket they send from
+      if (session->video.sock &&
+          ((ref->video_txtime && !platf::enable_socket_txtime(session->video.sock->native_handle())) ||
+           (ref->video_zerocopy && !platf::enable_socket_zerocopy(session->video.sock->native_handle())))) {
+        session->video.sock.reset();
+      }
+    }
+    auto &video_sock = session->video.sock ? *session->video.sock : ref->video_sock;
+
     // Enable local prioritization and QoS tagging on video traffic if requested by the client
     auto address = session->video.peer.address();
-    session->video.qos = platf::enable_socket_qos(ref->video_sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
+    session->video.qos = platf::enable_socket_qos(video_sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
+
+    session->video.path_mtu = check_path_mtu(*session);
+
+    // What the probe finds is more current than what the last session to the client learned
+    if (auto &probe = session->video.bandwidth_probe) {
+      start_from_bandwidth_probe(*session, probe->wait(bandwidth_probe_timeout));
+    } else {
+      start_from_network_profile(*session);
+    }
+
+    if (!config::stream.video_trace_replay.empty()) {
+      video::replay_trace(session->mail, config::stream.video_trace_replay, config::stream.video_trace_replay_realtime, session->config.monitor, session);
+      return;
+    }
+
+    if (!config::stream.video_trace_dir.empty()) {
+      start_video_trace(*session);
+    }
+
+    session->config.monitor.packet_layout = video_packet_layout(session->config.packetsize);
 
     BOOST_LOG(debug) << "Start capturing Video"sv;
     video::capture(session->mail, session->config.monitor, session);
@@ -1933,9 +3708,14 @@ namespace stream {
       return;
     }
 
+    if (ref->session_sockets) {
+      session->audio.sock = open_session_socket(ref->audio_sock, session->localAddress, session->audio.peer);
+    }
+    auto &audio_sock = session->audio.sock ? *session->audio.sock : ref->audio_sock;
+
     // Enable local prioritization and QoS tagging on audio traffic if requested by the client
     auto address = session->audio.peer.address();
-    session->audio.qos = platf::enable_socket_qos(ref->audio_sock.native_handle(), address, session->audio.peer.port(), platf::qos_data_type_e::audio, session->config.audioQosType != 0);
+    session->audio.qos = platf::enable_socket_qos(audio_sock.native_handle(), address, session->audio.peer.port(), platf::qos_data_type_e::audio, session->config.audioQosType != 0);
 
     BOOST_LOG(debug) << "Start capturing Audio"sv;
     audio::capture(session->mail, session->config.audio, session);
@@ -1944,6 +3724,97 @@ namespace stream {
   namespace session {
     std::atomic_uint running_sessions;
 
+    // The sessions streaming proc::proc rather than an instance next to it
+    std::atomic_uint primary_sessions;
+
+    // Suspended sessions still count as running, and as streaming their app
+    std::mutex suspended_sessions_lock;
+    std::vector<std::shared_ptr<suspended_session_t>> suspended_sessions;
+
+    /**
+     * @brief Take a suspended session out of the list, so only one caller ends or resumes it.
+     * @param pred Picks the session.
+     * @return The session, or `nullptr` if none matched.
+     */
+    template<class Pred>
+    std::shared_ptr<suspended_session_t> take_suspended(Pred &&pred) {
+      std::lock_guard lg {suspended_sessions_lock};
+
+      auto it = std::find_if(std::begin(suspended_sessions), std::end(suspended_sessions), std::forward<Pred>(pred));
+      if (it == std::end(suspended_sessions)) {
+        return nullptr;
+      }
+
+      auto suspended = std::move(*it);
+      suspended_sessions.erase(it);
+      return suspended;
+    }
+
+    /**
+     * @brief Stop counting a session that ended for good: pause its app and revert the displays if it was the last one.
+     * @param app_instance The instance of proc::instances the session streamed, 0 for proc::proc.
+     */
+    void release(int app_instance) {
+      // The app of an instance pauses with its own last session, the displays are only configured for proc::proc
+      if (app_instance) {
+        proc::instances.session_ended(app_instance);
+      } else if (--primary_sessions == 0) {
+        bool revert_display_config {config::video.dd.config_revert_on_disconnect};
+        if (proc::proc.running()) {
+          proc::proc.pause();
+        } else {
+          // We have no app running and also no clients anymore.
+          revert_display_config = true;
+        }
+
+        if (revert_display_config) {
+          display_device::revert_configuration();
+        }
+      }
+
+      // If this is the last session, invoke the platform callbacks
+      if (--running_sessions == 0) {
+        platf::streaming_will_stop();
+      }
+    }
+
+    /**
+     * @brief Keep what a session that lost its client runs for a while, so the client can resume it.
+     * @param session The session, once its threads ended.
+     */
+    void suspend(session_t &session) {
+      auto suspended = std::make_shared<suspended_session_t>();
+      suspended->device_uuid = session.device_uuid;
+      suspended->app_instance = session.app_instance;
+      suspended->broadcast_ref = session.broadcast_ref;
+      suspended->capture = video::hold_capture(session.config.monitor);
+
+      {
+        std::lock_guard lg {suspended_sessions_lock};
+        suspended_sessions.push_back(suspended);
+      }
+
+      BOOST_LOG(info) << "Suspending the session of ["sv << session.device_name << "] for "sv << config::stream.suspend_timeout.count() << "ms"sv;
+
+      task_pool.pushDelayed([weak = std::weak_ptr {suspended}]() {
+        auto suspended = weak.lock();
+        if (suspended && take_suspended([&](const auto &candidate) {
+              return candidate == suspended;
+            })) {
+          BOOST_LOG(info) << "Suspended session wasn't resumed in time, ending it"sv;
+          release(suspended->app_instance);
+        }
+      }, config::stream.suspend_timeout);
+    }
+
+    void end_suspended() {
+      while (auto suspended = take_suspended([](const auto &) {
+               return true;
+             })) {
+        release(suspended->app_instance);
+      }
+    }
+
     state_e state(session_t &session) {
       return session.state.load(std::memory_order_relaxed);
     }
@@ -2039,8 +3910,13 @@ namespace stream {
 
       BOOST_LOG(debug) << "Waiting for video to end..."sv;
       session.videoThread.join();
+      store_network_profile(session);
       BOOST_LOG(debug) << "Waiting for audio to end..."sv;
       session.audioThread.join();
+
+      if (session.broadcast_ref && !session.broadcast_ref->video_shards.empty()) {
+        --session.broadcast_ref->video_shards[session.video.shard]->sessions;
+      }
       BOOST_LOG(debug) << "Waiting for control to end..."sv;
       session.controlEnd.view();
       // Reset input on session stop to avoid stuck repeated keys
@@ -2066,42 +3942,48 @@ namespace stream {
         exec_thread.detach();
       }
 
-      // If this is the last session, invoke the platform callbacks
-      if (--running_sessions == 0) {
-        bool revert_display_config {config::video.dd.config_revert_on_disconnect};
-        if (proc::proc.running()) {
-          proc::proc.pause();
-        } else {
-          // We have no app running and also no clients anymore.
-          revert_display_config = true;
-        }
-
-        if (revert_display_config) {
-          display_device::revert_configuration();
-        }
-
-        platf::streaming_will_stop();
+      // A client that only lost its connection may resume the session shortly
+      auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+      if (session.lost_client && config::stream.suspend_timeout > 0ms && !broadcast_shutdown_event->peek()) {
+        suspend(session);
+      } else {
+        release(session.app_instance);
       }
 
       BOOST_LOG(debug) << "Session ended"sv;
     }
 
     int start(session_t &session, const std::string &addr_string) {
-      session.input = input::alloc(session.mail);
+      session.input = input::alloc(session.mail, session.metrics);
 
       session.broadcast_ref = broadcast.ref();
       if (!session.broadcast_ref) {
         return -1;
       }
 
+      // Assign the session to the least loaded video shard
+      auto &video_shards = session.broadcast_ref->video_shards;
+      session.video.shard = 0;
+      for (int x = 1; x < (int) video_shards.size(); ++x) {
+        if (video_shards[x]->sessions < video_shards[session.video.shard]->sessions) {
+          session.video.shard = x;
+        }
+      }
+      if (!video_shards.empty()) {
+        ++video_shards[session.video.shard]->sessions;
+      }
+
       session.control.expected_peer_address = addr_string;
       BOOST_LOG(debug) << "Expecting incoming session connections from "sv << addr_string;
 
+      session.pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+
       // Insert this session into the session list
       {
         auto lg = session.broadcast_ref->control_server._sessions.lock();
         session.broadcast_ref->control_server._sessions->push_back(&session);
       }
+      session.broadcast_ref->control_server.watch(&session);
 
       auto addr = boost::asio::ip::make_address(addr_string);
       session.video.peer.address(addr);
@@ -2110,7 +3992,10 @@ namespace stream {
       session.audio.peer.address(addr);
       session.audio.peer.port(0);
 
-      session.pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+      // Both threads sending the session are fed from the start
+      if (!config::stream.recording_dir.empty()) {
+        start_recording(session);
+      }
 
       session.audioThread = std::thread {audioThread, &session};
       session.videoThread = std::thread {videoThread, &session};
@@ -2120,9 +4005,23 @@ namespace stream {
       // If this is the first session, invoke the platform callbacks
       if (++running_sessions == 1) {
         platf::streaming_will_start();
+      }
+
+      if (session.app_instance) {
+        proc::instances.session_started(session.app_instance);
+      } else if (++primary_sessions == 1) {
         proc::proc.resume();
       }
 
+      // The suspended session of the client stops counting, now that this one does
+      session.resumed = take_suspended([&](const auto &suspended) {
+        return suspended->device_uuid == session.device_uuid;
+      });
+      if (session.resumed) {
+        BOOST_LOG(info) << "Resuming the suspended session of ["sv << session.device_name << ']';
+        release(session.resumed->app_instance);
+      }
+
       if (!session.do_cmds.empty()) {
         auto exec_thread = std::thread([cmd_list = session.do_cmds]{
           for (auto &cmd : cmd_list) {
@@ -2155,6 +4054,16 @@ namespace stream {
       session->device_name = launch_session.device_name;
       session->device_uuid = launch_session.unique_id;
       session->permission = launch_session.perm;
+      session->metrics = metrics::register_session(launch_session.id, launch_session.device_name);
+      session->app_instance = launch_session.app_instance;
+      if (!config.monitor.input_only) {
+        session->admission = admission::instance().attach({
+          config.monitor.width,
+          config.monitor.height,
+          config.monitor.encodingFramerate / 1000.0,
+          config.monitor.bitrate,
+        });
+      }
 
       session->do_cmds = std::move(launch_session.client_do_cmds);
       session->undo_cmds = std::move(launch_session.client_undo_cmds);
@@ -2163,8 +4072,11 @@ namespace stream {
 
       session->control.connect_data = launch_session.control_connect_data;
       session->control.feedback_queue = mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback);
+      session->control.feedback_queue->count_drops_in(&metrics::queues().gamepad_feedback_dropped);
       session->control.hdr_queue = mail->event<video::hdr_info_t>(mail::hdr);
       session->control.legacy_input_enc_iv = launch_session.iv;
+      // Nvidia's old style encryption uses a 16-byte IV, sized once so encoding messages doesn't allocate
+      session->control.outgoing_iv.resize(config.encryptionFlagsEnabled & SS_ENC_CONTROL_V2 ? 12 : 16);
       session->control.cipher = crypto::cipher::gcm_t {
         launch_session.gcm_key,
         false
@@ -2172,6 +4084,23 @@ namespace stream {
 
       session->video.idr_events = mail->event<bool>(mail::idr);
       session->video.invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+      session->video.bitrate_events = mail->event<int>(mail::bitrate);
+      session->video.runtime = config::runtime();
+      session->video.negotiated_bitrate = config.monitor.bitrate;
+      if (config::stream.adaptive_bitrate || config::stream.dynamic_fec) {
+        session->video.bitrate_controller = std::make_unique<bitrate_controller_t>(config.monitor.bitrate, session->video.runtime->fec_percentage, config::stream.adaptive_bitrate, config::stream.dynamic_fec);
+      }
+      if (config::stream.adaptive_pacing) {
+        // An adapted bitrate backs off for the loss, the pacing rate only for the round-trip time and drain rate
+        session->video.network_estimator = std::make_unique<network_estimator_t>(network_estimator_t::default_max_pacing_rate_mbps, !config::stream.adaptive_bitrate);
+      }
+      session->network_profile = launch_session.network_profile;
+      if (auto &profile = session->network_profile; profile && profile->pacing_rate_mbps > 0 && session->video.network_estimator) {
+        session->video.network_estimator->start_from(profile->pacing_rate_mbps, profile->rtt);
+      }
+      if (config::stream.bandwidth_probe) {
+        session->video.bandwidth_probe = std::make_unique<bandwidth_probe_t>(config.monitor.bitrate, session->video.runtime->fec_percentage);
+      }
       session->video.lowseq = 0;
       session->video.ping_payload = launch_session.av_ping_payload;
       if (config.encryptionFlagsEnabled & SS_ENC_VIDEO) {
@@ -2214,6 +4143,10 @@ namespace stream {
       session->audio.avRiKeyId = util::endian::big(*(std::uint32_t *) launch_session.iv.data());
       session->audio.sequenceNumber = 0;
       session->audio.timestamp = 0;
+      if (config::audio.adaptive) {
+        session->audio.loss_monitor = std::make_unique<audio::loss_monitor_t>();
+        session->audio.loss_events = mail->event<int>(mail::audio_loss);
+      }
 
       session->control.peer = nullptr;
       session->state.store(state_e::STOPPED, std::memory_order_relaxed);
@@ -5,6 +5,7 @@
 #pragma once
 
 // standard includes
+#include <cstdint>
 #include <utility>
 
 // lib includes
@@ -20,6 +21,19 @@ namespace stream {
   constexpr auto CONTROL_PORT = 10;
   constexpr auto AUDIO_STREAM_PORT = 11;
 
+#pragma pack(push, 1)
+
+  /**
+   * @brief The prefix of each video packet when video encryption is enabled.
+   */
+  struct video_packet_enc_prefix_t {
+    std::uint8_t iv[12];  // 12-byte IV is ideal for AES-GCM
+    std::uint32_t frameNumber;
+    std::uint8_t tag[16];
+  };
+
+#pragma pack(pop)
+
   struct session_t;
 
   struct config_t {
@@ -54,6 +68,12 @@ namespace stream {
     void stop(session_t &session);
     void graceful_stop(session_t& session);
     void join(session_t &session);
+
+    /**
+     * @brief End the sessions suspended for their clients to resume them, e.g. when shutting down.
+     */
+    void end_suspended();
+
     state_e state(session_t &session);
     inline bool send(session_t& session, const std::string_view &payload);
   }  // namespace session
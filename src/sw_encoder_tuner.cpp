@@ -0,0 +1,103 @@
+/**
+ * @file src/sw_encoder_tuner.cpp
+ * @brief Definitions for tuning the software encoders to the host and the stream they encode.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+// local includes
+#include "sw_encoder_tuner.h"
+
+namespace sw_tuner {
+  namespace {
+    // Megapixels a core encodes per second with each preset, about what x264 manages on a desktop core
+    constexpr std::array<double, presets.size()> core_throughput {120, 70, 45, 30, 22, 16, 9, 5, 2};
+
+    // SMT siblings share the execution units of their core
+    constexpr double smt_share = 0.25;
+
+    // Slices shorter than this cost too much quality for the time they save
+    constexpr int min_slice_height = 120;
+    constexpr int max_slices = 16;
+
+    // Each frame encoded alongside another one adds a frame of latency
+    constexpr int max_frame_threads = 4;
+
+    // Keep the encoder from running at its limit, the content of a frame varies
+    constexpr double throughput_headroom = 1.25;
+  }  // namespace
+
+  int preset_index(std::string_view preset) {
+    auto it = std::find(std::begin(presets), std::end(presets), preset);
+    return it == std::end(presets) ? -1 : (int) (it - std::begin(presets));
+  }
+
+  host_t host_from_topology(const std::vector<platf::cpu_info_t> &cpus, int hardware_concurrency) {
+    if (cpus.empty()) {
+      auto logical_cpus = std::max(hardware_concurrency, 1);
+      return {logical_cpus, logical_cpus};
+    }
+
+    // CPUs of an unknown core count as cores of their own
+    std::set<int> cores;
+    int physical_cores = 0;
+    for (auto &cpu : cpus) {
+      if (cpu.core < 0) {
+        ++physical_cores;
+      } else if (cores.insert(cpu.core).second) {
+        ++physical_cores;
+      }
+    }
+
+    return {(int) cpus.size(), physical_cores};
+  }
+
+  plan_t choose_plan(const host_t &host, int width, int height, int framerate, int preset, int min_slices, int min_threads, int level) {
+    min_slices = std::max(min_slices, 1);
+    min_threads = std::max(min_threads, 1);
+
+    // Leave a CPU to capture the display and send the frames
+    auto spare = host.logical_cpus > 2 ? 1 : 0;
+    auto usable_cores = std::max(1.0, host.physical_cores + (host.logical_cpus - host.physical_cores) * smt_share - spare);
+    auto usable_threads = std::max(1, host.logical_cpus - spare);
+
+    auto pixel_rate = (double) width * height * framerate / 1'000'000 * throughput_headroom;
+    auto slice_threads = std::clamp(usable_threads, 1, std::clamp(height / min_slice_height, 1, max_slices));
+
+    auto keeps_up = [&](int preset, int threads) {
+      return core_throughput[preset] * std::min<double>(usable_cores, threads) >= pixel_rate;
+    };
+
+    bool frame_threads = false;
+    if (preset >= 0) {
+      auto stepped = std::max(0, preset - level);
+      level -= preset - stepped;
+      preset = stepped;
+
+      while (preset > 0 && !keeps_up(preset, slice_threads)) {
+        --preset;
+      }
+
+      frame_threads = level > 0 || !keeps_up(preset, slice_threads);
+    } else {
+      frame_threads = level > 0;
+    }
+
+    // Frame threads only help once there are CPUs for several frames
+    if (frame_threads && usable_threads >= 2) {
+      auto needed = preset >= 0 ? (int) std::ceil(pixel_rate / core_throughput[preset]) : max_frame_threads;
+      auto threads = std::clamp(needed, 2, std::min(max_frame_threads, usable_threads));
+      return {threading_e::frame, std::max(threads, min_threads), min_slices, preset};
+    }
+
+    auto threads = std::max({slice_threads, min_slices, min_threads});
+    return {threading_e::slice, threads, threads, preset};
+  }
+
+  int max_level(int preset) {
+    // Every faster preset, then frame threads
+    return std::max(preset, 0) + 1;
+  }
+}  // namespace sw_tuner
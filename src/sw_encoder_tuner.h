@@ -0,0 +1,93 @@
+/**
+ * @file src/sw_encoder_tuner.h
+ * @brief Declarations for tuning the software encoders to the host and the stream they encode.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "platform/common.h"
+
+namespace sw_tuner {
+  /**
+   * @brief The presets of x264 and x265, from the fastest to the slowest.
+   */
+  constexpr std::array<std::string_view, 9> presets {
+    "ultrafast",
+    "superfast",
+    "veryfast",
+    "faster",
+    "fast",
+    "medium",
+    "slow",
+    "slower",
+    "veryslow",
+  };
+
+  /**
+   * @brief Get the position of a preset in `presets`.
+   * @param preset The name of the preset.
+   * @return The position, or -1 if it isn't one of them.
+   */
+  int preset_index(std::string_view preset);
+
+  /**
+   * @brief The CPUs the encoder threads can run on.
+   */
+  struct host_t {
+    int logical_cpus;
+    int physical_cores;  ///< Cores without their SMT siblings.
+  };
+
+  /**
+   * @brief Count the CPUs of the host.
+   * @param cpus The CPUs from `platf::cpu_topology()`.
+   * @param hardware_concurrency What `std::thread::hardware_concurrency()` reports, for hosts without a known topology.
+   */
+  host_t host_from_topology(const std::vector<platf::cpu_info_t> &cpus, int hardware_concurrency);
+
+  enum class threading_e {
+    slice,  ///< The threads encode slices of the same frame, which adds no latency.
+    frame,  ///< The threads encode several frames at once, each frame they overlap adds a frame of latency.
+  };
+
+  /**
+   * @brief How a software encoder is opened.
+   */
+  struct plan_t {
+    threading_e threading;
+    int threads;
+    int slices;
+    int preset;  ///< The position in `presets`, -1 to keep the configured one.
+
+    bool operator==(const plan_t &) const = default;
+  };
+
+  /**
+   * @brief Choose how to open a software encoder for a stream.
+   * @details The preset starts at the configured one, and gets faster until the estimated throughput of the host
+   *          fits the pixel rate of the stream. Each level the encoder was stepped down at runtime makes it one
+   *          faster, and once the fastest preset doesn't keep up either, the threads encode frames instead of slices.
+   *          Slice threads use all usable CPUs, short of one left to capture and send, up to as many slices as the
+   *          frame is tall enough for. SMT siblings only count for a quarter of a core.
+   * @param host The CPUs of the host.
+   * @param width The width of the stream.
+   * @param height The height of the stream.
+   * @param framerate The frames per second of the stream.
+   * @param preset The position of the configured preset in `presets`, -1 if it's another one.
+   * @param min_slices The slices the client asked for, which are never gone below.
+   * @param min_threads The threads never gone below, `config::video.min_threads`.
+   * @param level The levels the encoder was stepped down at runtime, see `encoder_budget::monitor_t`.
+   */
+  plan_t choose_plan(const host_t &host, int width, int height, int framerate, int preset, int min_slices, int min_threads, int level);
+
+  /**
+   * @brief Get the most levels an encoder starting at a preset can be stepped down.
+   * @param preset The position of the configured preset in `presets`, -1 if it's another one.
+   */
+  int max_level(int preset);
+}  // namespace sw_tuner
@@ -76,6 +76,7 @@ namespace system_tray {
   void
   tray_force_stop_cb(struct tray_menu *item) {
     BOOST_LOG(info) << "Force stop from system tray"sv;
+    proc::instances.terminate_all();
     proc::proc.terminate();
   }
 
@@ -88,6 +89,7 @@ namespace system_tray {
   void tray_restart_cb([[maybe_unused]] struct tray_menu *item) {
     BOOST_LOG(info) << "Restarting from system tray"sv;
 
+    proc::instances.terminate_all();
     proc::proc.terminate();
     platf::restart();
   }
@@ -95,6 +97,7 @@ namespace system_tray {
   void tray_quit_cb([[maybe_unused]] struct tray_menu *item) {
     BOOST_LOG(info) << "Quitting from system tray"sv;
 
+    proc::instances.terminate_all();
     proc::proc.terminate();
 
   #ifdef _WIN32
@@ -17,14 +17,25 @@
 
 // local includes
 #include "move_by_copy.h"
+#include "timer_wheel.h"
 #include "utility.h"
 
 namespace task_pool_util {
 
+  /**
+   * @brief How urgently a task needs to run.
+   */
+  enum class priority_e {
+    high,  ///< Input and anything else that's felt by the client when it's late
+    normal,  ///< Everything else, including tasks that block
+  };
+
   class _ImplBase {
   public:
     // _unique_base_type _this_ptr;
 
+    priority_e priority = priority_e::normal;
+
     inline virtual ~_ImplBase() = default;
 
     virtual void run() = 0;
@@ -35,8 +46,9 @@ namespace task_pool_util {
     Function _func;
 
   public:
-    _Impl(Function &&f):
+    _Impl(Function &&f, priority_e priority):
         _func(std::forward<Function>(f)) {
+      this->priority = priority;
     }
 
     void run() override {
@@ -65,7 +77,7 @@ namespace task_pool_util {
 
   protected:
     std::deque<__task> _tasks;
-    std::vector<std::pair<__time_point, __task>> _timer_tasks;
+    timer_wheel_t<task_id_t, __task> _timer_tasks;
     std::mutex _task_mutex;
 
   public:
@@ -85,36 +97,24 @@ namespace task_pool_util {
 
     template<class Function, class... Args>
     auto push(Function &&newTask, Args &&...args) {
-      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
-
-      using __return = std::invoke_result_t<Function, Args &&...>;
-      using task_t = std::packaged_task<__return()>;
-
-      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
-        return std::apply(task, std::move(tuple_args));
-      };
-
-      task_t task(std::move(bind));
+      return push(priority_e::normal, std::forward<Function>(newTask), std::forward<Args>(args)...);
+    }
 
-      auto future = task.get_future();
+    template<class Function, class... Args>
+    auto push(priority_e priority, Function &&newTask, Args &&...args) {
+      auto [runnable, future] = make_task(priority, std::forward<Function>(newTask), std::forward<Args>(args)...);
 
       std::lock_guard<std::mutex> lg(_task_mutex);
-      _tasks.emplace_back(toRunnable(std::move(task)));
+      _tasks.emplace_back(std::move(runnable));
 
-      return future;
+      return std::move(future);
     }
 
     void pushDelayed(std::pair<__time_point, __task> &&task) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.cbegin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        if (std::get<0>(*it) < task.first) {
-          break;
-        }
-      }
-
-      _timer_tasks.emplace(it, task.first, std::move(task.second));
+      task_id_t task_id = &*task.second;
+      _timer_tasks.insert(task_id, task.first, std::move(task.second));
     }
 
     /**
@@ -122,11 +122,15 @@ namespace task_pool_util {
      */
     template<class Function, class X, class Y, class... Args>
     auto pushDelayed(Function &&newTask, std::chrono::duration<X, Y> duration, Args &&...args) {
-      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
-
-      using __return = std::invoke_result_t<Function, Args &&...>;
-      using task_t = std::packaged_task<__return()>;
+      return pushDelayed(priority_e::normal, std::forward<Function>(newTask), duration, std::forward<Args>(args)...);
+    }
 
+    /**
+     * @param priority The priority the task runs with once it's due.
+     * @return An id to potentially delay the task.
+     */
+    template<class Function, class X, class Y, class... Args>
+    auto pushDelayed(priority_e priority, Function &&newTask, std::chrono::duration<X, Y> duration, Args &&...args) {
       __time_point time_point;
       if constexpr (std::is_floating_point_v<X>) {
         time_point = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
@@ -134,20 +138,13 @@ namespace task_pool_util {
         time_point = std::chrono::steady_clock::now() + duration;
       }
 
-      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
-        return std::apply(task, std::move(tuple_args));
-      };
-
-      task_t task(std::move(bind));
-
-      auto future = task.get_future();
-      auto runnable = toRunnable(std::move(task));
+      auto [runnable, future] = make_task(priority, std::forward<Function>(newTask), std::forward<Args>(args)...);
 
       task_id_t task_id = &*runnable;
 
       pushDelayed(std::pair {time_point, std::move(runnable)});
 
-      return timer_task_t<__return> {task_id, future};
+      return timer_task_t<std::invoke_result_t<Function, Args &&...>> {task_id, future};
     }
 
     /**
@@ -158,62 +155,19 @@ namespace task_pool_util {
     void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          std::get<0>(*it) = std::chrono::steady_clock::now() + duration;
-
-          break;
-        }
-      }
-
-      if (it == _timer_tasks.cend()) {
-        return;
-      }
-
-      // smaller time goes to the back
-      auto prev = it - 1;
-      while (it > _timer_tasks.cbegin()) {
-        if (std::get<0>(*it) > std::get<0>(*prev)) {
-          std::swap(*it, *prev);
-        }
-
-        --prev;
-        --it;
-      }
+      _timer_tasks.reschedule(task_id, std::chrono::steady_clock::now() + duration);
     }
 
     bool cancel(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          _timer_tasks.erase(it);
-
-          return true;
-        }
-      }
-
-      return false;
+      return _timer_tasks.erase(task_id).has_value();
     }
 
     std::optional<std::pair<__time_point, __task>> pop(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto pos = std::find_if(std::begin(_timer_tasks), std::end(_timer_tasks), [&task_id](const auto &t) {
-        return t.second.get() == task_id;
-      });
-
-      if (pos == std::end(_timer_tasks)) {
-        return std::nullopt;
-      }
-
-      return std::move(*pos);
+      return _timer_tasks.erase(task_id);
     }
 
     std::optional<__task> pop() {
@@ -225,10 +179,8 @@ namespace task_pool_util {
         return task;
       }
 
-      if (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now()) {
-        __task task = std::move(std::get<1>(_timer_tasks.back()));
-        _timer_tasks.pop_back();
-        return task;
+      if (auto timer_task = _timer_tasks.pop(std::chrono::steady_clock::now())) {
+        return std::move(timer_task->second);
       }
 
       return std::nullopt;
@@ -237,23 +189,54 @@ namespace task_pool_util {
     bool ready() {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      return !_tasks.empty() || (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now());
+      return !_tasks.empty() || _timer_tasks.ready(std::chrono::steady_clock::now());
     }
 
     std::optional<__time_point> next() {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      if (_timer_tasks.empty()) {
-        return std::nullopt;
+      return _timer_tasks.next();
+    }
+
+  protected:
+    /**
+     * @brief Wrap a function and its arguments into a task.
+     * @return The task and the future of its result.
+     */
+    template<class Function, class... Args>
+    auto make_task(priority_e priority, Function &&newTask, Args &&...args) {
+      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
+
+      using __return = std::invoke_result_t<Function, Args &&...>;
+      using task_t = std::packaged_task<__return()>;
+
+      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        return std::apply(task, std::move(tuple_args));
+      };
+
+      task_t task(std::move(bind));
+
+      auto future = task.get_future();
+      return std::pair {toRunnable(std::move(task), priority), std::move(future)};
+    }
+
+    /**
+     * @brief Take the delayed task that's due first, if any is.
+     */
+    std::optional<__task> pop_due() {
+      std::lock_guard lg(_task_mutex);
+
+      if (auto timer_task = _timer_tasks.pop(std::chrono::steady_clock::now())) {
+        return std::move(timer_task->second);
       }
 
-      return std::get<0>(_timer_tasks.back());
+      return std::nullopt;
     }
 
   private:
     template<class Function>
-    std::unique_ptr<_ImplBase> toRunnable(Function &&f) {
-      return std::make_unique<_Impl<Function>>(std::forward<Function &&>(f));
+    std::unique_ptr<_ImplBase> toRunnable(Function &&f, priority_e priority) {
+      return std::make_unique<_Impl<Function>>(std::forward<Function &&>(f), priority);
     }
   };
 }  // namespace task_pool_util
@@ -0,0 +1,301 @@
+/**
+ * @file src/thread_affinity.cpp
+ * @brief Definitions for placing the threads of the streaming pipeline on CPUs close to each other.
+ */
+// standard includes
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+// local includes
+#include "logging.h"
+#include "thread_affinity.h"
+
+using namespace std::literals;
+
+namespace thread_affinity {
+  namespace {
+    /**
+     * @brief Get what all the CPUs have in common, -1 if they differ.
+     */
+    template<class F>
+    int common_value(const std::vector<platf::cpu_info_t> &cpus, F &&value_of) {
+      if (cpus.empty()) {
+        return -1;
+      }
+
+      auto value = value_of(cpus.front());
+      for (auto &cpu : cpus) {
+        if (value_of(cpu) != value) {
+          return -1;
+        }
+      }
+
+      return value;
+    }
+  }  // namespace
+
+  std::optional<placement_t> choose_placement(const std::vector<platf::cpu_info_t> &cpus, config::stream_t::thread_affinity_e policy, int gpu_numa_node) {
+    if (policy == config::stream_t::thread_affinity_e::disabled || cpus.empty()) {
+      return std::nullopt;
+    }
+
+    auto fastest = std::max_element(std::begin(cpus), std::end(cpus), [](auto &a, auto &b) {
+                     return a.efficiency_class < b.efficiency_class;
+                   })->efficiency_class;
+
+    std::vector<platf::cpu_info_t> candidates;
+    std::copy_if(std::begin(cpus), std::end(cpus), std::back_inserter(candidates), [fastest](auto &cpu) {
+      return cpu.efficiency_class == fastest;
+    });
+    bool performance_cores = candidates.size() < cpus.size();
+
+    // Memory the GPU reads from is on its own node, unless that node has none of the fastest cores
+    if (gpu_numa_node >= 0) {
+      std::vector<platf::cpu_info_t> near_gpu;
+      std::copy_if(std::begin(candidates), std::end(candidates), std::back_inserter(near_gpu), [gpu_numa_node](auto &cpu) {
+        return cpu.numa_node == gpu_numa_node;
+      });
+
+      if (!near_gpu.empty()) {
+        candidates = std::move(near_gpu);
+      }
+    }
+
+    if (policy == config::stream_t::thread_affinity_e::shared_cache) {
+      std::map<int, std::vector<platf::cpu_info_t>> domains;
+      for (auto &cpu : candidates) {
+        domains[cpu.l3_domain].emplace_back(cpu);
+      }
+
+      // The biggest domain, the first one of those with as many CPUs
+      auto domain = std::max_element(std::begin(domains), std::end(domains), [](auto &a, auto &b) {
+        return a.second.size() < b.second.size();
+      });
+      candidates = std::move(domain->second);
+    }
+
+    if (candidates.size() == cpus.size()) {
+      return std::nullopt;
+    }
+
+    placement_t placement {
+      {},
+      common_value(candidates, [](auto &cpu) {
+        return cpu.l3_domain;
+      }),
+      common_value(candidates, [](auto &cpu) {
+        return cpu.numa_node;
+      }),
+      performance_cores,
+    };
+    for (auto &cpu : candidates) {
+      placement.cpus.emplace_back(cpu.id);
+    }
+    std::sort(std::begin(placement.cpus), std::end(placement.cpus));
+
+    return placement;
+  }
+
+  std::vector<int> choose_reserved_cpus(const std::vector<platf::cpu_info_t> &cpus, int cores, int gpu_numa_node) {
+    struct core_t {
+      int id;
+      int efficiency_class;
+      bool near_gpu;
+      std::vector<int> cpus;
+    };
+
+    // CPUs of an unknown core are cores of their own
+    std::map<int, core_t> by_id;
+    for (auto &cpu : cpus) {
+      auto id = cpu.core >= 0 ? cpu.core : cpu.id;
+      auto &core = by_id.try_emplace(id, core_t {id, cpu.efficiency_class, gpu_numa_node >= 0 && cpu.numa_node == gpu_numa_node, {}}).first->second;
+      core.efficiency_class = std::max(core.efficiency_class, cpu.efficiency_class);
+      core.cpus.emplace_back(cpu.id);
+    }
+
+    if (cores <= 0 || cores >= (int) by_id.size()) {
+      return {};
+    }
+
+    std::vector<core_t> ranked;
+    for (auto &[id, core] : by_id) {
+      ranked.emplace_back(std::move(core));
+    }
+    std::sort(std::begin(ranked), std::end(ranked), [](auto &a, auto &b) {
+      return std::tie(a.efficiency_class, a.near_gpu, a.id) > std::tie(b.efficiency_class, b.near_gpu, b.id);
+    });
+
+    std::vector<int> reserved;
+    for (auto core = std::begin(ranked); core != std::begin(ranked) + cores; ++core) {
+      reserved.insert(std::end(reserved), std::begin(core->cpus), std::end(core->cpus));
+    }
+    std::sort(std::begin(reserved), std::end(reserved));
+
+    return reserved;
+  }
+
+  const std::vector<int> &reserved_cpus() {
+    static std::once_flag reserve_once;
+    static std::vector<int> reserved;
+    std::call_once(reserve_once, []() {
+      auto cores = config::stream.app_reserved_cores;
+      if (cores <= 0) {
+        return;
+      }
+
+      auto cpus = platf::cpu_topology();
+      if (cpus.empty()) {
+        BOOST_LOG(warning) << "The CPU topology isn't known on this platform, no cores can be reserved for the streaming threads"sv;
+        return;
+      }
+
+      reserved = choose_reserved_cpus(cpus, cores, platf::gpu_numa_node());
+      if (reserved.empty()) {
+        BOOST_LOG(warning) << "Reserving "sv << cores << " cores for the streaming threads would leave none of the "sv << cpus.size() << " CPUs to the apps"sv;
+        return;
+      }
+
+      BOOST_LOG(info) << "Reserving CPUs "sv << format_cpu_list(reserved) << " of "sv << cpus.size() << " for the streaming threads"sv;
+    });
+
+    return reserved;
+  }
+
+  std::vector<int> app_cpus() {
+    auto &reserved = reserved_cpus();
+    if (reserved.empty()) {
+      return {};
+    }
+
+    std::vector<int> cpus;
+    for (auto &cpu : platf::cpu_topology()) {
+      if (!std::binary_search(std::begin(reserved), std::end(reserved), cpu.id)) {
+        cpus.emplace_back(cpu.id);
+      }
+    }
+    std::sort(std::begin(cpus), std::end(cpus));
+
+    return cpus;
+  }
+
+  std::vector<int> parse_cpu_list(std::string_view list) {
+    std::vector<int> cpus;
+
+    while (!list.empty() && (list.back() == '\n' || list.back() == ' ')) {
+      list.remove_suffix(1);
+    }
+
+    while (!list.empty()) {
+      auto range = list.substr(0, list.find(','));
+      list.remove_prefix(std::min(range.size() + 1, list.size()));
+
+      int first, last;
+      auto dash = range.find('-');
+      auto first_str = range.substr(0, dash);
+      if (std::from_chars(first_str.data(), first_str.data() + first_str.size(), first).ec != std::errc {}) {
+        return {};
+      }
+
+      last = first;
+      if (dash != std::string_view::npos) {
+        auto last_str = range.substr(dash + 1);
+        if (std::from_chars(last_str.data(), last_str.data() + last_str.size(), last).ec != std::errc {} || last < first) {
+          return {};
+        }
+      }
+
+      for (auto cpu = first; cpu <= last; ++cpu) {
+        cpus.emplace_back(cpu);
+      }
+    }
+
+    std::sort(std::begin(cpus), std::end(cpus));
+    cpus.erase(std::unique(std::begin(cpus), std::end(cpus)), std::end(cpus));
+
+    return cpus;
+  }
+
+  std::string format_cpu_list(std::vector<int> cpus) {
+    std::sort(std::begin(cpus), std::end(cpus));
+    cpus.erase(std::unique(std::begin(cpus), std::end(cpus)), std::end(cpus));
+
+    std::string list;
+    for (std::size_t x = 0; x < cpus.size();) {
+      auto last = x;
+      while (last + 1 < cpus.size() && cpus[last + 1] == cpus[last] + 1) {
+        ++last;
+      }
+
+      if (!list.empty()) {
+        list += ',';
+      }
+      list += std::to_string(cpus[x]);
+      if (last > x) {
+        list += '-';
+        list += std::to_string(cpus[last]);
+      }
+
+      x = last + 1;
+    }
+
+    return list;
+  }
+
+  void pin_current_thread(std::string_view thread_name) {
+    if (auto &reserved = reserved_cpus(); !reserved.empty()) {
+      if (!platf::set_thread_affinity(reserved)) {
+        BOOST_LOG(warning) << "Unable to place the "sv << thread_name << " thread on the reserved CPUs "sv << format_cpu_list(reserved);
+      }
+      return;
+    }
+
+    if (config::stream.thread_affinity == config::stream_t::thread_affinity_e::disabled) {
+      return;
+    }
+
+    static std::once_flag choose_once;
+    static std::optional<placement_t> placement;
+    std::call_once(choose_once, []() {
+      auto cpus = platf::cpu_topology();
+      if (cpus.empty()) {
+        BOOST_LOG(warning) << "The CPU topology isn't known on this platform, the streaming threads can run on any CPU"sv;
+        return;
+      }
+
+      auto gpu_numa_node = platf::gpu_numa_node();
+      placement = choose_placement(cpus, config::stream.thread_affinity, gpu_numa_node);
+      if (!placement) {
+        BOOST_LOG(info) << "All "sv << cpus.size() << " CPUs are equally close, the streaming threads can run on any of them"sv;
+        return;
+      }
+
+      auto &chosen = *placement;
+      std::string details;
+      if (chosen.performance_cores) {
+        details += ", performance cores"s;
+      }
+      if (chosen.l3_domain >= 0) {
+        details += ", L3 domain "s + std::to_string(chosen.l3_domain);
+      }
+      if (chosen.numa_node >= 0) {
+        details += ", NUMA node "s + std::to_string(chosen.numa_node) + (chosen.numa_node == gpu_numa_node ? " of the GPU"s : ""s);
+      }
+
+      BOOST_LOG(info) << "Placing the streaming threads on CPUs "sv << format_cpu_list(chosen.cpus) << " of "sv << cpus.size() << details;
+    });
+
+    if (!placement) {
+      return;
+    }
+
+    if (!platf::set_thread_affinity(placement->cpus)) {
+      BOOST_LOG(warning) << "Unable to place the "sv << thread_name << " thread on CPUs "sv << format_cpu_list(placement->cpus);
+      return;
+    }
+
+    BOOST_LOG(debug) << "Placed the "sv << thread_name << " thread on CPUs "sv << format_cpu_list(placement->cpus);
+  }
+}  // namespace thread_affinity
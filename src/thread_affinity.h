@@ -0,0 +1,84 @@
+/**
+ * @file src/thread_affinity.h
+ * @brief Declarations for placing the threads of the streaming pipeline on CPUs close to each other.
+ */
+#pragma once
+
+// standard includes
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "config.h"
+#include "platform/common.h"
+
+namespace thread_affinity {
+  /**
+   * @brief The CPUs the threads of the streaming pipeline run on.
+   */
+  struct placement_t {
+    std::vector<int> cpus;
+    int l3_domain;  ///< The L3 domain of all the CPUs, -1 if they span several or it's unknown.
+    int numa_node;  ///< The NUMA node of all the CPUs, -1 if they span several or it's unknown.
+    bool performance_cores;  ///< Whether slower cores of a hybrid CPU were left out.
+  };
+
+  /**
+   * @brief Choose the CPUs for the threads of the streaming pipeline.
+   * @details The fastest cores are preferred, on the NUMA node of the GPU when it has any of them.
+   *          With `shared_cache`, they're further narrowed down to the L3 domain with the most of them.
+   * @param cpus The CPUs of the host.
+   * @param policy How to place the threads.
+   * @param gpu_numa_node The NUMA node of the GPU, -1 if unknown.
+   * @return The placement, or `std::nullopt` if the threads should run anywhere.
+   */
+  std::optional<placement_t> choose_placement(const std::vector<platf::cpu_info_t> &cpus, config::stream_t::thread_affinity_e policy, int gpu_numa_node);
+
+  /**
+   * @brief Choose the cores to keep the apps off, for the threads of the streaming pipeline.
+   * @details The fastest cores are taken, on the NUMA node of the GPU when it has enough of them, and the last
+   *          of those, as the first ones handle more interrupts. Cores are taken with all their SMT siblings,
+   *          so the threads of the apps don't compete with the pipeline for them either.
+   * @param cpus The CPUs of the host.
+   * @param cores The number of cores to reserve.
+   * @param gpu_numa_node The NUMA node of the GPU, -1 if unknown.
+   * @return The CPUs of the cores, or an empty list if that would leave no core for the apps.
+   */
+  std::vector<int> choose_reserved_cpus(const std::vector<platf::cpu_info_t> &cpus, int cores, int gpu_numa_node);
+
+  /**
+   * @brief Get the CPUs reserved for the streaming pipeline according to `config::stream.app_reserved_cores`.
+   * @details The reservation is chosen and logged the first time it's needed.
+   * @return The CPUs, or an empty list if the apps may run on every CPU.
+   */
+  const std::vector<int> &reserved_cpus();
+
+  /**
+   * @brief Get the CPUs the apps run on, besides the ones reserved for the streaming pipeline.
+   * @return The CPUs, or an empty list if the apps may run on every CPU.
+   */
+  std::vector<int> app_cpus();
+
+  /**
+   * @brief Parse a list of CPUs in the format Linux uses, e.g. `0-3,8,10-11`.
+   * @param list The list.
+   * @return The CPUs in ascending order, or an empty list if it's malformed.
+   */
+  std::vector<int> parse_cpu_list(std::string_view list);
+
+  /**
+   * @brief Format CPUs as a list in the format Linux uses, e.g. `0-3,8,10-11`.
+   * @param cpus The CPUs.
+   */
+  std::string format_cpu_list(std::vector<int> cpus);
+
+  /**
+   * @brief Place the current thread according to `config::stream.thread_affinity`.
+   * @details The placement is chosen and logged the first time a thread is placed.
+   *          With cores reserved for the streaming pipeline, the thread is placed on them instead.
+   * @param thread_name What the thread does, for the log.
+   */
+  void pin_current_thread(std::string_view thread_name);
+}  // namespace thread_affinity
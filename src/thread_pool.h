@@ -5,38 +5,69 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <thread>
 
 // local includes
 #include "task_pool.h"
 
 namespace thread_pool_util {
+  using task_pool_util::priority_e;
+
   /**
    * Allow threads to execute unhindered while keeping full control over the threads.
+   * @details Every worker has a queue of its own for each priority. Tasks are pushed to the queues in turn,
+   *          and idle workers steal from the queues of the others, so pushing threads rarely contend and a slow
+   *          task only holds up its own worker. Every worker runs the high priority tasks before any normal one.
+   *          Reserved workers only ever run high priority tasks, so those never wait behind a task that blocks.
+   *          Delayed tasks join the queues of their priority once they're due.
    */
   class ThreadPool: public task_pool_util::TaskPool {
   public:
     typedef TaskPool::__task __task;
 
   private:
-    std::vector<std::thread> _thread;
+    struct worker_t {
+      std::mutex lock;
+
+      // Indexed by priority_e
+      std::array<std::deque<__task>, 2> tasks;
+
+      std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<worker_t>> _workers;
+
+    // The first workers, which only run high priority tasks
+    std::size_t _reserved = 0;
+
+    std::atomic_size_t _next_worker {0};
+
+    // Tasks in the queues of the workers, indexed by priority_e
+    std::array<std::atomic_int, 2> _queued {};
+    std::atomic_int _sleeping {0};
 
     std::condition_variable _cv;
     std::mutex _lock;
 
-    bool _continue;
+    std::atomic_bool _continue;
 
   public:
     ThreadPool():
         _continue {false} {
     }
 
-    explicit ThreadPool(int threads):
-        _thread(threads),
-        _continue {true} {
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
-      }
+    /**
+     * @param threads The number of workers.
+     * @param reserved The number of them that only run high priority tasks, always less than `threads`.
+     */
+    explicit ThreadPool(int threads, int reserved = 0):
+        _continue {false} {
+      start(threads, reserved);
     }
 
     ~ThreadPool() noexcept {
@@ -50,11 +81,15 @@ namespace thread_pool_util {
 
     template<class Function, class... Args>
     auto push(Function &&newTask, Args &&...args) {
-      std::lock_guard lg(_lock);
-      auto future = TaskPool::push(std::forward<Function>(newTask), std::forward<Args>(args)...);
+      return push(priority_e::normal, std::forward<Function>(newTask), std::forward<Args>(args)...);
+    }
 
-      _cv.notify_one();
-      return future;
+    template<class Function, class... Args>
+    auto push(priority_e priority, Function &&newTask, Args &&...args) {
+      auto [runnable, future] = make_task(priority, std::forward<Function>(newTask), std::forward<Args>(args)...);
+
+      queue(std::move(runnable));
+      return std::move(future);
     }
 
     void pushDelayed(std::pair<__time_point, __task> &&task) {
@@ -65,21 +100,45 @@ namespace thread_pool_util {
 
     template<class Function, class X, class Y, class... Args>
     auto pushDelayed(Function &&newTask, std::chrono::duration<X, Y> duration, Args &&...args) {
+      return pushDelayed(priority_e::normal, std::forward<Function>(newTask), duration, std::forward<Args>(args)...);
+    }
+
+    template<class Function, class X, class Y, class... Args>
+    auto pushDelayed(priority_e priority, Function &&newTask, std::chrono::duration<X, Y> duration, Args &&...args) {
       std::lock_guard lg(_lock);
-      auto future = TaskPool::pushDelayed(std::forward<Function>(newTask), duration, std::forward<Args>(args)...);
+      auto future = TaskPool::pushDelayed(priority, std::forward<Function>(newTask), duration, std::forward<Args>(args)...);
 
       // Update all timers for wait_until
       _cv.notify_all();
       return future;
     }
 
-    void start(int threads) {
+    /**
+     * @param threads The number of workers.
+     * @param reserved The number of them that only run high priority tasks, always less than `threads`.
+     */
+    void start(int threads, int reserved = 0) {
       _continue = true;
 
-      _thread.resize(threads);
+      _workers.clear();
+      for (int x = 0; x < threads; ++x) {
+        _workers.emplace_back(std::make_unique<worker_t>());
+      }
+      _reserved = std::clamp(reserved, 0, std::max(threads - 1, 0));
+
+      // Tasks pushed before the pool started
+      std::deque<__task> pending;
+      {
+        std::lock_guard lg(_task_mutex);
+        std::swap(pending, _tasks);
+      }
+      for (auto &task : pending) {
+        queue(std::move(task));
+      }
 
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
+      // Every worker exists before any of them steals
+      for (std::size_t x = 0; x < _workers.size(); ++x) {
+        _workers[x]->thread = std::thread(&ThreadPool::_main, this, x);
       }
     }
 
@@ -91,37 +150,127 @@ namespace thread_pool_util {
     }
 
     void join() {
-      for (auto &t : _thread) {
-        t.join();
+      for (auto &worker : _workers) {
+        worker->thread.join();
       }
     }
 
-  public:
-    void _main() {
-      while (_continue) {
-        if (auto task = this->pop()) {
-          (*task)->run();
+  private:
+    /**
+     * @brief Add a task to the queue of the next worker allowed to run it.
+     */
+    void queue(__task &&task) {
+      auto priority = task->priority;
+
+      if (_workers.empty()) {
+        std::lock_guard lg(_task_mutex);
+        _tasks.emplace_back(std::move(task));
+        return;
+      }
+
+      auto shared = _workers.size() - _reserved;
+      auto next = _next_worker.fetch_add(1, std::memory_order_relaxed);
+      auto &worker = priority == priority_e::high ? *_workers[next % _workers.size()] : *_workers[_reserved + next % shared];
+      {
+        std::lock_guard lg(worker.lock);
+        worker.tasks[(int) priority].emplace_back(std::move(task));
+      }
+
+      // Pairs with the check of a worker going to sleep, which counts itself before looking at the queues
+      _queued[(int) priority].fetch_add(1);
+      if (_sleeping.load()) {
+        std::lock_guard lg(_lock);
+
+        // A reserved worker would leave a normal priority task alone
+        if (priority == priority_e::high) {
+          _cv.notify_one();
         } else {
-          std::unique_lock uniq_lock(_lock);
+          _cv.notify_all();
+        }
+      }
+    }
 
-          if (ready()) {
-            continue;
-          }
+    /**
+     * @brief Take the oldest task from the queue of a worker.
+     */
+    std::optional<__task> take(worker_t &worker, priority_e priority) {
+      std::lock_guard lg(worker.lock);
+
+      auto &tasks = worker.tasks[(int) priority];
+      if (tasks.empty()) {
+        return std::nullopt;
+      }
+
+      auto task = std::move(tasks.front());
+      tasks.pop_front();
+      _queued[(int) priority].fetch_sub(1);
 
-          if (!_continue) {
-            break;
+      return task;
+    }
+
+    /**
+     * @brief Take the next task a worker runs, from its own queues first.
+     */
+    std::optional<__task> next_task(std::size_t index) {
+      auto reserved = index < _reserved;
+
+      for (auto priority : {priority_e::high, priority_e::normal}) {
+        if (reserved && priority == priority_e::normal) {
+          break;
+        }
+
+        for (std::size_t x = 0; x < _workers.size(); ++x) {
+          if (auto task = take(*_workers[(index + x) % _workers.size()], priority)) {
+            return task;
           }
+        }
+      }
 
-          if (auto tp = next()) {
-            _cv.wait_until(uniq_lock, *tp);
+      return std::nullopt;
+    }
+
+  public:
+    void _main(std::size_t index) {
+      while (_continue) {
+        if (auto task = next_task(index)) {
+          (*task)->run();
+          continue;
+        }
+
+        if (auto task = pop_due()) {
+          if ((*task)->priority == priority_e::high || index >= _reserved) {
+            (*task)->run();
           } else {
-            _cv.wait(uniq_lock);
+            queue(std::move(*task));
           }
+          continue;
+        }
+
+        std::unique_lock uniq_lock(_lock);
+
+        _sleeping.fetch_add(1);
+        auto fg = util::fail_guard([this]() {
+          _sleeping.fetch_sub(1);
+        });
+
+        auto queued = _queued[(int) priority_e::high].load() + (index < _reserved ? 0 : _queued[(int) priority_e::normal].load());
+        if (queued > 0 || ready()) {
+          continue;
+        }
+
+        if (!_continue) {
+          break;
+        }
+
+        if (auto tp = next()) {
+          _cv.wait_until(uniq_lock, *tp);
+        } else {
+          _cv.wait(uniq_lock);
         }
       }
 
-      // Execute remaining tasks
-      while (auto task = this->pop()) {
+      // Execute remaining tasks, of every priority
+      while (auto task = next_task(_reserved)) {
         (*task)->run();
       }
     }
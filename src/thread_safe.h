@@ -5,15 +5,20 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <bit>
 #include <condition_variable>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <vector>
 
 // local includes
+#include "consumer_signal.h"
 #include "utility.h"
 
 namespace safe {
@@ -36,6 +41,21 @@ namespace safe {
       }
 
       _cv.notify_all();
+
+      if (_notify) {
+        _notify();
+      }
+    }
+
+    /**
+     * @brief Set a function called whenever a value is raised, so a thread can wait on more than this alone.
+     * @details The function is called with the lock held, so it must not block.
+     * @param notify The function, or an empty one to remove it.
+     */
+    void on_raise(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+
+      _notify = std::move(notify);
     }
 
     // pop and view should not be used interchangeably
@@ -143,6 +163,7 @@ namespace safe {
   private:
     bool _continue {true};
     status_t _status {util::false_v<status_t>};
+    std::function<void()> _notify;
 
     std::condition_variable _cv;
     std::mutex _lock;
@@ -249,34 +270,112 @@ namespace safe {
     return std::make_shared<alarm_raw_t<T>>();
   }
 
+  /**
+   * @brief What a queue does with a value raised while it's full.
+   */
+  enum class overflow_e {
+    drop_oldest,  ///< Drop the oldest value queued
+    drop_newest,  ///< Drop the value raised
+    block,  ///< Wait for a value to be popped, or for the queue to stop
+    drop_to_keyframe,  ///< Drop the values queued before the next keyframe, or all of them if none is queued
+  };
+
+  /**
+   * @brief A fixed-capacity ring of values passed between threads.
+   */
   template<class T>
   class queue_t {
   public:
     using status_t = util::optional_t<T>;
+    using keyframe_f = std::function<bool(const T &)>;
 
     queue_t(std::uint32_t max_elements = 32):
-        _max_elements {max_elements} {
+        _ring(std::max<std::uint32_t>(max_elements, 1)) {
     }
 
     template<class... Args>
     void raise(Args &&...args) {
-      std::lock_guard ul {_lock};
+      std::unique_lock ul {_lock};
 
       if (!_continue) {
         return;
       }
 
-      if (_queue.size() == _max_elements) {
-        _queue.clear();
+      if (_size == _ring.size()) {
+        switch (_overflow) {
+          case overflow_e::drop_oldest:
+            drop(1);
+            break;
+          case overflow_e::drop_newest:
+            count_drops(1);
+            return;
+          case overflow_e::block:
+            while (_size == _ring.size()) {
+              _cv.wait(ul);
+
+              if (!_continue) {
+                return;
+              }
+            }
+            break;
+          case overflow_e::drop_to_keyframe:
+            drop(next_keyframe());
+            break;
+        }
       }
 
-      _queue.emplace_back(std::forward<Args>(args)...);
+      _ring[(_head + _size) % _ring.size()].emplace(std::forward<Args>(args)...);
+      ++_size;
 
       _cv.notify_all();
+
+      if (_notify) {
+        _notify();
+      }
+    }
+
+    /**
+     * @brief Set what happens when a value is raised while the queue is full.
+     * @param overflow The policy, `overflow_e::drop_oldest` by default.
+     * @param is_keyframe For `overflow_e::drop_to_keyframe`, whether a value can be used without the ones before it.
+     */
+    void overflow(overflow_e overflow, keyframe_f is_keyframe = {}) {
+      std::lock_guard lg {_lock};
+
+      _overflow = overflow;
+      _is_keyframe = std::move(is_keyframe);
+    }
+
+    /**
+     * @brief Also count the values dropped on overflow in a counter owned by the caller, e.g. a metric.
+     * @param counter The counter, which must outlive the queue, or `nullptr` to stop counting.
+     */
+    void count_drops_in(std::atomic_uint64_t *counter) {
+      std::lock_guard lg {_lock};
+
+      _drop_counter = counter;
+    }
+
+    /**
+     * @brief Get the number of values dropped on overflow.
+     */
+    std::uint64_t dropped() const {
+      return _dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Set a function called whenever a value is raised, so a thread can wait on more than this alone.
+     * @details The function is called with the lock held, so it must not block.
+     * @param notify The function, or an empty one to remove it.
+     */
+    void on_raise(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+
+      _notify = std::move(notify);
     }
 
     bool peek() {
-      return _continue && !_queue.empty();
+      return _continue && _size != 0;
     }
 
     template<class Rep, class Period>
@@ -287,16 +386,13 @@ namespace safe {
         return util::false_v<status_t>;
       }
 
-      while (_queue.empty()) {
+      while (_size == 0) {
         if (!_continue || _cv.wait_for(ul, delay) == std::cv_status::timeout) {
           return util::false_v<status_t>;
         }
       }
 
-      auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
-
-      return val;
+      return take();
     }
 
     status_t pop() {
@@ -306,7 +402,7 @@ namespace safe {
         return util::false_v<status_t>;
       }
 
-      while (_queue.empty()) {
+      while (_size == 0) {
         _cv.wait(ul);
 
         if (!_continue) {
@@ -314,14 +410,29 @@ namespace safe {
         }
       }
 
-      auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
+      return take();
+    }
 
-      return val;
+    /**
+     * @brief Take every value still queued, e.g. to clean up after the queue has been stopped.
+     * @return The values, oldest first.
+     */
+    std::vector<T> drain() {
+      std::lock_guard lg {_lock};
+
+      std::vector<T> values;
+      values.reserve(_size);
+      while (_size != 0) {
+        values.emplace_back(take());
+      }
+
+      return values;
     }
 
-    std::vector<T> &unsafe() {
-      return _queue;
+    std::size_t size() {
+      std::lock_guard lg {_lock};
+
+      return _size;
     }
 
     void stop() {
@@ -337,13 +448,71 @@ namespace safe {
     }
 
   private:
+    // The lock must be held for all of these
+    T take() {
+      auto val = std::move(*_ring[_head]);
+      _ring[_head].reset();
+
+      _head = (_head + 1) % _ring.size();
+      --_size;
+
+      // Only a raise blocked on a full queue waits for a pop
+      if (_overflow == overflow_e::block) {
+        _cv.notify_all();
+      }
+
+      return val;
+    }
+
+    void drop(std::size_t count) {
+      for (std::size_t x = 0; x < count; ++x) {
+        _ring[_head].reset();
+        _head = (_head + 1) % _ring.size();
+      }
+      _size -= count;
+
+      count_drops(count);
+    }
+
+    void count_drops(std::size_t count) {
+      _dropped.fetch_add(count, std::memory_order_relaxed);
+      if (_drop_counter) {
+        _drop_counter->fetch_add(count, std::memory_order_relaxed);
+      }
+    }
+
+    /**
+     * @return The number of values queued before the first keyframe that isn't the oldest value.
+     */
+    std::size_t next_keyframe() const {
+      if (!_is_keyframe) {
+        return 1;
+      }
+
+      std::size_t x = 1;
+      while (x < _size && !_is_keyframe(*_ring[(_head + x) % _ring.size()])) {
+        ++x;
+      }
+
+      return x;
+    }
+
     bool _continue {true};
-    std::uint32_t _max_elements;
 
     std::mutex _lock;
     std::condition_variable _cv;
 
-    std::vector<T> _queue;
+    std::vector<std::optional<T>> _ring;
+    std::size_t _head {0};
+    std::atomic_size_t _size {0};
+
+    overflow_e _overflow {overflow_e::drop_oldest};
+    keyframe_f _is_keyframe;
+
+    std::atomic_uint64_t _dropped {0};
+    std::atomic_uint64_t *_drop_counter {nullptr};
+
+    std::function<void()> _notify;
   };
 
   template<class T>
@@ -469,6 +638,269 @@ namespace safe {
     };
   }
 
+  /**
+   * @brief A fixed-capacity lock-free ring of values passed to a single consumer thread.
+   * @details Producers never block and never take a lock. The consumer sleeps on the same
+   *          util::consumer_signal_t as util::spsc_ring_t, which producers only wake when
+   *          the consumer is actually asleep. Unlike the slots of util::spsc_ring_t, which one
+   *          producer fills in place, cells are claimed by any number of producers, so each
+   *          cell carries a sequence number telling who may use it next.
+   *          A producer can't touch the values queued without racing the consumer, so on
+   *          overflow only `overflow_e::drop_newest` and `overflow_e::drop_to_keyframe` are
+   *          supported, the latter dropping new values until a keyframe is raised. A new value nothing
+   *          depends on is dropped alone. Values of several streams can each be cut on their own,
+   *          with the state of the cut kept by the stream.
+   * @tparam T The type of the values.
+   * @tparam multi_producer Whether several threads may raise values, or only one.
+   */
+  template<class T, bool multi_producer>
+  class lockfree_queue_t {
+  public:
+    using status_t = util::optional_t<T>;
+    using keyframe_f = bool (*)(const T &);
+    using cutting_f = std::atomic_bool &(*) (const T &);
+    using cut_f = void (*)(const T &);
+
+    lockfree_queue_t(std::uint32_t max_elements = 32):
+        _mask {std::bit_ceil(std::max<std::uint32_t>(max_elements, 2)) - 1},
+        _cells {std::make_unique<cell_t[]>(_mask + 1)} {
+      for (std::size_t x = 0; x <= _mask; ++x) {
+        _cells[x].sequence.store(x, std::memory_order_relaxed);
+      }
+    }
+
+    template<class... Args>
+    void raise(Args &&...args) {
+      if (!_continue.load(std::memory_order_relaxed)) {
+        return;
+      }
+
+      T value(std::forward<Args>(args)...);
+
+      auto overflow = _overflow.load(std::memory_order_relaxed);
+      auto is_keyframe = _is_keyframe.load(std::memory_order_relaxed);
+      auto cutting_of = _cutting.load(std::memory_order_relaxed);
+      auto &cutting = cutting_of ? cutting_of(value) : _dropping;
+      if (overflow == overflow_e::drop_to_keyframe && is_keyframe) {
+        // The values after a dropped one are useless until the next keyframe
+        if (is_keyframe(value)) {
+          cutting.store(false, std::memory_order_relaxed);
+        } else if (cutting.load(std::memory_order_relaxed)) {
+          count_drop();
+          return;
+        }
+      }
+
+      auto is_droppable = _is_droppable.load(std::memory_order_relaxed);
+      auto droppable = is_droppable && is_droppable(value);
+      if (!push(value)) {
+        // The values after a droppable one don't miss it
+        if (overflow == overflow_e::drop_to_keyframe && is_keyframe && !droppable && !cutting.exchange(true, std::memory_order_relaxed)) {
+          if (auto cut = _cut.load(std::memory_order_relaxed)) {
+            cut(value);
+          }
+        }
+        count_drop();
+        return;
+      }
+
+      _signal.notify();
+    }
+
+    /**
+     * @brief Set what happens when a value is raised while the queue is full.
+     * @param overflow `overflow_e::drop_to_keyframe`, or `overflow_e::drop_newest` by default.
+     * @param is_keyframe For `overflow_e::drop_to_keyframe`, whether a value can be used without the ones before it.
+     * @param is_droppable For `overflow_e::drop_to_keyframe`, whether no value after it depends on it.
+     * @param cutting For `overflow_e::drop_to_keyframe`, the flag set while the stream of a value is cut,
+     *                so a drop only cuts the values of its own stream. All values share one without it.
+     *                Only one thread may raise the values of a stream.
+     * @param cut For `overflow_e::drop_to_keyframe`, called with the dropped value when a cut starts,
+     *            e.g. to ask its stream for a keyframe.
+     */
+    void overflow(overflow_e overflow, keyframe_f is_keyframe = nullptr, keyframe_f is_droppable = nullptr, cutting_f cutting = nullptr, cut_f cut = nullptr) {
+      _is_keyframe.store(is_keyframe, std::memory_order_relaxed);
+      _is_droppable.store(is_droppable, std::memory_order_relaxed);
+      _cutting.store(cutting, std::memory_order_relaxed);
+      _cut.store(cut, std::memory_order_relaxed);
+      _overflow.store(overflow == overflow_e::drop_to_keyframe ? overflow : overflow_e::drop_newest, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Also count the values dropped on overflow in a counter owned by the caller, e.g. a metric.
+     * @param counter The counter, which must outlive the queue, or `nullptr` to stop counting.
+     */
+    void count_drops_in(std::atomic_uint64_t *counter) {
+      _drop_counter.store(counter, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the number of values dropped on overflow.
+     */
+    std::uint64_t dropped() const {
+      return _dropped.load(std::memory_order_relaxed);
+    }
+
+    bool peek() {
+      return _continue.load(std::memory_order_relaxed) && ready();
+    }
+
+    /**
+     * @brief Pop a value, waiting for one to be raised.
+     * @details Only the consumer thread may call this.
+     */
+    status_t pop() {
+      while (_continue.load(std::memory_order_relaxed)) {
+        if (ready()) {
+          return take();
+        }
+
+        // Checked again after sampling, since stop() bumps the signal too
+        auto seen = _signal.prepare();
+        if (!ready() && _continue.load(std::memory_order_relaxed)) {
+          _signal.wait(seen);
+        }
+      }
+
+      return util::false_v<status_t>;
+    }
+
+    /**
+     * @brief Take every value still queued, e.g. to clean up after the queue has been stopped.
+     * @details Only the consumer thread may call this.
+     * @return The values, oldest first.
+     */
+    std::vector<T> drain() {
+      std::vector<T> values;
+      while (ready()) {
+        values.emplace_back(take());
+      }
+
+      return values;
+    }
+
+    std::size_t size() {
+      auto head = _head.load(std::memory_order_acquire);
+      auto tail = _tail.load(std::memory_order_acquire);
+      return tail > head ? tail - head : 0;
+    }
+
+    void stop() {
+      _continue.store(false);
+      _signal.notify();
+    }
+
+    [[nodiscard]] bool running() const {
+      return _continue.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct cell_t {
+      std::atomic_size_t sequence;
+      std::optional<T> value;
+    };
+
+    /**
+     * @brief Claim the cell at the tail and fill it.
+     * @details A cell is free for position `pos` when its sequence is `pos`, and holds the value of
+     *          `pos` once its sequence is `pos + 1`. Popping it frees it for `pos + capacity`.
+     * @return `false` if the queue is full, in which case the value is left alone.
+     */
+    bool push(T &value) {
+      auto pos = _tail.load(std::memory_order_relaxed);
+
+      cell_t *cell;
+      while (true) {
+        cell = &_cells[pos & _mask];
+        auto sequence = cell->sequence.load(std::memory_order_acquire);
+        auto diff = (std::intptr_t) sequence - (std::intptr_t) pos;
+
+        if (diff < 0) {
+          return false;
+        }
+
+        if (diff == 0) {
+          if constexpr (multi_producer) {
+            if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+              break;
+            }
+          } else {
+            _tail.store(pos + 1, std::memory_order_relaxed);
+            break;
+          }
+        } else {
+          pos = _tail.load(std::memory_order_relaxed);
+        }
+      }
+
+      cell->value.emplace(std::move(value));
+      cell->sequence.store(pos + 1, std::memory_order_release);
+
+      return true;
+    }
+
+    bool ready() const {
+      auto pos = _head.load(std::memory_order_relaxed);
+      return _cells[pos & _mask].sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // Only the consumer thread may call this, once ready() returned true
+    T take() {
+      auto pos = _head.load(std::memory_order_relaxed);
+      auto &cell = _cells[pos & _mask];
+
+      auto value = std::move(*cell.value);
+      cell.value.reset();
+
+      cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+      _head.store(pos + 1, std::memory_order_release);
+
+      return value;
+    }
+
+    void count_drop() {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      if (auto counter = _drop_counter.load(std::memory_order_relaxed)) {
+        counter->fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    const std::size_t _mask;
+    std::unique_ptr<cell_t[]> _cells;
+
+    // The producers and the consumer each get a cache line of their own
+    alignas(64) std::atomic_size_t _tail {0};
+    alignas(64) std::atomic_size_t _head {0};
+
+    alignas(64) util::consumer_signal_t _signal;
+    std::atomic_bool _continue {true};
+
+    std::atomic<overflow_e> _overflow {overflow_e::drop_newest};
+    std::atomic<keyframe_f> _is_keyframe {nullptr};
+    std::atomic<keyframe_f> _is_droppable {nullptr};
+    std::atomic<cutting_f> _cutting {nullptr};
+    std::atomic<cut_f> _cut {nullptr};
+    std::atomic_bool _dropping {false};
+
+    std::atomic_uint64_t _dropped {0};
+    std::atomic<std::atomic_uint64_t *> _drop_counter {nullptr};
+  };
+
+  template<class T>
+  using spsc_queue_t = lockfree_queue_t<T, false>;
+
+  template<class T>
+  using mpsc_queue_t = lockfree_queue_t<T, true>;
+
+  /**
+   * @brief The queue mail_raw_t::queue() hands out for values of T.
+   * @details Specialize it with a lock-free queue for the values of a hot pipeline with a single consumer.
+   */
+  template<class T>
+  struct mail_queue {
+    using type = queue_t<T>;
+  };
+
   using signal_t = event_t<bool>;
 
   class mail_raw_t;
@@ -503,7 +935,7 @@ namespace safe {
     using event_t = std::shared_ptr<post_t<event_t<T>>>;
 
     template<class T>
-    using queue_t = std::shared_ptr<post_t<queue_t<T>>>;
+    using queue_t = std::shared_ptr<post_t<typename mail_queue<T>::type>>;
 
     template<class T>
     event_t<T> event(const std::string_view &id) {
@@ -0,0 +1,275 @@
+/**
+ * @file src/timer_wheel.h
+ * @brief Declarations for a hierarchical timer wheel.
+ */
+#pragma once
+
+// standard includes
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace task_pool_util {
+  /**
+   * @brief Timers sorted into buckets of coarser granularity the further out they expire.
+   * @details Inserting, rescheduling and erasing a timer is O(1). As time advances, the buckets of the coarser levels
+   *          are redistributed into the finer ones, so every timer is touched at most once per level.
+   *          Timers expire at millisecond granularity, never before their deadline.
+   *          Not thread-safe, the owner is expected to lock around it.
+   * @tparam Key Identifies a pending timer.
+   * @tparam T The value of a timer.
+   */
+  template<class Key, class T>
+  class timer_wheel_t {
+  public:
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+
+    static constexpr auto tick = std::chrono::milliseconds(1);
+
+    // 64 slots per level cover about 12 days with 5 levels, later timers wait in an overflow bucket
+    static constexpr int slot_bits = 6;
+    static constexpr int slots = 1 << slot_bits;
+    static constexpr int levels = 5;
+
+    explicit timer_wheel_t(time_point start = clock::now()):
+        _start {start} {
+    }
+
+    /**
+     * @brief Add a timer.
+     * @param key The key of the timer, which must not be pending already.
+     * @param deadline The earliest time the timer expires.
+     * @param value The value of the timer.
+     */
+    void insert(Key key, time_point deadline, T value) {
+      auto &bucket = _buckets[overflow];
+      bucket.push_back({key, deadline, std::move(value)});
+
+      _index.insert_or_assign(key, location_t {overflow, std::prev(std::end(bucket))});
+      place(key);
+    }
+
+    /**
+     * @brief Change the deadline of a pending timer.
+     * @param key The key of the timer.
+     * @param deadline The new deadline.
+     * @return false if the timer isn't pending.
+     */
+    bool reschedule(Key key, time_point deadline) {
+      auto it = _index.find(key);
+      if (it == std::end(_index)) {
+        return false;
+      }
+
+      it->second.entry->deadline = deadline;
+      place(key);
+      return true;
+    }
+
+    /**
+     * @brief Remove a pending timer.
+     * @param key The key of the timer.
+     * @return The deadline and the value of the timer, or std::nullopt if it isn't pending.
+     */
+    std::optional<std::pair<time_point, T>> erase(Key key) {
+      auto it = _index.find(key);
+      if (it == std::end(_index)) {
+        return std::nullopt;
+      }
+
+      auto [bucket, entry] = it->second;
+      std::pair<time_point, T> result {entry->deadline, std::move(entry->value)};
+
+      _buckets[bucket].erase(entry);
+      _index.erase(it);
+
+      return result;
+    }
+
+    /**
+     * @brief Remove a timer that expired.
+     * @param now The current time.
+     * @return The deadline and the value of the timer, or std::nullopt if none expired.
+     */
+    std::optional<std::pair<time_point, T>> pop(time_point now) {
+      if (!ready(now)) {
+        return std::nullopt;
+      }
+
+      return erase(_buckets[due].front().key);
+    }
+
+    /**
+     * @param now The current time.
+     * @return true if a timer expired.
+     */
+    bool ready(time_point now) {
+      advance(now);
+
+      return !_buckets[due].empty();
+    }
+
+    /**
+     * @brief Get the time to wait until before checking for expired timers again.
+     * @details This may be earlier than any deadline when a bucket of a coarser level is to be redistributed.
+     * @return The time, or std::nullopt if there are no timers.
+     */
+    std::optional<time_point> next() const {
+      if (_index.empty()) {
+        return std::nullopt;
+      }
+
+      if (!_buckets[due].empty()) {
+        return _buckets[due].front().deadline;
+      }
+
+      auto earliest = std::numeric_limits<std::uint64_t>::max();
+      for (int level = 0; level < levels; ++level) {
+        auto shift = level * slot_bits;
+        auto current = _tick >> shift;
+
+        for (std::uint64_t x = 1; x <= slots; ++x) {
+          if (!_buckets[bucket_of(level, (current + x) % slots)].empty()) {
+            earliest = std::min(earliest, (current + x) << shift);
+            break;
+          }
+        }
+      }
+
+      if (!_buckets[overflow].empty()) {
+        auto shift = levels * slot_bits;
+        earliest = std::min(earliest, ((_tick >> shift) + 1) << shift);
+      }
+
+      return _start + tick * earliest;
+    }
+
+    std::size_t size() const {
+      return _index.size();
+    }
+
+    bool empty() const {
+      return _index.empty();
+    }
+
+  private:
+    struct entry_t {
+      Key key;
+      time_point deadline;
+      T value;
+    };
+
+    using bucket_t = std::list<entry_t>;
+
+    // The buckets of every level, followed by those for expired and far away timers
+    static constexpr int due = levels * slots;
+    static constexpr int overflow = due + 1;
+
+    struct location_t {
+      int bucket;
+      typename bucket_t::iterator entry;
+    };
+
+    static constexpr int bucket_of(int level, std::uint64_t slot) {
+      return level * slots + (int) slot;
+    }
+
+    /**
+     * @brief The tick from which a deadline has passed.
+     */
+    std::uint64_t tick_of(time_point deadline) const {
+      if (deadline <= _start) {
+        return 0;
+      }
+
+      // Rounded up, so a timer never expires early
+      return (std::uint64_t) ((deadline - _start + tick - clock::duration(1)) / tick);
+    }
+
+    /**
+     * @brief Move a timer into the bucket matching its deadline.
+     */
+    void place(Key key) {
+      auto &location = _index.at(key);
+      auto deadline_tick = tick_of(location.entry->deadline);
+
+      int bucket = overflow;
+      if (deadline_tick <= _tick) {
+        bucket = due;
+      } else {
+        auto delta = deadline_tick - _tick;
+        for (int level = 0; level < levels; ++level) {
+          if (delta < (std::uint64_t) 1 << ((level + 1) * slot_bits)) {
+            bucket = bucket_of(level, (deadline_tick >> (level * slot_bits)) % slots);
+            break;
+          }
+        }
+      }
+
+      _buckets[bucket].splice(std::end(_buckets[bucket]), _buckets[location.bucket], location.entry);
+      location.bucket = bucket;
+    }
+
+    /**
+     * @brief Redistribute the timers of a bucket.
+     */
+    void cascade(int bucket) {
+      // Timers may land in this very bucket again, so only the ones in it now are moved
+      for (auto count = _buckets[bucket].size(); count > 0; --count) {
+        place(_buckets[bucket].front().key);
+      }
+    }
+
+    /**
+     * @brief Advance the wheel up to the current time, expiring timers on the way.
+     */
+    void advance(time_point now) {
+      auto now_tick = now <= _start ? 0 : (std::uint64_t) ((now - _start) / tick);
+
+      while (_tick < now_tick) {
+        // Nothing to expire on the way
+        if (_index.size() == _buckets[due].size()) {
+          _tick = now_tick;
+          return;
+        }
+
+        ++_tick;
+
+        // The coarsest level whose bucket is up goes first, its timers may land in the finer levels
+        int top = 0;
+        while (top < levels && (_tick & (((std::uint64_t) 1 << ((top + 1) * slot_bits)) - 1)) == 0) {
+          ++top;
+        }
+
+        if (top == levels) {
+          cascade(overflow);
+          top = levels - 1;
+        }
+
+        for (int level = top; level > 0; --level) {
+          cascade(bucket_of(level, (_tick >> (level * slot_bits)) % slots));
+        }
+
+        auto &expired = _buckets[bucket_of(0, _tick % slots)];
+        while (!expired.empty()) {
+          auto key = expired.front().key;
+          _buckets[due].splice(std::end(_buckets[due]), expired, std::begin(expired));
+          _index.at(key).bucket = due;
+        }
+      }
+    }
+
+    time_point _start;
+    std::uint64_t _tick {};
+
+    std::array<bucket_t, overflow + 1> _buckets;
+    std::unordered_map<Key, location_t> _index;
+  };
+}  // namespace task_pool_util
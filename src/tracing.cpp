@@ -0,0 +1,133 @@
+/**
+ * @file src/tracing.cpp
+ * @brief Definitions for tracing the scopes of the streaming threads, in builds with SUNSHINE_ENABLE_TRACING.
+ */
+#ifdef SUNSHINE_TRACING
+
+  // standard includes
+  #include <fstream>
+  #include <iomanip>
+  #include <memory>
+  #include <mutex>
+  #include <vector>
+
+  // local includes
+  #include "logging.h"
+  #include "tracing.h"
+
+using namespace std::literals;
+
+namespace tracing {
+  namespace {
+    // About 24 MB of scopes per thread, a few minutes of a stream at 120 fps
+    constexpr std::size_t max_events_per_thread = 1 << 20;
+
+    struct event_t {
+      const char *name;
+      std::chrono::steady_clock::time_point start;
+      std::chrono::nanoseconds duration;
+      std::uint64_t flow;
+    };
+
+    /**
+     * @brief The latest scopes of one thread, kept after the thread ends.
+     */
+    struct thread_events_t {
+      std::mutex mutex;
+      std::uint64_t tid;
+      std::vector<event_t> events;
+      std::size_t next = 0;  ///< Where the next scope goes once the buffer wraps around.
+    };
+
+    std::mutex threads_mutex;
+    std::vector<std::shared_ptr<thread_events_t>> threads;
+    const auto epoch = std::chrono::steady_clock::now();
+
+    thread_events_t &current_thread() {
+      thread_local std::shared_ptr<thread_events_t> current = []() {
+        auto thread = std::make_shared<thread_events_t>();
+
+        std::lock_guard lg {threads_mutex};
+        thread->tid = threads.size() + 1;
+        threads.emplace_back(thread);
+        return thread;
+      }();
+
+      return *current;
+    }
+
+    double to_us(std::chrono::nanoseconds duration) {
+      return std::chrono::duration<double, std::micro> {duration}.count();
+    }
+  }  // namespace
+
+  std::uint64_t frame_flow(const void *session, std::int64_t frame_index) {
+    auto flow = (std::uint64_t) (std::uintptr_t) session * 0x9E3779B97F4A7C15ull ^ (std::uint64_t) frame_index;
+    return flow ? flow : 1;
+  }
+
+  scope_t::scope_t(const char *name, std::uint64_t flow) noexcept:
+      _name {name},
+      _flow {flow},
+      _start {std::chrono::steady_clock::now()} {
+  }
+
+  scope_t::~scope_t() {
+    event_t event {_name, _start, std::chrono::steady_clock::now() - _start, _flow};
+
+    auto &thread = current_thread();
+    std::lock_guard lg {thread.mutex};
+    if (thread.events.size() < max_events_per_thread) {
+      thread.events.emplace_back(event);
+      return;
+    }
+
+    thread.events[thread.next] = event;
+    thread.next = (thread.next + 1) % max_events_per_thread;
+  }
+
+  bool save(const std::filesystem::path &file) {
+    std::ofstream out {file, std::ios::trunc};
+
+    // Microseconds with nanosecond precision, however long the stream ran
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first = true;
+    std::size_t count = 0;
+
+    std::lock_guard threads_lg {threads_mutex};
+    for (auto &thread : threads) {
+      std::lock_guard lg {thread->mutex};
+
+      // The oldest scope is where the next one goes
+      for (std::size_t x = 0; x < thread->events.size(); ++x) {
+        auto &event = thread->events[(thread->next + x) % thread->events.size()];
+
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->tid
+            << ",\"ts\":" << to_us(event.start - epoch) << ",\"dur\":" << to_us(event.duration);
+        if (event.flow) {
+          out << ",\"bind_id\":\"0x" << std::hex << event.flow << std::dec << "\",\"flow_in\":true,\"flow_out\":true";
+        }
+        out << '}';
+
+        first = false;
+        ++count;
+      }
+    }
+
+    out << "\n]}\n";
+    out.close();
+
+    if (!out) {
+      BOOST_LOG(error) << "Couldn't write the trace to "sv << file.string();
+      return false;
+    }
+
+    BOOST_LOG(info) << "Wrote "sv << count << " traced scopes to "sv << file.string();
+    return true;
+  }
+}  // namespace tracing
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file src/tracing.h
+ * @brief Declarations for tracing the scopes of the streaming threads, in builds with SUNSHINE_ENABLE_TRACING.
+ * @details The trace is in the Chrome JSON trace format, which Perfetto and chrome://tracing open.
+ *          Without SUNSHINE_ENABLE_TRACING, the macros expand to nothing and nothing here is compiled.
+ */
+#pragma once
+
+#ifdef SUNSHINE_TRACING
+
+// standard includes
+  #include <chrono>
+  #include <cstdint>
+  #include <filesystem>
+
+namespace tracing {
+  /**
+   * @brief Get the flow id following a frame of a session across the threads it passes through.
+   * @param session The `channel_data` of the session.
+   * @param frame_index The index of the frame.
+   */
+  std::uint64_t frame_flow(const void *session, std::int64_t frame_index);
+
+  /**
+   * @brief Records how long it's alive on the current thread.
+   */
+  class scope_t {
+  public:
+    /**
+     * @param name The name of the scope, which must outlive the trace like a string literal does.
+     * @param flow The flow id linking the scope to the scopes of the same frame on other threads, 0 for none.
+     */
+    explicit scope_t(const char *name, std::uint64_t flow = 0) noexcept;
+    ~scope_t();
+
+    scope_t(const scope_t &) = delete;
+    scope_t &operator=(const scope_t &) = delete;
+
+  private:
+    const char *_name;
+    std::uint64_t _flow;
+    std::chrono::steady_clock::time_point _start;
+  };
+
+  /**
+   * @brief Write the scopes recorded so far as a trace.
+   * @details Each thread keeps its latest scopes, the oldest ones are dropped once it has recorded too many.
+   * @param file The trace file.
+   * @return `true` if the trace was written.
+   */
+  bool save(const std::filesystem::path &file);
+}  // namespace tracing
+
+  #define TRACE_CONCAT_INNER(a, b) a##b
+  #define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+  /**
+   * @brief Trace the rest of the enclosing scope.
+   * @examples
+   * TRACE_SCOPE("fec");
+   * @examples_end
+   */
+  #define TRACE_SCOPE(name) ::tracing::scope_t TRACE_CONCAT(trace_scope_, __COUNTER__) {name}
+
+  /**
+   * @brief Trace the rest of the enclosing scope as part of a frame of a session.
+   * @examples
+   * TRACE_FRAME_SCOPE("send", packet->channel_data, packet->frame_index());
+   * @examples_end
+   */
+  #define TRACE_FRAME_SCOPE(name, session, frame_index) ::tracing::scope_t TRACE_CONCAT(trace_scope_, __COUNTER__) {name, ::tracing::frame_flow(session, frame_index)}
+#else
+  #define TRACE_SCOPE(name)
+  #define TRACE_FRAME_SCOPE(name, session, frame_index)
+#endif
@@ -3,6 +3,7 @@
  * @brief Definitions for UPnP port mapping.
  */
 // standard includes
+#include <atomic>
 #include <stddef.h>  // workaround for type_t error in miniupnpc 2.3.3, see https://github.com/miniupnp/miniupnp/commit/e263ab6f56c382e10fed31347ec68095d691a0e8
 
 // lib includes
@@ -26,6 +27,8 @@ using namespace std::literals;
 
 namespace upnp {
 
+  static std::atomic<status_e> upnp_status {status_e::disabled};
+
   struct mapping_t {
     struct {
       std::string wan;
@@ -309,11 +312,16 @@ namespace upnp {
       // Refresh UPnP rules every few minutes. They can be lost if the router reboots,
       // WAN IP address changes, or various other conditions.
       do {
+        if (!mapped) {
+          upnp_status = status_e::discovering;
+        }
+
         int err = 0;
         device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
         if (!device || err) {
           BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
           mapped = false;
+          upnp_status = status_e::failed;
           continue;
         }
 
@@ -328,6 +336,7 @@ namespace upnp {
         if (status != 1 && status != 2) {
           BOOST_LOG(error) << status_string(status);
           mapped = false;
+          upnp_status = status_e::failed;
           continue;
         }
 
@@ -353,7 +362,12 @@ namespace upnp {
 
         mapped = true;
         mapped_urls = std::move(urls);
-      } while (!shutdown_event->view(REFRESH_INTERVAL));
+        upnp_status = status_e::mapped;
+
+        // Retry sooner while no IGD answered, the gateway may still be booting
+      } while (!shutdown_event->view(mapped ? REFRESH_INTERVAL : RETRY_INTERVAL));
+
+      upnp_status = status_e::disabled;
 
       if (mapped) {
         // Unmap ports upon termination
@@ -373,4 +387,8 @@ namespace upnp {
 
     return std::make_unique<deinit_t>();
   }
+
+  status_e status() {
+    return upnp_status;
+  }
 }  // namespace upnp
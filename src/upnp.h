@@ -19,6 +19,17 @@ namespace upnp {
   constexpr auto IPv6 = 1;
   constexpr auto PORT_MAPPING_LIFETIME = 3600s;
   constexpr auto REFRESH_INTERVAL = 120s;
+  constexpr auto RETRY_INTERVAL = 10s;
+
+  /**
+   * @brief State of the port mappings.
+   */
+  enum class status_e : int {
+    disabled,  ///< UPnP is disabled
+    discovering,  ///< Looking for an IGD
+    mapped,  ///< The ports are mapped
+    failed,  ///< No IGD mapped the ports, it's retried in the background
+  };
 
   using device_t = util::safe_ptr<UPNPDev, freeUPNPDevlist>;
 
@@ -40,5 +51,16 @@ namespace upnp {
    */
   int UPNP_GetValidIGDStatus(device_t &device, urls_t *urls, IGDdatas *data, std::array<char, INET6_ADDRESS_STRLEN> &lan_addr);
 
+  /**
+   * @brief Start mapping the ports of the host on the IGD.
+   * @details Returns without waiting for the IGD, discovery and mapping run in the background.
+   * @return The mappings, which are removed when destroyed, or `nullptr` if UPnP is disabled.
+   */
   [[nodiscard]] std::unique_ptr<platf::deinit_t> start();
+
+  /**
+   * @brief Get the state of the port mappings.
+   * @return The state.
+   */
+  status_e status();
 }  // namespace upnp
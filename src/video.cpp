@@ -4,9 +4,19 @@
  */
 // standard includes
 #include <atomic>
+#include <bit>
 #include <bitset>
-#include <list>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <future>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
+#include <tuple>
+#include <typeindex>
 
 // lib includes
 #include <boost/pointer_cast.hpp>
@@ -20,15 +30,31 @@ extern "C" {
 
 // local includes
 #include "process.h"
+#include "capture_benchmark.h"
 #include "cbs.h"
 #include "config.h"
 #include "display_device.h"
+#include "dynamic_resolution.h"
+#include "encoder_benchmark.h"
+#include "encoder_budget.h"
+#include "encoder_probe_cache.h"
+#include "file_handler.h"
+#include "flight_recorder.h"
 #include "globals.h"
+#include "gpu_sampler.h"
+#include "gpu_scheduler.h"
+#include "image_pool.h"
 #include "input.h"
 #include "logging.h"
+#include "metrics.h"
 #include "nvenc/nvenc_base.h"
 #include "platform/common.h"
+#include "rgb_to_yuv.h"
+#include "screen_content.h"
+#include "sw_encoder_tuner.h"
 #include "sync.h"
+#include "thread_affinity.h"
+#include "tracing.h"
 #include "video.h"
 
 #ifdef _WIN32
@@ -130,12 +156,19 @@ namespace video {
 
   util::Either<avcodec_buffer_t, int> dxgi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
   util::Either<avcodec_buffer_t, int> vaapi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
+  util::Either<avcodec_buffer_t, int> vulkan_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
   util::Either<avcodec_buffer_t, int> cuda_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
   util::Either<avcodec_buffer_t, int> vt_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
 
   class avcodec_software_encode_device_t: public platf::avcodec_encode_device_t {
   public:
     int convert(platf::img_t &img) override {
+      // Without scaling, convert straight into the padded frame
+      if (rgb_to_yuv) {
+        rgb_to_yuv->convert(img.data, img.row_pitch, sw_frame->data, sw_frame->linesize, offsetW, offsetH);
+        return transfer();
+      }
+
       // If we need to add aspect ratio padding, we need to scale into an intermediate output buffer
       bool requires_padding = (sw_frame->width != sws_output_frame->width || sw_frame->height != sws_output_frame->height);
 
@@ -167,8 +200,14 @@ namespace video {
         }
       }
 
-      // If frame is not a software frame, it means we still need to transfer from main memory
-      // to vram memory
+      return transfer();
+    }
+
+    /**
+     * If frame is not a software frame, it means we still need to transfer from main memory
+     * to vram memory
+     */
+    int transfer() {
       if (frame->hw_frames_ctx) {
         auto status = av_hwframe_transfer_data(frame, sw_frame.get(), 0);
         if (status < 0) {
@@ -201,6 +240,10 @@ namespace video {
     void apply_colorspace() override {
       auto avcodec_colorspace = avcodec_colorspace_from_sunshine_colorspace(colorspace);
       sws_setColorspaceDetails(sws.get(), sws_getCoefficients(SWS_CS_DEFAULT), 0, sws_getCoefficients(avcodec_colorspace.software_format), avcodec_colorspace.range - 1, 0, 1 << 16, 1 << 16);
+
+      if (rgb_to_yuv) {
+        rgb_to_yuv->set_colorspace(colorspace);
+      }
     }
 
     /**
@@ -281,6 +324,14 @@ namespace video {
         return -1;
       }
 
+      // Scaling is left to swscale, and the padding must not split a chroma sample
+      if (out_width == in_width && out_height == in_height && offsetW % 2 == 0 && offsetH % 2 == 0) {
+        rgb_to_yuv = rgb_to_yuv_t::make(format, in_width, in_height, config::video.min_threads);
+        if (rgb_to_yuv) {
+          BOOST_LOG(info) << "Using "sv << rgb_to_yuv->isa() << " color conversion instead of swscale"sv;
+        }
+      }
+
       return 0;
     }
 
@@ -292,6 +343,9 @@ namespace video {
     avcodec_frame_t sws_output_frame;
     sws_t sws;
 
+    // Replaces swscale when no scaling is needed
+    std::unique_ptr<rgb_to_yuv_t> rgb_to_yuv;
+
     // Offset of input image to output frame in pixels
     int offsetW;
     int offsetH;
@@ -310,6 +364,93 @@ namespace video {
     ALWAYS_REPROBE = 1 << 9,  ///< This is an encoder of last resort and we want to aggressively probe for a better one
     YUV444_SUPPORT = 1 << 10,  ///< Encoder may support 4:4:4 chroma sampling depending on hardware
     ASYNC_TEARDOWN = 1 << 11,  ///< Encoder supports async teardown on a different thread
+    DYNAMIC_BITRATE = 1 << 12,  ///< Encoder picks up changes of the rate control limits while encoding
+    IDR_REF_FRAMES_INVALIDATION = 1 << 13,  ///< Support reference frames invalidation by encoding an IDR frame, unless one is already on its way
+    INTRA_REFRESH = 1 << 14,  ///< Encoder can heal the picture with waves of intra refresh instead of IDR frames
+  };
+
+  // How often the HDR metadata of the display is checked while encoding
+  constexpr auto hdr_metadata_poll_interval = 1s;
+
+  /**
+   * @brief Attach HDR metadata to a frame, replacing what it had.
+   * @param frame The frame.
+   * @param hdr_metadata The metadata.
+   */
+  void attach_hdr_metadata(AVFrame *frame, const SS_HDR_METADATA &hdr_metadata) {
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA);
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL);
+
+    auto mdm = av_mastering_display_metadata_create_side_data(frame);
+    if (!mdm) {
+      return;
+    }
+
+    mdm->display_primaries[0][0] = av_make_q(hdr_metadata.displayPrimaries[0].x, 50000);
+    mdm->display_primaries[0][1] = av_make_q(hdr_metadata.displayPrimaries[0].y, 50000);
+    mdm->display_primaries[1][0] = av_make_q(hdr_metadata.displayPrimaries[1].x, 50000);
+    mdm->display_primaries[1][1] = av_make_q(hdr_metadata.displayPrimaries[1].y, 50000);
+    mdm->display_primaries[2][0] = av_make_q(hdr_metadata.displayPrimaries[2].x, 50000);
+    mdm->display_primaries[2][1] = av_make_q(hdr_metadata.displayPrimaries[2].y, 50000);
+
+    mdm->white_point[0] = av_make_q(hdr_metadata.whitePoint.x, 50000);
+    mdm->white_point[1] = av_make_q(hdr_metadata.whitePoint.y, 50000);
+
+    mdm->min_luminance = av_make_q(hdr_metadata.minDisplayLuminance, 10000);
+    mdm->max_luminance = av_make_q(hdr_metadata.maxDisplayLuminance, 1);
+
+    mdm->has_luminance = hdr_metadata.maxDisplayLuminance != 0 ? 1 : 0;
+    mdm->has_primaries = hdr_metadata.displayPrimaries[0].x != 0 ? 1 : 0;
+
+    if (hdr_metadata.maxContentLightLevel != 0 || hdr_metadata.maxFrameAverageLightLevel != 0) {
+      auto clm = av_content_light_metadata_create_side_data(frame);
+      if (!clm) {
+        return;
+      }
+
+      clm->MaxCLL = hdr_metadata.maxContentLightLevel;
+      clm->MaxFALL = hdr_metadata.maxFrameAverageLightLevel;
+    }
+  }
+
+  /**
+   * @brief Notices the HDR metadata of a display changing while it stays in HDR mode, like when a game
+   *        switches its mastering metadata, so the client and encoder get it without a reinit.
+   */
+  class hdr_metadata_watch_t {
+  public:
+    /**
+     * @param metadata The metadata the client and encoder were given.
+     */
+    explicit hdr_metadata_watch_t(const SS_HDR_METADATA &metadata):
+        _metadata {metadata},
+        _next_poll {std::chrono::steady_clock::now() + hdr_metadata_poll_interval} {
+    }
+
+    /**
+     * @brief Check the metadata of the display, at most once per `hdr_metadata_poll_interval`.
+     * @param display The display.
+     * @return The new metadata, or `std::nullopt` if it didn't change.
+     */
+    std::optional<SS_HDR_METADATA> poll(platf::display_t &display) {
+      auto now = std::chrono::steady_clock::now();
+      if (now < _next_poll) {
+        return std::nullopt;
+      }
+      _next_poll = now + hdr_metadata_poll_interval;
+
+      SS_HDR_METADATA metadata;
+      if (!display.get_hdr_metadata(metadata) || std::memcmp(&metadata, &_metadata, sizeof(metadata)) == 0) {
+        return std::nullopt;
+      }
+
+      _metadata = metadata;
+      return metadata;
+    }
+
+  private:
+    SS_HDR_METADATA _metadata;
+    std::chrono::steady_clock::time_point _next_poll;
   };
 
   class avcodec_encode_session_t: public encode_session_t {
@@ -325,6 +466,8 @@ namespace video {
     avcodec_encode_session_t(avcodec_encode_session_t &&other) noexcept = default;
 
     ~avcodec_encode_session_t() {
+      stop_async_output();
+
       // Flush any remaining frames in the encoder
       if (avcodec_send_frame(avcodec_ctx.get(), nullptr) == 0) {
         packet_raw_avcodec pkt;
@@ -341,6 +484,7 @@ namespace video {
       device = std::move(other.device);
       avcodec_ctx = std::move(other.avcodec_ctx);
       replacements = std::move(other.replacements);
+      packet_pool = std::move(other.packet_pool);
       sps = std::move(other.sps);
       vps = std::move(other.vps);
 
@@ -353,10 +497,17 @@ namespace video {
       if (!device) {
         return -1;
       }
+
+      TRACE_SCOPE("convert");
       return device->convert(img);
     }
 
     void request_idr_frame() override {
+      // The waves of intra refresh heal the picture once the stream has started
+      if (intra_refresh && last_idr_frame) {
+        return;
+      }
+
       if (device && device->frame) {
         auto &frame = device->frame;
         frame->pict_type = AV_PICTURE_TYPE_I;
@@ -373,13 +524,201 @@ namespace video {
     }
 
     void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
-      BOOST_LOG(error) << "Encoder doesn't support reference frame invalidation";
+      // libavcodec doesn't let us pick the reference frames, so the client recovers with an IDR frame.
+      // An IDR frame encoded after the lost frames is already on its way, and repairs them just as well.
+      if (last_idr_frame && *last_idr_frame > last_frame) {
+        BOOST_LOG(debug) << "Frames "sv << first_frame << '-' << last_frame << " are repaired by IDR frame "sv << *last_idr_frame;
+        return;
+      }
+
+      request_idr_frame();
+    }
+
+    bool park() override {
+      stop_async_output();
+      return device && device->detach_display();
+    }
+
+    bool resume(const std::shared_ptr<platf::display_t> &display, int bitrate) override {
+      // The rate control of libavcodec encoders is fixed once they're opened
+      if (bitrate != this->bitrate || !device->attach_display(display)) {
+        return false;
+      }
+
+      // The encoder needs increasing timestamps even when the frame numbers start over
+      pts_offset = last_pts;
+      last_idr_frame.reset();
       request_idr_frame();
+
+      // The last stream may have adapted the bitrate
+      if (current_bitrate != bitrate) {
+        pending_bitrate = bitrate;
+      }
+
+      return true;
+    }
+
+    bool resize_input(int width, int height) override {
+      return device && device->resize_input(width, height);
+    }
+
+    bool set_regions_of_interest(const std::vector<region_of_interest_t> &regions) override {
+      // Handed to the encoder as side data of the next frames, encoders without support ignore it
+      regions_of_interest = regions;
+      return true;
+    }
+
+    bool set_hdr_metadata(const SS_HDR_METADATA &metadata) override {
+      // Devices converting into several frames in turn get the metadata on each of them as they come up
+      hdr_metadata = metadata;
+      hdr_metadata_frames.clear();
+      return true;
+    }
+
+    /**
+     * @brief Attach HDR metadata that changed while encoding to the frame about to be sent to the encoder.
+     */
+    void apply_hdr_metadata() {
+      auto frame = device->frame;
+      if (!hdr_metadata || std::find(std::begin(hdr_metadata_frames), std::end(hdr_metadata_frames), frame) != std::end(hdr_metadata_frames)) {
+        return;
+      }
+
+      attach_hdr_metadata(frame, *hdr_metadata);
+      hdr_metadata_frames.push_back(frame);
+    }
+
+    /**
+     * @brief Attach the regions of interest to the frame about to be sent to the encoder.
+     */
+    void apply_regions_of_interest() {
+      auto frame = device->frame;
+      av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+      if (regions_of_interest.empty()) {
+        return;
+      }
+
+      auto side_data = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, regions_of_interest.size() * sizeof(AVRegionOfInterest));
+      if (!side_data) {
+        return;
+      }
+
+      auto rois = (AVRegionOfInterest *) side_data->data;
+      for (std::size_t x = 0; x < regions_of_interest.size(); ++x) {
+        auto &rect = regions_of_interest[x].rect;
+
+        rois[x].self_size = sizeof(AVRegionOfInterest);
+        rois[x].top = rect.y;
+        rois[x].bottom = rect.y + rect.height;
+        rois[x].left = rect.x;
+        rois[x].right = rect.x + rect.width;
+
+        // The offset is relative to the QP range of the encoder
+        rois[x].qoffset = av_make_q(regions_of_interest[x].qp_offset, 51);
+      }
+    }
+
+    bool set_bitrate(int bitrate) override {
+      if (!dynamic_bitrate) {
+        return false;
+      }
+
+      // Applied right before the next frame is sent, when the encoder isn't in use by the completion thread
+      pending_bitrate = bitrate;
+      return true;
+    }
+
+    /**
+     * @brief Scale the rate control limits the encoder was opened with to the pending bitrate.
+     * @details The encoder keeps its rate control mode, and its VBV buffer stays as many frames long.
+     */
+    void apply_pending_bitrate() {
+      if (!pending_bitrate) {
+        return;
+      }
+
+      auto ctx = avcodec_ctx.get();
+      auto scale = [&](auto value) {
+        return (decltype(value)) ((int64_t) value * *pending_bitrate / current_bitrate);
+      };
+
+      auto vbr = ctx->bit_rate < ctx->rc_max_rate;
+      ctx->bit_rate = scale(ctx->bit_rate);
+      ctx->rc_max_rate = scale(ctx->rc_max_rate);
+      ctx->rc_min_rate = scale(ctx->rc_min_rate);
+      ctx->rc_buffer_size = scale(ctx->rc_buffer_size);
+      if (vbr && ctx->bit_rate >= ctx->rc_max_rate) {
+        ctx->bit_rate = ctx->rc_max_rate - 1;
+      }
+
+      current_bitrate = *pending_bitrate;
+      pending_bitrate.reset();
     }
 
+    /**
+     * @brief Receive the packets on a completion thread, so the next image is converted while the frame is encoded.
+     * @details The session must not be moved while the completion thread runs.
+     */
+    void start_async_output();
+
+    /**
+     * @brief Wait for the packets of the frame being encoded, then stop the completion thread.
+     */
+    void stop_async_output();
+
+    /**
+     * @brief A frame sent to the encoder, whose packets haven't been received yet.
+     */
+    struct sent_frame_t {
+      int64_t frame_nr;
+      bool idr_requested;
+      safe::mail_raw_t::queue_t<packet_t> packets;
+      void *channel_data;
+      std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+    };
+
+    struct async_output_t {
+      std::mutex lock;
+      std::condition_variable cv;
+
+      // The encoder gets the next frame once the packets of this one are received
+      std::optional<sent_frame_t> sent_frame;
+      bool stopping = false;
+      bool failed = false;
+
+      std::thread thread;
+    };
+
     avcodec_ctx_t avcodec_ctx;
     std::unique_ptr<platf::avcodec_encode_device_t> device;
 
+    // The context takes the data of its packets from the pool too
+    std::shared_ptr<av_packet_pool_t> packet_pool = std::make_shared<av_packet_pool_t>();
+
+    // Only set while the packets are received on the completion thread
+    std::unique_ptr<async_output_t> async_output;
+
+    // The bitrate the encoder was opened with, and the one it uses now
+    int bitrate = 0;
+    int current_bitrate = 0;
+    std::optional<int> pending_bitrate;
+    bool dynamic_bitrate = false;
+
+    int64_t pts_offset = 0;
+    int64_t last_pts = 0;
+
+    // The last frame sent to the encoder as an IDR frame
+    std::optional<int64_t> last_idr_frame;
+
+    // The encoder runs waves of intra refresh, see config::video_t::intra_refresh_frames
+    bool intra_refresh = false;
+
+    std::vector<region_of_interest_t> regions_of_interest;
+
+    // HDR metadata that changed while encoding, and the frames of the device it's attached to
+    std::optional<SS_HDR_METADATA> hdr_metadata;
+    std::vector<AVFrame *> hdr_metadata_frames;
+
     std::vector<packet_raw_t::replace_t> replacements;
 
     cbs::nal_t sps;
@@ -399,6 +738,8 @@ namespace video {
       if (!device) {
         return -1;
       }
+
+      TRACE_SCOPE("convert");
       return device->convert(img);
     }
 
@@ -420,16 +761,48 @@ namespace video {
       }
     }
 
-    nvenc::nvenc_encoded_frame encode_frame(uint64_t frame_index) {
+    bool park() override {
+      return device && device->nvenc && device->detach_display();
+    }
+
+    bool resume(const std::shared_ptr<platf::display_t> &display, int bitrate) override {
+      if (!device->attach_display(display) || !device->nvenc->reset_encoder(bitrate)) {
+        return false;
+      }
+
+      force_idr = true;
+      return true;
+    }
+
+    bool set_bitrate(int bitrate) override {
+      return device && device->nvenc && device->nvenc->set_bitrate(bitrate);
+    }
+
+    bool resize_input(int width, int height) override {
+      return device && device->resize_input(width, height);
+    }
+
+    bool set_regions_of_interest(const std::vector<region_of_interest_t> &regions) override {
+      return device && device->nvenc && device->nvenc->set_regions_of_interest(regions);
+    }
+
+    nvenc::nvenc_encoded_frame encode_frame(uint64_t frame_index, const nvenc::nvenc_base::subframe_callback_t &on_subframe = {}, const nvenc::nvenc_base::bitstream_copy_t &copy_bitstream = {}) {
       if (!device || !device->nvenc) {
         return {};
       }
 
-      auto result = device->nvenc->encode_frame(frame_index, force_idr);
+      auto result = device->nvenc->encode_frame(frame_index, force_idr, on_subframe, copy_bitstream);
       force_idr = false;
       return result;
     }
 
+    // Hand the slices to the network thread as they're encoded, if the encoder outputs them
+    bool subframes = false;
+
+    // Whole frames are copied out of NVENC once, into the layout the network thread sends them in
+    packet_layout_t packet_layout;
+    std::shared_ptr<frame_buffer_pool_t> buffer_pool = std::make_shared<frame_buffer_pool_t>();
+
   private:
     std::unique_ptr<platf::nvenc_encode_device_t> device;
     bool force_idr = false;
@@ -451,6 +824,7 @@ namespace video {
   struct sync_session_t {
     sync_session_ctx_t *ctx;
     std::unique_ptr<encode_session_t> session;
+    std::optional<hdr_metadata_watch_t> hdr_metadata_watch;
   };
 
   using encode_session_ctx_queue_t = safe::queue_t<sync_session_ctx_t>;
@@ -466,115 +840,587 @@ namespace video {
     std::thread capture_thread;
 
     safe::signal_t reinit_event;
-    const encoder_t *encoder_p;
+
+    // Switched by the sessions when the encoder fails, the display is reopened for the memory type of the next one
+    std::atomic<const encoder_t *> encoder_p;
     sync_util::sync_t<std::weak_ptr<platf::display_t>> display_wp;
+
+    // The display the thread is pinned to, empty to follow the display of the running app
+    std::string display_name;
   };
 
   struct capture_thread_sync_ctx_t {
     encode_session_ctx_queue_t encode_session_ctx_queue {30};
   };
 
-  int start_capture_sync(capture_thread_sync_ctx_t &ctx);
-  void end_capture_sync(capture_thread_sync_ctx_t &ctx);
-  int start_capture_async(capture_thread_async_ctx_t &ctx);
-  void end_capture_async(capture_thread_async_ctx_t &ctx);
+  /**
+   * @brief An encoder shared by the sessions that stream with the same video settings.
+   * @details One viewer runs the encoder at a time, from its own capture_async() thread,
+   *          and another one takes over when it leaves. Requests of all viewers are merged,
+   *          and every packet is handed to every viewer.
+   */
+  class shared_encoder_t {
+  public:
+    struct viewer_t {
+      void *channel_data;
+      safe::mail_raw_t::event_t<bool> idr_events;
+      safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
+      safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event;
+      safe::mail_raw_t::event_t<hdr_info_t> hdr_event;
+
+      // Subtracted from the frame numbers of the encoder, set by the first keyframe sent to the viewer
+      std::optional<int64_t> frame_index_offset;
+    };
 
-  // Keep a reference counter to ensure the capture thread only runs when other threads have a reference to the capture thread
-  auto capture_thread_async = safe::make_shared<capture_thread_async_ctx_t>(start_capture_async, end_capture_async);
-  auto capture_thread_sync = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
+    explicit shared_encoder_t(const config_t &config):
+        config {config} {
+    }
 
-#ifdef _WIN32
-  encoder_t nvenc {
-    "nvenc"sv,
-    std::make_unique<encoder_platform_formats_nvenc>(
-      platf::mem_type_e::dxgi,
-      platf::pix_fmt_e::nv12,
-      platf::pix_fmt_e::p010,
-      platf::pix_fmt_e::ayuv,
-      platf::pix_fmt_e::yuv444p16
-    ),
-    {
-      {},  // Common options
-      {},  // SDR-specific options
-      {},  // HDR-specific options
-      {},  // YUV444 SDR-specific options
-      {},  // YUV444 HDR-specific options
-      {},  // Fallback options
-      "av1_nvenc"s,
-    },
-    {
-      {},  // Common options
-      {},  // SDR-specific options
-      {},  // HDR-specific options
-      {},  // YUV444 SDR-specific options
-      {},  // YUV444 HDR-specific options
-      {},  // Fallback options
-      "hevc_nvenc"s,
-    },
-    {
-      {},  // Common options
-      {},  // SDR-specific options
-      {},  // HDR-specific options
-      {},  // YUV444 SDR-specific options
-      {},  // YUV444 HDR-specific options
-      {},  // Fallback options
-      "h264_nvenc"s,
-    },
-    PARALLEL_ENCODING | REF_FRAMES_INVALIDATION | YUV444_SUPPORT | ASYNC_TEARDOWN  // flags
-  };
-#elif !defined(__APPLE__)
-  encoder_t nvenc {
-    "nvenc"sv,
-    std::make_unique<encoder_platform_formats_avcodec>(
-  #ifdef _WIN32
-      AV_HWDEVICE_TYPE_D3D11VA,
-      AV_HWDEVICE_TYPE_NONE,
-      AV_PIX_FMT_D3D11,
-  #else
-      AV_HWDEVICE_TYPE_CUDA,
-      AV_HWDEVICE_TYPE_NONE,
-      AV_PIX_FMT_CUDA,
-  #endif
-      AV_PIX_FMT_NV12,
-      AV_PIX_FMT_P010,
-      AV_PIX_FMT_NONE,
-      AV_PIX_FMT_NONE,
-  #ifdef _WIN32
-      dxgi_init_avcodec_hardware_input_buffer
-  #else
-      cuda_init_avcodec_hardware_input_buffer
-  #endif
-    ),
-    {
-      // Common options
-      {
-        {"delay"s, 0},
-        {"forced-idr"s, 1},
-        {"zerolatency"s, 1},
-        {"surfaces"s, 1},
-        {"cbr_padding"s, false},
-        {"preset"s, &config::video.nv_legacy.preset},
-        {"tune"s, NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY},
-        {"rc"s, NV_ENC_PARAMS_RC_CBR},
-        {"multipass"s, &config::video.nv_legacy.multipass},
-        {"aq"s, &config::video.nv_legacy.aq},
-      },
-      {},  // SDR-specific options
-      {},  // HDR-specific options
-      {},  // YUV444 SDR-specific options
-      {},  // YUV444 HDR-specific options
-      {},  // Fallback options
-      "av1_nvenc"s,
-    },
-    {
-      // Common options
-      {
-        {"delay"s, 0},
-        {"forced-idr"s, 1},
-        {"zerolatency"s, 1},
-        {"surfaces"s, 1},
-        {"cbr_padding"s, false},
-        {"preset"s, &config::video.nv_legacy.preset},
+    void join(viewer_t *viewer) {
+      std::lock_guard lg {_lock};
+
+      _viewers.emplace_back(viewer);
+
+      // Catch up on the display state that was sent to the other viewers
+      if (_touch_port) {
+        viewer->touch_port_event->raise(*_touch_port);
+      }
+      if (_hdr_info) {
+        viewer->hdr_event->raise(std::make_unique<hdr_info_raw_t>(*_hdr_info));
+      }
+    }
+
+    void leave(viewer_t *viewer) {
+      std::lock_guard lg {_lock};
+
+      std::erase(_viewers, viewer);
+      if (_leader == viewer) {
+        _leader = nullptr;
+        _cv.notify_all();
+      }
+    }
+
+    /**
+     * @brief Wait for the encoder to be free, and run it from the calling viewer.
+     * @return `true` if the viewer runs the encoder.
+     */
+    bool lead(viewer_t *viewer, std::chrono::milliseconds timeout) {
+      std::unique_lock ul {_lock};
+
+      if (!_cv.wait_for(ul, timeout, [&]() {
+            return !_leader || _leader == viewer;
+          })) {
+        return false;
+      }
+
+      if (!_leader) {
+        BOOST_LOG(info) << "Session "sv << viewer->channel_data << " runs the shared encoder for "sv << _viewers.size() << " session(s)"sv;
+        _leader = viewer;
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Forward the reference frame invalidations of all viewers to the encoder.
+     * @return `true` if any viewer requested an IDR frame.
+     */
+    bool poll_requests(encode_session_t &session) {
+      std::lock_guard lg {_lock};
+
+      bool requested_idr_frame = false;
+      for (auto viewer : _viewers) {
+        while (viewer->invalidate_ref_frames_events->peek()) {
+          auto frames = viewer->invalidate_ref_frames_events->pop(0ms);
+
+          // Frames from before the first keyframe of a viewer were never sent to it
+          if (frames && viewer->frame_index_offset) {
+            session.invalidate_ref_frames(frames->first + *viewer->frame_index_offset, frames->second + *viewer->frame_index_offset);
+          }
+        }
+
+        if (viewer->idr_events->peek()) {
+          requested_idr_frame = true;
+          viewer->idr_events->pop();
+        }
+      }
+
+      return requested_idr_frame;
+    }
+
+    void publish(const input::touch_port_t &touch_port, const hdr_info_raw_t &hdr_info) {
+      std::lock_guard lg {_lock};
+
+      _touch_port = touch_port;
+      _hdr_info = hdr_info;
+      for (auto viewer : _viewers) {
+        viewer->touch_port_event->raise(touch_port);
+        viewer->hdr_event->raise(std::make_unique<hdr_info_raw_t>(hdr_info));
+      }
+    }
+
+    /**
+     * @brief Send HDR metadata that changed while encoding to every viewer.
+     * @param hdr_info The HDR state of the display.
+     */
+    void publish_hdr(const hdr_info_raw_t &hdr_info) {
+      std::lock_guard lg {_lock};
+
+      _hdr_info = hdr_info;
+      for (auto viewer : _viewers) {
+        viewer->hdr_event->raise(std::make_unique<hdr_info_raw_t>(hdr_info));
+      }
+    }
+
+    /**
+     * @brief Hand the packets that were just encoded to every viewer.
+     * @param encoded The queue the encoder raised the packets on.
+     * @param packets The queue of the packets to send.
+     */
+    void fan_out(safe::mail_raw_t::queue_t<packet_t> &encoded, safe::mail_raw_t::queue_t<packet_t> &packets) {
+      while (encoded->peek()) {
+        std::shared_ptr<packet_raw_t> packet = encoded->pop();
+
+        std::lock_guard lg {_lock};
+        for (auto viewer : _viewers) {
+          // Viewers start with a keyframe, which they see as the first frame
+          if (!viewer->frame_index_offset) {
+            if (!packet->is_idr()) {
+              continue;
+            }
+
+            viewer->frame_index_offset = packet->frame_index() - 1;
+          }
+
+          auto viewer_packet = std::make_unique<packet_raw_shared>(packet, *viewer->frame_index_offset);
+          viewer_packet->channel_data = viewer->channel_data;
+          packets->raise(std::move(viewer_packet));
+        }
+      }
+    }
+
+    const config_t config;
+
+    // Only used by the viewer that runs the encoder
+    int frame_nr = 1;
+
+  private:
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::vector<viewer_t *> _viewers;
+    viewer_t *_leader = nullptr;
+
+    // The last display state sent to the viewers
+    std::optional<input::touch_port_t> _touch_port;
+    std::optional<hdr_info_raw_t> _hdr_info;
+  };
+
+  std::mutex shared_encoders_lock;
+  std::vector<std::weak_ptr<shared_encoder_t>> shared_encoders;
+
+  /**
+   * @brief Check whether two sessions would get the same stream from an encoder.
+   */
+  bool same_encoding(const config_t &a, const config_t &b) {
+    return a.width == b.width &&
+           a.height == b.height &&
+           a.framerate == b.framerate &&
+           a.bitrate == b.bitrate &&
+           a.slicesPerFrame == b.slicesPerFrame &&
+           a.numRefFrames == b.numRefFrames &&
+           a.encoderCscMode == b.encoderCscMode &&
+           a.videoFormat == b.videoFormat &&
+           a.dynamicRange == b.dynamicRange &&
+           a.chromaSamplingType == b.chromaSamplingType &&
+           a.enableIntraRefresh == b.enableIntraRefresh &&
+           a.encodingFramerate == b.encodingFramerate &&
+           a.display_name == b.display_name;
+  }
+
+  /**
+   * @brief Add a viewer to the shared encoder for its video settings, creating it if there's none.
+   */
+  std::shared_ptr<shared_encoder_t> join_shared_encoder(const config_t &config, shared_encoder_t::viewer_t *viewer) {
+    std::lock_guard lg {shared_encoders_lock};
+
+    std::erase_if(shared_encoders, [](auto &weak) {
+      return weak.expired();
+    });
+
+    std::shared_ptr<shared_encoder_t> shared_encoder;
+    for (auto &weak : shared_encoders) {
+      auto candidate = weak.lock();
+      if (candidate && same_encoding(candidate->config, config)) {
+        shared_encoder = std::move(candidate);
+        break;
+      }
+    }
+
+    if (!shared_encoder) {
+      shared_encoder = std::make_shared<shared_encoder_t>(config);
+      shared_encoders.emplace_back(shared_encoder);
+    }
+
+    shared_encoder->join(viewer);
+    return shared_encoder;
+  }
+
+  /**
+   * @brief Destroy an encode session, on a separate thread if the encoder supports it.
+   */
+  void teardown_encode_session(const encoder_t &encoder, std::unique_ptr<encode_session_t> session) {
+    // As a workaround for NVENC hangs and to generally speed up encoder reinit,
+    // we will complete the encoder teardown in a separate thread if supported.
+    // This will move expensive processing off the encoder thread to allow us
+    // to restart encoding as soon as possible. For cases where the NVENC driver
+    // hang occurs, this thread may probably never exit, but it will allow
+    // streaming to continue without requiring a full restart of Sunshine.
+    if (session && (encoder.flags & ASYNC_TEARDOWN)) {
+      std::thread encoder_teardown_thread {[session = std::move(session)]() mutable {
+        BOOST_LOG(info) << "Starting async encoder teardown";
+        session.reset();
+        BOOST_LOG(info) << "Async encoder teardown complete";
+      }};
+      encoder_teardown_thread.detach();
+    }
+  }
+
+  /**
+   * @brief Encode sessions kept open after their stream ended.
+   * @details A session is parked without its display, and resumed by the next stream of the same
+   *          encoder with the same video settings on the same output, which then skips opening an encoder.
+   *          When the output came back in another mode, e.g. after a virtual display switched resolutions
+   *          and the capture reinitialized, a session whose device can convert images of the new size is
+   *          resumed as well. Sessions parked for longer than `encoder_pool_timeout` are destroyed.
+   */
+  class encode_session_pool_t {
+  public:
+    /**
+     * @brief Take a parked session matching a new stream, and resume it.
+     * @return The session, or `nullptr` if a new one must be made.
+     */
+    std::unique_ptr<encode_session_t> take(const encoder_t &encoder, const config_t &config, const std::shared_ptr<platf::display_t> &display) {
+      auto key = display_key(*display);
+
+      std::optional<entry_t> taken;
+      {
+        std::lock_guard lg {_lock};
+
+        auto it = std::find_if(std::begin(_entries), std::end(_entries), [&](const entry_t &entry) {
+          return entry.encoder == &encoder && same_session(entry.config, config) && entry.display == key;
+        });
+        if (it == std::end(_entries)) {
+          it = std::find_if(std::begin(_entries), std::end(_entries), [&](const entry_t &entry) {
+            return entry.encoder == &encoder && same_session(entry.config, config) && same_output(entry.display, key);
+          });
+        }
+        if (it == std::end(_entries)) {
+          return nullptr;
+        }
+
+        taken.emplace(std::move(*it));
+        _entries.erase(it);
+      }
+
+      if (taken->display != key) {
+        if (!taken->session->resize_input(display->width, display->height)) {
+          // Still good for a stream on the output in its old mode
+          std::lock_guard lg {_lock};
+          _entries.emplace_back(std::move(*taken));
+          return nullptr;
+        }
+
+        BOOST_LOG(info) << "Pooled encoder session takes images of "sv << display->width << 'x' << display->height << " now"sv;
+      }
+
+      auto session = std::move(taken->session);
+      if (!session->resume(display, config.bitrate)) {
+        BOOST_LOG(debug) << "Couldn't resume the pooled encoder session"sv;
+        teardown_encode_session(encoder, std::move(session));
+        return nullptr;
+      }
+
+      BOOST_LOG(info) << "Resumed a pooled encoder session"sv;
+      return session;
+    }
+
+    /**
+     * @brief Park the session of a stream that ended.
+     * @return The session if it can't be parked, which must then be destroyed.
+     */
+    std::unique_ptr<encode_session_t> park(const encoder_t &encoder, const config_t &config, const platf::display_t &display, std::unique_ptr<encode_session_t> session) {
+      // Over the frame memory budget, the memory is better left to the streams running
+      std::chrono::seconds timeout {config::video.encoder_pool_timeout};
+      if (timeout <= 0s || config.input_only || memory_budget::frames().over() || !session->park()) {
+        return session;
+      }
+
+      std::vector<entry_t> dropped;
+      {
+        std::lock_guard lg {_lock};
+
+        // The oldest sessions make room for the new one
+        while (_entries.size() >= max_entries) {
+          dropped.emplace_back(std::move(_entries.front()));
+          _entries.erase(std::begin(_entries));
+        }
+
+        _entries.emplace_back(entry_t {&encoder, config, display_key(display), std::chrono::steady_clock::now() + timeout, std::move(session)});
+      }
+      teardown(std::move(dropped));
+
+      task_pool.pushDelayed(&encode_session_pool_t::expire, timeout, this);
+
+      return nullptr;
+    }
+
+    /**
+     * @brief Destroy parked sessions, oldest first, until memory fits within the frame memory budget.
+     * @param bytes The number of bytes that should fit.
+     */
+    void make_room(std::size_t bytes) {
+      auto &budget = memory_budget::frames();
+
+      // The dropped sessions count until they're torn down
+      std::size_t freed = 0;
+      auto fits = [&]() {
+        return !budget.limit() || budget.used() + bytes <= budget.limit() + freed;
+      };
+
+      std::vector<entry_t> dropped;
+      {
+        std::lock_guard lg {_lock};
+
+        while (!_entries.empty() && !fits()) {
+          freed += _entries.front().session->memory.bytes();
+          dropped.emplace_back(std::move(_entries.front()));
+          _entries.erase(std::begin(_entries));
+        }
+      }
+
+      if (!dropped.empty()) {
+        BOOST_LOG(info) << "Destroying "sv << dropped.size() << " pooled encoder session(s) to stay within the frame memory budget"sv;
+      }
+      teardown(std::move(dropped));
+    }
+
+    /**
+     * @brief Destroy all parked sessions.
+     */
+    void clear() {
+      std::vector<entry_t> dropped;
+      {
+        std::lock_guard lg {_lock};
+        dropped = std::move(_entries);
+        _entries.clear();
+      }
+
+      teardown(std::move(dropped));
+    }
+
+  private:
+    // Every session holds encoder resources of the GPU
+    static constexpr std::size_t max_entries = 2;
+
+    using display_key_t = std::tuple<std::type_index, int, int, int, int, int, int, bool>;
+
+    struct entry_t {
+      const encoder_t *encoder;
+      config_t config;
+      display_key_t display;
+      std::chrono::steady_clock::time_point expiry;
+      std::unique_ptr<encode_session_t> session;
+    };
+
+    static display_key_t display_key(const platf::display_t &display) {
+      return {typeid(display), display.width, display.height, display.offset_x, display.offset_y, display.env_width, display.env_height, display.is_hdr()};
+    }
+
+    /**
+     * @brief Check whether two keys are of the same output, maybe in different modes.
+     */
+    static bool same_output(const display_key_t &a, const display_key_t &b) {
+      return std::get<0>(a) == std::get<0>(b) && std::get<3>(a) == std::get<3>(b) && std::get<4>(a) == std::get<4>(b) && std::get<7>(a) == std::get<7>(b);
+    }
+
+    /**
+     * @brief Check whether a session can be resumed with other video settings.
+     * @details The bitrate is left to `encode_session_t::resume()`.
+     */
+    static bool same_session(const config_t &a, const config_t &b) {
+      auto a_bitrate = a;
+      a_bitrate.bitrate = b.bitrate;
+      return same_encoding(a_bitrate, b) && a.quality_level == b.quality_level && a.screen_content == b.screen_content;
+    }
+
+    static void teardown(std::vector<entry_t> entries) {
+      for (auto &entry : entries) {
+        teardown_encode_session(*entry.encoder, std::move(entry.session));
+      }
+    }
+
+    void expire() {
+      std::vector<entry_t> dropped;
+      {
+        std::lock_guard lg {_lock};
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = std::begin(_entries); it != std::end(_entries);) {
+          if (it->expiry <= now) {
+            dropped.emplace_back(std::move(*it));
+            it = _entries.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      }
+
+      if (!dropped.empty()) {
+        BOOST_LOG(debug) << "Destroying "sv << dropped.size() << " pooled encoder session(s)"sv;
+      }
+      teardown(std::move(dropped));
+    }
+
+    std::mutex _lock;
+    std::vector<entry_t> _entries;
+  };
+
+  encode_session_pool_t encode_session_pool;
+
+  int start_capture_sync(capture_thread_sync_ctx_t &ctx);
+  void end_capture_sync(capture_thread_sync_ctx_t &ctx);
+  int start_capture_async(capture_thread_async_ctx_t &ctx);
+  void end_capture_async(capture_thread_async_ctx_t &ctx);
+
+  using capture_thread_async_t = safe::shared_t<capture_thread_async_ctx_t>;
+
+  // Keep a reference counter to ensure a capture thread only runs when other threads have a reference to the capture thread.
+  // Entries are never erased, references point into them, an idle one costs no more than its name.
+  std::mutex capture_threads_async_lock;
+  std::map<std::string, std::unique_ptr<capture_thread_async_t>> capture_threads_async;
+
+  /**
+   * @brief Get a reference to the capture thread of a display, starting it if nobody captures the display yet.
+   * @param display_name The display to capture, empty for the display of the running app.
+   */
+  capture_thread_async_t::ptr_t capture_thread_async(const std::string &display_name) {
+    std::lock_guard lg {capture_threads_async_lock};
+
+    auto &capture_thread = capture_threads_async[display_name];
+    if (!capture_thread) {
+      capture_thread = std::make_unique<capture_thread_async_t>([display_name](capture_thread_async_ctx_t &ctx) {
+        ctx.display_name = display_name;
+        return start_capture_async(ctx);
+      }, end_capture_async);
+    }
+
+    return capture_thread->ref();
+  }
+
+  auto capture_thread_sync = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
+
+#ifdef _WIN32
+  encoder_t nvenc {
+    "nvenc"sv,
+    std::make_unique<encoder_platform_formats_nvenc>(
+      platf::mem_type_e::dxgi,
+      platf::pix_fmt_e::nv12,
+      platf::pix_fmt_e::p010,
+      platf::pix_fmt_e::ayuv,
+      platf::pix_fmt_e::yuv444p16
+    ),
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "av1_nvenc"s,
+    },
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "hevc_nvenc"s,
+    },
+    {
+      {},  // Common options
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {},  // Fallback options
+      "h264_nvenc"s,
+    },
+    PARALLEL_ENCODING | REF_FRAMES_INVALIDATION | YUV444_SUPPORT | ASYNC_TEARDOWN | INTRA_REFRESH  // flags
+  };
+#elif !defined(__APPLE__)
+  encoder_t nvenc {
+    "nvenc"sv,
+    std::make_unique<encoder_platform_formats_avcodec>(
+  #ifdef _WIN32
+      AV_HWDEVICE_TYPE_D3D11VA,
+      AV_HWDEVICE_TYPE_NONE,
+      AV_PIX_FMT_D3D11,
+  #else
+      AV_HWDEVICE_TYPE_CUDA,
+      AV_HWDEVICE_TYPE_NONE,
+      AV_PIX_FMT_CUDA,
+  #endif
+      AV_PIX_FMT_NV12,
+      AV_PIX_FMT_P010,
+      AV_PIX_FMT_NONE,
+      AV_PIX_FMT_NONE,
+  #ifdef _WIN32
+      dxgi_init_avcodec_hardware_input_buffer
+  #else
+      cuda_init_avcodec_hardware_input_buffer
+  #endif
+    ),
+    {
+      // Common options
+      {
+        {"delay"s, 0},
+        {"forced-idr"s, 1},
+        {"zerolatency"s, 1},
+        {"surfaces"s, 1},
+        {"cbr_padding"s, false},
+        {"preset"s, &config::video.nv_legacy.preset},
+        {"tune"s, NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY},
+        {"rc"s, NV_ENC_PARAMS_RC_CBR},
+        {"multipass"s, &config::video.nv_legacy.multipass},
+        {"aq"s, &config::video.nv_legacy.aq},
+        {"tile-columns"s, [](const config_t &cfg) {
+           return std::to_string(av1_tiles(cfg).first);
+         }},
+        {"tile-rows"s, [](const config_t &cfg) {
+           return std::to_string(av1_tiles(cfg).second);
+         }},
+      },
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {
+        // Fallback options
+        {"tile-columns"s, 1},
+        {"tile-rows"s, 1},
+      },
+      "av1_nvenc"s,
+    },
+    {
+      // Common options
+      {
+        {"delay"s, 0},
+        {"forced-idr"s, 1},
+        {"zerolatency"s, 1},
+        {"surfaces"s, 1},
+        {"cbr_padding"s, false},
+        {"preset"s, &config::video.nv_legacy.preset},
         {"tune"s, NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY},
         {"rc"s, NV_ENC_PARAMS_RC_CBR},
         {"multipass"s, &config::video.nv_legacy.multipass},
@@ -617,7 +1463,7 @@ namespace video {
       {},  // Fallback options
       "h264_nvenc"s,
     },
-    PARALLEL_ENCODING
+    PARALLEL_ENCODING | DYNAMIC_BITRATE
   };
 #endif
 
@@ -642,6 +1488,12 @@ namespace video {
         {"async_depth"s, 1},
         {"low_delay_brc"s, 1},
         {"low_power"s, 1},
+        {"tile_cols"s, [](const config_t &cfg) {
+           return std::to_string(av1_tiles(cfg).first);
+         }},
+        {"tile_rows"s, [](const config_t &cfg) {
+           return std::to_string(av1_tiles(cfg).second);
+         }},
       },
       {
         // SDR-specific options
@@ -659,7 +1511,11 @@ namespace video {
         // YUV444 HDR-specific options
         {"profile"s, (int) qsv::profile_av1_e::high},
       },
-      {},  // Fallback options
+      {
+        // Fallback options
+        {"tile_cols"s, 1},
+        {"tile_rows"s, 1},
+      },
       "av1_qsv"s,
     },
     {
@@ -727,7 +1583,7 @@ namespace video {
       },
       "h264_qsv"s,
     },
-    PARALLEL_ENCODING | CBR_WITH_VBR | RELAXED_COMPLIANCE | NO_RC_BUF_LIMIT | YUV444_SUPPORT
+    PARALLEL_ENCODING | CBR_WITH_VBR | RELAXED_COMPLIANCE | NO_RC_BUF_LIMIT | YUV444_SUPPORT | DYNAMIC_BITRATE | IDR_REF_FRAMES_INVALIDATION
   };
 
   encoder_t amdvce {
@@ -853,9 +1709,13 @@ namespace video {
       // libsvtav1 takes different presets than libx264/libx265.
       // We set an infinite GOP length, use a low delay prediction structure,
       // force I frames to be key frames, and set max bitrate to default to work
-      // around a FFmpeg bug with CBR mode.
+      // around a FFmpeg bug with CBR mode. Tiles are given as powers of two.
       {
-        {"svtav1-params"s, "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0"s},
+        {"svtav1-params"s, [](const config_t &cfg) {
+           auto [columns, rows] = av1_tiles(cfg);
+           return "keyint=-1:pred-struct=1:force-key-frames=1:mbr=0:tile-columns="s + std::to_string(std::countr_zero((unsigned) columns)) +
+                  ":tile-rows="s + std::to_string(std::countr_zero((unsigned) rows));
+         }},
         {"preset"s, &config::video.sw.svtav1_preset},
       },
       {},  // SDR-specific options
@@ -877,10 +1737,15 @@ namespace video {
       // x265's Info SEI is so long that it causes the IDR picture data to be
       // kicked to the 2nd packet in the frame, breaking Moonlight's parsing logic.
       // It also looks like gop_size isn't passed on to x265, so we have to set
-      // 'keyint=-1' in the parameters ourselves.
+      // 'keyint=-1' in the parameters ourselves, or the length of a wave of intra refresh.
       {
         {"forced-idr"s, 1},
-        {"x265-params"s, "info=0:keyint=-1"s},
+        {"x265-params"s, [](const config_t &cfg) {
+           if (config::video.intra_refresh_frames > 0) {
+             return "info=0:intra-refresh=1:keyint="s + std::to_string(config::video.intra_refresh_frames);
+           }
+           return "info=0:keyint=-1"s;
+         }},
         {"preset"s, &config::video.sw.sw_preset},
         {"tune"s, &config::video.sw.sw_tune},
       },
@@ -896,6 +1761,13 @@ namespace video {
       {
         {"preset"s, &config::video.sw.sw_preset},
         {"tune"s, &config::video.sw.sw_tune},
+        // A wave of intra refresh is as long as the GOP
+        {"x264-params"s, [](const config_t &cfg) {
+           if (config::video.intra_refresh_frames > 0) {
+             return "intra-refresh=1:keyint="s + std::to_string(config::video.intra_refresh_frames);
+           }
+           return ""s;
+         }},
       },
       {},  // SDR-specific options
       {},  // HDR-specific options
@@ -904,7 +1776,7 @@ namespace video {
       {},  // Fallback options
       "libx264"s,
     },
-    H264_ONLY | PARALLEL_ENCODING | ALWAYS_REPROBE | YUV444_SUPPORT
+    H264_ONLY | PARALLEL_ENCODING | ALWAYS_REPROBE | YUV444_SUPPORT | INTRA_REFRESH
   };
 
 #ifdef __linux__
@@ -925,12 +1797,19 @@ namespace video {
       {
         {"async_depth"s, 1},
         {"idr_interval"s, std::numeric_limits<int>::max()},
+        {"tiles"s, [](const config_t &cfg) {
+           auto [columns, rows] = av1_tiles(cfg);
+           return std::to_string(columns) + "x"s + std::to_string(rows);
+         }},
       },
       {},  // SDR-specific options
       {},  // HDR-specific options
       {},  // YUV444 SDR-specific options
       {},  // YUV444 HDR-specific options
-      {},  // Fallback options
+      {
+        // Fallback options
+        {"tiles"s, "1x1"s},
+      },
       "av1_vaapi"s,
     },
     {
@@ -962,7 +1841,75 @@ namespace video {
       "h264_vaapi"s,
     },
     // RC buffer size will be set in platform code if supported
-    LIMITED_GOP_SIZE | PARALLEL_ENCODING | NO_RC_BUF_LIMIT
+    LIMITED_GOP_SIZE | PARALLEL_ENCODING | NO_RC_BUF_LIMIT | IDR_REF_FRAMES_INVALIDATION
+  };
+#endif
+
+#if defined(__linux__) && defined(SUNSHINE_BUILD_VULKAN)
+  encoder_t vulkan {
+    "vulkan"sv,
+    std::make_unique<encoder_platform_formats_avcodec>(
+      AV_HWDEVICE_TYPE_VULKAN,
+      AV_HWDEVICE_TYPE_NONE,
+      AV_PIX_FMT_VULKAN,
+      AV_PIX_FMT_NV12,
+      AV_PIX_FMT_P010,
+      AV_PIX_FMT_NONE,
+      AV_PIX_FMT_NONE,
+      vulkan_init_avcodec_hardware_input_buffer
+    ),
+    {
+      // Common options
+      {
+        {"async_depth"s, 1},
+        {"tune"s, "ull"s},
+        {"rc_mode"s, "cbr"s},
+      },
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {
+        // Fallback options
+        {"rc_mode"s, "vbr"s},
+      },
+      "av1_vulkan"s,
+    },
+    {
+      // Common options
+      {
+        {"async_depth"s, 1},
+        {"tune"s, "ull"s},
+        {"rc_mode"s, "cbr"s},
+      },
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {
+        // Fallback options
+        {"rc_mode"s, "vbr"s},
+      },
+      "hevc_vulkan"s,
+    },
+    {
+      // Common options
+      {
+        {"async_depth"s, 1},
+        {"tune"s, "ull"s},
+        {"rc_mode"s, "cbr"s},
+      },
+      {},  // SDR-specific options
+      {},  // HDR-specific options
+      {},  // YUV444 SDR-specific options
+      {},  // YUV444 HDR-specific options
+      {
+        // Fallback options
+        {"rc_mode"s, "vbr"s},
+      },
+      "h264_vulkan"s,
+    },
+    PARALLEL_ENCODING | IDR_REF_FRAMES_INVALIDATION
   };
 #endif
 
@@ -1045,6 +1992,9 @@ namespace video {
 #ifdef __linux__
     &vaapi,
 #endif
+#if defined(__linux__) && defined(SUNSHINE_BUILD_VULKAN)
+    &vulkan,
+#endif
 #ifdef __APPLE__
     &videotoolbox,
 #endif
@@ -1075,14 +2025,103 @@ namespace video {
     }
   }
 
+  /**
+   * @brief The displays a capture thread switched away from, kept open to switch back to them without recreating them.
+   * @details Some capture backends only support a single display session per device or application, which is why
+   *          no display is kept unless `config::video.standby_displays` is set.
+   */
+  class standby_displays_t {
+  public:
+    /**
+     * @brief Keep a display open, closing the one kept the longest when more than `config::video.standby_displays` are.
+     * @param display_name The name of the display.
+     * @param disp The display, or nullptr.
+     */
+    void keep(const std::string &display_name, std::shared_ptr<platf::display_t> disp) {
+      if (!disp) {
+        return;
+      }
+
+      std::erase_if(_displays, [&display_name](const auto &display) {
+        return display.first == display_name;
+      });
+      _displays.emplace(std::begin(_displays), display_name, std::move(disp));
+
+      auto capacity = (std::size_t) std::max(config::video.standby_displays, 0);
+      if (_displays.size() > capacity) {
+        _displays.erase(std::begin(_displays) + capacity, std::end(_displays));
+      }
+    }
+
+    /**
+     * @brief Take a kept display back.
+     * @param display_name The name of the display.
+     * @return The display, or nullptr if it wasn't kept.
+     */
+    std::shared_ptr<platf::display_t> take(const std::string &display_name) {
+      auto it = std::find_if(std::begin(_displays), std::end(_displays), [&display_name](const auto &display) {
+        return display.first == display_name;
+      });
+      if (it == std::end(_displays)) {
+        return nullptr;
+      }
+
+      auto disp = std::move(it->second);
+      _displays.erase(it);
+
+      BOOST_LOG(debug) << "Switching to display ["sv << display_name << "], which was kept open"sv;
+      return disp;
+    }
+
+    /**
+     * @brief Close every kept display.
+     */
+    void clear() {
+      _displays.clear();
+    }
+
+  private:
+    std::vector<std::pair<std::string, std::shared_ptr<platf::display_t>>> _displays;
+  };
+
+  /**
+   * @brief Get the names of the displays, enumerating them only if the display topology changed since last time.
+   * @param dev_type The encoder device type used for display lookup.
+   * @param reenumerate Enumerate them even if no change was reported, e.g. because capturing a display failed.
+   * @return The names of the displays.
+   */
+  std::vector<std::string> cached_display_names(platf::mem_type_e dev_type, bool reenumerate) {
+    static std::mutex lock;
+    static std::map<platf::mem_type_e, std::pair<std::uint64_t, std::vector<std::string>>> cache;
+
+    auto generation = platf::display_topology_generation();
+
+    std::lock_guard lg {lock};
+    auto it = cache.find(dev_type);
+    if (!reenumerate && it != std::end(cache) && it->second.first == generation) {
+      return it->second.second;
+    }
+
+    auto names = platf::display_names(dev_type);
+    if (names.empty()) {
+      cache.erase(dev_type);
+    } else {
+      cache[dev_type] = {generation, names};
+    }
+
+    return names;
+  }
+
   /**
    * @brief Update the list of display names before or during a stream.
    * @details This will attempt to keep `current_display_index` pointing at the same display.
    * @param dev_type The encoder device type used for display lookup.
    * @param display_names The list of display names to repopulate.
    * @param current_display_index The current display index or -1 if not yet known.
+   * @param preferred_display_name The name of the display to keep pointing at, if not empty.
+   * @param reenumerate Enumerate the displays even if the display topology is reported unchanged.
    */
-  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index, std::string &preferred_display_name) {
+  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index, std::string &preferred_display_name, bool reenumerate = false) {
     // It is possible that the output name may be empty even if it wasn't before (device disconnected) or vice-versa
     const auto output_name { display_device::map_output_name(config::video.output_name) };
     std::string current_display_name = preferred_display_name;
@@ -1094,7 +2133,7 @@ namespace video {
 
     // Refresh the display names
     auto old_display_names = std::move(display_names);
-    display_names = platf::display_names(dev_type);
+    display_names = cached_display_names(dev_type, reenumerate);
 
     // If we now have no displays, let's put the old display array back and fail
     if (display_names.empty() && !old_display_names.empty()) {
@@ -1133,19 +2172,23 @@ namespace video {
     }
   }
 
-  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index) {
+  void refresh_displays(platf::mem_type_e dev_type, std::vector<std::string> &display_names, int &current_display_index, bool reenumerate = false) {
     static std::string empty_str = "";
-    refresh_displays(dev_type, display_names, current_display_index, empty_str);
+    refresh_displays(dev_type, display_names, current_display_index, empty_str, reenumerate);
   }
 
   void captureThread(
     std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
     sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
     safe::signal_t &reinit_event,
-    const encoder_t &encoder
+    std::atomic<const encoder_t *> &encoder_p,
+    std::string pinned_display_name
   ) {
     std::vector<capture_ctx_t> capture_ctxs;
 
+    // The memory type the display captures into, which the encoder takes its images in
+    auto dev_type = encoder_p.load()->platform_formats->dev_type;
+
     auto fg = util::fail_guard([&]() {
       capture_ctx_queue->stop();
 
@@ -1153,12 +2196,16 @@ namespace video {
       for (auto &capture_ctx : capture_ctxs) {
         capture_ctx.images->stop();
       }
-      for (auto &capture_ctx : capture_ctx_queue->unsafe()) {
+      for (auto &capture_ctx : capture_ctx_queue->drain()) {
         capture_ctx.images->stop();
       }
     });
 
-    auto switch_display_event = mail::man->event<int>(mail::switch_display);
+    // Display switches only move the sessions that follow the display of the running app
+    safe::mail_raw_t::event_t<int> switch_display_event;
+    if (pinned_display_name.empty()) {
+      switch_display_event = mail::man->event<int>(mail::switch_display);
+    }
 
     // Wait for the initial capture context or a request to stop the queue
     auto initial_capture_ctx = capture_ctx_queue->pop();
@@ -1170,127 +2217,80 @@ namespace video {
     std::vector<std::string> display_names;
     int display_p = -1;
     std::shared_ptr<platf::display_t> disp;
-    if (!proc::proc.display_name.empty()) {
-      disp = platf::display(encoder.platform_formats->dev_type, proc::proc.display_name, capture_ctxs.front().config);
+    std::string display_name;
+    if (!pinned_display_name.empty()) {
+      disp = platf::display(dev_type, pinned_display_name, capture_ctxs.front().config);
+      if (!disp) {
+        BOOST_LOG(error) << "Couldn't capture display ["sv << pinned_display_name << ']';
+        return;
+      }
+      display_name = pinned_display_name;
+    } else if (!proc::proc.display_name.empty()) {
+      disp = platf::display(dev_type, proc::proc.display_name, capture_ctxs.front().config);
+      display_name = proc::proc.display_name;
     }
     if (!disp) {
       // Get all the monitor names now, rather than at boot, to
       // get the most up-to-date list available monitors
-      refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
-      disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+      refresh_displays(dev_type, display_names, display_p);
+      disp = platf::display(dev_type, display_names[display_p], capture_ctxs.front().config);
       if (disp) {
-        proc::proc.display_name = display_names[display_p];
+        proc::proc.display_name = display_name = display_names[display_p];
       } else {
         return;
       }
     }
 
+    standby_displays_t standby_displays;
+
     display_wp = disp;
 
     constexpr auto capture_buffer_size = 12;
-    std::list<std::shared_ptr<platf::img_t>> imgs(capture_buffer_size);
-
-    std::vector<std::optional<std::chrono::steady_clock::time_point>> imgs_used_timestamps;
-    const std::chrono::seconds trim_timeot = 3s;
-    auto trim_imgs = [&]() {
-      // count allocated and used within current pool
-      size_t allocated_count = 0;
-      size_t used_count = 0;
-      for (const auto &img : imgs) {
-        if (img) {
-          allocated_count += 1;
-          if (img.use_count() > 1) {
-            used_count += 1;
-          }
-        }
-      }
-
-      // remember the timestamp of currently used count
-      const auto now = std::chrono::steady_clock::now();
-      if (imgs_used_timestamps.size() <= used_count) {
-        imgs_used_timestamps.resize(used_count + 1);
-      }
-      imgs_used_timestamps[used_count] = now;
-
-      // decide whether to trim allocated unused above the currently used count
-      // based on last used timestamp and universal timeout
-      size_t trim_target = used_count;
-      for (size_t i = used_count; i < imgs_used_timestamps.size(); i++) {
-        if (imgs_used_timestamps[i] && now - *imgs_used_timestamps[i] < trim_timeot) {
-          trim_target = i;
-        }
-      }
-
-      // trim allocated unused above the newly decided trim target
-      if (allocated_count > trim_target) {
-        size_t to_trim = allocated_count - trim_target;
-        // prioritize trimming least recently used
-        for (auto it = imgs.rbegin(); it != imgs.rend(); it++) {
-          auto &img = *it;
-          if (img && img.use_count() == 1) {
-            img.reset();
-            to_trim -= 1;
-            if (to_trim == 0) {
-              break;
-            }
-          }
-        }
-        // forget timestamps that no longer relevant
-        imgs_used_timestamps.resize(trim_target + 1);
-      }
-    };
+    image_pool_t imgs {capture_buffer_size, 3s, &memory_budget::frames()};
 
     auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
+      TRACE_SCOPE("capture: wait for free image");
+
       img_out.reset();
       while (capture_ctx_queue->running()) {
-        // pick first allocated but unused
-        for (auto it = imgs.begin(); it != imgs.end(); it++) {
-          if (*it && it->use_count() == 1) {
-            img_out = *it;
-            if (it != imgs.begin()) {
-              // move image to the front of the list to prioritize its reusal
-              imgs.erase(it);
-              imgs.push_front(img_out);
-            }
-            break;
-          }
-        }
-        // otherwise pick first unallocated
-        if (!img_out) {
-          for (auto it = imgs.begin(); it != imgs.end(); it++) {
-            if (!*it) {
-              // allocate image
-              *it = disp->alloc_img();
-              img_out = *it;
-              if (it != imgs.begin()) {
-                // move image to the front of the list to prioritize its reusal
-                imgs.erase(it);
-                imgs.push_front(img_out);
-              }
-              break;
-            }
-          }
-        }
+        // Wait a bounded amount of time for an image to be returned if the pool is exhausted
+        img_out = imgs.acquire([&]() {
+          return disp->alloc_img();
+        }, 100ms);
+
         if (img_out) {
-          // trim allocated but unused portion of the pool based on timeouts
-          trim_imgs();
           img_out->frame_timestamp.reset();
+          img_out->damage.reset();
+          img_out->cursor.reset();
           return true;
-        } else {
-          // sleep and retry if image pool is full
-          std::this_thread::sleep_for(1ms);
         }
       }
       return false;
     };
 
+    // Bumped for every captured image that differs from the previous one
+    std::uint64_t content_version = 0;
+
     // Capture takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_affinity::pin_current_thread("video capture"sv);
 
     while (capture_ctx_queue->running()) {
       bool artificial_reinit = false;
 
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        TRACE_SCOPE("capture: push image");
+
+        if (frame_captured) {
+          if (!img->damage || !img->damage->empty()) {
+            ++content_version;
+          }
+          img->content_version = content_version;
+
+          auto age = img->frame_timestamp ? std::chrono::steady_clock::now() - *img->frame_timestamp : 0ns;
+          flight_recorder::record(flight_recorder::event_e::capture, nullptr, 0, (std::int64_t) content_version, age.count());
+        }
+
         KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
           if (!capture_ctx->images->running()) {
             capture_ctx = capture_ctxs.erase(capture_ctx);
@@ -1313,7 +2313,13 @@ namespace video {
           capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
         }
 
-        if (switch_display_event->peek()) {
+        if (switch_display_event && switch_display_event->peek()) {
+          artificial_reinit = true;
+          return false;
+        }
+
+        // The sessions fell back to an encoder that takes images of another memory type
+        if (encoder_p.load()->platform_formats->dev_type != dev_type) {
           artificial_reinit = true;
           return false;
         }
@@ -1323,10 +2329,12 @@ namespace video {
 
       auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
 
+      bool switching_display = false;
       if (artificial_reinit && status != platf::capture_e::error) {
         status = platf::capture_e::reinit;
 
         artificial_reinit = false;
+        switching_display = encoder_p.load()->platform_formats->dev_type == dev_type;
       }
 
       switch (status) {
@@ -1335,9 +2343,7 @@ namespace video {
             reinit_event.raise(true);
 
             // Some classes of images contain references to the display --> display won't delete unless img is deleted
-            for (auto &img : imgs) {
-              img.reset();
-            }
+            imgs.clear();
 
             // display_wp is modified in this thread only
             // Wait for the other shared_ptr's of display to be destroyed.
@@ -1363,23 +2369,55 @@ namespace video {
               std::this_thread::sleep_for(20ms);
             }
 
+            // Displays of the memory type of the previous encoder are of no use to the next one
+            dev_type = encoder_p.load()->platform_formats->dev_type;
+
+            bool retry = false;
             while (capture_ctx_queue->running()) {
+              // The display switched away from is kept open to switch back to it, while any other
+              // reinitialization may have invalidated the kept ones
+              if (switching_display) {
+                standby_displays.keep(display_name, std::move(disp));
+              } else {
+                standby_displays.clear();
+              }
+
               // Release the display before reenumerating displays, since some capture backends
               // only support a single display session per device/application.
               disp.reset();
 
-              // Refresh display names since a display removal might have caused the reinitialization
-              refresh_displays(encoder.platform_formats->dev_type, display_names, display_p, proc::proc.display_name);
+              if (!pinned_display_name.empty()) {
+                // The sessions of a pinned display can't be moved to another one, so give up once it's gone
+                auto names = platf::display_names(dev_type);
+                if (std::find(std::begin(names), std::end(names), pinned_display_name) == std::end(names)) {
+                  BOOST_LOG(error) << "Display ["sv << pinned_display_name << "] is no longer present"sv;
+                  break;
+                }
+
+                reset_display(disp, dev_type, pinned_display_name, capture_ctxs.front().config);
+                if (disp) {
+                  break;
+                }
+                continue;
+              }
+
+              // Refresh display names since a display removal might have caused the reinitialization,
+              // unless it's a display switch and no change to the displays was reported
+              refresh_displays(dev_type, display_names, display_p, proc::proc.display_name, !switching_display || retry);
+              retry = true;
 
               // Process any pending display switch with the new list of displays
-              if (switch_display_event->peek()) {
+              if (switch_display_event && switch_display_event->peek()) {
                 display_p = std::clamp(*switch_display_event->pop(), 0, (int) display_names.size() - 1);
               }
 
               // reset_display() will sleep between retries
-              reset_display(disp, encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
+              disp = standby_displays.take(display_names[display_p]);
+              if (!disp) {
+                reset_display(disp, dev_type, display_names[display_p], capture_ctxs.front().config);
+              }
               if (disp) {
-                proc::proc.display_name = display_names[display_p];
+                proc::proc.display_name = display_name = display_names[display_p];
                 break;
               }
             }
@@ -1387,43 +2425,96 @@ namespace video {
               return;
             }
 
-            display_wp = disp;
+            display_wp = disp;
+
+            reinit_event.reset();
+            continue;
+          }
+        case platf::capture_e::error:
+        case platf::capture_e::ok:
+        case platf::capture_e::timeout:
+        case platf::capture_e::interrupted:
+          return;
+        default:
+          BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+          return;
+      }
+    }
+  }
+
+  std::pair<int, int> av1_tiles(const config_t &config) {
+    // One tile keeps up with about 1080p at 120 fps on the encoders and decoders of today
+    constexpr double pixels_per_tile = 1920.0 * 1080 * 120;
+
+    // AV1 tiles are at most 4096 pixels wide and 4096x2304 pixels large
+    constexpr int max_tile_width = 4096;
+    constexpr double max_tile_area = 4096.0 * 2304;
+
+    auto width = std::max(config.width, 1);
+    auto height = std::max(config.height, 1);
+    auto pixel_rate = (double) width * height * std::max(config.framerate, 1);
+    auto tiles = std::bit_ceil((unsigned) std::clamp(std::max((int) std::ceil(pixel_rate / pixels_per_tile), config.slicesPerFrame), 1, max_av1_tiles));
+
+    int columns = 1;
+    int rows = 1;
+    while (width / columns > max_tile_width) {
+      columns *= 2;
+    }
+
+    // Split the longer side of the tiles, columns first since they also split the rows of superblocks
+    while (columns * rows < (int) tiles || (double) width / columns * height / rows > max_tile_area) {
+      if (width / columns >= height / rows) {
+        columns *= 2;
+      } else {
+        rows *= 2;
+      }
+    }
+
+    return {columns, rows};
+  }
+
+  bool is_non_reference(int video_format, std::span<const uint8_t> data) {
+    if (video_format > 1) {
+      return false;
+    }
+
+    // Walk the NAL units to the first slice, past the parameter sets and SEI
+    for (std::size_t x = 0; x + 3 < data.size(); ++x) {
+      if (data[x] != 0 || data[x + 1] != 0 || data[x + 2] != 1) {
+        continue;
+      }
 
-            reinit_event.reset();
-            continue;
-          }
-        case platf::capture_e::error:
-        case platf::capture_e::ok:
-        case platf::capture_e::timeout:
-        case platf::capture_e::interrupted:
-          return;
-        default:
-          BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
-          return;
+      auto header = data[x + 3];
+      if (video_format == 0) {
+        auto type = header & 0x1F;
+        if (type >= 1 && type <= 5) {
+          return type == 1 && (header & 0x60) == 0;
+        }
+      } else {
+        auto type = (header >> 1) & 0x3F;
+        if (type <= 31) {
+          // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved RSV_VCL_N types are even and below 16
+          return type < 16 && type % 2 == 0;
+        }
       }
+
+      x += 3;
     }
+
+    return false;
   }
 
-  int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    auto &frame = session.device->frame;
-    frame->pts = frame_nr;
+  int receive_avcodec(avcodec_encode_session_t &session, const avcodec_encode_session_t::sent_frame_t &sent_frame) {
+    auto &[frame_nr, idr_requested, packets, channel_data, frame_timestamp] = sent_frame;
 
     auto &ctx = session.avcodec_ctx;
 
     auto &sps = session.sps;
     auto &vps = session.vps;
 
-    // send the frame to the encoder
-    auto ret = avcodec_send_frame(ctx.get(), frame);
-    if (ret < 0) {
-      char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
-      BOOST_LOG(error) << "Could not send a frame for encoding: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, ret);
-
-      return -1;
-    }
-
+    int ret = 0;
     while (ret >= 0) {
-      auto packet = std::make_unique<packet_raw_avcodec>();
+      auto packet = std::make_unique<packet_raw_avcodec>(session.packet_pool);
       auto av_packet = packet.get()->av_packet;
 
       ret = avcodec_receive_packet(ctx.get(), av_packet);
@@ -1433,11 +2524,17 @@ namespace video {
         return ret;
       }
 
+      // The frame index is taken from the timestamp
+      av_packet->pts -= session.pts_offset;
+      if (av_packet->dts != AV_NOPTS_VALUE) {
+        av_packet->dts -= session.pts_offset;
+      }
+
       if (av_packet->flags & AV_PKT_FLAG_KEY) {
         BOOST_LOG(debug) << "Frame "sv << frame_nr << ": IDR Keyframe (AV_FRAME_FLAG_KEY)"sv;
       }
 
-      if ((frame->flags & AV_FRAME_FLAG_KEY) && !(av_packet->flags & AV_PKT_FLAG_KEY)) {
+      if (idr_requested && !(av_packet->flags & AV_PKT_FLAG_KEY)) {
         BOOST_LOG(error) << "Encoder did not produce IDR frame when requested!"sv;
       }
 
@@ -1470,6 +2567,7 @@ namespace video {
         packet->frame_timestamp = frame_timestamp;
       }
 
+      packet->non_reference = is_non_reference(ctx->codec_id == AV_CODEC_ID_H264 ? 0 : ctx->codec_id == AV_CODEC_ID_HEVC ? 1 : 2, {av_packet->data, (std::size_t) av_packet->size});
       packet->replacements = &session.replacements;
       packet->channel_data = channel_data;
       packets->raise(std::move(packet));
@@ -1478,9 +2576,380 @@ namespace video {
     return 0;
   }
 
+  int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+    auto async_output = session.async_output.get();
+
+    // Only one frame is in the encoder at a time, so this waits for the packets of the previous one
+    std::unique_lock<std::mutex> ul;
+    if (async_output) {
+      ul = std::unique_lock {async_output->lock};
+      async_output->cv.wait(ul, [&]() {
+        return !async_output->sent_frame || async_output->failed;
+      });
+
+      if (async_output->failed) {
+        return -1;
+      }
+    }
+
+    session.apply_pending_bitrate();
+    session.apply_regions_of_interest();
+    session.apply_hdr_metadata();
+
+    auto &frame = session.device->frame;
+    frame->pts = frame_nr + session.pts_offset;
+    session.last_pts = frame->pts;
+
+    // send the frame to the encoder
+    auto ret = avcodec_send_frame(session.avcodec_ctx.get(), frame);
+    if (ret < 0) {
+      char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
+      BOOST_LOG(error) << "Could not send a frame for encoding: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, ret);
+
+      return -1;
+    }
+
+    avcodec_encode_session_t::sent_frame_t sent_frame {frame_nr, (frame->flags & AV_FRAME_FLAG_KEY) != 0, packets, channel_data, frame_timestamp};
+    if (sent_frame.idr_requested) {
+      session.last_idr_frame = frame_nr;
+    }
+
+    if (async_output) {
+      async_output->sent_frame = std::move(sent_frame);
+      async_output->cv.notify_all();
+
+      return 0;
+    }
+
+    return receive_avcodec(session, sent_frame);
+  }
+
+  void avcodec_encode_session_t::start_async_output() {
+    if (async_output) {
+      return;
+    }
+
+    async_output = std::make_unique<async_output_t>();
+    async_output->thread = std::thread {[this]() {
+      std::unique_lock ul {async_output->lock};
+      while (true) {
+        async_output->cv.wait(ul, [&]() {
+          return async_output->sent_frame || async_output->stopping;
+        });
+
+        // The frame that was sent last is received before stopping
+        if (!async_output->sent_frame) {
+          return;
+        }
+
+        auto sent_frame = *async_output->sent_frame;
+
+        ul.unlock();
+        auto ret = receive_avcodec(*this, sent_frame);
+        ul.lock();
+
+        if (ret) {
+          BOOST_LOG(error) << "Could not receive video packets of frame "sv << sent_frame.frame_nr;
+          async_output->failed = true;
+        }
+
+        async_output->sent_frame.reset();
+        async_output->cv.notify_all();
+      }
+    }};
+  }
+
+  void avcodec_encode_session_t::stop_async_output() {
+    if (!async_output) {
+      return;
+    }
+
+    {
+      std::lock_guard lg {async_output->lock};
+      async_output->stopping = true;
+    }
+    async_output->cv.notify_all();
+
+    async_output->thread.join();
+    async_output.reset();
+  }
+
+  void packet_raw_partial::slices_t::update(std::span<const uint8_t> frame, int slices) {
+    {
+      std::lock_guard lg {_lock};
+
+      if (frame.size() > _size) {
+        auto data = frame.subspan(_size);
+        _chunks.emplace_back(std::begin(data), std::end(data));
+        _size = frame.size();
+      }
+      _slices = slices;
+    }
+
+    _cv.notify_all();
+  }
+
+  void packet_raw_partial::slices_t::complete(std::span<const uint8_t> frame) {
+    {
+      std::lock_guard lg {_lock};
+
+      if (frame.size() > _size) {
+        auto data = frame.subspan(_size);
+        _chunks.emplace_back(std::begin(data), std::end(data));
+        _size = frame.size();
+      }
+      _complete = true;
+    }
+
+    _cv.notify_all();
+  }
+
+  void packet_raw_partial::slices_t::abort() {
+    {
+      std::lock_guard lg {_lock};
+      _aborted = true;
+    }
+
+    _cv.notify_all();
+  }
+
+  std::optional<packet_raw_partial::slices_t::taken_t> packet_raw_partial::slices_t::take(int min_slices, std::chrono::milliseconds timeout) {
+    std::unique_lock ul {_lock};
+
+    if (!_cv.wait_for(ul, timeout, [&]() {
+          return _aborted || _complete || _slices >= min_slices;
+        }) ||
+        _aborted) {
+      return std::nullopt;
+    }
+
+    taken_t taken {{}, _slices, _complete};
+    for (; _chunks_taken < _chunks.size(); ++_chunks_taken) {
+      auto &chunk = _chunks[_chunks_taken];
+      taken.data.emplace_back((const char *) chunk.data(), chunk.size());
+    }
+
+    return taken;
+  }
+
+  std::vector<uint8_t> &packet_raw_partial::slices_t::frame() {
+    std::unique_lock ul {_lock};
+
+    _cv.wait(ul, [&]() {
+      return _aborted || _complete;
+    });
+
+    if (_complete && _frame.empty()) {
+      _frame.reserve(_size);
+      for (auto &chunk : _chunks) {
+        _frame.insert(std::end(_frame), std::begin(chunk), std::end(chunk));
+      }
+    }
+
+    return _frame;
+  }
+
+  std::size_t packet_layout_t::size(std::size_t frame_size) const {
+    auto stream_size = headroom + frame_size;
+    if (!block_size) {
+      return block_header_size + stream_size;
+    }
+
+    auto blocks = (stream_size + block_size - 1) / block_size;
+    return blocks * block_header_size + stream_size;
+  }
+
+  /**
+   * @brief Call a function for every piece of a frame that lies in one block of a layout.
+   * @param layout The layout.
+   * @param frame_size The size of the frame.
+   * @param f Called with the offset of the piece in the buffer, its offset in the frame and its size.
+   */
+  template<class F>
+  static void for_each_piece(const packet_layout_t &layout, std::size_t frame_size, F &&f) {
+    if (!layout.block_size) {
+      f(layout.block_header_size + layout.headroom, 0, frame_size);
+      return;
+    }
+
+    auto stride = layout.block_header_size + layout.block_size;
+    for (std::size_t offset = 0; offset < frame_size;) {
+      auto stream_offset = layout.headroom + offset;
+      auto block_offset = stream_offset % layout.block_size;
+      auto size = std::min(layout.block_size - block_offset, frame_size - offset);
+
+      f(stream_offset / layout.block_size * stride + layout.block_header_size + block_offset, offset, size);
+      offset += size;
+    }
+  }
+
+  void packet_layout_t::copy(std::span<const uint8_t> frame, uint8_t *buffer) const {
+    for_each_piece(*this, frame.size(), [&](std::size_t buffer_offset, std::size_t frame_offset, std::size_t size) {
+      std::memcpy(buffer + buffer_offset, frame.data() + frame_offset, size);
+    });
+  }
+
+  void packet_layout_t::gather(const uint8_t *buffer, std::size_t frame_size, uint8_t *frame) const {
+    for_each_piece(*this, frame_size, [&](std::size_t buffer_offset, std::size_t frame_offset, std::size_t size) {
+      std::memcpy(frame + frame_offset, buffer + buffer_offset, size);
+    });
+  }
+
+  frame_buffer_pool_t::buffer_t frame_buffer_pool_t::take(std::size_t size) {
+    std::unique_ptr<std::vector<uint8_t>> buffer;
+    {
+      std::lock_guard lg {_lock};
+      if (!_buffers.empty()) {
+        buffer = std::move(_buffers.back());
+        _buffers.pop_back();
+      }
+    }
+
+    if (!buffer) {
+      buffer = std::make_unique<std::vector<uint8_t>>();
+    }
+
+    // Only the bytes past the size the buffer had before are initialized
+    buffer->resize(size);
+
+    auto give_back = [pool = weak_from_this()](std::vector<uint8_t> *released) {
+      std::unique_ptr<std::vector<uint8_t>> buffer {released};
+
+      if (auto self = pool.lock()) {
+        std::lock_guard lg {self->_lock};
+        if (self->_buffers.size() < max_buffers) {
+          self->_buffers.emplace_back(std::move(buffer));
+        }
+      }
+    };
+
+    return {buffer.release(), std::move(give_back)};
+  }
+
+  uint8_t *packet_raw_pooled::data() {
+    if (!layout.block_size) {
+      return buffer->data() + layout.block_header_size + layout.headroom;
+    }
+
+    std::call_once(_gathered, [this]() {
+      _frame.resize(frame_size);
+      layout.gather(buffer->data(), frame_size, _frame.data());
+    });
+
+    return _frame.data();
+  }
+
+  av_packet_pool_t::~av_packet_pool_t() {
+    for (auto packet : _packets) {
+      av_packet_free(&packet);
+    }
+
+    // Buffers still held by packets are freed once they're released
+    av_buffer_pool_uninit(&_buffers);
+  }
+
+  AVPacket *av_packet_pool_t::take() {
+    {
+      std::lock_guard lg {_lock};
+      if (!_packets.empty()) {
+        auto packet = _packets.back();
+        _packets.pop_back();
+
+        ++metrics::encoder().packets_reused;
+        return packet;
+      }
+    }
+
+    ++metrics::encoder().packets_allocated;
+    return av_packet_alloc();
+  }
+
+  void av_packet_pool_t::give_back(AVPacket *packet) {
+    // The data goes back to the buffer pool
+    av_packet_unref(packet);
+
+    std::lock_guard lg {_lock};
+    if (_packets.size() < max_packets) {
+      _packets.emplace_back(packet);
+    } else {
+      av_packet_free(&packet);
+    }
+  }
+
+  int av_packet_pool_t::get_encode_buffer(AVCodecContext *ctx, AVPacket *packet, int flags) {
+    auto pool = (av_packet_pool_t *) ctx->opaque;
+
+    if (packet->size < 0 || packet->size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE) {
+      return AVERROR(EINVAL);
+    }
+    std::size_t size = packet->size + AV_INPUT_BUFFER_PADDING_SIZE;
+
+    {
+      std::lock_guard lg {pool->_lock};
+
+      if (size > pool->_buffer_size) {
+        // Grow ahead of the frames, so a few keyframes settle the size
+        pool->_buffer_size = std::max(size, pool->_buffer_size * 2);
+
+        av_buffer_pool_uninit(&pool->_buffers);
+        pool->_buffers = av_buffer_pool_init2(pool->_buffer_size, nullptr, [](void *, std::size_t size) {
+          ++metrics::encoder().packet_buffers_allocated;
+          return av_buffer_alloc(size);
+        }, nullptr);
+      }
+
+      packet->buf = pool->_buffers ? av_buffer_pool_get(pool->_buffers) : nullptr;
+    }
+
+    if (!packet->buf) {
+      return AVERROR(ENOMEM);
+    }
+
+    packet->data = packet->buf->data;
+    std::memset(packet->data + packet->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    return 0;
+  }
+
   int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
-    auto encoded_frame = session.encode_frame(frame_nr);
-    if (encoded_frame.data.empty()) {
+    // The frame is raised with its first slices, and the network thread sends them while the rest is encoded
+    std::shared_ptr<packet_raw_partial::slices_t> slices;
+    nvenc::nvenc_base::subframe_callback_t on_subframe;
+    if (session.subframes) {
+      on_subframe = [&](const nvenc::nvenc_encoded_subframe &subframe) {
+        if (!slices) {
+          slices = std::make_shared<packet_raw_partial::slices_t>();
+
+          auto packet = std::make_unique<packet_raw_partial>(slices, frame_nr, subframe.idr, subframe.total_slices);
+          packet->channel_data = channel_data;
+          packet->after_ref_frame_invalidation = subframe.after_ref_frame_invalidation;
+          packet->intra_refresh = subframe.intra_refresh;
+          packet->non_reference = subframe.non_reference;
+          packet->frame_timestamp = frame_timestamp;
+          packets->raise(std::move(packet));
+        }
+
+        slices->update(subframe.data, subframe.slices);
+      };
+    }
+
+    frame_buffer_pool_t::buffer_t buffer;
+    std::size_t frame_size = 0;
+    nvenc::nvenc_base::bitstream_copy_t copy_bitstream;
+    if (!session.subframes) {
+      copy_bitstream = [&](std::span<const uint8_t> bitstream) {
+        buffer = session.buffer_pool->take(session.packet_layout.size(bitstream.size()));
+        session.packet_layout.copy(bitstream, buffer->data());
+        frame_size = bitstream.size();
+      };
+    }
+
+    auto encoded_frame = session.encode_frame(frame_nr, on_subframe, copy_bitstream);
+    if (buffer ? frame_size == 0 : encoded_frame.data.empty()) {
+      if (slices) {
+        slices->abort();
+      }
+
       BOOST_LOG(error) << "NvENC returned empty packet";
       return -1;
     }
@@ -1489,9 +2958,21 @@ namespace video {
       BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
     }
 
-    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
+    if (slices) {
+      slices->complete(encoded_frame.data);
+      return 0;
+    }
+
+    packet_t packet;
+    if (buffer) {
+      packet = std::make_unique<packet_raw_pooled>(std::move(buffer), session.packet_layout, frame_size, encoded_frame.frame_index, encoded_frame.idr);
+    } else {
+      packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
+    }
     packet->channel_data = channel_data;
     packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
+    packet->intra_refresh = encoded_frame.intra_refresh;
+    packet->non_reference = encoded_frame.non_reference;
     packet->frame_timestamp = frame_timestamp;
     packets->raise(std::move(packet));
 
@@ -1499,6 +2980,8 @@ namespace video {
   }
 
   int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+    TRACE_FRAME_SCOPE("encode", channel_data, frame_nr);
+
     if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
       return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp);
     } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
@@ -1508,6 +2991,162 @@ namespace video {
     return -1;
   }
 
+  /**
+   * @brief Append to the parameters an encoder library takes in a single option, like `x264-params`.
+   * @param options The options the encoder is opened with.
+   * @param key The option.
+   * @param params The parameters, separated by colons.
+   */
+  static void append_encoder_params(AVDictionary **options, const char *key, const std::string &params) {
+    auto entry = av_dict_get(*options, key, nullptr, 0);
+    auto value = entry && *entry->value ? entry->value + ":"s + params : params;
+    av_dict_set(options, key, value.c_str(), 0);
+  }
+
+  /**
+   * @brief Set the options of a software encoder the tuner chose, beyond the threads of the context.
+   * @param plan The plan of the tuner.
+   * @param codec The name of the encoder.
+   * @param options The options the encoder is opened with.
+   */
+  static void apply_sw_plan(const sw_tuner::plan_t &plan, const std::string &codec, AVDictionary **options) {
+    if (plan.preset >= 0) {
+      av_dict_set(options, "preset", std::string {sw_tuner::presets[plan.preset]}.c_str(), 0);
+    }
+
+    auto frame_threads = plan.threading == sw_tuner::threading_e::frame;
+    if (codec == "libx264"sv) {
+      // Frame threads must not hold frames back to look ahead, whichever tune is used
+      if (frame_threads) {
+        append_encoder_params(options, "x264-params", "sync-lookahead=0:rc-lookahead=0");
+      }
+    } else if (codec == "libx265"sv) {
+      // libx265 doesn't take the threads of the context
+      append_encoder_params(options, "x265-params", "pools="s + std::to_string(plan.threads) + ":frame-threads="s + std::to_string(frame_threads ? plan.threads : 1));
+    } else if (codec == "libsvtav1"sv) {
+      append_encoder_params(options, "svtav1-params", "lp="s + std::to_string(plan.threads));
+    }
+  }
+
+  // The AMF quality presets of each codec, from the best quality to the fastest
+  constexpr std::array<std::array<int, 3>, 3> amf_quality_presets {{
+    {2, 0, 1},  // H.264: quality, balanced, speed
+    {0, 5, 10},  // HEVC
+    {30, 70, 100},  // AV1
+  }};
+
+  /**
+   * @brief Get the position of the AMF quality preset of a codec in `amf_quality_presets`.
+   * @return The position, or -1 if it isn't configured or isn't one of them.
+   */
+  static int amf_quality_position(int video_format) {
+    auto &quality = video_format == 0 ? config::video.amd.amd_quality_h264 :
+                    video_format == 1 ? config::video.amd.amd_quality_hevc :
+                                        config::video.amd.amd_quality_av1;
+    auto &presets = amf_quality_presets[std::clamp(video_format, 0, 2)];
+
+    auto it = quality ? std::find(presets.begin(), presets.end(), *quality) : presets.end();
+    return it == presets.end() ? -1 : (int) (it - presets.begin());
+  }
+
+  // The fastest QSV preset, veryfast
+  constexpr int qsv_fastest_preset = 7;
+
+  /**
+   * @brief Get how many quality levels an encoder can be stepped down while its frames overrun their time.
+   * @details NVENC drops two-pass encoding, then gets a faster preset. AMF drops pre-analysis, then gets a faster
+   *          quality preset. QSV gets a faster preset. The software encoders are left to `sw_tuner::choose_plan()`.
+   *          Lookahead is never traded for speed, it holds frames back. VAAPI has no levels.
+   * @param encoder The encoder.
+   * @param config The video settings of the stream.
+   */
+  static int quality_levels(const encoder_t &encoder, const config_t &config) {
+    if (&encoder == &software) {
+      // libsvtav1 takes its own presets
+      return config::video.sw.auto_tune ? sw_tuner::max_level(config.videoFormat == 2 ? -1 : sw_tuner::preset_index(config::video.sw.sw_preset)) : 0;
+    }
+
+    if (!config::video.encoder_step_down) {
+      return 0;
+    }
+
+    if (encoder.name == "nvenc"sv) {
+      return nvenc::quality_levels(config::video.nv);
+    }
+    if (encoder.name == "amdvce"sv) {
+      auto position = amf_quality_position(config.videoFormat);
+      return (config::video.amd.amd_preanalysis.value_or(0) ? 1 : 0) + (position >= 0 ? (int) amf_quality_presets[0].size() - 1 - position : 0);
+    }
+    if (encoder.name == "quicksync"sv) {
+      return config::video.qsv.qsv_preset ? std::max(qsv_fastest_preset - *config::video.qsv.qsv_preset, 0) : 0;
+    }
+
+    return 0;
+  }
+
+  /**
+   * @brief Set the options of a hardware encoder stepped down some quality levels, see `quality_levels()`.
+   * @param encoder The encoder.
+   * @param config The video settings of the stream, with the levels to step down.
+   * @param options The options the encoder is opened with.
+   */
+  static void apply_quality_level(const encoder_t &encoder, const config_t &config, AVDictionary **options) {
+    auto level = std::min(config.quality_level, quality_levels(encoder, config));
+    if (level <= 0) {
+      return;
+    }
+
+    if (encoder.name == "nvenc"sv) {
+      auto nv = nvenc::at_quality_level(config::video.nv, level);
+      av_dict_set_int(options, "preset", nv.quality_preset + 11, 0);
+      av_dict_set_int(options, "multipass", nv.two_pass == nvenc::nvenc_two_pass::quarter_resolution ? NV_ENC_TWO_PASS_QUARTER_RESOLUTION : nv.two_pass == nvenc::nvenc_two_pass::full_resolution ? NV_ENC_TWO_PASS_FULL_RESOLUTION : NV_ENC_MULTI_PASS_DISABLED, 0);
+      return;
+    }
+
+    if (encoder.name == "amdvce"sv) {
+      if (config::video.amd.amd_preanalysis.value_or(0)) {
+        av_dict_set_int(options, "preencode", 0, 0);
+        --level;
+      }
+      if (auto position = amf_quality_position(config.videoFormat); position >= 0 && level > 0) {
+        av_dict_set_int(options, "quality", amf_quality_presets[config.videoFormat][position + level], 0);
+      }
+    } else if (encoder.name == "quicksync"sv) {
+      av_dict_set_int(options, "preset", *config::video.qsv.qsv_preset + level, 0);
+    }
+  }
+
+  /**
+   * @brief Set the options of an encoder for text and UI, when the stream is encoded with the screen content tools.
+   * @details AV1 uses its screen content tools, palette and intra block copy, where the encoder exposes them.
+   *          Otherwise the edges of text are kept sharp with less deblocking and psychovisual tuning, and without
+   *          the adaptive quantization that moves bits from detailed regions to flat ones.
+   *          HEVC SCC is a profile of its own that clients don't decode, so it isn't used.
+   * @param encoder The encoder.
+   * @param codec The name of the encoder.
+   * @param config The video settings of the stream.
+   * @param options The options the encoder is opened with.
+   */
+  static void apply_screen_content(const encoder_t &encoder, const std::string &codec, const config_t &config, AVDictionary **options) {
+    if (!config.screen_content) {
+      return;
+    }
+
+    if (codec == "libx264"sv) {
+      append_encoder_params(options, "x264-params", "deblock=-1,-1:psy=0:aq-mode=0");
+    } else if (codec == "libx265"sv) {
+      append_encoder_params(options, "x265-params", "deblock=-1,-1:psy-rd=0:psy-rdoq=0:aq-mode=0");
+    } else if (codec == "libsvtav1"sv) {
+      append_encoder_params(options, "svtav1-params", "scm=1");
+    } else if (encoder.name == "nvenc"sv) {
+      av_dict_set_int(options, "aq", 0, 0);
+    } else if (codec == "av1_amf"sv) {
+      av_dict_set_int(options, "screen_content_tools", 1, 0);
+      av_dict_set_int(options, "palette_mode", 1, 0);
+      av_dict_set_int(options, "force_integer_mv", 1, 0);
+    }
+  }
+
   std::unique_ptr<avcodec_encode_session_t> make_avcodec_encode_session(
     platf::display_t *disp,
     const encoder_t &encoder,
@@ -1558,7 +3197,25 @@ namespace video {
     // Note: If we later end up needing multiple sets of
     // fallback options, we may need to allow more retries
     // to try applying each set.
+    auto packet_pool = std::make_shared<av_packet_pool_t>();
+
+    // Software encoders are tuned to the host and the stream they encode
+    std::optional<sw_tuner::plan_t> sw_plan;
+    auto sw_level = std::min(config.quality_level, quality_levels(encoder, config));
+    if (!hardware && config::video.sw.auto_tune) {
+      static const auto host = sw_tuner::host_from_topology(platf::cpu_topology(), (int) std::thread::hardware_concurrency());
+
+      // libsvtav1 takes its own presets
+      auto preset = config.videoFormat == 2 ? -1 : sw_tuner::preset_index(config::video.sw.sw_preset);
+      sw_plan = sw_tuner::choose_plan(host, config.width, config.height, config.framerate, preset, config.slicesPerFrame, config::video.min_threads, sw_level);
+
+      BOOST_LOG(info) << "Software encoder: "sv << sw_plan->threads << (sw_plan->threading == sw_tuner::threading_e::frame ? " frame"sv : " slice"sv)
+                      << " threads, "sv << sw_plan->slices << " slices, preset "sv << (sw_plan->preset >= 0 ? sw_tuner::presets[sw_plan->preset] : config::video.sw.sw_preset)
+                      << " ("sv << host.physical_cores << " cores, "sv << host.logical_cpus << " CPUs, level "sv << sw_level << ')';
+    }
+
     avcodec_ctx_t ctx;
+    bool split_encode = false;
     for (int retries = 0; retries < 2; retries++) {
       ctx.reset(avcodec_alloc_context3(codec));
       ctx->width = config.width;
@@ -1684,7 +3341,7 @@ namespace video {
         // Clients will request for the fewest slices per frame to get the
         // most efficient encode, but we may want to provide more slices than
         // requested to ensure we have enough parallelism for good performance.
-        ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+        ctx->slices = sw_plan ? sw_plan->slices : std::max(config.slicesPerFrame, config::video.min_threads);
       }
 
       if (encoder.flags & SINGLE_SLICE_ONLY) {
@@ -1693,6 +3350,10 @@ namespace video {
 
       ctx->thread_type = FF_THREAD_SLICE;
       ctx->thread_count = ctx->slices;
+      if (sw_plan) {
+        ctx->thread_type = sw_plan->threading == sw_tuner::threading_e::frame ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+        ctx->thread_count = sw_plan->threads;
+      }
 
       AVDictionary *options {nullptr};
       auto handle_option = [&options, &config](const encoder_t::option_t &option) {
@@ -1745,6 +3406,20 @@ namespace video {
           handle_option(option);
         }
       }
+      if (sw_plan) {
+        apply_sw_plan(*sw_plan, video_format.name, &options);
+      } else if (hardware) {
+        apply_quality_level(encoder, config, &options);
+      }
+      apply_screen_content(encoder, video_format.name, config, &options);
+
+      // Only libavcodec built against Video Codec SDK 12.1 or later splits frames across the NVENC engines
+      split_encode = encoder.name == "nvenc"sv && nvenc::use_split_encode(config::video.nv, config.videoFormat, config.width, config.height, config.framerate) &&
+                     av_opt_find(ctx->priv_data, "split_encode_mode", nullptr, 0, 0);
+      if (split_encode) {
+        // NV_ENC_SPLIT_AUTO_FORCED_MODE, the driver doesn't split frames for the ultra-low latency tuning on its own
+        av_dict_set_int(&options, "split_encode_mode", 1, 0);
+      }
 
       auto bitrate = config.bitrate * 1000;
       ctx->rc_max_rate = bitrate;
@@ -1782,6 +3457,10 @@ namespace video {
       // Allow the encoding device a final opportunity to set/unset or override any options
       encode_device->init_codec_options(ctx.get(), &options);
 
+      // Encoders that support it write their packets into buffers of the pool
+      ctx->opaque = packet_pool.get();
+      ctx->get_encode_buffer = av_packet_pool_t::get_encode_buffer;
+
       if (auto status = avcodec_open2(ctx.get(), codec, &options)) {
         char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
 
@@ -1819,30 +3498,7 @@ namespace video {
     if (colorspace_is_hdr(colorspace)) {
       SS_HDR_METADATA hdr_metadata;
       if (disp->get_hdr_metadata(hdr_metadata)) {
-        auto mdm = av_mastering_display_metadata_create_side_data(frame.get());
-
-        mdm->display_primaries[0][0] = av_make_q(hdr_metadata.displayPrimaries[0].x, 50000);
-        mdm->display_primaries[0][1] = av_make_q(hdr_metadata.displayPrimaries[0].y, 50000);
-        mdm->display_primaries[1][0] = av_make_q(hdr_metadata.displayPrimaries[1].x, 50000);
-        mdm->display_primaries[1][1] = av_make_q(hdr_metadata.displayPrimaries[1].y, 50000);
-        mdm->display_primaries[2][0] = av_make_q(hdr_metadata.displayPrimaries[2].x, 50000);
-        mdm->display_primaries[2][1] = av_make_q(hdr_metadata.displayPrimaries[2].y, 50000);
-
-        mdm->white_point[0] = av_make_q(hdr_metadata.whitePoint.x, 50000);
-        mdm->white_point[1] = av_make_q(hdr_metadata.whitePoint.y, 50000);
-
-        mdm->min_luminance = av_make_q(hdr_metadata.minDisplayLuminance, 10000);
-        mdm->max_luminance = av_make_q(hdr_metadata.maxDisplayLuminance, 1);
-
-        mdm->has_luminance = hdr_metadata.maxDisplayLuminance != 0 ? 1 : 0;
-        mdm->has_primaries = hdr_metadata.displayPrimaries[0].x != 0 ? 1 : 0;
-
-        if (hdr_metadata.maxContentLightLevel != 0 || hdr_metadata.maxFrameAverageLightLevel != 0) {
-          auto clm = av_content_light_metadata_create_side_data(frame.get());
-
-          clm->MaxCLL = hdr_metadata.maxContentLightLevel;
-          clm->MaxFALL = hdr_metadata.maxFrameAverageLightLevel;
-        }
+        attach_hdr_metadata(frame.get(), hdr_metadata);
       } else {
         BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
       }
@@ -1876,6 +3532,15 @@ namespace video {
       // 0 ==> don't inject, 1 ==> inject for h264, 2 ==> inject for hevc
       config.videoFormat <= 1 ? (1 - (int) video_format[encoder_t::VUI_PARAMETERS]) * (1 + config.videoFormat) : 0
     );
+    session->packet_pool = std::move(packet_pool);
+    session->bitrate = config.bitrate;
+    session->current_bitrate = config.bitrate;
+    session->dynamic_bitrate = encoder.flags & DYNAMIC_BITRATE;
+    session->intra_refresh = (encoder.flags & INTRA_REFRESH) && config::video.intra_refresh_frames > 0 && config.videoFormat <= 1;
+    session->split_encode = split_encode;
+    if (split_encode) {
+      BOOST_LOG(info) << video_format.name << ": splitting frames across the NVENC engines"sv;
+    }
 
     return session;
   }
@@ -1885,52 +3550,75 @@ namespace video {
       return nullptr;
     }
 
-    return std::make_unique<nvenc_encode_session_t>(std::move(encode_device));
+    auto split_encode = encode_device->nvenc->split_encode();
+
+    auto session = std::make_unique<nvenc_encode_session_t>(std::move(encode_device));
+    session->packet_layout = client_config.packet_layout;
+    session->split_encode = split_encode;
+    return session;
+  }
+
+  /**
+   * @brief Estimate the memory an encoder takes for its frames.
+   * @details The frame converted into, the frame it reconstructs and its reference frames, at the bit depth
+   *          and chroma sampling of the stream. Encoders keep more for lookahead, which isn't counted.
+   */
+  std::size_t encoder_frames_bytes(const config_t &config, int width, int height) {
+    std::size_t pixel_bytes_x2 = config.chromaSamplingType == 1 ? 6 : 3;
+    if (config.dynamicRange) {
+      pixel_bytes_x2 *= 2;
+    }
+
+    auto frames = 2 + (std::size_t) std::max(config.numRefFrames, 1);
+    return (std::size_t) width * height * pixel_bytes_x2 / 2 * frames;
   }
 
   std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device) {
+    // The encoders waiting in the pool give way to the one a stream needs now
+    auto bytes = encoder_frames_bytes(config, width, height);
+    encode_session_pool.make_room(bytes);
+
+    std::unique_ptr<encode_session_t> session;
     if (dynamic_cast<platf::avcodec_encode_device_t *>(encode_device.get())) {
       auto avcodec_encode_device = boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
-      return make_avcodec_encode_session(disp, encoder, config, width, height, std::move(avcodec_encode_device));
+      session = make_avcodec_encode_session(disp, encoder, config, width, height, std::move(avcodec_encode_device));
     } else if (dynamic_cast<platf::nvenc_encode_device_t *>(encode_device.get())) {
       auto nvenc_encode_device = boost::dynamic_pointer_cast<platf::nvenc_encode_device_t>(std::move(encode_device));
-      return make_nvenc_encode_session(config, std::move(nvenc_encode_device));
+      session = make_nvenc_encode_session(config, std::move(nvenc_encode_device));
     }
 
-    return nullptr;
+    if (session) {
+      session->memory = memory_budget::frames().reserve(memory_budget::pool_e::encoder, bytes);
+    }
+
+    return session;
   }
 
-  void encode_run(
+  /**
+   * @return Whether the encoder failed, rather than the stream ending or the encoder being reopened on purpose.
+   */
+  bool encode_run(
     int &frame_nr,  // Store progress of the frame number
     safe::mail_t mail,
     img_event_t images,
     config_t config,
     std::shared_ptr<platf::display_t> disp,
-    std::unique_ptr<platf::encode_device_t> encode_device,
+    std::unique_ptr<encode_session_t> session,
     safe::signal_t &reinit_event,
     const encoder_t &encoder,
-    void *channel_data
+    void *channel_data,
+    shared_encoder_t *shared_encoder,
+    dynamic_resolution::controller_t *resolution,
+    screen_content::detector_t *screen
   ) {
-    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
-    if (!session) {
-      return;
-    }
-
-    // As a workaround for NVENC hangs and to generally speed up encoder reinit,
-    // we will complete the encoder teardown in a separate thread if supported.
-    // This will move expensive processing off the encoder thread to allow us
-    // to restart encoding as soon as possible. For cases where the NVENC driver
-    // hang occurs, this thread may probably never exit, but it will allow
-    // streaming to continue without requiring a full restart of Sunshine.
-    auto fail_guard = util::fail_guard([&encoder, &session] {
-      if (encoder.flags & ASYNC_TEARDOWN) {
-        std::thread encoder_teardown_thread {[session = std::move(session)]() mutable {
-          BOOST_LOG(info) << "Starting async encoder teardown";
-          session.reset();
-          BOOST_LOG(info) << "Async encoder teardown complete";
-        }};
-        encoder_teardown_thread.detach();
+    // Sessions that weren't interrupted by an error wait in the pool for the next stream
+    bool reusable = false;
+    auto fail_guard = util::fail_guard([&]() {
+      if (reusable) {
+        session = encode_session_pool.park(encoder, config, *disp, std::move(session));
       }
+
+      teardown_encode_session(encoder, std::move(session));
     });
 
     // set max frame time based on client-requested target framerate.
@@ -1946,6 +3634,34 @@ namespace video {
     auto packets = mail::man->queue<packet_t>(mail::video_packets);
     auto idr_events = mail->event<bool>(mail::idr);
     auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+    auto bitrate_events = mail->event<int>(mail::bitrate);
+    auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
+
+    // A shared encoder hands its packets to every viewer after they're encoded,
+    // so the slices of its frames can't be sent while the rest is encoded
+    auto encoded_packets = shared_encoder ? mail->queue<packet_t>(mail::shared_encoder_packets) : packets;
+    if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(session.get())) {
+      nvenc_session->subframes = !shared_encoder;
+    }
+
+    // The session counts toward the load of its GPU while it encodes
+    auto gpu_lease = gpu_scheduler::instance().attach(session->gpu);
+
+    // The next image is converted while the previous frame is being encoded, when the device has a surface to spare
+    bool timed = true;
+    if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(session.get())) {
+      if (!shared_encoder && avcodec_session->device->can_convert_while_encoding()) {
+        avcodec_session->start_async_output();
+      }
+      timed = !avcodec_session->async_output;
+    }
+
+    // The encoder is reopened a quality level down when its frames overrun their time, or up when it has time to spare.
+    // Only an encoder done with the frame when encode() returns can be timed, and tells the resolution controller its load.
+    std::optional<encoder_budget::monitor_t> budget;
+    if (auto max_level = quality_levels(encoder, config); timed && (max_level > 0 || resolution)) {
+      budget.emplace(config.framerate, std::min(config.quality_level, max_level), max_level);
+    }
 
     {
       // Load a dummy image into the AVFrame to ensure we have something to encode
@@ -1954,29 +3670,38 @@ namespace video {
       // in a separate scope.
       auto dummy_img = disp->alloc_img();
       if (!dummy_img || disp->dummy_img(dummy_img.get()) || session->convert(*dummy_img)) {
-        return;
+        return true;
       }
     }
 
-    if (config.input_only) {
-      BOOST_LOG(info) << "Input only session, video will not be captured."sv;
+    std::chrono::steady_clock::time_point encode_frame_timestamp;
 
-      // Encode the dummy img only once
-      if (encode(frame_nr++, *session, packets, channel_data, std::chrono::steady_clock::now())) {
-        BOOST_LOG(error) << "Could not encode dummy video packet"sv;
-        return;
-      }
+    // Content version of the image in the encode device, and when a frame was last encoded
+    std::optional<std::uint64_t> converted_content_version;
+    std::chrono::steady_clock::time_point last_encode_time;
 
-      while (true) {
-        if (shutdown_event->peek() || !images->running() || (reinit_event.peek())) {
-          return;
-        } else {
-          std::this_thread::sleep_for(300ms);
-        }
-      }
+    // How long converting the image of the next frame took, which counts toward its time
+    std::chrono::nanoseconds convert_time {};
+
+    // Duplicates encoded since the content last changed
+    int static_frame_repeats = 0;
+
+    // Share of the image of the next frame that changed, which tells static streams from moving ones
+    double changed_area = 0;
+
+    std::optional<hdr_metadata_watch_t> hdr_metadata_watch;
+    if (SS_HDR_METADATA hdr_metadata; colorspace_is_hdr(colorspace_from_client_config(config, disp->is_hdr())) && disp->get_hdr_metadata(hdr_metadata)) {
+      hdr_metadata_watch.emplace(hdr_metadata);
     }
 
-    std::chrono::steady_clock::time_point encode_frame_timestamp;
+    bool failed = false;
+
+    // Regions with text or UI, in pixels of the display
+    std::vector<platf::damage_rect_t> roi_hints;
+    for (std::size_t x = 0; x + 3 < config::video.roi_regions.size(); x += 4) {
+      auto &regions = config::video.roi_regions;
+      roi_hints.push_back({regions[x], regions[x + 1], regions[x + 2], regions[x + 3]});
+    }
 
     while (true) {
       // Break out of the encoding loop if any of the following are true:
@@ -1987,20 +3712,53 @@ namespace video {
       // If we have to reinit before we have received any captured frames, we will encode
       // the blank dummy frame just to let Moonlight know that we're alive.
       if (shutdown_event->peek() || !images->running() || (reinit_event.peek() && frame_nr > 1)) {
+        reusable = true;
         break;
       }
 
       bool requested_idr_frame = false;
 
-      while (invalidate_ref_frames_events->peek()) {
-        if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
-          session->invalidate_ref_frames(frames->first, frames->second);
+      if (shared_encoder) {
+        requested_idr_frame = shared_encoder->poll_requests(*session);
+      } else {
+        while (invalidate_ref_frames_events->peek()) {
+          if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
+            session->invalidate_ref_frames(frames->first, frames->second);
+          }
+        }
+
+        if (idr_events->peek()) {
+          requested_idr_frame = true;
+          idr_events->pop();
+          flight_recorder::record(flight_recorder::event_e::idr_request, channel_data, frame_nr, 0);
+        }
+
+        // A shared encoder keeps the bitrate of the stream it was opened for
+        if (bitrate_events->peek()) {
+          auto bitrate = bitrate_events->pop(0ms);
+          if (bitrate && resolution) {
+            resolution->set_bitrate(*bitrate);
+          }
+          if (bitrate && !session->set_bitrate(*bitrate)) {
+            BOOST_LOG(debug) << "Encoder can't change its bitrate to "sv << *bitrate << " Kbps while encoding"sv;
+          }
         }
       }
 
-      if (idr_events->peek()) {
-        requested_idr_frame = true;
-        idr_events->pop();
+      if (auto hdr_metadata = hdr_metadata_watch ? hdr_metadata_watch->poll(*disp) : std::nullopt) {
+        BOOST_LOG(info) << "HDR metadata of the display changed, max luminance: "sv << hdr_metadata->maxDisplayLuminance << " nits"sv;
+
+        hdr_info_raw_t hdr_info {true, *hdr_metadata};
+        if (shared_encoder) {
+          shared_encoder->publish_hdr(hdr_info);
+        } else {
+          hdr_event->raise(std::make_unique<hdr_info_raw_t>(hdr_info));
+        }
+
+        // The new metadata goes out with the next IDR frame
+        if (session->set_hdr_metadata(*hdr_metadata)) {
+          requested_idr_frame = true;
+        }
       }
 
       if (requested_idr_frame) {
@@ -2012,43 +3770,119 @@ namespace video {
       // Encode at a minimum FPS to avoid image quality issues with static content
       if (!requested_idr_frame || images->peek()) {
         if (auto img = images->pop(max_frametime)) {
-          frame_timestamp = img->frame_timestamp;
-          if (!frame_timestamp) {
-            frame_timestamp = std::chrono::steady_clock::now();
-          }
+          // Nothing changed since the image that was last converted, so treat it as if no
+          // new frame arrived and only repeat the previous frame to honor the minimum FPS
+          if (converted_content_version == img->content_version && !requested_idr_frame) {
+            if (std::chrono::steady_clock::now() - last_encode_time < max_frametime) {
+              continue;
+            }
+          } else {
+            frame_timestamp = img->frame_timestamp;
+            if (!frame_timestamp) {
+              frame_timestamp = std::chrono::steady_clock::now();
+            }
 
-          auto current_timestamp = *frame_timestamp;
-          auto time_diff = current_timestamp - encode_frame_timestamp;
+            auto current_timestamp = *frame_timestamp;
+            auto time_diff = current_timestamp - encode_frame_timestamp;
 
-          // If new frame comes in way too fast, just drop
-          if (time_diff < -frame_variation_threshold) {
-            continue;
-          }
+            // If new frame comes in way too fast, just drop
+            if (time_diff < -frame_variation_threshold) {
+              continue;
+            }
 
-          if (session->convert(*img)) {
-            BOOST_LOG(error) << "Could not convert image"sv;
-            break;
-          }
+            auto convert_start = std::chrono::steady_clock::now();
+            if (session->convert(*img)) {
+              BOOST_LOG(error) << "Could not convert image"sv;
+              failed = true;
+              break;
+            }
+            convert_time = std::chrono::steady_clock::now() - convert_start;
+            flight_recorder::record(flight_recorder::event_e::convert, channel_data, frame_nr, convert_time.count());
+            converted_content_version = img->content_version;
+            static_frame_repeats = 0;
+            if (screen) {
+              changed_area = screen_content::changed_area(img->damage, img->width, img->height);
+            }
 
-          if (time_diff < frame_variation_threshold) {
-            *frame_timestamp = encode_frame_timestamp;
-          } else {
-            encode_frame_timestamp = current_timestamp;
-          }
+            if (config::video.roi_qp_offset) {
+              session->set_regions_of_interest(make_regions_of_interest(img->cursor, img->damage, roi_hints, disp->width, disp->height, config.width, config.height, config::video.roi_qp_offset));
+            }
+
+            if (time_diff < frame_variation_threshold) {
+              *frame_timestamp = encode_frame_timestamp;
+            } else {
+              encode_frame_timestamp = current_timestamp;
+            }
 
-          encode_frame_timestamp += encode_frame_threshold;
+            encode_frame_timestamp += encode_frame_threshold;
+          }
         } else if (!images->running()) {
           break;
         }
       }
 
-      if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp)) {
+      // Without a timestamp this only repeats the previous frame, which the client can do without
+      // once the static content has been refined by enough duplicates
+      if (!frame_timestamp && !requested_idr_frame) {
+        if (config::video.static_frame_repeats > 0 && static_frame_repeats >= config::video.static_frame_repeats) {
+          continue;
+        }
+        ++static_frame_repeats;
+      }
+
+      auto encode_start = std::chrono::steady_clock::now();
+      if (encode(frame_nr++, *session, encoded_packets, channel_data, frame_timestamp)) {
         BOOST_LOG(error) << "Could not encode video packet"sv;
+        failed = true;
         break;
       }
+      last_encode_time = std::chrono::steady_clock::now();
+      flight_recorder::record(flight_recorder::event_e::encode, channel_data, frame_nr - 1, (last_encode_time - encode_start).count());
+      gpu_lease.frame_encoded(last_encode_time - encode_start, last_encode_time);
+      (session->split_encode ? metrics::encoder().encode_split : metrics::encoder().encode).record(last_encode_time - encode_start);
+
+      if (shared_encoder) {
+        shared_encoder->fan_out(encoded_packets, packets);
+      }
 
       session->request_normal_frame();
+
+      auto busy_time = convert_time + (last_encode_time - encode_start);
+      convert_time = {};
+      if (auto level = budget ? budget->frame_encoded(busy_time, last_encode_time) : std::nullopt) {
+        auto step_down = *level > budget->level();
+        ++(step_down ? metrics::encoder().quality_steps_down : metrics::encoder().quality_steps_up);
+        BOOST_LOG(info) << "Encoder "sv << encoder.name << (step_down ? " doesn't keep up"sv : " has time to spare"sv)
+                        << ", reopening it at quality level "sv << *level;
+
+        // The capture loop opens the encoder again, which starts with an IDR frame
+        encoder_budget::set_level(encoder.name, config.videoFormat, config.width, config.height, config.framerate, *level);
+        break;
+      }
+
+      if (auto step = resolution ? resolution->update(budget ? budget->load() : 0, budget && budget->saturated(), last_encode_time) : std::nullopt) {
+        auto step_down = *step > resolution->step();
+        ++(step_down ? metrics::encoder().resolution_steps_down : metrics::encoder().resolution_steps_up);
+
+        resolution->set_step(*step);
+        auto [width, height] = resolution->size();
+        BOOST_LOG(info) << (step_down ? "Stream is under pressure"sv : "Stream has headroom"sv) << ", reopening the encoder at "sv
+                        << width << 'x' << height << " and "sv << resolution->bitrate() << " Kbps"sv;
+
+        // The client decodes the new size from the IDR frame the encoder starts with, and scales it to its display
+        break;
+      }
+
+      if (auto active = screen ? screen->update(changed_area, last_encode_time) : std::nullopt) {
+        screen->set_active(*active);
+        BOOST_LOG(info) << (*active ? "Stream is mostly static"sv : "Stream is moving"sv) << ", reopening the encoder for "sv
+                        << (*active ? "text and UI"sv : "natural video"sv);
+        break;
+      }
+      changed_area = 0;
     }
+
+    return failed;
   }
 
   input::touch_port_t make_port(platf::display_t *display, const config_t &config) {
@@ -2127,6 +3961,13 @@ namespace video {
 
     if (result) {
       result->colorspace = colorspace;
+
+      // SDR streams of HDR displays are tone mapped, instead of clipped or washed out
+      if (config::video.hdr_tone_mapping && disp.is_hdr() && !colorspace_is_hdr(colorspace)) {
+        SS_HDR_METADATA metadata;
+        auto peak_nits = disp.get_hdr_metadata(metadata) && metadata.maxDisplayLuminance ? (float) metadata.maxDisplayLuminance : 1000.0f;
+        result->tone_mapping = {(float) config::video.sdr_white_level, peak_nits};
+      }
     }
 
     return result;
@@ -2154,6 +3995,9 @@ namespace video {
         BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
       }
     }
+    if (hdr_info->enabled) {
+      encode_session.hdr_metadata_watch.emplace(hdr_info->metadata);
+    }
     ctx.hdr_events->raise(std::move(hdr_info));
 
     auto session = make_encode_session(disp, encoder, ctx.config, img.width, img.height, std::move(encode_device));
@@ -2176,7 +4020,8 @@ namespace video {
     std::vector<std::unique_ptr<sync_session_ctx_t>> &synced_session_ctxs,
     encode_session_ctx_queue_t &encode_session_ctx_queue,
     std::vector<std::string> &display_names,
-    int &display_p
+    int &display_p,
+    standby_displays_t &standby_displays
   ) {
     const auto &encoder = *chosen_encoder;
 
@@ -2193,9 +4038,9 @@ namespace video {
       synced_session_ctxs.emplace_back(std::make_unique<sync_session_ctx_t>(std::move(*ctx)));
     }
 
-    while (encode_session_ctx_queue.running()) {
+    for (bool retry = false; encode_session_ctx_queue.running(); retry = true) {
       // Refresh display names since a display removal might have caused the reinitialization
-      refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
+      refresh_displays(encoder.platform_formats->dev_type, display_names, display_p, retry);
 
       // Process any pending display switch with the new list of displays
       if (switch_display_event->peek()) {
@@ -2203,7 +4048,10 @@ namespace video {
       }
 
       // reset_display() will sleep between retries
-      reset_display(disp, encoder.platform_formats->dev_type, display_names[display_p], synced_session_ctxs.front()->config);
+      disp = standby_displays.take(display_names[display_p]);
+      if (!disp) {
+        reset_display(disp, encoder.platform_formats->dev_type, display_names[display_p], synced_session_ctxs.front()->config);
+      }
       if (disp) {
         break;
       }
@@ -2228,6 +4076,10 @@ namespace video {
       synced_sessions.emplace_back(std::move(*synced_session));
     }
 
+    // Started once a second session joins, with a thread per session past the first
+    std::unique_ptr<thread_pool_util::ThreadPool> encode_pool;
+    std::size_t encode_workers = 0;
+
     auto ec = platf::capture_e::ok;
     while (encode_session_ctx_queue.running()) {
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
@@ -2266,34 +4118,80 @@ namespace video {
             continue;
           }
 
+          if (auto hdr_metadata = pos->hdr_metadata_watch ? pos->hdr_metadata_watch->poll(*disp) : std::nullopt) {
+            BOOST_LOG(info) << "HDR metadata of the display changed, max luminance: "sv << hdr_metadata->maxDisplayLuminance << " nits"sv;
+
+            ctx->hdr_events->raise(std::make_unique<hdr_info_raw_t>(true, *hdr_metadata));
+            if (pos->session->set_hdr_metadata(*hdr_metadata)) {
+              pos->session->request_idr_frame();
+            }
+          }
+
           if (ctx->idr_events->peek()) {
             pos->session->request_idr_frame();
             ctx->idr_events->pop();
           }
 
-          if (frame_captured && pos->session->convert(*img)) {
+          ++pos;
+        })
+
+        std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+        if (img) {
+          frame_timestamp = img->frame_timestamp;
+        }
+
+        // A session that fails is shut down, and removed before the next frame
+        auto encode_session = [&](sync_session_t &synced_session) {
+          auto ctx = synced_session.ctx;
+
+          if (frame_captured && synced_session.session->convert(*img)) {
             BOOST_LOG(error) << "Could not convert image"sv;
             ctx->shutdown_event->raise(true);
 
-            continue;
-          }
-
-          std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
-          if (img) {
-            frame_timestamp = img->frame_timestamp;
+            return;
           }
 
-          if (encode(ctx->frame_nr++, *pos->session, ctx->packets, ctx->channel_data, frame_timestamp)) {
+          if (encode(ctx->frame_nr++, *synced_session.session, ctx->packets, ctx->channel_data, frame_timestamp)) {
             BOOST_LOG(error) << "Could not encode video packet"sv;
             ctx->shutdown_event->raise(true);
 
-            continue;
+            return;
           }
 
-          pos->session->request_normal_frame();
+          synced_session.session->request_normal_frame();
+        };
+
+        // Each session past the first is converted and encoded on a worker, so no session waits
+        // for the encodes of the others, and all of them are done before the next capture
+        std::vector<std::future<void>> encodes;
+        if (synced_sessions.size() > 1) {
+          auto workers = synced_sessions.size() - 1;
+          if (workers > encode_workers) {
+            encode_pool.reset();
+            encode_pool = std::make_unique<thread_pool_util::ThreadPool>((int) workers);
+            encode_workers = workers;
+          }
 
-          ++pos;
-        })
+          encodes.reserve(workers);
+          for (auto pos = std::next(std::begin(synced_sessions)); pos != std::end(synced_sessions); ++pos) {
+            encodes.emplace_back(encode_pool->push([&encode_session, &synced_session = *pos]() {
+              // Workers run at the priority of the capture thread
+              thread_local bool prioritized = false;
+              if (!prioritized) {
+                platf::adjust_thread_priority(platf::thread_priority_e::high);
+                prioritized = true;
+              }
+
+              encode_session(synced_session);
+            }));
+          }
+        }
+
+        encode_session(synced_sessions.front());
+
+        for (auto &encoded : encodes) {
+          encoded.wait();
+        }
 
         if (switch_display_event->peek()) {
           ec = platf::capture_e::reinit;
@@ -2316,6 +4214,13 @@ namespace video {
         case platf::capture_e::ok:
         case platf::capture_e::timeout:
         case platf::capture_e::interrupted:
+          // The display switched away from is kept open to switch back to it, while any other
+          // reinitialization may have invalidated the kept ones
+          if (ec == platf::capture_e::reinit) {
+            standby_displays.keep(display_names[display_p], disp);
+          } else {
+            standby_displays.clear();
+          }
           return ec != platf::capture_e::ok ? ec : status;
       }
     }
@@ -2337,7 +4242,7 @@ namespace video {
         ctx->join_event->raise(true);
       }
 
-      for (auto &ctx : ctx.unsafe()) {
+      for (auto &ctx : ctx.drain()) {
         ctx.shutdown_event->raise(true);
         ctx.join_event->raise(true);
       }
@@ -2345,10 +4250,118 @@ namespace video {
 
     // Encoding and capture takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin_current_thread("video capture and encode"sv);
 
     std::vector<std::string> display_names;
     int display_p = -1;
-    while (encode_run_sync(synced_session_ctxs, ctx, display_names, display_p) == encode_e::reinit) {}
+    standby_displays_t standby_displays;
+    while (encode_run_sync(synced_session_ctxs, ctx, display_names, display_p, standby_displays) == encode_e::reinit) {}
+  }
+
+  /**
+   * @brief Open the encode session of a stream, on the least loaded GPU with `config::video.encoder_load_balancing`.
+   * @details A GPU that fails to open the session isn't chosen for the codec again, and the next one is tried.
+   * @return The session, or `nullptr` if it couldn't be opened.
+   */
+  std::unique_ptr<encode_session_t> open_encode_session(platf::display_t &display, const encoder_t &encoder, const config_t &config) {
+    auto &scheduler = gpu_scheduler::instance();
+    auto balanced = config::video.encoder_load_balancing && config::video.adapter_name.empty();
+
+    while (true) {
+      auto gpu = balanced ? scheduler.choose(config.videoFormat) : std::nullopt;
+
+      gpu_scheduler::placement_t placement {gpu.value_or(""s)};
+      std::unique_ptr<encode_session_t> session;
+      if (auto encode_device = make_encode_device(display, encoder, config)) {
+        session = make_encode_session(&display, encoder, config, display.width, display.height, std::move(encode_device));
+      }
+
+      // Encoders bound to the GPU of their display weren't placed
+      if (!placement.used()) {
+        return session;
+      }
+
+      if (session) {
+        for (auto &load : scheduler.loads()) {
+          BOOST_LOG(info) << (load.gpu == *gpu ? "Encoding on "sv : "Not encoding on "sv) << load.gpu << ": "sv << load.sessions
+                          << " sessions, "sv << (int) (load.utilization * 100) << "% busy"sv;
+        }
+        session->gpu = *gpu;
+        return session;
+      }
+
+      BOOST_LOG(warning) << "Couldn't open the encoder on "sv << *gpu << ", trying another GPU"sv;
+      scheduler.mark_incapable(*gpu, config.videoFormat);
+    }
+  }
+
+  encoder_recovery_t::action_e encoder_recovery_t::failed(bool open_failed, clock::time_point now) {
+    if (!_outage_start) {
+      _outage_start = now;
+    }
+
+    auto persistent = open_failed || (_last_failure && now - *_last_failure < persistent_window);
+    _last_failure = now;
+
+    if (now - *_outage_start > max_recovery) {
+      return action_e::give_up;
+    }
+
+    return persistent ? action_e::fall_back : action_e::reopen;
+  }
+
+  std::optional<encoder_recovery_t::clock::duration> encoder_recovery_t::opened(clock::time_point now) {
+    if (!_outage_start) {
+      return std::nullopt;
+    }
+
+    return now - *std::exchange(_outage_start, std::nullopt);
+  }
+
+  /**
+   * @brief Switch the streams off an encoder that failed persistently, to the next one that works for the codec.
+   * @details The next one is the first after it in the order of the probe that passes validation, which the probe
+   *          cache usually answers right away. Encoders that can't encode on a thread of their own are skipped, as
+   *          the stream keeps its capture thread. Streams that fail on an encoder another stream already moved
+   *          away from follow it.
+   * @param failed The encoder that failed.
+   * @param config The stream.
+   * @return The encoder to go on with, or `nullptr` if none is left.
+   */
+  const encoder_t *fall_back_encoder(const encoder_t *failed, const config_t &config) {
+    static std::mutex fall_back_lock;
+    std::lock_guard lg {fall_back_lock};
+
+    // The client keeps decoding the codec, bit depth and chroma sampling it negotiated
+    auto supports = [&config](const encoder_t *encoder) {
+      auto &codec = encoder->codec_from_config(config);
+      return (encoder->flags & PARALLEL_ENCODING) && codec[encoder_t::PASSED] &&
+             (!config.dynamicRange || codec[encoder_t::DYNAMIC_RANGE]) &&
+             (!config.chromaSamplingType || codec[encoder_t::YUV444]);
+    };
+
+    if (chosen_encoder != failed) {
+      return chosen_encoder && supports(chosen_encoder) ? chosen_encoder : nullptr;
+    }
+
+    auto pos = std::find(std::begin(encoders), std::end(encoders), failed);
+    if (pos == std::end(encoders)) {
+      return nullptr;
+    }
+
+    for (++pos; pos != std::end(encoders); ++pos) {
+      auto encoder = *pos;
+      if (!validate_encoder(*encoder, false) || !supports(encoder)) {
+        continue;
+      }
+
+      BOOST_LOG(warning) << "Encoder ["sv << failed->name << "] keeps failing, falling back to ["sv << encoder->name << ']';
+      chosen_encoder = encoder;
+      return encoder;
+    }
+
+    BOOST_LOG(error) << "Encoder ["sv << failed->name << "] keeps failing, and no other encoder works"sv;
+    return nullptr;
   }
 
   void capture_async(
@@ -2364,26 +4377,106 @@ namespace video {
       shutdown_event->raise(true);
     });
 
-    auto ref = capture_thread_async.ref();
+    auto ref = capture_thread_async(config.display_name);
     if (!ref) {
       return;
     }
 
-    ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
-
-    if (!ref->capture_ctx_queue->running()) {
-      return;
-    }
-
     int frame_nr = 1;
 
     auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
     auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
 
+    // Sessions with the same video settings share an encoder, and only the viewer running it captures
+    std::shared_ptr<shared_encoder_t> shared_encoder;
+    shared_encoder_t::viewer_t viewer {
+      channel_data,
+      mail->event<bool>(mail::idr),
+      mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames),
+      touch_port_event,
+      hdr_event,
+    };
+    if (config::video.shared_encoder) {
+      shared_encoder = join_shared_encoder(config, &viewer);
+    }
+    auto leave_guard = util::fail_guard([&]() {
+      if (shared_encoder) {
+        shared_encoder->leave(&viewer);
+      }
+    });
+
+    // The stream is encoded at a lower resolution than the client asked for while it's under pressure
+    std::optional<dynamic_resolution::controller_t> resolution;
+    if (config::video.dynamic_resolution) {
+      resolution.emplace(config.width, config.height, config.framerate, config.videoFormat, config.bitrate);
+    }
+
+    // Mostly static streams, like a desktop or a document, are encoded with the screen content tools,
+    // and in 4:4:4 if the client asked for it while moving ones are encoded in 4:2:0
+    auto adaptive_screen_content = config::video.screen_content == config::video_t::screen_content_e::automatic;
+    auto adaptive_chroma = config::video.adaptive_chroma && config.chromaSamplingType == 1;
+    std::optional<screen_content::detector_t> screen;
+    if (adaptive_screen_content || adaptive_chroma) {
+      screen.emplace();
+    }
+
+    bool capturing = false;
+
+    // The encoder is reopened or replaced when it fails, while capture and the session go on
+    encoder_recovery_t recovery;
+
+    // The display captured for an encoder that was fallen back from, until the capture thread reopened it
+    std::weak_ptr<platf::display_t> stale_display;
+
+    // Returns whether the stream goes on
+    auto recover = [&](const encoder_t &encoder, const std::shared_ptr<platf::display_t> &display, bool open_failed) {
+      ++metrics::encoder().failures;
+
+      switch (recovery.failed(open_failed)) {
+        case encoder_recovery_t::action_e::reopen:
+          BOOST_LOG(warning) << "Encoder ["sv << encoder.name << "] failed, reopening it"sv;
+          return true;
+        case encoder_recovery_t::action_e::fall_back:
+          break;
+        case encoder_recovery_t::action_e::give_up:
+          BOOST_LOG(error) << "Stream went without a working encoder for too long"sv;
+          return false;
+      }
+
+      auto next = fall_back_encoder(&encoder, config);
+      if (!next) {
+        return false;
+      }
+      ++metrics::encoder().fallbacks;
+
+      // The capture thread reopens the display once it notices
+      if (next->platform_formats->dev_type != encoder.platform_formats->dev_type) {
+        stale_display = display;
+      }
+      ref->encoder_p = next;
+      return true;
+    };
+
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin_current_thread("video encode"sv);
 
     while (!shutdown_event->peek() && images->running()) {
+      // Wait for the viewer running the shared encoder to leave
+      if (shared_encoder && !shared_encoder->lead(&viewer, 100ms)) {
+        continue;
+      }
+
+      if (!capturing) {
+        ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
+
+        if (!ref->capture_ctx_queue->running()) {
+          return;
+        }
+
+        capturing = true;
+      }
+
       // Wait for the main capture event when the display is being reinitialized
       if (ref->reinit_event.peek()) {
         std::this_thread::sleep_for(20ms);
@@ -2397,41 +4490,228 @@ namespace video {
           continue;
         }
 
-        display = ref->display_wp->lock();
+        display = ref->display_wp->lock();
+      }
+
+      if (auto stale = stale_display.lock(); stale && stale == display) {
+        display.reset();
+        std::this_thread::sleep_for(20ms);
+        continue;
+      }
+
+      auto &encoder = *ref->encoder_p.load();
+
+      // The encoder is opened at the size and bitrate the stream was left at, input and the client keep the requested size
+      auto encode_config = config;
+      if (resolution) {
+        std::tie(encode_config.width, encode_config.height) = resolution->size();
+        encode_config.bitrate = resolution->bitrate();
+      }
+
+      if (screen && adaptive_screen_content) {
+        encode_config.screen_content = screen->active();
+      }
+      if (screen && adaptive_chroma) {
+        encode_config.chromaSamplingType = screen->active() ? 1 : 0;
       }
 
-      auto &encoder = *chosen_encoder;
+      // Streams start at the quality level the last one like it was left at, see encoder_budget::monitor_t
+      encode_config.quality_level = encoder_budget::level_for(encoder.name, encode_config.videoFormat, encode_config.width, encode_config.height, encode_config.framerate);
 
-      auto encode_device = make_encode_device(*display, encoder, config);
-      if (!encode_device) {
-        return;
+      // A session parked by a previous stream skips opening the encoder
+      auto session = encode_session_pool.take(encoder, encode_config, display);
+      if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(session.get())) {
+        // The new client may send packets of another size
+        nvenc_session->packet_layout = config.packet_layout;
+      }
+      if (!session) {
+        session = open_encode_session(*display, encoder, encode_config);
+      }
+      if (!session) {
+        if (!recover(encoder, display, true)) {
+          return;
+        }
+        continue;
+      }
+
+      // The new encoder starts with an IDR frame, which the client picks the stream up again from
+      if (auto outage = recovery.opened()) {
+        auto outage_ms = std::chrono::duration_cast<std::chrono::milliseconds>(*outage);
+        metrics::encoder().last_recovery_ms = outage_ms.count();
+        BOOST_LOG(info) << "Stream recovered on encoder ["sv << encoder.name << "] after "sv << outage_ms;
       }
 
       // absolute mouse coordinates require that the dimensions of the screen are known
-      touch_port_event->raise(make_port(display.get(), config));
+      auto touch_port = make_port(display.get(), config);
 
       // Update client with our current HDR display state
       hdr_info_t hdr_info = std::make_unique<hdr_info_raw_t>(false);
-      if (colorspace_is_hdr(encode_device->colorspace)) {
+      if (colorspace_is_hdr(colorspace_from_client_config(config, display->is_hdr()))) {
         if (display->get_hdr_metadata(hdr_info->metadata)) {
           hdr_info->enabled = true;
         } else {
           BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
         }
       }
-      hdr_event->raise(std::move(hdr_info));
 
-      encode_run(
-        frame_nr,
+      if (shared_encoder) {
+        shared_encoder->publish(touch_port, *hdr_info);
+      } else {
+        touch_port_event->raise(touch_port);
+        hdr_event->raise(std::move(hdr_info));
+      }
+
+      auto failed = encode_run(
+        shared_encoder ? shared_encoder->frame_nr : frame_nr,
         mail,
         images,
-        config,
+        encode_config,
         display,
-        std::move(encode_device),
+        std::move(session),
         ref->reinit_event,
-        *ref->encoder_p,
-        channel_data
+        encoder,
+        channel_data,
+        shared_encoder.get(),
+        resolution ? &*resolution : nullptr,
+        screen ? &*screen : nullptr
       );
+
+      if (failed && !shutdown_event->peek() && images->running() && !recover(encoder, display, false)) {
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief The keyframes input only sessions answer the negotiation of their video stream with.
+   * @details Input only sessions show no video, so rather than capturing and encoding for every one of them, a single
+   *          keyframe is encoded for each video format and handed to every session asking for that format.
+   *          Only encoding it opens a display and an encoder, which are closed again right after.
+   */
+  class input_only_frames_t {
+  public:
+    struct frame_t {
+      std::vector<uint8_t> data;  ///< The keyframe, with the replacements of its encoder already made.
+      input::touch_port_t touch_port;  ///< The touch port of the display the keyframe was encoded from.
+    };
+
+    /**
+     * @brief Get the keyframe of a video format, encoding it if it's the first one asked for.
+     * @param config The video settings of the session.
+     * @return The keyframe, or nullptr if it couldn't be encoded.
+     */
+    std::shared_ptr<const frame_t> get(const config_t &config) {
+      std::lock_guard lg {_lock};
+
+      auto key = std::make_tuple(config.videoFormat, config.width, config.height, config.dynamicRange, config.chromaSamplingType);
+      if (auto it = _frames.find(key); it != std::end(_frames)) {
+        return it->second;
+      }
+
+      auto frame = encode_frame(config);
+      if (frame) {
+        _frames.emplace(key, frame);
+      }
+
+      return frame;
+    }
+
+  private:
+    static std::shared_ptr<const frame_t> encode_frame(const config_t &config) {
+      auto &encoder = *chosen_encoder;
+
+      auto display_name = proc::proc.display_name.empty() ? display_device::map_output_name(config::video.output_name) : proc::proc.display_name;
+      auto disp = platf::display(encoder.platform_formats->dev_type, display_name, config);
+      if (!disp) {
+        return nullptr;
+      }
+
+      auto session = open_encode_session(*disp, encoder, config);
+      if (!session) {
+        return nullptr;
+      }
+
+      {
+        // Image buffers are large, so we use a separate scope to free it immediately after convert()
+        auto img = disp->alloc_img();
+        if (!img || disp->dummy_img(img.get()) || session->convert(*img)) {
+          return nullptr;
+        }
+      }
+
+      session->request_idr_frame();
+
+      auto encode_mail = std::make_shared<safe::mail_raw_t>();
+      auto packets = encode_mail->queue<packet_t>(mail::video_packets);
+      while (!packets->peek()) {
+        if (encode(1, *session, packets, nullptr, {})) {
+          return nullptr;
+        }
+      }
+
+      auto packet = packets->pop();
+      auto frame = std::make_shared<frame_t>(frame_t {
+        {packet->data(), packet->data() + packet->data_size()},
+        make_port(disp.get(), config),
+      });
+
+      // The replacements belong to the encode session, which is closed before the keyframe is sent
+      if (packet->replacements) {
+        for (auto &replacement : *packet->replacements) {
+          auto it = std::search(std::begin(frame->data), std::end(frame->data), std::begin(replacement.old), std::end(replacement.old));
+          if (it != std::end(frame->data)) {
+            it = frame->data.erase(it, it + replacement.old.size());
+            frame->data.insert(it, std::begin(replacement._new), std::end(replacement._new));
+          }
+        }
+      }
+
+      packet.reset();
+      teardown_encode_session(encoder, std::move(session));
+
+      BOOST_LOG(info) << "Encoded the keyframe of input only sessions at "sv << config.width << 'x' << config.height << " with ["sv << encoder.name << ']';
+      return frame;
+    }
+
+    std::mutex _lock;
+    std::map<std::tuple<int, int, int, int, int>, std::shared_ptr<const frame_t>> _frames;
+  };
+
+  input_only_frames_t input_only_frames;
+
+  /**
+   * @brief Answer the video stream of an input only session with a keyframe until the session shuts down.
+   * @details The session holds no display or encoder, and sends the keyframe again whenever the client asks for one.
+   */
+  void input_only_stream(safe::mail_t mail, const config_t &config, void *channel_data) {
+    BOOST_LOG(info) << "Input only session, video will not be captured."sv;
+
+    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    auto idr_events = mail->event<bool>(mail::idr);
+    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+
+    auto frame = input_only_frames.get(config);
+    if (!frame) {
+      BOOST_LOG(error) << "Could not encode dummy video packet"sv;
+      shutdown_event->view();
+      return;
+    }
+
+    // absolute mouse coordinates require that the dimensions of the screen are known
+    mail->event<input::touch_port_t>(mail::touch_port)->raise(frame->touch_port);
+    mail->event<hdr_info_t>(mail::hdr)->raise(std::make_unique<hdr_info_raw_t>(false));
+
+    int64_t frame_nr = 1;
+    while (!shutdown_event->peek()) {
+      if (idr_events->peek()) {
+        idr_events->pop();
+
+        auto packet = std::make_unique<packet_raw_generic>(std::vector<uint8_t> {frame->data}, frame_nr++, true);
+        packet->channel_data = channel_data;
+        packets->raise(std::move(packet));
+      }
+
+      shutdown_event->view(300ms);
     }
   }
 
@@ -2440,10 +4720,20 @@ namespace video {
     config_t config,
     void *channel_data
   ) {
+    display_device::wait_for_configuration();
+
+    // The GPUs are sampled while any session streams
+    auto gpu_sampler_ref = gpu_sampler::get_ref();
+
+    // Otherwise the screen content tools only come on once the stream turns out to be mostly static, see capture_async()
+    config.screen_content = config::video.screen_content == config::video_t::screen_content_e::enabled;
+
     auto idr_events = mail->event<bool>(mail::idr);
 
     idr_events->raise(true);
-    if (chosen_encoder->flags & PARALLEL_ENCODING) {
+    if (config.input_only) {
+      input_only_stream(std::move(mail), config, channel_data);
+    } else if (chosen_encoder->flags & PARALLEL_ENCODING) {
       capture_async(std::move(mail), config, channel_data);
     } else {
       safe::signal_t join_event;
@@ -2465,6 +4755,43 @@ namespace video {
     }
   }
 
+  namespace {
+    /**
+     * @brief A reference to a capture thread, which keeps it running.
+     */
+    template<class T>
+    class capture_hold_t: public platf::deinit_t {
+    public:
+      explicit capture_hold_t(T ref):
+          _ref {std::move(ref)} {
+      }
+
+    private:
+      T _ref;
+    };
+
+    template<class T>
+    std::unique_ptr<platf::deinit_t> make_capture_hold(T ref) {
+      if (!ref) {
+        return nullptr;
+      }
+
+      return std::make_unique<capture_hold_t<T>>(std::move(ref));
+    }
+  }  // namespace
+
+  std::unique_ptr<platf::deinit_t> hold_capture(const config_t &config) {
+    if (config.input_only) {
+      return nullptr;
+    }
+
+    if (chosen_encoder->flags & PARALLEL_ENCODING) {
+      return make_capture_hold(capture_thread_async(config.display_name));
+    }
+
+    return make_capture_hold(capture_thread_sync.ref());
+  }
+
   enum validate_flag_e {
     VUI_PARAMS = 0x01,  ///< VUI parameters
   };
@@ -2490,7 +4817,9 @@ namespace video {
 
     session->request_idr_frame();
 
-    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+    // Encoders may be validated concurrently, so each gets its own queue
+    auto probe_mail = std::make_shared<safe::mail_raw_t>();
+    auto packets = probe_mail->queue<packet_t>(mail::video_packets);
     while (!packets->peek()) {
       if (encode(1, *session, packets, nullptr, {})) {
         return -1;
@@ -2521,7 +4850,43 @@ namespace video {
     return flag;
   }
 
-  bool validate_encoder(encoder_t &encoder, bool expect_failure) {
+  encoder_probe_cache_t &probe_cache() {
+    static encoder_probe_cache_t cache {platf::appdata() / "encoder_probe_cache.json"};
+    return cache;
+  }
+
+  /**
+   * @brief Build the key of the probe cache.
+   * @details Any change to the build, the GPUs, their drivers, the displays or the configuration invalidates the cache.
+   * @return The key, or an empty string if the results can't be cached on this platform.
+   */
+  std::string probe_cache_key() {
+    auto fingerprint = platf::encoder_probe_fingerprint();
+    if (fingerprint.empty()) {
+      return {};
+    }
+
+    // The encoder options come from the config file too, so any edit of it triggers a probe
+    auto config_file = file_handler::read_file(config::sunshine.config_file.c_str());
+
+    std::stringstream key;
+    key << PROJECT_VERSION << ' ' << PROJECT_VERSION_COMMIT << '\n'
+        << fingerprint << '\n'
+        << "output "sv << display_device::map_output_name(config::video.output_name) << '\n'
+        << "flags "sv << config::sunshine.flags.to_string() << '\n'
+        << "config "sv << util::hex(std::hash<std::string> {}(config_file)).to_string_view();
+
+    return key.str();
+  }
+
+  /**
+   * @brief Validate an encoder by building real encode sessions for every codec and format.
+   * @param encoder The encoder to validate.
+   * @param expect_failure Whether to order the checks so a failing encoder is eliminated quickly.
+   * @param display_found Set to `false` if validation failed because no display could be captured.
+   * @return `true` if the encoder passed validation.
+   */
+  bool probe_encoder(encoder_t &encoder, bool expect_failure, bool &display_found) {
     const auto output_name {display_device::map_output_name(config::video.output_name)};
     std::shared_ptr<platf::display_t> disp;
 
@@ -2544,6 +4909,7 @@ namespace video {
     // If the encoder isn't supported at all (not even H.264), bail early
     reset_display(disp, encoder.platform_formats->dev_type, output_name, config_autoselect);
     if (!disp) {
+      display_found = false;
       return false;
     }
     if (!disp->is_codec_supported(encoder.h264.name, config_autoselect)) {
@@ -2646,6 +5012,7 @@ namespace video {
       // Reset the display since we're switching from SDR to HDR
       reset_display(disp, encoder.platform_formats->dev_type, output_name, generic_hdr_config);
       if (!disp) {
+        display_found = false;
         return false;
       }
 
@@ -2702,7 +5069,67 @@ namespace video {
     return true;
   }
 
+  bool validate_encoder(encoder_t &encoder, bool expect_failure) {
+    auto &cache = probe_cache();
+
+    if (auto result = cache.find(encoder.name)) {
+      if (!result->passed) {
+        BOOST_LOG(info) << "Encoder ["sv << encoder.name << "] failed when it was last probed"sv;
+        return false;
+      }
+
+      // The capabilities don't depend on the display, but it may have been disconnected since
+      std::shared_ptr<platf::display_t> disp;
+      reset_display(disp, encoder.platform_formats->dev_type, display_device::map_output_name(config::video.output_name), {1920, 1080, 60, 1000, 1, 0, 1, 0, 0, 0});
+      if (!disp) {
+        return false;
+      }
+
+      encoder.h264.capabilities = result->capabilities[0];
+      encoder.hevc.capabilities = result->capabilities[1];
+      encoder.av1.capabilities = result->capabilities[2];
+
+      BOOST_LOG(info) << "Encoder ["sv << encoder.name << "] passed when it was last probed"sv;
+      return true;
+    }
+
+    auto display_found = true;
+    auto passed = probe_encoder(encoder, expect_failure, display_found);
+
+    // Without a display we only know the encoder can't be used right now
+    if (display_found) {
+      cache.store(encoder.name, {passed, {encoder.h264.capabilities.to_ullong(), encoder.hevc.capabilities.to_ullong(), encoder.av1.capabilities.to_ullong()}});
+    }
+
+    return passed;
+  }
+
+  namespace {
+    std::shared_future<void> initial_probe;
+    thread_local bool initial_probe_thread = false;
+  }  // namespace
+
+  void start_initial_probe(std::function<void()> probe) {
+    auto probe_future = std::async(std::launch::async, [probe = std::move(probe)]() {
+      initial_probe_thread = true;
+      probe();
+    });
+    initial_probe = probe_future.share();
+  }
+
+  void wait_for_initial_probe() {
+    if (!initial_probe_thread && initial_probe.valid()) {
+      initial_probe.wait();
+    }
+  }
+
   int probe_encoders() {
+    // A launch right after startup uses the encoder picked by the initial probe
+    wait_for_initial_probe();
+
+    // The display must be in the mode it will be streamed in
+    display_device::wait_for_configuration();
+
     if (!allow_encoder_probing()) {
       // Error already logged
       return -1;
@@ -2715,6 +5142,9 @@ namespace video {
       return 0;
     }
 
+    // Parked sessions belong to the GPUs and encoders as they were before the probe
+    encode_session_pool.clear();
+
     // Restart encoder selection
     auto previous_encoder = chosen_encoder;
     chosen_encoder = nullptr;
@@ -2722,6 +5152,14 @@ namespace video {
     active_av1_mode = config::video.av1_mode;
     last_encoder_probe_supported_ref_frames_invalidation = false;
 
+    // Don't trust the results that led to an encoder of last resort, there may be a better one by now
+    auto &cache = probe_cache();
+    if (previous_encoder && (previous_encoder->flags & ALWAYS_REPROBE)) {
+      cache.clear();
+    }
+    auto cache_key = probe_cache_key();
+    cache.load(cache_key);
+
     auto adjust_encoder_constraints = [&](encoder_t *encoder) {
       // If we can't satisfy both the encoder and codec requirement, prefer the encoder over codec support
       if (active_hevc_mode == 3 && !encoder->hevc[encoder_t::DYNAMIC_RANGE]) {
@@ -2770,6 +5208,24 @@ namespace video {
 
     BOOST_LOG(info) << "// Testing for available encoders, this may generate errors. You can safely ignore those errors. //"sv;
 
+    // Probe everything that isn't cached at once, so the searches below only hit the cache
+    if (chosen_encoder == nullptr && platf::concurrent_encoder_probing() && !cache_key.empty()) {
+      std::vector<std::future<void>> probes;
+      for (auto encoder : encoder_list) {
+        if (cache.find(encoder->name)) {
+          continue;
+        }
+
+        probes.emplace_back(std::async(std::launch::async, [encoder, expect_failure = previous_encoder && previous_encoder != encoder]() {
+          validate_encoder(*encoder, expect_failure);
+        }));
+      }
+
+      for (auto &probe : probes) {
+        probe.wait();
+      }
+    }
+
     // If we haven't found an encoder yet, but we want one with specific codec support, search for that now.
     if (chosen_encoder == nullptr && (active_hevc_mode >= 2 || active_av1_mode >= 2)) {
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
@@ -2843,7 +5299,9 @@ namespace video {
 
     auto &encoder = *chosen_encoder;
 
-    last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & REF_FRAMES_INVALIDATION);
+    select_capture_method(encoder.platform_formats->dev_type, encoder.name, display_device::map_output_name(config::video.output_name));
+
+    last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & (REF_FRAMES_INVALIDATION | IDR_REF_FRAMES_INVALIDATION));
     last_encoder_probe_supported_yuv444_for_codec[0] = encoder.h264[encoder_t::PASSED] &&
                                                        encoder.h264[encoder_t::YUV444];
     last_encoder_probe_supported_yuv444_for_codec[1] = encoder.hevc[encoder_t::PASSED] &&
@@ -2892,6 +5350,164 @@ namespace video {
     return 0;
   }
 
+  /**
+   * @brief Encode frames as fast as possible for a while.
+   * @param disp The display the images are allocated from.
+   * @param encoder The encoder.
+   * @param config The configuration of the encoder.
+   * @param duration How long to encode.
+   * @param generated_content Set to whether the frames had moving content.
+   * @return The stats, or `std::nullopt` if the encoder failed.
+   */
+  std::optional<encode_stats_t> benchmark_encode(const std::shared_ptr<platf::display_t> &disp, const encoder_t &encoder, const config_t &config, std::chrono::nanoseconds duration, bool &generated_content) {
+    auto encode_device = make_encode_device(*disp, encoder, config);
+    if (!encode_device) {
+      return std::nullopt;
+    }
+
+    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
+    if (!session) {
+      return std::nullopt;
+    }
+
+    // Drawing a frame takes about as long as encoding it, so a few are drawn upfront and encoded in turn
+    std::vector<std::shared_ptr<platf::img_t>> imgs;
+    for (int x = 0; x < 8; ++x) {
+      auto img = disp->alloc_img();
+      if (!img || disp->dummy_img(img.get())) {
+        return std::nullopt;
+      }
+
+      generated_content = draw_test_pattern(*img, x);
+      imgs.emplace_back(std::move(img));
+      if (!generated_content) {
+        break;
+      }
+    }
+
+    auto probe_mail = std::make_shared<safe::mail_raw_t>();
+    auto packets = probe_mail->queue<packet_t>(mail::video_packets);
+
+    std::map<std::int64_t, std::pair<std::chrono::steady_clock::time_point, std::chrono::nanoseconds>> pending;
+    std::vector<encoded_frame_t> frames;
+
+    session->request_idr_frame();
+
+    auto start = std::chrono::steady_clock::now();
+    auto now = start;
+    for (std::int64_t frame_nr = 1; now - start < duration; ++frame_nr) {
+      auto convert_start = std::chrono::steady_clock::now();
+      if (session->convert(*imgs[frame_nr % imgs.size()])) {
+        return std::nullopt;
+      }
+      auto convert_time = std::chrono::steady_clock::now() - convert_start;
+
+      if (encode(frame_nr, *session, packets, nullptr, {})) {
+        return std::nullopt;
+      }
+      pending.emplace(frame_nr, std::pair {convert_start, convert_time});
+
+      // Encoders may output a frame only after the next ones were sent
+      while (packets->peek()) {
+        auto packet = packets->pop();
+        now = std::chrono::steady_clock::now();
+
+        auto it = pending.find(packet->frame_index());
+        if (it != std::end(pending)) {
+          frames.emplace_back(encoded_frame_t {it->second.second, now - it->second.first, packet->data_size()});
+          pending.erase(it);
+        }
+      }
+
+      session->request_normal_frame();
+      now = std::chrono::steady_clock::now();
+    }
+
+    return summarize_encode(frames, now - start, config.framerate);
+  }
+
+  std::vector<platf::mem_type_e> encoder_mem_types() {
+    std::vector<platf::mem_type_e> dev_types;
+    for (auto encoder : encoders) {
+      auto dev_type = encoder->platform_formats->dev_type;
+      if (std::find(std::begin(dev_types), std::end(dev_types), dev_type) == std::end(dev_types)) {
+        dev_types.emplace_back(dev_type);
+      }
+    }
+
+    return dev_types;
+  }
+
+  int benchmark_encoders(const std::filesystem::path &report_file, std::chrono::seconds duration) {
+    constexpr std::array<std::pair<int, int>, 4> resolutions {{{1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}}};
+    constexpr std::array<int, 2> framerates {60, 120};
+
+    active_hevc_mode = config::video.hevc_mode;
+    active_av1_mode = config::video.av1_mode;
+
+    auto &cache = probe_cache();
+    cache.load(probe_cache_key());
+
+    const auto output_name {display_device::map_output_name(config::video.output_name)};
+    std::vector<encoder_benchmark_result_t> results;
+
+    for (auto encoder : encoders) {
+      if (!validate_encoder(*encoder, false)) {
+        continue;
+      }
+
+      for (int video_format = 0; video_format < 3; ++video_format) {
+        auto &codec = video_format == 0 ? encoder->h264 : video_format == 1 ? encoder->hevc : encoder->av1;
+        if (!codec[encoder_t::PASSED]) {
+          continue;
+        }
+
+        for (auto [width, height] : resolutions) {
+          for (auto framerate : framerates) {
+            // Scale the bitrate with the pixel rate, from 20 Mbps at 1080p60
+            auto bitrate = (int) std::max(5000LL, 20000LL * width * height * framerate / (1920LL * 1080 * 60));
+
+            config_t config {width, height, framerate, bitrate, 1, 0, 1, video_format, 0, 0};
+            config.encodingFramerate = framerate * 1000;
+
+            std::shared_ptr<platf::display_t> disp;
+            reset_display(disp, encoder->platform_formats->dev_type, output_name, config);
+            if (!disp || !disp->is_codec_supported(codec.name, config)) {
+              BOOST_LOG(info) << "Skipping ["sv << codec.name << "] at "sv << width << 'x' << height << 'x' << framerate << ", it isn't supported"sv;
+              continue;
+            }
+
+            bool generated_content = false;
+            auto stats = benchmark_encode(disp, *encoder, config, duration, generated_content);
+            if (!stats) {
+              BOOST_LOG(warning) << "Encoder ["sv << codec.name << "] failed at "sv << width << 'x' << height << 'x' << framerate;
+              continue;
+            }
+
+            BOOST_LOG(info) << '[' << codec.name << "] at "sv << width << 'x' << height << 'x' << framerate << ": "sv
+                            << stats->fps << " fps, latency p50 "sv << std::chrono::duration<double, std::milli> {stats->latency_p50}.count()
+                            << "ms p99 "sv << std::chrono::duration<double, std::milli> {stats->latency_p99}.count()
+                            << "ms, convert "sv << std::chrono::duration<double, std::milli> {stats->convert_time}.count()
+                            << "ms, "sv << stats->bitrate_kbps << " kbps +/- "sv << stats->bitrate_stddev_kbps;
+            results.emplace_back(encoder_benchmark_result_t {std::string {encoder->name}, codec.name, width, height, framerate, bitrate, generated_content, *stats});
+          }
+        }
+      }
+    }
+
+    if (results.empty()) {
+      BOOST_LOG(error) << "No encoder could be benchmarked"sv;
+      return -1;
+    }
+
+    if (!save_encoder_benchmark(report_file, results)) {
+      return -1;
+    }
+
+    BOOST_LOG(info) << "Wrote the results of "sv << results.size() << " benchmarks to "sv << report_file.string();
+    return 0;
+  }
+
   // Linux only declaration
   typedef int (*vaapi_init_avcodec_hardware_input_buffer_fn)(platf::avcodec_encode_device_t *encode_device, AVBufferRef **hw_device_buf);
 
@@ -2907,7 +5523,8 @@ namespace video {
       return hw_device_buf;
     }
 
-    auto render_device = config::video.adapter_name.empty() ? nullptr : config::video.adapter_name.c_str();
+    auto gpu = gpu_scheduler::render_device();
+    auto render_device = gpu.empty() ? nullptr : gpu.c_str();
 
     auto status = av_hwdevice_ctx_create(&hw_device_buf, AV_HWDEVICE_TYPE_VAAPI, render_device, nullptr, 0);
     if (status < 0) {
@@ -2919,6 +5536,28 @@ namespace video {
     return hw_device_buf;
   }
 
+  util::Either<avcodec_buffer_t, int> vulkan_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *encode_device) {
+    avcodec_buffer_t hw_device_buf;
+
+    // If an egl hwdevice, which derives the Vulkan device from its own render node
+    if (encode_device->data) {
+      if (((vaapi_init_avcodec_hardware_input_buffer_fn) encode_device->data)(encode_device, &hw_device_buf)) {
+        return -1;
+      }
+
+      return hw_device_buf;
+    }
+
+    auto status = av_hwdevice_ctx_create(&hw_device_buf, AV_HWDEVICE_TYPE_VULKAN, nullptr, nullptr, 0);
+    if (status < 0) {
+      char string[AV_ERROR_MAX_STRING_SIZE];
+      BOOST_LOG(error) << "Failed to create a Vulkan device: "sv << av_make_error_string(string, AV_ERROR_MAX_STRING_SIZE, status);
+      return -1;
+    }
+
+    return hw_device_buf;
+  }
+
   util::Either<avcodec_buffer_t, int> cuda_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *encode_device) {
     avcodec_buffer_t hw_device_buf;
 
@@ -2990,7 +5629,8 @@ namespace video {
       capture_thread_ctx.capture_ctx_queue,
       std::ref(capture_thread_ctx.display_wp),
       std::ref(capture_thread_ctx.reinit_event),
-      std::ref(*capture_thread_ctx.encoder_p)
+      std::ref(capture_thread_ctx.encoder_p),
+      capture_thread_ctx.display_name
     };
 
     return 0;
@@ -3016,6 +5656,8 @@ namespace video {
         return platf::mem_type_e::dxgi;
       case AV_HWDEVICE_TYPE_VAAPI:
         return platf::mem_type_e::vaapi;
+      case AV_HWDEVICE_TYPE_VULKAN:
+        return platf::mem_type_e::vulkan;
       case AV_HWDEVICE_TYPE_CUDA:
         return platf::mem_type_e::cuda;
       case AV_HWDEVICE_TYPE_NONE:
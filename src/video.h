@@ -4,9 +4,24 @@
  */
 #pragma once
 
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
 // local includes
 #include "input.h"
+#include "memory_budget.h"
 #include "platform/common.h"
+#include "region_of_interest.h"
 #include "thread_safe.h"
 #include "video_colorspace.h"
 
@@ -19,6 +34,63 @@ struct AVPacket;
 
 namespace video {
 
+  /**
+   * @brief How an encoder lays a frame out in its buffer, so the network thread sends it without copying it again.
+   * @details The frame is cut into blocks of `block_size` bytes, each following `block_header_size` free bytes
+   *          for the headers of the packet it's sent in. The first block starts with `headroom` free bytes.
+   */
+  struct packet_layout_t {
+    std::size_t headroom = 0;  ///< Bytes left free in front of the frame, within its first block.
+    std::size_t block_header_size = 0;  ///< Bytes left free in front of every block.
+    std::size_t block_size = 0;  ///< Bytes of every block, 0 to keep the frame in one piece after the headroom.
+
+    /**
+     * @brief Get the size of a buffer holding a frame in this layout.
+     * @param frame_size The size of the frame.
+     * @return The size of the buffer.
+     */
+    std::size_t size(std::size_t frame_size) const;
+
+    /**
+     * @brief Copy a frame into a buffer in this layout.
+     * @param frame The frame.
+     * @param buffer The buffer, of at least `size(frame.size())` bytes.
+     */
+    void copy(std::span<const uint8_t> frame, uint8_t *buffer) const;
+
+    /**
+     * @brief Copy a frame out of a buffer in this layout.
+     * @param buffer The buffer.
+     * @param frame_size The size of the frame.
+     * @param frame Where to copy the frame to.
+     */
+    void gather(const uint8_t *buffer, std::size_t frame_size, uint8_t *frame) const;
+
+    bool operator==(const packet_layout_t &) const = default;
+  };
+
+  /**
+   * @brief Buffers for encoded frames, which go back to the pool once the last reference to them is gone.
+   */
+  class frame_buffer_pool_t: public std::enable_shared_from_this<frame_buffer_pool_t> {
+  public:
+    using buffer_t = std::shared_ptr<std::vector<uint8_t>>;
+
+    /**
+     * @brief Take a buffer from the pool, or allocate one if it's empty.
+     * @param size The size of the buffer.
+     * @return The buffer.
+     */
+    buffer_t take(std::size_t size);
+
+  private:
+    // Enough for the frames queued for the network thread
+    static constexpr std::size_t max_buffers = 8;
+
+    std::mutex _lock;
+    std::vector<std::unique_ptr<std::vector<uint8_t>>> _buffers;
+  };
+
   /* Encoding configuration requested by remote client */
   struct config_t {
     // DO NOT CHANGE ORDER OR ADD FIELDS IN THE MIDDLE!!!!!
@@ -48,6 +120,10 @@ namespace video {
 
     int encodingFramerate; // Requested display framerate
     bool input_only;
+    std::string display_name;  // Display to capture, empty for the display of the running app
+    packet_layout_t packet_layout;  // Layout the network thread sends frames in
+    int quality_level = 0;  // Levels the encoder is stepped down from its configured quality, see encoder_budget::monitor_t
+    bool screen_content = false;  // Encode text and UI with the screen content tools, see screen_content::detector_t
   };
 
   platf::mem_type_e map_base_dev_type(AVHWDeviceType type);
@@ -204,6 +280,8 @@ namespace video {
   };
 
   struct encode_session_t {
+    encode_session_t() = default;
+    encode_session_t(encode_session_t &&) = default;
     virtual ~encode_session_t() = default;
 
     virtual int convert(platf::img_t &img) = 0;
@@ -213,6 +291,68 @@ namespace video {
     virtual void request_normal_frame() = 0;
 
     virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
+
+    /**
+     * @brief Prepare the session to wait in the encoder session pool, releasing its display.
+     * @return `false` if the session can't be pooled.
+     */
+    virtual bool park() {
+      return false;
+    }
+
+    /**
+     * @brief Resume a pooled session for a new run of frames.
+     * @details The next frame is an IDR frame, and the frame numbers may start over.
+     * @param display The display, which captures the same output in the same mode as the old one.
+     * @param bitrate The bitrate of the new run in kilobits.
+     * @return `false` if the session can't be reused, in which case it must be destroyed.
+     */
+    virtual bool resume(const std::shared_ptr<platf::display_t> &display, int bitrate) {
+      return false;
+    }
+
+    /**
+     * @brief Take the images of a display in another mode than the old one, before it's resumed.
+     * @details The encoder isn't touched, since its frames have the size of the stream rather than the display.
+     * @param width The width of the images of the new display.
+     * @param height The height of the images of the new display.
+     * @return `false` if the session only takes images of the size it was made for, it's left as it was.
+     */
+    virtual bool resize_input(int width, int height) {
+      return false;
+    }
+
+    /**
+     * @brief Change the bitrate while encoding, without an IDR frame.
+     * @param bitrate The new bitrate in kilobits.
+     * @return `false` if the encoder keeps the bitrate it was opened with.
+     */
+    virtual bool set_bitrate(int bitrate) {
+      return false;
+    }
+
+    /**
+     * @brief Set the regions of interest of the frames encoded from now on.
+     * @param regions The regions, where the first one takes precedence where they overlap.
+     * @return `false` if the encoder can't vary the quality across the frame.
+     */
+    virtual bool set_regions_of_interest(const std::vector<region_of_interest_t> &regions) {
+      return false;
+    }
+
+    /**
+     * @brief Change the HDR metadata written into the bitstream while encoding.
+     * @details The new metadata is written with the next IDR frame.
+     * @param metadata The new metadata.
+     * @return `false` if the encoder doesn't write HDR metadata into the bitstream.
+     */
+    virtual bool set_hdr_metadata(const SS_HDR_METADATA &metadata) {
+      return false;
+    }
+
+    std::string gpu;  ///< The GPU the session was placed on by gpu_scheduler, empty if it wasn't placed.
+    bool split_encode = false;  ///< The frames are split across the encode engines of the GPU.
+    memory_budget::lease_t memory;  ///< What the frames of the session take of memory_budget::frames().
   };
 
   // encoders
@@ -261,16 +401,66 @@ namespace video {
     std::vector<replace_t> *replacements = nullptr;
     void *channel_data = nullptr;
     bool after_ref_frame_invalidation = false;
+    bool intra_refresh = false;
+    bool non_reference = false;  ///< No later frame references this one, so it can be dropped alone.
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
   };
 
+  /**
+   * @brief AVPackets of an avcodec session, and the buffers of their data.
+   * @details Packets go back to the pool when the network thread is done with them, and their data goes
+   *          back to an AVBufferPool, so a stream doesn't allocate memory for every frame.
+   */
+  class av_packet_pool_t {
+  public:
+    ~av_packet_pool_t();
+
+    /**
+     * @brief Take an empty packet from the pool, or allocate one if there's none.
+     * @return The packet.
+     */
+    AVPacket *take();
+
+    /**
+     * @brief Release the data of a packet and put it back into the pool.
+     * @param packet The packet.
+     */
+    void give_back(AVPacket *packet);
+
+    /**
+     * @brief Allocate the data of a packet from the pool of the encoder, see `AVCodecContext::get_encode_buffer`.
+     * @details The pool is the `opaque` of the context.
+     */
+    static int get_encode_buffer(AVCodecContext *ctx, AVPacket *packet, int flags);
+
+  private:
+    // Enough for the packets queued for the network thread
+    static constexpr std::size_t max_packets = 8;
+
+    std::mutex _lock;
+    std::vector<AVPacket *> _packets;
+
+    // Every buffer of the pool fits the largest packet seen so far
+    AVBufferPool *_buffers = nullptr;
+    std::size_t _buffer_size = 0;
+  };
+
   struct packet_raw_avcodec: packet_raw_t {
     packet_raw_avcodec() {
       av_packet = av_packet_alloc();
     }
 
+    explicit packet_raw_avcodec(std::shared_ptr<av_packet_pool_t> pool):
+        pool {std::move(pool)} {
+      av_packet = this->pool->take();
+    }
+
     ~packet_raw_avcodec() {
-      av_packet_free(&this->av_packet);
+      if (pool) {
+        pool->give_back(av_packet);
+      } else {
+        av_packet_free(&this->av_packet);
+      }
     }
 
     bool is_idr() override {
@@ -290,6 +480,7 @@ namespace video {
     }
 
     AVPacket *av_packet;
+    std::shared_ptr<av_packet_pool_t> pool;
   };
 
   struct packet_raw_generic: packet_raw_t {
@@ -320,6 +511,173 @@ namespace video {
     bool idr;
   };
 
+  /**
+   * @brief A frame handed to the network thread before the encoder finished it.
+   * @details The encoder appends the slices it finished, and the network thread sends them
+   *          as FEC blocks while the later slices are still being encoded.
+   */
+  struct packet_raw_partial: packet_raw_t {
+    /**
+     * @brief The slices of the frame, shared by the encoder and the network thread.
+     */
+    class slices_t {
+    public:
+      struct taken_t {
+        std::vector<std::string_view> data;  ///< The data appended since the previous call.
+        int slices;  ///< The number of slices done in total.
+        bool complete;  ///< Whether the encoder finished the frame.
+      };
+
+      /**
+       * @brief Append the data of the slices the encoder finished.
+       * @param frame The frame from its first byte to the end of the last slice that's done.
+       * @param slices The number of slices in `frame`.
+       */
+      void update(std::span<const uint8_t> frame, int slices);
+
+      /**
+       * @brief Append the rest of the frame.
+       * @param frame The whole frame.
+       */
+      void complete(std::span<const uint8_t> frame);
+
+      /**
+       * @brief Give up on the frame after an encoder error.
+       */
+      void abort();
+
+      /**
+       * @brief Wait for data that wasn't taken yet.
+       * @param min_slices Wait until this many slices are done, unless the frame completes first.
+       * @param timeout How long to wait.
+       * @return The new data, or `std::nullopt` if the encoder failed or timed out.
+       */
+      std::optional<taken_t> take(int min_slices, std::chrono::milliseconds timeout);
+
+      /**
+       * @brief Wait for the whole frame.
+       * @return The frame, empty if the encoder failed.
+       */
+      std::vector<uint8_t> &frame();
+
+    private:
+      std::mutex _lock;
+      std::condition_variable _cv;
+
+      // References to the elements of a deque stay valid while it grows
+      std::deque<std::vector<uint8_t>> _chunks;
+      std::size_t _chunks_taken = 0;
+      std::size_t _size = 0;
+      int _slices = 0;
+      bool _complete = false;
+      bool _aborted = false;
+
+      std::vector<uint8_t> _frame;
+    };
+
+    packet_raw_partial(std::shared_ptr<slices_t> slices, int64_t frame_index, bool idr, int total_slices):
+        slices {std::move(slices)},
+        index {frame_index},
+        idr {idr},
+        total_slices {total_slices} {
+    }
+
+    bool is_idr() override {
+      return idr;
+    }
+
+    int64_t frame_index() override {
+      return index;
+    }
+
+    uint8_t *data() override {
+      return slices->frame().data();
+    }
+
+    size_t data_size() override {
+      return slices->frame().size();
+    }
+
+    std::shared_ptr<slices_t> slices;
+    int64_t index;
+    bool idr;
+    int total_slices;
+  };
+
+  /**
+   * @brief A frame copied out of the encoder into a pooled buffer, in the layout it's sent in.
+   * @details data() is only contiguous without blocks, otherwise it gathers the frame into a copy,
+   *          for the rare consumers that need it in one piece.
+   */
+  struct packet_raw_pooled: packet_raw_t {
+    packet_raw_pooled(frame_buffer_pool_t::buffer_t buffer, const packet_layout_t &layout, std::size_t frame_size, int64_t frame_index, bool idr):
+        buffer {std::move(buffer)},
+        layout {layout},
+        frame_size {frame_size},
+        index {frame_index},
+        idr {idr} {
+    }
+
+    bool is_idr() override {
+      return idr;
+    }
+
+    int64_t frame_index() override {
+      return index;
+    }
+
+    uint8_t *data() override;
+
+    size_t data_size() override {
+      return frame_size;
+    }
+
+    frame_buffer_pool_t::buffer_t buffer;
+    packet_layout_t layout;
+    std::size_t frame_size;
+    int64_t index;
+    bool idr;
+
+  private:
+    std::once_flag _gathered;
+    std::vector<uint8_t> _frame;
+  };
+
+  /**
+   * @brief A packet of an encoder shared by several sessions.
+   * @details The encoded data is shared, while each session numbers the frames from its first keyframe.
+   */
+  struct packet_raw_shared: packet_raw_t {
+    packet_raw_shared(std::shared_ptr<packet_raw_t> packet, int64_t frame_index_offset):
+        packet {std::move(packet)},
+        frame_index_offset {frame_index_offset} {
+      replacements = this->packet->replacements;
+      after_ref_frame_invalidation = this->packet->after_ref_frame_invalidation;
+      intra_refresh = this->packet->intra_refresh;
+      non_reference = this->packet->non_reference;
+      frame_timestamp = this->packet->frame_timestamp;
+    }
+
+    bool is_idr() override {
+      return packet->is_idr();
+    }
+
+    int64_t frame_index() override {
+      return packet->frame_index() - frame_index_offset;
+    }
+
+    uint8_t *data() override {
+      return packet->data();
+    }
+
+    size_t data_size() override {
+      return packet->data_size();
+    }
+
+    std::shared_ptr<packet_raw_t> packet;
+    int64_t frame_index_offset;
+  };
+
   using packet_t = std::unique_ptr<packet_raw_t>;
 
   struct hdr_info_raw_t {
@@ -347,6 +705,83 @@ namespace video {
     void *channel_data
   );
 
+  /**
+   * @brief Keep capturing the display of a session that ended, so a session resuming it doesn't open the display again.
+   * @param config The video settings of the session.
+   * @return The hold, releasing the capture once destroyed, or `nullptr` if the session didn't capture.
+   */
+  std::unique_ptr<platf::deinit_t> hold_capture(const config_t &config);
+
+  /**
+   * @brief The most tiles an AV1 frame is split into, which every encoder and decoder supports.
+   */
+  constexpr int max_av1_tiles = 16;
+
+  /**
+   * @brief Choose how to split the frames of an AV1 stream into tiles, which are encoded and decoded in parallel.
+   * @details Frames get more tiles as the pixel rate of the stream grows, and at least as many as the client asked
+   *          for slices. The columns and rows are powers of two.
+   * @param config The video settings of the stream.
+   * @return The number of tile columns and tile rows.
+   */
+  std::pair<int, int> av1_tiles(const config_t &config);
+
+  /**
+   * @brief Check whether no later frame references a frame, from the header of its first slice.
+   * @details H.264 frames with a `nal_ref_idc` of 0 and HEVC sub-layer non-reference pictures are.
+   *          AV1 frames are never reported as non-reference.
+   * @param video_format 0 for H.264, 1 for HEVC, 2 for AV1.
+   * @param data The Annex B bitstream of the frame, or its beginning.
+   */
+  bool is_non_reference(int video_format, std::span<const uint8_t> data);
+
+  /**
+   * @brief Tells the failures of the encoder of a stream that reopening it recovers from, from the ones it won't.
+   * @details A failure soon after the previous one, or an encoder that doesn't open, is persistent, and the stream
+   *          moves on to the next encoder that works. A stream that went without an encoder for too long ends.
+   */
+  class encoder_recovery_t {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    enum class action_e {
+      reopen,  ///< Open the same encoder again.
+      fall_back,  ///< Switch to the next encoder.
+      give_up,  ///< End the stream.
+    };
+
+    // Failures closer together than this are persistent
+    static constexpr std::chrono::seconds persistent_window {5};
+
+    // How long the stream may go without an encoder
+    static constexpr std::chrono::seconds max_recovery {10};
+
+    /**
+     * @brief Account for the encoder failing.
+     * @param open_failed Whether it failed to open, rather than while encoding.
+     * @param now The current time.
+     * @return What to do about it.
+     */
+    action_e failed(bool open_failed, clock::time_point now = clock::now());
+
+    /**
+     * @brief Account for an encoder opened for the stream.
+     * @param now The current time.
+     * @return How long the stream went without an encoder, if it had failed.
+     */
+    std::optional<clock::duration> opened(clock::time_point now = clock::now());
+
+  private:
+    std::optional<clock::time_point> _outage_start;
+    std::optional<clock::time_point> _last_failure;
+  };
+
+  /**
+   * @brief Validate an encoder, reusing the result of a previous run from the probe cache if it's still valid.
+   * @param encoder The encoder to validate.
+   * @param expect_failure Whether to order the checks so a failing encoder is eliminated quickly.
+   * @return `true` if the encoder passed validation.
+   */
   bool validate_encoder(encoder_t &encoder, bool expect_failure);
 
   /**
@@ -360,8 +795,46 @@ namespace video {
    * This is called once at startup and each time a stream is launched to
    * ensure the best encoder is selected. Encoder availability can change
    * at runtime due to all sorts of things from driver updates to eGPUs.
+   * Results are cached on disk and keyed by the GPUs, drivers and displays,
+   * so a probe after a restart only builds encode sessions if one of them changed.
    *
    * @warning This is only safe to call when there is no client actively streaming.
    */
   int probe_encoders();
+
+  /**
+   * @brief Run the first encoder probe of the process in the background, so the servers don't wait for it.
+   * @details Until it completes, probe_encoders() and wait_for_initial_probe() wait for it.
+   * @param probe The probe, which may call probe_encoders() several times.
+   */
+  void start_initial_probe(std::function<void()> probe);
+
+  /**
+   * @brief Wait for the probe started by start_initial_probe() to complete.
+   * @details Returns right away if there's none, or when called from the probe itself.
+   */
+  void wait_for_initial_probe();
+
+  /**
+   * @brief Benchmark every encoder and codec that works on this system, at 720p to 4K and 60 to 120 fps.
+   * @details Each display mode is encoded as fast as possible from generated content, or from a blank image
+   *          if the images of the display can't be drawn into.
+   * @param report_file Where to write the JSON report.
+   * @param duration How long to encode each display mode.
+   * @return 0 on success, or -1 if nothing could be benchmarked.
+   *
+   * @warning This is only safe to call when there is no client actively streaming.
+   */
+  int benchmark_encoders(const std::filesystem::path &report_file, std::chrono::seconds duration);
+
+  /**
+   * @brief Get the memory types the encoders of this build capture into, without duplicates.
+   */
+  std::vector<platf::mem_type_e> encoder_mem_types();
 }  // namespace video
+
+// Every encoding thread raises packets for the video sender, which takes them one by one
+template<>
+struct safe::mail_queue<video::packet_t> {
+  using type = safe::mpsc_queue_t<video::packet_t>;
+};
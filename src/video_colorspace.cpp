@@ -128,7 +128,7 @@ namespace video {
 
   const color_t *color_vectors_from_colorspace(colorspace_e colorspace, bool full_range) {
     using float2 = float[2];
-    auto make_color_matrix = [](float Cr, float Cb, const float2 &range_Y, const float2 &range_UV) -> color_t {
+    constexpr auto make_color_matrix = [](float Cr, float Cb, const float2 &range_Y, const float2 &range_UV) -> color_t {
       float Cg = 1.0f - Cr - Cb;
 
       float Cr_i = 1.0f - Cr;
@@ -148,7 +148,7 @@ namespace video {
       };
     };
 
-    static const color_t colors[] {
+    static constexpr color_t colors[] {
       make_color_matrix(0.299f, 0.114f, {16.0f, 235.0f}, {16.0f, 240.0f}),  // BT601 MPEG
       make_color_matrix(0.299f, 0.114f, {0.0f, 255.0f}, {0.0f, 255.0f}),  // BT601 JPEG
       make_color_matrix(0.2126f, 0.0722f, {16.0f, 235.0f}, {16.0f, 240.0f}),  // BT709 MPEG
@@ -0,0 +1,278 @@
+/**
+ * @file src/video_trace.cpp
+ * @brief Definitions for recording the encoded frames of a session, and replaying them into a session.
+ */
+// standard includes
+#include <array>
+#include <bit>
+#include <cstring>
+#include <thread>
+
+// local includes
+#include "globals.h"
+#include "logging.h"
+#include "video_trace.h"
+
+using namespace std::literals;
+
+namespace video {
+  namespace {
+    constexpr std::array<char, 4> magic {'S', 'V', 'T', 'R'};
+    constexpr std::uint32_t version = 1;
+
+    enum record_flag_e : std::uint8_t {
+      IDR = 0x01,
+      AFTER_REF_FRAME_INVALIDATION = 0x02,
+      INTRA_REFRESH = 0x04,
+      HAS_FRAME_AGE = 0x08,
+    };
+
+    template<class T>
+    void put(std::vector<char> &buffer, T value) {
+      if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+      }
+
+      auto begin = (const char *) &value;
+      buffer.insert(buffer.end(), begin, begin + sizeof(value));
+    }
+
+    void put_bytes(std::vector<char> &buffer, std::string_view bytes) {
+      put(buffer, (std::uint32_t) bytes.size());
+      buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+    }
+
+    template<class T>
+    bool get(std::istream &in, T &value) {
+      if (!in.read((char *) &value, sizeof(value))) {
+        return false;
+      }
+
+      if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+      }
+
+      return true;
+    }
+
+    // A truncated or corrupt trace could ask for absurd sizes
+    constexpr std::uint32_t max_field_size = 64 * 1024 * 1024;
+
+    template<class T>
+    bool get_bytes(std::istream &in, T &bytes) {
+      std::uint32_t size;
+      if (!get(in, size) || size > max_field_size) {
+        return false;
+      }
+
+      bytes.resize(size);
+      return size == 0 || (bool) in.read((char *) bytes.data(), size);
+    }
+
+    /**
+     * @brief A replayed frame, which owns the parameter sets its replacements point to.
+     */
+    struct packet_raw_replayed: packet_raw_generic {
+      packet_raw_replayed(trace_record_t &&record, std::int64_t frame_index):
+          packet_raw_generic {std::move(record.data), frame_index, record.idr},
+          replaced_data {std::move(record.replacements)} {
+        after_ref_frame_invalidation = record.after_ref_frame_invalidation;
+        intra_refresh = record.intra_refresh;
+
+        if (!replaced_data.empty()) {
+          for (auto &[old, _new] : replaced_data) {
+            replacement_views.emplace_back(old, _new);
+          }
+          replacements = &replacement_views;
+        }
+      }
+
+      std::vector<std::pair<std::string, std::string>> replaced_data;
+      std::vector<replace_t> replacement_views;
+    };
+  }  // namespace
+
+  trace_writer_t::trace_writer_t(const std::filesystem::path &file, const trace_config_t &config):
+      _out {file, std::ios::binary | std::ios::trunc} {
+    _out.write(magic.data(), magic.size());
+
+    put(_buffer, version);
+    put(_buffer, (std::uint32_t) config.width);
+    put(_buffer, (std::uint32_t) config.height);
+    put(_buffer, (std::uint32_t) config.framerate);
+    put(_buffer, (std::uint8_t) config.videoFormat);
+    put(_buffer, (std::uint8_t) config.dynamicRange);
+    put(_buffer, (std::uint8_t) config.chromaSamplingType);
+    _out.write(_buffer.data(), _buffer.size());
+    _out.flush();
+  }
+
+  trace_writer_t::operator bool() const {
+    return (bool) _out;
+  }
+
+  void trace_writer_t::record(packet_raw_t &packet, std::chrono::steady_clock::time_point sent) {
+    if (!_out) {
+      return;
+    }
+
+    if (!_start) {
+      _start = sent;
+    }
+
+    std::uint8_t flags = 0;
+    flags |= packet.is_idr() ? IDR : 0;
+    flags |= packet.after_ref_frame_invalidation ? AFTER_REF_FRAME_INVALIDATION : 0;
+    flags |= packet.intra_refresh ? INTRA_REFRESH : 0;
+    flags |= packet.frame_timestamp ? HAS_FRAME_AGE : 0;
+
+    _buffer.clear();
+    put(_buffer, (std::uint64_t) std::chrono::nanoseconds {sent - *_start}.count());
+    put(_buffer, (std::int64_t) packet.frame_index());
+    put(_buffer, flags);
+    put(_buffer, (std::uint64_t) (packet.frame_timestamp ? std::max(std::chrono::nanoseconds {sent - *packet.frame_timestamp}, 0ns).count() : 0));
+
+    auto replacements = packet.replacements && packet.is_idr() ? packet.replacements->size() : 0;
+    put(_buffer, (std::uint16_t) replacements);
+    for (std::size_t x = 0; x < replacements; ++x) {
+      auto &replacement = (*packet.replacements)[x];
+      put_bytes(_buffer, replacement.old);
+      put_bytes(_buffer, replacement._new);
+    }
+
+    put(_buffer, (std::uint32_t) packet.data_size());
+    _out.write(_buffer.data(), _buffer.size());
+    _out.write((const char *) packet.data(), packet.data_size());
+
+    if (!_out) {
+      BOOST_LOG(error) << "Couldn't write to the video trace, recording stopped"sv;
+    }
+  }
+
+  trace_reader_t::trace_reader_t(const std::filesystem::path &file):
+      _in {file, std::ios::binary} {
+    std::array<char, 4> file_magic;
+    std::uint32_t file_version, width, height, framerate;
+    std::uint8_t video_format, dynamic_range, chroma_sampling_type;
+
+    if (!_in.read(file_magic.data(), file_magic.size()) || file_magic != magic ||
+        !get(_in, file_version) || file_version != version ||
+        !get(_in, width) || !get(_in, height) || !get(_in, framerate) ||
+        !get(_in, video_format) || !get(_in, dynamic_range) || !get(_in, chroma_sampling_type)) {
+      return;
+    }
+
+    _config = {(int) width, (int) height, (int) framerate, video_format, dynamic_range, chroma_sampling_type};
+    _first_record = _in.tellg();
+    _valid = true;
+  }
+
+  trace_reader_t::operator bool() const {
+    return _valid;
+  }
+
+  const trace_config_t &trace_reader_t::config() const {
+    return _config;
+  }
+
+  std::optional<trace_record_t> trace_reader_t::next() {
+    if (!_valid) {
+      return std::nullopt;
+    }
+
+    trace_record_t record;
+    std::uint64_t offset, frame_age;
+    std::uint8_t flags;
+    std::uint16_t replacements;
+    if (!get(_in, offset) || !get(_in, record.frame_index) || !get(_in, flags) || !get(_in, frame_age) || !get(_in, replacements)) {
+      return std::nullopt;
+    }
+
+    record.offset = std::chrono::nanoseconds {offset};
+    record.idr = flags & IDR;
+    record.after_ref_frame_invalidation = flags & AFTER_REF_FRAME_INVALIDATION;
+    record.intra_refresh = flags & INTRA_REFRESH;
+    if (flags & HAS_FRAME_AGE) {
+      record.frame_age = std::chrono::nanoseconds {frame_age};
+    }
+
+    for (std::uint16_t x = 0; x < replacements; ++x) {
+      auto &[old, _new] = record.replacements.emplace_back();
+      if (!get_bytes(_in, old) || !get_bytes(_in, _new)) {
+        return std::nullopt;
+      }
+    }
+
+    if (!get_bytes(_in, record.data)) {
+      return std::nullopt;
+    }
+
+    return record;
+  }
+
+  void trace_reader_t::rewind() {
+    if (!_valid) {
+      return;
+    }
+
+    _in.clear();
+    _in.seekg(_first_record);
+  }
+
+  void replay_trace(safe::mail_t mail, const std::filesystem::path &file, bool realtime, const config_t &config, void *channel_data) {
+    auto shutdown_event = mail->event<bool>(mail::shutdown);
+    auto packets = mail::man->queue<packet_t>(mail::video_packets);
+
+    trace_reader_t reader {file};
+    if (!reader) {
+      BOOST_LOG(error) << "Couldn't read the video trace "sv << file.string();
+      return;
+    }
+
+    auto &recorded = reader.config();
+    if (recorded.width != config.width || recorded.height != config.height || recorded.videoFormat != config.videoFormat ||
+        recorded.dynamicRange != config.dynamicRange || recorded.chromaSamplingType != config.chromaSamplingType) {
+      BOOST_LOG(warning) << "The video trace was recorded at "sv << recorded.width << 'x' << recorded.height << " in video format "sv << recorded.videoFormat
+                         << ", the client asked for "sv << config.width << 'x' << config.height << " in video format "sv << config.videoFormat
+                         << ", it may not be able to decode the trace"sv;
+    }
+
+    BOOST_LOG(info) << "Replaying the video trace "sv << file.string() << (realtime ? " at its recorded timing"sv : " as fast as it's sent"sv);
+
+    // The frame indices carry on from the last loop, so the client doesn't see them go back
+    std::int64_t frame_index = 1;
+    auto start = std::chrono::steady_clock::now();
+
+    while (!shutdown_event->peek()) {
+      auto record = reader.next();
+      if (!record) {
+        if (frame_index == 1) {
+          BOOST_LOG(error) << "The video trace "sv << file.string() << " has no frames"sv;
+          return;
+        }
+
+        reader.rewind();
+        start = std::chrono::steady_clock::now();
+        continue;
+      }
+
+      if (realtime) {
+        std::this_thread::sleep_until(start + record->offset);
+      } else {
+        // Keep only a frame ahead of the sender, so the frames aren't piling up in memory
+        while (packets->size() > 1 && !shutdown_event->peek()) {
+          std::this_thread::sleep_for(100us);
+        }
+      }
+
+      auto frame_age = record->frame_age;
+      auto packet = std::make_unique<packet_raw_replayed>(std::move(*record), frame_index++);
+      packet->channel_data = channel_data;
+      if (frame_age) {
+        packet->frame_timestamp = std::chrono::steady_clock::now() - *frame_age;
+      }
+
+      packets->raise(std::move(packet));
+    }
+  }
+}  // namespace video
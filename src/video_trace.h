@@ -0,0 +1,129 @@
+/**
+ * @file src/video_trace.h
+ * @brief Declarations for recording the encoded frames of a session, and replaying them into a session.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// local includes
+#include "thread_safe.h"
+#include "video.h"
+
+namespace video {
+  /**
+   * @brief The display mode and codec a trace was recorded with.
+   */
+  struct trace_config_t {
+    int width;
+    int height;
+    int framerate;
+    int videoFormat;  ///< 0 - H.264, 1 - HEVC, 2 - AV1
+    int dynamicRange;
+    int chromaSamplingType;
+  };
+
+  /**
+   * @brief An encoded frame read back from a trace.
+   */
+  struct trace_record_t {
+    std::chrono::nanoseconds offset;  ///< When the frame was sent, from the first frame of the trace.
+    std::int64_t frame_index;
+    bool idr;
+    bool after_ref_frame_invalidation;
+    bool intra_refresh;
+    std::optional<std::chrono::nanoseconds> frame_age;  ///< How long after its capture the frame was sent, if known.
+    std::vector<std::pair<std::string, std::string>> replacements;  ///< The parameter sets replaced in keyframes, old and new.
+    std::vector<std::uint8_t> data;
+  };
+
+  /**
+   * @brief Writes the encoded frames of a session to a trace file.
+   * @details Only the thread sending the video of the session may record.
+   */
+  class trace_writer_t {
+  public:
+    /**
+     * @brief Create the trace file.
+     * @param file The trace file, which is overwritten.
+     * @param config The display mode and codec of the session.
+     */
+    trace_writer_t(const std::filesystem::path &file, const trace_config_t &config);
+
+    /**
+     * @brief Check if the trace file could be created, and no write failed since.
+     */
+    explicit operator bool() const;
+
+    /**
+     * @brief Append a frame to the trace.
+     * @param packet The frame, whose data must be complete.
+     * @param sent When the frame started being sent.
+     */
+    void record(packet_raw_t &packet, std::chrono::steady_clock::time_point sent);
+
+  private:
+    std::ofstream _out;
+    std::vector<char> _buffer;
+    std::optional<std::chrono::steady_clock::time_point> _start;
+  };
+
+  /**
+   * @brief Reads the encoded frames of a trace file.
+   */
+  class trace_reader_t {
+  public:
+    /**
+     * @brief Open a trace file.
+     * @param file The trace file.
+     */
+    explicit trace_reader_t(const std::filesystem::path &file);
+
+    /**
+     * @brief Check if the trace file could be opened and is a trace.
+     */
+    explicit operator bool() const;
+
+    /**
+     * @brief Get the display mode and codec the trace was recorded with.
+     */
+    const trace_config_t &config() const;
+
+    /**
+     * @brief Read the next frame.
+     * @return The frame, or `std::nullopt` at the end of the trace or if it's truncated.
+     */
+    std::optional<trace_record_t> next();
+
+    /**
+     * @brief Go back to the first frame.
+     */
+    void rewind();
+
+  private:
+    std::ifstream _in;
+    std::streampos _first_record;
+    trace_config_t _config {};
+    bool _valid = false;
+  };
+
+  /**
+   * @brief Send the frames of a trace to a session instead of capturing and encoding, until the session ends.
+   * @details The trace is replayed from the start again when it ends, with the frame indices carrying on.
+   *          Requests for keyframes are ignored, the client gets the ones in the trace.
+   * @param mail The mail of the session.
+   * @param file The trace file.
+   * @param realtime Whether to keep the timing of the frames in the trace, or send them as fast as they're taken.
+   * @param config The configuration the client asked for, which the trace should match.
+   * @param channel_data The session.
+   */
+  void replay_trace(safe::mail_t mail, const std::filesystem::path &file, bool realtime, const config_t &config, void *channel_data);
+}  // namespace video
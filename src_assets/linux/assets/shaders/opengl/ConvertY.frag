@@ -1,7 +1,7 @@
 #version 300 es
 
 #ifdef GL_ES
-precision lowp float;
+precision highp float;
 #endif
 
 uniform sampler2D image;
@@ -17,9 +17,68 @@ layout(shared) uniform ColorMatrix {
 in vec2 tex;
 layout(location = 0) out float color;
 
+// The SDR white level and the peak of the display in nits, the peak is 0 when PQ images aren't tone mapped to SDR
+uniform vec2 tone_map;
+
+// Constants from SMPTE 2084 PQ
+const float m1 = 2610.0 / 4096.0 / 4.0;
+const float m2 = 2523.0 / 4096.0 * 128.0;
+const float c1 = 3424.0 / 4096.0;
+const float c2 = 2413.0 / 4096.0 * 32.0;
+const float c3 = 2392.0 / 4096.0 * 32.0;
+
+vec3 pq_to_nits(vec3 n) {
+  vec3 np = pow(clamp(n, 0.0, 1.0), vec3(1.0 / m2));
+  return pow(max(np - c1, 0.0) / (c2 - c3 * np), vec3(1.0 / m1)) * 10000.0;
+}
+
+float nits_to_pq(float l) {
+  float lp = pow(clamp(l / 10000.0, 0.0, 1.0), m1);
+  return pow((c1 + c2 * lp) / (1.0 + c3 * lp), m2);
+}
+
+// The EETF of ITU-R BT.2390, e and max_lum are PQ values normalized to the peak of the source
+float bt2390_eetf(float e, float max_lum) {
+  float ks = 1.5 * max_lum - 0.5;
+  if (e < ks) {
+    return e;
+  }
+
+  float t = (e - ks) / (1.0 - ks);
+  float t2 = t * t;
+  float t3 = t2 * t;
+  return (2.0 * t3 - 3.0 * t2 + 1.0) * ks + (t3 - 2.0 * t2 + t) * (1.0 - ks) + (-2.0 * t3 + 3.0 * t2) * max_lum;
+}
+
+vec3 tone_map_to_sdr(vec3 pq) {
+  const mat3 rec2020_to_rec709 = mat3(
+    1.6605, -0.1246, -0.0182,
+    -0.5876, 1.1329, -0.1006,
+    -0.0728, -0.0083, 1.1187
+  );
+
+  vec3 rgb = rec2020_to_rec709 * pq_to_nits(pq);
+
+  // The brightest channel is rolled off, and the others are scaled with it to keep the hue
+  float nits = max(max(rgb.r, rgb.g), max(rgb.b, 0.0));
+  if (nits > 0.0 && tone_map.y > tone_map.x) {
+    float peak_pq = nits_to_pq(tone_map.y);
+    float e = min(nits_to_pq(nits) / peak_pq, 1.0);
+    rgb *= pq_to_nits(vec3(bt2390_eetf(e, nits_to_pq(tone_map.x) / peak_pq) * peak_pq)).x / nits;
+  }
+
+  rgb = clamp(rgb / tone_map.x, 0.0, 1.0);
+  return mix(12.92 * rgb, 1.055 * pow(rgb, vec3(1.0 / 2.4)) - 0.055, step(0.0031308, rgb));
+}
+
+vec3 sample_rgb(vec2 pos) {
+  vec3 rgb = texture(image, pos).rgb;
+  return tone_map.y > 0.0 ? tone_map_to_sdr(rgb) : rgb;
+}
+
 void main()
 {
-	vec3 rgb = texture(image, tex).rgb;
+	vec3 rgb = sample_rgb(tex);
 	float y = dot(color_vec_y.xyz, rgb);
 
 	color = y * range_y.x + range_y.y;
@@ -1,7 +1,7 @@
 #version 300 es
 
 #ifdef GL_ES
-precision lowp float;
+precision highp float;
 #endif
 
 uniform sampler2D image;
@@ -0,0 +1,5 @@
+#include "include/convert_tone_mapped_base.hlsl"
+
+#define LEFT_SUBSAMPLING
+
+#include "include/convert_yuv420_packed_uv_ps_base.hlsl"
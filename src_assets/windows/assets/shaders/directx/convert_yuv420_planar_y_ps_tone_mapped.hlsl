@@ -0,0 +1,3 @@
+#include "include/convert_tone_mapped_base.hlsl"
+
+#include "include/convert_yuv420_planar_y_ps_base.hlsl"
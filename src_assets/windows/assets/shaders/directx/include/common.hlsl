@@ -1,41 +1,85 @@
-// This is a fast sRGB approximation from Microsoft's ColorSpaceUtility.hlsli
-float3 ApplySRGBCurve(float3 x)
-{
-    return x < 0.0031308 ? 12.92 * x : 1.13005 * sqrt(x - 0.00228) - 0.13448 * x + 0.005719;
-}
-
-float3 NitsToPQ(float3 L)
-{
-    // Constants from SMPTE 2084 PQ
-    static const float m1 = 2610.0 / 4096.0 / 4;
-    static const float m2 = 2523.0 / 4096.0 * 128;
-    static const float c1 = 3424.0 / 4096.0;
-    static const float c2 = 2413.0 / 4096.0 * 32;
-    static const float c3 = 2392.0 / 4096.0 * 32;
-
-    float3 Lp = pow(saturate(L / 10000.0), m1);
-    return pow((c1 + c2 * Lp) / (1 + c3 * Lp), m2);
-}
-
-float3 Rec709toRec2020(float3 rec709)
-{
-    static const float3x3 ConvMat =
-    {
-        0.627402, 0.329292, 0.043306,
-        0.069095, 0.919544, 0.011360,
-        0.016394, 0.088028, 0.895578
-    };
-    return mul(ConvMat, rec709);
-}
-
-float3 scRGBTo2100PQ(float3 rgb)
-{
-    // Convert from Rec 709 primaries (used by scRGB) to Rec 2020 primaries (used by Rec 2100)
-    rgb = Rec709toRec2020(rgb);
-
-    // 1.0f is defined as 80 nits in the scRGB colorspace
-    rgb *= 80;
-
-    // Apply the PQ transfer function on the raw color values in nits
-    return NitsToPQ(rgb);
-}
+// This is a fast sRGB approximation from Microsoft's ColorSpaceUtility.hlsli
+float3 ApplySRGBCurve(float3 x)
+{
+    return x < 0.0031308 ? 12.92 * x : 1.13005 * sqrt(x - 0.00228) - 0.13448 * x + 0.005719;
+}
+
+float3 NitsToPQ(float3 L)
+{
+    // Constants from SMPTE 2084 PQ
+    static const float m1 = 2610.0 / 4096.0 / 4;
+    static const float m2 = 2523.0 / 4096.0 * 128;
+    static const float c1 = 3424.0 / 4096.0;
+    static const float c2 = 2413.0 / 4096.0 * 32;
+    static const float c3 = 2392.0 / 4096.0 * 32;
+
+    float3 Lp = pow(saturate(L / 10000.0), m1);
+    return pow((c1 + c2 * Lp) / (1 + c3 * Lp), m2);
+}
+
+float3 PQToNits(float3 N)
+{
+    // Inverse of NitsToPQ()
+    static const float m1 = 2610.0 / 4096.0 / 4;
+    static const float m2 = 2523.0 / 4096.0 * 128;
+    static const float c1 = 3424.0 / 4096.0;
+    static const float c2 = 2413.0 / 4096.0 * 32;
+    static const float c3 = 2392.0 / 4096.0 * 32;
+
+    float3 Np = pow(saturate(N), 1 / m2);
+    return pow(max(Np - c1, 0) / (c2 - c3 * Np), 1 / m1) * 10000.0;
+}
+
+float3 Rec709toRec2020(float3 rec709)
+{
+    static const float3x3 ConvMat =
+    {
+        0.627402, 0.329292, 0.043306,
+        0.069095, 0.919544, 0.011360,
+        0.016394, 0.088028, 0.895578
+    };
+    return mul(ConvMat, rec709);
+}
+
+float3 scRGBTo2100PQ(float3 rgb)
+{
+    // Convert from Rec 709 primaries (used by scRGB) to Rec 2020 primaries (used by Rec 2100)
+    rgb = Rec709toRec2020(rgb);
+
+    // 1.0f is defined as 80 nits in the scRGB colorspace
+    rgb *= 80;
+
+    // Apply the PQ transfer function on the raw color values in nits
+    return NitsToPQ(rgb);
+}
+
+// The EETF of ITU-R BT.2390, which rolls off the PQ values above the knee toward max_lum
+// E and max_lum are PQ values normalized to the peak of the source
+float BT2390EETF(float E, float max_lum)
+{
+    float ks = 1.5 * max_lum - 0.5;
+    if (E < ks) {
+        return E;
+    }
+
+    float t = (E - ks) / (1 - ks);
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return (2 * t3 - 3 * t2 + 1) * ks + (t3 - 2 * t2 + t) * (1 - ks) + (-2 * t3 + 3 * t2) * max_lum;
+}
+
+float3 scRGBToneMapToSDR(float3 rgb, float sdr_white_nits, float peak_nits)
+{
+    // 1.0f is defined as 80 nits in the scRGB colorspace
+    float nits = max(max(rgb.r, rgb.g), max(rgb.b, 0)) * 80;
+    if (nits <= 0 || peak_nits <= sdr_white_nits) {
+        return rgb * (80 / sdr_white_nits);
+    }
+
+    // The brightest channel is rolled off, and the others are scaled with it to keep the hue
+    float peak_pq = NitsToPQ(peak_nits).x;
+    float E = min(NitsToPQ(nits).x / peak_pq, 1);
+    float mapped = PQToNits(BT2390EETF(E, NitsToPQ(sdr_white_nits).x / peak_pq) * peak_pq).x;
+
+    return rgb * (mapped / nits * 80 / sdr_white_nits);
+}
@@ -0,0 +1,11 @@
+#include "include/common.hlsl"
+
+cbuffer tone_map_cbuffer : register(b1) {
+    float sdr_white_nits;
+    float peak_nits;
+};
+
+float3 CONVERT_FUNCTION(float3 input)
+{
+    return ApplySRGBCurve(saturate(scRGBToneMapToSDR(input, sdr_white_nits, peak_nits)));
+}
@@ -0,0 +1,69 @@
+/**
+ * @file tests/benchmarks/bench_crypto.cpp
+ * @brief Benchmark the AES-GCM encryption of video shards with src/crypto.*.
+ */
+#include <benchmark/benchmark.h>
+
+#include <src/crypto.h>
+#include <src/stream.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+  using prefix_t = stream::video_packet_enc_prefix_t;
+
+  struct shards_t {
+    std::vector<std::uint8_t> data;
+    std::vector<std::uint8_t *> shards_p;
+    std::vector<prefix_t> prefixes;
+
+    shards_t(std::size_t shard_size, std::size_t shard_count):
+        data(shard_size * shard_count),
+        shards_p(shard_count),
+        prefixes(shard_count) {
+      for (std::size_t x = 0; x < data.size(); ++x) {
+        data[x] = (std::uint8_t) (x * 31);
+      }
+      for (std::size_t x = 0; x < shard_count; ++x) {
+        shards_p[x] = &data[x * shard_size];
+      }
+    }
+  };
+
+  /**
+   * @brief Encrypt a block of shards with one encrypt() call per shard, the way stream.cpp does.
+   * @details Arguments are the shard size and the number of shards.
+   */
+  void BM_GcmEncryptEach(benchmark::State &state) {
+    auto shard_size = (std::size_t) state.range(0);
+    shards_t shards {shard_size, (std::size_t) state.range(1)};
+
+    crypto::cipher::gcm_t cipher {crypto::aes_t(16, 0x42), false};
+    crypto::aes_t iv(sizeof(prefix_t::iv));
+    std::uint64_t iv_counter = 0;
+
+    for (auto _ : state) {
+      for (std::size_t x = 0; x < shards.shards_p.size(); ++x) {
+        std::copy_n((std::uint8_t *) &iv_counter, sizeof(iv_counter), std::begin(iv));
+        ++iv_counter;
+
+        auto &prefix = shards.prefixes[x];
+        std::copy(std::begin(iv), std::end(iv), prefix.iv);
+        if (cipher.encrypt(std::string_view {(char *) shards.shards_p[x], shard_size}, prefix.tag, shards.shards_p[x], &iv) < 0) {
+          state.SkipWithError("encrypt() failed");
+          return;
+        }
+      }
+      benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(state.iterations() * shards.data.size());
+  }
+
+  void gcm_args(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"shard_size", "shards"})->ArgsProduct({{1024, 1392}, {16, 128}});
+  }
+}  // namespace
+
+BENCHMARK(BM_GcmEncryptEach)->Apply(gcm_args);
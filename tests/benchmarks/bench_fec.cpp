@@ -0,0 +1,115 @@
+/**
+ * @file tests/benchmarks/bench_fec.cpp
+ * @brief Benchmark the FEC encoding of video frames with every vectorized version of src/rswrapper.*.
+ */
+extern "C" {
+#include <src/rswrapper.h>
+}
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace {
+  // The default packet size of Moonlight, each shard is one packet
+  constexpr int block_size = 1392;
+
+  /**
+   * @brief Encode the parity shards of one FEC block, the way fec::encode() sizes them.
+   * @details Arguments are the number of data shards and the FEC percentage.
+   */
+  template<reed_solomon_isa isa>
+  void BM_FecEncode(benchmark::State &state) {
+    if (!reed_solomon_init_isa(isa)) {
+      state.SkipWithMessage("not supported by this CPU");
+      return;
+    }
+
+    auto data_shards = (int) state.range(0);
+    auto parity_shards = (int) (data_shards * state.range(1) + 99) / 100;
+    auto nr_shards = data_shards + parity_shards;
+
+    std::vector<std::uint8_t> shards(nr_shards * block_size);
+    for (std::size_t x = 0; x < data_shards * block_size; ++x) {
+      shards[x] = (std::uint8_t) (x * 31);
+    }
+
+    std::vector<std::uint8_t *> shards_p(nr_shards);
+    for (int x = 0; x < nr_shards; ++x) {
+      shards_p[x] = &shards[x * block_size];
+    }
+
+    // Contexts are cached by the sending threads, so building the matrix isn't part of the hot path
+    auto rs = reed_solomon_new(data_shards, parity_shards);
+
+    for (auto _ : state) {
+      reed_solomon_encode(rs, shards_p.data(), nr_shards, block_size);
+      benchmark::DoNotOptimize(shards.data());
+      benchmark::ClobberMemory();
+    }
+
+    reed_solomon_release(rs);
+    reed_solomon_init();
+
+    state.SetBytesProcessed(state.iterations() * data_shards * block_size);
+    state.counters["parity_shards"] = parity_shards;
+  }
+
+  /**
+   * @brief Encode the parity shards of one FEC block with the best ISA, with the shards at
+   *        an offset from a cache line.
+   * @details Arguments are the number of data shards and the offset in bytes. Shards are the
+   *          size of a packet with its RTP header, so every one of them is at the same offset.
+   */
+  void BM_FecEncodeAlignment(benchmark::State &state) {
+    // The default packet size of Moonlight with the RTP header
+    constexpr int shard_size = 1392 + 16;
+    constexpr int cache_line = 64;
+
+    reed_solomon_init();
+
+    auto data_shards = (int) state.range(0);
+    auto parity_shards = (data_shards * 20 + 99) / 100;
+    auto nr_shards = data_shards + parity_shards;
+
+    std::vector<std::uint8_t> buffer(nr_shards * shard_size + 2 * cache_line);
+    auto aligned = (std::uintptr_t) buffer.data() + cache_line - 1;
+    auto *shards = (std::uint8_t *) (aligned - aligned % cache_line) + state.range(1);
+    for (std::size_t x = 0; x < data_shards * shard_size; ++x) {
+      shards[x] = (std::uint8_t) (x * 31);
+    }
+
+    std::vector<std::uint8_t *> shards_p(nr_shards);
+    for (int x = 0; x < nr_shards; ++x) {
+      shards_p[x] = &shards[x * shard_size];
+    }
+
+    auto rs = reed_solomon_new(data_shards, parity_shards);
+
+    for (auto _ : state) {
+      reed_solomon_encode(rs, shards_p.data(), nr_shards, shard_size);
+      benchmark::DoNotOptimize(shards);
+      benchmark::ClobberMemory();
+    }
+
+    reed_solomon_release(rs);
+
+    state.SetBytesProcessed(state.iterations() * data_shards * shard_size);
+  }
+
+  // nanors is limited to 255 shards per block, stream.cpp splits bigger frames into blocks
+  void fec_args(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"data_shards", "fec_percentage"})->ArgsProduct({{4, 16, 64, 128}, {10, 20, 50}});
+  }
+}  // namespace
+
+BENCHMARK(BM_FecEncode<REED_SOLOMON_ISA_DEFAULT>)->Apply(fec_args);
+BENCHMARK(BM_FecEncode<REED_SOLOMON_ISA_SSSE3>)->Apply(fec_args);
+BENCHMARK(BM_FecEncode<REED_SOLOMON_ISA_AVX2>)->Apply(fec_args);
+BENCHMARK(BM_FecEncode<REED_SOLOMON_ISA_AVX512>)->Apply(fec_args);
+BENCHMARK(BM_FecEncode<REED_SOLOMON_ISA_NEON>)->Apply(fec_args);
+BENCHMARK(BM_FecEncode<REED_SOLOMON_ISA_GFNI>)->Apply(fec_args);
+
+BENCHMARK(BM_FecEncodeAlignment)->ArgNames({"data_shards", "offset"})->ArgsProduct({{16, 64, 128}, {0, 8, 16, 32}});
@@ -0,0 +1,69 @@
+/**
+ * @file tests/benchmarks/bench_network.cpp
+ * @brief Benchmark sending batches of video packets with platf::send_batch() over loopback.
+ */
+#include <benchmark/benchmark.h>
+
+#include <src/platform/common.h>
+#include <src/stream.h>
+
+#include <boost/asio.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+  constexpr std::size_t packet_size = 1392;
+
+  // Each packet is preceded by the video encryption prefix
+  constexpr std::size_t header_size = sizeof(stream::video_packet_enc_prefix_t);
+
+  /**
+   * @brief Send a block of shards to a socket nobody reads from, so only the sending side is measured.
+   * @details The argument is the number of packets per batch.
+   */
+  void BM_SendBatchLoopback(benchmark::State &state) {
+    using boost::asio::ip::udp;
+
+    auto block_count = (std::size_t) state.range(0);
+
+    boost::asio::io_context io_context;
+    udp::socket receiver {io_context, udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+    udp::socket sender {io_context, udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+
+    // Packets that don't fit are dropped by the receiver, after the sender handed them over
+    receiver.set_option(boost::asio::socket_base::receive_buffer_size {1});
+
+    std::vector<char> headers(block_count * header_size);
+    std::vector<char> payload(block_count * packet_size, 'V');
+    std::vector<platf::buffer_descriptor_t> payload_buffers {{payload.data(), payload.size()}};
+
+    boost::asio::ip::address target_address = receiver.local_endpoint().address();
+    boost::asio::ip::address source_address = sender.local_endpoint().address();
+
+    platf::batched_send_info_t send_info {
+      headers.data(),
+      header_size,
+      payload_buffers,
+      packet_size,
+      0,
+      block_count,
+      (std::uintptr_t) sender.native_handle(),
+      target_address,
+      receiver.local_endpoint().port(),
+      source_address,
+    };
+
+    for (auto _ : state) {
+      if (!platf::send_batch(send_info)) {
+        state.SkipWithError("send_batch() failed");
+        break;
+      }
+    }
+
+    state.SetBytesProcessed(state.iterations() * block_count * (header_size + packet_size));
+    state.SetItemsProcessed(state.iterations() * block_count);
+  }
+}  // namespace
+
+BENCHMARK(BM_SendBatchLoopback)->ArgName("packets")->Arg(1)->Arg(16)->Arg(64)->Arg(256);
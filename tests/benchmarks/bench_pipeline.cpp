@@ -0,0 +1,149 @@
+/**
+ * @file tests/benchmarks/bench_pipeline.cpp
+ * @brief Benchmark the queueing and pacing between capture, encoding and sending, without a GPU.
+ */
+#include "fake_backends.h"
+
+#include <src/globals.h>
+#include <src/image_pool.h>
+#include <src/thread_safe.h>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace stream {
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments);
+}  // namespace stream
+
+using namespace std::literals;
+
+namespace {
+  // The RTP and video packet headers stream.cpp inserts before each packet
+  constexpr std::uint64_t insert_size = 16;
+  constexpr std::uint64_t slice_size = 1392 - insert_size;
+
+  bool is_keyframe(const video::packet_t &packet) {
+    return packet->is_idr();
+  }
+
+  bool is_droppable(const video::packet_t &packet) {
+    return packet->non_reference;
+  }
+
+  /**
+   * @brief Stream frames of the fake display through the fake encoder, and packetize them like the video broadcast thread.
+   * @details Each iteration is one frame delivered by the fake encoder.
+   *          The capture thread hands images to the encoding thread through an image pool and an event,
+   *          which hands packets to this thread through the video packet queue, like captureThread(),
+   *          encode_run() and videoBroadcastThread() do.
+   *          The arguments are the framerate, the jitter of the display in microseconds,
+   *          the size of a packet and the latency of the encoder in microseconds.
+   *          The `queueing` counter is the average time in microseconds a frame spent in the pipeline
+   *          beyond the latency of the encoder, `dropped` the share of captured frames never encoded.
+   */
+  void BM_Pipeline(benchmark::State &state) {
+    bench::fake_display_t display {(int) state.range(0), std::chrono::microseconds {state.range(1)}};
+    auto encode_latency = std::chrono::microseconds {state.range(3)};
+    bench::fake_encode_session_t session {(std::size_t) state.range(2), encode_latency};
+
+    auto mail = std::make_shared<safe::mail_raw_t>();
+    auto packets = mail->queue<video::packet_t>(mail::video_packets);
+    packets->overflow(safe::overflow_e::drop_to_keyframe, is_keyframe, is_droppable);
+
+    auto images = std::make_shared<safe::event_t<std::shared_ptr<platf::img_t>>>();
+
+    std::atomic_bool running {true};
+    std::atomic_int64_t captured {0};
+    std::atomic_int64_t encoded {0};
+
+    std::thread capture_thread {[&]() {
+      // Like captureThread()
+      video::image_pool_t imgs {12, 3s};
+
+      bool cursor = false;
+      display.capture(
+        [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) {
+          captured.fetch_add(1, std::memory_order_relaxed);
+          images->raise(std::move(img));
+          return running.load();
+        },
+        [&](std::shared_ptr<platf::img_t> &img_out) {
+          while (running.load()) {
+            img_out = imgs.acquire([&]() {
+              return display.alloc_img();
+            }, 100ms);
+
+            if (img_out) {
+              return true;
+            }
+          }
+          return false;
+        },
+        &cursor
+      );
+    }};
+
+    std::thread encode_thread {[&]() {
+      std::int64_t frame_nr = 1;
+      while (auto img = images->pop()) {
+        session.convert(*img);
+
+        // The image is back in the pool before the frame is encoded, like with a real encode device
+        img.reset();
+
+        session.encode(frame_nr++, packets, nullptr);
+        encoded.fetch_add(1, std::memory_order_relaxed);
+      }
+    }};
+
+    std::chrono::nanoseconds queueing {};
+    for (auto _ : state) {
+      auto packet = packets->pop();
+      if (!packet) {
+        state.SkipWithError("The packet queue stopped");
+        break;
+      }
+
+      std::vector<std::string_view> segments {
+        std::string_view {(const char *) packet->data(), packet->data_size()},
+      };
+      auto payload = stream::concat_and_insert(insert_size, slice_size, segments);
+      benchmark::DoNotOptimize(payload.data());
+
+      queueing += std::chrono::steady_clock::now() - *packet->frame_timestamp - encode_latency;
+    }
+
+    running = false;
+    images->stop();
+    packets->stop();
+    capture_thread.join();
+    encode_thread.join();
+
+    auto frames = captured.load();
+    state.counters["queueing"] = benchmark::Counter(std::chrono::duration<double, std::micro> {queueing}.count(), benchmark::Counter::kAvgIterations);
+    state.counters["dropped"] = frames ? (double) (frames - encoded.load()) / frames : 0.0;
+  }
+
+  void pipeline_args(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"fps", "jitter_us", "packet_size", "latency_us"});
+
+    // Paced like a 60 and 240 Hz display, smooth and with a jitter like a compositor's
+    for (auto fps : {60, 240}) {
+      for (auto jitter : {0, 1000}) {
+        b->Args({fps, jitter, 64 * 1024, 2000});
+      }
+    }
+
+    // As fast as images come back, which leaves only the overhead of the handoffs
+    b->Args({0, 0, 64 * 1024, 0});
+    b->Args({0, 0, 1024 * 1024, 0});
+  }
+}  // namespace
+
+BENCHMARK(BM_Pipeline)->Apply(pipeline_args)->UseRealTime()->Unit(benchmark::kMicrosecond);
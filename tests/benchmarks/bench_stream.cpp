@@ -0,0 +1,95 @@
+/**
+ * @file tests/benchmarks/bench_stream.cpp
+ * @brief Benchmark the packetization of video frames in src/stream.*.
+ */
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace stream {
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments);
+  void replace(std::vector<std::string_view> &segments, const std::string_view &old, const std::string_view &_new);
+}  // namespace stream
+
+using namespace std::literals;
+
+namespace {
+  // The RTP and video packet headers stream.cpp inserts before each packet
+  constexpr std::uint64_t insert_size = 16;
+  constexpr std::uint64_t slice_size = 1392 - insert_size;
+
+  const std::string_view start_code {"\x00\x00\x00\x01", 4};
+
+  /**
+   * @brief Build an H.264 IDR frame with the parameter sets in front, like the encoders deliver.
+   * @param size The size of the slice data.
+   */
+  std::string make_idr(std::size_t size) {
+    std::string frame;
+    frame += start_code;
+    frame += "\x67\x64\x00\x28\xac\xd9\x40\x78\x02\x27\xe5\x84\x00\x00\x03\x00\x04\x00\x00\x03\x00\xf0\x3c\x60\xc6\x58"sv;
+    frame += start_code;
+    frame += "\x68\xeb\xe3\xcb\x22\xc0"sv;
+    frame += start_code;
+    frame += '\x65';
+
+    // Emulation prevention keeps the slice data free of start codes
+    for (std::size_t x = 0; x < size; ++x) {
+      frame += (char) (x % 251 + 1);
+    }
+
+    return frame;
+  }
+
+  /**
+   * @brief Copy a frame into packets with room for the headers.
+   * @details The argument is the size of the frame.
+   */
+  void BM_ConcatAndInsert(benchmark::State &state) {
+    auto frame = make_idr(state.range(0));
+
+    // The frame is sent after the parameter sets were replaced, so it's split in segments
+    std::vector<std::string_view> segments {
+      std::string_view {frame}.substr(0, 64),
+      std::string_view {frame}.substr(64),
+    };
+
+    for (auto _ : state) {
+      auto packets = stream::concat_and_insert(insert_size, slice_size, segments);
+      benchmark::DoNotOptimize(packets.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * frame.size());
+  }
+
+  /**
+   * @brief Replace the SPS of a frame, like stream.cpp does when the client needs VUI parameters.
+   * @details The argument is the size of the frame.
+   */
+  void BM_ReplaceSps(benchmark::State &state) {
+    auto frame = make_idr(state.range(0));
+
+    auto old_sps = std::string_view {frame}.substr(0, 30);
+    std::string new_sps {old_sps};
+    new_sps += "\x01\x02\x03\x04"sv;
+
+    for (auto _ : state) {
+      std::vector<std::string_view> segments {frame};
+      stream::replace(segments, old_sps, new_sps);
+      benchmark::DoNotOptimize(segments.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * frame.size());
+  }
+
+  void frame_args(benchmark::internal::Benchmark *b) {
+    // A P-frame and IDR frames of 1080p and 4K streams
+    b->ArgName("frame_size")->Arg(16 * 1024)->Arg(256 * 1024)->Arg(1024 * 1024);
+  }
+}  // namespace
+
+BENCHMARK(BM_ConcatAndInsert)->Apply(frame_args);
+BENCHMARK(BM_ReplaceSps)->Apply(frame_args);
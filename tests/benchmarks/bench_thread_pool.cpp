@@ -0,0 +1,65 @@
+/**
+ * @file tests/benchmarks/bench_thread_pool.cpp
+ * @brief Benchmark the contention on src/thread_pool.* of many sessions pushing input at once.
+ */
+#include <src/thread_pool.h>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+
+using namespace std::literals;
+
+namespace {
+  using thread_pool_util::priority_e;
+
+  // Like the global task_pool, one worker reserved for input next to one for everything else
+  std::unique_ptr<thread_pool_util::ThreadPool> pool;
+
+  void setup_pool(const benchmark::State &) {
+    pool = std::make_unique<thread_pool_util::ThreadPool>(2, 1);
+  }
+
+  void teardown_pool(const benchmark::State &) {
+    pool.reset();
+  }
+
+  /**
+   * @brief Push input from every benchmark thread, each standing in for a session, and wait for it to run.
+   * @details The argument is whether a blocking platform call occupies the pool the whole time,
+   *          which input shouldn't wait behind.
+   */
+  void BM_PushInput(benchmark::State &state) {
+    std::atomic_bool blocking {state.range(0) != 0 && state.thread_index() == 0};
+    std::future<void> blocked;
+    if (blocking) {
+      blocked = pool->push([&blocking]() {
+        while (blocking.load(std::memory_order_relaxed)) {
+          std::this_thread::sleep_for(1ms);
+        }
+      });
+    }
+
+    std::int64_t latency_ns = 0;
+    for (auto _ : state) {
+      auto pushed = std::chrono::steady_clock::now();
+      auto ran = pool->push(priority_e::high, []() {
+        return std::chrono::steady_clock::now();
+      });
+
+      latency_ns += std::chrono::nanoseconds {ran.get() - pushed}.count();
+    }
+
+    blocking = false;
+    if (blocked.valid()) {
+      blocked.wait();
+    }
+
+    state.counters["latency_ns"] = benchmark::Counter((double) latency_ns, benchmark::Counter::kAvgIterations);
+  }
+}  // namespace
+
+BENCHMARK(BM_PushInput)->ArgName("blocking")->Arg(0)->Arg(1)->ThreadRange(1, 16)->Setup(setup_pool)->Teardown(teardown_pool)->UseRealTime();
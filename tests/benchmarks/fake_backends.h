@@ -0,0 +1,138 @@
+/**
+ * @file tests/benchmarks/fake_backends.h
+ * @brief Capture and encoder backends that need no GPU, to benchmark the pipeline around them.
+ */
+#pragma once
+
+#include <src/platform/common.h>
+#include <src/video.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace bench {
+  /**
+   * @brief A display that delivers frames at a fixed rate, each off its slot by a random jitter.
+   * @details The images carry no pixels, so only the handoff of the images is paid for.
+   */
+  class fake_display_t: public platf::display_t {
+  public:
+    /**
+     * @param framerate The rate frames are delivered at, or 0 to deliver them as fast as images are free.
+     * @param jitter The most a frame is delivered before or after its slot.
+     */
+    fake_display_t(int framerate, std::chrono::nanoseconds jitter):
+        _interval {framerate > 0 ? std::chrono::nanoseconds {std::chrono::seconds {1}} / framerate : std::chrono::nanoseconds {}},
+        _jitter {jitter} {
+      width = env_width = 1920;
+      height = env_height = 1080;
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      // Only the jitter is random, and the same from run to run
+      std::mt19937 rng {1};
+      std::uniform_int_distribution<std::int64_t> jitter {-_jitter.count(), _jitter.count()};
+
+      auto next_frame = std::chrono::steady_clock::now();
+      while (true) {
+        if (_interval.count()) {
+          next_frame += _interval;
+          std::this_thread::sleep_until(next_frame + std::chrono::nanoseconds {jitter(rng)});
+        }
+
+        std::shared_ptr<platf::img_t> img;
+        if (!pull_free_image_cb(img)) {
+          return platf::capture_e::interrupted;
+        }
+
+        img->frame_timestamp = std::chrono::steady_clock::now();
+        if (!push_captured_image_cb(std::move(img), true)) {
+          return platf::capture_e::ok;
+        }
+      }
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<platf::img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = width * 4;
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      return 0;
+    }
+
+  private:
+    std::chrono::nanoseconds _interval;
+    std::chrono::nanoseconds _jitter;
+  };
+
+  /**
+   * @brief An encode session that takes a fixed time per frame and emits packets of a fixed size.
+   * @details The time is spent spinning rather than sleeping, so it's as exact as a hardware encoder's.
+   */
+  class fake_encode_session_t: public video::encode_session_t {
+  public:
+    /**
+     * @param packet_size The size of the packet of each frame.
+     * @param latency The time from a frame being handed to the encoder to its packet coming out.
+     */
+    fake_encode_session_t(std::size_t packet_size, std::chrono::nanoseconds latency):
+        _packet_size {packet_size},
+        _latency {latency} {
+    }
+
+    int convert(platf::img_t &img) override {
+      _frame_timestamp = img.frame_timestamp;
+      return 0;
+    }
+
+    void request_idr_frame() override {
+      _idr = true;
+    }
+
+    void request_normal_frame() override {
+      _idr = false;
+    }
+
+    void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
+      _idr = true;
+    }
+
+    /**
+     * @brief Encode the last converted image, like video::encode() does for the real sessions.
+     * @param frame_nr The number of the frame.
+     * @param packets The queue the packet is raised on.
+     * @param channel_data The data of the session the packet is sent to.
+     */
+    void encode(std::int64_t frame_nr, safe::mail_raw_t::queue_t<video::packet_t> &packets, void *channel_data) {
+      auto done = std::chrono::steady_clock::now() + _latency;
+      while (std::chrono::steady_clock::now() < done) {
+        std::this_thread::yield();
+      }
+
+      auto packet = std::make_unique<video::packet_raw_generic>(std::vector<std::uint8_t>(_packet_size), frame_nr, _idr);
+      packet->channel_data = channel_data;
+      packet->frame_timestamp = _frame_timestamp;
+      packets->raise(std::move(packet));
+
+      _idr = false;
+    }
+
+  private:
+    std::size_t _packet_size;
+    std::chrono::nanoseconds _latency;
+
+    std::optional<std::chrono::steady_clock::time_point> _frame_timestamp;
+    bool _idr = true;
+  };
+}  // namespace bench
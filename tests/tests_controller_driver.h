@@ -0,0 +1,63 @@
+/**
+ * @file tests/tests_controller_driver.h
+ * @brief Utility functions to drive the controllers adapting a stream with samples at a fixed rate.
+ */
+#pragma once
+
+#include <chrono>
+#include <type_traits>
+
+namespace controller_driver {
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Feed a controller a sample at every interval for a while.
+   * @param now The time of the first sample, advanced past the last one.
+   * @param duration How long to feed the controller for.
+   * @param interval The time between two samples.
+   * @param sample Feeds the controller the sample at the time it's called with, and returns what the
+   *        controller reported, if anything.
+   * @return The last report of the controller, if any.
+   */
+  template<class Sample>
+  auto run_for(clock::time_point &now, clock::duration duration, clock::duration interval, Sample &&sample) {
+    using report_t = std::invoke_result_t<Sample &, clock::time_point>;
+
+    if constexpr (std::is_void_v<report_t>) {
+      for (auto end = now + duration; now < end; now += interval) {
+        sample(now);
+      }
+    } else {
+      report_t result {};
+      for (auto end = now + duration; now < end; now += interval) {
+        if (auto report = sample(now)) {
+          result = report;
+        }
+      }
+
+      return result;
+    }
+  }
+
+  /**
+   * @brief Feed a controller a sample at every interval, until it reports something or the time runs out.
+   * @param now The time of the first sample, left at the time of the sample the controller reported at.
+   * @param duration How long to feed the controller for at most.
+   * @param interval The time between two samples.
+   * @param sample Feeds the controller the sample at the time it's called with, and returns what the
+   *        controller reported, if anything.
+   * @return The first report of the controller, if any.
+   */
+  template<class Sample>
+  auto run_until_report(clock::time_point &now, clock::duration duration, clock::duration interval, Sample &&sample) {
+    using report_t = std::invoke_result_t<Sample &, clock::time_point>;
+
+    for (auto end = now + duration; now < end; now += interval) {
+      if (auto report = sample(now)) {
+        return report;
+      }
+    }
+
+    return report_t {};
+  }
+}  // namespace controller_driver
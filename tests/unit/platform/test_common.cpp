@@ -4,9 +4,14 @@
  */
 #include "../../tests_common.h"
 
+#include <algorithm>
+#include <array>
 #include <boost/asio/ip/host_name.hpp>
+#include <sstream>
 #include <src/platform/common.h>
 
+using namespace std::literals;
+
 struct SetEnvTest: ::testing::TestWithParam<std::tuple<std::string, std::string, int>> {
 protected:
   void TearDown() override {
@@ -53,3 +58,41 @@ TEST(HostnameTests, TestAsioEquality) {
   // These should be equivalent on all platforms for ASCII hostnames
   ASSERT_EQ(platf::get_host_name(), boost::asio::ip::host_name());
 }
+
+TEST(HighPrecisionTimerTests, WakeupErrorHistogram) {
+  auto timer = platf::create_high_precision_timer();
+  ASSERT_TRUE(timer && *timer);
+
+  // Microbenchmark the 1ms sleeps used for video pacing
+  constexpr auto iterations = 200;
+  constexpr auto sleep_duration = 1ms;
+
+  // Buckets of wake-up error: <25us, <50us, <100us, <200us, <500us, <1ms, >=1ms
+  constexpr std::array<std::chrono::microseconds, 6> bucket_limits {25us, 50us, 100us, 200us, 500us, 1ms};
+  std::array<int, bucket_limits.size() + 1> histogram {};
+
+  std::vector<std::chrono::nanoseconds> errors;
+  errors.reserve(iterations);
+  for (int x = 0; x < iterations; ++x) {
+    auto start = std::chrono::steady_clock::now();
+    timer->sleep_for(sleep_duration);
+    auto error = std::chrono::steady_clock::now() - start - sleep_duration;
+
+    auto bucket = std::find_if(std::begin(bucket_limits), std::end(bucket_limits), [&](auto limit) {
+      return error < limit;
+    });
+    ++histogram[bucket - std::begin(bucket_limits)];
+    errors.push_back(error);
+  }
+
+  std::stringstream ss;
+  for (int x = 0; x < histogram.size(); ++x) {
+    ss << (x < bucket_limits.size() ? "<" : ">=") << bucket_limits[std::min<size_t>(x, bucket_limits.size() - 1)].count() << "us: " << histogram[x] << ' ';
+  }
+  BOOST_LOG(info) << "High precision timer wake-up error histogram: " << ss.str();
+
+  // Never wake up early, and don't be wildly late (CI machines can be very noisy)
+  std::sort(std::begin(errors), std::end(errors));
+  EXPECT_GE(errors.front(), -10us);
+  EXPECT_LT(errors[iterations / 2], 5ms);
+}
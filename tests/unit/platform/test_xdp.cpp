@@ -0,0 +1,105 @@
+/**
+ * @file tests/unit/platform/test_xdp.cpp
+ * @brief Test src/platform/linux/xdp.*.
+ */
+#ifdef __linux__
+  #include "../../tests_common.h"
+
+  #include <numeric>
+  #include <src/platform/linux/xdp.h>
+  #include <vector>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Sum the big-endian 16-bit words of a buffer, folded into 16 bits.
+   */
+  std::uint16_t ones_complement_sum(const std::uint8_t *data, std::size_t size, std::uint32_t sum = 0) {
+    for (std::size_t x = 0; x < size; x += 2) {
+      sum += (data[x] << 8) | (x + 1 < size ? data[x + 1] : 0);
+    }
+
+    while (sum >> 16) {
+      sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return sum;
+  }
+
+  std::uint16_t read_u16(const std::uint8_t *data) {
+    return (data[0] << 8) | data[1];
+  }
+
+  xdp::route_t make_route(const char *source, const char *target) {
+    return {
+      {0x02, 0x00, 0x00, 0x00, 0x00, 0x01},
+      {0x02, 0x00, 0x00, 0x00, 0x00, 0x02},
+      boost::asio::ip::make_address(source),
+      47998,
+      boost::asio::ip::make_address(target),
+      51234,
+      0xB8,
+    };
+  }
+
+  std::vector<std::uint8_t> make_packet(const xdp::route_t &route, std::size_t payload_size) {
+    auto headers = xdp::header_size(route.target_address.is_v6());
+
+    std::vector<std::uint8_t> packet(headers + payload_size);
+    std::iota(std::begin(packet) + headers, std::end(packet), 0);
+
+    xdp::write_headers(packet.data(), route, payload_size);
+    return packet;
+  }
+}  // namespace
+
+TEST(XdpTests, WritesIpv4Headers) {
+  auto route = make_route("192.168.1.10", "192.168.1.20");
+  auto packet = make_packet(route, 101);
+  ASSERT_EQ(packet.size(), 14 + 20 + 8 + 101);
+
+  EXPECT_EQ(packet[0], 0x02);
+  EXPECT_EQ(packet[5], 0x02);
+  EXPECT_EQ(packet[11], 0x01);
+  EXPECT_EQ(read_u16(&packet[12]), 0x0800);
+
+  auto ip = &packet[14];
+  EXPECT_EQ(ip[0], 0x45);
+  EXPECT_EQ(ip[1], 0xB8);
+  EXPECT_EQ(read_u16(ip + 2), 20 + 8 + 101);
+  EXPECT_EQ(ip[9], 17);
+  EXPECT_EQ(ip[12], 192);
+  EXPECT_EQ(ip[19], 20);
+
+  // A valid header sums up to all ones, checksum included
+  EXPECT_EQ(ones_complement_sum(ip, 20), 0xFFFF);
+
+  auto udp = ip + 20;
+  EXPECT_EQ(read_u16(udp), 47998);
+  EXPECT_EQ(read_u16(udp + 2), 51234);
+  EXPECT_EQ(read_u16(udp + 4), 8 + 101);
+}
+
+TEST(XdpTests, WritesIpv6HeadersWithUdpChecksum) {
+  auto route = make_route("fd00::10", "fd00::20");
+  auto packet = make_packet(route, 101);
+  ASSERT_EQ(packet.size(), 14 + 40 + 8 + 101);
+
+  EXPECT_EQ(read_u16(&packet[12]), 0x86DD);
+
+  auto ip = &packet[14];
+  EXPECT_EQ(ip[0] >> 4, 6);
+  EXPECT_EQ(((ip[0] & 0xF) << 4) | (ip[1] >> 4), 0xB8);
+  EXPECT_EQ(read_u16(ip + 4), 8 + 101);
+  EXPECT_EQ(ip[6], 17);
+
+  // The pseudo-header, UDP header and payload sum up to all ones
+  auto udp = ip + 40;
+  std::uint32_t sum = ones_complement_sum(ip + 8, 32);
+  sum += 8 + 101;
+  sum += 17;
+  EXPECT_EQ(ones_complement_sum(udp, 8 + 101, sum), 0xFFFF);
+  EXPECT_NE(read_u16(udp + 6), 0);
+}
+#endif
@@ -0,0 +1,91 @@
+/**
+ * @file tests/unit/test_admission.cpp
+ * @brief Test src/admission.*.
+ */
+#include "../tests_common.h"
+
+#include <src/admission.h>
+
+namespace {
+  using verdict_e = admission::decision_t::verdict_e;
+
+  constexpr admission::stream_t stream_1080p120 {1920, 1080, 120, 20000};
+}  // namespace
+
+TEST(AdmissionTests, AdmitsEverythingWithoutLimits) {
+  admission::model_t model {{0, 0, 0}};
+
+  std::vector<admission::model_t::lease_t> leases;
+  for (int x = 0; x < 16; ++x) {
+    auto decision = model.decide(stream_1080p120);
+    ASSERT_EQ(decision.verdict, verdict_e::admit);
+    EXPECT_EQ(decision.stream.framerate, 120);
+    EXPECT_EQ(decision.stream.bitrate, 20000);
+
+    leases.emplace_back(model.attach(decision.stream));
+  }
+  EXPECT_EQ(model.sessions(), 16);
+}
+
+TEST(AdmissionTests, RejectsOnceEverySessionIsInUse) {
+  admission::model_t model {{2, 0, 0}};
+
+  auto first = model.attach(stream_1080p120);
+  EXPECT_EQ(model.decide(stream_1080p120).verdict, verdict_e::admit);
+
+  auto second = model.attach(stream_1080p120);
+  EXPECT_EQ(model.decide(stream_1080p120).verdict, verdict_e::reject);
+
+  // Sessions stop counting once they're gone
+  second = {};
+  EXPECT_EQ(model.decide(stream_1080p120).verdict, verdict_e::admit);
+
+  // The drivers may report sessions of other processes
+  model.set_sampled_sessions(2);
+  EXPECT_EQ(model.decide(stream_1080p120).verdict, verdict_e::reject);
+  model.set_sampled_sessions(-1);
+  EXPECT_EQ(model.decide(stream_1080p120).verdict, verdict_e::admit);
+}
+
+TEST(AdmissionTests, LowersTheFramerateToFitTheEncoders) {
+  // Room for a little over 1.5 1080p120 streams
+  admission::model_t model {{0, 1920 * 1080 * 190.0, 0}};
+
+  auto first = model.attach(stream_1080p120);
+
+  auto decision = model.decide(stream_1080p120);
+  ASSERT_EQ(decision.verdict, verdict_e::downgrade);
+  EXPECT_EQ(decision.stream.framerate, 60);
+  EXPECT_EQ(decision.stream.width, 1920);
+  EXPECT_EQ(decision.stream.height, 1080);
+  EXPECT_FALSE(decision.reason.empty());
+
+  auto second = model.attach(decision.stream);
+
+  decision = model.decide(stream_1080p120);
+  EXPECT_EQ(decision.verdict, verdict_e::reject);
+}
+
+TEST(AdmissionTests, CapsTheBitrateToTheEgressLeft) {
+  admission::model_t model {{0, 0, 50000}};
+
+  auto first = model.attach(stream_1080p120);
+  auto second = model.attach(stream_1080p120);
+
+  auto decision = model.decide(stream_1080p120);
+  ASSERT_EQ(decision.verdict, verdict_e::downgrade);
+  EXPECT_EQ(decision.stream.bitrate, 10000);
+  EXPECT_EQ(decision.stream.framerate, 120);
+
+  // Streams that lowered their bitrate leave room for others
+  first.set_bitrate(5000);
+  EXPECT_EQ(model.decide(stream_1080p120).verdict, verdict_e::admit);
+
+  auto third = model.attach(stream_1080p120);
+  auto fourth = model.attach({1920, 1080, 60, 4500});
+  EXPECT_EQ(model.decide(stream_1080p120).verdict, verdict_e::reject);
+
+  // Before the bitrate is known, only whether any is left counts
+  fourth = {};
+  EXPECT_EQ(model.decide({1920, 1080, 60, 0}).verdict, verdict_e::admit);
+}
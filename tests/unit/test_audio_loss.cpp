@@ -0,0 +1,76 @@
+/**
+ * @file tests/unit/test_audio_loss.cpp
+ * @brief Test src/audio_loss.*.
+ */
+#include "../tests_common.h"
+#include "../tests_controller_driver.h"
+
+#include <src/audio_loss.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Send 100 packets and report the ones lost every 50ms for a while.
+   * @return The last loss percentage reported, if any.
+   */
+  std::optional<int> report_loss(audio::loss_monitor_t &monitor, std::chrono::steady_clock::time_point &now, std::chrono::milliseconds duration, int lost_packets) {
+    return controller_driver::run_for(now, duration, 50ms, [&](auto at) {
+      monitor.packets_sent(100);
+      return monitor.packets_lost(lost_packets, at);
+    });
+  }
+}  // namespace
+
+TEST(AudioLossTests, KeepsSettingsWithoutLoss) {
+  auto settings = audio::loss_settings(0, 96000);
+
+  EXPECT_FALSE(settings.inband_fec);
+  EXPECT_EQ(settings.packet_loss_percentage, 0);
+  EXPECT_EQ(settings.bitrate, 96000);
+}
+
+TEST(AudioLossTests, ProtectsAndBacksOffUnderLoss) {
+  auto light = audio::loss_settings(3, 96000);
+  EXPECT_TRUE(light.inband_fec);
+  EXPECT_EQ(light.packet_loss_percentage, 3);
+  EXPECT_EQ(light.bitrate, 96000);
+
+  auto congested = audio::loss_settings(15, 96000);
+  EXPECT_TRUE(congested.inband_fec);
+  EXPECT_LT(congested.bitrate, 96000);
+
+  auto heavy = audio::loss_settings(100, 96000);
+  EXPECT_LE(heavy.packet_loss_percentage, 40);
+  EXPECT_LT(heavy.bitrate, congested.bitrate);
+  EXPECT_GT(heavy.bitrate, 0);
+}
+
+TEST(AudioLossTests, PicksUpLossAtOnceAndFadesSlowly) {
+  audio::loss_monitor_t monitor;
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_FALSE(report_loss(monitor, now, 2s, 0));
+
+  auto loss = report_loss(monitor, now, 600ms, 10);
+  ASSERT_TRUE(loss);
+  EXPECT_EQ(*loss, 10);
+
+  // A single update without loss doesn't drop the protection
+  loss = report_loss(monitor, now, 500ms, 0);
+  ASSERT_TRUE(loss);
+  EXPECT_GT(*loss, 5);
+
+  loss = report_loss(monitor, now, 10s, 0);
+  ASSERT_TRUE(loss);
+  EXPECT_EQ(*loss, 0);
+}
+
+TEST(AudioLossTests, IgnoresReportsWithoutTraffic) {
+  audio::loss_monitor_t monitor;
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_FALSE(monitor.packets_lost(5, now));
+  EXPECT_FALSE(monitor.packets_lost(5, now + 1s));
+  EXPECT_FALSE(monitor.packets_lost(5, now + 2s));
+}
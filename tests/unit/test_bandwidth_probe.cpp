@@ -0,0 +1,134 @@
+/**
+ * @file tests/unit/test_bandwidth_probe.cpp
+ * @brief Test src/bandwidth_probe.*.
+ */
+#include "../tests_common.h"
+
+#include <src/bandwidth_probe.h>
+
+#include <deque>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief A path draining a queue at a fixed rate, whose acknowledgements take a round-trip time to come back.
+   */
+  struct path_t {
+    path_t(double capacity, std::chrono::milliseconds rtt):
+        capacity {capacity},
+        rtt {rtt} {
+    }
+
+    double capacity;  // Bytes per second
+    std::chrono::milliseconds rtt;
+    std::uint32_t window = 64 * 1024;
+    double loss = 0;
+
+    double queue = 0;
+    std::uint64_t sent = 0;
+    std::uint64_t acked = 0;
+    double lost = 0;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::uint64_t>> acks;
+  };
+
+  /**
+   * @brief Run the probe over the path until it's done, sending its padding in packets of 1000 bytes.
+   */
+  std::optional<stream::bandwidth_probe_t::result_t> run(stream::bandwidth_probe_t &probe, path_t &path) {
+    auto now = std::chrono::steady_clock::now();
+    for (auto end = now + 2s; now < end && !probe.done(); now += 1ms) {
+      auto drained = std::min(path.queue, path.capacity / 1000);
+      path.queue -= drained;
+      path.lost += drained / 1000 * path.loss;
+      path.acks.emplace_back(now + path.rtt, (std::uint64_t) drained);
+      while (!path.acks.empty() && path.acks.front().first <= now) {
+        path.acked += path.acks.front().second;
+        path.acks.pop_front();
+      }
+
+      auto queueing = std::chrono::milliseconds {(int) (path.queue / path.capacity * 1000)};
+      stream::bandwidth_probe_t::sample_t sample {path.sent - std::min(path.sent, path.acked), path.rtt + queueing, (std::uint32_t) path.lost, path.window};
+
+      auto due = probe.update(sample, now);
+      int packets = 0;
+      std::size_t bytes = 0;
+      while (bytes + 1000 <= due && sample.bytes_in_flight + bytes + 1000 <= path.window) {
+        bytes += 1000;
+        ++packets;
+      }
+      path.queue += bytes;
+      path.sent += bytes;
+      probe.sent(bytes, packets);
+    }
+
+    return probe.wait(0ms);
+  }
+}  // namespace
+
+TEST(BandwidthProbeTests, KeepsRequestedBitrateWhenPathKeepsUp) {
+  // 20 Mbps with 20% FEC over a 200 Mbps path
+  stream::bandwidth_probe_t probe {20000, 20};
+  path_t path {200e6 / 8, 2ms};
+
+  auto result = run(probe, path);
+  ASSERT_TRUE(result);
+  EXPECT_FALSE(result->capacity);
+  EXPECT_EQ(result->rtt, 2ms);
+  EXPECT_DOUBLE_EQ(result->loss, 0);
+  EXPECT_EQ(result->bitrate(20000, 20), 20000);
+}
+
+TEST(BandwidthProbeTests, LowersBitrateBelowCapacityOfSlowPath) {
+  // 80 Mbps with 20% FEC over a 40 Mbps path
+  stream::bandwidth_probe_t probe {80000, 20};
+  path_t path {40e6 / 8, 2ms};
+
+  auto result = run(probe, path);
+  ASSERT_TRUE(result);
+  ASSERT_TRUE(result->capacity);
+  EXPECT_GE(*result->capacity, 24000);
+  EXPECT_LE(*result->capacity, 44000);
+
+  // The stream and its FEC fit into what the path carried
+  auto bitrate = result->bitrate(80000, 20);
+  EXPECT_LE(bitrate * 1.2, *result->capacity);
+  EXPECT_GE(bitrate, 4000);
+}
+
+TEST(BandwidthProbeTests, StopsAtLossyStep) {
+  stream::bandwidth_probe_t probe {20000, 20};
+  path_t path {200e6 / 8, 2ms};
+  path.loss = 0.1;
+
+  auto result = run(probe, path);
+  ASSERT_TRUE(result);
+  ASSERT_TRUE(result->capacity);
+  EXPECT_GT(result->loss, 0.05);
+  EXPECT_LT(result->bitrate(20000, 20), 20000);
+}
+
+TEST(BandwidthProbeTests, WindowLimitDoesntLowerBitrate) {
+  // 20 ms round trips only fit about 26 Mbps through a 64 KiB window
+  stream::bandwidth_probe_t probe {100000, 20};
+  path_t path {1e9 / 8, 20ms};
+
+  auto result = run(probe, path);
+  ASSERT_TRUE(result);
+  EXPECT_FALSE(result->capacity);
+  EXPECT_EQ(result->bitrate(100000, 20), 100000);
+}
+
+TEST(BandwidthProbeTests, StopsWhenNotFinishedInTime) {
+  stream::bandwidth_probe_t probe {20000, 20};
+
+  EXPECT_FALSE(probe.wait(1ms));
+  EXPECT_TRUE(probe.done());
+  EXPECT_EQ(probe.update({0, 2ms, 0, 64 * 1024}), 0u);
+}
+
+TEST(BandwidthProbeTests, BitrateNeverGoesBelowMinimum) {
+  stream::bandwidth_probe_t::result_t result {100, 0, 2ms};
+  EXPECT_EQ(result.bitrate(20000, 20), 1000);
+  EXPECT_EQ(result.bitrate(400, 20), 400);
+}
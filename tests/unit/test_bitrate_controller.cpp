@@ -0,0 +1,140 @@
+/**
+ * @file tests/unit/test_bitrate_controller.cpp
+ * @brief Test src/bitrate_controller.*.
+ */
+#include "../tests_common.h"
+#include "../tests_controller_driver.h"
+
+#include <src/bitrate_controller.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Send frames of 100 packets at 100 FPS for a while.
+   * @return The last bitrate the encoder was told about, if any.
+   */
+  std::optional<int> send_frames(stream::bitrate_controller_t &controller, std::chrono::steady_clock::time_point &now, std::chrono::milliseconds duration, std::chrono::milliseconds queue_delay = 5ms, int lost_packets_per_frame = 0) {
+    return controller_driver::run_for(now, duration, 10ms, [&](auto at) {
+      controller.packets_lost(lost_packets_per_frame);
+      return controller.frame_sent(100, queue_delay, at);
+    });
+  }
+}  // namespace
+
+TEST(BitrateControllerTests, KeepsBitrateWithoutLoss) {
+  stream::bitrate_controller_t controller {20000, 20};
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_FALSE(send_frames(controller, now, 10s));
+  EXPECT_EQ(controller.bitrate(), 20000);
+  EXPECT_EQ(controller.fec_percentage(), 20);
+}
+
+TEST(BitrateControllerTests, BacksOffOnLossAndRecovers) {
+  stream::bitrate_controller_t controller {20000, 20};
+  auto now = std::chrono::steady_clock::now();
+  send_frames(controller, now, 1s);
+
+  // 10% loss
+  auto bitrate = send_frames(controller, now, 3s, 5ms, 10);
+  ASSERT_TRUE(bitrate);
+  EXPECT_LT(*bitrate, 20000);
+  EXPECT_GE(*bitrate, 1000);
+  EXPECT_GT(controller.fec_percentage(), 20);
+
+  // Decreases are spaced out, so the network has time to drain
+  EXPECT_GE(controller.bitrate(), (int) (20000 * 0.85 * 0.85 * 0.85 * 0.85));
+
+  // The bitrate goes back up once the loss stops, and the FEC goes back down
+  bitrate = send_frames(controller, now, 30s);
+  ASSERT_TRUE(bitrate);
+  EXPECT_EQ(*bitrate, 20000);
+  EXPECT_EQ(controller.fec_percentage(), 20);
+}
+
+TEST(BitrateControllerTests, BacksOffWhenFramesQueueUp) {
+  stream::bitrate_controller_t controller {20000, 20};
+  auto now = std::chrono::steady_clock::now();
+  send_frames(controller, now, 2s, 5ms);
+
+  auto bitrate = send_frames(controller, now, 1s, 40ms);
+  ASSERT_TRUE(bitrate);
+  EXPECT_LT(*bitrate, 20000);
+}
+
+TEST(BitrateControllerTests, LostFramesCountAsLoss) {
+  stream::bitrate_controller_t controller {20000, 20};
+  auto now = std::chrono::steady_clock::now();
+  send_frames(controller, now, 1s);
+
+  for (int x = 0; x < 10; ++x) {
+    controller.frames_lost(10);
+    send_frames(controller, now, 100ms);
+  }
+
+  EXPECT_LT(controller.bitrate(), 20000);
+}
+
+TEST(BitrateControllerTests, StaysWithinLimits) {
+  stream::bitrate_controller_t controller {10000, 10};
+  auto now = std::chrono::steady_clock::now();
+
+  send_frames(controller, now, 120s, 5ms, 100);
+  EXPECT_EQ(controller.bitrate(), 500);
+  EXPECT_EQ(controller.fec_percentage(), 50);
+
+  // A client asking for less than the floor gets what it asked for
+  stream::bitrate_controller_t slow_controller {300, 10};
+  send_frames(slow_controller, now, 10s, 5ms, 100);
+  EXPECT_EQ(slow_controller.bitrate(), 300);
+}
+
+TEST(BitrateControllerTests, PerFrameFecFollowsFrameTypeAndLoss) {
+  stream::bitrate_controller_t controller {20000, 20, false, true};
+  auto now = std::chrono::steady_clock::now();
+
+  // Less FEC for ordinary frames on a clean network, more for the frames the client recovers with
+  send_frames(controller, now, 2s);
+  EXPECT_EQ(controller.fec_percentage(false), 5);
+  EXPECT_EQ(controller.fec_percentage(true), 40);
+
+  // 10% loss
+  send_frames(controller, now, 5s, 5ms, 10);
+  EXPECT_GT(controller.fec_percentage(false), 20);
+  EXPECT_GT(controller.fec_percentage(true), controller.fec_percentage(false));
+  EXPECT_LE(controller.fec_percentage(true), 100);
+
+  // Only the FEC adapts
+  EXPECT_EQ(controller.bitrate(), 20000);
+}
+
+TEST(BitrateControllerTests, FollowsNewLimits) {
+  stream::bitrate_controller_t controller {20000, 20};
+  auto now = std::chrono::steady_clock::now();
+  send_frames(controller, now, 1s);
+
+  controller.reconfigure(10000, 30);
+  EXPECT_EQ(send_frames(controller, now, 1s), 10000);
+  EXPECT_EQ(controller.fec_percentage(), 30);
+
+  // Raising the limit probes up to it again
+  controller.reconfigure(15000, 10);
+  send_frames(controller, now, 30s);
+  EXPECT_EQ(controller.bitrate(), 15000);
+  EXPECT_EQ(controller.fec_percentage(), 10);
+}
+
+TEST(BitrateControllerTests, StartsFromProbedBitrateAndLoss) {
+  stream::bitrate_controller_t controller {20000, 20};
+  auto now = std::chrono::steady_clock::now();
+
+  controller.start_from(8000, 0.05, now);
+  EXPECT_EQ(controller.bitrate(), 8000);
+  EXPECT_EQ(controller.fec_percentage(), 30);
+
+  // It climbs back to the maximum once the network keeps up
+  send_frames(controller, now, 30s);
+  EXPECT_EQ(controller.bitrate(), 20000);
+  EXPECT_EQ(controller.fec_percentage(), 20);
+}
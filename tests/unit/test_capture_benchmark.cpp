@@ -0,0 +1,78 @@
+/**
+ * @file tests/unit/test_capture_benchmark.cpp
+ * @brief Test src/capture_benchmark.*.
+ */
+#include "../tests_common.h"
+
+#include <src/capture_benchmark.h>
+
+using namespace std::literals;
+
+namespace {
+  video::capture_stats_t stats(std::size_t frames, std::chrono::milliseconds latency, std::chrono::milliseconds jitter = 0ms, std::chrono::milliseconds cpu_time = 0ms) {
+    return {frames, latency, jitter, cpu_time};
+  }
+
+  std::filesystem::path benchmark_file() {
+    auto file = std::filesystem::temp_directory_path() / "test_capture_benchmark.json";
+    std::filesystem::remove(file);
+    return file;
+  }
+}  // namespace
+
+TEST(CaptureBenchmarkTests, SummarizesFrames) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::chrono::steady_clock::time_point> arrivals {start, start + 10ms, start + 20ms, start + 30ms};
+  std::vector<std::chrono::nanoseconds> latencies {2ms, 4ms};
+
+  auto summary = video::summarize_capture(arrivals, latencies, 40ms);
+  EXPECT_EQ(summary.frames, 4);
+  EXPECT_EQ(summary.latency, 3ms);
+  EXPECT_EQ(summary.jitter, 0ns);
+  EXPECT_EQ(summary.cpu_time, 10ms);
+}
+
+TEST(CaptureBenchmarkTests, CountsMissedFrames) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::chrono::steady_clock::time_point> arrivals {start, start + 10ms, start + 30ms, start + 41ms, start + 80ms};
+
+  auto summary = video::summarize_capture(arrivals, {}, 0ms, 10ms);
+  EXPECT_DOUBLE_EQ(summary.fps, 50);
+  EXPECT_EQ(summary.missed_frames, 4);
+
+  EXPECT_EQ(video::summarize_capture(arrivals, {}, 0ms).missed_frames, 0);
+}
+
+TEST(CaptureBenchmarkTests, SummarizesNoFrames) {
+  auto summary = video::summarize_capture({}, {}, 40ms);
+  EXPECT_EQ(summary.frames, 0);
+  EXPECT_EQ(summary.latency, 0ns);
+  EXPECT_EQ(summary.cpu_time, 40ms);
+}
+
+TEST(CaptureBenchmarkTests, PicksLowestCost) {
+  EXPECT_EQ(video::pick_capture_method({}), "");
+  EXPECT_EQ(video::pick_capture_method({{"kms", stats(120, 4ms, 1ms, 1ms)}, {"x11", stats(120, 3ms, 1ms, 5ms)}}), "kms");
+  EXPECT_EQ(video::pick_capture_method({{"kms", stats(120, 4ms)}, {"x11", stats(120, 3ms)}}), "x11");
+}
+
+TEST(CaptureBenchmarkTests, PassesOverMethodsThatMissFrames) {
+  EXPECT_EQ(video::pick_capture_method({{"ddx", stats(120, 8ms)}, {"wgc", stats(60, 2ms)}}), "ddx");
+  EXPECT_EQ(video::pick_capture_method({{"ddx", stats(120, 8ms)}, {"wgc", stats(110, 2ms)}}), "wgc");
+}
+
+TEST(CaptureBenchmarkTests, PrefersFirstMethodOnIdleDisplay) {
+  EXPECT_EQ(video::pick_capture_method({{"ddx", stats(1, 8ms)}, {"wgc", stats(0, 0ms)}}), "ddx");
+}
+
+TEST(CaptureBenchmarkTests, PersistsWinnerForKey) {
+  auto file = benchmark_file();
+  EXPECT_FALSE(video::load_capture_method(file, "gpu 10de 2684"));
+
+  video::save_capture_method(file, "gpu 10de 2684", "kms");
+  EXPECT_EQ(video::load_capture_method(file, "gpu 10de 2684"), "kms");
+  EXPECT_FALSE(video::load_capture_method(file, "gpu 1002 744c"));
+  EXPECT_FALSE(video::load_capture_method(file, ""));
+
+  std::filesystem::remove(file);
+}
@@ -0,0 +1,49 @@
+/**
+ * @file tests/unit/test_consumer_signal.cpp
+ * @brief Test src/consumer_signal.*.
+ */
+#include "../tests_common.h"
+
+#include <src/consumer_signal.h>
+
+#include <thread>
+
+TEST(ConsumerSignalTests, NotifyAfterPrepareIsNotMissed) {
+  util::consumer_signal_t signal;
+
+  auto seen = signal.prepare();
+  signal.notify();
+
+  // Returns at once, since the signal was bumped after the sample
+  signal.wait(seen);
+  EXPECT_NE(signal.prepare(), seen);
+}
+
+TEST(ConsumerSignalTests, WakesSleepingConsumer) {
+  constexpr int count = 100000;
+
+  util::consumer_signal_t signal;
+  std::atomic<int> published {0};
+
+  std::thread producer {[&]() {
+    for (int x = 0; x < count; ++x) {
+      published.store(x + 1, std::memory_order_release);
+      signal.notify();
+    }
+  }};
+
+  int consumed = 0;
+  while (consumed < count) {
+    auto seen = signal.prepare();
+    auto value = published.load(std::memory_order_acquire);
+    if (value == consumed) {
+      signal.wait(seen);
+      continue;
+    }
+
+    consumed = value;
+  }
+
+  producer.join();
+  EXPECT_EQ(consumed, count);
+}
@@ -0,0 +1,101 @@
+/**
+ * @file tests/unit/test_crypto.cpp
+ * @brief Test src/crypto.*.
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <src/crypto.h>
+#include <src/stream.h>
+
+namespace {
+  constexpr auto shard_size = 1024;
+  constexpr auto shard_count = 64;
+
+  using prefix_t = stream::video_packet_enc_prefix_t;
+  static_assert(sizeof(prefix_t::tag) == crypto::cipher::tag_size);
+
+  const crypto::aes_t key(16, 0x42);
+
+  std::vector<std::uint8_t> make_shards() {
+    std::vector<std::uint8_t> data(shard_size * shard_count);
+    for (std::size_t x = 0; x < data.size(); ++x) {
+      data[x] = (std::uint8_t) (x * 31);
+    }
+    return data;
+  }
+
+  std::vector<std::uint8_t *> shard_pointers(std::vector<std::uint8_t> &data) {
+    std::vector<std::uint8_t *> shards_p(shard_count);
+    for (int x = 0; x < shard_count; ++x) {
+      shards_p[x] = &data[x * shard_size];
+    }
+    return shards_p;
+  }
+
+  void encrypt_each(crypto::cipher::gcm_t &cipher, std::vector<std::uint8_t *> &shards_p, std::vector<prefix_t> &prefixes, crypto::aes_t &iv, std::uint64_t &iv_counter) {
+    for (int x = 0; x < shards_p.size(); ++x) {
+      std::copy_n((std::uint8_t *) &iv_counter, sizeof(iv_counter), std::begin(iv));
+      ++iv_counter;
+
+      auto &prefix = prefixes[x];
+      std::copy(std::begin(iv), std::end(iv), prefix.iv);
+      ASSERT_GE(cipher.encrypt(std::string_view {(char *) shards_p[x], shard_size}, prefix.tag, shards_p[x], &iv), 0);
+    }
+  }
+}  // namespace
+
+TEST(CryptoTests, GcmEncryptsShardsInPlace) {
+  auto plain = make_shards();
+  auto data = plain;
+  auto shards_p = shard_pointers(data);
+  std::vector<prefix_t> prefixes(shard_count);
+
+  crypto::aes_t iv(sizeof(prefix_t::iv));
+  iv[11] = 'V';
+
+  crypto::cipher::gcm_t cipher {key, false};
+  std::uint64_t iv_counter = 5;
+  encrypt_each(cipher, shards_p, prefixes, iv, iv_counter);
+
+  EXPECT_EQ(iv_counter, 5 + shard_count);
+  EXPECT_NE(data, plain);
+
+  // Every shard decrypts with the IV and tag written next to it
+  for (int x = 0; x < shard_count; ++x) {
+    auto &prefix = prefixes[x];
+    crypto::aes_t shard_iv(std::begin(prefix.iv), std::end(prefix.iv));
+
+    std::string tagged_cipher((char *) prefix.tag, sizeof(prefix.tag));
+    tagged_cipher.append((char *) shards_p[x], shard_size);
+
+    std::vector<std::uint8_t> plaintext;
+    ASSERT_EQ(cipher.decrypt(tagged_cipher, plaintext, &shard_iv), 0);
+    EXPECT_TRUE(std::equal(std::begin(plaintext), std::end(plaintext), plain.data() + x * shard_size, plain.data() + (x + 1) * shard_size));
+  }
+}
+
+TEST(CryptoTests, CertChainFindsPairedCert) {
+  crypto::cert_chain_t chain;
+  std::vector<crypto::p_named_cert_t> paired;
+  for (auto name : {"first", "second", "third"}) {
+    auto named_cert_p = std::make_shared<crypto::named_cert_t>();
+    named_cert_p->name = name;
+    named_cert_p->cert = crypto::gen_creds(name, 2048).x509;
+    chain.add(named_cert_p);
+    paired.emplace_back(std::move(named_cert_p));
+  }
+
+  for (auto &named_cert_p : paired) {
+    crypto::p_named_cert_t verified;
+    EXPECT_EQ(chain.verify(crypto::x509(named_cert_p->cert).get(), verified), nullptr);
+    EXPECT_EQ(verified, named_cert_p);
+  }
+
+  crypto::p_named_cert_t verified;
+  EXPECT_NE(chain.verify(crypto::x509(crypto::gen_creds("unpaired", 2048).x509).get(), verified), nullptr);
+  EXPECT_FALSE(verified);
+
+  chain.clear();
+  EXPECT_NE(chain.verify(crypto::x509(paired.front()->cert).get(), verified), nullptr);
+}
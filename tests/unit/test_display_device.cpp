@@ -122,6 +122,23 @@ TEST_P(ParseHdrOption, IntegrationTest) {
   EXPECT_EQ(std::get<display_device::SingleDisplayConfiguration>(result).m_hdr_state, expected_value);
 }
 
+TEST(DisplayDeviceConfigTest, ToneMappingKeepsHdrOnForSdrStreams) {
+  config::video_t video_config {};
+  video_config.dd.configuration_option = config_option_e::verify_only;
+  video_config.dd.hdr_option = hdr_option_e::automatic;
+  video_config.hdr_tone_mapping = true;
+
+  rtsp_stream::launch_session_t session {};
+  session.enable_hdr = false;
+
+  auto result {display_device::parse_configuration(video_config, session)};
+  EXPECT_EQ(std::get<display_device::SingleDisplayConfiguration>(result).m_hdr_state, std::nullopt);
+
+  session.enable_hdr = true;
+  result = display_device::parse_configuration(video_config, session);
+  EXPECT_EQ(std::get<display_device::SingleDisplayConfiguration>(result).m_hdr_state, hdr_state_e::Enabled);
+}
+
 using ParseResolutionOption = DisplayDeviceConfigTest<std::pair<std::tuple<resolution_option_e, sops_enabled_t, std::variant<client_resolution_t, std::string>>, std::variant<failed_to_parse_resolution_tag_t, no_resolution_tag_t, resolution_t>>>;
 INSTANTIATE_TEST_SUITE_P(
   DisplayDeviceConfigTest,
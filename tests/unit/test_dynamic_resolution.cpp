@@ -0,0 +1,86 @@
+/**
+ * @file tests/unit/test_dynamic_resolution.cpp
+ * @brief Test src/dynamic_resolution.*.
+ */
+#include "../tests_common.h"
+#include "../tests_controller_driver.h"
+
+#include <src/dynamic_resolution.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Account for frames at 60 FPS for a while, with the encoder loaded as given.
+   */
+  std::optional<int> run(dynamic_resolution::controller_t &controller, std::chrono::steady_clock::time_point &now, std::chrono::seconds duration, double load, bool saturated = false) {
+    return controller_driver::run_until_report(now, duration, 16667us, [&](auto at) {
+      return controller.update(load, saturated, at);
+    });
+  }
+}  // namespace
+
+TEST(DynamicResolutionTests, ScalesSizes) {
+  EXPECT_EQ(dynamic_resolution::scaled_size(1920, 1080, 0), std::make_pair(1920, 1080));
+  EXPECT_EQ(dynamic_resolution::scaled_size(1920, 1080, 1), std::make_pair(1600, 900));
+  EXPECT_EQ(dynamic_resolution::scaled_size(1920, 1080, 2), std::make_pair(1280, 720));
+  EXPECT_EQ(dynamic_resolution::scaled_size(1920, 1080, 3), std::make_pair(960, 540));
+
+  // Odd sizes are rounded down
+  EXPECT_EQ(dynamic_resolution::scaled_size(1366, 768, 1), std::make_pair(1138, 640));
+}
+
+TEST(DynamicResolutionTests, KeepsResolutionWithEnoughBits) {
+  dynamic_resolution::controller_t controller {1920, 1080, 60, 0, 20000};
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_FALSE(run(controller, now, 60s, 0.3));
+  EXPECT_EQ(controller.step(), 0);
+}
+
+TEST(DynamicResolutionTests, StepsDownWhenBandwidthCollapses) {
+  dynamic_resolution::controller_t controller {1920, 1080, 60, 0, 20000};
+  auto now = std::chrono::steady_clock::now();
+  EXPECT_FALSE(run(controller, now, 10s, 0.3));
+
+  // 4 Mbps is too little for 1080p60
+  controller.set_bitrate(4000);
+  auto step = run(controller, now, 10s, 0.3);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(*step, 1);
+
+  // And too little for 900p60, once the stream settled
+  controller.set_step(*step);
+  EXPECT_FALSE(run(controller, now, 6s, 0.3));
+  step = run(controller, now, 10s, 0.3);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(*step, 2);
+}
+
+TEST(DynamicResolutionTests, StepsDownWhenEncoderSaturates) {
+  dynamic_resolution::controller_t controller {1920, 1080, 60, 1, 50000};
+  auto now = std::chrono::steady_clock::now();
+  EXPECT_FALSE(run(controller, now, 10s, 0.9));
+
+  auto step = run(controller, now, 10s, 1.2, true);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(*step, 1);
+}
+
+TEST(DynamicResolutionTests, StepsBackUp) {
+  dynamic_resolution::controller_t controller {1920, 1080, 60, 0, 20000};
+  controller.set_step(2);
+  auto now = std::chrono::steady_clock::now();
+
+  // The encoder would be too loaded at 900p
+  EXPECT_FALSE(run(controller, now, 60s, 0.4));
+
+  auto step = run(controller, now, 60s, 0.2);
+  ASSERT_TRUE(step);
+  EXPECT_EQ(*step, 1);
+
+  // Not while the bitrate is only just enough for 1080p
+  dynamic_resolution::controller_t scarce {1920, 1080, 60, 0, 7000};
+  scarce.set_step(1);
+  EXPECT_FALSE(run(scarce, now, 60s, 0.2));
+}
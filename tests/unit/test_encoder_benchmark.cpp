@@ -0,0 +1,106 @@
+/**
+ * @file tests/unit/test_encoder_benchmark.cpp
+ * @brief Test src/encoder_benchmark.*.
+ */
+#include "../tests_common.h"
+
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <src/encoder_benchmark.h>
+
+using namespace std::literals;
+
+namespace {
+  struct test_img_t: platf::img_t {
+    test_img_t(int width, int height):
+        buffer(width * height * 4) {
+      data = buffer.data();
+      this->width = width;
+      this->height = height;
+      pixel_pitch = 4;
+      row_pitch = width * 4;
+    }
+
+    std::vector<std::uint8_t> buffer;
+  };
+}  // namespace
+
+TEST(EncoderBenchmarkTests, SummarizesFrames) {
+  std::vector<video::encoded_frame_t> frames;
+  for (int x = 0; x < 100; ++x) {
+    frames.emplace_back(video::encoded_frame_t {1ms, std::chrono::milliseconds {x + 1}, 1000});
+  }
+
+  auto summary = video::summarize_encode(frames, 500ms, 50);
+  EXPECT_EQ(summary.frames, 100);
+  EXPECT_DOUBLE_EQ(summary.fps, 200);
+  EXPECT_EQ(summary.latency_p50, 51ms);
+  EXPECT_EQ(summary.latency_p95, 96ms);
+  EXPECT_EQ(summary.latency_p99, 100ms);
+  EXPECT_EQ(summary.convert_time, 1ms);
+
+  // 1000 bytes per frame at 50 fps
+  EXPECT_DOUBLE_EQ(summary.bitrate_kbps, 400);
+  EXPECT_DOUBLE_EQ(summary.bitrate_stddev_kbps, 0);
+}
+
+TEST(EncoderBenchmarkTests, MeasuresBitrateVariance) {
+  std::vector<video::encoded_frame_t> frames;
+  for (int x = 0; x < 4; ++x) {
+    frames.emplace_back(video::encoded_frame_t {0ms, 1ms, x < 2 ? 1000u : 3000u});
+  }
+
+  // Two windows of 2 frames: 16 kbps and 48 kbps
+  auto summary = video::summarize_encode(frames, 4ms, 2);
+  EXPECT_DOUBLE_EQ(summary.bitrate_kbps, 32);
+  EXPECT_DOUBLE_EQ(summary.bitrate_stddev_kbps, 16);
+}
+
+TEST(EncoderBenchmarkTests, SummarizesNoFrames) {
+  auto summary = video::summarize_encode({}, 1s, 60);
+  EXPECT_EQ(summary.frames, 0);
+  EXPECT_EQ(summary.fps, 0);
+  EXPECT_EQ(summary.latency_p99, 0ns);
+  EXPECT_EQ(summary.bitrate_kbps, 0);
+}
+
+TEST(EncoderBenchmarkTests, DrawsMovingContent) {
+  test_img_t first {64, 32};
+  test_img_t second {64, 32};
+  test_img_t again {64, 32};
+
+  ASSERT_TRUE(video::draw_test_pattern(first, 1));
+  ASSERT_TRUE(video::draw_test_pattern(second, 2));
+  ASSERT_TRUE(video::draw_test_pattern(again, 1));
+
+  EXPECT_NE(first.buffer, second.buffer);
+  EXPECT_EQ(first.buffer, again.buffer);
+}
+
+TEST(EncoderBenchmarkTests, LeavesImagesInVideoMemoryAlone) {
+  test_img_t img {64, 32};
+  img.data = nullptr;
+
+  EXPECT_FALSE(video::draw_test_pattern(img, 1));
+}
+
+TEST(EncoderBenchmarkTests, WritesReport) {
+  auto file = std::filesystem::temp_directory_path() / "test_encoder_benchmark.json";
+
+  video::encode_stats_t stats {600, 150, 4ms, 6ms, 8ms, 1ms, 20000, 500};
+  ASSERT_TRUE(video::save_encoder_benchmark(file, {{"nvenc", "h264_nvenc", 1920, 1080, 60, 20000, true, stats}}));
+
+  std::ifstream in {file};
+  auto root = nlohmann::json::parse(in);
+  ASSERT_EQ(root["results"].size(), 1);
+
+  auto &result = root["results"][0];
+  EXPECT_EQ(result["codec"], "h264_nvenc");
+  EXPECT_EQ(result["framerate"], 60);
+  EXPECT_EQ(result["fps"], 150);
+  EXPECT_EQ(result["latency_ms"]["p99"], 8);
+  EXPECT_EQ(result["output_bitrate_stddev_kbps"], 500);
+
+  in.close();
+  std::filesystem::remove(file);
+}
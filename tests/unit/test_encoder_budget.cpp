@@ -0,0 +1,99 @@
+/**
+ * @file tests/unit/test_encoder_budget.cpp
+ * @brief Test src/encoder_budget.*.
+ */
+#include "../tests_common.h"
+#include "../tests_controller_driver.h"
+
+#include <src/encoder_budget.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Encode frames at 60 FPS for a while, each taking as long as given.
+   */
+  std::optional<int> encode_frames(encoder_budget::monitor_t &monitor, std::chrono::steady_clock::time_point &now, std::chrono::seconds duration, std::chrono::microseconds busy_time) {
+    return controller_driver::run_until_report(now, duration, 16667us, [&](auto at) {
+      return monitor.frame_encoded(busy_time, at);
+    });
+  }
+}  // namespace
+
+TEST(EncoderBudgetTests, StepsDownOnOverruns) {
+  encoder_budget::monitor_t monitor {60, 0, 2};
+  auto now = std::chrono::steady_clock::now();
+
+  // Frames within the budget
+  EXPECT_FALSE(encode_frames(monitor, now, 10s, 8ms));
+
+  // Frames taking longer than they last
+  auto level = encode_frames(monitor, now, 10s, 20ms);
+  ASSERT_TRUE(level);
+  EXPECT_EQ(*level, 1);
+}
+
+TEST(EncoderBudgetTests, StepsDownOnBusyFrames) {
+  encoder_budget::monitor_t monitor {60, 0, 2};
+  auto now = std::chrono::steady_clock::now();
+
+  // None overrun, but they leave no time to send them
+  auto level = encode_frames(monitor, now, 10s, 15ms);
+  ASSERT_TRUE(level);
+  EXPECT_EQ(*level, 1);
+}
+
+TEST(EncoderBudgetTests, SettlesFirst) {
+  encoder_budget::monitor_t monitor {60, 0, 2};
+  auto now = std::chrono::steady_clock::now();
+
+  // The first frames of the encoder are slow
+  EXPECT_FALSE(encode_frames(monitor, now, 4s, 20ms));
+  EXPECT_TRUE(encode_frames(monitor, now, 4s, 20ms));
+}
+
+TEST(EncoderBudgetTests, StepsBackUp) {
+  encoder_budget::monitor_t monitor {60, 1, 2};
+  auto now = std::chrono::steady_clock::now();
+
+  // Some headroom isn't enough
+  EXPECT_FALSE(encode_frames(monitor, now, 60s, 10ms));
+
+  auto level = encode_frames(monitor, now, 60s, 4ms);
+  ASSERT_TRUE(level);
+  EXPECT_EQ(*level, 0);
+
+  // Already at the top, or at the bottom
+  encoder_budget::monitor_t top {60, 0, 2};
+  EXPECT_FALSE(encode_frames(top, now, 60s, 4ms));
+  encoder_budget::monitor_t bottom {60, 2, 2};
+  EXPECT_FALSE(encode_frames(bottom, now, 60s, 20ms));
+}
+
+TEST(EncoderBudgetTests, RemembersLevels) {
+  EXPECT_EQ(encoder_budget::level_for("nvenc"sv, 0, 1920, 1080, 120), 0);
+  encoder_budget::set_level("nvenc"sv, 0, 1920, 1080, 120, 2);
+  EXPECT_EQ(encoder_budget::level_for("nvenc"sv, 0, 1920, 1080, 120), 2);
+
+  // Other encoders and codecs start from the top
+  EXPECT_EQ(encoder_budget::level_for("software"sv, 0, 1920, 1080, 120), 0);
+  EXPECT_EQ(encoder_budget::level_for("nvenc"sv, 1, 1920, 1080, 120), 0);
+  encoder_budget::set_level("nvenc"sv, 0, 1920, 1080, 120, 0);
+}
+
+TEST(EncoderBudgetTests, ReportsSaturation) {
+  encoder_budget::monitor_t monitor {60, 1, 1};
+  auto now = std::chrono::steady_clock::now();
+
+  // Settling isn't saturation
+  EXPECT_FALSE(encode_frames(monitor, now, 4s, 20ms));
+  EXPECT_FALSE(monitor.saturated());
+  EXPECT_GT(monitor.load(), 1.0);
+
+  EXPECT_FALSE(encode_frames(monitor, now, 4s, 20ms));
+  EXPECT_TRUE(monitor.saturated());
+
+  EXPECT_FALSE(encode_frames(monitor, now, 4s, 8ms));
+  EXPECT_FALSE(monitor.saturated());
+  EXPECT_NEAR(monitor.load(), 0.48, 0.01);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/test_encoder_probe_cache.cpp
+ * @brief Test src/encoder_probe_cache.*.
+ */
+#include "../tests_common.h"
+
+#include <fstream>
+#include <src/encoder_probe_cache.h>
+
+namespace {
+  std::filesystem::path cache_file() {
+    auto file = std::filesystem::temp_directory_path() / "test_encoder_probe_cache.json";
+    std::filesystem::remove(file);
+    return file;
+  }
+}  // namespace
+
+TEST(EncoderProbeCacheTests, PersistsAcrossInstances) {
+  auto file = cache_file();
+  video::encoder_probe_cache_t::result_t nvenc {true, {0b10111, 0b11111, 0}};
+  video::encoder_probe_cache_t::result_t vaapi {false, {}};
+
+  {
+    video::encoder_probe_cache_t cache {file};
+    cache.load("gpu 10de 2684");
+    EXPECT_FALSE(cache.find("nvenc"));
+
+    cache.store("nvenc", nvenc);
+    cache.store("vaapi", vaapi);
+  }
+
+  video::encoder_probe_cache_t cache {file};
+  cache.load("gpu 10de 2684");
+  EXPECT_EQ(cache.find("nvenc"), nvenc);
+  EXPECT_EQ(cache.find("vaapi"), vaapi);
+  EXPECT_FALSE(cache.find("software"));
+
+  std::filesystem::remove(file);
+}
+
+TEST(EncoderProbeCacheTests, DropsResultsOfAnotherKey) {
+  auto file = cache_file();
+
+  {
+    video::encoder_probe_cache_t cache {file};
+    cache.load("driver 550.54");
+    cache.store("nvenc", {true, {1, 1, 1}});
+  }
+
+  video::encoder_probe_cache_t cache {file};
+  cache.load("driver 555.42");
+  EXPECT_FALSE(cache.find("nvenc"));
+
+  // The results of the new key replace the old ones on disk
+  cache.store("nvenc", {false, {}});
+  cache.load("driver 550.54");
+  EXPECT_FALSE(cache.find("nvenc"));
+
+  std::filesystem::remove(file);
+}
+
+TEST(EncoderProbeCacheTests, EmptyKeyDisablesCache) {
+  auto file = cache_file();
+
+  video::encoder_probe_cache_t cache {file};
+  cache.load("");
+  cache.store("nvenc", {true, {1, 1, 1}});
+
+  EXPECT_FALSE(cache.find("nvenc"));
+  EXPECT_FALSE(std::filesystem::exists(file));
+}
+
+TEST(EncoderProbeCacheTests, ClearRemovesFile) {
+  auto file = cache_file();
+
+  video::encoder_probe_cache_t cache {file};
+  cache.load("gpu 1002 744c");
+  cache.store("vaapi", {true, {1, 0, 0}});
+  ASSERT_TRUE(std::filesystem::exists(file));
+
+  cache.clear();
+  EXPECT_FALSE(std::filesystem::exists(file));
+
+  cache.load("gpu 1002 744c");
+  EXPECT_FALSE(cache.find("vaapi"));
+}
+
+TEST(EncoderProbeCacheTests, IgnoresCorruptFile) {
+  auto file = cache_file();
+  {
+    std::ofstream out {file};
+    out << R"({"version": 1, "key": "gpu", "encoders": {"nvenc": {"passed": true}}})";
+  }
+
+  video::encoder_probe_cache_t cache {file};
+  cache.load("gpu");
+  EXPECT_FALSE(cache.find("nvenc"));
+
+  std::filesystem::remove(file);
+}
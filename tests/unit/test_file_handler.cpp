@@ -4,6 +4,7 @@
  */
 #include "../tests_common.h"
 
+#include <filesystem>
 #include <format>
 #include <src/file_handler.h>
 
@@ -94,3 +95,41 @@ TEST(FileHandlerTests, ReadMissingFileTest) {
   // read missing file
   EXPECT_EQ(file_handler::read_file("non-existing-file.txt"), "");
 }
+
+TEST(FileHandlerTests, ReadFileRangeTest) {
+  const std::string fileName = "read_file_range_test.txt";
+  ASSERT_EQ(file_handler::write_file(fileName.c_str(), "0123456789"), 0);
+
+  EXPECT_EQ(file_handler::read_file_range(fileName.c_str(), 0), "0123456789");
+  EXPECT_EQ(file_handler::read_file_range(fileName.c_str(), 4, 3), "456");
+  EXPECT_EQ(file_handler::read_file_range(fileName.c_str(), 8, 5), "89");
+  EXPECT_EQ(file_handler::read_file_range(fileName.c_str(), 10), "");
+  EXPECT_EQ(file_handler::read_file_range("non-existing-file.txt", 0), "");
+}
+
+TEST(FileHandlerTests, FindTailTest) {
+  const std::string fileName = "find_tail_test.txt";
+  ASSERT_EQ(file_handler::write_file(fileName.c_str(), "one\ntwo\nthree\n"), 0);
+
+  EXPECT_EQ(file_handler::find_tail(fileName.c_str(), 0), 14);
+  EXPECT_EQ(file_handler::find_tail(fileName.c_str(), 1), 8);
+  EXPECT_EQ(file_handler::find_tail(fileName.c_str(), 2), 4);
+  EXPECT_EQ(file_handler::find_tail(fileName.c_str(), 3), 0);
+  EXPECT_EQ(file_handler::find_tail(fileName.c_str(), 10), 0);
+
+  // The last line may not be complete yet
+  ASSERT_EQ(file_handler::write_file(fileName.c_str(), "one\ntwo"), 0);
+  EXPECT_EQ(file_handler::find_tail(fileName.c_str(), 1), 4);
+  EXPECT_EQ(file_handler::find_tail("non-existing-file.txt", 1), 0);
+}
+
+TEST(FileHandlerTests, WriteFileAtomicTest) {
+  const std::string fileName = "write_file_atomic_test.txt";
+  ASSERT_EQ(file_handler::write_file(fileName.c_str(), "previous contents"), 0);
+
+  EXPECT_EQ(file_handler::write_file_atomic(fileName.c_str(), "new"), 0);
+  EXPECT_EQ(file_handler::read_file(fileName.c_str()), "new");
+  EXPECT_FALSE(std::filesystem::exists(fileName + ".tmp"));
+
+  EXPECT_EQ(file_handler::write_file_atomic("non-existing-dir/file.txt", "new"), -1);
+}
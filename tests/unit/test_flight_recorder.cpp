@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/test_flight_recorder.cpp
+ * @brief Test src/flight_recorder.*.
+ */
+#include "../tests_common.h"
+
+#include <src/flight_recorder.h>
+
+#include <thread>
+
+using namespace std::literals;
+using flight_recorder::event_e;
+
+TEST(FlightRecorderTests, ReadsRecordsBackInOrder) {
+  flight_recorder::recorder_t recorder {16};
+  auto start = std::chrono::steady_clock::now();
+
+  recorder.record(event_e::encode, 7, 100, 2000, 0, start + 1ms);
+  recorder.record(event_e::send_batch, 7, 100, 64, 500, start + 2ms);
+
+  auto records = recorder.since(start);
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_EQ(records[0].event, event_e::encode);
+  EXPECT_EQ(records[0].session, 7);
+  EXPECT_EQ(records[0].frame_index, 100);
+  EXPECT_EQ(records[0].value, 2000);
+  EXPECT_EQ(records[1].event, event_e::send_batch);
+  EXPECT_EQ(records[1].aux, 500);
+  EXPECT_EQ(records[1].time, start + 2ms);
+}
+
+TEST(FlightRecorderTests, KeepsOnlyTheLatestRecords) {
+  flight_recorder::recorder_t recorder {4};
+  auto start = std::chrono::steady_clock::now();
+
+  for (int x = 0; x < 10; ++x) {
+    recorder.record(event_e::capture, 0, 0, x, 0, start + x * 1ms);
+  }
+
+  auto records = recorder.since(start);
+  ASSERT_EQ(records.size(), 4);
+  EXPECT_EQ(records.front().value, 6);
+  EXPECT_EQ(records.back().value, 9);
+}
+
+TEST(FlightRecorderTests, SkipsRecordsBeforeTheWindow) {
+  flight_recorder::recorder_t recorder {16};
+  auto start = std::chrono::steady_clock::now();
+
+  recorder.record(event_e::input, 1, 0, 10, 0, start);
+  recorder.record(event_e::input, 1, 0, 20, 0, start + 5s);
+
+  auto records = recorder.since(start + 1s);
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].value, 20);
+}
+
+TEST(FlightRecorderTests, RecordsFromManyThreads) {
+  flight_recorder::recorder_t recorder {1024};
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < 4; ++thread) {
+    threads.emplace_back([&recorder, thread]() {
+      for (int x = 0; x < 100; ++x) {
+        recorder.record(event_e::fec, thread, x, x);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto records = recorder.since(start);
+  EXPECT_EQ(records.size(), 400);
+  EXPECT_TRUE(std::is_sorted(std::begin(records), std::end(records), [](auto &a, auto &b) {
+    return a.time < b.time;
+  }));
+}
+
+TEST(FlightRecorderTests, SessionsGetStableNonZeroIds) {
+  int session;
+
+  EXPECT_EQ(flight_recorder::session_id(nullptr), 0);
+  EXPECT_NE(flight_recorder::session_id(&session), 0);
+  EXPECT_EQ(flight_recorder::session_id(&session), flight_recorder::session_id(&session));
+}
+
+TEST(FlightRecorderTests, DumpsRecordsAsJson) {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<flight_recorder::record_t> records {
+    {now - 1500us, event_e::idr_request, 3, 42, 0, 0},
+  };
+
+  auto json = flight_recorder::to_json(records, now);
+  ASSERT_EQ(json.size(), 1);
+  EXPECT_EQ(json[0]["event"], "idr_request");
+  EXPECT_EQ(json[0]["age_us"], 1500);
+  EXPECT_EQ(json[0]["frame"], 42);
+}
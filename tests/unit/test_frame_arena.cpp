@@ -0,0 +1,99 @@
+/**
+ * @file tests/unit/test_frame_arena.cpp
+ * @brief Test src/frame_arena.*.
+ */
+#include "../tests_common.h"
+
+#include <src/frame_arena.h>
+
+TEST(FrameArenaTests, AllocationsAreAligned) {
+  util::frame_arena_t arena {1024};
+
+  arena.alloc<char>(3);
+  auto ptrs = arena.alloc<uint8_t *>(4);
+  EXPECT_EQ((uintptr_t) ptrs.data() % alignof(uint8_t *), 0);
+  EXPECT_EQ(ptrs.size(), 4);
+
+  arena.alloc<char>(1);
+  auto p = arena.allocate(16);
+  EXPECT_EQ((uintptr_t) p % alignof(std::max_align_t), 0);
+}
+
+TEST(FrameArenaTests, AllocationsAreAlignedToCacheLines) {
+  util::frame_arena_t arena {1024};
+
+  arena.alloc<char>(3);
+  auto shards = arena.alloc<char>(100, util::frame_arena_t::max_alignment);
+  EXPECT_EQ((uintptr_t) shards.data() % util::frame_arena_t::max_alignment, 0);
+
+  // Allocations that don't fit are aligned as well
+  auto overflow = arena.alloc<char>(2000, util::frame_arena_t::max_alignment);
+  EXPECT_EQ((uintptr_t) overflow.data() % util::frame_arena_t::max_alignment, 0);
+  std::fill(std::begin(overflow), std::end(overflow), 'a');
+
+  util::arena_allocator_t<uint8_t> alloc {arena, util::frame_arena_t::max_alignment};
+  std::vector<uint8_t, util::arena_allocator_t<uint8_t>> v {alloc};
+  v.resize(10);
+  EXPECT_EQ((uintptr_t) v.data() % util::frame_arena_t::max_alignment, 0);
+
+  // The next main block holds the whole frame, with the padding of its alignments
+  arena.reset();
+  arena.alloc<char>(3);
+  arena.alloc<char>(100, util::frame_arena_t::max_alignment);
+  arena.alloc<char>(2000, util::frame_arena_t::max_alignment);
+  auto capacity = arena.capacity();
+  arena.reset();
+  EXPECT_EQ(arena.capacity(), capacity);
+}
+
+TEST(FrameArenaTests, ResetReusesMemory) {
+  util::frame_arena_t arena {1024};
+
+  auto first = arena.alloc<char>(100);
+  arena.reset();
+  auto second = arena.alloc<char>(100);
+
+  EXPECT_EQ(first.data(), second.data());
+  EXPECT_EQ(arena.capacity(), 1024);
+}
+
+TEST(FrameArenaTests, GrowsToHighWaterMark) {
+  util::frame_arena_t arena;
+  EXPECT_EQ(arena.capacity(), 0);
+
+  // Allocations that don't fit are still usable until the next reset
+  auto first = arena.alloc<char>(600);
+  auto second = arena.alloc<char>(600);
+  std::fill(std::begin(first), std::end(first), 'a');
+  std::fill(std::begin(second), std::end(second), 'b');
+  EXPECT_EQ(first[599], 'a');
+
+  arena.reset();
+  EXPECT_GE(arena.capacity(), 1200);
+
+  // The same frame now fits into the main block
+  auto capacity = arena.capacity();
+  arena.alloc<char>(600);
+  arena.alloc<char>(600);
+  arena.reset();
+  EXPECT_EQ(arena.capacity(), capacity);
+}
+
+TEST(FrameArenaTests, BacksStandardContainers) {
+  util::frame_arena_t arena {4096};
+  util::arena_allocator_t<uint8_t> alloc {arena};
+
+  std::vector<uint8_t, util::arena_allocator_t<uint8_t>> v {alloc};
+  for (int x = 0; x < 1000; ++x) {
+    v.push_back((uint8_t) x);
+  }
+
+  ASSERT_EQ(v.size(), 1000);
+  for (int x = 0; x < 1000; ++x) {
+    EXPECT_EQ(v[x], (uint8_t) x);
+  }
+
+  std::vector<uint8_t, util::arena_allocator_t<uint8_t>> moved {alloc};
+  moved = std::move(v);
+  EXPECT_EQ(moved.size(), 1000);
+}
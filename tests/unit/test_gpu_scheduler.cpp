@@ -0,0 +1,119 @@
+/**
+ * @file tests/unit/test_gpu_scheduler.cpp
+ * @brief Test src/gpu_scheduler.*.
+ */
+#include "../tests_common.h"
+
+#include <src/config.h>
+#include <src/gpu_scheduler.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Encode frames at 60 FPS for a while, each taking as long as given.
+   */
+  void encode_frames(gpu_scheduler::scheduler_t::lease_t &lease, std::chrono::steady_clock::time_point &now, std::chrono::seconds duration, std::chrono::microseconds encode_time) {
+    for (auto end = now + duration; now < end; now += 16667us) {
+      lease.frame_encoded(encode_time, now);
+    }
+  }
+}  // namespace
+
+TEST(GpuSchedulerTests, SpreadsSessions) {
+  gpu_scheduler::scheduler_t scheduler {{"gpu0", "gpu1"}};
+  EXPECT_EQ(scheduler.choose(0), "gpu0");
+
+  auto first = scheduler.attach("gpu0");
+  EXPECT_EQ(scheduler.choose(0), "gpu1");
+
+  auto second = scheduler.attach("gpu1");
+  EXPECT_EQ(scheduler.choose(0), "gpu0");
+
+  // Sessions stop counting once they're gone
+  {
+    auto third = scheduler.attach("gpu0");
+    EXPECT_EQ(scheduler.loads()[0].sessions, 2);
+  }
+  EXPECT_EQ(scheduler.loads()[0].sessions, 1);
+
+  second = {};
+  EXPECT_EQ(scheduler.loads()[1].sessions, 0);
+  EXPECT_EQ(scheduler.choose(0), "gpu1");
+}
+
+TEST(GpuSchedulerTests, PrefersLessBusyGpu) {
+  gpu_scheduler::scheduler_t scheduler {{"gpu0", "gpu1"}};
+  auto now = std::chrono::steady_clock::now();
+
+  // A busy session against two idle ones
+  auto busy = scheduler.attach("gpu0");
+  auto idle = scheduler.attach("gpu1");
+  auto idle2 = scheduler.attach("gpu1");
+  encode_frames(busy, now, 10s, 12ms);
+  encode_frames(idle, now, 10s, 1ms);
+  encode_frames(idle2, now, 10s, 1ms);
+
+  auto loads = scheduler.loads();
+  EXPECT_NEAR(loads[0].utilization, 0.72, 0.05);
+  EXPECT_NEAR(loads[1].utilization, 0.12, 0.05);
+  EXPECT_EQ(scheduler.choose(0), "gpu1");
+
+  // The load goes with the session
+  busy = {};
+  EXPECT_NEAR(scheduler.loads()[0].utilization, 0, 0.001);
+  EXPECT_EQ(scheduler.choose(0), "gpu0");
+}
+
+TEST(GpuSchedulerTests, AvoidsGpusBusyWithOtherEncoders) {
+  gpu_scheduler::scheduler_t scheduler {{"gpu0", "gpu1"}};
+
+  // Another process keeps the encoder of gpu0 busy
+  scheduler.set_sampled_utilization("gpu0", 0.8);
+  EXPECT_EQ(scheduler.choose(0), "gpu1");
+
+  // Until our own sessions load gpu1 more
+  auto first = scheduler.attach("gpu1");
+  auto now = std::chrono::steady_clock::now();
+  encode_frames(first, now, 10s, 15ms);
+  EXPECT_EQ(scheduler.choose(0), "gpu0");
+  EXPECT_DOUBLE_EQ(scheduler.loads()[0].sampled_utilization, 0.8);
+
+  scheduler.set_sampled_utilization("unknown", 1.0);
+  EXPECT_EQ(scheduler.loads().size(), 2);
+}
+
+TEST(GpuSchedulerTests, SkipsIncapableGpus) {
+  gpu_scheduler::scheduler_t scheduler {{"gpu0", "gpu1"}};
+
+  scheduler.mark_incapable("gpu0", 2);
+  EXPECT_EQ(scheduler.choose(2), "gpu1");
+  EXPECT_EQ(scheduler.choose(0), "gpu0");
+
+  scheduler.mark_incapable("gpu1", 2);
+  EXPECT_FALSE(scheduler.choose(2));
+}
+
+TEST(GpuSchedulerTests, IgnoresUnscheduledGpus) {
+  gpu_scheduler::scheduler_t scheduler {{}};
+  EXPECT_FALSE(scheduler.choose(0));
+
+  auto lease = scheduler.attach("");
+  lease.frame_encoded(1ms);
+  EXPECT_TRUE(scheduler.loads().empty());
+}
+
+TEST(GpuSchedulerTests, PlacesEncodeDevices) {
+  EXPECT_EQ(gpu_scheduler::render_device(), config::video.adapter_name);
+
+  gpu_scheduler::placement_t placement {"/dev/dri/renderD129"};
+  EXPECT_FALSE(placement.used());
+  {
+    // An empty placement leaves encode devices where they'd be
+    gpu_scheduler::placement_t unplaced {""};
+    EXPECT_EQ(gpu_scheduler::render_device(), config::video.adapter_name);
+    EXPECT_FALSE(unplaced.used());
+  }
+  EXPECT_EQ(gpu_scheduler::render_device(), "/dev/dri/renderD129");
+  EXPECT_TRUE(placement.used());
+}
@@ -0,0 +1,87 @@
+/**
+ * @file tests/unit/test_image_memory.cpp
+ * @brief Test src/image_memory.*.
+ */
+#include "../tests_common.h"
+
+#include <cstring>
+#include <numeric>
+#include <set>
+#include <src/image_memory.h>
+#include <vector>
+
+TEST(ImageMemoryTests, AllocatesWritablePages) {
+  // Large enough for huge pages, and not a multiple of them
+  constexpr std::size_t size = 3840 * 2160 * 4 + 123;
+
+  auto data = util::alloc_image(size);
+  ASSERT_NE(data, nullptr);
+  EXPECT_EQ((std::uintptr_t) data % 4096, 0);
+
+  data[0] = 1;
+  data[size - 1] = 2;
+  EXPECT_EQ(data[0] + data[size - 1], 3);
+
+  util::free_image(data);
+}
+
+TEST(ImageMemoryTests, FreesEveryImage) {
+  std::vector<std::uint8_t *> images;
+  for (int x = 0; x < 4; ++x) {
+    images.emplace_back(util::alloc_image(1920 * 1080 * 4));
+  }
+
+  EXPECT_EQ(std::set<std::uint8_t *>(std::begin(images), std::end(images)).size(), images.size());
+
+  for (auto image : images) {
+    util::free_image(image);
+  }
+  util::free_image(nullptr);
+}
+
+TEST(ImageMemoryTests, WatchesEveryImage) {
+  auto before = util::alloc_image(1920 * 1080 * 4);
+
+  std::set<std::uint8_t *> watched;
+  auto id = util::watch_images(
+    [&](std::uint8_t *data, std::size_t size) {
+      EXPECT_GE(size, 1920 * 1080 * 4);
+      EXPECT_TRUE(watched.emplace(data).second);
+    },
+    [&](std::uint8_t *data, std::size_t) {
+      EXPECT_EQ(watched.erase(data), 1);
+    }
+  );
+  EXPECT_TRUE(watched.contains(before));
+
+  auto after = util::alloc_image(1920 * 1080 * 4);
+  EXPECT_TRUE(watched.contains(after));
+
+  util::free_image(before);
+  EXPECT_FALSE(watched.contains(before));
+
+  util::unwatch_images(id);
+  EXPECT_TRUE(watched.empty());
+
+  util::free_image(after);
+}
+
+TEST(ImageMemoryTests, CopiesEveryByteOnAnyAlignment) {
+  constexpr std::size_t size = 3840 * 2160 * 4;
+
+  std::vector<std::uint8_t> src(size + 64);
+  std::iota(std::begin(src), std::end(src), std::uint8_t {0});
+
+  util::image_copy_t image_copy {4};
+  for (std::size_t src_offset : {0, 1, 32}) {
+    for (std::size_t dst_offset : {0, 3}) {
+      for (std::size_t length : {std::size_t {0}, std::size_t {127}, std::size_t {4097}, size - 5}) {
+        std::vector<std::uint8_t> dst(size + 64, 0xFF);
+        image_copy.copy(src.data() + src_offset, dst.data() + dst_offset, length);
+
+        EXPECT_EQ(std::memcmp(dst.data() + dst_offset, src.data() + src_offset, length), 0) << src_offset << ' ' << dst_offset << ' ' << length;
+        EXPECT_EQ(dst[dst_offset + length], 0xFF) << src_offset << ' ' << dst_offset << ' ' << length;
+      }
+    }
+  }
+}
@@ -0,0 +1,192 @@
+/**
+ * @file tests/unit/test_image_pool.cpp
+ * @brief Test src/image_pool.*.
+ */
+#include "../tests_common.h"
+
+#include <src/image_pool.h>
+#include <thread>
+
+using namespace std::literals;
+
+namespace {
+  struct counted_img_t: platf::img_t {
+    explicit counted_img_t(int &alive):
+        alive {alive} {
+      ++alive;
+    }
+
+    ~counted_img_t() override {
+      --alive;
+    }
+
+    int &alive;
+  };
+}  // namespace
+
+TEST(ImagePoolTests, ReusesReturnedImages) {
+  int alive = 0;
+  video::image_pool_t pool {4, 1h};
+  auto alloc = [&]() -> std::shared_ptr<platf::img_t> {
+    return std::make_shared<counted_img_t>(alive);
+  };
+
+  auto first = pool.acquire(alloc, 0ms);
+  ASSERT_TRUE(first);
+  auto first_ptr = first.get();
+  EXPECT_EQ(pool.in_use(), 1);
+
+  first.reset();
+  EXPECT_EQ(pool.in_use(), 0);
+
+  auto second = pool.acquire(alloc, 0ms);
+  EXPECT_EQ(second.get(), first_ptr);
+  EXPECT_EQ(alive, 1);
+  EXPECT_EQ(pool.allocated(), 1);
+}
+
+TEST(ImagePoolTests, WaitsForImagesWhenExhausted) {
+  int alive = 0;
+  video::image_pool_t pool {2, 1h};
+  auto alloc = [&]() -> std::shared_ptr<platf::img_t> {
+    return std::make_shared<counted_img_t>(alive);
+  };
+
+  auto a = pool.acquire(alloc, 0ms);
+  auto b = pool.acquire(alloc, 0ms);
+  ASSERT_TRUE(a && b);
+
+  // Nothing is returned, so the acquire gives up after the timeout
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(pool.acquire(alloc, 20ms));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 20ms);
+
+  // An image returned from another thread wakes up the waiting acquire
+  std::thread releaser {[&]() {
+    std::this_thread::sleep_for(10ms);
+    b.reset();
+  }};
+  auto c = pool.acquire(alloc, 5s);
+  releaser.join();
+
+  ASSERT_TRUE(c);
+  EXPECT_EQ(alive, 2);
+}
+
+TEST(ImagePoolTests, ClearKeepsImagesInUseAlive) {
+  int alive = 0;
+  video::image_pool_t pool {2, 1h};
+  auto alloc = [&]() -> std::shared_ptr<platf::img_t> {
+    return std::make_shared<counted_img_t>(alive);
+  };
+
+  auto in_use = pool.acquire(alloc, 0ms);
+  pool.acquire(alloc, 0ms);
+  EXPECT_EQ(alive, 2);
+
+  pool.clear();
+  EXPECT_EQ(alive, 1);
+  EXPECT_EQ(pool.allocated(), 0);
+
+  in_use.reset();
+  EXPECT_EQ(alive, 0);
+
+  // Both slots can be allocated again
+  auto a = pool.acquire(alloc, 0ms);
+  auto b = pool.acquire(alloc, 0ms);
+  EXPECT_TRUE(a && b);
+}
+
+TEST(ImagePoolTests, TrimsUnusedImages) {
+  int alive = 0;
+  video::image_pool_t pool {4, 0s};
+  auto alloc = [&]() -> std::shared_ptr<platf::img_t> {
+    return std::make_shared<counted_img_t>(alive);
+  };
+
+  {
+    auto a = pool.acquire(alloc, 0ms);
+    auto b = pool.acquire(alloc, 0ms);
+    auto c = pool.acquire(alloc, 0ms);
+  }
+  EXPECT_EQ(alive, 3);
+
+  // Without a trim timeout, only the image that's in use is kept
+  auto img = pool.acquire(alloc, 0ms);
+  EXPECT_EQ(alive, 1);
+  EXPECT_EQ(pool.allocated(), 1);
+}
+
+TEST(ImagePoolTests, GrowsWithinTheBudget) {
+  int alive = 0;
+  memory_budget::budget_t budget {3 << 20};
+  video::image_pool_t pool {8, 1h, &budget};
+  auto alloc = [&]() -> std::shared_ptr<platf::img_t> {
+    auto img = std::make_shared<counted_img_t>(alive);
+    img->row_pitch = 1 << 10;
+    img->height = 1 << 10;
+    return img;
+  };
+
+  auto a = pool.acquire(alloc, 0ms);
+  auto b = pool.acquire(alloc, 0ms);
+  auto c = pool.acquire(alloc, 0ms);
+  ASSERT_TRUE(a && b && c);
+  EXPECT_EQ(budget.used(memory_budget::pool_e::capture), 3 << 20);
+
+  // A fourth image would go over the budget, so the pool waits for one to be returned instead
+  EXPECT_FALSE(pool.acquire(alloc, 0ms));
+  EXPECT_EQ(alive, 3);
+  EXPECT_EQ(budget.refused(), 1);
+
+  // The memory stays accounted until the images are gone, even past the pool
+  pool.clear();
+  EXPECT_EQ(budget.used(), 3 << 20);
+  a.reset();
+  b.reset();
+  c.reset();
+  EXPECT_EQ(budget.used(), 0);
+}
+
+TEST(ImagePoolTests, KeepsItsFirstImagesOverTheBudget) {
+  int alive = 0;
+  memory_budget::budget_t budget {1};
+  video::image_pool_t pool {8, 0s, &budget};
+  auto alloc = [&]() -> std::shared_ptr<platf::img_t> {
+    auto img = std::make_shared<counted_img_t>(alive);
+    img->row_pitch = 1 << 10;
+    img->height = 1 << 10;
+    return img;
+  };
+
+  auto a = pool.acquire(alloc, 0ms);
+  auto b = pool.acquire(alloc, 0ms);
+  EXPECT_TRUE(a && b);
+  EXPECT_FALSE(pool.acquire(alloc, 0ms));
+  EXPECT_TRUE(budget.over());
+}
+
+TEST(ImagePoolTests, FreesIdleImagesOverTheBudget) {
+  int alive = 0;
+  memory_budget::budget_t budget {4 << 20};
+  video::image_pool_t pool {8, 1h, &budget};
+  auto alloc = [&]() -> std::shared_ptr<platf::img_t> {
+    auto img = std::make_shared<counted_img_t>(alive);
+    img->row_pitch = 1 << 10;
+    img->height = 1 << 10;
+    return img;
+  };
+
+  {
+    auto a = pool.acquire(alloc, 0ms);
+    auto b = pool.acquire(alloc, 0ms);
+    auto c = pool.acquire(alloc, 0ms);
+  }
+  EXPECT_EQ(alive, 3);
+
+  // An encoder opening takes what the idle images held, despite the trim timeout
+  auto encoder = budget.reserve(memory_budget::pool_e::encoder, 2 << 20);
+  auto img = pool.acquire(alloc, 0ms);
+  EXPECT_EQ(alive, 2);
+  EXPECT_EQ(pool.allocated(), video::image_pool_t::min_images);
+}
@@ -8,6 +8,7 @@
 #include <format>
 #include <random>
 #include <src/logging.h>
+#include <src/utility.h>
 
 namespace {
   std::array log_levels = {
@@ -45,3 +46,21 @@ TEST_P(LogLevelsTest, PutMessage) {
 
   ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
 }
+
+TEST(LoggingTests, HotLogSkipsFilteredLevels) {
+  auto level = logging::min_level.load();
+  auto restore = util::fail_guard([level]() {
+    logging::min_level = level;
+  });
+  logging::min_level = 2;
+
+  EXPECT_FALSE(logging::enabled(debug));
+  EXPECT_TRUE(logging::enabled(info));
+
+  int evaluated = 0;
+  BOOST_LOG_HOT(verbose) << ++evaluated;
+  EXPECT_EQ(evaluated, 0);
+
+  BOOST_LOG_HOT(warning) << ++evaluated;
+  EXPECT_EQ(evaluated, 1);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file tests/unit/test_memory_budget.cpp
+ * @brief Test src/memory_budget.*.
+ */
+#include "../tests_common.h"
+
+#include <src/memory_budget.h>
+
+using memory_budget::pool_e;
+
+TEST(MemoryBudgetTests, RefusesWhatGoesOverTheLimit) {
+  memory_budget::budget_t budget {100};
+
+  auto a = budget.try_reserve(pool_e::capture, 60);
+  ASSERT_TRUE(a);
+  EXPECT_FALSE(budget.try_reserve(pool_e::capture, 50));
+  EXPECT_EQ(budget.refused(), 1);
+  EXPECT_TRUE(budget.fits(40));
+  EXPECT_FALSE(budget.fits(41));
+
+  // What a stream can't do without is accounted anyway
+  auto b = budget.reserve(pool_e::encoder, 50);
+  EXPECT_EQ(budget.used(), 110);
+  EXPECT_EQ(budget.used(pool_e::encoder), 50);
+  EXPECT_TRUE(budget.over());
+
+  a.reset();
+  EXPECT_EQ(budget.used(), 50);
+  EXPECT_FALSE(budget.over());
+}
+
+TEST(MemoryBudgetTests, NoLimitNeverRefuses) {
+  memory_budget::budget_t budget {0};
+
+  auto lease = budget.try_reserve(pool_e::capture, std::size_t {1} << 40);
+  EXPECT_TRUE(lease);
+  EXPECT_FALSE(budget.over());
+  EXPECT_EQ(budget.refused(), 0);
+}
+
+TEST(MemoryBudgetTests, MovedLeasesReleaseOnce) {
+  memory_budget::budget_t budget {100};
+
+  memory_budget::lease_t kept;
+  {
+    auto lease = budget.reserve(pool_e::capture, 30);
+    kept = std::move(lease);
+  }
+  EXPECT_EQ(budget.used(), 30);
+  EXPECT_EQ(kept.bytes(), 30);
+
+  kept = memory_budget::lease_t {};
+  EXPECT_EQ(budget.used(), 0);
+  EXPECT_EQ(budget.used(pool_e::capture), 0);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file tests/unit/test_metrics.cpp
+ * @brief Test src/metrics.*.
+ */
+#include "../tests_common.h"
+
+#include <src/metrics.h>
+
+using namespace std::literals;
+
+TEST(MetricsTests, HistogramQuantiles) {
+  metrics::histogram_t histogram;
+  EXPECT_EQ(histogram.snapshot().quantile(0.5), 0us);
+
+  histogram.record(300us);
+  histogram.record(3ms);
+  histogram.record(1s);
+
+  auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count, 3);
+  EXPECT_EQ(snapshot.sum, 1003300us);
+  EXPECT_EQ(snapshot.quantile(0.3), 500us);
+  EXPECT_EQ(snapshot.quantile(0.6), 4ms);
+
+  // Samples above the last bucket are reported at least at the last limit
+  EXPECT_GE(snapshot.quantile(1), 128ms);
+}
+
+TEST(MetricsTests, DroppedFramesFromIndexGaps) {
+  auto session = metrics::register_session(1, "client");
+
+  session->frame_started(1, true);
+  session->frame_started(2, false);
+  session->frame_started(5, false);
+
+  // The encoder was reinitialized
+  session->frame_started(1, true);
+
+  EXPECT_EQ(session->frames, 4);
+  EXPECT_EQ(session->idr_frames, 2);
+  EXPECT_EQ(session->dropped_frames, 2);
+}
+
+TEST(MetricsTests, RegistryTracksLiveSessions) {
+  auto session = metrics::register_session(42, "living \"room\"");
+  session->frame.record(2ms);
+
+  auto sessions = metrics::to_json()["sessions"];
+  auto it = std::find_if(std::begin(sessions), std::end(sessions), [](auto &node) {
+    return node["id"] == 42;
+  });
+  ASSERT_NE(it, std::end(sessions));
+  EXPECT_EQ((*it)["device_name"], "living \"room\"");
+  EXPECT_EQ((*it)["frame"]["count"], 1);
+
+  auto text = metrics::to_prometheus();
+  EXPECT_NE(text.find(R"(apollo_frame_seconds_count{session="42",device="living \"room\""} 1)"), std::string::npos);
+  EXPECT_NE(text.find("# TYPE apollo_frames_total counter"), std::string::npos);
+
+  session.reset();
+  EXPECT_EQ(metrics::to_prometheus().find(R"(session="42")"), std::string::npos);
+}
+
+TEST(MetricsTests, InputToSendWaitsForFrameCapturedAfterInput) {
+  auto session = metrics::register_session(7, "client");
+  auto now = std::chrono::steady_clock::now();
+
+  session->input_injected(now - 20ms, now - 19ms);
+
+  // Later input in the same burst doesn't restart the measurement
+  session->input_injected(now - 10ms, now - 9ms);
+
+  // Captured before the input reached the OS
+  session->frame_on_wire(now - 25ms);
+  EXPECT_EQ(session->input_to_send.snapshot().count, 0);
+
+  session->frame_on_wire(now - 5ms);
+  auto snapshot = session->input_to_send.snapshot();
+  EXPECT_EQ(snapshot.count, 1);
+  EXPECT_GE(snapshot.sum, 20ms);
+
+  // Nothing to measure until the next input
+  session->frame_on_wire(now);
+  EXPECT_EQ(session->input_to_send.snapshot().count, 1);
+}
+
+TEST(MetricsTests, GpusAreExportedWithTheirKnownValues) {
+  metrics::gpu_metrics_t gpu;
+  gpu.gpu = "/dev/dri/renderD128";
+  gpu.busy_percent = 40;
+  gpu.encoder_percent = 75;
+  metrics::set_gpus({gpu});
+
+  auto json = metrics::to_json();
+  ASSERT_EQ(json["gpus"].size(), 1);
+  EXPECT_EQ(json["gpus"][0]["gpu"], "/dev/dri/renderD128");
+  EXPECT_EQ(json["gpus"][0]["encoder_percent"], 75);
+  EXPECT_EQ(json["gpus"][0]["clock_mhz"], -1);
+
+  auto text = metrics::to_prometheus();
+  EXPECT_NE(text.find(R"(apollo_gpu_encoder_percent{gpu="/dev/dri/renderD128"} 75)"), std::string::npos);
+  EXPECT_EQ(text.find(R"(apollo_gpu_clock_mhz{gpu=)"), std::string::npos);
+
+  metrics::set_gpus({});
+  EXPECT_TRUE(metrics::to_json()["gpus"].empty());
+}
+
+TEST(MetricsTests, EncodeTimesAreExportedByEngines) {
+  metrics::encoder().encode.record(6ms);
+  metrics::encoder().encode_split.record(3ms);
+
+  auto json = metrics::to_json();
+  EXPECT_GE(json["encoder"]["encode"]["count"], 1);
+  EXPECT_GE(json["encoder"]["encode_split"]["count"], 1);
+
+  auto text = metrics::to_prometheus();
+  EXPECT_NE(text.find(R"(apollo_encoder_encode_seconds_bucket{engines="single",le="0.008"})"), std::string::npos);
+  EXPECT_NE(text.find(R"(apollo_encoder_encode_seconds_count{engines="split"})"), std::string::npos);
+}
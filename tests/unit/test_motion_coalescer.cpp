@@ -0,0 +1,75 @@
+/**
+ * @file tests/unit/test_motion_coalescer.cpp
+ * @brief Test src/motion_coalescer.*.
+ */
+#include "../tests_common.h"
+
+#include <src/motion_coalescer.h>
+
+using namespace std::literals;
+
+namespace {
+  platf::gamepad_motion_t gyro(float x) {
+    return {{0, 0}, LI_MOTION_TYPE_GYRO, x, -x, 0};
+  }
+}  // namespace
+
+TEST(MotionCoalescerTests, SendsEverySampleWithoutLimit) {
+  input::motion_coalescer_t coalescer;
+  auto now = input::motion_coalescer_t::clock::now();
+
+  for (int x = 0; x < 10; ++x) {
+    auto motion = coalescer.add(gyro(x), now);
+    ASSERT_TRUE(motion);
+    EXPECT_EQ(motion->x, x);
+  }
+  EXPECT_FALSE(coalescer.deadline());
+}
+
+TEST(MotionCoalescerTests, AveragesSamplesWithinInterval) {
+  input::motion_coalescer_t coalescer {4ms};
+  auto now = input::motion_coalescer_t::clock::now();
+
+  // The first sample isn't held back
+  ASSERT_TRUE(coalescer.add(gyro(1), now));
+
+  EXPECT_FALSE(coalescer.add(gyro(2), now + 1ms));
+  EXPECT_FALSE(coalescer.add(gyro(4), now + 2ms));
+  EXPECT_EQ(coalescer.deadline(), now + 4ms);
+
+  auto motion = coalescer.flush(now + 4ms);
+  ASSERT_TRUE(motion);
+  EXPECT_EQ(motion->x, 3);
+  EXPECT_EQ(motion->y, -3);
+  EXPECT_EQ(motion->motionType, LI_MOTION_TYPE_GYRO);
+
+  EXPECT_FALSE(coalescer.flush(now + 5ms));
+  EXPECT_FALSE(coalescer.deadline());
+}
+
+TEST(MotionCoalescerTests, SampleAfterIntervalIsSentWithPendingOnes) {
+  input::motion_coalescer_t coalescer {4ms};
+  auto now = input::motion_coalescer_t::clock::now();
+
+  coalescer.add(gyro(1), now);
+  coalescer.add(gyro(2), now + 1ms);
+
+  auto motion = coalescer.add(gyro(4), now + 5ms);
+  ASSERT_TRUE(motion);
+  EXPECT_EQ(motion->x, 3);
+
+  // A sensor at rest sends right away again
+  EXPECT_TRUE(coalescer.add(gyro(0), now + 20ms));
+}
+
+TEST(MotionCoalescerTests, ResetDropsPendingSamples) {
+  input::motion_coalescer_t coalescer {4ms};
+  auto now = input::motion_coalescer_t::clock::now();
+
+  coalescer.add(gyro(1), now);
+  coalescer.add(gyro(2), now + 1ms);
+  coalescer.reset();
+
+  EXPECT_FALSE(coalescer.flush(now + 4ms));
+  EXPECT_TRUE(coalescer.add(gyro(5), now + 2ms));
+}
@@ -26,3 +26,40 @@ INSTANTIATE_TEST_SUITE_P(
     std::make_tuple(std::string(128, 'a'), std::string(63, 'a'))
   )
 );
+
+TEST(NetworkTests, OnNetwork) {
+  using boost::asio::ip::make_address;
+
+  EXPECT_TRUE(net::on_network(make_address("192.168.1.20"), make_address("192.168.1.2"), 24));
+  EXPECT_TRUE(net::on_network(make_address("::ffff:192.168.1.20"), make_address("192.168.1.2"), 24));
+  EXPECT_FALSE(net::on_network(make_address("192.168.2.20"), make_address("192.168.1.2"), 24));
+  EXPECT_TRUE(net::on_network(make_address("10.0.7.1"), make_address("10.0.0.1"), 20));
+  EXPECT_FALSE(net::on_network(make_address("10.0.16.1"), make_address("10.0.0.1"), 20));
+  EXPECT_TRUE(net::on_network(make_address("fe80::1234"), make_address("fe80::1"), 64));
+  EXPECT_FALSE(net::on_network(make_address("fe80::1234"), make_address("192.168.1.2"), 24));
+}
+
+TEST(NetworkTests, SourceInterfaces) {
+  using boost::asio::ip::make_address;
+
+  std::vector<platf::interface_address_t> interfaces {
+    {"eth0", make_address("192.168.1.2"), 24},
+    {"eth0", make_address("fe80::1"), 64},
+    {"wlan0", make_address("192.168.1.3"), 24},
+    {"wlan0", make_address("192.168.1.4"), 24},
+    {"eth1", make_address("10.0.0.2"), 8},
+  };
+
+  auto sources = net::source_interfaces(interfaces, make_address("::ffff:192.168.1.2"), make_address("::ffff:192.168.1.20"));
+  ASSERT_EQ(sources.size(), 2);
+  EXPECT_EQ(sources[0].name, "eth0");
+  EXPECT_EQ(sources[1].name, "wlan0");
+  EXPECT_EQ(sources[1].address, make_address("192.168.1.3"));
+
+  // A client behind a router is only reached through the interface it connected to
+  sources = net::source_interfaces(interfaces, make_address("10.0.0.2"), make_address("172.16.0.5"));
+  ASSERT_EQ(sources.size(), 1);
+  EXPECT_EQ(sources[0].name, "eth1");
+
+  EXPECT_TRUE(net::source_interfaces(interfaces, make_address("192.168.5.5"), make_address("192.168.1.20")).empty());
+}
@@ -0,0 +1,126 @@
+/**
+ * @file tests/unit/test_network_estimator.cpp
+ * @brief Test src/network_estimator.*.
+ */
+#include "../tests_common.h"
+#include "../tests_controller_driver.h"
+
+#include <src/network_estimator.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Send frames of 100 packets of 1400 bytes at 100 FPS for a while, about 112 Mbps.
+   */
+  void send_frames(stream::network_estimator_t &estimator, std::chrono::steady_clock::time_point &now, std::chrono::milliseconds duration, std::chrono::milliseconds rtt = 2ms, int lost_packets_per_frame = 0, std::chrono::milliseconds send_time = 0ms) {
+    controller_driver::run_for(now, duration, 10ms, [&](auto at) {
+      estimator.rtt_sampled(rtt, 1ms);
+      estimator.packets_lost(lost_packets_per_frame);
+      estimator.batch_sent(100 * 1400, send_time);
+      estimator.frame_sent(100, 100 * 1400, at);
+    });
+  }
+}  // namespace
+
+TEST(NetworkEstimatorTests, KeepsMaximumRateWhilePathKeepsUp) {
+  stream::network_estimator_t estimator {800};
+  auto now = std::chrono::steady_clock::now();
+
+  send_frames(estimator, now, 10s);
+  EXPECT_EQ(estimator.pacing_rate(), 800);
+
+  auto estimates = estimator.estimates();
+  EXPECT_EQ(estimates.rtt, 2ms);
+  EXPECT_EQ(estimates.min_rtt, 2ms);
+  EXPECT_EQ(estimates.drain_rate_mbps, 0);
+}
+
+TEST(NetworkEstimatorTests, BacksOffOnLossAndRecovers) {
+  stream::network_estimator_t estimator {800};
+  auto now = std::chrono::steady_clock::now();
+  send_frames(estimator, now, 1s);
+
+  // 10% loss
+  send_frames(estimator, now, 5s, 2ms, 10);
+  auto rate = estimator.pacing_rate();
+  EXPECT_LT(rate, 800);
+
+  // Never slower than the stream needs
+  EXPECT_GE(rate, 112 * 3 / 2);
+
+  send_frames(estimator, now, 60s);
+  EXPECT_EQ(estimator.pacing_rate(), 800);
+}
+
+TEST(NetworkEstimatorTests, BacksOffWhenRttGrows) {
+  stream::network_estimator_t estimator {800};
+  auto now = std::chrono::steady_clock::now();
+  send_frames(estimator, now, 2s, 2ms);
+
+  send_frames(estimator, now, 2s, 30ms);
+  EXPECT_LT(estimator.pacing_rate(), 800);
+}
+
+TEST(NetworkEstimatorTests, LeavesLossToAdaptedBitrate) {
+  stream::network_estimator_t estimator {800, false};
+  auto now = std::chrono::steady_clock::now();
+  send_frames(estimator, now, 1s);
+
+  // 10% loss
+  send_frames(estimator, now, 5s, 2ms, 10);
+  EXPECT_EQ(estimator.pacing_rate(), 800);
+  EXPECT_GT(estimator.estimates().loss, 0.05);
+
+  // The round-trip time growing still backs off
+  send_frames(estimator, now, 2s, 30ms);
+  EXPECT_LT(estimator.pacing_rate(), 800);
+}
+
+TEST(NetworkEstimatorTests, FollowsDrainRate) {
+  stream::network_estimator_t estimator {800};
+  auto now = std::chrono::steady_clock::now();
+
+  // Each 1.12 Mbit frame takes 7ms to send, 160 Mbps
+  send_frames(estimator, now, 2s, 2ms, 0, 7ms);
+  auto estimates = estimator.estimates();
+  EXPECT_EQ(estimates.drain_rate_mbps, 160);
+  EXPECT_EQ(estimates.pacing_rate_mbps, 160);
+}
+
+TEST(NetworkEstimatorTests, AddsFecForJitter) {
+  stream::network_estimator_t estimator;
+  EXPECT_EQ(estimator.fec_percentage(20), 20);
+
+  estimator.rtt_sampled(10ms, 2ms);
+  EXPECT_EQ(estimator.fec_percentage(20), 20);
+
+  estimator.rtt_sampled(20ms, 15ms);
+  EXPECT_EQ(estimator.fec_percentage(20), 30);
+
+  estimator.rtt_sampled(50ms, 100ms);
+  EXPECT_EQ(estimator.fec_percentage(20), 40);
+  EXPECT_EQ(estimator.fec_percentage(250), 255);
+}
+
+TEST(NetworkEstimatorTests, StartsFromLearnedRate) {
+  stream::network_estimator_t estimator {800};
+  auto now = std::chrono::steady_clock::now();
+
+  estimator.start_from(300, 12ms, now);
+  EXPECT_EQ(estimator.pacing_rate(), 300);
+  EXPECT_EQ(estimator.estimates().rtt, 12ms);
+  EXPECT_FALSE(estimator.estimates().min_rtt);
+
+  // Holds through the first updates, then climbs once the path keeps up
+  send_frames(estimator, now, 1s);
+  EXPECT_EQ(estimator.pacing_rate(), 300);
+
+  send_frames(estimator, now, 10s);
+  EXPECT_GT(estimator.pacing_rate(), 300);
+
+  stream::network_estimator_t clamped {800};
+  clamped.start_from(5000, 0ms);
+  EXPECT_EQ(clamped.pacing_rate(), 800);
+  EXPECT_FALSE(clamped.estimates().rtt);
+}
@@ -0,0 +1,61 @@
+/**
+ * @file tests/unit/test_network_profile.cpp
+ * @brief Test src/network_profile.*.
+ */
+#include "../tests_common.h"
+
+#include <src/network_profile.h>
+
+using namespace std::literals;
+
+TEST(NetworkProfileTests, RoundTripsThroughStateFile) {
+  stream::network_profile_t profile {12000, 0.01, 8ms, 1500, 350, "eth0"};
+
+  auto parsed = stream::network_profile_t::parse(nlohmann::json::parse(profile.serialize().dump()));
+  ASSERT_TRUE(parsed);
+  EXPECT_EQ(*parsed, profile);
+}
+
+TEST(NetworkProfileTests, ParsesPartialAndInvalidProfiles) {
+  auto partial = stream::network_profile_t::parse(nlohmann::json {{"bitrate", 5000}, {"loss", 3.0}});
+  ASSERT_TRUE(partial);
+  EXPECT_EQ(partial->bitrate, 5000);
+  EXPECT_EQ(partial->loss, 1.0);
+  EXPECT_EQ(partial->mtu, 0);
+  EXPECT_TRUE(partial->interface.empty());
+
+  EXPECT_FALSE(stream::network_profile_t::parse(nlohmann::json {}));
+  EXPECT_FALSE(stream::network_profile_t::parse(nlohmann::json {{"bitrate", "fast"}}));
+}
+
+TEST(NetworkProfileTests, LearnsBitrateHeldWithoutLoss) {
+  stream::stable_bitrate_t stable;
+  auto now = std::chrono::steady_clock::now();
+
+  stable.sample(20000, 0, now);
+  stable.sample(20000, 0, now + 4s);
+  EXPECT_FALSE(stable.stable());
+
+  stable.sample(20000, 0.01, now + 5s);
+  ASSERT_TRUE(stable.stable());
+  EXPECT_EQ(stable.stable()->bitrate, 20000);
+  EXPECT_EQ(stable.stable()->loss, 0.01);
+
+  // Backing off only counts once the lower bitrate held as well
+  stable.sample(15000, 0, now + 6s);
+  stable.sample(15000, 0, now + 10s);
+  EXPECT_EQ(stable.stable()->bitrate, 20000);
+
+  stable.sample(15000, 0, now + 11s);
+  EXPECT_EQ(stable.stable()->bitrate, 15000);
+}
+
+TEST(NetworkProfileTests, IgnoresBitrateHeldUnderLoss) {
+  stream::stable_bitrate_t stable;
+  auto now = std::chrono::steady_clock::now();
+
+  for (auto t = 0s; t <= 10s; t += 1s) {
+    stable.sample(20000, 0.1, now + t);
+  }
+  EXPECT_FALSE(stable.stable());
+}
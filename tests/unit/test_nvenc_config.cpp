@@ -0,0 +1,31 @@
+/**
+ * @file tests/unit/test_nvenc_config.cpp
+ * @brief Test src/nvenc/nvenc_config.*.
+ */
+#include "../tests_common.h"
+
+#include <src/nvenc/nvenc_config.h>
+
+TEST(NvencConfigTests, SplitsHighPixelRatesAutomatically) {
+  nvenc::nvenc_config config;
+  config.split_encode = nvenc::nvenc_split_encode::automatic;
+
+  EXPECT_TRUE(nvenc::use_split_encode(config, 1, 3840, 2160, 120));
+  EXPECT_TRUE(nvenc::use_split_encode(config, 2, 7680, 4320, 60));
+  EXPECT_FALSE(nvenc::use_split_encode(config, 1, 3840, 2160, 60));
+  EXPECT_FALSE(nvenc::use_split_encode(config, 2, 2560, 1440, 240));
+}
+
+TEST(NvencConfigTests, NeverSplitsH264) {
+  nvenc::nvenc_config config;
+  config.split_encode = nvenc::nvenc_split_encode::forced;
+
+  EXPECT_FALSE(nvenc::use_split_encode(config, 0, 7680, 4320, 60));
+  EXPECT_TRUE(nvenc::use_split_encode(config, 1, 1920, 1080, 60));
+}
+
+TEST(NvencConfigTests, DoesntSplitWhenDisabled) {
+  nvenc::nvenc_config config;
+
+  EXPECT_FALSE(nvenc::use_split_encode(config, 2, 7680, 4320, 120));
+}
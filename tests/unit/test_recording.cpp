@@ -0,0 +1,188 @@
+/**
+ * @file tests/unit/test_recording.cpp
+ * @brief Test src/recording.*.
+ */
+#include "../tests_common.h"
+
+#include <src/recording.h>
+
+#include <algorithm>
+#include <iterator>
+
+using namespace std::literals;
+
+namespace {
+  recording::config_t stereo_config() {
+    return recording::config_t {0, 1920, 1080, 60, 48000, 2, 1, 1, {0, 1}, 5};
+  }
+
+  bool contains(const std::vector<std::uint8_t> &haystack, const std::vector<std::uint8_t> &needle) {
+    return std::search(std::begin(haystack), std::end(haystack), std::begin(needle), std::end(needle)) != std::end(haystack);
+  }
+
+  std::vector<std::uint8_t> concat(std::initializer_list<std::vector<std::uint8_t>> parts) {
+    std::vector<std::uint8_t> whole;
+    for (auto &part : parts) {
+      whole.insert(std::end(whole), std::begin(part), std::end(part));
+    }
+
+    return whole;
+  }
+
+  // High profile 4:2:0 8 bit, only as far as the bit depths
+  const std::vector<std::uint8_t> h264_sps {0x67, 0x64, 0x00, 0x28, 0xAE, 0x80};
+  const std::vector<std::uint8_t> h264_pps {0x68, 0xEE, 0x3C, 0x80};
+  const std::vector<std::uint8_t> h264_idr {0x65, 0x88, 0x84, 0x21};
+
+  const std::vector<std::uint8_t> h264_keyframe = concat({{0, 0, 0, 1}, h264_sps, {0, 0, 0, 1}, h264_pps, {0, 0, 1}, h264_idr});
+}  // namespace
+
+TEST(RecordingTests, HeaderStartsAnEbmlMatroskaDocument) {
+  std::vector<std::uint8_t> buffer;
+  recording::mkv::put_header(buffer);
+
+  ASSERT_GE(buffer.size(), 4);
+  EXPECT_EQ(std::vector<std::uint8_t>(std::begin(buffer), std::begin(buffer) + 4), (std::vector<std::uint8_t> {0x1A, 0x45, 0xDF, 0xA3}));
+  EXPECT_TRUE(contains(buffer, {'m', 'a', 't', 'r', 'o', 's', 'k', 'a'}));
+
+  // The segment is live, and has an unknown size
+  EXPECT_TRUE(contains(buffer, {0x18, 0x53, 0x80, 0x67, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}));
+}
+
+TEST(RecordingTests, TracksHaveTheDecoderConfigurations) {
+  std::vector<std::uint8_t> buffer;
+  recording::mkv::put_tracks(buffer, stereo_config(), {1, 0x64, 0x00, 0x28});
+
+  ASSERT_GE(buffer.size(), 4);
+  EXPECT_EQ(std::vector<std::uint8_t>(std::begin(buffer), std::begin(buffer) + 4), (std::vector<std::uint8_t> {0x16, 0x54, 0xAE, 0x6B}));
+  EXPECT_TRUE(contains(buffer, {'V', '_', 'M', 'P', 'E', 'G', '4', '/', 'I', 'S', 'O', '/', 'A', 'V', 'C'}));
+  EXPECT_TRUE(contains(buffer, {0x63, 0xA2, 0x84, 1, 0x64, 0x00, 0x28}));
+  EXPECT_TRUE(contains(buffer, {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2}));
+}
+
+TEST(RecordingTests, SurroundUsesItsOwnChannelMapping) {
+  auto config = stereo_config();
+  config.channels = 6;
+  config.streams = 4;
+  config.coupledStreams = 2;
+  std::uint8_t mapping[] {0, 4, 1, 2, 3, 5};
+  std::copy_n(mapping, 6, config.mapping);
+
+  std::vector<std::uint8_t> buffer;
+  recording::mkv::put_tracks(buffer, config, {});
+
+  EXPECT_TRUE(contains(buffer, {0, 0, 255, 4, 2, 0, 4, 1, 2, 3, 5}));
+}
+
+TEST(RecordingTests, AvcConfigurationHasTheParameterSets) {
+  auto expected = concat({{1, 0x64, 0x00, 0x28, 0xFF, 0xE1, 0x00, 0x06}, h264_sps, {0x01, 0x00, 0x04}, h264_pps, {0xFD, 0xF8, 0xF8, 0x00}});
+
+  EXPECT_EQ(recording::mkv::video_private(0, h264_keyframe), expected);
+  EXPECT_TRUE(recording::mkv::video_private(0, concat({{0, 0, 1}, h264_idr})).empty());
+}
+
+TEST(RecordingTests, HevcConfigurationHasTheProfileOfTheSps) {
+  std::vector<std::uint8_t> vps {0x40, 0x01, 0x0C, 0x01};
+  std::vector<std::uint8_t> sps {
+    0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+    0x00, 0x5D, 0xA0, 0x03, 0xC0, 0x80, 0x10, 0xE7, 0xCB, 0xC0
+  };
+  std::vector<std::uint8_t> pps {0x44, 0x01, 0xC1, 0x72};
+  std::vector<std::uint8_t> idr {0x26, 0x01, 0xAF, 0x11};
+
+  auto record = recording::mkv::video_private(1, concat({{0, 0, 0, 1}, vps, {0, 0, 0, 1}, sps, {0, 0, 0, 1}, pps, {0, 0, 1}, idr}));
+
+  // general_profile_tier_level, then 4:2:0 8 bit, a single temporal layer nested and 4 byte lengths
+  std::vector<std::uint8_t> expected {
+    1, 0x01, 0x60, 0x00, 0x00, 0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5D,
+    0xF0, 0x00, 0xFC, 0xFD, 0xF8, 0xF8, 0x00, 0x00, 0x0F, 3
+  };
+  ASSERT_GT(record.size(), expected.size());
+  EXPECT_EQ(std::vector<std::uint8_t>(std::begin(record), std::begin(record) + expected.size()), expected);
+  EXPECT_TRUE(contains(record, concat({{33, 0x00, 0x01, 0x00, (std::uint8_t) sps.size()}, sps})));
+}
+
+TEST(RecordingTests, Av1ConfigurationHasTheSequenceHeader) {
+  // Main profile, level 4.0, 4:2:0 8 bit
+  std::vector<std::uint8_t> sequence_header {0x0A, 0x0F, 0x00, 0x00, 0x00, 0x21, 0x55, 0xDF, 0xE1, 0xB8, 0x04, 0xF3, 0x20, 0x20, 0x20, 0x20, 0x80};
+  std::vector<std::uint8_t> frame {0x32, 0x02, 0xAA, 0xBB};
+
+  auto record = recording::mkv::video_private(2, concat({{0x12, 0x00}, sequence_header, frame}));
+
+  EXPECT_EQ(record, concat({{0x81, 0x08, 0x0C, 0x00}, sequence_header}));
+}
+
+TEST(RecordingTests, VideoBlocksAreStoredAsMatroskaExpects) {
+  auto block = recording::mkv::video_block(0, h264_keyframe);
+  EXPECT_EQ(block, concat({{0, 0, 0, 6}, h264_sps, {0, 0, 0, 4}, h264_pps, {0, 0, 0, 4}, h264_idr}));
+
+  // Without the temporal delimiter
+  std::vector<std::uint8_t> frame {0x32, 0x02, 0xAA, 0xBB};
+  EXPECT_EQ(recording::mkv::video_block(2, concat({{0x12, 0x00}, frame})), frame);
+}
+
+TEST(RecordingTests, SimpleBlockHasTrackTimeAndFlags) {
+  std::vector<std::uint8_t> buffer;
+  recording::mkv::put_simple_block(buffer, 1, -2, true, {0xAA, 0xBB});
+
+  EXPECT_EQ(buffer, (std::vector<std::uint8_t> {0xA3, 0x86, 0x81, 0xFF, 0xFE, 0x80, 0xAA, 0xBB}));
+}
+
+TEST(RecordingTests, ClusterHasItsTimestamp) {
+  std::vector<std::uint8_t> buffer;
+  recording::mkv::put_cluster(buffer, 0x1234);
+
+  EXPECT_EQ(buffer, (std::vector<std::uint8_t> {0x1F, 0x43, 0xB6, 0x75, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xE7, 0x82, 0x12, 0x34}));
+}
+
+TEST(RecordingTests, StartsWithAKeyframe) {
+  auto file = std::filesystem::temp_directory_path() / "test_recording_starts.mkv";
+  std::uint8_t frame[16] {};
+  auto slice = concat({{0, 0, 0, 1}, {0x41, 0x9A, 0x02, 0x03}});
+  auto now = std::chrono::steady_clock::now();
+
+  {
+    recording::recorder_t recorder {file, stereo_config()};
+    ASSERT_TRUE(recorder);
+
+    EXPECT_FALSE(recorder.audio(frame, sizeof(frame), now));
+    EXPECT_FALSE(recorder.video(slice.data(), slice.size(), false, now));
+    EXPECT_TRUE(recorder.video(h264_keyframe.data(), h264_keyframe.size(), true, now + 16ms));
+    EXPECT_TRUE(recorder.audio(frame, sizeof(frame), now + 17ms));
+    EXPECT_TRUE(recorder.video(slice.data(), slice.size(), false, now + 33ms));
+    EXPECT_EQ(recorder.dropped(), 0);
+  }
+
+  std::ifstream in {file, std::ios::binary};
+  std::vector<std::uint8_t> written {std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {}};
+
+  // The tracks come before the first cluster, configured from the keyframe
+  std::vector<std::uint8_t> cluster_id {0x1F, 0x43, 0xB6, 0x75};
+  auto tracks = std::search(std::begin(written), std::end(written), std::begin(h264_sps), std::end(h264_sps));
+  auto cluster = std::search(std::begin(written), std::end(written), std::begin(cluster_id), std::end(cluster_id));
+  ASSERT_NE(cluster, std::end(written));
+  EXPECT_LT(tracks, cluster);
+
+  EXPECT_TRUE(contains(written, concat({{0xA3, 0x9E, 0x81, 0x00, 0x00, 0x80}, recording::mkv::video_block(0, h264_keyframe)})));
+  EXPECT_TRUE(contains(written, {0xA3, 0x94, 0x82, 0x00, 0x01, 0x80}));
+  EXPECT_TRUE(contains(written, {0xA3, 0x8C, 0x81, 0x00, 0x11, 0x00, 0x00, 0x00, 0x00, 0x04, 0x41, 0x9A, 0x02, 0x03}));
+
+  std::filesystem::remove(file);
+}
+
+TEST(RecordingTests, DropsVideoUntilTheNextKeyframeWhenFull) {
+  auto file = std::filesystem::temp_directory_path() / "test_recording_drops.mkv";
+  std::uint8_t frame[16] {};
+  auto now = std::chrono::steady_clock::now();
+
+  {
+    recording::recorder_t recorder {file, stereo_config(), 0};
+    ASSERT_TRUE(recorder);
+
+    EXPECT_FALSE(recorder.video(frame, sizeof(frame), true, now));
+    EXPECT_FALSE(recorder.video(frame, sizeof(frame), false, now + 16ms));
+    EXPECT_EQ(recorder.dropped(), 1);
+  }
+
+  std::filesystem::remove(file);
+}
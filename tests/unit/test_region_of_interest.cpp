@@ -0,0 +1,61 @@
+/**
+ * @file tests/unit/test_region_of_interest.cpp
+ * @brief Test src/region_of_interest.*.
+ */
+#include "../tests_common.h"
+
+#include <src/region_of_interest.h>
+
+TEST(RegionOfInterestTests, DisabledWithoutOffset) {
+  EXPECT_TRUE(video::make_regions_of_interest(platf::damage_rect_t {10, 10, 32, 32}, std::nullopt, {{0, 0, 100, 20}}, 1920, 1080, 1920, 1080, 0).empty());
+}
+
+TEST(RegionOfInterestTests, HintsAndCursorComeFirst) {
+  std::vector<platf::damage_rect_t> damage {{500, 500, 100, 100}};
+  auto regions = video::make_regions_of_interest(platf::damage_rect_t {1000, 500, 32, 32}, damage, {{0, 1040, 1920, 40}}, 1920, 1080, 1920, 1080, -8);
+
+  ASSERT_EQ(regions.size(), 3);
+  EXPECT_EQ(regions[0], (video::region_of_interest_t {{0, 1040, 1920, 40}, -8}));
+  EXPECT_EQ(regions[1], (video::region_of_interest_t {{872, 372, 288, 288}, -8}));
+  EXPECT_EQ(regions[2], (video::region_of_interest_t {{500, 500, 100, 100}, -4}));
+}
+
+TEST(RegionOfInterestTests, ScalesIntoFrameKeepingAspectRatio) {
+  // 4:3 image letterboxed into a 16:9 frame at half the size
+  auto regions = video::make_regions_of_interest(std::nullopt, std::nullopt, {{0, 0, 1440, 100}}, 1440, 1080, 960, 540, -6);
+
+  ASSERT_EQ(regions.size(), 1);
+  EXPECT_EQ(regions[0].rect, (platf::damage_rect_t {120, 0, 720, 50}));
+}
+
+TEST(RegionOfInterestTests, ClipsToFrame) {
+  auto regions = video::make_regions_of_interest(platf::damage_rect_t {-10, -10, 32, 32}, std::nullopt, {{5000, 5000, 10, 10}}, 1920, 1080, 1920, 1080, -6);
+
+  ASSERT_EQ(regions.size(), 1);
+  EXPECT_EQ(regions[0].rect, (platf::damage_rect_t {0, 0, 150, 150}));
+}
+
+TEST(RegionOfInterestTests, IgnoresLargeDamage) {
+  std::vector<platf::damage_rect_t> damage {{0, 0, 1920, 1080}};
+  EXPECT_TRUE(video::make_regions_of_interest(std::nullopt, damage, {}, 1920, 1080, 1920, 1080, -6).empty());
+
+  // Many small changes are merged into fewer regions
+  damage.clear();
+  for (int x = 0; x < 20; ++x) {
+    damage.push_back({x * 20, 0, 10, 10});
+  }
+  EXPECT_EQ(video::make_regions_of_interest(std::nullopt, damage, {}, 1920, 1080, 1920, 1080, -6).size(), 8);
+}
+
+TEST(RegionOfInterestTests, QpDeltaMapFirstRegionWins) {
+  std::vector<video::region_of_interest_t> regions {
+    {{0, 0, 16, 16}, -8},
+    {{0, 0, 40, 20}, -4},
+  };
+
+  // 3x2 blocks of 16 pixels, partially covered blocks included
+  auto map = video::make_qp_delta_map(regions, 48, 20, 16);
+  EXPECT_EQ(map, (std::vector<std::int8_t> {-8, -4, -4, -4, -4, -4}));
+
+  EXPECT_EQ(video::make_qp_delta_map({}, 48, 20, 16), std::vector<std::int8_t>(6, 0));
+}
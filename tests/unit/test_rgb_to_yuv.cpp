@@ -0,0 +1,183 @@
+/**
+ * @file tests/unit/test_rgb_to_yuv.cpp
+ * @brief Test src/rgb_to_yuv.*.
+ */
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+#include "../tests_common.h"
+
+#include <random>
+#include <src/rgb_to_yuv.h>
+
+using namespace std::literals;
+
+namespace {
+  struct planes_t {
+    std::array<std::vector<std::uint8_t>, 3> buffers;
+    std::array<std::uint8_t *, 3> data {};
+    std::array<int, 3> linesize {};
+  };
+
+  bool is_10bit(AVPixelFormat format) {
+    return format == AV_PIX_FMT_P010 || format == AV_PIX_FMT_YUV420P10;
+  }
+
+  bool is_interleaved(AVPixelFormat format) {
+    return format == AV_PIX_FMT_NV12 || format == AV_PIX_FMT_P010;
+  }
+
+  planes_t make_planes(AVPixelFormat format, int width, int height) {
+    auto sample_size = is_10bit(format) ? 2 : 1;
+
+    planes_t planes;
+    planes.linesize = {width * sample_size, (is_interleaved(format) ? width : width / 2) * sample_size, width / 2 * sample_size};
+    planes.buffers[0].resize(planes.linesize[0] * height);
+    planes.buffers[1].resize(planes.linesize[1] * height / 2);
+    planes.buffers[2].resize(planes.linesize[2] * height / 2);
+    for (int x = 0; x < 3; ++x) {
+      planes.data[x] = planes.buffers[x].data();
+    }
+
+    return planes;
+  }
+
+  int sample(const planes_t &planes, AVPixelFormat format, int plane, int x, int y) {
+    auto row = planes.data[plane] + y * planes.linesize[plane];
+    if (!is_10bit(format)) {
+      return row[x];
+    }
+
+    auto value = ((const std::uint16_t *) row)[x];
+    return format == AV_PIX_FMT_P010 ? value >> 6 : value;
+  }
+
+  std::vector<std::uint8_t> random_image(int width, int height) {
+    std::mt19937 rng {42};
+    std::vector<std::uint8_t> image(width * height * 4);
+    for (auto &byte : image) {
+      byte = (std::uint8_t) rng();
+    }
+
+    return image;
+  }
+}  // namespace
+
+class RgbToYuvTest: public testing::TestWithParam<std::tuple<AVPixelFormat, video::colorspace_e, bool>> {};
+
+TEST_P(RgbToYuvTest, MatchesReference) {
+  auto [format, colorspace_e, full_range] = GetParam();
+
+  // Odd number of row pairs per band, and padding around the image
+  constexpr int width = 70, height = 38, offset_x = 4, offset_y = 2;
+  constexpr int frame_width = width + 2 * offset_x, frame_height = height + 2 * offset_y;
+
+  auto converter = video::rgb_to_yuv_t::make(format, width, height, 3);
+  ASSERT_NE(converter, nullptr);
+
+  video::sunshine_colorspace_t colorspace {colorspace_e, full_range, is_10bit(format) ? 10u : 8u};
+  converter->set_colorspace(colorspace);
+
+  auto image = random_image(width, height);
+  auto planes = make_planes(format, frame_width, frame_height);
+  converter->convert(image.data(), width * 4, planes.data.data(), planes.linesize.data(), offset_x, offset_y);
+
+  auto color_vectors = video::new_color_vectors_from_colorspace(colorspace);
+  auto dot = [&](const float *vec, double r, double g, double b) {
+    return (int) std::floor(vec[0] * r + vec[1] * g + vec[2] * b + vec[3]);
+  };
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      auto pixel = &image[(y * width + x) * 4];
+      auto expected = dot(color_vectors->color_vec_y, pixel[2] / 255.0, pixel[1] / 255.0, pixel[0] / 255.0);
+      ASSERT_NEAR(sample(planes, format, 0, x + offset_x, y + offset_y), expected, 1) << x << 'x' << y;
+    }
+  }
+
+  for (int y = 0; y < height / 2; ++y) {
+    for (int x = 0; x < width / 2; ++x) {
+      double r = 0, g = 0, b = 0;
+      for (auto [dx, dy] : {std::pair {0, 0}, {1, 0}, {0, 1}, {1, 1}}) {
+        auto pixel = &image[((y * 2 + dy) * width + x * 2 + dx) * 4];
+        r += pixel[2] / (4 * 255.0);
+        g += pixel[1] / (4 * 255.0);
+        b += pixel[0] / (4 * 255.0);
+      }
+
+      auto chroma_x = x + offset_x / 2, chroma_y = y + offset_y / 2;
+      auto u = is_interleaved(format) ? sample(planes, format, 1, chroma_x * 2, chroma_y) : sample(planes, format, 1, chroma_x, chroma_y);
+      auto v = is_interleaved(format) ? sample(planes, format, 1, chroma_x * 2 + 1, chroma_y) : sample(planes, format, 2, chroma_x, chroma_y);
+      ASSERT_NEAR(u, dot(color_vectors->color_vec_u, r, g, b), 1) << x << 'x' << y;
+      ASSERT_NEAR(v, dot(color_vectors->color_vec_v, r, g, b), 1) << x << 'x' << y;
+    }
+  }
+
+  // The padding is left alone
+  EXPECT_TRUE(std::all_of(planes.data[0], planes.data[0] + planes.linesize[0] * offset_y, [](auto byte) {
+    return byte == 0;
+  }));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  RgbToYuvTests,
+  RgbToYuvTest,
+  testing::Combine(
+    testing::Values(AV_PIX_FMT_NV12, AV_PIX_FMT_P010, AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P10),
+    testing::Values(video::colorspace_e::rec601, video::colorspace_e::rec709, video::colorspace_e::bt2020),
+    testing::Bool()
+  )
+);
+
+TEST(RgbToYuvTests, RejectsUnsupported) {
+  EXPECT_EQ(video::rgb_to_yuv_t::make(AV_PIX_FMT_YUV444P, 64, 64, 1), nullptr);
+  EXPECT_EQ(video::rgb_to_yuv_t::make(AV_PIX_FMT_NV12, 63, 64, 1), nullptr);
+  EXPECT_EQ(video::rgb_to_yuv_t::make(AV_PIX_FMT_NV12, 64, 63, 1), nullptr);
+}
+
+TEST(RgbToYuvTests, ThroughputAgainstSwscale) {
+  // Microbenchmark against swscale with the flags of the software encode device
+  constexpr auto iterations = 10;
+  auto threads = (int) std::max(1u, std::thread::hardware_concurrency());
+
+  for (auto [width, height] : {std::pair {1920, 1080}, {2560, 1440}, {3840, 2160}}) {
+    auto image = random_image(width, height);
+    auto planes = make_planes(AV_PIX_FMT_NV12, width, height);
+    const std::uint8_t *src[] = {image.data()};
+    int src_pitch[] = {width * 4};
+
+    auto sws = sws_getContext(width, height, AV_PIX_FMT_BGR0, width, height, AV_PIX_FMT_NV12, SWS_LANCZOS | SWS_ACCURATE_RND, nullptr, nullptr, nullptr);
+    ASSERT_NE(sws, nullptr);
+
+    auto single = video::rgb_to_yuv_t::make(AV_PIX_FMT_NV12, width, height, 1);
+    auto threaded = video::rgb_to_yuv_t::make(AV_PIX_FMT_NV12, width, height, threads);
+    ASSERT_NE(single, nullptr);
+    ASSERT_NE(threaded, nullptr);
+
+    auto measure = [&](auto &&f) {
+      auto start = std::chrono::steady_clock::now();
+      for (int x = 0; x < iterations; ++x) {
+        f();
+      }
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+    };
+
+    auto swscale_ms = measure([&]() {
+      sws_scale(sws, src, src_pitch, 0, height, planes.data.data(), planes.linesize.data());
+    });
+    auto single_ms = measure([&]() {
+      single->convert(image.data(), width * 4, planes.data.data(), planes.linesize.data(), 0, 0);
+    });
+    auto threaded_ms = measure([&]() {
+      threaded->convert(image.data(), width * 4, planes.data.data(), planes.linesize.data(), 0, 0);
+    });
+    sws_freeContext(sws);
+
+    BOOST_LOG(info) << "BGR0 to NV12 at "sv << width << 'x' << height << ": "sv
+                    << swscale_ms << " ms swscale, "sv << single_ms << " ms "sv << single->isa() << ", "sv
+                    << threaded_ms << " ms "sv << threaded->isa() << " with "sv << threads << " threads"sv;
+
+    EXPECT_GT(single_ms, 0);
+  }
+}
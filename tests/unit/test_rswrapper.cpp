@@ -8,6 +8,8 @@ extern "C" {
 
 #include "../tests_common.h"
 
+#include <vector>
+
 TEST(ReedSolomonWrapperTests, InitTest) {
   reed_solomon_init();
 
@@ -34,3 +36,48 @@ TEST(ReedSolomonWrapperTests, EncodeTest) {
 
   reed_solomon_release(rs);
 }
+
+TEST(ReedSolomonWrapperTests, EveryIsaEncodesTheSameParity) {
+  // Blocks that aren't a multiple of the vector width have a tail of their own
+  struct shape_t {
+    int data_shards;
+    int parity_shards;
+    int block_size;
+  };
+
+  for (auto [data_shards, parity_shards, block_size] : {shape_t {8, 4, 64}, shape_t {20, 7, 1397}}) {
+    auto encode = [&](reed_solomon_isa isa, std::vector<uint8_t> &shards) {
+      if (!reed_solomon_init_isa(isa)) {
+        return false;
+      }
+
+      auto rs = reed_solomon_new(data_shards, parity_shards);
+      EXPECT_NE(rs, nullptr);
+
+      std::vector<uint8_t *> shard_ptrs;
+      for (int x = 0; x < data_shards + parity_shards; ++x) {
+        shard_ptrs.emplace_back(&shards[x * block_size]);
+      }
+      EXPECT_EQ(reed_solomon_encode(rs, shard_ptrs.data(), data_shards + parity_shards, block_size), 0);
+
+      reed_solomon_release(rs);
+      return true;
+    };
+
+    std::vector<uint8_t> expected((data_shards + parity_shards) * block_size);
+    for (int x = 0; x < data_shards * block_size; ++x) {
+      expected[x] = (uint8_t) (x * 7 + 3);
+    }
+    auto data = expected;
+    ASSERT_TRUE(encode(REED_SOLOMON_ISA_DEFAULT, expected));
+
+    for (auto isa : {REED_SOLOMON_ISA_SSSE3, REED_SOLOMON_ISA_AVX2, REED_SOLOMON_ISA_AVX512, REED_SOLOMON_ISA_NEON, REED_SOLOMON_ISA_GFNI}) {
+      auto actual = data;
+      if (encode(isa, actual)) {
+        EXPECT_EQ(actual, expected) << "ISA " << isa << ", " << data_shards << " data shards";
+      }
+    }
+  }
+
+  reed_solomon_init();
+}
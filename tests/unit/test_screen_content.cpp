@@ -0,0 +1,67 @@
+/**
+ * @file tests/unit/test_screen_content.cpp
+ * @brief Test src/screen_content.*.
+ */
+#include "../tests_common.h"
+#include "../tests_controller_driver.h"
+
+#include <src/screen_content.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief Account for frames at 60 FPS for a while, with the share of each frame that changed as given.
+   */
+  std::optional<bool> run(screen_content::detector_t &detector, std::chrono::steady_clock::time_point &now, std::chrono::seconds duration, double changed_area) {
+    return controller_driver::run_until_report(now, duration, 16667us, [&](auto at) {
+      return detector.update(changed_area, at);
+    });
+  }
+}  // namespace
+
+TEST(ScreenContentTests, MeasuresChangedArea) {
+  EXPECT_DOUBLE_EQ(screen_content::changed_area(std::nullopt, 100, 100), 1.0);
+  EXPECT_DOUBLE_EQ(screen_content::changed_area(std::vector<platf::damage_rect_t> {}, 100, 100), 0.0);
+  EXPECT_DOUBLE_EQ(screen_content::changed_area(std::vector<platf::damage_rect_t> {{0, 0, 50, 20}}, 100, 100), 0.1);
+
+  // Rectangles are clipped to the image
+  EXPECT_DOUBLE_EQ(screen_content::changed_area(std::vector<platf::damage_rect_t> {{90, -10, 20, 20}}, 100, 100), 0.01);
+}
+
+TEST(ScreenContentTests, TurnsStaticAfterALongQuietRun) {
+  screen_content::detector_t detector;
+  auto now = std::chrono::steady_clock::now();
+
+  // A few quiet seconds aren't enough, and the encoder isn't reopened right after it was opened
+  EXPECT_FALSE(run(detector, now, 9s, 0.01));
+
+  auto active = run(detector, now, 5s, 0.01);
+  ASSERT_TRUE(active);
+  EXPECT_TRUE(*active);
+}
+
+TEST(ScreenContentTests, StaysMovingWithVideo) {
+  screen_content::detector_t detector;
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_FALSE(run(detector, now, 60s, 0.3));
+  EXPECT_FALSE(detector.active());
+}
+
+TEST(ScreenContentTests, TurnsBackWhenMuchChanges) {
+  screen_content::detector_t detector {true};
+  auto now = std::chrono::steady_clock::now();
+  EXPECT_FALSE(run(detector, now, 11s, 0.01));
+
+  // Typing and the cursor don't end it
+  EXPECT_FALSE(run(detector, now, 10s, 0.05));
+
+  auto active = run(detector, now, 3s, 0.5);
+  ASSERT_TRUE(active);
+  EXPECT_FALSE(*active);
+
+  // Once switched, the stream settles in the new mode
+  detector.set_active(*active);
+  EXPECT_FALSE(run(detector, now, 9s, 0.01));
+}
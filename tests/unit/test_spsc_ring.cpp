@@ -0,0 +1,72 @@
+/**
+ * @file tests/unit/test_spsc_ring.cpp
+ * @brief Test src/spsc_ring.*.
+ */
+#include "../tests_common.h"
+
+#include <src/spsc_ring.h>
+
+#include <thread>
+
+TEST(SpscRingTests, PushAndPopInOrder) {
+  util::spsc_ring_t<int, 4> ring;
+  EXPECT_TRUE(ring.empty());
+
+  for (int x = 0; x < 4; ++x) {
+    auto slot = ring.back();
+    ASSERT_NE(slot, nullptr);
+    *slot = x;
+    ring.push();
+  }
+
+  // Full until the consumer hands a slot back
+  EXPECT_EQ(ring.back(), nullptr);
+  EXPECT_EQ(ring.size(), 4);
+  EXPECT_EQ(ring[3], 3);
+
+  EXPECT_EQ(ring.front(), 0);
+  ring.pop();
+  ASSERT_NE(ring.back(), nullptr);
+  *ring.back() = 4;
+  ring.push();
+
+  for (int x = 1; x <= 4; ++x) {
+    EXPECT_EQ(ring.front(), x);
+    ring.pop();
+  }
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(SpscRingTests, HandsOverBetweenThreads) {
+  constexpr int count = 100000;
+  util::spsc_ring_t<int, 64> ring;
+
+  std::thread producer {[&]() {
+    for (int x = 0; x < count; ++x) {
+      int *slot;
+      while (!(slot = ring.back())) {
+        std::this_thread::yield();
+      }
+      *slot = x;
+      ring.push();
+    }
+    ring.close();
+  }};
+
+  int expected = 0;
+  while (true) {
+    ring.wait();
+    if (ring.empty()) {
+      if (ring.closed() && ring.empty()) {
+        break;
+      }
+      continue;
+    }
+
+    EXPECT_EQ(ring.front(), expected++);
+    ring.pop();
+  }
+
+  producer.join();
+  EXPECT_EQ(expected, count);
+}
@@ -0,0 +1,130 @@
+/**
+ * @file tests/unit/test_stat_trackers.cpp
+ * @brief Test src/stat_trackers.*.
+ */
+#include "../tests_common.h"
+
+#include <src/stat_trackers.h>
+
+#include <random>
+#include <thread>
+
+using namespace std::literals;
+
+namespace {
+  using histogram_t = stat_trackers::log_linear_histogram;
+}  // namespace
+
+TEST(LogLinearHistogramTests, BucketsCoverEveryValueInOrder) {
+  for (std::uint64_t value = 0; value < histogram_t::sub_buckets; ++value) {
+    EXPECT_EQ(histogram_t::bucket_of(value), value);
+    EXPECT_EQ(histogram_t::value_of(value), value);
+  }
+
+  std::size_t last = 0;
+  for (std::uint64_t value = 1; value < (std::uint64_t {1} << 20); ++value) {
+    auto bucket = histogram_t::bucket_of(value);
+    EXPECT_TRUE(bucket == last || bucket == last + 1) << value;
+    last = bucket;
+  }
+
+  EXPECT_EQ(histogram_t::bucket_of(std::numeric_limits<std::uint64_t>::max()), histogram_t::bucket_count - 1);
+}
+
+TEST(LogLinearHistogramTests, BucketValuesStayWithinThreePercent) {
+  for (std::uint64_t value = 1; value < (std::uint64_t {1} << 36); value = value * 3 / 2 + 1) {
+    auto estimate = (double) histogram_t::value_of(histogram_t::bucket_of(value));
+    EXPECT_NEAR(estimate, (double) value, value * 0.031) << value;
+  }
+}
+
+TEST(LogLinearHistogramTests, PercentilesOfUniformValues) {
+  histogram_t histogram;
+  for (std::uint64_t value = 1; value <= 10000; ++value) {
+    histogram.record(value);
+  }
+
+  auto snapshot = histogram.snapshot_and_reset();
+  EXPECT_EQ(snapshot.count, 10000u);
+  EXPECT_EQ(snapshot.min, 1u);
+  EXPECT_EQ(snapshot.max, 10000u);
+  EXPECT_DOUBLE_EQ(snapshot.total, 10000.0 * 10001 / 2);
+
+  EXPECT_NEAR((double) snapshot.percentile(50), 5000, 5000 * 0.031);
+  EXPECT_NEAR((double) snapshot.percentile(90), 9000, 9000 * 0.031);
+  EXPECT_NEAR((double) snapshot.percentile(99), 9900, 9900 * 0.031);
+  EXPECT_NEAR((double) snapshot.percentile(99.9), 9990, 9990 * 0.031);
+  EXPECT_EQ(snapshot.percentile(100), 10000u);
+
+  // The snapshot took every value
+  auto empty = histogram.snapshot_and_reset();
+  EXPECT_EQ(empty.count, 0u);
+  EXPECT_EQ(empty.min, 0u);
+  EXPECT_EQ(empty.max, 0u);
+  EXPECT_EQ(empty.percentile(99), 0u);
+}
+
+TEST(LogLinearHistogramTests, TailIsntHiddenByTheAverage) {
+  histogram_t histogram;
+  for (int x = 0; x < 990; ++x) {
+    histogram.record(1000);
+  }
+  for (int x = 0; x < 10; ++x) {
+    histogram.record(100000);
+  }
+
+  auto snapshot = histogram.snapshot_and_reset();
+  EXPECT_NEAR((double) snapshot.percentile(50), 1000, 1000 * 0.031);
+  EXPECT_NEAR((double) snapshot.percentile(99.9), 100000, 100000 * 0.031);
+}
+
+TEST(LogLinearHistogramTests, ConcurrentRecordsAreAllCounted) {
+  histogram_t histogram;
+
+  std::vector<std::thread> threads;
+  for (int x = 0; x < 4; ++x) {
+    threads.emplace_back([&histogram, x]() {
+      std::mt19937_64 rng {(std::uint64_t) x};
+      std::uniform_int_distribution<std::uint64_t> dist {0, 1000000};
+      for (int y = 0; y < 10000; ++y) {
+        histogram.record(dist(rng));
+      }
+    });
+  }
+
+  std::uint64_t count = 0;
+  for (int x = 0; x < 10; ++x) {
+    count += histogram.snapshot_and_reset().count;
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  count += histogram.snapshot_and_reset().count;
+
+  EXPECT_EQ(count, 40000u);
+}
+
+TEST(PercentileTrackerTests, CallsBackWithTheStatsOfEachInterval) {
+  stat_trackers::percentile_tracker<double> tracker;
+
+  std::vector<stat_trackers::percentile_tracker<double>::stats_t> intervals;
+  auto callback = [&](const auto &stats) {
+    intervals.emplace_back(stats);
+  };
+
+  // Every call past the first ends the interval, before its own stat is recorded
+  tracker.collect_and_callback_on_interval(1.5, callback, 0s);
+  std::this_thread::sleep_for(1ms);
+  tracker.collect_and_callback_on_interval(3.25, callback, 0s);
+  std::this_thread::sleep_for(1ms);
+  tracker.collect_and_callback_on_interval(5.0, callback, 0s);
+
+  ASSERT_EQ(intervals.size(), 2u);
+  EXPECT_DOUBLE_EQ(intervals[0].min, 1.5);
+  EXPECT_DOUBLE_EQ(intervals[0].max, 1.5);
+  EXPECT_DOUBLE_EQ(intervals[0].avg, 1.5);
+  EXPECT_DOUBLE_EQ(intervals[0].p50, 1.5);
+  EXPECT_DOUBLE_EQ(intervals[1].min, 3.25);
+  EXPECT_DOUBLE_EQ(intervals[1].p999, 3.25);
+}
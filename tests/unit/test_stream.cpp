@@ -8,8 +8,14 @@
 #include <string>
 #include <vector>
 
+#include <src/platform/common.h>
+
 namespace stream {
   std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::vector<std::string_view> &segments);
+  void replace(std::vector<std::string_view> &segments, const std::string_view &old, const std::string_view &_new);
+  std::size_t parameter_sets_size(const std::string_view &frame, int video_format);
+  void coalesce_feedback(std::vector<platf::gamepad_feedback_msg_t> &pending, const platf::gamepad_feedback_msg_t &msg);
 }
 
 #include "../tests_common.h"
@@ -37,3 +43,84 @@ TEST(ConcatAndInsertTests, ConcatSmallStrideTest) {
   auto expected = std::vector<uint8_t> {0, 'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e'};
   ASSERT_EQ(res, expected);
 }
+
+TEST(ConcatAndInsertTests, ConcatSegmentsTest) {
+  std::vector<std::string_view> segments {"ab", "", "c", "defg"};
+  auto res = stream::concat_and_insert(1, 3, segments);
+  auto expected = std::vector<uint8_t> {0, 'a', 'b', 'c', 0, 'd', 'e', 'f', 0, 'g'};
+  ASSERT_EQ(res, expected);
+}
+
+TEST(ReplaceTests, ReplaceSplitsSegment) {
+  std::string frame = "headSPSbody";
+  std::vector<std::string_view> segments {frame};
+  stream::replace(segments, "SPS", "NEWSPS");
+
+  auto expected = std::vector<std::string_view> {"head", "NEWSPS", "body"};
+  ASSERT_EQ(segments, expected);
+
+  // Data referenced by the segments is never copied
+  EXPECT_EQ(segments[0].data(), frame.data());
+  EXPECT_EQ(segments[2].data(), frame.data() + 7);
+}
+
+TEST(ReplaceTests, ReplaceFirstOccurrenceOnly) {
+  std::vector<std::string_view> segments {"aXbX"};
+  stream::replace(segments, "X", "YY");
+  stream::replace(segments, "Q", "Z");
+
+  auto res = stream::concat_and_insert(0, 1, segments);
+  auto expected = std::vector<uint8_t> {'a', 'Y', 'Y', 'b', 'X'};
+  ASSERT_EQ(res, expected);
+}
+
+TEST(ParameterSetsTests, StopsAtFirstH264Slice) {
+  using namespace std::literals;
+
+  // AUD, SPS and PPS, then an IDR slice and a non-IDR slice
+  auto frame = "\0\0\0\1\x09\xF0\0\0\1\x67SPS\0\0\1\x68PPS\0\0\1\x65IDR\0\0\1\x41P"sv;
+  EXPECT_EQ(stream::parameter_sets_size(frame, 0), frame.find("\0\0\1\x65"sv));
+
+  // Without slices, everything may hold parameter sets
+  auto headers = "\0\0\1\x67SPS\0\0\1\x68PPS"sv;
+  EXPECT_EQ(stream::parameter_sets_size(headers, 0), headers.size());
+  EXPECT_EQ(stream::parameter_sets_size(""sv, 0), 0);
+}
+
+TEST(ParameterSetsTests, StopsAtFirstHevcSlice) {
+  using namespace std::literals;
+
+  // VPS, SPS, PPS and prefix SEI, then an IDR_W_RADL slice
+  auto frame = "\0\0\1\x40\x01VPS\0\0\1\x42\x01SPS\0\0\1\x44\x01PPS\0\0\1\x4E\x01SEI\0\0\1\x26\x01IDR"sv;
+  EXPECT_EQ(stream::parameter_sets_size(frame, 1), frame.find("\0\0\1\x26"sv));
+
+  // AV1 has no start codes, so all of it is searched
+  EXPECT_EQ(stream::parameter_sets_size(frame, 2), frame.size());
+}
+
+TEST(CoalesceFeedbackTests, KeepsNewestStatePerGamepad) {
+  std::vector<platf::gamepad_feedback_msg_t> pending;
+  stream::coalesce_feedback(pending, platf::gamepad_feedback_msg_t::make_rumble(0, 1, 1));
+  stream::coalesce_feedback(pending, platf::gamepad_feedback_msg_t::make_rgb_led(0, 1, 2, 3));
+  stream::coalesce_feedback(pending, platf::gamepad_feedback_msg_t::make_rumble(1, 4, 4));
+  stream::coalesce_feedback(pending, platf::gamepad_feedback_msg_t::make_rumble(0, 2, 3));
+
+  ASSERT_EQ(pending.size(), 3);
+  EXPECT_EQ(pending[0].type, platf::gamepad_feedback_e::rumble);
+  EXPECT_EQ(pending[0].id, 0);
+  EXPECT_EQ(pending[0].data.rumble.lowfreq, 2);
+  EXPECT_EQ(pending[0].data.rumble.highfreq, 3);
+  EXPECT_EQ(pending[1].type, platf::gamepad_feedback_e::set_rgb_led);
+  EXPECT_EQ(pending[2].id, 1);
+}
+
+TEST(CoalesceFeedbackTests, KeepsMotionStatePerSensor) {
+  std::vector<platf::gamepad_feedback_msg_t> pending;
+  stream::coalesce_feedback(pending, platf::gamepad_feedback_msg_t::make_motion_event_state(0, LI_MOTION_TYPE_ACCEL, 100));
+  stream::coalesce_feedback(pending, platf::gamepad_feedback_msg_t::make_motion_event_state(0, LI_MOTION_TYPE_GYRO, 100));
+  stream::coalesce_feedback(pending, platf::gamepad_feedback_msg_t::make_motion_event_state(0, LI_MOTION_TYPE_ACCEL, 0));
+
+  ASSERT_EQ(pending.size(), 2);
+  EXPECT_EQ(pending[0].data.motion_event_state.report_rate, 0);
+  EXPECT_EQ(pending[1].data.motion_event_state.motion_type, LI_MOTION_TYPE_GYRO);
+}
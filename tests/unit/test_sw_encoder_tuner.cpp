@@ -0,0 +1,92 @@
+/**
+ * @file tests/unit/test_sw_encoder_tuner.cpp
+ * @brief Test src/sw_encoder_tuner.*.
+ */
+#include "../tests_common.h"
+
+#include <src/sw_encoder_tuner.h>
+
+using sw_tuner::threading_e;
+
+namespace {
+  // 8 cores with 2 SMT siblings each
+  constexpr sw_tuner::host_t desktop {16, 8};
+
+  // 2 vCPUs without SMT, like a small cloud VM
+  constexpr sw_tuner::host_t small_vm {2, 2};
+
+  const int superfast = sw_tuner::preset_index("superfast");
+}  // namespace
+
+TEST(SwEncoderTunerTests, FindsPresets) {
+  EXPECT_EQ(sw_tuner::preset_index("ultrafast"), 0);
+  EXPECT_EQ(sw_tuner::preset_index("medium"), 5);
+  EXPECT_EQ(sw_tuner::preset_index("placebo"), -1);
+}
+
+TEST(SwEncoderTunerTests, CountsPhysicalCores) {
+  std::vector<platf::cpu_info_t> cpus;
+  for (int x = 0; x < 8; ++x) {
+    cpus.push_back({x, 0, 0, 0, x % 4});
+  }
+  auto host = sw_tuner::host_from_topology(cpus, 8);
+  EXPECT_EQ(host.logical_cpus, 8);
+  EXPECT_EQ(host.physical_cores, 4);
+
+  // Without known cores, every CPU is one
+  cpus.resize(2);
+  cpus[0].core = cpus[1].core = -1;
+  EXPECT_EQ(sw_tuner::host_from_topology(cpus, 8).physical_cores, 2);
+
+  host = sw_tuner::host_from_topology({}, 6);
+  EXPECT_EQ(host.logical_cpus, 6);
+  EXPECT_EQ(host.physical_cores, 6);
+}
+
+TEST(SwEncoderTunerTests, UsesSliceThreadsOnBigHosts) {
+  auto plan = sw_tuner::choose_plan(desktop, 1920, 1080, 60, superfast, 1, 2, 0);
+  EXPECT_EQ(plan, (sw_tuner::plan_t {threading_e::slice, 9, 9, superfast}));
+
+  // The client asked for more slices
+  plan = sw_tuner::choose_plan(desktop, 1920, 1080, 60, superfast, 12, 2, 0);
+  EXPECT_EQ(plan.slices, 12);
+  EXPECT_EQ(plan.threads, 12);
+
+  // Short frames take fewer slices
+  plan = sw_tuner::choose_plan(desktop, 1280, 720, 60, superfast, 1, 2, 0);
+  EXPECT_EQ(plan.slices, 6);
+}
+
+TEST(SwEncoderTunerTests, PicksFasterPresetOnSmallHosts) {
+  // 1080p60 takes more than 2 cores at superfast
+  auto plan = sw_tuner::choose_plan(small_vm, 1920, 1080, 60, superfast, 1, 2, 0);
+  EXPECT_EQ(plan, (sw_tuner::plan_t {threading_e::slice, 2, 2, 0}));
+
+  // 720p30 fits at medium on the desktop, and stays there
+  auto medium = sw_tuner::preset_index("medium");
+  plan = sw_tuner::choose_plan(desktop, 1280, 720, 30, medium, 1, 2, 0);
+  EXPECT_EQ(plan.threading, threading_e::slice);
+  EXPECT_EQ(plan.preset, medium);
+
+  // 4K60 doesn't, and steps to a faster one
+  plan = sw_tuner::choose_plan(desktop, 3840, 2160, 60, medium, 1, 2, 0);
+  EXPECT_EQ(plan.threading, threading_e::slice);
+  EXPECT_LT(plan.preset, medium);
+}
+
+TEST(SwEncoderTunerTests, StepsDownByLevel) {
+  auto plan = sw_tuner::choose_plan(desktop, 1920, 1080, 60, superfast, 1, 2, 1);
+  EXPECT_EQ(plan.preset, 0);
+  EXPECT_EQ(plan.threading, threading_e::slice);
+
+  // Out of faster presets
+  EXPECT_EQ(sw_tuner::max_level(superfast), 2);
+  plan = sw_tuner::choose_plan(desktop, 1920, 1080, 60, superfast, 1, 2, 2);
+  EXPECT_EQ(plan, (sw_tuner::plan_t {threading_e::frame, 2, 1, 0}));
+
+  // Another preset only gets frame threads
+  EXPECT_EQ(sw_tuner::max_level(-1), 1);
+  plan = sw_tuner::choose_plan(desktop, 1920, 1080, 60, -1, 1, 2, 1);
+  EXPECT_EQ(plan.threading, threading_e::frame);
+  EXPECT_EQ(plan.preset, -1);
+}
@@ -0,0 +1,111 @@
+/**
+ * @file tests/unit/test_thread_affinity.cpp
+ * @brief Test src/thread_affinity.*.
+ */
+#include "../tests_common.h"
+
+#include <src/thread_affinity.h>
+
+using affinity_e = config::stream_t::thread_affinity_e;
+
+namespace {
+  /**
+   * @brief 8 P-cores sharing an L3 cache and 8 E-cores in 2 clusters with their own, like a hybrid Intel CPU.
+   */
+  std::vector<platf::cpu_info_t> hybrid_cpu() {
+    std::vector<platf::cpu_info_t> cpus;
+    for (int x = 0; x < 16; ++x) {
+      cpus.push_back({x, x < 8 ? 0 : 8 + (x - 8) / 4 * 4, 0, x < 8 ? 1 : 0});
+    }
+    return cpus;
+  }
+
+  /**
+   * @brief 2 CCDs of 8 cores with their own L3 cache on 2 NUMA nodes, the second one with 2 more cores.
+   */
+  std::vector<platf::cpu_info_t> dual_ccd_cpu() {
+    std::vector<platf::cpu_info_t> cpus;
+    for (int x = 0; x < 18; ++x) {
+      cpus.push_back({x, x < 8 ? 0 : 8, x < 8 ? 0 : 1, 0});
+    }
+    return cpus;
+  }
+}  // namespace
+
+TEST(ThreadAffinityTests, PrefersPerformanceCores) {
+  auto placement = thread_affinity::choose_placement(hybrid_cpu(), affinity_e::performance_cores, -1);
+  ASSERT_TRUE(placement);
+  EXPECT_EQ(placement->cpus, (std::vector<int> {0, 1, 2, 3, 4, 5, 6, 7}));
+  EXPECT_TRUE(placement->performance_cores);
+  EXPECT_EQ(placement->l3_domain, 0);
+  EXPECT_EQ(placement->numa_node, 0);
+}
+
+TEST(ThreadAffinityTests, PicksBiggestCache) {
+  auto placement = thread_affinity::choose_placement(dual_ccd_cpu(), affinity_e::shared_cache, -1);
+  ASSERT_TRUE(placement);
+  EXPECT_EQ(placement->cpus.size(), 10);
+  EXPECT_EQ(placement->cpus.front(), 8);
+  EXPECT_FALSE(placement->performance_cores);
+  EXPECT_EQ(placement->l3_domain, 8);
+}
+
+TEST(ThreadAffinityTests, StaysNearGpu) {
+  auto placement = thread_affinity::choose_placement(dual_ccd_cpu(), affinity_e::shared_cache, 0);
+  ASSERT_TRUE(placement);
+  EXPECT_EQ(placement->cpus, (std::vector<int> {0, 1, 2, 3, 4, 5, 6, 7}));
+  EXPECT_EQ(placement->numa_node, 0);
+
+  // Without a cache to share, all cores of the node qualify
+  placement = thread_affinity::choose_placement(dual_ccd_cpu(), affinity_e::performance_cores, 1);
+  ASSERT_TRUE(placement);
+  EXPECT_EQ(placement->cpus.size(), 10);
+  EXPECT_EQ(placement->numa_node, 1);
+}
+
+TEST(ThreadAffinityTests, LeavesUniformHostsAlone) {
+  std::vector<platf::cpu_info_t> cpus;
+  for (int x = 0; x < 8; ++x) {
+    cpus.push_back({x, 0, 0, 0});
+  }
+
+  EXPECT_FALSE(thread_affinity::choose_placement(cpus, affinity_e::shared_cache, 0));
+  EXPECT_FALSE(thread_affinity::choose_placement(hybrid_cpu(), affinity_e::disabled, -1));
+  EXPECT_FALSE(thread_affinity::choose_placement({}, affinity_e::shared_cache, -1));
+}
+
+TEST(ThreadAffinityTests, ParsesCpuLists) {
+  EXPECT_EQ(thread_affinity::parse_cpu_list("0-3,8,10-11\n"), (std::vector<int> {0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(thread_affinity::parse_cpu_list("5"), (std::vector<int> {5}));
+  EXPECT_TRUE(thread_affinity::parse_cpu_list("").empty());
+  EXPECT_TRUE(thread_affinity::parse_cpu_list("3-1").empty());
+  EXPECT_TRUE(thread_affinity::parse_cpu_list("a,b").empty());
+}
+
+TEST(ThreadAffinityTests, FormatsCpuLists) {
+  EXPECT_EQ(thread_affinity::format_cpu_list({11, 0, 1, 2, 3, 8, 10}), "0-3,8,10-11");
+  EXPECT_EQ(thread_affinity::format_cpu_list({4}), "4");
+  EXPECT_EQ(thread_affinity::format_cpu_list({}), "");
+}
+
+TEST(ThreadAffinityTests, ReservesFastestCores) {
+  // The last P-cores
+  EXPECT_EQ(thread_affinity::choose_reserved_cpus(hybrid_cpu(), 2, -1), (std::vector<int> {6, 7}));
+
+  // Those of the node of the GPU
+  EXPECT_EQ(thread_affinity::choose_reserved_cpus(dual_ccd_cpu(), 1, 0), (std::vector<int> {7}));
+  EXPECT_EQ(thread_affinity::choose_reserved_cpus(dual_ccd_cpu(), 1, -1), (std::vector<int> {17}));
+}
+
+TEST(ThreadAffinityTests, ReservesWholeCores) {
+  std::vector<platf::cpu_info_t> cpus;
+  for (int x = 0; x < 8; ++x) {
+    cpus.push_back({x, 0, 0, 0, x % 4});
+  }
+
+  EXPECT_EQ(thread_affinity::choose_reserved_cpus(cpus, 1, -1), (std::vector<int> {3, 7}));
+
+  // The apps keep at least a core
+  EXPECT_TRUE(thread_affinity::choose_reserved_cpus(cpus, 4, -1).empty());
+  EXPECT_TRUE(thread_affinity::choose_reserved_cpus(cpus, 0, -1).empty());
+}
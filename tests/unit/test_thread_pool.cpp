@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/test_thread_pool.cpp
+ * @brief Test src/thread_pool.*.
+ */
+#include "../tests_common.h"
+
+#include <src/thread_pool.h>
+
+#include <latch>
+
+using thread_pool_util::priority_e;
+using thread_pool_util::ThreadPool;
+
+TEST(ThreadPoolTests, RunsEveryTask) {
+  ThreadPool pool {4};
+
+  std::vector<std::future<int>> futures;
+  for (int x = 0; x < 1000; ++x) {
+    futures.emplace_back(pool.push(x % 2 ? priority_e::high : priority_e::normal, [x]() {
+      return x * 2;
+    }));
+  }
+
+  for (int x = 0; x < 1000; ++x) {
+    EXPECT_EQ(futures[x].get(), x * 2);
+  }
+}
+
+TEST(ThreadPoolTests, HighPriorityDoesntWaitBehindBlockingTasks) {
+  ThreadPool pool {2, 1};
+
+  // Every worker allowed to run normal priority tasks is blocked
+  std::latch release {1};
+  std::latch started {1};
+  auto blocking = pool.push([&]() {
+    started.count_down();
+    release.wait();
+  });
+  started.wait();
+  auto queued = pool.push([]() {});
+
+  auto high = pool.push(priority_e::high, []() {
+    return true;
+  });
+  ASSERT_EQ(high.wait_for(5s), std::future_status::ready);
+  EXPECT_TRUE(high.get());
+
+  // The reserved worker leaves normal priority tasks alone
+  EXPECT_EQ(queued.wait_for(50ms), std::future_status::timeout);
+
+  release.count_down();
+  blocking.get();
+  EXPECT_EQ(queued.wait_for(5s), std::future_status::ready);
+}
+
+TEST(ThreadPoolTests, DelayedTasksRunWithTheirPriority) {
+  ThreadPool pool {2, 1};
+
+  std::latch release {1};
+  std::latch started {1};
+  auto blocking = pool.push([&]() {
+    started.count_down();
+    release.wait();
+  });
+  started.wait();
+
+  auto high = pool.pushDelayed(priority_e::high, []() {}, 10ms);
+  auto normal = pool.pushDelayed([]() {}, 10ms);
+  EXPECT_EQ(high.future.wait_for(5s), std::future_status::ready);
+  EXPECT_EQ(normal.future.wait_for(50ms), std::future_status::timeout);
+
+  release.count_down();
+  blocking.get();
+  EXPECT_EQ(normal.future.wait_for(5s), std::future_status::ready);
+}
+
+TEST(ThreadPoolTests, CancelledTasksDontRun) {
+  ThreadPool pool {1};
+
+  std::atomic_bool ran {false};
+  auto task = pool.pushDelayed(priority_e::high, [&]() {
+    ran = true;
+  },
+                               50ms);
+  EXPECT_TRUE(pool.cancel(task.task_id));
+
+  std::this_thread::sleep_for(100ms);
+  EXPECT_FALSE(ran);
+}
+
+TEST(ThreadPoolTests, TasksPushedBeforeStartRun) {
+  ThreadPool pool;
+
+  auto future = pool.push([]() {
+    return 42;
+  });
+  pool.start(2, 1);
+
+  EXPECT_EQ(future.get(), 42);
+}
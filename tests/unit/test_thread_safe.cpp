@@ -0,0 +1,314 @@
+/**
+ * @file tests/unit/test_thread_safe.cpp
+ * @brief Test src/thread_safe.*.
+ */
+#include "../tests_common.h"
+
+#include <src/thread_safe.h>
+
+#include <memory>
+#include <thread>
+
+using namespace std::literals;
+
+namespace {
+  std::vector<int> pop_all(safe::queue_t<int> &queue) {
+    std::vector<int> values;
+    while (queue.peek()) {
+      values.emplace_back(*queue.pop());
+    }
+    return values;
+  }
+}  // namespace
+
+TEST(QueueTests, PopsInOrderAcrossWrapAround) {
+  safe::queue_t<int> queue {3};
+
+  for (int x = 0; x < 10; ++x) {
+    queue.raise(x);
+    EXPECT_EQ(*queue.pop(), x);
+  }
+
+  EXPECT_EQ(queue.size(), 0);
+  EXPECT_EQ(queue.dropped(), 0);
+}
+
+TEST(QueueTests, DropsOldestByDefault) {
+  safe::queue_t<int> queue {3};
+  std::atomic_uint64_t counter {0};
+  queue.count_drops_in(&counter);
+
+  for (int x = 0; x < 5; ++x) {
+    queue.raise(x);
+  }
+
+  EXPECT_EQ(pop_all(queue), (std::vector<int> {2, 3, 4}));
+  EXPECT_EQ(queue.dropped(), 2);
+  EXPECT_EQ(counter, 2);
+}
+
+TEST(QueueTests, DropsNewest) {
+  safe::queue_t<int> queue {3};
+  queue.overflow(safe::overflow_e::drop_newest);
+
+  for (int x = 0; x < 5; ++x) {
+    queue.raise(x);
+  }
+
+  EXPECT_EQ(pop_all(queue), (std::vector<int> {0, 1, 2}));
+  EXPECT_EQ(queue.dropped(), 2);
+}
+
+TEST(QueueTests, DropsToNextKeyframe) {
+  safe::queue_t<int> queue {4};
+  queue.overflow(safe::overflow_e::drop_to_keyframe, [](const int &value) {
+    return value % 10 == 0;
+  });
+
+  for (auto value : {0, 1, 10, 11}) {
+    queue.raise(value);
+  }
+
+  // The oldest group of pictures goes, the keyframe after it stays
+  queue.raise(12);
+  EXPECT_EQ(pop_all(queue), (std::vector<int> {10, 11, 12}));
+  EXPECT_EQ(queue.dropped(), 2);
+
+  // Without a keyframe queued, nothing queued can be used anymore
+  for (auto value : {13, 14, 15, 16}) {
+    queue.raise(value);
+  }
+  queue.raise(20);
+  EXPECT_EQ(pop_all(queue), (std::vector<int> {20}));
+  EXPECT_EQ(queue.dropped(), 6);
+}
+
+TEST(QueueTests, BlocksUntilPopped) {
+  safe::queue_t<int> queue {1};
+  queue.overflow(safe::overflow_e::block);
+  queue.raise(0);
+
+  std::thread producer {[&]() {
+    queue.raise(1);
+  }};
+
+  std::this_thread::sleep_for(20ms);
+  EXPECT_EQ(queue.size(), 1);
+  EXPECT_EQ(*queue.pop(), 0);
+
+  producer.join();
+  EXPECT_EQ(*queue.pop(), 1);
+  EXPECT_EQ(queue.dropped(), 0);
+}
+
+TEST(QueueTests, StopWakesBlockedRaise) {
+  safe::queue_t<int> queue {1};
+  queue.overflow(safe::overflow_e::block);
+  queue.raise(0);
+
+  std::thread producer {[&]() {
+    queue.raise(1);
+  }};
+
+  std::this_thread::sleep_for(20ms);
+  queue.stop();
+  producer.join();
+
+  EXPECT_EQ(queue.drain(), (std::vector<int> {0}));
+}
+
+TEST(LockfreeQueueTests, PopsInOrderAcrossWrapAround) {
+  safe::spsc_queue_t<int> queue {3};
+
+  for (int x = 0; x < 10; ++x) {
+    queue.raise(x);
+    EXPECT_EQ(*queue.pop(), x);
+  }
+
+  EXPECT_EQ(queue.size(), 0);
+  EXPECT_FALSE(queue.peek());
+}
+
+TEST(LockfreeQueueTests, DropsNewestWhenFull) {
+  safe::mpsc_queue_t<int> queue {4};
+  std::atomic_uint64_t counter {0};
+  queue.count_drops_in(&counter);
+
+  for (int x = 0; x < 6; ++x) {
+    queue.raise(x);
+  }
+
+  EXPECT_EQ(queue.drain(), (std::vector<int> {0, 1, 2, 3}));
+  EXPECT_EQ(queue.dropped(), 2);
+  EXPECT_EQ(counter, 2);
+}
+
+TEST(LockfreeQueueTests, DropsUntilNextKeyframe) {
+  safe::mpsc_queue_t<int> queue {2};
+  queue.overflow(safe::overflow_e::drop_to_keyframe, [](const int &value) {
+    return value % 10 == 0;
+  });
+
+  for (auto value : {0, 1, 2}) {
+    queue.raise(value);
+  }
+  EXPECT_EQ(*queue.pop(), 0);
+
+  // There is room again, but 3 depends on the 2 that was dropped
+  queue.raise(3);
+  queue.raise(10);
+  EXPECT_EQ(queue.drain(), (std::vector<int> {1, 10}));
+  EXPECT_EQ(queue.dropped(), 2);
+}
+
+TEST(LockfreeQueueTests, DropsDroppableValuesAlone) {
+  safe::mpsc_queue_t<int> queue {2};
+  queue.overflow(safe::overflow_e::drop_to_keyframe, [](const int &value) {
+    return value % 10 == 0;
+  }, [](const int &value) {
+    return value % 2 == 1;
+  });
+
+  for (auto value : {0, 2, 3}) {
+    queue.raise(value);
+  }
+  EXPECT_EQ(*queue.pop(), 0);
+
+  // Nothing depends on the 3 that was dropped
+  queue.raise(4);
+  EXPECT_EQ(queue.drain(), (std::vector<int> {2, 4}));
+  EXPECT_EQ(queue.dropped(), 1);
+}
+
+namespace {
+  // The values of stream n are n * 100 onwards, the keyframes of every stream are multiples of 10
+  std::atomic_bool cutting_streams[2];
+  std::vector<int> cuts;
+
+  std::atomic_bool &cutting_stream(const int &value) {
+    return cutting_streams[value / 100];
+  }
+
+  void cut_stream(const int &value) {
+    cuts.emplace_back(value);
+  }
+}  // namespace
+
+TEST(LockfreeQueueTests, CutsEachStreamOnItsOwn) {
+  safe::mpsc_queue_t<int> queue {2};
+  queue.overflow(safe::overflow_e::drop_to_keyframe, [](const int &value) {
+    return value % 10 == 0;
+  }, nullptr, cutting_stream, cut_stream);
+  cuts.clear();
+
+  for (auto value : {0, 100, 1, 2}) {
+    queue.raise(value);
+  }
+  EXPECT_EQ(*queue.pop(), 0);
+  EXPECT_EQ(*queue.pop(), 100);
+
+  // The cut of the first stream starts once and asks for a keyframe, the second stream goes on,
+  // and a keyframe of the second stream doesn't end the cut of the first
+  queue.raise(3);
+  queue.raise(110);
+  queue.raise(101);
+  EXPECT_EQ(queue.drain(), (std::vector<int> {110, 101}));
+  EXPECT_EQ(cuts, (std::vector<int> {1}));
+
+  queue.raise(10);
+  queue.raise(11);
+  EXPECT_EQ(queue.drain(), (std::vector<int> {10, 11}));
+  EXPECT_EQ(queue.dropped(), 3);
+}
+
+TEST(LockfreeQueueTests, StopWakesBlockedPop) {
+  safe::mpsc_queue_t<std::unique_ptr<int>> queue;
+
+  std::thread consumer {[&]() {
+    EXPECT_EQ(queue.pop(), nullptr);
+  }};
+
+  std::this_thread::sleep_for(20ms);
+  queue.stop();
+  consumer.join();
+}
+
+TEST(LockfreeQueueTests, ManyProducers) {
+  constexpr int producers = 4;
+  constexpr int values = 10000;
+
+  safe::mpsc_queue_t<int> queue {1024};
+
+  std::vector<std::thread> threads;
+  for (int x = 0; x < producers; ++x) {
+    threads.emplace_back([&queue, x]() {
+      for (int y = 0; y < values; ++y) {
+        queue.raise(x * values + y);
+      }
+    });
+  }
+
+  // Every value is either received or dropped, and the values of each producer arrive in order
+  std::vector<int> next(producers);
+  std::uint64_t received = 0;
+  while (received + queue.dropped() < producers * values) {
+    if (!queue.peek()) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    auto value = *queue.pop();
+    EXPECT_GE(value % values, next[value / values]);
+    next[value / values] = value % values + 1;
+    ++received;
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_FALSE(queue.peek());
+}
+
+namespace {
+  /**
+   * @brief Pass values from one thread to another as fast as possible.
+   * @return The time per value.
+   */
+  template<class Queue>
+  std::chrono::nanoseconds pass_values(int values) {
+    Queue queue {1024};
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer {[&]() {
+      for (int x = 0; x < values; ++x) {
+        queue.raise(x);
+      }
+    }};
+
+    std::uint64_t received = 0;
+    while (received + queue.dropped() < values) {
+      if (queue.peek()) {
+        queue.pop();
+        ++received;
+      }
+    }
+    producer.join();
+
+    return (std::chrono::steady_clock::now() - start) / values;
+  }
+}  // namespace
+
+TEST(LockfreeQueueTests, ThroughputAgainstMutexQueue) {
+  // Microbenchmark of handing values from one thread to another
+  constexpr auto values = 200000;
+
+  auto mutex_ns = pass_values<safe::queue_t<int>>(values);
+  auto spsc_ns = pass_values<safe::spsc_queue_t<int>>(values);
+  auto mpsc_ns = pass_values<safe::mpsc_queue_t<int>>(values);
+
+  BOOST_LOG(info) << "Per value: "sv << mutex_ns.count() << " ns safe::queue_t, "sv
+                  << spsc_ns.count() << " ns safe::spsc_queue_t, "sv
+                  << mpsc_ns.count() << " ns safe::mpsc_queue_t"sv;
+
+  EXPECT_GT(mutex_ns.count() + spsc_ns.count() + mpsc_ns.count(), 0);
+}
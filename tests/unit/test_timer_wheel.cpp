@@ -0,0 +1,123 @@
+/**
+ * @file tests/unit/test_timer_wheel.cpp
+ * @brief Test src/timer_wheel.*.
+ */
+#include "../tests_common.h"
+
+#include <src/timer_wheel.h>
+
+#include <random>
+
+using namespace std::literals;
+
+namespace {
+  using wheel_t = task_pool_util::timer_wheel_t<int, int>;
+
+  /**
+   * @brief Pop every timer that expired by now.
+   */
+  std::vector<int> pop_all(wheel_t &wheel, wheel_t::time_point now) {
+    std::vector<int> values;
+    while (auto timer = wheel.pop(now)) {
+      EXPECT_LE(timer->first, now);
+      values.push_back(timer->second);
+    }
+
+    return values;
+  }
+}  // namespace
+
+TEST(TimerWheelTests, ExpiresInOrderAndNeverEarly) {
+  auto start = wheel_t::clock::now();
+  wheel_t wheel {start};
+
+  wheel.insert(1, start + 5ms, 1);
+  wheel.insert(2, start + 100ms, 2);
+  wheel.insert(3, start + 90s, 3);
+
+  EXPECT_TRUE(pop_all(wheel, start + 4ms).empty());
+  EXPECT_EQ(pop_all(wheel, start + 5ms), std::vector<int> {1});
+  EXPECT_TRUE(pop_all(wheel, start + 99ms + 999us).empty());
+  EXPECT_EQ(pop_all(wheel, start + 100ms), std::vector<int> {2});
+  EXPECT_TRUE(pop_all(wheel, start + 89s).empty());
+  EXPECT_EQ(pop_all(wheel, start + 90s), std::vector<int> {3});
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTests, RescheduleAndErase) {
+  auto start = wheel_t::clock::now();
+  wheel_t wheel {start};
+
+  wheel.insert(1, start + 10ms, 1);
+  wheel.insert(2, start + 20ms, 2);
+
+  EXPECT_TRUE(wheel.reschedule(1, start + 30ms));
+  auto erased = wheel.erase(2);
+  ASSERT_TRUE(erased);
+  EXPECT_EQ(erased->second, 2);
+
+  EXPECT_FALSE(wheel.erase(2));
+  EXPECT_FALSE(wheel.reschedule(2, start));
+
+  EXPECT_TRUE(pop_all(wheel, start + 25ms).empty());
+  EXPECT_EQ(pop_all(wheel, start + 30ms), std::vector<int> {1});
+}
+
+TEST(TimerWheelTests, NextWakesUpInTime) {
+  auto start = wheel_t::clock::now();
+  wheel_t wheel {start};
+  EXPECT_FALSE(wheel.next());
+
+  wheel.insert(1, start + 10s, 1);
+
+  // Waking up at next() until the timer expires never oversleeps
+  auto now = start;
+  std::vector<int> values;
+  while (values.empty()) {
+    auto next = wheel.next();
+    ASSERT_TRUE(next);
+    ASSERT_LE(*next, start + 10s);
+    ASSERT_GT(*next, now);
+
+    now = *next;
+    values = pop_all(wheel, now);
+  }
+
+  EXPECT_EQ(now, start + 10s);
+}
+
+TEST(TimerWheelTests, ManyRepeatingTimers) {
+  auto start = wheel_t::clock::now();
+  wheel_t wheel {start};
+
+  // Every timer is rearmed with its own period once it expires, like key repeat for many sessions
+  constexpr int count = 1000;
+  std::mt19937 rng {42};
+  std::vector<std::chrono::milliseconds> periods;
+  std::vector<wheel_t::time_point> deadlines;
+  for (int x = 0; x < count; ++x) {
+    periods.emplace_back(std::uniform_int_distribution {1, 500}(rng));
+    deadlines.push_back(start + periods.back());
+    wheel.insert(x, deadlines.back(), x);
+  }
+
+  std::vector<int> fired(count);
+  for (auto now = start; now <= start + 10s; now += 1ms) {
+    while (auto timer = wheel.pop(now)) {
+      auto x = timer->second;
+
+      // Not late by more than the tick either
+      EXPECT_EQ(timer->first, deadlines[x]);
+      EXPECT_LE(now - deadlines[x], 1ms);
+
+      ++fired[x];
+      deadlines[x] += periods[x];
+      wheel.insert(x, deadlines[x], x);
+    }
+  }
+
+  EXPECT_EQ(wheel.size(), count);
+  for (int x = 0; x < count; ++x) {
+    EXPECT_EQ(fired[x], 10s / periods[x]);
+  }
+}
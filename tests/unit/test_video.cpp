@@ -4,7 +4,9 @@
  */
 #include "../tests_common.h"
 
+#include <src/metrics.h>
 #include <src/video.h>
+#include <thread>
 
 struct EncoderTest: PlatformTestSuite, testing::WithParamInterface<video::encoder_t *> {
   void SetUp() override {
@@ -48,3 +50,212 @@ INSTANTIATE_TEST_SUITE_P(
 TEST_P(EncoderTest, ValidateEncoder) {
   // todo:: test something besides fixture setup
 }
+
+TEST(PartialPacketTests, TakesSlicesAsTheyAreDone) {
+  using namespace std::literals;
+
+  std::string frame = "sps|slice1|slice2|slice3";
+  std::span<const uint8_t> data {(const uint8_t *) frame.data(), frame.size()};
+
+  video::packet_raw_partial::slices_t slices;
+  EXPECT_FALSE(slices.take(1, 0ms));
+
+  slices.update(data.first(4), 0);
+  slices.update(data.first(11), 1);
+  auto taken = slices.take(1, 0ms);
+  ASSERT_TRUE(taken);
+  EXPECT_EQ(taken->data, (std::vector<std::string_view> {"sps|", "slice1|"}));
+  EXPECT_EQ(taken->slices, 1);
+  EXPECT_FALSE(taken->complete);
+
+  // Nothing new until the next slice is done
+  EXPECT_FALSE(slices.take(2, 0ms));
+
+  std::thread encoder {[&]() {
+    std::this_thread::sleep_for(10ms);
+    slices.complete(data);
+  }};
+  taken = slices.take(3, 1s);
+  encoder.join();
+
+  ASSERT_TRUE(taken);
+  EXPECT_EQ(taken->data, (std::vector<std::string_view> {"slice2|slice3"}));
+  EXPECT_TRUE(taken->complete);
+
+  auto &whole = slices.frame();
+  EXPECT_EQ(std::string(std::begin(whole), std::end(whole)), frame);
+}
+
+TEST(PartialPacketTests, AbortEndsTheFrame) {
+  using namespace std::literals;
+
+  std::string frame = "sps|slice1|";
+  video::packet_raw_partial::slices_t slices;
+  slices.update({(const uint8_t *) frame.data(), frame.size()}, 1);
+  slices.abort();
+
+  EXPECT_FALSE(slices.take(1, 0ms));
+  EXPECT_TRUE(slices.frame().empty());
+}
+
+TEST(PacketLayoutTests, LeavesRoomForHeaders) {
+  // 2 bytes of headroom and 3 bytes of headers in front of blocks of 4 bytes
+  video::packet_layout_t layout {2, 3, 4};
+
+  std::string frame = "abcdefghij";
+  EXPECT_EQ(layout.size(frame.size()), 3 * 3 + 2 + frame.size());
+
+  std::vector<uint8_t> buffer(layout.size(frame.size()), '.');
+  layout.copy({(const uint8_t *) frame.data(), frame.size()}, buffer.data());
+  EXPECT_EQ(std::string(std::begin(buffer), std::end(buffer)), ".....ab...cdef...ghij");
+
+  std::string gathered(frame.size(), '\0');
+  layout.gather(buffer.data(), frame.size(), (uint8_t *) gathered.data());
+  EXPECT_EQ(gathered, frame);
+}
+
+TEST(PacketLayoutTests, KeepsFrameInOnePiece) {
+  video::packet_layout_t layout {2, 3, 0};
+
+  std::string frame = "abcdefghij";
+  ASSERT_EQ(layout.size(frame.size()), 5 + frame.size());
+
+  std::vector<uint8_t> buffer(layout.size(frame.size()), '.');
+  layout.copy({(const uint8_t *) frame.data(), frame.size()}, buffer.data());
+  EXPECT_EQ(std::string(std::begin(buffer), std::end(buffer)), ".....abcdefghij");
+}
+
+TEST(Av1TilesTests, GrowWithThePixelRate) {
+  auto tiles = [](int width, int height, int framerate, int slices = 1) {
+    video::config_t config {};
+    config.width = width;
+    config.height = height;
+    config.framerate = framerate;
+    config.slicesPerFrame = slices;
+    return video::av1_tiles(config);
+  };
+
+  EXPECT_EQ(tiles(1920, 1080, 60), std::make_pair(1, 1));
+  EXPECT_EQ(tiles(3840, 2160, 60), std::make_pair(2, 1));
+  EXPECT_EQ(tiles(3840, 2160, 120), std::make_pair(2, 2));
+  EXPECT_EQ(tiles(7680, 4320, 60), std::make_pair(4, 2));
+
+  // The slices the client asks for are the least, rounded up to a power of two
+  EXPECT_EQ(tiles(1920, 1080, 60, 3), std::make_pair(2, 2));
+
+  // Tiles are never wider than 4096 pixels
+  EXPECT_EQ(tiles(5120, 1440, 30), std::make_pair(2, 1));
+}
+
+TEST(NonReferenceTests, ReadsTheFirstSliceHeader) {
+  // H.264: SPS, then a P slice with nal_ref_idc 0 or 2
+  std::vector<uint8_t> h264_non_reference {0, 0, 0, 1, 0x67, 0x64, 0, 0, 1, 0x01, 0x9a};
+  std::vector<uint8_t> h264_reference {0, 0, 0, 1, 0x67, 0x64, 0, 0, 1, 0x41, 0x9a};
+  std::vector<uint8_t> h264_idr {0, 0, 1, 0x65, 0x88};
+  EXPECT_TRUE(video::is_non_reference(0, h264_non_reference));
+  EXPECT_FALSE(video::is_non_reference(0, h264_reference));
+  EXPECT_FALSE(video::is_non_reference(0, h264_idr));
+
+  // HEVC: VPS, then a TRAIL_N or TRAIL_R slice
+  std::vector<uint8_t> hevc_non_reference {0, 0, 0, 1, 0x40, 0x01, 0, 0, 1, 0x00, 0x01, 0xaf};
+  std::vector<uint8_t> hevc_reference {0, 0, 0, 1, 0x40, 0x01, 0, 0, 1, 0x02, 0x01, 0xaf};
+  EXPECT_TRUE(video::is_non_reference(1, hevc_non_reference));
+  EXPECT_FALSE(video::is_non_reference(1, hevc_reference));
+
+  // Without a slice, the frame is kept
+  std::vector<uint8_t> sps_only {0, 0, 0, 1, 0x67, 0x64};
+  EXPECT_FALSE(video::is_non_reference(0, sps_only));
+  EXPECT_FALSE(video::is_non_reference(2, h264_non_reference));
+}
+
+TEST(FrameBufferPoolTests, RecyclesBuffers) {
+  auto pool = std::make_shared<video::frame_buffer_pool_t>();
+
+  auto buffer = pool->take(100);
+  EXPECT_EQ(buffer->size(), 100);
+  auto data = buffer->data();
+  buffer.reset();
+
+  // The buffer came back, and keeps its memory while it fits
+  buffer = pool->take(50);
+  EXPECT_EQ(buffer->data(), data);
+  EXPECT_EQ(buffer->size(), 50);
+
+  auto other = pool->take(50);
+  EXPECT_NE(other->data(), data);
+
+  // Buffers outliving their pool are freed
+  pool.reset();
+  buffer.reset();
+}
+
+TEST(AvPacketPoolTests, RecyclesPacketsAndTheirData) {
+  auto pool = std::make_shared<video::av_packet_pool_t>();
+  auto allocated = metrics::encoder().packets_allocated.load();
+  auto reused = metrics::encoder().packets_reused.load();
+
+  AVCodecContext ctx {};
+  ctx.opaque = pool.get();
+
+  AVPacket *first;
+  {
+    video::packet_raw_avcodec packet {pool};
+    first = packet.av_packet;
+
+    packet.av_packet->size = 1000;
+    ASSERT_EQ(video::av_packet_pool_t::get_encode_buffer(&ctx, packet.av_packet, 0), 0);
+    ASSERT_NE(packet.av_packet->buf, nullptr);
+    EXPECT_GE(packet.av_packet->buf->size, 1000 + AV_INPUT_BUFFER_PADDING_SIZE);
+  }
+
+  // The packet comes back without its data
+  video::packet_raw_avcodec packet {pool};
+  EXPECT_EQ(packet.av_packet, first);
+  EXPECT_EQ(packet.av_packet->buf, nullptr);
+
+  EXPECT_EQ(metrics::encoder().packets_allocated, allocated + 1);
+  EXPECT_EQ(metrics::encoder().packets_reused, reused + 1);
+}
+
+TEST(EncoderRecoveryTests, ReopensAfterAnIsolatedFailure) {
+  using namespace std::literals;
+  using action_e = video::encoder_recovery_t::action_e;
+
+  video::encoder_recovery_t recovery;
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_EQ(recovery.opened(now), std::nullopt);
+
+  EXPECT_EQ(recovery.failed(false, now), action_e::reopen);
+  EXPECT_EQ(recovery.opened(now + 200ms), 200ms);
+
+  // Long enough after the last one to be unrelated
+  EXPECT_EQ(recovery.failed(false, now + 1min), action_e::reopen);
+}
+
+TEST(EncoderRecoveryTests, FallsBackOnPersistentFailures) {
+  using namespace std::literals;
+  using action_e = video::encoder_recovery_t::action_e;
+
+  auto now = std::chrono::steady_clock::now();
+
+  video::encoder_recovery_t failing_again;
+  EXPECT_EQ(failing_again.failed(false, now), action_e::reopen);
+  failing_again.opened(now + 100ms);
+  EXPECT_EQ(failing_again.failed(false, now + 2s), action_e::fall_back);
+
+  video::encoder_recovery_t failing_to_open;
+  EXPECT_EQ(failing_to_open.failed(true, now), action_e::fall_back);
+}
+
+TEST(EncoderRecoveryTests, GivesUpOnceTheOutageIsTooLong) {
+  using namespace std::literals;
+  using action_e = video::encoder_recovery_t::action_e;
+
+  video::encoder_recovery_t recovery;
+  auto now = std::chrono::steady_clock::now();
+
+  EXPECT_EQ(recovery.failed(true, now), action_e::fall_back);
+  EXPECT_EQ(recovery.failed(true, now + 4s), action_e::fall_back);
+  EXPECT_EQ(recovery.failed(true, now + video::encoder_recovery_t::max_recovery + 1s), action_e::give_up);
+}
@@ -0,0 +1,102 @@
+/**
+ * @file tests/unit/test_video_trace.cpp
+ * @brief Test src/video_trace.*.
+ */
+#include "../tests_common.h"
+
+#include <src/video_trace.h>
+
+using namespace std::literals;
+
+namespace {
+  std::filesystem::path trace_file() {
+    return std::filesystem::temp_directory_path() / "test_video_trace.svtr";
+  }
+}  // namespace
+
+TEST(VideoTraceTests, ReplaysRecordedFrames) {
+  auto file = trace_file();
+  auto start = std::chrono::steady_clock::now();
+
+  {
+    video::trace_writer_t writer {file, {1920, 1080, 60, 1, 0, 0}};
+    ASSERT_TRUE(writer);
+
+    std::vector<video::packet_raw_t::replace_t> replacements;
+    replacements.emplace_back("old sps"sv, "new sps"sv);
+
+    video::packet_raw_generic idr {{1, 2, 3}, 1, true};
+    idr.replacements = &replacements;
+    idr.frame_timestamp = start - 5ms;
+    writer.record(idr, start);
+
+    video::packet_raw_generic frame {{4, 5}, 2, false};
+    frame.after_ref_frame_invalidation = true;
+    writer.record(frame, start + 16ms);
+  }
+
+  video::trace_reader_t reader {file};
+  ASSERT_TRUE(reader);
+  EXPECT_EQ(reader.config().width, 1920);
+  EXPECT_EQ(reader.config().framerate, 60);
+  EXPECT_EQ(reader.config().videoFormat, 1);
+
+  auto idr = reader.next();
+  ASSERT_TRUE(idr);
+  EXPECT_EQ(idr->offset, 0ns);
+  EXPECT_EQ(idr->frame_index, 1);
+  EXPECT_TRUE(idr->idr);
+  EXPECT_EQ(idr->frame_age, 5ms);
+  ASSERT_EQ(idr->replacements.size(), 1);
+  EXPECT_EQ(idr->replacements[0].first, "old sps");
+  EXPECT_EQ(idr->replacements[0].second, "new sps");
+  EXPECT_EQ(idr->data, (std::vector<std::uint8_t> {1, 2, 3}));
+
+  auto frame = reader.next();
+  ASSERT_TRUE(frame);
+  EXPECT_EQ(frame->offset, 16ms);
+  EXPECT_FALSE(frame->idr);
+  EXPECT_TRUE(frame->after_ref_frame_invalidation);
+  EXPECT_FALSE(frame->frame_age);
+  EXPECT_TRUE(frame->replacements.empty());
+  EXPECT_EQ(frame->data, (std::vector<std::uint8_t> {4, 5}));
+
+  EXPECT_FALSE(reader.next());
+
+  reader.rewind();
+  auto again = reader.next();
+  ASSERT_TRUE(again);
+  EXPECT_EQ(again->frame_index, 1);
+
+  std::filesystem::remove(file);
+}
+
+TEST(VideoTraceTests, RejectsOtherFiles) {
+  auto file = trace_file();
+  {
+    std::ofstream out {file, std::ios::binary};
+    out << "not a trace";
+  }
+
+  video::trace_reader_t reader {file};
+  EXPECT_FALSE(reader);
+  EXPECT_FALSE(reader.next());
+
+  std::filesystem::remove(file);
+}
+
+TEST(VideoTraceTests, StopsAtTruncatedFrame) {
+  auto file = trace_file();
+  {
+    video::trace_writer_t writer {file, {1280, 720, 60, 0, 0, 0}};
+    video::packet_raw_generic frame {{1, 2, 3, 4}, 1, true};
+    writer.record(frame, std::chrono::steady_clock::now());
+  }
+  std::filesystem::resize_file(file, std::filesystem::file_size(file) - 2);
+
+  video::trace_reader_t reader {file};
+  ASSERT_TRUE(reader);
+  EXPECT_FALSE(reader.next());
+
+  std::filesystem::remove(file);
+}
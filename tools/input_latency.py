@@ -0,0 +1,105 @@
+"""
+@file tools/input_latency.py
+@brief Measure the input to send latency of the active streaming sessions.
+
+Samples the Prometheus metrics of a running host twice and reports the latency between the two samples,
+next to the capture to send latencies of video and audio it contains. Interact with the stream while this runs.
+"""
+# standard imports
+import argparse
+import base64
+import re
+import ssl
+import time
+import urllib.request
+
+METRIC_RE = re.compile(r'^apollo_(\w+)_seconds_(bucket|sum|count)\{([^}]*)\} (\S+)$')
+LABEL_RE = re.compile(r'(\w+)="((?:[^"\\]|\\.)*)"')
+
+HISTOGRAMS = ('input_to_send', 'capture_to_send', 'audio_capture_to_send')
+
+
+def fetch(args):
+    """Get the histograms of every session, keyed by session and histogram name."""
+    request = urllib.request.Request(f'https://{args.host}:{args.port}/api/metrics/prometheus')
+    credentials = base64.b64encode(f'{args.username}:{args.password}'.encode()).decode()
+    request.add_header('Authorization', f'Basic {credentials}')
+
+    # The host uses a self-signed certificate
+    context = ssl.create_default_context()
+    context.check_hostname = False
+    context.verify_mode = ssl.CERT_NONE
+
+    with urllib.request.urlopen(request, context=context) as response:
+        text = response.read().decode()
+
+    sessions = {}
+    for line in text.splitlines():
+        match = METRIC_RE.match(line)
+        if not match or match.group(1) not in HISTOGRAMS:
+            continue
+
+        name, kind, labels, value = match.groups()
+        labels = dict(LABEL_RE.findall(labels))
+        histogram = sessions.setdefault((labels['session'], labels['device']), {}).setdefault(
+            name, {'buckets': {}, 'sum': 0.0, 'count': 0})
+
+        if kind == 'bucket':
+            histogram['buckets'][float(labels['le'])] = int(value)
+        elif kind == 'sum':
+            histogram['sum'] = float(value)
+        else:
+            histogram['count'] = int(value)
+
+    return sessions
+
+
+def quantile(buckets, count, q):
+    """Get the upper limit of the bucket holding a quantile from cumulative bucket counts."""
+    target = q * count
+    for limit in sorted(buckets):
+        if buckets[limit] >= target:
+            return limit
+    return float('inf')
+
+
+def report(before, after):
+    for key, histograms in sorted(after.items()):
+        print(f'Session {key[0]} ({key[1]})')
+
+        for name in HISTOGRAMS:
+            end = histograms.get(name)
+            if not end:
+                continue
+            start = before.get(key, {}).get(name, {'buckets': {}, 'sum': 0.0, 'count': 0})
+
+            count = end['count'] - start['count']
+            if count <= 0:
+                print(f'  {name:21} no samples')
+                continue
+
+            buckets = {limit: value - start['buckets'].get(limit, 0) for limit, value in end['buckets'].items()}
+            average = (end['sum'] - start['sum']) / count * 1000
+            p50, p90, p99 = (quantile(buckets, count, q) * 1000 for q in (0.5, 0.9, 0.99))
+
+            print(f'  {name:21} {count:6} samples  avg {average:7.2f} ms  p50 <= {p50:g} ms  p90 <= {p90:g} ms  p99 <= {p99:g} ms')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure the input to send latency of the active streaming sessions.')
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=47990, help='The port of the web UI.')
+    parser.add_argument('--username', required=True)
+    parser.add_argument('--password', required=True)
+    parser.add_argument('--duration', type=float, default=30, help='How long to measure, in seconds.')
+    args = parser.parse_args()
+
+    before = fetch(args)
+    print(f'Measuring for {args.duration:g} seconds, interact with the stream now')
+    time.sleep(args.duration)
+
+    report(before, fetch(args))
+
+
+if __name__ == '__main__':
+    main()
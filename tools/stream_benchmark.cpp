@@ -0,0 +1,1138 @@
+/**
+ * @file tools/stream_benchmark.cpp
+ * @brief A headless client that streams from a host to benchmark its throughput and latency.
+ *
+ * Pairs with the host once, then runs any number of concurrent sessions against it. Each session
+ * speaks the same RTSP, ENet and UDP protocols as Moonlight, but only looks at the frame headers and
+ * the FEC shards of the video, the frames are never decoded. Packets can be dropped on purpose to see
+ * how the host and FEC hold up under packet loss.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <boost/asio.hpp>
+#include <boost/endian/arithmetic.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <curl/curl.h>
+#include <enet/enet.h>
+
+extern "C" {
+  // clang-format off
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include "src/rswrapper.h"
+  // clang-format on
+}
+
+// local includes
+#include "src/crypto.h"
+#include "src/utility.h"
+
+using namespace std::literals;
+
+namespace asio = boost::asio;
+namespace pt = boost::property_tree;
+
+using asio::ip::tcp;
+using asio::ip::udp;
+
+namespace bench {
+  // Offsets of the ports from the base port, see nvhttp.h, rtsp.h and stream.h
+  constexpr int PORT_HTTPS = -5;
+  constexpr int RTSP_SETUP_PORT = 21;
+
+  constexpr auto unique_id = "0123456789ABCDEF"sv;
+
+#pragma pack(push, 1)
+
+  // The layout of the video packets, see stream.cpp
+  struct video_short_frame_header_t {
+    std::uint8_t headerType;
+    boost::endian::little_uint16_at frame_processing_latency;
+    std::uint8_t frameType;
+    boost::endian::little_uint16_at lastPayloadLen;
+    std::uint8_t unknown[2];
+  };
+
+  struct video_packet_raw_t {
+    RTP_PACKET rtp;
+    char reserved[4];
+
+    NV_VIDEO_PACKET packet;
+  };
+
+  struct video_packet_enc_prefix_t {
+    std::uint8_t iv[12];
+    std::uint32_t frameNumber;
+    std::uint8_t tag[16];
+  };
+
+  struct control_header_v2 {
+    std::uint16_t type;
+    std::uint16_t payloadLength;
+  };
+
+#pragma pack(pop)
+
+  // Control message types, see packetTypes in stream.cpp
+  constexpr std::uint16_t CONTROL_START_A = 0x0305;
+  constexpr std::uint16_t CONTROL_START_B = 0x0307;
+  constexpr std::uint16_t CONTROL_TERMINATION = 0x0109;
+  constexpr std::uint16_t CONTROL_PERIODIC_PING = 0x0200;
+  constexpr std::uint16_t CONTROL_REQUEST_IDR_FRAME = 0x0302;
+
+  struct options_t {
+    std::string host = "127.0.0.1";
+    int port = 47989;
+    std::string app;
+    int sessions = 1;
+    std::chrono::seconds duration = 30s;
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+    int bitrate = 20000;
+    int packet_size = 1392;
+    int codec = 0;
+    bool encrypt = false;
+    double loss = 0;
+    int burst = 1;
+    std::string otp;
+    std::string passphrase;
+    std::filesystem::path state = "stream-benchmark";
+  };
+
+  void usage(const char *name) {
+    std::cout
+      << "Usage: "sv << name << " [options]"sv << std::endl
+      << std::endl
+      << "  --host <address>      The host to stream from, 127.0.0.1 by default"sv << std::endl
+      << "  --port <port>         The base port of the host, 47989 by default"sv << std::endl
+      << "  --app <name|id>       The app to launch, Desktop or the first app by default"sv << std::endl
+      << "  --sessions <n>        The number of concurrent sessions, 1 by default"sv << std::endl
+      << "  --duration <seconds>  How long to stream, 30 by default"sv << std::endl
+      << "  --mode <WxHxFPS>      The display mode of every session, 1920x1080x60 by default"sv << std::endl
+      << "  --bitrate <kbps>      The bitrate of every session, 20000 by default"sv << std::endl
+      << "  --packet-size <bytes> The video packet size, 1392 by default"sv << std::endl
+      << "  --codec <codec>       h264, hevc or av1, h264 by default"sv << std::endl
+      << "  --encrypt             Have the host encrypt the video"sv << std::endl
+      << "  --loss <percent>      Drop this share of the video packets on purpose"sv << std::endl
+      << "  --burst <packets>     Drop packets in bursts of this length, 1 by default"sv << std::endl
+      << "  --otp <pin>           Pair with a one-time PIN from the web UI instead of entering a PIN"sv << std::endl
+      << "  --passphrase <text>   The passphrase the one-time PIN was requested with"sv << std::endl
+      << "  --state <directory>   Where the client certificate is kept, ./stream-benchmark by default"sv << std::endl;
+  }
+
+  std::optional<options_t> parse_options(int argc, char **argv) {
+    options_t options;
+
+    for (int x = 1; x < argc; ++x) {
+      std::string_view arg {argv[x]};
+
+      if (arg == "--help"sv || arg == "-h"sv) {
+        return std::nullopt;
+      }
+      if (arg == "--encrypt"sv) {
+        options.encrypt = true;
+        continue;
+      }
+
+      if (x + 1 >= argc) {
+        std::cerr << "Missing value for "sv << arg << std::endl;
+        return std::nullopt;
+      }
+      std::string value {argv[++x]};
+
+      try {
+        if (arg == "--host"sv) {
+          options.host = value;
+        } else if (arg == "--port"sv) {
+          options.port = std::stoi(value);
+        } else if (arg == "--app"sv) {
+          options.app = value;
+        } else if (arg == "--sessions"sv) {
+          options.sessions = std::max(1, std::stoi(value));
+        } else if (arg == "--duration"sv) {
+          options.duration = std::chrono::seconds {std::max(1, std::stoi(value))};
+        } else if (arg == "--mode"sv) {
+          if (std::sscanf(value.c_str(), "%dx%dx%d", &options.width, &options.height, &options.fps) != 3) {
+            std::cerr << "Invalid mode: "sv << value << std::endl;
+            return std::nullopt;
+          }
+        } else if (arg == "--bitrate"sv) {
+          options.bitrate = std::stoi(value);
+        } else if (arg == "--packet-size"sv) {
+          options.packet_size = std::stoi(value);
+        } else if (arg == "--codec"sv) {
+          if (value == "h264"sv) {
+            options.codec = 0;
+          } else if (value == "hevc"sv) {
+            options.codec = 1;
+          } else if (value == "av1"sv) {
+            options.codec = 2;
+          } else {
+            std::cerr << "Unknown codec: "sv << value << std::endl;
+            return std::nullopt;
+          }
+        } else if (arg == "--loss"sv) {
+          options.loss = std::clamp(std::stod(value), 0.0, 100.0);
+        } else if (arg == "--burst"sv) {
+          options.burst = std::max(1, std::stoi(value));
+        } else if (arg == "--otp"sv) {
+          options.otp = value;
+        } else if (arg == "--passphrase"sv) {
+          options.passphrase = value;
+        } else if (arg == "--state"sv) {
+          options.state = value;
+        } else {
+          std::cerr << "Unknown option: "sv << arg << std::endl;
+          return std::nullopt;
+        }
+      } catch (std::exception &) {
+        std::cerr << "Invalid value for "sv << arg << ": "sv << value << std::endl;
+        return std::nullopt;
+      }
+    }
+
+    return options;
+  }
+
+  using curl_t = util::safe_ptr<CURL, curl_easy_cleanup>;
+
+  std::size_t append_to_string(char *data, std::size_t size, std::size_t nmemb, void *userdata) {
+    ((std::string *) userdata)->append(data, size * nmemb);
+    return size * nmemb;
+  }
+
+  /**
+   * @brief The client certificate, and the host it's paired with.
+   */
+  struct client_t {
+    std::string host;
+    std::uint16_t base_port;
+
+    crypto::creds_t creds;
+    std::filesystem::path cert_file;
+    std::filesystem::path key_file;
+
+    /**
+     * @brief Send a request to the host and parse the XML it answers with.
+     * @param https Whether to use the HTTPS port, which authenticates with the client certificate.
+     * @param path The path and query of the request, without the unique ID.
+     * @param timeout How long to wait for the answer, zero to wait forever.
+     * @return The answer, or `std::nullopt` if the request failed or the host refused it.
+     */
+    std::optional<pt::ptree> request(bool https, const std::string &path, std::chrono::seconds timeout = 60s) const {
+      auto port = https ? base_port + PORT_HTTPS : base_port;
+      auto separator = path.find('?') == std::string::npos ? '?' : '&';
+      auto url = (https ? "https://"s : "http://"s) + host + ':' + std::to_string(port) + path + separator + "uniqueid="s + std::string {unique_id};
+
+      curl_t curl {curl_easy_init()};
+      if (!curl) {
+        return std::nullopt;
+      }
+
+      std::string body;
+      curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
+      curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, append_to_string);
+      curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &body);
+      curl_easy_setopt(curl.get(), CURLOPT_TIMEOUT, (long) timeout.count());
+      if (https) {
+        // The host uses a self-signed certificate, and this is a benchmark, not a client to trust
+        curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYHOST, 0L);
+        curl_easy_setopt(curl.get(), CURLOPT_SSLCERT, cert_file.string().c_str());
+        curl_easy_setopt(curl.get(), CURLOPT_SSLKEY, key_file.string().c_str());
+      }
+
+      if (auto result = curl_easy_perform(curl.get()); result != CURLE_OK) {
+        std::cerr << "Request to "sv << path << " failed: "sv << curl_easy_strerror(result) << std::endl;
+        return std::nullopt;
+      }
+
+      pt::ptree tree;
+      try {
+        std::istringstream in {body};
+        pt::read_xml(in, tree);
+      } catch (std::exception &e) {
+        std::cerr << "Invalid answer to "sv << path << ": "sv << e.what() << std::endl;
+        return std::nullopt;
+      }
+
+      auto status = tree.get("root.<xmlattr>.status_code", 0);
+      if (status != 200) {
+        std::cerr << "Request to "sv << path << " failed with status "sv << status << ": "sv
+                  << tree.get("root.<xmlattr>.status_message", ""s) << std::endl;
+        return std::nullopt;
+      }
+
+      return tree;
+    }
+
+    /**
+     * @brief Pair the client certificate with the host, the same way Moonlight does.
+     * @param otp A one-time PIN, or an empty string to have the user enter a PIN on the host.
+     * @param passphrase The passphrase the one-time PIN was requested with.
+     */
+    bool pair(const std::string &otp, const std::string &passphrase) const {
+      auto salt = crypto::rand(16);
+      auto salt_hex = util::hex_vec(salt, true);
+
+      std::string pin = otp;
+      std::string path = "/pair?devicename=stream-benchmark&updateState=1&phrase=getservercert&salt="s + salt_hex +
+                         "&clientcert="s + util::hex_vec(creds.x509, true);
+      if (!otp.empty()) {
+        path += "&otpauth="s + util::hex(crypto::hash(otp + salt_hex + passphrase), true).to_string();
+      } else {
+        std::mt19937 gen {std::random_device {}()};
+        pin = std::to_string(std::uniform_int_distribution {1000, 9999}(gen));
+        std::cout << "Enter PIN "sv << pin << " in the web UI of the host to pair"sv << std::endl;
+      }
+
+      if (!request(false, path, 0s)) {
+        return false;
+      }
+
+      auto key = crypto::gen_aes_key(util::from_hex<std::array<std::uint8_t, 16>>(salt_hex, true), pin);
+      crypto::cipher::ecb_t cipher {key, false};
+
+      // The server checks the hashes of the secrets, so this is where a wrong PIN shows
+      std::vector<std::uint8_t> challenge;
+      cipher.encrypt(crypto::rand(16), challenge);
+      auto tree = request(false, "/pair?devicename=stream-benchmark&updateState=1&clientchallenge="s + util::hex_vec(challenge, true));
+      if (!tree) {
+        return false;
+      }
+
+      std::vector<std::uint8_t> response;
+      cipher.decrypt(util::from_hex_vec(tree->get("root.challengeresponse", ""s), true), response);
+      if (response.size() < 48) {
+        std::cerr << "Invalid challenge response, is the PIN right?"sv << std::endl;
+        return false;
+      }
+      std::string server_challenge {response.begin() + 32, response.begin() + 48};
+
+      auto x509 = crypto::x509(creds.x509);
+      auto client_secret = crypto::rand(16);
+      auto client_hash = crypto::hash(server_challenge + std::string {crypto::signature(x509)} + client_secret);
+
+      std::vector<std::uint8_t> encrypted_hash;
+      cipher.encrypt(std::string_view {(char *) client_hash.data(), client_hash.size()}, encrypted_hash);
+      if (!request(false, "/pair?devicename=stream-benchmark&updateState=1&serverchallengeresp="s + util::hex_vec(encrypted_hash, true))) {
+        return false;
+      }
+
+      auto sign = crypto::sign256(crypto::pkey(creds.pkey), client_secret);
+      auto pairing_secret = client_secret + std::string {sign.begin(), sign.end()};
+      tree = request(false, "/pair?devicename=stream-benchmark&updateState=1&clientpairingsecret="s + util::hex_vec(pairing_secret, true));
+      if (!tree || tree->get("root.paired", 0) != 1) {
+        std::cerr << "The host refused to pair, is the PIN right?"sv << std::endl;
+        return false;
+      }
+
+      return (bool) request(true, "/pair?devicename=stream-benchmark&updateState=1&phrase=pairchallenge");
+    }
+
+    /**
+     * @brief Find the ID of the app to launch.
+     * @param app The name or ID of the app, or an empty string for Desktop or the first app.
+     */
+    std::optional<std::string> find_app(const std::string &app) const {
+      auto tree = request(true, "/applist");
+      if (!tree) {
+        return std::nullopt;
+      }
+
+      std::optional<std::string> first;
+      std::optional<std::string> desktop;
+      for (auto &[name, node] : tree->get_child("root")) {
+        if (name != "App"sv) {
+          continue;
+        }
+
+        auto title = node.get("AppTitle", ""s);
+        auto id = node.get("ID", ""s);
+        if (!app.empty() && (title == app || id == app)) {
+          return id;
+        }
+
+        if (!first) {
+          first = id;
+        }
+        if (title == "Desktop"sv) {
+          desktop = id;
+        }
+      }
+
+      if (!app.empty()) {
+        std::cerr << "The host has no app "sv << app << std::endl;
+        return std::nullopt;
+      }
+
+      return desktop ? desktop : first;
+    }
+  };
+
+  /**
+   * @brief Load the client certificate from the state directory, or create it.
+   */
+  std::optional<client_t> load_client(const options_t &options) {
+    client_t client {options.host, (std::uint16_t) options.port};
+    client.cert_file = options.state / "cert.pem";
+    client.key_file = options.state / "key.pem";
+
+    std::error_code ec;
+    if (std::filesystem::exists(client.cert_file, ec) && std::filesystem::exists(client.key_file, ec)) {
+      std::ifstream cert {client.cert_file};
+      std::ifstream key {client.key_file};
+
+      client.creds.x509.assign(std::istreambuf_iterator<char> {cert}, {});
+      client.creds.pkey.assign(std::istreambuf_iterator<char> {key}, {});
+
+      return client;
+    }
+
+    std::filesystem::create_directories(options.state, ec);
+    client.creds = crypto::gen_creds("Stream Benchmark"sv, 2048);
+
+    std::ofstream cert {client.cert_file};
+    std::ofstream key {client.key_file};
+    cert << client.creds.x509;
+    key << client.creds.pkey;
+    if (!cert || !key) {
+      std::cerr << "Couldn't write the client certificate to "sv << options.state.string() << std::endl;
+      return std::nullopt;
+    }
+
+    return client;
+  }
+
+  /**
+   * @brief The endpoints and keys of a session, as negotiated over HTTPS and RTSP.
+   */
+  struct handshake_t {
+    crypto::aes_t key;
+
+    std::string ping_payload;
+    std::uint32_t connect_data = 0;
+
+    std::uint16_t video_port = 0;
+    std::uint16_t audio_port = 0;
+    std::uint16_t control_port = 0;
+  };
+
+  struct rtsp_response_t {
+    int status = 0;
+    std::map<std::string, std::string> options;
+  };
+
+  /**
+   * @brief Send an RTSP request and wait for the response, on a connection of its own like Moonlight does.
+   */
+  std::optional<rtsp_response_t> rtsp_request(const std::string &host, std::uint16_t port, const std::string &request) {
+    try {
+      asio::io_context io_context;
+      tcp::socket sock {io_context};
+      sock.connect(tcp::endpoint {asio::ip::make_address(host), port});
+      asio::write(sock, asio::buffer(request));
+
+      // The host closes the connection once it has responded
+      std::string raw;
+      boost::system::error_code ec;
+      std::array<char, 4096> buf;
+      while (!ec) {
+        auto bytes = sock.read_some(asio::buffer(buf), ec);
+        raw.append(buf.data(), bytes);
+      }
+
+      rtsp_response_t response;
+      std::istringstream in {raw};
+      std::string line;
+
+      std::getline(in, line);
+      if (std::sscanf(line.c_str(), "RTSP/1.0 %d", &response.status) != 1) {
+        std::cerr << "Invalid RTSP response: "sv << line << std::endl;
+        return std::nullopt;
+      }
+
+      while (std::getline(in, line) && line != "\r"sv && !line.empty()) {
+        auto colon = line.find(':');
+        if (colon == std::string::npos) {
+          continue;
+        }
+
+        auto value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        if (!value.empty() && value.back() == '\r') {
+          value.pop_back();
+        }
+        response.options.emplace(line.substr(0, colon), std::move(value));
+      }
+
+      return response;
+    } catch (std::exception &e) {
+      std::cerr << "RTSP request failed: "sv << e.what() << std::endl;
+      return std::nullopt;
+    }
+  }
+
+  /**
+   * @brief Launch the app and negotiate a session over RTSP.
+   */
+  std::optional<handshake_t> handshake(const client_t &client, const options_t &options, const std::string &app_id) {
+    handshake_t handshake;
+    handshake.key = crypto::aes_t(16);
+    RAND_bytes(handshake.key.data(), handshake.key.size());
+
+    std::uint32_t key_id;
+    RAND_bytes((std::uint8_t *) &key_id, sizeof(key_id));
+
+    // corever=0 keeps the RTSP handshake in plaintext
+    auto launch = client.request(true, "/launch?appid="s + app_id + "&mode="s + std::to_string(options.width) + 'x' + std::to_string(options.height) + 'x' + std::to_string(options.fps) + "&additionalStates=1&sops=0&rikey="s + util::hex_vec(handshake.key, true) + "&rikeyid="s + std::to_string(key_id) + "&localAudioPlayMode=0&surroundAudioInfo=196610&remoteControllersBitmap=0&gcmap=0&corever=0"s);
+    if (!launch) {
+      return std::nullopt;
+    }
+
+    auto rtsp_port = (std::uint16_t) (client.base_port + RTSP_SETUP_PORT);
+    auto url = "rtsp://"s + client.host + ':' + std::to_string(rtsp_port);
+    int cseq = 0;
+
+    auto send = [&](const std::string &command, const std::string &target, const std::string &payload = {}) {
+      std::ostringstream request;
+      request << command << ' ' << target << " RTSP/1.0\r\n"sv
+              << "CSeq: "sv << ++cseq << "\r\n"sv
+              << "X-GS-ClientVersion: 14\r\n"sv
+              << "Host: "sv << client.host << "\r\n"sv;
+      if (!payload.empty()) {
+        request << "Content-type: application/sdp\r\n"sv
+                << "Content-length: "sv << payload.size() << "\r\n"sv;
+      }
+      request << "\r\n"sv << payload;
+
+      auto response = rtsp_request(client.host, rtsp_port, request.str());
+      if (response && response->status != 200) {
+        std::cerr << command << " failed with status "sv << response->status << std::endl;
+        return std::optional<rtsp_response_t> {};
+      }
+      return response;
+    };
+
+    auto server_port = [](rtsp_response_t &response) -> std::uint16_t {
+      auto &transport = response.options["Transport"];
+      auto pos = transport.find("server_port="sv);
+      return pos == std::string::npos ? 0 : (std::uint16_t) std::stoi(transport.substr(pos + 12));
+    };
+
+    if (!send("OPTIONS", url) || !send("DESCRIBE", url)) {
+      return std::nullopt;
+    }
+
+    auto audio = send("SETUP", "streamid=audio/0/0");
+    auto video = audio ? send("SETUP", "streamid=video/0/0") : std::nullopt;
+    auto control = video ? send("SETUP", "streamid=control/13/0") : std::nullopt;
+    if (!control) {
+      return std::nullopt;
+    }
+
+    handshake.audio_port = server_port(*audio);
+    handshake.video_port = server_port(*video);
+    handshake.control_port = server_port(*control);
+    handshake.ping_payload = video->options["X-SS-Ping-Payload"];
+    handshake.connect_data = (std::uint32_t) std::stoul(control->options["X-SS-Connect-Data"]);
+
+    std::ostringstream sdp;
+    auto attribute = [&sdp](std::string_view name, auto value) {
+      sdp << "a="sv << name << ':' << value << " \r\n"sv;
+    };
+    sdp << "v=0\r\n"sv
+        << "o=android 0 14 IN IPv4 "sv << client.host << "\r\n"sv
+        << "s=NVIDIA Streaming Client\r\n"sv;
+    attribute("x-nv-video[0].clientViewportWd"sv, options.width);
+    attribute("x-nv-video[0].clientViewportHt"sv, options.height);
+    attribute("x-nv-video[0].maxFPS"sv, options.fps);
+    attribute("x-nv-video[0].packetSize"sv, options.packet_size);
+    attribute("x-nv-video[0].videoEncoderSlicesPerFrame"sv, 1);
+    attribute("x-nv-video[0].maxNumReferenceFrames"sv, 1);
+    attribute("x-nv-vqos[0].bw.maximumBitrateKbps"sv, options.bitrate);
+    attribute("x-ml-video.configuredBitrateKbps"sv, options.bitrate);
+    attribute("x-nv-vqos[0].bitStreamFormat"sv, options.codec);
+    attribute("x-nv-vqos[0].fec.minRequiredFecPackets"sv, 2);
+    attribute("x-nv-audio.surround.numChannels"sv, 2);
+    attribute("x-nv-audio.surround.channelMask"sv, 3);
+    attribute("x-nv-audio.surround.AudioQuality"sv, 0);
+    attribute("x-nv-aqos.packetDuration"sv, 5);
+    attribute("x-nv-general.useReliableUdp"sv, 13);
+    attribute("x-ss-general.encryptionEnabled"sv, options.encrypt ? SS_ENC_VIDEO : 0);
+
+    // Every session comes from the same address, so the host tells them apart by the ping payload
+    attribute("x-ml-general.featureFlags"sv, ML_FF_SESSION_ID_V1);
+
+    if (!send("ANNOUNCE", "streamid=control/13/0", sdp.str()) || !send("PLAY", "/")) {
+      return std::nullopt;
+    }
+
+    return handshake;
+  }
+
+  /**
+   * @brief What a session saw of the stream.
+   */
+  struct stats_t {
+    std::uint64_t packets = 0;  ///< Video packets received, including the ones dropped on purpose.
+    std::uint64_t packets_lost = 0;  ///< Video packets the network lost, going by the gaps in the sequence numbers.
+    std::uint64_t packets_dropped = 0;  ///< Video packets dropped on purpose.
+
+    std::uint64_t frames = 0;  ///< Frames with all data shards received.
+    std::uint64_t frames_recovered = 0;  ///< Frames missing data shards, that FEC recovered.
+    std::uint64_t frames_lost = 0;  ///< Frames that couldn't be recovered, including the ones nothing was received of.
+    std::uint64_t idr_requests = 0;  ///< IDR frames requested after a lost frame.
+
+    std::uint64_t goodput_bytes = 0;  ///< Bytes of frame data in the frames that were received or recovered.
+    std::vector<double> latencies;  ///< The frame processing latency the host reported for each frame, in ms.
+
+    std::chrono::steady_clock::duration elapsed {};
+    std::string error;
+  };
+
+  /**
+   * @brief One FEC block of a frame as it comes in.
+   */
+  struct fec_block_t {
+    int data_shards = 0;
+    int parity_shards = 0;
+
+    std::vector<std::vector<std::uint8_t>> shards;
+    std::vector<std::uint8_t> missing;
+    int received = 0;
+    int data_received = 0;
+  };
+
+  struct frame_t {
+    int blocks = 0;
+    std::array<fec_block_t, 4> fec_blocks;
+  };
+
+  class session_t {
+  public:
+    session_t(int id, const options_t &options, handshake_t handshake, std::string host):
+        _id {id},
+        _options {options},
+        _handshake {std::move(handshake)},
+        _host {std::move(host)},
+        _video_sock {_io_context},
+        _audio_sock {_io_context},
+        _timer {_io_context},
+        _gen {std::random_device {}()},
+        _cipher {_handshake.key, false},
+        _blocksize {(std::size_t) options.packet_size + MAX_RTP_HEADER_SIZE} {
+    }
+
+    ~session_t() {
+      for (auto &[shards, rs] : _rs) {
+        reed_solomon_release(rs);
+      }
+    }
+
+    /**
+     * @brief Stream until the duration passed or the host ends the session.
+     * @param stop Set by the main thread to end all sessions early.
+     */
+    void run(const std::atomic_bool &stop) {
+      auto start = std::chrono::steady_clock::now();
+      auto fg = util::fail_guard([&]() {
+        _stats.elapsed = std::chrono::steady_clock::now() - start;
+      });
+
+      if (!connect()) {
+        return;
+      }
+
+      _deadline = start + _options.duration;
+      _stop = &stop;
+
+      receive_video();
+      receive_audio();
+      tick();
+
+      _io_context.run();
+
+      finish_frames(std::numeric_limits<std::uint32_t>::max());
+      if (_peer) {
+        enet_peer_disconnect_now(_peer, 0);
+      }
+    }
+
+    const stats_t &stats() const {
+      return _stats;
+    }
+
+    int id() const {
+      return _id;
+    }
+
+  private:
+    bool connect() {
+      auto address = asio::ip::make_address(_host);
+      boost::system::error_code ec;
+
+      for (auto [sock, port] : {std::pair {&_video_sock, _handshake.video_port}, std::pair {&_audio_sock, _handshake.audio_port}}) {
+        sock->connect(udp::endpoint {address, port}, ec);
+        if (ec) {
+          _stats.error = "Couldn't connect the UDP sockets: "s + ec.message();
+          return false;
+        }
+      }
+      _video_sock.set_option(asio::socket_base::receive_buffer_size {8 * 1024 * 1024}, ec);
+
+      send_pings();
+
+      _enet.reset(enet_host_create(address.is_v6() ? AF_INET6 : AF_INET, nullptr, 1, 0, 0, 0));
+      if (!_enet) {
+        _stats.error = "Couldn't create the ENet host"s;
+        return false;
+      }
+
+      ENetAddress enet_address;
+      enet_address_set_host(&enet_address, _host.c_str());
+      enet_address_set_port(&enet_address, _handshake.control_port);
+
+      _peer = enet_host_connect(_enet.get(), &enet_address, 32, _handshake.connect_data);
+      ENetEvent event;
+      if (!_peer || enet_host_service(_enet.get(), &event, 5000) <= 0 || event.type != ENET_EVENT_TYPE_CONNECT) {
+        _stats.error = "Couldn't connect to the control stream"s;
+        return false;
+      }
+
+      std::uint8_t start_a[2] {};
+      std::uint8_t start_b[1] {};
+      send_control(CONTROL_START_A, {start_a, sizeof(start_a)});
+      send_control(CONTROL_START_B, {start_b, sizeof(start_b)});
+
+      return true;
+    }
+
+    void send_pings() {
+      SS_PING ping {};
+      std::copy_n(_handshake.ping_payload.data(), std::min(_handshake.ping_payload.size(), sizeof(ping.payload)), ping.payload);
+      ping.sequenceNumber = util::endian::big(++_ping_sequence);
+
+      boost::system::error_code ec;
+      _video_sock.send(asio::buffer(&ping, sizeof(ping)), 0, ec);
+      _audio_sock.send(asio::buffer(&ping, sizeof(ping)), 0, ec);
+    }
+
+    void send_control(std::uint16_t type, std::span<const std::uint8_t> payload) {
+      std::vector<std::uint8_t> message(sizeof(control_header_v2) + payload.size());
+      auto header = (control_header_v2 *) message.data();
+      header->type = util::endian::little(type);
+      header->payloadLength = util::endian::little((std::uint16_t) payload.size());
+      std::copy(payload.begin(), payload.end(), message.begin() + sizeof(control_header_v2));
+
+      auto packet = enet_packet_create(message.data(), message.size(), ENET_PACKET_FLAG_RELIABLE);
+      if (enet_peer_send(_peer, 0, packet)) {
+        enet_packet_destroy(packet);
+      }
+      enet_host_flush(_enet.get());
+    }
+
+    void tick() {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= _deadline || _stop->load(std::memory_order_relaxed) || !_stats.error.empty()) {
+        _io_context.stop();
+        return;
+      }
+
+      ENetEvent event;
+      while (_enet && enet_host_service(_enet.get(), &event, 0) > 0) {
+        if (event.type == ENET_EVENT_TYPE_DISCONNECT) {
+          _peer = nullptr;
+          _stats.error = "The host closed the control stream"s;
+        } else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+          if (event.packet->dataLength >= sizeof(control_header_v2) &&
+              util::endian::little(((control_header_v2 *) event.packet->data)->type) == CONTROL_TERMINATION) {
+            _stats.error = "The host ended the session"s;
+          }
+          enet_packet_destroy(event.packet);
+        }
+      }
+
+      if (now >= _next_control_ping && _peer) {
+        std::uint8_t payload[8] {};
+        send_control(CONTROL_PERIODIC_PING, {payload, sizeof(payload)});
+        _next_control_ping = now + 100ms;
+      }
+
+      if (now >= _next_ping) {
+        send_pings();
+        _next_ping = now + 500ms;
+      }
+
+      _timer.expires_after(10ms);
+      _timer.async_wait([this](const boost::system::error_code &ec) {
+        if (!ec) {
+          tick();
+        }
+      });
+    }
+
+    void receive_audio() {
+      _audio_sock.async_receive(asio::buffer(_audio_buf), [this](const boost::system::error_code &ec, std::size_t) {
+        if (!ec) {
+          receive_audio();
+        }
+      });
+    }
+
+    void receive_video() {
+      _video_sock.async_receive(asio::buffer(_video_buf), [this](const boost::system::error_code &ec, std::size_t bytes) {
+        if (ec) {
+          if (ec != asio::error::operation_aborted && ec != asio::error::connection_refused) {
+            _stats.error = "Couldn't receive video: "s + ec.message();
+          }
+          if (ec == asio::error::connection_refused) {
+            receive_video();
+          }
+          return;
+        }
+
+        handle_video(std::span {_video_buf.data(), bytes});
+        receive_video();
+      });
+    }
+
+    /**
+     * @brief Decide whether the impairment drops the next packet.
+     */
+    bool impaired() {
+      if (_burst_left > 0) {
+        --_burst_left;
+        return true;
+      }
+
+      // Bursts start less often so the share of packets dropped stays the same
+      if (_options.loss > 0 && std::uniform_real_distribution {0.0, 100.0}(_gen) < _options.loss / _options.burst) {
+        _burst_left = _options.burst - 1;
+        return true;
+      }
+
+      return false;
+    }
+
+    void handle_video(std::span<std::uint8_t> data) {
+      std::span<std::uint8_t> shard = data;
+      if (_options.encrypt) {
+        if (data.size() < sizeof(video_packet_enc_prefix_t)) {
+          return;
+        }
+
+        auto prefix = (video_packet_enc_prefix_t *) data.data();
+        crypto::aes_t iv {std::begin(prefix->iv), std::end(prefix->iv)};
+
+        std::string tagged_cipher {(char *) prefix->tag, sizeof(prefix->tag)};
+        tagged_cipher.append((char *) data.data() + sizeof(*prefix), data.size() - sizeof(*prefix));
+        if (_cipher.decrypt(tagged_cipher, _plaintext, &iv)) {
+          return;
+        }
+        shard = _plaintext;
+      }
+
+      if (shard.size() < sizeof(video_packet_raw_t)) {
+        return;
+      }
+      auto header = (video_packet_raw_t *) shard.data();
+
+      ++_stats.packets;
+
+      // Gaps in the sequence numbers are the packets the network lost
+      std::uint16_t sequence = util::endian::big(header->rtp.sequenceNumber);
+      if (_next_sequence) {
+        auto gap = (std::uint16_t) (sequence - *_next_sequence);
+        if (gap < 0x8000) {
+          _stats.packets_lost += gap;
+        }
+      }
+      if (!_next_sequence || (std::uint16_t) (sequence - *_next_sequence) < 0x8000) {
+        _next_sequence = (std::uint16_t) (sequence + 1);
+      }
+
+      if (impaired()) {
+        ++_stats.packets_dropped;
+        return;
+      }
+
+      std::uint32_t frame_index = util::endian::little(header->packet.frameIndex);
+      std::uint32_t fec_info = util::endian::little(header->packet.fecInfo);
+      auto shard_index = (int) ((fec_info >> 12) & 0x3FF);
+      auto data_shards = (int) (fec_info >> 22);
+      auto fec_percentage = (int) ((fec_info >> 4) & 0xFF);
+      auto block_index = (header->packet.multiFecBlocks >> 4) & 0x3;
+      auto last_block = (header->packet.multiFecBlocks >> 6) & 0x3;
+
+      if (_last_finished && (std::int32_t) (frame_index - *_last_finished) <= 0) {
+        // Too late, the frame was already counted
+        return;
+      }
+
+      // Frames are sent in order, so a new frame means the ones before it are as complete as they'll get
+      finish_frames(frame_index);
+
+      auto &frame = _frames[frame_index];
+      frame.blocks = last_block + 1;
+
+      auto &block = frame.fec_blocks[block_index];
+      if (block.shards.empty()) {
+        block.data_shards = data_shards;
+        block.parity_shards = (data_shards * fec_percentage + 99) / 100;
+        block.shards.resize(block.data_shards + block.parity_shards, std::vector<std::uint8_t>(_blocksize));
+        block.missing.resize(block.shards.size(), 1);
+      }
+
+      if (shard_index >= block.shards.size() || !block.missing[shard_index]) {
+        return;
+      }
+
+      std::copy_n(shard.begin(), std::min(shard.size(), _blocksize), block.shards[shard_index].begin());
+      block.missing[shard_index] = 0;
+      ++block.received;
+      if (shard_index < block.data_shards) {
+        ++block.data_received;
+      }
+    }
+
+    /**
+     * @brief Count the frames before a frame index, recovering their blocks with FEC if needed.
+     */
+    void finish_frames(std::uint32_t before) {
+      while (!_frames.empty() && (std::int32_t) (_frames.begin()->first - before) < 0) {
+        auto node = _frames.extract(_frames.begin());
+        auto frame_index = node.key();
+        auto &frame = node.mapped();
+
+        // Frames nothing was received of
+        if (_last_finished) {
+          _stats.frames_lost += frame_index - *_last_finished - 1;
+        }
+        _last_finished = frame_index;
+
+        bool recovered = false;
+        bool lost = false;
+        std::uint64_t bytes = 0;
+        for (int x = 0; x < frame.blocks; ++x) {
+          auto &block = frame.fec_blocks[x];
+          if (block.shards.empty() || block.received < block.data_shards) {
+            lost = true;
+            break;
+          }
+
+          if (block.data_received < block.data_shards) {
+            auto rs = get_rs(block.data_shards, block.parity_shards);
+
+            std::vector<std::uint8_t *> shards_p;
+            for (auto &shard : block.shards) {
+              shards_p.emplace_back(shard.data());
+            }
+            if (!rs || reed_solomon_decode(rs, shards_p.data(), block.missing.data(), shards_p.size(), _blocksize)) {
+              lost = true;
+              break;
+            }
+            recovered = true;
+          }
+
+          bytes += block.data_shards * (_blocksize - sizeof(video_packet_raw_t));
+        }
+
+        if (lost) {
+          ++_stats.frames_lost;
+
+          // Like Moonlight, ask for an IDR frame rather than wait for the stream to heal
+          if (_peer) {
+            send_control(CONTROL_REQUEST_IDR_FRAME, {});
+            ++_stats.idr_requests;
+          }
+          continue;
+        }
+
+        (recovered ? _stats.frames_recovered : _stats.frames) += 1;
+        _stats.goodput_bytes += bytes;
+
+        // The frame header is right after the packet header of the first shard
+        auto &first = frame.fec_blocks[0].shards[0];
+        auto frame_header = (video_short_frame_header_t *) (first.data() + sizeof(video_packet_raw_t));
+        if (frame_header->headerType == 0x01 && frame_header->frame_processing_latency != 0) {
+          _stats.latencies.emplace_back(frame_header->frame_processing_latency / 10.0);
+        }
+      }
+    }
+
+    reed_solomon *get_rs(int data_shards, int parity_shards) {
+      auto &rs = _rs[{data_shards, parity_shards}];
+      if (!rs) {
+        rs = reed_solomon_new(data_shards, parity_shards);
+      }
+      return rs;
+    }
+
+    int _id;
+    const options_t &_options;
+    handshake_t _handshake;
+    std::string _host;
+
+    asio::io_context _io_context;
+    udp::socket _video_sock;
+    udp::socket _audio_sock;
+    asio::steady_timer _timer;
+
+    util::safe_ptr<ENetHost, enet_host_destroy> _enet;
+    ENetPeer *_peer = nullptr;
+
+    std::array<std::uint8_t, 65536> _video_buf;
+    std::array<std::uint8_t, 4096> _audio_buf;
+
+    std::chrono::steady_clock::time_point _deadline;
+    std::chrono::steady_clock::time_point _next_ping;
+    std::chrono::steady_clock::time_point _next_control_ping;
+    const std::atomic_bool *_stop = nullptr;
+    std::uint32_t _ping_sequence = 0;
+
+    std::mt19937 _gen;
+    int _burst_left = 0;
+
+    crypto::cipher::gcm_t _cipher;
+    std::vector<std::uint8_t> _plaintext;
+
+    std::size_t _blocksize;
+    std::optional<std::uint16_t> _next_sequence;
+    std::optional<std::uint32_t> _last_finished;
+    std::map<std::uint32_t, frame_t> _frames;
+    std::map<std::pair<int, int>, reed_solomon *> _rs;
+
+    stats_t _stats;
+  };
+
+  double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+      return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (std::size_t) (p * values.size()))];
+  }
+
+  void report(const std::string &name, const stats_t &stats) {
+    auto seconds = std::max(std::chrono::duration<double> {stats.elapsed}.count(), 0.001);
+    auto delivered = stats.frames + stats.frames_recovered;
+    auto damaged = stats.frames_recovered + stats.frames_lost;
+    auto expected_packets = stats.packets + stats.packets_lost;
+
+    double latency = 0;
+    for (auto value : stats.latencies) {
+      latency += value;
+    }
+    if (!stats.latencies.empty()) {
+      latency /= stats.latencies.size();
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+              << name << ": "sv << delivered / seconds << " fps, goodput "sv << stats.goodput_bytes * 8 / seconds / 1e6 << " Mbps"sv << std::endl
+              << "  frame latency avg "sv << latency << " ms, p50 "sv << percentile(stats.latencies, 0.5) << " ms, p99 "sv << percentile(stats.latencies, 0.99) << " ms"sv << std::endl
+              << "  frames "sv << delivered << " delivered, "sv << stats.frames_recovered << " recovered by FEC, "sv << stats.frames_lost << " lost ("sv
+              << (damaged ? 100.0 * stats.frames_recovered / damaged : 100.0) << "% recovery rate, "sv << stats.idr_requests << " IDR requests)"sv << std::endl
+              << "  packets "sv << stats.packets << " received, "sv << (expected_packets ? 100.0 * stats.packets_lost / expected_packets : 0.0) << "% lost by the network, "sv
+              << (stats.packets ? 100.0 * stats.packets_dropped / stats.packets : 0.0) << "% dropped on purpose"sv << std::endl;
+
+    if (!stats.error.empty()) {
+      std::cout << "  ended early: "sv << stats.error << std::endl;
+    }
+  }
+}  // namespace bench
+
+int main(int argc, char **argv) {
+  auto options = bench::parse_options(argc, argv);
+  if (!options) {
+    bench::usage(argv[0]);
+    return 1;
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  enet_initialize();
+  reed_solomon_init();
+
+  auto client = bench::load_client(*options);
+  if (!client) {
+    return 1;
+  }
+
+  // Pair on the first run, the host remembers the certificate
+  if (!client->request(true, "/serverinfo")) {
+    if (!client->pair(options->otp, options->passphrase)) {
+      return 1;
+    }
+  }
+
+  auto app_id = client->find_app(options->app);
+  if (!app_id) {
+    return 1;
+  }
+
+  std::atomic_bool stop {false};
+  std::vector<std::unique_ptr<bench::session_t>> sessions;
+  std::vector<std::thread> threads;
+
+  // The host negotiates one session at a time, each starts streaming before the next is set up
+  for (int x = 0; x < options->sessions; ++x) {
+    auto handshake = bench::handshake(*client, *options, *app_id);
+    if (!handshake) {
+      std::cerr << "Couldn't start session "sv << x + 1 << std::endl;
+      break;
+    }
+
+    auto session = sessions.emplace_back(std::make_unique<bench::session_t>(x + 1, *options, std::move(*handshake), options->host)).get();
+    threads.emplace_back([session, &stop]() {
+      session->run(stop);
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  bench::stats_t total;
+  for (auto &session : sessions) {
+    auto &stats = session->stats();
+    bench::report("Session "s + std::to_string(session->id()), stats);
+
+    total.packets += stats.packets;
+    total.packets_lost += stats.packets_lost;
+    total.packets_dropped += stats.packets_dropped;
+    total.frames += stats.frames;
+    total.frames_recovered += stats.frames_recovered;
+    total.frames_lost += stats.frames_lost;
+    total.idr_requests += stats.idr_requests;
+    total.goodput_bytes += stats.goodput_bytes;
+    total.latencies.insert(total.latencies.end(), stats.latencies.begin(), stats.latencies.end());
+    total.elapsed = std::max(total.elapsed, stats.elapsed);
+  }
+
+  if (sessions.size() > 1) {
+    bench::report("All "s + std::to_string(sessions.size()) + " sessions"s, total);
+  }
+
+  enet_deinitialize();
+  curl_global_cleanup();
+
+  return sessions.size() == (std::size_t) options->sessions ? 0 : 1;
+}
@@ -6,6 +6,7 @@ import { ViteEjsPlugin } from "vite-plugin-ejs";
 import { codecovVitePlugin } from "@codecov/vite-plugin";
 import vue from '@vitejs/plugin-vue'
 import process from 'process'
+import zlib from 'zlib'
 
 /**
  * Before actually building the pages with Vite, we do an intermediate build step using ejs
@@ -42,6 +43,35 @@ else {
 
 let header = fs.readFileSync(resolve(assetsSrcPath, "template_header.html"))
 
+/**
+ * Write brotli and gzip variants next to the files of the build,
+ * which the web server sends to the browsers accepting them instead
+ */
+function precompress() {
+    return {
+        name: 'precompress',
+        apply: 'build',
+        writeBundle(options, bundle) {
+            for (const fileName of Object.keys(bundle)) {
+                if (!/\.(html|js|css|svg|json)$/.test(fileName)) {
+                    continue;
+                }
+
+                const file = resolve(options.dir, fileName);
+                const content = fs.readFileSync(file);
+                if (content.length < 1024) {
+                    continue;
+                }
+
+                fs.writeFileSync(file + '.br', zlib.brotliCompressSync(content, {
+                    params: { [zlib.constants.BROTLI_PARAM_QUALITY]: zlib.constants.BROTLI_MAX_QUALITY }
+                }));
+                fs.writeFileSync(file + '.gz', zlib.gzipSync(content, { level: zlib.constants.Z_BEST_COMPRESSION }));
+            }
+        },
+    }
+}
+
 // https://vitejs.dev/config/
 export default defineConfig({
     resolve: {
@@ -53,6 +83,7 @@ export default defineConfig({
     plugins: [
         vue(),
         ViteEjsPlugin({ header }),
+        precompress(),
         // The Codecov vite plugin should be after all other plugins
         codecovVitePlugin({
             enableBundleAnalysis: process.env.CODECOV_TOKEN !== undefined,